@@ -0,0 +1,21 @@
+AC_DEFUN([DOVECOT_WANT_ZSTD], [
+  AS_IF([test "$want_zstd" != "no"], [
+    AC_CHECK_HEADER(zstd.h, [
+      dnl ZSTD_compressStream2() is part of the stable API since zstd 1.4.0
+      AC_CHECK_LIB(zstd, ZSTD_compressStream2, [
+        have_zstd=yes
+        have_compress_lib=yes
+        AC_DEFINE(HAVE_ZSTD,, [Define if you have zstd library])
+        COMPRESS_LIBS="$COMPRESS_LIBS -lzstd"
+      ], [
+        AS_IF([test "$want_zstd" = "yes"], [
+          AC_ERROR([Can't build with zstd support: libzstd (v1.4.0+) not found])
+        ])
+      ])
+    ], [
+      AS_IF([test "$want_zstd" = "yes"], [
+        AC_ERROR([Can't build with zstd support: zstd.h not found])
+      ])
+    ])
+  ])
+])
@@ -0,0 +1,25 @@
+dnl Check if functions can be compiled for x86 SIMD instruction sets that
+dnl are not enabled by default, and selected at runtime with
+dnl __builtin_cpu_supports().
+AC_DEFUN([DOVECOT_X86_SIMD],[
+  AC_CACHE_CHECK([for x86 SIMD function targets],i_cv_have_x86_simd_targets,[
+    AC_TRY_LINK([
+      #include <tmmintrin.h>
+      __attribute__((target("ssse3")))
+      static int test_ssse3(int x)
+      {
+        __m128i v = _mm_set1_epi8(x);
+        return _mm_movemask_epi8(_mm_shuffle_epi8(v, v));
+      }
+    ], [
+      return __builtin_cpu_supports("ssse3") ? test_ssse3(1) : 0;
+    ], [
+      i_cv_have_x86_simd_targets=yes
+    ], [
+      i_cv_have_x86_simd_targets=no
+    ])
+  ])
+  if test $i_cv_have_x86_simd_targets = yes; then
+    AC_DEFINE(HAVE_X86_SIMD_TARGETS,, [Define if x86 SIMD code can be selected at runtime])
+  fi
+])
@@ -13,7 +13,9 @@
 
 #include <unistd.h>
 
-#define MAX_INBUF_SIZE 1024
+/* Large enough to read a full batch of commands written to the FIFO at once
+   (see master_service_anvil_send_batched()) */
+#define MAX_INBUF_SIZE 4096
 
 #define ANVIL_CLIENT_PROTOCOL_MAJOR_VERSION 1
 #define ANVIL_CLIENT_PROTOCOL_MINOR_VERSION 0
@@ -172,15 +174,20 @@ static void anvil_connection_input(struct anvil_connection *conn)
 		conn->version_received = TRUE;
 	}
 
+	/* send the replies to all the pipelined requests at once */
+	if (conn->output != NULL)
+		o_stream_cork(conn->output);
 	while ((args = anvil_connection_next_line(conn)) != NULL) {
 		if (args[0] != NULL) {
 			if (anvil_connection_request(conn, args, &error) < 0) {
 				i_error("Anvil client input error: %s", error);
 				anvil_connection_destroy(conn);
-				break;
+				return;
 			}
 		}
 	}
+	if (conn->output != NULL)
+		o_stream_uncork(conn->output);
 }
 
 struct anvil_connection *
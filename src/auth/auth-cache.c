@@ -5,11 +5,19 @@
 #include "hash.h"
 #include "str.h"
 #include "strescape.h"
+#include "strnum.h"
+#include "istream.h"
+#include "ostream.h"
 #include "var-expand.h"
 #include "auth-request.h"
 #include "auth-cache.h"
 
+#include <stdio.h>
 #include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define AUTH_CACHE_FILE_HEADER "AUTH-CACHE\t1"
 
 struct auth_cache {
 	HASH_TABLE(char *, struct auth_cache_node *) hash;
@@ -231,7 +239,7 @@ struct auth_cache *auth_cache_new(size_t max_size, unsigned int ttl_secs,
 	struct auth_cache *cache;
 
 	cache = i_new(struct auth_cache, 1);
-	hash_table_create(&cache->hash, default_pool, 0, str_hash, strcmp);
+	hash_table_create_open(&cache->hash, 0, str_hash, strcmp);
 	cache->max_size = max_size;
 	cache->size_left = max_size;
 	cache->ttl_secs = ttl_secs;
@@ -409,31 +417,15 @@ auth_cache_lookup(struct auth_cache *cache, const struct auth_request *request,
 	return value;
 }
 
-void auth_cache_insert(struct auth_cache *cache, struct auth_request *request,
-		       const char *key, const char *value, bool last_success)
+static size_t
+auth_cache_insert_node(struct auth_cache *cache, const char *key,
+		       const char *value, time_t created, bool last_success)
 {
         struct auth_cache_node *node;
 	size_t data_size, alloc_size, key_len, value_len = strlen(value);
-	char *hash_key, *current_username;
-
-	if (*value == '\0' && cache->neg_ttl_secs == 0) {
-		/* we're not caching negative entries */
-		return;
-	}
-
-	/* store into cache using the translated username, except if we're doing
-	   a master user login */
-	current_username = request->user;
-	if (request->translated_username != NULL &&
-	    request->requested_login_user == NULL &&
-	    request->master_user == NULL)
-		request->user = t_strdup_noconst(request->translated_username);
+	char *hash_key;
 
-	key = auth_request_expand_cache_key(request, key);
 	key_len = strlen(key);
-
-	request->user = current_username;
-
 	data_size = key_len + 1 + value_len + 1;
 	alloc_size = sizeof(struct auth_cache_node) -
 		sizeof(node->data) + data_size;
@@ -450,7 +442,7 @@ void auth_cache_insert(struct auth_cache *cache, struct auth_request *request,
 
 	/* @UNSAFE */
 	node = i_malloc(alloc_size);
-	node->created = time(NULL);
+	node->created = created;
 	node->alloc_size = alloc_size;
 	node->last_success = last_success;
 	memcpy(node->data, key, key_len);
@@ -461,7 +453,45 @@ void auth_cache_insert(struct auth_cache *cache, struct auth_request *request,
 	cache->size_left -= alloc_size;
 	hash_key = node->data;
 	hash_table_insert(cache->hash, hash_key, node);
+	return alloc_size;
+}
+
+bool auth_cache_node_expires_within(struct auth_cache *cache,
+				    const struct auth_cache_node *node,
+				    unsigned int secs)
+{
+	const char *value = node->data + strlen(node->data) + 1;
+	unsigned int ttl_secs =
+		*value == '\0' ? cache->neg_ttl_secs : cache->ttl_secs;
+
+	return node->created + (time_t)ttl_secs - (time_t)secs <= time(NULL);
+}
+
+void auth_cache_insert(struct auth_cache *cache, struct auth_request *request,
+		       const char *key, const char *value, bool last_success)
+{
+	size_t alloc_size;
+	char *current_username;
+
+	if (*value == '\0' && cache->neg_ttl_secs == 0) {
+		/* we're not caching negative entries */
+		return;
+	}
 
+	/* store into cache using the translated username, except if we're doing
+	   a master user login */
+	current_username = request->user;
+	if (request->translated_username != NULL &&
+	    request->requested_login_user == NULL &&
+	    request->master_user == NULL)
+		request->user = t_strdup_noconst(request->translated_username);
+
+	key = auth_request_expand_cache_key(request, key);
+
+	request->user = current_username;
+
+	alloc_size = auth_cache_insert_node(cache, key, value, time(NULL),
+					    last_success);
 	if (*value != '\0') {
 		cache->pos_entries++;
 		cache->pos_size += alloc_size;
@@ -483,3 +513,140 @@ void auth_cache_remove(struct auth_cache *cache,
 
 	auth_cache_node_destroy(cache, node);
 }
+
+static bool
+auth_cache_is_expired(struct auth_cache *cache, const char *value,
+		      time_t created, time_t now)
+{
+	unsigned int ttl_secs =
+		*value == '\0' ? cache->neg_ttl_secs : cache->ttl_secs;
+
+	return created < now - (time_t)ttl_secs;
+}
+
+int auth_cache_save(struct auth_cache *cache, const char *path,
+		    const char *version)
+{
+	struct auth_cache_node *node;
+	struct ostream *output;
+	const char *temp_path, *value;
+	string_t *str;
+	time_t now = time(NULL);
+	int fd, ret = 0;
+
+	temp_path = t_strconcat(path, ".tmp", NULL);
+	/* the cache contains password hashes */
+	fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1) {
+		i_error("open(%s) failed: %m", temp_path);
+		return -1;
+	}
+	output = o_stream_create_fd_file_autoclose(&fd, 0);
+	o_stream_cork(output);
+	o_stream_nsend_str(output, t_strdup_printf(
+		AUTH_CACHE_FILE_HEADER"\t%s\n", str_tabescape(version)));
+
+	/* write the oldest first, so the LRU order is preserved when they're
+	   loaded one by one to the cache's head */
+	str = t_str_new(256);
+	for (node = cache->tail; node != NULL; node = node->next) {
+		value = node->data + strlen(node->data) + 1;
+		if (auth_cache_is_expired(cache, value, node->created, now))
+			continue;
+
+		str_truncate(str, 0);
+		str_printfa(str, "%ld\t%c\t", (long)node->created,
+			    node->last_success ? '1' : '0');
+		str_append_tabescaped(str, node->data);
+		str_append_c(str, '\t');
+		str_append_tabescaped(str, value);
+		str_append_c(str, '\n');
+		o_stream_nsend(output, str_data(str), str_len(str));
+	}
+	if (o_stream_finish(output) < 0) {
+		i_error("write(%s) failed: %s", temp_path,
+			o_stream_get_error(output));
+		ret = -1;
+	}
+	o_stream_destroy(&output);
+
+	if (ret == 0 && rename(temp_path, path) < 0) {
+		i_error("rename(%s, %s) failed: %m", temp_path, path);
+		ret = -1;
+	}
+	if (ret < 0)
+		(void)i_unlink_if_exists(temp_path);
+	return ret;
+}
+
+static int
+auth_cache_load_line(struct auth_cache *cache, const char *line, time_t now)
+{
+	const char *const *args = t_strsplit_tabescaped(line);
+	time_t created;
+
+	if (str_array_length(args) != 4 || str_to_time(args[0], &created) < 0 ||
+	    (args[1][0] != '0' && args[1][0] != '1'))
+		return -1;
+
+	if (auth_cache_is_expired(cache, args[3], created, now))
+		return 0;
+	if (*args[3] == '\0' && cache->neg_ttl_secs == 0)
+		return 0;
+	if (hash_table_lookup(cache->hash, args[2]) != NULL)
+		return 0;
+
+	(void)auth_cache_insert_node(cache, args[2], args[3], created,
+				     args[1][0] == '1');
+	return 1;
+}
+
+int auth_cache_load(struct auth_cache *cache, const char *path,
+		    const char *version)
+{
+	struct istream *input;
+	const char *line, *header;
+	time_t now = time(NULL);
+	unsigned int count = 0;
+	int ret = 0;
+
+	input = i_stream_create_file(path, IO_BLOCK_SIZE);
+	header = t_strdup_printf(AUTH_CACHE_FILE_HEADER"\t%s",
+				 str_tabescape(version));
+	line = i_stream_read_next_line(input);
+	if (line == NULL) {
+		/* missing or empty file */
+	} else if (strcmp(line, header) != 0) {
+		/* written by a different version or with different
+		   passdbs/userdbs. the cache keys may not mean the same
+		   anymore. */
+		e_debug(auth_event, "%s: Ignoring cache with different "
+			"configuration", path);
+	} else {
+		while ((line = i_stream_read_next_line(input)) != NULL) {
+			T_BEGIN {
+				ret = auth_cache_load_line(cache, line, now);
+			} T_END;
+			if (ret < 0) {
+				i_error("%s: Corrupted line: %s", path, line);
+				break;
+			}
+			count += ret;
+			ret = 0;
+		}
+	}
+	if (input->stream_errno != 0 && input->stream_errno != ENOENT) {
+		i_error("read(%s) failed: %s", path,
+			i_stream_get_error(input));
+		ret = -1;
+	}
+	i_stream_unref(&input);
+
+	/* Don't load the same entries again if this process crashes.
+	   They may have been flushed in the meantime. */
+	(void)i_unlink_if_exists(path);
+
+	if (count > 0)
+		e_debug(auth_event, "%s: Loaded %u cache entries", path, count);
+	return ret;
+}
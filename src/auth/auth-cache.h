@@ -6,9 +6,11 @@ struct auth_cache_node {
 
 	time_t created;
 	/* Total number of bytes used by this node */
-	uint32_t alloc_size:31;
+	uint32_t alloc_size:30;
 	/* TRUE if the user gave the correct password the last time. */
 	bool last_success:1;
+	/* TRUE if a background refresh was already started for this node */
+	bool refreshing:1;
 
 	char data[4]; /* key \0 value \0 */
 };
@@ -41,6 +43,11 @@ const char *
 auth_cache_lookup(struct auth_cache *cache, const struct auth_request *request,
 		  const char *key, struct auth_cache_node **node_r,
 		  bool *expired_r, bool *neg_expired_r);
+/* Returns TRUE if the node's TTL expires within the given number of
+   seconds. */
+bool auth_cache_node_expires_within(struct auth_cache *cache,
+				    const struct auth_cache_node *node,
+				    unsigned int secs);
 /* Insert key => value into cache. "" value means negative cache entry. */
 void auth_cache_insert(struct auth_cache *cache, struct auth_request *request,
 		       const char *key, const char *value, bool last_success);
@@ -50,4 +57,13 @@ void auth_cache_remove(struct auth_cache *cache,
 		       const struct auth_request *request,
 		       const char *key);
 
+/* Write the unexpired cache entries to the path. Only a cache loaded with
+   the same version string can use them. */
+int auth_cache_save(struct auth_cache *cache, const char *path,
+		    const char *version);
+/* Load the cache entries written by auth_cache_save() and delete the file.
+   It's not an error if the file doesn't exist or has a different version. */
+int auth_cache_load(struct auth_cache *cache, const char *path,
+		    const char *version);
+
 #endif
@@ -1,6 +1,8 @@
 /* Copyright (c) 2016-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "llist.h"
+#include "hash.h"
 #include "net.h"
 #include "str.h"
 #include "istream.h"
@@ -21,6 +23,8 @@
 #include "iostream-ssl.h"
 
 #define AUTH_POLICY_DNS_SOCKET_PATH "dns-client"
+#define AUTH_POLICY_CACHE_MAX_ENTRIES 100000
+#define AUTH_POLICY_CACHE_CLEANUP_MSECS (60*1000)
 
 static struct http_client_settings http_client_set = {
 	.dns_client_socket_path = AUTH_POLICY_DNS_SOCKET_PATH,
@@ -31,10 +35,36 @@ static struct http_client_settings http_client_set = {
 	.user_agent = "dovecot/auth-policy-client"
 };
 
+struct policy_waiter {
+	struct auth_request *request;
+	struct event *event;
+	auth_policy_callback_t callback;
+	void *callback_context;
+};
+ARRAY_DEFINE_TYPE(policy_waiter, struct policy_waiter);
+
+struct policy_cache_entry {
+	struct policy_cache_entry *prev, *next;
+
+	char *key;
+	int result;
+	char *message;
+	time_t expire_time;
+};
+
 static char *auth_policy_json_template;
 
 static struct http_client *http_client;
 
+/* Check request JSON -> policy_cache_entry */
+static HASH_TABLE(char *, struct policy_cache_entry *) policy_cache;
+/* Oldest first */
+static struct policy_cache_entry *policy_cache_head, *policy_cache_tail;
+static unsigned int policy_cache_count;
+static struct timeout *to_policy_cache;
+/* Check request JSON -> policy_lookup_ctx waiting for a response */
+static HASH_TABLE(char *, struct policy_lookup_ctx *) policy_pending_checks;
+
 struct policy_lookup_ctx {
 	pool_t pool;
 	string_t *json;
@@ -53,6 +83,10 @@ struct policy_lookup_ctx {
 	struct io *io;
 	struct event *event;
 
+	/* Set when identical checks are waiting for this one's result */
+	char *cache_key;
+	ARRAY_TYPE(policy_waiter) waiters;
+
 	enum {
 		POLICY_RESULT = 0,
 		POLICY_RESULT_VALUE_STATUS,
@@ -60,6 +94,7 @@ struct policy_lookup_ctx {
 	} parse_state;
 
 	bool parse_error;
+	bool have_result;
 };
 
 struct policy_template_keyvalue {
@@ -229,6 +264,22 @@ void auth_policy_init(void)
 	if (global_auth_settings->policy_log_only)
 		i_warning("auth-policy: Currently in log-only mode. Ignoring "
 			  "tarpit and disconnect instructions from policy server");
+
+	hash_table_create(&policy_cache, default_pool, 0, str_hash, strcmp);
+	hash_table_create(&policy_pending_checks, default_pool, 0,
+			  str_hash, strcmp);
+}
+
+static void policy_cache_entry_free(struct policy_cache_entry *entry)
+{
+	hash_table_remove(policy_cache, entry->key);
+	DLLIST2_REMOVE(&policy_cache_head, &policy_cache_tail, entry);
+	i_assert(policy_cache_count > 0);
+	policy_cache_count--;
+
+	i_free(entry->key);
+	i_free(entry->message);
+	i_free(entry);
 }
 
 void auth_policy_deinit(void)
@@ -236,6 +287,83 @@ void auth_policy_deinit(void)
 	if (http_client != NULL)
 		http_client_deinit(&http_client);
 	i_free(auth_policy_json_template);
+
+	timeout_remove(&to_policy_cache);
+	while (policy_cache_head != NULL)
+		policy_cache_entry_free(policy_cache_head);
+	if (hash_table_is_created(policy_cache))
+		hash_table_destroy(&policy_cache);
+	if (hash_table_is_created(policy_pending_checks)) {
+		i_assert(hash_table_count(policy_pending_checks) == 0);
+		hash_table_destroy(&policy_pending_checks);
+	}
+}
+
+static bool auth_policy_cache_enabled(const struct auth_settings *set)
+{
+	return set->policy_cache_ttl > 0 || set->policy_cache_negative_ttl > 0;
+}
+
+static void policy_cache_cleanup(void *context ATTR_UNUSED)
+{
+	struct policy_cache_entry *entry, *next;
+
+	for (entry = policy_cache_head; entry != NULL; entry = next) {
+		next = entry->next;
+		if (entry->expire_time <= ioloop_time)
+			policy_cache_entry_free(entry);
+	}
+	if (policy_cache_head == NULL)
+		timeout_remove(&to_policy_cache);
+}
+
+static struct policy_cache_entry *policy_cache_lookup(const char *key)
+{
+	struct policy_cache_entry *entry;
+
+	entry = hash_table_lookup(policy_cache, key);
+	if (entry == NULL)
+		return NULL;
+	if (entry->expire_time <= ioloop_time) {
+		policy_cache_entry_free(entry);
+		return NULL;
+	}
+	return entry;
+}
+
+static void
+policy_cache_add(const struct auth_settings *set, const char *key,
+		 int result, const char *message)
+{
+	struct policy_cache_entry *entry;
+	unsigned int ttl;
+
+	/* tarpitting and refusals may have a different lifetime than the
+	   plain "continue" result */
+	ttl = result == 0 ? set->policy_cache_ttl :
+		set->policy_cache_negative_ttl;
+	if (ttl == 0)
+		return;
+
+	entry = hash_table_lookup(policy_cache, key);
+	if (entry != NULL)
+		policy_cache_entry_free(entry);
+	while (policy_cache_count >= AUTH_POLICY_CACHE_MAX_ENTRIES)
+		policy_cache_entry_free(policy_cache_head);
+
+	entry = i_new(struct policy_cache_entry, 1);
+	entry->key = i_strdup(key);
+	entry->result = result;
+	entry->message = i_strdup(message);
+	entry->expire_time = ioloop_time + ttl;
+	hash_table_insert(policy_cache, entry->key, entry);
+	DLLIST2_APPEND(&policy_cache_head, &policy_cache_tail, entry);
+	policy_cache_count++;
+
+	if (to_policy_cache == NULL) {
+		to_policy_cache = timeout_add(AUTH_POLICY_CACHE_CLEANUP_MSECS,
+					      policy_cache_cleanup, NULL);
+	}
 }
 
 static
@@ -267,9 +395,28 @@ void auth_policy_log_result(struct policy_lookup_ctx *context)
 			action);
 }
 
+static void auth_policy_pending_remove(struct policy_lookup_ctx *context)
+{
+	struct policy_waiter *waiter;
+
+	if (context->cache_key == NULL)
+		return;
+	hash_table_remove(policy_pending_checks, context->cache_key);
+	context->cache_key = NULL;
+
+	if (array_is_created(&context->waiters)) {
+		array_foreach_modifiable(&context->waiters, waiter) {
+			event_unref(&waiter->event);
+			auth_request_unref(&waiter->request);
+		}
+		array_clear(&context->waiters);
+	}
+}
+
 static
 void auth_policy_finish(struct policy_lookup_ctx *context)
 {
+	auth_policy_pending_remove(context);
 	if (context->parser != NULL) {
 		const char *error ATTR_UNUSED;
 		(void)json_parser_deinit(&context->parser, &error);
@@ -281,13 +428,67 @@ void auth_policy_finish(struct policy_lookup_ctx *context)
 	pool_unref(&context->pool);
 }
 
+static void
+auth_policy_apply_result(struct auth_request *request, struct event *event,
+			 int result, const char *message)
+{
+	request->policy_refusal = FALSE;
+
+	if (result < 0) {
+		if (message != NULL) {
+			/* set message here */
+			e_debug(event, "Policy response %d with message: %s",
+				result, message);
+			auth_request_set_field(request, "reason", message, NULL);
+		}
+		request->policy_refusal = TRUE;
+	} else {
+		e_debug(event, "Policy response %d", result);
+	}
+
+	if (request->policy_refusal && request->set->verbose) {
+		e_info(event, "Authentication failure due to policy server refusal%s%s",
+		       (message!=NULL?": ":""),
+		       (message!=NULL?message:""));
+	}
+}
+
 static
 void auth_policy_callback(struct policy_lookup_ctx *context)
 {
+	ARRAY_TYPE(policy_waiter) waiters;
+	struct policy_waiter *waiter;
+
+	if (context->cache_key != NULL) {
+		if (context->have_result && !context->parse_error) {
+			policy_cache_add(context->set, context->cache_key,
+					 context->result, context->message);
+		}
+		/* the waiters are called after the check is no longer
+		   pending, so their callbacks can start new checks */
+		hash_table_remove(policy_pending_checks, context->cache_key);
+		context->cache_key = NULL;
+	}
+
 	if (context->callback != NULL)
 		context->callback(context->result, context->callback_context);
 	if (context->event != NULL)
 		auth_policy_log_result(context);
+
+	if (!array_is_created(&context->waiters))
+		return;
+	waiters = context->waiters;
+	i_zero(&context->waiters);
+	array_foreach_modifiable(&waiters, waiter) {
+		if (context->have_result) {
+			auth_policy_apply_result(waiter->request, waiter->event,
+						 context->result,
+						 context->message);
+		}
+		waiter->callback(context->result, waiter->callback_context);
+		event_unref(&waiter->event);
+		auth_request_unref(&waiter->request);
+	}
 }
 
 static
@@ -353,28 +554,9 @@ void auth_policy_parse_response(struct policy_lookup_ctx *context)
 		context->result = (context->set->policy_reject_on_fail ? -1 : 0);
 	}
 
-	context->request->policy_refusal = FALSE;
-
-	if (context->result < 0) {
-		if (context->message != NULL) {
-			/* set message here */
-			e_debug(context->event,
-				"Policy response %d with message: %s",
-				context->result, context->message);
-			auth_request_set_field(context->request, "reason", context->message, NULL);
-		}
-		context->request->policy_refusal = TRUE;
-	} else {
-		e_debug(context->event,
-			"Policy response %d", context->result);
-	}
-
-	if (context->request->policy_refusal == TRUE && context->set->verbose == TRUE) {
-		e_info(context->event, "Authentication failure due to policy server refusal%s%s",
-		       (context->message!=NULL?": ":""),
-		       (context->message!=NULL?context->message:""));
-	}
-
+	auth_policy_apply_result(context->request, context->event,
+				 context->result, context->message);
+	context->have_result = TRUE;
 	auth_policy_callback(context);
 }
 
@@ -446,8 +628,15 @@ void auth_policy_send_request(struct policy_lookup_ctx *context)
 	struct istream *is = i_stream_create_from_buffer(context->json);
 	http_client_request_set_payload(context->http_request, is, FALSE);
 	i_stream_unref(&is);
+	if (context->expect_result)
+		auth_request_ref(context->request);
+	else {
+		/* Reports don't need the auth request after the JSON is
+		   created, so don't keep it around until the policy server
+		   answers. */
+		context->request = NULL;
+	}
 	http_client_request_submit(context->http_request);
-	auth_request_ref(context->request);
 }
 
 static
@@ -566,6 +755,57 @@ static const char *auth_policy_get_prefix(struct auth_request *request)
 	return str_c(str);
 }
 
+static struct event *
+auth_policy_event_create(struct auth_request *request, const char *mode)
+{
+	struct event *event = event_create(request->event);
+
+	event_add_str(event, "mode", mode);
+	event_set_append_log_prefix(event, auth_policy_get_prefix(request));
+	return event;
+}
+
+static bool
+auth_policy_check_cached(struct policy_lookup_ctx *ctx,
+			 auth_policy_callback_t cb, void *context)
+{
+	struct policy_cache_entry *entry;
+	struct policy_lookup_ctx *pending;
+	struct policy_waiter *waiter;
+	const char *key = str_c(ctx->json);
+
+	entry = policy_cache_lookup(key);
+	if (entry != NULL) {
+		e_debug(ctx->event, "Policy response found from cache");
+		auth_policy_apply_result(ctx->request, ctx->event,
+					 entry->result, entry->message);
+		cb(entry->result, context);
+		return TRUE;
+	}
+
+	pending = hash_table_lookup(policy_pending_checks, key);
+	if (pending != NULL) {
+		/* Identical check is already waiting for the policy server.
+		   Use its result. */
+		e_debug(ctx->event,
+			"Waiting for an identical policy request's response");
+		if (!array_is_created(&pending->waiters))
+			p_array_init(&pending->waiters, pending->pool, 4);
+		waiter = array_append_space(&pending->waiters);
+		waiter->request = ctx->request;
+		auth_request_ref(waiter->request);
+		waiter->event = ctx->event;
+		ctx->event = NULL;
+		waiter->callback = cb;
+		waiter->callback_context = context;
+		return TRUE;
+	}
+
+	ctx->cache_key = p_strdup(ctx->pool, key);
+	hash_table_insert(policy_pending_checks, ctx->cache_key, ctx);
+	return FALSE;
+}
+
 void auth_policy_check(struct auth_request *request, const char *password,
 	auth_policy_callback_t cb, void *context)
 {
@@ -581,15 +821,19 @@ void auth_policy_check(struct auth_request *request, const char *password,
 	ctx->callback = cb;
 	ctx->callback_context = context;
 	ctx->set = request->set;
-	ctx->event = event_create(request->event);
-	event_add_str(ctx->event, "mode", "allow");
-	event_set_append_log_prefix(ctx->event, auth_policy_get_prefix(request));
+	ctx->event = auth_policy_event_create(request, "allow");
 	auth_policy_url(ctx, "allow");
 	ctx->result = (ctx->set->policy_reject_on_fail ? -1 : 0);
 	e_debug(ctx->event, "Policy request %s", ctx->url);
 	T_BEGIN {
 		auth_policy_create_json(ctx, password, FALSE);
 	} T_END;
+	if (auth_policy_cache_enabled(ctx->set) &&
+	    auth_policy_check_cached(ctx, cb, context)) {
+		event_unref(&ctx->event);
+		pool_unref(&ctx->pool);
+		return;
+	}
 	auth_policy_send_request(ctx);
 }
 
@@ -606,9 +850,7 @@ void auth_policy_report(struct auth_request *request)
 	ctx->request = request;
 	ctx->expect_result = FALSE;
 	ctx->set = request->set;
-	ctx->event = event_create(request->event);
-	event_add_str(ctx->event, "mode", "report");
-	event_set_append_log_prefix(ctx->event, auth_policy_get_prefix(request));
+	ctx->event = auth_policy_event_create(request, "report");
 	auth_policy_url(ctx, "report");
 	e_debug(ctx->event, "Policy request %s", ctx->url);
 	T_BEGIN {
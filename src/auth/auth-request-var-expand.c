@@ -1,15 +1,22 @@
 /* Copyright (c) 2002-2018 Dovecot authors, see the included COPYING file */
 
 #include "auth-common.h"
+#include "hash.h"
 #include "str.h"
 #include "strescape.h"
 #include "auth-request.h"
 
+/* Maximum number of compiled templates to keep. The templates come from the
+   configuration, so normally there are far fewer of them. */
+#define AUTH_REQUEST_VAR_EXPAND_MAX_PROGRAMS 256
+
 struct auth_request_var_expand_ctx {
 	const struct auth_request *auth_request;
 	auth_request_escape_func_t *escape_func;
 };
 
+static HASH_TABLE(char *, struct var_expand_program *) var_expand_programs;
+
 const struct var_expand_table
 auth_request_var_expand_static_tab[AUTH_REQUEST_VAR_TAB_COUNT+1] = {
 	{ 'u', NULL, "user" },
@@ -242,6 +249,45 @@ const struct var_expand_func_table auth_request_var_funcs_table[] = {
 	{ NULL, NULL }
 };
 
+static void auth_request_var_expand_programs_clear(void)
+{
+	struct hash_iterate_context *iter;
+	struct var_expand_program *program;
+	char *key;
+
+	iter = hash_table_iterate_init(var_expand_programs);
+	while (hash_table_iterate(iter, var_expand_programs, &key, &program)) {
+		var_expand_program_free(&program);
+		i_free(key);
+	}
+	hash_table_iterate_deinit(&iter);
+	hash_table_clear(var_expand_programs, FALSE);
+}
+
+static struct var_expand_program *
+auth_request_var_expand_program_get(const char *str,
+				    const struct var_expand_table *table)
+{
+	struct var_expand_program *program;
+	char *key;
+
+	if (!hash_table_is_created(var_expand_programs)) {
+		hash_table_create(&var_expand_programs, default_pool, 0,
+				  str_hash, strcmp);
+	}
+	program = hash_table_lookup(var_expand_programs, str);
+	if (program != NULL)
+		return program;
+
+	if (hash_table_count(var_expand_programs) >=
+	    AUTH_REQUEST_VAR_EXPAND_MAX_PROGRAMS)
+		auth_request_var_expand_programs_clear();
+	program = var_expand_program_compile(str, table);
+	key = i_strdup(str);
+	hash_table_insert(var_expand_programs, key, program);
+	return program;
+}
+
 int auth_request_var_expand(string_t *dest, const char *str,
 			    const struct auth_request *auth_request,
 			    auth_request_escape_func_t *escape_func,
@@ -259,12 +305,16 @@ int auth_request_var_expand_with_table(string_t *dest, const char *str,
 				       const char **error_r)
 {
 	struct auth_request_var_expand_ctx ctx;
+	struct var_expand_program *program;
 
 	i_zero(&ctx);
 	ctx.auth_request = auth_request;
 	ctx.escape_func = escape_func == NULL ? escape_none : escape_func;
-	return var_expand_with_funcs(dest, str, table,
-				     auth_request_var_funcs_table, &ctx, error_r);
+
+	program = auth_request_var_expand_program_get(str, table);
+	return var_expand_program_expand(program, dest, table,
+					 auth_request_var_funcs_table, &ctx,
+					 error_r);
 }
 
 int t_auth_request_var_expand(const char *str,
@@ -278,3 +328,11 @@ int t_auth_request_var_expand(const char *str,
 	*value_r = str_c(dest);
 	return ret;
 }
+
+void auth_request_var_expand_deinit(void)
+{
+	if (!hash_table_is_created(var_expand_programs))
+		return;
+	auth_request_var_expand_programs_clear();
+	hash_table_destroy(&var_expand_programs);
+}
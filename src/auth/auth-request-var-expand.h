@@ -37,6 +37,9 @@ int t_auth_request_var_expand(const char *str,
 			      auth_request_escape_func_t *escape_func,
 			      const char **value_r, const char **error_r);
 
+/* Free the cached compiled templates. */
+void auth_request_var_expand_deinit(void);
+
 const char *auth_request_str_escape(const char *string,
 				    const struct auth_request *request);
 
@@ -72,6 +72,8 @@ void auth_request_verify_plain_continue(struct auth_request *request,
 static
 void auth_request_lookup_credentials_policy_continue(struct auth_request *request,
 						     lookup_credentials_callback_t *callback);
+static void
+auth_request_lookup_credentials_passdb(struct auth_request *request);
 static
 void auth_request_policy_check_callback(int result, void *context);
 
@@ -381,6 +383,7 @@ void auth_request_unref(struct auth_request **_request)
 		dns_lookup_abort(&request->dns_lookup_ctx->dns_lookup);
 	timeout_remove(&request->to_abort);
 	timeout_remove(&request->to_penalty);
+	timeout_remove(&request->to_cache_refresh);
 
 	if (request->mech != NULL)
 		request->mech->auth_free(request);
@@ -1436,6 +1439,16 @@ void auth_request_lookup_credentials_callback(enum passdb_result result,
 	    auth_fields_exists(request->extra_fields, "noauthenticate"))
 		result = PASSDB_RESULT_NEXT;
 
+	if (request->cache_refresh) {
+		/* nobody is waiting for this. on failure the old cache
+		   entry is kept. */
+		if (result != PASSDB_RESULT_INTERNAL_FAILURE)
+			auth_request_save_cache(request, result);
+		auth_request_passdb_lookup_end(request, result);
+		auth_request_unref(&request);
+		return;
+	}
+
 	if (result != PASSDB_RESULT_INTERNAL_FAILURE)
 		auth_request_save_cache(request, result);
 	else {
@@ -1490,7 +1503,7 @@ void auth_request_lookup_credentials_policy_continue(struct auth_request *reques
 						     lookup_credentials_callback_t *callback)
 {
 	struct auth_passdb *passdb;
-	const char *cache_key, *cache_cred, *cache_scheme, *error;
+	const char *cache_key, *cache_cred, *cache_scheme;
 	enum passdb_result result;
 
 	i_assert(request->state == AUTH_REQUEST_STATE_MECH_CONTINUE);
@@ -1527,6 +1540,15 @@ void auth_request_lookup_credentials_policy_continue(struct auth_request *reques
 		}
 	}
 
+	auth_request_lookup_credentials_passdb(request);
+}
+
+static void
+auth_request_lookup_credentials_passdb(struct auth_request *request)
+{
+	struct auth_passdb *passdb = request->passdb;
+	const char *error;
+
 	auth_request_set_state(request, AUTH_REQUEST_STATE_PASSDB);
 
 	if (passdb->passdb->iface.lookup_credentials == NULL) {
@@ -1551,6 +1573,54 @@ void auth_request_lookup_credentials_policy_continue(struct auth_request *reques
 	}
 }
 
+static void
+auth_request_passdb_cache_refresh_start(struct auth_request *request)
+{
+	timeout_remove(&request->to_cache_refresh);
+
+	auth_request_passdb_lookup_begin(request);
+	e_debug(authdb_event(request), "cache: Refreshing entry");
+	auth_request_lookup_credentials_passdb(request);
+}
+
+void auth_request_passdb_cache_refresh(struct auth_request *request)
+{
+	struct auth_request *refresh;
+	const char *const *args, *key, *value;
+	string_t *str;
+
+	if (request->passdb->passdb->iface.lookup_credentials == NULL) {
+		/* e.g. PAM can only verify passwords */
+		return;
+	}
+
+	str = t_str_new(256);
+	auth_request_export(request, str);
+
+	refresh = auth_request_new_dummy();
+	for (args = t_strsplit_tabescaped(str_c(str)); *args != NULL; args++) {
+		value = strchr(*args, '=');
+		if (value == NULL)
+			(void)auth_request_import(refresh, *args, "");
+		else {
+			key = t_strdup_until(*args, value++);
+			(void)auth_request_import(refresh, key, value);
+		}
+	}
+	/* cache only the fields that the refresh lookup sets */
+	auth_fields_snapshot(refresh->extra_fields);
+
+	auth_request_init(refresh);
+	refresh->passdb = request->passdb;
+	refresh->credentials_scheme = "";
+	refresh->cache_refresh = TRUE;
+
+	/* The caller is still using the cache node. Start the lookup later,
+	   because it may finish immediately and replace the node. */
+	refresh->to_cache_refresh = timeout_add_short(0,
+		auth_request_passdb_cache_refresh_start, refresh);
+}
+
 void auth_request_set_credentials(struct auth_request *request,
 				  const char *scheme, const char *data,
 				  set_credentials_callback_t *callback)
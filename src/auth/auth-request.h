@@ -91,7 +91,7 @@ struct auth_request {
 	struct ip_addr local_ip, remote_ip, real_local_ip, real_remote_ip;
 	in_port_t local_port, remote_port, real_local_port, real_remote_port;
 
-	struct timeout *to_abort, *to_penalty;
+	struct timeout *to_abort, *to_penalty, *to_cache_refresh;
 	unsigned int policy_penalty;
 	unsigned int last_penalty;
 	size_t initial_response_len;
@@ -166,6 +166,8 @@ struct auth_request {
 	bool stats_sent:1;
 	bool policy_refusal:1;
 	bool policy_processed:1;
+	/* this is a background passdb lookup that refreshes the cache */
+	bool cache_refresh:1;
 
 	bool event_finished_sent:1;
 
@@ -286,6 +288,9 @@ auth_request_verify_plain_callback_finish(enum passdb_result result,
                                           struct auth_request *request);
 void auth_request_verify_plain_callback(enum passdb_result result,
 					struct auth_request *request);
+/* Refresh the request's current passdb cache entry in the background with
+   a credentials lookup. */
+void auth_request_passdb_cache_refresh(struct auth_request *request);
 void auth_request_lookup_credentials_callback(enum passdb_result result,
 					      const unsigned char *credentials,
 					      size_t size,
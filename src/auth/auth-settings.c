@@ -231,6 +231,9 @@ static const struct setting_define auth_setting_defines[] = {
 	DEF(SET_TIME, cache_ttl),
 	DEF(SET_TIME, cache_negative_ttl),
 	DEF(SET_BOOL, cache_verify_password_with_worker),
+	DEF(SET_BOOL, verify_slow_password_with_worker),
+	DEF(SET_STR, cache_file),
+	DEF(SET_TIME, cache_refresh_ahead),
 	DEF(SET_STR, username_chars),
 	DEF(SET_STR, username_translation),
 	DEF(SET_STR, username_format),
@@ -254,6 +257,8 @@ static const struct setting_define auth_setting_defines[] = {
 	DEF(SET_BOOL, policy_report_after_auth),
 	DEF(SET_BOOL, policy_log_only),
 	DEF(SET_UINT, policy_hash_truncate),
+	DEF(SET_TIME, policy_cache_ttl),
+	DEF(SET_TIME, policy_cache_negative_ttl),
 
 	DEF(SET_BOOL, stats),
 	DEF(SET_BOOL, verbose),
@@ -265,6 +270,7 @@ static const struct setting_define auth_setting_defines[] = {
 	DEF(SET_BOOL, use_winbind),
 
 	DEF(SET_UINT, worker_max_count),
+	DEF(SET_UINT, worker_max_pending_requests),
 
 	DEFLIST(passdbs, "passdb", &auth_passdb_setting_parser_info),
 	DEFLIST(userdbs, "userdb", &auth_userdb_setting_parser_info),
@@ -290,6 +296,9 @@ static const struct auth_settings auth_default_settings = {
 	.cache_ttl = 60*60,
 	.cache_negative_ttl = 60*60,
 	.cache_verify_password_with_worker = FALSE,
+	.verify_slow_password_with_worker = FALSE,
+	.cache_file = "",
+	.cache_refresh_ahead = 0,
 	.username_chars = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ01234567890.-_@",
 	.username_translation = "",
 	.username_format = "%Lu",
@@ -313,6 +322,8 @@ static const struct auth_settings auth_default_settings = {
 	.policy_report_after_auth = TRUE,
 	.policy_log_only = FALSE,
 	.policy_hash_truncate = 12,
+	.policy_cache_ttl = 0,
+	.policy_cache_negative_ttl = 0,
 
 	.stats = FALSE,
 	.verbose = FALSE,
@@ -327,6 +338,7 @@ static const struct auth_settings auth_default_settings = {
 	.use_winbind = FALSE,
 
 	.worker_max_count = 30,
+	.worker_max_pending_requests = 1,
 
 	.passdbs = ARRAY_INIT,
 	.userdbs = ARRAY_INIT,
@@ -431,6 +443,10 @@ static bool auth_settings_check(void *_set, pool_t pool,
 		*error_r = "auth_worker_max_count must be above zero";
 		return FALSE;
 	}
+	if (set->worker_max_pending_requests == 0) {
+		*error_r = "auth_worker_max_pending_requests must be above zero";
+		return FALSE;
+	}
 
 	if (set->cache_size > 0 && set->cache_size < 1024) {
 		/* probably a configuration error.
@@ -45,6 +45,9 @@ struct auth_settings {
 	unsigned int cache_ttl;
 	unsigned int cache_negative_ttl;
 	bool cache_verify_password_with_worker;
+	bool verify_slow_password_with_worker;
+	const char *cache_file;
+	unsigned int cache_refresh_ahead;
 	const char *username_chars;
 	const char *username_translation;
 	const char *username_format;
@@ -68,6 +71,8 @@ struct auth_settings {
 	bool policy_report_after_auth;
 	bool policy_log_only;
 	unsigned int policy_hash_truncate;
+	unsigned int policy_cache_ttl;
+	unsigned int policy_cache_negative_ttl;
 
 	bool stats;
 	bool verbose, debug, debug_passwords;
@@ -77,6 +82,7 @@ struct auth_settings {
 	bool use_winbind;
 
 	unsigned int worker_max_count;
+	unsigned int worker_max_pending_requests;
 
 	/* settings that don't have auth_ prefix: */
 	ARRAY(struct auth_passdb_settings *) passdbs;
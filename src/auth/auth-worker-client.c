@@ -29,14 +29,20 @@ struct auth_worker_client {
 	int refcount;
 
         struct auth *auth;
-	struct event *event;
-	time_t cmd_start;
 
 	bool error_sent:1;
 	bool destroyed:1;
 };
 
+struct auth_worker_command {
+	struct auth_worker_client *client;
+	/* each pipelined request has its own event and start time */
+	struct event *event;
+	time_t start;
+};
+
 struct auth_worker_list_context {
+	struct auth_worker_command *cmd;
 	struct auth_worker_client *client;
 	struct auth_request *auth_request;
 	struct userdb_iterate_context *iter;
@@ -50,11 +56,14 @@ static bool auth_worker_client_error = FALSE;
 static int auth_worker_output(struct auth_worker_client *client);
 static void auth_worker_client_destroy(struct connection *conn);
 static void auth_worker_client_unref(struct auth_worker_client **_client);
+static void
+auth_worker_client_check_throttle(struct auth_worker_client *client);
 
-static void auth_worker_log_finished(struct auth_worker_client *client,
-				     const char *error)
+static void auth_worker_request_finished(struct auth_worker_command *cmd,
+					 const char *error)
 {
-	struct event_passthrough *e = event_create_passthrough(client->event)->
+	struct auth_worker_client *client = cmd->client;
+	struct event_passthrough *e = event_create_passthrough(cmd->event)->
 		set_name("auth_worker_request_finished");
 	if (error != NULL) {
 		e->add_str("error", error);
@@ -62,6 +71,10 @@ static void auth_worker_log_finished(struct auth_worker_client *client,
 	} else {
 		e_debug(e->event(), "Finished");
 	}
+	event_unref(&cmd->event);
+	i_free(cmd);
+	auth_worker_client_check_throttle(client);
+	auth_worker_client_unref(&client);
 }
 
 void auth_worker_refresh_proctitle(const char *state)
@@ -87,7 +100,7 @@ auth_worker_client_check_throttle(struct auth_worker_client *client)
 	}
 }
 
-bool auth_worker_auth_request_new(struct auth_worker_client *client, unsigned int id,
+bool auth_worker_auth_request_new(struct auth_worker_command *cmd, unsigned int id,
 				  const char *const *args, struct auth_request **request_r)
 {
 	struct auth_request *auth_request;
@@ -95,8 +108,7 @@ bool auth_worker_auth_request_new(struct auth_worker_client *client, unsigned in
 
 	auth_request = auth_request_new_dummy();
 
-	client->refcount++;
-	auth_request->context = client;
+	auth_request->context = cmd;
 	auth_request->id = id;
 
 	for (; *args != NULL; args++) {
@@ -125,11 +137,12 @@ bool auth_worker_auth_request_new(struct auth_worker_client *client, unsigned in
 	return TRUE;
 }
 
-static void auth_worker_send_reply(struct auth_worker_client *client,
+static void auth_worker_send_reply(struct auth_worker_command *cmd,
 				   struct auth_request *request,
 				   string_t *str)
 {
-	time_t cmd_duration = time(NULL) - client->cmd_start;
+	struct auth_worker_client *client = cmd->client;
+	time_t cmd_duration = time(NULL) - cmd->start;
 	const char *p;
 
 	if (worker_restart_request)
@@ -140,7 +153,7 @@ static void auth_worker_send_reply(struct auth_worker_client *client,
 		p = i_strchr_to_next(str_c(str), '\t');
 		p = p == NULL ? "BUG" : t_strcut(p, '\t');
 
-		e_warning(client->event, "Auth master disconnected us while handling "
+		e_warning(cmd->event, "Auth master disconnected us while handling "
 			  "request for %s for %ld secs (result=%s)",
 			  request->user, (long)cmd_duration, p);
 	}
@@ -169,7 +182,7 @@ reply_append_extra_fields(string_t *str, struct auth_request *request)
 static void verify_plain_callback(enum passdb_result result,
 				  struct auth_request *request)
 {
-	struct auth_worker_client *client = request->context;
+	struct auth_worker_command *cmd = request->context;
 	string_t *str;
 
 	if (request->failed && result == PASSDB_RESULT_OK)
@@ -195,17 +208,15 @@ static void verify_plain_callback(enum passdb_result result,
 		reply_append_extra_fields(str, request);
 	}
 	str_append_c(str, '\n');
-	auth_worker_send_reply(client, request, str);
+	auth_worker_send_reply(cmd, request, str);
 
 	auth_request_passdb_lookup_end(request, result);
-	auth_worker_log_finished(client, NULL);
 	auth_request_unref(&request);
-	auth_worker_client_check_throttle(client);
-	auth_worker_client_unref(&client);
+	auth_worker_request_finished(cmd, NULL);
 }
 
 static bool
-auth_worker_handle_passv(struct auth_worker_client *client,
+auth_worker_handle_passv(struct auth_worker_command *cmd,
 			 unsigned int id, const char *const *args,
 			 const char **error_r)
 {
@@ -222,7 +233,7 @@ auth_worker_handle_passv(struct auth_worker_client *client,
 	}
 	password = args[1];
 
-	if (!auth_worker_auth_request_new(client, id, args + 2, &auth_request)) {
+	if (!auth_worker_auth_request_new(cmd, id, args + 2, &auth_request)) {
 		*error_r = "BUG: Auth worker server sent us invalid PASSV";
 		return FALSE;
 	}
@@ -254,14 +265,15 @@ auth_worker_handle_passv(struct auth_worker_client *client,
 }
 
 static bool
-auth_worker_handle_passw(struct auth_worker_client *client,
+auth_worker_handle_passw(struct auth_worker_command *cmd,
 			 unsigned int id, const char *const *args,
-			 const char **error_r)
+			 bool passdb_lookup, const char **error_r)
 {
 	struct auth_request *request;
+	struct auth_passdb *passdb;
 	string_t *str;
 	const char *password;
-	const char *crypted, *scheme;
+	const char *crypted, *scheme, *subsystem;
 	unsigned int passdb_id;
 	int ret;
 
@@ -278,15 +290,29 @@ auth_worker_handle_passw(struct auth_worker_client *client,
 		return FALSE;
 	}
 
-	if (!auth_worker_auth_request_new(client, id, args + 3, &request)) {
+	if (!auth_worker_auth_request_new(cmd, id, args + 3, &request)) {
 		*error_r = "BUG: PASSW had missing parameters";
 		return FALSE;
 	}
 	request->mech_password =
 		p_strdup(request->pool, password);
 
+	if (passdb_lookup) {
+		/* VERIFY: the password came from a passdb lookup, so log
+		   using the passdb whose password is being verified */
+		passdb = request->passdb;
+		while (passdb != NULL && passdb->passdb->id != passdb_id)
+			passdb = passdb->next;
+		if (passdb != NULL)
+			request->passdb = passdb;
+		subsystem = AUTH_SUBSYS_DB;
+	} else {
+		/* PASSW: the password came from the auth cache */
+		subsystem = "cache";
+	}
+
 	ret = auth_request_password_verify(request, password,
-					   crypted, scheme, "cache");
+					   crypted, scheme, subsystem);
 	str = t_str_new(128);
 	str_printfa(str, "%u\t", request->id);
 
@@ -298,12 +324,10 @@ auth_worker_handle_passw(struct auth_worker_client *client,
 		str_printfa(str, "FAIL\t%d", PASSDB_RESULT_INTERNAL_FAILURE);
 
 	str_append_c(str, '\n');
-	auth_worker_send_reply(client, request, str);
+	auth_worker_send_reply(cmd, request, str);
 
-	auth_worker_log_finished(client, NULL);
 	auth_request_unref(&request);
-	auth_worker_client_check_throttle(client);
-	auth_worker_client_unref(&client);
+	auth_worker_request_finished(cmd, NULL);
 	return TRUE;
 }
 
@@ -312,7 +336,7 @@ lookup_credentials_callback(enum passdb_result result,
 			    const unsigned char *credentials, size_t size,
 			    struct auth_request *request)
 {
-	struct auth_worker_client *client = request->context;
+	struct auth_worker_command *cmd = request->context;
 	string_t *str;
 
 	if (request->failed && result == PASSDB_RESULT_OK)
@@ -340,17 +364,15 @@ lookup_credentials_callback(enum passdb_result result,
 		reply_append_extra_fields(str, request);
 	}
 	str_append_c(str, '\n');
-	auth_worker_send_reply(client, request, str);
+	auth_worker_send_reply(cmd, request, str);
 
 	auth_request_passdb_lookup_end(request, result);
 	auth_request_unref(&request);
-	auth_worker_log_finished(client, NULL);
-	auth_worker_client_check_throttle(client);
-	auth_worker_client_unref(&client);
+	auth_worker_request_finished(cmd, NULL);
 }
 
 static bool
-auth_worker_handle_passl(struct auth_worker_client *client,
+auth_worker_handle_passl(struct auth_worker_command *cmd,
 			 unsigned int id, const char *const *args,
 			 const char **error_r)
 {
@@ -366,7 +388,7 @@ auth_worker_handle_passl(struct auth_worker_client *client,
 	}
 	scheme = args[1];
 
-	if (!auth_worker_auth_request_new(client, id, args + 2, &auth_request)) {
+	if (!auth_worker_auth_request_new(cmd, id, args + 2, &auth_request)) {
 		*error_r = "BUG: PASSL had missing parameters";
 		return FALSE;
 	}
@@ -397,22 +419,20 @@ auth_worker_handle_passl(struct auth_worker_client *client,
 static void
 set_credentials_callback(bool success, struct auth_request *request)
 {
-	struct auth_worker_client *client = request->context;
+	struct auth_worker_command *cmd = request->context;
 
 	string_t *str;
 
 	str = t_str_new(64);
 	str_printfa(str, "%u\t%s\n", request->id, success ? "OK" : "FAIL");
-	auth_worker_send_reply(client, request, str);
+	auth_worker_send_reply(cmd, request, str);
 
-	auth_worker_log_finished(client, NULL);
 	auth_request_unref(&request);
-	auth_worker_client_check_throttle(client);
-	auth_worker_client_unref(&client);
+	auth_worker_request_finished(cmd, NULL);
 }
 
 static bool
-auth_worker_handle_setcred(struct auth_worker_client *client,
+auth_worker_handle_setcred(struct auth_worker_command *cmd,
 			   unsigned int id, const char *const *args,
 			   const char **error_r)
 {
@@ -427,7 +447,7 @@ auth_worker_handle_setcred(struct auth_worker_client *client,
 	}
 	creds = args[1];
 
-	if (!auth_worker_auth_request_new(client, id, args + 2, &auth_request)) {
+	if (!auth_worker_auth_request_new(cmd, id, args + 2, &auth_request)) {
 		*error_r = "BUG: SETCRED had missing parameters";
 		return FALSE;
 	}
@@ -450,7 +470,7 @@ static void
 lookup_user_callback(enum userdb_result result,
 		     struct auth_request *auth_request)
 {
-	struct auth_worker_client *client = auth_request->context;
+	struct auth_worker_command *cmd = auth_request->context;
 	string_t *str;
 
 	str = t_str_new(128);
@@ -477,13 +497,11 @@ lookup_user_callback(enum userdb_result result,
 	}
 	str_append_c(str, '\n');
 
-	auth_worker_send_reply(client, auth_request, str);
+	auth_worker_send_reply(cmd, auth_request, str);
 
 	auth_request_userdb_lookup_end(auth_request, result);
-	auth_worker_log_finished(client, NULL);
 	auth_request_unref(&auth_request);
-	auth_worker_client_check_throttle(client);
-	auth_worker_client_unref(&client);
+	auth_worker_request_finished(cmd, NULL);
 }
 
 static struct auth_userdb *
@@ -499,7 +517,7 @@ auth_userdb_find_by_id(struct auth_userdb *userdbs, unsigned int id)
 }
 
 static bool
-auth_worker_handle_user(struct auth_worker_client *client,
+auth_worker_handle_user(struct auth_worker_command *cmd,
 			unsigned int id, const char *const *args,
 			const char **error_r)
 {
@@ -513,7 +531,7 @@ auth_worker_handle_user(struct auth_worker_client *client,
 		return FALSE;
 	}
 
-	if (!auth_worker_auth_request_new(client, id, args + 1, &auth_request)) {
+	if (!auth_worker_auth_request_new(cmd, id, args + 1, &auth_request)) {
 		*error_r = "BUG: USER had missing parameters";
 		return FALSE;
 	}
@@ -543,6 +561,7 @@ auth_worker_client_idle_kill(struct connection *conn ATTR_UNUSED)
 
 static void list_iter_deinit(struct auth_worker_list_context *ctx)
 {
+	struct auth_worker_command *cmd = ctx->cmd;
 	struct auth_worker_client *client = ctx->client;
 	string_t *str;
 
@@ -554,15 +573,14 @@ static void list_iter_deinit(struct auth_worker_list_context *ctx)
 		str_printfa(str, "%u\tFAIL\n", ctx->auth_request->id);
 	else
 		str_printfa(str, "%u\tOK\n", ctx->auth_request->id);
-	auth_worker_send_reply(client, NULL, str);
+	auth_worker_send_reply(cmd, NULL, str);
 
 	connection_input_resume(&client->conn);
 	o_stream_set_flush_callback(client->conn.output, auth_worker_output,
 				    client);
 	auth_request_userdb_lookup_end(ctx->auth_request, USERDB_RESULT_OK);
-	auth_worker_log_finished(client, NULL);
 	auth_request_unref(&ctx->auth_request);
-	auth_worker_client_unref(&client);
+	auth_worker_request_finished(cmd, NULL);
 	i_free(ctx);
 
 	auth_worker_refresh_proctitle(CLIENT_STATE_IDLE);
@@ -634,7 +652,7 @@ static int auth_worker_list_output(struct auth_worker_list_context *ctx)
 }
 
 static bool
-auth_worker_handle_list(struct auth_worker_client *client,
+auth_worker_handle_list(struct auth_worker_command *cmd,
 			unsigned int id, const char *const *args,
 			const char **error_r)
 {
@@ -647,15 +665,16 @@ auth_worker_handle_list(struct auth_worker_client *client,
 		return FALSE;
 	}
 
-	userdb = auth_userdb_find_by_id(client->auth->userdbs, userdb_id);
+	userdb = auth_userdb_find_by_id(cmd->client->auth->userdbs, userdb_id);
 	if (userdb == NULL) {
 		*error_r = "BUG: LIST had invalid userdb ID";
 		return FALSE;
 	}
 
 	ctx = i_new(struct auth_worker_list_context, 1);
-	ctx->client = client;
-	if (!auth_worker_auth_request_new(client, id, args + 1, &ctx->auth_request)) {
+	ctx->cmd = cmd;
+	ctx->client = cmd->client;
+	if (!auth_worker_auth_request_new(cmd, id, args + 1, &ctx->auth_request)) {
 		*error_r = "BUG: LIST had missing parameters";
 		i_free(ctx);
 		return FALSE;
@@ -722,6 +741,7 @@ auth_worker_client_input_args(struct connection *conn, const char *const *args)
 	const char *error = NULL;
 	struct auth_worker_client *client =
 		container_of(conn, struct auth_worker_client, conn);
+	struct auth_worker_command *cmd;
 
 	if (str_array_length(args) < 3 ||
 	    str_to_uint(args[0], &id) < 0) {
@@ -730,28 +750,32 @@ auth_worker_client_input_args(struct connection *conn, const char *const *args)
 	}
 
 	io_loop_time_refresh();
-	if (client->event == NULL)
-		client->event = event_create(client->conn.event);
-	event_add_str(client->event, "command", args[1]);
-	event_add_int(client->event, "id", id);
-	event_set_append_log_prefix(client->event, t_strdup_printf("auth-worker<%u>: ", id));
-	client->cmd_start = ioloop_time;
-	client->refcount++;
-	e_debug(client->event, "Handling %s request", args[1]);
+	/* the command keeps the client referenced until it's finished */
+	client->refcount += 2;
+	cmd = i_new(struct auth_worker_command, 1);
+	cmd->client = client;
+	cmd->event = event_create(client->conn.event);
+	event_add_str(cmd->event, "command", args[1]);
+	event_add_int(cmd->event, "id", id);
+	event_set_append_log_prefix(cmd->event, t_strdup_printf("auth-worker<%u>: ", id));
+	cmd->start = ioloop_time;
+	e_debug(cmd->event, "Handling %s request", args[1]);
 
 	auth_worker_refresh_proctitle(args[1]);
 	if (strcmp(args[1], "PASSV") == 0)
-		ret = auth_worker_handle_passv(client, id, args + 2, &error);
+		ret = auth_worker_handle_passv(cmd, id, args + 2, &error);
 	else if (strcmp(args[1], "PASSL") == 0)
-		ret = auth_worker_handle_passl(client, id, args + 2, &error);
+		ret = auth_worker_handle_passl(cmd, id, args + 2, &error);
 	else if (strcmp(args[1], "PASSW") == 0)
-		ret = auth_worker_handle_passw(client, id, args + 2, &error);
+		ret = auth_worker_handle_passw(cmd, id, args + 2, FALSE, &error);
+	else if (strcmp(args[1], "VERIFY") == 0)
+		ret = auth_worker_handle_passw(cmd, id, args + 2, TRUE, &error);
 	else if (strcmp(args[1], "SETCRED") == 0)
-		ret = auth_worker_handle_setcred(client, id, args + 2, &error);
+		ret = auth_worker_handle_setcred(cmd, id, args + 2, &error);
 	else if (strcmp(args[1], "USER") == 0)
-		ret = auth_worker_handle_user(client, id, args + 2, &error);
+		ret = auth_worker_handle_user(cmd, id, args + 2, &error);
 	else if (strcmp(args[1], "LIST") == 0)
-		ret = auth_worker_handle_list(client, id, args + 2, &error);
+		ret = auth_worker_handle_list(cmd, id, args + 2, &error);
 	else {
 		error = t_strdup_printf("BUG: Auth-worker received unknown command: %s",
 			args[1]);
@@ -760,7 +784,7 @@ auth_worker_client_input_args(struct connection *conn, const char *const *args)
 	i_assert(ret || error != NULL);
 
 	if (!ret) {
-		auth_worker_log_finished(client, error);
+		auth_worker_request_finished(cmd, error);
 	} else if (client->conn.io == NULL) {
 		auth_worker_refresh_proctitle(CLIENT_STATE_IDLE);
 	}
@@ -793,7 +817,6 @@ static void auth_worker_client_unref(struct auth_worker_client **_client)
 
 	/* the connection should've been destroyed before getting here */
 	i_assert(client->destroyed);
-	event_unref(&client->event);
 	connection_deinit(&client->conn);
 	i_free(client);
 }
@@ -4,6 +4,7 @@
 #include "ioloop.h"
 #include "array.h"
 #include "aqueue.h"
+#include "llist.h"
 #include "net.h"
 #include "istream.h"
 #include "ostream.h"
@@ -29,12 +30,18 @@
 #define AUTH_WORKER_DELAY_WARN_MIN_INTERVAL_SECS 300
 
 struct auth_worker_request {
+	struct auth_worker_request *prev, *next;
+
 	unsigned int id;
 	time_t created;
 	const char *username;
 	const char *data;
 	auth_worker_callback_t *callback;
 	void *context;
+
+	/* Multi-line replies (user iteration) may halt the input, so they're
+	   never pipelined with other requests. */
+	bool exclusive:1;
 };
 
 struct auth_worker_connection {
@@ -45,7 +52,11 @@ struct auth_worker_connection {
 	struct ostream *output;
 	struct timeout *to;
 
-	struct auth_worker_request *request;
+	/* Requests sent to the worker, in the order they were sent. With
+	   auth_worker_max_pending_requests > 1 the replies may come in any
+	   order. */
+	struct auth_worker_request *requests_head, *requests_tail;
+	unsigned int request_count;
 	unsigned int id_counter;
 
 	bool received_error:1;
@@ -70,7 +81,7 @@ static void auth_worker_destroy(struct auth_worker_connection **conn,
 
 static void auth_worker_idle_timeout(struct auth_worker_connection *conn)
 {
-	i_assert(conn->request == NULL);
+	i_assert(conn->request_count == 0);
 
 	if (idle_count > 1)
 		auth_worker_destroy(&conn, NULL, FALSE);
@@ -80,11 +91,25 @@ static void auth_worker_idle_timeout(struct auth_worker_connection *conn)
 
 static void auth_worker_call_timeout(struct auth_worker_connection *conn)
 {
-	i_assert(conn->request != NULL);
+	i_assert(conn->request_count > 0);
 
 	auth_worker_destroy(&conn, "Lookup timed out", TRUE);
 }
 
+static bool
+auth_worker_can_send(struct auth_worker_connection *conn,
+		     struct auth_worker_request *request)
+{
+	if (conn->request_count == 0)
+		return TRUE;
+	if (conn->restart || conn->shutdown)
+		return FALSE;
+	if (request->exclusive || conn->requests_head->exclusive)
+		return FALSE;
+	return conn->request_count <
+		global_auth_settings->worker_max_pending_requests;
+}
+
 static bool auth_worker_request_send(struct auth_worker_connection *conn,
 				     struct auth_worker_request *request)
 {
@@ -123,13 +148,14 @@ static bool auth_worker_request_send(struct auth_worker_connection *conn,
 
 	o_stream_nsendv(conn->output, iov, 3);
 
-	i_assert(conn->request == NULL);
-	conn->request = request;
-
-	timeout_remove(&conn->to);
-	conn->to = timeout_add(AUTH_WORKER_LOOKUP_TIMEOUT_SECS * 1000,
-			       auth_worker_call_timeout, conn);
-	idle_count--;
+	i_assert(auth_worker_can_send(conn, request));
+	DLLIST2_APPEND(&conn->requests_head, &conn->requests_tail, request);
+	if (conn->request_count++ == 0) {
+		timeout_remove(&conn->to);
+		conn->to = timeout_add(AUTH_WORKER_LOOKUP_TIMEOUT_SECS * 1000,
+				       auth_worker_call_timeout, conn);
+		idle_count--;
+	}
 	return TRUE;
 }
 
@@ -137,15 +163,15 @@ static void auth_worker_request_send_next(struct auth_worker_connection *conn)
 {
 	struct auth_worker_request *request, *const *requestp;
 
-	do {
-		if (aqueue_count(worker_request_queue) == 0)
-			return;
-
+	while (aqueue_count(worker_request_queue) > 0) {
 		requestp = array_idx(&worker_request_array,
 				     aqueue_idx(worker_request_queue, 0));
 		request = *requestp;
+		if (!auth_worker_can_send(conn, request))
+			break;
 		aqueue_delete_tail(worker_request_queue);
-	} while (!auth_worker_request_send(conn, request));
+		(void)auth_worker_request_send(conn, request);
+	}
 }
 
 static void auth_worker_send_handshake(struct auth_worker_connection *conn)
@@ -210,6 +236,7 @@ static void auth_worker_destroy(struct auth_worker_connection **_conn,
 {
 	struct auth_worker_connection *conn = *_conn;
 	struct auth_worker_connection *const *conns;
+	struct auth_worker_request *request, *next;
 	unsigned int idx;
 
 	*_conn = NULL;
@@ -228,16 +255,18 @@ static void auth_worker_destroy(struct auth_worker_connection **_conn,
 		}
 	}
 
-	if (conn->request == NULL)
+	if (conn->request_count == 0)
 		idle_count--;
 
-	if (conn->request != NULL) {
+	/* the callbacks may free the requests */
+	for (request = conn->requests_head; request != NULL; request = next) {
+		next = request->next;
 		i_error("auth worker: Aborted %s request for %s: %s",
-			t_strcut(conn->request->data, '\t'),
-			conn->request->username, reason);
-		conn->request->callback(t_strdup_printf(
+			t_strcut(request->data, '\t'),
+			request->username, reason);
+		request->callback(t_strdup_printf(
 				"FAIL\t%d", PASSDB_RESULT_INTERNAL_FAILURE),
-				conn->request->context);
+				request->context);
 	}
 
 	io_remove(&conn->io);
@@ -266,13 +295,28 @@ static struct auth_worker_connection *auth_worker_find_free(void)
 	array_foreach_modifiable(&connections, conns) {
 		struct auth_worker_connection *conn = *conns;
 
-		if (conn->request == NULL)
+		if (conn->request_count == 0)
 			return conn;
 	}
 	i_unreached();
 	return NULL;
 }
 
+static struct auth_worker_connection *
+auth_worker_find_least_busy(struct auth_worker_request *request)
+{
+	struct auth_worker_connection **conns, *best = NULL;
+
+	array_foreach_modifiable(&connections, conns) {
+		struct auth_worker_connection *conn = *conns;
+
+		if (auth_worker_can_send(conn, request) &&
+		    (best == NULL || conn->request_count < best->request_count))
+			best = conn;
+	}
+	return best;
+}
+
 static bool auth_worker_request_handle(struct auth_worker_connection *conn,
 				       struct auth_worker_request *request,
 				       const char *line)
@@ -288,13 +332,19 @@ static bool auth_worker_request_handle(struct auth_worker_connection *conn,
 					       auth_worker_call_timeout, conn);
 		}
 	} else {
-		conn->resuming = FALSE;
-		conn->request = NULL;
-		conn->timeout_pending_resume = FALSE;
-		timeout_remove(&conn->to);
-		conn->to = timeout_add(AUTH_WORKER_MAX_IDLE_SECS * 1000,
-				       auth_worker_idle_timeout, conn);
-		idle_count++;
+		DLLIST2_REMOVE(&conn->requests_head, &conn->requests_tail,
+			       request);
+		if (--conn->request_count > 0) {
+			/* more replies are still pending */
+			timeout_reset(conn->to);
+		} else {
+			conn->resuming = FALSE;
+			conn->timeout_pending_resume = FALSE;
+			timeout_remove(&conn->to);
+			conn->to = timeout_add(AUTH_WORKER_MAX_IDLE_SECS * 1000,
+					       auth_worker_idle_timeout, conn);
+			idle_count++;
+		}
 	}
 
 	if (!request->callback(line, request->context) && conn->io != NULL) {
@@ -351,8 +401,22 @@ static void auth_worker_success(struct auth_worker_connection *conn)
 	conn->received_error = FALSE;
 }
 
+static struct auth_worker_request *
+auth_worker_request_find(struct auth_worker_connection *conn, unsigned int id)
+{
+	struct auth_worker_request *request;
+
+	for (request = conn->requests_head; request != NULL;
+	     request = request->next) {
+		if (request->id == id)
+			return request;
+	}
+	return NULL;
+}
+
 static void worker_input(struct auth_worker_connection *conn)
 {
+	struct auth_worker_request *request;
 	const char *line, *id_str;
 	unsigned int id;
 
@@ -396,14 +460,16 @@ static void worker_input(struct auth_worker_connection *conn)
 		    str_to_uint(t_strdup_until(id_str, line), &id) < 0)
 			continue;
 
-		if (conn->request != NULL && id == conn->request->id) {
-			if (!auth_worker_request_handle(conn, conn->request,
+		request = auth_worker_request_find(conn, id);
+		if (request != NULL) {
+			if (!auth_worker_request_handle(conn, request,
 							line + 1))
 				break;
 		} else {
-			if (conn->request != NULL) {
+			if (conn->request_count > 0) {
 				i_error("BUG: Worker sent reply with id %u, "
-					"expected %u", id, conn->request->id);
+					"expected %u", id,
+					conn->requests_head->id);
 			} else {
 				i_error("BUG: Worker sent reply with id %u, "
 					"none was expected", id);
@@ -413,8 +479,10 @@ static void worker_input(struct auth_worker_connection *conn)
 		}
 	}
 
-	if (conn->request != NULL) {
-		/* there's still a pending request */
+	if (conn->request_count > 0) {
+		/* there are still pending requests, but maybe more can be
+		   pipelined */
+		auth_worker_request_send_next(conn);
 	} else if (conn->restart)
 		auth_worker_destroy(&conn, "Max requests limit", TRUE);
 	else if (conn->shutdown)
@@ -445,6 +513,7 @@ auth_worker_call(pool_t pool, const char *username, const char *data,
 	request->data = p_strdup(pool, data);
 	request->callback = callback;
 	request->context = context;
+	request->exclusive = str_begins(data, "LIST\t");
 
 	if (aqueue_count(worker_request_queue) > 0) {
 		/* requests are already being queued, no chance of
@@ -456,6 +525,11 @@ auth_worker_call(pool_t pool, const char *username, const char *data,
 			/* no free connections, create a new one */
 			conn = auth_worker_create();
 		}
+		if (conn == NULL) {
+			/* reached the limit, pipeline the request if the
+			   workers allow it */
+			conn = auth_worker_find_least_busy(request);
+		}
 	}
 	if (conn != NULL) {
 		if (!auth_worker_request_send(conn, request))
@@ -469,7 +543,7 @@ auth_worker_call(pool_t pool, const char *username, const char *data,
 
 void auth_worker_server_resume_input(struct auth_worker_connection *conn)
 {
-	if (conn->request == NULL) {
+	if (conn->request_count == 0) {
 		/* request was just finished, don't try to resume it */
 		return;
 	}
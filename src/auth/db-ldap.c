@@ -124,6 +124,8 @@ static struct setting_def setting_defs[] = {
 	DEF_STR(default_pass_scheme),
 	DEF_BOOL(userdb_warning_disable),
 	DEF_BOOL(blocking),
+	DEF_INT(connections),
+	DEF_INT(max_pending_requests),
 
 	{ 0, NULL, 0 }
 };
@@ -160,7 +162,9 @@ static struct ldap_settings default_ldap_settings = {
 	.iterate_filter = "(objectClass=posixAccount)",
 	.default_pass_scheme = "crypt",
 	.userdb_warning_disable = FALSE,
-	.blocking = FALSE
+	.blocking = FALSE,
+	.connections = 1,
+	.max_pending_requests = DB_LDAP_DEFAULT_MAX_PENDING_REQUESTS
 };
 
 static struct ldap_connection *ldap_connections = NULL;
@@ -252,6 +256,7 @@ const char *ldap_get_error(struct ldap_connection *conn)
 
 static void ldap_conn_reconnect(struct ldap_connection *conn)
 {
+	conn->last_failure_stamp = ioloop_time;
 	db_ldap_conn_close(conn);
 	if (db_ldap_connect(conn) < 0)
 		db_ldap_conn_close(conn);
@@ -366,7 +371,7 @@ static bool db_ldap_request_queue_next(struct ldap_connection *conn)
 		/* no non-pending requests */
 		return FALSE;
 	}
-	if (conn->pending_count > DB_LDAP_MAX_PENDING_REQUESTS) {
+	if (conn->pending_count > conn->set.max_pending_requests) {
 		/* wait until server has replied to some requests */
 		return FALSE;
 	}
@@ -413,6 +418,15 @@ static bool db_ldap_request_queue_next(struct ldap_connection *conn)
 		/* success */
 		i_assert(request->msgid != -1);
 		conn->pending_count++;
+
+		struct event_passthrough *e =
+			event_create_passthrough(
+				authdb_event(request->auth_request))->
+			set_name("ldap_request_sent")->
+			add_int("queue_msecs", timeval_diff_msecs(
+				&ioloop_timeval, &request->create_timeval))->
+			add_int("pending_count", conn->pending_count);
+		e_debug(e->event(), "Sent LDAP request");
 		return TRUE;
 	} else if (ret < 0) {
 		/* disconnected */
@@ -446,13 +460,54 @@ db_ldap_check_hanging(struct ldap_connection *conn, struct ldap_request *request
 	}
 }
 
+static bool db_ldap_conn_is_failing(struct ldap_connection *conn)
+{
+	return conn->conn_state == LDAP_CONN_STATE_DISCONNECTED &&
+		conn->last_failure_stamp + DB_LDAP_CONN_FAILURE_AVOID_SECS >
+		ioloop_time;
+}
+
+static struct ldap_connection *
+db_ldap_get_least_busy_conn(struct ldap_connection *conn)
+{
+	struct ldap_connection *const *connp, *best;
+	bool best_failing;
+
+	if (conn->main_conn != NULL)
+		conn = conn->main_conn;
+	if (!array_is_created(&conn->extra_conns))
+		return conn;
+
+	/* prefer connections that haven't recently failed, and then the
+	   ones with the fewest requests in queue */
+	best = conn;
+	best_failing = db_ldap_conn_is_failing(conn);
+	array_foreach(&conn->extra_conns, connp) {
+		bool failing = db_ldap_conn_is_failing(*connp);
+
+		if (failing != best_failing) {
+			if (failing)
+				continue;
+		} else if (aqueue_count((*connp)->request_queue) >=
+			   aqueue_count(best->request_queue)) {
+			continue;
+		}
+		best = *connp;
+		best_failing = failing;
+	}
+	return best;
+}
+
 void db_ldap_request(struct ldap_connection *conn,
 		     struct ldap_request *request)
 {
 	i_assert(request->auth_request != NULL);
 
+	conn = db_ldap_get_least_busy_conn(conn);
+
 	request->msgid = -1;
 	request->create_time = ioloop_time;
+	request->create_timeval = ioloop_timeval;
 
 	db_ldap_check_hanging(conn, request);
 
@@ -466,12 +521,14 @@ static int db_ldap_connect_finish(struct ldap_connection *conn, int ret)
 		i_error("LDAP: Can't connect to server: %s",
 			conn->set.uris != NULL ?
 			conn->set.uris : conn->set.hosts);
+		conn->last_failure_stamp = ioloop_time;
 		return -1;
 	}
 	if (ret != LDAP_SUCCESS) {
 		i_error("LDAP: binding failed (dn %s): %s",
 			conn->set.dn == NULL ? "(none)" : conn->set.dn,
 			ldap_get_error(conn));
+		conn->last_failure_stamp = ioloop_time;
 		return -1;
 	}
 
@@ -1879,6 +1936,32 @@ static struct ldap_connection *ldap_conn_find(const char *config_path)
 	return NULL;
 }
 
+static void db_ldap_init_extra_conn(struct ldap_connection *main_conn)
+{
+	struct ldap_connection *conn;
+	pool_t pool;
+
+	/* the settings are shared with the main connection, which is
+	   freed last */
+	pool = pool_alloconly_create("ldap_connection", 1024);
+	conn = p_new(pool, struct ldap_connection, 1);
+	conn->pool = pool;
+	conn->refcount = 1;
+	conn->main_conn = main_conn;
+
+	conn->conn_state = LDAP_CONN_STATE_DISCONNECTED;
+	conn->default_bind_msgid = -1;
+	conn->fd = -1;
+	conn->config_path = main_conn->config_path;
+	conn->set = main_conn->set;
+
+	i_array_init(&conn->request_array, 512);
+	conn->request_queue = aqueue_init(&conn->request_array.arr);
+
+	db_ldap_init_ld(conn);
+	array_push_back(&main_conn->extra_conns, &conn);
+}
+
 struct ldap_connection *db_ldap_init(const char *config_path, bool userdb)
 {
 	struct ldap_connection *conn;
@@ -1959,6 +2042,10 @@ struct ldap_connection *db_ldap_init(const char *config_path, bool userdb)
 		i_fatal("LDAP %s: Unknown deref option '%s'", config_path, conn->set.deref);
 	if (scope2str(conn->set.scope, &conn->set.ldap_scope) < 0)
 		i_fatal("LDAP %s: Unknown scope option '%s'", config_path, conn->set.scope);
+	if (conn->set.connections == 0)
+		i_fatal("LDAP %s: connections must be at least 1", config_path);
+	if (conn->set.max_pending_requests == 0)
+		i_fatal("LDAP %s: max_pending_requests must be at least 1", config_path);
 
 	i_array_init(&conn->request_array, 512);
 	conn->request_queue = aqueue_init(&conn->request_array.arr);
@@ -1967,9 +2054,30 @@ struct ldap_connection *db_ldap_init(const char *config_path, bool userdb)
         ldap_connections = conn;
 
 	db_ldap_init_ld(conn);
+
+	if (conn->set.connections > 1) {
+		unsigned int i;
+
+		i_array_init(&conn->extra_conns, conn->set.connections - 1);
+		for (i = 1; i < conn->set.connections; i++)
+			db_ldap_init_extra_conn(conn);
+	}
 	return conn;
 }
 
+static void db_ldap_conn_free(struct ldap_connection *conn)
+{
+	db_ldap_abort_requests(conn, UINT_MAX, 0, FALSE, "Shutting down");
+	i_assert(conn->pending_count == 0);
+	db_ldap_conn_close(conn);
+	i_assert(conn->to == NULL);
+
+	array_free(&conn->request_array);
+	aqueue_deinit(&conn->request_queue);
+
+	pool_unref(&conn->pool);
+}
+
 void db_ldap_unref(struct ldap_connection **_conn)
 {
         struct ldap_connection *conn = *_conn;
@@ -1987,15 +2095,14 @@ void db_ldap_unref(struct ldap_connection **_conn)
 		}
 	}
 
-	db_ldap_abort_requests(conn, UINT_MAX, 0, FALSE, "Shutting down");
-	i_assert(conn->pending_count == 0);
-	db_ldap_conn_close(conn);
-	i_assert(conn->to == NULL);
-
-	array_free(&conn->request_array);
-	aqueue_deinit(&conn->request_queue);
+	if (array_is_created(&conn->extra_conns)) {
+		struct ldap_connection **connp;
 
-	pool_unref(&conn->pool);
+		array_foreach_modifiable(&conn->extra_conns, connp)
+			db_ldap_conn_free(*connp);
+		array_free(&conn->extra_conns);
+	}
+	db_ldap_conn_free(conn);
 }
 
 #ifndef BUILTIN_LDAP
@@ -5,8 +5,9 @@
    This define enables them until the code here can be refactored */
 #define LDAP_DEPRECATED 1
 
-/* Maximum number of pending requests before delaying new requests. */
-#define DB_LDAP_MAX_PENDING_REQUESTS 8
+/* Default maximum number of pending requests per connection before
+   delaying new requests. */
+#define DB_LDAP_DEFAULT_MAX_PENDING_REQUESTS 8
 /* connect() timeout to LDAP */
 #define DB_LDAP_CONNECT_TIMEOUT_SECS 5
 /* If LDAP connection is down, fail requests after waiting for this long. */
@@ -17,6 +18,9 @@
 /* If server disconnects us, don't reconnect if no requests have been sent
    for this many seconds. */
 #define DB_LDAP_IDLE_RECONNECT_SECS 60
+/* Don't send new requests to a connection that failed less than this many
+   seconds ago, if there are other connections. */
+#define DB_LDAP_CONN_FAILURE_AVOID_SECS 10
 
 #include <ldap.h>
 
@@ -67,6 +71,8 @@ struct ldap_settings {
 	const char *default_pass_scheme;
 	bool userdb_warning_disable; /* deprecated for now at least */
 	bool blocking;
+	unsigned int connections;
+	unsigned int max_pending_requests;
 
 	/* ... */
 	int ldap_deref, ldap_scope, ldap_tls_require_cert_parsed;
@@ -103,6 +109,9 @@ struct ldap_request {
 	int msgid;
 	/* timestamp when request was created */
 	time_t create_time;
+	/* same as create_time, but more precise for reporting the time spent
+	   waiting in the queue */
+	struct timeval create_timeval;
 
 	bool failed:1;
 	/* This is to prevent double logging the result */
@@ -176,6 +185,14 @@ struct ldap_connection {
 
 	/* Timestamp when we last received a reply */
 	time_t last_reply_stamp;
+	/* Timestamp when the connection last failed */
+	time_t last_failure_stamp;
+
+	/* With connections > 1 the first connection has the rest in
+	   extra_conns, and they have main_conn pointing to it. A new request
+	   is sent via the connection with the fewest queued requests. */
+	ARRAY(struct ldap_connection *) extra_conns;
+	struct ldap_connection *main_conn;
 
 	char **pass_attr_names, **user_attr_names, **iterate_attr_names;
 	ARRAY_TYPE(ldap_field) pass_attr_map, user_attr_map, iterate_attr_map;
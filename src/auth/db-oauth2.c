@@ -1,8 +1,13 @@
 /* Copyright (c) 2017-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "ioloop.h"
 #include "array.h"
+#include "hash.h"
 #include "str.h"
+#include "strnum.h"
+#include "sha2.h"
+#include "hex-binary.h"
 #include "var-expand.h"
 #include "env-util.h"
 #include "var-expand.h"
@@ -65,6 +70,13 @@ struct passdb_oauth2_settings {
 	unsigned int max_pipelined_requests;
 	bool tls_allow_invalid_cert;
 
+	/* how long successful token validation results are cached,
+	   0 disables the cache. The token's own expiration time is used
+	   if it's sooner. */
+	unsigned int token_cache_ttl_secs;
+	/* maximum number of cached token validation results */
+	unsigned int token_cache_max_entries;
+
 	bool debug;
 	/* Should introspection be done even if not necessary */
 	bool force_introspection;
@@ -73,6 +85,16 @@ struct passdb_oauth2_settings {
 	bool use_grant_password;
 };
 
+struct db_oauth2_token_cache_entry {
+	struct db_oauth2_token_cache_entry *prev, *next;
+
+	pool_t pool;
+	/* hex(SHA256(token)) - the token itself isn't kept */
+	const char *key;
+	ARRAY_TYPE(oauth2_field) fields;
+	time_t expires;
+};
+
 struct db_oauth2 {
 	struct db_oauth2 *prev,*next;
 
@@ -86,6 +108,11 @@ struct db_oauth2 {
 
 	struct db_oauth2_request *head;
 
+	HASH_TABLE(const char *, struct db_oauth2_token_cache_entry *) token_cache;
+	/* sorted by insertion time */
+	struct db_oauth2_token_cache_entry *token_cache_head, *token_cache_tail;
+	unsigned int token_cache_count;
+
 	unsigned int refcount;
 };
 
@@ -119,6 +146,8 @@ static struct setting_def setting_defs[] = {
 	DEF_INT(max_pipelined_requests),
 	DEF_BOOL(send_auth_headers),
 	DEF_BOOL(use_grant_password),
+	DEF_INT(token_cache_ttl_secs),
+	DEF_INT(token_cache_max_entries),
 
 	DEF_STR(tls_ca_cert_file),
 	DEF_STR(tls_ca_cert_dir),
@@ -153,6 +182,8 @@ static struct passdb_oauth2_settings default_oauth2_settings = {
 	.max_idle_time_msecs = 60000,
 	.max_parallel_connections = 1,
 	.max_pipelined_requests = 1,
+	.token_cache_ttl_secs = 0,
+	.token_cache_max_entries = 10000,
 	.tls_ca_cert_file = NULL,
 	.tls_ca_cert_dir = NULL,
 	.tls_cert_file = NULL,
@@ -256,11 +287,113 @@ struct db_oauth2 *db_oauth2_init(const char *config_path)
 			db->set.introspection_mode);
 	}
 
+	if (db->set.token_cache_ttl_secs > 0) {
+		if (db->set.use_grant_password)
+			i_fatal("oauth2: token_cache_ttl_secs can't be used with use_grant_password");
+		if (db->set.token_cache_max_entries == 0)
+			i_fatal("oauth2: token_cache_max_entries must be larger than 0");
+		hash_table_create(&db->token_cache, default_pool, 0,
+				  str_hash, strcmp);
+	}
+
 	DLLIST_PREPEND(&db_oauth2_head, db);
 
 	return db;
 }
 
+static void
+db_oauth2_token_cache_entry_free(struct db_oauth2 *db,
+				 struct db_oauth2_token_cache_entry *entry)
+{
+	hash_table_remove(db->token_cache, entry->key);
+	DLLIST2_REMOVE(&db->token_cache_head, &db->token_cache_tail, entry);
+	db->token_cache_count--;
+	pool_unref(&entry->pool);
+}
+
+static const char *db_oauth2_token_cache_key(const char *token)
+{
+	unsigned char digest[SHA256_RESULTLEN];
+
+	sha256_get_digest(token, strlen(token), digest);
+	return binary_to_hex(digest, sizeof(digest));
+}
+
+static struct db_oauth2_token_cache_entry *
+db_oauth2_token_cache_lookup(struct db_oauth2 *db, const char *token)
+{
+	struct db_oauth2_token_cache_entry *entry;
+
+	if (!hash_table_is_created(db->token_cache))
+		return NULL;
+
+	entry = hash_table_lookup(db->token_cache,
+				  db_oauth2_token_cache_key(token));
+	if (entry == NULL)
+		return NULL;
+	if (entry->expires <= ioloop_time) {
+		db_oauth2_token_cache_entry_free(db, entry);
+		return NULL;
+	}
+	return entry;
+}
+
+static void db_oauth2_token_cache_add(struct db_oauth2_request *req)
+{
+	struct db_oauth2 *db = req->db;
+	struct db_oauth2_token_cache_entry *entry;
+	const ARRAY_TYPE(auth_field) *fields;
+	const struct auth_field *field;
+	struct oauth2_field *cfield;
+	const char *key, *value;
+	time_t expires, exp;
+	unsigned int expires_in;
+
+	if (!hash_table_is_created(db->token_cache))
+		return;
+
+	/* don't cache the result for longer than the token is valid.
+	   Introspection returns the absolute "exp", tokeninfo endpoints
+	   commonly the relative "expires_in". */
+	expires = ioloop_time + db->set.token_cache_ttl_secs;
+	value = auth_fields_find(req->fields, "exp");
+	if (value != NULL && str_to_time(value, &exp) == 0 && exp < expires)
+		expires = exp;
+	value = auth_fields_find(req->fields, "expires_in");
+	if (value != NULL && str_to_uint(value, &expires_in) == 0 &&
+	    ioloop_time + (time_t)expires_in < expires)
+		expires = ioloop_time + expires_in;
+	if (expires <= ioloop_time)
+		return;
+
+	key = db_oauth2_token_cache_key(req->token);
+	entry = hash_table_lookup(db->token_cache, key);
+	if (entry != NULL)
+		db_oauth2_token_cache_entry_free(db, entry);
+	while (db->token_cache_head != NULL &&
+	       (db->token_cache_head->expires <= ioloop_time ||
+		db->token_cache_count >= db->set.token_cache_max_entries))
+		db_oauth2_token_cache_entry_free(db, db->token_cache_head);
+
+	pool_t pool = pool_alloconly_create("oauth2 token cache entry", 512);
+	entry = p_new(pool, struct db_oauth2_token_cache_entry, 1);
+	entry->pool = pool;
+	entry->key = p_strdup(pool, key);
+	entry->expires = expires;
+
+	fields = auth_fields_export(req->fields);
+	p_array_init(&entry->fields, pool, array_count(fields));
+	array_foreach(fields, field) {
+		cfield = array_append_space(&entry->fields);
+		cfield->name = p_strdup(pool, field->key);
+		cfield->value = p_strdup(pool, field->value);
+	}
+
+	hash_table_insert(db->token_cache, entry->key, entry);
+	DLLIST2_APPEND(&db->token_cache_head, &db->token_cache_tail, entry);
+	db->token_cache_count++;
+}
+
 void db_oauth2_ref(struct db_oauth2 *db)
 {
 	i_assert(db->refcount > 0);
@@ -287,6 +420,14 @@ void db_oauth2_unref(struct db_oauth2 **_db)
 	while (db->head != NULL)
 		oauth2_request_abort(&db->head->req);
 
+	if (hash_table_is_created(db->token_cache)) {
+		while (db->token_cache_head != NULL) {
+			db_oauth2_token_cache_entry_free(db,
+				db->token_cache_head);
+		}
+		hash_table_destroy(&db->token_cache);
+	}
+
 	http_client_deinit(&db->client);
 
 	pool_unref(&db->pool);
@@ -572,6 +713,8 @@ db_oauth2_introspect_continue(struct oauth2_request_result *result,
 	} else {
 		db_oauth2_fields_merge(req, result->fields);
 		db_oauth2_process_fields(req, &passdb_result, &error);
+		if (passdb_result == PASSDB_RESULT_OK)
+			db_oauth2_token_cache_add(req);
 	}
 	db_oauth2_callback(req, passdb_result, error);
 }
@@ -675,6 +818,8 @@ db_oauth2_lookup_continue(struct oauth2_request_result *result,
 			return;
 		}
 		db_oauth2_process_fields(req, &passdb_result, &error);
+		if (passdb_result == PASSDB_RESULT_OK)
+			db_oauth2_token_cache_add(req);
 	}
 	db_oauth2_callback(req, passdb_result, error);
 }
@@ -684,6 +829,7 @@ void db_oauth2_lookup(struct db_oauth2 *db, struct db_oauth2_request *req,
 		      const char *token, struct auth_request *request,
 		      db_oauth2_lookup_callback_t *callback, void *context)
 {
+	struct db_oauth2_token_cache_entry *entry;
 	struct oauth2_request_input input;
 	i_zero(&input);
 
@@ -693,6 +839,21 @@ void db_oauth2_lookup(struct db_oauth2 *db, struct db_oauth2_request *req,
 	req->context = context;
 	req->auth_request = request;
 
+	if ((entry = db_oauth2_token_cache_lookup(db, token)) != NULL) {
+		enum passdb_result passdb_result;
+		const char *error;
+
+		/* The token is known to be valid. The fields still need to
+		   be checked against this request's username. */
+		e_debug(authdb_event(req->auth_request),
+			"oauth2: Using cached token validation result");
+		DLLIST_PREPEND(&db->head, req);
+		db_oauth2_fields_merge(req, &entry->fields);
+		db_oauth2_process_fields(req, &passdb_result, &error);
+		db_oauth2_callback(req, passdb_result, error);
+		return;
+	}
+
 	input.token = token;
 	input.local_ip = req->auth_request->local_ip;
 	input.local_port = req->auth_request->local_port;
@@ -156,13 +156,19 @@ passwd_file_new(struct db_passwd_file *db, const char *expanded_path)
 	pw = i_new(struct passwd_file, 1);
 	pw->db = db;
 	pw->path = i_strdup(expanded_path);
-	pw->fd = -1;
 
 	if (hash_table_is_created(db->files))
 		hash_table_insert(db->files, pw->path, pw);
 	return pw;
 }
 
+static void passwd_file_close(struct passwd_file *pw)
+{
+	if (hash_table_is_created(pw->users))
+		hash_table_destroy(&pw->users);
+	pool_unref(&pw->pool);
+}
+
 static int passwd_file_open(struct passwd_file *pw, bool startup,
 			    const char **error_r)
 {
@@ -171,7 +177,7 @@ static int passwd_file_open(struct passwd_file *pw, bool startup,
 	const char *line;
 	struct stat st;
 	time_t start_time, end_time;
-	unsigned int time_secs;
+	unsigned int time_secs, initial_size = 0;
 	int fd;
 
 	fd = open(pw->path, O_RDONLY);
@@ -192,15 +198,23 @@ static int passwd_file_open(struct passwd_file *pw, bool startup,
 		return -1;
 	}
 
-	pw->fd = fd;
+	/* The file could be opened, so replace the old users only now.
+	   If reopening fails, lookups keep using the old users. Size the new
+	   hash table by the old user count, so reloading a large file
+	   doesn't need to keep growing it. */
+	if (hash_table_is_created(pw->users)) {
+		initial_size = hash_table_count(pw->users);
+		passwd_file_close(pw);
+	}
 	pw->stamp = st.st_mtime;
 	pw->size = st.st_size;
 
 	pw->pool = pool_alloconly_create(MEMPOOL_GROWING"passwd_file", 10240);
-	hash_table_create(&pw->users, pw->pool, 0, str_hash, strcmp);
+	hash_table_create(&pw->users, pw->pool, initial_size,
+			  str_hash, strcmp);
 
 	start_time = time(NULL);
-	input = i_stream_create_fd(pw->fd, (size_t)-1);
+	input = i_stream_create_fd(fd, (size_t)-1);
 	i_stream_set_return_partial_line(input, TRUE);
 	while ((line = i_stream_read_next_line(input)) != NULL) {
 		if (*line == '\0' || *line == ':' || *line == '#')
@@ -218,6 +232,8 @@ static int passwd_file_open(struct passwd_file *pw, bool startup,
 		} T_END;
 	}
 	i_stream_destroy(&input);
+	/* the users are all in memory now, so don't keep the file open */
+	i_close_fd_path(&fd, pw->path);
 	end_time = time(NULL);
 	time_secs = end_time - start_time;
 
@@ -232,14 +248,6 @@ static int passwd_file_open(struct passwd_file *pw, bool startup,
 	return 0;
 }
 
-static void passwd_file_close(struct passwd_file *pw)
-{
-	i_close_fd_path(&pw->fd, pw->path);
-
-	hash_table_destroy(&pw->users);
-	pool_unref(&pw->pool);
-}
-
 static void passwd_file_free(struct passwd_file *pw)
 {
 	if (hash_table_is_created(pw->db->files))
@@ -283,11 +291,12 @@ static int passwd_file_sync(struct auth_request *request,
 	}
 
 	if (st.st_mtime != pw->stamp || st.st_size != pw->size) {
-		passwd_file_close(pw);
 		if (passwd_file_open(pw, FALSE, &error) < 0) {
 			e_error(authdb_event(request),
 				"%s", error);
-			return -1;
+			if (!hash_table_is_created(pw->users))
+				return -1;
+			/* keep using the previously read users */
 		}
 	}
 	return 1;
@@ -24,7 +24,6 @@ struct passwd_file {
 	char *path;
 	time_t stamp;
 	off_t size;
-	int fd;
 
 	HASH_TABLE(char *, struct passwd_user *) users;
 };
@@ -5,6 +5,7 @@
 #if defined(PASSDB_SQL) || defined(USERDB_SQL)
 
 #include "settings.h"
+#include "str.h"
 #include "auth-request.h"
 #include "auth-worker-client.h"
 #include "db-sql.h"
@@ -53,6 +54,133 @@ static struct db_sql_connection *sql_conn_find(const char *config_path)
 	return NULL;
 }
 
+bool db_sql_query_parse(pool_t pool, const char *query_str,
+			const char **template_r, ARRAY_TYPE(const_string) *params)
+{
+	string_t *template = t_str_new(128);
+	string_t *literal = t_str_new(64);
+	const char *p, *start, *value;
+	bool escape_string;
+
+	p_array_init(params, pool, 4);
+	for (p = query_str; *p != '\0'; p++) {
+		if (*p == '%' || *p == '?' || *p == '\\') {
+			/* %variables outside quotes can't be parameters, and
+			   "?" would be confused with one */
+			return FALSE;
+		}
+		if (*p == '"') {
+			/* quoted identifier */
+			start = p;
+			if ((p = strchr(p + 1, '"')) == NULL)
+				return FALSE;
+			value = t_strdup_until(start, p);
+			if (strpbrk(value, "%?") != NULL)
+				return FALSE;
+			str_append(template, value);
+			str_append_c(template, '"');
+			continue;
+		}
+		if (*p != '\'') {
+			str_append_c(template, *p);
+			continue;
+		}
+
+		/* E'...' is a PostgreSQL string with backslash escapes */
+		escape_string = p > query_str && i_toupper(p[-1]) == 'E' &&
+			(p - 1 == query_str ||
+			 (!i_isalnum(p[-2]) && p[-2] != '_'));
+		start = p;
+		str_truncate(literal, 0);
+		for (p++;; p++) {
+			if (*p == '\0')
+				return FALSE;
+			if (*p == '\\') {
+				/* outside E'' strings backslashes depend on
+				   standard_conforming_strings */
+				if (!escape_string || p[1] == '\0')
+					return FALSE;
+				str_append_c(literal, *p++);
+			} else if (*p == '\'') {
+				if (p[1] != '\'')
+					break;
+				/* '' is an escaped quote */
+				p++;
+			}
+			str_append_c(literal, *p);
+		}
+		value = str_c(literal);
+		if (strchr(value, '?') != NULL)
+			return FALSE;
+		if (strchr(value, '%') == NULL)
+			str_append_data(template, start, p - start + 1);
+		else if (escape_string) {
+			/* the parameter would need its backslash escapes
+			   unescaped */
+			return FALSE;
+		} else {
+			/* the parameter value is the unescaped literal */
+			str_append_c(template, '?');
+			value = p_strdup(pool, value);
+			array_push_back(params, &value);
+		}
+	}
+	*template_r = p_strdup(pool, str_c(template));
+	return TRUE;
+}
+
+static void
+db_sql_query_init(struct db_sql_connection *conn, struct db_sql_query *query,
+		  const char *query_str)
+{
+	query->query = query_str;
+	if ((sql_get_flags(conn->db) & SQL_DB_FLAG_PREP_STATEMENTS) == 0)
+		return;
+	if (!db_sql_query_parse(conn->pool, query_str, &query->template,
+				&query->params))
+		return;
+	query->prep_stmt = sql_prepared_statement_init(conn->db,
+						       query->template);
+}
+
+static void db_sql_query_deinit(struct db_sql_query *query)
+{
+	if (query->prep_stmt != NULL)
+		sql_prepared_statement_deinit(&query->prep_stmt);
+}
+
+int db_sql_query_expand(struct db_sql_query *query,
+			const struct auth_request *auth_request,
+			auth_request_escape_func_t *escape_func,
+			struct sql_statement **stmt_r, const char **query_r,
+			const char **error_r)
+{
+	const char *const *params, **values;
+	unsigned int i, count;
+	int ret;
+
+	if (query->prep_stmt == NULL) {
+		*stmt_r = NULL;
+		return t_auth_request_var_expand(query->query, auth_request,
+						 escape_func, query_r, error_r);
+	}
+
+	params = array_get(&query->params, &count);
+	values = t_new(const char *, count);
+	for (i = 0; i < count; i++) {
+		ret = t_auth_request_var_expand(params[i], auth_request, NULL,
+						&values[i], error_r);
+		if (ret <= 0)
+			return ret;
+	}
+
+	*stmt_r = sql_statement_init_prepared(query->prep_stmt);
+	for (i = 0; i < count; i++)
+		sql_statement_bind_str(*stmt_r, i, values[i]);
+	*query_r = query->template;
+	return 1;
+}
+
 static const char *parse_setting(const char *key, const char *value,
 				 struct db_sql_connection *conn)
 {
@@ -113,6 +241,9 @@ struct db_sql_connection *db_sql_init(const char *config_path, bool userdb)
 	if (sql_init_full(&set, &conn->db, &error) < 0) {
 		i_fatal("sql: %s", error);
 	}
+	db_sql_query_init(conn, &conn->password_query,
+			  conn->set.password_query);
+	db_sql_query_init(conn, &conn->user_query, conn->set.user_query);
 
 	conn->next = connections;
 	connections = conn;
@@ -131,6 +262,8 @@ void db_sql_unref(struct db_sql_connection **_conn)
 	if (--conn->refcount > 0)
 		return;
 
+	db_sql_query_deinit(&conn->password_query);
+	db_sql_query_deinit(&conn->user_query);
 	sql_deinit(&conn->db);
 	pool_unref(&conn->pool);
 }
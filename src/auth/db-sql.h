@@ -2,6 +2,7 @@
 #define DB_SQL_H
 
 #include "sql-api.h"
+#include "auth-request-var-expand.h"
 
 struct db_sql_settings {
 	const char *driver;
@@ -14,6 +15,18 @@ struct db_sql_settings {
 	bool userdb_warning_disable;
 };
 
+struct db_sql_query {
+	const char *query;
+
+	/* With drivers supporting prepared statements, the query with each
+	   quoted literal containing %variables replaced by "?". The literals
+	   are expanded unescaped into params. NULL if the query can't be
+	   sent as a prepared statement. */
+	const char *template;
+	ARRAY_TYPE(const_string) params;
+	struct sql_prepared_statement *prep_stmt;
+};
+
 struct db_sql_connection {
 	struct db_sql_connection *next;
 
@@ -24,6 +37,9 @@ struct db_sql_connection {
 	struct db_sql_settings set;
 	struct sql_db *db;
 
+	struct db_sql_query password_query;
+	struct db_sql_query user_query;
+
 	bool default_password_query:1;
 	bool default_user_query:1;
 	bool default_update_query:1;
@@ -39,4 +55,21 @@ void db_sql_success(struct db_sql_connection *conn);
 
 void db_sql_check_userdb_warning(struct db_sql_connection *conn);
 
+/* Parse query_str into a prepared statement template, where each quoted
+   literal containing %variables is replaced by "?" and added unescaped to
+   params. Returns FALSE if the query can't be converted safely. */
+bool db_sql_query_parse(pool_t pool, const char *query_str,
+			const char **template_r, ARRAY_TYPE(const_string) *params);
+
+/* Expand the query for the auth request. If it can be sent as a prepared
+   statement, it's returned in stmt_r with the parameters bound, and
+   query_r is the statement's template. Otherwise stmt_r is set to NULL and
+   query_r is the query expanded using escape_func. Returns the same as
+   t_auth_request_var_expand(). */
+int db_sql_query_expand(struct db_sql_query *query,
+			const struct auth_request *auth_request,
+			auth_request_escape_func_t *escape_func,
+			struct sql_statement **stmt_r, const char **query_r,
+			const char **error_r);
+
 #endif
@@ -294,6 +294,7 @@ static void main_deinit(void)
 	passdb_cache_deinit();
         password_schemes_deinit();
 	auth_request_stats_deinit();
+	auth_request_var_expand_deinit();
 
 	sql_drivers_deinit();
 	child_wait_deinit();
@@ -100,6 +100,63 @@ void passdb_blocking_verify_plain(struct auth_request *request)
 			 verify_plain_callback, request);
 }
 
+struct passdb_blocking_verify_context {
+	struct auth_request *request;
+	verify_plain_callback_t *callback;
+};
+
+static bool
+verify_password_callback(const char *reply, void *context)
+{
+	struct passdb_blocking_verify_context *ctx = context;
+	struct auth_request *request = ctx->request;
+	enum passdb_result result;
+
+	result = passdb_blocking_auth_worker_reply_parse(request, reply);
+	ctx->callback(result, request);
+	auth_request_unref(&request);
+	return TRUE;
+}
+
+bool passdb_blocking_verify_password(struct auth_request *request,
+				     const char *crypted_password,
+				     const char *scheme,
+				     verify_plain_callback_t *callback)
+{
+	struct passdb_blocking_verify_context *ctx;
+	string_t *str;
+
+	if (!request->set->verify_slow_password_with_worker || worker)
+		return FALSE;
+	if (!password_scheme_is_slow(scheme))
+		return FALSE;
+	/* these don't need the password to be verified at all */
+	if (request->skip_password_check || request->passdb->set->deny ||
+	    auth_fields_exists(request->extra_fields, "nopassword"))
+		return FALSE;
+
+	str = t_str_new(128);
+	str_printfa(str, "VERIFY\t%u\t", request->passdb->passdb->id);
+	str_append_tabescaped(str, request->mech_password);
+	str_append_c(str, '\t');
+	str_append_tabescaped(str, t_strdup_printf("{%s}%s", scheme,
+						   crypted_password));
+	str_append_c(str, '\t');
+	auth_request_export(request, str);
+
+	e_debug(authdb_event(request),
+		"Verifying %s password on worker", scheme);
+
+	ctx = p_new(request->pool, struct passdb_blocking_verify_context, 1);
+	ctx->request = request;
+	ctx->callback = callback;
+
+	auth_request_ref(request);
+	auth_worker_call(request->pool, request->user, str_c(str),
+			 verify_password_callback, ctx);
+	return TRUE;
+}
+
 static bool lookup_credentials_callback(const char *reply, void *context)
 {
 	struct auth_request *request = context;
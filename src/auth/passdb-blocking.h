@@ -4,6 +4,14 @@
 enum passdb_result
 passdb_blocking_auth_worker_reply_parse(struct auth_request *request, const char *reply);
 void passdb_blocking_verify_plain(struct auth_request *request);
+/* Verify the crypted password on an auth worker process if it uses a slow
+   scheme and auth_verify_slow_password_with_worker is enabled. Returns TRUE
+   if the callback is called later with the result, FALSE if the caller
+   should verify the password itself. */
+bool passdb_blocking_verify_password(struct auth_request *request,
+				     const char *crypted_password,
+				     const char *scheme,
+				     verify_plain_callback_t *callback);
 void passdb_blocking_lookup_credentials(struct auth_request *request);
 void passdb_blocking_set_credentials(struct auth_request *request,
 				     const char *new_credentials);
@@ -3,6 +3,8 @@
 #include "auth-common.h"
 #include "str.h"
 #include "strescape.h"
+#include "hex-binary.h"
+#include "md5.h"
 #include "restrict-process-size.h"
 #include "auth-request-stats.h"
 #include "auth-worker-server.h"
@@ -10,8 +12,10 @@
 #include "passdb.h"
 #include "passdb-cache.h"
 #include "passdb-blocking.h"
+#include "userdb.h"
 
 struct auth_cache *passdb_cache = NULL;
+static char *passdb_cache_file = NULL, *passdb_cache_version = NULL;
 
 static void
 passdb_cache_log_hit(struct auth_request *request, const char *value)
@@ -49,6 +53,16 @@ passdb_cache_lookup(struct auth_request *request, const char *key,
 	stats->auth_cache_hit_count++;
 	passdb_cache_log_hit(request, value);
 
+	if (!expired && request->set->cache_refresh_ahead > 0 &&
+	    !(*node_r)->refreshing &&
+	    auth_cache_node_expires_within(passdb_cache, *node_r,
+					   request->set->cache_refresh_ahead)) {
+		/* use the cached value now, but refresh it before it
+		   expires */
+		(*node_r)->refreshing = TRUE;
+		auth_request_passdb_cache_refresh(request);
+	}
+
 	*value_r = value;
 	return TRUE;
 }
@@ -194,10 +208,32 @@ void passdb_cache_init(const struct auth_settings *set)
 	}
 	passdb_cache = auth_cache_new(set->cache_size, set->cache_ttl,
 				      set->cache_negative_ttl);
+
+	if (set->cache_file[0] != '\0') {
+		unsigned char passdb_md5[MD5_RESULTLEN];
+		unsigned char userdb_md5[MD5_RESULTLEN];
+
+		/* the cache keys contain the passdb/userdb IDs, so the
+		   saved cache can be used only if they haven't changed */
+		passdbs_generate_md5(passdb_md5);
+		userdbs_generate_md5(userdb_md5);
+		passdb_cache_file = i_strdup(set->cache_file);
+		passdb_cache_version = i_strconcat(
+			binary_to_hex(passdb_md5, sizeof(passdb_md5)), "\t",
+			binary_to_hex(userdb_md5, sizeof(userdb_md5)), NULL);
+		(void)auth_cache_load(passdb_cache, passdb_cache_file,
+				      passdb_cache_version);
+	}
 }
 
 void passdb_cache_deinit(void)
 {
+	if (passdb_cache != NULL && passdb_cache_file != NULL) {
+		(void)auth_cache_save(passdb_cache, passdb_cache_file,
+				      passdb_cache_version);
+	}
 	if (passdb_cache != NULL)
 		auth_cache_free(&passdb_cache);
+	i_free(passdb_cache_file);
+	i_free(passdb_cache_version);
 }
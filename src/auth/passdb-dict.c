@@ -9,6 +9,7 @@
 #include "dict.h"
 #include "password-scheme.h"
 #include "auth-cache.h"
+#include "passdb-blocking.h"
 #include "db-dict.h"
 
 #include <string.h>
@@ -111,6 +112,10 @@ static void passdb_dict_lookup_pass(struct passdb_dict_request *dict_request)
 			dict_request->callback.lookup_credentials,
 			auth_request);
 	} else {
+		if (password != NULL &&
+		    passdb_blocking_verify_password(auth_request, password,
+				scheme, dict_request->callback.verify_plain))
+			return;
 		if (password != NULL) {
 			ret = auth_request_password_verify(auth_request,
 					auth_request->mech_password,
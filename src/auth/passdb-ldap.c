@@ -10,6 +10,7 @@
 #include "str.h"
 #include "password-scheme.h"
 #include "auth-cache.h"
+#include "passdb-blocking.h"
 #include "db-ldap.h"
 
 #include <ldap.h>
@@ -103,6 +104,10 @@ ldap_lookup_finish(struct auth_request *auth_request,
 			ldap_request->callback.lookup_credentials,
 			auth_request);
 	} else {
+		if (password != NULL &&
+		    passdb_blocking_verify_password(auth_request, password,
+				scheme, ldap_request->callback.verify_plain))
+			return;
 		if (password != NULL) {
 			ret = auth_request_password_verify(auth_request,
 					auth_request->mech_password,
@@ -8,6 +8,7 @@
 #include "safe-memset.h"
 #include "password-scheme.h"
 #include "auth-cache.h"
+#include "passdb-blocking.h"
 #include "db-sql.h"
 
 #include <string.h>
@@ -130,6 +131,12 @@ static void sql_query_callback(struct sql_result *result,
 		return;
 	}
 
+	if (passdb_blocking_verify_password(auth_request, password, scheme,
+					    sql_request->callback.verify_plain)) {
+		auth_request_unref(&auth_request);
+		return;
+	}
+
 	ret = auth_request_password_verify(auth_request,
 					   auth_request->mech_password,
 					   password, scheme, AUTH_SUBSYS_DB);
@@ -154,11 +161,12 @@ static void sql_lookup_pass(struct passdb_sql_request *sql_request)
 	struct passdb_module *_module =
 		sql_request->auth_request->passdb->passdb;
 	struct sql_passdb_module *module = (struct sql_passdb_module *)_module;
+	struct sql_statement *stmt;
 	const char *query, *error;
 
-	if (t_auth_request_var_expand(module->conn->set.password_query,
-				      sql_request->auth_request,
-				      passdb_sql_escape, &query, &error) <= 0) {
+	if (db_sql_query_expand(&module->conn->password_query,
+				sql_request->auth_request, passdb_sql_escape,
+				&stmt, &query, &error) <= 0) {
 		e_debug(authdb_event(sql_request->auth_request),
 			"Failed to expand password_query=%s: %s",
 			module->conn->set.password_query, error);
@@ -171,8 +179,12 @@ static void sql_lookup_pass(struct passdb_sql_request *sql_request)
 		"query: %s", query);
 
 	auth_request_ref(sql_request->auth_request);
-	sql_query(module->conn->db, query,
-		  sql_query_callback, sql_request);
+	if (stmt != NULL) {
+		sql_statement_query(&stmt, sql_query_callback, sql_request);
+	} else {
+		sql_query(module->conn->db, query,
+			  sql_query_callback, sql_request);
+	}
 }
 
 static void sql_verify_plain(struct auth_request *request,
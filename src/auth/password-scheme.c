@@ -257,6 +257,15 @@ const char *password_generate_salt(size_t len)
 	return salt;
 }
 
+bool password_scheme_is_slow(const char *scheme)
+{
+	const struct password_scheme *s;
+	enum password_encoding encoding;
+
+	s = password_scheme_lookup(scheme, &encoding);
+	return s != NULL && s->slow;
+}
+
 bool password_scheme_is_alias(const char *scheme1, const char *scheme2)
 {
 	const struct password_scheme *s1 = NULL, *s2 = NULL;
@@ -796,43 +805,197 @@ rpa_generate(const char *plaintext, const struct password_generate_params *param
 }
 
 static const struct password_scheme builtin_schemes[] = {
-	{ "MD5", PW_ENCODING_NONE, 0, md5_verify, md5_crypt_generate },
-	{ "MD5-CRYPT", PW_ENCODING_NONE, 0,
-	  md5_crypt_verify, md5_crypt_generate },
- 	{ "SHA", PW_ENCODING_BASE64, SHA1_RESULTLEN, NULL, sha1_generate },
- 	{ "SHA1", PW_ENCODING_BASE64, SHA1_RESULTLEN, NULL, sha1_generate },
- 	{ "SHA256", PW_ENCODING_BASE64, SHA256_RESULTLEN,
-	  NULL, sha256_generate },
- 	{ "SHA512", PW_ENCODING_BASE64, SHA512_RESULTLEN,
-	  NULL, sha512_generate },
-	{ "SMD5", PW_ENCODING_BASE64, 0, smd5_verify, smd5_generate },
-	{ "SSHA", PW_ENCODING_BASE64, 0, ssha_verify, ssha_generate },
-	{ "SSHA256", PW_ENCODING_BASE64, 0, ssha256_verify, ssha256_generate },
-	{ "SSHA512", PW_ENCODING_BASE64, 0, ssha512_verify, ssha512_generate },
-	{ "PLAIN", PW_ENCODING_NONE, 0, plain_verify, plain_generate },
-	{ "CLEAR", PW_ENCODING_NONE, 0, plain_verify, plain_generate },
-	{ "CLEARTEXT", PW_ENCODING_NONE, 0, plain_verify, plain_generate },
-	{ "PLAIN-TRUNC", PW_ENCODING_NONE, 0, plain_trunc_verify, plain_generate },
-	{ "CRAM-MD5", PW_ENCODING_HEX, CRAM_MD5_CONTEXTLEN,
-	  NULL, cram_md5_generate },
-	{ "SCRAM-SHA-1", PW_ENCODING_NONE, 0, scram_sha1_verify,
-	  scram_sha1_generate},
-	{ "HMAC-MD5", PW_ENCODING_HEX, CRAM_MD5_CONTEXTLEN,
-	  NULL, cram_md5_generate },
-	{ "DIGEST-MD5", PW_ENCODING_HEX, MD5_RESULTLEN,
-	  NULL, digest_md5_generate },
-	{ "PLAIN-MD4", PW_ENCODING_HEX, MD4_RESULTLEN,
-	  NULL, plain_md4_generate },
-	{ "PLAIN-MD5", PW_ENCODING_HEX, MD5_RESULTLEN,
-	  NULL, plain_md5_generate },
-	{ "LDAP-MD5", PW_ENCODING_BASE64, MD5_RESULTLEN,
-	  NULL, plain_md5_generate },
-	{ "LANMAN", PW_ENCODING_HEX, LM_HASH_SIZE, NULL, lm_generate },
-	{ "NTLM", PW_ENCODING_HEX, NTLMSSP_HASH_SIZE, NULL, ntlm_generate },
-	{ "OTP", PW_ENCODING_NONE, 0, otp_verify, otp_generate },
-	{ "SKEY", PW_ENCODING_NONE, 0, otp_verify, skey_generate },
-	{ "RPA", PW_ENCODING_HEX, MD5_RESULTLEN, NULL, rpa_generate },
-        { "PBKDF2", PW_ENCODING_NONE, 0, pbkdf2_verify, pbkdf2_generate },
+	{
+		.name = "MD5",
+		.default_encoding = PW_ENCODING_NONE,
+		.raw_password_len = 0,
+		.password_verify = md5_verify,
+		.password_generate = md5_crypt_generate,
+	},
+	{
+		.name = "MD5-CRYPT",
+		.default_encoding = PW_ENCODING_NONE,
+		.raw_password_len = 0,
+		.password_verify = md5_crypt_verify,
+		.password_generate = md5_crypt_generate,
+	},
+	{
+		.name = "SHA",
+		.default_encoding = PW_ENCODING_BASE64,
+		.raw_password_len = SHA1_RESULTLEN,
+		.password_verify = NULL,
+		.password_generate = sha1_generate,
+	},
+	{
+		.name = "SHA1",
+		.default_encoding = PW_ENCODING_BASE64,
+		.raw_password_len = SHA1_RESULTLEN,
+		.password_verify = NULL,
+		.password_generate = sha1_generate,
+	},
+	{
+		.name = "SHA256",
+		.default_encoding = PW_ENCODING_BASE64,
+		.raw_password_len = SHA256_RESULTLEN,
+		.password_verify = NULL,
+		.password_generate = sha256_generate,
+	},
+	{
+		.name = "SHA512",
+		.default_encoding = PW_ENCODING_BASE64,
+		.raw_password_len = SHA512_RESULTLEN,
+		.password_verify = NULL,
+		.password_generate = sha512_generate,
+	},
+	{
+		.name = "SMD5",
+		.default_encoding = PW_ENCODING_BASE64,
+		.raw_password_len = 0,
+		.password_verify = smd5_verify,
+		.password_generate = smd5_generate,
+	},
+	{
+		.name = "SSHA",
+		.default_encoding = PW_ENCODING_BASE64,
+		.raw_password_len = 0,
+		.password_verify = ssha_verify,
+		.password_generate = ssha_generate,
+	},
+	{
+		.name = "SSHA256",
+		.default_encoding = PW_ENCODING_BASE64,
+		.raw_password_len = 0,
+		.password_verify = ssha256_verify,
+		.password_generate = ssha256_generate,
+	},
+	{
+		.name = "SSHA512",
+		.default_encoding = PW_ENCODING_BASE64,
+		.raw_password_len = 0,
+		.password_verify = ssha512_verify,
+		.password_generate = ssha512_generate,
+	},
+	{
+		.name = "PLAIN",
+		.default_encoding = PW_ENCODING_NONE,
+		.raw_password_len = 0,
+		.password_verify = plain_verify,
+		.password_generate = plain_generate,
+	},
+	{
+		.name = "CLEAR",
+		.default_encoding = PW_ENCODING_NONE,
+		.raw_password_len = 0,
+		.password_verify = plain_verify,
+		.password_generate = plain_generate,
+	},
+	{
+		.name = "CLEARTEXT",
+		.default_encoding = PW_ENCODING_NONE,
+		.raw_password_len = 0,
+		.password_verify = plain_verify,
+		.password_generate = plain_generate,
+	},
+	{
+		.name = "PLAIN-TRUNC",
+		.default_encoding = PW_ENCODING_NONE,
+		.raw_password_len = 0,
+		.password_verify = plain_trunc_verify,
+		.password_generate = plain_generate,
+	},
+	{
+		.name = "CRAM-MD5",
+		.default_encoding = PW_ENCODING_HEX,
+		.raw_password_len = CRAM_MD5_CONTEXTLEN,
+		.password_verify = NULL,
+		.password_generate = cram_md5_generate,
+	},
+	{
+		.name = "SCRAM-SHA-1",
+		.default_encoding = PW_ENCODING_NONE,
+		.raw_password_len = 0,
+		.password_verify = scram_sha1_verify,
+		.password_generate = scram_sha1_generate,
+		.slow = TRUE,
+	},
+	{
+		.name = "HMAC-MD5",
+		.default_encoding = PW_ENCODING_HEX,
+		.raw_password_len = CRAM_MD5_CONTEXTLEN,
+		.password_verify = NULL,
+		.password_generate = cram_md5_generate,
+	},
+	{
+		.name = "DIGEST-MD5",
+		.default_encoding = PW_ENCODING_HEX,
+		.raw_password_len = MD5_RESULTLEN,
+		.password_verify = NULL,
+		.password_generate = digest_md5_generate,
+	},
+	{
+		.name = "PLAIN-MD4",
+		.default_encoding = PW_ENCODING_HEX,
+		.raw_password_len = MD4_RESULTLEN,
+		.password_verify = NULL,
+		.password_generate = plain_md4_generate,
+	},
+	{
+		.name = "PLAIN-MD5",
+		.default_encoding = PW_ENCODING_HEX,
+		.raw_password_len = MD5_RESULTLEN,
+		.password_verify = NULL,
+		.password_generate = plain_md5_generate,
+	},
+	{
+		.name = "LDAP-MD5",
+		.default_encoding = PW_ENCODING_BASE64,
+		.raw_password_len = MD5_RESULTLEN,
+		.password_verify = NULL,
+		.password_generate = plain_md5_generate,
+	},
+	{
+		.name = "LANMAN",
+		.default_encoding = PW_ENCODING_HEX,
+		.raw_password_len = LM_HASH_SIZE,
+		.password_verify = NULL,
+		.password_generate = lm_generate,
+	},
+	{
+		.name = "NTLM",
+		.default_encoding = PW_ENCODING_HEX,
+		.raw_password_len = NTLMSSP_HASH_SIZE,
+		.password_verify = NULL,
+		.password_generate = ntlm_generate,
+	},
+	{
+		.name = "OTP",
+		.default_encoding = PW_ENCODING_NONE,
+		.raw_password_len = 0,
+		.password_verify = otp_verify,
+		.password_generate = otp_generate,
+	},
+	{
+		.name = "SKEY",
+		.default_encoding = PW_ENCODING_NONE,
+		.raw_password_len = 0,
+		.password_verify = otp_verify,
+		.password_generate = skey_generate,
+	},
+	{
+		.name = "RPA",
+		.default_encoding = PW_ENCODING_HEX,
+		.raw_password_len = MD5_RESULTLEN,
+		.password_verify = NULL,
+		.password_generate = rpa_generate,
+	},
+	{
+		.name = "PBKDF2",
+		.default_encoding = PW_ENCODING_NONE,
+		.raw_password_len = 0,
+		.password_verify = pbkdf2_verify,
+		.password_generate = pbkdf2_generate,
+		.slow = TRUE,
+	},
 };
 
 void password_scheme_register(const struct password_scheme *scheme)
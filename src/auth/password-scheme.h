@@ -28,6 +28,9 @@ struct password_scheme {
 	void (*password_generate)(const char *plaintext, const struct password_generate_params *params,
 				  const unsigned char **raw_password_r,
 				  size_t *size_r);
+	/* The verification is CPU-intensive by design, so it's worth
+	   offloading to auth worker processes. */
+	bool slow;
 };
 ARRAY_DEFINE_TYPE(password_scheme_p, const struct password_scheme *);
 void password_schemes_get(ARRAY_TYPE(password_scheme_p) *schemes_r);
@@ -62,6 +65,10 @@ bool password_generate(const char *plaintext, const struct password_generate_par
 bool password_generate_encoded(const char *plaintext, const struct password_generate_params *params,
 			       const char *scheme, const char **password_r);
 
+/* Returns TRUE if the scheme's verification is CPU-intensive. Unknown
+   schemes return FALSE. */
+bool password_scheme_is_slow(const char *scheme);
+
 /* Returns TRUE if schemes are equivalent. */
 bool password_scheme_is_alias(const char *scheme1, const char *scheme2);
 
@@ -6,6 +6,14 @@
 #include "auth-cache.h"
 #include "test-common.h"
 
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#define TEST_CACHE_FILE ".test-auth-cache"
+
+struct event *auth_event;
+
 const struct var_expand_table auth_request_var_expand_static_tab[] = {
 	/* these 3 must be in this order */
 	{ 'u', NULL, "user" },
@@ -64,10 +72,71 @@ static void test_auth_cache_parse_key(void)
 	test_end();
 }
 
+static void test_auth_cache_save_load(void)
+{
+	struct auth_request request;
+	struct auth_cache *cache;
+	struct auth_cache_node *node;
+	const char *str;
+	bool expired, neg_expired;
+	int fd;
+
+	test_begin("auth cache save and load");
+	i_zero(&request);
+	request.user = "testuser";
+	auth_event = event_create(NULL);
+
+	cache = auth_cache_new(1024*1024, 3600, 3600);
+	auth_cache_insert(cache, &request, "%u", "pos\tvalue", TRUE);
+	auth_cache_insert(cache, &request, "%u\t%d", "", FALSE);
+	test_assert(auth_cache_save(cache, TEST_CACHE_FILE, "v1") == 0);
+	auth_cache_free(&cache);
+
+	/* different version is ignored */
+	cache = auth_cache_new(1024*1024, 3600, 3600);
+	test_assert(auth_cache_load(cache, TEST_CACHE_FILE".none", "v1") == 0);
+	test_assert(link(TEST_CACHE_FILE, TEST_CACHE_FILE".2") == 0);
+	test_assert(auth_cache_load(cache, TEST_CACHE_FILE".2", "v2") == 0);
+	test_assert(auth_cache_lookup(cache, &request, "%u", NULL,
+				      &expired, &neg_expired) == NULL);
+	test_assert(access(TEST_CACHE_FILE".2", F_OK) < 0);
+
+	test_assert(auth_cache_load(cache, TEST_CACHE_FILE, "v1") == 0);
+	test_assert(access(TEST_CACHE_FILE, F_OK) < 0);
+	test_assert_strcmp(auth_cache_lookup(cache, &request, "%u", NULL,
+					     &expired, &neg_expired),
+			   "pos\tvalue");
+	test_assert(!expired);
+	test_assert_strcmp(auth_cache_lookup(cache, &request, "%u\t%d", NULL,
+					     &expired, &neg_expired), "");
+	test_assert(auth_cache_lookup(cache, &request, "%u", &node,
+				      &expired, &neg_expired) != NULL);
+	test_assert(!auth_cache_node_expires_within(cache, node, 60));
+	test_assert(auth_cache_node_expires_within(cache, node, 3600));
+	auth_cache_free(&cache);
+
+	/* expired entries aren't loaded */
+	fd = creat(TEST_CACHE_FILE, 0600);
+	test_assert(fd != -1);
+	str = t_strdup_printf("AUTH-CACHE\t1\tv1\n"
+			      "1\t1\told\tvalue\n"
+			      "%ld\t1\tnew\tvalue\n", (long)time(NULL));
+	test_assert(write(fd, str, strlen(str)) == (ssize_t)strlen(str));
+	i_close_fd(&fd);
+	cache = auth_cache_new(1024*1024, 3600, 3600);
+	test_assert(auth_cache_load(cache, TEST_CACHE_FILE, "v1") == 0);
+	test_assert(auth_cache_clear(cache) == 1);
+	auth_cache_free(&cache);
+
+	event_unref(&auth_event);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_auth_cache_parse_key,
+		test_auth_cache_save_load,
 		NULL
 	};
 	return test_run(test_functions);
@@ -10,6 +10,7 @@ struct auth_passdb;
 
 void test_auth_request_var_expand(void);
 void test_db_dict_parse_cache_key(void);
+void test_db_sql_query_parse(void);
 void test_username_filter(void);
 void test_db_lua(void);
 struct auth_passdb *passdb_mock(void);
@@ -0,0 +1,71 @@
+/* Copyright (c) 2018 Dovecot authors, see the included COPYING file */
+
+#include "test-auth.h"
+
+#if defined(PASSDB_SQL) || defined(USERDB_SQL)
+#include "array.h"
+#include "auth-request.h"
+#include "db-sql.h"
+
+void test_db_sql_query_parse(void)
+{
+	static const struct {
+		const char *query;
+		const char *template;
+		const char *params[3];
+	} tests[] = {
+		{ "SELECT password FROM users WHERE user = '%u' AND domain = '%d'",
+		  "SELECT password FROM users WHERE user = ? AND domain = ?",
+		  { "%u", "%d", NULL } },
+		{ "SELECT password FROM users WHERE user = 'foo'",
+		  "SELECT password FROM users WHERE user = 'foo'",
+		  { NULL } },
+		/* '' is an escaped quote inside the literal */
+		{ "SELECT 'it''s' FROM users WHERE user = 'o''%n''s'",
+		  "SELECT 'it''s' FROM users WHERE user = ?",
+		  { "o'%n's", NULL } },
+		{ "SELECT * FROM users WHERE user LIKE '%n%%' AND x = ''",
+		  "SELECT * FROM users WHERE user LIKE ? AND x = ''",
+		  { "%n%%", NULL } },
+		/* backslash escaped quote in E'' string */
+		{ "SELECT E'it\\'s' FROM users WHERE user = '%u'",
+		  "SELECT E'it\\'s' FROM users WHERE user = ?",
+		  { "%u", NULL } },
+		{ "SELECT \"it's\" FROM users WHERE user = '%u'",
+		  "SELECT \"it's\" FROM users WHERE user = ?",
+		  { "%u", NULL } },
+	};
+	static const char *const invalid_queries[] = {
+		"SELECT password FROM users WHERE user = %u",
+		"SELECT password FROM users WHERE user = '%u",
+		"SELECT password FROM users WHERE user = '%u' AND x = ?",
+		"SELECT password FROM users WHERE user = '?%u'",
+		"SELECT password FROM users WHERE user = '\\'%u'",
+		"SELECT password FROM users WHERE user = E'%u'",
+		"SELECT password FROM users WHERE user = e'\\'%u'",
+		"SELECT \"%u\" FROM users",
+	};
+	ARRAY_TYPE(const_string) params;
+	const char *template, *const *values;
+	unsigned int i, j, count;
+	pool_t pool;
+
+	test_begin("db sql query parse");
+	pool = pool_alloconly_create("db sql query parse", 1024);
+	for (i = 0; i < N_ELEMENTS(tests); i++) {
+		test_assert_idx(db_sql_query_parse(pool, tests[i].query,
+						   &template, &params), i);
+		test_assert_idx(strcmp(template, tests[i].template) == 0, i);
+		values = array_get(&params, &count);
+		test_assert_idx(count == str_array_length(tests[i].params), i);
+		for (j = 0; j < count && tests[i].params[j] != NULL; j++)
+			test_assert_idx(strcmp(values[j], tests[i].params[j]) == 0, i);
+	}
+	for (i = 0; i < N_ELEMENTS(invalid_queries); i++) {
+		test_assert_idx(!db_sql_query_parse(pool, invalid_queries[i],
+						    &template, &params), i);
+	}
+	pool_unref(&pool);
+	test_end();
+}
+#endif
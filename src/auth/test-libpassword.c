@@ -94,6 +94,19 @@ static void test_password_failures(void)
 	test_end();
 }
 
+static void test_password_scheme_is_slow(void)
+{
+	test_begin("password scheme is slow");
+	test_assert(password_scheme_is_slow("SHA512-CRYPT"));
+	test_assert(password_scheme_is_slow("PBKDF2"));
+	test_assert(password_scheme_is_slow("pbkdf2"));
+	test_assert(!password_scheme_is_slow("SSHA512"));
+	test_assert(!password_scheme_is_slow("PLAIN"));
+	test_assert(!password_scheme_is_slow("PLAIN-MD5.hex"));
+	test_assert(!password_scheme_is_slow("NONEXISTENT"));
+	test_end();
+}
+
 static void test_password_schemes(void)
 {
 	test_password_scheme("PLAIN", "{PLAIN}test", "test");
@@ -131,6 +144,7 @@ int main(void)
 	static void (*const test_functions[])(void) = {
 		test_password_schemes,
 		test_password_failures,
+		test_password_scheme_is_slow,
 		NULL
 	};
 	password_schemes_init();
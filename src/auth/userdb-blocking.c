@@ -12,6 +12,7 @@ struct blocking_userdb_iterate_context {
 	struct auth_worker_connection *conn;
 	bool next;
 	bool destroyed;
+	bool in_callback;
 };
 
 static bool user_callback(const char *reply, void *context)
@@ -74,7 +75,9 @@ static bool iter_callback(const char *reply, void *context)
 		if (ctx->destroyed)
 			return TRUE;
 		ctx->next = FALSE;
+		ctx->in_callback = TRUE;
 		ctx->ctx.callback(reply + 2, ctx->ctx.context);
+		ctx->in_callback = FALSE;
 		return ctx->next || ctx->destroyed;
 	}
 
@@ -114,7 +117,11 @@ void userdb_blocking_iter_next(struct userdb_iterate_context *_ctx)
 		(struct blocking_userdb_iterate_context *)_ctx;
 
 	ctx->next = TRUE;
-	auth_worker_server_resume_input(ctx->conn);
+	/* When called from the callback, returning TRUE to the worker
+	   connection already continues reading the next user. Don't add
+	   a resume timeout for each user. */
+	if (!ctx->in_callback)
+		auth_worker_server_resume_input(ctx->conn);
 }
 
 int userdb_blocking_iter_deinit(struct userdb_iterate_context **_ctx)
@@ -105,11 +105,12 @@ static void userdb_sql_lookup(struct auth_request *auth_request,
 	struct sql_userdb_module *module =
 		(struct sql_userdb_module *)_module;
 	struct userdb_sql_request *sql_request;
+	struct sql_statement *stmt;
 	const char *query, *error;
 
-	if (t_auth_request_var_expand(module->conn->set.user_query,
-				      auth_request, userdb_sql_escape,
-				      &query, &error) <= 0) {
+	if (db_sql_query_expand(&module->conn->user_query, auth_request,
+				userdb_sql_escape, &stmt, &query,
+				&error) <= 0) {
 		e_error(authdb_event(auth_request),
 			"Failed to expand user_query=%s: %s",
 			module->conn->set.user_query, error);
@@ -124,8 +125,12 @@ static void userdb_sql_lookup(struct auth_request *auth_request,
 
 	e_debug(authdb_event(auth_request), "%s", query);
 
-	sql_query(module->conn->db, query,
-		  sql_query_callback, sql_request);
+	if (stmt != NULL) {
+		sql_statement_query(&stmt, sql_query_callback, sql_request);
+	} else {
+		sql_query(module->conn->db, query,
+			  sql_query_callback, sql_request);
+	}
 }
 
 static void sql_iter_query_callback(struct sql_result *sql_result,
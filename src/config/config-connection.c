@@ -3,6 +3,8 @@
 #include "lib.h"
 #include "array.h"
 #include "llist.h"
+#include "hash.h"
+#include "str.h"
 #include "istream.h"
 #include "ostream.h"
 #include "strescape.h"
@@ -16,6 +18,9 @@
 #include <unistd.h>
 
 #define MAX_INBUF_SIZE 1024
+/* Maximum number of cached replies. The whole cache is cleared when this is
+   reached. */
+#define CONFIG_CACHE_MAX_REPLIES 1024
 
 #define CONFIG_CLIENT_PROTOCOL_MAJOR_VERSION 2
 #define CONFIG_CLIENT_PROTOCOL_MINOR_VERSION 0
@@ -32,8 +37,24 @@ struct config_connection {
 	bool handshaked:1;
 };
 
+/* Whether the service's settings may depend on local or remote IP. This is
+   known after the first request for the service. */
+struct config_cache_service {
+	bool uses_local:1;
+	bool uses_remote:1;
+};
+
+struct config_cache_reply {
+	const unsigned char *data;
+	size_t size;
+};
+
 static struct config_connection *config_connections = NULL;
 
+static pool_t config_cache_pool;
+static HASH_TABLE(char *, struct config_cache_service *) config_cache_services;
+static HASH_TABLE(char *, struct config_cache_reply *) config_cache_replies;
+
 static const char *const *
 config_connection_next_line(struct config_connection *conn)
 {
@@ -46,22 +67,90 @@ config_connection_next_line(struct config_connection *conn)
 	return t_strsplit_tabescaped(line);
 }
 
+static void config_cache_clear(void)
+{
+	if (config_cache_pool == NULL)
+		return;
+	hash_table_destroy(&config_cache_services);
+	hash_table_destroy(&config_cache_replies);
+	pool_unref(&config_cache_pool);
+}
+
+static void config_cache_init(void)
+{
+	if (config_cache_pool != NULL)
+		return;
+	config_cache_pool = pool_alloconly_create("config reply cache", 1024*16);
+	hash_table_create(&config_cache_services, config_cache_pool, 0,
+			  str_hash, strcmp);
+	hash_table_create(&config_cache_replies, config_cache_pool, 0,
+			  str_hash, strcmp);
+}
+
+static const char *
+config_cache_get_reply_key(const char *service_key,
+			   const struct config_cache_service *cache_service,
+			   const char *local_name, const char *lip,
+			   const char *rip)
+{
+	string_t *key = t_str_new(128);
+
+	str_append(key, service_key);
+	if (cache_service->uses_local) {
+		str_printfa(key, "\tlname=%s\tlip=%s",
+			    local_name == NULL ? "" : local_name,
+			    lip == NULL ? "" : lip);
+	}
+	if (cache_service->uses_remote)
+		str_printfa(key, "\trip=%s", rip == NULL ? "" : rip);
+	return str_c(key);
+}
+
+static void
+config_cache_add(const char *service_key, const char *reply_key,
+		 const struct config_cache_service *cache_service,
+		 const string_t *reply)
+{
+	struct config_cache_service *new_service;
+	struct config_cache_reply *new_reply;
+
+	if (config_cache_pool != NULL &&
+	    hash_table_count(config_cache_replies) >= CONFIG_CACHE_MAX_REPLIES)
+		config_cache_clear();
+	config_cache_init();
+
+	if (hash_table_lookup(config_cache_services, service_key) == NULL) {
+		new_service = p_new(config_cache_pool,
+				    struct config_cache_service, 1);
+		*new_service = *cache_service;
+		hash_table_insert(config_cache_services,
+				  p_strdup(config_cache_pool, service_key),
+				  new_service);
+	}
+	new_reply = p_new(config_cache_pool, struct config_cache_reply, 1);
+	new_reply->data = p_memdup(config_cache_pool, str_data(reply),
+				   str_len(reply));
+	new_reply->size = str_len(reply);
+	hash_table_insert(config_cache_replies,
+			  p_strdup(config_cache_pool, reply_key), new_reply);
+}
+
 static void
 config_request_output(const char *key, const char *value,
 		      enum config_key_type type ATTR_UNUSED, void *context)
 {
-	struct ostream *output = context;
+	string_t *output = context;
 	const char *p;
 
-	o_stream_nsend_str(output, key);
-	o_stream_nsend_str(output, "=");
+	str_append(output, key);
+	str_append_c(output, '=');
 	while ((p = strchr(value, '\n')) != NULL) {
-		o_stream_nsend(output, value, p-value);
-		o_stream_nsend(output, SETTING_STREAM_LF_CHAR, 1);
+		str_append_data(output, value, p-value);
+		str_append_data(output, SETTING_STREAM_LF_CHAR, 1);
 		value = p+1;
 	}
-	o_stream_nsend_str(output, value);
-	o_stream_nsend_str(output, "\n");
+	str_append(output, value);
+	str_append_c(output, '\n');
 }
 
 static int config_connection_request(struct config_connection *conn,
@@ -70,8 +159,12 @@ static int config_connection_request(struct config_connection *conn,
 	struct config_export_context *ctx;
 	struct master_service_settings_output output;
 	struct config_filter filter;
+	struct config_cache_service *cache_service, new_cache_service;
+	struct config_cache_reply *cache_reply;
 	const char *path, *error, *module, *const *wanted_modules;
+	const char *lip = NULL, *rip = NULL, *service_key, *reply_key;
 	ARRAY(const char *) modules;
+	string_t *reply, *header;
 	bool is_master = FALSE;
 
 	/* [<args>] */
@@ -88,12 +181,14 @@ static int config_connection_request(struct config_connection *conn,
 		} else if (str_begins(*args, "lname="))
 			filter.local_name = *args + 6;
 		else if (str_begins(*args, "lip=")) {
+			lip = *args + 4;
 			if (net_addr2ip(*args + 4, &filter.local_net) == 0) {
 				filter.local_bits =
 					IPADDR_IS_V4(&filter.local_net) ?
 					32 : 128;
 			}
 		} else if (str_begins(*args, "rip=")) {
+			rip = *args + 4;
 			if (net_addr2ip(*args + 4, &filter.remote_net) == 0) {
 				filter.remote_bits =
 					IPADDR_IS_V4(&filter.remote_net) ?
@@ -114,39 +209,67 @@ static int config_connection_request(struct config_connection *conn,
 			config_connection_destroy(conn);
 			return -1;
 		}
+		/* the settings may have changed */
+		config_cache_clear();
 	}
 
-	o_stream_cork(conn->output);
+	/* The reply depends only on the service and modules, unless the
+	   service has local or remote filters. Cache the replies so that
+	   the settings don't need to be filtered again for each process. */
+	service_key = t_strdup_printf("%s\t%s",
+		filter.service == NULL ? "" : filter.service,
+		wanted_modules == NULL ? "" :
+		t_strarray_join(wanted_modules, "\t"));
+	cache_service = config_cache_pool == NULL ? NULL :
+		hash_table_lookup(config_cache_services, service_key);
+	if (cache_service != NULL) {
+		reply_key = config_cache_get_reply_key(service_key,
+			cache_service, filter.local_name, lip, rip);
+		cache_reply = hash_table_lookup(config_cache_replies, reply_key);
+		if (cache_reply != NULL) {
+			o_stream_nsend(conn->output, cache_reply->data,
+				       cache_reply->size);
+			return 0;
+		}
+	}
 
+	header = t_str_new(128);
+	reply = t_str_new(8192);
 	ctx = config_export_init(wanted_modules, CONFIG_DUMP_SCOPE_SET, 0,
-				 config_request_output, conn->output);
+				 config_request_output, reply);
 	config_export_by_filter(ctx, &filter);
 	config_export_get_output(ctx, &output);
 
 	if (output.specific_services != NULL) {
 		const char *const *s;
 
-		for (s = output.specific_services; *s != NULL; s++) {
-			o_stream_nsend_str(conn->output,
-				t_strdup_printf("service=%s\t", *s));
-		}
+		for (s = output.specific_services; *s != NULL; s++)
+			str_printfa(header, "service=%s\t", *s);
 	}
 	if (output.service_uses_local)
-		o_stream_nsend_str(conn->output, "service-uses-local\t");
+		str_append(header, "service-uses-local\t");
 	if (output.service_uses_remote)
-		o_stream_nsend_str(conn->output, "service-uses-remote\t");
+		str_append(header, "service-uses-remote\t");
 	if (output.used_local)
-		o_stream_nsend_str(conn->output, "used-local\t");
+		str_append(header, "used-local\t");
 	if (output.used_remote)
-		o_stream_nsend_str(conn->output, "used-remote\t");
-	o_stream_nsend_str(conn->output, "\n");
+		str_append(header, "used-remote\t");
+	str_append_c(header, '\n');
 
 	if (config_export_finish(&ctx) < 0) {
 		config_connection_destroy(conn);
 		return -1;
 	}
-	o_stream_nsend_str(conn->output, "\n");
-	o_stream_uncork(conn->output);
+	str_insert(reply, 0, str_c(header));
+	str_append_c(reply, '\n');
+	o_stream_nsend(conn->output, str_data(reply), str_len(reply));
+
+	i_zero(&new_cache_service);
+	new_cache_service.uses_local = output.service_uses_local;
+	new_cache_service.uses_remote = output.service_uses_remote;
+	reply_key = config_cache_get_reply_key(service_key, &new_cache_service,
+					       filter.local_name, lip, rip);
+	config_cache_add(service_key, reply_key, &new_cache_service, reply);
 	return 0;
 }
 
@@ -255,4 +378,5 @@ void config_connections_destroy_all(void)
 {
 	while (config_connections != NULL)
 		config_connection_destroy(config_connections);
+	config_cache_clear();
 }
@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "array.h"
+#include "ioloop.h"
 #include "ostream.h"
 #include "str.h"
 #include "strescape.h"
@@ -35,6 +36,15 @@ struct dict_connection_cmd {
 	unsigned int trans_id; /* obsolete */
 };
 
+struct dict_inc_batch {
+	struct dict_connection *conn;
+	struct timeout *to_flush;
+
+	ARRAY(struct dict_connection_inc) incs;
+	/* COMMIT_ASYNC commands waiting for the batch to be committed */
+	ARRAY(struct dict_connection_cmd *) cmds;
+};
+
 struct dict_command_stats cmd_stats;
 
 static int cmd_iterate_flush(struct dict_connection_cmd *cmd);
@@ -347,6 +357,38 @@ dict_connection_transaction_array_remove(struct dict_connection *conn,
 	i_unreached();
 }
 
+void dict_connection_transaction_free_incs(
+	struct dict_connection_transaction *trans)
+{
+	struct dict_connection_inc *inc;
+
+	if (!array_is_created(&trans->incs))
+		return;
+	array_foreach_modifiable(&trans->incs, inc)
+		i_free(inc->key);
+	array_free(&trans->incs);
+}
+
+static void
+dict_connection_transaction_apply_incs(struct dict_connection_transaction *trans)
+{
+	const struct dict_connection_inc *inc;
+
+	if (!array_is_created(&trans->incs))
+		return;
+	array_foreach(&trans->incs, inc)
+		dict_atomic_inc(trans->ctx, inc->key, inc->diff);
+	dict_connection_transaction_free_incs(trans);
+}
+
+static void
+dict_connection_transaction_changed(struct dict_connection_transaction *trans)
+{
+	/* keep the changes in their original order */
+	dict_connection_transaction_apply_incs(trans);
+	trans->have_other_changes = TRUE;
+}
+
 static int cmd_begin(struct dict_connection_cmd *cmd, const char *line)
 {
 	struct dict_connection_transaction *trans;
@@ -447,6 +489,93 @@ static void cmd_commit_callback_async(const struct dict_commit_result *result,
 	cmd_commit_finish(cmd, result, TRUE);
 }
 
+static void
+dict_inc_batch_commit_callback(const struct dict_commit_result *result,
+			       void *context)
+{
+	struct dict_inc_batch *batch = context;
+	struct dict_connection *conn = batch->conn;
+	struct dict_connection_cmd *const *cmdp;
+	struct dict_connection_inc *inc;
+
+	dict_connection_ref(conn);
+	array_foreach(&batch->cmds, cmdp)
+		cmd_commit_finish(*cmdp, result, TRUE);
+
+	array_foreach_modifiable(&batch->incs, inc)
+		i_free(inc->key);
+	array_free(&batch->incs);
+	array_free(&batch->cmds);
+	i_free(batch);
+	dict_connection_unref_safe(conn);
+}
+
+void dict_connection_flush_inc_batch(struct dict_connection *conn)
+{
+	struct dict_inc_batch *batch = conn->inc_batch;
+	struct dict_transaction_context *ctx;
+	const struct dict_connection_inc *inc;
+
+	if (batch == NULL)
+		return;
+	conn->inc_batch = NULL;
+	timeout_remove(&batch->to_flush);
+
+	ctx = dict_transaction_begin(conn->dict);
+	array_foreach(&batch->incs, inc)
+		dict_atomic_inc(ctx, inc->key, inc->diff);
+	dict_transaction_commit_async(&ctx, dict_inc_batch_commit_callback,
+				      batch);
+}
+
+static void
+dict_inc_batch_add(struct dict_inc_batch *batch,
+		   struct dict_connection_inc *new_inc)
+{
+	struct dict_connection_inc *inc;
+
+	array_foreach_modifiable(&batch->incs, inc) {
+		if (strcmp(inc->key, new_inc->key) == 0) {
+			inc->diff += new_inc->diff;
+			i_free(new_inc->key);
+			return;
+		}
+	}
+	array_push_back(&batch->incs, new_inc);
+}
+
+static void
+cmd_commit_async_batch(struct dict_connection_cmd *cmd,
+		       struct dict_connection_transaction *trans)
+{
+	struct dict_connection *conn = cmd->conn;
+	struct dict_inc_batch *batch = conn->inc_batch;
+	struct dict_connection_inc *inc;
+
+	if (batch == NULL) {
+		batch = i_new(struct dict_inc_batch, 1);
+		batch->conn = conn;
+		i_array_init(&batch->incs, 8);
+		i_array_init(&batch->cmds, 8);
+		batch->to_flush =
+			timeout_add(dict_settings->dict_atomic_inc_batch_interval,
+				    dict_connection_flush_inc_batch, conn);
+		conn->inc_batch = batch;
+	}
+
+	/* the keys are moved to the batch */
+	array_foreach_modifiable(&trans->incs, inc)
+		dict_inc_batch_add(batch, inc);
+	array_free(&trans->incs);
+	/* nothing was given to the transaction itself */
+	dict_transaction_rollback(&trans->ctx);
+
+	array_push_back(&batch->cmds, &cmd);
+	if (array_count(&batch->cmds) >=
+	    dict_settings->dict_atomic_inc_batch_max_commits)
+		dict_connection_flush_inc_batch(conn);
+}
+
 static int
 cmd_commit(struct dict_connection_cmd *cmd, const char *line)
 {
@@ -455,6 +584,7 @@ cmd_commit(struct dict_connection_cmd *cmd, const char *line)
 	if (dict_connection_transaction_lookup_parse(cmd->conn, line, &trans) < 0)
 		return -1;
 	cmd->trans_id = trans->id;
+	dict_connection_transaction_apply_incs(trans);
 
 	dict_connection_cmd_async(cmd);
 	dict_transaction_commit_async(&trans->ctx, cmd_commit_callback, cmd);
@@ -471,6 +601,13 @@ cmd_commit_async(struct dict_connection_cmd *cmd, const char *line)
 	cmd->trans_id = trans->id;
 
 	dict_connection_cmd_async(cmd);
+	if (array_is_created(&trans->incs) && !trans->have_other_changes) {
+		/* only atomic increments - these can be committed together
+		   with other such transactions */
+		cmd_commit_async_batch(cmd, trans);
+		return 1;
+	}
+	dict_connection_transaction_apply_incs(trans);
 	dict_transaction_commit_async(&trans->ctx, cmd_commit_callback_async, cmd);
 	return 1;
 }
@@ -482,6 +619,7 @@ static int cmd_rollback(struct dict_connection_cmd *cmd, const char *line)
 	if (dict_connection_transaction_lookup_parse(cmd->conn, line, &trans) < 0)
 		return -1;
 
+	dict_connection_transaction_free_incs(trans);
 	dict_transaction_rollback(&trans->ctx);
 	dict_connection_transaction_array_remove(cmd->conn, trans->id);
 	return 0;
@@ -501,6 +639,7 @@ static int cmd_set(struct dict_connection_cmd *cmd, const char *line)
 
 	if (dict_connection_transaction_lookup_parse(cmd->conn, args[0], &trans) < 0)
 		return -1;
+	dict_connection_transaction_changed(trans);
         dict_set(trans->ctx, args[1], args[2]);
 	return 0;
 }
@@ -519,6 +658,7 @@ static int cmd_unset(struct dict_connection_cmd *cmd, const char *line)
 
 	if (dict_connection_transaction_lookup_parse(cmd->conn, args[0], &trans) < 0)
 		return -1;
+	dict_connection_transaction_changed(trans);
         dict_unset(trans->ctx, args[1]);
 	return 0;
 }
@@ -540,6 +680,22 @@ static int cmd_atomic_inc(struct dict_connection_cmd *cmd, const char *line)
 	if (dict_connection_transaction_lookup_parse(cmd->conn, args[0], &trans) < 0)
 		return -1;
 
+	if (dict_settings->dict_atomic_inc_batch_interval > 0 &&
+	    !trans->have_other_changes &&
+	    cmd->conn->minor_version >= DICT_CLIENT_PROTOCOL_UNORDERED_MIN_VERSION) {
+		/* Delay giving the increment to the transaction until we know
+		   whether it can be batched. Avoid this with the old
+		   protocol, since replies to the later commands would have
+		   to wait for the batch. */
+		struct dict_connection_inc *inc;
+
+		if (!array_is_created(&trans->incs))
+			i_array_init(&trans->incs, 4);
+		inc = array_append_space(&trans->incs);
+		inc->key = i_strdup(args[1]);
+		inc->diff = diff;
+		return 0;
+	}
         dict_atomic_inc(trans->ctx, args[1], diff);
 	return 0;
 }
@@ -567,6 +723,7 @@ static int cmd_timestamp(struct dict_connection_cmd *cmd, const char *line)
 		.tv_sec = tv_sec,
 		.tv_nsec = tv_nsec
 	};
+	dict_connection_transaction_changed(trans);
         dict_transaction_set_timestamp(trans->ctx, &ts);
 	return 0;
 }
@@ -2,6 +2,7 @@
 #define DICT_COMMANDS_H
 
 struct dict_connection;
+struct dict_connection_transaction;
 
 struct dict_command_stats {
 	struct stats_dist *lookups;
@@ -14,6 +15,10 @@ extern struct dict_command_stats cmd_stats;
 int dict_command_input(struct dict_connection *conn, const char *line);
 
 void dict_connection_cmds_output_more(struct dict_connection *conn);
+/* Commit the batched atomic increments immediately. */
+void dict_connection_flush_inc_batch(struct dict_connection *conn);
+void dict_connection_transaction_free_incs(
+	struct dict_connection_transaction *trans);
 
 void dict_commands_init(void);
 void dict_commands_deinit(void);
@@ -231,6 +231,7 @@ bool dict_connection_unref(struct dict_connection *conn)
 	   rollbacked yet. close those before dict is deinitialized. */
 	if (array_is_created(&conn->transactions)) {
 		array_foreach_modifiable(&conn->transactions, transaction) {
+			dict_connection_transaction_free_incs(transaction);
 			if (transaction->ctx != NULL)
 				dict_transaction_rollback(&transaction->ctx);
 		}
@@ -300,6 +301,7 @@ void dict_connection_destroy(struct dict_connection *conn)
 
 	   flush the command output here in case we were waiting on iteration
 	   output. */
+	dict_connection_flush_inc_batch(conn);
 	dict_connection_cmds_output_more(conn);
 
 	dict_connection_unref(conn);
@@ -3,10 +3,21 @@
 
 #include "dict.h"
 
+struct dict_connection_inc {
+	char *key;
+	long long diff;
+};
+
 struct dict_connection_transaction {
 	unsigned int id;
 	struct dict_connection *conn;
 	struct dict_transaction_context *ctx;
+
+	/* Atomic increments not given to ctx yet. If the transaction has
+	   nothing else, they may be batched with other such transactions
+	   when it's committed asynchronously. */
+	ARRAY(struct dict_connection_inc) incs;
+	bool have_other_changes:1;
 };
 
 struct dict_connection {
@@ -32,6 +43,8 @@ struct dict_connection {
 	ARRAY(struct dict_connection_transaction) transactions;
 	ARRAY(struct dict_connection_cmd *) cmds;
 	unsigned int async_id_counter;
+	/* Atomic increments of async commits waiting to be committed */
+	struct dict_inc_batch *inc_batch;
 
 	bool destroyed:1;
 };
@@ -89,6 +89,8 @@ static const struct setting_define dict_setting_defines[] = {
 	DEF(SET_BOOL, verbose_proctitle),
 
 	DEF(SET_STR, dict_db_config),
+	DEF(SET_TIME_MSECS, dict_atomic_inc_batch_interval),
+	DEF(SET_UINT, dict_atomic_inc_batch_max_commits),
 	{ SET_STRLIST, "dict", offsetof(struct dict_server_settings, dicts), NULL },
 
 	SETTING_DEFINE_LIST_END
@@ -99,6 +101,8 @@ const struct dict_server_settings dict_default_settings = {
 	.verbose_proctitle = FALSE,
 
 	.dict_db_config = "",
+	.dict_atomic_inc_batch_interval = 0,
+	.dict_atomic_inc_batch_max_commits = 100,
 	.dicts = ARRAY_INIT
 };
 
@@ -6,6 +6,8 @@ struct dict_server_settings {
 	bool verbose_proctitle;
 
 	const char *dict_db_config;
+	unsigned int dict_atomic_inc_batch_interval;
+	unsigned int dict_atomic_inc_batch_max_commits;
 	ARRAY(const char *) dicts;
 };
 
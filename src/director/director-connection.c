@@ -31,6 +31,7 @@
 #include "lib.h"
 #include "ioloop.h"
 #include "array.h"
+#include "hash.h"
 #include "net.h"
 #include "istream.h"
 #include "ostream.h"
@@ -89,12 +90,16 @@
 /* How many USER entries to send during handshake before going back to ioloop
    to see if there's other work to be done as well. */
 #define DIRECTOR_HANDSHAKE_MAX_USERS_SENT_PER_FLUSH 10000
+/* Flush a "UB" line after it grows this large. This must be well below
+   MAX_INBUF_SIZE. */
+#define DIRECTOR_HANDSHAKE_USER_BATCH_MAX_LEN 800
 
 #define CMD_IS_USER_HANDSHAKE(minor_version, args) \
 	((minor_version) < DIRECTOR_VERSION_HANDSHAKE_U_CMD && \
 	 str_array_length(args) > 2)
 
 #define DIRECTOR_OPT_CONSISTENT_HASHING "consistent-hashing"
+#define DIRECTOR_OPT_RENDEZVOUS_HASHING "rendezvous-hashing"
 
 struct director_connection {
 	int refcount;
@@ -749,33 +754,15 @@ director_user_refresh(struct director_connection *conn,
 	return ret ? 1 : 0;
 }
 
-static bool
-director_handshake_cmd_user(struct director_connection *conn,
-			    const char *const *args)
+static void
+director_handshake_user(struct director_connection *conn,
+			unsigned int username_hash, struct mail_host *host,
+			unsigned int timestamp, bool weak)
 {
-	unsigned int username_hash, timestamp;
-	struct ip_addr ip;
-	struct mail_host *host;
 	struct user *user;
-	bool weak, forced;
+	bool forced;
 
-	if (str_array_length(args) < 3 ||
-	    str_to_uint(args[0], &username_hash) < 0 ||
-	    net_addr2ip(args[1], &ip) < 0 ||
-	    str_to_uint(args[2], &timestamp) < 0) {
-		director_cmd_error(conn, "Invalid parameters");
-		return FALSE;
-	}
-	weak = args[3] != NULL && args[3][0] == 'w';
 	conn->handshake_users_received++;
-
-	host = mail_host_lookup(conn->dir->mail_hosts, &ip);
-	if (host == NULL) {
-		i_error("director(%s): USER used unknown host %s in handshake",
-			conn->name, args[1]);
-		return FALSE;
-	}
-
 	if ((time_t)timestamp > ioloop_time) {
 		/* The other director's clock seems to be into the future
 		   compared to us. Don't set any of our users' timestamps into
@@ -786,7 +773,7 @@ director_handshake_cmd_user(struct director_connection *conn,
 	if (director_user_refresh(conn, username_hash, host,
 				  timestamp, weak, &forced, &user) < 0) {
 		/* user expired - ignore */
-		return TRUE;
+		return;
 	}
 	/* Possibilities:
 
@@ -808,6 +795,84 @@ director_handshake_cmd_user(struct director_connection *conn,
 	/* always sort users after handshaking to make sure the order
 	   is correct */
 	conn->users_unsorted = TRUE;
+}
+
+static bool
+director_handshake_cmd_user(struct director_connection *conn,
+			    const char *const *args)
+{
+	unsigned int username_hash, timestamp;
+	struct ip_addr ip;
+	struct mail_host *host;
+	bool weak;
+
+	if (str_array_length(args) < 3 ||
+	    str_to_uint(args[0], &username_hash) < 0 ||
+	    net_addr2ip(args[1], &ip) < 0 ||
+	    str_to_uint(args[2], &timestamp) < 0) {
+		director_cmd_error(conn, "Invalid parameters");
+		return FALSE;
+	}
+	weak = args[3] != NULL && args[3][0] == 'w';
+
+	host = mail_host_lookup(conn->dir->mail_hosts, &ip);
+	if (host == NULL) {
+		i_error("director(%s): USER used unknown host %s in handshake",
+			conn->name, args[1]);
+		return FALSE;
+	}
+	director_handshake_user(conn, username_hash, host, timestamp, weak);
+	return TRUE;
+}
+
+static bool
+director_handshake_cmd_user_batch(struct director_connection *conn,
+				  const char *const *args)
+{
+	struct ip_addr ip;
+	struct mail_host *host;
+	const char *p, *value;
+	unsigned int username_hash;
+	long long timestamp = 0, diff;
+	size_t len;
+	bool weak;
+
+	/* <host ip> <username hash>:<timestamp diff>[w] [...]
+
+	   The timestamp diff is relative to the previous user's timestamp,
+	   or to 0 for the first user. */
+	if (args[0] == NULL || net_addr2ip(args[0], &ip) < 0) {
+		director_cmd_error(conn, "Invalid parameters");
+		return FALSE;
+	}
+	host = mail_host_lookup(conn->dir->mail_hosts, &ip);
+	if (host == NULL) {
+		i_error("director(%s): UB used unknown host %s in handshake",
+			conn->name, args[0]);
+		return FALSE;
+	}
+
+	for (args++; *args != NULL; args++) {
+		p = strchr(*args, ':');
+		if (p == NULL ||
+		    str_to_uint(t_strdup_until(*args, p), &username_hash) < 0) {
+			director_cmd_error(conn, "Invalid parameters");
+			return FALSE;
+		}
+		value = p + 1;
+		len = strlen(value);
+		weak = len > 0 && value[len-1] == 'w';
+		if (weak)
+			value = t_strndup(value, len-1);
+		if (str_to_llong(value, &diff) < 0 ||
+		    diff < -timestamp || diff > (long long)UINT_MAX - timestamp) {
+			director_cmd_error(conn, "Invalid parameters");
+			return FALSE;
+		}
+		timestamp += diff;
+		director_handshake_user(conn, username_hash, host,
+					(unsigned int)timestamp, weak);
+	}
 	return TRUE;
 }
 
@@ -1449,16 +1514,23 @@ static bool director_handshake_cmd_done(struct director_connection *conn)
 	}
 }
 
+static bool director_rendezvous_hashing(struct director *dir)
+{
+	return strcmp(dir->set->director_host_hash_method, "rendezvous") == 0;
+}
+
 static int
 director_handshake_cmd_options(struct director_connection *conn,
 			       const char *const *args)
 {
-	bool consistent_hashing = FALSE;
+	bool consistent_hashing = FALSE, rendezvous_hashing = FALSE;
 	unsigned int i;
 
 	for (i = 0; args[i] != NULL; i++) {
 		if (strcmp(args[i], DIRECTOR_OPT_CONSISTENT_HASHING) == 0)
 			consistent_hashing = TRUE;
+		else if (strcmp(args[i], DIRECTOR_OPT_RENDEZVOUS_HASHING) == 0)
+			rendezvous_hashing = TRUE;
 	}
 	if (!consistent_hashing) {
 		i_error("director(%s): director_consistent_hashing settings "
@@ -1467,6 +1539,11 @@ director_handshake_cmd_options(struct director_connection *conn,
 			conn->name);
 		return -1;
 	}
+	if (rendezvous_hashing != director_rendezvous_hashing(conn->dir)) {
+		i_error("director(%s): director_host_hash_method settings "
+			"differ between directors", conn->name);
+		return -1;
+	}
 	return 1;
 }
 
@@ -1543,6 +1620,8 @@ director_connection_handle_handshake(struct director_connection *conn,
 	     (strcmp(cmd, "USER") == 0 &&
 	      CMD_IS_USER_HANDSHAKE(conn->minor_version, args))))
 		return director_handshake_cmd_user(conn, args) ? 1 : -1;
+	if (conn->in && strcmp(cmd, "UB") == 0)
+		return director_handshake_cmd_user_batch(conn, args) ? 1 : -1;
 
 	/* both get DONE */
 	if (strcmp(cmd, "DONE") == 0)
@@ -2165,6 +2244,9 @@ static int director_connection_send_done(struct director_connection *conn)
 
 	if (conn->minor_version >= DIRECTOR_VERSION_OPTIONS) {
 		director_connection_send(conn,
+			director_rendezvous_hashing(conn->dir) ?
+			"OPTIONS\t"DIRECTOR_OPT_CONSISTENT_HASHING"\t"
+			DIRECTOR_OPT_RENDEZVOUS_HASHING"\n" :
 			"OPTIONS\t"DIRECTOR_OPT_CONSISTENT_HASHING"\n");
 	} else {
 		i_error("director(%s): Director version is too old for supporting director_consistent_hashing=yes",
@@ -2175,6 +2257,83 @@ static int director_connection_send_done(struct director_connection *conn)
 	return 0;
 }
 
+struct director_user_batch {
+	string_t *str;
+	unsigned int last_timestamp;
+};
+HASH_TABLE_DEFINE_TYPE(director_user_batches, struct mail_host *,
+		       struct director_user_batch *);
+
+static int
+director_connection_send_users_finish(struct director_connection *conn);
+
+static void
+director_connection_send_user_batch(struct director_connection *conn,
+				    struct director_user_batch *batch)
+{
+	if (str_len(batch->str) == 0)
+		return;
+	str_append_c(batch->str, '\n');
+	director_connection_send(conn, str_c(batch->str));
+	str_truncate(batch->str, 0);
+}
+
+static void
+director_connection_send_user_batches(struct director_connection *conn,
+	HASH_TABLE_TYPE(director_user_batches) batches)
+{
+	struct hash_iterate_context *iter;
+	struct mail_host *host;
+	struct director_user_batch *batch;
+
+	iter = hash_table_iterate_init(batches);
+	while (hash_table_iterate(iter, batches, &host, &batch))
+		director_connection_send_user_batch(conn, batch);
+	hash_table_iterate_deinit(&iter);
+}
+
+static int
+director_connection_send_users_batched(struct director_connection *conn,
+	HASH_TABLE_TYPE(director_user_batches) batches)
+{
+	struct director_user_batch *batch;
+	struct user *user;
+	unsigned int sent_count = 0;
+
+	/* Each user's host usually occurs many times, so group the users by
+	   host and send many of them in each "UB" line. */
+	while ((user = director_iterate_users_next(conn->user_iter)) != NULL) {
+		batch = hash_table_lookup(batches, user->host);
+		if (batch == NULL) {
+			batch = t_new(struct director_user_batch, 1);
+			batch->str = t_str_new(DIRECTOR_HANDSHAKE_USER_BATCH_MAX_LEN + 64);
+			hash_table_insert(batches, user->host, batch);
+		}
+		if (str_len(batch->str) == 0) {
+			str_append(batch->str, "UB\t");
+			str_append(batch->str, user->host->ip_str);
+			batch->last_timestamp = 0;
+		}
+		str_printfa(batch->str, "\t%u:%lld", user->username_hash,
+			    (long long)user->timestamp -
+			    (long long)batch->last_timestamp);
+		if (user->weak)
+			str_append_c(batch->str, 'w');
+		batch->last_timestamp = user->timestamp;
+		if (str_len(batch->str) >= DIRECTOR_HANDSHAKE_USER_BATCH_MAX_LEN)
+			director_connection_send_user_batch(conn, batch);
+
+		conn->handshake_users_sent++;
+		if (++sent_count >= DIRECTOR_HANDSHAKE_MAX_USERS_SENT_PER_FLUSH) {
+			/* Don't send too much at once to avoid hangs */
+			return 0;
+		}
+		if (o_stream_get_buffer_used_size(conn->output) >= OUTBUF_FLUSH_THRESHOLD)
+			return 0;
+	}
+	return 1;
+}
+
 static int director_connection_send_users(struct director_connection *conn)
 {
 	struct user *user;
@@ -2185,6 +2344,24 @@ static int director_connection_send_users(struct director_connection *conn)
 
 	i_assert(conn->version_received);
 
+	if (director_connection_get_minor_version(conn) >= DIRECTOR_VERSION_HANDSHAKE_UB_CMD) {
+		HASH_TABLE_TYPE(director_user_batches) batches;
+
+		hash_table_create_direct(&batches, default_pool, 0);
+		ret = director_connection_send_users_batched(conn, batches);
+		/* the users were only grouped within this call, since the
+		   hosts may change before the next one */
+		director_connection_send_user_batches(conn, batches);
+		hash_table_destroy(&batches);
+		if (ret == 0) {
+			/* continue later */
+			ret = o_stream_flush(conn->output);
+			timeout_reset(conn->to_ping);
+			return ret < 0 ? -1 : 0;
+		}
+		return director_connection_send_users_finish(conn);
+	}
+
 	/* with new versions use "U" for sending the handshake users, because
 	   otherwise their parameters may look identical and can't be
 	   distinguished. */
@@ -2220,6 +2397,14 @@ static int director_connection_send_users(struct director_connection *conn)
 			}
 		}
 	}
+	return director_connection_send_users_finish(conn);
+}
+
+static int
+director_connection_send_users_finish(struct director_connection *conn)
+{
+	int ret;
+
 	director_iterate_users_deinit(&conn->user_iter);
 	if (director_connection_send_done(conn) < 0)
 		return -1;
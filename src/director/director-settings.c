@@ -72,6 +72,7 @@ static const struct setting_define director_setting_defines[] = {
 	DEF(SET_STR, director_mail_servers),
 	DEF(SET_STR, director_username_hash),
 	DEF(SET_STR, director_flush_socket),
+	DEF(SET_ENUM, director_host_hash_method),
 	DEF(SET_TIME, director_ping_idle_timeout),
 	DEF(SET_TIME, director_ping_max_timeout),
 	DEF(SET_TIME, director_user_expire),
@@ -90,6 +91,7 @@ const struct director_settings director_default_settings = {
 	.director_mail_servers = "",
 	.director_username_hash = "%Lu",
 	.director_flush_socket = "",
+	.director_host_hash_method = "ring:rendezvous",
 	.director_ping_idle_timeout = 30,
 	.director_ping_max_timeout = 60,
 	.director_user_expire = 60*15,
@@ -10,6 +10,7 @@ struct director_settings {
 	const char *director_mail_servers;
 	const char *director_username_hash;
 	const char *director_flush_socket;
+	const char *director_host_hash_method;
 
 	unsigned int director_ping_idle_timeout;
 	unsigned int director_ping_max_timeout;
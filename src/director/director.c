@@ -24,6 +24,8 @@
 #define DIRECTOR_RECONNECT_RETRY_SECS 60
 #define DIRECTOR_RECONNECT_TIMEOUT_MSECS (30*1000)
 #define DIRECTOR_USER_MOVE_TIMEOUT_MSECS (30*1000)
+/* Maximum number of users kicked with a single IPC command */
+#define DIRECTOR_KICK_BATCH_MAX_USERS 1000
 #define DIRECTOR_SYNC_TIMEOUT_MSECS (5*1000)
 #define DIRECTOR_RING_MIN_WAIT_SECS 20
 #define DIRECTOR_QUICK_RECONNECT_TIMEOUT_MSECS 1000
@@ -904,6 +906,123 @@ director_flush_user(struct director *dir, struct user *user)
 	program_client_run_async(ctx->pclient, director_flush_user_continue, ctx);
 }
 
+struct director_kick_batch {
+	struct director *dir;
+	/* NULL entries are users whose move already finished */
+	ARRAY(struct director_kill_context *) kill_ctxs;
+	unsigned int pending_count;
+
+	struct timeout *to_send;
+	struct ipc_client_cmd *ipc_cmd;
+};
+
+static void director_kick_batch_free(struct director_kick_batch **_batch)
+{
+	struct director_kick_batch *batch = *_batch;
+
+	*_batch = NULL;
+	timeout_remove(&batch->to_send);
+	array_free(&batch->kill_ctxs);
+	i_free(batch);
+}
+
+static void director_kick_batch_remove(struct director_kill_context *kill_ctx)
+{
+	struct director_kick_batch *batch = kill_ctx->kick_batch;
+	struct director_kill_context **ctxp;
+
+	array_foreach_modifiable(&batch->kill_ctxs, ctxp) {
+		if (*ctxp == kill_ctx) {
+			*ctxp = NULL;
+			break;
+		}
+	}
+	kill_ctx->kick_batch = NULL;
+
+	i_assert(batch->pending_count > 0);
+	if (--batch->pending_count == 0 && batch->ipc_cmd != NULL) {
+		/* nobody is waiting for the reply anymore */
+		ipc_client_cmd_abort(batch->dir->ipc_proxy, &batch->ipc_cmd);
+		director_kick_batch_free(&batch);
+	}
+}
+
+static void director_kill_user_callback(enum ipc_client_cmd_state state,
+					const char *data, void *context);
+
+static void director_kick_batch_callback(enum ipc_client_cmd_state state,
+					 const char *data, void *context)
+{
+	struct director_kick_batch *batch = context;
+	struct director_kill_context *const *ctxs, *ctx;
+	unsigned int i, count;
+
+	if (state == IPC_CLIENT_CMD_STATE_REPLY) {
+		/* shouldn't get here. the command reply isn't finished yet. */
+		i_error("login process sent unexpected reply to kick: %s", data);
+		return;
+	}
+
+	/* don't try to abort the IPC command anymore */
+	batch->ipc_cmd = NULL;
+	/* the callbacks may finish other users' moves, which clears their
+	   entries from the array. */
+	ctxs = array_get(&batch->kill_ctxs, &count);
+	for (i = 0; i < count; i++) {
+		if ((ctx = ctxs[i]) == NULL)
+			continue;
+		ctx->kick_batch = NULL;
+		batch->pending_count--;
+		director_kill_user_callback(state, data, ctx);
+	}
+	director_kick_batch_free(&batch);
+}
+
+static void director_kick_batch_send(struct director *dir)
+{
+	struct director_kick_batch *batch = dir->kick_batch;
+	struct director_kill_context *const *ctxp;
+	string_t *cmd;
+
+	dir->kick_batch = NULL;
+	timeout_remove(&batch->to_send);
+	if (batch->pending_count == 0) {
+		director_kick_batch_free(&batch);
+		return;
+	}
+
+	cmd = t_str_new(64 + batch->pending_count * 11);
+	str_append(cmd, "proxy\t*\tKICK-DIRECTOR-HASHES");
+	array_foreach(&batch->kill_ctxs, ctxp) {
+		if (*ctxp != NULL)
+			str_printfa(cmd, "\t%u", (*ctxp)->username_hash);
+	}
+	batch->ipc_cmd = ipc_client_cmd(dir->ipc_proxy, str_c(cmd),
+					director_kick_batch_callback, batch);
+}
+
+static void director_kick_batch_add(struct director *dir,
+				    struct director_kill_context *kill_ctx)
+{
+	struct director_kick_batch *batch = dir->kick_batch;
+
+	if (batch == NULL) {
+		/* send the kicks after all the users moved by the current
+		   ioloop run have been added */
+		batch = dir->kick_batch = i_new(struct director_kick_batch, 1);
+		batch->dir = dir;
+		i_array_init(&batch->kill_ctxs, 16);
+		batch->to_send = timeout_add_short(0, director_kick_batch_send,
+						   dir);
+	}
+	array_push_back(&batch->kill_ctxs, &kill_ctx);
+	batch->pending_count++;
+	kill_ctx->kick_batch = batch;
+
+	if (array_count(&batch->kill_ctxs) >= DIRECTOR_KICK_BATCH_MAX_USERS)
+		director_kick_batch_send(dir);
+}
+
 static void director_user_move_finished(struct director *dir)
 {
 	i_assert(dir->users_moving_count > 0);
@@ -922,8 +1041,8 @@ static void director_user_move_free(struct user *user)
 	dir_debug("User %u move finished at state=%s", user->username_hash,
 		  user_kill_state_names[kill_ctx->kill_state]);
 
-	if (kill_ctx->ipc_cmd != NULL)
-		ipc_client_cmd_abort(dir->ipc_proxy, &kill_ctx->ipc_cmd);
+	if (kill_ctx->kick_batch != NULL)
+		director_kick_batch_remove(kill_ctx);
 	timeout_remove(&kill_ctx->to_move);
 	i_free(kill_ctx->socket_path);
 	i_free(kill_ctx);
@@ -1001,17 +1120,12 @@ static void director_kill_user_callback(enum ipc_client_cmd_state state,
 	struct director_kill_context *ctx = context;
 	struct user *user;
 
-	/* don't try to abort the IPC command anymore */
-	ctx->ipc_cmd = NULL;
-
 	/* this is an asynchronous notification about user being killed.
 	   there are no guarantees about what might have happened to the user
 	   in the mean time. */
 	switch (state) {
 	case IPC_CLIENT_CMD_STATE_REPLY:
-		/* shouldn't get here. the command reply isn't finished yet. */
-		i_error("login process sent unexpected reply to kick: %s", data);
-		return;
+		i_unreached();
 	case IPC_CLIENT_CMD_STATE_OK:
 		break;
 	case IPC_CLIENT_CMD_STATE_ERROR:
@@ -1072,7 +1186,6 @@ void director_kill_user(struct director *dir, struct director_host *src,
 			struct mail_host *old_host, bool forced_kick)
 {
 	struct director_kill_context *ctx;
-	const char *cmd;
 
 	if (USER_IS_BEING_KILLED(user)) {
 		/* User is being moved again before the previous move
@@ -1101,11 +1214,8 @@ void director_kill_user(struct director *dir, struct director_host *src,
 	ctx->kill_state = USER_KILL_STATE_KILLING;
 
 	if ((old_host != NULL && old_host != user->host) || forced_kick) {
-		cmd = t_strdup_printf("proxy\t*\tKICK-DIRECTOR-HASH\t%u",
-				      user->username_hash);
 		dir->users_kicking_count++;
-		ctx->ipc_cmd = ipc_client_cmd(dir->ipc_proxy, cmd,
-					      director_kill_user_callback, ctx);
+		director_kick_batch_add(dir, ctx);
 	} else {
 		/* a) we didn't even know about the user before now.
 		   don't bother performing a local kick, since it wouldn't
@@ -1449,7 +1559,8 @@ director_init(const struct director_settings *set,
 	i_array_init(&dir->pending_requests, 16);
 	i_array_init(&dir->connections, 8);
 	dir->mail_hosts = mail_hosts_init(set->director_user_expire,
-					  director_user_freed);
+		strcmp(set->director_host_hash_method, "rendezvous") == 0,
+		director_user_freed);
 
 	dir->ipc_proxy = ipc_client_init(DIRECTOR_IPC_PROXY_PATH);
 	dir->ring_min_version = DIRECTOR_VERSION_MINOR;
@@ -1473,6 +1584,8 @@ void director_deinit(struct director **_dir)
 	mail_hosts_deinit(&dir->mail_hosts);
 	mail_hosts_deinit(&dir->orig_config_hosts);
 
+	if (dir->kick_batch != NULL)
+		director_kick_batch_free(&dir->kick_batch);
 	ipc_client_deinit(&dir->ipc_proxy);
 	timeout_remove(&dir->to_reconnect);
 	timeout_remove(&dir->to_handshake_warning);
@@ -6,7 +6,7 @@
 
 #define DIRECTOR_VERSION_NAME "director"
 #define DIRECTOR_VERSION_MAJOR 1
-#define DIRECTOR_VERSION_MINOR 9
+#define DIRECTOR_VERSION_MINOR 10
 
 /* weak users supported in protocol */
 #define DIRECTOR_VERSION_WEAK_USERS 1
@@ -30,6 +30,8 @@
 #define DIRECTOR_VERSION_HANDSHAKE_U_CMD 9
 /* USER event with timestamp supported */
 #define DIRECTOR_VERSION_USER_TIMESTAMP 9
+/* Users are sent in batches as "UB" command in handshake */
+#define DIRECTOR_VERSION_HANDSHAKE_UB_CMD 10
 
 /* Minimum time between even attempting to communicate with a director that
    failed due to a protocol error. */
@@ -90,8 +92,8 @@ struct director_kill_context {
 	/* Move timeout to make sure user's connections won't silently hang
 	   indefinitely if there is some trouble moving it. */
 	struct timeout *to_move;
-	/* IPC command to kick the user */
-	struct ipc_client_cmd *ipc_cmd;
+	/* Batched IPC command that kicks the user */
+	struct director_kick_batch *kick_batch;
 
 	/* these are set only for director_flush_socket handling: */
 	struct ip_addr host_ip;
@@ -146,6 +148,8 @@ struct director {
 	struct timeout *to_remove_dirs;
 
 	struct ipc_client *ipc_proxy;
+	/* Users waiting to be kicked with the next batched IPC command */
+	struct director_kick_batch *kick_batch;
 	unsigned int sync_seq;
 	unsigned int ring_change_counter;
 	unsigned int last_sync_sent_ring_change_counter;
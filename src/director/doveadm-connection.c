@@ -128,7 +128,8 @@ doveadm_cmd_host_list_removed(struct doveadm_connection *conn,
 	int ret;
 
 	orig_hosts_list = mail_hosts_init(conn->dir->set->director_user_expire,
-					  NULL);
+		strcmp(conn->dir->set->director_host_hash_method, "rendezvous") == 0,
+		NULL);
 	(void)mail_hosts_parse_and_add(orig_hosts_list,
 				       conn->dir->set->director_mail_servers);
 
@@ -16,6 +16,7 @@ struct mail_host_list {
 	user_free_hook_t *user_free_hook;
 	unsigned int hosts_hash;
 	unsigned int user_expire_secs;
+	bool rendezvous_hashing;
 	bool vhosts_unsorted;
 	bool have_vhosts;
 };
@@ -415,6 +416,38 @@ mail_host_get_by_hash_ring(struct mail_tag *tag, unsigned int hash)
 	return vhosts[idx % count].host;
 }
 
+static inline uint64_t
+mail_vhost_rendezvous_score(const struct mail_vhost *vhost, unsigned int hash)
+{
+	uint64_t x = ((uint64_t)vhost->hash << 32) | hash;
+
+	/* splitmix64 finalizer */
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+static struct mail_host *
+mail_host_get_by_hash_rendezvous(struct mail_tag *tag, unsigned int hash)
+{
+	const struct mail_vhost *vhost, *best = NULL;
+	uint64_t score, best_score = 0;
+
+	/* Each vhost is equally likely to win, so the users are divided
+	   between the hosts in proportion to their vhost counts. Adding or
+	   removing a host (or some of its vhosts) moves only the users that
+	   the change itself wins or loses. The vhosts are sorted, so ties
+	   are broken the same way in all the directors. */
+	array_foreach(&tag->vhosts, vhost) {
+		score = mail_vhost_rendezvous_score(vhost, hash);
+		if (best == NULL || score > best_score) {
+			best = vhost;
+			best_score = score;
+		}
+	}
+	return best == NULL ? NULL : best->host;
+}
+
 struct mail_host *
 mail_host_get_by_hash(struct mail_host_list *list, unsigned int hash,
 		      const char *tag_name)
@@ -428,6 +461,8 @@ mail_host_get_by_hash(struct mail_host_list *list, unsigned int hash,
 	if (tag == NULL)
 		return NULL;
 
+	if (list->rendezvous_hashing)
+		return mail_host_get_by_hash_rendezvous(tag, hash);
 	return mail_host_get_by_hash_ring(tag, hash);
 }
 
@@ -482,13 +517,14 @@ const ARRAY_TYPE(mail_tag) *mail_hosts_get_tags(struct mail_host_list *list)
 }
 
 struct mail_host_list *
-mail_hosts_init(unsigned int user_expire_secs,
+mail_hosts_init(unsigned int user_expire_secs, bool rendezvous_hashing,
 		user_free_hook_t *user_free_hook)
 {
 	struct mail_host_list *list;
 
 	list = i_new(struct mail_host_list, 1);
 	list->user_expire_secs = user_expire_secs;
+	list->rendezvous_hashing = rendezvous_hashing;
 	list->user_free_hook = user_free_hook;
 
 	i_array_init(&list->hosts, 16);
@@ -531,7 +567,8 @@ struct mail_host_list *mail_hosts_dup(const struct mail_host_list *src)
 	struct mail_host_list *dest;
 	struct mail_host *const *hostp, *dest_host;
 
-	dest = mail_hosts_init(src->user_expire_secs, src->user_free_hook);
+	dest = mail_hosts_init(src->user_expire_secs, src->rendezvous_hashing,
+			       src->user_free_hook);
 	array_foreach(&src->hosts, hostp) {
 		dest_host = mail_host_dup(dest, *hostp);
 		array_push_back(&dest->hosts, &dest_host);
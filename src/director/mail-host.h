@@ -77,8 +77,11 @@ struct user *
 mail_hosts_find_user(struct mail_host_list *list, const char *tag_name,
 		     unsigned int username_hash);
 
+/* With rendezvous_hashing=TRUE each user is mapped to the host whose vhost
+   gets the highest hash combined with the username hash. Otherwise the user
+   is mapped to the next vhost in the hash ring. */
 struct mail_host_list *
-mail_hosts_init(unsigned int user_expire_secs,
+mail_hosts_init(unsigned int user_expire_secs, bool rendezvous_hashing,
 		user_free_hook_t *user_free_hook);
 void mail_hosts_deinit(struct mail_host_list **list);
 
@@ -14,6 +14,8 @@
 #define USER_NEAR_EXPIRING_MAX 30
 /* This shouldn't matter what it is exactly, just try it sometimes later. */
 #define USER_BEING_KILLED_EXPIRE_RETRY_SECS 60
+/* Users are allocated in chunks of this many users */
+#define USER_DIRECTORY_CHUNK_USER_COUNT 1024
 
 struct user_directory_iter {
 	struct user_directory *dir;
@@ -29,6 +31,12 @@ struct user_directory {
 	ARRAY(struct user_directory_iter *) iters;
 	user_free_hook_t *user_free_hook;
 
+	/* Allocating each user separately would waste a lot of memory with
+	   millions of users, so they're allocated from these chunks. The
+	   freed users are linked via their next pointers. */
+	ARRAY(struct user *) user_chunks;
+	struct user *free_users;
+
 	unsigned int timeout_secs;
 	/* If user's expire time is less than this many seconds away,
 	   don't assume that other directors haven't yet expired it */
@@ -53,6 +61,25 @@ static void user_move_iters(struct user_directory *dir, struct user *user)
 	}
 }
 
+static struct user *user_alloc(struct user_directory *dir)
+{
+	struct user *user, *chunk;
+	unsigned int i;
+
+	if (dir->free_users == NULL) {
+		chunk = i_new(struct user, USER_DIRECTORY_CHUNK_USER_COUNT);
+		array_push_back(&dir->user_chunks, &chunk);
+		for (i = USER_DIRECTORY_CHUNK_USER_COUNT; i > 0; i--) {
+			chunk[i-1].next = dir->free_users;
+			dir->free_users = &chunk[i-1];
+		}
+	}
+	user = dir->free_users;
+	dir->free_users = user->next;
+	i_zero(user);
+	return user;
+}
+
 static void user_free(struct user_directory *dir, struct user *user)
 {
 	i_assert(user->host->user_count > 0);
@@ -64,7 +91,10 @@ static void user_free(struct user_directory *dir, struct user *user)
 
 	hash_table_remove(dir->hash, POINTER_CAST(user->username_hash));
 	DLLIST2_REMOVE(&dir->head, &dir->tail, user);
-	i_free(user);
+
+	i_zero(user);
+	user->next = dir->free_users;
+	dir->free_users = user;
 }
 
 static bool user_directory_user_has_connections(struct user_directory *dir,
@@ -150,7 +180,7 @@ user_directory_add(struct user_directory *dir, unsigned int username_hash,
 	if (timestamp > ioloop_time)
 		timestamp = ioloop_time;
 
-	user = i_new(struct user, 1);
+	user = user_alloc(dir);
 	user->username_hash = username_hash;
 	user->host = host;
 	user->host->user_count++;
@@ -271,14 +301,16 @@ user_directory_init(unsigned int timeout_secs,
 	i_assert(dir->timeout_secs/2 > dir->user_near_expiring_secs);
 
 	dir->user_free_hook = user_free_hook;
-	hash_table_create_direct(&dir->hash, default_pool, 0);
+	hash_table_create_direct_open(&dir->hash, 0);
 	i_array_init(&dir->iters, 8);
+	i_array_init(&dir->user_chunks, 16);
 	return dir;
 }
 
 void user_directory_deinit(struct user_directory **_dir)
 {
 	struct user_directory *dir = *_dir;
+	struct user **chunkp;
 
 	*_dir = NULL;
 
@@ -289,6 +321,9 @@ void user_directory_deinit(struct user_directory **_dir)
 	timeout_remove(&dir->to_expire);
 	hash_table_destroy(&dir->hash);
 	array_free(&dir->iters);
+	array_foreach_modifiable(&dir->user_chunks, chunkp)
+		i_free(*chunkp);
+	array_free(&dir->user_chunks);
 	i_free(dir);
 }
 
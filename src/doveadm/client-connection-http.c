@@ -47,6 +47,14 @@ enum client_request_parse_state {
 	CLIENT_REQUEST_PARSE_DONE
 };
 
+/* Command parsed from the request, executed once the whole request is read */
+struct client_request_http_cmd {
+	const struct doveadm_cmd_ver2 *cmd;
+	ARRAY_TYPE(doveadm_cmd_param_arr_t) pargv;
+	int method_err;
+	char *method_id;
+};
+
 struct client_request_http {
 	pool_t pool;
 	struct client_connection_http *conn;
@@ -63,6 +71,7 @@ struct client_request_http {
 	struct doveadm_cmd_param *cmd_param;
 	struct ioloop *ioloop;
 	ARRAY_TYPE(doveadm_cmd_param_arr_t) pargv;
+	ARRAY(struct client_request_http_cmd) cmds;
 	int method_err;
 	char *method_id;
 	bool first_row;
@@ -273,7 +282,6 @@ request_json_parse_init(struct client_request_http *req)
 		return -1;
 	}
 	req->first_row = TRUE;
-	o_stream_nsend_str(req->output,"[");
 
 	/* next: parse the next command */
 	req->parse_state = CLIENT_REQUEST_PARSE_CMD;
@@ -633,8 +641,15 @@ request_json_parse_cmd_done(struct client_request_http *req)
 		return -1;
 	}
 
-	/* execute command */
-	doveadm_http_server_command_execute(req);
+	/* queue the command - the commands are executed once the whole
+	   request is read, so the response can be streamed to the client */
+	struct client_request_http_cmd *cmd = array_append_space(&req->cmds);
+	cmd->cmd = req->cmd;
+	cmd->pargv = req->pargv;
+	cmd->method_err = req->method_err;
+	cmd->method_id = req->method_id;
+	req->method_id = NULL;
+	p_array_init(&req->pargv, req->pool, 5);
 
 	/* next: parse next command */
 	req->parse_state = CLIENT_REQUEST_PARSE_CMD;
@@ -702,6 +717,44 @@ doveadm_http_server_json_parse_v1(struct client_request_http *req)
 	i_unreached();
 }
 
+static void
+doveadm_http_server_execute_commands(struct client_request_http *req)
+{
+	struct http_server_request *http_sreq = req->http_request;
+	struct http_server_response *http_resp;
+	struct client_request_http_cmd *cmd;
+
+	/* The results are written to the client as soon as each command
+	   finishes using chunked encoding, so large results aren't
+	   buffered. The output stream blocks while the client is slow. */
+	http_resp = http_server_response_create(http_sreq, 200, "OK");
+	http_server_response_add_header(http_resp, "Content-Type",
+		"application/json; charset=utf-8");
+	req->output = http_server_response_get_payload_output(http_resp, TRUE);
+
+	o_stream_nsend_str(req->output, "[");
+	array_foreach_modifiable(&req->cmds, cmd) {
+		if (req->output->stream_errno != 0)
+			break;
+		req->cmd = cmd->cmd;
+		req->method_err = cmd->method_err;
+		req->method_id = cmd->method_id;
+		req->pargv = cmd->pargv;
+		doveadm_http_server_command_execute(req);
+		doveadm_cmd_params_clean(&req->pargv);
+	}
+	o_stream_nsend_str(req->output, "]");
+
+	if (o_stream_finish(req->output) < 0) {
+		i_info("error writing output: %s",
+		       o_stream_get_error(req->output));
+		/* aborts the response and closes the connection */
+		o_stream_destroy(&req->output);
+		return;
+	}
+	o_stream_unref(&req->output);
+}
+
 static void
 doveadm_http_server_read_request_v1(struct client_request_http *req)
 {
@@ -745,9 +798,8 @@ doveadm_http_server_read_request_v1(struct client_request_http *req)
 	}
 
 	i_stream_destroy(&req->input);
-	o_stream_nsend_str(req->output,"]");
 
-	doveadm_http_server_send_response(req);
+	doveadm_http_server_execute_commands(req);
 }
 
 static void doveadm_http_server_camelcase_value(string_t *value)
@@ -952,6 +1004,12 @@ doveadm_http_server_request_destroy(struct client_request_http *req)
 		(void)json_parser_deinit(&req->json_parser, &error);
 		// we've already failed, ignore error
 	}
+	if (array_is_created(&req->cmds)) {
+		struct client_request_http_cmd *cmd;
+
+		array_foreach_modifiable(&req->cmds, cmd)
+			doveadm_cmd_params_clean(&cmd->pargv);
+	}
 	if (req->output != NULL)
 		o_stream_set_no_error_handling(req->output, TRUE);
 	io_remove(&req->io);
@@ -1130,9 +1188,8 @@ doveadm_http_server_handle_request(void *context,
 				  net_ip2addr(&conn->conn.remote_ip));
 		i_stream_ref(req->input);
 		req->io = io_add_istream(req->input, *ep->handler, req);
-		req->output = iostream_temp_create_named(
-			"/tmp/doveadm.", 0, net_ip2addr(&conn->conn.remote_ip));
 		p_array_init(&req->pargv, req->pool, 5);
+		p_array_init(&req->cmds, req->pool, 4);
 		ep->handler(req);
 	} else {
 		req->output = iostream_temp_create_named(
@@ -18,6 +18,9 @@
 #include <unistd.h>
 #include <fcntl.h>
 
+/* Same as the director's default vhost count for new hosts */
+#define DIRECTOR_DEFAULT_VHOST_COUNT 100
+
 struct director_context {
 	const char *socket_path;
 	const char *users_path;
@@ -450,6 +453,30 @@ deinit:
 	pool_unref(&pool);
 }
 
+static int
+director_load_get_vhost_count(struct doveadm_cmd_context *cctx,
+			      const char *load_str, unsigned int *vhost_count_r)
+{
+	int64_t base = DIRECTOR_DEFAULT_VHOST_COUNT, min;
+	unsigned int load;
+
+	(void)doveadm_cmd_param_int64(cctx, "base-vhost-count", &base);
+	if (!doveadm_cmd_param_int64(cctx, "min-vhost-count", &min))
+		min = I_MAX(base / 10, 1);
+	if (str_to_uint(load_str, &load) < 0 ||
+	    base <= 0 || base > UINT_MAX || min < 0 || min > base)
+		return -1;
+
+	/* Load is the percentage of the host's nominal capacity. Keep the
+	   full vhost count until the host is overloaded, and then give it
+	   new users in inverse proportion to its load. */
+	if (load <= 100)
+		*vhost_count_r = base;
+	else
+		*vhost_count_r = I_MAX(base * 100 / load, min);
+	return 0;
+}
+
 static void
 cmd_director_add_or_update(struct doveadm_cmd_context *cctx, bool update)
 {
@@ -457,7 +484,7 @@ cmd_director_add_or_update(struct doveadm_cmd_context *cctx, bool update)
 	struct director_context *ctx;
 	struct ip_addr *ips;
 	unsigned int i, ips_count, vhost_count = UINT_MAX;
-	const char *line, *host;
+	const char *line, *host, *load;
 	string_t *cmd;
 
 	ctx = cmd_director_init(cctx);
@@ -467,7 +494,12 @@ cmd_director_add_or_update(struct doveadm_cmd_context *cctx, bool update)
 		director_cmd_help(cctx->cmd);
 		return;
 	}
-	if (ctx->vhost_count != NULL) {
+	if (doveadm_cmd_param_str(cctx, "load", &load)) {
+		if (director_load_get_vhost_count(cctx, load, &vhost_count) < 0) {
+			director_cmd_help(cctx->cmd);
+			return;
+		}
+	} else if (ctx->vhost_count != NULL) {
 		if (str_to_uint(ctx->vhost_count, &vhost_count) < 0) {
 			director_cmd_help(cctx->cmd);
 			return;
@@ -531,6 +563,17 @@ static void cmd_director_update(struct doveadm_cmd_context *cctx)
 	cmd_director_add_or_update(cctx, TRUE);
 }
 
+static void cmd_director_load(struct doveadm_cmd_context *cctx)
+{
+	const char *load;
+
+	if (!doveadm_cmd_param_str(cctx, "load", &load)) {
+		director_cmd_help(cctx->cmd);
+		return;
+	}
+	cmd_director_add_or_update(cctx, TRUE);
+}
+
 static void
 cmd_director_ipcmd(const char *cmd_name, const char *success_result,
 	struct doveadm_cmd_context *cctx)
@@ -968,6 +1011,18 @@ DOVEADM_CMD_PARAM('\0', "host", CMD_PARAM_STR, CMD_PARAM_FLAG_POSITIONAL)
 DOVEADM_CMD_PARAM('\0', "vhost-count", CMD_PARAM_STR, CMD_PARAM_FLAG_POSITIONAL)
 DOVEADM_CMD_PARAMS_END
 },
+{
+	.name = "director load",
+	.cmd = cmd_director_load,
+	.usage = "[-a <director socket path>] [-b <base vhost count>] [-m <min vhost count>] <host> <load>",
+DOVEADM_CMD_PARAMS_START
+DOVEADM_CMD_PARAM('a', "socket-path", CMD_PARAM_STR, 0)
+DOVEADM_CMD_PARAM('b', "base-vhost-count", CMD_PARAM_INT64, 0)
+DOVEADM_CMD_PARAM('m', "min-vhost-count", CMD_PARAM_INT64, 0)
+DOVEADM_CMD_PARAM('\0', "host", CMD_PARAM_STR, CMD_PARAM_FLAG_POSITIONAL)
+DOVEADM_CMD_PARAM('\0', "load", CMD_PARAM_STR, CMD_PARAM_FLAG_POSITIONAL)
+DOVEADM_CMD_PARAMS_END
+},
 {
 	.name = "director up",
 	.cmd = cmd_director_up,
@@ -270,14 +270,27 @@ static int fetch_text_utf8(struct fetch_cmd_context *ctx)
 	struct message_decoder_context *decoder;
 	struct message_block raw_block, block;
 	struct message_part *parts;
+	enum mail_lookup_abort orig_lookup_abort;
+	const char *error;
 	int ret = 0;
 
 	if (mail_get_stream(ctx->mail, NULL, NULL, &input) < 0)
 		return -1;
 
-	parser = message_parser_init(pool_datastack_create(), input,
-				     MESSAGE_HEADER_PARSER_FLAG_CLEAN_ONELINE,
-				     0);
+	/* use the cached MIME structure if it exists */
+	orig_lookup_abort = ctx->mail->lookup_abort;
+	ctx->mail->lookup_abort = MAIL_LOOKUP_ABORT_NOT_IN_CACHE;
+	if (mail_get_parts(ctx->mail, &parts) < 0)
+		parts = NULL;
+	ctx->mail->lookup_abort = orig_lookup_abort;
+
+	if (parts != NULL) {
+		parser = message_parser_init_from_parts(parts, input,
+				MESSAGE_HEADER_PARSER_FLAG_CLEAN_ONELINE, 0);
+	} else {
+		parser = message_parser_init(pool_datastack_create(), input,
+				MESSAGE_HEADER_PARSER_FLAG_CLEAN_ONELINE, 0);
+	}
 	decoder = message_decoder_init(NULL, 0);
 
 	while ((ret = message_parser_parse_next_block(parser, &raw_block)) > 0) {
@@ -304,7 +317,11 @@ static int fetch_text_utf8(struct fetch_cmd_context *ctx)
 	}
 	i_assert(ret != 0);
 	message_decoder_deinit(&decoder);
-	message_parser_deinit(&parser, &parts);
+	if (message_parser_deinit_from_parts(&parser, &parts, &error) < 0) {
+		mail_set_cache_corrupted(ctx->mail, MAIL_FETCH_MESSAGE_PARTS,
+			t_strdup_printf("Cached MIME parts don't match message during parsing: %s",
+					error));
+	}
 
 	doveadm_print_stream("", 0);
 	if (input->stream_errno != 0) {
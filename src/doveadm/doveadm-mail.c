@@ -7,7 +7,12 @@
 #include "istream.h"
 #include "istream-dot.h"
 #include "istream-seekable.h"
+#include "ostream.h"
 #include "str.h"
+#include "strescape.h"
+#include "fd-util.h"
+#include "write-full.h"
+#include "time-util.h"
 #include "unichar.h"
 #include "module-dir.h"
 #include "wildcard-match.h"
@@ -29,6 +34,9 @@
 #include "doveadm-mail.h"
 
 #include <stdio.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/wait.h>
 
 #define DOVEADM_MAIL_CMD_INPUT_TIMEOUT_MSECS (5*60*1000)
 
@@ -492,18 +500,52 @@ int doveadm_mail_single_user(struct doveadm_mail_cmd_context *ctx,
 	return doveadm_mail_next_user(ctx, error_r);
 }
 
+struct doveadm_mail_worker {
+	pid_t pid;
+	/* usernames are written to the worker's fd */
+	int fd;
+	/* the worker's print output and the finished-user markers */
+	int output_fd;
+	/* partial tab-escaped field read from output_fd */
+	string_t *field;
+
+	bool busy:1;
+	bool streaming:1;
+};
+
+struct doveadm_mail_workers {
+	struct doveadm_mail_worker *workers;
+	unsigned int count;
+	/* the worker whose output is currently being printed. The others'
+	   output isn't read until it has finished its user, so the users'
+	   output doesn't get mixed. */
+	struct doveadm_mail_worker *printing;
+
+	unsigned int finished_count;
+	struct timeval start_time;
+
+	bool failed:1;
+};
+
 static void
-doveadm_mail_all_users(struct doveadm_mail_cmd_context *ctx,
-		       const char *wildcard_user)
+doveadm_mail_print_progress(unsigned int user_count,
+			    const struct timeval *start_time)
 {
-	struct doveadm_cmd_context *cctx = ctx->cctx;
-	unsigned int user_idx;
-	const char *ip, *user, *error;
-	int ret;
-
-	ctx->service_flags |= MAIL_STORAGE_SERVICE_FLAG_USERDB_LOOKUP;
+	struct timeval now;
+	long long msecs;
+
+	if (gettimeofday(&now, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	msecs = timeval_diff_msecs(&now, start_time);
+	printf("\r%u users, %.1f users/sec", user_count,
+	       msecs <= 0 ? 0.0 : user_count * 1000.0 / msecs);
+	fflush(stdout);
+}
 
-	doveadm_cctx_to_storage_service_input(cctx, &ctx->storage_service_input);
+static void
+doveadm_mail_all_users_init(struct doveadm_mail_cmd_context *ctx,
+			    const char *wildcard_user, bool iterate)
+{
 	ctx->storage_service = mail_storage_service_init(master_service, NULL,
 							 ctx->service_flags);
         lib_signals_set_handler(SIGINT, 0, sig_die, NULL);
@@ -511,18 +553,36 @@ doveadm_mail_all_users(struct doveadm_mail_cmd_context *ctx,
 
 	ctx->v.init(ctx, ctx->args);
 
-	mail_storage_service_all_init_mask(ctx->storage_service,
-		wildcard_user != NULL ? wildcard_user : "");
+	if (iterate) {
+		mail_storage_service_all_init_mask(ctx->storage_service,
+			wildcard_user != NULL ? wildcard_user : "");
+	}
 
 	if (hook_doveadm_mail_init != NULL)
 		hook_doveadm_mail_init(ctx);
+}
 
-	user_idx = 0;
-	while ((ret = ctx->v.get_next_user(ctx, &user)) > 0) {
-		if (wildcard_user != NULL) {
-			if (!wildcard_match_icase(user, wildcard_user))
-				continue;
-		}
+static void
+doveadm_mail_worker_run(struct doveadm_mail_cmd_context *ctx, int fd,
+			int output_fd)
+{
+	struct doveadm_cmd_context *cctx = ctx->cctx;
+	struct istream *input;
+	struct ostream *output;
+	const char *user, *error;
+	int ret;
+
+	/* the parent prints our output with its formatter */
+	output = o_stream_create_fd_autoclose(&output_fd, 0);
+	o_stream_set_no_error_handling(output, TRUE);
+	doveadm_print_forward(output);
+
+	/* usernames are read from the parent's pipe one at a time. The
+	   storage service and its settings cache are shared by all the
+	   users. */
+	doveadm_mail_all_users_init(ctx, NULL, FALSE);
+	input = i_stream_create_fd(fd, 1024);
+	while ((user = i_stream_read_next_line(input)) != NULL) {
 		cctx->username = user;
 		doveadm_print_sticky("username", user);
 		T_BEGIN {
@@ -532,13 +592,377 @@ doveadm_mail_all_users(struct doveadm_mail_cmd_context *ctx,
 			else if (ret == 0)
 				i_info("User no longer exists, skipping");
 		} T_END;
-		if (ret == -1)
+		doveadm_print_flush();
+		/* tell the parent that we're ready for the next user */
+		o_stream_nsend(doveadm_print_ostream, "\n", 1);
+		(void)o_stream_flush(doveadm_print_ostream);
+		if (ret == -1) {
+			ctx->exit_code = EX_TEMPFAIL;
+			break;
+		}
+		if (killed_signo != 0)
 			break;
-		if (doveadm_verbose) {
-			if (++user_idx % 100 == 0) {
-				printf("\r%d", user_idx);
-				fflush(stdout);
+	}
+	if (input->stream_errno != 0) {
+		i_error("read(worker pipe) failed: %s",
+			i_stream_get_error(input));
+		ctx->exit_code = EX_TEMPFAIL;
+	}
+	i_stream_destroy(&input);
+	i_close_fd(&fd);
+	i_set_failure_prefix("doveadm: ");
+}
+
+static void doveadm_mail_worker_close(struct doveadm_mail_worker *worker)
+{
+	if (worker->fd != -1)
+		i_close_fd(&worker->fd);
+	if (worker->output_fd != -1)
+		i_close_fd(&worker->output_fd);
+	if (worker->field != NULL)
+		str_free(&worker->field);
+	worker->busy = FALSE;
+}
+
+static int
+doveadm_mail_workers_start(struct doveadm_mail_cmd_context *ctx,
+			   struct doveadm_mail_workers *w)
+{
+	struct doveadm_mail_worker *worker;
+	unsigned int i, j;
+	int fd[2], output_fd[2];
+	pid_t pid;
+
+	/* flush any pending output, so the workers don't duplicate it */
+	doveadm_print_flush();
+	fflush(stdout);
+
+	for (i = 0; i < w->count; i++) {
+		if (pipe(fd) < 0) {
+			i_error("pipe() failed: %m");
+			return -1;
+		}
+		if (pipe(output_fd) < 0) {
+			i_error("pipe() failed: %m");
+			i_close_fd(&fd[0]);
+			i_close_fd(&fd[1]);
+			return -1;
+		}
+		if ((pid = fork()) < 0) {
+			i_error("fork() failed: %m");
+			i_close_fd(&fd[0]);
+			i_close_fd(&fd[1]);
+			i_close_fd(&output_fd[0]);
+			i_close_fd(&output_fd[1]);
+			return -1;
+		}
+		if (pid == 0) {
+			io_loop_reinit_after_fork();
+			i_failure_discard_buffer();
+			/* worker - the other workers' pipes belong to the
+			   parent */
+			for (j = 0; j < i; j++)
+				doveadm_mail_worker_close(&w->workers[j]);
+			i_close_fd(&fd[1]);
+			i_close_fd(&output_fd[0]);
+			doveadm_mail_worker_run(ctx, fd[0], output_fd[1]);
+			return 1;
+		}
+		i_close_fd(&fd[0]);
+		i_close_fd(&output_fd[1]);
+		fd_close_on_exec(fd[1], TRUE);
+		fd_close_on_exec(output_fd[0], TRUE);
+		worker = &w->workers[i];
+		worker->pid = pid;
+		worker->fd = fd[1];
+		worker->output_fd = output_fd[0];
+		worker->field = str_new(default_pool, 128);
+	}
+	return 0;
+}
+
+static void
+doveadm_mail_worker_print_field(struct doveadm_mail_worker *worker, bool last)
+{
+	const unsigned char *data = str_data(worker->field);
+	size_t size = str_len(worker->field);
+	string_t *value;
+
+	if (!last) {
+		/* streaming a long field - keep a trailing escape character
+		   until we see the character after it */
+		if (size > 0 && data[size-1] == '\001')
+			size--;
+		if (size == 0)
+			return;
+	}
+
+	value = t_str_new(size + 1);
+	str_append_tabunescaped(value, data, size);
+	if (last && !worker->streaming)
+		doveadm_print(str_c(value));
+	else {
+		if (str_len(value) > 0)
+			doveadm_print_stream(str_data(value), str_len(value));
+		if (last)
+			doveadm_print_stream("", 0);
+		worker->streaming = !last;
+	}
+	str_delete(worker->field, 0, size);
+}
+
+static int
+doveadm_mail_worker_read(struct doveadm_mail_workers *w,
+			 struct doveadm_mail_worker *worker)
+{
+	unsigned char buf[IO_BLOCK_SIZE];
+	size_t i, start;
+	ssize_t ret;
+
+	ret = read(worker->output_fd, buf, sizeof(buf));
+	if (ret < 0 && errno == EINTR)
+		return 0;
+	if (ret <= 0) {
+		if (ret < 0)
+			i_error("read(worker %ld) failed: %m", (long)worker->pid);
+		else {
+			i_error("Worker %ld exited while processing a user",
+				(long)worker->pid);
+		}
+		if (worker->streaming)
+			doveadm_print_stream("", 0);
+		doveadm_mail_worker_close(worker);
+		w->printing = NULL;
+		return -1;
+	}
+
+	w->printing = worker;
+	for (i = start = 0; i < (size_t)ret; i++) {
+		if (buf[i] == '\n') {
+			/* the worker finished the user */
+			if (i != start || str_len(worker->field) > 0 ||
+			    i + 1 != (size_t)ret) {
+				i_error("Worker %ld sent broken print output",
+					(long)worker->pid);
+				doveadm_mail_worker_close(worker);
+				w->printing = NULL;
+				return -1;
+			}
+			worker->busy = FALSE;
+			w->printing = NULL;
+			if (++w->finished_count % 100 == 0 && doveadm_verbose) {
+				doveadm_mail_print_progress(w->finished_count,
+							    &w->start_time);
 			}
+			return 0;
+		}
+		if (buf[i] == '\t') {
+			str_append_data(worker->field, buf + start, i - start);
+			doveadm_mail_worker_print_field(worker, TRUE);
+			start = i + 1;
+		}
+	}
+	str_append_data(worker->field, buf + start, ret - start);
+	if (str_len(worker->field) >= IO_BLOCK_SIZE)
+		doveadm_mail_worker_print_field(worker, FALSE);
+	return 0;
+}
+
+/* Wait until a worker has output and read it. */
+static void doveadm_mail_workers_read(struct doveadm_mail_workers *w)
+{
+	struct doveadm_mail_worker *worker;
+	struct pollfd *fds;
+	unsigned int i, count = 0;
+
+	fds = t_new(struct pollfd, w->count);
+	for (i = 0; i < w->count; i++) {
+		worker = &w->workers[i];
+		if (!worker->busy ||
+		    (w->printing != NULL && w->printing != worker))
+			continue;
+		fds[count].fd = worker->output_fd;
+		fds[count].events = POLLIN;
+		count++;
+	}
+	i_assert(count > 0);
+
+	if (poll(fds, count, -1) < 0) {
+		if (errno == EINTR)
+			return;
+		i_fatal("poll() failed: %m");
+	}
+	for (i = 0; i < count; i++) {
+		if (fds[i].revents != 0)
+			break;
+	}
+	i_assert(i < count);
+	for (worker = w->workers; worker->output_fd != fds[i].fd; worker++) ;
+	if (doveadm_mail_worker_read(w, worker) < 0)
+		w->failed = TRUE;
+}
+
+static bool doveadm_mail_workers_have_busy(struct doveadm_mail_workers *w)
+{
+	unsigned int i;
+
+	for (i = 0; i < w->count; i++) {
+		if (w->workers[i].busy)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static struct doveadm_mail_worker *
+doveadm_mail_workers_get_idle(struct doveadm_mail_workers *w)
+{
+	unsigned int i;
+
+	for (;;) {
+		for (i = 0; i < w->count; i++) {
+			if (!w->workers[i].busy && w->workers[i].fd != -1)
+				return &w->workers[i];
+		}
+		if (killed_signo != 0 || !doveadm_mail_workers_have_busy(w))
+			return NULL;
+		doveadm_mail_workers_read(w);
+	}
+}
+
+static int
+doveadm_mail_workers_wait(struct doveadm_mail_cmd_context *ctx,
+			  struct doveadm_mail_workers *w)
+{
+	unsigned int i;
+	int status, ret = 0;
+
+	/* finish printing the users that are still being processed */
+	while (killed_signo == 0 && doveadm_mail_workers_have_busy(w))
+		doveadm_mail_workers_read(w);
+	if (w->failed)
+		ret = -1;
+	for (i = 0; i < w->count; i++)
+		doveadm_mail_worker_close(&w->workers[i]);
+	for (i = 0; i < w->count; i++) {
+		if (w->workers[i].pid == -1)
+			continue;
+		while (waitpid(w->workers[i].pid, &status, 0) < 0) {
+			if (errno != EINTR) {
+				i_error("waitpid() failed: %m");
+				status = -1;
+				break;
+			}
+		}
+		if (status == -1)
+			ret = -1;
+		else if (WIFSIGNALED(status)) {
+			i_error("Worker %ld killed with signal %d",
+				(long)w->workers[i].pid, WTERMSIG(status));
+			ret = -1;
+		} else if (WIFEXITED(status) && WEXITSTATUS(status) != 0 &&
+			   ctx->exit_code == 0) {
+			ctx->exit_code = WEXITSTATUS(status);
+		}
+	}
+	return ret;
+}
+
+static unsigned int
+doveadm_mail_local_worker_count(struct doveadm_mail_cmd_context *ctx)
+{
+	/* commands reading their input from stdin are run serially, as are
+	   commands already distributed to doveadm servers */
+	if (ctx->set->doveadm_local_worker_count <= 1 ||
+	    ctx->set->doveadm_worker_count > 0 ||
+	    ctx->cmd_input != NULL ||
+	    ctx->cctx->conn_type != DOVEADM_CONNECTION_TYPE_CLI)
+		return 0;
+	return ctx->set->doveadm_local_worker_count;
+}
+
+static void
+doveadm_mail_all_users(struct doveadm_mail_cmd_context *ctx,
+		       const char *wildcard_user)
+{
+	struct doveadm_cmd_context *cctx = ctx->cctx;
+	struct doveadm_mail_workers w;
+	struct doveadm_mail_worker *worker;
+	unsigned int i, user_idx;
+	const char *ip, *user, *error;
+	int ret;
+
+	ctx->service_flags |= MAIL_STORAGE_SERVICE_FLAG_USERDB_LOOKUP;
+	doveadm_cctx_to_storage_service_input(cctx, &ctx->storage_service_input);
+
+	i_zero(&w);
+	w.count = doveadm_mail_local_worker_count(ctx);
+	if (w.count > 0) {
+		/* the workers are started before initializing anything,
+		   so they don't share the userdb connection */
+		w.workers = t_new(struct doveadm_mail_worker, w.count);
+		for (i = 0; i < w.count; i++) {
+			w.workers[i].pid = -1;
+			w.workers[i].fd = -1;
+			w.workers[i].output_fd = -1;
+		}
+		ret = doveadm_mail_workers_start(ctx, &w);
+		if (ret > 0) {
+			/* we're a worker process */
+			return;
+		}
+		if (ret < 0) {
+			(void)doveadm_mail_workers_wait(ctx, &w);
+			i_warning("Failed to start workers - "
+				  "processing users serially");
+			w.count = 0;
+		}
+	}
+	doveadm_mail_all_users_init(ctx, wildcard_user, TRUE);
+	if (w.count > 0) {
+		/* the workers print the sticky values as well */
+		doveadm_print_unstick_headers();
+	}
+
+	if (gettimeofday(&w.start_time, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	user_idx = 0;
+	while ((ret = ctx->v.get_next_user(ctx, &user)) > 0) {
+		if (wildcard_user != NULL) {
+			if (!wildcard_match_icase(user, wildcard_user))
+				continue;
+		}
+		if (w.count > 0) {
+			/* waits until some worker has finished its user */
+			if ((worker = doveadm_mail_workers_get_idle(&w)) == NULL) {
+				if (killed_signo == 0) {
+					i_error("No more workers available");
+					ret = -1;
+					break;
+				}
+			} else if (write_full(worker->fd,
+					      t_strconcat(user, "\n", NULL),
+					      strlen(user) + 1) < 0) {
+				i_error("write(worker %ld) failed: %m",
+					(long)worker->pid);
+				ret = -1;
+				break;
+			} else {
+				worker->busy = TRUE;
+			}
+		} else {
+			cctx->username = user;
+			doveadm_print_sticky("username", user);
+			T_BEGIN {
+				ret = doveadm_mail_next_user(ctx, &error);
+				if (ret < 0)
+					i_error("%s", error);
+				else if (ret == 0)
+					i_info("User no longer exists, skipping");
+			} T_END;
+			if (ret == -1)
+				break;
+			if (++user_idx % 100 == 0 && doveadm_verbose)
+				doveadm_mail_print_progress(user_idx, &w.start_time);
 		}
 		if (killed_signo != 0) {
 			i_warning("Killed with signal %d", killed_signo);
@@ -546,8 +970,15 @@ doveadm_mail_all_users(struct doveadm_mail_cmd_context *ctx,
 			break;
 		}
 	}
-	if (doveadm_verbose)
+	if (w.count > 0) {
+		if (doveadm_mail_workers_wait(ctx, &w) < 0)
+			ret = -1;
+		user_idx = w.finished_count;
+	}
+	if (doveadm_verbose) {
+		doveadm_mail_print_progress(user_idx, &w.start_time);
 		printf("\n");
+	}
 	ip = net_ip2addr(&cctx->remote_ip);
 	if (ip[0] == '\0')
 		i_set_failure_prefix("doveadm: ");
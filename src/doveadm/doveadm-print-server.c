@@ -7,7 +7,6 @@
 #include "ostream.h"
 #include "doveadm.h"
 #include "doveadm-print-private.h"
-#include "client-connection.h"
 
 struct doveadm_print_server_context {
 	unsigned int header_idx, header_count;
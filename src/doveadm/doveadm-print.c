@@ -5,6 +5,7 @@
 #include "istream.h"
 #include "ostream.h"
 #include "doveadm-print-private.h"
+#include "doveadm-server.h"
 
 struct doveadm_print_header_context {
 	const char *key;
@@ -165,6 +166,27 @@ void doveadm_print_unstick_headers(void)
 	}
 }
 
+void doveadm_print_forward(struct ostream *output)
+{
+	const struct doveadm_print_header_context *hdr_ctx;
+	struct doveadm_print_header hdr;
+
+	if (ctx != NULL) {
+		/* the current formatter's state belongs to the process
+		   that prints the forwarded values, so just drop it */
+		ctx->v = &doveadm_print_server_vfuncs;
+		ctx->v->init();
+		array_foreach(&ctx->headers, hdr_ctx) {
+			i_zero(&hdr);
+			hdr.key = hdr_ctx->key;
+			hdr.title = hdr_ctx->key;
+			ctx->v->header(&hdr);
+		}
+	}
+	o_stream_unref(&doveadm_print_ostream);
+	doveadm_print_ostream = output;
+}
+
 void doveadm_print_init(const char *name)
 {
 	pool_t pool;
@@ -40,6 +40,10 @@ void doveadm_print_flush(void);
 void doveadm_print_unstick_headers(void);
 
 void doveadm_print_init(const char *name);
+/* Stop printing with the current formatter. Instead, send all the printed
+   values to output using the doveadm-server's print protocol, so another
+   process can print them with its formatter. */
+void doveadm_print_forward(struct ostream *output);
 void doveadm_print_deinit(void);
 
 void doveadm_print_formatted_set_format(const char *format);
@@ -63,6 +63,7 @@ static const struct setting_define doveadm_setting_defines[] = {
 	DEF(SET_STR, auth_socket_path),
 	DEF(SET_STR, doveadm_socket_path),
 	DEF(SET_UINT, doveadm_worker_count),
+	DEF(SET_UINT, doveadm_local_worker_count),
 	DEF(SET_IN_PORT, doveadm_port),
 	{ SET_ALIAS, "doveadm_proxy_port", 0, NULL },
 	DEF(SET_STR, doveadm_username),
@@ -91,6 +92,7 @@ const struct doveadm_settings doveadm_default_settings = {
 	.auth_socket_path = "auth-userdb",
 	.doveadm_socket_path = "doveadm-server",
 	.doveadm_worker_count = 0,
+	.doveadm_local_worker_count = 0,
 	.doveadm_port = 0,
 	.doveadm_username = "doveadm",
 	.doveadm_password = "",
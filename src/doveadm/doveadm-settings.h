@@ -18,6 +18,7 @@ struct doveadm_settings {
 	const char *auth_socket_path;
 	const char *doveadm_socket_path;
 	unsigned int doveadm_worker_count;
+	unsigned int doveadm_local_worker_count;
 	in_port_t doveadm_port;
 	const char *doveadm_username;
 	const char *doveadm_password;
@@ -489,9 +489,15 @@ bool dsync_brain_recv_mailbox_tree_deletes(struct dsync_brain *brain)
 	}
 
 	dsync_brain_mailbox_trees_sync(brain);
-	brain->state = brain->master_brain ?
-		DSYNC_STATE_MASTER_SEND_MAILBOX :
-		DSYNC_STATE_SLAVE_RECV_MAILBOX;
+	if (dsync_brain_want_mailbox_batch(brain)) {
+		brain->state = brain->master_brain ?
+			DSYNC_STATE_MASTER_MAILBOX_BATCH :
+			DSYNC_STATE_SLAVE_MAILBOX_BATCH;
+	} else {
+		brain->state = brain->master_brain ?
+			DSYNC_STATE_MASTER_SEND_MAILBOX :
+			DSYNC_STATE_SLAVE_RECV_MAILBOX;
+	}
 	i_assert(brain->local_tree_iter == NULL);
 	brain->local_tree_iter =
 		dsync_mailbox_tree_iter_init(brain->local_mailbox_tree);
@@ -224,7 +224,7 @@ dsync_brain_sync_mailbox_init_remote(struct dsync_brain *brain,
 		import_flags |= DSYNC_MAILBOX_IMPORT_FLAG_EMPTY_HDR_WORKAROUND;
 
 	brain->box_importer = brain->backup_send ? NULL :
-		dsync_mailbox_import_init(brain->box, brain->virtual_all_box,
+		dsync_mailbox_import_init(brain->box, brain->virtual_all_guids,
 					  brain->log_scan,
 					  last_common_uid, last_common_modseq,
 					  last_common_pvt_modseq,
@@ -465,6 +465,15 @@ dsync_brain_has_mailbox_state_changed(struct dsync_brain *brain,
 		state->last_messages_count != dsync_box->messages_count;
 }
 
+static bool
+dsync_brain_mailbox_batch_is_unchanged(struct dsync_brain *brain,
+				       const guid_128_t mailbox_guid)
+{
+	const uint8_t *guid_p = mailbox_guid;
+
+	return hash_table_lookup(brain->mailbox_batch_unchanged, guid_p) != NULL;
+}
+
 static int
 dsync_brain_try_next_mailbox(struct dsync_brain *brain, struct mailbox **box_r,
 			     struct file_lock **lock_r,
@@ -484,7 +493,9 @@ dsync_brain_try_next_mailbox(struct dsync_brain *brain, struct mailbox **box_r,
 
 	while (dsync_mailbox_tree_iter_next(brain->local_tree_iter, &vname, &node)) {
 		if (node->existence == DSYNC_MAILBOX_NODE_EXISTS &&
-		    !guid_128_is_empty(node->mailbox_guid))
+		    !guid_128_is_empty(node->mailbox_guid) &&
+		    !dsync_brain_mailbox_batch_is_unchanged(brain,
+							    node->mailbox_guid))
 			break;
 		vname = NULL;
 	}
@@ -594,6 +605,227 @@ void dsync_brain_master_send_mailbox(struct dsync_brain *brain)
 	brain->state = DSYNC_STATE_SYNC_MAILS;
 }
 
+bool dsync_brain_want_mailbox_batch(struct dsync_brain *brain)
+{
+	/* both brains must come to the same conclusion here. full sync
+	   doesn't skip any mailboxes, so there's no point in it. */
+	return brain->mailbox_batch && !brain->no_mail_sync &&
+		brain->sync_type != DSYNC_BRAIN_SYNC_TYPE_FULL;
+}
+
+static void
+dsync_brain_master_mailbox_batch_unchanged(struct dsync_brain *brain,
+					   const struct dsync_mailbox *local_box)
+{
+	const struct dsync_mailbox_state *state;
+	struct dsync_mailbox_state new_state;
+	uint8_t *guid_p;
+
+	guid_p = p_malloc(brain->pool, GUID_128_SIZE);
+	memcpy(guid_p, local_box->mailbox_guid, GUID_128_SIZE);
+	hash_table_insert(brain->mailbox_batch_unchanged, guid_p, guid_p);
+
+	/* keep the mailbox state the same way as if the mailbox had been
+	   skipped after the individual mailbox exchange */
+	state = dsync_mailbox_state_find(brain, local_box->mailbox_guid);
+	if (state != NULL)
+		new_state = *state;
+	else {
+		i_zero(&new_state);
+		memcpy(new_state.mailbox_guid, local_box->mailbox_guid,
+		       sizeof(new_state.mailbox_guid));
+		new_state.last_uidvalidity = local_box->uid_validity;
+	}
+	array_push_back(&brain->remote_mailbox_states, &new_state);
+}
+
+static void
+dsync_brain_master_mailbox_batch_recv(struct dsync_brain *brain,
+				      const struct dsync_mailbox *remote_box)
+{
+	struct dsync_mailbox local_box;
+	struct mailbox *box;
+	const char *errstr, *resync_reason;
+	enum mail_error error;
+	int ret;
+
+	/* remote says this mailbox is unchanged. verify it against the
+	   current local state, since it may have changed after we sent it. */
+	if (dsync_brain_mailbox_alloc(brain, remote_box->mailbox_guid,
+				      &box, &errstr, &error) < 0) {
+		i_error("Couldn't allocate mailbox GUID %s: %s",
+			guid_128_to_string(remote_box->mailbox_guid), errstr);
+		brain->mail_error = error;
+		brain->failed = TRUE;
+		return;
+	}
+	if (box == NULL) {
+		/* deleted during sync. let the individual sync handle it. */
+		return;
+	}
+	if ((ret = dsync_box_get(box, &local_box, &error)) <= 0) {
+		if (ret < 0) {
+			brain->mail_error = error;
+			brain->failed = TRUE;
+		}
+		mailbox_free(&box);
+		return;
+	}
+	if (!dsync_boxes_need_sync(brain, &local_box, remote_box)) {
+		if (brain->debug) {
+			i_debug("brain %c: Skipping unchanged mailbox %s "
+				"confirmed in mailbox batch",
+				brain->master_brain ? 'M' : 'S',
+				guid_128_to_string(local_box.mailbox_guid));
+		}
+		/* UIDVALIDITY is the same, so this only updates cache
+		   fields and can't require a resync */
+		(void)dsync_brain_mailbox_update_pre(brain, box, &local_box,
+						     remote_box, &resync_reason);
+		dsync_brain_master_mailbox_batch_unchanged(brain, &local_box);
+	}
+	mailbox_free(&box);
+}
+
+static bool dsync_brain_master_mailbox_batch_send(struct dsync_brain *brain)
+{
+	struct dsync_mailbox dsync_box;
+	struct mailbox *box;
+	struct file_lock *lock;
+
+	if (!dsync_brain_next_mailbox(brain, &box, &lock, &dsync_box)) {
+		if (brain->failed)
+			return FALSE;
+		dsync_ibc_send_end_of_list(brain->ibc, DSYNC_IBC_EOL_MAILBOX);
+		brain->mailbox_batch_sent = TRUE;
+		/* iterate the mailboxes again for syncing the changed ones */
+		i_assert(brain->local_tree_iter == NULL);
+		brain->local_tree_iter =
+			dsync_mailbox_tree_iter_init(brain->local_mailbox_tree);
+		return FALSE;
+	}
+	dsync_ibc_send_mailbox(brain->ibc, &dsync_box);
+	file_lock_free(&lock);
+	mailbox_free(&box);
+	return TRUE;
+}
+
+bool dsync_brain_master_mailbox_batch(struct dsync_brain *brain)
+{
+	const struct dsync_mailbox *remote_box;
+	enum dsync_ibc_recv_ret ret;
+	bool changed = FALSE, more = TRUE;
+
+	i_assert(brain->master_brain);
+	i_assert(brain->box == NULL);
+
+	/* keep reading the replies while sending, so that neither side
+	   gets stuck with a full output buffer */
+	while (!brain->mailbox_batch_sent && more && !brain->failed &&
+	       !dsync_ibc_is_send_queue_full(brain->ibc)) T_BEGIN {
+		more = dsync_brain_master_mailbox_batch_send(brain);
+		changed = TRUE;
+	} T_END;
+
+	while (!brain->failed &&
+	       (ret = dsync_ibc_recv_mailbox(brain->ibc, &remote_box)) != 0) {
+		changed = TRUE;
+		if (ret == DSYNC_IBC_RECV_RET_FINISHED) {
+			if (!brain->mailbox_batch_sent) {
+				i_error("Remote sent mailbox batch end-of-list "
+					"too early");
+				brain->failed = TRUE;
+				break;
+			}
+			brain->state = DSYNC_STATE_MASTER_SEND_MAILBOX;
+			break;
+		}
+		T_BEGIN {
+			dsync_brain_master_mailbox_batch_recv(brain, remote_box);
+		} T_END;
+	}
+	return changed;
+}
+
+static void
+dsync_brain_slave_mailbox_batch_recv(struct dsync_brain *brain,
+				     const struct dsync_mailbox *remote_box)
+{
+	struct dsync_mailbox local_box;
+	struct mailbox *box;
+	struct file_lock *lock;
+	const char *errstr, *resync_reason;
+	enum mail_error error;
+	int ret;
+
+	/* only unchanged mailboxes are replied to. anything unexpected is
+	   left for the individual mailbox sync to handle. */
+	if (dsync_brain_mailbox_alloc(brain, remote_box->mailbox_guid,
+				      &box, &errstr, &error) < 0) {
+		i_error("Couldn't allocate mailbox GUID %s: %s",
+			guid_128_to_string(remote_box->mailbox_guid), errstr);
+		brain->mail_error = error;
+		brain->failed = TRUE;
+		return;
+	}
+	if (box == NULL)
+		return;
+
+	if (dsync_mailbox_lock(brain, box, &lock) < 0) {
+		mailbox_free(&box);
+		brain->failed = TRUE;
+		return;
+	}
+	if (mailbox_sync(box, MAILBOX_SYNC_FLAG_FULL_READ) < 0) {
+		i_error("Can't sync mailbox %s: %s",
+			mailbox_get_vname(box),
+			mailbox_get_last_internal_error(box, &brain->mail_error));
+		brain->failed = TRUE;
+	} else if ((ret = dsync_box_get(box, &local_box, &error)) < 0) {
+		brain->mail_error = error;
+		brain->failed = TRUE;
+	} else if (ret > 0 &&
+		   !dsync_boxes_need_sync(brain, &local_box, remote_box)) {
+		if (brain->debug) {
+			i_debug("brain %c: Skipping unchanged mailbox %s "
+				"in mailbox batch",
+				brain->master_brain ? 'M' : 'S',
+				guid_128_to_string(local_box.mailbox_guid));
+		}
+		(void)dsync_brain_mailbox_update_pre(brain, box, &local_box,
+						     remote_box, &resync_reason);
+		dsync_ibc_send_mailbox(brain->ibc, &local_box);
+	}
+	file_lock_free(&lock);
+	mailbox_free(&box);
+}
+
+bool dsync_brain_slave_mailbox_batch(struct dsync_brain *brain)
+{
+	const struct dsync_mailbox *remote_box;
+	enum dsync_ibc_recv_ret ret;
+	bool changed = FALSE;
+
+	i_assert(!brain->master_brain);
+	i_assert(brain->box == NULL);
+
+	while (!brain->failed &&
+	       !dsync_ibc_is_send_queue_full(brain->ibc) &&
+	       (ret = dsync_ibc_recv_mailbox(brain->ibc, &remote_box)) != 0) {
+		changed = TRUE;
+		if (ret == DSYNC_IBC_RECV_RET_FINISHED) {
+			dsync_ibc_send_end_of_list(brain->ibc,
+						   DSYNC_IBC_EOL_MAILBOX);
+			brain->state = DSYNC_STATE_SLAVE_RECV_MAILBOX;
+			break;
+		}
+		T_BEGIN {
+			dsync_brain_slave_mailbox_batch_recv(brain, remote_box);
+		} T_END;
+	}
+	return changed;
+}
+
 bool dsync_boxes_need_sync(struct dsync_brain *brain,
 			   const struct dsync_mailbox *box1,
 			   const struct dsync_mailbox *box2)
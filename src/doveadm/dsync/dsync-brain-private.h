@@ -26,6 +26,12 @@ enum dsync_state {
 	DSYNC_STATE_RECV_MAILBOX_TREE,
 	DSYNC_STATE_RECV_MAILBOX_TREE_DELETES,
 
+	/* master sends all the mailboxes it's going to sync, and slave
+	   replies with the ones that are unchanged on its side. these
+	   mailboxes are skipped in the following states. */
+	DSYNC_STATE_MASTER_MAILBOX_BATCH,
+	DSYNC_STATE_SLAVE_MAILBOX_BATCH,
+
 	/* master decides in which order mailboxes are synced (it knows the
 	   slave's mailboxes by looking at the received mailbox tree) */
 	DSYNC_STATE_MASTER_SEND_MAILBOX,
@@ -56,6 +62,7 @@ struct dsync_brain {
 	ARRAY(struct mail_namespace *) sync_namespaces;
 	const char *sync_box;
 	struct mailbox *virtual_all_box;
+	struct dsync_mailbox_guid_cache *virtual_all_guids;
 	guid_128_t sync_box_guid;
 	const char *const *exclude_mailboxes;
 	enum dsync_brain_sync_type sync_type;
@@ -102,6 +109,9 @@ struct dsync_brain {
 	struct dsync_mailbox_state mailbox_state;
 	/* new states for synced mailboxes */
 	ARRAY_TYPE(dsync_mailbox_state) remote_mailbox_states;
+	/* mailbox GUIDs that both sides found unchanged in the mailbox batch
+	   state. the master doesn't need to sync them individually. */
+	HASH_TABLE(uint8_t *, uint8_t *) mailbox_batch_unchanged;
 
 	const char *changes_during_sync;
 	enum mail_error mail_error;
@@ -125,6 +135,10 @@ struct dsync_brain {
 	bool no_notify:1;
 	bool failed:1;
 	bool empty_hdr_workaround:1;
+	/* remote supports the mailbox batch states */
+	bool mailbox_batch:1;
+	/* DSYNC_STATE_MASTER_MAILBOX_BATCH: all mailboxes have been sent */
+	bool mailbox_batch_sent:1;
 };
 
 extern const char *dsync_box_state_names[DSYNC_BOX_STATE_DONE+1];
@@ -154,6 +168,9 @@ void dsync_brain_sync_init_box_states(struct dsync_brain *brain);
 void dsync_brain_set_changes_during_sync(struct dsync_brain *brain,
 					 const char *reason);
 
+bool dsync_brain_want_mailbox_batch(struct dsync_brain *brain);
+bool dsync_brain_master_mailbox_batch(struct dsync_brain *brain);
+bool dsync_brain_slave_mailbox_batch(struct dsync_brain *brain);
 void dsync_brain_master_send_mailbox(struct dsync_brain *brain);
 bool dsync_brain_slave_recv_mailbox(struct dsync_brain *brain);
 int dsync_brain_sync_mailbox_open(struct dsync_brain *brain,
@@ -33,6 +33,8 @@ static const char *dsync_state_names[] = {
 	"send_mailbox_tree_deletes",
 	"recv_mailbox_tree",
 	"recv_mailbox_tree_deletes",
+	"master_mailbox_batch",
+	"slave_mailbox_batch",
 	"master_send_mailbox",
 	"slave_recv_mailbox",
 	"sync_mails",
@@ -141,6 +143,8 @@ dsync_brain_common_init(struct mail_user *user, struct dsync_ibc *ibc)
 	brain->verbose_proctitle = service_set->verbose_proctitle;
 	hash_table_create(&brain->mailbox_states, pool, 0,
 			  guid_128_hash, guid_128_cmp);
+	hash_table_create(&brain->mailbox_batch_unchanged, pool, 0,
+			  guid_128_hash, guid_128_cmp);
 	p_array_init(&brain->remote_mailbox_states, pool, 64);
 	return brain;
 }
@@ -175,6 +179,8 @@ dsync_brain_open_virtual_all_box(struct dsync_brain *brain,
 	ns = mail_namespace_find(brain->user->namespaces, vname);
 	brain->virtual_all_box =
 		mailbox_alloc(ns->list, vname, MAILBOX_FLAG_READONLY);
+	brain->virtual_all_guids =
+		dsync_mailbox_guid_cache_init(brain->virtual_all_box);
 }
 
 struct dsync_brain *
@@ -267,6 +273,7 @@ dsync_brain_master_init(struct mail_user *user, struct dsync_ibc *ibc,
 	       sizeof(ibc_set.sync_box_guid));
 	ibc_set.sync_type = sync_type;
 	ibc_set.hdr_hash_v2 = TRUE;
+	ibc_set.mailbox_batch = TRUE;
 	ibc_set.lock_timeout = set->lock_timeout_secs;
 	ibc_set.import_commit_msgs_interval = set->import_commit_msgs_interval;
 	ibc_set.hashed_headers = set->hashed_headers;
@@ -307,6 +314,7 @@ dsync_brain_slave_init(struct mail_user *user, struct dsync_ibc *ibc,
 
 	i_zero(&ibc_set);
 	ibc_set.hdr_hash_v2 = TRUE;
+	ibc_set.mailbox_batch = TRUE;
 	ibc_set.hostname = my_hostdomain();
 	dsync_ibc_send_handshake(ibc, &ibc_set);
 
@@ -358,6 +366,8 @@ int dsync_brain_deinit(struct dsync_brain **_brain, enum mail_error *error_r)
 
 	if (brain->box != NULL)
 		dsync_brain_sync_mailbox_deinit(brain);
+	if (brain->virtual_all_guids != NULL)
+		dsync_mailbox_guid_cache_deinit(&brain->virtual_all_guids);
 	if (brain->virtual_all_box != NULL)
 		mailbox_free(&brain->virtual_all_box);
 	if (brain->local_tree_iter != NULL)
@@ -368,6 +378,7 @@ int dsync_brain_deinit(struct dsync_brain **_brain, enum mail_error *error_r)
 		dsync_mailbox_tree_deinit(&brain->remote_mailbox_tree);
 	hash_table_iterate_deinit(&brain->mailbox_states_iter);
 	hash_table_destroy(&brain->mailbox_states);
+	hash_table_destroy(&brain->mailbox_batch_unchanged);
 
 	pool_unref(&brain->dsync_box_pool);
 
@@ -488,6 +499,7 @@ static bool dsync_brain_master_recv_handshake(struct dsync_brain *brain)
 		}
 	}
 	dsync_brain_set_hdr_hash_version(brain, ibc_set);
+	brain->mailbox_batch = ibc_set->mailbox_batch;
 
 	brain->state = brain->sync_type == DSYNC_BRAIN_SYNC_TYPE_STATE ?
 		DSYNC_STATE_MASTER_SEND_LAST_COMMON :
@@ -506,6 +518,7 @@ static bool dsync_brain_slave_recv_handshake(struct dsync_brain *brain)
 	if (dsync_ibc_recv_handshake(brain->ibc, &ibc_set) == 0)
 		return FALSE;
 	dsync_brain_set_hdr_hash_version(brain, ibc_set);
+	brain->mailbox_batch = ibc_set->mailbox_batch;
 
 	if (ibc_set->lock_timeout > 0) {
 		brain->lock_timeout = ibc_set->lock_timeout;
@@ -698,6 +711,12 @@ static bool dsync_brain_run_real(struct dsync_brain *brain, bool *changed_r)
 	case DSYNC_STATE_RECV_MAILBOX_TREE_DELETES:
 		changed = dsync_brain_recv_mailbox_tree_deletes(brain);
 		break;
+	case DSYNC_STATE_MASTER_MAILBOX_BATCH:
+		changed = dsync_brain_master_mailbox_batch(brain);
+		break;
+	case DSYNC_STATE_SLAVE_MAILBOX_BATCH:
+		changed = dsync_brain_slave_mailbox_batch(brain);
+		break;
 	case DSYNC_STATE_MASTER_SEND_MAILBOX:
 		dsync_brain_master_send_mailbox(brain);
 		changed = TRUE;
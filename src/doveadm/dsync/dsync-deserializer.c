@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "str.h"
 #include "strescape.h"
+#include "hash.h"
 #include "dsync-serializer.h"
 #include "dsync-deserializer.h"
 
@@ -13,10 +14,15 @@ struct dsync_deserializer {
 	const char *const *keys;
 	unsigned int *required_field_indexes;
 	unsigned int required_field_count;
+	/* key => index+1 */
+	HASH_TABLE(const char *, void *) key_indexes;
+
+	/* reused by each decoder */
+	pool_t decoder_pool;
+	bool decoding;
 };
 
 struct dsync_deserializer_decoder {
-	pool_t pool;
 	struct dsync_deserializer *deserializer;
 	const char *const *values;
 	unsigned int values_count;
@@ -53,6 +59,16 @@ int dsync_deserializer_init(const char *name, const char *const *required_fields
 	deserializer->pool = pool;
 	deserializer->name = p_strdup(pool, name);
 	deserializer->keys = (void *)p_strsplit_tabescaped(pool, header_line);
+	hash_table_create(&deserializer->key_indexes, pool, 0, str_hash, strcmp);
+	for (i = 0; deserializer->keys[i] != NULL; i++) {
+		/* use the first one if the remote sent duplicates */
+		if (hash_table_lookup(deserializer->key_indexes,
+				      deserializer->keys[i]) == NULL) {
+			hash_table_insert(deserializer->key_indexes,
+					  deserializer->keys[i],
+					  POINTER_CAST(i + 1));
+		}
+	}
 
 	deserializer->required_field_count = required_count =
 		required_fields == NULL ? 0 :
@@ -68,6 +84,7 @@ int dsync_deserializer_init(const char *name, const char *const *required_fields
 			*error_r = t_strdup_printf(
 				"Header missing required field %s",
 				required_fields[i]);
+			hash_table_destroy(&deserializer->key_indexes);
 			pool_unref(&pool);
 			return -1;
 		}
@@ -84,6 +101,9 @@ void dsync_deserializer_deinit(struct dsync_deserializer **_deserializer)
 
 	*_deserializer = NULL;
 
+	i_assert(!deserializer->decoding);
+	hash_table_destroy(&deserializer->key_indexes);
+	pool_unref(&deserializer->decoder_pool);
 	pool_unref(&deserializer->pool);
 }
 
@@ -99,9 +119,18 @@ int dsync_deserializer_decode_begin(struct dsync_deserializer *deserializer,
 
 	*decoder_r = NULL;
 
-	pool = pool_alloconly_create("dsync deserializer decode", 1024);
+	/* only one decoder at a time, so the same pool can be reused for
+	   each record instead of creating a new one. */
+	i_assert(!deserializer->decoding);
+	if (deserializer->decoder_pool == NULL) {
+		deserializer->decoder_pool =
+			pool_alloconly_create("dsync deserializer decode", 1024);
+	} else {
+		p_clear(deserializer->decoder_pool);
+	}
+	pool = deserializer->decoder_pool;
+
 	decoder = p_new(pool, struct dsync_deserializer_decoder, 1);
-	decoder->pool = pool;
 	decoder->deserializer = deserializer;
 	values = p_strsplit_tabescaped(pool, input);
 
@@ -124,11 +153,11 @@ int dsync_deserializer_decode_begin(struct dsync_deserializer *deserializer,
 		if (ridx >= decoder->values_count || values[ridx] == NULL) {
 			*error_r = t_strdup_printf("Missing required field %s",
 				deserializer->required_fields[i]);
-			pool_unref(&pool);
 			return -1;
 		}
 	}
 	decoder->values = (void *)values;
+	deserializer->decoding = TRUE;
 
 	*decoder_r = decoder;
 	return 0;
@@ -138,15 +167,14 @@ static bool
 dsync_deserializer_find_field(struct dsync_deserializer *deserializer,
 			      const char *key, unsigned int *idx_r)
 {
-	unsigned int i;
+	unsigned int idx;
 
-	for (i = 0; deserializer->keys[i] != NULL; i++) {
-		if (strcmp(deserializer->keys[i], key) == 0) {
-			*idx_r = i;
-			return TRUE;
-		}
-	}
-	return FALSE;
+	idx = POINTER_CAST_TO(hash_table_lookup(deserializer->key_indexes, key),
+			      unsigned int);
+	if (idx == 0)
+		return FALSE;
+	*idx_r = idx - 1;
+	return TRUE;
 }
 
 bool dsync_deserializer_decode_try(struct dsync_deserializer_decoder *decoder,
@@ -189,5 +217,5 @@ void dsync_deserializer_decode_finish(struct dsync_deserializer_decoder **_decod
 
 	*_decoder = NULL;
 
-	pool_unref(&decoder->pool);
+	decoder->deserializer->decoding = FALSE;
 }
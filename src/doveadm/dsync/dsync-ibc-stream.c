@@ -25,14 +25,15 @@
 #define DSYNC_IBC_STREAM_OUTBUF_THROTTLE_SIZE (1024*128)
 
 #define DSYNC_PROTOCOL_VERSION_MAJOR 3
-#define DSYNC_PROTOCOL_VERSION_MINOR 5
-#define DSYNC_HANDSHAKE_VERSION "VERSION\tdsync\t3\t5\n"
+#define DSYNC_PROTOCOL_VERSION_MINOR 6
+#define DSYNC_HANDSHAKE_VERSION "VERSION\tdsync\t3\t6\n"
 
 #define DSYNC_PROTOCOL_MINOR_HAVE_ATTRIBUTES 1
 #define DSYNC_PROTOCOL_MINOR_HAVE_SAVE_GUID 2
 #define DSYNC_PROTOCOL_MINOR_HAVE_FINISH 3
 #define DSYNC_PROTOCOL_MINOR_HAVE_HDR_HASH_V2 4
 #define DSYNC_PROTOCOL_MINOR_HAVE_HDR_HASH_V3 5
+#define DSYNC_PROTOCOL_MINOR_HAVE_MAILBOX_BATCH 6
 
 enum item_type {
 	ITEM_NONE,
@@ -357,14 +358,14 @@ static void dsync_ibc_stream_deinit(struct dsync_ibc *_ibc)
 	struct dsync_ibc_stream *ibc = (struct dsync_ibc_stream *)_ibc;
 	unsigned int i;
 
+	if (ibc->cur_decoder != NULL)
+		dsync_deserializer_decode_finish(&ibc->cur_decoder);
 	for (i = ITEM_DONE + 1; i < ITEM_END_OF_LIST; i++) {
 		if (ibc->serializers[i] != NULL)
 			dsync_serializer_deinit(&ibc->serializers[i]);
 		if (ibc->deserializers[i] != NULL)
 			dsync_deserializer_deinit(&ibc->deserializers[i]);
 	}
-	if (ibc->cur_decoder != NULL)
-		dsync_deserializer_decode_finish(&ibc->cur_decoder);
 	if (ibc->value_output != NULL)
 		i_stream_unref(&ibc->value_output);
 	else {
@@ -893,6 +894,7 @@ dsync_ibc_stream_recv_handshake(struct dsync_ibc *_ibc,
 		set->hashed_headers = (const char*const*)p_strsplit_tabescaped(pool, value);
 	set->hdr_hash_v2 = ibc->minor_version >= DSYNC_PROTOCOL_MINOR_HAVE_HDR_HASH_V2;
 	set->hdr_hash_v3 = ibc->minor_version >= DSYNC_PROTOCOL_MINOR_HAVE_HDR_HASH_V3;
+	set->mailbox_batch = ibc->minor_version >= DSYNC_PROTOCOL_MINOR_HAVE_MAILBOX_BATCH;
 
 	*set_r = set;
 	return DSYNC_IBC_RECV_RET_OK;
@@ -71,6 +71,9 @@ struct dsync_ibc_settings {
 	enum dsync_brain_flags brain_flags;
 	bool hdr_hash_v2;
 	bool hdr_hash_v3;
+	/* Remote supports checking unchanged mailboxes in a single batch
+	   before syncing them one by one. */
+	bool mailbox_batch;
 	unsigned int lock_timeout;
 	unsigned int import_commit_msgs_interval;
 };
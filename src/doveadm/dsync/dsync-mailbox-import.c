@@ -54,6 +54,16 @@ struct importer_new_mail {
 HASH_TABLE_DEFINE_TYPE(guid_new_mail, const char *, struct importer_new_mail *);
 HASH_TABLE_DEFINE_TYPE(uid_new_mail, void *, struct importer_new_mail *);
 
+struct dsync_mailbox_guid_cache {
+	pool_t pool;
+	struct mailbox *box;
+
+	/* GUID => first UID in box having it */
+	HASH_TABLE(char *, void *) guids;
+	/* mails with UID below this have already been added to guids */
+	uint32_t next_uid;
+};
+
 struct dsync_mailbox_importer {
 	pool_t pool;
 	struct mailbox *box;
@@ -79,7 +89,7 @@ struct dsync_mailbox_importer {
 	struct mail_search_context *search_ctx;
 	struct mail *mail, *ext_mail;
 
-	struct mailbox *virtual_all_box;
+	struct dsync_mailbox_guid_cache *virtual_all_guids;
 	struct mailbox_transaction_context *virtual_trans;
 	struct mail *virtual_mail;
 
@@ -214,9 +224,33 @@ dsync_mailbox_import_transaction_begin(struct dsync_mailbox_importer *importer)
 	importer->ext_mail = mail_alloc(importer->ext_trans, 0, NULL);
 }
 
+struct dsync_mailbox_guid_cache *
+dsync_mailbox_guid_cache_init(struct mailbox *box)
+{
+	struct dsync_mailbox_guid_cache *cache;
+	pool_t pool;
+
+	pool = pool_alloconly_create(MEMPOOL_GROWING"dsync guid cache", 10240);
+	cache = p_new(pool, struct dsync_mailbox_guid_cache, 1);
+	cache->pool = pool;
+	cache->box = box;
+	cache->next_uid = 1;
+	hash_table_create(&cache->guids, pool, 0, str_hash, strcmp);
+	return cache;
+}
+
+void dsync_mailbox_guid_cache_deinit(struct dsync_mailbox_guid_cache **_cache)
+{
+	struct dsync_mailbox_guid_cache *cache = *_cache;
+
+	*_cache = NULL;
+	hash_table_destroy(&cache->guids);
+	pool_unref(&cache->pool);
+}
+
 struct dsync_mailbox_importer *
 dsync_mailbox_import_init(struct mailbox *box,
-			  struct mailbox *virtual_all_box,
+			  struct dsync_mailbox_guid_cache *virtual_all_guids,
 			  struct dsync_transaction_log_scan *log_scan,
 			  uint32_t last_common_uid,
 			  uint64_t last_common_modseq,
@@ -243,7 +277,7 @@ dsync_mailbox_import_init(struct mailbox *box,
 	importer = p_new(pool, struct dsync_mailbox_importer, 1);
 	importer->pool = pool;
 	importer->box = box;
-	importer->virtual_all_box = virtual_all_box;
+	importer->virtual_all_guids = virtual_all_guids;
 	importer->last_common_uid = last_common_uid;
 	importer->last_common_modseq = last_common_modseq;
 	importer->last_common_pvt_modseq = last_common_pvt_modseq;
@@ -2177,30 +2211,33 @@ dsync_mailbox_import_handle_mail(struct dsync_mailbox_importer *importer,
 }
 
 static void
-dsync_mailbox_import_find_virtual_uids(struct dsync_mailbox_importer *importer)
+dsync_mailbox_guid_cache_update(struct dsync_mailbox_guid_cache *cache,
+				struct mailbox_transaction_context *trans)
 {
 	struct mail_search_context *search_ctx;
 	struct mail_search_args *search_args;
-	struct importer_new_mail *newmail;
+	struct mail_search_arg *sarg;
+	struct mailbox_status status;
 	struct mail *mail;
 	const char *guid;
+	char *guid_dup;
 
-	if (mailbox_sync(importer->virtual_all_box, 0) < 0) {
-		i_error("Couldn't sync \\All mailbox '%s': %s",
-			mailbox_get_vname(importer->virtual_all_box),
-			mailbox_get_last_internal_error(importer->virtual_all_box, NULL));
+	mailbox_get_open_status(cache->box, STATUS_UIDNEXT, &status);
+	if (status.uidnext <= cache->next_uid)
 		return;
-	}
 
+	/* only the mails added since the previous lookup need to be looked
+	   up. this way the \All mailbox is scanned only once per session,
+	   and mails saved by the earlier mailbox imports become available
+	   as copy sources for the later ones. */
 	search_args = mail_search_build_init();
-	mail_search_build_add_all(search_args);
+	sarg = mail_search_build_add(search_args, SEARCH_UIDSET);
+	p_array_init(&sarg->value.seqset, search_args->pool, 1);
+	seq_range_array_add_range(&sarg->value.seqset, cache->next_uid,
+				  status.uidnext - 1);
 
-	importer->virtual_trans =
-		mailbox_transaction_begin(importer->virtual_all_box,
-					  importer->transaction_flags,
-					  __func__);
-	search_ctx = mailbox_search_init(importer->virtual_trans, search_args,
-					 NULL, MAIL_FETCH_GUID, NULL);
+	search_ctx = mailbox_search_init(trans, search_args, NULL,
+					 MAIL_FETCH_GUID, NULL);
 	mail_search_args_unref(&search_args);
 
 	while (mailbox_search_next(search_ctx, &mail)) {
@@ -2208,15 +2245,52 @@ dsync_mailbox_import_find_virtual_uids(struct dsync_mailbox_importer *importer)
 			/* ignore errors */
 			continue;
 		}
-		newmail = hash_table_lookup(importer->import_guids, guid);
-		if (newmail != NULL && newmail->virtual_all_uid == 0)
-			newmail->virtual_all_uid = mail->uid;
+		if (*guid == '\0' ||
+		    hash_table_lookup(cache->guids, guid) != NULL)
+			continue;
+		guid_dup = p_strdup(cache->pool, guid);
+		hash_table_insert(cache->guids, guid_dup,
+				  POINTER_CAST(mail->uid));
 	}
 	if (mailbox_search_deinit(&search_ctx) < 0) {
 		i_error("Couldn't search \\All mailbox '%s': %s",
-			mailbox_get_vname(importer->virtual_all_box),
-			mailbox_get_last_internal_error(importer->virtual_all_box, NULL));
+			mailbox_get_vname(cache->box),
+			mailbox_get_last_internal_error(cache->box, NULL));
+		return;
 	}
+	cache->next_uid = status.uidnext;
+}
+
+static void
+dsync_mailbox_import_find_virtual_uids(struct dsync_mailbox_importer *importer)
+{
+	struct dsync_mailbox_guid_cache *cache = importer->virtual_all_guids;
+	struct hash_iterate_context *iter;
+	struct importer_new_mail *newmail;
+	const char *guid;
+	void *value;
+
+	if (mailbox_sync(cache->box, 0) < 0) {
+		i_error("Couldn't sync \\All mailbox '%s': %s",
+			mailbox_get_vname(cache->box),
+			mailbox_get_last_internal_error(cache->box, NULL));
+		return;
+	}
+
+	importer->virtual_trans =
+		mailbox_transaction_begin(cache->box,
+					  importer->transaction_flags,
+					  __func__);
+	dsync_mailbox_guid_cache_update(cache, importer->virtual_trans);
+
+	iter = hash_table_iterate_init(importer->import_guids);
+	while (hash_table_iterate(iter, importer->import_guids,
+				  &guid, &newmail)) {
+		value = hash_table_lookup(cache->guids, guid);
+		if (value != NULL && newmail->virtual_all_uid == 0)
+			newmail->virtual_all_uid = POINTER_CAST_TO(value, uint32_t);
+	}
+	hash_table_iterate_deinit(&iter);
 
 	importer->virtual_mail = mail_alloc(importer->virtual_trans, 0, NULL);
 }
@@ -2229,7 +2303,7 @@ dsync_mailbox_import_handle_local_mails(struct dsync_mailbox_importer *importer)
 	void *key2;
 	struct importer_new_mail *mail;
 
-	if (importer->virtual_all_box != NULL &&
+	if (importer->virtual_all_guids != NULL &&
 	    hash_table_count(importer->import_guids) > 0) {
 		/* find UIDs in \All mailbox for all wanted GUIDs. */
 		dsync_mailbox_import_find_virtual_uids(importer);
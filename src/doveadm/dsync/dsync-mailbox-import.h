@@ -20,9 +20,16 @@ struct dsync_mail;
 struct dsync_mail_change;
 struct dsync_transaction_log_scan;
 
+/* Maps mail GUIDs to UIDs in the given (virtual \All) mailbox. The mapping
+   is shared by all the mailbox imports in the sync, and it's extended with
+   only the newly added mails each time. The mailbox isn't freed. */
+struct dsync_mailbox_guid_cache *
+dsync_mailbox_guid_cache_init(struct mailbox *box);
+void dsync_mailbox_guid_cache_deinit(struct dsync_mailbox_guid_cache **cache);
+
 struct dsync_mailbox_importer *
 dsync_mailbox_import_init(struct mailbox *box,
-			  struct mailbox *virtual_all_box,
+			  struct dsync_mailbox_guid_cache *virtual_all_guids,
 			  struct dsync_transaction_log_scan *log_scan,
 			  uint32_t last_common_uid,
 			  uint64_t last_common_modseq,
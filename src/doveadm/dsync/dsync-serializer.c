@@ -4,16 +4,22 @@
 #include "array.h"
 #include "str.h"
 #include "strescape.h"
+#include "hash.h"
 #include "dsync-serializer.h"
 
 struct dsync_serializer {
 	pool_t pool;
 	const char *const *keys;
 	unsigned int keys_count;
+	/* key => index+1 */
+	HASH_TABLE(const char *, void *) key_indexes;
+
+	/* reused by each encoder */
+	pool_t encoder_pool;
+	bool encoding;
 };
 
 struct dsync_serializer_encoder {
-	pool_t pool;
 	struct dsync_serializer *serializer;
 	ARRAY_TYPE(const_string) values;
 };
@@ -31,8 +37,12 @@ struct dsync_serializer *dsync_serializer_init(const char *const keys[])
 
 	count = str_array_length(keys);
 	dup_keys = p_new(pool, const char *, count + 1);
-	for (i = 0; i < count; i++)
+	hash_table_create(&serializer->key_indexes, pool, count, str_hash, strcmp);
+	for (i = 0; i < count; i++) {
 		dup_keys[i] = p_strdup(pool, keys[i]);
+		hash_table_insert(serializer->key_indexes, dup_keys[i],
+				  POINTER_CAST(i + 1));
+	}
 	serializer->keys = dup_keys;
 	serializer->keys_count = count;
 	return serializer;
@@ -44,6 +54,9 @@ void dsync_serializer_deinit(struct dsync_serializer **_serializer)
 
 	*_serializer = NULL;
 
+	i_assert(!serializer->encoding);
+	hash_table_destroy(&serializer->key_indexes);
+	pool_unref(&serializer->encoder_pool);
 	pool_unref(&serializer->pool);
 }
 
@@ -66,28 +79,38 @@ struct dsync_serializer_encoder *
 dsync_serializer_encode_begin(struct dsync_serializer *serializer)
 {
 	struct dsync_serializer_encoder *encoder;
-	pool_t pool = pool_alloconly_create("dsync serializer encode", 1024);
 
-	encoder = p_new(pool, struct dsync_serializer_encoder, 1);
-	encoder->pool = pool;
+	/* only one encoder at a time, so the same pool can be reused for
+	   each record instead of creating a new one. */
+	i_assert(!serializer->encoding);
+	if (serializer->encoder_pool == NULL) {
+		serializer->encoder_pool =
+			pool_alloconly_create("dsync serializer encode", 1024);
+	} else {
+		p_clear(serializer->encoder_pool);
+	}
+	serializer->encoding = TRUE;
+
+	encoder = p_new(serializer->encoder_pool,
+			struct dsync_serializer_encoder, 1);
 	encoder->serializer = serializer;
-	p_array_init(&encoder->values, pool, serializer->keys_count);
+	p_array_init(&encoder->values, serializer->encoder_pool,
+		     serializer->keys_count);
 	return encoder;
 }
 
 void dsync_serializer_encode_add(struct dsync_serializer_encoder *encoder,
 				 const char *key, const char *value)
 {
-	unsigned int i;
-
-	for (i = 0; encoder->serializer->keys[i] != NULL; i++) {
-		if (strcmp(encoder->serializer->keys[i], key) == 0) {
-			value = p_strdup(encoder->pool, value);
-			array_idx_set(&encoder->values, i, &value);
-			return;
-		}
-	}
-	i_panic("Unknown key: %s", key);
+	struct dsync_serializer *serializer = encoder->serializer;
+	unsigned int idx;
+
+	idx = POINTER_CAST_TO(hash_table_lookup(serializer->key_indexes, key),
+			      unsigned int);
+	if (idx == 0)
+		i_panic("Unknown key: %s", key);
+	value = p_strdup(serializer->encoder_pool, value);
+	array_idx_set(&encoder->values, idx - 1, &value);
 }
 
 void dsync_serializer_encode_finish(struct dsync_serializer_encoder **_encoder,
@@ -113,5 +136,5 @@ void dsync_serializer_encode_finish(struct dsync_serializer_encoder **_encoder,
 	}
 	str_append_c(output, '\n');
 
-	pool_unref(&encoder->pool);
+	encoder->serializer->encoding = FALSE;
 }
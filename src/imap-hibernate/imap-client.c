@@ -38,6 +38,9 @@
 
 /* How often to try to unhibernate clients. */
 #define IMAP_UNHIBERNATE_RETRY_MSECS 10
+/* Disconnect a client that has stopped IDLE but isn't sending any commands
+   after this many milliseconds. This is the same as imap's idle timeout. */
+#define IMAP_CLIENT_NONIDLE_TIMEOUT_MSECS (60*30*1000)
 
 #define IMAP_CLIENT_BUFFER_FULL_ERROR "Client output buffer is full"
 
@@ -70,6 +73,7 @@ struct imap_client {
 	struct istream *input;
 	struct ostream *output;
 	struct timeout *to_keepalive;
+	struct timeout *to_nonidle;
 	struct imap_master_connection *master_conn;
 	struct ioloop_context *ioloop_ctx;
 	const char *log_prefix;
@@ -77,6 +81,8 @@ struct imap_client {
 	bool bad_done, idle_done;
 	bool unhibernate_queued;
 	bool input_pending;
+	/* mailbox has changed while not IDLEing */
+	bool changes_pending;
 };
 
 static struct imap_client *imap_clients;
@@ -88,6 +94,8 @@ static void imap_client_stop(struct imap_client *client);
 void imap_client_destroy(struct imap_client **_client, const char *reason);
 static void imap_client_add_idle_keepalive_timeout(struct imap_client *client);
 static void imap_clients_unhibernate(void *context);
+static void imap_client_input_idle_cmd(struct imap_client *client);
+static void imap_client_input_nonidle(struct imap_client *client);
 
 static void imap_client_disconnected(struct imap_client **_client)
 {
@@ -122,7 +130,8 @@ imap_client_move_back_send_callback(void *context, struct ostream *output)
 {
 	struct imap_client *client = context;
 	const struct imap_client_state *state = &client->state;
-	string_t *str = t_str_new(256);
+	string_t *str = t_str_new(256 +
+		MAX_BASE64_ENCODED_SIZE(state->state_size));
 	const unsigned char *input_data;
 	size_t input_size;
 	ssize_t ret;
@@ -255,6 +264,25 @@ static void imap_client_move_back(struct imap_client *client)
 	}
 }
 
+static bool imap_client_send(struct imap_client *client, const char *output)
+{
+	ssize_t ret;
+
+	ret = o_stream_flush(client->output);
+	if (ret > 0)
+		ret = o_stream_send_str(client->output, output);
+	if (ret < 0) {
+		imap_client_disconnected(&client);
+		return FALSE;
+	}
+	if ((size_t)ret != strlen(output)) {
+		/* disconnect */
+		imap_client_destroy(&client, IMAP_CLIENT_BUFFER_FULL_ERROR);
+		return FALSE;
+	}
+	return TRUE;
+}
+
 static enum imap_client_input_state
 imap_client_input_parse(const unsigned char *data, size_t size, const char **tag_r)
 {
@@ -315,6 +343,120 @@ imap_client_input_parse(const unsigned char *data, size_t size, const char **tag
 	return state;
 }
 
+static bool imap_client_tag_is_valid(const char *tag)
+{
+	const unsigned char *p;
+
+	if (*tag == '\0')
+		return FALSE;
+	for (p = (const unsigned char *)tag; *p != '\0'; p++) {
+		if (*p <= ' ' || *p >= 0x7f || strchr("(){%*\"\\]+", *p) != NULL)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static const char *
+imap_client_parse_simple_cmd(const char *line, const char **tag_r)
+{
+	const char *p;
+
+	p = strchr(line, ' ');
+	if (p == NULL)
+		return NULL;
+	*tag_r = t_strdup_until(line, p);
+	if (!imap_client_tag_is_valid(*tag_r))
+		return NULL;
+	p++;
+	if (strcasecmp(p, "NOOP") == 0)
+		return "NOOP";
+	if (strcasecmp(p, "IDLE") == 0)
+		return "IDLE";
+	return NULL;
+}
+
+static void nonidle_timeout(struct imap_client *client)
+{
+	o_stream_nsend_str(client->output,
+			   "* BYE Disconnected for inactivity.\r\n");
+	imap_client_destroy(&client, "Disconnected for inactivity");
+}
+
+static bool imap_client_idle_stop(struct imap_client *client)
+{
+	const char *output;
+
+	output = t_strdup_printf("%s OK Idle completed.\r\n",
+				 client->state.tag);
+	i_free(client->state.tag);
+	client->state.idle_cmd = FALSE;
+	timeout_remove(&client->to_keepalive);
+	io_remove(&client->io);
+	client->io = io_add(client->fd, IO_READ,
+			    imap_client_input_nonidle, client);
+	client->to_nonidle = timeout_add(IMAP_CLIENT_NONIDLE_TIMEOUT_MSECS,
+					 nonidle_timeout, client);
+	return imap_client_send(client, output);
+}
+
+static void imap_client_idle_start(struct imap_client *client, const char *tag)
+{
+	client->state.tag = i_strdup(tag);
+	client->state.idle_cmd = TRUE;
+	timeout_remove(&client->to_nonidle);
+	io_remove(&client->io);
+	client->io = io_add(client->fd, IO_READ,
+			    imap_client_input_idle_cmd, client);
+	if (imap_client_send(client, "+ idling\r\n"))
+		imap_client_add_idle_keepalive_timeout(client);
+}
+
+static void imap_client_input_simple_cmds(struct imap_client *client)
+{
+	const unsigned char *data, *p;
+	const char *line, *cmd_name, *tag;
+	size_t size, line_size;
+
+	/* Handle NOOP and IDLE commands while there are no mailbox changes.
+	   Anything else requires recreating the imap process. */
+	for (;;) {
+		data = i_stream_get_data(client->input, &size);
+		if (size == 0)
+			return;
+		p = memchr(data, '\n', size);
+		if (p == NULL) {
+			if (size < IMAP_MAX_INBUF) {
+				/* wait for the rest of the line */
+				return;
+			}
+			break;
+		}
+		line_size = p - data;
+		if (line_size > 0 && data[line_size-1] == '\r')
+			line_size--;
+		line = t_strndup(data, line_size);
+		cmd_name = imap_client_parse_simple_cmd(line, &tag);
+		if (cmd_name == NULL || client->changes_pending)
+			break;
+
+		if (strcmp(cmd_name, "IDLE") == 0) {
+			if ((size_t)(p - data) + 1 != size) {
+				/* more commands pipelined after IDLE */
+				break;
+			}
+			i_stream_skip(client->input, size);
+			imap_client_idle_start(client, tag);
+			return;
+		}
+		i_stream_skip(client->input, p - data + 1);
+		if (!imap_client_send(client, t_strdup_printf(
+				"%s OK NOOP completed.\r\n", tag)))
+			return;
+	}
+	client->input_pending = TRUE;
+	imap_client_move_back(client);
+}
+
 static void imap_client_input_idle_cmd(struct imap_client *client)
 {
 	char *old_tag;
@@ -357,25 +499,20 @@ static void imap_client_input_idle_cmd(struct imap_client *client)
 		client->state.tag = i_strdup(new_tag);
 		output = t_strdup_printf("%s OK Idle completed.\r\n+ idling\r\n", old_tag);
 		i_free(old_tag);
-		ret = o_stream_flush(client->output);
-		if (ret > 0)
-			ret = o_stream_send_str(client->output, output);
-		if (ret < 0) {
-			imap_client_disconnected(&client);
-			return;
-		}
-		if ((size_t)ret != strlen(output)) {
-			/* disconnect */
-			imap_client_destroy(&client, IMAP_CLIENT_BUFFER_FULL_ERROR);
+		if (!imap_client_send(client, output))
 			return;
-		} else {
-			done = FALSE;
-			i_stream_skip(client->input, size);
-		}
+		done = FALSE;
+		i_stream_skip(client->input, size);
 		break;
 	}
 
-	if (done) {
+	if (done && !client->bad_done && client->state.simple_cmds) {
+		/* finish the IDLE here and continue hibernation until the
+		   client sends a command that we can't handle */
+		if (!imap_client_idle_stop(client))
+			return;
+		imap_client_input_simple_cmds(client);
+	} else if (done) {
 		client->idle_done = TRUE;
 		client->input_pending = TRUE;
 		imap_client_move_back(client);
@@ -387,7 +524,10 @@ static void imap_client_input_nonidle(struct imap_client *client)
 {
 	if (i_stream_read(client->input) < 0)
 		imap_client_disconnected(&client);
-	else {
+	else if (client->state.simple_cmds) {
+		timeout_reset(client->to_nonidle);
+		imap_client_input_simple_cmds(client);
+	} else {
 		client->input_pending = TRUE;
 		imap_client_move_back(client);
 	}
@@ -395,7 +535,17 @@ static void imap_client_input_nonidle(struct imap_client *client)
 
 static void imap_client_input_notify(struct imap_client *client)
 {
-	imap_client_move_back(client);
+	struct imap_client_notify *notify;
+
+	if (client->state.idle_cmd) {
+		imap_client_move_back(client);
+		return;
+	}
+	/* the changes are sent only after the next command. the imap
+	   process will find them itself once it's recreated. */
+	client->changes_pending = TRUE;
+	array_foreach_modifiable(&client->notifys, notify)
+		io_remove(&notify->io);
 }
 
 static void keepalive_timeout(struct imap_client *client)
@@ -520,6 +670,26 @@ static const char *imap_client_get_anvil_userip_ident(struct imap_client_state *
 			   str_tabescape(state->username), NULL);
 }
 
+static size_t
+imap_client_state_get_pool_size(const struct imap_client_state *state)
+{
+	size_t size = sizeof(struct imap_client) +
+		sizeof(struct imap_client_notify) * 2 +
+		strlen(state->username) + 1 +
+		/* log prefix is usually about the same size */
+		strlen(state->mail_log_prefix) + 64 +
+		state->state_size;
+
+	if (state->session_id != NULL)
+		size += strlen(state->session_id) + 1;
+	if (state->userdb_fields != NULL)
+		size += strlen(state->userdb_fields) + 1;
+	if (state->stats != NULL)
+		size += strlen(state->stats) + 1;
+	/* leave some space for the pool's own alignment */
+	return size + 64;
+}
+
 struct imap_client *
 imap_client_create(int fd, const struct imap_client_state *state)
 {
@@ -528,13 +698,18 @@ imap_client_create(int fd, const struct imap_client_state *state)
 		{ NULL, NULL }
 	};
 	struct imap_client *client;
-	pool_t pool = pool_alloconly_create("imap client", 256);
+	pool_t pool;
 	void *statebuf;
 	const char *ident, *error;
 
 	i_assert(state->username != NULL);
 	i_assert(state->mail_log_prefix != NULL);
 
+	/* there may be a lot of hibernated clients, so allocate the pool
+	   large enough for all of the client's state at once. */
+	pool = pool_alloconly_create("imap client",
+		imap_client_state_get_pool_size(state));
+
 	fd_set_nonblock(fd, TRUE); /* it should already be, but be sure */
 
 	client = p_new(pool, struct imap_client, 1);
@@ -569,7 +744,7 @@ imap_client_create(int fd, const struct imap_client_state *state)
 
 	ident = imap_client_get_anvil_userip_ident(&client->state);
 	if (ident != NULL) {
-		master_service_anvil_send(master_service, t_strconcat(
+		master_service_anvil_send_batched(master_service, t_strconcat(
 			"CONNECT\t", my_pid, "\timap/", ident, "\n", NULL));
 		client->state.anvil_sent = TRUE;
 	}
@@ -587,6 +762,7 @@ static void imap_client_stop(struct imap_client *client)
 		priorityq_remove(unhibernate_queue, &client->item);
 	io_remove(&client->io);
 	timeout_remove(&client->to_keepalive);
+	timeout_remove(&client->to_nonidle);
 
 	array_foreach_modifiable(&client->notifys, notify) {
 		io_remove(&notify->io);
@@ -607,7 +783,7 @@ void imap_client_destroy(struct imap_client **_client, const char *reason)
 	}
 
 	if (client->state.anvil_sent) {
-		master_service_anvil_send(master_service, t_strconcat(
+		master_service_anvil_send_batched(master_service, t_strconcat(
 			"DISCONNECT\t", my_pid, "\timap/",
 			imap_client_get_anvil_userip_ident(&client->state),
 			"\n", NULL));
@@ -660,6 +836,10 @@ void imap_client_create_finish(struct imap_client *client)
 				    imap_client_input_nonidle, client);
 	}
 	imap_client_add_idle_keepalive_timeout(client);
+	if (!client->state.idle_cmd && client->state.simple_cmds) {
+		client->to_nonidle = timeout_add(IMAP_CLIENT_NONIDLE_TIMEOUT_MSECS,
+						 nonidle_timeout, client);
+	}
 
 	array_foreach_modifiable(&client->notifys, notify) {
 		notify->io = io_add(notify->fd, IO_READ,
@@ -23,6 +23,8 @@ struct imap_client_state {
 
 	unsigned int imap_idle_notify_interval;
 	bool idle_cmd;
+	/* handle DONE, NOOP and IDLE without recreating the imap process */
+	bool simple_cmds;
 	bool have_notify_fd;
 	bool anvil_sent;
 };
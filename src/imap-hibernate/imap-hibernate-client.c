@@ -115,6 +115,8 @@ imap_hibernate_client_parse_input(const char *const *args, pool_t pool,
 			state_r->stats = value;
 		} else if (strcmp(key, "idle-cmd") == 0) {
 			state_r->idle_cmd = TRUE;
+		} else if (strcmp(key, "simple-cmds") == 0) {
+			state_r->simple_cmds = TRUE;
 		} else if (strcmp(key, "session") == 0) {
 			state_r->session_id = value;
 		} else if (strcmp(key, "session_created") == 0) {
@@ -96,6 +96,8 @@ static void imap_hibernate_write_cmd(struct client *client, string_t *cmd,
 	if (client->command_queue != NULL &&
 	    strcasecmp(client->command_queue->name, "IDLE") == 0)
 		str_append(cmd, "\tidle-cmd");
+	if (client->set->imap_hibernate_simple_commands)
+		str_append(cmd, "\tsimple-cmds");
 	if (fd_notify != -1)
 		str_append(cmd, "\tnotify_fd");
 	str_append(cmd, "\tstate=");
@@ -211,7 +211,7 @@ struct client *client_create(int fd_in, int fd_out, const char *session_id,
 
 	ident = mail_user_get_anvil_userip_ident(client->user);
 	if (ident != NULL) {
-		master_service_anvil_send(master_service, t_strconcat(
+		master_service_anvil_send_batched(master_service, t_strconcat(
 			"CONNECT\t", my_pid, "\timap/", ident, "\n", NULL));
 		client->anvil_sent = TRUE;
 	}
@@ -470,7 +470,7 @@ static void client_default_destroy(struct client *client, const char *reason)
 	if (client->urlauth_ctx != NULL)
 		imap_urlauth_deinit(&client->urlauth_ctx);
 	if (client->anvil_sent) {
-		master_service_anvil_send(master_service, t_strconcat(
+		master_service_anvil_send_batched(master_service, t_strconcat(
 			"DISCONNECT\t", my_pid, "\timap/",
 			mail_user_get_anvil_userip_ident(client->user),
 			"\n", NULL));
@@ -974,6 +974,12 @@ void client_command_free(struct client_command_context **_cmd)
 	event_add_int(cmd->event, "lock_wait_usecs", cmd->stats.lock_wait_usecs);
 	event_add_int(cmd->event, "bytes_in", cmd->stats.bytes_in);
 	event_add_int(cmd->event, "bytes_out", cmd->stats.bytes_out);
+	event_add_int(cmd->event, "cpu_user_usecs", cmd->stats.cpu_user_usecs);
+	event_add_int(cmd->event, "cpu_sys_usecs", cmd->stats.cpu_sys_usecs);
+	event_add_int(cmd->event, "storage_read_bytes",
+		      cmd->stats.storage_read_bytes);
+	event_add_int(cmd->event, "cache_hits", cmd->stats.cache_hits);
+	event_add_int(cmd->event, "cache_misses", cmd->stats.cache_misses);
 
 	e_debug(cmd->event, "Command finished: %s %s", cmd->name,
 		cmd->human_args != NULL ? cmd->human_args : "");
@@ -1235,6 +1241,25 @@ static bool client_command_input(struct client_command_context *cmd)
 	}
 }
 
+static bool client_command_queue_is_full(struct client *client)
+{
+	struct client_command_context *cmd;
+	unsigned int active_count = 0;
+
+	if (client->command_queue_size < CLIENT_COMMAND_QUEUE_MAX_SIZE)
+		return FALSE;
+	if (client->command_queue_size >=
+	    CLIENT_COMMAND_QUEUE_MAX_SIZE + CLIENT_COMMAND_QUEUE_MAX_SYNC_WAITS)
+		return TRUE;
+
+	/* the commands waiting for sync don't count towards the limit */
+	for (cmd = client->command_queue; cmd != NULL; cmd = cmd->next) {
+		if (cmd->state != CLIENT_COMMAND_STATE_WAIT_SYNC)
+			active_count++;
+	}
+	return active_count >= CLIENT_COMMAND_QUEUE_MAX_SIZE;
+}
+
 static bool client_handle_next_command(struct client *client, bool *remove_io_r)
 {
 	*remove_io_r = FALSE;
@@ -1265,7 +1290,7 @@ static bool client_handle_next_command(struct client *client, bool *remove_io_r)
 		return FALSE;
 
 	/* beginning a new command */
-	if (client->command_queue_size >= CLIENT_COMMAND_QUEUE_MAX_SIZE ||
+	if (client_command_queue_is_full(client) ||
 	    client->output_cmd_lock != NULL) {
 		/* wait for some of the commands to finish */
 		*remove_io_r = TRUE;
@@ -1348,6 +1373,11 @@ void client_input(struct client *client)
 	o_stream_uncork(output);
 	o_stream_unref(&output);
 	imap_refresh_proctitle();
+	if (imap_client_count > 1) {
+		/* the process is shared by multiple users. don't keep the
+		   data stack memory used by this command reserved. */
+		data_stack_free_unused();
+	}
 
 	if (client->disconnected)
 		client_destroy(client, NULL);
@@ -5,6 +5,10 @@
 #include "message-size.h"
 
 #define CLIENT_COMMAND_QUEUE_MAX_SIZE 4
+/* Maximum number of additional commands that have finished and are only
+   waiting for the mailbox to be synced. Pipelined commands are synced
+   together, so this allows syncing a burst of them at once. */
+#define CLIENT_COMMAND_QUEUE_MAX_SYNC_WAITS 100
 /* Maximum number of CONTEXT=SEARCH UPDATEs. Clients probably won't need more
    than a few, so this is mainly to avoid more or less accidental pointless
    resource usage. */
@@ -67,12 +71,21 @@ struct client_command_stats {
 	uint64_t lock_wait_usecs;
 	/* how many bytes of client input/output command has used */
 	uint64_t bytes_in, bytes_out;
+	/* how many usecs of user/system CPU time the command has used */
+	uint64_t cpu_user_usecs, cpu_sys_usecs;
+	/* how many bytes of mail files the command has read */
+	uint64_t storage_read_bytes;
+	/* how many mail cache lookups found/didn't find the field */
+	uint64_t cache_hits, cache_misses;
 };
 
 struct client_command_stats_start {
 	struct timeval timeval;
+	struct timeval cpu_user, cpu_sys;
 	uint64_t lock_wait_usecs;
 	uint64_t bytes_in, bytes_out;
+	uint64_t storage_read_bytes;
+	uint64_t cache_hits, cache_misses;
 };
 
 struct client_command_context {
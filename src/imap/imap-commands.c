@@ -9,6 +9,8 @@
 #include "time-util.h"
 #include "imap-commands.h"
 
+#include <sys/resource.h>
+
 
 struct command_hook {
 	command_hook_callback_t *pre;
@@ -160,19 +162,53 @@ void command_hook_unregister(command_hook_callback_t *pre,
 	i_panic("command_hook_unregister(): hook not registered");
 }
 
+static void command_stats_get_rusage(struct timeval *user_r,
+				     struct timeval *sys_r)
+{
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) < 0) {
+		i_error("getrusage() failed: %m");
+		i_zero(user_r);
+		i_zero(sys_r);
+		return;
+	}
+	*user_r = usage.ru_utime;
+	*sys_r = usage.ru_stime;
+}
+
 void command_stats_start(struct client_command_context *cmd)
 {
+	struct mail_user *user = cmd->client->user;
+
 	cmd->stats_start.timeval = ioloop_timeval;
+	command_stats_get_rusage(&cmd->stats_start.cpu_user,
+				 &cmd->stats_start.cpu_sys);
 	cmd->stats_start.lock_wait_usecs = file_lock_wait_get_total_usecs();
 	cmd->stats_start.bytes_in = i_stream_get_absolute_offset(cmd->client->input);
 	cmd->stats_start.bytes_out = cmd->client->output->offset;
+	cmd->stats_start.storage_read_bytes = user->trans_files_read_bytes;
+	cmd->stats_start.cache_hits = user->trans_cache_hit_count;
+	cmd->stats_start.cache_misses = user->trans_cache_miss_count;
 }
 
 void command_stats_flush(struct client_command_context *cmd)
 {
+	struct mail_user *user = cmd->client->user;
+	struct timeval cpu_user, cpu_sys;
+
 	io_loop_time_refresh();
 	cmd->stats.running_usecs +=
 		timeval_diff_usecs(&ioloop_timeval, &cmd->stats_start.timeval);
+	command_stats_get_rusage(&cpu_user, &cpu_sys);
+	if (timeval_cmp(&cpu_user, &cmd->stats_start.cpu_user) > 0) {
+		cmd->stats.cpu_user_usecs +=
+			timeval_diff_usecs(&cpu_user, &cmd->stats_start.cpu_user);
+	}
+	if (timeval_cmp(&cpu_sys, &cmd->stats_start.cpu_sys) > 0) {
+		cmd->stats.cpu_sys_usecs +=
+			timeval_diff_usecs(&cpu_sys, &cmd->stats_start.cpu_sys);
+	}
 	cmd->stats.lock_wait_usecs +=
 		file_lock_wait_get_total_usecs() -
 		cmd->stats_start.lock_wait_usecs;
@@ -180,6 +216,12 @@ void command_stats_flush(struct client_command_context *cmd)
 		cmd->stats_start.bytes_in;
 	cmd->stats.bytes_out += cmd->client->output->offset -
 		cmd->stats_start.bytes_out;
+	cmd->stats.storage_read_bytes += user->trans_files_read_bytes -
+		cmd->stats_start.storage_read_bytes;
+	cmd->stats.cache_hits += user->trans_cache_hit_count -
+		cmd->stats_start.cache_hits;
+	cmd->stats.cache_misses += user->trans_cache_miss_count -
+		cmd->stats_start.cache_misses;
 	/* allow flushing multiple times */
 	command_stats_start(cmd);
 }
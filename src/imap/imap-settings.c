@@ -77,6 +77,7 @@ static const struct setting_define imap_setting_defines[] = {
 	DEF(SET_BOOL, imap_metadata),
 	DEF(SET_BOOL, imap_literal_minus),
 	DEF(SET_TIME, imap_hibernate_timeout),
+	DEF(SET_BOOL, imap_hibernate_simple_commands),
 
 	DEF(SET_STR, imap_urlauth_host),
 	DEF(SET_IN_PORT, imap_urlauth_port),
@@ -105,6 +106,7 @@ static const struct imap_settings imap_default_settings = {
 	.imap_metadata = FALSE,
 	.imap_literal_minus = FALSE,
 	.imap_hibernate_timeout = 0,
+	.imap_hibernate_simple_commands = FALSE,
 
 	.imap_urlauth_host = "",
 	.imap_urlauth_port = 143
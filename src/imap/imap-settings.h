@@ -35,6 +35,7 @@ struct imap_settings {
 	bool imap_metadata;
 	bool imap_literal_minus;
 	unsigned int imap_hibernate_timeout;
+	bool imap_hibernate_simple_commands;
 
 	/* imap urlauth: */
 	const char *imap_urlauth_host;
@@ -1,18 +1,56 @@
 /* Copyright (c) 2011-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "ioloop.h"
 #include "array.h"
 #include "llist.h"
 #include "hash.h"
+#include "time-util.h"
 #include "indexer-queue.h"
 
+/* Requests prepended to the queue (e.g. from an IMAP session waiting in
+   SEARCH) are served before the appended ones. Within both priorities each
+   user has their own list of requests, and the users take turns, so a user
+   with a lot of mailboxes to index can't starve the others. An appended
+   request that has waited for longer than max_wait_secs is served
+   before anything else. */
+enum indexer_queue_priority {
+	INDEXER_QUEUE_PRIORITY_HIGH = 0,
+	INDEXER_QUEUE_PRIORITY_NORMAL,
+
+	INDEXER_QUEUE_PRIORITY_COUNT
+};
+
+struct indexer_queue_user {
+	struct indexer_queue_user *prev, *next;
+
+	char *username;
+	enum indexer_queue_priority priority;
+	struct indexer_request *head, *tail;
+};
+
+struct indexer_queue_users {
+	/* username -> indexer_queue_user */
+	HASH_TABLE(char *, struct indexer_queue_user *) hash;
+	/* the next user to be served is the head */
+	struct indexer_queue_user *head, *tail;
+};
+
 struct indexer_queue {
 	indexer_status_callback_t *callback;
 	void (*listen_callback)(struct indexer_queue *);
+	unsigned int max_wait_secs;
+	struct event *event;
 
 	/* username+mailbox -> indexer_request */
 	HASH_TABLE(struct indexer_request *, struct indexer_request *) requests;
-	struct indexer_request *head, *tail;
+	struct indexer_queue_users users[INDEXER_QUEUE_PRIORITY_COUNT];
+	/* normal priority requests in the order they were queued */
+	struct indexer_request *wait_head, *wait_tail;
+};
+
+static struct event_category event_category_indexer = {
+	.name = "indexer",
 };
 
 static unsigned int
@@ -29,26 +67,39 @@ static int indexer_request_cmp(const struct indexer_request *r1,
 }
 
 struct indexer_queue *
-indexer_queue_init(indexer_status_callback_t *callback)
+indexer_queue_init(indexer_status_callback_t *callback,
+		   unsigned int max_wait_secs)
 {
 	struct indexer_queue *queue;
+	unsigned int i;
 	
 	queue = i_new(struct indexer_queue, 1);
 	queue->callback = callback;
+	queue->max_wait_secs = max_wait_secs;
+	queue->event = event_create(NULL);
+	event_add_category(queue->event, &event_category_indexer);
 	hash_table_create(&queue->requests, default_pool, 0,
 			  indexer_request_hash, indexer_request_cmp);
+	for (i = 0; i < INDEXER_QUEUE_PRIORITY_COUNT; i++) {
+		hash_table_create(&queue->users[i].hash, default_pool, 0,
+				  str_hash, strcmp);
+	}
 	return queue;
 }
 
 void indexer_queue_deinit(struct indexer_queue **_queue)
 {
 	struct indexer_queue *queue = *_queue;
+	unsigned int i;
 
 	*_queue = NULL;
 
 	i_assert(indexer_queue_is_empty(queue));
 
+	for (i = 0; i < INDEXER_QUEUE_PRIORITY_COUNT; i++)
+		hash_table_destroy(&queue->users[i].hash);
 	hash_table_destroy(&queue->requests);
+	event_unref(&queue->event);
 	i_free(queue);
 }
 
@@ -79,6 +130,67 @@ static void request_add_context(struct indexer_request *request, void *context)
 	array_push_back(&request->contexts, &context);
 }
 
+static void
+indexer_queue_link(struct indexer_queue *queue,
+		   struct indexer_request *request,
+		   enum indexer_queue_priority priority, bool head)
+{
+	struct indexer_queue_users *users = &queue->users[priority];
+	struct indexer_queue_user *user;
+
+	i_assert(request->queue_user == NULL);
+
+	user = hash_table_lookup(users->hash, request->username);
+	if (user == NULL) {
+		user = i_new(struct indexer_queue_user, 1);
+		user->username = i_strdup(request->username);
+		user->priority = priority;
+		hash_table_insert(users->hash, user->username, user);
+		DLLIST2_APPEND(&users->head, &users->tail, user);
+	}
+	if (head)
+		DLLIST2_PREPEND(&user->head, &user->tail, request);
+	else
+		DLLIST2_APPEND(&user->head, &user->tail, request);
+	request->queue_user = user;
+
+	if (priority == INDEXER_QUEUE_PRIORITY_NORMAL) {
+		DLLIST2_APPEND_FULL(&queue->wait_head, &queue->wait_tail,
+				    request, wait_prev, wait_next);
+	}
+}
+
+static void
+indexer_queue_unlink(struct indexer_queue *queue,
+		     struct indexer_request *request)
+{
+	struct indexer_queue_user *user = request->queue_user;
+	struct indexer_queue_users *users = &queue->users[user->priority];
+
+	DLLIST2_REMOVE(&user->head, &user->tail, request);
+	if (user->priority == INDEXER_QUEUE_PRIORITY_NORMAL) {
+		DLLIST2_REMOVE_FULL(&queue->wait_head, &queue->wait_tail,
+				    request, wait_prev, wait_next);
+	}
+	request->queue_user = NULL;
+
+	if (user->head == NULL) {
+		hash_table_remove(users->hash, user->username);
+		DLLIST2_REMOVE(&users->head, &users->tail, user);
+		i_free(user->username);
+		i_free(user);
+	}
+}
+
+static void
+indexer_queue_request_queued(struct indexer_queue *queue,
+			     struct indexer_request *request,
+			     enum indexer_queue_priority priority, bool head)
+{
+	request->queued_time = ioloop_timeval;
+	indexer_queue_link(queue, request, priority, head);
+}
+
 static struct indexer_request *
 indexer_queue_append_request(struct indexer_queue *queue, bool append,
 			     const char *username, const char *mailbox,
@@ -96,6 +208,12 @@ indexer_queue_append_request(struct indexer_queue *queue, bool append,
 		request->max_recent_msgs = max_recent_msgs;
 		request_add_context(request, context);
 		hash_table_insert(queue->requests, request, request);
+
+		request->event = event_create(queue->event);
+		event_add_str(request->event, "user", username);
+		event_add_str(request->event, "mailbox", mailbox);
+		if (session_id != NULL)
+			event_add_str(request->event, "session", session_id);
 	} else {
 		if (request->max_recent_msgs > max_recent_msgs)
 			request->max_recent_msgs = max_recent_msgs;
@@ -112,14 +230,23 @@ indexer_queue_append_request(struct indexer_queue *queue, bool append,
 			/* keep the request in its old position */
 			return request;
 		}
-		/* move request to beginning of the queue */
-		DLLIST2_REMOVE(&queue->head, &queue->tail, request);
+		/* move request to the beginning of the user's high priority
+		   requests. keep the original queueing time, so the wait
+		   time is reported correctly. */
+		indexer_queue_unlink(queue, request);
+		indexer_queue_link(queue, request,
+				   INDEXER_QUEUE_PRIORITY_HIGH, TRUE);
+		return request;
 	}
 
-	if (append)
-		DLLIST2_APPEND(&queue->head, &queue->tail, request);
-	else
-		DLLIST2_PREPEND(&queue->head, &queue->tail, request);
+	if (append) {
+		indexer_queue_request_queued(queue, request,
+					     INDEXER_QUEUE_PRIORITY_NORMAL,
+					     FALSE);
+	} else {
+		indexer_queue_request_queued(queue, request,
+					     INDEXER_QUEUE_PRIORITY_HIGH, TRUE);
+	}
 	return request;
 }
 
@@ -158,16 +285,39 @@ void indexer_queue_append_optimize(struct indexer_queue *queue,
 
 struct indexer_request *indexer_queue_request_peek(struct indexer_queue *queue)
 {
-	return queue->head;
+	struct indexer_request *oldest = queue->wait_head;
+	unsigned int i;
+
+	if (oldest != NULL && queue->max_wait_secs > 0 &&
+	    oldest->queued_time.tv_sec +
+	    (time_t)queue->max_wait_secs <= ioloop_time) {
+		/* don't let the high priority requests starve the normal
+		   ones forever */
+		return oldest;
+	}
+	for (i = 0; i < INDEXER_QUEUE_PRIORITY_COUNT; i++) {
+		if (queue->users[i].head != NULL)
+			return queue->users[i].head->head;
+	}
+	return NULL;
 }
 
 void indexer_queue_request_remove(struct indexer_queue *queue)
 {
-	struct indexer_request *request = queue->head;
+	struct indexer_request *request = indexer_queue_request_peek(queue);
+	struct indexer_queue_user *user;
+	struct indexer_queue_users *users;
 
 	i_assert(request != NULL);
 
-	DLLIST2_REMOVE(&queue->head, &queue->tail, request);
+	/* let the other users' requests go before this user's next one */
+	user = request->queue_user;
+	users = &queue->users[user->priority];
+	if (user->next != NULL) {
+		DLLIST2_REMOVE(&users->head, &users->tail, user);
+		DLLIST2_APPEND(&users->head, &users->tail, user);
+	}
+	indexer_queue_unlink(queue, request);
 }
 
 static void indexer_queue_request_status_int(struct indexer_queue *queue,
@@ -194,10 +344,20 @@ void indexer_queue_request_status(struct indexer_queue *queue,
 
 void indexer_queue_request_work(struct indexer_request *request)
 {
+	int wait_msecs =
+		timeval_diff_msecs(&ioloop_timeval, &request->queued_time);
+
 	request->working = TRUE;
 	request->working_context_idx =
 		!array_is_created(&request->contexts) ? 0 :
 		array_count(&request->contexts);
+
+	struct event_passthrough *e =
+		event_create_passthrough(request->event)->
+		set_name("indexer_request_started")->
+		add_int("queue_wait_msecs", wait_msecs);
+	e_debug(e->event(), "Started indexing %s (waited %d msecs in queue)",
+		request->mailbox, wait_msecs);
 }
 
 void indexer_queue_request_finish(struct indexer_queue *queue,
@@ -210,7 +370,17 @@ void indexer_queue_request_finish(struct indexer_queue *queue,
 
 	indexer_queue_request_status_int(queue, request, success ? 100 : -1);
 
+	struct event_passthrough *e =
+		event_create_passthrough(request->event)->
+		set_name("indexer_request_finished");
+	if (!success)
+		e->add_str("error", "Indexing failed");
+	e_debug(e->event(), "Finished indexing %s%s", request->mailbox,
+		success ? "" : " (failed)");
+
 	if (request->reindex_head || request->reindex_tail) {
+		bool head = request->reindex_head;
+
 		i_assert(request->working);
 		request->working = FALSE;
 		request->reindex_head = FALSE;
@@ -219,18 +389,20 @@ void indexer_queue_request_finish(struct indexer_queue *queue,
 			array_delete(&request->contexts, 0,
 				     request->working_context_idx);
 		}
-		if (request->reindex_head)
-			DLLIST2_PREPEND(&queue->head, &queue->tail, request);
-		else
-			DLLIST2_APPEND(&queue->head, &queue->tail, request);
+		indexer_queue_request_queued(queue, request, head ?
+					     INDEXER_QUEUE_PRIORITY_HIGH :
+					     INDEXER_QUEUE_PRIORITY_NORMAL,
+					     head);
 		return;
 	}
 
 	hash_table_remove(queue->requests, request);
 	if (array_is_created(&request->contexts))
 		array_free(&request->contexts);
+	event_unref(&request->event);
 	i_free(request->username);
 	i_free(request->mailbox);
+	i_free(request->session_id);
 	i_free(request);
 
 	indexer_refresh_proctitle();
@@ -257,7 +429,7 @@ void indexer_queue_cancel_all(struct indexer_queue *queue)
 
 bool indexer_queue_is_empty(struct indexer_queue *queue)
 {
-	return queue->head == NULL;
+	return indexer_queue_request_peek(queue) == NULL;
 }
 
 unsigned int indexer_queue_count(struct indexer_queue *queue)
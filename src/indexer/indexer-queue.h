@@ -4,13 +4,22 @@
 #include "indexer.h"
 
 struct indexer_request {
+	/* in the user's list of requests */
 	struct indexer_request *prev, *next;
+	/* in the queue's list of normal priority requests */
+	struct indexer_request *wait_prev, *wait_next;
 
 	char *username;
 	char *mailbox;
 	char *session_id;
 	unsigned int max_recent_msgs;
 
+	/* NULL when the request isn't in the queue */
+	struct indexer_queue_user *queue_user;
+	/* when the request was added to the queue */
+	struct timeval queued_time;
+	struct event *event;
+
 	/* index messages in this mailbox */
 	bool index:1;
 	/* optimize this mailbox */
@@ -30,7 +39,10 @@ struct indexer_request {
 	ARRAY(void *) contexts;
 };
 
-struct indexer_queue *indexer_queue_init(indexer_status_callback_t *callback);
+/* Appended requests that have waited for max_wait_secs are handled before
+   the prepended ones. 0 means they can wait forever. */
+struct indexer_queue *indexer_queue_init(indexer_status_callback_t *callback,
+					 unsigned int max_wait_secs);
 void indexer_queue_deinit(struct indexer_queue **queue);
 
 /* The callback is called whenever a new request is added to the queue. */
@@ -4,6 +4,7 @@
 #include "buffer.h"
 #include "settings-parser.h"
 #include "service-settings.h"
+#include "indexer-settings.h"
 
 #include <stddef.h>
 
@@ -48,3 +49,32 @@ struct service_settings indexer_service_settings = {
 
 	.process_limit_1 = TRUE
 };
+
+#undef DEF
+#define DEF(type, name) \
+	{ type, #name, offsetof(struct indexer_settings, name), NULL }
+
+static const struct setting_define indexer_setting_defines[] = {
+	DEF(SET_UINT, indexer_user_max_workers),
+	DEF(SET_TIME, indexer_queue_max_wait),
+	DEF(SET_UINT, indexer_max_pressure),
+
+	SETTING_DEFINE_LIST_END
+};
+
+const struct indexer_settings indexer_default_settings = {
+	.indexer_user_max_workers = 1,
+	.indexer_queue_max_wait = 5*60,
+	.indexer_max_pressure = 0
+};
+
+const struct setting_parser_info indexer_setting_parser_info = {
+	.module_name = "indexer",
+	.defines = indexer_setting_defines,
+	.defaults = &indexer_default_settings,
+
+	.type_offset = (size_t)-1,
+	.struct_size = sizeof(struct indexer_settings),
+
+	.parent_offset = (size_t)-1
+};
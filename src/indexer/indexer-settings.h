@@ -0,0 +1,18 @@
+#ifndef INDEXER_SETTINGS_H
+#define INDEXER_SETTINGS_H
+
+struct indexer_settings {
+	/* Maximum number of indexer-worker processes that may be indexing
+	   different mailboxes of the same user at the same time. */
+	unsigned int indexer_user_max_workers;
+	/* Prepended requests (e.g. from IMAP SEARCH) are handled first, but
+	   an appended request is handled anyway after waiting this long. */
+	unsigned int indexer_queue_max_wait;
+	/* Use fewer indexer-worker processes while the CPU or IO pressure
+	   (PSI avg10) is above this percentage. 0 = unlimited. */
+	unsigned int indexer_max_pressure;
+};
+
+extern const struct setting_parser_info indexer_setting_parser_info;
+
+#endif
@@ -8,6 +8,7 @@
 #include "master-service-settings.h"
 #include "indexer-client.h"
 #include "indexer-queue.h"
+#include "indexer-settings.h"
 #include "worker-pool.h"
 #include "worker-connection.h"
 
@@ -17,6 +18,7 @@ struct worker_request {
 };
 
 static const struct master_service_settings *set;
+static const struct indexer_settings *indexer_set;
 static struct indexer_queue *queue;
 static struct worker_pool *worker_pool;
 static struct timeout *to_send_more;
@@ -58,22 +60,31 @@ static void worker_send_request(struct worker_connection *conn,
 
 static void queue_try_send_more(struct indexer_queue *queue)
 {
-	struct worker_connection *conn;
+	struct worker_connection *conn, *user_conn;
 	struct indexer_request *request;
+	unsigned int user_conn_count;
 
 	timeout_remove(&to_send_more);
 
 	while ((request = indexer_queue_request_peek(queue)) != NULL) {
-		conn = worker_pool_find_username_connection(worker_pool,
-							    request->username);
-		if (conn != NULL) {
-			/* there is already a worker handling this user.
-			   it must be the one doing the indexing. use the same
-			   connection for sending this next request. */
+		user_conn = worker_pool_find_username_connection(worker_pool,
+				request->username, &user_conn_count);
+		if (user_conn != NULL &&
+		    user_conn_count >= indexer_set->indexer_user_max_workers) {
+			/* the user already has as many workers as allowed.
+			   use the least busy one of them for sending this
+			   next request. */
+			conn = user_conn;
+		} else if (worker_pool_get_connection(worker_pool, &conn)) {
+			/* got an empty worker. the queue never contains a
+			   mailbox that is already being indexed, so this
+			   is indexing a different mailbox of the user. */
+		} else if (user_conn != NULL) {
+			/* no more empty workers, but one of the user's
+			   workers can still handle this request. */
+			conn = user_conn;
 		} else {
-			/* try to find an empty worker */
-			if (!worker_pool_get_connection(worker_pool, &conn))
-				break;
+			break;
 		}
 		indexer_queue_request_remove(queue);
 		worker_send_request(conn, request);
@@ -110,26 +121,33 @@ static void worker_status_callback(int percentage, void *context)
 
 int main(int argc, char *argv[])
 {
+	const struct setting_parser_info *set_roots[] = {
+		&indexer_setting_parser_info,
+		NULL
+	};
 	const char *error;
 
 	master_service = master_service_init("indexer", 0, &argc, &argv, "");
 	if (master_getopt(master_service) > 0)
 		return FATAL_DEFAULT;
 
-	if (master_service_settings_read_simple(master_service, NULL,
+	if (master_service_settings_read_simple(master_service, set_roots,
 						&error) < 0)
 		i_fatal("Error reading configuration: %s", error);
 	set = master_service_settings_get(master_service);
+	indexer_set = master_service_settings_get_others(master_service)[0];
 
 	master_service_init_log(master_service, "indexer: ");
 	restrict_access_by_env(RESTRICT_ACCESS_FLAG_ALLOW_ROOT, NULL);
 	restrict_access_allow_coredumps(TRUE);
 	master_service_set_idle_die_callback(master_service, idle_die);
 
-	queue = indexer_queue_init(indexer_client_status_callback);
+	queue = indexer_queue_init(indexer_client_status_callback,
+				   indexer_set->indexer_queue_max_wait);
 	indexer_queue_set_listen_callback(queue, queue_listen_callback);
 	worker_pool = worker_pool_init("indexer-worker",
-				       worker_status_callback);
+				       worker_status_callback,
+				       indexer_set->indexer_max_pressure);
 	master_service_init_finish(master_service);
 
 	master_service_run(master_service, client_connected);
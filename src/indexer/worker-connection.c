@@ -259,6 +259,11 @@ bool worker_connection_is_busy(struct worker_connection *conn)
 	return aqueue_count(conn->request_queue) > 0;
 }
 
+unsigned int worker_connection_get_request_count(struct worker_connection *conn)
+{
+	return aqueue_count(conn->request_queue);
+}
+
 const char *worker_connection_get_username(struct worker_connection *conn)
 {
 	return conn->request_username;
@@ -28,6 +28,8 @@ void worker_connection_request(struct worker_connection *conn,
 			       void *context);
 /* Returns TRUE if a request is being handled. */
 bool worker_connection_is_busy(struct worker_connection *conn);
+/* Returns the number of requests that haven't been finished yet. */
+unsigned int worker_connection_get_request_count(struct worker_connection *conn);
 /* Returns username of the currently pending requests,
    or NULL if there are none. */
 const char *worker_connection_get_username(struct worker_connection *conn);
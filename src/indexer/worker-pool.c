@@ -3,11 +3,20 @@
 #include "lib.h"
 #include "ioloop.h"
 #include "llist.h"
+#include "strnum.h"
 #include "master-service.h"
 #include "worker-connection.h"
 #include "worker-pool.h"
 
+#include <unistd.h>
+#include <fcntl.h>
+
 #define MAX_WORKER_IDLE_SECS (60*5)
+/* avg10 in /proc/pressure is the average over 10 seconds, so there's no
+   point in checking it more often. */
+#define WORKER_POOL_PRESSURE_CHECK_INTERVAL_SECS 10
+#define WORKER_POOL_PRESSURE_CPU_PATH "/proc/pressure/cpu"
+#define WORKER_POOL_PRESSURE_IO_PATH "/proc/pressure/io"
 
 struct worker_connection_list {
 	struct worker_connection_list *prev, *next;
@@ -22,6 +31,13 @@ struct worker_pool {
 
 	unsigned int connection_count;
 	struct worker_connection_list *busy_list, *idle_list;
+
+	/* Maximum CPU/IO pressure percentage, 0 if unlimited */
+	unsigned int max_pressure;
+	/* The connection limit lowered because of the pressure,
+	   0 if there is no such limit currently. */
+	unsigned int pressure_limit;
+	time_t pressure_last_check;
 };
 
 static void
@@ -29,13 +45,15 @@ worker_connection_list_free(struct worker_pool *pool,
 			    struct worker_connection_list *list);
 
 struct worker_pool *
-worker_pool_init(const char *socket_path, indexer_status_callback_t *callback)
+worker_pool_init(const char *socket_path, indexer_status_callback_t *callback,
+		 unsigned int max_pressure)
 {
 	struct worker_pool *pool;
 
 	pool = i_new(struct worker_pool, 1);
 	pool->socket_path = i_strdup(socket_path);
 	pool->callback = callback;
+	pool->max_pressure = max_pressure;
 	return pool;
 }
 
@@ -119,6 +137,74 @@ static unsigned int worker_pool_find_max_connections(struct worker_pool *pool)
 	return 0;
 }
 
+static int worker_pool_read_pressure(const char *path, unsigned int *pressure_r)
+{
+	char buf[256];
+	const char *p;
+	ssize_t ret;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		/* ENOENT = kernel doesn't support PSI */
+		if (errno != ENOENT)
+			i_error("open(%s) failed: %m", path);
+		return -1;
+	}
+	ret = read(fd, buf, sizeof(buf)-1);
+	if (ret < 0)
+		i_error("read(%s) failed: %m", path);
+	i_close_fd(&fd);
+	if (ret <= 0)
+		return -1;
+	buf[ret] = '\0';
+
+	/* some avg10=1.23 avg60=0.50 avg300=0.10 total=12345 - the
+	   fractional part is ignored */
+	p = strstr(buf, "avg10=");
+	if (p == NULL || str_parse_uint(p + 6, pressure_r, &p) < 0) {
+		i_error("%s: Unexpected content: %s", path, buf);
+		return -1;
+	}
+	return 0;
+}
+
+static void
+worker_pool_update_pressure_limit(struct worker_pool *pool,
+				  unsigned int max_connections)
+{
+	unsigned int cpu, io, limit;
+
+	if (pool->max_pressure == 0 ||
+	    pool->pressure_last_check +
+	    WORKER_POOL_PRESSURE_CHECK_INTERVAL_SECS > ioloop_time)
+		return;
+	pool->pressure_last_check = ioloop_time;
+
+	if (worker_pool_read_pressure(WORKER_POOL_PRESSURE_CPU_PATH, &cpu) < 0 ||
+	    worker_pool_read_pressure(WORKER_POOL_PRESSURE_IO_PATH, &io) < 0) {
+		/* don't try again */
+		pool->max_pressure = 0;
+		pool->pressure_limit = 0;
+		return;
+	}
+
+	/* Lower the limit one connection at a time while the system is
+	   loaded, and raise it back the same way. The idle workers above
+	   the limit are disconnected when they finish their requests. */
+	limit = pool->pressure_limit == 0 ? max_connections :
+		pool->pressure_limit;
+	if (I_MAX(cpu, io) > pool->max_pressure) {
+		if (pool->connection_count > 0)
+			limit = I_MIN(limit, pool->connection_count);
+		if (limit > 1)
+			limit--;
+	} else if (limit < max_connections) {
+		limit++;
+	}
+	pool->pressure_limit = limit >= max_connections ? 0 : limit;
+}
+
 bool worker_pool_get_connection(struct worker_pool *pool,
 				struct worker_connection **conn_r)
 {
@@ -134,6 +220,10 @@ bool worker_pool_get_connection(struct worker_pool *pool,
 
 	if (pool->idle_list == NULL) {
 		max_connections = worker_pool_find_max_connections(pool);
+		worker_pool_update_pressure_limit(pool, max_connections);
+		if (pool->pressure_limit != 0 &&
+		    pool->pressure_limit < max_connections)
+			max_connections = pool->pressure_limit;
 		if (pool->connection_count >= max_connections)
 			return FALSE;
 		if (worker_pool_add_connection(pool) < 0)
@@ -181,7 +271,9 @@ void worker_pool_release_connection(struct worker_pool *pool,
 
 	DLLIST_REMOVE(&pool->busy_list, list);
 
-	if (!worker_connection_is_connected(conn))
+	if (!worker_connection_is_connected(conn) ||
+	    (pool->pressure_limit != 0 &&
+	     pool->connection_count > pool->pressure_limit))
 		worker_connection_list_free(pool, list);
 	else {
 		DLLIST_PREPEND(&pool->idle_list, list);
@@ -193,15 +285,26 @@ void worker_pool_release_connection(struct worker_pool *pool,
 
 struct worker_connection *
 worker_pool_find_username_connection(struct worker_pool *pool,
-				     const char *username)
+				     const char *username,
+				     unsigned int *count_r)
 {
 	struct worker_connection_list *list;
+	struct worker_connection *conn = NULL;
+	unsigned int count = 0, request_count, min_request_count = UINT_MAX;
 	const char *worker_user;
 
 	for (list = pool->busy_list; list != NULL; list = list->next) {
 		worker_user = worker_connection_get_username(list->conn);
-		if (worker_user != NULL && strcmp(worker_user, username) == 0)
-			return list->conn;
+		if (worker_user == NULL || strcmp(worker_user, username) != 0)
+			continue;
+
+		count++;
+		request_count = worker_connection_get_request_count(list->conn);
+		if (request_count < min_request_count) {
+			conn = list->conn;
+			min_request_count = request_count;
+		}
 	}
-	return NULL;
+	*count_r = count;
+	return conn;
 }
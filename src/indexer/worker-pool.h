@@ -5,8 +5,11 @@
 
 struct worker_connection;
 
+/* If max_pressure is non-zero, fewer connections are used while the CPU or
+   IO pressure in /proc/pressure is above the max_pressure percentage. */
 struct worker_pool *
-worker_pool_init(const char *socket_path, indexer_status_callback_t *callback);
+worker_pool_init(const char *socket_path, indexer_status_callback_t *callback,
+		 unsigned int max_pressure);
 void worker_pool_deinit(struct worker_pool **pool);
 
 bool worker_pool_have_busy_connections(struct worker_pool *pool);
@@ -16,8 +19,12 @@ bool worker_pool_get_connection(struct worker_pool *pool,
 void worker_pool_release_connection(struct worker_pool *pool,
 				    struct worker_connection *conn);
 
+/* Find the busy connection for the user that has the fewest requests
+   queued. Returns NULL if none of the busy connections are handling the
+   user. count_r is set to the number of connections handling the user. */
 struct worker_connection *
 worker_pool_find_username_connection(struct worker_pool *pool,
-				     const char *username);
+				     const char *username,
+				     unsigned int *count_r);
 
 #endif
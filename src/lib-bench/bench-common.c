@@ -0,0 +1,209 @@
+/* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "str.h"
+#include "strnum.h"
+#include "json-parser.h"
+#include "write-full.h"
+#include "bench-common.h"
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#define BENCH_DEFAULT_MIN_MSECS 200
+#define BENCH_MAX_BATCH_COUNT (1024*1024*64)
+
+struct bench_result {
+	const char *name;
+	unsigned long long ops;
+	unsigned long long nsecs;
+	size_t bytes_per_op;
+};
+
+static pool_t bench_pool;
+static ARRAY(struct bench_result) bench_results;
+static unsigned long long bench_min_nsecs =
+	BENCH_DEFAULT_MIN_MSECS * 1000000ULL;
+
+static struct bench_result *bench_cur;
+static unsigned long long bench_batch_start;
+static unsigned int bench_batch_count;
+
+static unsigned long long bench_now_nsecs(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		i_fatal("clock_gettime() failed: %m");
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void bench_begin(const char *name)
+{
+	i_assert(bench_cur == NULL);
+
+	bench_cur = array_append_space(&bench_results);
+	bench_cur->name = p_strdup(bench_pool, name);
+	bench_batch_count = 0;
+}
+
+unsigned int bench_batch(void)
+{
+	unsigned long long now = bench_now_nsecs();
+	unsigned long long left, batch_nsecs;
+
+	i_assert(bench_cur != NULL);
+
+	if (bench_batch_count == 0) {
+		/* first batch is a single operation */
+		bench_batch_start = now;
+		bench_batch_count = 1;
+		return bench_batch_count;
+	}
+
+	batch_nsecs = now - bench_batch_start;
+	bench_cur->ops += bench_batch_count;
+	bench_cur->nsecs += batch_nsecs;
+	if (bench_cur->nsecs >= bench_min_nsecs)
+		return 0;
+
+	/* Aim to finish with the next batch, but don't grow the batch size
+	   more than 10x at a time in case the first batches were unusually
+	   slow or fast. */
+	left = bench_min_nsecs - bench_cur->nsecs;
+	if (batch_nsecs == 0)
+		bench_batch_count *= 10;
+	else {
+		unsigned long long next =
+			left * bench_batch_count / batch_nsecs + 1;
+		next = I_MIN(next, (unsigned long long)bench_batch_count * 10);
+		bench_batch_count = I_MAX(next, 1);
+	}
+	bench_batch_count = I_MIN(bench_batch_count, BENCH_MAX_BATCH_COUNT);
+	bench_batch_start = bench_now_nsecs();
+	return bench_batch_count;
+}
+
+void bench_set_bytes_per_op(size_t bytes)
+{
+	i_assert(bench_cur != NULL);
+
+	bench_cur->bytes_per_op = bytes;
+}
+
+void bench_end(void)
+{
+	double ns_per_op;
+
+	i_assert(bench_cur != NULL);
+	i_assert(bench_cur->ops > 0);
+
+	ns_per_op = (double)bench_cur->nsecs / bench_cur->ops;
+	printf("%-40s %12llu ops %12.1f ns/op", bench_cur->name,
+	       bench_cur->ops, ns_per_op);
+	if (bench_cur->bytes_per_op > 0) {
+		printf(" %10"PRIuSIZE_T" bytes/op %10.1f MB/s",
+		       bench_cur->bytes_per_op,
+		       bench_cur->bytes_per_op * 1000.0 / ns_per_op);
+	}
+	printf("\n");
+	fflush(stdout);
+	bench_cur = NULL;
+}
+
+static void bench_append_json(string_t *str)
+{
+	const struct bench_result *result;
+	bool first = TRUE;
+
+	str_append(str, "{\"benchmarks\":[");
+	array_foreach(&bench_results, result) {
+		if (first)
+			first = FALSE;
+		else
+			str_append_c(str, ',');
+		str_append(str, "\n{\"name\":\"");
+		json_append_escaped(str, result->name);
+		str_printfa(str, "\",\"ops\":%llu,\"ns_per_op\":%.3f,"
+			    "\"bytes_per_op\":%"PRIuSIZE_T"}", result->ops,
+			    (double)result->nsecs / result->ops,
+			    result->bytes_per_op);
+	}
+	str_append(str, "\n]}\n");
+}
+
+static int bench_write_json(const char *path)
+{
+	string_t *str = t_str_new(1024);
+	int fd, ret = 0;
+
+	bench_append_json(str);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd == -1) {
+		i_error("open(%s) failed: %m", path);
+		return -1;
+	}
+	if (write_full(fd, str_data(str), str_len(str)) < 0) {
+		i_error("write(%s) failed: %m", path);
+		ret = -1;
+	}
+	if (close(fd) < 0) {
+		i_error("close(%s) failed: %m", path);
+		ret = -1;
+	}
+	return ret;
+}
+
+int bench_run_named(const struct named_bench benches[], const char *match,
+		    const char *json_path)
+{
+	unsigned int i;
+	int ret = 0;
+
+	bench_pool = pool_alloconly_create("bench results", 1024);
+	i_array_init(&bench_results, 64);
+
+	for (i = 0; benches[i].func != NULL; i++) {
+		if (strstr(benches[i].name, match) != NULL) T_BEGIN {
+			benches[i].func();
+		} T_END;
+	}
+	i_assert(bench_cur == NULL);
+
+	if (json_path != NULL) T_BEGIN {
+		ret = bench_write_json(json_path);
+	} T_END;
+	array_free(&bench_results);
+	pool_unref(&bench_pool);
+	return ret < 0 ? 1 : 0;
+}
+
+int bench_main(const struct named_bench benches[], int argc, char *argv[])
+{
+	const char *match = "", *json_path = NULL;
+	unsigned int msecs;
+	int i, ret;
+
+	lib_init();
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--match") == 0 && i+1 < argc)
+			match = argv[++i];
+		else if (strcmp(argv[i], "--json") == 0 && i+1 < argc)
+			json_path = argv[++i];
+		else if (strcmp(argv[i], "--min-time") == 0 && i+1 < argc &&
+			 str_to_uint(argv[i+1], &msecs) == 0 && msecs > 0) {
+			bench_min_nsecs = msecs * 1000000ULL;
+			i++;
+		} else {
+			i_fatal("Usage: %s [--match <substring>] "
+				"[--json <path>] [--min-time <msecs>]",
+				argv[0]);
+		}
+	}
+	ret = bench_run_named(benches, match, json_path);
+	lib_deinit();
+	return ret;
+}
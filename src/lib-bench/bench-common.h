@@ -0,0 +1,43 @@
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+/* Each benchmark is written as:
+
+   bench_begin("name");
+   while ((count = bench_batch()) > 0) {
+	   for (i = 0; i < count; i++)
+		   ..one operation..
+   }
+   bench_end();
+
+   bench_batch() keeps increasing the batch size until the benchmark has run
+   long enough to give stable results. Everything between two
+   bench_batch() calls is timed, so any per-batch setup should be cheap
+   compared to the operations themselves. */
+
+struct named_bench {
+	const char *name;
+	void (*func)(void);
+};
+#define BENCH_NAMED(x) { .name = #x , .func = x },
+
+void bench_begin(const char *name);
+/* Returns the number of operations to run in the next batch, or 0 when the
+   benchmark is finished. */
+unsigned int bench_batch(void);
+/* Set the number of bytes each operation processes. This is used to report
+   bytes/op and MB/s. */
+void bench_set_bytes_per_op(size_t bytes);
+void bench_end(void);
+
+/* Run the benchmarks whose name contains the match string. Results are
+   printed to stdout. If json_path isn't NULL, they're also written there
+   as JSON. */
+int bench_run_named(const struct named_bench benches[], const char *match,
+		    const char *json_path) ATTR_NULL(3) ATTR_WARN_UNUSED_RESULT;
+/* Parse the standard bench command line:
+   [--match <substring>] [--json <path>] [--min-time <msecs>] */
+int bench_main(const struct named_bench benches[], int argc, char *argv[])
+	ATTR_WARN_UNUSED_RESULT;
+
+#endif
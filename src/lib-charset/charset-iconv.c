@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "buffer.h"
+#include "unichar.h"
 #include "charset-utf8-private.h"
 
 #ifdef HAVE_ICONV
@@ -12,8 +13,28 @@
 struct charset_translation {
 	iconv_t cd;
 	normalizer_func_t *normalizer;
+	/* 7bit input is ASCII and can be handled without iconv() */
+	bool ascii_compatible:1;
 };
 
+static bool charset_is_ascii_compatible(const char *charset)
+{
+	/* Stateless charsets where all the 7bit bytes are ASCII. Most
+	   notably this excludes ISO-2022-*, UTF-7, UTF-16 and UTF-32. */
+	return strncasecmp(charset, "ISO-8859-", 9) == 0 ||
+		strncasecmp(charset, "ISO8859-", 8) == 0 ||
+		strncasecmp(charset, "WINDOWS-125", 11) == 0 ||
+		strncasecmp(charset, "CP125", 5) == 0 ||
+		strcasecmp(charset, "KOI8-R") == 0 ||
+		strcasecmp(charset, "KOI8-U") == 0 ||
+		strcasecmp(charset, "GB2312") == 0 ||
+		strcasecmp(charset, "GBK") == 0 ||
+		strcasecmp(charset, "GB18030") == 0 ||
+		strcasecmp(charset, "BIG5") == 0 ||
+		strcasecmp(charset, "EUC-JP") == 0 ||
+		strcasecmp(charset, "EUC-KR") == 0;
+}
+
 static int
 iconv_charset_to_utf8_begin(const char *charset, normalizer_func_t *normalizer,
 			    struct charset_translation **t_r)
@@ -34,6 +55,8 @@ iconv_charset_to_utf8_begin(const char *charset, normalizer_func_t *normalizer,
 	t = i_new(struct charset_translation, 1);
 	t->cd = cd;
 	t->normalizer = normalizer;
+	t->ascii_compatible = cd != (iconv_t)-1 &&
+		charset_is_ascii_compatible(charset);
 	*t_r = t;
 	return 0;
 }
@@ -66,6 +89,12 @@ charset_to_utf8_try(struct charset_translation *t,
 		*result = charset_utf8_to_utf8(t->normalizer, src, src_size, dest);
 		return TRUE;
 	}
+	if (t->ascii_compatible &&
+	    uni_utf8_ascii_prefix_len(src, *src_size) == *src_size) {
+		/* 7bit input is the same in UTF-8 */
+		*result = charset_utf8_to_utf8(t->normalizer, src, src_size, dest);
+		return TRUE;
+	}
 	destleft = sizeof(tmpbuf);
 	ic_destbuf = tmpbuf;
 	srcleft = *src_size;
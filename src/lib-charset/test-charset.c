@@ -70,6 +70,8 @@ static void test_charset_iconv(void)
 		enum charset_result result;
 	} tests[] = {
 		{ "ISO-8859-1", "p\xE4\xE4", "p\xC3\xA4\xC3\xA4", CHARSET_RET_OK },
+		{ "ISO-8859-1", "only 7bit ASCII text", "only 7bit ASCII text", CHARSET_RET_OK },
+		{ "WINDOWS-1252", "ascii \x80", "ascii \xE2\x82\xAC", CHARSET_RET_OK },
 		{ "UTF-7", "+AOQA5AD2AOQA9gDkAPYA5AD2AOQA9gDkAPYA5AD2AOQA9gDkAPYA5AD2AOQA9gDkAPYA5AD2AOQA9gDkAPYA5AD2AOQA9gDk",
 		  "\xC3\xA4\xC3\xA4\xC3\xB6\xC3\xA4\xC3\xB6\xC3\xA4\xC3\xB6\xC3\xA4"
 		  "\xC3\xB6\xC3\xA4\xC3\xB6\xC3\xA4\xC3\xB6\xC3\xA4\xC3\xB6\xC3\xA4"
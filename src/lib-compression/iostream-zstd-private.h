@@ -0,0 +1,27 @@
+#ifndef IOSTREAM_ZSTD_PRIVATE_H
+#define IOSTREAM_ZSTD_PRIVATE_H
+
+#include "iostream-zstd.h"
+
+#include <zstd.h>
+
+#define ZSTD_DICTIONARY_MAX_LEVEL 9
+
+struct zstd_dictionary {
+	int refcount;
+	char *path;
+	unsigned int dict_id;
+
+	void *data;
+	size_t size;
+
+	ZSTD_DDict *ddict;
+	/* The digested compression dictionary depends on the compression
+	   level. Each one is created when it's first needed. */
+	ZSTD_CDict *cdicts[ZSTD_DICTIONARY_MAX_LEVEL+1];
+};
+
+const ZSTD_CDict *
+zstd_dictionary_get_cdict(struct zstd_dictionary *dict, int level);
+
+#endif
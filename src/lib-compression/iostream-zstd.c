@@ -0,0 +1,176 @@
+/* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "istream.h"
+#include "iostream-zstd.h"
+
+#ifdef HAVE_ZSTD
+
+#include "buffer.h"
+#include "iostream-zstd-private.h"
+
+/* Trained dictionaries are normally around 100 kB. Don't waste memory if
+   something else is accidentally configured. */
+#define ZSTD_DICTIONARY_MAX_SIZE (1024*1024*10)
+
+static int
+zstd_dictionary_read(const char *path, buffer_t *buf, const char **error_r)
+{
+	struct istream *input;
+	const unsigned char *data;
+	size_t size;
+	int ret;
+
+	input = i_stream_create_file(path, IO_BLOCK_SIZE);
+	while ((ret = i_stream_read_more(input, &data, &size)) > 0) {
+		if (buf->used + size > ZSTD_DICTIONARY_MAX_SIZE) {
+			*error_r = t_strdup_printf(
+				"Dictionary %s is too large (> %d bytes)",
+				path, ZSTD_DICTIONARY_MAX_SIZE);
+			i_stream_unref(&input);
+			return -1;
+		}
+		buffer_append(buf, data, size);
+		i_stream_skip(input, size);
+	}
+	i_assert(ret == -1);
+	if (input->stream_errno != 0) {
+		*error_r = t_strdup_printf("read(%s) failed: %s", path,
+					   i_stream_get_error(input));
+		i_stream_unref(&input);
+		return -1;
+	}
+	i_stream_unref(&input);
+	return 0;
+}
+
+int zstd_dictionary_load(const char *path, struct zstd_dictionary **dict_r,
+			 const char **error_r)
+{
+	struct zstd_dictionary *dict;
+	buffer_t *buf;
+	unsigned int dict_id;
+
+	buf = buffer_create_dynamic(default_pool, 1024*128);
+	if (zstd_dictionary_read(path, buf, error_r) < 0) {
+		buffer_free(&buf);
+		return -1;
+	}
+	/* The dictionary ID is written to the frames compressed with it, which
+	   allows detecting when a wrong dictionary is used. Raw content
+	   dictionaries don't have it, so require a trained one. */
+	dict_id = ZSTD_getDictID_fromDict(buf->data, buf->used);
+	if (dict_id == 0) {
+		*error_r = t_strdup_printf(
+			"%s isn't a trained zstd dictionary", path);
+		buffer_free(&buf);
+		return -1;
+	}
+
+	dict = i_new(struct zstd_dictionary, 1);
+	dict->refcount = 1;
+	dict->path = i_strdup(path);
+	dict->dict_id = dict_id;
+	dict->size = buf->used;
+	dict->data = buffer_free_without_data(&buf);
+	dict->ddict = ZSTD_createDDict(dict->data, dict->size);
+	if (dict->ddict == NULL)
+		i_fatal_status(FATAL_OUTOFMEM, "zstd: Out of memory");
+	*dict_r = dict;
+	return 0;
+}
+
+void zstd_dictionary_ref(struct zstd_dictionary *dict)
+{
+	i_assert(dict->refcount > 0);
+
+	dict->refcount++;
+}
+
+void zstd_dictionary_unref(struct zstd_dictionary **_dict)
+{
+	struct zstd_dictionary *dict = *_dict;
+	unsigned int i;
+
+	if (dict == NULL)
+		return;
+	*_dict = NULL;
+
+	i_assert(dict->refcount > 0);
+	if (--dict->refcount > 0)
+		return;
+
+	for (i = 0; i < N_ELEMENTS(dict->cdicts); i++)
+		ZSTD_freeCDict(dict->cdicts[i]);
+	ZSTD_freeDDict(dict->ddict);
+	i_free(dict->data);
+	i_free(dict->path);
+	i_free(dict);
+}
+
+const ZSTD_CDict *
+zstd_dictionary_get_cdict(struct zstd_dictionary *dict, int level)
+{
+	i_assert(level >= 1 && level <= ZSTD_DICTIONARY_MAX_LEVEL);
+
+	/* The existing ones can't be freed, because streams may be using
+	   them. Normally only a single level is used anyway. */
+	if (dict->cdicts[level] == NULL) {
+		dict->cdicts[level] =
+			ZSTD_createCDict(dict->data, dict->size, level);
+		if (dict->cdicts[level] == NULL)
+			i_fatal_status(FATAL_OUTOFMEM, "zstd: Out of memory");
+	}
+	return dict->cdicts[level];
+}
+
+#else
+
+int zstd_dictionary_load(const char *path ATTR_UNUSED,
+			 struct zstd_dictionary **dict_r,
+			 const char **error_r)
+{
+	*dict_r = NULL;
+	*error_r = "zstd support not compiled in";
+	return -1;
+}
+
+void zstd_dictionary_ref(struct zstd_dictionary *dict ATTR_UNUSED)
+{
+	i_unreached();
+}
+
+void zstd_dictionary_unref(struct zstd_dictionary **dict)
+{
+	i_assert(*dict == NULL);
+}
+
+struct istream *
+i_stream_create_zstd_dict(struct istream *input ATTR_UNUSED,
+			  struct zstd_dictionary *dict ATTR_UNUSED,
+			  bool log_errors ATTR_UNUSED)
+{
+	i_unreached();
+}
+
+struct ostream *
+o_stream_create_zstd_dict(struct ostream *output ATTR_UNUSED,
+			  int level ATTR_UNUSED,
+			  struct zstd_dictionary *dict ATTR_UNUSED)
+{
+	i_unreached();
+}
+
+struct ostream *
+o_stream_create_zstd_set(struct ostream *output ATTR_UNUSED,
+			 const struct zstd_ostream_settings *set ATTR_UNUSED)
+{
+	i_unreached();
+}
+
+bool i_stream_zstd_is_seekable(struct istream *input ATTR_UNUSED)
+{
+	i_unreached();
+}
+
+#endif
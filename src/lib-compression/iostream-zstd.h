@@ -0,0 +1,78 @@
+#ifndef IOSTREAM_ZSTD_H
+#define IOSTREAM_ZSTD_H
+
+/* zstd frames begin with this magic (0xFD2FB528 in little-endian) */
+#define IOSTREAM_ZSTD_MAGIC "\x28\xb5\x2f\xfd"
+#define IOSTREAM_ZSTD_MAGIC_LEN (sizeof(IOSTREAM_ZSTD_MAGIC)-1)
+
+/*
+   The seekable format is the same as in zstd's contrib/seekable_format:
+
+   n x (independently compressed zstd frame)
+   skippable frame: 4 byte IOSTREAM_ZSTD_SEEK_TABLE_SKIPPABLE_MAGIC,
+      4 byte size of the rest of the frame
+   n x (4 byte compressed frame size, 4 byte uncompressed frame size,
+        4 byte checksum if the descriptor's bit 7 is set)
+   footer: 4 byte number of frames, 1 byte descriptor,
+      4 byte IOSTREAM_ZSTD_SEEKABLE_MAGIC
+
+   All numbers are little-endian. Decompressors that don't know about the
+   seek table skip over it, so these are normal zstd files.
+*/
+#define IOSTREAM_ZSTD_SEEK_TABLE_SKIPPABLE_MAGIC 0x184D2A5E
+#define IOSTREAM_ZSTD_SEEKABLE_MAGIC 0x8F92EAB1
+#define IOSTREAM_ZSTD_SKIPPABLE_HEADER_SIZE 8
+#define IOSTREAM_ZSTD_SEEK_TABLE_ENTRY_SIZE 8
+#define IOSTREAM_ZSTD_SEEK_TABLE_FOOTER_SIZE 9
+#define IOSTREAM_ZSTD_SEEK_TABLE_DESCRIPTOR_CHECKSUM 0x80
+/* Uncompressed size of each frame in the seekable format. Seeking needs to
+   decompress at most this much, but smaller frames compress worse. */
+#define OSTREAM_ZSTD_SEEKABLE_FRAME_SIZE (1024*256)
+
+/* A dictionary trained with "zstd --train" from a set of similar small
+   files (e.g. mails). It improves the compression ratio of small inputs
+   a lot. Data compressed with a dictionary can be decompressed only when
+   the same dictionary is used. */
+struct zstd_dictionary;
+
+/* Load the dictionary from the given file. Returns 0 on success, -1 if the
+   file couldn't be read or it's not a valid dictionary. */
+int zstd_dictionary_load(const char *path, struct zstd_dictionary **dict_r,
+			 const char **error_r);
+void zstd_dictionary_ref(struct zstd_dictionary *dict);
+void zstd_dictionary_unref(struct zstd_dictionary **dict);
+
+/* Same as i_stream_create_zstd() and o_stream_create_zstd(), but use the
+   given dictionary. The streams keep a reference to it. */
+struct istream *
+i_stream_create_zstd_dict(struct istream *input, struct zstd_dictionary *dict,
+			  bool log_errors);
+struct ostream *
+o_stream_create_zstd_dict(struct ostream *output, int level,
+			  struct zstd_dictionary *dict);
+
+struct zstd_ostream_settings {
+	/* 1..9 */
+	int level;
+	/* Dictionary to use, or NULL */
+	struct zstd_dictionary *dict;
+	/* Compress the data in parallel blocks using this many worker threads
+	   created by libzstd. The output is still a normal zstd stream. If
+	   libzstd doesn't support threads, the data is compressed in the
+	   calling thread. Starting the threads has some overhead, so this is
+	   useful only for large inputs. */
+	unsigned int workers;
+	/* Write the seekable format, so the istream can seek without
+	   decompressing everything before the offset. */
+	bool seekable;
+};
+struct ostream *
+o_stream_create_zstd_set(struct ostream *output,
+			 const struct zstd_ostream_settings *set);
+
+/* Returns TRUE if the zstd istream has a seek table, i.e. seeking anywhere
+   in it requires decompressing at most one frame. This reads the end of the
+   parent stream, which must be seekable. */
+bool i_stream_zstd_is_seekable(struct istream *input);
+
+#endif
@@ -0,0 +1,431 @@
+/* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+
+#ifdef HAVE_ZSTD
+
+#include "array.h"
+#include "istream-private.h"
+#include "istream-zlib.h"
+#include "iostream-zstd-private.h"
+
+#include <zstd_errors.h>
+
+struct zstd_seek_frame {
+	/* offsets relative to the beginning of the stream */
+	uoff_t compressed_offset;
+	uoff_t uncompressed_offset;
+};
+
+struct zstd_istream {
+	struct istream_private istream;
+
+	ZSTD_DCtx *dctx;
+	struct zstd_dictionary *dict;
+	struct stat last_parent_statbuf;
+
+	/* Frames listed in the seekable format's seek table, followed by an
+	   entry with the total sizes. Not created if there is no seek table. */
+	ARRAY(struct zstd_seek_frame) seek_table;
+
+	bool log_errors:1;
+	bool marked:1;
+	/* the last frame was fully decompressed (or nothing was read yet) */
+	bool frame_finished:1;
+	bool seek_table_read:1;
+};
+
+static void i_stream_zstd_close(struct iostream_private *stream,
+				bool close_parent)
+{
+	struct zstd_istream *zstream = (struct zstd_istream *)stream;
+
+	if (zstream->dctx != NULL) {
+		ZSTD_freeDCtx(zstream->dctx);
+		zstream->dctx = NULL;
+	}
+	zstd_dictionary_unref(&zstream->dict);
+	if (array_is_created(&zstream->seek_table))
+		array_free(&zstream->seek_table);
+	if (close_parent)
+		i_stream_close(zstream->istream.parent);
+}
+
+static void zstd_read_error(struct zstd_istream *zstream, const char *error)
+{
+	io_stream_set_error(&zstream->istream.iostream,
+			    "zstd.read(%s): %s at %"PRIuUOFF_T,
+			    i_stream_get_name(&zstream->istream.istream), error,
+			    i_stream_get_absolute_offset(&zstream->istream.istream));
+	if (zstream->log_errors)
+		i_error("%s", zstream->istream.iostream.error);
+}
+
+static void zstd_handle_error(struct zstd_istream *zstream, size_t ret)
+{
+	struct istream_private *stream = &zstream->istream;
+
+	switch (ZSTD_getErrorCode(ret)) {
+	case ZSTD_error_prefix_unknown:
+		zstd_read_error(zstream, "wrong magic in header (not zstd file?)");
+		stream->istream.stream_errno = EINVAL;
+		break;
+	case ZSTD_error_dictionary_wrong:
+		zstd_read_error(zstream, zstream->dict == NULL ?
+			"compressed with a dictionary, but none is configured" :
+			t_strdup_printf("compressed with a different dictionary "
+					"than %s", zstream->dict->path));
+		stream->istream.stream_errno = EINVAL;
+		break;
+	case ZSTD_error_memory_allocation:
+		i_fatal_status(FATAL_OUTOFMEM, "zstd.read(%s): Out of memory",
+			       i_stream_get_name(&stream->istream));
+	case ZSTD_error_frameParameter_windowTooLarge:
+		zstd_read_error(zstream, "window size too large");
+		stream->istream.stream_errno = EIO;
+		break;
+	default:
+		zstd_read_error(zstream, t_strdup_printf(
+			"corrupted data: %s", ZSTD_getErrorName(ret)));
+		stream->istream.stream_errno = EINVAL;
+		break;
+	}
+}
+
+static ssize_t i_stream_zstd_read(struct istream_private *stream)
+{
+	struct zstd_istream *zstream = (struct zstd_istream *)stream;
+	const unsigned char *data;
+	ZSTD_inBuffer input;
+	ZSTD_outBuffer output;
+	size_t size, out_size, ret;
+	int read_ret;
+
+	for (;;) {
+		if (!zstream->marked) {
+			if (!i_stream_try_alloc(stream, ZSTD_DStreamOutSize(),
+						&out_size))
+				return -2; /* buffer full */
+		} else {
+			/* try to avoid compressing, so we can quickly seek
+			   backwards */
+			if (!i_stream_try_alloc_avoid_compress(stream,
+					ZSTD_DStreamOutSize(), &out_size))
+				return -2; /* buffer full */
+		}
+
+		read_ret = i_stream_read_more(stream->parent, &data, &size);
+		if (read_ret < 0 && stream->parent->stream_errno != 0) {
+			stream->istream.stream_errno =
+				stream->parent->stream_errno;
+			return -1;
+		}
+		if (read_ret == 0) {
+			/* no more input */
+			i_assert(!stream->istream.blocking);
+			return 0;
+		}
+
+		/* At EOF there may still be decompressed data buffered
+		   internally, so call the decompressor with empty input
+		   until it has nothing more to give. */
+		input.src = data;
+		input.size = size;
+		input.pos = 0;
+		output.dst = stream->w_buffer + stream->pos;
+		output.size = out_size;
+		output.pos = 0;
+		ret = ZSTD_decompressStream(zstream->dctx, &output, &input);
+		i_stream_skip(stream->parent, input.pos);
+		if (ZSTD_isError(ret)) {
+			zstd_handle_error(zstream, ret);
+			return -1;
+		}
+		/* ret is 0 when the frame is finished and fully flushed.
+		   With no progress the return value is only a hint of the
+		   wanted input size for the next frame, so ignore it. */
+		if (input.pos > 0 || output.pos > 0)
+			zstream->frame_finished = ret == 0;
+
+		if (output.pos > 0) {
+			stream->pos += output.pos;
+			return output.pos;
+		}
+		if (read_ret < 0) {
+			i_assert(stream->parent->eof);
+			if (!zstream->frame_finished) {
+				zstd_read_error(zstream, "truncated zstd input");
+				stream->istream.stream_errno = EPIPE;
+				return -1;
+			}
+			stream->cached_stream_size = stream->istream.v_offset +
+				(stream->pos - stream->skip);
+			stream->istream.eof = TRUE;
+			return -1;
+		}
+		/* the input contained only headers - read more */
+	}
+}
+
+static void i_stream_zstd_init(struct zstd_istream *zstream)
+{
+	size_t ret;
+
+	zstream->dctx = ZSTD_createDCtx();
+	if (zstream->dctx == NULL)
+		i_fatal_status(FATAL_OUTOFMEM, "zstd: Out of memory");
+	if (zstream->dict != NULL) {
+		ret = ZSTD_DCtx_refDDict(zstream->dctx, zstream->dict->ddict);
+		if (ZSTD_isError(ret)) {
+			i_fatal("ZSTD_DCtx_refDDict() failed: %s",
+				ZSTD_getErrorName(ret));
+		}
+	}
+	zstream->frame_finished = TRUE;
+}
+
+static void i_stream_zstd_reset(struct zstd_istream *zstream)
+{
+	struct istream_private *stream = &zstream->istream;
+
+	i_stream_seek(stream->parent, stream->parent_start_offset);
+	/* the dictionary stays referenced */
+	(void)ZSTD_DCtx_reset(zstream->dctx, ZSTD_reset_session_only);
+	zstream->frame_finished = TRUE;
+
+	stream->parent_expected_offset = stream->parent_start_offset;
+	stream->skip = stream->pos = 0;
+	stream->istream.v_offset = 0;
+	stream->istream.eof = FALSE;
+}
+
+static bool i_stream_zstd_parse_seek_table(struct zstd_istream *zstream)
+{
+	struct istream_private *stream = &zstream->istream;
+	struct istream *parent = stream->parent;
+	struct zstd_seek_frame *frame;
+	const unsigned char *data;
+	uoff_t end_offset, table_offset, table_size;
+	uoff_t compressed_offset = 0, uncompressed_offset = 0;
+	uint32_t i, count;
+	size_t size, entry_size;
+
+	if (!parent->seekable ||
+	    i_stream_get_size(parent, TRUE, &end_offset) <= 0 ||
+	    end_offset < stream->parent_start_offset +
+			 IOSTREAM_ZSTD_SKIPPABLE_HEADER_SIZE +
+			 IOSTREAM_ZSTD_SEEK_TABLE_FOOTER_SIZE)
+		return FALSE;
+
+	/* footer */
+	i_stream_seek(parent, end_offset - IOSTREAM_ZSTD_SEEK_TABLE_FOOTER_SIZE);
+	if (i_stream_read_bytes(parent, &data, &size,
+				IOSTREAM_ZSTD_SEEK_TABLE_FOOTER_SIZE) <= 0 ||
+	    le32_to_cpu_unaligned(data + 5) != IOSTREAM_ZSTD_SEEKABLE_MAGIC)
+		return FALSE;
+	count = le32_to_cpu_unaligned(data);
+	if ((data[4] & ~IOSTREAM_ZSTD_SEEK_TABLE_DESCRIPTOR_CHECKSUM) != 0) {
+		/* reserved bits are set */
+		return FALSE;
+	}
+	entry_size = IOSTREAM_ZSTD_SEEK_TABLE_ENTRY_SIZE +
+		((data[4] & IOSTREAM_ZSTD_SEEK_TABLE_DESCRIPTOR_CHECKSUM) != 0 ?
+		 sizeof(uint32_t) : 0);
+	table_size = IOSTREAM_ZSTD_SKIPPABLE_HEADER_SIZE +
+		(uoff_t)count * entry_size +
+		IOSTREAM_ZSTD_SEEK_TABLE_FOOTER_SIZE;
+	if (end_offset - stream->parent_start_offset < table_size)
+		return FALSE;
+	table_offset = end_offset - table_size;
+
+	/* skippable frame header */
+	i_stream_seek(parent, table_offset);
+	if (i_stream_read_bytes(parent, &data, &size,
+				IOSTREAM_ZSTD_SKIPPABLE_HEADER_SIZE) <= 0 ||
+	    le32_to_cpu_unaligned(data) !=
+		IOSTREAM_ZSTD_SEEK_TABLE_SKIPPABLE_MAGIC ||
+	    le32_to_cpu_unaligned(data + 4) !=
+		table_size - IOSTREAM_ZSTD_SKIPPABLE_HEADER_SIZE)
+		return FALSE;
+	i_stream_skip(parent, IOSTREAM_ZSTD_SKIPPABLE_HEADER_SIZE);
+
+	i_array_init(&zstream->seek_table, count + 1);
+	for (i = 0; i < count; i++) {
+		if (i_stream_read_bytes(parent, &data, &size, entry_size) <= 0)
+			break;
+		frame = array_append_space(&zstream->seek_table);
+		frame->compressed_offset = compressed_offset;
+		frame->uncompressed_offset = uncompressed_offset;
+		compressed_offset += le32_to_cpu_unaligned(data);
+		uncompressed_offset += le32_to_cpu_unaligned(data + 4);
+		i_stream_skip(parent, entry_size);
+	}
+	if (i < count ||
+	    stream->parent_start_offset + compressed_offset != table_offset) {
+		/* the table doesn't match the file */
+		array_free(&zstream->seek_table);
+		return FALSE;
+	}
+	frame = array_append_space(&zstream->seek_table);
+	frame->compressed_offset = compressed_offset;
+	frame->uncompressed_offset = uncompressed_offset;
+	stream->cached_stream_size = uncompressed_offset;
+	return TRUE;
+}
+
+static void i_stream_zstd_read_seek_table(struct zstd_istream *zstream)
+{
+	struct istream_private *stream = &zstream->istream;
+
+	if (zstream->seek_table_read)
+		return;
+	zstream->seek_table_read = TRUE;
+
+	(void)i_stream_zstd_parse_seek_table(zstream);
+	/* i_stream_seek() expects the parent to be where we left it */
+	i_stream_seek(stream->parent, stream->parent_expected_offset);
+}
+
+static bool
+i_stream_zstd_seek_frame(struct zstd_istream *zstream, uoff_t v_offset)
+{
+	struct istream_private *stream = &zstream->istream;
+	const struct zstd_seek_frame *frames;
+	unsigned int count, idx, left, right;
+	uoff_t start_offset, high_offset;
+
+	start_offset = stream->istream.v_offset - stream->skip;
+	high_offset = start_offset + stream->pos;
+	if (v_offset >= start_offset && v_offset <= high_offset) {
+		/* seeking within the buffer */
+		return FALSE;
+	}
+
+	i_stream_zstd_read_seek_table(zstream);
+	if (!array_is_created(&zstream->seek_table))
+		return FALSE;
+	frames = array_get(&zstream->seek_table, &count);
+	if (count < 2)
+		return FALSE;
+
+	/* find the last frame beginning at or before v_offset. the last
+	   entry only marks the end of the stream. */
+	left = 0; right = count - 1;
+	while (left + 1 < right) {
+		idx = (left + right) / 2;
+		if (frames[idx].uncompressed_offset <= v_offset)
+			left = idx;
+		else
+			right = idx;
+	}
+	idx = left;
+	if (v_offset >= start_offset &&
+	    frames[idx].uncompressed_offset <= high_offset) {
+		/* already decompressing the wanted frame - read forward */
+		return FALSE;
+	}
+
+	i_stream_seek(stream->parent, stream->parent_start_offset +
+		      frames[idx].compressed_offset);
+	stream->parent_expected_offset = stream->parent->v_offset;
+	(void)ZSTD_DCtx_reset(zstream->dctx, ZSTD_reset_session_only);
+	zstream->frame_finished = TRUE;
+
+	stream->skip = stream->pos = 0;
+	stream->high_pos = 0;
+	stream->istream.v_offset = frames[idx].uncompressed_offset;
+	stream->istream.eof = FALSE;
+	return TRUE;
+}
+
+static void
+i_stream_zstd_seek(struct istream_private *stream, uoff_t v_offset, bool mark)
+{
+	struct zstd_istream *zstream = (struct zstd_istream *) stream;
+
+	if (i_stream_zstd_seek_frame(zstream, v_offset)) {
+		/* moved to the beginning of the frame containing v_offset */
+		if (!i_stream_nonseekable_try_seek(stream, v_offset))
+			i_unreached();
+		if (mark)
+			zstream->marked = TRUE;
+		return;
+	}
+	if (i_stream_nonseekable_try_seek(stream, v_offset))
+		return;
+
+	/* have to seek backwards - reset state and retry */
+	i_stream_zstd_reset(zstream);
+	if (!i_stream_nonseekable_try_seek(stream, v_offset))
+		i_unreached();
+
+	if (mark)
+		zstream->marked = TRUE;
+}
+
+static void i_stream_zstd_sync(struct istream_private *stream)
+{
+	struct zstd_istream *zstream = (struct zstd_istream *) stream;
+	const struct stat *st;
+
+	if (i_stream_stat(stream->parent, FALSE, &st) < 0) {
+		if (memcmp(&zstream->last_parent_statbuf,
+			   st, sizeof(*st)) == 0) {
+			/* a compressed file doesn't change unexpectedly,
+			   don't clear our caches unnecessarily */
+			return;
+		}
+		zstream->last_parent_statbuf = *st;
+	}
+	i_stream_zstd_reset(zstream);
+	if (array_is_created(&zstream->seek_table))
+		array_free(&zstream->seek_table);
+	zstream->seek_table_read = FALSE;
+	stream->cached_stream_size = (uoff_t)-1;
+}
+
+struct istream *
+i_stream_create_zstd_dict(struct istream *input, struct zstd_dictionary *dict,
+			  bool log_errors)
+{
+	struct zstd_istream *zstream;
+
+	zstream = i_new(struct zstd_istream, 1);
+	zstream->log_errors = log_errors;
+	if (dict != NULL) {
+		zstd_dictionary_ref(dict);
+		zstream->dict = dict;
+	}
+
+	i_stream_zstd_init(zstream);
+
+	zstream->istream.iostream.close = i_stream_zstd_close;
+	zstream->istream.max_buffer_size = input->real_stream->max_buffer_size;
+	zstream->istream.read = i_stream_zstd_read;
+	zstream->istream.seek = i_stream_zstd_seek;
+	zstream->istream.sync = i_stream_zstd_sync;
+
+	zstream->istream.istream.readable_fd = FALSE;
+	zstream->istream.istream.blocking = input->blocking;
+	zstream->istream.istream.seekable = input->seekable;
+
+	return i_stream_create(&zstream->istream, input,
+			       i_stream_get_fd(input), 0);
+}
+
+bool i_stream_zstd_is_seekable(struct istream *input)
+{
+	struct zstd_istream *zstream =
+		(struct zstd_istream *)input->real_stream;
+
+	i_assert(zstream->istream.read == i_stream_zstd_read);
+
+	i_stream_zstd_read_seek_table(zstream);
+	return array_is_created(&zstream->seek_table);
+}
+
+struct istream *i_stream_create_zstd(struct istream *input, bool log_errors)
+{
+	return i_stream_create_zstd_dict(input, NULL, log_errors);
+}
+#endif
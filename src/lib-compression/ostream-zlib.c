@@ -22,6 +22,10 @@ struct zlib_ostream {
 
 	uint32_t crc, bytes32;
 
+	/* current level and the range where it's adapted, or 0 if not */
+	int level, min_level, max_level;
+	uLong adapt_total_in;
+
 	bool gz:1;
 	bool header_sent:1;
 	bool flushed:1;
@@ -165,6 +169,33 @@ o_stream_zlib_send_chunk(struct zlib_ostream *zstream,
 	return size;
 }
 
+static void o_stream_zlib_adapt_level(struct zlib_ostream *zstream)
+{
+	int level = zstream->level;
+	size_t used;
+
+	if (zstream->zs.total_in == zstream->adapt_total_in)
+		return;
+	zstream->adapt_total_in = zstream->zs.total_in;
+
+	/* Compressed data is left in the parent stream's buffer only when
+	   the peer reads it slower than it's compressed. Spend more CPU to
+	   send less data then, and less CPU when the data goes out
+	   immediately. */
+	used = o_stream_get_buffer_used_size(zstream->ostream.parent);
+	if (used > CHUNK_SIZE && level < zstream->max_level)
+		level++;
+	else if (used == 0 && level > zstream->min_level)
+		level--;
+	if (level == zstream->level)
+		return;
+
+	/* everything was just flushed, so nothing needs to be compressed
+	   with the old parameters anymore. */
+	if (deflateParams(&zstream->zs, level, Z_DEFAULT_STRATEGY) == Z_OK)
+		zstream->level = level;
+}
+
 static int
 o_stream_zlib_send_flush(struct zlib_ostream *zstream, bool final)
 {
@@ -223,6 +254,8 @@ o_stream_zlib_send_flush(struct zlib_ostream *zstream, bool final)
 	}
 	if (final)
 		zstream->flushed = TRUE;
+	else if (zstream->max_level != 0)
+		o_stream_zlib_adapt_level(zstream);
 	return 0;
 }
 
@@ -326,6 +359,7 @@ o_stream_create_zlib(struct ostream *output, int level, bool gz)
 		o_stream_zlib_get_buffer_avail_size;
 	zstream->ostream.iostream.close = o_stream_zlib_close;
 	zstream->crc = 0;
+	zstream->level = level;
 	zstream->gz = gz;
 	if (!gz)
 		zstream->header_sent = TRUE;
@@ -360,4 +394,28 @@ struct ostream *o_stream_create_deflate(struct ostream *output, int level)
 {
 	return o_stream_create_zlib(output, level, FALSE);
 }
+
+void o_stream_deflate_set_adaptive_level(struct ostream *output,
+					 int min_level, int max_level)
+{
+	struct zlib_ostream *zstream =
+		(struct zlib_ostream *)output->real_stream;
+
+	i_assert(zstream->ostream.sendv == o_stream_zlib_sendv);
+	i_assert(!zstream->gz);
+	i_assert(min_level >= 1 && min_level <= zstream->level);
+	i_assert(max_level >= zstream->level && max_level <= 9);
+
+	zstream->min_level = min_level;
+	zstream->max_level = max_level;
+}
+#else
+#include "ostream-zlib.h"
+
+void o_stream_deflate_set_adaptive_level(struct ostream *output ATTR_UNUSED,
+					 int min_level ATTR_UNUSED,
+					 int max_level ATTR_UNUSED)
+{
+	i_unreached();
+}
 #endif
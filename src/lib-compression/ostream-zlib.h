@@ -6,5 +6,13 @@ struct ostream *o_stream_create_deflate(struct ostream *output, int level);
 struct ostream *o_stream_create_bz2(struct ostream *output, int level);
 struct ostream *o_stream_create_lzma(struct ostream *output, int level);
 struct ostream *o_stream_create_lz4(struct ostream *output, int level);
+struct ostream *o_stream_create_zstd(struct ostream *output, int level);
+
+/* Adapt the compression level of a deflate ostream between min_level and
+   max_level after each flush: raise it when the compressed data is
+   buffered in the parent stream, lower it when it isn't. The output must
+   have been created with o_stream_create_deflate(). */
+void o_stream_deflate_set_adaptive_level(struct ostream *output,
+					 int min_level, int max_level);
 
 #endif
@@ -0,0 +1,435 @@
+/* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+
+#ifdef HAVE_ZSTD
+
+#include "buffer.h"
+#include "ostream-private.h"
+#include "ostream-zlib.h"
+#include "iostream-zstd-private.h"
+
+#include <zstd_errors.h>
+
+#define CHUNK_SIZE (1024*64)
+
+struct zstd_ostream {
+	struct ostream_private ostream;
+
+	ZSTD_CCtx *cctx;
+	struct zstd_dictionary *dict;
+
+	unsigned char outbuf[CHUNK_SIZE];
+	unsigned int outbuf_offset, outbuf_used;
+	ZSTD_outBuffer output;
+	/* number of compressed bytes moved to outbuf so far */
+	uoff_t compressed_offset;
+
+	/* Seekable format: uncompressed bytes written to the current frame
+	   and the compressed offset where it began. */
+	unsigned int frame_size;
+	uoff_t frame_start_offset;
+	/* seek table entries, and the whole seek table frame once the stream
+	   is finished */
+	buffer_t *seek_table;
+	size_t seek_table_sent;
+
+	bool seekable:1;
+	bool seek_table_finished:1;
+	bool flushed:1;
+};
+
+static void o_stream_zstd_close(struct iostream_private *stream,
+				bool close_parent)
+{
+	struct zstd_ostream *zstream = (struct zstd_ostream *)stream;
+
+	i_assert(zstream->ostream.finished ||
+		 zstream->ostream.ostream.stream_errno != 0 ||
+		 zstream->ostream.error_handling_disabled);
+	if (zstream->cctx != NULL) {
+		ZSTD_freeCCtx(zstream->cctx);
+		zstream->cctx = NULL;
+	}
+	buffer_free(&zstream->seek_table);
+	zstd_dictionary_unref(&zstream->dict);
+	if (close_parent)
+		o_stream_close(zstream->ostream.parent);
+}
+
+static void zstd_check_error(struct zstd_ostream *zstream, size_t ret)
+{
+	if (!ZSTD_isError(ret))
+		return;
+
+	if (ZSTD_getErrorCode(ret) == ZSTD_error_memory_allocation) {
+		i_fatal_status(FATAL_OUTOFMEM, "zstd.write(%s): Out of memory",
+			       o_stream_get_name(&zstream->ostream.ostream));
+	}
+	i_panic("zstd.write(%s) failed: %s",
+		o_stream_get_name(&zstream->ostream.ostream),
+		ZSTD_getErrorName(ret));
+}
+
+static int o_stream_zstd_send_outbuf(struct zstd_ostream *zstream)
+{
+	ssize_t ret;
+	size_t size;
+
+	if (zstream->outbuf_used == 0)
+		return 1;
+
+	size = zstream->outbuf_used - zstream->outbuf_offset;
+	i_assert(size > 0);
+	ret = o_stream_send(zstream->ostream.parent,
+			    zstream->outbuf + zstream->outbuf_offset, size);
+	if (ret < 0) {
+		o_stream_copy_error_from_parent(&zstream->ostream);
+		return -1;
+	}
+	if ((size_t)ret != size) {
+		zstream->outbuf_offset += ret;
+		return 0;
+	}
+	zstream->outbuf_offset = 0;
+	zstream->outbuf_used = 0;
+	return 1;
+}
+
+/* Send the data compressed to zstream->output so far. */
+static int o_stream_zstd_send_output(struct zstd_ostream *zstream)
+{
+	i_assert(zstream->outbuf_used == 0);
+
+	zstream->outbuf_used = zstream->output.pos;
+	zstream->compressed_offset += zstream->output.pos;
+	zstream->output.pos = 0;
+	return o_stream_zstd_send_outbuf(zstream);
+}
+
+static void
+o_stream_zstd_seek_table_add(struct zstd_ostream *zstream,
+			     uoff_t compressed_size, unsigned int size)
+{
+	uint32_t entry[2];
+
+	/* the frame's uncompressed size is limited by
+	   OSTREAM_ZSTD_SEEKABLE_FRAME_SIZE */
+	i_assert(compressed_size < (uint32_t)-1);
+
+	entry[0] = cpu32_to_le(compressed_size);
+	entry[1] = cpu32_to_le(size);
+	buffer_append(zstream->seek_table, entry, sizeof(entry));
+}
+
+/* Returns 1 if the frame was ended, 0 if the parent stream's buffer is
+   full, -1 on error. */
+static int o_stream_zstd_end_frame(struct zstd_ostream *zstream)
+{
+	ZSTD_inBuffer input = { NULL, 0, 0 };
+	size_t ret;
+	int ret2;
+
+	/* finish sending the earlier output before overwriting outbuf */
+	if ((ret2 = o_stream_zstd_send_outbuf(zstream)) <= 0)
+		return ret2;
+
+	for (;;) {
+		ret = ZSTD_compressStream2(zstream->cctx, &zstream->output,
+					   &input, ZSTD_e_end);
+		zstd_check_error(zstream, ret);
+		if (ret == 0)
+			break;
+		if ((ret2 = o_stream_zstd_send_output(zstream)) <= 0)
+			return ret2;
+	}
+
+	if (zstream->seekable) {
+		uoff_t frame_end_offset =
+			zstream->compressed_offset + zstream->output.pos;
+
+		o_stream_zstd_seek_table_add(zstream,
+			frame_end_offset - zstream->frame_start_offset,
+			zstream->frame_size);
+		zstream->frame_start_offset = frame_end_offset;
+		zstream->frame_size = 0;
+	}
+	return 1;
+}
+
+static ssize_t
+o_stream_zstd_send_chunk(struct zstd_ostream *zstream,
+			 const void *data, size_t size)
+{
+	ZSTD_inBuffer input = { data, size, 0 }, frame_input;
+	size_t ret;
+	int ret2;
+
+	i_assert(zstream->outbuf_used == 0);
+
+	while (input.pos < input.size) {
+		if (zstream->seekable &&
+		    zstream->frame_size == OSTREAM_ZSTD_SEEKABLE_FRAME_SIZE) {
+			/* each frame can be decompressed independently */
+			if ((ret2 = o_stream_zstd_end_frame(zstream)) < 0)
+				return -1;
+			if (ret2 == 0)
+				break;
+		}
+		if (zstream->output.pos == zstream->output.size) {
+			/* previous block was compressed. send it and start
+			   compression for a new block. */
+			if ((ret2 = o_stream_zstd_send_output(zstream)) < 0)
+				return -1;
+			if (ret2 == 0) {
+				/* parent stream's buffer full */
+				break;
+			}
+		}
+
+		/* don't give more input than fits to the seekable frame */
+		frame_input = input;
+		if (zstream->seekable) {
+			frame_input.size = I_MIN(input.size, input.pos +
+				(OSTREAM_ZSTD_SEEKABLE_FRAME_SIZE -
+				 zstream->frame_size));
+		}
+		ret = ZSTD_compressStream2(zstream->cctx, &zstream->output,
+					   &frame_input, ZSTD_e_continue);
+		zstd_check_error(zstream, ret);
+		zstream->frame_size += frame_input.pos - input.pos;
+		input.pos = frame_input.pos;
+	}
+
+	zstream->flushed = FALSE;
+	return input.pos;
+}
+
+static void o_stream_zstd_seek_table_finish(struct zstd_ostream *zstream)
+{
+	buffer_t *entries = zstream->seek_table;
+	uint32_t num;
+	unsigned char descriptor = 0;
+
+	zstream->seek_table = buffer_create_dynamic(default_pool,
+		IOSTREAM_ZSTD_SKIPPABLE_HEADER_SIZE + entries->used +
+		IOSTREAM_ZSTD_SEEK_TABLE_FOOTER_SIZE);
+	num = cpu32_to_le(IOSTREAM_ZSTD_SEEK_TABLE_SKIPPABLE_MAGIC);
+	buffer_append(zstream->seek_table, &num, sizeof(num));
+	num = cpu32_to_le(entries->used + IOSTREAM_ZSTD_SEEK_TABLE_FOOTER_SIZE);
+	buffer_append(zstream->seek_table, &num, sizeof(num));
+	buffer_append_buf(zstream->seek_table, entries, 0, (size_t)-1);
+
+	/* footer: number of frames, descriptor (no checksums), magic */
+	num = cpu32_to_le(entries->used / IOSTREAM_ZSTD_SEEK_TABLE_ENTRY_SIZE);
+	buffer_append(zstream->seek_table, &num, sizeof(num));
+	buffer_append(zstream->seek_table, &descriptor, sizeof(descriptor));
+	num = cpu32_to_le(IOSTREAM_ZSTD_SEEKABLE_MAGIC);
+	buffer_append(zstream->seek_table, &num, sizeof(num));
+	buffer_free(&entries);
+	zstream->seek_table_finished = TRUE;
+}
+
+static int o_stream_zstd_send_seek_table(struct zstd_ostream *zstream)
+{
+	ssize_t ret;
+	size_t size;
+
+	if (!zstream->seek_table_finished) {
+		if ((ret = o_stream_zstd_end_frame(zstream)) <= 0)
+			return ret;
+		o_stream_zstd_seek_table_finish(zstream);
+		if ((ret = o_stream_zstd_send_output(zstream)) <= 0)
+			return ret;
+	}
+	if ((ret = o_stream_zstd_send_outbuf(zstream)) <= 0)
+		return ret;
+
+	size = zstream->seek_table->used - zstream->seek_table_sent;
+	if (size == 0)
+		return 1;
+	ret = o_stream_send(zstream->ostream.parent,
+			    CONST_PTR_OFFSET(zstream->seek_table->data,
+					     zstream->seek_table_sent), size);
+	if (ret < 0) {
+		o_stream_copy_error_from_parent(&zstream->ostream);
+		return -1;
+	}
+	zstream->seek_table_sent += ret;
+	return (size_t)ret == size ? 1 : 0;
+}
+
+static int
+o_stream_zstd_send_flush(struct zstd_ostream *zstream, bool final)
+{
+	ZSTD_inBuffer input = { NULL, 0, 0 };
+	size_t ret;
+	int ret2;
+
+	if (zstream->flushed)
+		return 0;
+
+	if ((ret2 = o_stream_flush_parent_if_needed(&zstream->ostream)) <= 0)
+		return ret2;
+	if ((ret2 = o_stream_zstd_send_outbuf(zstream)) <= 0)
+		return ret2;
+
+	if (final && zstream->seekable) {
+		if ((ret2 = o_stream_zstd_send_seek_table(zstream)) <= 0)
+			return ret2;
+		zstream->flushed = TRUE;
+		return 0;
+	}
+
+	/* ZSTD_e_end ends the frame. If more data is written after it, it's
+	   written to a new frame, which the istream handles transparently. */
+	i_assert(zstream->outbuf_used == 0);
+	do {
+		ret = ZSTD_compressStream2(zstream->cctx, &zstream->output,
+					   &input, final ? ZSTD_e_end :
+					   ZSTD_e_flush);
+		zstd_check_error(zstream, ret);
+
+		if (zstream->output.pos > 0) {
+			if ((ret2 = o_stream_zstd_send_output(zstream)) <= 0)
+				return ret2;
+		}
+	} while (ret > 0);
+
+	if (final)
+		zstream->flushed = TRUE;
+	return 0;
+}
+
+static int o_stream_zstd_flush(struct ostream_private *stream)
+{
+	struct zstd_ostream *zstream = (struct zstd_ostream *)stream;
+
+	if (o_stream_zstd_send_flush(zstream, stream->finished) < 0)
+		return -1;
+
+	return o_stream_flush_parent(stream);
+}
+
+static size_t
+o_stream_zstd_get_buffer_used_size(const struct ostream_private *stream)
+{
+	const struct zstd_ostream *zstream =
+		(const struct zstd_ostream *)stream;
+
+	/* outbuf has already compressed data that we're trying to send to the
+	   parent stream, or that is waiting for the block to fill up. We're
+	   not including zstd's internal compression buffer size. */
+	return (zstream->outbuf_used - zstream->outbuf_offset) +
+		zstream->output.pos +
+		o_stream_get_buffer_used_size(stream->parent);
+}
+
+static size_t
+o_stream_zstd_get_buffer_avail_size(const struct ostream_private *stream)
+{
+	/* FIXME: not correct - this is counting compressed size, which may be
+	   too larger than uncompressed size in some situations. Fixing would
+	   require some kind of additional buffering. */
+	return o_stream_get_buffer_avail_size(stream->parent);
+}
+
+static ssize_t
+o_stream_zstd_sendv(struct ostream_private *stream,
+		    const struct const_iovec *iov, unsigned int iov_count)
+{
+	struct zstd_ostream *zstream = (struct zstd_ostream *)stream;
+	ssize_t ret, bytes = 0;
+	unsigned int i;
+
+	if ((ret = o_stream_zstd_send_outbuf(zstream)) <= 0) {
+		/* error / we still couldn't flush existing data to
+		   parent stream. */
+		return ret;
+	}
+
+	for (i = 0; i < iov_count; i++) {
+		ret = o_stream_zstd_send_chunk(zstream, iov[i].iov_base,
+					       iov[i].iov_len);
+		if (ret < 0)
+			return -1;
+		bytes += ret;
+		if ((size_t)ret != iov[i].iov_len)
+			break;
+	}
+	stream->ostream.offset += bytes;
+	return bytes;
+}
+
+struct ostream *
+o_stream_create_zstd_set(struct ostream *output,
+			 const struct zstd_ostream_settings *set)
+{
+	struct zstd_ostream *zstream;
+	size_t ret;
+
+	i_assert(set->level >= 1 && set->level <= 9);
+
+	zstream = i_new(struct zstd_ostream, 1);
+	zstream->ostream.sendv = o_stream_zstd_sendv;
+	zstream->ostream.flush = o_stream_zstd_flush;
+	zstream->ostream.get_buffer_used_size =
+		o_stream_zstd_get_buffer_used_size;
+	zstream->ostream.get_buffer_avail_size =
+		o_stream_zstd_get_buffer_avail_size;
+	zstream->ostream.iostream.close = o_stream_zstd_close;
+
+	zstream->cctx = ZSTD_createCCtx();
+	if (zstream->cctx == NULL)
+		i_fatal_status(FATAL_OUTOFMEM, "zstd: Out of memory");
+	if (set->dict == NULL) {
+		/* zstd's levels go higher than 9, but they're much slower
+		   and the gain is small. */
+		ret = ZSTD_CCtx_setParameter(zstream->cctx,
+					     ZSTD_c_compressionLevel,
+					     set->level);
+	} else {
+		/* the level is taken from the digested dictionary */
+		zstd_dictionary_ref(set->dict);
+		zstream->dict = set->dict;
+		ret = ZSTD_CCtx_refCDict(zstream->cctx,
+			zstd_dictionary_get_cdict(set->dict, set->level));
+	}
+	if (ZSTD_isError(ret))
+		i_fatal("zstd: Failed to set level %d: %s", set->level,
+			ZSTD_getErrorName(ret));
+	/* verify the data when decompressing, like gz and xz do */
+	(void)ZSTD_CCtx_setParameter(zstream->cctx, ZSTD_c_checksumFlag, 1);
+	/* This fails if libzstd was built without multithreading support.
+	   The output is the same, so then just compress in this thread. */
+	if (set->workers > 0) {
+		(void)ZSTD_CCtx_setParameter(zstream->cctx, ZSTD_c_nbWorkers,
+					     set->workers);
+	}
+	if (set->seekable) {
+		zstream->seekable = TRUE;
+		zstream->seek_table = buffer_create_dynamic(default_pool, 64);
+	}
+
+	zstream->output.dst = zstream->outbuf;
+	zstream->output.size = sizeof(zstream->outbuf);
+	return o_stream_create(&zstream->ostream, output,
+			       o_stream_get_fd(output));
+}
+
+struct ostream *
+o_stream_create_zstd_dict(struct ostream *output, int level,
+			  struct zstd_dictionary *dict)
+{
+	struct zstd_ostream_settings set = {
+		.level = level,
+		.dict = dict,
+	};
+	return o_stream_create_zstd_set(output, &set);
+}
+
+struct ostream *o_stream_create_zstd(struct ostream *output, int level)
+{
+	return o_stream_create_zstd_dict(output, level, NULL);
+}
+#endif
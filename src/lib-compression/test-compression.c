@@ -2,15 +2,23 @@
 
 #include "lib.h"
 #include "buffer.h"
+#include "str.h"
 #include "istream.h"
 #include "ostream.h"
 #include "sha1.h"
 #include "randgen.h"
+#include "write-full.h"
 #include "test-common.h"
 #include "compression.h"
+#include "istream-zlib.h"
+#include "ostream-zlib.h"
+#include "iostream-zstd.h"
 
 #include <unistd.h>
 #include <fcntl.h>
+#ifdef HAVE_ZSTD
+#  include <zdict.h>
+#endif
 
 static void test_compression_handler(const struct compression_handler *handler)
 {
@@ -115,6 +123,49 @@ static void test_compression(void)
 	}
 }
 
+static void test_deflate_adaptive_level(void)
+{
+	const struct compression_handler *deflate =
+		compression_lookup_handler("deflate");
+	struct ostream *buf_output, *output;
+	struct istream *buf_input, *input;
+	buffer_t *buf = t_buffer_create(1024);
+	string_t *str = t_str_new(1024);
+	const unsigned char *data;
+	const char *line;
+	size_t size;
+	unsigned int i;
+
+	if (deflate == NULL || deflate->create_ostream == NULL)
+		return; /* not compiled in */
+
+	test_begin("deflate adaptive level");
+	buf_output = o_stream_create_buffer(buf);
+	output = deflate->create_ostream(buf_output, 9);
+	o_stream_deflate_set_adaptive_level(output, 1, 9);
+	/* the level is lowered after each flush */
+	for (i = 0; i < 20; i++) {
+		line = t_strdup_printf("line %u: %u\n", i, i_rand());
+		str_append(str, line);
+		o_stream_nsend_str(output, line);
+		test_assert(o_stream_flush(output) > 0);
+	}
+	test_assert(o_stream_finish(output) > 0);
+	o_stream_destroy(&output);
+	o_stream_destroy(&buf_output);
+
+	buf_input = i_stream_create_from_data(buf->data, buf->used);
+	input = deflate->create_istream(buf_input, TRUE);
+	while (i_stream_read(input) > 0) ;
+	test_assert(input->stream_errno == 0);
+	data = i_stream_get_data(input, &size);
+	test_assert(size == str_len(str) &&
+		    memcmp(data, str_data(str), size) == 0);
+	i_stream_unref(&input);
+	i_stream_unref(&buf_input);
+	test_end();
+}
+
 static void test_gz(const char *str1, const char *str2)
 {
 	const struct compression_handler *gz = compression_lookup_handler("gz");
@@ -222,6 +273,247 @@ static void test_gz_large_header(void)
 	test_end();
 }
 
+#ifdef HAVE_ZSTD
+static const char *test_zstd_sample(unsigned int i)
+{
+	return t_strdup_printf(
+		"Return-Path: <user%u@example.com>\r\n"
+		"Delivered-To: dest%u@example.org\r\n"
+		"Message-ID: <%u.%u@example.com>\r\n"
+		"Subject: Test message %u\r\n"
+		"Content-Type: text/plain; charset=utf-8\r\n\r\n"
+		"Hello %u, this is message number %u.\r\n",
+		i % 17, i % 5, i, i * 7, i, i % 13, i);
+}
+
+static buffer_t *
+test_zstd_compress(const char *data, struct zstd_dictionary *dict)
+{
+	buffer_t *buf = t_buffer_create(256);
+	struct ostream *buf_output, *output;
+
+	buf_output = o_stream_create_buffer(buf);
+	output = o_stream_create_zstd_dict(buf_output, 3, dict);
+	o_stream_nsend_str(output, data);
+	test_assert(o_stream_finish(output) > 0);
+	o_stream_destroy(&output);
+	o_stream_destroy(&buf_output);
+	return buf;
+}
+
+static void test_zstd_dictionary(void)
+{
+	const char *path = "test-compression.dict";
+	struct zstd_dictionary *dict;
+	struct istream *buf_input, *input;
+	buffer_t *samples, *dict_buf, *buf, *plain_buf;
+	size_t sample_sizes[1000], size;
+	const unsigned char *data;
+	const char *sample, *error;
+	unsigned int i;
+	int fd;
+
+	test_begin("zstd dictionary");
+
+	/* train a dictionary */
+	samples = t_buffer_create(1024*128);
+	for (i = 0; i < N_ELEMENTS(sample_sizes); i++) {
+		sample = test_zstd_sample(i);
+		sample_sizes[i] = strlen(sample);
+		buffer_append(samples, sample, sample_sizes[i]);
+	}
+	dict_buf = t_buffer_create(4096);
+	size = ZDICT_trainFromBuffer(buffer_get_space_unsafe(dict_buf, 0, 4096),
+				     4096, samples->data, sample_sizes,
+				     N_ELEMENTS(sample_sizes));
+	test_assert(!ZDICT_isError(size));
+	buffer_set_used_size(dict_buf, ZDICT_isError(size) ? 0 : size);
+
+	fd = open(path, O_TRUNC | O_CREAT | O_WRONLY, 0600);
+	if (fd == -1)
+		i_fatal("creat(%s) failed: %m", path);
+	if (write_full(fd, dict_buf->data, dict_buf->used) < 0)
+		i_fatal("write(%s) failed: %m", path);
+	i_close_fd(&fd);
+
+	test_assert(zstd_dictionary_load(path, &dict, &error) == 0);
+	i_unlink(path);
+
+	/* the dictionary gives a better compression ratio */
+	sample = test_zstd_sample(N_ELEMENTS(sample_sizes) + 1);
+	buf = test_zstd_compress(sample, dict);
+	plain_buf = test_zstd_compress(sample, NULL);
+	test_assert(buf->used < plain_buf->used);
+
+	buf_input = test_istream_create_data(buf->data, buf->used);
+	input = i_stream_create_zstd_dict(buf_input, dict, FALSE);
+	test_assert(i_stream_read_bytes(input, &data, &size,
+					strlen(sample)) > 0);
+	test_assert(size == strlen(sample) &&
+		    memcmp(data, sample, size) == 0);
+	i_stream_skip(input, size);
+	test_assert(i_stream_read(input) == -1 && input->stream_errno == 0);
+	i_stream_unref(&input);
+
+	/* can't decompress without the dictionary */
+	i_stream_seek(buf_input, 0);
+	input = i_stream_create_zstd_dict(buf_input, NULL, FALSE);
+	test_assert(i_stream_read(input) == -1 &&
+		    input->stream_errno == EINVAL);
+	i_stream_unref(&input);
+	i_stream_unref(&buf_input);
+
+	/* the streams keep the dictionary referenced */
+	buf_input = test_istream_create_data(buf->data, buf->used);
+	input = i_stream_create_zstd_dict(buf_input, dict, FALSE);
+	zstd_dictionary_unref(&dict);
+	test_assert(i_stream_read(input) > 0);
+	i_stream_unref(&input);
+	i_stream_unref(&buf_input);
+
+	test_assert(zstd_dictionary_load(path, &dict, &error) < 0);
+	test_end();
+}
+
+static void test_zstd_mt(void)
+{
+	struct ostream *buf_output, *output;
+	struct istream *buf_input, *input;
+	buffer_t *buf = t_buffer_create(1024*64);
+	unsigned char data[1024];
+	const unsigned char *rdata;
+	struct sha1_ctxt sha1;
+	unsigned char output_sha1[SHA1_RESULTLEN], input_sha1[SHA1_RESULTLEN];
+	struct zstd_ostream_settings set = {
+		.level = 3,
+		.workers = 2,
+	};
+	unsigned int i, j;
+	size_t size;
+
+	test_begin("zstd multithreaded");
+	buf_output = o_stream_create_buffer(buf);
+	output = o_stream_create_zstd_set(buf_output, &set);
+	sha1_init(&sha1);
+	for (i = 0; i < 1024*2; i++) {
+		for (j = 0; j < sizeof(data); j++)
+			data[j] = i_rand_limit(3) == 0 ? i_rand_limit(4) : j;
+		sha1_loop(&sha1, data, sizeof(data));
+		o_stream_nsend(output, data, sizeof(data));
+	}
+	test_assert(o_stream_finish(output) > 0);
+	o_stream_destroy(&output);
+	o_stream_destroy(&buf_output);
+	sha1_result(&sha1, output_sha1);
+
+	/* the result is readable with the normal istream */
+	buf_input = test_istream_create_data(buf->data, buf->used);
+	input = i_stream_create_zstd(buf_input, FALSE);
+	sha1_init(&sha1);
+	while (i_stream_read_more(input, &rdata, &size) > 0) {
+		sha1_loop(&sha1, rdata, size);
+		i_stream_skip(input, size);
+	}
+	test_assert(input->stream_errno == 0);
+	sha1_result(&sha1, input_sha1);
+	test_assert(memcmp(input_sha1, output_sha1, sizeof(input_sha1)) == 0);
+	i_stream_unref(&input);
+	i_stream_unref(&buf_input);
+	test_end();
+}
+
+static void test_zstd_seekable(void)
+{
+	const char *path = "test-compression.tmp";
+	struct zstd_ostream_settings set = {
+		.level = 1,
+		.seekable = TRUE,
+	};
+	struct ostream *file_output, *output;
+	struct istream *file_input, *buf_input, *input;
+	buffer_t *buf, *plain = t_buffer_create(1024*1024);
+	const unsigned char *data;
+	uoff_t offset, stream_size, file_size;
+	unsigned int i;
+	size_t size;
+	int fd;
+
+	test_begin("zstd seekable");
+	for (i = 0; plain->used < OSTREAM_ZSTD_SEEKABLE_FRAME_SIZE * 3 + 123; i++)
+		str_printfa(plain, "line %u: %u\n", i, i_rand_limit(1000));
+	fd = open(path, O_TRUNC | O_CREAT | O_RDWR, 0600);
+	if (fd == -1)
+		i_fatal("creat(%s) failed: %m", path);
+	file_output = o_stream_create_fd_file(fd, 0, FALSE);
+	output = o_stream_create_zstd_set(file_output, &set);
+	/* send in odd sized blocks, so they cross the frames */
+	for (offset = 0; offset < plain->used; offset += size) {
+		size = I_MIN(plain->used - offset, 10000);
+		o_stream_nsend(output, CONST_PTR_OFFSET(plain->data, offset),
+			       size);
+	}
+	test_assert(o_stream_finish(output) > 0);
+	file_size = file_output->offset;
+	o_stream_destroy(&output);
+	o_stream_destroy(&file_output);
+
+	/* the seek table is skipped when reading sequentially */
+	file_input = i_stream_create_fd(fd, IO_BLOCK_SIZE);
+	input = i_stream_create_zstd(file_input, FALSE);
+	offset = 0;
+	while (i_stream_read_more(input, &data, &size) > 0) {
+		test_assert(offset + size <= plain->used &&
+			    memcmp(data, CONST_PTR_OFFSET(plain->data, offset),
+				   size) == 0);
+		offset += size;
+		i_stream_skip(input, size);
+	}
+	test_assert(input->stream_errno == 0);
+	test_assert(offset == plain->used);
+
+	/* the size is known without decompressing */
+	i_stream_seek(input, 0);
+	test_assert(i_stream_zstd_is_seekable(input));
+	test_assert(i_stream_get_size(input, TRUE, &stream_size) == 1);
+	test_assert(stream_size == plain->used);
+
+	/* seek around */
+	for (i = 0; i < 100; i++) {
+		if (i % 10 == 0)
+			offset = plain->used;
+		else
+			offset = i_rand_limit(plain->used);
+		i_stream_seek(input, offset);
+		if (offset == plain->used) {
+			test_assert_idx(i_stream_read(input) == -1 &&
+					input->stream_errno == 0, i);
+			continue;
+		}
+		test_assert_idx(i_stream_read_more(input, &data, &size) > 0, i);
+		size = I_MIN(size, plain->used - offset);
+		test_assert_idx(memcmp(data, CONST_PTR_OFFSET(plain->data, offset),
+				       I_MIN(size, 100)) == 0, i);
+	}
+	/* seeking to the last frame doesn't decompress the earlier ones */
+	i_stream_seek(input, plain->used - 10);
+	test_assert(i_stream_read_more(input, &data, &size) > 0);
+	test_assert(file_input->v_offset > file_size / 2);
+	i_stream_unref(&input);
+	i_stream_unref(&file_input);
+	i_close_fd(&fd);
+	i_unlink(path);
+
+	/* not seekable without the seek table */
+	buf = test_zstd_compress(str_c(plain), NULL);
+	buf_input = test_istream_create_data(buf->data, buf->used);
+	input = i_stream_create_zstd(buf_input, FALSE);
+	test_assert(!i_stream_zstd_is_seekable(input));
+	i_stream_unref(&input);
+	i_stream_unref(&buf_input);
+	test_end();
+}
+#endif
+
 static void test_uncompress_file(const char *path)
 {
 	const struct compression_handler *handler;
@@ -313,6 +605,12 @@ int main(int argc, char *argv[])
 		test_gz_concat,
 		test_gz_no_concat,
 		test_gz_large_header,
+		test_deflate_adaptive_level,
+#ifdef HAVE_ZSTD
+		test_zstd_dictionary,
+		test_zstd_mt,
+		test_zstd_seekable,
+#endif
 		NULL
 	};
 	if (argc == 2) {
@@ -6,11 +6,45 @@ static const unsigned char IOSTREAM_CRYPT_MAGIC[] =
 #define IOSTREAM_CRYPT_VERSION 2
 #define IOSTREAM_TAG_SIZE 16
 
+/* Version 3 streams consist of independently authenticated AEAD blocks of
+   this many plaintext bytes, each followed by its tag. The last block is
+   always shorter (possibly empty), so a missing end can be detected. */
+#define IOSTREAM_CRYPT_BLOCK_SIZE 8192
+#define IOSTREAM_CRYPT_MAX_BLOCK_SIZE (1024*1024)
+/* stream AAD + block number + last block flag */
+#define IOSTREAM_CRYPT_BLOCK_AAD_SIZE (IOSTREAM_TAG_SIZE + 8 + 1)
+
 enum io_stream_encrypt_flags {
 	IO_STREAM_ENC_INTEGRITY_HMAC = 0x1,
 	IO_STREAM_ENC_INTEGRITY_AEAD = 0x2,
 	IO_STREAM_ENC_INTEGRITY_NONE = 0x4,
 	IO_STREAM_ENC_VERSION_1      = 0x8,
+	/* Seekable format, requires IO_STREAM_ENC_INTEGRITY_AEAD */
+	IO_STREAM_ENC_VERSION_3      = 0x10,
 };
 
+/* The stream's IV with the block number XORed into its last 8 bytes */
+static inline void
+io_stream_crypt_block_iv(unsigned char *iv_r, const unsigned char *iv,
+			 size_t iv_len, uint64_t block_idx)
+{
+	unsigned int i;
+
+	memcpy(iv_r, iv, iv_len);
+	for (i = 0; i < 8 && i < iv_len; i++)
+		iv_r[iv_len - 1 - i] ^= (block_idx >> (i*8)) & 0xff;
+}
+
+/* Binding the block number and the last block flag to the AAD prevents
+   reordering, dropping or truncating blocks. */
+static inline void
+io_stream_crypt_block_aad(unsigned char aad_r[IOSTREAM_CRYPT_BLOCK_AAD_SIZE],
+			  const unsigned char aad[IOSTREAM_TAG_SIZE],
+			  uint64_t block_idx, bool last)
+{
+	memcpy(aad_r, aad, IOSTREAM_TAG_SIZE);
+	cpu64_to_be_unaligned(block_idx, aad_r + IOSTREAM_TAG_SIZE);
+	aad_r[IOSTREAM_TAG_SIZE + 8] = last ? 1 : 0;
+}
+
 #endif
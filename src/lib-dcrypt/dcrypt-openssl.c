@@ -474,8 +474,10 @@ dcrypt_openssl_ctx_sym_final(struct dcrypt_context_symmetric *ctx,
 		buffer_set_used_size(result, buf_used + outl);
 		/* when **ENCRYPTING** recover tag */
 		if (ctx->mode == 1 && ctx->aad != NULL) {
-			/* tag should be NULL here */
-			i_assert(ctx->tag == NULL);
+			/* replace the previous message's tag if the context
+			   is reused */
+			if (ctx->tag != NULL)
+				p_free(ctx->pool, ctx->tag);
 			/* openssl claims taglen is always 16, go figure .. */
 			ctx->tag = p_malloc(ctx->pool, EVP_GCM_TLS_TAG_LEN);
 			ec = EVP_CIPHER_CTX_ctrl(ctx->ctx, EVP_CTRL_GCM_GET_TAG,
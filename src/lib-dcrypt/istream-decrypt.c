@@ -34,8 +34,16 @@ struct decrypt_istream {
 	uoff_t ftr, pos;
 	enum io_stream_encrypt_flags flags;
 
-	/* original iv, in case seeking is done, future feature */
-	unsigned char *iv;  
+	/* original iv, used to derive the per-block IVs in version 3 */
+	unsigned char *iv;
+
+	/* version 3 */
+	unsigned char aad[IOSTREAM_TAG_SIZE];
+	size_t block_size;
+	uoff_t data_start_offset;
+	uint64_t block_idx;
+	/* number of bytes to drop from the next block after seeking */
+	size_t block_skip;
 
 	struct dcrypt_context_symmetric *ctx_sym;
 	struct dcrypt_context_hmac *ctx_mac;
@@ -51,6 +59,8 @@ static void i_stream_decrypt_reset(struct decrypt_istream *dstream)
 	dstream->ftr = 0;
 	dstream->pos = 0;
 	dstream->flags = 0;
+	dstream->block_idx = 0;
+	dstream->block_skip = 0;
 
 	if (!dstream->symmetric) {
 		dstream->initialized = FALSE;
@@ -656,6 +666,7 @@ i_stream_decrypt_header_contents(struct decrypt_istream *stream,
 	} else if ((stream->flags & IO_STREAM_ENC_INTEGRITY_AEAD) ==
 		IO_STREAM_ENC_INTEGRITY_AEAD) {
 		dcrypt_ctx_sym_set_aad(stream->ctx_sym, ptr, tagsize);
+		memcpy(stream->aad, ptr, tagsize);
 		stream->ftr = tagsize;
 		stream->use_mac = TRUE;
 	} else {
@@ -693,14 +704,16 @@ i_stream_decrypt_read_header(struct decrypt_istream *stream,
 		stream->format = DECRYPT_FORMAT_V1;
 		return i_stream_decrypt_read_header_v1(stream, data+1,
 						       end - (data+1));
+	} else if (*data == '\x03') {
+		stream->format = DECRYPT_FORMAT_V3;
 	} else if (*data != '\x02') {
 		io_stream_set_error(&stream->istream.iostream,
 				    "Unsupported encrypted data 0x%02x", *data);
 		return -1;
+	} else {
+		stream->format = DECRYPT_FORMAT_V2;
 	}
 
-	stream->format = DECRYPT_FORMAT_V2;
-
 	data++;
 
 	/* read flags */
@@ -717,6 +730,27 @@ i_stream_decrypt_read_header(struct decrypt_istream *stream,
 	if ((size_t)(end-data)+1 < hdr_len)
 		return 0;
 
+	if (stream->format == DECRYPT_FORMAT_V3) {
+		uint32_t block_size;
+
+		if (!get_msb32(&data, end, &block_size))
+			return 0;
+		if (block_size == 0 ||
+		    block_size > IOSTREAM_CRYPT_MAX_BLOCK_SIZE) {
+			io_stream_set_error(&stream->istream.iostream,
+				"Decryption error: invalid block size %u",
+				block_size);
+			return -1;
+		}
+		if ((stream->flags & IO_STREAM_ENC_INTEGRITY_AEAD) == 0) {
+			io_stream_set_error(&stream->istream.iostream,
+				"Decryption error: "
+				"Version 3 requires AEAD integrity");
+			return -1;
+		}
+		stream->block_size = block_size;
+	}
+
 	int ret;
 	if ((ret = i_stream_decrypt_header_contents(stream, data, hdr_len)) < 0)
 		return -1;
@@ -728,6 +762,19 @@ i_stream_decrypt_read_header(struct decrypt_istream *stream,
 	}
 	stream->initialized = TRUE;
 
+	if (stream->format == DECRYPT_FORMAT_V3) {
+		/* each block is initialized separately. make sure the parent
+		   can buffer a whole block with its tag. */
+		size_t full_block_size = stream->block_size + stream->ftr;
+
+		if (stream->istream.parent->real_stream->max_buffer_size <
+		    full_block_size) {
+			i_stream_set_max_buffer_size(stream->istream.parent,
+						     full_block_size);
+		}
+		return hdr_len;
+	}
+
 	/* if it all went well, try to initialize decryption context */
 	if (!dcrypt_ctx_sym_init(stream->ctx_sym, &error)) {
 		io_stream_set_error(&stream->istream.iostream,
@@ -737,6 +784,80 @@ i_stream_decrypt_read_header(struct decrypt_istream *stream,
 	return hdr_len;
 }
 
+static int
+i_stream_decrypt_read_block(struct decrypt_istream *dstream)
+{
+	struct istream_private *stream = &dstream->istream;
+	struct dcrypt_context_symmetric *ctx = dstream->ctx_sym;
+	size_t full_block_size = dstream->block_size + dstream->ftr;
+	unsigned int iv_len = dcrypt_ctx_sym_get_iv_length(ctx);
+	unsigned char iv[iv_len];
+	unsigned char aad[IOSTREAM_CRYPT_BLOCK_AAD_SIZE];
+	const unsigned char *data;
+	size_t size, data_size;
+	const char *error;
+	bool last;
+	int ret;
+
+	ret = i_stream_read_bytes(stream->parent, &data, &size,
+				  full_block_size);
+	if (ret > 0) {
+		/* full block, there's always a shorter last block after it */
+		data_size = dstream->block_size;
+		last = FALSE;
+	} else if (stream->parent->stream_errno != 0) {
+		stream->istream.stream_errno = stream->parent->stream_errno;
+		return -1;
+	} else if (ret == -2) {
+		io_stream_set_error(&stream->iostream,
+			"Decryption error: block size %"PRIuSIZE_T" is larger "
+			"than the input buffer", full_block_size);
+		stream->istream.stream_errno = EINVAL;
+		return -1;
+	} else if (!stream->parent->eof) {
+		return 0;
+	} else if (size < dstream->ftr) {
+		io_stream_set_error(&stream->iostream,
+				    "Decryption error: truncated block %"PRIu64,
+				    dstream->block_idx);
+		stream->istream.stream_errno = EPIPE;
+		return -1;
+	} else {
+		data_size = size - dstream->ftr;
+		last = TRUE;
+	}
+
+	io_stream_crypt_block_iv(iv, dstream->iv, iv_len, dstream->block_idx);
+	io_stream_crypt_block_aad(aad, dstream->aad, dstream->block_idx, last);
+	dcrypt_ctx_sym_set_iv(ctx, iv, iv_len);
+	dcrypt_ctx_sym_set_aad(ctx, aad, sizeof(aad));
+	dcrypt_ctx_sym_set_tag(ctx, data + data_size, dstream->ftr);
+
+	size_t old_used = dstream->buf->used;
+	if (!dcrypt_ctx_sym_init(ctx, &error) ||
+	    !dcrypt_ctx_sym_update(ctx, data, data_size, dstream->buf, &error) ||
+	    !dcrypt_ctx_sym_final(ctx, dstream->buf, &error)) {
+		io_stream_set_error(&stream->iostream,
+				    "Decryption error in block %"PRIu64": %s",
+				    dstream->block_idx, error);
+		stream->istream.stream_errno = EINVAL;
+		return -1;
+	}
+	i_stream_skip(stream->parent, data_size + dstream->ftr);
+	dstream->block_idx++;
+	if (last)
+		dstream->finalized = TRUE;
+
+	if (dstream->block_skip > 0) {
+		size_t skip = I_MIN(dstream->block_skip,
+				    dstream->buf->used - old_used);
+
+		buffer_delete(dstream->buf, old_used, skip);
+		dstream->block_skip = 0;
+	}
+	return 1;
+}
+
 static ssize_t
 i_stream_decrypt_read(struct istream_private *stream)
 {
@@ -797,6 +918,13 @@ i_stream_decrypt_read(struct istream_private *stream)
 			return -1;
 		}
 
+		if (dstream->initialized &&
+		    dstream->format == DECRYPT_FORMAT_V3) {
+			if ((ret = i_stream_decrypt_read_block(dstream)) <= 0)
+				return ret;
+			continue;
+		}
+
 		/* need to read more input */
 		ret = i_stream_read_memarea(stream->parent);
 		if (ret == 0)
@@ -877,6 +1005,11 @@ i_stream_decrypt_read(struct istream_private *stream)
 					    0, dstream->buf->used);
 				buffer_set_used_size(dstream->buf, 0);
 				i_stream_skip(stream->parent, hret);
+				if (dstream->format == DECRYPT_FORMAT_V3) {
+					dstream->data_start_offset =
+						stream->parent->v_offset;
+					continue;
+				}
 			}
 
 			data = i_stream_get_data(stream->parent, &size);
@@ -949,6 +1082,34 @@ i_stream_decrypt_read(struct istream_private *stream)
 	}
 }
 
+static void
+i_stream_decrypt_seek_block(struct decrypt_istream *dstream, uoff_t v_offset)
+{
+	struct istream_private *stream = &dstream->istream;
+	uoff_t start_offset = stream->istream.v_offset - stream->skip;
+	uint64_t block_idx = v_offset / dstream->block_size;
+
+	if (v_offset >= start_offset && v_offset <= start_offset + stream->pos) {
+		/* within what's already decrypted */
+		if (!i_stream_nonseekable_try_seek(stream, v_offset))
+			i_unreached();
+		return;
+	}
+
+	/* decrypt only the blocks from the wanted offset onwards */
+	i_stream_seek(stream->parent, dstream->data_start_offset +
+		      block_idx * (dstream->block_size + dstream->ftr));
+	safe_memset(buffer_get_modifiable_data(dstream->buf, 0), 0,
+		    dstream->buf->used);
+	buffer_set_used_size(dstream->buf, 0);
+	stream->skip = stream->pos = 0;
+	stream->high_pos = 0;
+	stream->istream.v_offset = v_offset;
+	dstream->block_idx = block_idx;
+	dstream->block_skip = v_offset % dstream->block_size;
+	dstream->finalized = FALSE;
+}
+
 static void
 i_stream_decrypt_seek(struct istream_private *stream, uoff_t v_offset,
 		      bool mark ATTR_UNUSED)
@@ -956,6 +1117,11 @@ i_stream_decrypt_seek(struct istream_private *stream, uoff_t v_offset,
 	struct decrypt_istream *dstream =
 		(struct decrypt_istream *)stream;
 
+	if (dstream->initialized && dstream->format == DECRYPT_FORMAT_V3) {
+		i_stream_decrypt_seek_block(dstream, v_offset);
+		return;
+	}
+
 	if (i_stream_nonseekable_try_seek(stream, v_offset))
 		return;
 
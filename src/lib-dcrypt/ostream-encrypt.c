@@ -26,6 +26,9 @@
  * key data
  * cipher data
  * mac data (mac specific bytes)
+ *
+ * version 3 adds plaintext block size (4 bytes) after the size of header.
+ * The cipher data is then split into blocks, each followed by its AEAD tag.
  */
 
 #define IO_STREAM_ENCRYPT_SEED_SIZE 32
@@ -47,6 +50,12 @@ struct encrypt_ostream {
 	buffer_t *mac_oid;
 	size_t block_size;
 
+	/* version 3: the plaintext of the current block */
+	buffer_t *block_buf;
+	unsigned char *iv;
+	unsigned char aad[IOSTREAM_TAG_SIZE];
+	uint64_t block_idx;
+
 	bool finalized;
 	bool failed;
 	bool prefix_written;
@@ -102,6 +111,7 @@ o_stream_encrypt_send_header_v1(struct encrypt_ostream *stream)
 static int
 o_stream_encrypt_send_header_v2(struct encrypt_ostream *stream)
 {
+	bool v3 = (stream->flags & IO_STREAM_ENC_VERSION_3) != 0;
 	unsigned char c;
 	unsigned int i;
 
@@ -111,18 +121,23 @@ o_stream_encrypt_send_header_v2(struct encrypt_ostream *stream)
 	buffer_t *values = t_buffer_create(256);
 	buffer_append(values, IOSTREAM_CRYPT_MAGIC,
 		      sizeof(IOSTREAM_CRYPT_MAGIC));
-	c = 2;
+	c = v3 ? 3 : 2;
 	buffer_append(values, &c, 1);
 	i = cpu32_to_be(stream->flags);
 	buffer_append(values, &i, 4);
 	/* store total length of header
 	   9 = version + flags + length
+	   4 = block size (v3)
 	   8 = rounds + key data length
 	   */
-	i = cpu32_to_be(sizeof(IOSTREAM_CRYPT_MAGIC) + 9 +
+	i = cpu32_to_be(sizeof(IOSTREAM_CRYPT_MAGIC) + 9 + (v3 ? 4 : 0) +
 		stream->cipher_oid->used + stream->mac_oid->used +
 		8 + stream->key_data_len);
 	buffer_append(values, &i, 4);
+	if (v3) {
+		i = cpu32_to_be(IOSTREAM_CRYPT_BLOCK_SIZE);
+		buffer_append(values, &i, 4);
+	}
 
 	buffer_append_buf(values, stream->cipher_oid, 0, (size_t)-1);
 	buffer_append_buf(values, stream->mac_oid, 0, (size_t)-1);
@@ -450,6 +465,20 @@ o_stream_encrypt_keydata_create_v2(struct encrypt_ostream *stream,
 	ptr += dcrypt_ctx_sym_get_key_length(stream->ctx_sym);
 	dcrypt_ctx_sym_set_iv(stream->ctx_sym, ptr,
 			      dcrypt_ctx_sym_get_iv_length(stream->ctx_sym));
+	if ((stream->flags & IO_STREAM_ENC_VERSION_3) != 0) {
+		/* each block is encrypted with its own IV and AAD, which
+		   are derived from these */
+		stream->iv = i_malloc(dcrypt_ctx_sym_get_iv_length(stream->ctx_sym));
+		memcpy(stream->iv, ptr,
+		       dcrypt_ctx_sym_get_iv_length(stream->ctx_sym));
+		ptr += dcrypt_ctx_sym_get_iv_length(stream->ctx_sym);
+		memcpy(stream->aad, ptr, tagsize);
+		safe_memset(buffer_get_modifiable_data(keydata, 0), 0,
+			    keydata->used);
+		stream->block_buf = buffer_create_dynamic(default_pool,
+			IOSTREAM_CRYPT_BLOCK_SIZE);
+		return 0;
+	}
 	ptr += dcrypt_ctx_sym_get_iv_length(stream->ctx_sym);
 
 	if ((stream->flags & IO_STREAM_ENC_INTEGRITY_HMAC) ==
@@ -472,6 +501,76 @@ o_stream_encrypt_keydata_create_v2(struct encrypt_ostream *stream,
 	return 0;
 }
 
+static int
+o_stream_encrypt_send_block(struct encrypt_ostream *stream, bool last)
+{
+	struct dcrypt_context_symmetric *ctx = stream->ctx_sym;
+	unsigned int iv_len = dcrypt_ctx_sym_get_iv_length(ctx);
+	unsigned char iv[iv_len];
+	unsigned char aad[IOSTREAM_CRYPT_BLOCK_AAD_SIZE];
+	const char *error;
+	int ret = 0;
+
+	io_stream_crypt_block_iv(iv, stream->iv, iv_len, stream->block_idx);
+	io_stream_crypt_block_aad(aad, stream->aad, stream->block_idx, last);
+	dcrypt_ctx_sym_set_iv(ctx, iv, iv_len);
+	dcrypt_ctx_sym_set_aad(ctx, aad, sizeof(aad));
+
+	T_BEGIN {
+		buffer_t *buf = t_buffer_create(stream->block_buf->used +
+			dcrypt_ctx_sym_get_block_size(ctx) + IOSTREAM_TAG_SIZE);
+
+		if (!dcrypt_ctx_sym_init(ctx, &error) ||
+		    !dcrypt_ctx_sym_update(ctx, stream->block_buf->data,
+					   stream->block_buf->used, buf,
+					   &error) ||
+		    !dcrypt_ctx_sym_final(ctx, buf, &error)) {
+			io_stream_set_error(&stream->ostream.iostream,
+					    "Encryption failure: %s", error);
+			stream->ostream.ostream.stream_errno = EINVAL;
+			ret = -1;
+		} else {
+			dcrypt_ctx_sym_get_tag(ctx, buf);
+			ret = o_stream_encrypt_send(stream, buf->data,
+						    buf->used);
+		}
+	} T_END;
+
+	safe_memset(buffer_get_modifiable_data(stream->block_buf, 0), 0,
+		    stream->block_buf->used);
+	buffer_set_used_size(stream->block_buf, 0);
+	stream->block_idx++;
+	return ret;
+}
+
+static ssize_t
+o_stream_encrypt_sendv_blocks(struct encrypt_ostream *estream,
+			      const struct const_iovec *iov,
+			      unsigned int iov_count)
+{
+	ssize_t total = 0;
+
+	for (unsigned int i = 0; i < iov_count; i++) {
+		const unsigned char *ptr = iov[i].iov_base;
+		size_t bl, len = iov[i].iov_len;
+
+		while (len > 0) {
+			bl = I_MIN(IOSTREAM_CRYPT_BLOCK_SIZE -
+				   estream->block_buf->used, len);
+			buffer_append(estream->block_buf, ptr, bl);
+			/* a full block is never the last one */
+			if (estream->block_buf->used == IOSTREAM_CRYPT_BLOCK_SIZE &&
+			    o_stream_encrypt_send_block(estream, FALSE) < 0)
+				return -1;
+			ptr += bl;
+			len -= bl;
+			total += bl;
+		}
+	}
+	estream->ostream.ostream.offset += total;
+	return total;
+}
+
 static ssize_t
 o_stream_encrypt_sendv(struct ostream_private *stream,
 		       const struct const_iovec *iov, unsigned int iov_count)
@@ -496,6 +595,8 @@ o_stream_encrypt_sendv(struct ostream_private *stream,
 			return -1;
 		}
 	}
+	if (estream->block_buf != NULL)
+		return o_stream_encrypt_sendv_blocks(estream, iov, iov_count);
 
 	/* buffer for encrypted data */
 	unsigned char ciphertext[IO_BLOCK_SIZE];
@@ -560,6 +661,9 @@ o_stream_encrypt_finalize(struct ostream_private *stream)
 	/* if nothing was written, we are done */
 	if (!estream->prefix_written) return 0;
 
+	if (estream->block_buf != NULL)
+		return o_stream_encrypt_send_block(estream, TRUE);
+
 	/* acquire last block */
 	buffer_t *buf = t_buffer_create(
 		dcrypt_ctx_sym_get_block_size(estream->ctx_sym));
@@ -645,6 +749,12 @@ o_stream_encrypt_destroy(struct iostream_private *stream)
 		dcrypt_ctx_hmac_destroy(&estream->ctx_mac);
 	if (estream->key_data != NULL)
 		i_free(estream->key_data);
+	if (estream->block_buf != NULL) {
+		safe_memset(buffer_get_modifiable_data(estream->block_buf, 0),
+			    0, estream->block_buf->used);
+		buffer_free(&estream->block_buf);
+	}
+	i_free(estream->iv);
 	if (estream->cipher_oid != NULL)
 		buffer_free(&estream->cipher_oid);
 	if (estream->mac_oid != NULL)
@@ -674,6 +784,13 @@ o_stream_encrypt_init(struct encrypt_ostream *estream, const char *algorithm)
 		/* then do keying */
 		return o_stream_encrypt_keydata_create_v1(estream);
 	} else {
+		if ((estream->flags & IO_STREAM_ENC_VERSION_3) != 0 &&
+		    (estream->flags & IO_STREAM_ENC_INTEGRITY_AEAD) == 0) {
+			io_stream_set_error(&estream->ostream.iostream,
+					    "Cannot create ostream-encrypt: "
+					    "Version 3 requires AEAD integrity");
+			return -1;
+		}
 		calg = t_strdup_noconst(algorithm);
 		malg = strrchr(calg, '-');
 
@@ -500,6 +500,154 @@ static void test_write_read_v2_empty(void)
 	test_end();
 }
 
+static buffer_t *test_write_v3(const unsigned char *payload, size_t size)
+{
+	buffer_t *buf = buffer_create_dynamic(default_pool, size + 1024);
+	struct ostream *os = o_stream_create_buffer(buf);
+	struct ostream *os_2 = o_stream_create_encrypt(os,
+		"aes-256-gcm-sha256", test_v1_kp.pub,
+		IO_STREAM_ENC_INTEGRITY_AEAD | IO_STREAM_ENC_VERSION_3);
+	o_stream_nsend(os_2, payload, size);
+	test_assert(o_stream_finish(os_2) > 0);
+	if (os_2->stream_errno != 0)
+		i_debug("error: %s", o_stream_get_error(os_2));
+
+	o_stream_unref(&os);
+	o_stream_unref(&os_2);
+	return buf;
+}
+
+static void test_write_read_v3(void)
+{
+	test_begin("test_write_read_v3");
+	unsigned char payload[IO_BLOCK_SIZE*10 + 123];
+	const unsigned char *ptr;
+	size_t pos = 0, siz;
+	random_fill(payload, sizeof(payload));
+
+	buffer_t *buf = test_write_v3(payload, sizeof(payload));
+	struct istream *is = test_istream_create_data(buf->data, buf->used);
+	struct istream *is_2 = i_stream_create_decrypt(is, test_v1_kp.priv);
+
+	size_t offset = 0;
+	test_istream_set_size(is, 0);
+	test_istream_set_allow_eof(is, FALSE);
+	while(i_stream_read_data(is_2, &ptr, &siz, 0)>=0) {
+		if (offset == buf->used)
+			test_istream_set_allow_eof(is, TRUE);
+		else
+			test_istream_set_size(is, ++offset);
+
+		test_assert_idx(pos + siz <= sizeof(payload), pos);
+		if (pos + siz > sizeof(payload)) break;
+		test_assert_idx(siz == 0 ||
+				memcmp(ptr, payload + pos, siz) == 0, pos);
+		i_stream_skip(is_2, siz); pos += siz;
+	}
+	test_assert(pos == sizeof(payload));
+	test_assert(is_2->stream_errno == 0);
+	if (is_2->stream_errno != 0)
+		i_debug("error: %s", i_stream_get_error(is_2));
+	test_assert(i_stream_encrypt_get_format(is_2) == DECRYPT_FORMAT_V3);
+
+	/* test seeking */
+	for (size_t i = 100; i < sizeof(payload); i += 1000) {
+		i_stream_seek(is_2, i);
+		test_assert_idx(i_stream_read_data(is_2, &ptr, &siz, 0) == 1, i);
+		test_assert_idx(memcmp(ptr, payload + i, siz) == 0, i);
+	}
+	i_stream_seek(is_2, 0);
+	test_assert(i_stream_read_data(is_2, &ptr, &siz, 0) == 1);
+	test_assert(memcmp(ptr, payload, siz) == 0);
+
+	/* seeking reads only the wanted block */
+	i_stream_seek(is_2, IO_BLOCK_SIZE*9 + 5);
+	test_assert(i_stream_read_data(is_2, &ptr, &siz, 0) == 1);
+	test_assert(siz == IO_BLOCK_SIZE - 5);
+	test_assert(memcmp(ptr, payload + IO_BLOCK_SIZE*9 + 5, siz) == 0);
+	i_stream_skip(is_2, siz);
+	test_assert(i_stream_read_data(is_2, &ptr, &siz, 0) == 1);
+	test_assert(siz == 123);
+	test_assert(memcmp(ptr, payload + IO_BLOCK_SIZE*10, siz) == 0);
+	i_stream_skip(is_2, siz);
+	test_assert(i_stream_read_data(is_2, &ptr, &siz, 0) == -1);
+	test_assert(is_2->stream_errno == 0);
+
+	i_stream_unref(&is);
+	i_stream_unref(&is_2);
+	buffer_free(&buf);
+
+	test_end();
+}
+
+static void test_write_read_v3_empty(void)
+{
+	const unsigned char *ptr;
+	size_t siz;
+	unsigned char payload[IO_BLOCK_SIZE];
+
+	test_begin("test_write_read_v3_empty");
+	/* a full block is followed by an empty last block */
+	random_fill(payload, sizeof(payload));
+	buffer_t *buf = test_write_v3(payload, sizeof(payload));
+	test_assert(buf->used > (sizeof(payload) + IOSTREAM_TAG_SIZE * 2));
+
+	struct istream *is = test_istream_create_data(buf->data, buf->used);
+	struct istream *is_2 = i_stream_create_decrypt(is, test_v1_kp.priv);
+	test_assert(i_stream_read_bytes(is_2, &ptr, &siz, sizeof(payload)) == 1);
+	test_assert(siz == sizeof(payload) &&
+		    memcmp(ptr, payload, siz) == 0);
+	i_stream_skip(is_2, siz);
+	test_assert(i_stream_read_data(is_2, &ptr, &siz, 0) == -1);
+	test_assert(is_2->stream_errno == 0);
+	i_stream_unref(&is);
+	i_stream_unref(&is_2);
+	buffer_free(&buf);
+	test_end();
+}
+
+static void test_read_v3_truncated(void)
+{
+	const unsigned char *ptr;
+	size_t siz;
+	unsigned char payload[IO_BLOCK_SIZE*2 + 10];
+
+	test_begin("test_read_v3_truncated");
+	random_fill(payload, sizeof(payload));
+	buffer_t *buf = test_write_v3(payload, sizeof(payload));
+
+	/* the whole last block is missing */
+	struct istream *is = test_istream_create_data(buf->data,
+		buf->used - 10 - IOSTREAM_TAG_SIZE);
+	struct istream *is_2 = i_stream_create_decrypt(is, test_v1_kp.priv);
+	while (i_stream_read_more(is_2, &ptr, &siz) > 0)
+		i_stream_skip(is_2, siz);
+	test_assert(is_2->stream_errno != 0);
+	i_stream_unref(&is);
+	i_stream_unref(&is_2);
+
+	/* corrupted data in the middle can't be read */
+	((unsigned char *)buffer_get_modifiable_data(buf, NULL))[buf->used - 100] ^= 1;
+	is = test_istream_create_data(buf->data, buf->used);
+	is_2 = i_stream_create_decrypt(is, test_v1_kp.priv);
+	i_stream_seek(is_2, IO_BLOCK_SIZE*2);
+	test_assert(i_stream_read_more(is_2, &ptr, &siz) == -1);
+	test_assert(is_2->stream_errno != 0);
+	i_stream_unref(&is);
+	i_stream_unref(&is_2);
+
+	/* but the earlier blocks still can */
+	is = test_istream_create_data(buf->data, buf->used);
+	is_2 = i_stream_create_decrypt(is, test_v1_kp.priv);
+	test_assert(i_stream_read_bytes(is_2, &ptr, &siz, IO_BLOCK_SIZE) == 1);
+	test_assert(memcmp(ptr, payload, IO_BLOCK_SIZE) == 0);
+	i_stream_unref(&is);
+	i_stream_unref(&is_2);
+
+	buffer_free(&buf);
+	test_end();
+}
+
 static int
 no_op_cb(const char *digest ATTR_UNUSED,
 	 struct dcrypt_private_key **priv_key_r ATTR_UNUSED,
@@ -625,6 +773,9 @@ int main(void)
 		test_write_read_v2,
 		test_write_read_v2_short,
 		test_write_read_v2_empty,
+		test_write_read_v3,
+		test_write_read_v3_empty,
+		test_read_v3_truncated,
 		test_free_keys,
 		test_read_0_to_400_byte_garbage,
 		test_read_large_header,
@@ -0,0 +1,446 @@
+/* Copyright (c) 2018 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "hash.h"
+#include "llist.h"
+#include "ioloop.h"
+#include "dict-private.h"
+
+/* URI: cache:[ttl_secs=<n>:][negative_ttl_secs=<n>:][max_count=<n>:]<uri>
+   Lookups are cached in memory for ttl_secs (not found results for
+   negative_ttl_secs). The least recently used entries are dropped once
+   there are more than max_count of them. Keys changed via this dict are
+   dropped from the cache, but changes done by other processes are seen
+   only after the entries expire. */
+
+#define CACHE_DICT_DEFAULT_TTL_SECS 60
+#define CACHE_DICT_DEFAULT_MAX_COUNT 1000
+
+struct cache_dict_entry {
+	struct cache_dict_entry *prev, *next;
+
+	char *key;
+	/* NULL = key not found */
+	char *value;
+	time_t expire_time;
+};
+
+struct cache_dict {
+	struct dict dict;
+	struct dict *child;
+
+	unsigned int ttl_secs, negative_ttl_secs, max_count;
+
+	HASH_TABLE(char *, struct cache_dict_entry *) entries;
+	/* the most recently used entry is the head */
+	struct cache_dict_entry *lru_head, *lru_tail;
+
+	/* increased whenever entries are invalidated, so that lookups
+	   started before the invalidation won't get cached */
+	unsigned int generation;
+};
+
+struct cache_dict_lookup_context {
+	struct cache_dict *dict;
+	char *key;
+	unsigned int generation;
+
+	dict_lookup_callback_t *callback;
+	void *context;
+};
+
+struct cache_dict_transaction_context {
+	struct dict_transaction_context ctx;
+	struct dict_transaction_context *child;
+
+	ARRAY_TYPE(string) changed_keys;
+};
+
+struct cache_dict_commit_context {
+	struct cache_dict *dict;
+	ARRAY_TYPE(string) changed_keys;
+
+	dict_transaction_commit_callback_t *callback;
+	void *context;
+};
+
+static void
+cache_dict_entry_free(struct cache_dict *dict, struct cache_dict_entry *entry)
+{
+	hash_table_remove(dict->entries, entry->key);
+	DLLIST2_REMOVE(&dict->lru_head, &dict->lru_tail, entry);
+	i_free(entry->key);
+	i_free(entry->value);
+	i_free(entry);
+}
+
+static void cache_dict_invalidate(struct cache_dict *dict, const char *key)
+{
+	struct cache_dict_entry *entry;
+
+	dict->generation++;
+	entry = hash_table_lookup(dict->entries, key);
+	if (entry != NULL)
+		cache_dict_entry_free(dict, entry);
+}
+
+static struct cache_dict_entry *
+cache_dict_entry_lookup(struct cache_dict *dict, const char *key)
+{
+	struct cache_dict_entry *entry;
+
+	entry = hash_table_lookup(dict->entries, key);
+	if (entry == NULL)
+		return NULL;
+	if (entry->expire_time <= ioloop_time) {
+		cache_dict_entry_free(dict, entry);
+		return NULL;
+	}
+	DLLIST2_REMOVE(&dict->lru_head, &dict->lru_tail, entry);
+	DLLIST2_PREPEND(&dict->lru_head, &dict->lru_tail, entry);
+	return entry;
+}
+
+static void
+cache_dict_entry_add(struct cache_dict *dict, const char *key,
+		     const char *value)
+{
+	struct cache_dict_entry *entry;
+	unsigned int ttl = value != NULL ? dict->ttl_secs :
+		dict->negative_ttl_secs;
+
+	if (ttl == 0)
+		return;
+
+	entry = hash_table_lookup(dict->entries, key);
+	if (entry != NULL)
+		cache_dict_entry_free(dict, entry);
+	if (hash_table_count(dict->entries) >= dict->max_count)
+		cache_dict_entry_free(dict, dict->lru_tail);
+
+	entry = i_new(struct cache_dict_entry, 1);
+	entry->key = i_strdup(key);
+	entry->value = i_strdup(value);
+	entry->expire_time = ioloop_time + ttl;
+	hash_table_insert(dict->entries, entry->key, entry);
+	DLLIST2_PREPEND(&dict->lru_head, &dict->lru_tail, entry);
+}
+
+static int
+cache_dict_init(struct dict *driver, const char *uri,
+		const struct dict_settings *set,
+		struct dict **dict_r, const char **error_r)
+{
+	struct cache_dict *dict;
+	unsigned int ttl_secs = CACHE_DICT_DEFAULT_TTL_SECS;
+	unsigned int negative_ttl_secs = CACHE_DICT_DEFAULT_TTL_SECS;
+	unsigned int max_count = CACHE_DICT_DEFAULT_MAX_COUNT;
+	struct dict *child;
+	const char *p, *arg, *error;
+
+	for (;;) {
+		p = strchr(uri, ':');
+		if (p == NULL)
+			break;
+		arg = t_strdup_until(uri, p);
+		if (str_begins(arg, "ttl_secs=")) {
+			if (str_to_uint(arg + 9, &ttl_secs) < 0) {
+				*error_r = t_strdup_printf(
+					"Invalid ttl_secs: %s", arg + 9);
+				return -1;
+			}
+		} else if (str_begins(arg, "negative_ttl_secs=")) {
+			if (str_to_uint(arg + 18, &negative_ttl_secs) < 0) {
+				*error_r = t_strdup_printf(
+					"Invalid negative_ttl_secs: %s",
+					arg + 18);
+				return -1;
+			}
+		} else if (str_begins(arg, "max_count=")) {
+			if (str_to_uint(arg + 10, &max_count) < 0 ||
+			    max_count == 0) {
+				*error_r = t_strdup_printf(
+					"Invalid max_count: %s", arg + 10);
+				return -1;
+			}
+		} else {
+			/* the rest is the cached dict's URI */
+			break;
+		}
+		uri = p + 1;
+	}
+
+	if (dict_init(uri, set, &child, &error) < 0) {
+		*error_r = error;
+		return -1;
+	}
+
+	dict = i_new(struct cache_dict, 1);
+	dict->dict = *driver;
+	dict->child = child;
+	dict->ttl_secs = ttl_secs;
+	dict->negative_ttl_secs = negative_ttl_secs;
+	dict->max_count = max_count;
+	hash_table_create(&dict->entries, default_pool, 0, str_hash, strcmp);
+	*dict_r = &dict->dict;
+	return 0;
+}
+
+static void cache_dict_deinit(struct dict *_dict)
+{
+	struct cache_dict *dict = (struct cache_dict *)_dict;
+
+	while (dict->lru_head != NULL)
+		cache_dict_entry_free(dict, dict->lru_head);
+	hash_table_destroy(&dict->entries);
+	dict_deinit(&dict->child);
+	i_free(dict);
+}
+
+static void cache_dict_wait(struct dict *_dict)
+{
+	struct cache_dict *dict = (struct cache_dict *)_dict;
+
+	dict_wait(dict->child);
+}
+
+static bool cache_dict_switch_ioloop(struct dict *_dict)
+{
+	struct cache_dict *dict = (struct cache_dict *)_dict;
+
+	return dict_switch_ioloop(dict->child);
+}
+
+static int cache_dict_lookup(struct dict *_dict, pool_t pool, const char *key,
+			     const char **value_r, const char **error_r)
+{
+	struct cache_dict *dict = (struct cache_dict *)_dict;
+	struct cache_dict_entry *entry;
+	unsigned int generation = dict->generation;
+	int ret;
+
+	entry = cache_dict_entry_lookup(dict, key);
+	if (entry != NULL) {
+		*value_r = p_strdup(pool, entry->value);
+		return entry->value != NULL ? 1 : 0;
+	}
+
+	ret = dict_lookup(dict->child, pool, key, value_r, error_r);
+	if (ret >= 0 && generation == dict->generation)
+		cache_dict_entry_add(dict, key, ret > 0 ? *value_r : NULL);
+	return ret;
+}
+
+static void
+cache_dict_lookup_async_callback(const struct dict_lookup_result *result,
+				 void *context)
+{
+	struct cache_dict_lookup_context *ctx = context;
+	struct cache_dict *dict = ctx->dict;
+
+	/* multiple values can't be cached */
+	if (result->ret == 0 ||
+	    (result->ret > 0 && result->values[1] == NULL)) {
+		if (ctx->generation == dict->generation)
+			cache_dict_entry_add(dict, ctx->key, result->value);
+	}
+	ctx->callback(result, ctx->context);
+	i_free(ctx->key);
+	i_free(ctx);
+}
+
+static void
+cache_dict_lookup_async(struct dict *_dict, const char *key,
+			dict_lookup_callback_t *callback, void *context)
+{
+	struct cache_dict *dict = (struct cache_dict *)_dict;
+	struct cache_dict_lookup_context *ctx;
+	struct cache_dict_entry *entry;
+
+	entry = cache_dict_entry_lookup(dict, key);
+	if (entry != NULL) {
+		struct dict_lookup_result result;
+
+		i_zero(&result);
+		result.ret = entry->value != NULL ? 1 : 0;
+		result.value = t_strdup(entry->value);
+		const char *const values[] = { result.value, NULL };
+		result.values = values;
+		callback(&result, context);
+		return;
+	}
+
+	ctx = i_new(struct cache_dict_lookup_context, 1);
+	ctx->dict = dict;
+	ctx->key = i_strdup(key);
+	ctx->generation = dict->generation;
+	ctx->callback = callback;
+	ctx->context = context;
+	dict_lookup_async(dict->child, key,
+			  cache_dict_lookup_async_callback, ctx);
+}
+
+static struct dict_iterate_context *
+cache_dict_iterate_init(struct dict *_dict, const char *const *paths,
+			enum dict_iterate_flags flags)
+{
+	struct cache_dict *dict = (struct cache_dict *)_dict;
+
+	/* iterations aren't cached. the returned context belongs to the
+	   child dict, so the rest of the iteration goes directly to it. */
+	if (dict->child->v.iterate_init == NULL)
+		return &dict_iter_unsupported;
+	return dict->child->v.iterate_init(dict->child, paths, flags);
+}
+
+static struct dict_transaction_context *
+cache_dict_transaction_init(struct dict *_dict)
+{
+	struct cache_dict *dict = (struct cache_dict *)_dict;
+	struct cache_dict_transaction_context *ctx;
+
+	ctx = i_new(struct cache_dict_transaction_context, 1);
+	ctx->ctx.dict = _dict;
+	ctx->child = dict_transaction_begin(dict->child);
+	i_array_init(&ctx->changed_keys, 8);
+	return &ctx->ctx;
+}
+
+static void cache_dict_changed_keys_free(ARRAY_TYPE(string) *keys)
+{
+	char **keyp;
+
+	array_foreach_modifiable(keys, keyp)
+		i_free(*keyp);
+	array_free(keys);
+}
+
+static void
+cache_dict_transaction_key_changed(struct cache_dict_transaction_context *ctx,
+				   const char *key)
+{
+	struct cache_dict *dict = (struct cache_dict *)ctx->ctx.dict;
+	char *key_dup = i_strdup(key);
+
+	cache_dict_invalidate(dict, key);
+	array_push_back(&ctx->changed_keys, &key_dup);
+}
+
+static void
+cache_dict_commit_callback(const struct dict_commit_result *result,
+			   void *context)
+{
+	struct cache_dict_commit_context *cctx = context;
+	char *const *keyp;
+
+	/* lookups done while the commit was running may have cached the old
+	   values. drop them regardless of whether the commit succeeded. */
+	array_foreach(&cctx->changed_keys, keyp)
+		cache_dict_invalidate(cctx->dict, *keyp);
+	cctx->callback(result, cctx->context);
+	cache_dict_changed_keys_free(&cctx->changed_keys);
+	i_free(cctx);
+}
+
+static void
+cache_dict_transaction_commit(struct dict_transaction_context *_ctx,
+			      bool async,
+			      dict_transaction_commit_callback_t *callback,
+			      void *context)
+{
+	struct cache_dict_transaction_context *ctx =
+		(struct cache_dict_transaction_context *)_ctx;
+	struct cache_dict_commit_context *cctx;
+
+	cctx = i_new(struct cache_dict_commit_context, 1);
+	cctx->dict = (struct cache_dict *)_ctx->dict;
+	cctx->changed_keys = ctx->changed_keys;
+	cctx->callback = callback;
+	cctx->context = context;
+
+	if (async) {
+		dict_transaction_commit_async(&ctx->child,
+					      cache_dict_commit_callback, cctx);
+	} else {
+		struct dict_commit_result result;
+		int ret;
+
+		i_zero(&result);
+		ret = dict_transaction_commit(&ctx->child, &result.error);
+		result.ret = ret;
+		cache_dict_commit_callback(&result, cctx);
+	}
+	i_free(ctx);
+}
+
+static void
+cache_dict_transaction_rollback(struct dict_transaction_context *_ctx)
+{
+	struct cache_dict_transaction_context *ctx =
+		(struct cache_dict_transaction_context *)_ctx;
+
+	dict_transaction_rollback(&ctx->child);
+	cache_dict_changed_keys_free(&ctx->changed_keys);
+	i_free(ctx);
+}
+
+static void cache_dict_set(struct dict_transaction_context *_ctx,
+			   const char *key, const char *value)
+{
+	struct cache_dict_transaction_context *ctx =
+		(struct cache_dict_transaction_context *)_ctx;
+
+	cache_dict_transaction_key_changed(ctx, key);
+	dict_set(ctx->child, key, value);
+}
+
+static void cache_dict_unset(struct dict_transaction_context *_ctx,
+			     const char *key)
+{
+	struct cache_dict_transaction_context *ctx =
+		(struct cache_dict_transaction_context *)_ctx;
+
+	cache_dict_transaction_key_changed(ctx, key);
+	dict_unset(ctx->child, key);
+}
+
+static void cache_dict_atomic_inc(struct dict_transaction_context *_ctx,
+				  const char *key, long long diff)
+{
+	struct cache_dict_transaction_context *ctx =
+		(struct cache_dict_transaction_context *)_ctx;
+
+	cache_dict_transaction_key_changed(ctx, key);
+	dict_atomic_inc(ctx->child, key, diff);
+}
+
+static void
+cache_dict_set_timestamp(struct dict_transaction_context *_ctx,
+			 const struct timespec *ts)
+{
+	struct cache_dict_transaction_context *ctx =
+		(struct cache_dict_transaction_context *)_ctx;
+
+	dict_transaction_set_timestamp(ctx->child, ts);
+}
+
+struct dict dict_driver_cache = {
+	.name = "cache",
+	{
+		.init = cache_dict_init,
+		.deinit = cache_dict_deinit,
+		.wait = cache_dict_wait,
+		.lookup = cache_dict_lookup,
+		.iterate_init = cache_dict_iterate_init,
+		.transaction_init = cache_dict_transaction_init,
+		.transaction_commit = cache_dict_transaction_commit,
+		.transaction_rollback = cache_dict_transaction_rollback,
+		.set = cache_dict_set,
+		.unset = cache_dict_unset,
+		.atomic_inc = cache_dict_atomic_inc,
+		.lookup_async = cache_dict_lookup_async,
+		.switch_ioloop = cache_dict_switch_ioloop,
+		.set_timestamp = cache_dict_set_timestamp,
+	}
+};
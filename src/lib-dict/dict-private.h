@@ -78,6 +78,8 @@ struct dict_transaction_context {
 void dict_transaction_commit_async_noop_callback(
 	const struct dict_commit_result *result, void *context);
 
+extern struct dict dict_driver_cache;
+extern struct dict dict_driver_shard;
 extern struct dict dict_driver_client;
 extern struct dict dict_driver_file;
 extern struct dict dict_driver_fs;
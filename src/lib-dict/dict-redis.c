@@ -564,10 +564,12 @@ static int redis_dict_lookup(struct dict *_dict, pool_t pool, const char *key,
 		}
 
 		if (dict->connected) {
+			o_stream_cork(dict->conn.conn.output);
 			redis_dict_select_db(dict);
 			cmd = t_strdup_printf("*2\r\n$3\r\nGET\r\n$%d\r\n%s\r\n",
 					      (int)strlen(key), key);
 			o_stream_nsend_str(dict->conn.conn.output, cmd);
+			o_stream_uncork(dict->conn.conn.output);
 
 			str_truncate(dict->conn.last_reply, 0);
 			redis_input_state_add(dict, REDIS_INPUT_STATE_GET);
@@ -651,6 +653,8 @@ redis_transaction_commit(struct dict_transaction_context *_ctx, bool async,
 
 		o_stream_nsend_str(dict->conn.conn.output,
 				   "*1\r\n$4\r\nEXEC\r\n");
+		/* send the whole MULTI..EXEC in one go */
+		o_stream_uncork(dict->conn.conn.output);
 		reply = array_append_space(&dict->replies);
 		reply->callback = callback;
 		reply->context = context;
@@ -685,6 +689,7 @@ static void redis_transaction_rollback(struct dict_transaction_context *_ctx)
 	} else if (_ctx->changed) {
 		o_stream_nsend_str(dict->conn.conn.output,
 				   "*1\r\n$7\r\nDISCARD\r\n");
+		o_stream_uncork(dict->conn.conn.output);
 		reply = array_append_space(&dict->replies);
 		reply->reply_count = 1;
 		redis_input_state_add(dict, REDIS_INPUT_STATE_DISCARD);
@@ -706,6 +711,10 @@ static int redis_check_transaction(struct redis_dict_transaction_context *ctx)
 	if (ctx->ctx.changed)
 		return 0;
 
+	/* The commands are buffered until EXEC or DISCARD, so that the
+	   whole transaction is pipelined to the server with a minimal
+	   number of writes. */
+	o_stream_cork(dict->conn.conn.output);
 	redis_input_state_add(dict, REDIS_INPUT_STATE_MULTI);
 	if (o_stream_send_str(dict->conn.conn.output,
 			      "*1\r\n$5\r\nMULTI\r\n") < 0) {
@@ -0,0 +1,409 @@
+/* Copyright (c) 2018 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "hash.h"
+#include "dict-private.h"
+
+/* URI: shard:<uri>;<uri>[;<uri>...]
+   Each key is always routed to the same dict, selected by a hash of the key
+   (and the username for private keys). With proxy dicts pointing to
+   separate dict services this keeps all the changes for a key within a
+   single dict process, while the load is spread across all of them.
+
+   Transactions are split into per-shard transactions, so they're atomic
+   only within each shard. Iterations go through the shards one after
+   another, so with sorting flags the results are sorted only within each
+   shard. */
+
+struct shard_dict {
+	struct dict dict;
+	char *username;
+
+	ARRAY(struct dict *) shards;
+};
+
+struct shard_dict_iterate_context {
+	struct dict_iterate_context ctx;
+	pool_t pool;
+
+	const char *const *paths;
+	enum dict_iterate_flags flags;
+
+	unsigned int shard_idx;
+	struct dict_iterate_context *child;
+	char *error;
+};
+
+struct shard_dict_transaction_context {
+	struct dict_transaction_context ctx;
+
+	/* indexed by shard, NULL if the shard isn't changed */
+	ARRAY(struct dict_transaction_context *) children;
+};
+
+struct shard_dict_commit_context {
+	unsigned int pending;
+	enum dict_commit_ret ret;
+	char *error;
+
+	dict_transaction_commit_callback_t *callback;
+	void *context;
+};
+
+static int
+shard_dict_init(struct dict *driver, const char *uri,
+		const struct dict_settings *set,
+		struct dict **dict_r, const char **error_r)
+{
+	struct shard_dict *dict;
+	const char *const *uris, *error;
+	struct dict *child;
+	unsigned int i, count;
+
+	uris = t_strsplit(uri, ";");
+	count = str_array_length(uris);
+	if (count == 0 || uris[0][0] == '\0') {
+		*error_r = "No dicts given";
+		return -1;
+	}
+
+	dict = i_new(struct shard_dict, 1);
+	dict->dict = *driver;
+	dict->username = i_strdup(set->username);
+	i_array_init(&dict->shards, count);
+	*dict_r = &dict->dict;
+
+	for (i = 0; i < count; i++) {
+		if (dict_init(uris[i], set, &child, &error) < 0) {
+			*error_r = t_strdup_printf("shard %u: %s", i, error);
+			dict->dict.v.deinit(&dict->dict);
+			*dict_r = NULL;
+			return -1;
+		}
+		array_push_back(&dict->shards, &child);
+	}
+	return 0;
+}
+
+static void shard_dict_deinit(struct dict *_dict)
+{
+	struct shard_dict *dict = (struct shard_dict *)_dict;
+	struct dict **childp;
+
+	array_foreach_modifiable(&dict->shards, childp)
+		dict_deinit(childp);
+	array_free(&dict->shards);
+	i_free(dict->username);
+	i_free(dict);
+}
+
+static unsigned int
+shard_dict_get_idx(struct shard_dict *dict, const char *key)
+{
+	unsigned int hash = str_hash(key);
+
+	if (str_begins(key, DICT_PATH_PRIVATE)) {
+		/* spread the same private key of different users
+		   across the shards */
+		hash = hash * 31 + str_hash(dict->username);
+	}
+	return hash % array_count(&dict->shards);
+}
+
+static struct dict *shard_dict_get(struct shard_dict *dict, const char *key)
+{
+	return *array_idx(&dict->shards, shard_dict_get_idx(dict, key));
+}
+
+static void shard_dict_wait(struct dict *_dict)
+{
+	struct shard_dict *dict = (struct shard_dict *)_dict;
+	struct dict *const *childp;
+
+	array_foreach(&dict->shards, childp)
+		dict_wait(*childp);
+}
+
+static bool shard_dict_switch_ioloop(struct dict *_dict)
+{
+	struct shard_dict *dict = (struct shard_dict *)_dict;
+	struct dict *const *childp;
+	bool ret = FALSE;
+
+	array_foreach(&dict->shards, childp) {
+		if (dict_switch_ioloop(*childp))
+			ret = TRUE;
+	}
+	return ret;
+}
+
+static int shard_dict_lookup(struct dict *_dict, pool_t pool, const char *key,
+			     const char **value_r, const char **error_r)
+{
+	struct shard_dict *dict = (struct shard_dict *)_dict;
+
+	return dict_lookup(shard_dict_get(dict, key), pool, key,
+			   value_r, error_r);
+}
+
+static void
+shard_dict_lookup_async(struct dict *_dict, const char *key,
+			dict_lookup_callback_t *callback, void *context)
+{
+	struct shard_dict *dict = (struct shard_dict *)_dict;
+
+	dict_lookup_async(shard_dict_get(dict, key), key, callback, context);
+}
+
+static void shard_dict_iterate_async_callback(void *context)
+{
+	struct shard_dict_iterate_context *ctx = context;
+
+	ctx->ctx.async_callback(ctx->ctx.async_context);
+}
+
+static void
+shard_dict_iterate_child_init(struct shard_dict_iterate_context *ctx)
+{
+	struct shard_dict *dict = (struct shard_dict *)ctx->ctx.dict;
+	struct dict *child = *array_idx(&dict->shards, ctx->shard_idx);
+
+	ctx->child = dict_iterate_init_multiple(child, ctx->paths, ctx->flags);
+	if ((ctx->flags & DICT_ITERATE_FLAG_ASYNC) != 0) {
+		dict_iterate_set_async_callback(ctx->child,
+			shard_dict_iterate_async_callback, ctx);
+	}
+}
+
+static struct dict_iterate_context *
+shard_dict_iterate_init(struct dict *_dict, const char *const *paths,
+			enum dict_iterate_flags flags)
+{
+	struct shard_dict_iterate_context *ctx;
+	pool_t pool;
+
+	pool = pool_alloconly_create("shard dict iterate", 256);
+	ctx = p_new(pool, struct shard_dict_iterate_context, 1);
+	ctx->ctx.dict = _dict;
+	ctx->ctx.has_more = TRUE;
+	ctx->pool = pool;
+	ctx->paths = p_strarray_dup(pool, paths);
+	ctx->flags = flags;
+	shard_dict_iterate_child_init(ctx);
+	return &ctx->ctx;
+}
+
+static bool shard_dict_iterate(struct dict_iterate_context *_ctx,
+			       const char **key_r, const char **value_r)
+{
+	struct shard_dict_iterate_context *ctx =
+		(struct shard_dict_iterate_context *)_ctx;
+	struct shard_dict *dict = (struct shard_dict *)_ctx->dict;
+	const char *error;
+
+	while (ctx->child != NULL) {
+		if (dict_iterate(ctx->child, key_r, value_r))
+			return TRUE;
+		if (dict_iterate_has_more(ctx->child)) {
+			/* waiting for more async results */
+			return FALSE;
+		}
+		if (dict_iterate_deinit(&ctx->child, &error) < 0) {
+			ctx->error = i_strdup(error);
+			break;
+		}
+		if (++ctx->shard_idx < array_count(&dict->shards))
+			shard_dict_iterate_child_init(ctx);
+	}
+	_ctx->has_more = FALSE;
+	return FALSE;
+}
+
+static int shard_dict_iterate_deinit(struct dict_iterate_context *_ctx,
+				     const char **error_r)
+{
+	struct shard_dict_iterate_context *ctx =
+		(struct shard_dict_iterate_context *)_ctx;
+	const char *error;
+	int ret = ctx->error != NULL ? -1 : 0;
+
+	if (ctx->child != NULL) {
+		if (dict_iterate_deinit(&ctx->child, &error) < 0 && ret == 0) {
+			ctx->error = i_strdup(error);
+			ret = -1;
+		}
+	}
+	*error_r = t_strdup(ctx->error);
+	i_free(ctx->error);
+	pool_unref(&ctx->pool);
+	return ret;
+}
+
+static struct dict_transaction_context *
+shard_dict_transaction_init(struct dict *_dict)
+{
+	struct shard_dict *dict = (struct shard_dict *)_dict;
+	struct shard_dict_transaction_context *ctx;
+
+	ctx = i_new(struct shard_dict_transaction_context, 1);
+	ctx->ctx.dict = _dict;
+	i_array_init(&ctx->children, array_count(&dict->shards));
+	return &ctx->ctx;
+}
+
+static struct dict_transaction_context *
+shard_dict_transaction_get(struct shard_dict_transaction_context *ctx,
+			   const char *key)
+{
+	struct shard_dict *dict = (struct shard_dict *)ctx->ctx.dict;
+	struct dict_transaction_context **childp;
+	unsigned int idx = shard_dict_get_idx(dict, key);
+
+	childp = array_idx_get_space(&ctx->children, idx);
+	if (*childp == NULL) {
+		*childp = dict_transaction_begin(
+			*array_idx(&dict->shards, idx));
+		if (ctx->ctx.timestamp.tv_sec != 0) {
+			dict_transaction_set_timestamp(*childp,
+						       &ctx->ctx.timestamp);
+		}
+		if (ctx->ctx.no_slowness_warning)
+			dict_transaction_no_slowness_warning(*childp);
+	}
+	return *childp;
+}
+
+static void
+shard_dict_commit_finish(struct shard_dict_commit_context *cctx)
+{
+	struct dict_commit_result result;
+
+	if (--cctx->pending > 0)
+		return;
+
+	i_zero(&result);
+	result.ret = cctx->ret;
+	result.error = cctx->error;
+	cctx->callback(&result, cctx->context);
+	i_free(cctx->error);
+	i_free(cctx);
+}
+
+static void
+shard_dict_commit_callback(const struct dict_commit_result *result,
+			   void *context)
+{
+	struct shard_dict_commit_context *cctx = context;
+
+	/* return the worst result of all the shards */
+	if (result->ret < cctx->ret) {
+		cctx->ret = result->ret;
+		i_free(cctx->error);
+		cctx->error = i_strdup(result->error);
+	}
+	shard_dict_commit_finish(cctx);
+}
+
+static void
+shard_dict_transaction_commit(struct dict_transaction_context *_ctx,
+			      bool async,
+			      dict_transaction_commit_callback_t *callback,
+			      void *context)
+{
+	struct shard_dict_transaction_context *ctx =
+		(struct shard_dict_transaction_context *)_ctx;
+	struct shard_dict_commit_context *cctx;
+	struct dict_transaction_context **childp;
+
+	cctx = i_new(struct shard_dict_commit_context, 1);
+	cctx->ret = DICT_COMMIT_RET_OK;
+	cctx->callback = callback;
+	cctx->context = context;
+	/* keep the context referenced until all commits are started */
+	cctx->pending = 1;
+
+	array_foreach_modifiable(&ctx->children, childp) {
+		if (*childp == NULL)
+			continue;
+		cctx->pending++;
+		if (async) {
+			dict_transaction_commit_async(childp,
+				shard_dict_commit_callback, cctx);
+		} else {
+			struct dict_commit_result result;
+			int ret;
+
+			i_zero(&result);
+			ret = dict_transaction_commit(childp, &result.error);
+			result.ret = ret;
+			shard_dict_commit_callback(&result, cctx);
+		}
+	}
+	array_free(&ctx->children);
+	i_free(ctx);
+	shard_dict_commit_finish(cctx);
+}
+
+static void
+shard_dict_transaction_rollback(struct dict_transaction_context *_ctx)
+{
+	struct shard_dict_transaction_context *ctx =
+		(struct shard_dict_transaction_context *)_ctx;
+	struct dict_transaction_context **childp;
+
+	array_foreach_modifiable(&ctx->children, childp) {
+		if (*childp != NULL)
+			dict_transaction_rollback(childp);
+	}
+	array_free(&ctx->children);
+	i_free(ctx);
+}
+
+static void shard_dict_set(struct dict_transaction_context *_ctx,
+			   const char *key, const char *value)
+{
+	struct shard_dict_transaction_context *ctx =
+		(struct shard_dict_transaction_context *)_ctx;
+
+	dict_set(shard_dict_transaction_get(ctx, key), key, value);
+}
+
+static void shard_dict_unset(struct dict_transaction_context *_ctx,
+			     const char *key)
+{
+	struct shard_dict_transaction_context *ctx =
+		(struct shard_dict_transaction_context *)_ctx;
+
+	dict_unset(shard_dict_transaction_get(ctx, key), key);
+}
+
+static void shard_dict_atomic_inc(struct dict_transaction_context *_ctx,
+				  const char *key, long long diff)
+{
+	struct shard_dict_transaction_context *ctx =
+		(struct shard_dict_transaction_context *)_ctx;
+
+	dict_atomic_inc(shard_dict_transaction_get(ctx, key), key, diff);
+}
+
+struct dict dict_driver_shard = {
+	.name = "shard",
+	{
+		.init = shard_dict_init,
+		.deinit = shard_dict_deinit,
+		.wait = shard_dict_wait,
+		.lookup = shard_dict_lookup,
+		.iterate_init = shard_dict_iterate_init,
+		.iterate = shard_dict_iterate,
+		.iterate_deinit = shard_dict_iterate_deinit,
+		.transaction_init = shard_dict_transaction_init,
+		.transaction_commit = shard_dict_transaction_commit,
+		.transaction_rollback = shard_dict_transaction_rollback,
+		.set = shard_dict_set,
+		.unset = shard_dict_unset,
+		.atomic_inc = shard_dict_atomic_inc,
+		.lookup_async = shard_dict_lookup_async,
+		.switch_ioloop = shard_dict_switch_ioloop,
+	}
+};
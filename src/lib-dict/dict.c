@@ -145,6 +145,70 @@ void dict_lookup_async(struct dict *dict, const char *key,
 	dict->v.lookup_async(dict, key, callback, context);
 }
 
+struct dict_lookup_multi_context {
+	pool_t pool;
+	const char **values;
+	char *error;
+	unsigned int pending;
+};
+
+struct dict_lookup_multi_key {
+	struct dict_lookup_multi_context *ctx;
+	unsigned int idx;
+};
+
+static void
+dict_lookup_multi_callback(const struct dict_lookup_result *result,
+			   void *context)
+{
+	struct dict_lookup_multi_key *key = context;
+	struct dict_lookup_multi_context *ctx = key->ctx;
+
+	i_assert(ctx->pending > 0);
+	ctx->pending--;
+
+	if (result->ret > 0)
+		ctx->values[key->idx] = p_strdup(ctx->pool, result->value);
+	else if (result->ret < 0 && ctx->error == NULL)
+		ctx->error = i_strdup(result->error);
+}
+
+int dict_lookup_multi(struct dict *dict, pool_t pool,
+		      const char *const *keys, const char *const **values_r,
+		      const char **error_r)
+{
+	struct dict_lookup_multi_context ctx;
+	struct dict_lookup_multi_key *mkeys;
+	unsigned int i, count = str_array_length(keys);
+
+	i_zero(&ctx);
+	ctx.pool = pool;
+	ctx.values = p_new(pool, const char *, count + 1);
+	ctx.pending = count;
+	mkeys = i_new(struct dict_lookup_multi_key, count);
+
+	/* send all the lookups before waiting for any of the replies */
+	for (i = 0; i < count; i++) {
+		i_assert(dict_key_prefix_is_valid(keys[i]));
+		mkeys[i].ctx = &ctx;
+		mkeys[i].idx = i;
+		dict_lookup_async(dict, keys[i],
+				  dict_lookup_multi_callback, &mkeys[i]);
+	}
+	if (ctx.pending > 0)
+		dict_wait(dict);
+	i_assert(ctx.pending == 0);
+	i_free(mkeys);
+
+	if (ctx.error != NULL) {
+		*error_r = t_strdup(ctx.error);
+		i_free(ctx.error);
+		return -1;
+	}
+	*values_r = ctx.values;
+	return 0;
+}
+
 struct dict_iterate_context *
 dict_iterate_init(struct dict *dict, const char *path, 
 		  enum dict_iterate_flags flags)
@@ -100,6 +100,14 @@ int dict_lookup(struct dict *dict, pool_t pool,
 		const char *key, const char **value_r, const char **error_r);
 void dict_lookup_async(struct dict *dict, const char *key,
 		       dict_lookup_callback_t *callback, void *context);
+/* Lookup values for all the NULL-terminated keys. All the lookups are sent
+   before waiting for any replies, so with drivers supporting async lookups
+   (e.g. the proxy) they cost only a single round-trip. values_r[i] is set to
+   the value of keys[i] allocated from pool, or NULL if it's not found.
+   Returns 0 if ok, -1 if any of the lookups failed. */
+int dict_lookup_multi(struct dict *dict, pool_t pool,
+		      const char *const *keys, const char *const **values_r,
+		      const char **error_r);
 
 /* Iterate through all values in a path. flag indicates how iteration
    is carried out */
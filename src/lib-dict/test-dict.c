@@ -36,10 +36,176 @@ static void test_dict_escape(void)
 	test_end();
 }
 
+static int
+test_dict_lookup(struct dict *dict ATTR_UNUSED, pool_t pool,
+		 const char *key, const char **value_r, const char **error_r)
+{
+	if (strcmp(key, "shared/fail") == 0) {
+		*error_r = "lookup failed";
+		return -1;
+	}
+	if (strcmp(key, "shared/missing") == 0) {
+		*value_r = NULL;
+		return 0;
+	}
+	*value_r = p_strconcat(pool, "value:", key, NULL);
+	return 1;
+}
+
+static void test_dict_lookup_multi(void)
+{
+	struct dict dict = {
+		.name = "test",
+		.v = { .lookup = test_dict_lookup },
+	};
+	const char *keys[] = { "shared/a", "shared/missing", "priv/b", NULL };
+	const char *fail_keys[] = { "shared/a", "shared/fail", NULL };
+	const char *const *values, *error;
+
+	test_begin("dict lookup multi");
+	test_assert(dict_lookup_multi(&dict, pool_datastack_create(),
+				      keys, &values, &error) == 0);
+	test_assert_strcmp(values[0], "value:shared/a");
+	test_assert(values[1] == NULL);
+	test_assert_strcmp(values[2], "value:priv/b");
+	test_assert(values[3] == NULL);
+
+	test_assert(dict_lookup_multi(&dict, pool_datastack_create(),
+				      fail_keys, &values, &error) == -1);
+	test_assert_strcmp(error, "lookup failed");
+	test_end();
+}
+
+static unsigned int test_dict_lookup_count;
+
+static int
+test_dict_counting_init(struct dict *driver, const char *uri ATTR_UNUSED,
+			const struct dict_settings *set ATTR_UNUSED,
+			struct dict **dict_r, const char **error_r ATTR_UNUSED)
+{
+	*dict_r = i_new(struct dict, 1);
+	**dict_r = *driver;
+	return 0;
+}
+
+static void test_dict_counting_deinit(struct dict *dict)
+{
+	i_free(dict);
+}
+
+static int
+test_dict_counting_lookup(struct dict *dict, pool_t pool, const char *key,
+			  const char **value_r, const char **error_r)
+{
+	test_dict_lookup_count++;
+	return test_dict_lookup(dict, pool, key, value_r, error_r);
+}
+
+static void test_dict_cache(void)
+{
+	struct dict driver = {
+		.name = "test",
+		.v = {
+			.init = test_dict_counting_init,
+			.deinit = test_dict_counting_deinit,
+			.lookup = test_dict_counting_lookup,
+		},
+	};
+	struct dict_settings set = { .username = "" };
+	struct dict *dict;
+	const char *value, *error;
+
+	test_begin("dict cache");
+	dict_driver_register(&driver);
+	dict_driver_register(&dict_driver_cache);
+	test_assert(dict_init("cache:ttl_secs=10:max_count=2:test:",
+			      &set, &dict, &error) == 0);
+
+	/* repeated lookups are served from the cache */
+	test_assert(dict_lookup(dict, pool_datastack_create(), "shared/a",
+				&value, &error) == 1);
+	test_assert(dict_lookup(dict, pool_datastack_create(), "shared/a",
+				&value, &error) == 1);
+	test_assert_strcmp(value, "value:shared/a");
+	test_assert(test_dict_lookup_count == 1);
+
+	/* not found results are cached as well, but failures aren't */
+	test_assert(dict_lookup(dict, pool_datastack_create(), "shared/missing",
+				&value, &error) == 0);
+	test_assert(dict_lookup(dict, pool_datastack_create(), "shared/missing",
+				&value, &error) == 0);
+	test_assert(value == NULL);
+	test_assert(test_dict_lookup_count == 2);
+	test_assert(dict_lookup(dict, pool_datastack_create(), "shared/fail",
+				&value, &error) == -1);
+	test_assert(dict_lookup(dict, pool_datastack_create(), "shared/fail",
+				&value, &error) == -1);
+	test_assert(test_dict_lookup_count == 4);
+
+	/* adding a third key drops the least recently used one */
+	test_assert(dict_lookup(dict, pool_datastack_create(), "shared/b",
+				&value, &error) == 1);
+	test_assert(test_dict_lookup_count == 5);
+	test_assert(dict_lookup(dict, pool_datastack_create(), "shared/missing",
+				&value, &error) == 0);
+	test_assert(test_dict_lookup_count == 5);
+	test_assert(dict_lookup(dict, pool_datastack_create(), "shared/a",
+				&value, &error) == 1);
+	test_assert(test_dict_lookup_count == 6);
+
+	dict_deinit(&dict);
+	dict_driver_unregister(&dict_driver_cache);
+	dict_driver_unregister(&driver);
+	test_end();
+}
+
+static void test_dict_shard(void)
+{
+	struct dict driver = {
+		.name = "test",
+		.v = {
+			.init = test_dict_counting_init,
+			.deinit = test_dict_counting_deinit,
+			.lookup = test_dict_counting_lookup,
+		},
+	};
+	struct dict_settings set = { .username = "user" };
+	struct dict *dict;
+	const char *value, *error;
+
+	test_begin("dict shard");
+	dict_driver_register(&driver);
+	dict_driver_register(&dict_driver_shard);
+	test_assert(dict_init("shard:test:;nonexistent:", &set,
+			      &dict, &error) == -1);
+	test_assert(strstr(error, "shard 1") != NULL);
+
+	test_assert(dict_init("shard:test:;test:;test:", &set,
+			      &dict, &error) == 0);
+	test_dict_lookup_count = 0;
+	test_assert(dict_lookup(dict, pool_datastack_create(), "shared/a",
+				&value, &error) == 1);
+	test_assert_strcmp(value, "value:shared/a");
+	test_assert(dict_lookup(dict, pool_datastack_create(), "priv/b",
+				&value, &error) == 1);
+	test_assert_strcmp(value, "value:priv/b");
+	test_assert(dict_lookup(dict, pool_datastack_create(), "shared/fail",
+				&value, &error) == -1);
+	test_assert(test_dict_lookup_count == 3);
+	dict_deinit(&dict);
+
+	dict_driver_unregister(&dict_driver_shard);
+	dict_driver_unregister(&driver);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_dict_escape,
+		test_dict_lookup_multi,
+		test_dict_cache,
+		test_dict_shard,
 		NULL
 	};
 	return test_run(test_functions);
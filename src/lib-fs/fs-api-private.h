@@ -71,6 +71,9 @@ struct fs_vfuncs {
 
 	bool (*switch_ioloop)(struct fs *fs);
 	int (*get_nlinks)(struct fs_file *file, nlink_t *nlinks_r);
+	/* Optional. fs_delete_bulk() falls back to calling delete_file()
+	   for each file if this is NULL. */
+	int (*delete_bulk)(struct fs_file *const *files, unsigned int count);
 };
 
 struct fs {
@@ -146,18 +149,21 @@ struct fs_iter {
 	struct event *event;
 	enum fs_iter_flags flags;
 	struct timeval start_time;
+	char *path_class;
 
 	bool async_have_more;
 	fs_file_async_callback_t *async_callback;
 	void *async_context;
 };
 
+extern const struct fs fs_class_cache;
 extern const struct fs fs_class_dict;
 extern const struct fs fs_class_posix;
 extern const struct fs fs_class_randomfail;
 extern const struct fs fs_class_metawrap;
 extern const struct fs fs_class_sis;
 extern const struct fs fs_class_sis_queue;
+extern const struct fs fs_class_sis_dict;
 extern const struct fs fs_class_test;
 
 void fs_class_register(const struct fs *fs_class);
@@ -16,6 +16,11 @@
 
 struct fs_api_module_register fs_api_module_register = { 0 };
 
+static const char *fs_op_names[FS_OP_COUNT] = {
+	"wait", "metadata", "prefetch", "read", "write", "lock", "exists",
+	"stat", "copy", "rename", "delete", "iter"
+};
+
 static struct module *fs_modules = NULL;
 static ARRAY(const struct fs *) fs_classes;
 
@@ -68,12 +73,14 @@ static void fs_classes_deinit(void)
 static void fs_classes_init(void)
 {
 	i_array_init(&fs_classes, 8);
+	fs_class_register(&fs_class_cache);
 	fs_class_register(&fs_class_dict);
 	fs_class_register(&fs_class_posix);
 	fs_class_register(&fs_class_randomfail);
 	fs_class_register(&fs_class_metawrap);
 	fs_class_register(&fs_class_sis);
 	fs_class_register(&fs_class_sis_queue);
+	fs_class_register(&fs_class_sis_dict);
 	fs_class_register(&fs_class_test);
 	lib_atexit(fs_classes_deinit);
 }
@@ -438,9 +445,21 @@ static void fs_file_timing_start(struct fs_file *file, enum fs_op op)
 	}
 }
 
+static const char *fs_path_get_class(const char *path)
+{
+	const char *p;
+
+	while (*path == '/')
+		path++;
+	p = strchr(path, '/');
+	return p == NULL ? "" : t_strdup_until(path, p);
+}
+
 static void
-fs_timing_end(struct stats_dist **timing, const struct timeval *start_tv)
+fs_timing_end(struct fs *fs, struct event *event, enum fs_op op,
+	      const char *path_class, const struct timeval *start_tv)
 {
+	struct stats_dist **timing = &fs->stats.timings[op];
 	struct timeval now;
 	long long diff;
 
@@ -453,6 +472,15 @@ fs_timing_end(struct stats_dist **timing, const struct timeval *start_tv)
 			*timing = stats_dist_init();
 		stats_dist_add(*timing, diff);
 	}
+
+	struct event_passthrough *e =
+		event_create_passthrough(event)->
+		set_name("fs_op_finished")->
+		add_str("op", fs_op_names[op])->
+		add_str("driver", fs->name)->
+		add_str("path_class", path_class)->
+		add_int("duration_usecs", diff);
+	e_debug(e->event(), "%s finished in %lld usecs", fs_op_names[op], diff);
 }
 
 void fs_file_timing_end(struct fs_file *file, enum fs_op op)
@@ -460,7 +488,11 @@ void fs_file_timing_end(struct fs_file *file, enum fs_op op)
 	if (!file->fs->set.enable_timing || file->timing_start[op].tv_sec == 0)
 		return;
 
-	fs_timing_end(&file->fs->stats.timings[op], &file->timing_start[op]);
+	T_BEGIN {
+		fs_timing_end(file->fs, file->event, op,
+			      fs_path_get_class(file->path),
+			      &file->timing_start[op]);
+	} T_END;
 	/* don't count this again */
 	file->timing_start[op].tv_sec = 0;
 }
@@ -576,7 +608,9 @@ ssize_t fs_read_via_stream(struct fs_file *file, void *buf, size_t size)
 		file->pending_read_input = fs_read_stream(file, size+1);
 	ret = i_stream_read_bytes(file->pending_read_input, &data,
 				  &data_size, size);
-	if (ret == 0) {
+	if (ret == 0 && !file->pending_read_input->eof) {
+		/* 0 is returned also when EOF was reached after reading
+		   some data, i.e. the file is smaller than size */
 		fs_set_error_async(file->fs);
 		return -1;
 	}
@@ -1110,6 +1144,80 @@ int fs_delete(struct fs_file *file)
 	return ret;
 }
 
+static int fs_default_delete_bulk(struct fs_file *const *files,
+				  unsigned int count)
+{
+	struct fs *fs = files[0]->fs;
+	bool *pending;
+	const char *first_error = NULL;
+	int first_errno = 0;
+	unsigned int i, pending_count = count;
+
+	/* Start deleting all the files. Files opened with FS_OPEN_FLAG_ASYNC
+	   return EAGAIN, so their deletions run in parallel. */
+	pending = t_new(bool, count);
+	for (i = 0; i < count; i++)
+		pending[i] = TRUE;
+	for (;;) {
+		for (i = 0; i < count; i++) {
+			if (!pending[i])
+				continue;
+			if (fs_delete(files[i]) < 0) {
+				if (errno == EAGAIN)
+					continue;
+				if (first_error == NULL) {
+					first_errno = errno;
+					first_error = t_strdup(
+						fs_file_last_error(files[i]));
+				}
+			}
+			pending[i] = FALSE;
+			pending_count--;
+		}
+		if (pending_count == 0)
+			break;
+		fs_wait_async(fs);
+	}
+	if (first_error == NULL)
+		return 0;
+	/* a later failure may have overwritten the first error */
+	fs_set_error(fs, "%s", first_error);
+	errno = first_errno;
+	return -1;
+}
+
+int fs_delete_bulk(struct fs_file *const *files, unsigned int count)
+{
+	struct fs *fs;
+	unsigned int i;
+	int ret;
+
+	if (count == 0)
+		return 0;
+	fs = files[0]->fs;
+	for (i = 0; i < count; i++) {
+		i_assert(files[i]->fs == fs);
+		i_assert(!files[i]->writing_stream);
+	}
+
+	if (fs->v.delete_bulk == NULL) {
+		T_BEGIN {
+			ret = fs_default_delete_bulk(files, count);
+		} T_END;
+		return ret;
+	}
+
+	for (i = 0; i < count; i++)
+		fs_file_timing_start(files[i], FS_OP_DELETE);
+	T_BEGIN {
+		ret = fs->v.delete_bulk(files, count);
+	} T_END;
+	fs->stats.delete_count += count;
+	for (i = 0; i < count; i++)
+		fs_file_timing_end(files[i], FS_OP_DELETE);
+	return ret;
+}
+
 struct fs_iter *
 fs_iter_init(struct fs *fs, const char *path, enum fs_iter_flags flags)
 {
@@ -1142,6 +1250,9 @@ fs_iter_init_with_event(struct fs *fs, struct event *event,
 		fs->v.iter_init(iter, path, flags);
 	} T_END;
 	iter->start_time = now;
+	/* the iterated path itself is a directory */
+	iter->path_class = i_strdup(fs_path_get_class(
+		t_strconcat(path, "/", NULL)));
 	DLLIST_PREPEND(&fs->iters, iter);
 	return iter;
 }
@@ -1150,12 +1261,14 @@ int fs_iter_deinit(struct fs_iter **_iter)
 {
 	struct fs_iter *iter = *_iter;
 	struct event *event;
+	char *path_class;
 	int ret;
 
 	if (iter == NULL)
 		return 0;
 
 	event = iter->event;
+	path_class = iter->path_class;
 
 	*_iter = NULL;
 	DLLIST_REMOVE(&iter->fs->iters, iter);
@@ -1168,6 +1281,7 @@ int fs_iter_deinit(struct fs_iter **_iter)
 		ret = iter->fs->v.iter_deinit(iter);
 	} T_END;
 	event_unref(&event);
+	i_free(path_class);
 	return ret;
 }
 
@@ -1185,7 +1299,9 @@ const char *fs_iter_next(struct fs_iter *iter)
 		/* first result returned - count this as the finish time, since
 		   we don't want to count the time caller spends on this
 		   iteration. */
-		fs_timing_end(&iter->fs->stats.timings[FS_OP_ITER], &iter->start_time);
+		fs_timing_end(iter->fs, iter->event != NULL ? iter->event :
+			      iter->fs->event, FS_OP_ITER, iter->path_class,
+			      &iter->start_time);
 		/* don't count this again */
 		iter->start_time.tv_sec = 0;
 	}
@@ -1210,6 +1326,12 @@ const struct fs_stats *fs_get_stats(struct fs *fs)
 	return &fs->stats;
 }
 
+const char *fs_op_get_name(enum fs_op op)
+{
+	i_assert(op < FS_OP_COUNT);
+	return fs_op_names[op];
+}
+
 void fs_set_error(struct fs *fs, const char *fmt, ...)
 {
 	va_list args;
@@ -191,8 +191,10 @@ struct fs_stats {
 	/* Number of bytes written by fs_write*() calls. */
 	uint64_t write_bytes;
 
-	/* Cumulative sum of usecs spent on calls - set only if
-	   fs_settings.enable_timing=TRUE */
+	/* Distribution of usecs spent on calls - set only if
+	   fs_settings.enable_timing=TRUE. Each finished call also sends a
+	   "fs_op_finished" event with op, driver, path_class (the path's first
+	   directory) and duration_usecs fields. */
 	struct stats_dist *timings[FS_OP_COUNT];
 };
 
@@ -320,6 +322,13 @@ bool fs_switch_ioloop(struct fs *fs) ATTR_NOWARN_UNUSED_RESULT;
 int fs_exists(struct fs_file *file);
 /* Delete a file. Returns 0 if file was actually deleted by us, -1 if error. */
 int fs_delete(struct fs_file *file);
+/* Delete multiple files, which must all belong to the same fs. Drivers may
+   implement this more efficiently than separate fs_delete() calls, e.g. by
+   sending the requests in parallel. Otherwise files opened with
+   FS_OPEN_FLAG_ASYNC are deleted in parallel and the rest one by one. Returns
+   0 if all the files were deleted, -1 if any of them failed. In that case
+   fs_last_error() and errno contain the first failure. */
+int fs_delete_bulk(struct fs_file *const *files, unsigned int count);
 
 /* Returns 0 if ok, -1 if error occurred (e.g. errno=ENOENT).
    All fs backends may not support all stat fields. */
@@ -371,6 +380,9 @@ bool fs_iter_have_more(struct fs_iter *iter);
    filesystem whose stats you want to see. */
 const struct fs_stats *fs_get_stats(struct fs *fs);
 
+/* Returns the operation's name, e.g. "read". */
+const char *fs_op_get_name(enum fs_op op);
+
 /* Helper functions to count number of usecs for read/write operations. */
 uint64_t fs_stats_get_read_usecs(const struct fs_stats *stats);
 uint64_t fs_stats_get_write_usecs(const struct fs_stats *stats);
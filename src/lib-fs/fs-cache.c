@@ -0,0 +1,658 @@
+/* Copyright (c) 2018 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "str.h"
+#include "hex-binary.h"
+#include "md5.h"
+#include "ioloop.h"
+#include "istream.h"
+#include "ostream.h"
+#include "file-lock.h"
+#include "mkdir-parents.h"
+#include "safe-mkstemp.h"
+#include "fs-api-private.h"
+
+#include <stdio.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+
+/* Cached objects are spread into this many shard directories. Each shard
+   has its own index file containing the shard's total size. */
+#define FS_CACHE_SHARD_COUNT 16
+#define FS_CACHE_INDEX_FNAME ".index"
+#define FS_CACHE_TEMP_PREFIX ".temp."
+#define FS_CACHE_LOCK_TIMEOUT_SECS 30
+/* Update cached file's mtime on access only this often */
+#define FS_CACHE_TOUCH_INTERVAL_SECS 60
+/* Delete temp files left behind by crashed processes after this long */
+#define FS_CACHE_TEMP_STALE_SECS 3600
+/* Objects larger than 1/n of the shard size aren't cached */
+#define FS_CACHE_MAX_OBJECT_SIZE_DIVISOR 4
+
+struct cache_fs {
+	struct fs fs;
+	char *cache_dir;
+	uoff_t shard_max_size;
+};
+
+struct cache_fs_file {
+	struct fs_file file;
+	struct cache_fs *fs;
+	char *shard_dir, *cache_path;
+
+	/* write-through: the data is first written to a temp file in the
+	   cache, which is then sent to the parent */
+	string_t *temp_path;
+	int temp_fd;
+	struct ostream *super_output;
+	bool writing:1;
+};
+
+struct fs_cache_entry {
+	const char *path;
+	time_t mtime;
+	off_t size;
+};
+
+static struct fs *fs_cache_alloc(void)
+{
+	struct cache_fs *fs;
+
+	fs = i_new(struct cache_fs, 1);
+	fs->fs = fs_class_cache;
+	return &fs->fs;
+}
+
+static int fs_cache_parse_size(const char *str, uoff_t *size_r)
+{
+	const char *end;
+	uoff_t multiply = 1;
+
+	if (str_parse_uoff(str, size_r, &end) < 0)
+		return -1;
+	switch (*end) {
+	case '\0':
+		return 0;
+	case 'k':
+	case 'K':
+		multiply = 1024;
+		break;
+	case 'm':
+	case 'M':
+		multiply = 1024*1024;
+		break;
+	case 'g':
+	case 'G':
+		multiply = 1024*1024*1024;
+		break;
+	default:
+		return -1;
+	}
+	if (end[1] != '\0' || *size_r > (uoff_t)-1 / multiply)
+		return -1;
+	*size_r *= multiply;
+	return 0;
+}
+
+static int
+fs_cache_init(struct fs *_fs, const char *args, const struct fs_settings *set)
+{
+	struct cache_fs *fs = (struct cache_fs *)_fs;
+	const char *p, *size_str, *parent_name, *parent_args, *error;
+	uoff_t max_size;
+
+	/* <max size>:<cache dir>:<parent fs>[:<args>] */
+	p = strchr(args, ':');
+	if (p == NULL) {
+		fs_set_error(_fs, "Cache size not given as parameter");
+		return -1;
+	}
+	size_str = t_strdup_until(args, p++);
+	if (fs_cache_parse_size(size_str, &max_size) < 0 || max_size == 0) {
+		fs_set_error(_fs, "Invalid cache size '%s'", size_str);
+		return -1;
+	}
+	fs->shard_max_size = max_size / FS_CACHE_SHARD_COUNT;
+	args = p;
+
+	p = strchr(args, ':');
+	if (p == NULL || p[1] == '\0') {
+		fs_set_error(_fs, "Parent filesystem not given as parameter");
+		return -1;
+	}
+	fs->cache_dir = i_strdup_until(args, p++);
+	args = p;
+
+	parent_args = strchr(args, ':');
+	if (parent_args == NULL) {
+		parent_name = args;
+		parent_args = "";
+	} else {
+		parent_name = t_strdup_until(args, parent_args);
+		parent_args++;
+	}
+	if (fs_init(parent_name, parent_args, set, &_fs->parent, &error) < 0) {
+		fs_set_error(_fs, "%s: %s", parent_name, error);
+		return -1;
+	}
+	return 0;
+}
+
+static void fs_cache_deinit(struct fs *_fs)
+{
+	struct cache_fs *fs = (struct cache_fs *)_fs;
+
+	fs_deinit(&_fs->parent);
+	i_free(fs->cache_dir);
+	i_free(fs);
+}
+
+static struct fs_file *fs_cache_file_alloc(void)
+{
+	struct cache_fs_file *file = i_new(struct cache_fs_file, 1);
+	return &file->file;
+}
+
+static void fs_cache_file_update_path(struct cache_fs_file *file)
+{
+	unsigned char digest[MD5_RESULTLEN];
+	const char *path, *hash;
+
+	/* FS_OPEN_MODE_CREATE_UNIQUE_128 and FS_METADATA_WRITE_FNAME change
+	   the path, so the cache path is based on the parent's path. */
+	path = fs_file_path(file->file.parent);
+	md5_get_digest(path, strlen(path), digest);
+	hash = binary_to_hex(digest, sizeof(digest));
+
+	i_free(file->shard_dir);
+	i_free(file->cache_path);
+	file->shard_dir = i_strdup_printf("%s/%c", file->fs->cache_dir, hash[0]);
+	file->cache_path = i_strdup_printf("%s/%s", file->shard_dir, hash);
+}
+
+static void
+fs_cache_file_init(struct fs_file *_file, const char *path,
+		   enum fs_open_mode mode, enum fs_open_flags flags)
+{
+	struct cache_fs_file *file = (struct cache_fs_file *)_file;
+
+	file->file.path = i_strdup(path);
+	file->fs = (struct cache_fs *)_file->fs;
+	file->temp_fd = -1;
+	file->file.parent = fs_file_init_parent(_file, path, mode | flags);
+	fs_cache_file_update_path(file);
+}
+
+static void fs_cache_write_cleanup(struct cache_fs_file *file)
+{
+	if (file->temp_fd != -1) {
+		if (unlink(str_c(file->temp_path)) < 0 && errno != ENOENT) {
+			e_error(file->file.event, "unlink(%s) failed: %m",
+				str_c(file->temp_path));
+		}
+		i_close_fd(&file->temp_fd);
+	}
+	str_free(&file->temp_path);
+}
+
+static void fs_cache_file_deinit(struct fs_file *_file)
+{
+	struct cache_fs_file *file = (struct cache_fs_file *)_file;
+
+	fs_cache_write_cleanup(file);
+	fs_file_deinit(&_file->parent);
+	i_free(file->shard_dir);
+	i_free(file->cache_path);
+	i_free(file->file.path);
+	i_free(file);
+}
+
+static int fs_cache_entry_cmp(const struct fs_cache_entry *e1,
+			      const struct fs_cache_entry *e2)
+{
+	if (e1->mtime < e2->mtime)
+		return -1;
+	if (e1->mtime > e2->mtime)
+		return 1;
+	return 0;
+}
+
+/* Scan the shard and delete the least recently used files until it's
+   below 90% of its maximum size. Returns the new size of the shard. */
+static uoff_t fs_cache_shard_evict(struct cache_fs *fs, const char *shard_dir)
+{
+	ARRAY(struct fs_cache_entry) entries;
+	struct fs_cache_entry *entry;
+	struct dirent *d;
+	struct stat st;
+	const char *path;
+	uoff_t total = 0, target_size;
+	DIR *dir;
+
+	if ((dir = opendir(shard_dir)) == NULL) {
+		if (errno != ENOENT)
+			i_error("opendir(%s) failed: %m", shard_dir);
+		return 0;
+	}
+	t_array_init(&entries, 128);
+	while ((d = readdir(dir)) != NULL) {
+		if (d->d_name[0] == '.' &&
+		    !str_begins(d->d_name, FS_CACHE_TEMP_PREFIX))
+			continue;
+		path = t_strdup_printf("%s/%s", shard_dir, d->d_name);
+		if (stat(path, &st) < 0) {
+			if (errno != ENOENT)
+				i_error("stat(%s) failed: %m", path);
+			continue;
+		}
+		if (d->d_name[0] == '.') {
+			/* temp file */
+			if (st.st_mtime < ioloop_time - FS_CACHE_TEMP_STALE_SECS &&
+			    unlink(path) < 0 && errno != ENOENT)
+				i_error("unlink(%s) failed: %m", path);
+			continue;
+		}
+		entry = array_append_space(&entries);
+		entry->path = path;
+		entry->mtime = st.st_mtime;
+		entry->size = st.st_size;
+		total += st.st_size;
+	}
+	if (closedir(dir) < 0)
+		i_error("closedir(%s) failed: %m", shard_dir);
+
+	if (total <= fs->shard_max_size)
+		return total;
+
+	target_size = fs->shard_max_size / 10 * 9;
+	array_sort(&entries, fs_cache_entry_cmp);
+	array_foreach_modifiable(&entries, entry) {
+		if (total <= target_size)
+			break;
+		if (unlink(entry->path) < 0 && errno != ENOENT) {
+			i_error("unlink(%s) failed: %m", entry->path);
+			continue;
+		}
+		total -= entry->size;
+	}
+	return total;
+}
+
+/* Add diff bytes to the shard's size, evicting files if it grows too
+   large. The shard index is locked, so this is safe with multiple
+   processes sharing the same cache. */
+static void
+fs_cache_shard_update(struct cache_fs *fs, const char *shard_dir,
+		      int64_t diff)
+{
+	struct file_lock *lock;
+	const char *index_path;
+	char buf[MAX_INT_STRLEN + 1];
+	uoff_t total = 0;
+	ssize_t ret;
+	int fd;
+
+	index_path = t_strdup_printf("%s/"FS_CACHE_INDEX_FNAME, shard_dir);
+	fd = open(index_path, O_RDWR | O_CREAT, 0600);
+	if (fd == -1) {
+		i_error("open(%s) failed: %m", index_path);
+		return;
+	}
+	if (file_wait_lock(fd, index_path, F_WRLCK, FILE_LOCK_METHOD_FCNTL,
+			   FS_CACHE_LOCK_TIMEOUT_SECS, &lock) <= 0) {
+		i_close_fd(&fd);
+		return;
+	}
+
+	ret = pread(fd, buf, sizeof(buf)-1, 0);
+	if (ret < 0)
+		i_error("pread(%s) failed: %m", index_path);
+	else {
+		buf[ret] = '\0';
+		if (str_to_uoff(t_strcut(buf, '\n'), &total) < 0)
+			total = 0;
+	}
+	if (diff < 0 && (uoff_t)-diff > total)
+		total = 0;
+	else
+		total += diff;
+	if (total > fs->shard_max_size)
+		total = fs_cache_shard_evict(fs, shard_dir);
+
+	i_snprintf(buf, sizeof(buf), "%"PRIuUOFF_T"\n", total);
+	if (pwrite(fd, buf, strlen(buf), 0) < 0)
+		i_error("pwrite(%s) failed: %m", index_path);
+	else if (ftruncate(fd, strlen(buf)) < 0)
+		i_error("ftruncate(%s) failed: %m", index_path);
+	file_unlock(&lock);
+	i_close_fd(&fd);
+}
+
+static void fs_cache_invalidate(struct cache_fs_file *file)
+{
+	struct stat st;
+
+	if (stat(file->cache_path, &st) < 0) {
+		if (errno != ENOENT) {
+			e_error(file->file.event, "stat(%s) failed: %m",
+				file->cache_path);
+		}
+		return;
+	}
+	if (unlink(file->cache_path) < 0) {
+		if (errno != ENOENT) {
+			e_error(file->file.event, "unlink(%s) failed: %m",
+				file->cache_path);
+		}
+		return;
+	}
+	T_BEGIN {
+		fs_cache_shard_update(file->fs, file->shard_dir, -st.st_size);
+	} T_END;
+}
+
+static int fs_cache_temp_create(struct cache_fs_file *file)
+{
+	string_t *path;
+	int fd;
+
+	path = str_new(default_pool, 128);
+	str_printfa(path, "%s/"FS_CACHE_TEMP_PREFIX, file->shard_dir);
+	fd = safe_mkstemp(path, 0600, (uid_t)-1, (gid_t)-1);
+	if (fd == -1 && errno == ENOENT) {
+		if (mkdir_parents(file->shard_dir, 0700) < 0 &&
+		    errno != EEXIST) {
+			e_error(file->file.event, "mkdir(%s) failed: %m",
+				file->shard_dir);
+			str_free(&path);
+			return -1;
+		}
+		str_truncate(path, 0);
+		str_printfa(path, "%s/"FS_CACHE_TEMP_PREFIX, file->shard_dir);
+		fd = safe_mkstemp(path, 0600, (uid_t)-1, (gid_t)-1);
+	}
+	if (fd == -1) {
+		e_error(file->file.event, "safe_mkstemp(%s) failed: %m",
+			str_c(path));
+		str_free(&path);
+		return -1;
+	}
+	file->temp_path = path;
+	file->temp_fd = fd;
+	return 0;
+}
+
+/* Move the finished temp file to the cache. */
+static void fs_cache_temp_commit(struct cache_fs_file *file)
+{
+	struct stat st, old_st;
+	int64_t diff;
+	int ret;
+
+	if (fstat(file->temp_fd, &st) < 0) {
+		e_error(file->file.event, "fstat(%s) failed: %m",
+			str_c(file->temp_path));
+		fs_cache_write_cleanup(file);
+		fs_cache_invalidate(file);
+		return;
+	}
+	if ((uoff_t)st.st_size > file->fs->shard_max_size /
+	    FS_CACHE_MAX_OBJECT_SIZE_DIVISOR) {
+		/* too large to be cached */
+		fs_cache_write_cleanup(file);
+		fs_cache_invalidate(file);
+		return;
+	}
+
+	/* the path may have changed while writing, in which case the temp
+	   file is in a different shard */
+	fs_cache_file_update_path(file);
+	if (stat(file->cache_path, &old_st) < 0)
+		old_st.st_size = 0;
+	ret = rename(str_c(file->temp_path), file->cache_path);
+	if (ret < 0 && errno == ENOENT &&
+	    mkdir_parents(file->shard_dir, 0700) == 0)
+		ret = rename(str_c(file->temp_path), file->cache_path);
+	if (ret < 0) {
+		e_error(file->file.event, "rename(%s, %s) failed: %m",
+			str_c(file->temp_path), file->cache_path);
+		fs_cache_write_cleanup(file);
+		fs_cache_invalidate(file);
+		return;
+	}
+	diff = st.st_size - old_st.st_size;
+	i_close_fd(&file->temp_fd);
+	str_free(&file->temp_path);
+	T_BEGIN {
+		fs_cache_shard_update(file->fs, file->shard_dir, diff);
+	} T_END;
+}
+
+static struct istream *
+fs_cache_try_open(struct cache_fs_file *file, size_t max_buffer_size)
+{
+	struct istream *input;
+	struct stat st;
+	int fd;
+
+	fd = open(file->cache_path, O_RDONLY);
+	if (fd == -1) {
+		if (errno != ENOENT) {
+			e_error(file->file.event, "open(%s) failed: %m",
+				file->cache_path);
+		}
+		return NULL;
+	}
+	/* the mtime is used for LRU eviction */
+	if (fstat(fd, &st) == 0 &&
+	    st.st_mtime < ioloop_time - FS_CACHE_TOUCH_INTERVAL_SECS &&
+	    utime(file->cache_path, NULL) < 0 && errno != ENOENT) {
+		e_error(file->file.event, "utime(%s) failed: %m",
+			file->cache_path);
+	}
+	input = i_stream_create_fd_autoclose(&fd, max_buffer_size);
+	i_stream_set_name(input, file->file.path);
+	return input;
+}
+
+static struct istream *
+fs_cache_read_stream(struct fs_file *_file, size_t max_buffer_size)
+{
+	struct cache_fs_file *file = (struct cache_fs_file *)_file;
+	struct istream *input, *cache_input;
+	struct ostream *output;
+	uoff_t size;
+
+	if ((input = fs_cache_try_open(file, max_buffer_size)) != NULL)
+		return input;
+
+	input = fs_read_stream(_file->parent, max_buffer_size);
+	if ((_file->flags & FS_OPEN_FLAG_ASYNC) != 0 ||
+	    (i_stream_get_size(input, FALSE, &size) > 0 &&
+	     size > file->fs->shard_max_size /
+	     FS_CACHE_MAX_OBJECT_SIZE_DIVISOR))
+		return input;
+
+	/* copy it to the cache */
+	if (fs_cache_temp_create(file) < 0)
+		return input;
+	output = o_stream_create_fd(file->temp_fd, IO_BLOCK_SIZE);
+	switch (o_stream_send_istream(output, input)) {
+	case OSTREAM_SEND_ISTREAM_RESULT_FINISHED:
+		break;
+	case OSTREAM_SEND_ISTREAM_RESULT_WAIT_INPUT:
+	case OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT:
+		i_unreached();
+	case OSTREAM_SEND_ISTREAM_RESULT_ERROR_INPUT:
+		/* return the stream with the error */
+		o_stream_destroy(&output);
+		fs_cache_write_cleanup(file);
+		return input;
+	case OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT:
+		e_error(_file->event, "write(%s) failed: %s",
+			o_stream_get_name(output), o_stream_get_error(output));
+		o_stream_destroy(&output);
+		fs_cache_write_cleanup(file);
+		i_stream_unref(&input);
+		return fs_read_stream(_file->parent, max_buffer_size);
+	}
+	if (o_stream_finish(output) < 0) {
+		e_error(_file->event, "write(%s) failed: %s",
+			o_stream_get_name(output), o_stream_get_error(output));
+		o_stream_destroy(&output);
+		fs_cache_write_cleanup(file);
+		i_stream_unref(&input);
+		return fs_read_stream(_file->parent, max_buffer_size);
+	}
+	o_stream_destroy(&output);
+	i_stream_unref(&input);
+
+	fs_cache_temp_commit(file);
+	if ((cache_input = fs_cache_try_open(file, max_buffer_size)) != NULL)
+		return cache_input;
+	/* evicted already */
+	return fs_read_stream(_file->parent, max_buffer_size);
+}
+
+static void fs_cache_write_stream(struct fs_file *_file)
+{
+	struct cache_fs_file *file = (struct cache_fs_file *)_file;
+
+	i_assert(_file->output == NULL);
+
+	file->writing = TRUE;
+	if (fs_cache_temp_create(file) < 0) {
+		/* write directly to the parent without caching */
+		fs_cache_invalidate(file);
+		fs_wrapper_write_stream(_file);
+		return;
+	}
+	_file->output = o_stream_create_fd(file->temp_fd, IO_BLOCK_SIZE);
+	o_stream_set_name(_file->output, _file->path);
+}
+
+static int fs_cache_write_stream_finish(struct fs_file *_file, bool success)
+{
+	struct cache_fs_file *file = (struct cache_fs_file *)_file;
+	struct istream *input;
+	int ret;
+
+	if (file->temp_path == NULL) {
+		/* not caching */
+		ret = fs_wrapper_write_stream_finish(_file, success);
+		if (ret != 0)
+			file->writing = FALSE;
+		return ret;
+	}
+
+	if (_file->output != NULL) {
+		if (_file->output->closed)
+			success = FALSE;
+		o_stream_unref(&_file->output);
+		if (!success) {
+			fs_cache_write_cleanup(file);
+			file->writing = FALSE;
+			return -1;
+		}
+
+		/* write-through to the parent */
+		input = i_stream_create_fd(file->temp_fd, IO_BLOCK_SIZE);
+		file->super_output = fs_write_stream(_file->parent);
+		o_stream_nsend_istream(file->super_output, input);
+		i_stream_unref(&input);
+		ret = fs_write_stream_finish(_file->parent, &file->super_output);
+	} else {
+		/* finishing up an asynchronous write */
+		i_assert(success);
+		ret = fs_write_stream_finish_async(_file->parent);
+	}
+	if (ret == 0)
+		return 0;
+
+	if (ret < 0) {
+		fs_cache_write_cleanup(file);
+		fs_cache_invalidate(file);
+	} else {
+		fs_cache_temp_commit(file);
+	}
+	file->writing = FALSE;
+	return ret;
+}
+
+static int fs_cache_exists(struct fs_file *_file)
+{
+	struct cache_fs_file *file = (struct cache_fs_file *)_file;
+
+	if (access(file->cache_path, F_OK) == 0)
+		return 1;
+	return fs_wrapper_exists(_file);
+}
+
+static int fs_cache_copy(struct fs_file *_src, struct fs_file *_dest)
+{
+	struct cache_fs_file *dest = (struct cache_fs_file *)_dest;
+
+	if (_src != NULL)
+		fs_cache_invalidate(dest);
+	return fs_wrapper_copy(_src, _dest);
+}
+
+static int fs_cache_rename(struct fs_file *_src, struct fs_file *_dest)
+{
+	struct cache_fs_file *src = (struct cache_fs_file *)_src;
+	struct cache_fs_file *dest = (struct cache_fs_file *)_dest;
+
+	fs_cache_invalidate(src);
+	fs_cache_invalidate(dest);
+	return fs_wrapper_rename(_src, _dest);
+}
+
+static int fs_cache_delete(struct fs_file *_file)
+{
+	struct cache_fs_file *file = (struct cache_fs_file *)_file;
+
+	fs_cache_invalidate(file);
+	return fs_wrapper_delete(_file);
+}
+
+const struct fs fs_class_cache = {
+	.name = "cache",
+	.v = {
+		fs_cache_alloc,
+		fs_cache_init,
+		fs_cache_deinit,
+		fs_wrapper_get_properties,
+		fs_cache_file_alloc,
+		fs_cache_file_init,
+		fs_cache_file_deinit,
+		fs_wrapper_file_close,
+		fs_wrapper_file_get_path,
+		fs_wrapper_set_async_callback,
+		fs_wrapper_wait_async,
+		fs_wrapper_set_metadata,
+		fs_wrapper_get_metadata,
+		fs_wrapper_prefetch,
+		fs_read_via_stream,
+		fs_cache_read_stream,
+		fs_write_via_stream,
+		fs_cache_write_stream,
+		fs_cache_write_stream_finish,
+		fs_wrapper_lock,
+		fs_wrapper_unlock,
+		fs_cache_exists,
+		fs_wrapper_stat,
+		fs_cache_copy,
+		fs_cache_rename,
+		fs_cache_delete,
+		fs_wrapper_iter_alloc,
+		fs_wrapper_iter_init,
+		fs_wrapper_iter_next,
+		fs_wrapper_iter_deinit,
+		NULL,
+		fs_wrapper_get_nlinks,
+	}
+};
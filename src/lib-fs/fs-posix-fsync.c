@@ -0,0 +1,316 @@
+/* Copyright (c) 2018 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "llist.h"
+#include "fdpass.h"
+#include "fd-util.h"
+#include "write-full.h"
+#include "fs-posix-fsync.h"
+
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#define FS_POSIX_FSYNC_DEFAULT_MAX_FDS 1024
+
+struct fs_posix_fsync_reply {
+	unsigned int id;
+	int error;
+};
+
+struct fs_posix_fsync_request {
+	struct fs_posix_fsync_request *prev, *next;
+
+	unsigned int id;
+	/* NULL if aborted */
+	fs_posix_fsync_callback_t *callback;
+	void *context;
+};
+
+struct fs_posix_fsync_worker {
+	struct fs_posix_fsync *fsync;
+	pid_t pid;
+	int fd;
+	struct io *io;
+
+	/* the worker replies to the requests in the order they were sent */
+	struct fs_posix_fsync_request *requests, *requests_tail;
+	unsigned int request_count;
+
+	unsigned char reply_buf[sizeof(struct fs_posix_fsync_reply)];
+	size_t reply_pos;
+};
+
+struct fs_posix_fsync {
+	struct fs_posix_fsync_worker *workers;
+	unsigned int worker_count;
+	unsigned int next_id;
+
+	struct ioloop *wait_ioloop;
+};
+
+static void ATTR_NORETURN fs_posix_fsync_worker_run(int sock)
+{
+	struct fs_posix_fsync_reply reply;
+	unsigned int id;
+	long max_fd;
+	ssize_t ret;
+	int i, fd;
+
+	/* We're a forked copy of the parent: don't run its signal handlers
+	   or keep its files and client connections open. Only plain system
+	   calls are used from here on. */
+	for (i = 1; i < NSIG; i++)
+		(void)signal(i, SIG_DFL);
+	if ((max_fd = sysconf(_SC_OPEN_MAX)) < 0)
+		max_fd = FS_POSIX_FSYNC_DEFAULT_MAX_FDS;
+	for (fd = 3; fd < max_fd; fd++) {
+		if (fd != sock)
+			(void)close(fd);
+	}
+
+	for (;;) {
+		ret = fd_read(sock, &id, sizeof(id), &fd);
+		if (ret <= 0) {
+			/* parent closed the connection */
+			_exit(0);
+		}
+		if (ret != sizeof(id) || fd == -1)
+			_exit(1);
+
+		i_zero(&reply);
+		reply.id = id;
+		reply.error = fdatasync(fd) < 0 ? errno : 0;
+		(void)close(fd);
+		if (write_full(sock, &reply, sizeof(reply)) < 0)
+			_exit(0);
+	}
+}
+
+static void
+fs_posix_fsync_request_finish(struct fs_posix_fsync_request *req, int error)
+{
+	fs_posix_fsync_callback_t *callback = req->callback;
+	void *context = req->context;
+
+	i_free(req);
+	if (callback != NULL)
+		callback(error, context);
+}
+
+static void
+fs_posix_fsync_worker_destroy(struct fs_posix_fsync_worker *worker, int error)
+{
+	struct fs_posix_fsync_request *req, *next;
+
+	io_remove(&worker->io);
+	if (worker->fd != -1) {
+		/* the worker exits after seeing EOF */
+		i_close_fd(&worker->fd);
+		(void)waitpid(worker->pid, NULL, WNOHANG);
+		worker->pid = -1;
+	}
+	worker->reply_pos = 0;
+
+	/* the callbacks may start new requests to a new worker */
+	req = worker->requests;
+	worker->requests = worker->requests_tail = NULL;
+	worker->request_count = 0;
+	for (; req != NULL; req = next) {
+		next = req->next;
+		if (error == 0)
+			req->callback = NULL;
+		fs_posix_fsync_request_finish(req, error);
+	}
+}
+
+static void fs_posix_fsync_worker_input(struct fs_posix_fsync_worker *worker)
+{
+	struct fs_posix_fsync_request *req;
+	struct fs_posix_fsync_reply reply;
+	ssize_t ret;
+
+	ret = read(worker->fd, worker->reply_buf + worker->reply_pos,
+		   sizeof(worker->reply_buf) - worker->reply_pos);
+	if (ret < 0 && errno == EAGAIN)
+		return;
+	if (ret <= 0) {
+		if (ret < 0)
+			i_error("fs-posix: read(fsync worker) failed: %m");
+		else
+			i_error("fs-posix: fsync worker %ld died unexpectedly",
+				(long)worker->pid);
+		fs_posix_fsync_worker_destroy(worker, EIO);
+		return;
+	}
+	worker->reply_pos += ret;
+	if (worker->reply_pos < sizeof(worker->reply_buf))
+		return;
+	worker->reply_pos = 0;
+	memcpy(&reply, worker->reply_buf, sizeof(reply));
+
+	req = worker->requests;
+	if (req == NULL || req->id != reply.id) {
+		i_error("fs-posix: fsync worker %ld sent unexpected reply %u",
+			(long)worker->pid, reply.id);
+		fs_posix_fsync_worker_destroy(worker, EIO);
+		return;
+	}
+	DLLIST2_REMOVE(&worker->requests, &worker->requests_tail, req);
+	worker->request_count--;
+
+	if (worker->fsync->wait_ioloop != NULL)
+		io_loop_stop(worker->fsync->wait_ioloop);
+	fs_posix_fsync_request_finish(req, reply.error);
+}
+
+static int fs_posix_fsync_worker_spawn(struct fs_posix_fsync_worker *worker)
+{
+	int fds[2];
+	pid_t pid;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+		i_error("fs-posix: socketpair() failed: %m");
+		return -1;
+	}
+	if ((pid = fork()) < 0) {
+		i_error("fs-posix: fork() failed: %m");
+		i_close_fd(&fds[0]);
+		i_close_fd(&fds[1]);
+		return -1;
+	}
+	if (pid == 0) {
+		(void)close(fds[0]);
+		fs_posix_fsync_worker_run(fds[1]);
+	}
+	i_close_fd(&fds[1]);
+	fd_set_nonblock(fds[0], TRUE);
+	fd_close_on_exec(fds[0], TRUE);
+
+	worker->pid = pid;
+	worker->fd = fds[0];
+	worker->io = io_add(worker->fd, IO_READ,
+			    fs_posix_fsync_worker_input, worker);
+	return 0;
+}
+
+struct fs_posix_fsync *fs_posix_fsync_init(unsigned int worker_count)
+{
+	struct fs_posix_fsync *fsync;
+	unsigned int i;
+
+	i_assert(worker_count > 0);
+
+	fsync = i_new(struct fs_posix_fsync, 1);
+	fsync->worker_count = worker_count;
+	fsync->workers = i_new(struct fs_posix_fsync_worker, worker_count);
+	for (i = 0; i < worker_count; i++) {
+		fsync->workers[i].fsync = fsync;
+		fsync->workers[i].pid = -1;
+		fsync->workers[i].fd = -1;
+	}
+	return fsync;
+}
+
+void fs_posix_fsync_deinit(struct fs_posix_fsync **_fsync)
+{
+	struct fs_posix_fsync *fsync = *_fsync;
+	unsigned int i;
+
+	*_fsync = NULL;
+	i_assert(fsync->wait_ioloop == NULL);
+
+	for (i = 0; i < fsync->worker_count; i++)
+		fs_posix_fsync_worker_destroy(&fsync->workers[i], 0);
+	i_free(fsync->workers);
+	i_free(fsync);
+}
+
+#undef fs_posix_fsync_start
+int fs_posix_fsync_start(struct fs_posix_fsync *fsync, int fd,
+			 fs_posix_fsync_callback_t *callback, void *context,
+			 struct fs_posix_fsync_request **req_r)
+{
+	struct fs_posix_fsync_worker *worker = &fsync->workers[0];
+	struct fs_posix_fsync_request *req;
+	unsigned int i, id;
+
+	/* use the least busy worker */
+	for (i = 1; i < fsync->worker_count; i++) {
+		if (fsync->workers[i].request_count < worker->request_count)
+			worker = &fsync->workers[i];
+	}
+	if (worker->fd == -1 && fs_posix_fsync_worker_spawn(worker) < 0)
+		return -1;
+
+	id = ++fsync->next_id;
+	if (fd_send(worker->fd, fd, &id, sizeof(id)) != sizeof(id)) {
+		int send_errno = errno;
+
+		i_error("fs-posix: fd_send(fsync worker) failed: %m");
+		fs_posix_fsync_worker_destroy(worker, EIO);
+		errno = send_errno;
+		return -1;
+	}
+
+	req = i_new(struct fs_posix_fsync_request, 1);
+	req->id = id;
+	req->callback = callback;
+	req->context = context;
+	DLLIST2_APPEND(&worker->requests, &worker->requests_tail, req);
+	worker->request_count++;
+	*req_r = req;
+	return 0;
+}
+
+void fs_posix_fsync_abort(struct fs_posix_fsync_request **_req)
+{
+	struct fs_posix_fsync_request *req = *_req;
+
+	*_req = NULL;
+	/* freed once the worker replies */
+	req->callback = NULL;
+	req->context = NULL;
+}
+
+bool fs_posix_fsync_have_pending(struct fs_posix_fsync *fsync)
+{
+	unsigned int i;
+
+	for (i = 0; i < fsync->worker_count; i++) {
+		if (fsync->workers[i].request_count > 0)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+void fs_posix_fsync_wait(struct fs_posix_fsync *fsync)
+{
+	struct ioloop *prev_ioloop = current_ioloop;
+
+	i_assert(fsync->wait_ioloop == NULL);
+
+	if (!fs_posix_fsync_have_pending(fsync))
+		return;
+
+	fsync->wait_ioloop = io_loop_create();
+	fs_posix_fsync_switch_ioloop(fsync);
+	io_loop_run(fsync->wait_ioloop);
+
+	io_loop_set_current(prev_ioloop);
+	fs_posix_fsync_switch_ioloop(fsync);
+	io_loop_set_current(fsync->wait_ioloop);
+	io_loop_destroy(&fsync->wait_ioloop);
+}
+
+void fs_posix_fsync_switch_ioloop(struct fs_posix_fsync *fsync)
+{
+	unsigned int i;
+
+	for (i = 0; i < fsync->worker_count; i++) {
+		if (fsync->workers[i].io != NULL)
+			fsync->workers[i].io = io_loop_move_io(&fsync->workers[i].io);
+	}
+}
@@ -0,0 +1,39 @@
+#ifndef FS_POSIX_FSYNC_H
+#define FS_POSIX_FSYNC_H
+
+/* Pool of worker processes doing fdatasync() calls, so that a slow fsync
+   (e.g. a stalled NFS server) doesn't block the whole process. The file
+   descriptors are passed to the workers via UNIX sockets. */
+
+struct fs_posix_fsync_request;
+
+/* error is 0 on success, otherwise the fdatasync() errno. */
+typedef void fs_posix_fsync_callback_t(int error, void *context);
+
+struct fs_posix_fsync *fs_posix_fsync_init(unsigned int worker_count);
+/* Pending requests are aborted without calling their callbacks. */
+void fs_posix_fsync_deinit(struct fs_posix_fsync **fsync);
+
+/* Start fdatasync()ing the fd. The callback is called from ioloop once it's
+   finished. The fd must not be closed before that. Returns 0 if the request
+   was sent, -1 if no worker could be started (errno is set). */
+int fs_posix_fsync_start(struct fs_posix_fsync *fsync, int fd,
+			 fs_posix_fsync_callback_t *callback, void *context,
+			 struct fs_posix_fsync_request **req_r);
+#define fs_posix_fsync_start(fsync, fd, callback, context, req_r) \
+	fs_posix_fsync_start(fsync, fd, \
+		(fs_posix_fsync_callback_t *)callback, context + \
+		CALLBACK_TYPECHECK(callback, void (*)(int, typeof(context))), \
+		req_r)
+/* Don't call the request's callback. The worker still finishes the
+   fdatasync() in the background. */
+void fs_posix_fsync_abort(struct fs_posix_fsync_request **req);
+
+/* Returns TRUE if there are requests waiting for a reply. */
+bool fs_posix_fsync_have_pending(struct fs_posix_fsync *fsync);
+/* Wait until at least one pending request has finished. */
+void fs_posix_fsync_wait(struct fs_posix_fsync *fsync);
+/* Move the worker IOs to the current ioloop. */
+void fs_posix_fsync_switch_ioloop(struct fs_posix_fsync *fsync);
+
+#endif
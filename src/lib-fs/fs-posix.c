@@ -12,6 +12,7 @@
 #include "file-lock.h"
 #include "file-dotlock.h"
 #include "fs-api-private.h"
+#include "fs-posix-fsync.h"
 
 #include <stdio.h>
 #include <unistd.h>
@@ -38,6 +39,9 @@ struct posix_fs {
 	bool have_dirs;
 	bool disable_fsync;
 	bool accurate_mtime;
+
+	/* fsync worker processes for FS_OPEN_FLAG_ASYNC files */
+	struct fs_posix_fsync *fsync;
 };
 
 struct posix_fs_file {
@@ -49,7 +53,13 @@ struct posix_fs_file {
 
 	buffer_t *write_buf;
 
+	struct fs_posix_fsync_request *fsync_req;
+	int fsync_error;
+	fs_file_async_callback_t *async_callback;
+	void *async_context;
+
 	bool seek_to_beginning;
+	bool fsync_finished;
 };
 
 struct posix_fs_lock {
@@ -109,6 +119,17 @@ fs_posix_init(struct fs *_fs, const char *args, const struct fs_settings *set)
 			fs->disable_fsync = TRUE;
 		} else if (strcmp(arg, "accurate-mtime") == 0) {
 			fs->accurate_mtime = TRUE;
+		} else if (str_begins(arg, "fsync-workers=")) {
+			unsigned int count;
+			if (str_to_uint(arg+14, &count) < 0) {
+				fs_set_error(_fs, "Invalid fsync-workers value: %s",
+					     arg+14);
+				return -1;
+			}
+			if (fs->fsync != NULL)
+				fs_posix_fsync_deinit(&fs->fsync);
+			if (count > 0)
+				fs->fsync = fs_posix_fsync_init(count);
 		} else if (str_begins(arg, "mode=")) {
 			unsigned int mode;
 			if (str_to_uint_oct(arg+5, &mode) < 0) {
@@ -132,6 +153,8 @@ static void fs_posix_deinit(struct fs *_fs)
 {
 	struct posix_fs *fs = (struct posix_fs *)_fs;
 
+	if (fs->fsync != NULL)
+		fs_posix_fsync_deinit(&fs->fsync);
 	i_free(fs->temp_file_prefix);
 	i_free(fs->root_path);
 	i_free(fs->path_prefix);
@@ -363,6 +386,8 @@ static void fs_posix_file_deinit(struct fs_file *_file)
 
 	i_assert(_file->output == NULL);
 
+	if (file->fsync_req != NULL)
+		fs_posix_fsync_abort(&file->fsync_req);
 	switch (file->open_mode) {
 	case FS_OPEN_MODE_READONLY:
 	case FS_OPEN_MODE_APPEND:
@@ -499,6 +524,57 @@ static int fs_posix_write_finish_link(struct posix_fs_file *file)
 	return ret;
 }
 
+static bool fs_posix_want_async_fsync(struct posix_fs_file *file)
+{
+	struct posix_fs *fs = (struct posix_fs *)file->file.fs;
+
+	return fs->fsync != NULL && !fs->disable_fsync &&
+		(file->open_flags & (FS_OPEN_FLAG_FSYNC | FS_OPEN_FLAG_ASYNC)) ==
+		(FS_OPEN_FLAG_FSYNC | FS_OPEN_FLAG_ASYNC);
+}
+
+static void fs_posix_fsync_callback(int error, struct posix_fs_file *file)
+{
+	file->fsync_req = NULL;
+	file->fsync_error = error;
+	file->fsync_finished = TRUE;
+	if (file->async_callback != NULL)
+		file->async_callback(file->async_context);
+}
+
+/* Returns 1 if fsync is done, 0 if it's still running in a worker process,
+   -1 if it failed. */
+static int fs_posix_write_fsync(struct posix_fs_file *file)
+{
+	struct posix_fs *fs = (struct posix_fs *)file->file.fs;
+
+	if (file->fsync_finished) {
+		file->fsync_finished = FALSE;
+		if (file->fsync_error != 0) {
+			errno = file->fsync_error;
+			fs_set_error(file->file.fs, "fdatasync(%s) failed: %m",
+				     file->full_path);
+			return -1;
+		}
+		return 1;
+	}
+	if (file->fsync_req != NULL)
+		return 0;
+	if (fs_posix_want_async_fsync(file) &&
+	    fs_posix_fsync_start(fs->fsync, file->fd, fs_posix_fsync_callback,
+				 file, &file->fsync_req) == 0)
+		return 0;
+	/* fall back to doing it ourself */
+	if (fdatasync(file->fd) < 0) {
+		fs_set_error(file->file.fs, "fdatasync(%s) failed: %m",
+			     file->full_path);
+		return -1;
+	}
+	return 1;
+}
+
+/* Returns 1 if the write is finished, 0 if it's waiting for fsync,
+   -1 if it failed. */
 static int fs_posix_write_finish(struct posix_fs_file *file)
 {
 	struct posix_fs *fs = (struct posix_fs *)file->file.fs;
@@ -507,11 +583,8 @@ static int fs_posix_write_finish(struct posix_fs_file *file)
 
 	if ((file->open_flags & FS_OPEN_FLAG_FSYNC) != 0 &&
 	    !fs->disable_fsync) {
-		if (fdatasync(file->fd) < 0) {
-			fs_set_error(file->file.fs, "fdatasync(%s) failed: %m",
-				     file->full_path);
-			return -1;
-		}
+		if ((ret = fs_posix_write_fsync(file)) <= 0)
+			return ret;
 	}
 	if (fs->accurate_mtime) {
 		/* Linux updates the mtime timestamp only on timer interrupts.
@@ -568,7 +641,7 @@ static int fs_posix_write_finish(struct posix_fs_file *file)
 	file->seek_to_beginning = TRUE;
 	/* allow opening the file after writing to it */
 	file->open_mode = FS_OPEN_MODE_READONLY;
-	return 0;
+	return 1;
 }
 
 static int fs_posix_write(struct fs_file *_file, const void *data, size_t size)
@@ -576,6 +649,12 @@ static int fs_posix_write(struct fs_file *_file, const void *data, size_t size)
 	struct posix_fs_file *file = (struct posix_fs_file *)_file;
 	ssize_t ret;
 
+	if (file->open_mode != FS_OPEN_MODE_APPEND &&
+	    fs_posix_want_async_fsync(file)) {
+		/* the stream API keeps track of the pending write */
+		return fs_write_via_stream(_file, data, size);
+	}
+
 	if (file->fd == -1) {
 		if (fs_posix_open(file) < 0)
 			return -1;
@@ -588,7 +667,7 @@ static int fs_posix_write(struct fs_file *_file, const void *data, size_t size)
 				     file->full_path);
 			return -1;
 		}
-		return fs_posix_write_finish(file);
+		return fs_posix_write_finish(file) < 0 ? -1 : 0;
 	}
 
 	/* atomic append - it should either succeed or fail */
@@ -630,28 +709,60 @@ static void fs_posix_write_stream(struct fs_file *_file)
 static int fs_posix_write_stream_finish(struct fs_file *_file, bool success)
 {
 	struct posix_fs_file *file = (struct posix_fs_file *)_file;
-	int ret = success ? 0 : -1;
+	int ret = success ? 1 : -1;
 
 	o_stream_destroy(&_file->output);
 
 	switch (file->open_mode) {
 	case FS_OPEN_MODE_APPEND:
-		if (ret == 0) {
-			ret = fs_posix_write(_file, file->write_buf->data,
-					     file->write_buf->used);
-		}
+		if (ret > 0 && fs_posix_write(_file, file->write_buf->data,
+					      file->write_buf->used) < 0)
+			ret = -1;
 		buffer_free(&file->write_buf);
 		break;
 	case FS_OPEN_MODE_CREATE:
 	case FS_OPEN_MODE_CREATE_UNIQUE_128:
 	case FS_OPEN_MODE_REPLACE:
-		if (ret == 0)
+		if (ret > 0)
 			ret = fs_posix_write_finish(file);
 		break;
 	case FS_OPEN_MODE_READONLY:
 		i_unreached();
 	}
-	return ret < 0 ? -1 : 1;
+	return ret;
+}
+
+static void
+fs_posix_set_async_callback(struct fs_file *_file,
+			    fs_file_async_callback_t *callback, void *context)
+{
+	struct posix_fs_file *file = (struct posix_fs_file *)_file;
+
+	if (file->fsync_req == NULL) {
+		/* nothing running asynchronously */
+		callback(context);
+		return;
+	}
+	file->async_callback = callback;
+	file->async_context = context;
+}
+
+static void fs_posix_wait_async(struct fs *_fs)
+{
+	struct posix_fs *fs = (struct posix_fs *)_fs;
+
+	if (fs->fsync != NULL)
+		fs_posix_fsync_wait(fs->fsync);
+}
+
+static bool fs_posix_switch_ioloop(struct fs *_fs)
+{
+	struct posix_fs *fs = (struct posix_fs *)_fs;
+
+	if (fs->fsync == NULL)
+		return FALSE;
+	fs_posix_fsync_switch_ioloop(fs->fsync);
+	return fs_posix_fsync_have_pending(fs->fsync);
 }
 
 static int
@@ -955,7 +1066,8 @@ const struct fs fs_class_posix = {
 		fs_posix_file_deinit,
 		fs_posix_file_close,
 		NULL,
-		NULL, NULL,
+		fs_posix_set_async_callback,
+		fs_posix_wait_async,
 		fs_default_set_metadata,
 		NULL,
 		fs_posix_prefetch,
@@ -975,7 +1087,7 @@ const struct fs fs_class_posix = {
 		fs_posix_iter_init,
 		fs_posix_iter_next,
 		fs_posix_iter_deinit,
-		NULL,
+		fs_posix_switch_ioloop,
 		NULL,
 	}
 };
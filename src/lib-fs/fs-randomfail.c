@@ -12,11 +12,6 @@
 
 #define RANDOMFAIL_ERROR "Random failure injection"
 
-static const char *fs_op_names[FS_OP_COUNT] = {
-	"wait", "metadata", "prefetch", "read", "write", "lock", "exists",
-	"stat", "copy", "rename", "delete", "iter"
-};
-
 struct randomfail_fs {
 	struct fs fs;
 	unsigned int op_probability[FS_OP_COUNT];
@@ -52,7 +47,7 @@ static bool fs_op_find(const char *str, enum fs_op *op_r)
 	enum fs_op op;
 
 	for (op = 0; op < FS_OP_COUNT; op++) {
-		if (strcmp(fs_op_names[op], str) == 0) {
+		if (strcmp(fs_op_get_name(op), str) == 0) {
 			*op_r = op;
 			return TRUE;
 		}
@@ -0,0 +1,680 @@
+/* Copyright (c) 2018 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "str.h"
+#include "guid.h"
+#include "istream.h"
+#include "ostream.h"
+#include "ostream-null.h"
+#include "dict.h"
+#include "fs-sis-common.h"
+
+#include <unistd.h>
+
+/* Single instance storage where the references are kept in a dict instead
+   of relying on hard link counts. Each unique attachment is written only
+   once to <dir>/hashes/<hash> in the parent fs and never modified
+   afterwards, so this works also with object storages that don't support
+   hard links or renames.
+
+   The dict has no compare-and-set, so there's no race-free way to keep a
+   single refcount per blob. Instead each referencing path has its own
+   record:
+
+     sis/<hash path>/refs/<filename>
+     sis/<hash path>/deleting/<guid> = <timestamp>
+
+   A blob is deleted only after the deleter has added a "deleting" record
+   and then seen that there are no "refs" records left. A writer adds its
+   "refs" record and only then looks for "deleting" records. If there are
+   any, it waits until they're gone before checking if the blob still
+   exists. So either the deleter sees the new reference, or the writer
+   sees the deletion and writes the blob again. The dict must support
+   iteration. */
+
+#define FS_SIS_DICT_KEY_PREFIX DICT_PATH_SHARED"sis/"
+/* Blobs whose last reference was dropped are deleted in batches of this
+   many, or when the fs is deinitialized. */
+#define FS_SIS_DICT_DELETE_BATCH_SIZE 100
+/* "deleting" records older than this are left behind by crashed
+   processes, and they're ignored. */
+#define FS_SIS_DICT_DELETE_STALE_SECS 60
+#define FS_SIS_DICT_DELETE_WAIT_MSECS 100
+
+struct sis_dict_fs {
+	struct fs fs;
+	struct dict *dict;
+
+	ARRAY_TYPE(string) pending_deletes;
+};
+
+struct sis_dict_fs_file {
+	struct fs_file file;
+	struct sis_dict_fs *fs;
+
+	struct ostream *fs_output;
+	char *hash_path, *ref_key;
+
+	/* the reference record was added for this file */
+	bool referenced:1;
+	/* the blob already exists - the written data is discarded */
+	bool blob_exists:1;
+	bool ref_failed:1;
+};
+
+static struct fs *fs_sis_dict_alloc(void)
+{
+	struct sis_dict_fs *fs;
+
+	fs = i_new(struct sis_dict_fs, 1);
+	fs->fs = fs_class_sis_dict;
+	i_array_init(&fs->pending_deletes, 16);
+	return &fs->fs;
+}
+
+static int
+fs_sis_dict_init(struct fs *_fs, const char *args,
+		 const struct fs_settings *set)
+{
+	struct sis_dict_fs *fs = (struct sis_dict_fs *)_fs;
+	struct dict_settings dict_set;
+	const char *p, *dict_uri, *parent_name, *parent_args, *error;
+
+	/* <dict uri> <parent fs>[:<args>] */
+	p = strchr(args, ' ');
+	if (p == NULL) {
+		fs_set_error(_fs, "Parent filesystem not given as parameter");
+		return -1;
+	}
+	dict_uri = t_strdup_until(args, p);
+	args = p + 1;
+
+	parent_args = strchr(args, ':');
+	if (parent_args == NULL) {
+		parent_name = args;
+		parent_args = "";
+	} else {
+		parent_name = t_strdup_until(args, parent_args);
+		parent_args++;
+	}
+
+	i_zero(&dict_set);
+	dict_set.username = set->username;
+	dict_set.base_dir = set->base_dir;
+	if (dict_init(dict_uri, &dict_set, &fs->dict, &error) < 0) {
+		fs_set_error(_fs, "dict_init(%s) failed: %s", dict_uri, error);
+		return -1;
+	}
+	if (fs_init(parent_name, parent_args, set, &_fs->parent, &error) < 0) {
+		fs_set_error(_fs, "%s", error);
+		return -1;
+	}
+	return 0;
+}
+
+static void fs_sis_dict_wait_parent(struct fs *parent_fs)
+{
+	/* the dict operations are synchronous, so also wait for the parent */
+	fs_wait_async(parent_fs);
+}
+
+static const char *
+fs_sis_dict_hash_key(const char *hash_path, const char *suffix)
+{
+	return t_strconcat(FS_SIS_DICT_KEY_PREFIX,
+			   dict_escape_string(hash_path), "/", suffix, NULL);
+}
+
+/* Returns the number of references to the blob, up to max_count if it's
+   non-zero, or -1 on error. */
+static int
+fs_sis_dict_refs_count(struct dict *dict, const char *hash_path,
+		       unsigned int max_count, const char **error_r)
+{
+	struct dict_iterate_context *iter;
+	const char *key, *value;
+	int count = 0;
+
+	iter = dict_iterate_init(dict, fs_sis_dict_hash_key(hash_path, "refs/"),
+				 DICT_ITERATE_FLAG_NO_VALUE);
+	if (max_count > 0)
+		dict_iterate_set_limit(iter, max_count);
+	while (dict_iterate(iter, &key, &value))
+		count++;
+	if (dict_iterate_deinit(&iter, error_r) < 0)
+		return -1;
+	return count;
+}
+
+/* Set or unset the "deleting" records of all the given blobs. */
+static int
+fs_sis_dict_deleting_update(struct dict *dict, const char *const *hash_paths,
+			    unsigned int count, const char *id, bool set,
+			    const char **error_r)
+{
+	struct dict_transaction_context *trans;
+	const char *timestamp = dec2str(time(NULL));
+	unsigned int i;
+
+	trans = dict_transaction_begin(dict);
+	for (i = 0; i < count; i++) {
+		const char *key = fs_sis_dict_hash_key(hash_paths[i],
+			t_strconcat("deleting/", id, NULL));
+		if (set)
+			dict_set(trans, key, timestamp);
+		else
+			dict_unset(trans, key);
+	}
+	return dict_transaction_commit(&trans, error_r) < 0 ? -1 : 0;
+}
+
+static void fs_sis_dict_flush_deletes(struct sis_dict_fs *fs)
+{
+	const char *const *hash_paths, *id, *error;
+	struct fs_file *super_file;
+	guid_128_t guid;
+	unsigned int i, count;
+	int ret;
+
+	hash_paths = (const char *const *)array_get(&fs->pending_deletes,
+						    &count);
+	if (count == 0)
+		return;
+
+	/* announce the deletions before looking at the references. If a
+	   writer adds a reference after this, it waits for the deletion to
+	   finish and writes the blob again. */
+	guid_128_generate(guid);
+	id = guid_128_to_string(guid);
+	if (fs_sis_dict_deleting_update(fs->dict, hash_paths, count, id,
+					TRUE, &error) < 0) {
+		e_error(fs->fs.event,
+			"Couldn't mark attachments being deleted: %s", error);
+		return;
+	}
+
+	for (i = 0; i < count; i++) {
+		ret = fs_sis_dict_refs_count(fs->dict, hash_paths[i], 1,
+					     &error);
+		if (ret < 0) {
+			e_error(fs->fs.event,
+				"Couldn't look up references of %s: %s",
+				hash_paths[i], error);
+			continue;
+		}
+		if (ret > 0) {
+			/* referenced again after being queued */
+			continue;
+		}
+
+		super_file = fs_file_init(fs->fs.parent, hash_paths[i],
+					  FS_OPEN_MODE_READONLY);
+		while ((ret = fs_delete(super_file)) < 0 && errno == EAGAIN)
+			fs_sis_dict_wait_parent(fs->fs.parent);
+		if (ret < 0 && errno != ENOENT) {
+			e_error(fs->fs.event, "%s",
+				fs_file_last_error(super_file));
+		}
+		fs_file_deinit(&super_file);
+	}
+
+	if (fs_sis_dict_deleting_update(fs->dict, hash_paths, count, id,
+					FALSE, &error) < 0) {
+		/* writers will ignore them once they're stale */
+		e_error(fs->fs.event,
+			"Couldn't unmark attachments being deleted: %s", error);
+	}
+}
+
+static void fs_sis_dict_pending_deletes_clear(struct sis_dict_fs *fs)
+{
+	char **pathp;
+
+	array_foreach_modifiable(&fs->pending_deletes, pathp)
+		i_free(*pathp);
+	array_clear(&fs->pending_deletes);
+}
+
+static void fs_sis_dict_queue_delete(struct sis_dict_fs *fs,
+				     const char *hash_path)
+{
+	char *path = i_strdup(hash_path);
+
+	array_push_back(&fs->pending_deletes, &path);
+	if (array_count(&fs->pending_deletes) < FS_SIS_DICT_DELETE_BATCH_SIZE)
+		return;
+
+	T_BEGIN {
+		fs_sis_dict_flush_deletes(fs);
+	} T_END;
+	fs_sis_dict_pending_deletes_clear(fs);
+}
+
+static void fs_sis_dict_deinit(struct fs *_fs)
+{
+	struct sis_dict_fs *fs = (struct sis_dict_fs *)_fs;
+
+	if (fs->dict != NULL && _fs->parent != NULL) T_BEGIN {
+		fs_sis_dict_flush_deletes(fs);
+	} T_END;
+	fs_sis_dict_pending_deletes_clear(fs);
+	array_free(&fs->pending_deletes);
+
+	if (fs->dict != NULL)
+		dict_deinit(&fs->dict);
+	fs_deinit(&_fs->parent);
+	i_free(fs);
+}
+
+static enum fs_properties fs_sis_dict_get_properties(struct fs *_fs)
+{
+	enum fs_properties props = fs_get_properties(_fs->parent);
+
+	/* copying only adds a reference. Iteration would list the
+	   hashes/ directory, and renaming works only within the same hash.
+	   Everything is waited on internally. */
+	props |= FS_PROPERTY_FASTCOPY;
+	props &= ~(FS_PROPERTY_ITER | FS_PROPERTY_RELIABLEITER |
+		   FS_PROPERTY_RENAME | FS_PROPERTY_ASYNC);
+	return props;
+}
+
+static struct fs_file *fs_sis_dict_file_alloc(void)
+{
+	struct sis_dict_fs_file *file = i_new(struct sis_dict_fs_file, 1);
+	return &file->file;
+}
+
+static void
+fs_sis_dict_file_init(struct fs_file *_file, const char *path,
+		      enum fs_open_mode mode, enum fs_open_flags flags)
+{
+	struct sis_dict_fs_file *file = (struct sis_dict_fs_file *)_file;
+	struct sis_dict_fs *fs = (struct sis_dict_fs *)_file->fs;
+	const char *dir, *hash, *fname;
+
+	file->file.path = i_strdup(path);
+	file->fs = fs;
+	if (mode == FS_OPEN_MODE_APPEND) {
+		fs_set_error(_file->fs, "APPEND mode not supported");
+		return;
+	}
+
+	if (fs_sis_path_parse(_file->fs, path, &dir, &hash) < 0) {
+		fs_set_error(_file->fs, "Invalid path");
+		return;
+	}
+	fname = strrchr(path, '/');
+	fname = fname == NULL ? path : fname + 1;
+
+	file->hash_path = i_strdup_printf("%s/"HASH_DIR_NAME"/%s", dir, hash);
+	file->ref_key = i_strdup(fs_sis_dict_hash_key(file->hash_path,
+		t_strconcat("refs/", dict_escape_string(fname), NULL)));
+	/* the blobs are write-once. If one is written again, it has the
+	   same content. */
+	if (mode != FS_OPEN_MODE_READONLY)
+		mode = FS_OPEN_MODE_REPLACE;
+	file->file.parent = fs_file_init_parent(_file, file->hash_path,
+						mode | flags);
+}
+
+static void fs_sis_dict_file_deinit(struct fs_file *_file)
+{
+	struct sis_dict_fs_file *file = (struct sis_dict_fs_file *)_file;
+
+	fs_file_deinit(&_file->parent);
+	i_free(file->hash_path);
+	i_free(file->ref_key);
+	i_free(file->file.path);
+	i_free(file);
+}
+
+static const char *fs_sis_dict_file_get_path(struct fs_file *_file)
+{
+	return _file->path;
+}
+
+/* Returns 1 if the file's reference exists, 0 if not, -1 on error. */
+static int fs_sis_dict_ref_lookup(struct sis_dict_fs_file *file)
+{
+	const char *value, *error;
+	int ret;
+
+	ret = dict_lookup(file->fs->dict, pool_datastack_create(),
+			  file->ref_key, &value, &error);
+	if (ret < 0) {
+		fs_set_error(&file->fs->fs,
+			     "Couldn't look up reference %s of %s: %s",
+			     file->file.path, file->hash_path, error);
+	}
+	return ret;
+}
+
+static int
+fs_sis_dict_ref_update(struct sis_dict_fs_file *file,
+		       struct sis_dict_fs_file *unref_file)
+{
+	struct dict_transaction_context *trans;
+	const char *error;
+
+	trans = dict_transaction_begin(file->fs->dict);
+	if (unref_file != file)
+		dict_set(trans, file->ref_key, "1");
+	if (unref_file != NULL)
+		dict_unset(trans, unref_file->ref_key);
+	if (dict_transaction_commit(&trans, &error) < 0) {
+		fs_set_error(&file->fs->fs,
+			     "Couldn't update reference %s of %s: %s",
+			     file->file.path, file->hash_path, error);
+		return -1;
+	}
+	return 0;
+}
+
+static void fs_sis_dict_unref(struct sis_dict_fs_file *file)
+{
+	struct fs *_fs = &file->fs->fs;
+
+	if (fs_sis_dict_ref_update(file, file) < 0)
+		e_error(file->file.event, "%s", fs_last_error(_fs));
+	else {
+		/* this may have been the last reference. Whether it really
+		   was is checked when the batch is flushed. */
+		fs_sis_dict_queue_delete(file->fs, file->hash_path);
+	}
+	file->referenced = FALSE;
+}
+
+/* Wait until nobody is deleting the blob anymore. */
+static int fs_sis_dict_wait_deletes(struct sis_dict_fs_file *file)
+{
+	struct dict_iterate_context *iter;
+	struct dict_transaction_context *trans;
+	const char *path, *key, *value, *error;
+	time_t timestamp, now;
+	bool deleting;
+
+	path = fs_sis_dict_hash_key(file->hash_path, "deleting/");
+	for (;;) {
+		deleting = FALSE;
+		trans = NULL;
+		now = time(NULL);
+		iter = dict_iterate_init(file->fs->dict, path, 0);
+		while (dict_iterate(iter, &key, &value)) {
+			if (str_to_time(value, &timestamp) == 0 &&
+			    timestamp + FS_SIS_DICT_DELETE_STALE_SECS > now) {
+				deleting = TRUE;
+				continue;
+			}
+			/* left behind by a crashed process */
+			if (trans == NULL)
+				trans = dict_transaction_begin(file->fs->dict);
+			dict_unset(trans, key);
+		}
+		if (dict_iterate_deinit(&iter, &error) < 0) {
+			if (trans != NULL)
+				dict_transaction_rollback(&trans);
+			fs_set_error(&file->fs->fs,
+				     "Couldn't look up deletions of %s: %s",
+				     file->hash_path, error);
+			return -1;
+		}
+		if (trans != NULL &&
+		    dict_transaction_commit(&trans, &error) < 0) {
+			e_error(file->file.event,
+				"Couldn't remove stale deletions of %s: %s",
+				file->hash_path, error);
+		}
+		if (!deleting)
+			return 0;
+		usleep(FS_SIS_DICT_DELETE_WAIT_MSECS * 1000);
+	}
+}
+
+/* Returns 1 if the blob already exists and the reference was added,
+   0 if the blob needs to be written, -1 on error. */
+static int fs_sis_dict_ref(struct sis_dict_fs_file *file)
+{
+	int ret;
+
+	if (fs_sis_dict_ref_update(file, NULL) < 0)
+		return -1;
+	file->referenced = TRUE;
+
+	/* the blob may be just getting deleted. Adding the reference
+	   prevented any new deletions, so wait for the existing ones. */
+	if (fs_sis_dict_wait_deletes(file) < 0) {
+		fs_sis_dict_unref(file);
+		return -1;
+	}
+	while ((ret = fs_exists(file->file.parent)) < 0 && errno == EAGAIN)
+		fs_sis_dict_wait_parent(file->file.parent->fs);
+	if (ret < 0) {
+		e_error(file->file.event, "%s",
+			fs_file_last_error(file->file.parent));
+	}
+	return ret > 0 ? 1 : 0;
+}
+
+static int
+fs_sis_dict_write(struct fs_file *_file, const void *data, size_t size)
+{
+	struct sis_dict_fs_file *file = (struct sis_dict_fs_file *)_file;
+	int ret;
+
+	if (_file->parent == NULL)
+		return -1;
+
+	if ((ret = fs_sis_dict_ref(file)) < 0)
+		return -1;
+	if (ret > 0) {
+		/* deduplicated */
+		return 0;
+	}
+
+	if (fs_write(_file->parent, data, size) < 0) {
+		fs_sis_dict_unref(file);
+		return -1;
+	}
+	return 0;
+}
+
+static void fs_sis_dict_write_stream(struct fs_file *_file)
+{
+	struct sis_dict_fs_file *file = (struct sis_dict_fs_file *)_file;
+	int ret;
+
+	i_assert(_file->output == NULL);
+
+	if (_file->parent == NULL) {
+		_file->output = o_stream_create_error_str(EINVAL, "%s",
+						fs_file_last_error(_file));
+	} else if ((ret = fs_sis_dict_ref(file)) < 0) {
+		file->ref_failed = TRUE;
+		_file->output = o_stream_create_error_str(EIO, "%s",
+						fs_file_last_error(_file));
+	} else if (ret > 0) {
+		/* the hash is already stored, so the data isn't needed */
+		file->blob_exists = TRUE;
+		_file->output = o_stream_create_null();
+	} else {
+		file->fs_output = fs_write_stream(_file->parent);
+		_file->output = file->fs_output;
+		o_stream_ref(_file->output);
+	}
+	o_stream_set_name(_file->output, _file->path);
+}
+
+static int
+fs_sis_dict_write_stream_finish(struct fs_file *_file, bool success)
+{
+	struct sis_dict_fs_file *file = (struct sis_dict_fs_file *)_file;
+	int ret;
+
+	if (file->ref_failed)
+		success = FALSE;
+	if (!success) {
+		if (file->fs_output != NULL)
+			fs_write_stream_abort_parent(_file, &file->fs_output);
+		o_stream_unref(&_file->output);
+		if (file->referenced)
+			fs_sis_dict_unref(file);
+		return -1;
+	}
+	o_stream_unref(&_file->output);
+	if (file->blob_exists)
+		return 1;
+
+	ret = fs_write_stream_finish(_file->parent, &file->fs_output);
+	while (ret == 0) {
+		fs_sis_dict_wait_parent(_file->parent->fs);
+		ret = fs_write_stream_finish_async(_file->parent);
+	}
+	if (ret < 0) {
+		fs_sis_dict_unref(file);
+		return -1;
+	}
+	return 1;
+}
+
+static int fs_sis_dict_copy(struct fs_file *_src, struct fs_file *_dest)
+{
+	struct sis_dict_fs_file *src = (struct sis_dict_fs_file *)_src;
+	struct sis_dict_fs_file *dest = (struct sis_dict_fs_file *)_dest;
+	int ret;
+
+	if (_dest->parent == NULL)
+		return -1;
+	if (strcmp(src->hash_path, dest->hash_path) != 0) {
+		fs_set_error(_dest->fs, "Can't copy %s to %s with different "
+			     "hash", _src->path, _dest->path);
+		errno = ENOTSUP;
+		return -1;
+	}
+	if ((ret = fs_sis_dict_ref(dest)) < 0)
+		return -1;
+	if (ret == 0) {
+		fs_sis_dict_unref(dest);
+		fs_set_error(_dest->fs, "copy(%s, %s) failed: "
+			     "Attachment doesn't exist",
+			     _src->path, _dest->path);
+		errno = ENOENT;
+		return -1;
+	}
+	return 0;
+}
+
+static int fs_sis_dict_rename(struct fs_file *_src, struct fs_file *_dest)
+{
+	struct sis_dict_fs_file *src = (struct sis_dict_fs_file *)_src;
+	struct sis_dict_fs_file *dest = (struct sis_dict_fs_file *)_dest;
+	int ret;
+
+	if (_dest->parent == NULL)
+		return -1;
+	if (strcmp(src->hash_path, dest->hash_path) != 0) {
+		fs_set_error(_dest->fs, "Can't rename %s to %s with different "
+			     "hash", _src->path, _dest->path);
+		errno = ENOTSUP;
+		return -1;
+	}
+	/* both point to the same blob, only the reference is moved */
+	if (strcmp(src->ref_key, dest->ref_key) == 0)
+		return 0;
+	if ((ret = fs_sis_dict_ref_lookup(src)) < 0)
+		return -1;
+	if (ret == 0) {
+		fs_set_error(_src->fs, "rename(%s, %s) failed: "
+			     "No such file or directory",
+			     _src->path, _dest->path);
+		errno = ENOENT;
+		return -1;
+	}
+	return fs_sis_dict_ref_update(dest, src);
+}
+
+static int fs_sis_dict_delete(struct fs_file *_file)
+{
+	struct sis_dict_fs_file *file = (struct sis_dict_fs_file *)_file;
+	int ret;
+
+	if (_file->parent == NULL)
+		return -1;
+
+	if ((ret = fs_sis_dict_ref_lookup(file)) < 0)
+		return -1;
+	if (ret == 0) {
+		fs_set_error(_file->fs, "unlink(%s) failed: "
+			     "No such file or directory", _file->path);
+		errno = ENOENT;
+		return -1;
+	}
+	if (fs_sis_dict_ref_update(file, file) < 0)
+		return -1;
+	fs_sis_dict_queue_delete(file->fs, file->hash_path);
+	return 0;
+}
+
+static int fs_sis_dict_get_nlinks(struct fs_file *_file, nlink_t *nlinks_r)
+{
+	struct sis_dict_fs_file *file = (struct sis_dict_fs_file *)_file;
+	const char *error;
+	int ret;
+
+	if (_file->parent == NULL)
+		return -1;
+
+	ret = fs_sis_dict_refs_count(file->fs->dict, file->hash_path, 0,
+				     &error);
+	if (ret < 0) {
+		fs_set_error(_file->fs, "Couldn't look up references of %s: %s",
+			     file->hash_path, error);
+		return -1;
+	}
+	if (ret == 0) {
+		fs_set_error(_file->fs, "%s doesn't exist", _file->path);
+		errno = ENOENT;
+		return -1;
+	}
+	*nlinks_r = ret;
+	return 0;
+}
+
+const struct fs fs_class_sis_dict = {
+	.name = "sis-dict",
+	.v = {
+		fs_sis_dict_alloc,
+		fs_sis_dict_init,
+		fs_sis_dict_deinit,
+		fs_sis_dict_get_properties,
+		fs_sis_dict_file_alloc,
+		fs_sis_dict_file_init,
+		fs_sis_dict_file_deinit,
+		fs_wrapper_file_close,
+		fs_sis_dict_file_get_path,
+		fs_wrapper_set_async_callback,
+		fs_wrapper_wait_async,
+		fs_wrapper_set_metadata,
+		fs_wrapper_get_metadata,
+		fs_wrapper_prefetch,
+		fs_wrapper_read,
+		fs_wrapper_read_stream,
+		fs_sis_dict_write,
+		fs_sis_dict_write_stream,
+		fs_sis_dict_write_stream_finish,
+		fs_wrapper_lock,
+		fs_wrapper_unlock,
+		fs_wrapper_exists,
+		fs_wrapper_stat,
+		fs_sis_dict_copy,
+		fs_sis_dict_rename,
+		fs_sis_dict_delete,
+		NULL,
+		NULL,
+		NULL,
+		NULL,
+		NULL,
+		fs_sis_dict_get_nlinks,
+	}
+};
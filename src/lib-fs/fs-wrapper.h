@@ -28,6 +28,7 @@ int fs_wrapper_get_nlinks(struct fs_file *file, nlink_t *nlinks_r);
 int fs_wrapper_copy(struct fs_file *src, struct fs_file *dest);
 int fs_wrapper_rename(struct fs_file *src, struct fs_file *dest);
 int fs_wrapper_delete(struct fs_file *file);
+int fs_wrapper_delete_bulk(struct fs_file *const *files, unsigned int count);
 struct fs_iter *fs_wrapper_iter_alloc(void);
 void fs_wrapper_iter_init(struct fs_iter *iter, const char *path,
 			  enum fs_iter_flags flags);
@@ -0,0 +1,154 @@
+/* Copyright (c) 2018 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "str.h"
+#include "istream.h"
+#include "fs-api.h"
+#include "safe-mkdir.h"
+#include "test-common.h"
+#include "unlink-directory.h"
+
+#include <unistd.h>
+
+#define TEST_DATA_DIR ".test-fs-cache-data"
+#define TEST_CACHE_DIR ".test-fs-cache"
+
+static void test_fs_cache_cleanup(void)
+{
+	const char *error;
+
+	if (unlink_directory(TEST_DATA_DIR, UNLINK_DIRECTORY_FLAG_RMDIR, &error) < 0)
+		i_error("unlink_directory(%s) failed: %s", TEST_DATA_DIR, error);
+	if (unlink_directory(TEST_CACHE_DIR, UNLINK_DIRECTORY_FLAG_RMDIR, &error) < 0)
+		i_error("unlink_directory(%s) failed: %s", TEST_CACHE_DIR, error);
+}
+
+static struct fs *test_fs_cache_init(const char *size)
+{
+	struct fs_settings fs_set;
+	struct fs *fs;
+	const char *error;
+
+	test_fs_cache_cleanup();
+	if (safe_mkdir(TEST_DATA_DIR, 0700, (uid_t)-1, (gid_t)-1) != 1)
+		i_fatal("safe_mkdir(%s) failed", TEST_DATA_DIR);
+
+	i_zero(&fs_set);
+	if (fs_init("cache", t_strdup_printf("%s:%s:posix:prefix=%s/",
+			size, TEST_CACHE_DIR, TEST_DATA_DIR),
+		    &fs_set, &fs, &error) < 0)
+		i_fatal("fs_init() failed: %s", error);
+	return fs;
+}
+
+static bool test_fs_cache_read(struct fs *fs, const char *path,
+			       const char *expected)
+{
+	struct fs_file *file;
+	struct istream *input;
+	const unsigned char *data;
+	size_t size;
+	string_t *str = t_str_new(128);
+	bool ret;
+
+	file = fs_file_init(fs, path, FS_OPEN_MODE_READONLY);
+	input = fs_read_stream(file, IO_BLOCK_SIZE);
+	while (i_stream_read_more(input, &data, &size) > 0) {
+		str_append_data(str, data, size);
+		i_stream_skip(input, size);
+	}
+	ret = input->stream_errno == 0 && strcmp(str_c(str), expected) == 0;
+	i_stream_unref(&input);
+	fs_file_deinit(&file);
+	return ret;
+}
+
+static void test_fs_cache_write(struct fs *fs, const char *path,
+				const char *data)
+{
+	struct fs_file *file;
+
+	file = fs_file_init(fs, path, FS_OPEN_MODE_REPLACE);
+	test_assert(fs_write(file, data, strlen(data)) == 0);
+	fs_file_deinit(&file);
+}
+
+static void test_fs_cache_read_write(void)
+{
+	struct fs *fs;
+	struct fs_file *file;
+
+	test_begin("fs cache read and write");
+	fs = test_fs_cache_init("1M");
+
+	/* write-through: the data is readable even after it's removed
+	   from the parent */
+	test_fs_cache_write(fs, "foo", "hello");
+	test_assert(unlink(TEST_DATA_DIR"/foo") == 0);
+	test_assert(test_fs_cache_read(fs, "foo", "hello"));
+
+	/* read miss populates the cache */
+	test_fs_cache_write(fs_get_parent(fs), "bar", "world");
+	test_assert(test_fs_cache_read(fs, "bar", "world"));
+	test_assert(unlink(TEST_DATA_DIR"/bar") == 0);
+	test_assert(test_fs_cache_read(fs, "bar", "world"));
+
+	/* overwriting replaces the cached data */
+	test_fs_cache_write(fs, "bar", "updated");
+	test_assert(test_fs_cache_read(fs, "bar", "updated"));
+
+	/* delete invalidates the cache */
+	file = fs_file_init(fs, "bar", FS_OPEN_MODE_READONLY);
+	test_assert(fs_exists(file) == 1);
+	test_assert(fs_delete(file) == 0);
+	test_assert(fs_exists(file) == 0);
+	fs_file_deinit(&file);
+	test_assert(!test_fs_cache_read(fs, "bar", "updated"));
+
+	fs_deinit(&fs);
+	test_fs_cache_cleanup();
+	test_end();
+}
+
+static void test_fs_cache_evict(void)
+{
+	struct fs *fs;
+	const char *path;
+	unsigned int i, cached = 0;
+
+	test_begin("fs cache eviction");
+	/* 64 bytes per shard, up to 16 bytes per object */
+	fs = test_fs_cache_init("1k");
+	for (i = 0; i < 200; i++) {
+		path = t_strdup_printf("file%u", i);
+		test_fs_cache_write(fs, path, "0123456789");
+	}
+	/* too large to be cached */
+	test_fs_cache_write(fs, "large", "01234567890123456789");
+
+	for (i = 0; i < 200; i++) {
+		path = t_strdup_printf(TEST_DATA_DIR"/file%u", i);
+		test_assert(unlink(path) == 0);
+		if (test_fs_cache_read(fs, t_strdup_printf("file%u", i),
+				       "0123456789"))
+			cached++;
+	}
+	/* each shard can hold at most 6 files */
+	test_assert(cached > 0 && cached <= 16*6);
+	test_assert(unlink(TEST_DATA_DIR"/large") == 0);
+	test_assert(!test_fs_cache_read(fs, "large", "01234567890123456789"));
+
+	fs_deinit(&fs);
+	test_fs_cache_cleanup();
+	test_end();
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_fs_cache_read_write,
+		test_fs_cache_evict,
+		NULL
+	};
+	return test_run(test_functions);
+}
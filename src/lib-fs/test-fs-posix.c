@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "str.h"
+#include "ioloop.h"
 #include "ostream.h"
 #include "fs-api.h"
 #include "safe-mkdir.h"
@@ -124,6 +125,19 @@ static void test_fs_posix(void)
 	fs_file_deinit(&file);
 	test_end();
 
+	test_begin("test-fs-posix bulk delete");
+	struct fs_file *files[3];
+	files[0] = fs_file_init(fs, "subdir/rename1", FS_OPEN_MODE_READONLY);
+	files[1] = fs_file_init(fs, "subdir/nonexistent", FS_OPEN_MODE_READONLY);
+	files[2] = fs_file_init(fs, "subdir/rename2", FS_OPEN_MODE_READONLY);
+	test_assert(fs_delete_bulk(files, 3) == -1 && errno == ENOENT);
+	test_assert(fs_exists(files[0]) == 0);
+	test_assert(fs_exists(files[2]) == 0);
+	test_assert(fs_delete_bulk(files, 0) == 0);
+	for (unsigned int i = 0; i < N_ELEMENTS(files); i++)
+		fs_file_deinit(&files[i]);
+	test_end();
+
 	fs_deinit(&fs);
 
 error_no_fs:
@@ -133,10 +147,69 @@ error_no_testdir:
 	return;
 }
 
+static void test_fs_posix_async_fsync_callback(void *context)
+{
+	bool *called = context;
+
+	*called = TRUE;
+}
+
+static void test_fs_posix_async_fsync(void)
+{
+	const char testdir[] = ".test-fs-posix-async";
+	const char *error, *unlink_err;
+	struct fs_settings fs_set;
+	struct fs *fs;
+	struct fs_file *file;
+	struct ostream *output;
+	struct ioloop *ioloop;
+	bool called = FALSE;
+	int ret;
+
+	test_begin("test-fs-posix async fsync");
+	if (unlink_directory(testdir, UNLINK_DIRECTORY_FLAG_RMDIR, &unlink_err) < 0)
+		i_error("Couldn't prepare test directory (%s): %s", testdir, unlink_err);
+	ioloop = io_loop_create();
+	i_zero(&fs_set);
+	if (fs_init("posix", t_strdup_printf("prefix=%s/:fsync-workers=2", testdir),
+		    &fs_set, &fs, &error) < 0)
+		i_fatal("fs_init() failed: %s", error);
+
+	/* fs_write() returns EAGAIN until the fsync has finished */
+	file = fs_file_init(fs, "file1", FS_OPEN_MODE_REPLACE |
+			    FS_OPEN_FLAG_FSYNC | FS_OPEN_FLAG_ASYNC);
+	while ((ret = fs_write(file, "hello", 5)) < 0 && errno == EAGAIN)
+		fs_wait_async(fs);
+	test_assert(ret == 0);
+	test_assert(fs_exists(file) == 1);
+	fs_file_deinit(&file);
+
+	/* the async callback is called once the fsync has finished */
+	file = fs_file_init(fs, "file2", FS_OPEN_MODE_CREATE |
+			    FS_OPEN_FLAG_FSYNC | FS_OPEN_FLAG_ASYNC);
+	output = fs_write_stream(file);
+	o_stream_nsend_str(output, "world");
+	test_assert(fs_write_stream_finish(file, &output) == 0);
+	fs_file_set_async_callback(file, test_fs_posix_async_fsync_callback,
+				   &called);
+	while (!called)
+		fs_wait_async(fs);
+	test_assert(fs_write_stream_finish_async(file) == 1);
+	test_assert(fs_exists(file) == 1);
+	fs_file_deinit(&file);
+
+	fs_deinit(&fs);
+	io_loop_destroy(&ioloop);
+	if (unlink_directory(testdir, UNLINK_DIRECTORY_FLAG_RMDIR, &unlink_err) < 0)
+		i_error("Couldn't clean up test directory (%s): %s", testdir, unlink_err);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_fs_posix,
+		test_fs_posix_async_fsync,
 		NULL
 	};
 	return test_run(test_functions);
@@ -0,0 +1,476 @@
+/* Copyright (c) 2018 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "hash.h"
+#include "unlink-directory.h"
+#include "dict-transaction-memory.h"
+#include "fs-api.h"
+#include "test-common.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TEST_DIR ".test-fs-sis-dict"
+#define TEST_DATA "attachment data"
+
+/* All the dict instances share the same data, like separate processes
+   using the same dict server. */
+static HASH_TABLE(char *, char *) test_dict_data;
+/* called after each commit or at the beginning of each iteration, so the
+   tests can interleave other processes' operations */
+static void (*test_dict_commit_hook)(struct dict_transaction_memory_context *ctx);
+static void (*test_dict_iterate_hook)(const char *path);
+
+struct test_dict_iterate_context {
+	struct dict_iterate_context ctx;
+	pool_t pool;
+	ARRAY_TYPE(const_string) keys, values;
+	unsigned int idx;
+};
+
+static int
+test_dict_init(struct dict *driver, const char *uri ATTR_UNUSED,
+	       const struct dict_settings *set ATTR_UNUSED,
+	       struct dict **dict_r, const char **error_r ATTR_UNUSED)
+{
+	struct dict *dict = i_new(struct dict, 1);
+
+	*dict = *driver;
+	*dict_r = dict;
+	return 0;
+}
+
+static void test_dict_deinit(struct dict *dict)
+{
+	i_free(dict);
+}
+
+static int
+test_dict_lookup(struct dict *dict ATTR_UNUSED, pool_t pool, const char *key,
+		 const char **value_r, const char **error_r ATTR_UNUSED)
+{
+	const char *value = hash_table_lookup(test_dict_data, key);
+
+	*value_r = p_strdup(pool, value);
+	return value == NULL ? 0 : 1;
+}
+
+static struct dict_iterate_context *
+test_dict_iterate_init(struct dict *dict, const char *const *paths,
+		       enum dict_iterate_flags flags ATTR_UNUSED)
+{
+	struct test_dict_iterate_context *ctx;
+	struct hash_iterate_context *iter;
+	size_t len = strlen(paths[0]);
+	char *key, *value;
+	pool_t pool;
+
+	if (test_dict_iterate_hook != NULL)
+		test_dict_iterate_hook(paths[0]);
+
+	pool = pool_alloconly_create("test dict iterate", 256);
+	ctx = p_new(pool, struct test_dict_iterate_context, 1);
+	ctx->ctx.dict = dict;
+	ctx->pool = pool;
+	p_array_init(&ctx->keys, pool, 8);
+	p_array_init(&ctx->values, pool, 8);
+
+	iter = hash_table_iterate_init(test_dict_data);
+	while (hash_table_iterate(iter, test_dict_data, &key, &value)) {
+		if (strncmp(key, paths[0], len) != 0 ||
+		    strchr(key + len, '/') != NULL)
+			continue;
+		const char *k = p_strdup(pool, key), *v = p_strdup(pool, value);
+		array_push_back(&ctx->keys, &k);
+		array_push_back(&ctx->values, &v);
+	}
+	hash_table_iterate_deinit(&iter);
+	return &ctx->ctx;
+}
+
+static bool
+test_dict_iterate(struct dict_iterate_context *_ctx,
+		  const char **key_r, const char **value_r)
+{
+	struct test_dict_iterate_context *ctx =
+		(struct test_dict_iterate_context *)_ctx;
+
+	if (ctx->idx == array_count(&ctx->keys))
+		return FALSE;
+	*key_r = *array_idx(&ctx->keys, ctx->idx);
+	*value_r = *array_idx(&ctx->values, ctx->idx);
+	ctx->idx++;
+	return TRUE;
+}
+
+static int
+test_dict_iterate_deinit(struct dict_iterate_context *_ctx,
+			 const char **error_r ATTR_UNUSED)
+{
+	struct test_dict_iterate_context *ctx =
+		(struct test_dict_iterate_context *)_ctx;
+
+	pool_unref(&ctx->pool);
+	return 0;
+}
+
+static struct dict_transaction_context *
+test_dict_transaction_init(struct dict *dict)
+{
+	struct dict_transaction_memory_context *ctx;
+	pool_t pool;
+
+	pool = pool_alloconly_create("test dict transaction", 1024);
+	ctx = p_new(pool, struct dict_transaction_memory_context, 1);
+	dict_transaction_memory_init(ctx, dict, pool);
+	return &ctx->ctx;
+}
+
+static void test_dict_data_set(const char *key, const char *value)
+{
+	char *orig_key, *orig_value;
+
+	if (hash_table_lookup_full(test_dict_data, key,
+				   &orig_key, &orig_value)) {
+		hash_table_remove(test_dict_data, orig_key);
+		i_free(orig_key);
+		i_free(orig_value);
+	}
+	if (value != NULL) {
+		hash_table_insert(test_dict_data, i_strdup(key),
+				  i_strdup(value));
+	}
+}
+
+static void
+test_dict_transaction_commit(struct dict_transaction_context *_ctx,
+			     bool async ATTR_UNUSED,
+			     dict_transaction_commit_callback_t *callback,
+			     void *context)
+{
+	struct dict_transaction_memory_context *ctx =
+		(struct dict_transaction_memory_context *)_ctx;
+	const struct dict_transaction_memory_change *change;
+	struct dict_commit_result result;
+
+	i_zero(&result);
+	result.ret = DICT_COMMIT_RET_OK;
+	array_foreach(&ctx->changes, change) {
+		switch (change->type) {
+		case DICT_CHANGE_TYPE_SET:
+			test_dict_data_set(change->key, change->value.str);
+			break;
+		case DICT_CHANGE_TYPE_UNSET:
+			test_dict_data_set(change->key, NULL);
+			break;
+		case DICT_CHANGE_TYPE_INC:
+			i_unreached();
+		}
+	}
+	if (test_dict_commit_hook != NULL)
+		test_dict_commit_hook(ctx);
+	pool_unref(&ctx->pool);
+	callback(&result, context);
+}
+
+static struct dict test_dict_driver = {
+	.name = "test",
+	{
+		.init = test_dict_init,
+		.deinit = test_dict_deinit,
+		.lookup = test_dict_lookup,
+		.iterate_init = test_dict_iterate_init,
+		.iterate = test_dict_iterate,
+		.iterate_deinit = test_dict_iterate_deinit,
+		.transaction_init = test_dict_transaction_init,
+		.transaction_commit = test_dict_transaction_commit,
+		.transaction_rollback = dict_transaction_memory_rollback,
+		.set = dict_transaction_memory_set,
+		.unset = dict_transaction_memory_unset,
+		.atomic_inc = dict_transaction_memory_atomic_inc,
+	}
+};
+
+static struct fs *test_fs_init(void)
+{
+	struct fs_settings fs_set;
+	struct fs *fs;
+	const char *error;
+
+	i_zero(&fs_set);
+	fs_set.username = "testuser";
+	fs_set.base_dir = ".";
+	if (fs_init("sis-dict", "test: posix:prefix="TEST_DIR"/",
+		    &fs_set, &fs, &error) < 0)
+		i_fatal("fs_init() failed: %s", error);
+	return fs;
+}
+
+static int test_fs_write(struct fs *fs, const char *path)
+{
+	struct fs_file *file;
+	int ret;
+
+	file = fs_file_init(fs, path, FS_OPEN_MODE_REPLACE);
+	ret = fs_write(file, TEST_DATA, strlen(TEST_DATA));
+	fs_file_deinit(&file);
+	return ret;
+}
+
+static bool test_fs_read_ok(struct fs *fs, const char *path)
+{
+	struct fs_file *file;
+	char buf[128];
+	ssize_t ret;
+
+	file = fs_file_init(fs, path, FS_OPEN_MODE_READONLY);
+	ret = fs_read(file, buf, sizeof(buf));
+	fs_file_deinit(&file);
+	return ret == (ssize_t)strlen(TEST_DATA) &&
+		memcmp(buf, TEST_DATA, ret) == 0;
+}
+
+static int test_fs_delete(struct fs *fs, const char *path)
+{
+	struct fs_file *file;
+	int ret;
+
+	file = fs_file_init(fs, path, FS_OPEN_MODE_READONLY);
+	ret = fs_delete(file);
+	fs_file_deinit(&file);
+	return ret;
+}
+
+static int test_fs_nlinks(struct fs *fs, const char *path)
+{
+	struct fs_file *file;
+	nlink_t nlinks;
+	int ret;
+
+	file = fs_file_init(fs, path, FS_OPEN_MODE_READONLY);
+	ret = fs_get_nlinks(file, &nlinks);
+	fs_file_deinit(&file);
+	return ret < 0 ? -1 : (int)nlinks;
+}
+
+static bool test_blob_exists(const char *hash)
+{
+	struct stat st;
+
+	return stat(t_strdup_printf(TEST_DIR"/dir/hashes/%s", hash), &st) == 0;
+}
+
+static const char *test_key(const char *hash, const char *suffix)
+{
+	return t_strdup_printf(DICT_PATH_SHARED"sis/%s/%s",
+		dict_escape_string(t_strconcat("dir/hashes/", hash, NULL)),
+		suffix);
+}
+
+static void test_begin_dir(const char *name)
+{
+	const char *error;
+
+	test_begin(name);
+	if (unlink_directory(TEST_DIR, UNLINK_DIRECTORY_FLAG_RMDIR,
+			     &error) < 0)
+		i_fatal("unlink_directory(%s) failed: %s", TEST_DIR, error);
+}
+
+static void test_end_dir(void)
+{
+	const char *error;
+	char *key, *value;
+	struct hash_iterate_context *iter;
+
+	test_dict_commit_hook = NULL;
+	test_dict_iterate_hook = NULL;
+	iter = hash_table_iterate_init(test_dict_data);
+	while (hash_table_iterate(iter, test_dict_data, &key, &value)) {
+		i_free(key);
+		i_free(value);
+	}
+	hash_table_iterate_deinit(&iter);
+	hash_table_clear(test_dict_data, FALSE);
+
+	if (unlink_directory(TEST_DIR, UNLINK_DIRECTORY_FLAG_RMDIR,
+			     &error) < 0)
+		i_error("unlink_directory(%s) failed: %s", TEST_DIR, error);
+	test_end();
+}
+
+static void test_fs_sis_dict_refs(void)
+{
+	struct fs *fs1, *fs2;
+
+	test_begin_dir("fs sis-dict references");
+	fs1 = test_fs_init();
+	fs2 = test_fs_init();
+
+	test_assert(test_fs_write(fs1, "dir/h1-a") == 0);
+	test_assert(test_fs_write(fs2, "dir/h1-b") == 0);
+	test_assert(test_fs_nlinks(fs1, "dir/h1-a") == 2);
+
+	test_assert(test_fs_delete(fs1, "dir/h1-a") == 0);
+	test_assert(test_fs_delete(fs1, "dir/h1-a") < 0 && errno == ENOENT);
+	fs_deinit(&fs1);
+	test_assert(test_blob_exists("h1"));
+	test_assert(test_fs_read_ok(fs2, "dir/h1-b"));
+	test_assert(test_fs_nlinks(fs2, "dir/h1-b") == 1);
+
+	test_assert(test_fs_delete(fs2, "dir/h1-b") == 0);
+	fs_deinit(&fs2);
+	test_assert(!test_blob_exists("h1"));
+	test_end_dir();
+}
+
+static struct fs *test_hook_fs;
+
+static void
+test_concurrent_write_hook(struct dict_transaction_memory_context *ctx ATTR_UNUSED)
+{
+	struct fs *fs = test_hook_fs;
+
+	/* the other writer runs after our reference was added but before
+	   we checked if the blob exists */
+	test_dict_commit_hook = NULL;
+	test_hook_fs = NULL;
+	test_assert(test_fs_write(fs, "dir/h2-b") == 0);
+}
+
+static void test_fs_sis_dict_concurrent_writers(void)
+{
+	struct fs *fs1, *fs2;
+
+	test_begin_dir("fs sis-dict concurrent writers");
+	fs1 = test_fs_init();
+	fs2 = test_fs_init();
+
+	test_hook_fs = fs2;
+	test_dict_commit_hook = test_concurrent_write_hook;
+	test_assert(test_fs_write(fs1, "dir/h2-a") == 0);
+	test_assert(test_dict_commit_hook == NULL);
+	test_assert(test_fs_nlinks(fs1, "dir/h2-a") == 2);
+
+	/* dropping one reference keeps the blob */
+	test_assert(test_fs_delete(fs2, "dir/h2-b") == 0);
+	fs_deinit(&fs2);
+	test_assert(test_fs_read_ok(fs1, "dir/h2-a"));
+	fs_deinit(&fs1);
+	test_end_dir();
+}
+
+static void
+test_delete_race_hook(struct dict_transaction_memory_context *ctx)
+{
+	const struct dict_transaction_memory_change *change;
+	bool deleting = FALSE;
+
+	array_foreach(&ctx->changes, change) {
+		if (change->type == DICT_CHANGE_TYPE_SET &&
+		    strstr(change->key, "/deleting/") != NULL)
+			deleting = TRUE;
+	}
+	if (!deleting)
+		return;
+
+	/* a writer adds its reference right after the deleter announced
+	   the deletion */
+	test_dict_commit_hook = NULL;
+	test_dict_data_set(test_key("h3", "refs/h3-b"), "1");
+}
+
+static void test_fs_sis_dict_delete_race(void)
+{
+	struct fs *fs1, *fs2;
+
+	test_begin_dir("fs sis-dict delete racing with a new reference");
+	fs1 = test_fs_init();
+	fs2 = test_fs_init();
+
+	test_assert(test_fs_write(fs1, "dir/h3-a") == 0);
+	test_assert(test_fs_delete(fs1, "dir/h3-a") == 0);
+
+	test_dict_commit_hook = test_delete_race_hook;
+	fs_deinit(&fs1);
+	test_assert(test_dict_commit_hook == NULL);
+	/* the deleter saw the reference and kept the blob */
+	test_assert(test_blob_exists("h3"));
+
+	/* the writer continues and finds the blob */
+	test_assert(test_fs_write(fs2, "dir/h3-b") == 0);
+	test_assert(test_fs_read_ok(fs2, "dir/h3-b"));
+	test_assert(test_fs_nlinks(fs2, "dir/h3-b") == 1);
+	fs_deinit(&fs2);
+	test_end_dir();
+}
+
+static unsigned int test_deleting_iter_count;
+
+static void test_wait_delete_hook(const char *path)
+{
+	if (strstr(path, "/deleting/") == NULL)
+		return;
+	if (++test_deleting_iter_count < 2)
+		return;
+
+	/* the deleter finishes while the writer is waiting for it */
+	test_dict_iterate_hook = NULL;
+	i_unlink(TEST_DIR"/dir/hashes/h4");
+	test_dict_data_set(test_key("h4", "deleting/other"), NULL);
+}
+
+static void test_fs_sis_dict_write_while_deleting(void)
+{
+	struct fs *fs1, *fs2;
+
+	test_begin_dir("fs sis-dict write while deleting");
+	fs1 = test_fs_init();
+	fs2 = test_fs_init();
+
+	/* the deleter has seen that there are no references and is about to
+	   delete the blob */
+	test_assert(test_fs_write(fs1, "dir/h4-a") == 0);
+	test_dict_data_set(test_key("h4", "refs/h4-a"), NULL);
+	test_dict_data_set(test_key("h4", "deleting/other"),
+			   dec2str(time(NULL)));
+
+	test_deleting_iter_count = 0;
+	test_dict_iterate_hook = test_wait_delete_hook;
+	test_assert(test_fs_write(fs2, "dir/h4-b") == 0);
+	test_assert(test_deleting_iter_count == 2);
+	/* the writer noticed the deletion and wrote the blob again */
+	test_assert(test_blob_exists("h4"));
+	test_assert(test_fs_read_ok(fs2, "dir/h4-b"));
+
+	/* stale deletions are ignored and removed */
+	test_dict_data_set(test_key("h4", "deleting/crashed"), "1");
+	test_assert(test_fs_write(fs2, "dir/h4-c") == 0);
+	test_assert(hash_table_lookup(test_dict_data,
+		test_key("h4", "deleting/crashed")) == NULL);
+	test_assert(test_fs_nlinks(fs2, "dir/h4-c") == 2);
+
+	fs_deinit(&fs1);
+	fs_deinit(&fs2);
+	test_end_dir();
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_fs_sis_dict_refs,
+		test_fs_sis_dict_concurrent_writers,
+		test_fs_sis_dict_delete_race,
+		test_fs_sis_dict_write_while_deleting,
+		NULL
+	};
+	int ret;
+
+	hash_table_create(&test_dict_data, default_pool, 0, str_hash, strcmp);
+	dict_driver_register(&test_dict_driver);
+	ret = test_run(test_functions);
+	dict_driver_unregister(&test_dict_driver);
+	hash_table_destroy(&test_dict_data);
+	return ret;
+}
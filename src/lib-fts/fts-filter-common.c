@@ -8,6 +8,8 @@
 #include "fts-filter-common.h"
 #include "fts-tokenizer-common.h"
 
+#include <ctype.h>
+
 void fts_filter_truncate_token(string_t *token, size_t max_length)
 {
 	if (str_len(token) <= max_length)
@@ -18,3 +20,17 @@ void fts_filter_truncate_token(string_t *token, size_t max_length)
 	str_truncate(token, len);
 	i_assert(len <= max_length);
 }
+
+bool fts_filter_ascii_lcase(string_t *dest, const char *token)
+{
+	size_t i, orig_len = str_len(dest);
+
+	for (i = 0; token[i] != '\0'; i++) {
+		if ((unsigned char)token[i] >= 0x80) {
+			str_truncate(dest, orig_len);
+			return FALSE;
+		}
+		str_append_c(dest, i_tolower(token[i]));
+	}
+	return TRUE;
+}
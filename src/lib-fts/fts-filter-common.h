@@ -2,5 +2,9 @@
 #define FTS_FILTER_COMMON_H
 
 void fts_filter_truncate_token(string_t *token, size_t max_length);
+/* Append the lowercased token to dest if it consists only of ASCII
+   characters and return TRUE. Otherwise return FALSE and leave dest
+   unchanged. */
+bool fts_filter_ascii_lcase(string_t *dest, const char *token);
 
 #endif
@@ -19,8 +19,15 @@ struct fts_filter_normalizer_icu {
 	UTransliterator *transliterator;
 	ARRAY_TYPE(icu_utf16) utf16_token, trans_token;
 	string_t *utf8_token;
+
+	/* The default transliterator only lowercases ASCII tokens and
+	   removes their spaces, so those can be handled without ICU. */
+	bool ascii_lcase:1;
 };
 
+#define FTS_FILTER_NORMALIZER_ICU_DEFAULT_ID \
+	"Any-Lower; NFKD; [: Nonspacing Mark :] Remove; NFC; [\\x20] Remove"
+
 static void fts_filter_normalizer_icu_destroy(struct fts_filter *filter)
 {
 	struct fts_filter_normalizer_icu *np =
@@ -40,7 +47,7 @@ fts_filter_normalizer_icu_create(const struct fts_language *lang ATTR_UNUSED,
 	struct fts_filter_normalizer_icu *np;
 	pool_t pp;
 	unsigned int i, max_length = 250;
-	const char *id = "Any-Lower; NFKD; [: Nonspacing Mark :] Remove; NFC; [\\x20] Remove";
+	const char *id = FTS_FILTER_NORMALIZER_ICU_DEFAULT_ID;
 
 	for (i = 0; settings[i] != NULL; i += 2) {
 		const char *key = settings[i], *value = settings[i+1];
@@ -65,6 +72,7 @@ fts_filter_normalizer_icu_create(const struct fts_language *lang ATTR_UNUSED,
 	np->pool = pp;
 	np->filter = *fts_filter_normalizer_icu;
 	np->transliterator_id = p_strdup(pp, id);
+	np->ascii_lcase = strcmp(id, FTS_FILTER_NORMALIZER_ICU_DEFAULT_ID) == 0;
 	p_array_init(&np->utf16_token, pp, 64);
 	p_array_init(&np->trans_token, pp, 64);
 	np->utf8_token = buffer_create_dynamic(pp, 128);
@@ -73,6 +81,20 @@ fts_filter_normalizer_icu_create(const struct fts_language *lang ATTR_UNUSED,
 	return 0;
 }
 
+static void fts_filter_normalizer_icu_remove_spaces(string_t *token)
+{
+	char *data = str_c_modifiable(token);
+	size_t i, j;
+
+	if (strchr(data, ' ') == NULL)
+		return;
+	for (i = j = 0; data[i] != '\0'; i++) {
+		if (data[i] != ' ')
+			data[j++] = data[i];
+	}
+	str_truncate(token, j);
+}
+
 static int
 fts_filter_normalizer_icu_filter(struct fts_filter *filter, const char **token,
 				 const char **error_r)
@@ -80,6 +102,19 @@ fts_filter_normalizer_icu_filter(struct fts_filter *filter, const char **token,
 	struct fts_filter_normalizer_icu *np =
 		(struct fts_filter_normalizer_icu *)filter;
 
+	if (np->ascii_lcase) {
+		str_truncate(np->utf8_token, 0);
+		if (fts_filter_ascii_lcase(np->utf8_token, *token)) {
+			fts_filter_normalizer_icu_remove_spaces(np->utf8_token);
+			if (str_len(np->utf8_token) == 0)
+				return 0;
+			fts_filter_truncate_token(np->utf8_token,
+						  np->filter.max_length);
+			*token = str_c(np->utf8_token);
+			return 1;
+		}
+	}
+
 	if (np->transliterator == NULL)
 		if (fts_icu_transliterator_create(np->transliterator_id,
 		                                  &np->transliterator,
@@ -27,6 +27,23 @@ static unsigned char fts_ascii_word_breaks[128] = {
 	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 0  /* 112-127: {|}~ */
 };
 
+/* letter_type() of each ASCII character, filled by the first TR29
+   tokenizer */
+static enum letter_type fts_ascii_letter_types[128];
+static bool fts_ascii_letter_types_initialized = FALSE;
+
+static void fts_ascii_letter_types_init(void);
+
+static inline int
+fts_tokenizer_get_char(const unsigned char *data, size_t size, unichar_t *c_r)
+{
+	if (data[0] < 0x80) {
+		*c_r = data[0];
+		return 1;
+	}
+	return uni_utf8_get_char_n(data, size, c_r);
+}
+
 static int
 fts_tokenizer_generic_create(const char *const *settings,
 			     struct fts_tokenizer **tokenizer_r,
@@ -86,6 +103,10 @@ fts_tokenizer_generic_create(const char *const *settings,
 		return -1;
 	}
 
+	if (algo == BOUNDARY_ALGORITHM_TR29 &&
+	    !fts_ascii_letter_types_initialized)
+		fts_ascii_letter_types_init();
+
 	tok = i_new(struct generic_fts_tokenizer, 1);
 	if (algo == BOUNDARY_ALGORITHM_TR29)
 		tok->tokenizer.v = &generic_tokenizer_vfuncs_tr29;
@@ -259,7 +280,15 @@ fts_tokenizer_generic_simple_next(struct fts_tokenizer *_tok,
 	enum fts_break_type break_type;
 
 	for (i = 0; i < size; i += char_size) {
-		char_size = uni_utf8_get_char_n(data + i, size - i, &c);
+		if (data[i] < 0x80 && fts_ascii_word_breaks[data[i]] == 0 &&
+		    tok->prev_type == LETTER_TYPE_ALETTER &&
+		    !IS_APOSTROPHE(data[i]) && !IS_PREFIX_SPLAT(data[i])) {
+			/* fast path: ASCII letter continuing the word */
+			shift_prev_type(tok, LETTER_TYPE_ALETTER);
+			char_size = 1;
+			continue;
+		}
+		char_size = fts_tokenizer_get_char(data + i, size - i, &c);
 		i_assert(char_size > 0);
 
 		apostrophe = IS_APOSTROPHE(c);
@@ -318,7 +347,7 @@ fts_tokenizer_generic_simple_next(struct fts_tokenizer *_tok,
    HYPHEN.
    TODO
 */
-static enum letter_type letter_type(unichar_t c)
+static enum letter_type letter_type_lookup(unichar_t c)
 {
 	unsigned int idx;
 
@@ -361,6 +390,22 @@ static enum letter_type letter_type(unichar_t c)
 	return LETTER_TYPE_OTHER;
 }
 
+static void fts_ascii_letter_types_init(void)
+{
+	unichar_t c;
+
+	for (c = 0; c < N_ELEMENTS(fts_ascii_letter_types); c++)
+		fts_ascii_letter_types[c] = letter_type_lookup(c);
+	fts_ascii_letter_types_initialized = TRUE;
+}
+
+static inline enum letter_type letter_type(unichar_t c)
+{
+	if (c < N_ELEMENTS(fts_ascii_letter_types))
+		return fts_ascii_letter_types[c];
+	return letter_type_lookup(c);
+}
+
 static bool letter_panic(struct generic_fts_tokenizer *tok ATTR_UNUSED)
 {
 	i_panic("Letter type should not be used.");
@@ -714,7 +759,7 @@ fts_tokenizer_generic_tr29_next(struct fts_tokenizer *_tok,
 
 	for (i = 0; i < size; ) {
 		char_start_i = i;
-		char_size = uni_utf8_get_char_n(data + i, size - i, &c);
+		char_size = fts_tokenizer_get_char(data + i, size - i, &c);
 		i_assert(char_size > 0);
 		i += char_size;
 		lt = letter_type(c);
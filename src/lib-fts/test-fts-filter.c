@@ -648,6 +648,42 @@ static void test_fts_filter_normalizer_empty(void)
 	test_end();
 }
 
+static void test_fts_filter_normalizer_ascii(void)
+{
+	/* the default id is handled without ICU for ASCII tokens. compare it
+	   against an equivalent id that always goes through ICU. */
+	static const char *tokens[] = {
+		"Hello", "hello World", " ", "  A b  ", "MiXeD-123_'x", "~`!@#$%^"
+	};
+	const char * const settings[] =
+		{"id", "Any-Lower; NFKD; [: Nonspacing Mark :] Remove; NFC; [\\x20] Remove; Null", NULL};
+	struct fts_filter *norm, *norm_icu;
+	const char *token, *token_icu, *error;
+	char ascii_token[2] = { '\0', '\0' };
+	unsigned int i;
+	int ret;
+
+	test_begin("fts filter normalizer ascii");
+	test_assert(fts_filter_create(fts_filter_normalizer_icu, NULL, NULL, NULL, &norm, &error) == 0);
+	test_assert(fts_filter_create(fts_filter_normalizer_icu, NULL, NULL, settings, &norm_icu, &error) == 0);
+	for (i = 0; i < N_ELEMENTS(tokens) + 127; i++) {
+		if (i < N_ELEMENTS(tokens))
+			token = tokens[i];
+		else {
+			ascii_token[0] = i - N_ELEMENTS(tokens) + 1;
+			token = ascii_token;
+		}
+		token_icu = token = t_strdup(token);
+		ret = fts_filter_filter(norm, &token, &error);
+		test_assert_idx(fts_filter_filter(norm_icu, &token_icu, &error) == ret, i);
+		if (ret > 0)
+			test_assert_idx(strcmp(token, token_icu) == 0, i);
+	}
+	fts_filter_unref(&norm);
+	fts_filter_unref(&norm_icu);
+	test_end();
+}
+
 static void test_fts_filter_normalizer_baddata(void)
 {
 	const char * const settings[] =
@@ -1003,6 +1039,7 @@ int main(void)
 		test_fts_filter_normalizer_swedish_short_default_id,
 		test_fts_filter_normalizer_french,
 		test_fts_filter_normalizer_empty,
+		test_fts_filter_normalizer_ascii,
 		test_fts_filter_normalizer_baddata,
 		test_fts_filter_normalizer_invalid_id,
 		test_fts_filter_normalizer_oversized,
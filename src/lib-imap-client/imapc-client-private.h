@@ -28,6 +28,8 @@ struct imapc_client {
 	void *login_context;
 
 	ARRAY(struct imapc_client_connection *) conns;
+	/* connection where the last non-mailbox command was sent */
+	struct imapc_client_connection *cmd_conn;
 	bool logging_out;
 
 	struct ioloop *ioloop;
@@ -142,6 +142,8 @@ void imapc_client_disconnect(struct imapc_client *client)
 	for (i = count; i > 0; i--) {
 		conn = conns[i-1];
 		array_delete(&client->conns, i-1, 1);
+		if (client->cmd_conn == conn)
+			client->cmd_conn = NULL;
 
 		i_assert(imapc_connection_get_mailbox(conn->conn) == NULL);
 		imapc_connection_deinit(&conn->conn);
@@ -270,13 +272,44 @@ imapc_client_add_connection(struct imapc_client *client)
 static struct imapc_connection *
 imapc_client_find_connection(struct imapc_client *client)
 {
-	struct imapc_client_connection *const *connp;
+	struct imapc_client_connection *const *connp, *best = NULL;
+	unsigned int count, best_count = UINT_MAX, nonmailbox_count;
 
-	/* FIXME: stupid algorithm */
 	if (array_count(&client->conns) == 0)
 		return imapc_client_add_connection(client)->conn;
-	connp = array_front(&client->conns);
-	return (*connp)->conn;
+
+	/* the non-mailbox commands must be handled in the order they were
+	   sent, so keep using the same connection until they're finished */
+	if (client->cmd_conn != NULL) {
+		(void)imapc_connection_get_pending_count(client->cmd_conn->conn,
+							 &nonmailbox_count);
+		if (nonmailbox_count > 0)
+			return client->cmd_conn->conn;
+	}
+
+	/* Use the logged in connection with the fewest pending commands, so
+	   that e.g. a large FETCH in a selected mailbox doesn't delay the
+	   command. Prefer connections without a mailbox on ties. */
+	array_foreach(&client->conns, connp) {
+		if (imapc_connection_get_state((*connp)->conn) !=
+		    IMAPC_CONNECTION_STATE_DONE)
+			continue;
+		count = imapc_connection_get_pending_count((*connp)->conn,
+							   &nonmailbox_count);
+		if (count < best_count ||
+		    (count == best_count && (*connp)->box == NULL &&
+		     best->box != NULL)) {
+			best = *connp;
+			best_count = count;
+		}
+	}
+	if (best == NULL) {
+		/* nothing is logged in yet */
+		connp = array_front(&client->conns);
+		best = *connp;
+	}
+	client->cmd_conn = best;
+	return best->conn;
 }
 
 struct imapc_command *
@@ -2480,6 +2480,25 @@ imapc_connection_get_mailbox(struct imapc_connection *conn)
 	return conn->selected_box;
 }
 
+unsigned int
+imapc_connection_get_pending_count(struct imapc_connection *conn,
+				   unsigned int *nonmailbox_count_r)
+{
+	struct imapc_command *const *cmdp;
+
+	*nonmailbox_count_r = 0;
+	array_foreach(&conn->cmd_send_queue, cmdp) {
+		if ((*cmdp)->box == NULL)
+			(*nonmailbox_count_r)++;
+	}
+	array_foreach(&conn->cmd_wait_list, cmdp) {
+		if ((*cmdp)->box == NULL)
+			(*nonmailbox_count_r)++;
+	}
+	return array_count(&conn->cmd_send_queue) +
+		array_count(&conn->cmd_wait_list);
+}
+
 static void
 imapc_connection_idle_callback(const struct imapc_command_reply *reply ATTR_UNUSED,
 			       void *context)
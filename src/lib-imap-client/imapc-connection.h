@@ -57,6 +57,12 @@ imapc_connection_get_capabilities(struct imapc_connection *conn);
 
 struct imapc_client_mailbox *
 imapc_connection_get_mailbox(struct imapc_connection *conn);
+/* Returns the number of commands that are queued or waiting for a reply.
+   The number of them that aren't for any mailbox is returned in
+   nonmailbox_count_r. */
+unsigned int
+imapc_connection_get_pending_count(struct imapc_connection *conn,
+				   unsigned int *nonmailbox_count_r);
 
 void imapc_connection_idle(struct imapc_connection *conn);
 
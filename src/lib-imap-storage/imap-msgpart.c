@@ -763,7 +763,7 @@ imap_msgpart_parse_bodystructure(struct mail *mail,
 	if (mail_get_special(mail, MAIL_FETCH_IMAP_BODYSTRUCTURE,
 			     &bodystructure) < 0)
 		return -1;
-	if (all_parts->context != NULL) {
+	if (all_parts->data != NULL) {
 		/* we just parsed the bodystructure */
 		return 0;
 	}
@@ -824,9 +824,10 @@ int imap_msgpart_bodypartstructure(struct mail *mail,
 		return 0;
 	}
 
+	mail_add_temp_wanted_fields(mail, MAIL_FETCH_IMAP_BODYSTRUCTURE, NULL);
 	if (mail_get_parts(mail, &all_parts) < 0)
 		return -1;
-	if (all_parts->context == NULL) {
+	if (all_parts->data == NULL) {
 		if (imap_msgpart_parse_bodystructure(mail, all_parts) < 0)
 			return -1;
 	}
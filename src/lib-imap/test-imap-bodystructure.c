@@ -5,6 +5,7 @@
 #include "str.h"
 #include "message-part-data.h"
 #include "message-parser.h"
+#include "message-part-serialize.h"
 #include "imap-bodystructure.h"
 #include "test-common.h"
 
@@ -430,6 +431,44 @@ static void test_imap_bodystructure_write(void)
 	} T_END;
 }
 
+static void test_imap_bodystructure_serialize(void)
+{
+	struct message_part *parts, *parts2;
+	const char *error;
+	unsigned int i;
+
+	for (i = 0; i < parse_tests_count; i++) T_BEGIN {
+		struct parse_test *test = &parse_tests[i];
+		string_t *str = t_str_new(128);
+		buffer_t *parts_buf = t_buffer_create(128);
+		buffer_t *data_buf = t_buffer_create(256);
+		pool_t pool = pool_alloconly_create("imap bodystructure serialize", 1024);
+
+		test_begin(t_strdup_printf("imap bodystructure serialize [%u]", i));
+		parts = msg_parse(pool, test->message, TRUE);
+		message_part_serialize(parts, parts_buf);
+		message_part_data_serialize(parts, data_buf);
+
+		parts2 = message_part_deserialize(pool, parts_buf->data,
+						  parts_buf->used, &error);
+		test_assert(parts2 != NULL);
+		test_assert(message_part_data_deserialize(pool, parts2,
+			data_buf->data, data_buf->used, &error) == 0);
+		imap_bodystructure_write(parts2, str, TRUE);
+		test_assert(strcmp(str_c(str), test->bodystructure) == 0);
+
+		/* truncated data fails and leaves no partial data */
+		parts2 = message_part_deserialize(pool, parts_buf->data,
+						  parts_buf->used, &error);
+		test_assert(message_part_data_deserialize(pool, parts2,
+			data_buf->data, data_buf->used - 1, &error) < 0);
+		test_assert(parts2->data == NULL);
+
+		pool_unref(&pool);
+		test_end();
+	} T_END;
+}
+
 static void test_imap_bodystructure_parse(void)
 {
 	struct message_part *parts;
@@ -533,6 +572,7 @@ int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_imap_bodystructure_write,
+		test_imap_bodystructure_serialize,
 		test_imap_bodystructure_parse,
 		test_imap_bodystructure_normalize,
 		test_imap_bodystructure_parse_full,
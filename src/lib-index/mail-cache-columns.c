@@ -0,0 +1,212 @@
+/* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "bsearch-insert-pos.h"
+#include "sort.h"
+#include "nfs-workarounds.h"
+#include "mmap-util.h"
+#include "mail-cache-private.h"
+
+static void
+mail_cache_columns_set_corrupted(struct mail_cache *cache, const char *path,
+				 const char *reason)
+{
+	/* the columns are only an optimization. just ignore the file -
+	   the next compression rewrites it. */
+	i_warning("Corrupted index cache columns file %s: %s - ignoring",
+		  path, reason);
+	mail_cache_columns_close(cache);
+}
+
+void mail_cache_columns_close(struct mail_cache *cache)
+{
+	if (cache->columns_mmap_base != NULL) {
+		if (munmap(cache->columns_mmap_base,
+			   cache->columns_mmap_length) < 0)
+			i_error("munmap(%s"MAIL_CACHE_COLUMNS_FILE_SUFFIX
+				") failed: %m", cache->filepath);
+	}
+	cache->columns_mmap_base = NULL;
+	cache->columns_mmap_length = 0;
+	cache->column_uids = NULL;
+	cache->column_rows = 0;
+	if (array_is_created(&cache->columns))
+		array_clear(&cache->columns);
+}
+
+static bool
+mail_cache_columns_parse(struct mail_cache *cache, const char *path)
+{
+	const struct mail_cache_columns_header *hdr;
+	const struct mail_cache_column_header *col_hdrs;
+	const struct mail_cache_field *field;
+	struct mail_cache_column *column;
+	const unsigned char *base = cache->columns_mmap_base;
+	size_t size = cache->columns_mmap_length;
+	size_t offset, data_size;
+	unsigned int i, field_idx;
+
+	if (size < sizeof(*hdr)) {
+		mail_cache_columns_set_corrupted(cache, path, "File too small");
+		return FALSE;
+	}
+	hdr = cache->columns_mmap_base;
+	if (hdr->indexid != cache->hdr->indexid ||
+	    hdr->file_seq != cache->hdr->file_seq) {
+		/* written for a different cache file */
+		return FALSE;
+	}
+	offset = sizeof(*hdr) + sizeof(*col_hdrs) * (size_t)hdr->column_count +
+		sizeof(uint32_t) * (size_t)hdr->row_count;
+	if (hdr->column_count > cache->file_fields_count || offset > size) {
+		mail_cache_columns_set_corrupted(cache, path,
+			"Header points outside file");
+		return FALSE;
+	}
+	col_hdrs = CONST_PTR_OFFSET(base, sizeof(*hdr));
+	cache->column_uids = CONST_PTR_OFFSET(col_hdrs,
+		sizeof(*col_hdrs) * hdr->column_count);
+	cache->column_rows = hdr->row_count;
+
+	if (!array_is_created(&cache->columns))
+		i_array_init(&cache->columns, hdr->column_count);
+	for (i = 0; i < hdr->column_count; i++) {
+		if (col_hdrs[i].file_field_idx >= cache->file_fields_count) {
+			mail_cache_columns_set_corrupted(cache, path,
+				"Invalid field index");
+			return FALSE;
+		}
+		data_size = MAIL_CACHE_COLUMN_EXISTS_SIZE(hdr->row_count) +
+			(size_t)col_hdrs[i].field_size * hdr->row_count;
+		if (col_hdrs[i].offset > size ||
+		    data_size > size - col_hdrs[i].offset) {
+			mail_cache_columns_set_corrupted(cache, path,
+				"Column points outside file");
+			return FALSE;
+		}
+
+		field_idx = cache->file_field_map[col_hdrs[i].file_field_idx];
+		field = &cache->fields[field_idx].field;
+		if (field->type != MAIL_CACHE_FIELD_FIXED_SIZE ||
+		    field->field_size != col_hdrs[i].field_size) {
+			/* field was re-registered with a different size */
+			continue;
+		}
+
+		column = array_append_space(&cache->columns);
+		column->field_idx = field_idx;
+		column->field_size = col_hdrs[i].field_size;
+		column->exists = CONST_PTR_OFFSET(base, col_hdrs[i].offset);
+		column->data = CONST_PTR_OFFSET(column->exists,
+			MAIL_CACHE_COLUMN_EXISTS_SIZE(hdr->row_count));
+	}
+	return TRUE;
+}
+
+static void mail_cache_columns_open(struct mail_cache *cache)
+{
+	const char *path;
+	int fd;
+
+	mail_cache_columns_close(cache);
+	cache->columns_file_seq = cache->hdr->file_seq;
+
+	if ((cache->index->flags & MAIL_INDEX_OPEN_FLAG_MMAP_DISABLE) != 0 ||
+	    MAIL_INDEX_IS_IN_MEMORY(cache->index))
+		return;
+
+	path = t_strconcat(cache->filepath, MAIL_CACHE_COLUMNS_FILE_SUFFIX, NULL);
+	fd = nfs_safe_open(path, O_RDONLY);
+	if (fd == -1) {
+		if (errno != ENOENT)
+			i_error("open(%s) failed: %m", path);
+		return;
+	}
+	cache->columns_mmap_base =
+		mmap_ro_file(fd, &cache->columns_mmap_length);
+	if (cache->columns_mmap_base == MAP_FAILED) {
+		i_error("mmap(%s) failed: %m", path);
+		cache->columns_mmap_base = NULL;
+		cache->columns_mmap_length = 0;
+	}
+	i_close_fd(&fd);
+
+	if (cache->columns_mmap_base != NULL &&
+	    !mail_cache_columns_parse(cache, path))
+		mail_cache_columns_close(cache);
+}
+
+static const struct mail_cache_column *
+mail_cache_column_find(struct mail_cache *cache, unsigned int field_idx)
+{
+	const struct mail_cache_column *column;
+
+	if (MAIL_CACHE_IS_UNUSABLE(cache))
+		return NULL;
+	if (cache->columns_file_seq != cache->hdr->file_seq)
+		mail_cache_columns_open(cache);
+	if (cache->column_rows == 0)
+		return NULL;
+
+	array_foreach(&cache->columns, column) {
+		if (column->field_idx == field_idx)
+			return column;
+	}
+	return NULL;
+}
+
+static bool
+mail_cache_column_find_row(struct mail_cache_view *view, uint32_t uid,
+			   unsigned int *row_r)
+{
+	const uint32_t *uids = view->cache->column_uids;
+	unsigned int rows = view->cache->column_rows;
+	unsigned int row = view->column_row;
+
+	/* the common case is looking up the same or the next mail */
+	if (row < rows && uids[row] == uid) {
+		*row_r = row;
+		return TRUE;
+	}
+	if (row + 1 < rows && uids[row + 1] == uid) {
+		*row_r = view->column_row = row + 1;
+		return TRUE;
+	}
+	if (!bsearch_insert_pos(&uid, uids, rows, sizeof(*uids),
+				uint32_cmp, &row))
+		return FALSE;
+	*row_r = view->column_row = row;
+	return TRUE;
+}
+
+bool mail_cache_lookup_column(struct mail_cache_view *view, uint32_t seq,
+			      unsigned int field_idx, buffer_t *dest_buf)
+{
+	const struct mail_cache_column *column;
+	unsigned int row;
+	uint32_t uid;
+
+	if (!view->cache->opened)
+		(void)mail_cache_open_and_verify(view->cache);
+
+	column = mail_cache_column_find(view->cache, field_idx);
+	if (column == NULL)
+		return FALSE;
+
+	if (seq > mail_index_view_get_messages_count(view->view))
+		return FALSE;
+	mail_index_lookup_uid(view->view, seq, &uid);
+	if (!mail_cache_column_find_row(view, uid, &row))
+		return FALSE;
+	if ((column->exists[row / 8] & (1 << (row % 8))) == 0) {
+		/* not cached while compressing, but it could have been
+		   added later on */
+		return FALSE;
+	}
+	if (dest_buf != NULL) {
+		buffer_append(dest_buf, column->data + row * column->field_size,
+			      column->field_size);
+	}
+	return TRUE;
+}
@@ -5,6 +5,7 @@
 #include "ostream.h"
 #include "nfs-workarounds.h"
 #include "read-full.h"
+#include "write-full.h"
 #include "file-dotlock.h"
 #include "file-cache.h"
 #include "file-set-size.h"
@@ -13,12 +14,58 @@
 #include <stdio.h>
 #include <sys/stat.h>
 
+struct mail_cache_copy_column {
+	unsigned int field_idx;
+	uint32_t file_field_idx;
+	unsigned int field_size;
+	buffer_t *exists, *data;
+};
+
+enum mail_cache_copy_field_drop {
+	/* field hasn't been accessed for a while. change its decision to NO */
+	MAIL_CACHE_COPY_DROP_DECISION	= 0x01,
+	/* field isn't written to the new cache file */
+	MAIL_CACHE_COPY_DROP_FIELD	= 0x02
+};
+
+struct mail_cache_copy_offset {
+	uint32_t uid;
+	uint32_t offset;
+};
+
 struct mail_cache_copy_context {
 	struct mail_cache *cache;
+	struct ostream *output;
+	struct mail_cache_header hdr;
+
+	/* the new cache file. With incremental compression these stay
+	   across multiple syncs. */
+	int fd;
+	char *temp_path;
+	/* file_seq of the cache file that is being compressed */
+	uint32_t old_file_seq;
 
 	buffer_t *buffer, *field_seen;
 	ARRAY(unsigned int) bitmask_pos;
 	uint32_t *field_file_map;
+	/* enum mail_cache_copy_field_drop for each field. These are applied
+	   to cache->fields only after the new file is finished. */
+	uint8_t *field_drop;
+	/* number of fields in field_file_map. More fields may be registered
+	   while an incremental compression is in progress. */
+	unsigned int fields_count;
+	unsigned int used_fields_count;
+
+	/* offsets of the written records */
+	ARRAY(struct mail_cache_copy_offset) offsets;
+	/* the next mail to copy has at least this UID */
+	uint32_t next_uid;
+	uint32_t max_uid;
+
+	/* field_idx -> columns index + 1, or 0 if the field isn't a column */
+	unsigned int *field_column_map;
+	ARRAY(struct mail_cache_copy_column) columns;
+	ARRAY_TYPE(uint32_t) column_uids;
 
 	uint8_t field_seen_value;
 	bool new_msg;
@@ -46,6 +93,25 @@ mail_cache_merge_bitmask(struct mail_cache_copy_context *ctx,
 		dest[i] |= ((const unsigned char*)field->data)[i];
 }
 
+static void
+mail_cache_copy_column_add(struct mail_cache_copy_context *ctx,
+			   const struct mail_cache_iterate_field *field)
+{
+	struct mail_cache_copy_column *column;
+	unsigned int row = array_count(&ctx->column_uids);
+	uint8_t *exists;
+
+	column = array_idx_modifiable(&ctx->columns,
+		ctx->field_column_map[field->field_idx] - 1);
+	if (field->size != column->field_size)
+		return;
+
+	buffer_write(column->data, row * column->field_size,
+		     field->data, field->size);
+	exists = buffer_get_space_unsafe(column->exists, row / 8, 1);
+	*exists |= 1 << (row % 8);
+}
+
 static void
 mail_cache_compress_field(struct mail_cache_copy_context *ctx,
 			  const struct mail_cache_iterate_field *field)
@@ -55,6 +121,8 @@ mail_cache_compress_field(struct mail_cache_copy_context *ctx,
 	uint32_t file_field_idx, size32;
 	uint8_t *field_seen;
 
+	if (field->field_idx >= ctx->fields_count)
+		return;
 	file_field_idx = ctx->field_file_map[field->field_idx];
 	if (file_field_idx == (uint32_t)-1)
 		return;
@@ -96,6 +164,141 @@ mail_cache_compress_field(struct mail_cache_copy_context *ctx,
 	buffer_append(ctx->buffer, field->data, field->size);
 	if ((field->size & 3) != 0)
 		buffer_append_zero(ctx->buffer, 4 - (field->size & 3));
+
+	if (ctx->field_column_map != NULL &&
+	    ctx->field_column_map[field->field_idx] != 0)
+		mail_cache_copy_column_add(ctx, field);
+}
+
+static void
+mail_cache_copy_columns_init(struct mail_cache_copy_context *ctx)
+{
+	struct mail_cache *cache = ctx->cache;
+	struct mail_cache_copy_column *column;
+	const struct mail_cache_field *field;
+	unsigned int i;
+
+	i_array_init(&ctx->columns, 8);
+	for (i = 0; i < ctx->fields_count; i++) {
+		field = &cache->fields[i].field;
+		if (ctx->field_file_map[i] == (uint32_t)-1 ||
+		    field->type != MAIL_CACHE_FIELD_FIXED_SIZE ||
+		    field->field_size > MAIL_CACHE_COLUMN_MAX_FIELD_SIZE ||
+		    (field->decision & ~MAIL_CACHE_DECISION_FORCED) !=
+		    MAIL_CACHE_DECISION_YES)
+			continue;
+
+		if (ctx->field_column_map == NULL) {
+			ctx->field_column_map =
+				i_new(unsigned int, ctx->fields_count);
+		}
+		column = array_append_space(&ctx->columns);
+		column->field_idx = i;
+		column->file_field_idx = ctx->field_file_map[i];
+		column->field_size = field->field_size;
+		column->exists = buffer_create_dynamic(default_pool, 128);
+		column->data = buffer_create_dynamic(default_pool, 1024);
+		ctx->field_column_map[i] = array_count(&ctx->columns);
+	}
+	if (ctx->field_column_map != NULL)
+		i_array_init(&ctx->column_uids, 128);
+}
+
+static void
+mail_cache_copy_columns_deinit(struct mail_cache_copy_context *ctx)
+{
+	struct mail_cache_copy_column *column;
+
+	if (!array_is_created(&ctx->columns))
+		return;
+	array_foreach_modifiable(&ctx->columns, column) {
+		buffer_free(&column->exists);
+		buffer_free(&column->data);
+	}
+	array_free(&ctx->columns);
+	if (ctx->field_column_map != NULL) {
+		i_free(ctx->field_column_map);
+		array_free(&ctx->column_uids);
+	}
+}
+
+static void
+mail_cache_copy_columns_end_row(struct mail_cache_copy_context *ctx,
+				uint32_t uid, bool added)
+{
+	struct mail_cache_copy_column *column;
+	unsigned int row = array_count(&ctx->column_uids);
+	uint8_t *exists;
+
+	if (added) {
+		array_push_back(&ctx->column_uids, &uid);
+		return;
+	}
+	/* the record was dropped. forget what was already written for this
+	   row - the next mail reuses it. */
+	array_foreach_modifiable(&ctx->columns, column) {
+		if (row / 8 < column->exists->used) {
+			exists = buffer_get_space_unsafe(column->exists,
+							 row / 8, 1);
+			*exists &= ~(1 << (row % 8));
+		}
+	}
+}
+
+static buffer_t *
+mail_cache_copy_columns_get(struct mail_cache_copy_context *ctx,
+			    const struct mail_cache_header *hdr)
+{
+	struct mail_cache_columns_header col_hdr;
+	struct mail_cache_column_header column_hdr;
+	const struct mail_cache_copy_column *column;
+	unsigned int row_count = array_count(&ctx->column_uids);
+	size_t exists_size = MAIL_CACHE_COLUMN_EXISTS_SIZE(row_count);
+	size_t data_size, used;
+	buffer_t *buf;
+	uint32_t offset;
+
+	if (row_count == 0)
+		return NULL;
+
+	i_zero(&col_hdr);
+	col_hdr.indexid = hdr->indexid;
+	col_hdr.file_seq = hdr->file_seq;
+	col_hdr.row_count = row_count;
+	col_hdr.column_count = array_count(&ctx->columns);
+
+	offset = sizeof(col_hdr) + sizeof(column_hdr) * col_hdr.column_count +
+		sizeof(uint32_t) * row_count;
+	buf = buffer_create_dynamic(default_pool, offset +
+		(exists_size + row_count * MAIL_CACHE_COLUMN_MAX_FIELD_SIZE) *
+		col_hdr.column_count);
+	buffer_append(buf, &col_hdr, sizeof(col_hdr));
+	array_foreach(&ctx->columns, column) {
+		i_zero(&column_hdr);
+		column_hdr.file_field_idx = column->file_field_idx;
+		column_hdr.field_size = column->field_size;
+		column_hdr.offset = offset;
+		buffer_append(buf, &column_hdr, sizeof(column_hdr));
+		offset += exists_size +
+			((column->field_size * row_count + 3) & ~3U);
+	}
+	buffer_append(buf, array_front(&ctx->column_uids),
+		      sizeof(uint32_t) * row_count);
+
+	/* rows at the end that didn't have the field may not have been
+	   written to the buffers at all */
+	array_foreach(&ctx->columns, column) {
+		used = I_MIN(column->exists->used, exists_size);
+		buffer_append(buf, column->exists->data, used);
+		buffer_append_zero(buf, exists_size - used);
+
+		data_size = column->field_size * row_count;
+		used = I_MIN(column->data->used, data_size);
+		buffer_append(buf, column->data->data, used);
+		buffer_append_zero(buf, ((data_size + 3) & ~3U) - used);
+	}
+	i_assert(buf->used == offset);
+	return buf;
 }
 
 static uint32_t get_next_file_seq(struct mail_cache *cache)
@@ -159,49 +362,64 @@ mail_cache_compress_get_fields(struct mail_cache_copy_context *ctx,
 	mail_cache_header_fields_get(cache, ctx->buffer);
 }
 
-static int
-mail_cache_copy(struct mail_cache *cache, struct mail_index_transaction *trans,
-		int fd, uint32_t *file_seq_r, uoff_t *file_size_r, uint32_t *max_uid_r,
-		ARRAY_TYPE(uint32_t) *ext_offsets)
+static void mail_cache_copy_deinit(struct mail_cache_copy_context **_ctx)
 {
-        struct mail_cache_copy_context ctx;
-	struct mail_cache_lookup_iterate_ctx iter;
-	struct mail_cache_iterate_field field;
-	struct mail_index_view *view;
-	struct mail_cache_view *cache_view;
+	struct mail_cache_copy_context *ctx = *_ctx;
+
+	*_ctx = NULL;
+	mail_cache_copy_columns_deinit(ctx);
+	o_stream_destroy(&ctx->output);
+	if (ctx->fd != -1) {
+		/* the new file wasn't taken into use */
+		i_close_fd(&ctx->fd);
+		i_unlink(ctx->temp_path);
+	}
+	buffer_free(&ctx->buffer);
+	buffer_free(&ctx->field_seen);
+	array_free(&ctx->bitmask_pos);
+	array_free(&ctx->offsets);
+	i_free(ctx->field_file_map);
+	i_free(ctx->field_drop);
+	i_free(ctx->temp_path);
+	i_free(ctx);
+}
+
+static struct mail_cache_copy_context *
+mail_cache_copy_init(struct mail_cache *cache, struct mail_index_view *view,
+		     int fd, const char *temp_path)
+{
+	struct mail_cache_copy_context *ctx;
 	const struct mail_index_header *idx_hdr;
-	struct mail_cache_header hdr;
-	struct mail_cache_record cache_rec;
-	struct ostream *output;
-	uint32_t message_count, seq, first_new_seq, ext_offset;
-	unsigned int i, used_fields_count, orig_fields_count, record_count;
+	unsigned int i;
 	time_t max_drop_time;
 
-	*max_uid_r = 0;
+	ctx = i_new(struct mail_cache_copy_context, 1);
+	ctx->cache = cache;
+	ctx->fd = fd;
+	ctx->temp_path = i_strdup(temp_path);
+	ctx->old_file_seq = MAIL_CACHE_IS_UNUSABLE(cache) ? 0 :
+		cache->hdr->file_seq;
+	ctx->output = o_stream_create_fd_file(fd, 0, FALSE);
+	ctx->buffer = buffer_create_dynamic(default_pool, 4096);
+	ctx->field_seen = buffer_create_dynamic(default_pool, 64);
+	ctx->field_seen_value = 0;
+	ctx->next_uid = 1;
+	i_array_init(&ctx->bitmask_pos, 32);
+	i_array_init(&ctx->offsets,
+		     mail_index_view_get_messages_count(view) + 1);
 
 	/* get the latest info on fields */
-	if (mail_cache_header_fields_read(cache) < 0)
-		return -1;
+	if (mail_cache_header_fields_read(cache) < 0) {
+		mail_cache_copy_deinit(&ctx);
+		return NULL;
+	}
 
-	view = mail_index_transaction_get_view(trans);
-	cache_view = mail_cache_view_open(cache, view);
-	output = o_stream_create_fd_file(fd, 0, FALSE);
-
-	i_zero(&hdr);
-	hdr.major_version = MAIL_CACHE_MAJOR_VERSION;
-	hdr.minor_version = MAIL_CACHE_MINOR_VERSION;
-	hdr.compat_sizeof_uoff_t = sizeof(uoff_t);
-	hdr.indexid = cache->index->indexid;
-	hdr.file_seq = get_next_file_seq(cache);
-	o_stream_nsend(output, &hdr, sizeof(hdr));
-
-	i_zero(&ctx);
-	ctx.cache = cache;
-	ctx.buffer = buffer_create_dynamic(default_pool, 4096);
-	ctx.field_seen = buffer_create_dynamic(default_pool, 64);
-	ctx.field_seen_value = 0;
-	ctx.field_file_map = t_new(uint32_t, cache->fields_count + 1);
-	t_array_init(&ctx.bitmask_pos, 32);
+	ctx->hdr.major_version = MAIL_CACHE_MAJOR_VERSION;
+	ctx->hdr.minor_version = MAIL_CACHE_MINOR_VERSION;
+	ctx->hdr.compat_sizeof_uoff_t = sizeof(uoff_t);
+	ctx->hdr.indexid = cache->index->indexid;
+	ctx->hdr.file_seq = get_next_file_seq(cache);
+	o_stream_nsend(ctx->output, &ctx->hdr, sizeof(ctx->hdr));
 
 	/* @UNSAFE: drop unused fields and create a field mapping for
 	   used fields */
@@ -210,18 +428,21 @@ mail_cache_copy(struct mail_cache *cache, struct mail_index_transaction *trans,
 		idx_hdr->day_stamp -
 		cache->index->optimization_set.cache.unaccessed_field_drop_secs;
 
-	orig_fields_count = cache->fields_count;
+	ctx->fields_count = cache->fields_count;
+	ctx->field_file_map = i_new(uint32_t, ctx->fields_count + 1);
+	ctx->field_drop = i_new(uint8_t, ctx->fields_count + 1);
 	if (cache->file_fields_count == 0) {
 		/* creating the initial cache file. add all fields. */
-		for (i = 0; i < orig_fields_count; i++)
-			ctx.field_file_map[i] = i;
-		used_fields_count = i;
+		for (i = 0; i < ctx->fields_count; i++)
+			ctx->field_file_map[i] = i;
+		ctx->used_fields_count = i;
 	} else {
-		for (i = used_fields_count = 0; i < orig_fields_count; i++) {
+		for (i = 0; i < ctx->fields_count; i++) {
 			struct mail_cache_field_private *priv =
 				&cache->fields[i];
 			enum mail_cache_decision_type dec =
 				priv->field.decision;
+			bool used = priv->used;
 
 			/* if the decision isn't forced and this field hasn't
 			   been accessed for a while, drop it */
@@ -229,147 +450,266 @@ mail_cache_copy(struct mail_cache *cache, struct mail_index_transaction *trans,
 			    priv->field.last_used < max_drop_time &&
 			    !priv->adding) {
 				dec = MAIL_CACHE_DECISION_NO;
-				priv->field.decision = dec;
+				ctx->field_drop[i] |=
+					MAIL_CACHE_COPY_DROP_DECISION;
 			}
 
 			/* drop all fields we don't want */
 			if ((dec & ~MAIL_CACHE_DECISION_FORCED) ==
 			    MAIL_CACHE_DECISION_NO && !priv->adding) {
-				priv->used = FALSE;
-				priv->field.last_used = 0;
+				used = FALSE;
+				ctx->field_drop[i] |= MAIL_CACHE_COPY_DROP_FIELD;
 			}
 
-			ctx.field_file_map[i] = !priv->used ?
-				(uint32_t)-1 : used_fields_count++;
+			ctx->field_file_map[i] = !used ?
+				(uint32_t)-1 : ctx->used_fields_count++;
 		}
 	}
 
+	if (cache->index->optimization_set.cache.columns)
+		mail_cache_copy_columns_init(ctx);
+	return ctx;
+}
+
+static void
+mail_cache_copy_mail(struct mail_cache_copy_context *ctx,
+		     struct mail_cache_view *cache_view,
+		     uint32_t seq, uint32_t uid)
+{
+	struct mail_cache_lookup_iterate_ctx iter;
+	struct mail_cache_iterate_field field;
+	struct mail_cache_record cache_rec;
+	struct mail_cache_copy_offset *offset;
+	bool added = FALSE;
+
+	buffer_set_used_size(ctx->buffer, 0);
+
+	if (++ctx->field_seen_value == 0) {
+		memset(buffer_get_modifiable_data(ctx->field_seen, NULL),
+		       0, buffer_get_size(ctx->field_seen));
+		ctx->field_seen_value++;
+	}
+
+	i_zero(&cache_rec);
+	buffer_append(ctx->buffer, &cache_rec, sizeof(cache_rec));
+
+	mail_cache_lookup_iter_init(cache_view, seq, &iter);
+	while (mail_cache_lookup_iter_next(&iter, &field) > 0)
+		mail_cache_compress_field(ctx, &field);
+
+	if (ctx->buffer->used == sizeof(cache_rec) ||
+	    ctx->buffer->used > ctx->cache->index->optimization_set.cache.record_max_size) {
+		/* nothing cached */
+	} else {
+		ctx->max_uid = uid;
+		cache_rec.size = ctx->buffer->used;
+		offset = array_append_space(&ctx->offsets);
+		offset->uid = uid;
+		offset->offset = ctx->output->offset;
+		buffer_write(ctx->buffer, 0, &cache_rec, sizeof(cache_rec));
+		o_stream_nsend(ctx->output, ctx->buffer->data, cache_rec.size);
+		added = TRUE;
+	}
+	if (ctx->field_column_map != NULL)
+		mail_cache_copy_columns_end_row(ctx, uid, added);
+}
+
+/* Copy mails starting from ctx->next_uid. If max_count is non-zero, stop
+   after that many mails. Returns TRUE if all the mails were copied. */
+static bool
+mail_cache_copy_mails(struct mail_cache_copy_context *ctx,
+		      struct mail_index_transaction *trans,
+		      unsigned int max_count)
+{
+	struct mail_index_view *view;
+	struct mail_cache_view *cache_view;
+	uint32_t message_count, seq, seq2, first_new_seq, uid;
+	unsigned int count = 0;
+
+	view = mail_index_transaction_get_view(trans);
+	cache_view = mail_cache_view_open(ctx->cache, view);
+
 	/* get sequence of first message which doesn't need its temp fields
 	   removed. */
 	first_new_seq = mail_cache_get_first_new_seq(view);
 	message_count = mail_index_view_get_messages_count(view);
 
-	i_array_init(ext_offsets, message_count); record_count = 0;
-	for (seq = 1; seq <= message_count; seq++) {
-		if (mail_index_transaction_is_expunged(trans, seq)) {
-			array_append_zero(ext_offsets);
+	if (!mail_index_lookup_seq_range(view, ctx->next_uid, (uint32_t)-1,
+					 &seq, &seq2))
+		seq = message_count + 1;
+	for (; seq <= message_count; seq++) {
+		if (max_count != 0 && count == max_count)
+			break;
+		mail_index_lookup_uid(view, seq, &uid);
+		ctx->next_uid = uid + 1;
+		if (mail_index_transaction_is_expunged(trans, seq))
 			continue;
-		}
 
-		ctx.new_msg = seq >= first_new_seq;
-		buffer_set_used_size(ctx.buffer, 0);
+		ctx->new_msg = seq >= first_new_seq;
+		mail_cache_copy_mail(ctx, cache_view, seq, uid);
+		count++;
+	}
+	mail_cache_view_close(&cache_view);
+	return seq > message_count;
+}
 
-		if (++ctx.field_seen_value == 0) {
-			memset(buffer_get_modifiable_data(ctx.field_seen, NULL),
-			       0, buffer_get_size(ctx.field_seen));
-			ctx.field_seen_value++;
-		}
+static int
+mail_cache_copy_finish(struct mail_cache_copy_context *ctx,
+		       buffer_t **columns_r)
+{
+	struct mail_cache *cache = ctx->cache;
+	struct mail_cache_field_private *priv;
+	unsigned int i;
 
-		i_zero(&cache_rec);
-		buffer_append(ctx.buffer, &cache_rec, sizeof(cache_rec));
-
-		mail_cache_lookup_iter_init(cache_view, seq, &iter);
-		while (mail_cache_lookup_iter_next(&iter, &field) > 0)
-			mail_cache_compress_field(&ctx, &field);
-
-		if (ctx.buffer->used == sizeof(cache_rec) ||
-		    ctx.buffer->used > cache->index->optimization_set.cache.record_max_size) {
-			/* nothing cached */
-			ext_offset = 0;
-		} else {
-			mail_index_lookup_uid(view, seq, max_uid_r);
-			cache_rec.size = ctx.buffer->used;
-			ext_offset = output->offset;
-			buffer_write(ctx.buffer, 0, &cache_rec,
-				     sizeof(cache_rec));
-			o_stream_nsend(output, ctx.buffer->data, cache_rec.size);
-			record_count++;
+	*columns_r = NULL;
+
+	/* the new file is complete. now that we're committing to it,
+	   apply the field drops. */
+	for (i = 0; i < ctx->fields_count; i++) {
+		priv = &cache->fields[i];
+		if ((ctx->field_drop[i] & MAIL_CACHE_COPY_DROP_DECISION) != 0)
+			priv->field.decision = MAIL_CACHE_DECISION_NO;
+		if ((ctx->field_drop[i] & MAIL_CACHE_COPY_DROP_FIELD) != 0) {
+			priv->used = FALSE;
+			priv->field.last_used = 0;
 		}
-
-		array_push_back(ext_offsets, &ext_offset);
 	}
-	i_assert(orig_fields_count == cache->fields_count);
-
-	hdr.record_count = record_count;
-	hdr.field_header_offset = mail_index_uint32_to_offset(output->offset);
-	mail_cache_compress_get_fields(&ctx, used_fields_count);
-	o_stream_nsend(output, ctx.buffer->data, ctx.buffer->used);
+	if (cache->fields_count > ctx->fields_count) {
+		/* fields registered during incremental compression aren't
+		   in the new file */
+		ctx->field_file_map = i_realloc_type(ctx->field_file_map,
+			uint32_t, ctx->fields_count + 1,
+			cache->fields_count + 1);
+		for (i = ctx->fields_count; i < cache->fields_count; i++) {
+			ctx->field_file_map[i] = (uint32_t)-1;
+			cache->fields[i].used = FALSE;
+		}
+		ctx->fields_count = cache->fields_count;
+	}
 
-	hdr.backwards_compat_used_file_size = output->offset;
-	buffer_free(&ctx.buffer);
-	buffer_free(&ctx.field_seen);
+	ctx->hdr.record_count = array_count(&ctx->offsets);
+	ctx->hdr.field_header_offset =
+		mail_index_uint32_to_offset(ctx->output->offset);
+	mail_cache_compress_get_fields(ctx, ctx->used_fields_count);
+	o_stream_nsend(ctx->output, ctx->buffer->data, ctx->buffer->used);
 
-	(void)o_stream_seek(output, 0);
-	o_stream_nsend(output, &hdr, sizeof(hdr));
+	ctx->hdr.backwards_compat_used_file_size = ctx->output->offset;
+	if (ctx->field_column_map != NULL)
+		*columns_r = mail_cache_copy_columns_get(ctx, &ctx->hdr);
 
-	mail_cache_view_close(&cache_view);
+	(void)o_stream_seek(ctx->output, 0);
+	o_stream_nsend(ctx->output, &ctx->hdr, sizeof(ctx->hdr));
 
-	if (o_stream_finish(output) < 0) {
+	if (o_stream_finish(ctx->output) < 0) {
 		mail_cache_set_syscall_error(cache, "write()");
-		o_stream_destroy(&output);
-		array_free(ext_offsets);
+		if (*columns_r != NULL)
+			buffer_free(columns_r);
 		return -1;
 	}
-	*file_size_r = output->offset;
-	o_stream_destroy(&output);
 
 	if (cache->index->fsync_mode == FSYNC_MODE_ALWAYS) {
-		if (fdatasync(fd) < 0) {
+		if (fdatasync(ctx->fd) < 0) {
 			mail_cache_set_syscall_error(cache, "fdatasync()");
-			array_free(ext_offsets);
+			if (*columns_r != NULL)
+				buffer_free(columns_r);
 			return -1;
 		}
 	}
-
-	*file_seq_r = hdr.file_seq;
 	return 0;
 }
 
+static void
+mail_cache_compress_write_columns(struct mail_cache *cache, buffer_t *columns)
+{
+	const char *path, *temp_path;
+	int fd;
+
+	path = t_strconcat(cache->filepath, MAIL_CACHE_COLUMNS_FILE_SUFFIX, NULL);
+	if (columns == NULL) {
+		/* columns are disabled or there's nothing to write. a leftover
+		   file would be ignored anyway, since its file_seq is old. */
+		i_unlink_if_exists(path);
+		return;
+	}
+
+	/* the columns are only an optimization, so any failures here are
+	   logged but otherwise ignored. */
+	fd = mail_index_create_tmp_file(cache->index, path, &temp_path);
+	if (fd == -1)
+		return;
+	if (write_full(fd, columns->data, columns->used) < 0) {
+		mail_index_file_set_syscall_error(cache->index, temp_path,
+						  "write()");
+	} else if (cache->index->fsync_mode == FSYNC_MODE_ALWAYS &&
+		   fdatasync(fd) < 0) {
+		mail_index_file_set_syscall_error(cache->index, temp_path,
+						  "fdatasync()");
+	} else if (rename(temp_path, path) < 0) {
+		mail_index_file_set_syscall_error(cache->index, path,
+						  "rename()");
+	} else {
+		temp_path = NULL;
+	}
+	if (close(fd) < 0) {
+		mail_index_file_set_syscall_error(cache->index, path,
+						  "close()");
+	}
+	if (temp_path != NULL)
+		i_unlink(temp_path);
+}
+
 static int
 mail_cache_compress_write(struct mail_cache *cache,
 			  struct mail_index_transaction *trans,
-			  int fd, const char *temp_path, bool *unlock)
+			  struct mail_cache_copy_context *ctx, bool *unlock)
 {
+	struct mail_index_view *view = mail_index_transaction_get_view(trans);
+	const struct mail_cache_copy_offset *offset;
 	struct stat st;
-	uint32_t file_seq, old_offset, max_uid;
-	ARRAY_TYPE(uint32_t) ext_offsets;
-	const uint32_t *offsets;
-	uoff_t file_size;
-	unsigned int i, count;
-
-	if (mail_cache_copy(cache, trans, fd, &file_seq, &file_size,
-			    &max_uid, &ext_offsets) < 0)
+	uint32_t seq, old_offset;
+	buffer_t *columns;
+
+	/* copy everything that isn't copied yet. with incremental
+	   compression these are only the mails that were added after the
+	   previous step. */
+	if (!mail_cache_copy_mails(ctx, trans, 0))
+		i_unreached();
+	if (mail_cache_copy_finish(ctx, &columns) < 0)
 		return -1;
 
-	if (fstat(fd, &st) < 0) {
+	if (fstat(ctx->fd, &st) < 0) {
 		mail_cache_set_syscall_error(cache, "fstat()");
-		array_free(&ext_offsets);
+		if (columns != NULL)
+			buffer_free(&columns);
 		return -1;
 	}
-	if (rename(temp_path, cache->filepath) < 0) {
+	if (rename(ctx->temp_path, cache->filepath) < 0) {
 		mail_cache_set_syscall_error(cache, "rename()");
-		array_free(&ext_offsets);
+		if (columns != NULL)
+			buffer_free(&columns);
 		return -1;
 	}
+	mail_cache_compress_write_columns(cache, columns);
+	if (columns != NULL)
+		buffer_free(&columns);
 
 	if ((cache->index->flags & MAIL_INDEX_OPEN_FLAG_DEBUG) != 0) {
 		i_debug("%s: Compressed, file_seq changed %u -> %u, "
 			"size=%"PRIuUOFF_T", max_uid=%u", cache->filepath,
-			cache->need_compress_file_seq, file_seq,
-			file_size, max_uid);
+			cache->need_compress_file_seq, ctx->hdr.file_seq,
+			(uoff_t)ctx->hdr.backwards_compat_used_file_size,
+			ctx->max_uid);
 	}
 
 	/* once we're sure that the compression was successful,
 	   update the offsets */
-	mail_index_ext_reset(trans, cache->ext_id, file_seq, TRUE);
-	offsets = array_get(&ext_offsets, &count);
-	for (i = 0; i < count; i++) {
-		if (offsets[i] != 0) {
-			mail_index_update_ext(trans, i + 1, cache->ext_id,
-					      &offsets[i], &old_offset);
+	mail_index_ext_reset(trans, cache->ext_id, ctx->hdr.file_seq, TRUE);
+	array_foreach(&ctx->offsets, offset) {
+		if (mail_index_lookup_seq(view, offset->uid, &seq)) {
+			mail_index_update_ext(trans, seq, cache->ext_id,
+					      &offset->offset, &old_offset);
 		}
 	}
-	array_free(&ext_offsets);
 
 	if (*unlock) {
 		(void)mail_cache_unlock(cache);
@@ -378,7 +718,8 @@ mail_cache_compress_write(struct mail_cache *cache,
 
 	mail_cache_file_close(cache);
 	cache->opened = TRUE;
-	cache->fd = fd;
+	cache->fd = ctx->fd;
+	ctx->fd = -1;
 	cache->st_ino = st.st_ino;
 	cache->st_dev = st.st_dev;
 	cache->field_header_write_pending = FALSE;
@@ -436,6 +777,7 @@ static int mail_cache_compress_locked(struct mail_cache *cache, bool forced,
 				      struct mail_index_transaction *trans,
 				      bool *unlock, struct dotlock **dotlock_r)
 {
+	struct mail_cache_copy_context *ctx;
 	const char *temp_path;
 	const void *data;
 	int fd, ret;
@@ -457,6 +799,7 @@ static int mail_cache_compress_locked(struct mail_cache *cache, bool forced,
 			return -1;
 
 		/* was just compressed, forget this */
+		mail_cache_compress_abort(cache);
 		cache->need_compress_file_seq = 0;
 		file_dotlock_delete(dotlock_r);
 
@@ -473,15 +816,30 @@ static int mail_cache_compress_locked(struct mail_cache *cache, bool forced,
 			return -1;
 	}
 
-	/* we want to recreate the cache. write it first to a temporary file */
-	fd = mail_index_create_tmp_file(cache->index, cache->filepath, &temp_path);
-	if (fd == -1)
-		return -1;
-	if (mail_cache_compress_write(cache, trans, fd, temp_path, unlock) < 0) {
-		i_close_fd(&fd);
-		i_unlink(temp_path);
-		return -1;
+	/* continue an incremental compression if there is one for this
+	   same file */
+	ctx = cache->compress_ctx;
+	cache->compress_ctx = NULL;
+	if (ctx != NULL && (MAIL_CACHE_IS_UNUSABLE(cache) ||
+			    ctx->old_file_seq != cache->hdr->file_seq))
+		mail_cache_copy_deinit(&ctx);
+
+	if (ctx == NULL) {
+		/* we want to recreate the cache. write it first to a
+		   temporary file */
+		fd = mail_index_create_tmp_file(cache->index, cache->filepath,
+						&temp_path);
+		if (fd == -1)
+			return -1;
+		ctx = mail_cache_copy_init(cache,
+			mail_index_transaction_get_view(trans), fd, temp_path);
+		if (ctx == NULL)
+			return -1;
 	}
+	ret = mail_cache_compress_write(cache, trans, ctx, unlock);
+	mail_cache_copy_deinit(&ctx);
+	if (ret < 0)
+		return -1;
 	if (cache->file_cache != NULL)
 		file_cache_set_fd(cache->file_cache, cache->fd);
 
@@ -577,6 +935,65 @@ int mail_cache_compress_forced(struct mail_cache *cache,
 	return mail_cache_compress_full(cache, TRUE, trans, lock_r);
 }
 
+int mail_cache_compress_incremental(struct mail_cache *cache,
+				    struct mail_index_transaction *trans,
+				    struct mail_cache_compress_lock **lock_r)
+{
+	struct mail_index_view *view = mail_index_transaction_get_view(trans);
+	unsigned int max_count =
+		cache->index->optimization_set.cache.compress_incremental_count;
+	const char *temp_path;
+	bool finished;
+	int fd;
+
+	if (max_count == 0 || MAIL_INDEX_IS_IN_MEMORY(cache->index) ||
+	    cache->index->readonly || MAIL_CACHE_IS_UNUSABLE(cache) ||
+	    cache->map_with_read)
+		return mail_cache_compress(cache, trans, lock_r);
+
+	if (cache->compress_ctx != NULL &&
+	    cache->compress_ctx->old_file_seq != cache->hdr->file_seq) {
+		/* someone else already replaced the file */
+		mail_cache_compress_abort(cache);
+	}
+	if (cache->compress_ctx == NULL) {
+		if (mail_index_view_get_messages_count(view) <= max_count)
+			return mail_cache_compress(cache, trans, lock_r);
+
+		fd = mail_index_create_tmp_file(cache->index, cache->filepath,
+						&temp_path);
+		if (fd == -1)
+			return -1;
+		cache->compress_ctx =
+			mail_cache_copy_init(cache, view, fd, temp_path);
+		if (cache->compress_ctx == NULL)
+			return -1;
+	}
+
+	/* Copy the next chunk without locking. Records are only appended to
+	   the old file, so reading it is safe. Anything added to the
+	   already copied mails' records after this is lost, but that's
+	   just cached data that will be added again when needed. */
+	i_assert(!cache->compressing);
+	cache->compressing = TRUE;
+	finished = mail_cache_copy_mails(cache->compress_ctx, trans, max_count);
+	cache->compressing = FALSE;
+
+	if (finished) {
+		/* finish the compression with the cache locked. this copies
+		   only the mails added since the previous step. */
+		return mail_cache_compress(cache, trans, lock_r);
+	}
+	*lock_r = i_new(struct mail_cache_compress_lock, 1);
+	return 0;
+}
+
+void mail_cache_compress_abort(struct mail_cache *cache)
+{
+	if (cache->compress_ctx != NULL)
+		mail_cache_copy_deinit(&cache->compress_ctx);
+}
+
 void mail_cache_compress_unlock(struct mail_cache_compress_lock **_lock)
 {
 	struct mail_cache_compress_lock *lock = *_lock;
@@ -305,6 +305,72 @@ int mail_cache_lookup_iter_next(struct mail_cache_lookup_iterate_ctx *ctx,
 	return 1;
 }
 
+static void
+mail_cache_seq_save_data(struct mail_cache_view *view,
+			 const struct mail_cache_iterate_field *field)
+{
+	const struct mail_cache_field *field_def =
+		&view->cache->fields[field->field_idx].field;
+	struct mail_cache_view_field_data *field_data;
+	unsigned char *dest;
+	unsigned int i;
+
+	field_data = array_idx_get_space(&view->cached_data_fields,
+					 field->field_idx);
+	if (field_data->exists_value != view->cached_exists_value) {
+		field_data->exists_value = view->cached_exists_value;
+		field_data->offset = view->cached_data_buf->used;
+		if (field_def->type != MAIL_CACHE_FIELD_BITMASK) {
+			field_data->size = field->size;
+			buffer_append(view->cached_data_buf,
+				      field->data, field->size);
+			return;
+		}
+		field_data->size = field_def->field_size;
+		buffer_append_zero(view->cached_data_buf, field_def->field_size);
+	} else if (field_def->type != MAIL_CACHE_FIELD_BITMASK) {
+		/* if there are multiple they're all identical */
+		return;
+	}
+
+	/* merge all bits */
+	if (field->size > field_data->size) {
+		/* shouldn't happen, but don't write past the field */
+		view->cached_data_valid = FALSE;
+		return;
+	}
+	dest = buffer_get_space_unsafe(view->cached_data_buf,
+				       field_data->offset, field->size);
+	for (i = 0; i < field->size; i++)
+		dest[i] |= ((const unsigned char *)field->data)[i];
+}
+
+static void
+mail_cache_seq_get_key(struct mail_cache_view *view, uint32_t seq,
+		       uint32_t *uid_r, uint32_t *offset_r,
+		       uint32_t *reset_id_r)
+{
+	mail_index_lookup_uid(view->view, seq, uid_r);
+	*reset_id_r = 0;
+	*offset_r = mail_cache_lookup_cur_offset(view->view, seq, reset_id_r);
+}
+
+static bool mail_cache_seq_is_cached(struct mail_cache_view *view, uint32_t seq)
+{
+	uint32_t uid, offset, reset_id;
+
+	if (view->cached_exists_seq != seq)
+		return FALSE;
+
+	/* the view may have been synced since, so the sequence may now
+	   point to a different mail. the mail's records may also have been
+	   changed or compressed. */
+	mail_cache_seq_get_key(view, seq, &uid, &offset, &reset_id);
+	return view->cached_exists_uid == uid &&
+		view->cached_exists_offset == offset &&
+		view->cached_exists_reset_id == reset_id;
+}
+
 static int mail_cache_seq(struct mail_cache_view *view, uint32_t seq)
 {
 	struct mail_cache_lookup_iterate_ctx iter;
@@ -314,18 +380,54 @@ static int mail_cache_seq(struct mail_cache_view *view, uint32_t seq)
 	if (++view->cached_exists_value == 0) {
 		/* wrapped, we'll have to clear the buffer */
 		buffer_set_used_size(view->cached_exists_buf, 0);
+		array_clear(&view->cached_data_fields);
 		view->cached_exists_value++;
 	}
 	view->cached_exists_seq = seq;
+	mail_cache_seq_get_key(view, seq, &view->cached_exists_uid,
+			       &view->cached_exists_offset,
+			       &view->cached_exists_reset_id);
+	view->cached_data_valid = TRUE;
+	buffer_set_used_size(view->cached_data_buf, 0);
 
 	mail_cache_lookup_iter_init(view, seq, &iter);
 	while ((ret = mail_cache_lookup_iter_next(&iter, &field)) > 0) {
 		buffer_write(view->cached_exists_buf, field.field_idx,
 			     &view->cached_exists_value, 1);
+		mail_cache_seq_save_data(view, &field);
 	}
+	if (ret < 0)
+		view->cached_data_valid = FALSE;
 	return ret;
 }
 
+static bool
+mail_cache_lookup_saved_data(struct mail_cache_view *view, uint32_t seq,
+			     unsigned int field_idx, buffer_t *dest_buf)
+{
+	const struct mail_cache_view_field_data *field_data;
+	const void *data;
+
+	/* mail_cache_field_exists() was just called, so if cached_exists_seq
+	   matches, the data is for this same mail. */
+	if (!view->cached_data_valid ||
+	    view->cached_exists_seq != seq ||
+	    field_idx >= array_count(&view->cached_data_fields))
+		return FALSE;
+
+	field_data = array_idx(&view->cached_data_fields, field_idx);
+	if (field_data->exists_value != view->cached_exists_value)
+		return FALSE;
+
+	data = CONST_PTR_OFFSET(view->cached_data_buf->data,
+				field_data->offset);
+	if (view->cache->fields[field_idx].field.type == MAIL_CACHE_FIELD_BITMASK)
+		buffer_write(dest_buf, 0, data, field_data->size);
+	else
+		buffer_append(dest_buf, data, field_data->size);
+	return TRUE;
+}
+
 static bool
 mail_cache_file_has_field(struct mail_cache *cache, unsigned int field)
 {
@@ -345,9 +447,10 @@ int mail_cache_field_exists(struct mail_cache_view *view, uint32_t seq,
 
 	if (!mail_cache_file_has_field(view->cache, field))
 		return 0;
+	if (mail_cache_lookup_column(view, seq, field, NULL))
+		return 1;
 
-	/* FIXME: we should discard the cache if view has been synced */
-	if (view->cached_exists_seq != seq) {
+	if (!mail_cache_seq_is_cached(view, seq)) {
 		if (mail_cache_seq(view, seq) < 0)
 			return -1;
 	}
@@ -409,11 +512,23 @@ int mail_cache_lookup_field(struct mail_cache_view *view, buffer_t *dest_buf,
 	struct mail_cache_iterate_field field;
 	int ret;
 
+	/* fixed size fields may be found from the column segment without
+	   going through the mail's records */
+	if (mail_cache_lookup_column(view, seq, field_idx, dest_buf)) {
+		mail_cache_decision_state_update(view, seq, field_idx);
+		return 1;
+	}
+
 	ret = mail_cache_field_exists(view, seq, field_idx);
 	mail_cache_decision_state_update(view, seq, field_idx);
 	if (ret <= 0)
 		return ret;
 
+	/* the data was usually already copied while checking the field's
+	   existence */
+	if (mail_cache_lookup_saved_data(view, seq, field_idx, dest_buf))
+		return 1;
+
 	/* the field should exist */
 	mail_cache_lookup_iter_init(view, seq, &iter);
 	field_def = &view->cache->fields[field_idx].field;
@@ -8,6 +8,9 @@
 #define MAIL_CACHE_MAJOR_VERSION 1
 #define MAIL_CACHE_MINOR_VERSION 1
 
+/* Only fixed size fields up to this size are placed into columns */
+#define MAIL_CACHE_COLUMN_MAX_FIELD_SIZE 16
+
 #define MAIL_CACHE_LOCK_TIMEOUT 10
 #define MAIL_CACHE_LOCK_CHANGE_TIMEOUT 300
 
@@ -67,6 +70,38 @@ struct mail_cache_header_fields {
 #define MAIL_CACHE_FIELD_NAMES(count) \
 	(MAIL_CACHE_FIELD_DECISION(count) + sizeof(uint8_t) * (count))
 
+struct mail_cache_columns_header {
+	uint32_t indexid;
+	/* file_seq of the cache file these columns were written with */
+	uint32_t file_seq;
+	uint32_t row_count;
+	uint32_t column_count;
+#if 0
+	struct mail_cache_column_header columns[column_count];
+	/* UIDs of the rows in ascending order */
+	uint32_t uids[row_count];
+#endif
+};
+
+struct mail_cache_column_header {
+	uint32_t file_field_idx;
+	uint32_t field_size;
+	/* Offset to the column's data: a bitmap of rows that have the field
+	   cached, padded to 32 bits, followed by row_count * field_size
+	   bytes of data. */
+	uint32_t offset;
+};
+
+#define MAIL_CACHE_COLUMN_EXISTS_SIZE(row_count) \
+	((((row_count) + 7) / 8 + 3) & ~3U)
+
+struct mail_cache_column {
+	unsigned int field_idx;
+	unsigned int field_size;
+	const uint8_t *exists;
+	const unsigned char *data;
+};
+
 struct mail_cache_record {
 	uint32_t prev_offset;
 	uint32_t size; /* full record size, including this header */
@@ -133,6 +168,19 @@ struct mail_cache {
 	unsigned int *file_field_map;
 	unsigned int file_fields_count;
 
+	/* Incremental compression in progress */
+	struct mail_cache_copy_context *compress_ctx;
+
+	/* mmaped dovecot.index.cache.columns, if it matches the current
+	   cache file. columns_file_seq is the cache file_seq for which the
+	   columns file was last looked up. */
+	void *columns_mmap_base;
+	size_t columns_mmap_length;
+	uint32_t columns_file_seq;
+	const uint32_t *column_uids;
+	unsigned int column_rows;
+	ARRAY(struct mail_cache_column) columns;
+
 	bool opened:1;
 	bool locked:1;
 	bool last_lock_failed:1;
@@ -157,6 +205,12 @@ struct mail_cache_missing_reason_cache {
 	uoff_t log_file_head_offset;
 };
 
+struct mail_cache_view_field_data {
+	/* cached_exists_value when this was written */
+	uint8_t exists_value;
+	uint32_t offset, size;
+};
+
 struct mail_cache_view {
 	struct mail_cache *cache;
 	struct mail_index_view *view, *trans_view;
@@ -173,8 +227,26 @@ struct mail_cache_view {
 	buffer_t *cached_exists_buf;
 	uint8_t cached_exists_value;
 	uint32_t cached_exists_seq;
+	/* UID and the first cache record of the mail in cached_exists_buf.
+	   The buffer is used only while they're still the same for
+	   cached_exists_seq. */
+	uint32_t cached_exists_uid;
+	uint32_t cached_exists_offset, cached_exists_reset_id;
+
+	/* While filling cached_exists_buf, the data of all the fields is
+	   copied to cached_data_buf so that the following lookups for the
+	   same mail don't need to walk through its records again. The data
+	   is valid if cached_data_valid is set and the field's exists_value
+	   == cached_exists_value. */
+	buffer_t *cached_data_buf;
+	ARRAY(struct mail_cache_view_field_data) cached_data_fields;
+
+	/* Row of the previous column lookup. Sequential lookups can usually
+	   continue from here without searching the UIDs. */
+	unsigned int column_row;
 
 	bool no_decision_updates:1;
+	bool cached_data_valid:1;
 };
 
 struct mail_cache_iterate_field {
@@ -243,6 +315,16 @@ mail_cache_transaction_lookup_rec(struct mail_cache_transaction_ctx *ctx,
 				  unsigned int seq,
 				  unsigned int *trans_next_idx);
 
+/* Look up the field from the column segment. Returns TRUE and appends the
+   data to dest_buf (if non-NULL) if it was found. FALSE means that the
+   normal cache records need to be looked up. */
+bool mail_cache_lookup_column(struct mail_cache_view *view, uint32_t seq,
+			      unsigned int field_idx, buffer_t *dest_buf);
+void mail_cache_columns_close(struct mail_cache *cache);
+
+/* Abort an unfinished incremental compression. */
+void mail_cache_compress_abort(struct mail_cache *cache);
+
 int mail_cache_map(struct mail_cache *cache, size_t offset, size_t size,
 		   const void **data_r);
 void mail_cache_file_close(struct mail_cache *cache);
@@ -776,6 +776,9 @@ void mail_cache_add(struct mail_cache_transaction_ctx *ctx, uint32_t seq,
 	/* remember that this value exists, in case we try to look it up */
 	buffer_write(ctx->view->cached_exists_buf, field_idx,
 		     &ctx->view->cached_exists_value, 1);
+	/* the copied data doesn't have this value (or the bits added to
+	   a bitmask) */
+	ctx->view->cached_data_valid = FALSE;
 
 	full_size = (data_size + 3) & ~3;
 	if (fixed_size == UINT_MAX)
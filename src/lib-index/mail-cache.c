@@ -25,8 +25,11 @@ void mail_cache_set_syscall_error(struct mail_cache *cache,
 
 static void mail_cache_unlink(struct mail_cache *cache)
 {
-	if (!cache->index->readonly && !MAIL_INDEX_IS_IN_MEMORY(cache->index))
+	if (!cache->index->readonly && !MAIL_INDEX_IS_IN_MEMORY(cache->index)) {
 		i_unlink_if_exists(cache->filepath);
+		i_unlink_if_exists(t_strconcat(cache->filepath,
+			MAIL_CACHE_COLUMNS_FILE_SUFFIX, NULL));
+	}
 }
 
 void mail_cache_reset(struct mail_cache *cache)
@@ -90,6 +93,8 @@ void mail_cache_file_close(struct mail_cache *cache)
 	cache->hdr = NULL;
 	cache->mmap_length = 0;
 	cache->last_field_header_offset = 0;
+	mail_cache_columns_close(cache);
+	cache->columns_file_seq = 0;
 
 	file_lock_free(&cache->file_lock);
 	cache->locked = FALSE;
@@ -585,9 +590,12 @@ void mail_cache_free(struct mail_cache **_cache)
 		file_cache_free(&cache->file_cache);
 
 	mail_index_unregister_expunge_handler(cache->index, cache->ext_id);
+	mail_cache_compress_abort(cache);
 	mail_cache_file_close(cache);
 
 	buffer_free(&cache->read_buf);
+	if (array_is_created(&cache->columns))
+		array_free(&cache->columns);
 	hash_table_destroy(&cache->field_name_hash);
 	pool_unref(&cache->field_pool);
 	i_free(cache->field_file_map);
@@ -832,6 +840,9 @@ mail_cache_view_open(struct mail_cache *cache, struct mail_index_view *iview)
 	view->cached_exists_buf =
 		buffer_create_dynamic(default_pool,
 				      cache->file_fields_count + 10);
+	view->cached_data_buf = buffer_create_dynamic(default_pool, 1024);
+	i_array_init(&view->cached_data_fields,
+		     cache->file_fields_count + 10);
 	return view;
 }
 
@@ -847,6 +858,8 @@ void mail_cache_view_close(struct mail_cache_view **_view)
                 (void)mail_cache_header_fields_update(view->cache);
 
 	buffer_free(&view->cached_exists_buf);
+	buffer_free(&view->cached_data_buf);
+	array_free(&view->cached_data_fields);
 	i_free(view);
 }
 
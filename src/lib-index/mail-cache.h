@@ -4,6 +4,8 @@
 #include "mail-index.h"
 
 #define MAIL_CACHE_FILE_SUFFIX ".cache"
+/* Optional column segment written while compressing the cache file */
+#define MAIL_CACHE_COLUMNS_FILE_SUFFIX ".columns"
 
 struct mail_cache;
 struct mail_cache_view;
@@ -78,6 +80,13 @@ int mail_cache_compress(struct mail_cache *cache,
 int mail_cache_compress_forced(struct mail_cache *cache,
 			       struct mail_index_transaction *trans,
 			       struct mail_cache_compress_lock **lock_r);
+/* Like mail_cache_compress(), but if cache.compress_incremental_count is set,
+   copy only that many mails to the new cache file per call. The cache file
+   is replaced only by the call that copies the last mails, so
+   mail_cache_need_compress() keeps returning TRUE until then. */
+int mail_cache_compress_incremental(struct mail_cache *cache,
+				    struct mail_index_transaction *trans,
+				    struct mail_cache_compress_lock **lock_r);
 void mail_cache_compress_unlock(struct mail_cache_compress_lock **lock);
 /* Returns TRUE if there is at least something in the cache. */
 bool mail_cache_exists(struct mail_cache *cache);
@@ -36,7 +36,7 @@ static int mail_index_mmap(struct mail_index_map *map, uoff_t file_size)
 
 	i_assert(rec_map->mmap_base == NULL);
 
-	buffer_free(&rec_map->buffer);
+	mail_index_record_map_free_records(index, rec_map);
 	if (file_size > SSIZE_T_MAX) {
 		/* too large file to map into memory */
 		mail_index_set_error(index, "Index file too large: %s",
@@ -345,6 +345,10 @@ mail_index_map_latest_file(struct mail_index *index, const char **reason_r)
 	new_map = mail_index_map_alloc(index);
 	if (use_mmap) {
 		ret = mail_index_mmap(new_map, file_size);
+		if (ret > 0) {
+			new_map->rec_map->mmap_ino = st.st_ino;
+			new_map->rec_map->mmap_dev = st.st_dev;
+		}
 	} else {
 		ret = mail_index_read_map(new_map, file_size);
 	}
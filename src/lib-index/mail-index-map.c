@@ -263,18 +263,30 @@ struct mail_index_map *mail_index_map_alloc(struct mail_index *index)
 	return mail_index_map_clone(&tmp_map);
 }
 
-static void mail_index_record_map_free(struct mail_index_map *map,
-				       struct mail_index_record_map *rec_map)
+void mail_index_record_map_free_records(struct mail_index *index,
+					struct mail_index_record_map *rec_map)
 {
 	if (rec_map->buffer != NULL) {
 		i_assert(rec_map->mmap_base == NULL);
+		i_assert(rec_map->cow_base == NULL);
 		buffer_free(&rec_map->buffer);
+	} else if (rec_map->cow_base != NULL) {
+		i_assert(rec_map->mmap_base == NULL);
+		if (munmap(rec_map->cow_base, rec_map->cow_size) < 0)
+			mail_index_set_syscall_error(index, "munmap()");
+		rec_map->cow_base = NULL;
 	} else if (rec_map->mmap_base != NULL) {
-		i_assert(rec_map->buffer == NULL);
 		if (munmap(rec_map->mmap_base, rec_map->mmap_size) < 0)
-			mail_index_set_syscall_error(map->index, "munmap()");
+			mail_index_set_syscall_error(index, "munmap()");
 		rec_map->mmap_base = NULL;
 	}
+	rec_map->records = NULL;
+}
+
+static void mail_index_record_map_free(struct mail_index_map *map,
+				       struct mail_index_record_map *rec_map)
+{
+	mail_index_record_map_free_records(map->index, rec_map);
 	array_free(&rec_map->maps);
 	if (rec_map->modseq != NULL)
 		mail_index_map_modseq_free(&rec_map->modseq);
@@ -335,6 +347,97 @@ static void mail_index_map_copy_records(struct mail_index_record_map *dest,
 	dest->records_count = src->records_count;
 }
 
+static bool mail_index_map_cow_records(struct mail_index_record_map *dest,
+				       const struct mail_index_record_map *src,
+				       const struct mail_index_map *map)
+{
+#ifdef MAP_ANONYMOUS
+	struct mail_index *index = map->index;
+	struct stat st;
+	size_t page_size, records_offset, map_offset, map_size;
+	size_t records_size, size;
+	void *base;
+
+	/* The index files are never modified after they're renamed into
+	   place, so mapping the same file again gives the same records
+	   without copying them. Make sure the index wasn't reopened since
+	   the records were mmaped. */
+	if (index->fd == -1 || fstat(index->fd, &st) < 0 ||
+	    st.st_ino != src->mmap_ino || !CMP_DEV_T(st.st_dev, src->mmap_dev))
+		return FALSE;
+
+	page_size = mmap_get_page_size();
+	records_offset = (const char *)src->records -
+		(const char *)src->mmap_base;
+	map_offset = records_offset - records_offset % page_size;
+	records_size = src->records_count * map->hdr.record_size;
+	map_size = records_offset - map_offset + records_size;
+	/* +1% so we have a bit of space to grow, same as when copying.
+	   The space after the file is anonymous memory. */
+	size = map_size + I_MAX(records_size/100, 1024);
+	size = (size + page_size - 1) / page_size * page_size;
+
+	base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED)
+		return FALSE;
+	if (map_size > 0 &&
+	    mmap(base, map_size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_FIXED, index->fd, map_offset) == MAP_FAILED) {
+		mail_index_set_syscall_error(index, "mmap()");
+		if (munmap(base, size) < 0)
+			mail_index_set_syscall_error(index, "munmap()");
+		return FALSE;
+	}
+
+	dest->cow_base = base;
+	dest->cow_size = size;
+	dest->cow_records_size = size - (records_offset - map_offset);
+	dest->records = PTR_OFFSET(base, records_offset - map_offset);
+	dest->records_count = src->records_count;
+	return TRUE;
+#else
+	return FALSE;
+#endif
+}
+
+static void
+mail_index_record_map_cow_to_buffer(struct mail_index *index,
+				    struct mail_index_record_map *rec_map,
+				    size_t size)
+{
+	buffer_t *buffer;
+
+	i_assert(size <= rec_map->cow_records_size);
+
+	buffer = buffer_create_dynamic(default_pool,
+				       size + I_MAX(size/100, 1024));
+	buffer_append(buffer, rec_map->records, size);
+	mail_index_record_map_free_records(index, rec_map);
+
+	rec_map->buffer = buffer;
+	rec_map->records = buffer_get_modifiable_data(rec_map->buffer, NULL);
+}
+
+void *mail_index_map_get_records_space(struct mail_index_map *map,
+				       size_t pos, size_t size)
+{
+	struct mail_index_record_map *rec_map = map->rec_map;
+	void *ret;
+
+	i_assert(MAIL_INDEX_MAP_IS_IN_MEMORY(map));
+
+	if (rec_map->cow_base != NULL) {
+		if (pos + size <= rec_map->cow_records_size)
+			return PTR_OFFSET(rec_map->records, pos);
+		mail_index_record_map_cow_to_buffer(map->index, rec_map,
+			rec_map->records_count * map->hdr.record_size);
+	}
+	ret = buffer_get_space_unsafe(rec_map->buffer, pos, size);
+	rec_map->records = buffer_get_modifiable_data(rec_map->buffer, NULL);
+	return ret;
+}
+
 static void mail_index_map_copy_header(struct mail_index_map *dest,
 				       const struct mail_index_map *src)
 {
@@ -448,8 +551,13 @@ void mail_index_record_map_move_to_private(struct mail_index_map *map)
 			rec = MAIL_INDEX_REC_AT_SEQ(map, new_map->records_count);
 			new_map->last_appended_uid = rec->uid;
 		}
-		buffer_set_used_size(new_map->buffer, new_map->records_count *
-				     map->hdr.record_size);
+		if (new_map->buffer != NULL) {
+			buffer_set_used_size(new_map->buffer,
+				new_map->records_count * map->hdr.record_size);
+		} else {
+			i_assert(new_map->records_count * map->hdr.record_size <=
+				 new_map->cow_records_size);
+		}
 	}
 }
 
@@ -468,15 +576,22 @@ void mail_index_map_move_to_memory(struct mail_index_map *map)
 			mail_index_map_modseq_clone(map->rec_map->modseq);
 	}
 
-	mail_index_map_copy_records(new_map, map->rec_map,
-				    map->hdr.record_size);
 	mail_index_map_copy_header(map, map);
-
 	if (new_map != map->rec_map) {
+		if (!mail_index_map_cow_records(new_map, map->rec_map, map)) {
+			mail_index_map_copy_records(new_map, map->rec_map,
+						    map->hdr.record_size);
+		}
 		mail_index_record_map_unlink(map);
 		map->rec_map = new_map;
 	} else {
-		if (munmap(new_map->mmap_base, new_map->mmap_size) < 0)
+		struct mail_index_record_map old_map = *new_map;
+
+		if (!mail_index_map_cow_records(new_map, &old_map, map)) {
+			mail_index_map_copy_records(new_map, &old_map,
+						    map->hdr.record_size);
+		}
+		if (munmap(old_map.mmap_base, old_map.mmap_size) < 0)
 			mail_index_set_syscall_error(map->index, "munmap()");
 		new_map->mmap_base = NULL;
 	}
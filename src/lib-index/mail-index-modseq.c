@@ -42,6 +42,10 @@ void mail_index_modseq_init(struct mail_index *index)
 		mail_index_ext_register(index, MAIL_INDEX_MODSEQ_EXT_NAME,
 					sizeof(struct mail_index_modseq_header),
 					sizeof(uint64_t), sizeof(uint64_t));
+	index->modseq_expunges_ext_id =
+		mail_index_ext_register(index,
+			MAIL_INDEX_MODSEQ_EXPUNGES_EXT_NAME,
+			sizeof(struct mail_index_modseq_expunges_header), 0, 0);
 }
 
 static uint64_t mail_index_modseq_get_head(struct mail_index *index)
@@ -55,21 +59,41 @@ void mail_index_modseq_enable(struct mail_index *index)
 	struct mail_index_transaction *trans;
 	struct mail_index_view *view;
 	struct mail_index_modseq_header hdr;
+	struct mail_index_modseq_expunges_header expunges_hdr;
 	uint32_t ext_map_idx;
+	bool have_modseqs, have_expunges;
 
 	if (index->modseqs_enabled)
 		return;
 
-	if (!mail_index_map_get_ext_idx(index->map, index->modseq_ext_id,
-					&ext_map_idx)) {
+	have_modseqs = mail_index_map_get_ext_idx(index->map,
+						  index->modseq_ext_id,
+						  &ext_map_idx);
+	have_expunges = mail_index_map_get_ext_idx(index->map,
+					index->modseq_expunges_ext_id,
+					&ext_map_idx);
+	if (!have_modseqs || !have_expunges) {
 		/* modseqs not enabled to the index yet, add them. */
 		view = mail_index_view_open(index);
 		trans = mail_index_transaction_begin(view, 0);
 
-		i_zero(&hdr);
-		hdr.highest_modseq = mail_index_modseq_get_head(index);
-		mail_index_update_header_ext(trans, index->modseq_ext_id,
-					     0, &hdr, sizeof(hdr));
+		if (!have_modseqs) {
+			i_zero(&hdr);
+			hdr.highest_modseq = mail_index_modseq_get_head(index);
+			mail_index_update_header_ext(trans,
+						     index->modseq_ext_id,
+						     0, &hdr, sizeof(hdr));
+		}
+		if (!have_expunges) {
+			/* expunges before this aren't known. The records
+			   are zero-filled, so write only the beginning. */
+			i_zero(&expunges_hdr);
+			expunges_hdr.complete_modseq =
+				mail_index_modseq_get_head(index);
+			mail_index_update_header_ext(trans,
+				index->modseq_expunges_ext_id, 0, &expunges_hdr,
+				offsetof(struct mail_index_modseq_expunges_header, recs));
+		}
 
 		/* commit also refreshes the index, which syncs the modseqs */
 		(void)mail_index_transaction_commit(&trans);
@@ -122,6 +146,19 @@ uint64_t mail_index_map_modseq_get_highest(struct mail_index_map *map)
 	}
 }
 
+uint64_t mail_index_modseq_get_highest_synced(struct mail_index_view *view)
+{
+	const struct mail_index_modseq_header *modseq_hdr;
+
+	modseq_hdr = mail_index_map_get_modseq_header(view->map);
+	return modseq_hdr == NULL ? 0 : modseq_hdr->highest_modseq;
+}
+
+uint64_t mail_index_modseq_get_last_appended(struct mail_index *index)
+{
+	return index->last_appended_modseq;
+}
+
 uint64_t mail_index_modseq_get_highest(struct mail_index_view *view)
 {
 	return mail_index_map_modseq_get_highest(view->map);
@@ -547,6 +584,67 @@ void mail_index_modseq_append(struct mail_index_modseq_sync *ctx, uint32_t seq)
 	(void)mail_index_modseq_update_to_highest(ctx, seq, seq);
 }
 
+static void
+mail_index_modseq_expunges_add(struct mail_index_modseq_sync *ctx,
+			       uint32_t seq1, uint32_t seq2)
+{
+	struct mail_index_map *map = ctx->view->map;
+	const struct mail_index_ext *ext;
+	struct mail_index_modseq_expunges_header *hdr;
+	struct mail_index_modseq_expunge_rec *rec;
+	uint32_t ext_map_idx, uid1, uid2;
+	uint64_t modseq;
+
+	if (!mail_index_map_get_ext_idx(map,
+					ctx->view->index->modseq_expunges_ext_id,
+					&ext_map_idx))
+		return;
+	ext = array_idx(&map->extensions, ext_map_idx);
+	if (ext->hdr_size != sizeof(*hdr))
+		return;
+
+	uid1 = MAIL_INDEX_REC_AT_SEQ(map, seq1)->uid;
+	uid2 = MAIL_INDEX_REC_AT_SEQ(map, seq2)->uid;
+	modseq = mail_transaction_log_view_get_prev_modseq(ctx->log_view);
+
+	i_assert(map->hdr_copy_buf->used == map->hdr.header_size);
+	hdr = buffer_get_space_unsafe(map->hdr_copy_buf, ext->hdr_offset,
+				      sizeof(*hdr));
+	map->hdr_base = map->hdr_copy_buf->data;
+	if (hdr->count > MAIL_INDEX_MODSEQ_EXPUNGES_MAX_RECS ||
+	    hdr->first_idx >= MAIL_INDEX_MODSEQ_EXPUNGES_MAX_RECS) {
+		/* corrupted - start from scratch */
+		hdr->complete_modseq = modseq;
+		hdr->count = 0;
+		hdr->first_idx = 0;
+	}
+
+	if (hdr->count > 0) {
+		rec = &hdr->recs[(hdr->first_idx + hdr->count - 1) %
+				 MAIL_INDEX_MODSEQ_EXPUNGES_MAX_RECS];
+		if (uid1 >= rec->uid1 && uid1 <= rec->uid2 + 1) {
+			/* typically expunges are in ascending order */
+			rec->uid2 = I_MAX(rec->uid2, uid2);
+			rec->modseq = I_MAX(rec->modseq, modseq);
+			return;
+		}
+	}
+	if (hdr->count == MAIL_INDEX_MODSEQ_EXPUNGES_MAX_RECS) {
+		/* drop the oldest record */
+		rec = &hdr->recs[hdr->first_idx];
+		hdr->complete_modseq = I_MAX(hdr->complete_modseq, rec->modseq);
+		hdr->first_idx = (hdr->first_idx + 1) %
+			MAIL_INDEX_MODSEQ_EXPUNGES_MAX_RECS;
+		hdr->count--;
+	}
+	rec = &hdr->recs[(hdr->first_idx + hdr->count) %
+			 MAIL_INDEX_MODSEQ_EXPUNGES_MAX_RECS];
+	rec->uid1 = uid1;
+	rec->uid2 = uid2;
+	rec->modseq = modseq;
+	hdr->count++;
+}
+
 void mail_index_modseq_expunge(struct mail_index_modseq_sync *ctx,
 			       uint32_t seq1, uint32_t seq2)
 {
@@ -555,6 +653,8 @@ void mail_index_modseq_expunge(struct mail_index_modseq_sync *ctx,
 	if (ctx->mmap == NULL)
 		return;
 
+	mail_index_modseq_expunges_add(ctx, seq1, seq2);
+
 	seq1--;
 	array_foreach_modifiable(&ctx->mmap->metadata_modseqs, metadata) {
 		if (array_is_created(&metadata->modseqs))
@@ -674,6 +774,40 @@ void mail_index_map_modseq_free(struct mail_index_map_modseq **_mmap)
 	i_free(mmap);
 }
 
+bool mail_index_modseq_get_expunged_uids(struct mail_index_view *view,
+					 uint64_t modseq,
+					 ARRAY_TYPE(seq_range) *expunged_uids)
+{
+	const struct mail_index_ext *ext;
+	const struct mail_index_modseq_expunges_header *hdr;
+	const struct mail_index_modseq_expunge_rec *rec;
+	uint32_t ext_map_idx, i;
+
+	if (!mail_index_map_get_ext_idx(view->map,
+					view->index->modseq_expunges_ext_id,
+					&ext_map_idx))
+		return FALSE;
+	ext = array_idx(&view->map->extensions, ext_map_idx);
+	if (ext->hdr_size != sizeof(*hdr))
+		return FALSE;
+
+	hdr = CONST_PTR_OFFSET(view->map->hdr_base, ext->hdr_offset);
+	if (modseq < hdr->complete_modseq ||
+	    hdr->count > MAIL_INDEX_MODSEQ_EXPUNGES_MAX_RECS ||
+	    hdr->first_idx >= MAIL_INDEX_MODSEQ_EXPUNGES_MAX_RECS)
+		return FALSE;
+
+	for (i = 0; i < hdr->count; i++) {
+		rec = &hdr->recs[(hdr->first_idx + i) %
+				 MAIL_INDEX_MODSEQ_EXPUNGES_MAX_RECS];
+		if (rec->modseq > modseq && rec->uid1 <= rec->uid2) {
+			seq_range_array_add_range(expunged_uids,
+						  rec->uid1, rec->uid2);
+		}
+	}
+	return TRUE;
+}
+
 bool mail_index_modseq_get_next_log_offset(struct mail_index_view *view,
 					   uint64_t modseq, uint32_t *log_seq_r,
 					   uoff_t *log_offset_r)
@@ -2,8 +2,11 @@
 #define MAIL_INDEX_MODSEQ_H
 
 #include "mail-types.h"
+#include "seq-range-array.h"
 
 #define MAIL_INDEX_MODSEQ_EXT_NAME "modseq"
+#define MAIL_INDEX_MODSEQ_EXPUNGES_EXT_NAME "modseq-expunges"
+#define MAIL_INDEX_MODSEQ_EXPUNGES_MAX_RECS 128
 
 struct mail_keywords;
 struct mail_index;
@@ -21,6 +24,25 @@ struct mail_index_modseq_header {
 	uint32_t log_offset;
 };
 
+struct mail_index_modseq_expunge_rec {
+	uint32_t uid1, uid2;
+	/* highest modseq of the expunges in this range */
+	uint64_t modseq;
+};
+
+/* Expunged UIDs with their modseqs. These are kept even after the
+   transaction log files containing the expunges have been deleted.
+   Adjacent expunges are merged and the oldest records are dropped when
+   the ring is full. */
+struct mail_index_modseq_expunges_header {
+	/* All expunges with a higher modseq than this are in recs */
+	uint64_t complete_modseq;
+	/* Number of used records and the index of the oldest one */
+	uint32_t count;
+	uint32_t first_idx;
+	struct mail_index_modseq_expunge_rec recs[MAIL_INDEX_MODSEQ_EXPUNGES_MAX_RECS];
+};
+
 void mail_index_modseq_init(struct mail_index *index);
 
 const struct mail_index_modseq_header *
@@ -29,6 +51,13 @@ uint64_t mail_index_map_modseq_get_highest(struct mail_index_map *map);
 void mail_index_modseq_enable(struct mail_index *index);
 bool mail_index_have_modseq_tracking(struct mail_index *index);
 uint64_t mail_index_modseq_get_highest(struct mail_index_view *view);
+/* Returns the highest modseq in the view's modseq header, or 0 if there is
+   no header. Unlike mail_index_modseq_get_highest(), this doesn't fall back
+   to the transaction log's head, which the view may not have synced yet. */
+uint64_t mail_index_modseq_get_highest_synced(struct mail_index_view *view);
+/* Returns the highest modseq this process has written to the transaction
+   log, or 0 if it hasn't changed anything yet. */
+uint64_t mail_index_modseq_get_last_appended(struct mail_index *index);
 
 uint64_t mail_index_modseq_lookup(struct mail_index_view *view, uint32_t seq);
 uint64_t mail_index_modseq_lookup_flags(struct mail_index_view *view,
@@ -62,6 +91,12 @@ struct mail_index_map_modseq *
 mail_index_map_modseq_clone(const struct mail_index_map_modseq *mmap);
 void mail_index_map_modseq_free(struct mail_index_map_modseq **mmap);
 
+/* Add UIDs expunged after the given modseq to expunged_uids using the
+   modseq-expunges extension. Returns FALSE if the extension doesn't go back
+   that far. The returned UIDs may also contain UIDs expunged earlier. */
+bool mail_index_modseq_get_expunged_uids(struct mail_index_view *view,
+					 uint64_t modseq,
+					 ARRAY_TYPE(seq_range) *expunged_uids);
 bool mail_index_modseq_get_next_log_offset(struct mail_index_view *view,
 					   uint64_t modseq, uint32_t *log_seq_r,
 					   uoff_t *log_offset_r);
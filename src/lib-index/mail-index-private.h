@@ -108,8 +108,17 @@ struct mail_index_record_map {
 
 	void *mmap_base;
 	size_t mmap_size, mmap_used_size;
+	/* the mmaped index file */
+	ino_t mmap_ino;
+	dev_t mmap_dev;
 
 	buffer_t *buffer;
+	/* If non-NULL, the records are in a private copy-on-write mapping of
+	   the index file instead of the buffer. Its pages are shared with the
+	   page cache until they're modified. cow_records_size is the maximum
+	   size the records can grow to without moving them to a buffer. */
+	void *cow_base;
+	size_t cow_size, cow_records_size;
 
 	void *records; /* struct mail_index_record[] */
 	unsigned int records_count;
@@ -202,6 +211,9 @@ struct mail_index {
 
 	uint32_t keywords_ext_id;
 	uint32_t modseq_ext_id;
+	uint32_t modseq_expunges_ext_id;
+	/* Highest modseq appended to the transaction log by this process */
+	uint64_t last_appended_modseq;
 
 	struct mail_index_view *views;
 
@@ -275,6 +287,14 @@ void mail_index_unmap(struct mail_index_map **map);
 /* Clone a map. The returned map is always in memory. */
 struct mail_index_map *mail_index_map_clone(const struct mail_index_map *map);
 void mail_index_record_map_move_to_private(struct mail_index_map *map);
+/* Free the memory used by the records. */
+void mail_index_record_map_free_records(struct mail_index *index,
+					struct mail_index_record_map *rec_map);
+/* Returns pointer to size bytes of writable space at offset pos in the
+   records. The records may be moved, so the returned pointer must not be
+   used after the next records change. */
+void *mail_index_map_get_records_space(struct mail_index_map *map,
+				       size_t pos, size_t size);
 /* Move a mmaped map to memory. */
 void mail_index_map_move_to_memory(struct mail_index_map *map);
 void mail_index_fchown(struct mail_index *index, int fd, const char *path);
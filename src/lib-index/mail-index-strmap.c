@@ -252,6 +252,7 @@ static int mail_index_strmap_open(struct mail_index_strmap_view *view)
 	struct mail_index_strmap *strmap = view->strmap;
 	const struct mail_index_header *idx_hdr;
 	struct mail_index_strmap_header hdr;
+	const struct stat *st;
 	const unsigned char *data;
 	size_t size;
 	int ret;
@@ -265,7 +266,13 @@ static int mail_index_strmap_open(struct mail_index_strmap_view *view)
 		mail_index_strmap_set_syscall_error(strmap, "open()");
 		return -1;
 	}
-	strmap->input = i_stream_create_fd(strmap->fd, (size_t)-1);
+	if ((strmap->index->flags & MAIL_INDEX_OPEN_FLAG_MMAP_DISABLE) != 0)
+		strmap->input = i_stream_create_fd(strmap->fd, (size_t)-1);
+	else {
+		/* the whole file is read at open, so avoid copying it */
+		strmap->input = i_stream_create_mmap(strmap->fd, (size_t)-1,
+						     0, (uoff_t)-1, FALSE);
+	}
 	ret = i_stream_read_bytes(strmap->input, &data, &size, sizeof(hdr));
 	if (ret <= 0) {
 		if (ret < 0) {
@@ -297,6 +304,16 @@ static int mail_index_strmap_open(struct mail_index_strmap_view *view)
 	view->next_str_idx = 1;
 
 	mail_index_strmap_view_reset(view);
+
+	/* each record takes at least STRMAP_FILE_STRIDX_SIZE bytes. size the
+	   hash table for that many records, so it doesn't have to be grown
+	   and rehashed repeatedly while reading a large file. */
+	if (i_stream_stat(strmap->input, FALSE, &st) == 0 &&
+	    st->st_size > (off_t)sizeof(hdr)) {
+		hash2_reserve(view->hash, I_MIN((st->st_size - sizeof(hdr)) /
+						STRMAP_FILE_STRIDX_SIZE,
+						UINT_MAX / 2));
+	}
 	return 0;
 }
 
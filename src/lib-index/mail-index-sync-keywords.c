@@ -8,6 +8,9 @@
 #include "mail-index-sync-private.h"
 #include "mail-transaction-log.h"
 
+/* Keyword records up to this size (32 keywords) grow only as needed */
+#define KEYWORDS_EXT_RECORD_GROW_MIN_SIZE 4
+
 static bool
 keyword_lookup(struct mail_index_sync_map_ctx *ctx,
 	       const char *keyword_name, unsigned int *idx_r)
@@ -72,6 +75,27 @@ keywords_get_header_buf(struct mail_index_map *map,
 	return buf;
 }
 
+static uint16_t keywords_ext_record_size(unsigned int keywords_count)
+{
+	uint32_t size = (keywords_count + CHAR_BIT - 1) / CHAR_BIT;
+
+	if (size <= KEYWORDS_EXT_RECORD_GROW_MIN_SIZE) {
+		if ((size % 4) != 0) {
+			/* since we aren't properly aligned anyway,
+			   reserve one extra byte for future */
+			size++;
+		}
+		return size;
+	}
+
+	/* Growing the record size rewrites all the index records. With lots
+	   of keywords reserve space for 25% more of them, so new keywords
+	   can be added without resizing the records every time. */
+	size += size / 4;
+	size = (size + 3) & ~3U;
+	return I_MIN(size, (uint16_t)-1);
+}
+
 static void keywords_ext_register(struct mail_index_sync_map_ctx *ctx,
 				  uint32_t ext_map_idx, uint32_t reset_id,
 				  uint32_t hdr_size, uint32_t keywords_count)
@@ -90,12 +114,7 @@ static void keywords_ext_register(struct mail_index_sync_map_ctx *ctx,
 	u->ext_id = ext_map_idx;
 	u->reset_id = reset_id;
 	u->hdr_size = hdr_size;
-	u->record_size = (keywords_count + CHAR_BIT - 1) / CHAR_BIT;
-	if ((u->record_size % 4) != 0) {
-		/* since we aren't properly aligned anyway,
-		   reserve one extra byte for future */
-		u->record_size++;
-	}
+	u->record_size = keywords_ext_record_size(keywords_count);
 	u->record_align = 1;
 
 	if (ext_map_idx == (uint32_t)-1) {
@@ -171,8 +190,10 @@ keywords_header_add(struct mail_index_sync_map_ctx *ctx,
 
 	if (ext == NULL || buf->used > ext->hdr_size ||
 	    (uint32_t)ext->record_size * CHAR_BIT < keywords_count) {
-		/* if we need to grow the buffer, add some padding */
-		buffer_append_zero(buf, 128);
+		/* if we need to grow the buffer, add some padding. grow
+		   large headers in larger steps, so they don't need to be
+		   resized so often. */
+		buffer_append_zero(buf, I_MAX(128, (buf->used / 4) & ~3U));
 		keywords_ext_register(ctx, ext_map_idx,
 				      ext == NULL ? 0 : ext->reset_id,
 				      buf->used, keywords_count);
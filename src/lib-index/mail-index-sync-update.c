@@ -301,14 +301,10 @@ sync_expunge_range(struct mail_index_sync_map_ctx *ctx, const ARRAY_TYPE(seq_ran
 static void *sync_append_record(struct mail_index_map *map)
 {
 	size_t append_pos;
-	void *ret;
 
 	append_pos = map->rec_map->records_count * map->hdr.record_size;
-	ret = buffer_get_space_unsafe(map->rec_map->buffer, append_pos,
-				      map->hdr.record_size);
-	map->rec_map->records =
-		buffer_get_modifiable_data(map->rec_map->buffer, NULL);
-	return ret;
+	return mail_index_map_get_records_space(map, append_pos,
+						map->hdr.record_size);
 }
 
 static bool sync_update_ignored_change(struct mail_index_sync_map_ctx *ctx)
@@ -84,8 +84,8 @@ struct mail_index *mail_index_alloc(struct event *parent_event,
 					128, 2, 1);
 	index->keywords_pool = pool_alloconly_create("keywords", 512);
 	i_array_init(&index->keywords, 16);
-	hash_table_create(&index->keywords_hash, index->keywords_pool, 0,
-			  strcase_hash, strcasecmp);
+	hash_table_create_open(&index->keywords_hash, 0,
+			       strcase_hash, strcasecmp);
 	index->log = mail_transaction_log_alloc(index);
 	mail_index_modseq_init(index);
 	return index;
@@ -223,6 +223,11 @@ void mail_index_set_optimization_settings(struct mail_index *index,
 			set->cache.compress_header_continue_count;
 	if (set->cache.record_max_size != 0)
 		dest->cache.record_max_size = set->cache.record_max_size;
+	if (set->cache.compress_incremental_count != 0)
+		dest->cache.compress_incremental_count =
+			set->cache.compress_incremental_count;
+	if (set->cache.columns)
+		dest->cache.columns = TRUE;
 }
 
 void mail_index_set_ext_init_data(struct mail_index *index, uint32_t ext_id,
@@ -798,6 +803,10 @@ int mail_index_unlink(struct mail_index *index)
 	path = t_strconcat(index->filepath, MAIL_CACHE_FILE_SUFFIX, NULL);
 	if (unlink(path) < 0 && errno != ENOENT)
 		last_errno = errno;
+	path = t_strconcat(index->filepath, MAIL_CACHE_FILE_SUFFIX
+			   MAIL_CACHE_COLUMNS_FILE_SUFFIX, NULL);
+	if (unlink(path) < 0 && errno != ENOENT)
+		last_errno = errno;
 
 	if (last_errno == 0)
 		return 0;
@@ -285,6 +285,13 @@ struct mail_index_cache_optimization_settings {
 	/* Compress the file when we need to follow more than n next_offsets to
 	   find the latest cache header. */
 	unsigned int compress_header_continue_count;
+	/* Copy only this many mails per index sync when compressing, so
+	   large cache files are compressed over several syncs without
+	   keeping the cache locked. 0 copies everything at once. */
+	unsigned int compress_incremental_count;
+	/* When compressing, write hot fixed size fields also as columns into
+	   a separate file, where they're stored contiguously by UID. */
+	bool columns;
 };
 
 struct mail_index_optimization_settings {
@@ -91,7 +91,11 @@ static int log_buffer_write(struct mail_transaction_log_append_ctx *ctx)
 	if ((ctx->want_fsync &&
 	     file->log->index->fsync_mode != FSYNC_MODE_NEVER) ||
 	    file->log->index->fsync_mode == FSYNC_MODE_ALWAYS) {
-		if (fdatasync(file->fd) < 0) {
+		if (!file->log->index->log_sync_locked) {
+			/* fsync after unlocking, so the other writers don't
+			   have to wait for it. */
+			ctx->fsync_after_unlock = TRUE;
+		} else if (fdatasync(file->fd) < 0) {
 			mail_index_file_set_syscall_error(ctx->log->index,
 							  file->filepath,
 							  "fdatasync()");
@@ -210,7 +214,10 @@ mail_transaction_log_append_locked(struct mail_transaction_log_append_ctx *ctx)
 	log_append_sync_offset_if_needed(ctx);
 	if (log_buffer_write(ctx) < 0)
 		return -1;
+	if (ctx->new_highest_modseq > file->sync_highest_modseq)
+		ctx->log->index->last_appended_modseq = ctx->new_highest_modseq;
 	file->sync_highest_modseq = ctx->new_highest_modseq;
+	mail_transaction_log_file_update_modseq_checkpoints(file);
 	return 0;
 }
 
@@ -247,8 +254,22 @@ int mail_transaction_log_append_commit(struct mail_transaction_log_append_ctx **
 	*_ctx = NULL;
 
 	ret = mail_transaction_log_append_locked(ctx);
-	if (!index->log_sync_locked)
-		mail_transaction_log_file_unlock(index->log->head, "appending");
+	if (!index->log_sync_locked) {
+		struct mail_transaction_log_file *file = index->log->head;
+
+		mail_transaction_log_file_unlock(file, "appending");
+		/* fdatasync() also flushes the transactions appended by the
+		   other writers in the meantime, and the kernel batches
+		   concurrent fdatasync()s, so the writers effectively commit
+		   as a group. After unlocking we can't fall back to in-memory
+		   indexes anymore, since others may have appended after us. */
+		if (ret == 0 && ctx->fsync_after_unlock &&
+		    fdatasync(file->fd) < 0) {
+			mail_index_file_set_syscall_error(index, file->filepath,
+							  "fdatasync()");
+			ret = -1;
+		}
+	}
 
 	buffer_free(&ctx->output);
 	i_free(ctx);
@@ -115,6 +115,8 @@ void mail_transaction_log_file_free(struct mail_transaction_log_file **_file)
 		file->log->head = NULL;
 
 	buffer_free(&file->buffer);
+	if (array_is_created(&file->modseq_checkpoints))
+		array_free(&file->modseq_checkpoints);
 
 	if (file->mmap_base != NULL) {
 		if (munmap(file->mmap_base, file->mmap_size) < 0)
@@ -1163,6 +1165,94 @@ modseq_cache_get_modseq(struct mail_transaction_log_file *file, uint64_t modseq)
 	return &file->modseq_cache[best];
 }
 
+void mail_transaction_log_file_update_modseq_checkpoints(
+		struct mail_transaction_log_file *file)
+{
+	struct modseq_cache *checkpoint;
+	uoff_t prev_offset = file->hdr.hdr_size;
+
+	if (file->sync_highest_modseq == 0) {
+		/* modseqs aren't used */
+		return;
+	}
+	if (!array_is_created(&file->modseq_checkpoints))
+		i_array_init(&file->modseq_checkpoints, 16);
+	else if (array_count(&file->modseq_checkpoints) > 0) {
+		checkpoint = array_back_modifiable(&file->modseq_checkpoints);
+		prev_offset = checkpoint->offset;
+	}
+	if (file->sync_offset < prev_offset + LOG_FILE_MODSEQ_CHECKPOINT_INTERVAL)
+		return;
+
+	checkpoint = array_append_space(&file->modseq_checkpoints);
+	checkpoint->offset = file->sync_offset;
+	checkpoint->highest_modseq = file->sync_highest_modseq;
+}
+
+static void
+modseq_checkpoints_clear(struct mail_transaction_log_file *file)
+{
+	if (array_is_created(&file->modseq_checkpoints))
+		array_clear(&file->modseq_checkpoints);
+}
+
+static void
+modseq_checkpoint_skip_to_offset(struct mail_transaction_log_file *file,
+				 uoff_t offset, uoff_t *cur_offset,
+				 uint64_t *cur_modseq)
+{
+	const struct modseq_cache *checkpoints;
+	unsigned int idx, left_idx, right_idx, count;
+
+	if (!array_is_created(&file->modseq_checkpoints))
+		return;
+
+	/* find the last checkpoint at or before the offset */
+	checkpoints = array_get(&file->modseq_checkpoints, &count);
+	left_idx = 0; right_idx = count;
+	while (left_idx < right_idx) {
+		idx = (left_idx + right_idx) / 2;
+		if (checkpoints[idx].offset <= offset)
+			left_idx = idx + 1;
+		else
+			right_idx = idx;
+	}
+	if (left_idx > 0 && checkpoints[left_idx-1].offset > *cur_offset) {
+		*cur_offset = checkpoints[left_idx-1].offset;
+		*cur_modseq = checkpoints[left_idx-1].highest_modseq;
+	}
+}
+
+static void
+modseq_checkpoint_skip_to_modseq(struct mail_transaction_log_file *file,
+				 uint64_t modseq, uoff_t *cur_offset,
+				 uint64_t *cur_modseq)
+{
+	const struct modseq_cache *checkpoints;
+	unsigned int idx, left_idx, right_idx, count;
+
+	if (!array_is_created(&file->modseq_checkpoints))
+		return;
+
+	/* find the last checkpoint before the modseq was reached. the same
+	   modseq may continue over multiple checkpoints, so the offset of
+	   a checkpoint with the wanted modseq isn't necessarily the first
+	   one having it. */
+	checkpoints = array_get(&file->modseq_checkpoints, &count);
+	left_idx = 0; right_idx = count;
+	while (left_idx < right_idx) {
+		idx = (left_idx + right_idx) / 2;
+		if (checkpoints[idx].highest_modseq < modseq)
+			left_idx = idx + 1;
+		else
+			right_idx = idx;
+	}
+	if (left_idx > 0 && checkpoints[left_idx-1].offset > *cur_offset) {
+		*cur_offset = checkpoints[left_idx-1].offset;
+		*cur_modseq = checkpoints[left_idx-1].highest_modseq;
+	}
+}
+
 static int
 log_get_synced_record(struct mail_transaction_log_file *file, uoff_t *offset,
 		      const struct mail_transaction_header **hdr_r,
@@ -1224,6 +1314,7 @@ int mail_transaction_log_file_get_highest_modseq_at(
 		cur_offset = cache->offset;
 		cur_modseq = cache->highest_modseq;
 	}
+	modseq_checkpoint_skip_to_offset(file, offset, &cur_offset, &cur_modseq);
 
 	ret = mail_transaction_log_file_map(file, cur_offset, offset, &reason);
 	if (ret <= 0) {
@@ -1329,6 +1420,7 @@ int mail_transaction_log_file_get_modseq_next_offset(
 		cur_offset = cache->offset;
 		cur_modseq = cache->highest_modseq;
 	}
+	modseq_checkpoint_skip_to_modseq(file, modseq, &cur_offset, &cur_modseq);
 
 	if ((ret = get_modseq_next_offset_at(file, modseq, TRUE, &cur_offset,
 					     &cur_modseq, next_offset_r)) <= 0)
@@ -1354,6 +1446,7 @@ int mail_transaction_log_file_get_modseq_next_offset(
 		file->need_rotate = TRUE;
 		/* clear cache, since it's unreliable */
 		memset(file->modseq_cache, 0, sizeof(file->modseq_cache));
+		modseq_checkpoints_clear(file);
 	}
 
 	/* @UNSAFE: cache the value */
@@ -1450,6 +1543,7 @@ mail_transaction_log_file_sync(struct mail_transaction_log_file *file,
 		mail_transaction_log_file_set_corrupted(file, "%s", *reason_r);
 		/* fix the sync_offset to avoid crashes later on */
 		file->sync_offset = file->buffer_offset + size;
+		modseq_checkpoints_clear(file);
 		return 0;
 	}
 	while (file->sync_offset - file->buffer_offset + sizeof(*hdr) <= size) {
@@ -1478,6 +1572,7 @@ mail_transaction_log_file_sync(struct mail_transaction_log_file *file,
 		}
 
 		file->sync_offset += trans_size;
+		mail_transaction_log_file_update_modseq_checkpoints(file);
 	}
 
 	if (file->mmap_base != NULL && !file->locked) {
@@ -14,6 +14,9 @@ struct dotlock_settings;
 #define MAIL_TRANSACTION_LOG_FILE_IN_MEMORY(file) ((file)->fd == -1)
 
 #define LOG_FILE_MODSEQ_CACHE_SIZE 10
+/* Remember the highest modseq at roughly this interval of log file offsets,
+   so finding modseqs and offsets doesn't need to scan the whole file. */
+#define LOG_FILE_MODSEQ_CHECKPOINT_INTERVAL (64*1024)
 
 struct modseq_cache {
 	uoff_t offset;
@@ -64,6 +67,8 @@ struct mail_transaction_log_file {
 	uoff_t index_deleted_offset, index_undeleted_offset;
 
 	struct modseq_cache modseq_cache[LOG_FILE_MODSEQ_CACHE_SIZE];
+	/* sorted by offset (and so also by highest_modseq) */
+	ARRAY(struct modseq_cache) modseq_checkpoints;
 
 	struct file_lock *file_lock;
 	time_t lock_created;
@@ -148,5 +153,9 @@ int mail_transaction_log_file_get_highest_modseq_at(
 int mail_transaction_log_file_get_modseq_next_offset(
 		struct mail_transaction_log_file *file,
 		uint64_t modseq, uoff_t *next_offset_r);
+/* sync_offset and sync_highest_modseq have grown. Add a new modseq checkpoint
+   if enough data has been written since the previous one. */
+void mail_transaction_log_file_update_modseq_checkpoints(
+		struct mail_transaction_log_file *file);
 
 #endif
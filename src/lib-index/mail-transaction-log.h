@@ -194,6 +194,9 @@ struct mail_transaction_log_append_ctx {
 	bool tail_offset_changed:1;
 	bool sync_includes_this:1;
 	bool want_fsync:1;
+	/* the written data still needs to be fsynced after the log is
+	   unlocked */
+	bool fsync_after_unlock:1;
 };
 
 #define LOG_IS_BEFORE(seq1, offset1, seq2, offset2) \
@@ -0,0 +1,474 @@
+/* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "buffer.h"
+#include "unlink-directory.h"
+#include "test-common.h"
+#include "mail-index-private.h"
+#include "mail-cache-private.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#define TESTDIR_NAME ".dovecot.test"
+
+enum {
+	TEST_FIELD_STR,
+	TEST_FIELD_FIXED,
+	TEST_FIELD_BITMASK,
+
+	TEST_FIELD_COUNT
+};
+
+static struct mail_cache_field test_cache_fields[TEST_FIELD_COUNT] = {
+	{ .name = "test.str", .type = MAIL_CACHE_FIELD_VARIABLE_SIZE,
+	  .field_size = UINT_MAX, .decision = MAIL_CACHE_DECISION_YES },
+	{ .name = "test.fixed", .type = MAIL_CACHE_FIELD_FIXED_SIZE,
+	  .field_size = sizeof(uint32_t), .decision = MAIL_CACHE_DECISION_YES },
+	{ .name = "test.bitmask", .type = MAIL_CACHE_FIELD_BITMASK,
+	  .field_size = sizeof(uint32_t), .decision = MAIL_CACHE_DECISION_YES },
+};
+
+static int
+test_cache_lookup(struct mail_cache_view *cache_view, uint32_t seq,
+		  unsigned int field, buffer_t *buf)
+{
+	buffer_set_used_size(buf, 0);
+	return mail_cache_lookup_field(cache_view, buf, seq,
+				       test_cache_fields[field].idx);
+}
+
+static void
+test_cache_add_num(struct mail_index *index, uint32_t seq, uint32_t bits,
+		   bool add_all, uint32_t num)
+{
+	struct mail_index_view *view = mail_index_view_open(index);
+	struct mail_index_transaction *trans;
+	struct mail_cache_view *cache_view;
+	struct mail_cache_transaction_ctx *cache_trans;
+
+	trans = mail_index_transaction_begin(view, 0);
+	cache_view = mail_cache_view_open(index->cache, view);
+	cache_trans = mail_cache_get_transaction(cache_view, trans);
+	if (add_all) {
+		mail_cache_add(cache_trans, seq,
+			       test_cache_fields[TEST_FIELD_STR].idx,
+			       "hello world", 11);
+		mail_cache_add(cache_trans, seq,
+			       test_cache_fields[TEST_FIELD_FIXED].idx,
+			       &num, sizeof(num));
+	}
+	mail_cache_add(cache_trans, seq,
+		       test_cache_fields[TEST_FIELD_BITMASK].idx,
+		       &bits, sizeof(bits));
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_cache_view_close(&cache_view);
+	mail_index_view_close(&view);
+}
+
+static void
+test_cache_add(struct mail_index *index, uint32_t seq, uint32_t bits,
+	       bool add_all)
+{
+	test_cache_add_num(index, seq, bits, add_all, 1234);
+}
+
+static void test_cache_append(struct mail_index *index, uint32_t uid)
+{
+	struct mail_index_view *view = mail_index_view_open(index);
+	struct mail_index_transaction *trans;
+	uint32_t seq;
+
+	trans = mail_index_transaction_begin(view, 0);
+	mail_index_append(trans, uid, &seq);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+}
+
+static struct mail_index *
+test_cache_index_create(const struct mail_index_optimization_settings *set)
+{
+	struct mail_cache_field fields[TEST_FIELD_COUNT];
+	struct mail_index *index;
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	uint32_t uid_validity = 1234;
+	const char *error;
+	unsigned int i;
+
+	(void)unlink_directory(TESTDIR_NAME, UNLINK_DIRECTORY_FLAG_RMDIR, &error);
+	if (mkdir(TESTDIR_NAME, 0700) < 0)
+		i_error("mkdir(%s) failed: %m", TESTDIR_NAME);
+
+	index = mail_index_alloc(NULL, TESTDIR_NAME, "test.dovecot.index");
+	mail_index_set_optimization_settings(index, set);
+	test_assert(mail_index_open_or_create(index, MAIL_INDEX_OPEN_FLAG_CREATE) == 0);
+
+	/* compression changes YES decisions to TEMP until the fields are
+	   accessed again. force them to stay YES, so the columns get
+	   written every time. */
+	memcpy(fields, test_cache_fields, sizeof(fields));
+	for (i = 0; i < TEST_FIELD_COUNT; i++)
+		fields[i].decision |= MAIL_CACHE_DECISION_FORCED;
+	mail_cache_register_fields(index->cache, fields, TEST_FIELD_COUNT);
+	for (i = 0; i < TEST_FIELD_COUNT; i++)
+		test_cache_fields[i].idx = fields[i].idx;
+
+	view = mail_index_view_open(index);
+	trans = mail_index_transaction_begin(view, 0);
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid_validity, sizeof(uid_validity), TRUE);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+	return index;
+}
+
+static void test_cache_compress(struct mail_index *index)
+{
+	struct mail_index_view *view = mail_index_view_open(index);
+	struct mail_index_transaction *trans;
+	struct mail_cache_compress_lock *lock;
+
+	trans = mail_index_transaction_begin(view, 0);
+	test_assert(mail_cache_compress_forced(index->cache, trans, &lock) == 0);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_cache_compress_unlock(&lock);
+	mail_index_view_close(&view);
+}
+
+static void test_mail_cache_lookup_fields(void)
+{
+	struct mail_index *index;
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	struct mail_cache_view *cache_view;
+	struct mail_cache_transaction_ctx *cache_trans;
+	buffer_t *buf = t_buffer_create(64);
+	uint32_t seq, bits;
+	const char *error;
+
+	(void)unlink_directory(TESTDIR_NAME, UNLINK_DIRECTORY_FLAG_RMDIR, &error);
+	if (mkdir(TESTDIR_NAME, 0700) < 0)
+		i_error("mkdir(%s) failed: %m", TESTDIR_NAME);
+
+	ioloop_time = 1;
+
+	test_begin("mail cache lookup multiple fields");
+	index = mail_index_alloc(NULL, TESTDIR_NAME, "test.dovecot.index");
+	test_assert(mail_index_open_or_create(index, MAIL_INDEX_OPEN_FLAG_CREATE) == 0);
+	mail_cache_register_fields(index->cache, test_cache_fields,
+				   TEST_FIELD_COUNT);
+	view = mail_index_view_open(index);
+
+	trans = mail_index_transaction_begin(view, 0);
+	seq = 1234;
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&seq, sizeof(seq), TRUE);
+	mail_index_append(trans, 1, &seq);
+	mail_index_append(trans, 2, &seq);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+
+	/* bitmask is added in two separate records */
+	test_cache_add(index, 1, 0x01, TRUE);
+	test_cache_add(index, 1, 0x10, FALSE);
+	test_cache_add(index, 2, 0x02, TRUE);
+
+	view = mail_index_view_open(index);
+	cache_view = mail_cache_view_open(index->cache, view);
+	for (seq = 1; seq <= 2; seq++) {
+		test_assert_idx(test_cache_lookup(cache_view, seq,
+						  TEST_FIELD_STR, buf) == 1, seq);
+		test_assert_idx(buf->used == 11 &&
+				memcmp(buf->data, "hello world", 11) == 0, seq);
+		test_assert_idx(test_cache_lookup(cache_view, seq,
+						  TEST_FIELD_FIXED, buf) == 1, seq);
+		test_assert_idx(buf->used == sizeof(uint32_t) &&
+				*(const uint32_t *)buf->data == 1234, seq);
+		test_assert_idx(test_cache_lookup(cache_view, seq,
+						  TEST_FIELD_BITMASK, buf) == 1, seq);
+		test_assert_idx(buf->used == sizeof(uint32_t) &&
+				*(const uint32_t *)buf->data ==
+				(seq == 1 ? 0x11U : 0x02U), seq);
+		/* looking up again gives the same result */
+		test_assert_idx(test_cache_lookup(cache_view, seq,
+						  TEST_FIELD_STR, buf) == 1, seq);
+		test_assert_idx(buf->used == 11, seq);
+	}
+
+	/* bits added within the same view must be visible immediately */
+	trans = mail_index_transaction_begin(view, 0);
+	cache_trans = mail_cache_get_transaction(cache_view, trans);
+	test_assert(test_cache_lookup(cache_view, 2, TEST_FIELD_BITMASK, buf) == 1);
+	bits = 0x20;
+	mail_cache_add(cache_trans, 2, test_cache_fields[TEST_FIELD_BITMASK].idx,
+		       &bits, sizeof(bits));
+	test_assert(test_cache_lookup(cache_view, 2, TEST_FIELD_BITMASK, buf) == 1);
+	test_assert(buf->used == sizeof(uint32_t) &&
+		    *(const uint32_t *)buf->data == 0x22);
+	test_assert(test_cache_lookup(cache_view, 2, TEST_FIELD_STR, buf) == 1);
+	test_assert(buf->used == 11);
+	mail_index_transaction_rollback(&trans);
+
+	mail_cache_view_close(&cache_view);
+	mail_index_view_close(&view);
+	mail_index_close(index);
+	mail_index_free(&index);
+	(void)unlink_directory(TESTDIR_NAME, UNLINK_DIRECTORY_FLAG_RMDIR, &error);
+	test_end();
+}
+
+static void test_mail_cache_lookup_after_sync(void)
+{
+	struct mail_index_optimization_settings set;
+	struct mail_index *index;
+	struct mail_index_view *view, *sync_view;
+	struct mail_index_view_sync_ctx *view_sync_ctx;
+	struct mail_index_view_sync_rec sync_rec;
+	struct mail_index_sync_ctx *sync_ctx;
+	struct mail_index_transaction *trans;
+	struct mail_cache_view *cache_view;
+	buffer_t *buf = t_buffer_create(64);
+	const char *error;
+	bool delayed_expunges;
+
+	ioloop_time = 1;
+
+	test_begin("mail cache lookup after view sync");
+	i_zero(&set);
+	index = test_cache_index_create(&set);
+	test_cache_append(index, 1);
+	test_cache_append(index, 2);
+	test_cache_add_num(index, 1, 0x01, TRUE, 1111);
+	test_cache_add_num(index, 2, 0x02, TRUE, 2222);
+
+	view = mail_index_view_open(index);
+	cache_view = mail_cache_view_open(index->cache, view);
+	test_assert(test_cache_lookup(cache_view, 1, TEST_FIELD_FIXED, buf) == 1);
+	test_assert(buf->used == sizeof(uint32_t) &&
+		    *(const uint32_t *)buf->data == 1111);
+
+	/* expunge UID 1, so seq 1 becomes UID 2 after the view is synced */
+	test_assert(mail_index_sync_begin(index, &sync_ctx, &sync_view,
+					  &trans, 0) == 1);
+	mail_index_expunge(trans, 1);
+	test_assert(mail_index_sync_commit(&sync_ctx) == 0);
+
+	view_sync_ctx = mail_index_view_sync_begin(view, 0);
+	while (mail_index_view_sync_next(view_sync_ctx, &sync_rec)) ;
+	test_assert(mail_index_view_sync_commit(&view_sync_ctx,
+						&delayed_expunges) == 0);
+	test_assert(mail_index_view_get_messages_count(view) == 1);
+
+	test_assert(test_cache_lookup(cache_view, 1, TEST_FIELD_FIXED, buf) == 1);
+	test_assert(buf->used == sizeof(uint32_t) &&
+		    *(const uint32_t *)buf->data == 2222);
+	test_assert(test_cache_lookup(cache_view, 1, TEST_FIELD_BITMASK, buf) == 1);
+	test_assert(buf->used == sizeof(uint32_t) &&
+		    *(const uint32_t *)buf->data == 0x02);
+
+	/* data added for the mail by another view is seen once the view is
+	   synced */
+	test_cache_add(index, 1, 0x40, FALSE);
+	view_sync_ctx = mail_index_view_sync_begin(view, 0);
+	while (mail_index_view_sync_next(view_sync_ctx, &sync_rec)) ;
+	test_assert(mail_index_view_sync_commit(&view_sync_ctx,
+						&delayed_expunges) == 0);
+	test_assert(test_cache_lookup(cache_view, 1, TEST_FIELD_BITMASK, buf) == 1);
+	test_assert(buf->used == sizeof(uint32_t) &&
+		    *(const uint32_t *)buf->data == 0x42);
+
+	mail_cache_view_close(&cache_view);
+	mail_index_view_close(&view);
+	mail_index_close(index);
+	mail_index_free(&index);
+	(void)unlink_directory(TESTDIR_NAME, UNLINK_DIRECTORY_FLAG_RMDIR, &error);
+	test_end();
+}
+
+static void test_mail_cache_columns(void)
+{
+	struct mail_index_optimization_settings set = {
+		.cache = { .columns = TRUE },
+	};
+	struct mail_index *index;
+	struct mail_index_view *view;
+	struct mail_cache_view *cache_view;
+	buffer_t *buf = t_buffer_create(64);
+	unsigned int fixed_idx;
+	uint32_t seq;
+	const char *error;
+	struct stat st;
+	int fd;
+
+	ioloop_time = 1;
+
+	test_begin("mail cache columns");
+	index = test_cache_index_create(&set);
+	fixed_idx = test_cache_fields[TEST_FIELD_FIXED].idx;
+	for (seq = 1; seq <= 4; seq++)
+		test_cache_append(index, seq * 10);
+	/* mail 3 doesn't have the fixed field */
+	for (seq = 1; seq <= 4; seq++)
+		test_cache_add_num(index, seq, 0x01, seq != 3, seq * 100);
+	test_cache_compress(index);
+	test_assert(stat(TESTDIR_NAME"/test.dovecot.index.cache"
+			 MAIL_CACHE_COLUMNS_FILE_SUFFIX, &st) == 0);
+
+	/* new mail and a field added after compression aren't in columns */
+	test_cache_append(index, 50);
+	test_cache_add_num(index, 5, 0x01, TRUE, 500);
+	test_cache_add_num(index, 3, 0x01, TRUE, 300);
+
+	view = mail_index_view_open(index);
+	cache_view = mail_cache_view_open(index->cache, view);
+	/* look up backwards and forwards to test the row cursor */
+	for (seq = 5; seq >= 1; seq--) {
+		test_assert_idx(mail_cache_lookup_column(cache_view, seq,
+				fixed_idx, NULL) == (seq != 3 && seq != 5), seq);
+	}
+	for (seq = 1; seq <= 5; seq++) {
+		test_assert_idx(test_cache_lookup(cache_view, seq,
+						  TEST_FIELD_FIXED, buf) == 1, seq);
+		test_assert_idx(buf->used == sizeof(uint32_t) &&
+				*(const uint32_t *)buf->data == seq * 100, seq);
+		test_assert_idx(mail_cache_field_exists(cache_view, seq,
+							fixed_idx) == 1, seq);
+		/* other fields are still found from records */
+		test_assert_idx(test_cache_lookup(cache_view, seq,
+						  TEST_FIELD_STR, buf) == 1, seq);
+		test_assert_idx(test_cache_lookup(cache_view, seq,
+						  TEST_FIELD_BITMASK, buf) == 1, seq);
+		test_assert_idx(mail_cache_lookup_column(cache_view, seq,
+				test_cache_fields[TEST_FIELD_BITMASK].idx,
+				NULL) == FALSE, seq);
+	}
+	mail_cache_view_close(&cache_view);
+	mail_index_view_close(&view);
+	mail_index_close(index);
+	mail_index_free(&index);
+
+	/* without columns enabled, compression removes the old file */
+	set.cache.columns = FALSE;
+	index = test_cache_index_create(&set);
+	test_cache_append(index, 1);
+	test_cache_add(index, 1, 0x01, TRUE);
+	fd = creat(TESTDIR_NAME"/test.dovecot.index.cache"
+		   MAIL_CACHE_COLUMNS_FILE_SUFFIX, 0600);
+	test_assert(fd != -1);
+	i_close_fd(&fd);
+	test_cache_compress(index);
+	test_assert(stat(TESTDIR_NAME"/test.dovecot.index.cache"
+			 MAIL_CACHE_COLUMNS_FILE_SUFFIX, &st) < 0 &&
+		    errno == ENOENT);
+	mail_index_close(index);
+	mail_index_free(&index);
+
+	(void)unlink_directory(TESTDIR_NAME, UNLINK_DIRECTORY_FLAG_RMDIR, &error);
+	test_end();
+}
+
+static void
+test_cache_compress_incremental(struct mail_index *index, bool finish)
+{
+	struct mail_index_view *view = mail_index_view_open(index);
+	struct mail_index_transaction *trans;
+	struct mail_cache_compress_lock *lock;
+	uint32_t file_seq = index->cache->hdr->file_seq;
+
+	/* this is normally set by whoever notices the cache is fragmented */
+	index->cache->need_compress_file_seq = file_seq;
+	trans = mail_index_transaction_begin(view, 0);
+	test_assert(mail_cache_compress_incremental(index->cache, trans, &lock) == 0);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_cache_compress_unlock(&lock);
+	mail_index_view_close(&view);
+
+	test_assert((index->cache->compress_ctx == NULL) == finish);
+	test_assert((index->cache->hdr->file_seq != file_seq) == finish);
+	test_assert(mail_cache_need_compress(index->cache) == !finish);
+}
+
+static void test_mail_cache_compress_incremental(void)
+{
+	struct mail_index_optimization_settings set = {
+		.cache = { .compress_incremental_count = 2 },
+	};
+	struct mail_index *index;
+	struct mail_index_view *view;
+	struct mail_cache_view *cache_view;
+	buffer_t *buf = t_buffer_create(64);
+	uint32_t seq, file_seq;
+	const char *error;
+
+	ioloop_time = 1;
+
+	test_begin("mail cache compress incremental");
+	index = test_cache_index_create(&set);
+	for (seq = 1; seq <= 5; seq++) {
+		test_cache_append(index, seq);
+		test_cache_add_num(index, seq, 0x01, TRUE, seq * 100);
+	}
+
+	/* copies 1..2 and 3..4, then finishes with 5..6 */
+	test_cache_compress_incremental(index, FALSE);
+	test_cache_compress_incremental(index, FALSE);
+	/* mails added during the compression get copied at the end */
+	test_cache_append(index, 6);
+	test_cache_add_num(index, 6, 0x01, TRUE, 600);
+	test_cache_compress_incremental(index, TRUE);
+
+	view = mail_index_view_open(index);
+	cache_view = mail_cache_view_open(index->cache, view);
+	for (seq = 1; seq <= 6; seq++) {
+		test_assert_idx(test_cache_lookup(cache_view, seq,
+						  TEST_FIELD_FIXED, buf) == 1, seq);
+		test_assert_idx(buf->used == sizeof(uint32_t) &&
+				*(const uint32_t *)buf->data == seq * 100, seq);
+		test_assert_idx(test_cache_lookup(cache_view, seq,
+						  TEST_FIELD_STR, buf) == 1, seq);
+	}
+	mail_cache_view_close(&cache_view);
+	mail_index_view_close(&view);
+
+	/* a full compression finishes the unfinished one */
+	test_cache_compress_incremental(index, FALSE);
+	file_seq = index->cache->hdr->file_seq;
+	test_cache_compress(index);
+	test_assert(index->cache->compress_ctx == NULL);
+	test_assert(index->cache->hdr->file_seq != file_seq);
+
+	view = mail_index_view_open(index);
+	cache_view = mail_cache_view_open(index->cache, view);
+	for (seq = 1; seq <= 6; seq++) {
+		test_assert_idx(test_cache_lookup(cache_view, seq,
+						  TEST_FIELD_FIXED, buf) == 1, seq);
+		test_assert_idx(buf->used == sizeof(uint32_t) &&
+				*(const uint32_t *)buf->data == seq * 100, seq);
+	}
+	mail_cache_view_close(&cache_view);
+	mail_index_view_close(&view);
+
+	/* unfinished compression is cleaned up when closing */
+	test_cache_compress_incremental(index, FALSE);
+	mail_index_close(index);
+	mail_index_free(&index);
+
+	(void)unlink_directory(TESTDIR_NAME, UNLINK_DIRECTORY_FLAG_RMDIR, &error);
+	test_end();
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_mail_cache_lookup_fields,
+		test_mail_cache_lookup_after_sync,
+		test_mail_cache_columns,
+		test_mail_cache_compress_incremental,
+		NULL
+	};
+	return test_run(test_functions);
+}
@@ -2,11 +2,17 @@
 
 #include "lib.h"
 #include "array.h"
+#include "ioloop.h"
+#include "unlink-directory.h"
 #include "test-common.h"
 #include "mail-index-private.h"
 #include "mail-index-modseq.h"
 #include "mail-index-transaction-private.h"
 
+#include <sys/stat.h>
+
+#define TESTDIR_NAME ".dovecot.test"
+
 static void test_mail_index_map_lookup_seq_range_count(unsigned int messages_count)
 {
 	struct mail_index_record_map rec_map;
@@ -47,10 +53,106 @@ static void test_mail_index_map_lookup_seq_range(void)
 	test_end();
 }
 
+static void test_mail_index_map_append(struct mail_index *index,
+				       uint32_t first_uid, uint32_t count)
+{
+	struct mail_index_view *view = mail_index_view_open(index);
+	struct mail_index_transaction *trans;
+	uint32_t seq, uid, uid_validity = 1234;
+
+	trans = mail_index_transaction_begin(view, 0);
+	if (first_uid == 1) {
+		mail_index_update_header(trans,
+			offsetof(struct mail_index_header, uid_validity),
+			&uid_validity, sizeof(uid_validity), TRUE);
+	}
+	for (uid = first_uid; uid < first_uid + count; uid++)
+		mail_index_append(trans, uid, &seq);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+}
+
+static void test_mail_index_map_move_to_memory(void)
+{
+	/* large enough for the index to be mmaped */
+	const unsigned int count = MAIL_INDEX_MMAP_MIN_SIZE /
+		sizeof(struct mail_index_record) + 1000;
+	struct mail_index *index;
+	struct mail_index_view *view, *old_view;
+	struct mail_index_transaction *trans;
+	struct mail_index_sync_ctx *sync_ctx;
+	const struct mail_index_record *rec;
+	const char *error;
+	uint32_t seq;
+
+	test_begin("mail index map move to memory");
+	ioloop_time = 1;
+	(void)unlink_directory(TESTDIR_NAME, UNLINK_DIRECTORY_FLAG_RMDIR, &error);
+	if (mkdir(TESTDIR_NAME, 0700) < 0)
+		i_error("mkdir(%s) failed: %m", TESTDIR_NAME);
+
+	index = mail_index_alloc(NULL, TESTDIR_NAME, "test.dovecot.index");
+	test_assert(mail_index_open_or_create(index, MAIL_INDEX_OPEN_FLAG_CREATE) == 0);
+	test_mail_index_map_append(index, 1, count);
+	/* write dovecot.index */
+	index->need_recreate = TRUE;
+	test_assert(mail_index_sync_begin(index, &sync_ctx, &view, &trans, 0) == 1);
+	test_assert(mail_index_sync_commit(&sync_ctx) == 0);
+	mail_index_close(index);
+
+	test_assert(mail_index_open(index, 0) == 1);
+	test_assert(!MAIL_INDEX_MAP_IS_IN_MEMORY(index->map));
+
+	/* appending moves the map to memory, while the old view keeps using
+	   the mmaped records */
+	old_view = mail_index_view_open(index);
+	test_mail_index_map_append(index, count + 1, 1);
+	test_assert(mail_index_refresh(index) == 0);
+	test_assert(MAIL_INDEX_MAP_IS_IN_MEMORY(index->map));
+	test_assert(!MAIL_INDEX_MAP_IS_IN_MEMORY(old_view->map));
+#ifdef MAP_ANONYMOUS
+	test_assert(index->map->rec_map->cow_base != NULL);
+#endif
+	test_assert(index->map->hdr.messages_count == count + 1);
+
+	view = mail_index_view_open(index);
+	trans = mail_index_transaction_begin(view, 0);
+	mail_index_update_flags(trans, 1, MODIFY_ADD, MAIL_SEEN);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+	test_assert(mail_index_refresh(index) == 0);
+	test_assert(MAIL_INDEX_REC_AT_SEQ(index->map, 1)->flags == MAIL_SEEN);
+	test_assert(MAIL_INDEX_REC_AT_SEQ(old_view->map, 1)->flags == 0);
+
+	/* grow the records past the reserved space */
+	test_mail_index_map_append(index, count + 2, count - 1);
+	test_assert(mail_index_refresh(index) == 0);
+#ifdef MAP_ANONYMOUS
+	test_assert(index->map->rec_map->cow_base == NULL);
+#endif
+	test_assert(index->map->hdr.messages_count == count * 2);
+	for (seq = 1; seq <= count * 2; seq++) {
+		rec = MAIL_INDEX_REC_AT_SEQ(index->map, seq);
+		test_assert_idx(rec->uid == seq, seq);
+		test_assert_idx(rec->flags == (seq == 1 ? MAIL_SEEN : 0), seq);
+	}
+	for (seq = 1; seq <= count; seq++) {
+		rec = MAIL_INDEX_REC_AT_SEQ(old_view->map, seq);
+		test_assert_idx(rec->uid == seq && rec->flags == 0, seq);
+	}
+	mail_index_view_close(&old_view);
+	mail_index_close(index);
+	mail_index_free(&index);
+
+	(void)unlink_directory(TESTDIR_NAME, UNLINK_DIRECTORY_FLAG_RMDIR, &error);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_mail_index_map_lookup_seq_range,
+		test_mail_index_map_move_to_memory,
 		NULL
 	};
 	return test_run(test_functions);
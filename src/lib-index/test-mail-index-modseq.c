@@ -1,6 +1,7 @@
 /* Copyright (c) 2016-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
 #include "ioloop.h"
 #include "unlink-directory.h"
 #include "test-common.h"
@@ -18,8 +19,8 @@ static void test_mail_index_modseq_get_next_log_offset(void)
 	} tests[] = {
 		{ 0, 0 },
 		{ 2, 40 },
-		{ 2, 148 },
-		{ 2, 164 },
+		{ 2, 220 },
+		{ 2, 236 },
 		{ 3, 40 },
 		{ 3, 56 },
 		{ 3, 72 },
@@ -82,10 +83,96 @@ static void test_mail_index_modseq_get_next_log_offset(void)
 	test_end();
 }
 
+static void test_mail_index_modseq_get_expunged_uids(void)
+{
+	struct mail_index *index;
+	struct mail_index_view *view, *sync_view;
+	struct mail_index_transaction *trans;
+	struct mail_index_sync_ctx *sync_ctx;
+	ARRAY_TYPE(seq_range) uids;
+	const struct seq_range *range;
+	uint64_t modseq;
+	uint32_t seq, uid;
+	const char *error;
+
+	(void)unlink_directory(TESTDIR_NAME, UNLINK_DIRECTORY_FLAG_RMDIR, &error);
+	if (mkdir(TESTDIR_NAME, 0700) < 0)
+		i_error("mkdir(%s) failed: %m", TESTDIR_NAME);
+
+	ioloop_time = 1;
+
+	test_begin("mail_index_modseq_get_expunged_uids()");
+	index = mail_index_alloc(NULL, TESTDIR_NAME, "test.dovecot.index");
+	test_assert(mail_index_open_or_create(index, MAIL_INDEX_OPEN_FLAG_CREATE) == 0);
+	view = mail_index_view_open(index);
+	mail_index_modseq_enable(index);
+
+	trans = mail_index_transaction_begin(view, 0);
+	uid = 1234;
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid, sizeof(uid), TRUE);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+	view = mail_index_view_open(index);
+	modseq = mail_index_modseq_get_highest(view);
+
+	trans = mail_index_transaction_begin(view, 0);
+	for (uid = 1; uid <= 10; uid++)
+		mail_index_append(trans, uid, &seq);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+	view = mail_index_view_open(index);
+
+	/* expunge 2..3 and 7 in separate syncs */
+	test_assert(mail_index_sync_begin(index, &sync_ctx, &sync_view,
+					  &trans, 0) == 1);
+	mail_index_expunge(trans, 2);
+	mail_index_expunge(trans, 3);
+	test_assert(mail_index_sync_commit(&sync_ctx) == 0);
+	mail_index_view_close(&view);
+	view = mail_index_view_open(index);
+	uint64_t modseq2 = mail_index_modseq_get_highest(view);
+
+	test_assert(mail_index_sync_begin(index, &sync_ctx, &sync_view,
+					  &trans, 0) == 1);
+	test_assert(mail_index_lookup_seq(sync_view, 7, &seq));
+	mail_index_expunge(trans, seq);
+	test_assert(mail_index_sync_commit(&sync_ctx) == 0);
+	mail_index_view_close(&view);
+	view = mail_index_view_open(index);
+
+	t_array_init(&uids, 4);
+	test_assert(mail_index_modseq_get_expunged_uids(view, modseq, &uids));
+	test_assert(array_count(&uids) == 2);
+	range = array_idx(&uids, 0);
+	test_assert(range->seq1 == 2 && range->seq2 == 3);
+	range = array_idx(&uids, 1);
+	test_assert(range->seq1 == 7 && range->seq2 == 7);
+
+	array_clear(&uids);
+	test_assert(mail_index_modseq_get_expunged_uids(view, modseq2, &uids));
+	test_assert(array_count(&uids) == 1);
+	range = array_idx(&uids, 0);
+	test_assert(range->seq1 == 7 && range->seq2 == 7);
+
+	/* expunges before enabling modseqs aren't known */
+	array_clear(&uids);
+	test_assert(!mail_index_modseq_get_expunged_uids(view, 0, &uids));
+
+	mail_index_view_close(&view);
+	mail_index_close(index);
+	mail_index_free(&index);
+
+	(void)unlink_directory(TESTDIR_NAME, UNLINK_DIRECTORY_FLAG_RMDIR, &error);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_mail_index_modseq_get_next_log_offset,
+		test_mail_index_modseq_get_expunged_uids,
 		NULL
 	};
 	return test_run(test_functions);
@@ -26,6 +26,10 @@ int mail_index_map_ext_hdr_check(const struct mail_index_header *hdr ATTR_UNUSED
 				 const char *name ATTR_UNUSED,
 				 const char **error_r ATTR_UNUSED) { return -1; }
 void mail_index_modseq_hdr_update(struct mail_index_modseq_sync *ctx ATTR_UNUSED) {}
+void mail_index_record_map_free_records(struct mail_index *index ATTR_UNUSED,
+					struct mail_index_record_map *rec_map) {
+	buffer_free(&rec_map->buffer);
+}
 bool mail_index_lookup_seq(struct mail_index_view *view ATTR_UNUSED,
 			   uint32_t uid, uint32_t *seq_r) {
 	*seq_r = uid;
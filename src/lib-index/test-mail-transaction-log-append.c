@@ -39,6 +39,11 @@ int mail_index_move_to_memory(struct mail_index *index ATTR_UNUSED)
 	return -1;
 }
 
+void mail_transaction_log_file_update_modseq_checkpoints(
+	struct mail_transaction_log_file *file ATTR_UNUSED)
+{
+}
+
 static void test_append_expunge(struct mail_transaction_log *log)
 {
 	static unsigned int buf[] = { 0x12345678, 0xabcdef09 };
@@ -156,6 +161,20 @@ static void test_mail_transaction_log_append(void)
 	test_assert(mail_transaction_log_append_commit(&ctx) == 0);
 	if (fstat(fd, &st) < 0) i_fatal("fstat() failed: %m");
 	test_assert(st.st_size == 1);
+	test_end();
+
+	test_begin("transaction log append: fsync after unlock");
+	log->index->fsync_mode = FSYNC_MODE_ALWAYS;
+	file->log = log;
+	if (lseek(fd, 1, SEEK_SET) < 0) i_fatal("lseek() failed: %m");
+	test_assert(mail_transaction_log_append_begin(log->index, 0, &ctx) == 0);
+	mail_transaction_log_append_add(ctx, MAIL_TRANSACTION_EXPUNGE,
+					&st.st_size, 8);
+	test_assert(mail_transaction_log_append_commit(&ctx) == 0);
+	if (fstat(fd, &st) < 0) i_fatal("fstat() failed: %m");
+	test_assert(st.st_size == 1 + sizeof(struct mail_transaction_header) + 8);
+	test_assert(file->sync_offset == (uoff_t)st.st_size);
+	log->index->fsync_mode = FSYNC_MODE_OPTIMIZED;
 	file->fd = -1;
 	test_end();
 
@@ -1,6 +1,7 @@
 /* Copyright (c) 2009-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
 #include "ioloop.h"
 #include "test-common.h"
 #include "mail-index-private.h"
@@ -369,6 +370,52 @@ static void test_mail_transaction_log_file_modseq_offsets(void)
 	test_end();
 }
 
+static void test_mail_transaction_log_file_modseq_checkpoints(void)
+{
+	test_begin("mail_transaction_log_file modseq checkpoints");
+
+	struct mail_index *index = test_mail_index_open();
+	struct mail_transaction_log_file *file = index->log->head;
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	ARRAY(uoff_t) offsets;
+	uint64_t modseq, modseq_at;
+	uoff_t next_offset;
+	const char *error;
+	uint32_t seq;
+
+	/* offsets[modseq] = the offset where the modseq was reached */
+	t_array_init(&offsets, 1024);
+	array_idx_set(&offsets, 1, &file->sync_offset);
+	for (modseq = 2; file->sync_offset <
+	     LOG_FILE_MODSEQ_CHECKPOINT_INTERVAL * 4; modseq++) {
+		view = mail_index_view_open(index);
+		trans = mail_index_transaction_begin(view, 0);
+		mail_index_append(trans, modseq, &seq);
+		test_assert(mail_index_transaction_commit(&trans) == 0);
+		mail_index_view_close(&view);
+		array_idx_set(&offsets, modseq, &file->sync_offset);
+	}
+	test_assert(array_count(&file->modseq_checkpoints) >= 3);
+
+	for (modseq = 2; modseq < array_count(&offsets) - 1; modseq++) {
+		const uoff_t *offsetp = array_idx(&offsets, modseq);
+
+		/* make sure only the checkpoints are used */
+		memset(file->modseq_cache, 0, sizeof(file->modseq_cache));
+		test_assert_idx(mail_transaction_log_file_get_modseq_next_offset(file, modseq, &next_offset) == 0, modseq);
+		test_assert_idx(next_offset == *offsetp, modseq);
+
+		memset(file->modseq_cache, 0, sizeof(file->modseq_cache));
+		test_assert_idx(mail_transaction_log_file_get_highest_modseq_at(file, *offsetp, &modseq_at, &error) == 0, modseq);
+		test_assert_idx(modseq_at == modseq, modseq);
+	}
+
+	mail_index_close(index);
+	mail_index_free(&index);
+	test_end();
+}
+
 static void
 test_mail_transaction_log_file_get_modseq_next_offset_inconsistency(void)
 {
@@ -405,6 +452,7 @@ int main(void)
 	static void (*const test_functions[])(void) = {
 		test_mail_transaction_update_modseq,
 		test_mail_transaction_log_file_modseq_offsets,
+		test_mail_transaction_log_file_modseq_checkpoints,
 		test_mail_transaction_log_file_get_modseq_next_offset_inconsistency,
 		NULL
 	};
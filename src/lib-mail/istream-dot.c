@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "istream-private.h"
+#include "mem-scan.h"
 #include "istream-dot.h"
 
 struct dot_istream {
@@ -145,6 +146,21 @@ static ssize_t i_stream_dot_read(struct istream_private *stream)
 
 	data = i_stream_get_data(stream->parent, &size);
 	for (i = 0; i < size && dest < stream->buffer_size; i++) {
+		if (dstream->state == 0) {
+			/* copy everything until the next CR/LF */
+			const unsigned char *p;
+			size_t copy_size = I_MIN(size - i,
+						 stream->buffer_size - dest);
+
+			p = mem_find_crlf(data + i, copy_size);
+			if (p != NULL)
+				copy_size = p - (data + i);
+			memcpy(stream->w_buffer + dest, data + i, copy_size);
+			dest += copy_size;
+			i += copy_size;
+			if (i == size || dest == stream->buffer_size)
+				break;
+		}
 		switch (dstream->state) {
 		case 0:
 			break;
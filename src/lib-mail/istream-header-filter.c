@@ -8,6 +8,17 @@
 #include "istream-header-filter.h"
 
 
+/* Start of a header line. Used for seeking directly to the line instead of
+   re-parsing the headers from the beginning. */
+struct header_filter_line_offset {
+	/* parent stream offset */
+	uoff_t physical_offset;
+	/* offset in this stream's output */
+	uoff_t virtual_offset;
+	/* cur_line for the line */
+	unsigned int line;
+};
+
 struct header_filter_istream {
 	struct istream_private istream;
 	pool_t pool;
@@ -27,6 +38,7 @@ struct header_filter_istream {
 
 	unsigned int cur_line, parsed_lines;
 	ARRAY(unsigned int) match_change_lines;
+	ARRAY(struct header_filter_line_offset) line_offsets;
 
 	bool header_read:1;
 	bool seen_eoh:1;
@@ -196,8 +208,20 @@ static ssize_t read_header(struct header_filter_istream *mstream)
 						    &hdr)) > 0) {
 		bool matched;
 
-		if (!hdr->continued)
+		if (!hdr->continued) {
 			mstream->cur_line++;
+			if (!hdr->eoh && !mstream->header_parsed &&
+			    !mstream->headers_edited &&
+			    mstream->skip_count == 0) {
+				struct header_filter_line_offset *offset =
+					array_append_space(&mstream->line_offsets);
+				offset->physical_offset = hdr->name_offset;
+				offset->virtual_offset =
+					mstream->istream.istream.v_offset +
+					mstream->hdr_buf->used;
+				offset->line = mstream->cur_line;
+			}
+		}
 		if (hdr->eoh) {
 			mstream->seen_eoh = TRUE;
 			matched = FALSE;
@@ -460,21 +484,62 @@ static ssize_t i_stream_header_filter_read(struct istream_private *stream)
 	return ret;
 }
 
+static const struct header_filter_line_offset *
+i_stream_header_filter_find_line(struct header_filter_istream *mstream,
+				 uoff_t v_offset)
+{
+	const struct header_filter_line_offset *offsets;
+	unsigned int idx, left_idx, right_idx, count;
+
+	/* The offsets are valid only after the whole header has been parsed
+	   and only as long as the header lines are output the same way. */
+	if (!mstream->header_parsed || mstream->headers_edited)
+		return NULL;
+
+	offsets = array_get(&mstream->line_offsets, &count);
+	if (count == 0 || offsets[0].virtual_offset > v_offset)
+		return NULL;
+
+	/* find the last line starting at or before v_offset */
+	left_idx = 0; right_idx = count;
+	while (left_idx + 1 < right_idx) {
+		idx = (left_idx + right_idx) / 2;
+		if (offsets[idx].virtual_offset <= v_offset)
+			left_idx = idx;
+		else
+			right_idx = idx;
+	}
+	return &offsets[left_idx];
+}
+
 static void
 i_stream_header_filter_seek_to_header(struct header_filter_istream *mstream,
 				      uoff_t v_offset)
 {
-	i_stream_seek(mstream->istream.parent,
-		      mstream->istream.parent_start_offset);
-	mstream->istream.parent_expected_offset =
-		mstream->istream.parent_start_offset;
+	const struct header_filter_line_offset *line;
+	uoff_t parent_offset = mstream->istream.parent_start_offset;
+	unsigned int cur_line = 0;
+
+	line = i_stream_header_filter_find_line(mstream, v_offset);
+	if (!mstream->header_parsed) {
+		/* the offsets are added again while parsing */
+		array_clear(&mstream->line_offsets);
+	} else if (line != NULL) {
+		parent_offset = line->physical_offset;
+		v_offset -= line->virtual_offset;
+		/* cur_line is incremented when the line is parsed */
+		cur_line = line->line - 1;
+	}
+
+	i_stream_seek(mstream->istream.parent, parent_offset);
+	mstream->istream.parent_expected_offset = parent_offset;
 	mstream->istream.access_counter =
 		mstream->istream.parent->real_stream->access_counter;
 
 	if (mstream->hdr_ctx != NULL)
 		message_parse_header_deinit(&mstream->hdr_ctx);
 	mstream->skip_count = v_offset;
-	mstream->cur_line = 0;
+	mstream->cur_line = cur_line;
 	mstream->prev_matched = FALSE;
 	mstream->header_read = FALSE;
 	mstream->seen_eoh = FALSE;
@@ -647,6 +712,7 @@ i_stream_create_header_filter(struct istream *input,
 	}
 	mstream->headers_count = j;
 	mstream->hdr_buf = buffer_create_dynamic(mstream->pool, 1024);
+	p_array_init(&mstream->line_offsets, mstream->pool, 16);
 
 	mstream->callback = callback;
 	mstream->context = context;
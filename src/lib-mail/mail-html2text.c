@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "buffer.h"
 #include "unichar.h"
+#include "mem-scan.h"
 #include "message-parser.h"
 #include "mail-html2text.h"
 
@@ -180,6 +181,7 @@ static size_t
 parse_data(struct mail_html2text *ht,
 	   const unsigned char *data, size_t size, buffer_t *output)
 {
+	const unsigned char *p;
 	size_t i, ret;
 
 	for (i = 0; i < size; i++) {
@@ -187,20 +189,25 @@ parse_data(struct mail_html2text *ht,
 
 		switch (ht->state) {
 		case HTML_STATE_TEXT:
-			if (c == '<') {
+			if (c != '<' && c != '&') {
+				/* copy/skip the text until the next tag or
+				   entity at once */
+				p = mem_find_chr2(data + i, size - i, '<', '&');
+				ret = p == NULL ? size - i : (size_t)(p - (data + i));
+				if (ht->quote_level == 0)
+					buffer_append(output, data + i, ret);
+				i += ret - 1;
+			} else if (c == '<') {
 				ret = parse_tag_name(ht, data+i+1, size-i-1);
 				if (ret == 0)
 					return i;
 				i += ret - 1;
 			} else if (ht->quote_level == 0) {
-				if (c == '&') {
-					ret = parse_entity(data+i+1, size-i-1, output);
-					if (ret == 0)
-						return i;
-					i += ret - 1;
-				} else {
-					buffer_append_c(output, c);
-				}
+				/* '&' */
+				ret = parse_entity(data+i+1, size-i-1, output);
+				if (ret == 0)
+					return i;
+				i += ret - 1;
 			}
 			break;
 		case HTML_STATE_TAG:
@@ -248,7 +255,10 @@ parse_data(struct mail_html2text *ht,
 				ht->state = HTML_STATE_COMMENT;
 			break;
 		case HTML_STATE_SCRIPT:
-			if (c == '<') {
+			if (c != '<') {
+				p = memchr(data + i, '<', size - i);
+				i = p == NULL ? size - 1 : (size_t)(p - data) - 1;
+			} else {
 				unsigned int max_len = I_MIN(size-i, 9);
 
 				if (i_memcasecmp(data+i, "</script>", max_len) == 0) {
@@ -261,7 +271,10 @@ parse_data(struct mail_html2text *ht,
 			}
 			break;
 		case HTML_STATE_STYLE:
-			if (c == '<') {
+			if (c != '<') {
+				p = memchr(data + i, '<', size - i);
+				i = p == NULL ? size - 1 : (size_t)(p - data) - 1;
+			} else {
 				unsigned int max_len = I_MIN(size-i, 8);
 
 				if (i_memcasecmp(data+i, "</style>", max_len) == 0) {
@@ -86,6 +86,44 @@ boundary_find(struct message_boundary *boundaries,
 	return best;
 }
 
+#define WORD_ONES ((uint64_t)0x0101010101010101ULL)
+#define WORD_HIGHS ((uint64_t)0x8080808080808080ULL)
+/* Non-zero if any of the bytes in the word is zero. The bytes following a
+   zero byte may give false positives. */
+#define WORD_HAS_ZERO(w) (((w) - WORD_ONES) & ~(w) & WORD_HIGHS)
+
+static const unsigned char *
+boundary_line_candidate_find(const unsigned char *data,
+			     const unsigned char *end)
+{
+	const unsigned char *p = data;
+	uint64_t w1, w2;
+	unsigned int i;
+
+	/* Find the next LF that is followed by '-' or by the end of data.
+	   Only these can begin a boundary line. This is called for the whole
+	   body of each multipart, so check 8 bytes at a time for the
+	   "\n-" pair instead of stopping at every line. */
+	while (end - p > (ptrdiff_t)sizeof(w1)) {
+		memcpy(&w1, p, sizeof(w1));
+		memcpy(&w2, p + 1, sizeof(w2));
+		if ((WORD_HAS_ZERO(w1 ^ (WORD_ONES * '\n')) &
+		     WORD_HAS_ZERO(w2 ^ (WORD_ONES * '-'))) != 0) {
+			/* possibly found - check the bytes */
+			for (i = 0; i < sizeof(w1); i++) {
+				if (p[i] == '\n' && p[i+1] == '-')
+					return p + i;
+			}
+		}
+		p += sizeof(w1);
+	}
+	for (; p < end; p++) {
+		if (*p == '\n' && (p + 1 == end || p[1] == '-'))
+			return p;
+	}
+	return NULL;
+}
+
 static void parse_body_add_block(struct message_parser_ctx *ctx,
 				 struct message_block *block)
 {
@@ -365,7 +403,7 @@ static int parse_next_body_to_boundary(struct message_parser_ctx *ctx,
 				       struct message_block *block_r)
 {
 	struct message_boundary *boundary = NULL;
-	const unsigned char *data, *cur, *next, *end;
+	const unsigned char *data, *cur, *next, *end, *p;
 	size_t boundary_start;
 	int ret;
 	bool full;
@@ -388,10 +426,10 @@ static int parse_next_body_to_boundary(struct message_parser_ctx *ctx,
 	i_assert(block_r->size > 0);
 	boundary_start = 0;
 
-	/* skip to beginning of the next line. the first line was
-	   handled already. */
+	/* skip to beginning of the next line that may be a boundary. the
+	   first line was handled already. */
 	cur = data; end = data + block_r->size;
-	while ((next = memchr(cur, '\n', end - cur)) != NULL) {
+	while ((next = boundary_line_candidate_find(cur, end)) != NULL) {
 		cur = next + 1;
 
 		boundary_start = next - data;
@@ -413,6 +451,19 @@ static int parse_next_body_to_boundary(struct message_parser_ctx *ctx,
 		}
 	}
 
+	if (next == NULL) {
+		/* the rest of the lines can't be boundaries, but the last
+		   line is still needed for the code below */
+		for (p = end; p > cur; ) {
+			if (*--p == '\n') {
+				boundary_start = p - data;
+				if (p > data && p[-1] == '\r')
+					boundary_start--;
+				break;
+			}
+		}
+	}
+
 	if (next != NULL) {
 		/* found / need more data */
 		i_assert(ret >= 0);
@@ -1109,6 +1160,23 @@ int message_parser_deinit_from_parts(struct message_parser_ctx **_ctx,
 	return ret;
 }
 
+bool message_parser_skip_part_body(struct message_parser_ctx *ctx)
+{
+	if (!ctx->preparsed || ctx->part == NULL ||
+	    ctx->part->children != NULL)
+		return FALSE;
+	if (ctx->parse_next_block != preparsed_parse_finish_header &&
+	    ctx->parse_next_block != preparsed_parse_body_more &&
+	    ctx->parse_next_block != preparsed_parse_body_finish)
+		return FALSE;
+
+	/* the next part's header is seeked to by its cached offset */
+	i_stream_skip(ctx->input, ctx->skip);
+	ctx->skip = 0;
+	preparsed_skip_to_next(ctx);
+	return TRUE;
+}
+
 int message_parser_parse_next_block(struct message_parser_ctx *ctx,
 				    struct message_block *block_r)
 {
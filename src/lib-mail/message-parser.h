@@ -65,6 +65,13 @@ int message_parser_deinit_from_parts(struct message_parser_ctx **_ctx,
 				     struct message_part **parts_r,
 				     const char **error_r);
 
+/* Skip over the rest of the current part's body. This can be called after
+   the end of headers block or after body blocks have been returned for a
+   part without children. With preparsed parts the body is skipped directly
+   by its cached offset and TRUE is returned. Otherwise FALSE is returned and
+   the caller needs to keep reading (and ignoring) the body blocks. */
+bool message_parser_skip_part_body(struct message_parser_ctx *ctx);
+
 /* Read the next block of a message. Returns 1 if block is returned, 0 if
    input stream is non-blocking and more data needs to be read, -1 when all is
    done or error occurred (see stream's error status). */
@@ -2,7 +2,9 @@
 
 #include "lib.h"
 #include "buffer.h"
+#include "message-address.h"
 #include "message-parser.h"
+#include "message-part-data.h"
 #include "message-part-serialize.h"
 
 /*
@@ -28,6 +30,41 @@
 
 */
 
+/*
+   message_part_data is serialized separately for each part in the same
+   order as above:
+
+   part
+     unsigned char has_data
+     (has_data)
+       string content_type, content_subtype
+       params content_type_params
+       string content_transfer_encoding, content_id, content_description
+       string content_disposition
+       params content_disposition_params
+       string content_md5
+       unsigned int content_language_count
+       string content_language[content_language_count]
+       string content_location
+       unsigned char has_envelope
+       (has_envelope)
+         string date, subject
+         addresses from, sender, reply_to, to, cc, bcc
+         string in_reply_to, message_id
+
+   string
+     unsigned int size (0 = NULL, otherwise strlen()+1)
+     unsigned char data[size-1]
+   params
+     unsigned int count
+     string name, value (count times)
+   addresses
+     unsigned int count
+     (count times)
+       string name, route, mailbox, domain
+       unsigned char invalid_syntax
+*/
+
 #define MINIMUM_SERIALIZED_SIZE \
 	(sizeof(unsigned int) + sizeof(uoff_t) * 4)
 
@@ -267,3 +304,312 @@ message_part_deserialize(pool_t pool, const void *data, size_t size,
 
 	return part;
 }
+
+static void data_serialize_str(buffer_t *dest, const char *str)
+{
+	unsigned int size = str == NULL ? 0 : strlen(str) + 1;
+
+	buffer_append(dest, &size, sizeof(size));
+	if (size > 0)
+		buffer_append(dest, str, size - 1);
+}
+
+static void
+data_serialize_params(buffer_t *dest, const struct message_part_param *params,
+		      unsigned int count)
+{
+	unsigned int i;
+
+	buffer_append(dest, &count, sizeof(count));
+	for (i = 0; i < count; i++) {
+		data_serialize_str(dest, params[i].name);
+		data_serialize_str(dest, params[i].value);
+	}
+}
+
+static void
+data_serialize_addresses(buffer_t *dest, const struct message_address *addr)
+{
+	const struct message_address *a;
+	unsigned int count = 0;
+	unsigned char invalid_syntax;
+
+	for (a = addr; a != NULL; a = a->next)
+		count++;
+	buffer_append(dest, &count, sizeof(count));
+	for (a = addr; a != NULL; a = a->next) {
+		data_serialize_str(dest, a->name);
+		data_serialize_str(dest, a->route);
+		data_serialize_str(dest, a->mailbox);
+		data_serialize_str(dest, a->domain);
+		invalid_syntax = a->invalid_syntax ? 1 : 0;
+		buffer_append(dest, &invalid_syntax, sizeof(invalid_syntax));
+	}
+}
+
+static void
+data_serialize_envelope(buffer_t *dest,
+			const struct message_part_envelope *env)
+{
+	data_serialize_str(dest, env->date);
+	data_serialize_str(dest, env->subject);
+	data_serialize_addresses(dest, env->from);
+	data_serialize_addresses(dest, env->sender);
+	data_serialize_addresses(dest, env->reply_to);
+	data_serialize_addresses(dest, env->to);
+	data_serialize_addresses(dest, env->cc);
+	data_serialize_addresses(dest, env->bcc);
+	data_serialize_str(dest, env->in_reply_to);
+	data_serialize_str(dest, env->message_id);
+}
+
+static void data_serialize(const struct message_part_data *data,
+			   buffer_t *dest)
+{
+	unsigned int i, count;
+	unsigned char has;
+
+	has = data == NULL ? 0 : 1;
+	buffer_append(dest, &has, sizeof(has));
+	if (data == NULL)
+		return;
+
+	data_serialize_str(dest, data->content_type);
+	data_serialize_str(dest, data->content_subtype);
+	data_serialize_params(dest, data->content_type_params,
+			      data->content_type_params_count);
+	data_serialize_str(dest, data->content_transfer_encoding);
+	data_serialize_str(dest, data->content_id);
+	data_serialize_str(dest, data->content_description);
+	data_serialize_str(dest, data->content_disposition);
+	data_serialize_params(dest, data->content_disposition_params,
+			      data->content_disposition_params_count);
+	data_serialize_str(dest, data->content_md5);
+
+	count = data->content_language == NULL ? 0 :
+		str_array_length(data->content_language);
+	buffer_append(dest, &count, sizeof(count));
+	for (i = 0; i < count; i++)
+		data_serialize_str(dest, data->content_language[i]);
+	data_serialize_str(dest, data->content_location);
+
+	has = data->envelope == NULL ? 0 : 1;
+	buffer_append(dest, &has, sizeof(has));
+	if (data->envelope != NULL)
+		data_serialize_envelope(dest, data->envelope);
+}
+
+void message_part_data_serialize(const struct message_part *part,
+				 buffer_t *dest)
+{
+	for (; part != NULL; part = part->next) {
+		data_serialize(part->data, dest);
+		if (part->children != NULL)
+			message_part_data_serialize(part->children, dest);
+	}
+}
+
+static bool data_read_count(struct deserialize_context *ctx,
+			    unsigned int *count_r)
+{
+	if (!read_next(ctx, count_r, sizeof(*count_r)))
+		return FALSE;
+	/* each item needs at least one byte - don't allocate huge arrays
+	   with corrupted data */
+	if (*count_r > (size_t)(ctx->end - ctx->data)) {
+		ctx->error = "Too large count";
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static bool data_read_str(struct deserialize_context *ctx, const char **str_r)
+{
+	unsigned int size;
+
+	if (!read_next(ctx, &size, sizeof(size)))
+		return FALSE;
+	if (size == 0) {
+		*str_r = NULL;
+		return TRUE;
+	}
+	if (size - 1 > (size_t)(ctx->end - ctx->data)) {
+		ctx->error = "Not enough data";
+		return FALSE;
+	}
+	*str_r = p_strndup(ctx->pool, ctx->data, size - 1);
+	ctx->data += size - 1;
+	return TRUE;
+}
+
+static bool
+data_read_params(struct deserialize_context *ctx,
+		 const struct message_part_param **params_r,
+		 unsigned int *count_r)
+{
+	struct message_part_param *params;
+	unsigned int i;
+
+	if (!data_read_count(ctx, count_r))
+		return FALSE;
+	if (*count_r == 0) {
+		*params_r = NULL;
+		return TRUE;
+	}
+	params = p_new(ctx->pool, struct message_part_param, *count_r);
+	for (i = 0; i < *count_r; i++) {
+		if (!data_read_str(ctx, &params[i].name) ||
+		    !data_read_str(ctx, &params[i].value))
+			return FALSE;
+		if (params[i].name == NULL || params[i].value == NULL) {
+			ctx->error = "NULL parameter";
+			return FALSE;
+		}
+	}
+	*params_r = params;
+	return TRUE;
+}
+
+static bool
+data_read_addresses(struct deserialize_context *ctx,
+		    struct message_address **addr_r)
+{
+	struct message_address *addr, **addrp = addr_r;
+	unsigned int i, count;
+	unsigned char invalid_syntax;
+
+	*addr_r = NULL;
+	if (!data_read_count(ctx, &count))
+		return FALSE;
+	for (i = 0; i < count; i++) {
+		addr = p_new(ctx->pool, struct message_address, 1);
+		if (!data_read_str(ctx, &addr->name) ||
+		    !data_read_str(ctx, &addr->route) ||
+		    !data_read_str(ctx, &addr->mailbox) ||
+		    !data_read_str(ctx, &addr->domain) ||
+		    !read_next(ctx, &invalid_syntax, sizeof(invalid_syntax)))
+			return FALSE;
+		addr->invalid_syntax = invalid_syntax != 0;
+		*addrp = addr;
+		addrp = &addr->next;
+	}
+	return TRUE;
+}
+
+static bool
+data_read_envelope(struct deserialize_context *ctx,
+		   struct message_part_envelope **env_r)
+{
+	struct message_part_envelope *env;
+
+	*env_r = env = p_new(ctx->pool, struct message_part_envelope, 1);
+	return data_read_str(ctx, &env->date) &&
+		data_read_str(ctx, &env->subject) &&
+		data_read_addresses(ctx, &env->from) &&
+		data_read_addresses(ctx, &env->sender) &&
+		data_read_addresses(ctx, &env->reply_to) &&
+		data_read_addresses(ctx, &env->to) &&
+		data_read_addresses(ctx, &env->cc) &&
+		data_read_addresses(ctx, &env->bcc) &&
+		data_read_str(ctx, &env->in_reply_to) &&
+		data_read_str(ctx, &env->message_id);
+}
+
+static bool data_deserialize(struct deserialize_context *ctx,
+			     struct message_part_data **data_r)
+{
+	struct message_part_data *data;
+	const char **language;
+	unsigned int i, count;
+	unsigned char has;
+
+	*data_r = NULL;
+	if (!read_next(ctx, &has, sizeof(has)))
+		return FALSE;
+	if (has == 0)
+		return TRUE;
+
+	data = p_new(ctx->pool, struct message_part_data, 1);
+	if (!data_read_str(ctx, &data->content_type) ||
+	    !data_read_str(ctx, &data->content_subtype) ||
+	    !data_read_params(ctx, &data->content_type_params,
+			      &data->content_type_params_count) ||
+	    !data_read_str(ctx, &data->content_transfer_encoding) ||
+	    !data_read_str(ctx, &data->content_id) ||
+	    !data_read_str(ctx, &data->content_description) ||
+	    !data_read_str(ctx, &data->content_disposition) ||
+	    !data_read_params(ctx, &data->content_disposition_params,
+			      &data->content_disposition_params_count) ||
+	    !data_read_str(ctx, &data->content_md5) ||
+	    !data_read_count(ctx, &count))
+		return FALSE;
+
+	if (count > 0) {
+		language = p_new(ctx->pool, const char *, count + 1);
+		for (i = 0; i < count; i++) {
+			if (!data_read_str(ctx, &language[i]))
+				return FALSE;
+			if (language[i] == NULL) {
+				ctx->error = "NULL content-language";
+				return FALSE;
+			}
+		}
+		data->content_language = language;
+	}
+	if (!data_read_str(ctx, &data->content_location) ||
+	    !read_next(ctx, &has, sizeof(has)))
+		return FALSE;
+	if (has != 0) {
+		if (!data_read_envelope(ctx, &data->envelope))
+			return FALSE;
+	}
+	*data_r = data;
+	return TRUE;
+}
+
+static bool data_deserialize_parts(struct deserialize_context *ctx,
+				   struct message_part *part)
+{
+	for (; part != NULL; part = part->next) {
+		if (!data_deserialize(ctx, &part->data))
+			return FALSE;
+		if (part->children != NULL) {
+			if (!data_deserialize_parts(ctx, part->children))
+				return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+static void data_clear(struct message_part *part)
+{
+	for (; part != NULL; part = part->next) {
+		part->data = NULL;
+		if (part->children != NULL)
+			data_clear(part->children);
+	}
+}
+
+int message_part_data_deserialize(pool_t pool, struct message_part *parts,
+				  const void *data, size_t size,
+				  const char **error_r)
+{
+	struct deserialize_context ctx;
+
+	i_zero(&ctx);
+	ctx.pool = pool;
+	ctx.data = data;
+	ctx.end = ctx.data + size;
+
+	if (!data_deserialize_parts(&ctx, parts)) {
+		data_clear(parts);
+		*error_r = ctx.error;
+		return -1;
+	}
+	if (ctx.data != ctx.end) {
+		data_clear(parts);
+		*error_r = "Too much data";
+		return -1;
+	}
+	return 0;
+}
@@ -13,4 +13,14 @@ struct message_part *
 message_part_deserialize(pool_t pool, const void *data, size_t size,
 			 const char **error_r);
 
+/* Serialize the message_part_data of all the parts. */
+void message_part_data_serialize(const struct message_part *part,
+				 buffer_t *dest);
+/* Set part->data for all the parts from the serialized data. The parts must
+   have the same structure as when serializing. Returns 0 if ok, -1 if the
+   data was invalid. On failure all the part->data are left NULL. */
+int message_part_data_deserialize(pool_t pool, struct message_part *parts,
+				  const void *data, size_t size,
+				  const char **error_r);
+
 #endif
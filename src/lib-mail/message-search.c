@@ -1,10 +1,12 @@
 /* Copyright (c) 2002-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
 #include "buffer.h"
 #include "istream.h"
 #include "str.h"
 #include "str-find.h"
+#include "str-find-multi.h"
 #include "rfc822-parser.h"
 #include "message-decoder.h"
 #include "message-parser.h"
@@ -14,6 +16,7 @@ struct message_search_context {
 	enum message_search_flags flags;
 	normalizer_func_t *normalizer;
 
+	char *key;
 	struct str_find_context *str_find_ctx;
 	struct message_part *prev_part;
 
@@ -21,6 +24,20 @@ struct message_search_context {
 	bool content_type_text:1; /* text/any or message/any */
 };
 
+struct message_search_multi_context {
+	unsigned int count;
+	/* used only for decoding, has no key */
+	struct message_search_context *decode_ctx;
+	struct message_part *prev_part;
+
+	/* Keys that are searched from both headers and bodies, and keys
+	   that are searched only from bodies. The maps give the key's index
+	   in the original ctxs[] array. */
+	struct str_find_multi_context *text_find, *body_find;
+	unsigned int *text_key_map, *body_key_map;
+	unsigned int text_count, body_count;
+};
+
 struct message_search_context *
 message_search_init(const char *normalized_key_utf8,
 		    normalizer_func_t *normalizer,
@@ -32,6 +49,8 @@ message_search_init(const char *normalized_key_utf8,
 
 	ctx = i_new(struct message_search_context, 1);
 	ctx->flags = flags;
+	ctx->normalizer = normalizer;
+	ctx->key = i_strdup(normalized_key_utf8);
 	ctx->decoder = message_decoder_init(normalizer, 0);
 	ctx->str_find_ctx = str_find_init(default_pool, normalized_key_utf8);
 	return ctx;
@@ -44,6 +63,7 @@ void message_search_deinit(struct message_search_context **_ctx)
 	*_ctx = NULL;
 	str_find_deinit(&ctx->str_find_ctx);
 	message_decoder_deinit(&ctx->decoder);
+	i_free(ctx->key);
 	i_free(ctx);
 }
 
@@ -115,9 +135,9 @@ bool message_search_more(struct message_search_context *ctx,
 	return message_search_more_get_decoded(ctx, raw_block, &decoded_block);
 }
 
-bool message_search_more_get_decoded(struct message_search_context *ctx,
-				     struct message_block *raw_block,
-				     struct message_block *decoded_block_r)
+static bool message_search_decode(struct message_search_context *ctx,
+				  struct message_block *raw_block,
+				  struct message_block *decoded_block_r)
 {
 	struct message_header_line *hdr = raw_block->hdr;
 	struct message_block decoded_block;
@@ -166,7 +186,16 @@ bool message_search_more_get_decoded(struct message_search_context *ctx,
 	}
 
 	*decoded_block_r = decoded_block;
-	return message_search_more_decoded2(ctx, &decoded_block);
+	return TRUE;
+}
+
+bool message_search_more_get_decoded(struct message_search_context *ctx,
+				     struct message_block *raw_block,
+				     struct message_block *decoded_block_r)
+{
+	if (!message_search_decode(ctx, raw_block, decoded_block_r))
+		return FALSE;
+	return message_search_more_decoded2(ctx, decoded_block_r);
 }
 
 bool message_search_more_decoded(struct message_search_context *ctx,
@@ -187,7 +216,8 @@ void message_search_reset(struct message_search_context *ctx)
 	ctx->content_type_text = TRUE;
 
 	ctx->prev_part = NULL;
-	str_find_reset(ctx->str_find_ctx);
+	if (ctx->str_find_ctx != NULL)
+		str_find_reset(ctx->str_find_ctx);
 	message_decoder_decode_reset(ctx->decoder);
 }
 
@@ -247,3 +277,225 @@ int message_search_msg(struct message_search_context *ctx,
 	i_free(error);
 	return ret;
 }
+
+static struct str_find_multi_context *
+message_search_multi_find_init(struct message_search_context *const *ctxs,
+			       unsigned int count, bool skip_headers,
+			       unsigned int *key_map, unsigned int *key_count_r)
+{
+	ARRAY_TYPE(const_string) keys;
+	const char *key;
+	unsigned int i;
+
+	t_array_init(&keys, count + 1);
+	for (i = 0; i < count; i++) {
+		if (((ctxs[i]->flags & MESSAGE_SEARCH_FLAG_SKIP_HEADERS) != 0) !=
+		    skip_headers)
+			continue;
+		key = ctxs[i]->key;
+		key_map[array_count(&keys)] = i;
+		array_push_back(&keys, &key);
+	}
+	*key_count_r = array_count(&keys);
+	if (*key_count_r == 0)
+		return NULL;
+	array_append_zero(&keys);
+	return str_find_multi_init(default_pool, array_front(&keys));
+}
+
+struct message_search_multi_context *
+message_search_multi_init(struct message_search_context *const *ctxs,
+			  unsigned int count)
+{
+	struct message_search_multi_context *ctx;
+
+	i_assert(count > 0);
+
+	ctx = i_new(struct message_search_multi_context, 1);
+	ctx->count = count;
+	ctx->text_key_map = i_new(unsigned int, count);
+	ctx->body_key_map = i_new(unsigned int, count);
+	T_BEGIN {
+		ctx->text_find = message_search_multi_find_init(ctxs, count,
+					FALSE, ctx->text_key_map,
+					&ctx->text_count);
+		ctx->body_find = message_search_multi_find_init(ctxs, count,
+					TRUE, ctx->body_key_map,
+					&ctx->body_count);
+	} T_END;
+
+	/* the decoder needs to see the headers only if some key wants them */
+	ctx->decode_ctx = i_new(struct message_search_context, 1);
+	ctx->decode_ctx->normalizer = ctxs[0]->normalizer;
+	ctx->decode_ctx->decoder =
+		message_decoder_init(ctxs[0]->normalizer, 0);
+	if (ctx->text_find == NULL)
+		ctx->decode_ctx->flags = MESSAGE_SEARCH_FLAG_SKIP_HEADERS;
+	return ctx;
+}
+
+void message_search_multi_deinit(struct message_search_multi_context **_ctx)
+{
+	struct message_search_multi_context *ctx = *_ctx;
+
+	*_ctx = NULL;
+	if (ctx->text_find != NULL)
+		str_find_multi_deinit(&ctx->text_find);
+	if (ctx->body_find != NULL)
+		str_find_multi_deinit(&ctx->body_find);
+	message_decoder_deinit(&ctx->decode_ctx->decoder);
+	i_free(ctx->decode_ctx);
+	i_free(ctx->text_key_map);
+	i_free(ctx->body_key_map);
+	i_free(ctx);
+}
+
+static void
+message_search_multi_reset(struct message_search_multi_context *ctx)
+{
+	if (ctx->text_find != NULL)
+		str_find_multi_reset(ctx->text_find);
+	if (ctx->body_find != NULL)
+		str_find_multi_reset(ctx->body_find);
+}
+
+static bool
+message_search_multi_all_found(struct message_search_multi_context *ctx)
+{
+	return (ctx->text_find == NULL ||
+		str_find_multi_all_found(ctx->text_find)) &&
+		(ctx->body_find == NULL ||
+		 str_find_multi_all_found(ctx->body_find));
+}
+
+static void
+message_search_multi_block(struct message_search_multi_context *ctx,
+			   const struct message_block *block)
+{
+	static const unsigned char crlf[2] = { '\r', '\n' };
+	const struct message_header_line *hdr = block->hdr;
+
+	if (block->part != ctx->prev_part) {
+		/* part changes */
+		message_search_multi_reset(ctx);
+		ctx->prev_part = block->part;
+	}
+
+	if (hdr != NULL) {
+		/* only the keys without SKIP_HEADERS see the headers */
+		i_assert(ctx->text_find != NULL);
+		(void)str_find_multi_more(ctx->text_find,
+			(const unsigned char *)hdr->name, hdr->name_len);
+		(void)str_find_multi_more(ctx->text_find,
+			hdr->middle, hdr->middle_len);
+		(void)str_find_multi_more(ctx->text_find,
+			hdr->full_value, hdr->full_value_len);
+		if (!hdr->no_newline)
+			(void)str_find_multi_more(ctx->text_find, crlf, 2);
+	} else {
+		if (ctx->text_find != NULL) {
+			(void)str_find_multi_more(ctx->text_find,
+						  block->data, block->size);
+		}
+		if (ctx->body_find != NULL) {
+			(void)str_find_multi_more(ctx->body_find,
+						  block->data, block->size);
+		}
+	}
+}
+
+static int
+message_search_multi_msg_real(struct message_search_multi_context *ctx,
+			      struct istream *input,
+			      struct message_part *parts, bool *matches_r,
+			      const char **error_r)
+{
+	const enum message_header_parser_flags hdr_parser_flags =
+		MESSAGE_HEADER_PARSER_FLAG_CLEAN_ONELINE;
+	struct message_parser_ctx *parser_ctx;
+	struct message_block raw_block, decoded_block;
+	struct message_part *new_parts;
+	unsigned int i, found_count = 0;
+	int ret = 1;
+
+	message_search_reset(ctx->decode_ctx);
+	ctx->prev_part = NULL;
+	if (ctx->text_find != NULL)
+		str_find_multi_reset_found(ctx->text_find);
+	if (ctx->body_find != NULL)
+		str_find_multi_reset_found(ctx->body_find);
+
+	if (parts != NULL) {
+		parser_ctx = message_parser_init_from_parts(parts,
+						input, hdr_parser_flags, 0);
+	} else {
+		parser_ctx = message_parser_init(pool_datastack_create(),
+						 input, hdr_parser_flags, 0);
+	}
+
+	while ((ret = message_parser_parse_next_block(parser_ctx,
+						      &raw_block)) > 0) {
+		if (!message_search_decode(ctx->decode_ctx, &raw_block,
+					   &decoded_block))
+			continue;
+		message_search_multi_block(ctx, &decoded_block);
+		if (message_search_multi_all_found(ctx))
+			break;
+	}
+	i_assert(ret != 0);
+	if (ret < 0 && input->stream_errno == 0) {
+		/* normal exit */
+		ret = 0;
+	}
+	if (message_parser_deinit_from_parts(&parser_ctx, &new_parts, error_r) < 0) {
+		/* broken parts */
+		ret = -1;
+	}
+
+	for (i = 0; i < ctx->count; i++)
+		matches_r[i] = FALSE;
+	for (i = 0; i < ctx->text_count; i++) {
+		if (str_find_multi_is_found(ctx->text_find, i)) {
+			matches_r[ctx->text_key_map[i]] = TRUE;
+			found_count++;
+		}
+	}
+	for (i = 0; i < ctx->body_count; i++) {
+		if (str_find_multi_is_found(ctx->body_find, i)) {
+			matches_r[ctx->body_key_map[i]] = TRUE;
+			found_count++;
+		}
+	}
+	return ret < 0 ? -1 : (int)found_count;
+}
+
+int message_search_multi_msg(struct message_search_multi_context *ctx,
+			     struct istream *input, struct message_part *parts,
+			     bool *matches_r, const char **error_r)
+{
+	char *error;
+	int ret;
+
+	T_BEGIN {
+		ret = message_search_multi_msg_real(ctx, input, parts,
+						    matches_r, error_r);
+		error = i_strdup(*error_r);
+	} T_END;
+	*error_r = t_strdup(error);
+	i_free(error);
+	return ret;
+}
+
+int message_search_msg_multi(struct message_search_context *const *ctxs,
+			     unsigned int count, struct istream *input,
+			     struct message_part *parts, bool *matches_r,
+			     const char **error_r)
+{
+	struct message_search_multi_context *ctx;
+	int ret;
+
+	ctx = message_search_multi_init(ctxs, count);
+	ret = message_search_multi_msg(ctx, input, parts, matches_r, error_r);
+	message_search_multi_deinit(&ctx);
+	return ret;
+}
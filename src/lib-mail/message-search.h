@@ -4,6 +4,7 @@
 struct message_block;
 struct message_part;
 struct message_search_context;
+struct message_search_multi_context;
 
 enum message_search_flags {
 	/* Skip the main header and all the MIME headers. */
@@ -37,4 +38,27 @@ int message_search_msg(struct message_search_context *ctx,
 		       const char **error_r)
 	ATTR_NULL(3);
 
+/* Search for all the given keys at once. The message is parsed, decoded and
+   scanned only once, no matter how many keys there are. The ctxs must all
+   use the same normalizer and they must not be deinitialized before the
+   multi context. */
+struct message_search_multi_context *
+message_search_multi_init(struct message_search_context *const *ctxs,
+			  unsigned int count);
+void message_search_multi_deinit(struct message_search_multi_context **ctx);
+/* Search a full message. matches_r[i] is set to TRUE if ctxs[i]'s key was
+   found. Returns the number of keys found, or -1 on error similarly to
+   message_search_msg(). */
+int message_search_multi_msg(struct message_search_multi_context *ctx,
+			     struct istream *input, struct message_part *parts,
+			     bool *matches_r, const char **error_r)
+	ATTR_NULL(3);
+/* Same as message_search_multi_init() + message_search_multi_msg() +
+   message_search_multi_deinit(). */
+int message_search_msg_multi(struct message_search_context *const *ctxs,
+			     unsigned int count, struct istream *input,
+			     struct message_part *parts, bool *matches_r,
+			     const char **error_r)
+	ATTR_NULL(4);
+
 #endif
@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "istream.h"
+#include "mem-scan.h"
 #include "message-parser.h"
 #include "message-size.h"
 
@@ -69,7 +70,8 @@ int message_get_body_size(struct istream *input, struct message_size *body,
 			  bool *has_nuls_r)
 {
 	const unsigned char *msg;
-	size_t i, size, missing_cr_count;
+	struct mem_lf_counts counts;
+	size_t size, missing_cr_count;
 	int ret;
 
 	memset(body, 0, sizeof(struct message_size));
@@ -84,28 +86,14 @@ int message_get_body_size(struct istream *input, struct message_size *body,
 	if (msg[0] == '\n')
 		missing_cr_count++;
 
+	i_zero(&counts);
 	do {
-		for (i = 1; i < size; i++) {
-			if (msg[i] > '\n')
-				continue;
-
-			if (msg[i] == '\n') {
-				if (msg[i-1] != '\r') {
-					/* missing CR */
-					missing_cr_count++;
-				}
-
-				/* increase after making sure we didn't break
-				   at virtual \r */
-				body->lines++;
-			} else if (msg[i] == '\0') {
-				*has_nuls_r = TRUE;
-			}
-		}
+		/* msg[0] was already counted, or it's the first character */
+		mem_count_lfs(msg + 1, size - 1, msg[0], &counts);
 
 		/* leave the last character, it may be \r */
-		i_stream_skip(input, i - 1);
-		body->physical_size += i - 1;
+		i_stream_skip(input, size - 1);
+		body->physical_size += size - 1;
 	} while ((ret = i_stream_read_bytes(input, &msg, &size, 2)) > 0);
 	i_assert(ret == -1);
 
@@ -114,6 +102,9 @@ int message_get_body_size(struct istream *input, struct message_size *body,
 	i_stream_skip(input, 1);
 	body->physical_size++;
 
+	body->lines = counts.lf_count;
+	missing_cr_count += counts.bare_lf_count;
+	*has_nuls_r = counts.have_nuls;
 	body->virtual_size = body->physical_size + missing_cr_count;
 	i_assert(body->virtual_size >= body->physical_size);
 	return ret;
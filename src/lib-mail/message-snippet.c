@@ -1,6 +1,7 @@
 /* Copyright (c) 2015-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
 #include "buffer.h"
 #include "str.h"
 #include "istream.h"
@@ -9,6 +10,9 @@
 #include "message-decoder.h"
 #include "message-snippet.h"
 
+/* HTML input is converted to text this many bytes at a time */
+#define SNIPPET_HTML2TEXT_CHUNK_SIZE 1024
+
 enum snippet_state {
 	/* beginning of the line */
 	SNIPPET_STATE_NEWLINE = 0,
@@ -20,6 +24,8 @@ enum snippet_state {
 
 struct snippet_context {
 	string_t *snippet;
+	/* length of the snippet string before anything was appended to it */
+	size_t start_len;
 	unsigned int chars_left;
 	enum snippet_state state;
 	bool add_whitespace;
@@ -27,19 +33,30 @@ struct snippet_context {
 	buffer_t *plain_output;
 };
 
-static bool snippet_generate(struct snippet_context *ctx,
-			     const unsigned char *data, size_t size)
+struct message_snippet_part {
+	const struct message_part *part;
+	string_t *snippet;
+};
+
+struct message_snippet_parts {
+	pool_t pool;
+	unsigned int max_snippet_chars;
+	struct message_decoder_context *decoder;
+	buffer_t *plain_output;
+	ARRAY(struct message_snippet_part) parts;
+
+	/* the MIME part currently being parsed */
+	struct message_part *cur_part;
+	/* snippet is being generated for cur_part */
+	struct snippet_context ctx;
+	bool cur_active;
+};
+
+static bool snippet_generate_text(struct snippet_context *ctx,
+				  const unsigned char *data, size_t size)
 {
 	size_t i, count;
 
-	if (ctx->html2text != NULL) {
-		buffer_set_used_size(ctx->plain_output, 0);
-		mail_html2text_more(ctx->html2text, data, size,
-				    ctx->plain_output);
-		data = ctx->plain_output->data;
-		size = ctx->plain_output->used;
-	}
-
 	/* message-decoder should feed us only valid and complete
 	   UTF-8 input */
 
@@ -67,7 +84,7 @@ static bool snippet_generate(struct snippet_context *ctx,
 			if (data[i] == '\r' || data[i] == '\n' ||
 			    data[i] == '\t' || data[i] == ' ') {
 				/* skip any leading whitespace */
-				if (str_len(ctx->snippet) > 1)
+				if (str_len(ctx->snippet) > ctx->start_len)
 					ctx->add_whitespace = TRUE;
 				if (data[i] == '\n')
 					ctx->state = SNIPPET_STATE_NEWLINE;
@@ -95,6 +112,53 @@ static bool snippet_generate(struct snippet_context *ctx,
 	return TRUE;
 }
 
+static bool snippet_generate(struct snippet_context *ctx,
+			     const unsigned char *data, size_t size)
+{
+	size_t chunk_size;
+
+	if (ctx->html2text == NULL)
+		return snippet_generate_text(ctx, data, size);
+
+	/* Convert the HTML in small pieces, so the rest of the block isn't
+	   converted once the snippet is full. */
+	while (size > 0) {
+		chunk_size = I_MIN(size, SNIPPET_HTML2TEXT_CHUNK_SIZE);
+		/* don't split UTF-8 characters */
+		while (chunk_size < size && chunk_size > 1 &&
+		       (data[chunk_size] & 0xc0) == 0x80)
+			chunk_size--;
+		buffer_set_used_size(ctx->plain_output, 0);
+		mail_html2text_more(ctx->html2text, data, chunk_size,
+				    ctx->plain_output);
+		if (!snippet_generate_text(ctx, ctx->plain_output->data,
+					   ctx->plain_output->used))
+			return FALSE;
+		data += chunk_size;
+		size -= chunk_size;
+	}
+	return TRUE;
+}
+
+static bool
+snippet_part_begin(struct snippet_context *ctx,
+		   struct message_decoder_context *decoder,
+		   buffer_t *plain_output)
+{
+	const char *ct;
+
+	/* end of headers - verify that we can use this Content-Type */
+	ct = message_decoder_current_content_type(decoder);
+	if (ct == NULL)
+		/* text/plain */ ;
+	else if (mail_html2text_content_type_match(ct)) {
+		ctx->html2text = mail_html2text_init(MAIL_HTML2TEXT_FLAG_SKIP_QUOTED);
+		ctx->plain_output = plain_output;
+	} else if (strncasecmp(ct, "text/", 5) != 0)
+		return FALSE;
+	return TRUE;
+}
+
 int message_snippet_generate(struct istream *input,
 			     unsigned int max_snippet_chars,
 			     string_t *snippet)
@@ -110,6 +174,7 @@ int message_snippet_generate(struct istream *input,
 	i_zero(&ctx);
 	pool = pool_alloconly_create("message snippet", 1024);
 	ctx.snippet = snippet;
+	ctx.start_len = str_len(snippet);
 	ctx.chars_left = max_snippet_chars;
 
 	parser = message_parser_init(pool_datastack_create(), input, 0, 0);
@@ -118,21 +183,13 @@ int message_snippet_generate(struct istream *input,
 		if (!message_decoder_decode_next_block(decoder, &raw_block, &block))
 			continue;
 		if (block.size == 0) {
-			const char *ct;
-
 			if (block.hdr != NULL)
 				continue;
 
-			/* end of headers - verify that we can use this
-			   Content-Type. we get here only once, because we
-			   always handle only one non-multipart MIME part. */
-			ct = message_decoder_current_content_type(decoder);
-			if (ct == NULL)
-				/* text/plain */ ;
-			else if (mail_html2text_content_type_match(ct)) {
-				ctx.html2text = mail_html2text_init(MAIL_HTML2TEXT_FLAG_SKIP_QUOTED);
-				ctx.plain_output = buffer_create_dynamic(pool, 1024);
-			} else if (strncasecmp(ct, "text/", 5) != 0)
+			/* we get here only once, because we always handle
+			   only one non-multipart MIME part. */
+			if (!snippet_part_begin(&ctx, decoder,
+					buffer_create_dynamic(pool, 1024)))
 				break;
 			continue;
 		}
@@ -146,3 +203,93 @@ int message_snippet_generate(struct istream *input,
 	pool_unref(&pool);
 	return input->stream_errno == 0 ? 0 : -1;
 }
+
+static void snippet_parts_end_part(struct message_snippet_parts *sp)
+{
+	if (!sp->cur_active)
+		return;
+	mail_html2text_deinit(&sp->ctx.html2text);
+	sp->cur_active = FALSE;
+}
+
+struct message_snippet_parts *
+message_snippet_parts_init(pool_t pool, unsigned int max_snippet_chars)
+{
+	struct message_snippet_parts *sp;
+
+	sp = p_new(pool, struct message_snippet_parts, 1);
+	sp->pool = pool;
+	sp->max_snippet_chars = max_snippet_chars;
+	sp->decoder = message_decoder_init(NULL, 0);
+	p_array_init(&sp->parts, pool, 4);
+	return sp;
+}
+
+void message_snippet_parts_deinit(struct message_snippet_parts **_sp)
+{
+	struct message_snippet_parts *sp = *_sp;
+
+	if (sp == NULL)
+		return;
+	*_sp = NULL;
+
+	snippet_parts_end_part(sp);
+	message_decoder_deinit(&sp->decoder);
+}
+
+void message_snippet_parts_more(struct message_snippet_parts *sp,
+				struct message_block *raw_block)
+{
+	struct message_snippet_part *spart;
+	struct message_block block;
+
+	if (raw_block->part != sp->cur_part) {
+		snippet_parts_end_part(sp);
+		sp->cur_part = raw_block->part;
+	}
+	if (raw_block->hdr == NULL && raw_block->size > 0 && !sp->cur_active) {
+		/* body of a part we don't want a snippet for - don't waste
+		   time decoding it */
+		return;
+	}
+
+	if (!message_decoder_decode_next_block(sp->decoder, raw_block, &block))
+		return;
+	if (block.size == 0) {
+		if (block.hdr != NULL ||
+		    array_count(&sp->parts) >= MESSAGE_SNIPPET_PARTS_MAX_COUNT)
+			return;
+
+		if (sp->plain_output == NULL)
+			sp->plain_output = buffer_create_dynamic(sp->pool, 1024);
+		i_zero(&sp->ctx);
+		if (!snippet_part_begin(&sp->ctx, sp->decoder,
+					sp->plain_output))
+			return;
+
+		spart = array_append_space(&sp->parts);
+		spart->part = raw_block->part;
+		spart->snippet = str_new(sp->pool, 128);
+		sp->ctx.snippet = spart->snippet;
+		sp->ctx.chars_left = sp->max_snippet_chars;
+		sp->cur_active = TRUE;
+		return;
+	}
+	if (!snippet_generate(&sp->ctx, block.data, block.size))
+		snippet_parts_end_part(sp);
+}
+
+bool message_snippet_parts_get(struct message_snippet_parts *sp,
+			       const struct message_part *part,
+			       string_t *snippet)
+{
+	const struct message_snippet_part *spart;
+
+	array_foreach(&sp->parts, spart) {
+		if (spart->part == part) {
+			str_append_str(snippet, spart->snippet);
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
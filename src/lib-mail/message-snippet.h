@@ -11,4 +11,28 @@ int message_snippet_generate(struct istream *input,
 			     unsigned int max_snippet_chars,
 			     string_t *snippet);
 
+/* Snippets are collected only for this many text MIME parts. */
+#define MESSAGE_SNIPPET_PARTS_MAX_COUNT 8
+
+struct message_block;
+struct message_part;
+
+/* Generate snippets for the text MIME parts of the mail while it's being
+   parsed by the caller, so it doesn't need to be read again afterwards.
+   The blocks must be the raw blocks returned by
+   message_parser_parse_next_block(). The snippets are allocated from the
+   given pool. */
+struct message_snippet_parts *
+message_snippet_parts_init(pool_t pool, unsigned int max_snippet_chars);
+void message_snippet_parts_deinit(struct message_snippet_parts **sp);
+
+void message_snippet_parts_more(struct message_snippet_parts *sp,
+				struct message_block *raw_block);
+/* Append the snippet generated for the given part to the string. Returns
+   FALSE if no snippet was generated for the part. The result is the same as
+   with message_snippet_generate() for the part. */
+bool message_snippet_parts_get(struct message_snippet_parts *sp,
+			       const struct message_part *part,
+			       string_t *snippet);
+
 #endif
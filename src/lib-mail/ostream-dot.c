@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "array.h"
+#include "mem-scan.h"
 #include "ostream-private.h"
 #include "ostream-dot.h"
 
@@ -107,6 +108,19 @@ o_stream_dot_sendv(struct ostream_private *stream,
 		for (; p < pend && (size_t)(p-data)+2 < max_bytes; p++) {
 			char add = 0;
 
+			if (dstream->state == STREAM_STATE_NONE) {
+				/* nothing changes until the next CR/LF */
+				size_t scan_size = I_MIN((size_t)(pend - p),
+					max_bytes - 2 - (size_t)(p - data));
+				const char *crlf = mem_find_crlf(p, scan_size);
+
+				if (crlf == NULL) {
+					p += scan_size - 1;
+					continue;
+				}
+				p = crlf;
+			}
+
 			switch (dstream->state) {
 			/* none */
 			case STREAM_STATE_NONE:
@@ -653,6 +653,50 @@ static void test_istream_empty_missing_eoh_callback(void)
 	test_end();
 }
 
+static void test_istream_seek_into_header(void)
+{
+	static const char *include_headers[] = { "From", "Subject", "To" };
+	const char *input = "From: foo\nX-Drop: 1\nTo: bar,\n baz\n"
+		"X-Drop: 2\nSubject: plop\n\nhello world\n";
+	const char *output = "From: foo\nTo: bar,\n baz\nSubject: plop\n\n"
+		"hello world\n";
+	struct istream *istream, *filter;
+	const unsigned char *data;
+	size_t size, output_len = strlen(output);
+	unsigned int i;
+
+	test_begin("i_stream_create_header_filter: seek into header");
+	istream = test_istream_create(input);
+	filter = i_stream_create_header_filter(istream,
+					       HEADER_FILTER_INCLUDE |
+					       HEADER_FILTER_NO_CR,
+					       include_headers,
+					       N_ELEMENTS(include_headers),
+					       *null_header_filter_callback,
+					       NULL);
+	/* the first read parses the headers and remembers where the lines
+	   start, the seeks after it use them */
+	for (i = 0; i <= output_len; i++) {
+		i_stream_seek(filter, i);
+		if (i == output_len) {
+			test_assert_idx(i_stream_read(filter) == -1, i);
+			break;
+		}
+		while (i_stream_read(filter) > 0) ;
+		data = i_stream_get_data(filter, &size);
+		test_assert_idx(size == output_len - i &&
+				memcmp(data, output + i, size) == 0, i);
+	}
+	for (i = output_len; i > 0; i--) {
+		i_stream_seek(filter, i - 1);
+		test_assert_idx(i_stream_read_more(filter, &data, &size) > 0 &&
+				data[0] == (unsigned char)output[i - 1], i);
+	}
+	i_stream_unref(&filter);
+	i_stream_unref(&istream);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
@@ -668,6 +712,7 @@ int main(void)
 		test_istream_strip_eoh,
 		test_istream_missing_eoh_callback,
 		test_istream_empty_missing_eoh_callback,
+		test_istream_seek_into_header,
 		NULL
 	};
 	return test_run(test_functions);
@@ -167,6 +167,68 @@ static void test_message_parser_small_blocks(void)
 	test_end();
 }
 
+static void test_message_parser_dash_lines(void)
+{
+	struct message_parser_ctx *parser;
+	struct istream *input;
+	struct message_part *parts, *parts2;
+	struct message_block block;
+	string_t *body, *msg;
+	unsigned int i, msg_len;
+	pool_t pool;
+	int ret;
+
+	test_begin("message parser dash lines");
+	/* lines beginning with '-' at all the different word offsets */
+	body = t_str_new(512);
+	for (i = 0; i < 20; i++) {
+		str_append_data(body, "xxxxxxxxxxxxxxxxxxxx", i);
+		str_append(body, "\n-\n--x\n-b\n--\n");
+	}
+	msg = t_str_new(1024);
+	str_append(msg, "Content-Type: multipart/mixed; boundary=\"b\"\n\n"
+		   "--b\n\n");
+	str_append_str(msg, body);
+	str_append(msg, "--b\n\n");
+	str_append_str(msg, body);
+	str_append(msg, "--b--\n");
+	msg_len = str_len(msg);
+
+	pool = pool_alloconly_create("message parser", 10240);
+	input = test_istream_create_data(str_data(msg), msg_len);
+
+	parser = message_parser_init(pool, input, 0, 0);
+	while ((ret = message_parser_parse_next_block(parser, &block)) > 0) ;
+	test_assert(ret < 0);
+	message_parser_deinit(&parser, &parts);
+
+	test_assert(parts->children != NULL &&
+		    parts->children->next != NULL &&
+		    parts->children->next->next == NULL);
+	test_assert(parts->children->body_size.physical_size ==
+		    str_len(body) - 1);
+	test_assert(parts->children->next->body_size.physical_size ==
+		    str_len(body) - 1);
+
+	/* parsing in small blocks gives the same result */
+	i_stream_seek(input, 0);
+	test_istream_set_allow_eof(input, FALSE);
+	parser = message_parser_init(pool, input, 0, 0);
+	for (i = 1; i <= msg_len*2+1; i++) {
+		test_istream_set_size(input, i/2);
+		if (i > msg_len*2)
+			test_istream_set_allow_eof(input, TRUE);
+		while ((ret = message_parser_parse_next_block(parser,
+							      &block)) > 0) ;
+	}
+	message_parser_deinit(&parser, &parts2);
+	test_assert(msg_parts_cmp(parts, parts2));
+
+	i_stream_unref(&input);
+	pool_unref(&pool);
+	test_end();
+}
+
 static void test_message_parser_truncated_mime_headers(void)
 {
 static const char input_msg[] =
@@ -643,10 +705,57 @@ static void test_message_parser_no_eoh(void)
 	test_end();
 }
 
+static void test_message_parser_skip_part_body(void)
+{
+	struct message_parser_ctx *parser;
+	struct istream *input;
+	struct message_part *parts, *parts2;
+	struct message_block block;
+	unsigned int hdr_count = 0, body_count = 0;
+	const char *error;
+	pool_t pool;
+	int ret;
+
+	test_begin("message parser skip part body");
+	pool = pool_alloconly_create("message parser", 10240);
+	input = test_istream_create(test_msg);
+
+	parser = message_parser_init(pool, input, 0, 0);
+	while ((ret = message_parser_parse_next_block(parser, &block)) > 0) {
+		if (block.hdr == NULL && block.size == 0)
+			test_assert(!message_parser_skip_part_body(parser));
+	}
+	test_assert(ret < 0);
+	message_parser_deinit(&parser, &parts);
+
+	i_stream_seek(input, 0);
+	parser = message_parser_init_from_parts(parts, input, 0, 0);
+	while ((ret = message_parser_parse_next_block(parser, &block)) > 0) {
+		if (block.hdr != NULL) {
+			if (!block.hdr->continued && !block.hdr->eoh)
+				hdr_count++;
+		} else if (block.size > 0)
+			body_count++;
+		else if (block.part->children == NULL)
+			test_assert(message_parser_skip_part_body(parser));
+	}
+	test_assert(ret < 0);
+	test_assert(message_parser_deinit_from_parts(&parser, &parts2, &error) == 0);
+	test_assert(parts == parts2);
+	/* all the headers were returned, but none of the bodies */
+	test_assert(hdr_count == 8 + 2 + 1);
+	test_assert(body_count == 0);
+
+	i_stream_unref(&input);
+	pool_unref(&pool);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_message_parser_small_blocks,
+		test_message_parser_dash_lines,
 		test_message_parser_truncated_mime_headers,
 		test_message_parser_truncated_mime_headers2,
 		test_message_parser_truncated_mime_headers3,
@@ -656,6 +765,7 @@ int main(void)
 		test_message_parser_continuing_mime_boundary,
 		test_message_parser_continuing_truncated_mime_boundary,
 		test_message_parser_no_eoh,
+		test_message_parser_skip_part_body,
 		NULL
 	};
 	return test_run(test_functions);
@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "str.h"
+#include "istream.h"
 #include "unichar.h"
 #include "message-parser.h"
 #include "message-search.h"
@@ -51,10 +52,85 @@ static void test_message_search_more_get_decoded(void)
 	test_end();
 }
 
+static void test_message_search_msg_multi(void)
+{
+	static const char input[] =
+		"Subject: hello\n"
+		"Content-Type: multipart/mixed; boundary=\"b\"\n"
+		"\n"
+		"--b\n"
+		"Content-Type: text/plain\n"
+		"Content-Transfer-Encoding: base64\n"
+		"\n"
+		"d29ybGQgYm9keQ==\n"
+		"--b\n"
+		"Content-Type: application/octet-stream\n"
+		"\n"
+		"binary\n"
+		"--b--\n";
+	static const struct {
+		const char *key;
+		enum message_search_flags flags;
+		bool match;
+	} keys[] = {
+		{ "hello", MESSAGE_SEARCH_FLAG_SKIP_HEADERS, FALSE },
+		{ "world", MESSAGE_SEARCH_FLAG_SKIP_HEADERS, TRUE },
+		{ "hello", 0, TRUE },
+		{ "body", 0, TRUE },
+		{ "binary", 0, FALSE },
+		{ "missing", 0, FALSE },
+	};
+	struct message_search_context *ctxs[N_ELEMENTS(keys)];
+	struct message_search_multi_context *multi_ctx;
+	bool matches[N_ELEMENTS(keys)];
+	struct istream *input_stream;
+	const char *error;
+	unsigned int i, found = 0;
+
+	test_begin("message_search_msg_multi()");
+	for (i = 0; i < N_ELEMENTS(keys); i++) {
+		ctxs[i] = message_search_init(keys[i].key, NULL, keys[i].flags);
+		if (keys[i].match)
+			found++;
+	}
+
+	input_stream = test_istream_create(input);
+	test_assert(message_search_msg_multi(ctxs, N_ELEMENTS(ctxs),
+					     input_stream, NULL, matches,
+					     &error) == (int)found);
+	for (i = 0; i < N_ELEMENTS(keys); i++) {
+		test_assert_idx(matches[i] == keys[i].match, i);
+
+		/* the result must be the same as with a single key */
+		i_stream_seek(input_stream, 0);
+		test_assert_idx(message_search_msg(ctxs[i], input_stream,
+						   NULL, &error) ==
+				(keys[i].match ? 1 : 0), i);
+	}
+
+	/* the same multi context can be used for multiple searches */
+	multi_ctx = message_search_multi_init(ctxs, N_ELEMENTS(ctxs));
+	for (unsigned int j = 0; j < 2; j++) {
+		i_stream_seek(input_stream, 0);
+		test_assert(message_search_multi_msg(multi_ctx, input_stream,
+						     NULL, matches,
+						     &error) == (int)found);
+		for (i = 0; i < N_ELEMENTS(keys); i++)
+			test_assert_idx(matches[i] == keys[i].match, i);
+	}
+	message_search_multi_deinit(&multi_ctx);
+	i_stream_unref(&input_stream);
+
+	for (i = 0; i < N_ELEMENTS(keys); i++)
+		message_search_deinit(&ctxs[i]);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_message_search_more_get_decoded,
+		test_message_search_msg_multi,
 		NULL
 	};
 	return test_run(test_functions);
@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "str.h"
 #include "istream.h"
+#include "message-parser.h"
 #include "message-snippet.h"
 #include "test-common.h"
 
@@ -99,11 +100,68 @@ static void test_message_snippet_nuls(void)
 	test_end();
 }
 
+static void test_message_snippet_parts(void)
+{
+	static const char input_text[] =
+		"Content-Type: multipart/mixed; boundary=\"a\"\n"
+		"\n"
+		"--a\n"
+		"Content-Type: text/plain\n"
+		"\n"
+		"line1\n>quote2\nline2\n"
+		"--a\n"
+		"Content-Type: application/octet-stream\n"
+		"Content-Transfer-Encoding: base64\n"
+		"\n"
+		"Zm9vYmFy\n"
+		"--a\n"
+		"Content-Type: text/html\n"
+		"\n"
+		"<html><body>Hi, <b>how</b> are you?</body></html>\n"
+		"--a--\n";
+	struct message_parser_ctx *parser;
+	struct message_snippet_parts *sp;
+	struct message_part *parts, *part;
+	struct message_block block;
+	struct istream *input;
+	string_t *str = t_str_new(128);
+	pool_t pool;
+	int ret;
+
+	test_begin("message snippet parts");
+	pool = pool_alloconly_create("message snippet parts", 1024);
+	input = i_stream_create_from_data(input_text, sizeof(input_text)-1);
+	parser = message_parser_init(pool, input, 0, 0);
+	sp = message_snippet_parts_init(pool, 100);
+	while ((ret = message_parser_parse_next_block(parser, &block)) > 0)
+		message_snippet_parts_more(sp, &block);
+	test_assert(ret < 0);
+	message_parser_deinit(&parser, &parts);
+
+	test_assert(!message_snippet_parts_get(sp, parts, str));
+	part = parts->children;
+	test_assert(message_snippet_parts_get(sp, part, str));
+	test_assert_strcmp(str_c(str), "line1 line2");
+	part = part->next;
+	str_truncate(str, 0);
+	test_assert(!message_snippet_parts_get(sp, part, str));
+	part = part->next;
+	str_append(str, "1");
+	test_assert(message_snippet_parts_get(sp, part, str));
+	test_assert_strcmp(str_c(str), "1Hi, how are you?");
+
+	message_snippet_parts_deinit(&sp);
+	i_stream_destroy(&input);
+	pool_unref(&pool);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_message_snippet,
 		test_message_snippet_nuls,
+		test_message_snippet_parts,
 		NULL
 	};
 	return test_run(test_functions);
@@ -71,6 +71,9 @@ struct master_service {
 	time_t ssl_params_last_refresh;
 
 	struct stats_client *stats_client;
+	/* Batched anvil commands, written by to_anvil_send */
+	string_t *anvil_send_buf;
+	struct timeout *to_anvil_send;
 	struct master_service_haproxy_conn *haproxy_conns;
 
 	bool killed:1;
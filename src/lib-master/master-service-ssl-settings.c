@@ -33,6 +33,7 @@ static const struct setting_define master_service_ssl_setting_defines[] = {
 	DEF(SET_STR, ssl_min_protocol),
 	DEF(SET_STR, ssl_cert_username_field),
 	DEF(SET_STR, ssl_crypto_device),
+	DEF(SET_STR, ssl_ticket_key),
 	DEF(SET_BOOL, ssl_verify_client_cert),
 	DEF(SET_BOOL, ssl_client_require_valid_cert),
 	DEF(SET_BOOL, ssl_require_crl),
@@ -66,6 +67,7 @@ static const struct master_service_ssl_settings master_service_ssl_default_setti
 	.ssl_min_protocol = "TLSv1",
 	.ssl_cert_username_field = "commonName",
 	.ssl_crypto_device = "",
+	.ssl_ticket_key = "",
 	.ssl_verify_client_cert = FALSE,
 	.ssl_client_require_valid_cert = TRUE,
 	.ssl_require_crl = TRUE,
@@ -125,6 +127,7 @@ master_service_ssl_settings_check(void *_set, pool_t pool ATTR_UNUSED,
 	/* First set them all to defaults */
 	set->parsed_opts.compression = FALSE;
 	set->parsed_opts.tickets = TRUE;
+	set->parsed_opts.ktls = FALSE;
 
 	/* Then modify anything specified in the string */
 	const char **opts = t_strsplit_spaces(set->ssl_options, ", ");
@@ -139,6 +142,8 @@ master_service_ssl_settings_check(void *_set, pool_t pool ATTR_UNUSED,
 #endif
 		} else if (strcasecmp(opt, "no_ticket") == 0) {
 			set->parsed_opts.tickets = FALSE;
+		} else if (strcasecmp(opt, "ktls") == 0) {
+			set->parsed_opts.ktls = TRUE;
 		} else {
 			*error_r = t_strdup_printf("ssl_options: unknown flag: '%s'",
 						   opt);
@@ -192,6 +197,7 @@ void master_service_ssl_settings_to_iostream_set(
 		}
 		set_r->verify_remote_cert = ssl_set->ssl_verify_client_cert;
 		set_r->allow_invalid_cert = !set_r->verify_remote_cert;
+		set_r->ticket_key = p_strdup_empty(pool, ssl_set->ssl_ticket_key);
 		break;
 	case MASTER_SERVICE_SSL_SETTINGS_TYPE_CLIENT:
 		set_r->ca_file = p_strdup_empty(pool, ssl_set->ssl_client_ca_file);
@@ -213,5 +219,6 @@ void master_service_ssl_settings_to_iostream_set(
 	set_r->prefer_server_ciphers = ssl_set->ssl_prefer_server_ciphers;
 	set_r->compression = ssl_set->parsed_opts.compression;
 	set_r->tickets = ssl_set->parsed_opts.tickets;
+	set_r->ktls = ssl_set->parsed_opts.ktls;
 	set_r->curve_list = p_strdup(pool, ssl_set->ssl_curve_list);
 }
@@ -22,6 +22,7 @@ struct master_service_ssl_settings {
 	const char *ssl_min_protocol;
 	const char *ssl_cert_username_field;
 	const char *ssl_crypto_device;
+	const char *ssl_ticket_key;
 	const char *ssl_options;
 
 	bool ssl_verify_client_cert;
@@ -34,6 +35,7 @@ struct master_service_ssl_settings {
 	struct {
 		bool compression;
 		bool tickets;
+		bool ktls;
 	} parsed_opts;
 };
 
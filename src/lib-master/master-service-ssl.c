@@ -76,6 +76,8 @@ void master_service_ssl_ctx_init(struct master_service *service)
 		ssl_set.alt_cert.key_password = set->ssl_key_password;
 	}
 	ssl_set.crypto_device = set->ssl_crypto_device;
+	if (*set->ssl_ticket_key != '\0')
+		ssl_set.ticket_key = set->ssl_ticket_key;
 	ssl_set.skip_crl_check = !set->ssl_require_crl;
 
 	ssl_set.verbose = set->verbose_ssl;
@@ -6,6 +6,7 @@
 #include "ioloop.h"
 #include "path-util.h"
 #include "array.h"
+#include "str.h"
 #include "strescape.h"
 #include "env-util.h"
 #include "home-expand.h"
@@ -22,6 +23,7 @@
 #include "iostream-ssl.h"
 
 #include <unistd.h>
+#include <limits.h>
 #include <sys/stat.h>
 #include <syslog.h>
 
@@ -42,6 +44,14 @@
    force it. */
 #define MASTER_SERVICE_DIE_TIMEOUT_MSECS (30*1000)
 
+/* How many already waiting connections to accept at once when the listener
+   becomes readable. */
+#define MASTER_SERVICE_MAX_ACCEPTS_PER_IO 8
+
+/* How many bytes of debug and info messages to buffer when the log service
+   can't keep up, instead of blocking. */
+#define MASTER_SERVICE_LOG_BUFFER_SIZE (64*1024)
+
 struct master_service *master_service;
 
 static void master_service_io_listeners_close(struct master_service *service);
@@ -398,6 +408,7 @@ master_service_try_init_log(struct master_service *service,
 	if (getenv("LOG_SERVICE") != NULL && !service->log_directly) {
 		/* logging via log service */
 		i_set_failure_internal();
+		i_set_failure_buffer_size(MASTER_SERVICE_LOG_BUFFER_SIZE);
 		i_set_failure_prefix("%s", prefix);
 		return TRUE;
 	}
@@ -828,14 +839,11 @@ bool master_service_is_master_stopped(struct master_service *service)
 		(service->flags & MASTER_SERVICE_FLAG_STANDALONE) == 0;
 }
 
-void master_service_anvil_send(struct master_service *service, const char *cmd)
+static void master_service_anvil_write(const void *data, size_t size)
 {
 	ssize_t ret;
 
-	if ((service->flags & MASTER_SERVICE_FLAG_STANDALONE) != 0)
-		return;
-
-	ret = write(MASTER_ANVIL_FD, cmd, strlen(cmd));
+	ret = write(MASTER_ANVIL_FD, data, size);
 	if (ret < 0) {
 		if (errno == EPIPE) {
 			/* anvil process was probably recreated, don't bother
@@ -846,7 +854,58 @@ void master_service_anvil_send(struct master_service *service, const char *cmd)
 	} else if (ret == 0)
 		i_error("write(anvil) failed: EOF");
 	else {
-		i_assert((size_t)ret == strlen(cmd));
+		i_assert((size_t)ret == size);
+	}
+}
+
+static void master_service_anvil_flush(struct master_service *service)
+{
+	timeout_remove(&service->to_anvil_send);
+	if (service->anvil_send_buf == NULL ||
+	    str_len(service->anvil_send_buf) == 0)
+		return;
+
+	master_service_anvil_write(str_data(service->anvil_send_buf),
+				   str_len(service->anvil_send_buf));
+	str_truncate(service->anvil_send_buf, 0);
+}
+
+void master_service_anvil_send(struct master_service *service, const char *cmd)
+{
+	if ((service->flags & MASTER_SERVICE_FLAG_STANDALONE) != 0)
+		return;
+
+	/* keep the commands in order */
+	master_service_anvil_flush(service);
+	master_service_anvil_write(cmd, strlen(cmd));
+}
+
+void master_service_anvil_send_batched(struct master_service *service,
+				       const char *cmd)
+{
+	size_t len = strlen(cmd);
+
+	if ((service->flags & MASTER_SERVICE_FLAG_STANDALONE) != 0)
+		return;
+
+	/* The anvil FIFO is shared by all the processes. Writes up to
+	   PIPE_BUF bytes are atomic, so the batches can't get mixed with
+	   other processes' commands. */
+	if (len > PIPE_BUF) {
+		master_service_anvil_send(service, cmd);
+		return;
+	}
+	if (service->anvil_send_buf == NULL)
+		service->anvil_send_buf = str_new(default_pool, PIPE_BUF);
+	else if (str_len(service->anvil_send_buf) + len > PIPE_BUF)
+		master_service_anvil_flush(service);
+	str_append_data(service->anvil_send_buf, cmd, len);
+
+	if (service->to_anvil_send == NULL) {
+		service->to_anvil_send =
+			timeout_add_short_to(service->ioloop, 0,
+					     master_service_anvil_flush,
+					     service);
 	}
 }
 
@@ -1033,6 +1092,8 @@ void master_service_deinit(struct master_service **_service)
 	lib_signals_deinit();
 	/* run atexit callbacks before destroying ioloop */
 	lib_atexit_run();
+	master_service_anvil_flush(service);
+	str_free(&service->anvil_send_buf);
 	io_loop_destroy(&service->ioloop);
 
 	for (i = 0; i < service->socket_count; i++)
@@ -1046,7 +1107,7 @@ void master_service_deinit(struct master_service **_service)
 	lib_deinit();
 }
 
-static void master_service_listen(struct master_service_listener *l)
+static bool master_service_accept(struct master_service_listener *l)
 {
 	struct master_service *service = l->service;
 	struct master_service_connection conn;
@@ -1060,7 +1121,7 @@ static void master_service_listen(struct master_service_listener *l)
 
 		if (service->master_status.available_count == 0) {
 			master_service_io_listeners_remove(service);
-			return;
+			return FALSE;
 		}
 	}
 
@@ -1072,7 +1133,7 @@ static void master_service_listen(struct master_service_listener *l)
 		int orig_errno = errno;
 
 		if (conn.fd == -1)
-			return;
+			return FALSE;
 
 		if (errno == ENOTSOCK) {
 			/* it's not a socket. should be a fifo. */
@@ -1085,7 +1146,7 @@ static void master_service_listen(struct master_service_listener *l)
 			/* try again later after one of the existing
 			   connections has died */
 			master_service_io_listeners_remove(service);
-			return;
+			return FALSE;
 		}
 		/* use the "listener" as the connection fd and stop the
 		   listener. */
@@ -1112,6 +1173,24 @@ static void master_service_listen(struct master_service_listener *l)
 		master_service_haproxy_new(service, &conn);
 	else
 		master_service_client_connection_callback(service, &conn);
+	return !conn.fifo;
+}
+
+static void master_service_listen(struct master_service_listener *l)
+{
+	struct master_service *service = l->service;
+	unsigned int i;
+
+	/* Accept the connections that are already waiting without going
+	   through the ioloop for each one of them. */
+	for (i = 0; i < MASTER_SERVICE_MAX_ACCEPTS_PER_IO; i++) {
+		if (i > 0 && service->master_status.available_count == 0)
+			break;
+		if (!master_service_accept(l))
+			break;
+		if (l->io == NULL)
+			break;
+	}
 }
 
 void master_service_io_listeners_add(struct master_service *service)
@@ -208,6 +208,12 @@ bool master_service_is_master_stopped(struct master_service *service);
 
 /* Send command to anvil process, if we have fd to it. */
 void master_service_anvil_send(struct master_service *service, const char *cmd);
+/* Like master_service_anvil_send(), but the command may be delayed until the
+   end of the current ioloop run, so it can be written together with the other
+   commands sent meanwhile. Use this for commands whose effect doesn't need to
+   be immediately visible to lookups. */
+void master_service_anvil_send_batched(struct master_service *service,
+				       const char *cmd);
 /* Call to accept the client connection. Otherwise the connection is closed. */
 void master_service_client_connection_accept(struct master_service_connection *conn);
 /* Used to create "extra client connections" outside the common accept()
@@ -11,12 +11,18 @@
 #include "stats-client.h"
 
 #define STATS_CLIENT_RECONNECT_INTERVAL_MSECS (10*1000)
+/* Events are buffered in the corked output stream and flushed after this
+   many milliseconds, or earlier once the buffer grows past
+   STATS_CLIENT_FLUSH_THRESHOLD bytes. */
+#define STATS_CLIENT_FLUSH_INTERVAL_MSECS 10
+#define STATS_CLIENT_FLUSH_THRESHOLD (16*1024)
 
 struct stats_client {
 	struct connection conn;
 	struct event_filter *filter;
 	struct ioloop *ioloop;
 	struct timeout *to_reconnect;
+	struct timeout *to_flush;
 	bool handshaked;
 	bool handshake_received_at_least_once;
 	bool silent_notfound_errors;
@@ -26,6 +32,32 @@ static struct connection_list *stats_clients;
 
 static void stats_client_connect(struct stats_client *client);
 
+static void stats_client_flush(struct stats_client *client)
+{
+	timeout_remove(&client->to_flush);
+	if (client->conn.output != NULL)
+		o_stream_uncork(client->conn.output);
+}
+
+static struct ostream *stats_client_output_begin(struct stats_client *client)
+{
+	if (client->to_flush == NULL) {
+		o_stream_cork(client->conn.output);
+		client->to_flush =
+			timeout_add_short_to(client->conn.ioloop,
+					     STATS_CLIENT_FLUSH_INTERVAL_MSECS,
+					     stats_client_flush, client);
+	}
+	return client->conn.output;
+}
+
+static void stats_client_output_end(struct stats_client *client)
+{
+	if (o_stream_get_buffer_used_size(client->conn.output) >=
+	    STATS_CLIENT_FLUSH_THRESHOLD)
+		stats_client_flush(client);
+}
+
 static int
 client_handshake_filter(const char *const *args, struct event_filter **filter_r,
 			const char **error_r)
@@ -117,6 +149,7 @@ static void stats_client_destroy(struct connection *conn)
 		event->id_sent_to_stats = FALSE;
 
 	client->handshaked = FALSE;
+	timeout_remove(&client->to_flush);
 	connection_disconnect(conn);
 	if (client->ioloop != NULL) {
 		/* waiting for stats handshake to finish */
@@ -242,7 +275,9 @@ stats_client_send_event(struct stats_client *client, struct event *event,
 
 	string_t *str = t_str_new(256);
 	stats_event_write(event, ctx, str, FALSE);
-	o_stream_nsend(client->conn.output, str_data(str), str_len(str));
+	o_stream_nsend(stats_client_output_begin(client),
+		       str_data(str), str_len(str));
+	stats_client_output_end(client);
 }
 
 static void
@@ -250,8 +285,9 @@ stats_client_free_event(struct stats_client *client, struct event *event)
 {
 	if (!event->id_sent_to_stats)
 		return;
-	o_stream_nsend_str(client->conn.output,
+	o_stream_nsend_str(stats_client_output_begin(client),
 			   t_strdup_printf("END\t%"PRIu64"\n", event->id));
+	stats_client_output_end(client);
 }
 
 static bool
@@ -300,7 +336,9 @@ static void stats_category_registered(struct event_category *category)
 
 	string_t *str = t_str_new(64);
 	stats_category_append(str, category);
-	o_stream_nsend(client->conn.output, str_data(str), str_len(str));
+	o_stream_nsend(stats_client_output_begin(client),
+		       str_data(str), str_len(str));
+	stats_client_output_end(client);
 }
 
 static void stats_global_init(void)
@@ -324,6 +362,7 @@ static void stats_client_wait_handshake(struct stats_client *client)
 
 	i_assert(client->to_reconnect == NULL);
 
+	stats_client_flush(client);
 	client->ioloop = io_loop_create();
 	connection_switch_ioloop(&client->conn);
 	io_loop_run(client->ioloop);
@@ -381,6 +420,7 @@ void stats_client_deinit(struct stats_client **_client)
 
 	*_client = NULL;
 
+	stats_client_flush(client);
 	event_filter_unref(&client->filter);
 	connection_deinit(&client->conn);
 	timeout_remove(&client->to_reconnect);
@@ -239,6 +239,7 @@ program_client_local_connect(struct program_client *pclient)
 
 	if (plclient->pid == 0) {
 		/* child */
+		i_failure_discard_buffer();
 		if (fd_in[1] >= 0 && close(fd_in[1]) < 0) {
 			e_error(pclient->event,
 				"close(pipe:in:wr) failed: %m");
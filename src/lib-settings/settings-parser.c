@@ -40,6 +40,21 @@ struct setting_link {
 	ARRAY_TYPE(void_array) *change_array;
 };
 
+struct setting_root_key {
+	struct setting_root_key *next;
+
+	unsigned int root_idx;
+	const struct setting_define *def;
+};
+
+/* Index of the roots' setting keys. It depends only on the roots, so it's
+   shared with the duplicated parsers. */
+struct setting_root_keys {
+	int refcount;
+	pool_t pool;
+	HASH_TABLE(const char *, struct setting_root_key *) keys;
+};
+
 struct setting_parser_context {
 	pool_t set_pool, parser_pool;
         enum settings_parser_flags flags;
@@ -48,6 +63,8 @@ struct setting_parser_context {
 	struct setting_link *roots;
 	unsigned int root_count;
 	HASH_TABLE(char *, struct setting_link *) links;
+	/* created on the first key lookup */
+	struct setting_root_keys *root_keys;
 
 	unsigned int linenum;
 	const char *error;
@@ -235,11 +252,76 @@ settings_parser_init_list(pool_t set_pool,
 	return ctx;
 }
 
+static struct setting_root_keys *
+setting_root_keys_create(const struct setting_link *roots,
+			 unsigned int root_count)
+{
+	struct setting_root_keys *root_keys;
+	struct setting_root_key *key, *last;
+	const struct setting_define *def;
+	pool_t pool;
+	unsigned int i;
+
+	pool = pool_alloconly_create("settings root keys", 4096);
+	root_keys = p_new(pool, struct setting_root_keys, 1);
+	root_keys->refcount = 1;
+	root_keys->pool = pool;
+	hash_table_create(&root_keys->keys, pool, 0, str_hash, strcmp);
+
+	for (i = 0; i < root_count; i++) {
+		if (roots[i].info->defines == NULL)
+			continue;
+		for (def = roots[i].info->defines; def->key != NULL; def++) {
+			key = p_new(pool, struct setting_root_key, 1);
+			key->root_idx = i;
+			key->def = def;
+
+			last = hash_table_lookup(root_keys->keys, def->key);
+			if (last == NULL) {
+				hash_table_insert(root_keys->keys,
+						  def->key, key);
+				continue;
+			}
+			while (last->next != NULL)
+				last = last->next;
+			/* only the first define within the same root is
+			   used */
+			if (last->root_idx != i)
+				last->next = key;
+		}
+	}
+	return root_keys;
+}
+
+static void setting_root_keys_unref(struct setting_root_keys **_root_keys)
+{
+	struct setting_root_keys *root_keys = *_root_keys;
+
+	*_root_keys = NULL;
+	i_assert(root_keys->refcount > 0);
+	if (--root_keys->refcount > 0)
+		return;
+	hash_table_destroy(&root_keys->keys);
+	pool_unref(&root_keys->pool);
+}
+
+static struct setting_root_keys *
+settings_parser_get_root_keys(struct setting_parser_context *ctx)
+{
+	if (ctx->root_keys == NULL) {
+		ctx->root_keys = setting_root_keys_create(ctx->roots,
+							  ctx->root_count);
+	}
+	return ctx->root_keys;
+}
+
 void settings_parser_deinit(struct setting_parser_context **_ctx)
 {
 	struct setting_parser_context *ctx = *_ctx;
 
 	*_ctx = NULL;
+	if (ctx->root_keys != NULL)
+		setting_root_keys_unref(&ctx->root_keys);
 	hash_table_destroy(&ctx->links);
 	pool_unref(&ctx->set_pool);
 	pool_unref(&ctx->parser_pool);
@@ -731,18 +813,18 @@ settings_find_key_nth(struct setting_parser_context *ctx, const char *key,
 		      unsigned int *n, const struct setting_define **def_r,
 		      struct setting_link **link_r)
 {
-	const struct setting_define *def;
+	const struct setting_root_key *root_key;
 	struct setting_link *link;
 	const char *end, *parent_key;
-	unsigned int i;
 
 	/* try to find from roots */
-	for (i = *n; i < ctx->root_count; i++) {
-		def = setting_define_find(ctx->roots[i].info, key);
-		if (def != NULL) {
-			*n = i + 1;
-			*def_r = def;
-			*link_r = &ctx->roots[i];
+	root_key = hash_table_lookup(settings_parser_get_root_keys(ctx)->keys,
+				     key);
+	for (; root_key != NULL; root_key = root_key->next) {
+		if (root_key->root_idx >= *n) {
+			*n = root_key->root_idx + 1;
+			*def_r = root_key->def;
+			*link_r = &ctx->roots[root_key->root_idx];
 			return TRUE;
 		}
 	}
@@ -1934,6 +2016,12 @@ settings_parser_dup(const struct setting_parser_context *old_ctx,
 
 	hash_table_create_direct(&links, new_ctx->parser_pool, 0);
 
+	/* The keys index is shared by all the duplicated parsers, so create
+	   it already here. Otherwise each duplicate would create its own. */
+	new_ctx->root_keys = settings_parser_get_root_keys(
+		(struct setting_parser_context *)old_ctx);
+	new_ctx->root_keys->refcount++;
+
 	new_ctx->root_count = old_ctx->root_count;
 	new_ctx->roots = p_new(new_ctx->parser_pool, struct setting_link,
 			       new_ctx->root_count);
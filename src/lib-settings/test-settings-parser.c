@@ -139,10 +139,99 @@ static void test_settings_get_time(void)
 	test_end();
 }
 
+struct test_settings1 {
+	const char *name;
+	const char *shared;
+};
+struct test_settings2 {
+	const char *shared;
+	unsigned int num;
+};
+
+static const struct setting_define test_setting1_defines[] = {
+	SETTING_DEFINE_STRUCT_STR(name, test_settings1),
+	SETTING_DEFINE_STRUCT_STR(shared, test_settings1),
+	SETTING_DEFINE_LIST_END
+};
+static const struct test_settings1 test_settings1_defaults = {
+	.name = "",
+	.shared = "",
+};
+static const struct setting_parser_info test_setting1_parser_info = {
+	.module_name = "test1",
+	.defines = test_setting1_defines,
+	.defaults = &test_settings1_defaults,
+	.type_offset = (size_t)-1,
+	.struct_size = sizeof(struct test_settings1),
+	.parent_offset = (size_t)-1,
+};
+
+static const struct setting_define test_setting2_defines[] = {
+	SETTING_DEFINE_STRUCT_STR(shared, test_settings2),
+	SETTING_DEFINE_STRUCT_UINT(num, test_settings2),
+	SETTING_DEFINE_LIST_END
+};
+static const struct test_settings2 test_settings2_defaults = {
+	.shared = "",
+	.num = 0,
+};
+static const struct setting_parser_info test_setting2_parser_info = {
+	.module_name = "test2",
+	.defines = test_setting2_defines,
+	.defaults = &test_settings2_defaults,
+	.type_offset = (size_t)-1,
+	.struct_size = sizeof(struct test_settings2),
+	.parent_offset = (size_t)-1,
+};
+
+static void test_settings_parser_dup(void)
+{
+	const struct setting_parser_info *roots[] = {
+		&test_setting1_parser_info, &test_setting2_parser_info, NULL
+	};
+	struct setting_parser_context *parser, *dup_parser;
+	void *const *sets;
+	const struct test_settings1 *set1;
+	const struct test_settings2 *set2;
+	pool_t pool;
+
+	test_begin("settings_parser_dup()");
+	pool = pool_alloconly_create("test settings", 1024);
+	parser = settings_parser_init_list(pool, roots, 2, 0);
+	test_assert(settings_parse_line(parser, "shared=foo") == 1);
+	test_assert(settings_parse_line(parser, "unknown=foo") == 0);
+
+	dup_parser = settings_parser_dup(parser, pool);
+	test_assert(settings_parse_line(dup_parser, "name=bar") == 1);
+	test_assert(settings_parse_line(dup_parser, "num=5") == 1);
+	test_assert(settings_parse_line(dup_parser, "shared=baz") == 1);
+	test_assert(settings_parse_is_valid_key(dup_parser, "num"));
+	test_assert(!settings_parse_is_valid_key(dup_parser, "unknown"));
+
+	sets = settings_parser_get_list(parser);
+	set1 = sets[0]; set2 = sets[1];
+	test_assert(strcmp(set1->name, "") == 0);
+	test_assert(strcmp(set1->shared, "foo") == 0);
+	test_assert(strcmp(set2->shared, "foo") == 0);
+	test_assert(set2->num == 0);
+	settings_parser_deinit(&parser);
+
+	sets = settings_parser_get_list(dup_parser);
+	set1 = sets[0]; set2 = sets[1];
+	test_assert(strcmp(set1->name, "bar") == 0);
+	test_assert(strcmp(set1->shared, "baz") == 0);
+	test_assert(strcmp(set2->shared, "baz") == 0);
+	test_assert(set2->num == 5);
+	settings_parser_deinit(&dup_parser);
+	pool_unref(&pool);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_settings_get_time,
+		test_settings_parser_dup,
 		NULL
 	};
 	return test_run(test_functions);
@@ -1,6 +1,7 @@
 /* Copyright (c) 2013-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "str.h"
 #include "istream.h"
 #include "istream-failure-at.h"
 #include "istream-sized.h"
@@ -27,8 +28,8 @@ enum smtp_command_parser_state {
 struct smtp_command_parser_state_data {
 	enum smtp_command_parser_state state;
 
-	char *cmd_name;
-	char *cmd_params;
+	const char *cmd_name;
+	const char *cmd_params;
 
 	uoff_t poff;
 };
@@ -42,6 +43,8 @@ struct smtp_command_parser {
 	struct istream *data;
 
 	struct smtp_command_parser_state_data state;
+	/* Reused for each command to avoid allocations */
+	string_t *cmd_name_buf, *cmd_params_buf;
 
 	enum smtp_command_parse_error error_code;
 	char *error;
@@ -75,6 +78,9 @@ smtp_command_parser_init(struct istream *input,
 	parser = i_new(struct smtp_command_parser, 1);
 	parser->input = input;
 	i_stream_ref(input);
+	parser->cmd_name_buf = str_new(default_pool,
+				       SMTP_COMMAND_PARSER_MAX_COMMAND_LENGTH + 1);
+	parser->cmd_params_buf = str_new(default_pool, 128);
 
 	if (limits != NULL)
 		parser->limits = *limits;
@@ -99,8 +105,8 @@ void smtp_command_parser_deinit(struct smtp_command_parser **_parser)
 	struct smtp_command_parser *parser = *_parser;
 
 	i_stream_unref(&parser->data);
-	i_free(parser->state.cmd_name);
-	i_free(parser->state.cmd_params);
+	str_free(&parser->cmd_name_buf);
+	str_free(&parser->cmd_params_buf);
 	i_free(parser->error);
 	i_stream_unref(&parser->input);
 	i_free(parser);
@@ -110,8 +116,8 @@ void smtp_command_parser_deinit(struct smtp_command_parser **_parser)
 static void
 smtp_command_parser_restart(struct smtp_command_parser *parser)
 {
-	i_free(parser->state.cmd_name);
-	i_free(parser->state.cmd_params);
+	str_truncate(parser->cmd_name_buf, 0);
+	str_truncate(parser->cmd_params_buf, 0);
 
 	i_zero(&parser->state);
 }
@@ -156,7 +162,9 @@ static int smtp_command_parse_identifier(struct smtp_command_parser *parser)
 	parser->state.poff = p - parser->cur;
 	if (p == parser->end)
 		return 0;
-	parser->state.cmd_name = str_ucase(i_strdup_until(parser->cur, p));
+	str_append_data(parser->cmd_name_buf, parser->cur, p - parser->cur);
+	parser->state.cmd_name =
+		str_ucase(str_c_modifiable(parser->cmd_name_buf));
 	parser->cur = p;
 	parser->state.poff = 0;
 	return 1;
@@ -207,7 +215,8 @@ static int smtp_command_parse_parameters(struct smtp_command_parser *parser)
 		return -1;
 	}
 
-	parser->state.cmd_params = i_strdup_until(parser->cur, mp);
+	str_append_data(parser->cmd_params_buf, parser->cur, mp - parser->cur);
+	parser->state.cmd_params = str_c(parser->cmd_params_buf);
 	parser->cur = p;
 	parser->state.poff = 0;
 	return 1;
@@ -98,6 +98,41 @@ static bool smtp_param_value_valid(const char *value)
 	return (*p == '\0');
 }
 
+/* Parse the next space-separated parameter from *args. The args are parsed
+   in place, only the returned keyword and value are allocated from data
+   stack. Returns 1 if a parameter was parsed, 0 at the end of args and -1 on
+   error. */
+static int smtp_params_parse_next(const char **args,
+				  struct smtp_param *param_r,
+				  const char **error_r)
+{
+	struct smtp_parser parser;
+	const char *p = *args, *end;
+
+	i_zero(param_r);
+	if (p == NULL)
+		return 0;
+
+	end = strchr(p, ' ');
+	if (end == NULL)
+		end = p + strlen(p);
+	*args = (*end == '\0' ? NULL : end + 1);
+
+	if (p == end) {
+		*error_r = "Parameter is empty";
+		return -1;
+	}
+
+	i_zero(&parser);
+	parser.begin = parser.cur = (const unsigned char *)p;
+	parser.end = (const unsigned char *)end;
+	if (smtp_param_do_parse(&parser, param_r) <= 0) {
+		*error_r = parser.error;
+		return -1;
+	}
+	return 1;
+}
+
 void smtp_param_write(string_t *out, const struct smtp_param *param)
 {
 	str_append(out, t_str_ucase(param->keyword));
@@ -191,25 +226,24 @@ static int smtp_params_mail_parse_body(
 		return -1;
 	}
 
-	value = t_str_ucase(value);
 	params->body.ext = NULL;
 	/* =7BIT: RFC 6152 */
-	if (strcmp(value, "7BIT") == 0) {
+	if (strcasecmp(value, "7BIT") == 0) {
 		params->body.type = SMTP_PARAM_MAIL_BODY_TYPE_7BIT;
 	/* =8BITMIME: RFC 6152 */
 	} else if ((caps & SMTP_CAPABILITY_8BITMIME) != 0 &&
-			strcmp(value, "8BITMIME") == 0) {
+			strcasecmp(value, "8BITMIME") == 0) {
 		params->body.type = SMTP_PARAM_MAIL_BODY_TYPE_8BITMIME;
 	/* =BINARYMIME: RFC 3030 */
 	} else if ((caps & SMTP_CAPABILITY_BINARYMIME) != 0 &&
 			(caps & SMTP_CAPABILITY_CHUNKING) != 0 &&
-			strcmp(value, "BINARYMIME") == 0) {
+			strcasecmp(value, "BINARYMIME") == 0) {
 		params->body.type = SMTP_PARAM_MAIL_BODY_TYPE_BINARYMIME;
 	/* =?? */
 	} else if (extensions != NULL &&
 		   str_array_icase_find(extensions, value)) {
 		params->body.type = SMTP_PARAM_MAIL_BODY_TYPE_EXTENSION;
-		params->body.ext = p_strdup(pmparser->pool, value);
+		params->body.ext = p_strdup(pmparser->pool, t_str_ucase(value));
 	} else {
 		pmparser->error = "Unsupported mail BODY type";
 		pmparser->error_code = SMTP_PARAM_PARSE_ERROR_NOT_SUPPORTED;
@@ -343,7 +377,6 @@ int smtp_params_mail_parse(pool_t pool, const char *args,
 {
 	struct smtp_params_mail_parser pmparser;
 	struct smtp_param param;
-	const char *const *argv;
 	const char *error;
 	int ret = 0;
 
@@ -354,47 +387,47 @@ int smtp_params_mail_parse(pool_t pool, const char *args,
 	pmparser.params = params_r;
 	pmparser.caps = caps;
 
-	argv = t_strsplit(args, " ");
-	for (; *argv != NULL; argv++) {
-		if (smtp_param_parse(pool_datastack_create(), *argv,
-			&param, &error) < 0) {
+	if (*args == '\0')
+		args = NULL;
+	while ((ret = smtp_params_parse_next(&args, &param, &error)) != 0) {
+		if (ret < 0) {
 			*error_r = t_strdup_printf(
 				"Invalid MAIL parameter: %s", error);
 			*error_code_r = SMTP_PARAM_PARSE_ERROR_BAD_SYNTAX;
 			return -1;
 		}
+		ret = 0;
 
 		/* parse known parameters */
-		param.keyword = t_str_ucase(param.keyword);
 		if ((caps & SMTP_CAPABILITY_AUTH) != 0 &&
-			strcmp(param.keyword, "AUTH") == 0) {
+			strcasecmp(param.keyword, "AUTH") == 0) {
 			if (smtp_params_mail_parse_auth
 				(&pmparser, param.value) < 0) {
 				ret = -1;
 				break;
 			}
-		} else if (strcmp(param.keyword, "BODY") == 0) {
+		} else if (strcasecmp(param.keyword, "BODY") == 0) {
 			if (smtp_params_mail_parse_body(
 				&pmparser, param.value, body_extensions) < 0) {
 				ret = -1;
 				break;
 			}
 		} else if ((caps & SMTP_CAPABILITY_DSN) != 0 &&
-			strcmp(param.keyword, "ENVID") == 0) {
+			strcasecmp(param.keyword, "ENVID") == 0) {
 			if (smtp_params_mail_parse_envid
 				(&pmparser, param.value) < 0) {
 				ret = -1;
 				break;
 			}
 		} else if ((caps & SMTP_CAPABILITY_DSN) != 0 &&
-			strcmp(param.keyword, "RET") == 0) {
+			strcasecmp(param.keyword, "RET") == 0) {
 			if (smtp_params_mail_parse_ret
 				(&pmparser, param.value) < 0) {
 				ret = -1;
 				break;
 			}
 		} else if ((caps & SMTP_CAPABILITY_SIZE) != 0 &&
-			strcmp(param.keyword, "SIZE") == 0) {
+			strcasecmp(param.keyword, "SIZE") == 0) {
 			if (smtp_params_mail_parse_size
 				(&pmparser, param.value) < 0) {
 				ret = -1;
@@ -405,7 +438,8 @@ int smtp_params_mail_parse(pool_t pool, const char *args,
 			/* add the rest to ext_param for specific
 			   applications */
 			smtp_params_mail_add_extra(params_r, pool,
-						   param.keyword, param.value);
+						   t_str_ucase(param.keyword),
+						   param.value);
 		} else {
 			/* RFC 5321, Section 4.1.1.11:
 			   If the server SMTP does not recognize or cannot
@@ -974,7 +1008,6 @@ int smtp_params_rcpt_parse(pool_t pool, const char *args,
 {
 	struct smtp_params_rcpt_parser prparser;
 	struct smtp_param param;
-	const char *const *argv;
 	const char *error;
 	int ret = 0;
 
@@ -985,20 +1018,20 @@ int smtp_params_rcpt_parse(pool_t pool, const char *args,
 	prparser.params = params_r;
 	prparser.caps = caps;
 
-	argv = t_strsplit(args, " ");
-	for (; *argv != NULL; argv++) {
-		if (smtp_param_parse(pool_datastack_create(), *argv,
-			&param, &error) < 0) {
+	if (*args == '\0')
+		args = NULL;
+	while ((ret = smtp_params_parse_next(&args, &param, &error)) != 0) {
+		if (ret < 0) {
 			*error_r = t_strdup_printf(
 				"Invalid RCPT parameter: %s", error);
 			*error_code_r = SMTP_PARAM_PARSE_ERROR_BAD_SYNTAX;
 			return -1;
 		}
+		ret = 0;
 
 		/* parse known parameters */
-		param.keyword = t_str_ucase(param.keyword);
 		if ((caps & SMTP_CAPABILITY_DSN) != 0 &&
-			strcmp(param.keyword, "NOTIFY") == 0) {
+			strcasecmp(param.keyword, "NOTIFY") == 0) {
 			if (smtp_params_rcpt_parse_notify
 				(&prparser, param.value) < 0) {
 				ret = -1;
@@ -1006,7 +1039,7 @@ int smtp_params_rcpt_parse(pool_t pool, const char *args,
 			}
 		} else if (((caps & SMTP_CAPABILITY_DSN) != 0 ||
 			    (caps & SMTP_CAPABILITY__ORCPT) != 0) &&
-			   strcmp(param.keyword, "ORCPT") == 0) {
+			   strcasecmp(param.keyword, "ORCPT") == 0) {
 			if (smtp_params_rcpt_parse_orcpt
 				(&prparser, param.value) < 0) {
 				ret = -1;
@@ -1017,7 +1050,8 @@ int smtp_params_rcpt_parse(pool_t pool, const char *args,
 			/* add the rest to ext_param for specific applications
 			 */
 			smtp_params_rcpt_add_extra(params_r, pool,
-						   param.keyword, param.value);
+						   t_str_ucase(param.keyword),
+						   param.value);
 		} else {
 			/* RFC 5321, Section 4.1.1.11:
 			   If the server SMTP does not recognize or cannot
@@ -184,7 +184,8 @@ struct ostream *smtp_submit_send(struct smtp_submit *subm)
 
 	subm->output = iostream_temp_create
 		(t_strconcat("/tmp/dovecot.",
-			master_service_get_name(master_service), NULL), 0);
+			master_service_get_name(master_service), NULL),
+		 IOSTREAM_TEMP_FLAG_MEMFD);
 	o_stream_set_no_error_handling(subm->output, TRUE);
 	return subm->output;
 }
@@ -171,6 +171,27 @@ valid_mail_params_parse_tests[] = {
 		.params = {
 			.size = 267914296
 		}
+	/* <common> */
+	},{
+		.input = "SIZE=1024 BODY=8BITMIME",
+		.output = "BODY=8BITMIME SIZE=1024",
+		.caps = SMTP_CAPABILITY_SIZE | SMTP_CAPABILITY_8BITMIME,
+		.params = {
+			.body = {
+				.type = SMTP_PARAM_MAIL_BODY_TYPE_8BITMIME,
+			},
+			.size = 1024
+		}
+	},{
+		.input = "size=1024 body=8bitmime",
+		.output = "BODY=8BITMIME SIZE=1024",
+		.caps = SMTP_CAPABILITY_SIZE | SMTP_CAPABILITY_8BITMIME,
+		.params = {
+			.body = {
+				.type = SMTP_PARAM_MAIL_BODY_TYPE_8BITMIME,
+			},
+			.size = 1024
+		}
 	/* <extensions> */
 	},{
 		.input = "FROP=friep",
@@ -458,6 +479,13 @@ invalid_mail_params_parse_tests[] = {
 	},{
 		.input = "SIZE=ABC",
 		.caps = SMTP_CAPABILITY_SIZE
+	/* <syntax> */
+	},{
+		.input = "SIZE=13  BODY=7BIT",
+		.caps = SMTP_CAPABILITY_SIZE
+	},{
+		.input = "SIZE=13 ",
+		.caps = SMTP_CAPABILITY_SIZE
 	}
 };
 
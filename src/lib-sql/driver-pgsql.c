@@ -35,9 +35,37 @@ struct pgsql_db {
 	char *error;
 	const char *connect_state;
 
+	/* Incremented for each successful connect. The server forgets the
+	   prepared statements when the connection is closed, so a prepared
+	   statement is valid only if it was prepared with the same
+	   connect_count. */
+	unsigned int connect_count;
+	unsigned int prepared_stmt_counter;
+
 	bool fatal_error:1;
 };
 
+struct pgsql_prepared_statement {
+	struct sql_prepared_statement api;
+
+	char *query_template;
+	/* query_template with "?" replaced by "$1", "$2", .. */
+	char *pg_query;
+	char *name;
+	unsigned int params_count;
+	/* db->connect_count when the statement was prepared, 0 if never */
+	unsigned int prepared_connect_count;
+};
+
+struct pgsql_statement {
+	struct sql_statement api;
+	struct pgsql_prepared_statement *prep;
+
+	ARRAY(const char *) param_values;
+	ARRAY(int) param_lengths;
+	ARRAY(int) param_formats;
+};
+
 struct pgsql_binary_value {
 	unsigned char *value;
 	size_t size;
@@ -56,6 +84,10 @@ struct pgsql_result {
 
 	ARRAY(struct pgsql_binary_value) binary_values;
 
+	/* The statement is being prepared. It's executed after the prepare
+	   finishes. */
+	struct pgsql_statement *prepare_stmt;
+
 	sql_query_callback_t *callback;
 	void *context;
 
@@ -79,6 +111,8 @@ extern const struct sql_db driver_pgsql_db;
 extern const struct sql_result driver_pgsql_result;
 
 static void result_finish(struct pgsql_result *result);
+static void flush_callback(struct pgsql_result *result);
+static void prepare_finish(struct pgsql_result *result);
 static void
 transaction_update_callback(struct sql_result *result,
 			    struct sql_transaction_query *query);
@@ -193,6 +227,7 @@ static void connect_callback(struct pgsql_db *db)
 
 	if (io_dir == 0) {
 		db->connect_state = "connected";
+		db->connect_count++;
 		timeout_remove(&db->to_connect);
 		driver_pgsql_set_state(db, SQL_DB_STATE_IDLE);
 		if (db->ioloop != NULL) {
@@ -392,6 +427,8 @@ static void driver_pgsql_result_free(struct sql_result *_result)
 		array_free(&result->binary_values);
 	}
 
+	if (result->prepare_stmt != NULL)
+		pool_unref(&result->prepare_stmt->api.pool);
 	event_unref(&result->api.event);
 	i_free(result->query);
 	i_free(result->fields);
@@ -471,7 +508,10 @@ static void get_result(struct pgsql_result *result)
 	}
 
 	result->pgres = PQgetResult(db->pg);
-	result_finish(result);
+	if (result->prepare_stmt != NULL)
+		prepare_finish(result);
+	else
+		result_finish(result);
 }
 
 static void flush_callback(struct pgsql_result *result)
@@ -507,10 +547,9 @@ static void query_timeout(struct pgsql_result *result)
 	result_finish(result);
 }
 
-static void do_query(struct pgsql_result *result, const char *query)
+static void do_query_start(struct pgsql_result *result, const char *query)
 {
         struct pgsql_db *db = (struct pgsql_db *)result->api.db;
-	int ret;
 
 	i_assert(SQL_DB_IS_READY(&db->api));
 	i_assert(db->cur_result == NULL);
@@ -521,9 +560,14 @@ static void do_query(struct pgsql_result *result, const char *query)
 	result->to = timeout_add(SQL_QUERY_TIMEOUT_SECS * 1000,
 				 query_timeout, result);
 	result->query = i_strdup(query);
+}
+
+static void do_query_flush(struct pgsql_result *result, bool sent)
+{
+        struct pgsql_db *db = (struct pgsql_db *)result->api.db;
+	int ret;
 
-	if (PQsendQuery(db->pg, query) == 0 ||
-	    (ret = PQflush(db->pg)) < 0) {
+	if (!sent || (ret = PQflush(db->pg)) < 0) {
 		/* failed to send query */
 		result_finish(result);
 		return;
@@ -539,6 +583,139 @@ static void do_query(struct pgsql_result *result, const char *query)
 	}
 }
 
+static void do_query(struct pgsql_result *result, const char *query)
+{
+        struct pgsql_db *db = (struct pgsql_db *)result->api.db;
+
+	do_query_start(result, query);
+	do_query_flush(result, PQsendQuery(db->pg, query) != 0);
+}
+
+static bool
+do_stmt_send_prepared(struct pgsql_db *db, struct pgsql_statement *stmt)
+{
+	struct pgsql_prepared_statement *prep = stmt->prep;
+	unsigned int count = array_count(&stmt->param_values);
+
+	i_assert(count == prep->params_count);
+	return PQsendQueryPrepared(db->pg, prep->name, count,
+		count == 0 ? NULL : array_front(&stmt->param_values),
+		count == 0 ? NULL : array_front(&stmt->param_lengths),
+		count == 0 ? NULL : array_front(&stmt->param_formats),
+		0) != 0;
+}
+
+static void prepare_consume_results(struct pgsql_result *result)
+{
+        struct pgsql_db *db = (struct pgsql_db *)result->api.db;
+	struct pgsql_statement *stmt;
+	PGresult *pgres;
+	bool sent;
+
+	driver_pgsql_stop_io(db);
+
+	/* the prepare's results need to be consumed before the statement
+	   can be executed */
+	for (;;) {
+		if (PQconsumeInput(db->pg) == 0) {
+			result_finish(result);
+			return;
+		}
+		if (PQisBusy(db->pg) != 0) {
+			db->io = io_add(PQsocket(db->pg), IO_READ,
+					prepare_consume_results, result);
+			db->io_dir = IO_READ;
+			return;
+		}
+		pgres = PQgetResult(db->pg);
+		if (pgres == NULL)
+			break;
+		PQclear(pgres);
+	}
+
+	stmt = result->prepare_stmt;
+	result->prepare_stmt = NULL;
+	sent = do_stmt_send_prepared(db, stmt);
+	pool_unref(&stmt->api.pool);
+	do_query_flush(result, sent);
+}
+
+static void prepare_finish(struct pgsql_result *result)
+{
+        struct pgsql_db *db = (struct pgsql_db *)result->api.db;
+	struct pgsql_prepared_statement *prep = result->prepare_stmt->prep;
+
+	if (result->pgres == NULL ||
+	    PQresultStatus(result->pgres) != PGRES_COMMAND_OK) {
+		/* the prepare failure is returned as the query's result */
+		pool_unref(&result->prepare_stmt->api.pool);
+		result->prepare_stmt = NULL;
+		result_finish(result);
+		return;
+	}
+	PQclear(result->pgres);
+	result->pgres = NULL;
+
+	prep->prepared_connect_count = db->connect_count;
+	prepare_consume_results(result);
+}
+
+static const char *pgsql_query_template_convert(const char *query_template,
+						unsigned int *params_count_r)
+{
+	string_t *query = t_str_new(strlen(query_template) + 16);
+	unsigned int count = 0;
+	const char *p;
+
+	/* same as sql_statement_get_query(): each "?" is a parameter */
+	for (p = query_template; *p != '\0'; p++) {
+		if (*p == '?')
+			str_printfa(query, "$%u", ++count);
+		else
+			str_append_c(query, *p);
+	}
+	*params_count_r = count;
+	return str_c(query);
+}
+
+static void
+do_stmt_query(struct pgsql_result *result, struct pgsql_statement *stmt)
+{
+        struct pgsql_db *db = (struct pgsql_db *)result->api.db;
+	struct pgsql_prepared_statement *prep = stmt->prep;
+	unsigned int count = array_count(&stmt->param_values);
+	bool sent;
+
+	do_query_start(result, stmt->api.query_template);
+
+	if (prep == NULL) {
+		const char *query;
+		unsigned int params_count;
+
+		query = pgsql_query_template_convert(stmt->api.query_template,
+						     &params_count);
+		i_assert(count == params_count);
+		sent = PQsendQueryParams(db->pg, query, count, NULL,
+			count == 0 ? NULL : array_front(&stmt->param_values),
+			count == 0 ? NULL : array_front(&stmt->param_lengths),
+			count == 0 ? NULL : array_front(&stmt->param_formats),
+			0) != 0;
+	} else if (prep->prepared_connect_count == db->connect_count) {
+		sent = do_stmt_send_prepared(db, stmt);
+	} else {
+		/* not prepared yet for this connection */
+		sent = PQsendPrepare(db->pg, prep->name, prep->pg_query,
+				     prep->params_count, NULL) != 0;
+		if (sent) {
+			result->prepare_stmt = stmt;
+			do_query_flush(result, TRUE);
+			return;
+		}
+	}
+	pool_unref(&stmt->api.pool);
+	do_query_flush(result, sent);
+}
+
 static const char *
 driver_pgsql_escape_string(struct sql_db *_db, const char *string)
 {
@@ -601,6 +778,133 @@ static void driver_pgsql_query(struct sql_db *db, const char *query,
 	do_query(result, query);
 }
 
+static struct sql_prepared_statement *
+driver_pgsql_prepared_statement_init(struct sql_db *_db,
+				     const char *query_template)
+{
+	struct pgsql_db *db = (struct pgsql_db *)_db;
+	struct pgsql_prepared_statement *prep;
+
+	prep = i_new(struct pgsql_prepared_statement, 1);
+	prep->api.db = _db;
+	prep->query_template = i_strdup(query_template);
+	prep->pg_query = i_strdup(pgsql_query_template_convert(
+				query_template, &prep->params_count));
+	prep->name = i_strdup_printf("dovecot_stmt_%u",
+				     ++db->prepared_stmt_counter);
+	return &prep->api;
+}
+
+static void
+driver_pgsql_prepared_statement_deinit(struct sql_prepared_statement *_prep)
+{
+	struct pgsql_prepared_statement *prep =
+		(struct pgsql_prepared_statement *)_prep;
+
+	/* The statement is left prepared in the server until the connection
+	   is closed. The prepared statements are normally freed only at
+	   deinit, so it's not worth the extra roundtrip to deallocate it. */
+	i_free(prep->query_template);
+	i_free(prep->pg_query);
+	i_free(prep->name);
+	i_free(prep);
+}
+
+static struct pgsql_statement *driver_pgsql_statement_alloc(void)
+{
+	struct pgsql_statement *stmt;
+	pool_t pool;
+
+	pool = pool_alloconly_create("pgsql sql statement", 1024);
+	stmt = p_new(pool, struct pgsql_statement, 1);
+	stmt->api.pool = pool;
+	p_array_init(&stmt->param_values, pool, 8);
+	p_array_init(&stmt->param_lengths, pool, 8);
+	p_array_init(&stmt->param_formats, pool, 8);
+	return stmt;
+}
+
+static struct sql_statement *
+driver_pgsql_statement_init(struct sql_db *db ATTR_UNUSED,
+			    const char *query_template ATTR_UNUSED)
+{
+	return &driver_pgsql_statement_alloc()->api;
+}
+
+static struct sql_statement *
+driver_pgsql_statement_init_prepared(struct sql_prepared_statement *_prep)
+{
+	struct pgsql_prepared_statement *prep =
+		(struct pgsql_prepared_statement *)_prep;
+	struct pgsql_statement *stmt = driver_pgsql_statement_alloc();
+
+	stmt->api.query_template =
+		p_strdup(stmt->api.pool, prep->query_template);
+	stmt->prep = prep;
+	return &stmt->api;
+}
+
+static void
+driver_pgsql_statement_bind(struct pgsql_statement *stmt,
+			    unsigned int column_idx, const char *value,
+			    int length, int format)
+{
+	array_idx_set(&stmt->param_values, column_idx, &value);
+	array_idx_set(&stmt->param_lengths, column_idx, &length);
+	array_idx_set(&stmt->param_formats, column_idx, &format);
+}
+
+static void
+driver_pgsql_statement_bind_str(struct sql_statement *_stmt,
+				unsigned int column_idx, const char *value)
+{
+	struct pgsql_statement *stmt = (struct pgsql_statement *)_stmt;
+
+	driver_pgsql_statement_bind(stmt, column_idx,
+				    p_strdup(_stmt->pool, value), 0, 0);
+}
+
+static void
+driver_pgsql_statement_bind_binary(struct sql_statement *_stmt,
+				   unsigned int column_idx, const void *value,
+				   size_t value_size)
+{
+	struct pgsql_statement *stmt = (struct pgsql_statement *)_stmt;
+
+	i_assert(value_size <= INT_MAX);
+	driver_pgsql_statement_bind(stmt, column_idx,
+				    p_memdup(_stmt->pool, value, value_size),
+				    (int)value_size, 1);
+}
+
+static void
+driver_pgsql_statement_bind_int64(struct sql_statement *_stmt,
+				  unsigned int column_idx, int64_t value)
+{
+	struct pgsql_statement *stmt = (struct pgsql_statement *)_stmt;
+
+	driver_pgsql_statement_bind(stmt, column_idx,
+		p_strdup_printf(_stmt->pool, "%"PRId64, value), 0, 0);
+}
+
+static void
+driver_pgsql_statement_query(struct sql_statement *_stmt,
+			     sql_query_callback_t *callback, void *context)
+{
+	struct pgsql_statement *stmt = (struct pgsql_statement *)_stmt;
+	struct sql_db *db = _stmt->db;
+	struct pgsql_result *result;
+
+	result = i_new(struct pgsql_result, 1);
+	result->api = driver_pgsql_result;
+	result->api.db = db;
+	result->api.refcount = 1;
+	result->api.event = event_create(db->event);
+	result->callback = callback;
+	result->context = context;
+	do_stmt_query(result, stmt);
+}
+
 static void pgsql_query_s_callback(struct sql_result *result, void *context)
 {
         struct pgsql_db *db = context;
@@ -642,7 +946,8 @@ static void driver_pgsql_sync_deinit(struct pgsql_db *db)
 }
 
 static struct sql_result *
-driver_pgsql_sync_query(struct pgsql_db *db, const char *query)
+driver_pgsql_sync_query(struct pgsql_db *db, const char *query,
+			struct sql_statement *stmt)
 {
 	struct sql_result *result;
 
@@ -653,13 +958,21 @@ driver_pgsql_sync_query(struct pgsql_db *db, const char *query)
 	case SQL_DB_STATE_BUSY:
 		i_unreached();
 	case SQL_DB_STATE_DISCONNECTED:
+		if (stmt != NULL)
+			pool_unref(&stmt->pool);
 		sql_not_connected_result.refcount++;
 		return &sql_not_connected_result;
 	case SQL_DB_STATE_IDLE:
 		break;
 	}
 
-	driver_pgsql_query(&db->api, query, pgsql_query_s_callback, db);
+	if (stmt != NULL) {
+		driver_pgsql_statement_query(stmt, pgsql_query_s_callback,
+					     db);
+	} else {
+		driver_pgsql_query(&db->api, query, pgsql_query_s_callback,
+				   db);
+	}
 	if (db->sync_result == NULL)
 		io_loop_run(db->ioloop);
 
@@ -686,7 +999,19 @@ driver_pgsql_query_s(struct sql_db *_db, const char *query)
 	struct sql_result *result;
 
 	driver_pgsql_sync_init(db);
-	result = driver_pgsql_sync_query(db, query);
+	result = driver_pgsql_sync_query(db, query, NULL);
+	driver_pgsql_sync_deinit(db);
+	return result;
+}
+
+static struct sql_result *
+driver_pgsql_statement_query_s(struct sql_statement *stmt)
+{
+	struct pgsql_db *db = (struct pgsql_db *)stmt->db;
+	struct sql_result *result;
+
+	driver_pgsql_sync_init(db);
+	result = driver_pgsql_sync_query(db, NULL, stmt);
 	driver_pgsql_sync_deinit(db);
 	return result;
 }
@@ -1088,7 +1413,7 @@ driver_pgsql_transaction_commit_multi(struct pgsql_transaction_context *ctx)
 	struct sql_result *result;
 	struct sql_transaction_query *query;
 
-	result = driver_pgsql_sync_query(db, "BEGIN");
+	result = driver_pgsql_sync_query(db, "BEGIN", NULL);
 	if (sql_result_next_row(result) < 0) {
 		commit_multi_fail(ctx, result, "BEGIN");
 		return NULL;
@@ -1097,7 +1422,7 @@ driver_pgsql_transaction_commit_multi(struct pgsql_transaction_context *ctx)
 
 	/* send queries */
 	for (query = ctx->ctx.head; query != NULL; query = query->next) {
-		result = driver_pgsql_sync_query(db, query->query);
+		result = driver_pgsql_sync_query(db, query->query, NULL);
 		if (sql_result_next_row(result) < 0) {
 			commit_multi_fail(ctx, result, query->query);
 			break;
@@ -1114,7 +1439,7 @@ driver_pgsql_transaction_commit_multi(struct pgsql_transaction_context *ctx)
 	}
 
 	return driver_pgsql_sync_query(db, ctx->failed ?
-				       "ROLLBACK" : "COMMIT");
+				       "ROLLBACK" : "COMMIT", NULL);
 }
 
 static void
@@ -1230,7 +1555,7 @@ driver_pgsql_escape_blob(struct sql_db *_db ATTR_UNUSED,
 
 const struct sql_db driver_pgsql_db = {
 	.name = "pgsql",
-	.flags = SQL_DB_FLAG_POOLED,
+	.flags = SQL_DB_FLAG_POOLED | SQL_DB_FLAG_PREP_STATEMENTS,
 
 	.v = {
 		.init_full = driver_pgsql_init_full_v,
@@ -1250,6 +1575,16 @@ const struct sql_db driver_pgsql_db = {
 		.update = driver_pgsql_update,
 
 		.escape_blob = driver_pgsql_escape_blob,
+
+		.prepared_statement_init = driver_pgsql_prepared_statement_init,
+		.prepared_statement_deinit = driver_pgsql_prepared_statement_deinit,
+		.statement_init = driver_pgsql_statement_init,
+		.statement_init_prepared = driver_pgsql_statement_init_prepared,
+		.statement_bind_str = driver_pgsql_statement_bind_str,
+		.statement_bind_binary = driver_pgsql_statement_bind_binary,
+		.statement_bind_int64 = driver_pgsql_statement_bind_int64,
+		.statement_query = driver_pgsql_statement_query,
+		.statement_query_s = driver_pgsql_statement_query_s,
 	}
 };
 
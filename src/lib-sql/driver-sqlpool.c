@@ -4,11 +4,21 @@
 #include "array.h"
 #include "llist.h"
 #include "ioloop.h"
+#include "time-util.h"
 #include "sql-api-private.h"
 
 #include <time.h>
 
 #define QUERY_TIMEOUT_SECS 6
+/* Stop sending queries to a host for a while after this many
+   consecutive query failures. */
+#define SQLPOOL_HOST_MAX_FAILURES 5
+#define SQLPOOL_HOST_DISABLE_SECS 30
+/* Every this many queries ignore the latencies and use the next ready
+   connection in round-robin order. This way the latencies of the slower
+   hosts keep getting updated, and they're used again once they've become
+   faster. */
+#define SQLPOOL_LATENCY_PROBE_INTERVAL 32
 
 /* sqlpool events are separate from category:sql, because
    they are usually not very interesting, and would only
@@ -22,6 +32,15 @@ struct sqlpool_host {
 	char *connect_string;
 
 	unsigned int connection_count;
+
+	/* exponentially weighted moving average of query latencies */
+	unsigned int avg_latency_usecs;
+	/* avg_latency_usecs has been measured at least once */
+	bool latency_measured;
+	/* number of consecutive failed queries */
+	unsigned int failure_count;
+	/* don't send queries to the host until this time */
+	time_t disabled_until;
 };
 
 struct sqlpool_connection {
@@ -35,6 +54,8 @@ struct sqlpool_db {
 	pool_t pool;
 	const struct sql_db *driver;
 	unsigned int connection_limit;
+	/* maximum number of queued queries, 0 = unlimited */
+	unsigned int queue_limit;
 
 	ARRAY(struct sqlpool_host) hosts;
 	/* all connections from all hosts */
@@ -42,9 +63,12 @@ struct sqlpool_db {
 	/* index of last connection in all_connections that was used to
 	   send a query. */
 	unsigned int last_query_conn_idx;
+	/* number of queries sent to connections, for latency probing */
+	unsigned int query_count;
 
 	/* queued requests */
 	struct sqlpool_request *requests_head, *requests_tail;
+	unsigned int requests_count;
 	struct timeout *request_to;
 };
 
@@ -53,6 +77,8 @@ struct sqlpool_request {
 
 	struct sqlpool_db *db;
 	time_t created;
+	/* when the query was sent to a connection */
+	struct timeval sent_time;
 
 	unsigned int host_idx;
 	unsigned int retry_count;
@@ -63,11 +89,43 @@ struct sqlpool_request {
 	char *query;
 	sql_query_callback_t *callback;
 	void *context;
+	/* a2) statements, in which case query is the template */
+	struct sqlpool_statement *stmt;
 
 	/* b) transaction waiters */
 	struct sqlpool_transaction_context *trans;
 };
 
+struct sqlpool_prepared_statement {
+	struct sql_prepared_statement api;
+	char *query_template;
+
+	/* The prepared statements for the connections, indexed by their
+	   position in all_connections. They're created when needed. */
+	ARRAY(struct sql_prepared_statement *) conn_prep_stmts;
+};
+
+enum sqlpool_statement_param_type {
+	SQLPOOL_STATEMENT_PARAM_STR,
+	SQLPOOL_STATEMENT_PARAM_BINARY,
+	SQLPOOL_STATEMENT_PARAM_INT64,
+};
+
+struct sqlpool_statement_param {
+	enum sqlpool_statement_param_type type;
+	const void *value;
+	size_t value_size;
+	int64_t value_int64;
+};
+
+/* The statement is recreated for the connection it's sent to, so the bound
+   values need to be kept until then. */
+struct sqlpool_statement {
+	struct sql_statement api;
+	struct sqlpool_prepared_statement *prep;
+	ARRAY(struct sqlpool_statement_param) params;
+};
+
 struct sqlpool_transaction_context {
 	struct sql_transaction_context ctx;
 
@@ -112,6 +170,8 @@ sqlpool_request_free(struct sqlpool_request **_request)
 	*_request = NULL;
 
 	i_assert(request->prev == NULL && request->next == NULL);
+	if (request->stmt != NULL)
+		pool_unref(&request->stmt->api.pool);
 	event_unref(&request->event);
 	i_free(request->query);
 	i_free(request);
@@ -131,6 +191,7 @@ sqlpool_request_abort(struct sqlpool_request **_request)
 		 request->db->requests_head == request);
 	DLLIST2_REMOVE(&request->db->requests_head,
 		       &request->db->requests_tail, request);
+	request->db->requests_count--;
 	sqlpool_request_free(&request);
 }
 
@@ -163,6 +224,77 @@ sqlpool_request_handle_transaction(struct sql_db *conndb,
 			       driver_sqlpool_commit_callback, trans);
 }
 
+static struct sql_statement *
+sqlpool_statement_init_conn(struct sqlpool_statement *stmt,
+			    struct sql_db *conndb)
+{
+	struct sqlpool_db *db = (struct sqlpool_db *)stmt->api.db;
+	struct sqlpool_prepared_statement *prep = stmt->prep;
+	const struct sqlpool_connection *conn;
+	const struct sqlpool_statement_param *param;
+	struct sql_prepared_statement **conn_prepp;
+	struct sql_statement *conn_stmt;
+	unsigned int idx = UINT_MAX;
+
+	if (prep == NULL)
+		conn_stmt = sql_statement_init(conndb, stmt->api.query_template);
+	else {
+		array_foreach(&db->all_connections, conn) {
+			if (conn->db == conndb) {
+				idx = array_foreach_idx(&db->all_connections,
+							conn);
+				break;
+			}
+		}
+		i_assert(idx != UINT_MAX);
+		conn_prepp = array_idx_get_space(&prep->conn_prep_stmts, idx);
+		if (*conn_prepp == NULL) {
+			*conn_prepp = sql_prepared_statement_init(conndb,
+				prep->query_template);
+		}
+		conn_stmt = sql_statement_init_prepared(*conn_prepp);
+	}
+
+	array_foreach(&stmt->params, param) {
+		unsigned int column_idx =
+			array_foreach_idx(&stmt->params, param);
+
+		switch (param->type) {
+		case SQLPOOL_STATEMENT_PARAM_STR:
+			sql_statement_bind_str(conn_stmt, column_idx,
+					       param->value);
+			break;
+		case SQLPOOL_STATEMENT_PARAM_BINARY:
+			sql_statement_bind_binary(conn_stmt, column_idx,
+						  param->value,
+						  param->value_size);
+			break;
+		case SQLPOOL_STATEMENT_PARAM_INT64:
+			sql_statement_bind_int64(conn_stmt, column_idx,
+						 param->value_int64);
+			break;
+		}
+	}
+	return conn_stmt;
+}
+
+static void
+sqlpool_request_send_query(struct sqlpool_request *request,
+			   struct sql_db *conndb)
+{
+	struct sql_statement *conn_stmt;
+
+	request->sent_time = ioloop_timeval;
+	if (request->stmt == NULL) {
+		sql_query(conndb, request->query,
+			  driver_sqlpool_query_callback, request);
+	} else {
+		conn_stmt = sqlpool_statement_init_conn(request->stmt, conndb);
+		sql_statement_query(&conn_stmt,
+				    driver_sqlpool_query_callback, request);
+	}
+}
+
 static void
 sqlpool_request_send_next(struct sqlpool_db *db, struct sql_db *conndb)
 {
@@ -173,11 +305,11 @@ sqlpool_request_send_next(struct sqlpool_db *db, struct sql_db *conndb)
 
 	request = db->requests_head;
 	DLLIST2_REMOVE(&db->requests_head, &db->requests_tail, request);
+	db->requests_count--;
 	timeout_reset(db->request_to);
 
 	if (request->query != NULL) {
-		sql_query(conndb, request->query,
-			  driver_sqlpool_query_callback, request);
+		sqlpool_request_send_query(request, conndb);
 	} else if (request->trans != NULL) {
 		sqlpool_request_handle_transaction(conndb, request->trans);
 	} else {
@@ -321,16 +453,63 @@ sqlpool_add_new_connection(struct sqlpool_db *db)
 		return sqlpool_add_connection(db, host, host_idx);
 }
 
+static bool sqlpool_host_is_disabled(const struct sqlpool_host *host)
+{
+	return host->disabled_until > ioloop_time;
+}
+
+static bool sqlpool_all_hosts_disabled(struct sqlpool_db *db)
+{
+	const struct sqlpool_host *host;
+
+	array_foreach(&db->hosts, host) {
+		if (!sqlpool_host_is_disabled(host))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static unsigned int
+sqlpool_host_get_latency(struct sqlpool_db *db,
+			 const struct sqlpool_host *host)
+{
+	const struct sqlpool_host *hosts;
+	unsigned long long sum = 0;
+	unsigned int i, count, measured_count = 0;
+
+	if (host->latency_measured)
+		return host->avg_latency_usecs;
+
+	/* not measured yet - assume the host is as fast as the others on
+	   average, so it gets its share of queries without being preferred
+	   over all of them */
+	hosts = array_get(&db->hosts, &count);
+	for (i = 0; i < count; i++) {
+		if (hosts[i].latency_measured) {
+			sum += hosts[i].avg_latency_usecs;
+			measured_count++;
+		}
+	}
+	return measured_count == 0 ? 0 : sum / measured_count;
+}
+
 static const struct sqlpool_connection *
 sqlpool_find_available_connection(struct sqlpool_db *db,
 				  unsigned int unwanted_host_idx,
+				  bool allow_disabled_hosts,
 				  bool *all_disconnected_r)
 {
-	const struct sqlpool_connection *conns;
-	unsigned int i, count;
+	const struct sqlpool_connection *conns, *best = NULL;
+	const struct sqlpool_host *host;
+	unsigned int i, count, best_idx = 0, latency, best_latency = 0;
+	bool probe;
 
 	*all_disconnected_r = TRUE;
 
+	/* use the ready connection whose host has been responding the
+	   fastest. connections are checked in round-robin order, so with
+	   equal latencies the load is still spread evenly. */
+	probe = (db->query_count + 1) % SQLPOOL_LATENCY_PROBE_INTERVAL == 0;
 	conns = array_get(&db->all_connections, &count);
 	for (i = 0; i < count; i++) {
 		unsigned int idx = (i + db->last_query_conn_idx + 1) % count;
@@ -338,20 +517,33 @@ sqlpool_find_available_connection(struct sqlpool_db *db,
 
 		if (conns[idx].host_idx == unwanted_host_idx)
 			continue;
+		host = array_idx(&db->hosts, conns[idx].host_idx);
+		if (!allow_disabled_hosts && sqlpool_host_is_disabled(host))
+			continue;
 
-		if (!SQL_DB_IS_READY(conndb) && conndb->to_reconnect == NULL) {
+		if (!SQL_DB_IS_READY(conndb) && conndb->to_reconnect == NULL &&
+		    best == NULL) {
 			/* see if we could reconnect to it immediately */
 			(void)sql_connect(conndb);
 		}
 		if (SQL_DB_IS_READY(conndb)) {
-			db->last_query_conn_idx = idx;
 			*all_disconnected_r = FALSE;
-			return &conns[idx];
-		}
-		if (conndb->state != SQL_DB_STATE_DISCONNECTED)
+			if (best != NULL && probe)
+				continue;
+			latency = sqlpool_host_get_latency(db, host);
+			if (best == NULL || latency < best_latency) {
+				best = &conns[idx];
+				best_latency = latency;
+				best_idx = idx;
+			}
+		} else if (conndb->state != SQL_DB_STATE_DISCONNECTED)
 			*all_disconnected_r = FALSE;
 	}
-	return NULL;
+	if (best != NULL) {
+		db->last_query_conn_idx = best_idx;
+		db->query_count++;
+	}
+	return best;
 }
 
 static bool
@@ -364,10 +556,15 @@ driver_sqlpool_get_connection(struct sqlpool_db *db,
 	bool all_disconnected;
 
 	conn = sqlpool_find_available_connection(db, unwanted_host_idx,
-						 &all_disconnected);
+						 FALSE, &all_disconnected);
 	if (conn == NULL && unwanted_host_idx != UINT_MAX) {
 		/* maybe there are no wanted hosts. use any of them. */
-		conn = sqlpool_find_available_connection(db, UINT_MAX,
+		conn = sqlpool_find_available_connection(db, UINT_MAX, FALSE,
+							 &all_disconnected);
+	}
+	if (conn == NULL && sqlpool_all_hosts_disabled(db)) {
+		/* a disabled host is still better than no host at all */
+		conn = sqlpool_find_available_connection(db, UINT_MAX, TRUE,
 							 &all_disconnected);
 	}
 	if (conn == NULL && all_disconnected) {
@@ -380,7 +577,7 @@ driver_sqlpool_get_connection(struct sqlpool_db *db,
 			if (conndb->connect_delay > SQL_CONNECT_RESET_DELAY)
 				conndb->connect_delay = SQL_CONNECT_RESET_DELAY;
 		}
-		conn = sqlpool_find_available_connection(db, UINT_MAX,
+		conn = sqlpool_find_available_connection(db, UINT_MAX, TRUE,
 							 &all_disconnected);
 	}
 	if (conn == NULL) {
@@ -448,6 +645,12 @@ driver_sqlpool_parse_hosts(struct sqlpool_db *db, const char *connect_string,
 					value);
 				return -1;
 			}
+		} else if (strcmp(key, "maxqueue") == 0) {
+			if (str_to_uint(value, &db->queue_limit) < 0) {
+				*error_r = t_strdup_printf("Invalid value for maxqueue: %s",
+					value);
+				return -1;
+			}
 		} else if (strcmp(key, "host") == 0) {
 			array_push_back(&hostnames, &value);
 		} else {
@@ -650,6 +853,7 @@ driver_sqlpool_prepend_request(struct sqlpool_db *db,
 			       struct sqlpool_request *request)
 {
 	DLLIST2_PREPEND(&db->requests_head, &db->requests_tail, request);
+	db->requests_count++;
 	if (db->request_to == NULL) {
 		db->request_to = timeout_add(SQL_QUERY_TIMEOUT_SECS * 1000,
 					     driver_sqlpool_timeout, db);
@@ -661,12 +865,75 @@ driver_sqlpool_append_request(struct sqlpool_db *db,
 			      struct sqlpool_request *request)
 {
 	DLLIST2_APPEND(&db->requests_head, &db->requests_tail, request);
+	db->requests_count++;
 	if (db->request_to == NULL) {
 		db->request_to = timeout_add(SQL_QUERY_TIMEOUT_SECS * 1000,
 					     driver_sqlpool_timeout, db);
 	}
 }
 
+static struct sqlpool_host *
+sqlpool_find_conndb_host(struct sqlpool_db *db, struct sql_db *conndb)
+{
+	const struct sqlpool_connection *conn;
+
+	array_foreach(&db->all_connections, conn) {
+		if (conn->db == conndb)
+			return array_idx_modifiable(&db->hosts, conn->host_idx);
+	}
+	return NULL;
+}
+
+static const char *sqlpool_host_get_name(const struct sqlpool_host *host)
+{
+	/* don't log the whole connect string, it may contain passwords */
+	if (str_begins(host->connect_string, "host="))
+		return t_strcut(host->connect_string + 5, ' ');
+	return "the database";
+}
+
+static void
+sqlpool_request_update_host(struct sqlpool_request *request,
+			    struct sql_result *result)
+{
+	struct sqlpool_db *db = request->db;
+	struct sqlpool_host *host;
+	long long usecs;
+
+	host = result->db == NULL ? NULL :
+		sqlpool_find_conndb_host(db, result->db);
+	if (host == NULL)
+		return;
+
+	if (result->failed_try_retry) {
+		if (++host->failure_count == SQLPOOL_HOST_MAX_FAILURES) {
+			e_warning(db->api.event,
+				  "%u queries failed in a row to %s - "
+				  "not using it for %u secs",
+				  host->failure_count,
+				  sqlpool_host_get_name(host),
+				  SQLPOOL_HOST_DISABLE_SECS);
+			host->disabled_until =
+				ioloop_time + SQLPOOL_HOST_DISABLE_SECS;
+			host->failure_count = 0;
+		}
+		return;
+	}
+	host->failure_count = 0;
+
+	usecs = timeval_diff_usecs(&ioloop_timeval, &request->sent_time);
+	if (usecs < 0)
+		usecs = 0;
+	if (!host->latency_measured) {
+		host->avg_latency_usecs = usecs;
+		host->latency_measured = TRUE;
+	} else {
+		host->avg_latency_usecs =
+			((unsigned long long)host->avg_latency_usecs * 7 +
+			 usecs) / 8;
+	}
+}
+
 static void
 driver_sqlpool_query_callback(struct sql_result *result,
 			      struct sqlpool_request *request)
@@ -674,7 +941,9 @@ driver_sqlpool_query_callback(struct sql_result *result,
 	struct sqlpool_db *db = request->db;
 	const struct sqlpool_connection *conn = NULL;
 	struct sql_db *conndb;
+	struct timeval created;
 
+	sqlpool_request_update_host(request, result);
 	if (result->failed_try_retry &&
 	    request->retry_count < array_count(&db->hosts)) {
 		e_warning(db->api.event, "Query failed, retrying: %s",
@@ -694,6 +963,15 @@ driver_sqlpool_query_callback(struct sql_result *result,
 		}
 		conndb = result->db;
 
+		event_get_create_time(request->event, &created);
+		e_debug(event_create_passthrough(request->event)->
+			set_name("sql_pool_query_finished")->
+			add_int("queue_usecs", timeval_diff_usecs(
+				&request->sent_time, &created))->
+			add_int("query_usecs", timeval_diff_usecs(
+				&ioloop_timeval, &request->sent_time))->
+			event(), "Query finished");
+
 		if (request->callback != NULL)
 			request->callback(result, request->context);
 		sqlpool_request_free(&request);
@@ -702,25 +980,40 @@ driver_sqlpool_query_callback(struct sql_result *result,
 	}
 }
 
+static void
+driver_sqlpool_request_query(struct sqlpool_db *db,
+			     struct sqlpool_request *request)
+{
+	const struct sqlpool_connection *conn;
+
+	if (driver_sqlpool_get_connection(db, UINT_MAX, &conn)) {
+		request->host_idx = conn->host_idx;
+		sqlpool_request_send_query(request, conn->db);
+	} else if (db->queue_limit == 0 ||
+		   db->requests_count < db->queue_limit) {
+		driver_sqlpool_append_request(db, request);
+	} else {
+		e_error(db->api.event, "Query rejected: "
+			"Too many queued queries (maxqueue=%u): %s",
+			db->queue_limit, request->query);
+		if (request->callback != NULL)
+			request->callback(&sql_not_connected_result,
+					  request->context);
+		sqlpool_request_free(&request);
+	}
+}
+
 static void ATTR_NULL(3, 4)
 driver_sqlpool_query(struct sql_db *_db, const char *query,
 		     sql_query_callback_t *callback, void *context)
 {
         struct sqlpool_db *db = (struct sqlpool_db *)_db;
 	struct sqlpool_request *request;
-	const struct sqlpool_connection *conn;
 
 	request = sqlpool_request_new(db, query);
 	request->callback = callback;
 	request->context = context;
-
-	if (!driver_sqlpool_get_connection(db, UINT_MAX, &conn))
-		driver_sqlpool_append_request(db, request);
-	else {
-		request->host_idx = conn->host_idx;
-		sql_query(conn->db, query, driver_sqlpool_query_callback,
-			  request);
-	}
+	driver_sqlpool_request_query(db, request);
 }
 
 static void driver_sqlpool_exec(struct sql_db *_db, const char *query)
@@ -751,6 +1044,147 @@ driver_sqlpool_query_s(struct sql_db *_db, const char *query)
 	return result;
 }
 
+static struct sql_prepared_statement *
+driver_sqlpool_prepared_statement_init(struct sql_db *db,
+				       const char *query_template)
+{
+	struct sqlpool_prepared_statement *prep;
+
+	prep = i_new(struct sqlpool_prepared_statement, 1);
+	prep->api.db = db;
+	prep->query_template = i_strdup(query_template);
+	i_array_init(&prep->conn_prep_stmts, 8);
+	return &prep->api;
+}
+
+static void
+driver_sqlpool_prepared_statement_deinit(struct sql_prepared_statement *_prep)
+{
+	struct sqlpool_prepared_statement *prep =
+		(struct sqlpool_prepared_statement *)_prep;
+	struct sql_prepared_statement **conn_prepp;
+
+	array_foreach_modifiable(&prep->conn_prep_stmts, conn_prepp) {
+		if (*conn_prepp != NULL)
+			sql_prepared_statement_deinit(conn_prepp);
+	}
+	array_free(&prep->conn_prep_stmts);
+	i_free(prep->query_template);
+	i_free(prep);
+}
+
+static struct sqlpool_statement *driver_sqlpool_statement_alloc(void)
+{
+	struct sqlpool_statement *stmt;
+	pool_t pool;
+
+	pool = pool_alloconly_create("sqlpool sql statement", 1024);
+	stmt = p_new(pool, struct sqlpool_statement, 1);
+	stmt->api.pool = pool;
+	p_array_init(&stmt->params, pool, 8);
+	return stmt;
+}
+
+static struct sql_statement *
+driver_sqlpool_statement_init(struct sql_db *db ATTR_UNUSED,
+			      const char *query_template ATTR_UNUSED)
+{
+	return &driver_sqlpool_statement_alloc()->api;
+}
+
+static struct sql_statement *
+driver_sqlpool_statement_init_prepared(struct sql_prepared_statement *_prep)
+{
+	struct sqlpool_prepared_statement *prep =
+		(struct sqlpool_prepared_statement *)_prep;
+	struct sqlpool_statement *stmt = driver_sqlpool_statement_alloc();
+
+	stmt->api.query_template =
+		p_strdup(stmt->api.pool, prep->query_template);
+	stmt->prep = prep;
+	return &stmt->api;
+}
+
+static void
+driver_sqlpool_statement_bind_str(struct sql_statement *_stmt,
+				  unsigned int column_idx, const char *value)
+{
+	struct sqlpool_statement *stmt = (struct sqlpool_statement *)_stmt;
+	struct sqlpool_statement_param *param =
+		array_idx_get_space(&stmt->params, column_idx);
+
+	param->type = SQLPOOL_STATEMENT_PARAM_STR;
+	param->value = p_strdup(_stmt->pool, value);
+}
+
+static void
+driver_sqlpool_statement_bind_binary(struct sql_statement *_stmt,
+				     unsigned int column_idx, const void *value,
+				     size_t value_size)
+{
+	struct sqlpool_statement *stmt = (struct sqlpool_statement *)_stmt;
+	struct sqlpool_statement_param *param =
+		array_idx_get_space(&stmt->params, column_idx);
+
+	param->type = SQLPOOL_STATEMENT_PARAM_BINARY;
+	param->value = p_memdup(_stmt->pool, value, value_size);
+	param->value_size = value_size;
+}
+
+static void
+driver_sqlpool_statement_bind_int64(struct sql_statement *_stmt,
+				    unsigned int column_idx, int64_t value)
+{
+	struct sqlpool_statement *stmt = (struct sqlpool_statement *)_stmt;
+	struct sqlpool_statement_param *param =
+		array_idx_get_space(&stmt->params, column_idx);
+
+	param->type = SQLPOOL_STATEMENT_PARAM_INT64;
+	param->value_int64 = value;
+}
+
+static void
+driver_sqlpool_statement_query(struct sql_statement *_stmt,
+			       sql_query_callback_t *callback, void *context)
+{
+	struct sqlpool_statement *stmt = (struct sqlpool_statement *)_stmt;
+	struct sqlpool_db *db = (struct sqlpool_db *)_stmt->db;
+	struct sqlpool_request *request;
+
+	request = sqlpool_request_new(db, _stmt->query_template);
+	request->callback = callback;
+	request->context = context;
+	request->stmt = stmt;
+	driver_sqlpool_request_query(db, request);
+}
+
+static struct sql_result *
+driver_sqlpool_statement_query_s(struct sql_statement *_stmt)
+{
+	struct sqlpool_statement *stmt = (struct sqlpool_statement *)_stmt;
+	struct sqlpool_db *db = (struct sqlpool_db *)_stmt->db;
+	const struct sqlpool_connection *conn;
+	struct sql_statement *conn_stmt;
+	struct sql_result *result;
+
+	if (!driver_sqlpool_get_sync_connection(db, &conn)) {
+		pool_unref(&_stmt->pool);
+		sql_not_connected_result.refcount++;
+		return &sql_not_connected_result;
+	}
+
+	conn_stmt = sqlpool_statement_init_conn(stmt, conn->db);
+	result = sql_statement_query_s(&conn_stmt);
+	if (result->failed_try_retry &&
+	    driver_sqlpool_get_sync_connection(db, &conn)) {
+		sql_result_unref(result);
+		conn_stmt = sqlpool_statement_init_conn(stmt, conn->db);
+		result = sql_statement_query_s(&conn_stmt);
+	}
+	pool_unref(&_stmt->pool);
+	return result;
+}
+
 static struct sql_transaction_context *
 driver_sqlpool_transaction_begin(struct sql_db *_db)
 {
@@ -891,5 +1325,15 @@ struct sql_db driver_sqlpool_db = {
 		.update = driver_sqlpool_update,
 
 		.escape_blob = driver_sqlpool_escape_blob,
+
+		.prepared_statement_init = driver_sqlpool_prepared_statement_init,
+		.prepared_statement_deinit = driver_sqlpool_prepared_statement_deinit,
+		.statement_init = driver_sqlpool_statement_init,
+		.statement_init_prepared = driver_sqlpool_statement_init_prepared,
+		.statement_bind_str = driver_sqlpool_statement_bind_str,
+		.statement_bind_binary = driver_sqlpool_statement_bind_binary,
+		.statement_bind_int64 = driver_sqlpool_statement_bind_int64,
+		.statement_query = driver_sqlpool_statement_query,
+		.statement_query_s = driver_sqlpool_statement_query_s,
 	}
 };
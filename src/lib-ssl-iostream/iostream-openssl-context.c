@@ -1,7 +1,11 @@
 /* Copyright (c) 2009-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "hash.h"
+#include "ioloop.h"
 #include "safe-memset.h"
+#include "hmac.h"
+#include "sha2.h"
 #include "iostream-openssl.h"
 #include "dovecot-openssl-common.h"
 
@@ -15,6 +19,11 @@
 #  define HAVE_ECDH
 #endif
 
+/* Maximum number of hosts to cache client sessions for */
+#define OPENSSL_CLIENT_SESSION_CACHE_MAX_HOSTS 128
+/* Minimum length for ssl_ticket_key */
+#define OPENSSL_TICKET_KEY_MIN_LEN 32
+
 struct ssl_iostream_password_context {
 	const char *password;
 	const char *error;
@@ -177,6 +186,104 @@ ssl_iostream_ctx_use_dh(struct ssl_iostream_context *ctx,
 	return ret;
 }
 
+#ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEYS
+/* HKDF-SHA256 (RFC 5869) with an empty salt */
+static void
+ssl_iostream_hkdf_sha256(const unsigned char *ikm, size_t ikm_len,
+			 const char *info, unsigned char *okm, size_t okm_len)
+{
+	static const unsigned char zero_salt[SHA256_RESULTLEN];
+	unsigned char prk[SHA256_RESULTLEN], block[SHA256_RESULTLEN];
+	struct hmac_context hmac_ctx;
+	unsigned char counter;
+	size_t pos, len;
+
+	i_assert(okm_len <= 255 * SHA256_RESULTLEN);
+
+	/* extract */
+	hmac_init(&hmac_ctx, zero_salt, sizeof(zero_salt), &hash_method_sha256);
+	hmac_update(&hmac_ctx, ikm, ikm_len);
+	hmac_final(&hmac_ctx, prk);
+
+	/* expand: T(n) = HMAC(PRK, T(n-1) || info || n) */
+	for (pos = 0, counter = 1; pos < okm_len; counter++) {
+		hmac_init(&hmac_ctx, prk, sizeof(prk), &hash_method_sha256);
+		if (pos > 0)
+			hmac_update(&hmac_ctx, block, sizeof(block));
+		hmac_update(&hmac_ctx, info, strlen(info));
+		hmac_update(&hmac_ctx, &counter, sizeof(counter));
+		hmac_final(&hmac_ctx, block);
+
+		len = I_MIN(sizeof(block), okm_len - pos);
+		memcpy(okm + pos, block, len);
+		pos += len;
+	}
+	safe_memset(prk, 0, sizeof(prk));
+	safe_memset(block, 0, sizeof(block));
+	safe_memset(&hmac_ctx, 0, sizeof(hmac_ctx));
+}
+#endif
+
+static int
+ssl_iostream_ctx_set_ticket_key(struct ssl_iostream_context *ctx,
+				const struct ssl_iostream_settings *set,
+				const char **error_r)
+{
+#ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEYS
+	/* the key name is always 16 bytes, the rest is split evenly between
+	   the HMAC secret and the AES key */
+	const size_t name_len = 16;
+	const unsigned char *secret =
+		(const unsigned char *)set->ticket_key;
+	size_t secret_len = strlen(set->ticket_key), hmac_len;
+	unsigned char keys[128];
+	long keys_len;
+	int ret = 0;
+
+	if (secret_len < OPENSSL_TICKET_KEY_MIN_LEN) {
+		*error_r = t_strdup_printf(
+			"ssl_ticket_key must be at least %u characters",
+			OPENSSL_TICKET_KEY_MIN_LEN);
+		return -1;
+	}
+	/* the size depends on the OpenSSL version */
+	keys_len = SSL_CTX_get_tlsext_ticket_keys(ctx->ssl_ctx, NULL, 0);
+	if (keys_len <= (long)name_len || (size_t)keys_len > sizeof(keys) ||
+	    ((size_t)keys_len - name_len) % 2 != 0) {
+		*error_r = t_strdup_printf(
+			"Unexpected session ticket keys size %ld", keys_len);
+		return -1;
+	}
+	hmac_len = ((size_t)keys_len - name_len) / 2;
+
+	/* All the processes using the same secret derive the same keys, so
+	   they can decrypt each others' tickets. The key name is sent in
+	   plaintext in every ticket, so each part is derived with its own
+	   label, and the name reveals nothing about the keys. */
+	ssl_iostream_hkdf_sha256(secret, secret_len,
+				 "dovecot ssl ticket key name",
+				 keys, name_len);
+	ssl_iostream_hkdf_sha256(secret, secret_len,
+				 "dovecot ssl ticket hmac key",
+				 keys + name_len, hmac_len);
+	ssl_iostream_hkdf_sha256(secret, secret_len,
+				 "dovecot ssl ticket aes key",
+				 keys + name_len + hmac_len, hmac_len);
+	if (SSL_CTX_set_tlsext_ticket_keys(ctx->ssl_ctx, keys, keys_len) != 1) {
+		*error_r = t_strdup_printf(
+			"Can't set session ticket keys: %s",
+			openssl_iostream_error());
+		ret = -1;
+	}
+	safe_memset(keys, 0, sizeof(keys));
+	return ret;
+#else
+	*error_r = "ssl_ticket_key is set, but the linked openssl "
+		"version does not support it";
+	return -1;
+#endif
+}
+
 static int ssl_ctx_use_certificate_chain(SSL_CTX *ctx, const char *cert)
 {
 	/* mostly just copy&pasted from SSL_CTX_use_certificate_chain_file() */
@@ -434,6 +541,10 @@ ssl_iostream_context_set(struct ssl_iostream_context *ctx,
 		if (ssl_iostream_ctx_use_dh(ctx, set, error_r) < 0)
 			return -1;
 	}
+	if (set->ticket_key != NULL && set->tickets && !ctx->client_ctx) {
+		if (ssl_iostream_ctx_set_ticket_key(ctx, set, error_r) < 0)
+			return -1;
+	}
 
 	/* set trusted CA certs */
 	if (set->verify_remote_cert) {
@@ -589,6 +700,15 @@ ssl_iostream_context_init_common(struct ssl_iostream_context *ctx,
 	if (!set->tickets)
 		ssl_ops |= SSL_OP_NO_TICKET;
 #endif
+	if (set->ktls) {
+#ifdef HAVE_OPENSSL_KTLS
+		ssl_ops |= SSL_OP_ENABLE_KTLS;
+#else
+		*error_r = "ssl_options: ktls is set, but it's not supported "
+			"by the linked OpenSSL version or the OS";
+		return -1;
+#endif
+	}
 	SSL_CTX_set_options(ctx->ssl_ctx, ssl_ops);
 #ifdef SSL_MODE_RELEASE_BUFFERS
 	SSL_CTX_set_mode(ctx->ssl_ctx, SSL_MODE_RELEASE_BUFFERS);
@@ -605,6 +725,69 @@ ssl_iostream_context_init_common(struct ssl_iostream_context *ctx,
 	return ssl_iostream_context_set(ctx, set, error_r);
 }
 
+static int openssl_iostream_new_session(SSL *ssl, SSL_SESSION *session)
+{
+	struct ssl_iostream *ssl_io;
+	struct ssl_iostream_context *ctx;
+	SSL_SESSION *old_session;
+	char *key;
+
+	ssl_io = SSL_get_ex_data(ssl, dovecot_ssl_extdata_index);
+	if (ssl_io == NULL || ssl_io->session_key == NULL)
+		return 0;
+	ctx = ssl_io->ctx;
+
+	if (hash_table_lookup_full(ctx->client_sessions,
+				   ssl_io->session_key,
+				   &key, &old_session)) {
+		SSL_SESSION_free(old_session);
+		hash_table_update(ctx->client_sessions, key, session);
+	} else {
+		if (hash_table_count(ctx->client_sessions) >=
+		    OPENSSL_CLIENT_SESSION_CACHE_MAX_HOSTS)
+			return 0;
+		key = p_strdup(ctx->pool, ssl_io->session_key);
+		hash_table_insert(ctx->client_sessions, key, session);
+	}
+	/* we took the reference */
+	return 1;
+}
+
+void openssl_iostream_context_set_session(struct ssl_iostream_context *ctx,
+					  SSL *ssl, const char *session_key)
+{
+	SSL_SESSION *session;
+
+	if (!ctx->client_ctx || session_key == NULL)
+		return;
+	session = hash_table_lookup(ctx->client_sessions, session_key);
+	if (session == NULL)
+		return;
+
+	if (SSL_SESSION_get_time(session) +
+	    SSL_SESSION_get_timeout(session) <= ioloop_time) {
+		/* expired - it gets replaced once the full handshake
+		   gives us a new session */
+		return;
+	}
+	/* a failure just means a full handshake */
+	(void)SSL_set_session(ssl, session);
+}
+
+static void
+openssl_iostream_context_free_sessions(struct ssl_iostream_context *ctx)
+{
+	struct hash_iterate_context *iter;
+	SSL_SESSION *session;
+	char *key;
+
+	iter = hash_table_iterate_init(ctx->client_sessions);
+	while (hash_table_iterate(iter, ctx->client_sessions, &key, &session))
+		SSL_SESSION_free(session);
+	hash_table_iterate_deinit(&iter);
+	hash_table_destroy(&ctx->client_sessions);
+}
+
 int openssl_iostream_context_init_client(const struct ssl_iostream_settings *set,
 					 struct ssl_iostream_context **ctx_r,
 					 const char **error_r)
@@ -627,6 +810,13 @@ int openssl_iostream_context_init_client(const struct ssl_iostream_settings *set
 		ssl_iostream_context_unref(&ctx);
 		return -1;
 	}
+	/* cache the sessions ourself, so that reconnections to the same
+	   host:port can do abbreviated handshakes. */
+	hash_table_create(&ctx->client_sessions, ctx->pool, 0,
+			  str_hash, strcmp);
+	SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_CLIENT |
+				       SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(ssl_ctx, openssl_iostream_new_session);
 	*ctx_r = ctx;
 	return 0;
 }
@@ -667,6 +857,8 @@ void openssl_iostream_context_unref(struct ssl_iostream_context *ctx)
 	if (--ctx->refcount > 0)
 		return;
 
+	if (hash_table_is_created(ctx->client_sessions))
+		openssl_iostream_context_free_sessions(ctx);
 	SSL_CTX_free(ctx->ssl_ctx);
 	pool_unref(&ctx->pool);
 	i_free(ctx);
@@ -0,0 +1,324 @@
+/* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ostream-private.h"
+#include "iostream-openssl.h"
+
+#ifdef HAVE_OPENSSL_KTLS
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+
+#ifndef SOL_TLS
+#  define SOL_TLS 282
+#endif
+#ifndef TCP_ULP
+#  define TCP_ULP 31
+#endif
+
+/* OpenSSL-internal BIO controls (see the comment in openssl/bio.h). These
+   are what its socket BIO implements for kTLS: SET_KTLS gives the kernel
+   crypto info when the keys change, and SEND_CTRL_MSG tells the record
+   type of the next write when it's not application data. */
+#define OPENSSL_BIO_CTRL_SET_KTLS		72
+#define OPENSSL_BIO_CTRL_SET_KTLS_SEND_CTRL_MSG	74
+#define OPENSSL_BIO_CTRL_CLEAR_KTLS_CTRL_MSG	75
+
+static BIO_METHOD *ktls_bio_method = NULL;
+
+bool openssl_iostream_ktls_possible(struct ssl_iostream_context *ctx,
+				    struct ostream *plain_output)
+{
+	if (!ctx->set.ktls)
+		return FALSE;
+	/* The data written to the fd gets encrypted by the kernel, so there
+	   can't be any filter streams between us and the fd. */
+	return plain_output->real_stream->parent == NULL &&
+		o_stream_get_fd(plain_output) != -1;
+}
+
+bool openssl_iostream_ktls_send_direct(struct ssl_iostream *ssl_io)
+{
+	return ssl_io->ktls_send && ssl_io->handshaked &&
+		ssl_io->ktls_record_type == 0 && !SSL_want_write(ssl_io->ssl);
+}
+
+static void
+openssl_iostream_ktls_set_plain_error(struct ssl_iostream *ssl_io,
+				      int stream_errno, const char *error)
+{
+	i_free(ssl_io->plain_stream_errstr);
+	ssl_io->plain_stream_errstr = i_strdup(error);
+	ssl_io->plain_stream_errno = stream_errno;
+	ssl_io->closed = TRUE;
+	/* OpenSSL sees this as SSL_ERROR_SYSCALL */
+	errno = stream_errno;
+}
+
+static socklen_t
+openssl_iostream_ktls_crypto_info_size(const struct tls_crypto_info *info)
+{
+	/* OpenSSL's crypto info struct begins with the kernel's struct, but
+	   its total size depends on how OpenSSL was compiled. Get the size
+	   from the cipher type instead. */
+	switch (info->cipher_type) {
+#ifdef TLS_CIPHER_AES_GCM_128
+	case TLS_CIPHER_AES_GCM_128:
+		return sizeof(struct tls12_crypto_info_aes_gcm_128);
+#endif
+#ifdef TLS_CIPHER_AES_GCM_256
+	case TLS_CIPHER_AES_GCM_256:
+		return sizeof(struct tls12_crypto_info_aes_gcm_256);
+#endif
+#ifdef TLS_CIPHER_AES_CCM_128
+	case TLS_CIPHER_AES_CCM_128:
+		return sizeof(struct tls12_crypto_info_aes_ccm_128);
+#endif
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+	case TLS_CIPHER_CHACHA20_POLY1305:
+		return sizeof(struct tls12_crypto_info_chacha20_poly1305);
+#endif
+	}
+	return 0;
+}
+
+static int
+openssl_iostream_ktls_start(struct ssl_iostream *ssl_io,
+			    const struct tls_crypto_info *info)
+{
+	int fd = o_stream_get_fd(ssl_io->plain_output);
+	socklen_t size = openssl_iostream_ktls_crypto_info_size(info);
+
+	if (size == 0)
+		return 0;
+	if (setsockopt(fd, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) < 0 &&
+	    errno != EEXIST) {
+		/* not a TCP socket, tls kernel module not loaded, etc. */
+		if (ssl_io->verbose) {
+			i_debug("%skTLS not available: "
+				"setsockopt(TCP_ULP, tls) failed: %m",
+				ssl_io->log_prefix);
+		}
+		return 0;
+	}
+	if (setsockopt(fd, SOL_TLS, TLS_TX, info, size) < 0) {
+		if (ssl_io->verbose) {
+			i_debug("%skTLS not available: "
+				"setsockopt(TLS_TX) failed: %m",
+				ssl_io->log_prefix);
+		}
+		return 0;
+	}
+	if (ssl_io->verbose)
+		i_debug("%skTLS enabled for sending", ssl_io->log_prefix);
+	ssl_io->ktls_send = TRUE;
+	return 1;
+}
+
+static int openssl_iostream_ktls_flush_plain(struct ssl_iostream *ssl_io)
+{
+	struct ostream *plain_output = ssl_io->plain_output;
+
+	if (o_stream_get_buffer_used_size(plain_output) == 0)
+		return 1;
+	if (o_stream_flush(plain_output) < 0) {
+		openssl_iostream_ktls_set_plain_error(ssl_io,
+			plain_output->stream_errno,
+			o_stream_get_error(plain_output));
+		return -1;
+	}
+	if (o_stream_get_buffer_used_size(plain_output) == 0)
+		return 1;
+	o_stream_set_flush_pending(plain_output, TRUE);
+	return 0;
+}
+
+static ssize_t
+openssl_iostream_ktls_send_ctrl_msg(int fd, unsigned char record_type,
+				    const void *data, size_t size)
+{
+	char cbuf[CMSG_SPACE(sizeof(record_type))];
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+
+	i_zero(&msg);
+	memset(cbuf, 0, sizeof(cbuf));
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_TLS;
+	cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(record_type));
+	*CMSG_DATA(cmsg) = record_type;
+	msg.msg_controllen = cmsg->cmsg_len;
+
+	iov.iov_base = (void *)data;
+	iov.iov_len = size;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	return sendmsg(fd, &msg, 0);
+}
+
+static int
+openssl_iostream_ktls_write_ctrl_msg(BIO *bio, struct ssl_iostream *ssl_io,
+				     const char *data, size_t size)
+{
+	ssize_t ret;
+	int fd;
+
+	/* the control message must not get mixed with the data that is
+	   still buffered in plain_output */
+	if ((ret = openssl_iostream_ktls_flush_plain(ssl_io)) <= 0) {
+		if (ret == 0)
+			BIO_set_retry_write(bio);
+		return -1;
+	}
+
+	fd = o_stream_get_fd(ssl_io->plain_output);
+	ret = openssl_iostream_ktls_send_ctrl_msg(fd, ssl_io->ktls_record_type,
+						  data, size);
+	if (ret < 0) {
+		if (errno == EAGAIN) {
+			o_stream_set_flush_pending(ssl_io->plain_output, TRUE);
+			BIO_set_retry_write(bio);
+			return -1;
+		}
+		openssl_iostream_ktls_set_plain_error(ssl_io, errno,
+			t_strdup_printf("sendmsg(%s) failed: %m",
+					o_stream_get_name(ssl_io->plain_output)));
+		return -1;
+	}
+	ssl_io->ktls_record_type = 0;
+	return ret;
+}
+
+static int openssl_iostream_ktls_bio_write(BIO *bio, const char *data, int size)
+{
+	struct ssl_iostream *ssl_io = BIO_get_data(bio);
+	struct ostream *plain_output = ssl_io->plain_output;
+	size_t avail;
+	ssize_t ret;
+
+	BIO_clear_retry_flags(bio);
+	if (size <= 0)
+		return 0;
+	if (ssl_io->ktls_record_type != 0)
+		return openssl_iostream_ktls_write_ctrl_msg(bio, ssl_io, data, size);
+
+	avail = o_stream_get_buffer_avail_size(plain_output);
+	if (avail == 0) {
+		/* wait until output buffer clears */
+		o_stream_set_flush_pending(plain_output, TRUE);
+		BIO_set_retry_write(bio);
+		return -1;
+	}
+	if ((size_t)size > avail)
+		size = avail;
+	ret = o_stream_send(plain_output, data, size);
+	if (ret < 0) {
+		openssl_iostream_ktls_set_plain_error(ssl_io,
+			plain_output->stream_errno,
+			o_stream_get_error(plain_output));
+		return -1;
+	}
+	i_assert(ret == size);
+	return ret;
+}
+
+static long
+openssl_iostream_ktls_bio_ctrl(BIO *bio, int cmd, long num, void *ptr)
+{
+	struct ssl_iostream *ssl_io = BIO_get_data(bio);
+	int ret;
+
+	switch (cmd) {
+	case BIO_CTRL_FLUSH:
+		/* OpenSSL flushes before enabling kTLS, because the data that
+		   is already buffered mustn't be encrypted a second time. If
+		   the flush can't finish immediately kTLS isn't used. */
+		BIO_clear_retry_flags(bio);
+		if ((ret = openssl_iostream_ktls_flush_plain(ssl_io)) == 0)
+			BIO_set_retry_write(bio);
+		return ret > 0 ? 1 : 0;
+	case OPENSSL_BIO_CTRL_SET_KTLS:
+		/* only sending is offloaded - SSL_read() keeps using the
+		   BIO pair */
+		if (num == 0)
+			return 0;
+		return openssl_iostream_ktls_start(ssl_io, ptr);
+	case BIO_CTRL_GET_KTLS_SEND:
+		return ssl_io->ktls_send ? 1 : 0;
+	case OPENSSL_BIO_CTRL_SET_KTLS_SEND_CTRL_MSG:
+		ssl_io->ktls_record_type = num;
+		return 0;
+	case OPENSSL_BIO_CTRL_CLEAR_KTLS_CTRL_MSG:
+		ssl_io->ktls_record_type = 0;
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+static int openssl_iostream_ktls_bio_create_cb(BIO *bio)
+{
+	BIO_set_init(bio, 1);
+	return 1;
+}
+
+BIO *openssl_iostream_ktls_bio_create(struct ssl_iostream *ssl_io)
+{
+	BIO *bio;
+
+	if (ktls_bio_method == NULL) {
+		ktls_bio_method = BIO_meth_new(BIO_get_new_index() |
+					       BIO_TYPE_SOURCE_SINK,
+					       "dovecot kTLS");
+		if (ktls_bio_method == NULL)
+			return NULL;
+		(void)BIO_meth_set_write(ktls_bio_method,
+					 openssl_iostream_ktls_bio_write);
+		(void)BIO_meth_set_ctrl(ktls_bio_method,
+					openssl_iostream_ktls_bio_ctrl);
+		(void)BIO_meth_set_create(ktls_bio_method,
+					  openssl_iostream_ktls_bio_create_cb);
+	}
+	bio = BIO_new(ktls_bio_method);
+	if (bio == NULL)
+		return NULL;
+	BIO_set_data(bio, ssl_io);
+	return bio;
+}
+
+void openssl_iostream_ktls_deinit(void)
+{
+	if (ktls_bio_method != NULL) {
+		BIO_meth_free(ktls_bio_method);
+		ktls_bio_method = NULL;
+	}
+}
+
+#else
+
+bool openssl_iostream_ktls_possible(struct ssl_iostream_context *ctx ATTR_UNUSED,
+				    struct ostream *plain_output ATTR_UNUSED)
+{
+	return FALSE;
+}
+
+bool openssl_iostream_ktls_send_direct(struct ssl_iostream *ssl_io ATTR_UNUSED)
+{
+	return FALSE;
+}
+
+BIO *openssl_iostream_ktls_bio_create(struct ssl_iostream *ssl_io ATTR_UNUSED)
+{
+	i_unreached();
+}
+
+void openssl_iostream_ktls_deinit(void)
+{
+}
+
+#endif
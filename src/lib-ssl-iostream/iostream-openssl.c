@@ -1,6 +1,7 @@
 /* Copyright (c) 2009-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "net.h"
 #include "istream-private.h"
 #include "ostream-private.h"
 #include "iostream-openssl.h"
@@ -10,6 +11,23 @@
 
 static void openssl_iostream_free(struct ssl_iostream *ssl_io);
 
+static char *
+openssl_iostream_get_session_key(const char *host, struct ostream *output)
+{
+	struct ip_addr ip;
+	in_port_t port;
+	int fd;
+
+	if (host == NULL)
+		return NULL;
+	/* different ports on the same host may well be different servers
+	   (or at least different services), so they can't share sessions */
+	fd = o_stream_get_fd(output);
+	if (fd == -1 || net_getpeername(fd, &ip, &port) < 0)
+		port = 0;
+	return i_strdup_printf("%s:%u", host, port);
+}
+
 void openssl_iostream_set_error(struct ssl_iostream *ssl_io, const char *str)
 {
 	char *new_str;
@@ -289,14 +307,34 @@ openssl_iostream_create(struct ssl_iostream_context *ctx, const char *host,
 	ssl_io->plain_input = *input;
 	ssl_io->plain_output = *output;
 	ssl_io->connected_host = i_strdup(host);
+	ssl_io->session_key = openssl_iostream_get_session_key(host, *output);
 	ssl_io->log_prefix = host == NULL ? i_strdup("") :
 		i_strdup_printf("%s: ", host);
-	/* bio_int will be freed by SSL_free() */
-	SSL_set_bio(ssl_io->ssl, bio_int, bio_int);
+	if (openssl_iostream_ktls_possible(ctx, *output)) {
+		/* With kTLS the kernel must see the records being written,
+		   so the writes bypass the BIO pair. */
+		BIO *bio_ktls = openssl_iostream_ktls_bio_create(ssl_io);
+
+		if (bio_ktls == NULL) {
+			*error_r = t_strdup_printf("BIO_new() failed: %s",
+						   openssl_iostream_error());
+			BIO_free(bio_int);
+			openssl_iostream_free(ssl_io);
+			return -1;
+		}
+		/* bio_int and bio_ktls will be freed by SSL_free() */
+		SSL_set_bio(ssl_io->ssl, bio_int, bio_ktls);
+		ssl_io->ktls = TRUE;
+	} else {
+		/* bio_int will be freed by SSL_free() */
+		SSL_set_bio(ssl_io->ssl, bio_int, bio_int);
+	}
         SSL_set_ex_data(ssl_io->ssl, dovecot_ssl_extdata_index, ssl_io);
 #ifdef HAVE_SSL_GET_SERVERNAME
 	SSL_set_tlsext_host_name(ssl_io->ssl, host);
 #endif
+	openssl_iostream_context_set_session(ctx, ssl_io->ssl,
+					     ssl_io->session_key);
 
 	if (openssl_iostream_set(ssl_io, set, error_r) < 0) {
 		openssl_iostream_free(ssl_io);
@@ -332,6 +370,7 @@ static void openssl_iostream_free(struct ssl_iostream *ssl_io)
 	i_free(ssl_io->plain_stream_errstr);
 	i_free(ssl_io->last_error);
 	i_free(ssl_io->connected_host);
+	i_free(ssl_io->session_key);
 	i_free(ssl_io->sni_host);
 	i_free(ssl_io->log_prefix);
 	i_free(ssl_io);
@@ -562,7 +601,10 @@ int openssl_iostream_handle_error(struct ssl_iostream *ssl_io, int ret,
 	switch (err) {
 	case SSL_ERROR_WANT_WRITE:
 		if (!openssl_iostream_bio_sync(ssl_io, type)) {
-			if (type != OPENSSL_IOSTREAM_SYNC_TYPE_WRITE)
+			/* kTLS BIO may need to wait for plain_output to be
+			   flushed before it can write a control message */
+			if (type != OPENSSL_IOSTREAM_SYNC_TYPE_WRITE &&
+			    !ssl_io->ktls)
 				i_panic("SSL ostream buffer size not unlimited");
 			return 0;
 		}
@@ -919,5 +961,6 @@ void ssl_iostream_openssl_init(void)
 
 void ssl_iostream_openssl_deinit(void)
 {
+	openssl_iostream_ktls_deinit();
 	openssl_iostream_global_deinit();
 }
@@ -1,10 +1,16 @@
 #ifndef IOSTREAM_OPENSSL_H
 #define IOSTREAM_OPENSSL_H
 
+#include "hash.h"
 #include "iostream-ssl-private.h"
 
 #include <openssl/ssl.h>
 
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS) && \
+	defined(HAVE_LINUX_TLS_H)
+#  define HAVE_OPENSSL_KTLS
+#endif
+
 #ifndef HAVE_ASN1_STRING_GET0_DATA
 #  define ASN1_STRING_get0_data(str) ASN1_STRING_data(str)
 #endif
@@ -24,6 +30,11 @@ struct ssl_iostream_context {
 
 	int username_nid;
 
+	/* SSL clients: host:port => the latest session received from it. Since
+	   the contexts are shared via the context cache, all the connections
+	   using the same settings can resume each others' sessions. */
+	HASH_TABLE(char *, SSL_SESSION *) client_sessions;
+
 	bool client_ctx:1;
 };
 
@@ -41,6 +52,8 @@ struct ssl_iostream {
 
 	/* SSL clients: host where we connected to */
 	char *connected_host;
+	/* SSL clients: host:port used as the session cache key */
+	char *session_key;
 	/* SSL servers: host requested by the client via SNI */
 	char *sni_host;
 	char *last_error;
@@ -58,6 +71,9 @@ struct ssl_iostream {
 	ssl_iostream_sni_callback_t *sni_callback;
 	void *sni_context;
 
+	/* kTLS: record type for the next non-application data write */
+	unsigned char ktls_record_type;
+
 	bool handshaked:1;
 	bool handshake_failed:1;
 	bool cert_received:1;
@@ -66,6 +82,10 @@ struct ssl_iostream {
 	bool ostream_flush_waiting_input:1;
 	bool closed:1;
 	bool destroyed:1;
+	/* SSL's write BIO writes directly to plain_output (kTLS BIO) */
+	bool ktls:1;
+	/* kernel is encrypting everything written to plain_output */
+	bool ktls_send:1;
 };
 
 extern int dovecot_ssl_extdata_index;
@@ -83,6 +103,10 @@ int openssl_iostream_context_init_server(const struct ssl_iostream_settings *set
 					 struct ssl_iostream_context **ctx_r,
 					 const char **error_r);
 void openssl_iostream_context_ref(struct ssl_iostream_context *ctx);
+/* Set the session to resume for a new client connection to the host:port
+   session key, if the context has one cached. */
+void openssl_iostream_context_set_session(struct ssl_iostream_context *ctx,
+					  SSL *ssl, const char *session_key);
 void openssl_iostream_context_unref(struct ssl_iostream_context *ctx);
 void openssl_iostream_global_deinit(void);
 
@@ -98,6 +122,17 @@ bool openssl_cert_match_name(SSL *ssl, const char *verify_name,
 int openssl_min_protocol_to_options(const char *min_protocol, long *opt_r,
 				    int *version_r) ATTR_NULL(2,3);
 
+/* Returns TRUE if kTLS could be used for the given plain_output. */
+bool openssl_iostream_ktls_possible(struct ssl_iostream_context *ctx,
+				    struct ostream *plain_output);
+/* Create a write BIO that writes directly to ssl_io->plain_output and
+   supports handing the session keys to kernel. */
+BIO *openssl_iostream_ktls_bio_create(struct ssl_iostream *ssl_io);
+/* Returns TRUE if data can be written directly to plain_output, because
+   kernel encrypts it and OpenSSL has nothing pending. */
+bool openssl_iostream_ktls_send_direct(struct ssl_iostream *ssl_io);
+void openssl_iostream_ktls_deinit(void);
+
 /* Sync plain_input/plain_output streams with BIOs. Returns TRUE if at least
    one byte was read/written. */
 bool openssl_iostream_bio_sync(struct ssl_iostream *ssl_io,
@@ -21,6 +21,7 @@ static const size_t ssl_iostream_settings_string_offsets[] = {
 	OFFSET(dh),
 	OFFSET(cert_username_field),
 	OFFSET(crypto_device),
+	OFFSET(ticket_key),
 };
 
 static bool ssl_module_loaded = FALSE;
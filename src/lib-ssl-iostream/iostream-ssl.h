@@ -25,6 +25,8 @@ struct ssl_iostream_settings {
 	const char *dh; /* context-only */
 	const char *cert_username_field; /* both */
 	const char *crypto_device; /* context-only */
+	/* secret that the session ticket keys are derived from */
+	const char *ticket_key; /* context-only */
 
 	bool verbose, verbose_invalid_cert; /* stream-only */
 	bool skip_crl_check; /* context-only */
@@ -33,6 +35,7 @@ struct ssl_iostream_settings {
 	bool prefer_server_ciphers; /* both */
 	bool compression; /* context-only */
 	bool tickets; /* context-only */
+	bool ktls; /* context-only */
 };
 
 /* Load SSL module */
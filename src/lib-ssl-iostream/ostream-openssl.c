@@ -156,12 +156,41 @@ static int o_stream_ssl_flush(struct ostream_private *stream)
 	return o_stream_get_buffer_used_size(plain_output) == 0 ? 1 : 0;
 }
 
+static bool o_stream_ssl_ktls_direct(struct ssl_ostream *sstream)
+{
+	/* With kTLS the kernel encrypts everything written to plain_output.
+	   Once OpenSSL has nothing pending, bypass it completely. */
+	return (sstream->buffer == NULL || sstream->buffer->used == 0) &&
+		openssl_iostream_ktls_send_direct(sstream->ssl_io);
+}
+
+static void o_stream_ssl_copy_plain_error(struct ssl_ostream *sstream)
+{
+	struct ostream *plain_output = sstream->ssl_io->plain_output;
+
+	io_stream_set_error(&sstream->ostream.iostream, "%s",
+			    o_stream_get_error(plain_output));
+	sstream->ostream.ostream.stream_errno = plain_output->stream_errno;
+}
+
 static ssize_t
 o_stream_ssl_sendv(struct ostream_private *stream,
 		   const struct const_iovec *iov, unsigned int iov_count)
 {
 	struct ssl_ostream *sstream = (struct ssl_ostream *)stream;
 	size_t bytes_sent = 0;
+	ssize_t ret;
+
+	if (o_stream_ssl_ktls_direct(sstream)) {
+		ret = o_stream_sendv(sstream->ssl_io->plain_output,
+				     iov, iov_count);
+		if (ret < 0) {
+			o_stream_ssl_copy_plain_error(sstream);
+			return -1;
+		}
+		stream->ostream.offset += ret;
+		return ret;
+	}
 
 	bytes_sent = o_stream_ssl_buffer(sstream, iov, iov_count, bytes_sent);
 	if (sstream->ssl_io->handshaked &&
@@ -174,6 +203,25 @@ o_stream_ssl_sendv(struct ostream_private *stream,
 	return bytes_sent;
 }
 
+static enum ostream_send_istream_result
+o_stream_ssl_send_istream(struct ostream_private *outstream,
+			  struct istream *instream)
+{
+	struct ssl_ostream *sstream = (struct ssl_ostream *)outstream;
+	enum ostream_send_istream_result res;
+	uoff_t old_offset = instream->v_offset;
+
+	if (!o_stream_ssl_ktls_direct(sstream))
+		return io_stream_copy(&outstream->ostream, instream);
+
+	/* this allows plain_output to use sendfile() */
+	res = o_stream_send_istream(sstream->ssl_io->plain_output, instream);
+	outstream->ostream.offset += instream->v_offset - old_offset;
+	if (res == OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT)
+		o_stream_ssl_copy_plain_error(sstream);
+	return res;
+}
+
 static void o_stream_ssl_switch_ioloop_to(struct ostream_private *stream,
 					  struct ioloop *ioloop)
 {
@@ -264,6 +312,7 @@ struct ostream *openssl_o_stream_create_ssl(struct ssl_iostream *ssl_io)
 	sstream->ostream.iostream.destroy = o_stream_ssl_destroy;
 	sstream->ostream.sendv = o_stream_ssl_sendv;
 	sstream->ostream.flush = o_stream_ssl_flush;
+	sstream->ostream.send_istream = o_stream_ssl_send_istream;
 	sstream->ostream.switch_ioloop_to = o_stream_ssl_switch_ioloop_to;
 
 	sstream->ostream.get_buffer_used_size =
@@ -0,0 +1,581 @@
+/* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "str.h"
+#include "strnum.h"
+#include "istream.h"
+#include "randgen.h"
+#include "hex-binary.h"
+#include "path-util.h"
+#include "mkdir-parents.h"
+#include "unlink-directory.h"
+#include "stats-dist.h"
+#include "time-util.h"
+#include "settings-parser.h"
+#include "master-service.h"
+#include "mail-storage-service.h"
+#include "mail-search-build.h"
+#include "mail-storage-private.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+/* Storage benchmark. For each mail location driver a new user is created
+   and its INBOX is filled with generated messages. Then the messages are
+   fetched, the mailbox is searched and finally the messages are expunged.
+   Each save, fetch and expunge is its own operation, and each search is one
+   operation over the whole mailbox. The mailbox is closed and reopened
+   between the phases, so the fetches and searches don't use the mailbox's
+   in-memory state left by the earlier phases. The kernel's page cache is
+   still warm though.
+
+   The message sizes are picked randomly from the -s list, so a list such as
+   "2k,2k,2k,8k,8k,64k,1M" gives a rough size distribution. Extra userdb
+   fields can be given with -e, e.g. "-e mail_plugins=zlib
+   -e plugin/zlib_save=gz" or "-e mail_attachment_dir=/tmp/att". */
+
+#define BENCH_STORAGE_DEFAULT_DRIVERS "maildir", "sdbox", "mdbox"
+#define BENCH_STORAGE_DEFAULT_MSG_COUNT 1000
+#define BENCH_STORAGE_DEFAULT_SEARCH_COUNT 20
+#define BENCH_STORAGE_DEFAULT_MSG_SIZES "4k"
+/* The messages' subjects and bodies contain one of this many tokens, which
+   the searches then look for. */
+#define BENCH_STORAGE_TOKEN_COUNT 10
+
+enum bench_storage_op {
+	BENCH_STORAGE_OP_SAVE,
+	BENCH_STORAGE_OP_FETCH,
+	BENCH_STORAGE_OP_SEARCH,
+	BENCH_STORAGE_OP_EXPUNGE,
+
+	BENCH_STORAGE_OP_COUNT
+};
+
+static const char *bench_storage_op_names[BENCH_STORAGE_OP_COUNT] = {
+	"save", "fetch", "search", "expunge"
+};
+
+struct bench_storage_op_result {
+	/* operation latencies in microseconds */
+	struct stats_dist *latency;
+	uoff_t bytes;
+	unsigned int failures;
+};
+
+struct bench_storage_user {
+	const char *driver;
+	const char *home;
+	struct mail_storage_service_user *service_user;
+	struct mail_user *user;
+
+	struct bench_storage_op_result results[BENCH_STORAGE_OP_COUNT];
+};
+
+static struct mail_storage_service_ctx *storage_service;
+static const char *bench_dir;
+static ARRAY_TYPE(const_string) extra_fields;
+static ARRAY(uoff_t) msg_sizes;
+static unsigned int msg_count = BENCH_STORAGE_DEFAULT_MSG_COUNT;
+static unsigned int search_count = BENCH_STORAGE_DEFAULT_SEARCH_COUNT;
+static bool keep_dirs = FALSE;
+
+static const char *const bench_storage_words[] = {
+	"the", "of", "and", "mailbox", "message", "server", "storage",
+	"index", "cache", "folder", "about", "meeting", "tomorrow", "report",
+	"please", "attached", "thanks", "regards", "quarterly", "numbers"
+};
+
+static void bench_storage_msg_sizes_parse(const char *str)
+{
+	const char *const *sizes, *error;
+	uoff_t size;
+
+	array_clear(&msg_sizes);
+	for (sizes = t_strsplit(str, ","); *sizes != NULL; sizes++) {
+		if (settings_get_size(*sizes, &size, &error) < 0)
+			i_fatal("Invalid -s parameter: %s", error);
+		array_push_back(&msg_sizes, &size);
+	}
+}
+
+static void bench_storage_msg_generate(string_t *str, unsigned int msgnum)
+{
+	const uoff_t *sizes;
+	unsigned int count, line_len = 0;
+	const char *word;
+	uoff_t size;
+
+	sizes = array_get(&msg_sizes, &count);
+	size = sizes[i_rand_limit(count)];
+
+	str_truncate(str, 0);
+	str_printfa(str, "From: sender%u@example.com\r\n"
+		    "To: bench@example.com\r\n"
+		    "Subject: Benchmark message %u subjtoken%u\r\n"
+		    "Date: Mon, 1 Apr 2019 12:00:00 +0000\r\n"
+		    "Message-ID: <bench-%u@example.com>\r\n"
+		    "\r\n"
+		    "bodytoken%u\r\n",
+		    msgnum % 100, msgnum, msgnum % BENCH_STORAGE_TOKEN_COUNT,
+		    msgnum, msgnum % BENCH_STORAGE_TOKEN_COUNT);
+	while (str_len(str) < size) {
+		word = bench_storage_words[i_rand_limit(
+			N_ELEMENTS(bench_storage_words))];
+		str_append(str, word);
+		line_len += strlen(word) + 1;
+		if (line_len < 72)
+			str_append_c(str, ' ');
+		else {
+			str_append(str, "\r\n");
+			line_len = 0;
+		}
+	}
+	str_append(str, "\r\n");
+}
+
+static long long bench_storage_usecs_since(const struct timeval *start)
+{
+	struct timeval now;
+
+	if (gettimeofday(&now, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	return timeval_diff_usecs(&now, start);
+}
+
+static void
+bench_storage_op_add(struct bench_storage_user *buser,
+		     enum bench_storage_op op, const struct timeval *start,
+		     uoff_t bytes)
+{
+	struct bench_storage_op_result *result = &buser->results[op];
+	long long usecs = bench_storage_usecs_since(start);
+
+	stats_dist_add(result->latency, I_MAX(usecs, 0));
+	result->bytes += bytes;
+}
+
+static void
+bench_storage_op_failed(struct bench_storage_user *buser,
+			enum bench_storage_op op, struct mailbox *box)
+{
+	buser->results[op].failures++;
+	i_error("%s: %s failed: %s", buser->driver,
+		bench_storage_op_names[op],
+		mailbox_get_last_internal_error(box, NULL));
+}
+
+static struct mailbox *bench_storage_open(struct bench_storage_user *buser)
+{
+	struct mail_namespace *ns;
+	struct mailbox *box;
+
+	ns = mail_namespace_find_inbox(buser->user->namespaces);
+	box = mailbox_alloc(ns->list, "INBOX", 0);
+	if (mailbox_open(box) < 0 ||
+	    mailbox_sync(box, 0) < 0) {
+		i_fatal("%s: Failed to open INBOX: %s", buser->driver,
+			mailbox_get_last_internal_error(box, NULL));
+	}
+	return box;
+}
+
+static int bench_storage_save_one(struct mailbox *box, const string_t *msg)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail_save_context *save_ctx;
+	struct istream *input;
+	ssize_t ret;
+
+	input = i_stream_create_from_data(str_data(msg), str_len(msg));
+	trans = mailbox_transaction_begin(box, MAILBOX_TRANSACTION_FLAG_EXTERNAL,
+					  __func__);
+	save_ctx = mailbox_save_alloc(trans);
+	if (mailbox_save_begin(&save_ctx, input) < 0) {
+		mailbox_transaction_rollback(&trans);
+		i_stream_unref(&input);
+		return -1;
+	}
+	do {
+		if (mailbox_save_continue(save_ctx) < 0)
+			break;
+	} while ((ret = i_stream_read(input)) > 0);
+
+	if (!input->eof || mailbox_save_finish(&save_ctx) < 0 ||
+	    mailbox_transaction_commit(&trans) < 0)
+		ret = -1;
+	else
+		ret = 0;
+	if (save_ctx != NULL)
+		mailbox_save_cancel(&save_ctx);
+	if (trans != NULL)
+		mailbox_transaction_rollback(&trans);
+	i_stream_unref(&input);
+	return ret < 0 ? -1 : 0;
+}
+
+static void bench_storage_save(struct bench_storage_user *buser)
+{
+	struct mailbox *box;
+	struct timeval start;
+	string_t *msg = str_new(default_pool, 8192);
+	unsigned int i;
+
+	box = bench_storage_open(buser);
+	for (i = 0; i < msg_count; i++) T_BEGIN {
+		bench_storage_msg_generate(msg, i);
+		if (gettimeofday(&start, NULL) < 0)
+			i_fatal("gettimeofday() failed: %m");
+		if (bench_storage_save_one(box, msg) < 0) {
+			bench_storage_op_failed(buser, BENCH_STORAGE_OP_SAVE,
+						box);
+		} else {
+			bench_storage_op_add(buser, BENCH_STORAGE_OP_SAVE,
+					     &start, str_len(msg));
+		}
+	} T_END;
+	mailbox_free(&box);
+	str_free(&msg);
+}
+
+static int bench_storage_fetch_one(struct mail *mail, uoff_t *size_r)
+{
+	struct istream *input;
+	const unsigned char *data;
+	size_t size;
+
+	*size_r = 0;
+	if (mail_get_stream(mail, NULL, NULL, &input) < 0)
+		return -1;
+	while (i_stream_read_more(input, &data, &size) > 0) {
+		*size_r += size;
+		i_stream_skip(input, size);
+	}
+	return input->stream_errno != 0 ? -1 : 0;
+}
+
+static void bench_storage_fetch(struct bench_storage_user *buser)
+{
+	struct mailbox *box;
+	struct mailbox_transaction_context *trans;
+	struct mail *mail;
+	struct timeval start;
+	uint32_t seq, count;
+	uoff_t size;
+
+	box = bench_storage_open(buser);
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	mail = mail_alloc(trans, 0, NULL);
+	count = mail_index_view_get_messages_count(box->view);
+	for (seq = 1; seq <= count; seq++) T_BEGIN {
+		if (gettimeofday(&start, NULL) < 0)
+			i_fatal("gettimeofday() failed: %m");
+		mail_set_seq(mail, seq);
+		if (bench_storage_fetch_one(mail, &size) < 0) {
+			bench_storage_op_failed(buser, BENCH_STORAGE_OP_FETCH,
+						box);
+		} else {
+			bench_storage_op_add(buser, BENCH_STORAGE_OP_FETCH,
+					     &start, size);
+		}
+	} T_END;
+	mail_free(&mail);
+	(void)mailbox_transaction_commit(&trans);
+	mailbox_free(&box);
+}
+
+static int bench_storage_search_one(struct mailbox *box, unsigned int i)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail_search_args *search_args;
+	struct mail_search_arg *sarg;
+	struct mail_search_context *ctx;
+	struct mail *mail;
+	int ret;
+
+	/* alternate between header and body searches */
+	search_args = mail_search_build_init();
+	if (i % 2 == 0) {
+		sarg = mail_search_build_add(search_args, SEARCH_HEADER);
+		sarg->hdr_field_name = p_strdup(search_args->pool, "Subject");
+		sarg->value.str = p_strdup_printf(search_args->pool,
+			"subjtoken%u", i_rand_limit(BENCH_STORAGE_TOKEN_COUNT));
+	} else {
+		sarg = mail_search_build_add(search_args, SEARCH_BODY);
+		sarg->value.str = p_strdup_printf(search_args->pool,
+			"bodytoken%u", i_rand_limit(BENCH_STORAGE_TOKEN_COUNT));
+	}
+	mail_search_args_init(search_args, box, TRUE, NULL);
+
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	ctx = mailbox_search_init(trans, search_args, NULL, 0, NULL);
+	mail_search_args_unref(&search_args);
+	while (mailbox_search_next(ctx, &mail)) ;
+	ret = mailbox_search_deinit(&ctx);
+	(void)mailbox_transaction_commit(&trans);
+	return ret;
+}
+
+static void bench_storage_search(struct bench_storage_user *buser)
+{
+	struct mailbox *box;
+	struct timeval start;
+	unsigned int i;
+	/* each search goes through the whole mailbox */
+	uoff_t size = buser->results[BENCH_STORAGE_OP_SAVE].bytes;
+
+	box = bench_storage_open(buser);
+	for (i = 0; i < search_count; i++) T_BEGIN {
+		if (gettimeofday(&start, NULL) < 0)
+			i_fatal("gettimeofday() failed: %m");
+		if (bench_storage_search_one(box, i) < 0) {
+			bench_storage_op_failed(buser, BENCH_STORAGE_OP_SEARCH,
+						box);
+		} else {
+			bench_storage_op_add(buser, BENCH_STORAGE_OP_SEARCH,
+					     &start, size);
+		}
+	} T_END;
+	mailbox_free(&box);
+}
+
+static void bench_storage_expunge(struct bench_storage_user *buser)
+{
+	struct mailbox *box;
+	struct mailbox_transaction_context *trans;
+	struct mail *mail;
+	struct timeval start;
+	uint32_t count;
+
+	box = bench_storage_open(buser);
+	count = mail_index_view_get_messages_count(box->view);
+	for (; count > 0; count--) T_BEGIN {
+		if (gettimeofday(&start, NULL) < 0)
+			i_fatal("gettimeofday() failed: %m");
+		/* like IMAP, expunge the first message and sync it away
+		   before moving on to the next one */
+		trans = mailbox_transaction_begin(box, 0, __func__);
+		mail = mail_alloc(trans, 0, NULL);
+		mail_set_seq(mail, 1);
+		mail_expunge(mail);
+		mail_free(&mail);
+		if (mailbox_transaction_commit(&trans) < 0 ||
+		    mailbox_sync(box, MAILBOX_SYNC_FLAG_EXPUNGE) < 0) {
+			bench_storage_op_failed(buser,
+						BENCH_STORAGE_OP_EXPUNGE, box);
+		} else {
+			bench_storage_op_add(buser, BENCH_STORAGE_OP_EXPUNGE,
+					     &start, 0);
+		}
+	} T_END;
+	mailbox_free(&box);
+}
+
+static void bench_storage_print_header(void)
+{
+	printf("%-8s %-8s %8s %7s %10s %10s %9s %9s %9s %9s\n",
+	       "driver", "op", "count", "failed", "ops/s", "MB/s",
+	       "p50 ms", "p90 ms", "p99 ms", "max ms");
+}
+
+static void bench_storage_print_results(struct bench_storage_user *buser)
+{
+	const struct bench_storage_op_result *result;
+	unsigned int op, count;
+	uint64_t usecs;
+
+	for (op = 0; op < BENCH_STORAGE_OP_COUNT; op++) {
+		result = &buser->results[op];
+		count = stats_dist_get_count(result->latency);
+		printf("%-8s %-8s %8u %7u", buser->driver,
+		       bench_storage_op_names[op], count, result->failures);
+		usecs = stats_dist_get_sum(result->latency);
+		if (count == 0 || usecs == 0) {
+			printf("\n");
+			continue;
+		}
+		printf(" %10.1f", count * 1000000.0 / usecs);
+		/* bytes per microsecond is MB/s */
+		if (result->bytes == 0)
+			printf(" %10s", "-");
+		else
+			printf(" %10.2f", result->bytes / (double)usecs);
+		printf(" %9.3f %9.3f %9.3f %9.3f\n",
+		       stats_dist_get_percentile(result->latency, 0.50) / 1000.0,
+		       stats_dist_get_percentile(result->latency, 0.90) / 1000.0,
+		       stats_dist_get_percentile(result->latency, 0.99) / 1000.0,
+		       stats_dist_get_max(result->latency) / 1000.0);
+	}
+	fflush(stdout);
+}
+
+static void bench_storage_user_init(struct bench_storage_user *buser)
+{
+	ARRAY_TYPE(const_string) fields;
+	const char *error, *username, *home, *field;
+	unsigned int op;
+
+	username = t_strconcat("bench-", buser->driver, NULL);
+	home = t_strconcat(bench_dir, "/", username, NULL);
+	/* start from an empty mailbox */
+	if (unlink_directory(home, UNLINK_DIRECTORY_FLAG_RMDIR, &error) < 0 &&
+	    errno != ENOENT)
+		i_fatal("unlink_directory(%s) failed: %s", home, error);
+	if (mkdir_parents(home, S_IRWXU) < 0)
+		i_fatal("mkdir_parents(%s) failed: %m", home);
+	buser->home = home;
+
+	t_array_init(&fields, 8);
+	field = t_strdup_printf("mail=%s:~/mail", buser->driver);
+	array_push_back(&fields, &field);
+	field = t_strconcat("home=", home, NULL);
+	array_push_back(&fields, &field);
+	array_append_array(&fields, &extra_fields);
+	array_append_zero(&fields);
+
+	struct mail_storage_service_input input = {
+		.userdb_fields = array_front(&fields),
+		.username = username,
+		.no_userdb_lookup = TRUE,
+	};
+	if (mail_storage_service_lookup_next(storage_service, &input,
+					     &buser->service_user,
+					     &buser->user, &error) < 0) {
+		i_fatal("mail_storage_service_lookup_next(%s) failed: %s",
+			username, error);
+	}
+	for (op = 0; op < BENCH_STORAGE_OP_COUNT; op++)
+		buser->results[op].latency = stats_dist_init_sketch();
+}
+
+static void bench_storage_user_deinit(struct bench_storage_user *buser)
+{
+	const char *error;
+	unsigned int op;
+
+	mail_user_unref(&buser->user);
+	mail_storage_service_user_unref(&buser->service_user);
+	for (op = 0; op < BENCH_STORAGE_OP_COUNT; op++)
+		stats_dist_deinit(&buser->results[op].latency);
+
+	/* the storage service chdir()ed to the home directory */
+	if (chdir(bench_dir) < 0)
+		i_fatal("chdir(%s) failed: %m", bench_dir);
+	if (!keep_dirs &&
+	    unlink_directory(buser->home, UNLINK_DIRECTORY_FLAG_RMDIR,
+			     &error) < 0)
+		i_error("unlink_directory(%s) failed: %s", buser->home, error);
+}
+
+static void bench_storage_run(const char *driver)
+{
+	struct bench_storage_user buser;
+
+	i_zero(&buser);
+	buser.driver = driver;
+	bench_storage_user_init(&buser);
+
+	bench_storage_save(&buser);
+	bench_storage_fetch(&buser);
+	bench_storage_search(&buser);
+	bench_storage_expunge(&buser);
+
+	bench_storage_print_results(&buser);
+	bench_storage_user_deinit(&buser);
+}
+
+static const char *bench_storage_dir_get(const char *dir)
+{
+	const char *path, *error;
+	unsigned char rand[4];
+
+	if (dir == NULL) {
+		random_fill(rand, sizeof(rand));
+		dir = t_strconcat(".bench-storage-",
+				  binary_to_hex(rand, sizeof(rand)), NULL);
+	}
+	/* the storage service changes the working directory */
+	if (t_abspath(dir, &path, &error) < 0)
+		i_fatal("t_abspath(%s) failed: %s", dir, error);
+	return path;
+}
+
+int main(int argc, char *argv[])
+{
+	const enum master_service_flags service_flags =
+		MASTER_SERVICE_FLAG_STANDALONE |
+		MASTER_SERVICE_FLAG_DONT_SEND_STATS |
+		MASTER_SERVICE_FLAG_NO_CONFIG_SETTINGS |
+		MASTER_SERVICE_FLAG_NO_SSL_INIT;
+	static const char *const default_drivers[] = {
+		BENCH_STORAGE_DEFAULT_DRIVERS, NULL
+	};
+	const char *const *drivers;
+	bool dir_created;
+	int c;
+
+	master_service = master_service_init("bench-storage", service_flags,
+					     &argc, &argv, "d:n:q:s:e:K");
+	i_array_init(&extra_fields, 8);
+	i_array_init(&msg_sizes, 8);
+	bench_storage_msg_sizes_parse(BENCH_STORAGE_DEFAULT_MSG_SIZES);
+	while ((c = master_getopt(master_service)) > 0) {
+		switch (c) {
+		case 'd':
+			bench_dir = optarg;
+			break;
+		case 'n':
+			if (str_to_uint(optarg, &msg_count) < 0)
+				i_fatal("Invalid -n parameter: %s", optarg);
+			break;
+		case 'q':
+			if (str_to_uint(optarg, &search_count) < 0)
+				i_fatal("Invalid -q parameter: %s", optarg);
+			break;
+		case 's':
+			bench_storage_msg_sizes_parse(optarg);
+			break;
+		case 'e':
+			if (strchr(optarg, '=') == NULL)
+				i_fatal("Invalid -e parameter: %s", optarg);
+			array_push_back(&extra_fields, (const char **)&optarg);
+			break;
+		case 'K':
+			keep_dirs = TRUE;
+			break;
+		default:
+			i_fatal("Usage: bench-storage [-d <dir>] "
+				"[-n <messages>] [-q <searches>] "
+				"[-s <size>[,<size>...]] [-e <key>=<value>] "
+				"[-K] [<driver> ...]");
+		}
+	}
+	drivers = argv[optind] != NULL ?
+		(const char *const *)argv + optind : default_drivers;
+
+	master_service_init_log(master_service, "bench-storage: ");
+	master_service_init_finish(master_service);
+
+	dir_created = bench_dir == NULL;
+	bench_dir = bench_storage_dir_get(bench_dir);
+	storage_service = mail_storage_service_init(master_service, NULL,
+		MAIL_STORAGE_SERVICE_FLAG_NO_RESTRICT_ACCESS |
+		MAIL_STORAGE_SERVICE_FLAG_NO_LOG_INIT);
+
+	printf("%u messages, %u searches\n", msg_count, search_count);
+	bench_storage_print_header();
+	for (; *drivers != NULL; drivers++) T_BEGIN {
+		bench_storage_run(*drivers);
+	} T_END;
+
+	mail_storage_service_deinit(&storage_service);
+
+	if (dir_created && !keep_dirs && rmdir(bench_dir) < 0)
+		i_error("rmdir(%s) failed: %m", bench_dir);
+	array_free(&extra_fields);
+	array_free(&msg_sizes);
+	master_service_deinit(&master_service);
+	return 0;
+}
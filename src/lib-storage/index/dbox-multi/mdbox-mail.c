@@ -11,6 +11,7 @@
 #include "mdbox-map.h"
 #include "mdbox-file.h"
 
+#include <fcntl.h>
 #include <sys/stat.h>
 
 int mdbox_mail_lookup(struct mdbox_mailbox *mbox, struct mail_index_view *view,
@@ -147,6 +148,50 @@ int mdbox_mail_open(struct dbox_mail *mail, uoff_t *offset_r,
 	return 0;
 }
 
+static bool mdbox_mail_prefetch(struct mail *_mail)
+{
+	struct dbox_mail *mail = DBOX_MAIL(_mail);
+/* HAVE_POSIX_FADVISE alone isn't enough for CentOS 4.9 */
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_WILLNEED)
+	struct mdbox_mailbox *mbox = MDBOX_MAILBOX(_mail->box);
+	struct mdbox_map_mail_index_record rec;
+	struct dbox_file *file;
+	uint32_t map_uid;
+	uint16_t refcount;
+	uoff_t offset;
+	off_t len;
+
+	if (mail->imail.data.access_part == 0 || _mail->saving ||
+	    _mail->lookup_abort != MAIL_LOOKUP_ABORT_NEVER) {
+		/* everything we need is cached */
+		return TRUE;
+	}
+
+	/* The mail's location and size are in the map index, so nothing
+	   needs to be read from the m.* file yet. Errors are handled later
+	   when the mail is actually accessed. */
+	if (mdbox_mail_lookup(mbox, _mail->transaction->view, _mail->seq,
+			      &map_uid) < 0)
+		return TRUE;
+	if (mdbox_map_lookup_full(mbox->storage->map, map_uid,
+				  &rec, &refcount) <= 0)
+		return TRUE;
+	if (mdbox_mail_open(mail, &offset, &file) < 0)
+		return TRUE;
+
+	/* tell OS to start reading this mail's part of the file into
+	   memory */
+	if ((mail->imail.data.access_part & (READ_BODY | PARSE_BODY)) != 0)
+		len = rec.size;
+	else
+		len = I_MIN(rec.size, MAIL_READ_HDR_BLOCK_SIZE);
+	if (posix_fadvise(file->fd, offset, len, POSIX_FADV_WILLNEED) < 0)
+		i_error("posix_fadvise(%s) failed: %m", file->cur_path);
+	mail->imail.data.prefetch_sent = TRUE;
+#endif
+	return !mail->imail.data.prefetch_sent;
+}
+
 static int mdbox_mail_get_save_date(struct mail *mail, time_t *date_r)
 {
 	struct mdbox_mailbox *mbox = MDBOX_MAILBOX(mail->transaction->box);
@@ -228,7 +273,7 @@ struct mail_vfuncs mdbox_mail_vfuncs = {
 	index_mail_set_seq,
 	index_mail_set_uid,
 	index_mail_set_uid_cache_updates,
-	index_mail_prefetch,
+	mdbox_mail_prefetch,
 	index_mail_precache,
 	index_mail_add_temp_wanted_fields,
 
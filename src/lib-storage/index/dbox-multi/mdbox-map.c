@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "array.h"
 #include "hash.h"
+#include "sort.h"
 #include "ostream.h"
 #include "mkdir-parents.h"
 #include "unlink-old-files.h"
@@ -684,16 +685,27 @@ int mdbox_map_update_refcount(struct mdbox_map_transaction_context *ctx,
 int mdbox_map_update_refcounts(struct mdbox_map_transaction_context *ctx,
 			       const ARRAY_TYPE(uint32_t) *map_uids, int diff)
 {
-	const uint32_t *uidp;
-	unsigned int i, count;
+	ARRAY_TYPE(uint32_t) sorted_uids;
+	const uint32_t *uids;
+	unsigned int i, j, count;
 
 	if (unlikely(ctx->trans == NULL))
 		return -1;
 
+	/* Update the refcounts in map UID order. This keeps the map
+	   transaction's atomic increments appending to the end of their
+	   array instead of inserting into the middle of it. The same map UID
+	   may also be listed multiple times, which needs only one update. */
 	count = array_count(map_uids);
-	for (i = 0; i < count; i++) {
-		uidp = array_idx(map_uids, i);
-		if (mdbox_map_update_refcount(ctx, *uidp, diff) < 0)
+	t_array_init(&sorted_uids, count);
+	array_append_array(&sorted_uids, map_uids);
+	array_sort(&sorted_uids, uint32_cmp);
+
+	uids = array_front(&sorted_uids);
+	for (i = 0; i < count; i = j) {
+		for (j = i + 1; j < count && uids[j] == uids[i]; j++) ;
+		if (mdbox_map_update_refcount(ctx, uids[i],
+					      diff * (int)(j - i)) < 0)
 			return -1;
 	}
 	return 0;
@@ -6,6 +6,7 @@
 #include "ostream.h"
 #include "str.h"
 #include "hash.h"
+#include "time-util.h"
 #include "dbox-attachment.h"
 #include "mdbox-storage.h"
 #include "mdbox-storage-rebuild.h"
@@ -14,6 +15,7 @@
 #include "mdbox-sync.h"
 
 #include <dirent.h>
+#include <time.h>
 
 /*
    Altmoving works like:
@@ -48,6 +50,10 @@ struct mdbox_purge_context {
 
 	struct mdbox_map_atomic_context *atomic;
 	struct mdbox_map_append_context *append_ctx;
+
+	/* for mdbox_purge_max_rate */
+	struct timeval start_time;
+	uoff_t copied_size;
 };
 
 static int mdbox_map_file_msg_offset_cmp(const struct mdbox_map_file_msg *m1,
@@ -234,6 +240,30 @@ mdbox_purge_save_msg(struct mdbox_purge_context *ctx, struct dbox_file *file,
 	return ret;
 }
 
+static void mdbox_purge_throttle(struct mdbox_purge_context *ctx, uoff_t size)
+{
+	uoff_t max_rate = ctx->storage->set->mdbox_purge_max_rate;
+	struct timeval now;
+	struct timespec ts;
+	long long wait_msecs;
+
+	if (max_rate == 0)
+		return;
+
+	/* The map isn't locked while copying, so sleeping here blocks only
+	   the access to this file. */
+	ctx->copied_size += size;
+	if (gettimeofday(&now, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	wait_msecs = (long long)(ctx->copied_size * 1000 / max_rate) -
+		timeval_diff_msecs(&now, &ctx->start_time);
+	if (wait_msecs > 0) {
+		ts.tv_sec = wait_msecs / 1000;
+		ts.tv_nsec = (wait_msecs % 1000) * 1000000;
+		(void)nanosleep(&ts, NULL);
+	}
+}
+
 static int
 mdbox_file_purge_check_refcounts(struct mdbox_purge_context *ctx,
 				 const ARRAY_TYPE(mdbox_map_file_msg) *msgs_arr)
@@ -275,14 +305,21 @@ mdbox_purge_attachments(struct mdbox_purge_context *ctx,
 {
 	struct dbox_storage *storage = &ctx->storage->storage;
 	const struct mail_attachment_extref *extref;
-	int ret = 0;
+	ARRAY_TYPE(const_string) paths;
+	int ret;
 
-	array_foreach(extrefs_arr, extref) {
-		if (index_attachment_delete(&storage->storage,
-					    storage->attachment_fs,
-					    extref->path) < 0)
-			ret = -1;
-	}
+	if (array_count(extrefs_arr) == 0)
+		return 0;
+
+	T_BEGIN {
+		t_array_init(&paths, array_count(extrefs_arr));
+		array_foreach(extrefs_arr, extref)
+			array_push_back(&paths, &extref->path);
+		ret = index_attachment_delete_bulk(&storage->storage,
+						   storage->attachment_fs,
+						   array_front(&paths),
+						   array_count(&paths));
+	} T_END;
 	return ret;
 }
 
@@ -372,6 +409,7 @@ mdbox_file_purge(struct mdbox_purge_context *ctx, struct dbox_file *file,
 			if (ret <= 0)
 				break;
 			array_push_back(&copied_map_uids, &msgs[i].map_uid);
+			mdbox_purge_throttle(ctx, file->input->v_offset - offset);
 		}
 		offset = file->input->v_offset;
 	}
@@ -476,6 +514,8 @@ mdbox_purge_alloc(struct mdbox_storage *storage)
 	i_array_init(&ctx->primary_file_ids, 64);
 	i_array_init(&ctx->purge_file_ids, 64);
 	hash_table_create_direct(&ctx->altmoves, pool, 0);
+	if (gettimeofday(&ctx->start_time, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
 	return ctx;
 }
 
@@ -4,6 +4,7 @@
 #include "array.h"
 #include "ioloop.h"
 #include "istream.h"
+#include "ostream.h"
 #include "hash.h"
 #include "str.h"
 #include "mail-cache.h"
@@ -17,9 +18,15 @@
 #include "mdbox-storage-rebuild.h"
 
 #include <dirent.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 #define REBUILD_MAX_REFCOUNT 32768
+/* Number of storage files to read ahead while scanning */
+#define REBUILD_PREFETCH_FILES 8
+#define REBUILD_CHECKPOINT_FNAME "dovecot.map.rebuild"
+#define REBUILD_CHECKPOINT_MAX_MSGS 1000000
 
 struct mdbox_rebuild_msg {
 	struct mdbox_rebuild_msg *guid_hash_next;
@@ -35,6 +42,37 @@ struct mdbox_rebuild_msg {
 	bool seen_zero_ref_in_map:1;
 };
 
+/* The checkpoint file contains a record for each fully scanned storage file,
+   followed by the file's messages. If the rebuild is interrupted, the next
+   rebuild doesn't need to scan again the files whose inode, size and mtime
+   haven't changed. The file is deleted after a successful rebuild. */
+enum rebuild_checkpoint_flags {
+	REBUILD_CHECKPOINT_FLAG_POP3_UIDLS	= 0x01,
+	REBUILD_CHECKPOINT_FLAG_POP3_ORDERS	= 0x02
+};
+
+struct rebuild_checkpoint_file {
+	uint64_t ino;
+	uint64_t size;
+	uint64_t mtime;
+	uint32_t file_id;
+	uint32_t msg_count;
+	uint32_t flags; /* enum rebuild_checkpoint_flags */
+	uint32_t unused;
+};
+
+struct rebuild_checkpoint_msg {
+	guid_128_t guid_128;
+	uint64_t mail_size;
+	uint32_t offset;
+	uint32_t rec_size;
+};
+
+struct rebuild_checkpoint_entry {
+	struct rebuild_checkpoint_file file;
+	struct rebuild_checkpoint_msg *msgs;
+};
+
 struct rebuild_msg_mailbox {
 	struct mailbox *box;
 	struct mail_index_sync_ctx *sync_ctx;
@@ -60,6 +98,14 @@ struct mdbox_storage_rebuild_context {
 
 	struct rebuild_msg_mailbox prev_msg;
 
+	/* file_id => entry from an earlier interrupted rebuild */
+	pool_t checkpoint_pool;
+	HASH_TABLE(void *, struct rebuild_checkpoint_entry *) checkpoint;
+	const char *checkpoint_path;
+	struct ostream *checkpoint_output;
+	/* flags of the file currently being scanned */
+	enum rebuild_checkpoint_flags file_flags;
+
 	bool have_pop3_uidls:1;
 	bool have_pop3_orders:1;
 };
@@ -133,18 +179,57 @@ static int mdbox_rebuild_msg_uid_cmp(struct mdbox_rebuild_msg *const *m1,
 static void rebuild_scan_metadata(struct mdbox_storage_rebuild_context *ctx,
 				  struct dbox_file *file)
 {
-	if (dbox_file_metadata_get(file, DBOX_METADATA_POP3_UIDL) != NULL)
+	if (dbox_file_metadata_get(file, DBOX_METADATA_POP3_UIDL) != NULL) {
 		ctx->have_pop3_uidls = TRUE;
-	if (dbox_file_metadata_get(file, DBOX_METADATA_POP3_ORDER) != NULL)
+		ctx->file_flags |= REBUILD_CHECKPOINT_FLAG_POP3_UIDLS;
+	}
+	if (dbox_file_metadata_get(file, DBOX_METADATA_POP3_ORDER) != NULL) {
 		ctx->have_pop3_orders = TRUE;
+		ctx->file_flags |= REBUILD_CHECKPOINT_FLAG_POP3_ORDERS;
+	}
+}
+
+static void rebuild_add_msg(struct mdbox_storage_rebuild_context *ctx,
+			    struct mdbox_rebuild_msg *rec, const char *guid)
+{
+	struct mdbox_rebuild_msg *old_rec;
+	uint8_t *guid_p;
+
+	i_assert(!guid_128_is_empty(rec->guid_128));
+	array_push_back(&ctx->msgs, &rec);
+
+	guid_p = rec->guid_128;
+	old_rec = hash_table_lookup(ctx->guid_hash, guid_p);
+	if (old_rec == NULL)
+		hash_table_insert(ctx->guid_hash, guid_p, rec);
+	else if (rec->mail_size == old_rec->mail_size) {
+		/* two mails' GUID and size are the same, which quite
+		   likely means that their contents are the same as
+		   well. we'll compare the mail sizes instead of the
+		   record sizes, because the records' metadata may
+		   differ.
+
+		   save this duplicate mail with refcount=0 to the map,
+		   so it will eventually be purged. */
+		rec->seen_zero_ref_in_map = TRUE;
+	} else {
+		/* duplicate GUID, but not a duplicate message. */
+		i_error("mdbox %s: Duplicate GUID %s in "
+			"m.%u:%u (size=%"PRIuUOFF_T") and m.%u:%u "
+			"(size=%"PRIuUOFF_T")",
+			ctx->storage->storage_dir, guid,
+			old_rec->file_id, old_rec->offset, old_rec->mail_size,
+			rec->file_id, rec->offset, rec->mail_size);
+		rec->guid_hash_next = old_rec->guid_hash_next;
+		old_rec->guid_hash_next = rec;
+	}
 }
 
 static int rebuild_file_mails(struct mdbox_storage_rebuild_context *ctx,
 			      struct dbox_file *file, uint32_t file_id)
 {
 	const char *guid;
-	uint8_t *guid_p;
-	struct mdbox_rebuild_msg *rec, *old_rec;
+	struct mdbox_rebuild_msg *rec;
 	uoff_t offset, prev_offset;
 	bool last, first, fixed = FALSE;
 	int ret;
@@ -198,34 +283,7 @@ static int rebuild_file_mails(struct mdbox_storage_rebuild_context *ctx,
 		rec->rec_size = file->input->v_offset - offset;
 		rec->mail_size = dbox_file_get_plaintext_size(file);
 		mail_generate_guid_128_hash(guid, rec->guid_128);
-		i_assert(!guid_128_is_empty(rec->guid_128));
-		array_push_back(&ctx->msgs, &rec);
-
-		guid_p = rec->guid_128;
-		old_rec = hash_table_lookup(ctx->guid_hash, guid_p);
-		if (old_rec == NULL)
-			hash_table_insert(ctx->guid_hash, guid_p, rec);
-		else if (rec->mail_size == old_rec->mail_size) {
-			/* two mails' GUID and size are the same, which quite
-			   likely means that their contents are the same as
-			   well. we'll compare the mail sizes instead of the
-			   record sizes, because the records' metadata may
-			   differ.
-
-			   save this duplicate mail with refcount=0 to the map,
-			   so it will eventually be purged. */
-			rec->seen_zero_ref_in_map = TRUE;
-		} else {
-			/* duplicate GUID, but not a duplicate message. */
-			i_error("mdbox %s: Duplicate GUID %s in "
-				"m.%u:%u (size=%"PRIuUOFF_T") and m.%u:%u "
-				"(size=%"PRIuUOFF_T")",
-				ctx->storage->storage_dir, guid,
-				old_rec->file_id, old_rec->offset, old_rec->mail_size,
-				rec->file_id, rec->offset, rec->mail_size);
-			rec->guid_hash_next = old_rec->guid_hash_next;
-			old_rec->guid_hash_next = rec;
-		}
+		rebuild_add_msg(ctx, rec, guid);
 	}
 	if (ret < 0)
 		return -1;
@@ -235,6 +293,213 @@ static int rebuild_file_mails(struct mdbox_storage_rebuild_context *ctx,
 		return 1;
 }
 
+static uoff_t
+rebuild_checkpoint_read(struct mdbox_storage_rebuild_context *ctx)
+{
+	struct rebuild_checkpoint_entry *entry;
+	struct istream *input;
+	const unsigned char *data;
+	uoff_t valid_offset = 0;
+	size_t size;
+	unsigned int i;
+
+	input = i_stream_create_file(ctx->checkpoint_path, IO_BLOCK_SIZE);
+	while (i_stream_read_bytes(input, &data, &size,
+				   sizeof(entry->file)) > 0) {
+		entry = p_new(ctx->checkpoint_pool,
+			      struct rebuild_checkpoint_entry, 1);
+		memcpy(&entry->file, data, sizeof(entry->file));
+		i_stream_skip(input, sizeof(entry->file));
+		if (entry->file.msg_count > REBUILD_CHECKPOINT_MAX_MSGS)
+			break;
+
+		entry->msgs = p_new(ctx->checkpoint_pool,
+				    struct rebuild_checkpoint_msg,
+				    entry->file.msg_count);
+		for (i = 0; i < entry->file.msg_count; i++) {
+			if (i_stream_read_bytes(input, &data, &size,
+						sizeof(entry->msgs[i])) <= 0)
+				break;
+			memcpy(&entry->msgs[i], data, sizeof(entry->msgs[i]));
+			i_stream_skip(input, sizeof(entry->msgs[i]));
+		}
+		if (i < entry->file.msg_count) {
+			/* the last write was interrupted */
+			break;
+		}
+		hash_table_update(ctx->checkpoint,
+				  POINTER_CAST(entry->file.file_id), entry);
+		valid_offset = input->v_offset;
+	}
+	if (input->stream_errno != 0 && input->stream_errno != ENOENT) {
+		i_error("mdbox rebuild: read(%s) failed: %s",
+			ctx->checkpoint_path, i_stream_get_error(input));
+	}
+	i_stream_unref(&input);
+	return valid_offset;
+}
+
+static void rebuild_checkpoint_init(struct mdbox_storage_rebuild_context *ctx)
+{
+	struct mailbox_permissions perm;
+	uoff_t valid_offset;
+	int fd;
+
+	ctx->checkpoint_path = p_strconcat(ctx->pool,
+		ctx->storage->map->index_path, "/"REBUILD_CHECKPOINT_FNAME, NULL);
+	ctx->checkpoint_pool =
+		pool_alloconly_create("mdbox rebuild checkpoint", 1024*32);
+	hash_table_create_direct(&ctx->checkpoint, ctx->checkpoint_pool, 0);
+
+	valid_offset = rebuild_checkpoint_read(ctx);
+	if (hash_table_count(ctx->checkpoint) > 0) {
+		i_info("mdbox %s: Continuing an interrupted rebuild "
+		       "(%u files already scanned)", ctx->storage->storage_dir,
+		       hash_table_count(ctx->checkpoint));
+	}
+
+	/* append the newly scanned files after the existing valid ones */
+	mailbox_list_get_root_permissions(ctx->storage->map->root_list, &perm);
+	fd = open(ctx->checkpoint_path, O_WRONLY | O_CREAT,
+		  perm.file_create_mode);
+	if (fd == -1) {
+		i_error("mdbox rebuild: open(%s) failed: %m",
+			ctx->checkpoint_path);
+		return;
+	}
+	if (ftruncate(fd, valid_offset) < 0) {
+		i_error("mdbox rebuild: ftruncate(%s) failed: %m",
+			ctx->checkpoint_path);
+		i_close_fd(&fd);
+		return;
+	}
+	ctx->checkpoint_output =
+		o_stream_create_fd_file_autoclose(&fd, valid_offset);
+	o_stream_set_name(ctx->checkpoint_output, ctx->checkpoint_path);
+}
+
+static void
+rebuild_checkpoint_deinit(struct mdbox_storage_rebuild_context *ctx,
+			  bool success)
+{
+	if (ctx->checkpoint_output != NULL) {
+		if (o_stream_finish(ctx->checkpoint_output) < 0) {
+			i_error("mdbox rebuild: write(%s) failed: %s",
+				ctx->checkpoint_path,
+				o_stream_get_error(ctx->checkpoint_output));
+		}
+		o_stream_destroy(&ctx->checkpoint_output);
+	}
+	if (success)
+		i_unlink_if_exists(ctx->checkpoint_path);
+	hash_table_destroy(&ctx->checkpoint);
+	pool_unref(&ctx->checkpoint_pool);
+}
+
+static const struct rebuild_checkpoint_entry *
+rebuild_checkpoint_lookup(struct mdbox_storage_rebuild_context *ctx,
+			  uint32_t file_id, const struct stat *st)
+{
+	const struct rebuild_checkpoint_entry *entry;
+
+	entry = hash_table_lookup(ctx->checkpoint, POINTER_CAST(file_id));
+	if (entry == NULL ||
+	    entry->file.ino != (uint64_t)st->st_ino ||
+	    entry->file.size != (uint64_t)st->st_size ||
+	    entry->file.mtime != (uint64_t)st->st_mtime)
+		return NULL;
+	return entry;
+}
+
+static void
+rebuild_checkpoint_add_msgs(struct mdbox_storage_rebuild_context *ctx,
+			    const struct rebuild_checkpoint_entry *entry)
+{
+	struct mdbox_rebuild_msg *rec;
+	unsigned int i;
+
+	for (i = 0; i < entry->file.msg_count; i++) {
+		rec = p_new(ctx->pool, struct mdbox_rebuild_msg, 1);
+		rec->file_id = entry->file.file_id;
+		rec->offset = entry->msgs[i].offset;
+		rec->rec_size = entry->msgs[i].rec_size;
+		rec->mail_size = entry->msgs[i].mail_size;
+		memcpy(rec->guid_128, entry->msgs[i].guid_128,
+		       sizeof(rec->guid_128));
+		if (guid_128_is_empty(rec->guid_128))
+			continue;
+		rebuild_add_msg(ctx, rec, guid_128_to_string(rec->guid_128));
+	}
+	if ((entry->file.flags & REBUILD_CHECKPOINT_FLAG_POP3_UIDLS) != 0)
+		ctx->have_pop3_uidls = TRUE;
+	if ((entry->file.flags & REBUILD_CHECKPOINT_FLAG_POP3_ORDERS) != 0)
+		ctx->have_pop3_orders = TRUE;
+}
+
+static void
+rebuild_checkpoint_write(struct mdbox_storage_rebuild_context *ctx,
+			 uint32_t file_id, const struct stat *st,
+			 unsigned int first_msg_idx)
+{
+	struct rebuild_checkpoint_file cfile;
+	struct rebuild_checkpoint_msg cmsg;
+	struct mdbox_rebuild_msg *const *msgs;
+	unsigned int i, count;
+
+	if (ctx->checkpoint_output == NULL)
+		return;
+
+	msgs = array_get(&ctx->msgs, &count);
+	i_zero(&cfile);
+	cfile.ino = st->st_ino;
+	cfile.size = st->st_size;
+	cfile.mtime = st->st_mtime;
+	cfile.file_id = file_id;
+	cfile.msg_count = count - first_msg_idx;
+	cfile.flags = ctx->file_flags;
+	o_stream_nsend(ctx->checkpoint_output, &cfile, sizeof(cfile));
+
+	for (i = first_msg_idx; i < count; i++) {
+		i_zero(&cmsg);
+		memcpy(cmsg.guid_128, msgs[i]->guid_128, sizeof(cmsg.guid_128));
+		cmsg.mail_size = msgs[i]->mail_size;
+		cmsg.offset = msgs[i]->offset;
+		cmsg.rec_size = msgs[i]->rec_size;
+		o_stream_nsend(ctx->checkpoint_output, &cmsg, sizeof(cmsg));
+	}
+	/* make sure the file's record is complete if we crash later */
+	if (o_stream_flush(ctx->checkpoint_output) < 0) {
+		i_error("mdbox rebuild: write(%s) failed: %s",
+			ctx->checkpoint_path,
+			o_stream_get_error(ctx->checkpoint_output));
+		o_stream_destroy(&ctx->checkpoint_output);
+	}
+}
+
+static int
+rebuild_add_file_mails(struct mdbox_storage_rebuild_context *ctx,
+		       struct dbox_file *file, uint32_t file_id)
+{
+	const struct rebuild_checkpoint_entry *entry;
+	unsigned int first_msg_idx = array_count(&ctx->msgs);
+	struct stat st;
+	int ret;
+
+	if (stat(file->cur_path, &st) == 0 &&
+	    (entry = rebuild_checkpoint_lookup(ctx, file_id, &st)) != NULL) {
+		/* already scanned by the interrupted rebuild */
+		rebuild_checkpoint_add_msgs(ctx, entry);
+		return 1;
+	}
+
+	ctx->file_flags = 0;
+	ret = rebuild_file_mails(ctx, file, file_id);
+	/* the file may have been fixed or deleted while scanning it */
+	if (ret > 0 && stat(file->cur_path, &st) == 0)
+		rebuild_checkpoint_write(ctx, file_id, &st, first_msg_idx);
+	return ret;
+}
+
 static int
 rebuild_rename_file(struct mdbox_storage_rebuild_context *ctx,
 		    const char *dir, const char **fname_p, uint32_t *file_id_r)
@@ -296,7 +561,7 @@ static int rebuild_add_file(struct mdbox_storage_rebuild_context *ctx,
 
 	file = mdbox_file_init(ctx->storage, file_id);
 	if ((ret = dbox_file_open(file, &deleted)) > 0 && !deleted)
-		ret = rebuild_file_mails(ctx, file, file_id);
+		ret = rebuild_add_file_mails(ctx, file, file_id);
 	if (ret == 0)
 		i_error("mdbox rebuild: Failed to fix file %s/%s", dir, fname);
 	dbox_file_unref(&file);
@@ -865,12 +1130,41 @@ static int rebuild_finish(struct mdbox_storage_rebuild_context *ctx)
 	return 0;
 }
 
+static void
+rebuild_prefetch_file(struct mdbox_storage_rebuild_context *ctx,
+		      const char *dir, const char *fname)
+{
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_WILLNEED)
+	uint32_t file_id;
+	int fd;
+
+	if (str_to_uint32(fname + strlen(MDBOX_MAIL_FILE_PREFIX),
+			  &file_id) == 0 &&
+	    hash_table_lookup(ctx->checkpoint, POINTER_CAST(file_id)) != NULL) {
+		/* most likely doesn't need to be read */
+		return;
+	}
+
+	/* start reading the file into memory while the earlier files are
+	   still being scanned */
+	fd = open(t_strconcat(dir, "/", fname, NULL), O_RDONLY);
+	if (fd == -1)
+		return;
+	(void)posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+	i_close_fd(&fd);
+#endif
+}
+
 static int
 mdbox_storage_rebuild_scan_dir(struct mdbox_storage_rebuild_context *ctx,
 			       const char *storage_dir, bool alt)
 {
 	DIR *dir;
 	struct dirent *d;
+	pool_t pool;
+	ARRAY_TYPE(const_string) fnames;
+	const char *const *fnamep;
+	unsigned int i, count;
 	int ret = 0;
 
 	dir = opendir(storage_dir);
@@ -882,13 +1176,19 @@ mdbox_storage_rebuild_scan_dir(struct mdbox_storage_rebuild_context *ctx,
 			"opendir(%s) failed: %m", storage_dir);
 		return -1;
 	}
-	for (errno = 0; (d = readdir(dir)) != NULL && ret == 0; errno = 0) {
+	/* get the list of files first, so the next files can be read ahead
+	   while scanning. */
+	pool = pool_alloconly_create(MEMPOOL_GROWING"mdbox rebuild files",
+				     1024*16);
+	p_array_init(&fnames, pool, 256);
+	for (errno = 0; (d = readdir(dir)) != NULL; errno = 0) {
 		if (strncmp(d->d_name, MDBOX_MAIL_FILE_PREFIX,
-			    strlen(MDBOX_MAIL_FILE_PREFIX)) == 0) T_BEGIN {
-			ret = rebuild_add_file(ctx, storage_dir, d->d_name);
-		} T_END;
+			    strlen(MDBOX_MAIL_FILE_PREFIX)) == 0) {
+			const char *fname = p_strdup(pool, d->d_name);
+			array_push_back(&fnames, &fname);
+		}
 	}
-	if (ret == 0 && errno != 0) {
+	if (errno != 0) {
 		mail_storage_set_critical(&ctx->storage->storage.storage,
 			"readdir(%s) failed: %m", storage_dir);
 		ret = -1;
@@ -898,6 +1198,19 @@ mdbox_storage_rebuild_scan_dir(struct mdbox_storage_rebuild_context *ctx,
 			"closedir(%s) failed: %m", storage_dir);
 		ret = -1;
 	}
+
+	fnamep = array_get(&fnames, &count);
+	for (i = 0; i < count && i < REBUILD_PREFETCH_FILES; i++) T_BEGIN {
+		rebuild_prefetch_file(ctx, storage_dir, fnamep[i]);
+	} T_END;
+	for (i = 0; i < count && ret == 0; i++) T_BEGIN {
+		if (i + REBUILD_PREFETCH_FILES < count) {
+			rebuild_prefetch_file(ctx, storage_dir,
+					      fnamep[i + REBUILD_PREFETCH_FILES]);
+		}
+		ret = rebuild_add_file(ctx, storage_dir, fnamep[i]);
+	} T_END;
+	pool_unref(&pool);
 	return ret;
 }
 
@@ -905,6 +1218,7 @@ static int mdbox_storage_rebuild_scan(struct mdbox_storage_rebuild_context *ctx)
 {
 	const void *data;
 	size_t data_size;
+	int ret;
 
 	if (mdbox_map_open_or_create(ctx->storage->map) < 0)
 		return -1;
@@ -940,22 +1254,24 @@ static int mdbox_storage_rebuild_scan(struct mdbox_storage_rebuild_context *ctx)
 
 	i_warning("mdbox %s: rebuilding indexes", ctx->storage->storage_dir);
 
-	if (mdbox_storage_rebuild_scan_dir(ctx, ctx->storage->storage_dir,
-					   FALSE) < 0)
-		return -1;
-	if (ctx->storage->alt_storage_dir != NULL) {
-		if (mdbox_storage_rebuild_scan_dir(ctx,
-				ctx->storage->alt_storage_dir, TRUE) < 0)
-			return -1;
+	rebuild_checkpoint_init(ctx);
+	ret = mdbox_storage_rebuild_scan_dir(ctx, ctx->storage->storage_dir,
+					     FALSE);
+	if (ret == 0 && ctx->storage->alt_storage_dir != NULL) {
+		ret = mdbox_storage_rebuild_scan_dir(ctx,
+				ctx->storage->alt_storage_dir, TRUE);
 	}
 
-	rebuild_apply_map(ctx);
-	if (rebuild_mailboxes(ctx) < 0 ||
-	    rebuild_finish(ctx) < 0) {
-		mdbox_map_atomic_set_failed(ctx->atomic);
-		return -1;
+	if (ret == 0) {
+		rebuild_apply_map(ctx);
+		if (rebuild_mailboxes(ctx) < 0 ||
+		    rebuild_finish(ctx) < 0) {
+			mdbox_map_atomic_set_failed(ctx->atomic);
+			ret = -1;
+		}
 	}
-	return 0;
+	rebuild_checkpoint_deinit(ctx, ret == 0);
+	return ret;
 }
 
 int mdbox_storage_rebuild_in_context(struct mdbox_storage *storage,
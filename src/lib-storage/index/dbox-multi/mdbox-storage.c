@@ -452,7 +452,8 @@ struct mail_storage mdbox_storage = {
 	.class_flags = MAIL_STORAGE_CLASS_FLAG_UNIQUE_ROOT |
 		MAIL_STORAGE_CLASS_FLAG_HAVE_MAIL_GUIDS |
 		MAIL_STORAGE_CLASS_FLAG_HAVE_MAIL_SAVE_GUIDS |
-		MAIL_STORAGE_CLASS_FLAG_BINARY_DATA,
+		MAIL_STORAGE_CLASS_FLAG_BINARY_DATA |
+		MAIL_STORAGE_CLASS_FLAG_NO_EXTERNAL_CHANGES,
 	.event_category = &event_category_mdbox,
 
 	.v = {
@@ -66,8 +66,9 @@ static int mdbox_sync_expunge(struct mdbox_sync_context *ctx, uint32_t seq,
 		return ret;
 	if (mdbox_mail_lookup(ctx->mbox, ctx->sync_view, seq, &map_uid) < 0)
 		return -1;
-	if (mdbox_map_update_refcount(ctx->map_trans, map_uid, -1) < 0)
-		return -1;
+	/* the refcounts are updated all at once after all the expunges have
+	   been seen */
+	array_push_back(&ctx->expunged_map_uids, &map_uid);
 	return 0;
 }
 
@@ -169,11 +170,17 @@ static int mdbox_sync_index(struct mdbox_sync_context *ctx)
 	if (mdbox_map_atomic_is_locked(ctx->atomic)) {
 		ctx->map_trans = mdbox_map_transaction_begin(ctx->atomic, FALSE);
 		i_array_init(&ctx->expunged_seqs, 64);
+		i_array_init(&ctx->expunged_map_uids, 64);
 	}
 	while (mail_index_sync_next(ctx->index_sync_ctx, &sync_rec)) {
 		if ((ret = mdbox_sync_rec(ctx, &sync_rec)) < 0)
 			break;
 	}
+	if (ret == 0 && mdbox_map_atomic_is_locked(ctx->atomic) &&
+	    array_count(&ctx->expunged_map_uids) > 0) {
+		ret = mdbox_map_update_refcounts(ctx->map_trans,
+						 &ctx->expunged_map_uids, -1);
+	}
 
 	/* write refcount changes to map index. transaction commit updates the
 	   log head, while tail is left behind. */
@@ -191,6 +198,7 @@ static int mdbox_sync_index(struct mdbox_sync_context *ctx)
 		mdbox_map_transaction_free(&ctx->map_trans);
 		ctx->expunged_count = seq_range_count(&ctx->expunged_seqs);
 		array_free(&ctx->expunged_seqs);
+		array_free(&ctx->expunged_map_uids);
 	}
 
 	if (box->v.sync_notify != NULL)
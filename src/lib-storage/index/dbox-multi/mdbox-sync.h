@@ -22,6 +22,8 @@ struct mdbox_sync_context {
 	enum mdbox_sync_flags flags;
 
 	ARRAY_TYPE(seq_range) expunged_seqs;
+	/* map UIDs whose refcounts are decreased by the expunges */
+	ARRAY_TYPE(uint32_t) expunged_map_uids;
 	unsigned int expunged_count;
 };
 
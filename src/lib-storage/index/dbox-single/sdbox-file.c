@@ -52,6 +52,18 @@ struct dbox_file *sdbox_file_init(struct sdbox_mailbox *mbox, uint32_t uid)
 	return &file->file;
 }
 
+struct dbox_file *
+sdbox_file_init_expunged(struct sdbox_mailbox *mbox, uint32_t uid)
+{
+	struct dbox_file *file = sdbox_file_init(mbox, uid);
+
+	T_BEGIN {
+		sdbox_file_init_paths((struct sdbox_file *)file,
+			t_strdup_printf(SDBOX_EXPUNGED_FILE_FORMAT, uid));
+	} T_END;
+	return file;
+}
+
 struct dbox_file *sdbox_file_create(struct sdbox_mailbox *mbox)
 {
 	struct dbox_file *file;
@@ -185,6 +197,39 @@ int sdbox_file_assign_uid(struct sdbox_file *file, uint32_t uid,
 	return 0;
 }
 
+int sdbox_file_rename_expunged(struct sdbox_file *file)
+{
+	const char *p, *path, *new_fname, *new_path;
+	bool alt = FALSE;
+
+	i_assert(file->uid != 0);
+
+	new_fname = t_strdup_printf(SDBOX_EXPUNGED_FILE_FORMAT, file->uid);
+	path = file->file.primary_path;
+	for (;;) {
+		p = strrchr(path, '/');
+		i_assert(p != NULL);
+		new_path = t_strdup_printf("%s/%s",
+					   t_strdup_until(path, p), new_fname);
+		if (rename(path, new_path) == 0)
+			break;
+		if (errno != ENOENT) {
+			mailbox_set_critical(&file->mbox->box,
+					     "rename(%s, %s) failed: %m",
+					     path, new_path);
+			return -1;
+		}
+		if (file->file.alt_path == NULL || alt) {
+			/* already unlinked or renamed by someone else */
+			return 0;
+		}
+		path = file->file.alt_path;
+		alt = TRUE;
+	}
+	sdbox_file_init_paths(file, new_fname);
+	return 1;
+}
+
 static int sdbox_file_unlink_aborted_save_attachments(struct sdbox_file *file)
 {
 	struct dbox_storage *storage = file->file.storage;
@@ -404,14 +449,23 @@ sdbox_unlink_attachments(struct sdbox_file *sfile,
 {
 	struct dbox_storage *storage = sfile->file.storage;
 	const struct mail_attachment_extref *extref;
+	ARRAY_TYPE(const_string) paths;
 	const char *path;
-	int ret = 0;
+	int ret;
 
-	array_foreach(extrefs, extref) T_BEGIN {
-		path = sdbox_file_attachment_relpath(sfile, extref->path);
-		if (index_attachment_delete(&storage->storage,
-					    storage->attachment_fs, path) < 0)
-			ret = -1;
+	if (array_count(extrefs) == 0)
+		return 0;
+
+	T_BEGIN {
+		t_array_init(&paths, array_count(extrefs));
+		array_foreach(extrefs, extref) {
+			path = sdbox_file_attachment_relpath(sfile, extref->path);
+			array_push_back(&paths, &path);
+		}
+		ret = index_attachment_delete_bulk(&storage->storage,
+						   storage->attachment_fs,
+						   array_front(&paths),
+						   array_count(&paths));
 	} T_END;
 	return ret;
 }
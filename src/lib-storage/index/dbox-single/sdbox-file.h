@@ -17,6 +17,10 @@ struct sdbox_file {
 };
 
 struct dbox_file *sdbox_file_init(struct sdbox_mailbox *mbox, uint32_t uid);
+/* Like sdbox_file_init(), but for a file renamed by
+   sdbox_file_rename_expunged(). */
+struct dbox_file *
+sdbox_file_init_expunged(struct sdbox_mailbox *mbox, uint32_t uid);
 struct dbox_file *sdbox_file_create(struct sdbox_mailbox *mbox);
 void sdbox_file_free(struct dbox_file *file);
 
@@ -36,6 +40,11 @@ int sdbox_file_create_fd(struct dbox_file *file, const char *path,
 			 bool parents);
 /* Move the file to alt path or back. */
 int sdbox_file_move(struct dbox_file *file, bool alt_path);
+/* Rename an expunged file to SDBOX_EXPUNGED_FILE_FORMAT so it can be
+   unlinked later. Only one process can succeed, and index rebuilds won't
+   add the file back. Returns 1 if renamed, 0 if the file no longer exists,
+   -1 on error. */
+int sdbox_file_rename_expunged(struct sdbox_file *file);
 /* Unlink file and all of its referenced attachments. */
 int sdbox_file_unlink_with_attachments(struct sdbox_file *sfile);
 /* Unlink file and its attachments when rolling back a saved message. */
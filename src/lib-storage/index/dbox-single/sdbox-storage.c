@@ -376,6 +376,7 @@ static void sdbox_mailbox_close(struct mailbox *box)
 
 	if (mbox->corrupted_rebuild_count != 0)
 		(void)sdbox_sync(mbox, 0);
+	sdbox_sync_deferred_unlinks_flush(mbox);
 	index_storage_mailbox_close(box);
 }
 
@@ -438,7 +439,8 @@ struct mail_storage sdbox_storage = {
 		MAIL_STORAGE_CLASS_FLAG_HAVE_MAIL_GUIDS |
 		MAIL_STORAGE_CLASS_FLAG_HAVE_MAIL_SAVE_GUIDS |
 		MAIL_STORAGE_CLASS_FLAG_BINARY_DATA |
-		MAIL_STORAGE_CLASS_FLAG_STUBS,
+		MAIL_STORAGE_CLASS_FLAG_STUBS |
+		MAIL_STORAGE_CLASS_FLAG_NO_EXTERNAL_CHANGES,
 	.event_category = &event_category_sdbox,
 
 	.v = {
@@ -457,7 +459,8 @@ struct mail_storage sdbox_storage = {
 
 struct mail_storage dbox_storage = {
 	.name = "dbox", /* alias */
-	.class_flags = MAIL_STORAGE_CLASS_FLAG_FILE_PER_MSG,
+	.class_flags = MAIL_STORAGE_CLASS_FLAG_FILE_PER_MSG |
+		MAIL_STORAGE_CLASS_FLAG_NO_EXTERNAL_CHANGES,
 	.event_category = &event_category_sdbox,
 
 	.v = {
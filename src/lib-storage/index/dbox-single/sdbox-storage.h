@@ -7,6 +7,9 @@
 #define SDBOX_STORAGE_NAME "sdbox"
 #define SDBOX_MAIL_FILE_PREFIX "u."
 #define SDBOX_MAIL_FILE_FORMAT SDBOX_MAIL_FILE_PREFIX"%u"
+/* expunged mail file waiting to be unlinked */
+#define SDBOX_EXPUNGED_FILE_PREFIX ".expunged."
+#define SDBOX_EXPUNGED_FILE_FORMAT SDBOX_EXPUNGED_FILE_PREFIX"%u"
 
 #define SDBOX_INDEX_HEADER_MIN_SIZE (sizeof(uint32_t))
 struct sdbox_index_header {
@@ -31,6 +34,10 @@ struct sdbox_mailbox {
 	uint32_t corrupted_rebuild_count;
 
 	guid_128_t mailbox_guid;
+
+	/* expunged mails whose files haven't been unlinked yet */
+	ARRAY_TYPE(uint32_t) deferred_unlink_uids;
+	struct timeout *to_deferred_unlink;
 };
 
 #define SDBOX_STORAGE(s)	container_of(DBOX_STORAGE(s), struct sdbox_storage, storage)
@@ -73,6 +73,20 @@ sdbox_sync_add_file(struct index_rebuild_context *ctx,
 	uint32_t uid;
 	int ret;
 
+	if (str_begins(fname, SDBOX_EXPUNGED_FILE_PREFIX)) {
+		/* left behind by a process that crashed before unlinking
+		   it. It's already expunged, so finish the job. */
+		if (str_to_uint32(fname + strlen(SDBOX_EXPUNGED_FILE_PREFIX),
+				  &uid) == 0 && uid != 0) {
+			file = sdbox_file_init_expunged(mbox, uid);
+			if (!primary)
+				file->cur_path = file->alt_path;
+			(void)sdbox_file_unlink_with_attachments(
+				(struct sdbox_file *)file);
+			dbox_file_unref(&file);
+		}
+		return 0;
+	}
 	if (!str_begins(fname, SDBOX_MAIL_FILE_PREFIX))
 		return 0;
 	fname += strlen(SDBOX_MAIL_FILE_PREFIX);
@@ -190,6 +204,8 @@ int sdbox_sync_index_rebuild(struct sdbox_mailbox *mbox, bool force)
 		}
 	}
 	i_warning("sdbox %s: Rebuilding index", mailbox_get_path(&mbox->box));
+	/* don't add back the mails that are waiting to be unlinked */
+	sdbox_sync_deferred_unlinks_flush(mbox);
 
 	if (dbox_verify_alt_storage(mbox->box.list) < 0) {
 		mailbox_set_critical(&mbox->box,
@@ -1,6 +1,8 @@
 /* Copyright (c) 2007-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
+#include "ioloop.h"
 #include "dbox-attachment.h"
 #include "sdbox-storage.h"
 #include "sdbox-file.h"
@@ -8,6 +10,11 @@
 #include "mailbox-recent-flags.h"
 
 #define SDBOX_REBUILD_COUNT 3
+/* If more mails than this are expunged by a sync, unlink their files only
+   after the sync has finished. */
+#define SDBOX_SYNC_INLINE_UNLINK_MAX_COUNT 100
+/* Number of deferred files to unlink at a time */
+#define SDBOX_SYNC_DEFERRED_UNLINK_BATCH_COUNT 1000
 
 static void
 dbox_sync_file_move_if_needed(struct dbox_file *file,
@@ -132,25 +139,105 @@ static int sdbox_sync_index(struct sdbox_sync_context *ctx)
 	return 1;
 }
 
-static void dbox_sync_file_expunge(struct sdbox_sync_context *ctx,
-				   uint32_t uid)
+static int dbox_sync_file_unlink(struct sdbox_mailbox *mbox, uint32_t uid,
+				 bool expunged)
 {
-	struct mailbox *box = &ctx->mbox->box;
 	struct dbox_file *file;
 	struct sdbox_file *sfile;
 	int ret;
 
-	file = sdbox_file_init(ctx->mbox, uid);
+	file = expunged ? sdbox_file_init_expunged(mbox, uid) :
+		sdbox_file_init(mbox, uid);
 	sfile = (struct sdbox_file *)file;
 	if (file->storage->attachment_dir != NULL)
 		ret = sdbox_file_unlink_with_attachments(sfile);
 	else
 		ret = dbox_file_unlink(file);
+	dbox_file_unref(&file);
+	return ret;
+}
+
+static void dbox_sync_file_expunge(struct sdbox_sync_context *ctx,
+				   uint32_t uid)
+{
+	struct mailbox *box = &ctx->mbox->box;
 
 	/* do sync_notify only when the file was unlinked by us */
-	if (ret > 0 && box->v.sync_notify != NULL)
+	if (dbox_sync_file_unlink(ctx->mbox, uid, FALSE) > 0 &&
+	    box->v.sync_notify != NULL)
 		box->v.sync_notify(box, uid, MAILBOX_SYNC_TYPE_EXPUNGE);
+}
+
+static void sdbox_sync_deferred_unlinks(struct sdbox_mailbox *mbox)
+{
+	const uint32_t *uids;
+	unsigned int i, count, n;
+
+	uids = array_get(&mbox->deferred_unlink_uids, &count);
+	n = I_MIN(count, SDBOX_SYNC_DEFERRED_UNLINK_BATCH_COUNT);
+	for (i = count - n; i < count; i++) T_BEGIN {
+		(void)dbox_sync_file_unlink(mbox, uids[i], TRUE);
+	} T_END;
+	array_delete(&mbox->deferred_unlink_uids, count - n, n);
+
+	if (array_count(&mbox->deferred_unlink_uids) == 0) {
+		timeout_remove(&mbox->to_deferred_unlink);
+		array_free(&mbox->deferred_unlink_uids);
+	}
+}
+
+void sdbox_sync_deferred_unlinks_flush(struct sdbox_mailbox *mbox)
+{
+	while (array_is_created(&mbox->deferred_unlink_uids))
+		sdbox_sync_deferred_unlinks(mbox);
+}
+
+static int dbox_sync_file_rename_expunged(struct sdbox_mailbox *mbox,
+					  uint32_t uid)
+{
+	struct dbox_file *file;
+	int ret;
+
+	file = sdbox_file_init(mbox, uid);
+	ret = sdbox_file_rename_expunged((struct sdbox_file *)file);
 	dbox_file_unref(&file);
+	return ret;
+}
+
+static void dbox_sync_expunge_files_deferred(struct sdbox_sync_context *ctx)
+{
+	struct sdbox_mailbox *mbox = ctx->mbox;
+	struct mailbox *box = &mbox->box;
+	const uint32_t *uidp;
+	int ret;
+
+	/* The mails are already gone from the index, so the client doesn't
+	   need to wait for the files to be unlinked. Only rename them now,
+	   which tells whether we were the one expunging the file and keeps
+	   index rebuilds from adding it back if we crash before unlinking.
+	   Notify about the expunges already now, because e.g. quota tracks
+	   them only while the mailbox is being synced. The files are
+	   unlinked in batches from the ioloop or at the latest when the
+	   mailbox is closed. */
+	if (!array_is_created(&mbox->deferred_unlink_uids))
+		i_array_init(&mbox->deferred_unlink_uids,
+			     array_count(&ctx->expunged_uids));
+	array_foreach(&ctx->expunged_uids, uidp) {
+		T_BEGIN {
+			ret = dbox_sync_file_rename_expunged(mbox, *uidp);
+		} T_END;
+		if (ret <= 0)
+			continue;
+		if (box->v.sync_notify != NULL)
+			box->v.sync_notify(box, *uidp, MAILBOX_SYNC_TYPE_EXPUNGE);
+		array_push_back(&mbox->deferred_unlink_uids, uidp);
+	}
+	if (array_count(&mbox->deferred_unlink_uids) == 0)
+		array_free(&mbox->deferred_unlink_uids);
+	else if (mbox->to_deferred_unlink == NULL) {
+		mbox->to_deferred_unlink =
+			timeout_add_short(0, sdbox_sync_deferred_unlinks, mbox);
+	}
 }
 
 static void dbox_sync_expunge_files(struct sdbox_sync_context *ctx)
@@ -160,9 +247,13 @@ static void dbox_sync_expunge_files(struct sdbox_sync_context *ctx)
 	/* NOTE: Index is no longer locked. Multiple processes may be unlinking
 	   the files at the same time. */
 	ctx->mbox->box.tmp_sync_view = ctx->sync_view;
-	array_foreach(&ctx->expunged_uids, uidp) T_BEGIN {
-		dbox_sync_file_expunge(ctx, *uidp);
-	} T_END;
+	if (array_count(&ctx->expunged_uids) > SDBOX_SYNC_INLINE_UNLINK_MAX_COUNT)
+		dbox_sync_expunge_files_deferred(ctx);
+	else {
+		array_foreach(&ctx->expunged_uids, uidp) T_BEGIN {
+			dbox_sync_file_expunge(ctx, *uidp);
+		} T_END;
+	}
 	if (ctx->mbox->box.v.sync_notify != NULL)
 		ctx->mbox->box.v.sync_notify(&ctx->mbox->box, 0, 0);
 	ctx->mbox->box.tmp_sync_view = NULL;
@@ -29,6 +29,8 @@ int sdbox_sync_begin(struct sdbox_mailbox *mbox, enum sdbox_sync_flags flags,
 		     struct sdbox_sync_context **ctx_r);
 int sdbox_sync_finish(struct sdbox_sync_context **ctx, bool success);
 int sdbox_sync(struct sdbox_mailbox *mbox, enum sdbox_sync_flags flags);
+/* Unlink the files of expunged mails that haven't been unlinked yet. */
+void sdbox_sync_deferred_unlinks_flush(struct sdbox_mailbox *mbox);
 
 int sdbox_sync_index_rebuild(struct sdbox_mailbox *mbox, bool force);
 
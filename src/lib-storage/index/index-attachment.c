@@ -269,28 +269,42 @@ index_attachment_save_get_extrefs(struct mail_save_context *ctx)
 }
 
 static int
-index_attachment_delete_real(struct mail_storage *storage,
-			     struct fs *fs, const char *name)
+index_attachment_delete_real(struct mail_storage *storage, struct fs *fs,
+			     const char *const *names, unsigned int count)
 {
-	struct fs_file *file;
+	struct fs_file **files;
 	const char *path;
+	unsigned int i;
 	int ret;
 
-	path = t_strdup_printf("%s/%s", index_attachment_dir_get(storage), name);
-	file = fs_file_init(fs, path, FS_OPEN_MODE_READONLY);
-	if ((ret = fs_delete(file)) < 0)
+	files = t_new(struct fs_file *, count);
+	for (i = 0; i < count; i++) {
+		path = t_strdup_printf("%s/%s",
+				       index_attachment_dir_get(storage), names[i]);
+		files[i] = fs_file_init(fs, path, FS_OPEN_MODE_READONLY);
+	}
+	if ((ret = fs_delete_bulk(files, count)) < 0)
 		mail_storage_set_critical(storage, "%s", fs_last_error(fs));
-	fs_file_deinit(&file);
+	for (i = 0; i < count; i++)
+		fs_file_deinit(&files[i]);
 	return ret;
 }
 
 int index_attachment_delete(struct mail_storage *storage,
 			    struct fs *fs, const char *name)
+{
+	return index_attachment_delete_bulk(storage, fs, &name, 1);
+}
+
+int index_attachment_delete_bulk(struct mail_storage *storage, struct fs *fs,
+				 const char *const *names, unsigned int count)
 {
 	int ret;
 
+	if (count == 0)
+		return 0;
 	T_BEGIN {
-		ret = index_attachment_delete_real(storage, fs, name);
+		ret = index_attachment_delete_real(storage, fs, names, count);
 	} T_END;
 	return ret;
 }
@@ -0,0 +1,302 @@
+/* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "buffer.h"
+#include "str.h"
+#include "istream.h"
+#include "message-header-decode.h"
+#include "message-header-parser.h"
+#include "mail-search.h"
+#include "index-storage.h"
+#include "index-mail.h"
+#include "index-search-private.h"
+#include "index-header-bloom.h"
+
+/* Each indexed header has a 64bit filter in the mail's index record. It has
+   a bit set for each 3 byte substring of the header's values, as SEARCH
+   HEADER sees them after decoding and normalization. A search string can
+   be found only from mails that have the bits set for all of its 3 byte
+   substrings, so most of the mails can be skipped without opening them.
+
+   The extension header contains the indexed header names, each followed by
+   NUL. When the configured headers change, the extension is reset. */
+#define HEADER_BLOOM_EXT_NAME "hdr-search-bloom"
+
+/* The mail's filter has been written. Filters added before the headers were
+   configured are 0, and they're unknown. */
+#define HEADER_BLOOM_BIT_INDEXED	0x01
+/* The mail has the header */
+#define HEADER_BLOOM_BIT_EXISTS		0x02
+#define HEADER_BLOOM_FIRST_HASH_BIT	2
+#define HEADER_BLOOM_HASH_BIT_COUNT	(64 - HEADER_BLOOM_FIRST_HASH_BIT)
+
+struct header_bloom_filter {
+	uint64_t bits;
+	/* the last 3 bytes */
+	uint32_t window;
+	unsigned int window_len;
+};
+
+struct header_bloom_parse_context {
+	const buffer_t *names;
+	struct header_bloom_filter *filters;
+	normalizer_func_t *normalizer;
+	buffer_t *buf;
+};
+
+static int
+header_bloom_name_idx(const void *names, size_t names_size, const char *name)
+{
+	const char *p = names, *end = p + names_size;
+	int idx;
+
+	for (idx = 0; p < end; idx++) {
+		if (strcasecmp(p, name) == 0)
+			return idx;
+		p += strlen(p) + 1;
+	}
+	return -1;
+}
+
+static unsigned int header_bloom_name_count(const buffer_t *names)
+{
+	const unsigned char *p = names->data;
+	unsigned int i, count = 0;
+
+	for (i = 0; i < names->used; i++) {
+		if (p[i] == '\0')
+			count++;
+	}
+	return count;
+}
+
+static void
+header_bloom_filter_add(struct header_bloom_filter *filter,
+			const unsigned char *data, size_t size)
+{
+	uint32_t hash;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		filter->window = ((filter->window << 8) | data[i]) & 0xffffff;
+		if (filter->window_len < 3 && ++filter->window_len < 3)
+			continue;
+
+		hash = (filter->window * 0x9e3779b1U) >> 8;
+		filter->bits |= 1ULL << (HEADER_BLOOM_FIRST_HASH_BIT +
+					 hash % HEADER_BLOOM_HASH_BIT_COUNT);
+	}
+}
+
+void index_header_bloom_register(struct mailbox *box)
+{
+	struct index_mailbox_context *ibox = INDEX_STORAGE_CONTEXT(box);
+	const char *const *names;
+	buffer_t *buf;
+
+	ibox->header_bloom_ext_id =
+		mail_index_ext_register(box->index, HEADER_BLOOM_EXT_NAME,
+					0, 0, 0);
+
+	names = t_strsplit_spaces(box->storage->set->mail_search_indexed_headers,
+				  " ");
+	if (names[0] == NULL)
+		return;
+
+	buf = buffer_create_dynamic(box->pool, 64);
+	for (; *names != NULL; names++) {
+		if (header_bloom_name_idx(buf->data, buf->used, *names) >= 0)
+			continue;
+		buffer_append(buf, t_str_lcase(*names), strlen(*names) + 1);
+	}
+	ibox->header_bloom_names = buf;
+}
+
+static void header_bloom_parse_cb(struct message_header_line *hdr,
+				  struct header_bloom_parse_context *ctx)
+{
+	struct header_bloom_filter *filter;
+	int idx;
+
+	if (hdr == NULL || hdr->eoh)
+		return;
+	if (hdr->continues) {
+		hdr->use_full_value = TRUE;
+		return;
+	}
+	idx = header_bloom_name_idx(ctx->names->data, ctx->names->used,
+				    hdr->name);
+	if (idx < 0)
+		return;
+	filter = &ctx->filters[idx];
+	filter->bits |= HEADER_BLOOM_BIT_EXISTS;
+
+	/* this needs to match what search_header_arg() and message-search
+	   compare the search string against */
+	buffer_set_used_size(ctx->buf, 0);
+	message_header_decode_utf8(hdr->full_value, hdr->full_value_len,
+				   ctx->buf, ctx->normalizer);
+	if (!hdr->no_newline)
+		buffer_append_c(ctx->buf, '\n');
+	header_bloom_filter_add(filter, ctx->buf->data, ctx->buf->used);
+}
+
+static void
+index_header_bloom_check_ext(struct mailbox_transaction_context *t,
+			     struct index_mailbox_context *ibox,
+			     unsigned int count)
+{
+	const buffer_t *names = ibox->header_bloom_names;
+	const void *data;
+	size_t size;
+	uint32_t reset_id;
+
+	if (t->header_bloom_checked)
+		return;
+	t->header_bloom_checked = TRUE;
+
+	mail_index_get_header_ext(t->view, ibox->header_bloom_ext_id,
+				  &data, &size);
+	if (size == names->used && memcmp(data, names->data, size) == 0)
+		return;
+
+	/* the indexed headers changed - the existing filters are useless */
+	if (!mail_index_ext_get_reset_id(t->view, t->view->map,
+					 ibox->header_bloom_ext_id, &reset_id))
+		reset_id = 0;
+	mail_index_ext_resize(t->itrans, ibox->header_bloom_ext_id,
+			      names->used, count * sizeof(uint64_t),
+			      sizeof(uint64_t));
+	mail_index_ext_reset_inc(t->itrans, ibox->header_bloom_ext_id,
+				 reset_id, TRUE);
+	mail_index_update_header_ext(t->itrans, ibox->header_bloom_ext_id, 0,
+				     names->data, names->used);
+}
+
+static void index_header_bloom_finish(struct index_mail *mail)
+{
+	struct mail *_mail = &mail->mail.mail;
+	struct index_mailbox_context *ibox = INDEX_STORAGE_CONTEXT(_mail->box);
+	struct header_bloom_parse_context ctx;
+	struct istream *input;
+	uint64_t *rec;
+	unsigned int i, count;
+
+	count = header_bloom_name_count(ibox->header_bloom_names);
+	i_zero(&ctx);
+	ctx.names = ibox->header_bloom_names;
+	ctx.filters = t_new(struct header_bloom_filter, count);
+	ctx.normalizer = _mail->box->storage->user->default_normalizer;
+	ctx.buf = t_buffer_create(256);
+
+	if (mail->data.header_bloom_input != NULL) {
+		/* Parse the headers the same way as search does when reading
+		   them from the cache. */
+		input = i_stream_create_from_data(
+			str_data(mail->data.header_bloom_input),
+			str_len(mail->data.header_bloom_input));
+		message_parse_header(input, NULL,
+				     MESSAGE_HEADER_PARSER_FLAG_CLEAN_ONELINE,
+				     header_bloom_parse_cb, &ctx);
+		i_stream_unref(&input);
+		mail->data.header_bloom_input = NULL;
+	}
+
+	rec = t_new(uint64_t, count);
+	for (i = 0; i < count; i++)
+		rec[i] = ctx.filters[i].bits | HEADER_BLOOM_BIT_INDEXED;
+
+	index_header_bloom_check_ext(_mail->transaction, ibox, count);
+	mail_index_update_ext(_mail->transaction->itrans, _mail->seq,
+			      ibox->header_bloom_ext_id, rec, NULL);
+}
+
+void index_header_bloom_parse_header(struct index_mail *mail,
+				     const struct message_header_line *hdr)
+{
+	struct mail *_mail = &mail->mail.mail;
+	struct index_mailbox_context *ibox = INDEX_STORAGE_CONTEXT(_mail->box);
+	struct index_mail_data *data = &mail->data;
+	const buffer_t *names = ibox->header_bloom_names;
+
+	if (names == NULL || !_mail->saving)
+		return;
+
+	if (hdr == NULL) {
+		T_BEGIN {
+			index_header_bloom_finish(mail);
+		} T_END;
+		return;
+	}
+
+	if (!hdr->continued) {
+		data->header_bloom_line =
+			header_bloom_name_idx(names->data, names->used,
+					      hdr->name) >= 0;
+	}
+	if (!data->header_bloom_line)
+		return;
+
+	if (data->header_bloom_input == NULL) {
+		data->header_bloom_input =
+			str_new(mail->mail.data_pool, 256);
+	}
+	if (!hdr->continued) {
+		str_append(data->header_bloom_input, hdr->name);
+		str_append_data(data->header_bloom_input,
+				hdr->middle, hdr->middle_len);
+	}
+	str_append_data(data->header_bloom_input, hdr->value, hdr->value_len);
+	if (!hdr->no_newline)
+		str_append_c(data->header_bloom_input, '\n');
+}
+
+int index_header_bloom_match(struct index_search_context *ctx,
+			     const struct mail_search_arg *arg)
+{
+	struct index_mailbox_context *ibox = INDEX_STORAGE_CONTEXT(ctx->box);
+	struct header_bloom_filter key_filter;
+	const void *names, *rec;
+	size_t names_size;
+	uint64_t bits;
+	bool expunged;
+	int idx;
+
+	i_assert(arg->type == SEARCH_HEADER);
+
+	mail_index_get_header_ext(ctx->view, ibox->header_bloom_ext_id,
+				  &names, &names_size);
+	idx = header_bloom_name_idx(names, names_size, arg->hdr_field_name);
+	if (idx < 0)
+		return -1;
+	mail_index_lookup_ext(ctx->view, ctx->mail_ctx.seq,
+			      ibox->header_bloom_ext_id, &rec, &expunged);
+	if (rec == NULL)
+		return -1;
+	memcpy(&bits, CONST_PTR_OFFSET(rec, idx * sizeof(bits)), sizeof(bits));
+
+	if ((bits & HEADER_BLOOM_BIT_INDEXED) == 0)
+		return -1;
+	if ((bits & HEADER_BLOOM_BIT_EXISTS) == 0)
+		return 0;
+	if (arg->value.str[0] == '\0') {
+		/* testing only the existence of the header */
+		return 1;
+	}
+
+	i_zero(&key_filter);
+	T_BEGIN {
+		string_t *dtc = t_str_new(128);
+
+		if (ctx->mail_ctx.normalizer(arg->value.str,
+					     strlen(arg->value.str), dtc) == 0) {
+			header_bloom_filter_add(&key_filter, str_data(dtc),
+						str_len(dtc));
+		}
+	} T_END;
+	if (key_filter.bits == 0) {
+		/* too short to use the filter */
+		return -1;
+	}
+	return (bits & key_filter.bits) == key_filter.bits ? -1 : 0;
+}
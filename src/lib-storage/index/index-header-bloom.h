@@ -0,0 +1,24 @@
+#ifndef INDEX_HEADER_BLOOM_H
+#define INDEX_HEADER_BLOOM_H
+
+struct mailbox;
+struct message_header_line;
+struct mail_search_arg;
+struct index_mail;
+struct index_search_context;
+
+/* Register the header filter index extension for the opened mailbox. */
+void index_header_bloom_register(struct mailbox *box);
+
+/* Add a header line of a mail that is being saved to the mail's header
+   filters. hdr=NULL at the end of headers writes the filters to the index. */
+void index_header_bloom_parse_header(struct index_mail *mail,
+				     const struct message_header_line *hdr);
+
+/* Check SEARCH_HEADER arg against the current mail's header filter.
+   Returns 0 if the arg can't match, 1 if it's known to match, -1 if the
+   mail needs to be looked at. */
+int index_header_bloom_match(struct index_search_context *ctx,
+			     const struct mail_search_arg *arg);
+
+#endif
@@ -426,9 +426,14 @@ index_mail_read_binary_to_cache(struct mail *_mail,
 	if (part->parent == NULL && include_hdr &&
 	    mail->data.bin_parts == NULL) {
 		binary_parts_update(&ctx, part, &mail->data.bin_parts);
-		if (_mail->uid > 0)
+		if (_mail->uid > 0 || _mail->saving)
 			binary_parts_cache(&ctx);
 	}
+	if (cache->input != is) {
+		/* the mail being saved has no UID yet, so the decoded stream
+		   can't be looked up later */
+		i_stream_unref(&is);
+	}
 	binary_streams_free(&ctx);
 
 	*binary_r = ctx.converted ? TRUE : ctx.has_nuls;
@@ -461,6 +466,29 @@ static bool get_cached_binary_parts(struct index_mail *mail)
 	return TRUE;
 }
 
+void index_mail_save_finish_binary_parts(struct index_mail *mail)
+{
+	struct mail *_mail = &mail->mail.mail;
+	const unsigned int field_idx =
+		mail->ibox->cache_fields[MAIL_CACHE_BINARY_PARTS].idx;
+	struct message_part *all_parts;
+	bool binary, converted;
+
+	/* Clients that have used BINARY for the mailbox's mails are likely
+	   to do it for the new mails as well. Decode the mail while it's
+	   still in the page cache and add binary.parts to the cache, so
+	   BINARY.SIZE doesn't need to decode it again. */
+	if (mail->data.bin_parts != NULL ||
+	    !mail_cache_field_want_add(_mail->transaction->cache_trans,
+				       _mail->seq, field_idx))
+		return;
+	if (mail_get_parts(_mail, &all_parts) < 0)
+		return;
+	(void)index_mail_read_binary_to_cache(_mail, all_parts, TRUE,
+					      "binary.parts on save",
+					      &binary, &converted);
+}
+
 static struct message_part *
 msg_part_find(struct message_part *parts, uoff_t physical_pos)
 {
@@ -15,6 +15,7 @@
 #include "imap-bodystructure.h"
 #include "index-storage.h"
 #include "index-mail.h"
+#include "index-header-bloom.h"
 
 static const enum message_header_parser_flags hdr_parser_flags =
 	MESSAGE_HEADER_PARSER_FLAG_SKIP_INITIAL_LWSP |
@@ -303,6 +304,7 @@ void index_mail_parse_header(struct message_part *part,
 		if (hdr == NULL)
                         index_mail_parse_finish_imap_envelope(mail);
 	}
+	index_header_bloom_parse_header(mail, hdr);
 
 	if (hdr == NULL) {
 		/* end of headers */
@@ -647,6 +649,7 @@ index_mail_get_raw_headers(struct index_mail *mail, const char *field,
 	if (mail_cache_lookup_headers(_mail->transaction->cache_view, dest,
 				      _mail->seq, &field_idx, 1) <= 0) {
 		/* not in cache / error - first see if it's already parsed */
+		_mail->transaction->stats.cache_miss_count++;
 		p_free(mail->mail.data_pool, dest);
 		if (mail->data.header_parser_initialized) {
 			/* don't try to parse headers recursively. we're here
@@ -917,6 +920,7 @@ int index_mail_get_header_stream(struct mail *_mail,
 		return 0;
 	}
 	/* not in cache / error */
+	_mail->transaction->stats.cache_miss_count++;
 	p_free(mail->mail.data_pool, dest);
 
 	unsigned int first_not_found = UINT_MAX, not_found_count = 0;
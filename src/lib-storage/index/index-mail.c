@@ -26,6 +26,11 @@
 #define BODY_SNIPPET_ALGO_V1 "1"
 #define BODY_SNIPPET_MAX_CHARS 100
 
+#define INDEX_MAIL_DATA_POOL_INITIAL_SIZE 16384
+/* Don't keep more than this much memory allocated for the data_pool
+   between mails. */
+#define INDEX_MAIL_DATA_POOL_MAX_SIZE (256*1024)
+
 struct mail_cache_field global_cache_fields[MAIL_INDEX_CACHE_FIELD_COUNT] = {
 	{ .name = "flags",
 	  .type = MAIL_CACHE_FIELD_BITMASK,
@@ -63,6 +68,8 @@ struct mail_cache_field global_cache_fields[MAIL_INDEX_CACHE_FIELD_COUNT] = {
 	{ .name = "binary.parts",
 	  .type = MAIL_CACHE_FIELD_VARIABLE_SIZE },
 	{ .name = "body.snippet",
+	  .type = MAIL_CACHE_FIELD_VARIABLE_SIZE },
+	{ .name = "mime.parts.data",
 	  .type = MAIL_CACHE_FIELD_VARIABLE_SIZE }
 	/* FIXME: for now need to update get_metadata_precache_fields() in
 	   index-status.c when adding more fields. those fields should probably
@@ -83,6 +90,8 @@ int index_mail_cache_lookup_field(struct index_mail *mail, buffer_t *buf,
 				      buf, mail->data.seq, field_idx);
 	if (ret > 0)
 		mail->mail.mail.transaction->stats.cache_hit_count++;
+	else if (ret == 0)
+		mail->mail.mail.transaction->stats.cache_miss_count++;
 	return ret;
 }
 
@@ -153,6 +162,85 @@ static bool get_cached_parts(struct index_mail *mail)
 	return TRUE;
 }
 
+static void message_parts_clear_data(struct message_part *part)
+{
+	for (; part != NULL; part = part->next) {
+		part->data = NULL;
+		if (part->children != NULL)
+			message_parts_clear_data(part->children);
+	}
+}
+
+static void index_mail_cache_parts_data(struct index_mail *mail)
+{
+	struct mail *_mail = &mail->mail.mail;
+	const unsigned int cache_field =
+		mail->ibox->cache_fields[MAIL_CACHE_MESSAGE_PARTS_DATA].idx;
+	buffer_t *buffer;
+
+	i_assert(mail->data.parts->data != NULL);
+
+	if (!mail_cache_field_want_add(_mail->transaction->cache_trans,
+				       _mail->seq, cache_field))
+		return;
+
+	T_BEGIN {
+		buffer = t_buffer_create(1024);
+		message_part_data_serialize(mail->data.parts, buffer);
+		index_mail_cache_add_idx(mail, cache_field,
+					 buffer->data, buffer->used);
+	} T_END;
+}
+
+static void get_cached_parts_data(struct index_mail *mail)
+{
+	struct mail *_mail = &mail->mail.mail;
+	struct index_mail_data *data = &mail->data;
+	const unsigned int data_field =
+		mail->ibox->cache_fields[MAIL_CACHE_MESSAGE_PARTS_DATA].idx;
+	const unsigned int bodystructure_field =
+		mail->ibox->cache_fields[MAIL_CACHE_IMAP_BODYSTRUCTURE].idx;
+	buffer_t *buf;
+	string_t *str;
+	const char *error;
+	int ret;
+
+	/* The part data is needed only by the callers that want the
+	   BODYSTRUCTURE as a message_part tree. Don't look it up otherwise,
+	   because the lookup would make the field wanted in the cache. */
+	if (data->parts->data != NULL ||
+	    (data->wanted_fields & MAIL_FETCH_IMAP_BODYSTRUCTURE) == 0)
+		return;
+
+	T_BEGIN {
+		buf = t_buffer_create(256);
+		ret = index_mail_cache_lookup_field(mail, buf, data_field);
+		if (ret > 0 &&
+		    message_part_data_deserialize(mail->mail.data_pool, data->parts,
+						  buf->data, buf->used,
+						  &error) < 0) {
+			mail_set_mail_cache_corrupted(_mail,
+				"Corrupted cached mime.parts.data: %s", error);
+		}
+	} T_END;
+	if (ret != 0)
+		return;
+
+	/* Not cached yet. Parse the cached BODYSTRUCTURE once and cache the
+	   result, so that it doesn't need to be parsed again. */
+	str = str_new(mail->mail.data_pool, 128);
+	if (index_mail_cache_lookup_field(mail, str, bodystructure_field) <= 0)
+		return;
+	if (imap_bodystructure_parse(str_c(str), mail->mail.data_pool,
+				     data->parts, &error) < 0) {
+		/* the caller will notice the same error */
+		message_parts_clear_data(data->parts);
+		return;
+	}
+	data->bodystructure = str_c(str);
+	index_mail_cache_parts_data(mail);
+}
+
 void index_mail_set_message_parts_corrupted(struct mail *mail, const char *error)
 {
 	buffer_t *part_buf;
@@ -323,6 +411,7 @@ int index_mail_get_parts(struct mail *_mail, struct message_part **parts_r)
 
 	data->cache_fetch_fields |= MAIL_FETCH_MESSAGE_PARTS;
 	if (data->parts != NULL || get_cached_parts(mail)) {
+		get_cached_parts_data(mail);
 		*parts_r = data->parts;
 		return 0;
 	}
@@ -785,6 +874,7 @@ index_mail_body_parsed_cache_bodystructure(struct index_mail *mail,
 	if (!data->parsed_bodystructure)
 		return;
 	i_assert(data->parts != NULL);
+	index_mail_cache_parts_data(mail);
 
 	/* If BODY is fetched first but BODYSTRUCTURE is also wanted, we don't
 	   normally want to first cache BODY and then BODYSTRUCTURE. So check
@@ -892,7 +982,10 @@ bool index_mail_want_cache(struct index_mail *mail, enum index_cache_field field
 static void index_mail_save_finish_make_snippet(struct index_mail *mail)
 {
 	if (mail->data.save_body_snippet) {
-		if (index_mail_write_body_snippet(mail) < 0)
+		int ret = index_mail_write_body_snippet(mail);
+
+		message_snippet_parts_deinit(&mail->data.snippet_parts);
+		if (ret < 0)
 			return;
 		mail->data.save_body_snippet = FALSE;
 	}
@@ -924,13 +1017,15 @@ static void index_mail_cache_sizes(struct index_mail *mail)
 
 	/* store the virtual size in index if
 		extension for it exists or
-		extension for box virtual size exists and
+		extension for box virtual size exists or
+		mail is being saved and mail_vsize_on_save is set and
 		size fits and is present and
 		size is not cached or
 		cached size differs
 	*/
 	if ((mail_index_map_get_ext_idx(view->map, _mail->box->mail_vsize_ext_id, &idx) ||
-	     mail_index_map_get_ext_idx(view->map, _mail->box->vsize_hdr_ext_id, &idx)) &&
+	     mail_index_map_get_ext_idx(view->map, _mail->box->vsize_hdr_ext_id, &idx) ||
+	     (_mail->saving && _mail->box->storage->set->mail_vsize_on_save)) &&
 	    (sizes[0] != (uoff_t)-1 &&
 	     sizes[0] < (uint32_t)-1)) {
 		const uint32_t *vsize_ext =
@@ -1053,6 +1148,18 @@ static int index_mail_write_body_snippet(struct index_mail *mail)
 		return 0;
 	}
 
+	if (mail->data.snippet_parts != NULL) {
+		/* the snippet was already generated while saving the mail,
+		   unless the part wasn't one of the first text parts */
+		str = str_new(mail->mail.data_pool, 128);
+		str_append(str, BODY_SNIPPET_ALGO_V1);
+		if (message_snippet_parts_get(mail->data.snippet_parts,
+					      part, str)) {
+			mail->data.body_snippet = str_c(str);
+			return 0;
+		}
+	}
+
 	old_offset = mail->data.stream == NULL ? 0 : mail->data.stream->v_offset;
 	const char *reason = index_mail_cache_reason(&mail->mail.mail, "snippet");
 	if (mail_get_stream_because(&mail->mail.mail, NULL, NULL, reason, &input) < 0)
@@ -1643,7 +1750,11 @@ void index_mail_init(struct index_mail *mail,
 	mail->mail.mail.transaction = t;
 	index_mail_init_event(&mail->mail.mail);
 	t->mail_ref_count++;
-	mail->mail.data_pool = pool_alloconly_create("index_mail", 16384);
+	mail->mail.data_pool =
+		pool_alloconly_create("index_mail",
+				      INDEX_MAIL_DATA_POOL_INITIAL_SIZE);
+	mail->data_pool_size =
+		pool_alloconly_get_total_alloc_size(mail->mail.data_pool);
 	mail->ibox = INDEX_STORAGE_CONTEXT(t->box);
 	mail->mail.wanted_fields = wanted_fields;
 	if (wanted_headers != NULL) {
@@ -1666,6 +1777,7 @@ static void index_mail_close_streams_full(struct index_mail *mail, bool closing)
 		if (mail->data.save_bodystructure_body)
 			mail->data.save_bodystructure_header = TRUE;
 	}
+	message_snippet_parts_deinit(&data->snippet_parts);
 	i_stream_unref(&data->filter_stream);
 	if (data->stream != NULL) {
 		struct istream *orig_stream = data->stream;
@@ -1716,10 +1828,32 @@ static void index_mail_init_data(struct index_mail *mail)
 	}
 }
 
+static void index_mail_reset_data_pool(struct index_mail *mail)
+{
+	size_t size;
+
+	size = pool_alloconly_get_total_alloc_size(mail->mail.data_pool);
+	if (size <= mail->data_pool_size ||
+	    size > INDEX_MAIL_DATA_POOL_MAX_SIZE) {
+		p_clear(mail->mail.data_pool);
+		return;
+	}
+
+	/* The mail didn't fit into the pool's first block. Clearing the pool
+	   would free the other blocks, and they would most likely just be
+	   allocated again for the next mail. Replace the pool with one that
+	   has a large enough first block, so iterating through mails
+	   normally doesn't allocate any memory for them. */
+	pool_unref(&mail->mail.data_pool);
+	mail->mail.data_pool = pool_alloconly_create("index_mail", size);
+	mail->data_pool_size =
+		pool_alloconly_get_total_alloc_size(mail->mail.data_pool);
+}
+
 static void index_mail_reset_data(struct index_mail *mail)
 {
 	i_zero(&mail->data);
-	p_clear(mail->mail.data_pool);
+	index_mail_reset_data_pool(mail);
 
 	index_mail_init_data(mail);
 
@@ -1959,6 +2093,12 @@ void index_mail_update_access_parts_post(struct mail *_mail)
 	}
 }
 
+static void index_mail_event_add_fields(struct event *event, struct mail *mail)
+{
+	event_add_int(event, "seq", mail->seq);
+	event_add_int(event, "uid", mail->uid);
+}
+
 void index_mail_set_seq(struct mail *_mail, uint32_t seq, bool saving)
 {
 	struct index_mail *mail = INDEX_MAIL(_mail);
@@ -1979,8 +2119,9 @@ void index_mail_set_seq(struct mail *_mail, uint32_t seq, bool saving)
 	mail_index_lookup_uid(_mail->transaction->view, seq,
 			      &mail->mail.mail.uid);
 
-	event_add_int(_mail->event, "seq", _mail->seq);
-	event_add_int(_mail->event, "uid", _mail->uid);
+	/* most mail events are never logged or sent to stats */
+	event_set_fields_callback(_mail->event, index_mail_event_add_fields,
+				  _mail);
 	event_set_append_log_prefix(_mail->event, t_strdup_printf(
 		"%sUID %u: ", saving ? "saving " : "", _mail->uid));
 
@@ -2140,8 +2281,20 @@ void index_mail_cache_parse_continue(struct mail *_mail)
 	struct index_mail *mail = INDEX_MAIL(_mail);
 	struct message_block block;
 
+	if (mail->data.save_body_snippet && !mail->data.header_parsed &&
+	    mail->data.snippet_parts == NULL) {
+		/* generate the snippet while the mail is being parsed,
+		   instead of reading the text part again afterwards */
+		mail->data.snippet_parts =
+			message_snippet_parts_init(mail->mail.data_pool,
+						   BODY_SNIPPET_MAX_CHARS);
+	}
+
 	while (message_parser_parse_next_block(mail->data.parser_ctx,
 					       &block) > 0) {
+		if (mail->data.snippet_parts != NULL)
+			message_snippet_parts_more(mail->data.snippet_parts,
+						   &block);
 		if (block.size != 0)
 			continue;
 
@@ -2439,6 +2592,7 @@ void index_mail_save_finish(struct mail_save_context *ctx)
 	struct index_mail *imail = INDEX_MAIL(ctx->dest_mail);
 
 	index_mail_save_finish_make_snippet(imail);
+	index_mail_save_finish_binary_parts(imail);
 
 	if (ctx->data.from_envelope != NULL &&
 	    imail->data.from_envelope == NULL) {
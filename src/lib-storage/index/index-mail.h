@@ -24,6 +24,7 @@ enum index_cache_field {
 	MAIL_CACHE_MESSAGE_PARTS,
 	MAIL_CACHE_BINARY_PARTS,
 	MAIL_CACHE_BODY_SNIPPET,
+	MAIL_CACHE_MESSAGE_PARTS_DATA,
 
 	MAIL_INDEX_CACHE_FIELD_COUNT
 };
@@ -104,6 +105,10 @@ struct index_mail_data {
 	struct message_size hdr_size, body_size;
 	struct istream *parser_input;
 	struct message_parser_ctx *parser_ctx;
+	/* snippets generated while saving the mail */
+	struct message_snippet_parts *snippet_parts;
+	/* mail_search_indexed_headers lines seen while saving the mail */
+	string_t *header_bloom_input;
 	int parsing_count;
 	ARRAY_TYPE(keywords) keywords;
 	ARRAY_TYPE(keyword_indexes) keyword_indexes;
@@ -116,6 +121,8 @@ struct index_mail_data {
 	bool save_bodystructure_body:1;
 	bool save_message_parts:1;
 	bool save_body_snippet:1;
+	/* the current header line is in mail_search_indexed_headers */
+	bool header_bloom_line:1;
 	bool stream_has_only_header:1;
 	bool parsed_bodystructure:1;
 	bool parsed_bodystructure_header:1;
@@ -153,6 +160,8 @@ struct index_mail {
 	ARRAY(uint8_t) header_match;
 	ARRAY(unsigned int) header_match_lines;
 	uint8_t header_match_value;
+	/* data_pool's allocated size when it's empty */
+	size_t data_pool_size;
 
 	bool pop3_state_set:1;
 	/* close() is being called from mail_free() */
@@ -227,6 +236,9 @@ int index_mail_get_binary_stream(struct mail *_mail,
 				 bool include_hdr, uoff_t *size_r,
 				 unsigned int *body_lines_r, bool *binary_r,
 				 struct istream **stream_r);
+/* Add binary.parts to cache for the mail being saved, if the caching
+   decision wants it. */
+void index_mail_save_finish_binary_parts(struct index_mail *mail);
 int index_mail_get_special(struct mail *_mail, enum mail_fetch_field field,
 			   const char **value_r);
 int index_mail_get_backend_mail(struct mail *mail, struct mail **real_mail_r);
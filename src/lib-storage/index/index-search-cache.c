@@ -0,0 +1,374 @@
+/* Copyright (c) 2018 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "str.h"
+#include "seq-range-array.h"
+#include "mail-index-modseq.h"
+#include "mail-search.h"
+#include "index-storage.h"
+#include "index-search-private.h"
+#include "index-search-cache.h"
+
+/* The cache is kept in the main index file's header, so don't save results
+   that are larger than this many UID ranges. */
+#define INDEX_SEARCH_CACHE_MAX_RANGES 256
+
+enum index_search_cache_entry_flags {
+	/* The result depends on flags, keywords or modseqs. It's valid only
+	   as long as the mailbox's highest-modseq doesn't change. */
+	INDEX_SEARCH_CACHE_ENTRY_FLAG_DYNAMIC	= 0x01
+};
+
+struct index_search_cache_header {
+	uint32_t entry_count;
+	/* struct index_search_cache_entry[entry_count] */
+};
+
+struct index_search_cache_entry {
+	uint32_t key_size;
+	uint32_t range_count;
+	/* mailbox state at the time of the search */
+	uint32_t uid_validity;
+	uint32_t next_uid;
+	uint32_t messages_count;
+	uint32_t flags; /* enum index_search_cache_entry_flags */
+	uint64_t highest_modseq;
+	/* unsigned char key[key_size], padded to 32bit;
+	   struct seq_range uids[range_count]; */
+};
+
+struct index_search_cache {
+	string_t *key;
+	struct index_search_cache_entry state;
+	bool unchanged;
+
+	/* Messages with sequences below known_seq_limit match only if they're
+	   in known_seqs. */
+	ARRAY_TYPE(seq_range) known_seqs;
+	uint32_t known_seq_limit;
+	unsigned int known_seq_idx;
+
+	ARRAY_TYPE(seq_range) result_uids;
+	bool finished;
+};
+
+static bool
+index_search_cache_args_analyze(const struct mail_search_arg *arg,
+				bool *dynamic, bool *useful)
+{
+	for (; arg != NULL; arg = arg->next) {
+		switch (arg->type) {
+		case SEARCH_OR:
+		case SEARCH_SUB:
+			if (!index_search_cache_args_analyze(arg->value.subargs,
+							     dynamic, useful))
+				return FALSE;
+			break;
+		case SEARCH_ALL:
+			break;
+		case SEARCH_SEQSET:
+		case SEARCH_UIDSET:
+			/* sequences are valid only within the session, and
+			   UID sets are mostly used for fetching. neither
+			   benefits from caching. */
+		case SEARCH_INTHREAD:
+		case SEARCH_MAILBOX:
+		case SEARCH_MAILBOX_GUID:
+		case SEARCH_MAILBOX_GLOB:
+		case SEARCH_REAL_UID:
+			return FALSE;
+		case SEARCH_BEFORE:
+		case SEARCH_SINCE:
+			/* OLDER and YOUNGER (and other UTC times) are written
+			   relative to the current time, so the same key would
+			   later mean a different time. */
+			if ((arg->value.search_flags &
+			     MAIL_SEARCH_ARG_FLAG_UTC_TIMES) != 0)
+				return FALSE;
+			*useful = TRUE;
+			break;
+		case SEARCH_FLAGS:
+			/* \Recent is specific to the session and changing it
+			   doesn't update the modseq */
+			if ((arg->value.flags & MAIL_RECENT) != 0)
+				return FALSE;
+			/* fall through */
+		case SEARCH_KEYWORDS:
+		case SEARCH_MODSEQ:
+			*dynamic = TRUE;
+			*useful = TRUE;
+			break;
+		default:
+			/* the rest of the args never change their result
+			   for an existing message */
+			*useful = TRUE;
+			break;
+		}
+	}
+	return TRUE;
+}
+
+static size_t
+index_search_cache_entry_size(const struct index_search_cache_entry *entry)
+{
+	return sizeof(*entry) + (((size_t)entry->key_size + 3) & ~(size_t)3) +
+		(size_t)entry->range_count * sizeof(struct seq_range);
+}
+
+/* Read the next entry from the header. Returns FALSE if there are no more
+   entries or the header is broken. */
+static bool
+index_search_cache_entry_next(const unsigned char **pos,
+			      const unsigned char *end,
+			      struct index_search_cache_entry *entry_r,
+			      const unsigned char **key_r,
+			      const unsigned char **uids_r)
+{
+	if ((size_t)(end - *pos) < sizeof(*entry_r))
+		return FALSE;
+	memcpy(entry_r, *pos, sizeof(*entry_r));
+	if (entry_r->key_size > (size_t)(end - *pos) ||
+	    entry_r->range_count > INDEX_SEARCH_CACHE_MAX_RANGES ||
+	    index_search_cache_entry_size(entry_r) > (size_t)(end - *pos))
+		return FALSE;
+
+	*key_r = *pos + sizeof(*entry_r);
+	*uids_r = *key_r + ((entry_r->key_size + 3) & ~3U);
+	*pos += index_search_cache_entry_size(entry_r);
+	return TRUE;
+}
+
+static void
+index_search_cache_get_header(struct index_search_context *ctx,
+			      const unsigned char **pos_r,
+			      const unsigned char **end_r,
+			      unsigned int *entry_count_r)
+{
+	struct index_search_cache_header hdr;
+	const void *data;
+	size_t size;
+
+	mail_index_get_header_ext(ctx->view, ctx->box->search_cache_hdr_ext_id,
+				  &data, &size);
+	if (size < sizeof(hdr)) {
+		*pos_r = *end_r = NULL;
+		*entry_count_r = 0;
+		return;
+	}
+	memcpy(&hdr, data, sizeof(hdr));
+	*pos_r = CONST_PTR_OFFSET(data, sizeof(hdr));
+	*end_r = CONST_PTR_OFFSET(data, size);
+	*entry_count_r = hdr.entry_count;
+}
+
+static void
+index_search_cache_use_entry(struct index_search_context *ctx,
+			     const struct index_search_cache_entry *entry,
+			     const unsigned char *uids)
+{
+	struct index_search_cache *cache = ctx->search_cache;
+	struct seq_range range;
+	uint32_t seq1, seq2;
+	unsigned int i;
+
+	/* the entry's UIDs are the result for all the messages that existed
+	   at the time, i.e. the ones below its next_uid */
+	for (i = 0; i < entry->range_count; i++) {
+		memcpy(&range, uids + i * sizeof(range), sizeof(range));
+		if (range.seq1 > range.seq2 || range.seq1 == 0 ||
+		    range.seq2 >= entry->next_uid) {
+			/* broken - ignore the whole entry */
+			array_clear(&cache->known_seqs);
+			cache->unchanged = FALSE;
+			return;
+		}
+		if (mail_index_lookup_seq_range(ctx->view, range.seq1,
+						range.seq2, &seq1, &seq2))
+			seq_range_array_add_range(&cache->known_seqs, seq1, seq2);
+	}
+	if (!mail_index_lookup_seq_range(ctx->view, entry->next_uid,
+					 (uint32_t)-1, &seq1, &seq2))
+		seq1 = mail_index_view_get_messages_count(ctx->view) + 1;
+	cache->known_seq_limit = seq1;
+}
+
+static void index_search_cache_lookup(struct index_search_context *ctx)
+{
+	struct index_search_cache *cache = ctx->search_cache;
+	struct index_search_cache_entry entry;
+	const unsigned char *pos, *end, *key, *uids;
+	unsigned int i, count;
+
+	index_search_cache_get_header(ctx, &pos, &end, &count);
+	for (i = 0; i < count; i++) {
+		if (!index_search_cache_entry_next(&pos, end, &entry,
+						   &key, &uids))
+			break;
+		if (entry.key_size != str_len(cache->key) ||
+		    memcmp(key, str_data(cache->key), entry.key_size) != 0)
+			continue;
+
+		if (entry.uid_validity != cache->state.uid_validity ||
+		    entry.flags != cache->state.flags ||
+		    entry.next_uid > cache->state.next_uid)
+			break;
+		cache->unchanged = entry.next_uid == cache->state.next_uid &&
+			entry.messages_count == cache->state.messages_count &&
+			entry.highest_modseq == cache->state.highest_modseq;
+		if ((entry.flags & INDEX_SEARCH_CACHE_ENTRY_FLAG_DYNAMIC) != 0 &&
+		    !cache->unchanged) {
+			/* some flags may have changed */
+			break;
+		}
+		index_search_cache_use_entry(ctx, &entry, uids);
+		break;
+	}
+}
+
+void index_search_cache_init(struct index_search_context *ctx)
+{
+	struct mailbox *box = ctx->box;
+	struct mail_search_args *args = ctx->mail_ctx.args;
+	const struct mail_index_header *hdr;
+	struct index_search_cache *cache;
+	bool dynamic = FALSE, useful = FALSE;
+	const char *error;
+
+	if (box->storage->set->mail_search_cache_entries == 0 ||
+	    args->have_inthreads || args->stop_on_nonmatch ||
+	    ctx->have_mailbox_args || box->view_pvt != NULL)
+		return;
+	if (!index_search_cache_args_analyze(args->args, &dynamic, &useful) ||
+	    !useful)
+		return;
+	if (dynamic && !mail_index_have_modseq_tracking(box->index)) {
+		/* we can't know when flags change */
+		return;
+	}
+
+	cache = i_new(struct index_search_cache, 1);
+	cache->key = str_new(default_pool, 128);
+	if (!mail_search_args_to_imap(cache->key, args->args, &error)) {
+		str_free(&cache->key);
+		i_free(cache);
+		return;
+	}
+	hdr = mail_index_get_header(ctx->view);
+	cache->state.key_size = str_len(cache->key);
+	cache->state.uid_validity = hdr->uid_validity;
+	cache->state.next_uid = hdr->next_uid;
+	cache->state.messages_count =
+		mail_index_view_get_messages_count(ctx->view);
+	cache->state.flags = dynamic ? INDEX_SEARCH_CACHE_ENTRY_FLAG_DYNAMIC : 0;
+	cache->state.highest_modseq = mail_index_modseq_get_highest(ctx->view);
+	i_array_init(&cache->known_seqs, 8);
+	i_array_init(&cache->result_uids, 32);
+	ctx->search_cache = cache;
+
+	index_search_cache_lookup(ctx);
+}
+
+static void index_search_cache_save(struct index_search_context *ctx,
+				    struct index_search_cache *cache)
+{
+	struct mail_index_transaction *itrans = ctx->mail_ctx.transaction->itrans;
+	uint32_t ext_id = ctx->box->search_cache_hdr_ext_id;
+	struct index_search_cache_header hdr;
+	struct index_search_cache_entry entry;
+	const unsigned char *pos, *end, *key, *uids, *entry_start;
+	unsigned int i, count, max_count;
+	buffer_t *buf;
+
+	cache->state.range_count = array_count(&cache->result_uids);
+	if (cache->state.range_count > INDEX_SEARCH_CACHE_MAX_RANGES)
+		return;
+
+	buf = t_buffer_create(256);
+	i_zero(&hdr);
+	buffer_append(buf, &hdr, sizeof(hdr));
+
+	/* the newest entry is first, followed by the older ones */
+	hdr.entry_count = 1;
+	buffer_append(buf, &cache->state, sizeof(cache->state));
+	buffer_append(buf, str_data(cache->key), str_len(cache->key));
+	buffer_append_zero(buf, ((str_len(cache->key) + 3) & ~3U) -
+			   str_len(cache->key));
+	if (cache->state.range_count > 0) {
+		buffer_append(buf, array_front(&cache->result_uids),
+			      cache->state.range_count * sizeof(struct seq_range));
+	}
+
+	max_count = ctx->box->storage->set->mail_search_cache_entries;
+	index_search_cache_get_header(ctx, &pos, &end, &count);
+	for (i = 0; i < count && hdr.entry_count < max_count; i++) {
+		entry_start = pos;
+		if (!index_search_cache_entry_next(&pos, end, &entry,
+						   &key, &uids))
+			break;
+		if (entry.key_size == str_len(cache->key) &&
+		    memcmp(key, str_data(cache->key), entry.key_size) == 0)
+			continue;
+		buffer_append(buf, entry_start, pos - entry_start);
+		hdr.entry_count++;
+	}
+	buffer_write(buf, 0, &hdr, sizeof(hdr));
+
+	mail_index_ext_resize_hdr(itrans, ext_id, buf->used);
+	mail_index_update_header_ext(itrans, ext_id, 0, buf->data, buf->used);
+}
+
+void index_search_cache_deinit(struct index_search_context *ctx, bool success)
+{
+	struct index_search_cache *cache = ctx->search_cache;
+
+	if (cache == NULL)
+		return;
+	ctx->search_cache = NULL;
+
+	if (success && cache->finished && !cache->unchanged &&
+	    !mailbox_search_seen_lost_data(&ctx->mail_ctx)) T_BEGIN {
+		index_search_cache_save(ctx, cache);
+	} T_END;
+
+	array_free(&cache->known_seqs);
+	array_free(&cache->result_uids);
+	str_free(&cache->key);
+	i_free(cache);
+}
+
+int index_search_cache_next_seq(struct index_search_context *ctx,
+				uint32_t *seq)
+{
+	struct index_search_cache *cache = ctx->search_cache;
+	const struct seq_range *range;
+	unsigned int count;
+
+	range = array_get(&cache->known_seqs, &count);
+	while (*seq < cache->known_seq_limit) {
+		while (cache->known_seq_idx < count &&
+		       range[cache->known_seq_idx].seq2 < *seq)
+			cache->known_seq_idx++;
+		if (cache->known_seq_idx == count) {
+			/* the rest of the known messages don't match */
+			*seq = cache->known_seq_limit;
+			break;
+		}
+		if (range[cache->known_seq_idx].seq1 <= *seq)
+			return 1;
+		*seq = range[cache->known_seq_idx].seq1;
+	}
+	return -1;
+}
+
+void index_search_cache_add_match(struct index_search_context *ctx,
+				  uint32_t uid)
+{
+	seq_range_array_add(&ctx->search_cache->result_uids, uid);
+}
+
+void index_search_cache_finished(struct index_search_context *ctx)
+{
+	ctx->search_cache->finished = TRUE;
+}
@@ -0,0 +1,24 @@
+#ifndef INDEX_SEARCH_CACHE_H
+#define INDEX_SEARCH_CACHE_H
+
+struct index_search_context;
+
+/* Look up the search's previous result from the mailbox's persistent search
+   result cache. Does nothing if the search can't be cached. */
+void index_search_cache_init(struct index_search_context *ctx);
+/* Save the search's result to the cache if the search finished successfully,
+   and free the cache context. */
+void index_search_cache_deinit(struct index_search_context *ctx, bool success);
+
+/* Returns 1 if the message at *seq is known to match, -1 if the result isn't
+   known. *seq is first moved past all the messages that are known not to
+   match. */
+int index_search_cache_next_seq(struct index_search_context *ctx,
+				uint32_t *seq);
+/* Remember that the message was returned as a match. */
+void index_search_cache_add_match(struct index_search_context *ctx,
+				  uint32_t uid);
+/* All the matches have been returned. */
+void index_search_cache_finished(struct index_search_context *ctx);
+
+#endif
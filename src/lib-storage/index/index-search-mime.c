@@ -541,8 +541,14 @@ static int search_arg_match_mimepart(struct search_mimepart_context *mpctx,
 		p_array_init(&mpctx->stack, mpctx->pool, 16);
 	}
 	if (mpctx->mime_parts == NULL) {
-		/* FIXME: could the mail object already have message_part tree with
-		   data? */
+		/* use the mail's message_part tree if it already has the data,
+		   e.g. from the mime.parts.data cache field */
+		mail_add_temp_wanted_fields(ctx->cur_mail,
+					    MAIL_FETCH_IMAP_BODYSTRUCTURE, NULL);
+		if (mail_get_parts(ctx->cur_mail, &mpctx->mime_parts) < 0)
+			return -1;
+	}
+	if (mpctx->mime_parts->data == NULL) {
 		if (mail_get_special(ctx->cur_mail,
 			MAIL_FETCH_IMAP_BODYSTRUCTURE, &bodystructure) < 0)
 			return -1;
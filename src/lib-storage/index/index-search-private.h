@@ -7,6 +7,9 @@
 
 struct mail_search_mime_part;
 struct imap_message_part;
+struct index_search_cache;
+struct message_search_context;
+struct message_search_multi_context;
 
 struct index_search_context {
         struct mail_search_context mail_ctx;
@@ -22,6 +25,11 @@ struct index_search_context {
 	struct mail *cur_mail;
 	struct index_mail *cur_imail;
 	struct mail_thread_context *thread_ctx;
+	struct index_search_cache *search_cache;
+	/* BODY/TEXT keys that were searched from the previous mail, and the
+	   multi-key search context built for them */
+	ARRAY(struct message_search_context *) body_search_ctxs;
+	struct message_search_multi_context *body_search;
 
 	struct timeval search_start_time, last_notify;
 	struct timeval last_nonblock_timeval;
@@ -32,6 +40,8 @@ struct index_search_context {
 	bool have_seqsets:1;
 	bool have_index_args:1;
 	bool have_mailbox_args:1;
+	/* the current message is known to match from the search cache */
+	bool search_cache_match:1;
 };
 
 struct mail *index_search_get_mail(struct index_search_context *ctx);
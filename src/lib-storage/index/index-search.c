@@ -21,6 +21,8 @@
 #include "mailbox-search-result-private.h"
 #include "mailbox-recent-flags.h"
 #include "index-search-private.h"
+#include "index-search-cache.h"
+#include "index-header-bloom.h"
 
 #include <ctype.h>
 
@@ -56,6 +58,9 @@ struct search_body_context {
         struct index_search_context *index_ctx;
 	struct istream *input;
 	struct message_part *part;
+
+	ARRAY(struct mail_search_arg *) args;
+	ARRAY(struct message_search_context *) msg_search_ctxs;
 };
 
 static void search_parse_msgset_args(unsigned int messages_count,
@@ -403,6 +408,8 @@ static int search_arg_match_cached(struct index_search_context *ctx,
 			return -1;
 		}
 		return strcmp(str, arg->value.str) == 0 ? 1 : 0;
+	case SEARCH_HEADER:
+		return index_header_bloom_match(ctx, arg);
 	case SEARCH_REAL_UID: {
 		struct mail *real_mail;
 
@@ -671,12 +678,10 @@ static void search_header(struct message_header_line *hdr,
 	}
 }
 
-static void search_body(struct mail_search_arg *arg,
-			struct search_body_context *ctx)
+static void search_body_add(struct mail_search_arg *arg,
+			    struct search_body_context *ctx)
 {
 	struct message_search_context *msg_search_ctx;
-	const char *error;
-	int ret;
 
 	switch (arg->type) {
 	case SEARCH_BODY:
@@ -691,15 +696,60 @@ static void search_body(struct mail_search_arg *arg,
 		ARG_SET_RESULT(arg, 0);
 		return;
 	}
+	array_push_back(&ctx->args, &arg);
+	array_push_back(&ctx->msg_search_ctxs, &msg_search_ctx);
+}
+
+static struct message_search_multi_context *
+search_body_get_multi(struct search_body_context *ctx)
+{
+	struct index_search_context *index_ctx = ctx->index_ctx;
+
+	/* usually all the mails are searched with the same keys, so keep the
+	   multi-key context until the keys change */
+	if (index_ctx->body_search != NULL &&
+	    array_cmp(&index_ctx->body_search_ctxs, &ctx->msg_search_ctxs))
+		return index_ctx->body_search;
+
+	if (index_ctx->body_search != NULL)
+		message_search_multi_deinit(&index_ctx->body_search);
+	if (!array_is_created(&index_ctx->body_search_ctxs))
+		i_array_init(&index_ctx->body_search_ctxs, 8);
+	array_clear(&index_ctx->body_search_ctxs);
+	array_append_array(&index_ctx->body_search_ctxs, &ctx->msg_search_ctxs);
+	index_ctx->body_search =
+		message_search_multi_init(array_front(&ctx->msg_search_ctxs),
+					  array_count(&ctx->msg_search_ctxs));
+	return index_ctx->body_search;
+}
+
+static void search_body(struct search_body_context *ctx)
+{
+	struct message_search_multi_context *multi_ctx;
+	struct mail_search_arg *const *args;
+	const char *error;
+	unsigned int i, count;
+	bool *matches;
+	int ret;
+
+	/* search all the keys with a single pass over the mail, so it gets
+	   parsed, decoded and scanned only once */
+	count = array_count(&ctx->msg_search_ctxs);
+	if (count == 0)
+		return;
+	matches = t_new(bool, count);
+	multi_ctx = search_body_get_multi(ctx);
 
 	i_stream_seek(ctx->input, 0);
-	ret = message_search_msg(msg_search_ctx, ctx->input, ctx->part, &error);
+	ret = message_search_multi_msg(multi_ctx, ctx->input, ctx->part,
+				       matches, &error);
 	if (ret < 0 && ctx->input->stream_errno == 0) {
 		/* try again without cached parts */
 		index_mail_set_message_parts_corrupted(ctx->index_ctx->cur_mail, error);
 
 		i_stream_seek(ctx->input, 0);
-		ret = message_search_msg(msg_search_ctx, ctx->input, NULL, &error);
+		ret = message_search_multi_msg(multi_ctx, ctx->input, NULL,
+					       matches, &error);
 		i_assert(ret >= 0 || ctx->input->stream_errno != 0);
 	}
 	if (ctx->input->stream_errno != 0) {
@@ -708,7 +758,9 @@ static void search_body(struct mail_search_arg *arg,
 			i_stream_get_error(ctx->input));
 	}
 
-	ARG_SET_RESULT(arg, ret);
+	args = array_idx(&ctx->args, 0);
+	for (i = 0; i < count; i++)
+		ARG_SET_RESULT(args[i], ret < 0 ? -1 : (matches[i] ? 1 : 0));
 }
 
 static int search_arg_match_text(struct mail_search_arg *args,
@@ -843,7 +895,11 @@ static int search_arg_match_text(struct mail_search_arg *args,
 	(void)mail_get_parts(ctx->cur_mail, &body_ctx.part);
 	ctx->cur_mail->lookup_abort = MAIL_LOOKUP_ABORT_NEVER;
 
-	return mail_search_args_foreach(args, search_body, &body_ctx);
+	t_array_init(&body_ctx.args, 8);
+	t_array_init(&body_ctx.msg_search_ctxs, 8);
+	(void)mail_search_args_foreach(args, search_body_add, &body_ctx);
+	search_body(&body_ctx);
+	return mail_search_args_foreach(args, search_none, NULL);
 }
 
 static bool
@@ -1266,6 +1322,101 @@ wanted_sort_fields_get(struct mailbox *box,
 	}
 }
 
+/* The order in which the args are evaluated. Args that can be checked from
+   the index are evaluated before the ones that may need to open the mail,
+   so that a nonmatching cheap arg can skip the expensive ones. */
+enum search_arg_cost {
+	SEARCH_ARG_COST_INDEX = 0,
+	SEARCH_ARG_COST_CACHE,
+	SEARCH_ARG_COST_HEADER,
+	SEARCH_ARG_COST_BODY
+};
+
+static enum search_arg_cost
+search_arg_get_cost(const struct mail_search_arg *arg)
+{
+	const struct mail_search_arg *subarg;
+	enum search_arg_cost cost, subcost;
+
+	switch (arg->type) {
+	case SEARCH_OR:
+	case SEARCH_SUB:
+		/* all the subargs may need to be evaluated */
+		cost = SEARCH_ARG_COST_INDEX;
+		subarg = arg->value.subargs;
+		for (; subarg != NULL; subarg = subarg->next) {
+			subcost = search_arg_get_cost(subarg);
+			if (cost < subcost)
+				cost = subcost;
+		}
+		return cost;
+	case SEARCH_ALL:
+	case SEARCH_SEQSET:
+	case SEARCH_UIDSET:
+	case SEARCH_FLAGS:
+	case SEARCH_KEYWORDS:
+	case SEARCH_MODSEQ:
+	case SEARCH_INTHREAD:
+	case SEARCH_MAILBOX:
+	case SEARCH_MAILBOX_GUID:
+	case SEARCH_MAILBOX_GLOB:
+	case SEARCH_REAL_UID:
+		return SEARCH_ARG_COST_INDEX;
+	case SEARCH_BEFORE:
+	case SEARCH_ON:
+	case SEARCH_SINCE:
+		if (arg->value.date_type == MAIL_SEARCH_DATE_TYPE_SENT)
+			return SEARCH_ARG_COST_HEADER;
+		return SEARCH_ARG_COST_CACHE;
+	case SEARCH_SMALLER:
+	case SEARCH_LARGER:
+	case SEARCH_GUID:
+		return SEARCH_ARG_COST_CACHE;
+	case SEARCH_HEADER:
+	case SEARCH_HEADER_ADDRESS:
+	case SEARCH_HEADER_COMPRESS_LWSP:
+		return SEARCH_ARG_COST_HEADER;
+	case SEARCH_BODY:
+	case SEARCH_TEXT:
+	case SEARCH_MIMEPART:
+		break;
+	}
+	return SEARCH_ARG_COST_BODY;
+}
+
+static void search_args_sort_by_cost(struct mail_search_arg **_args)
+{
+	ARRAY(struct mail_search_arg *) args;
+	ARRAY(enum search_arg_cost) costs;
+	struct mail_search_arg *arg, *const *argp;
+	enum search_arg_cost cost;
+	unsigned int i, count;
+
+	t_array_init(&args, 8);
+	t_array_init(&costs, 8);
+	for (arg = *_args; arg != NULL; arg = arg->next) {
+		if (arg->type == SEARCH_SUB || arg->type == SEARCH_OR)
+			search_args_sort_by_cost(&arg->value.subargs);
+		cost = search_arg_get_cost(arg);
+
+		/* stable insertion sort - the lists are short */
+		for (i = array_count(&costs); i > 0; i--) {
+			if (*array_idx(&costs, i-1) <= cost)
+				break;
+		}
+		array_insert(&args, i, &arg, 1);
+		array_insert(&costs, i, &cost, 1);
+	}
+
+	argp = array_get(&args, &count);
+	if (count == 0)
+		return;
+	for (i = 1; i < count; i++)
+		argp[i-1]->next = argp[i];
+	argp[count-1]->next = NULL;
+	*_args = argp[0];
+}
+
 struct mail_search_context *
 index_storage_search_init(struct mailbox_transaction_context *t,
 			  struct mail_search_args *args,
@@ -1299,6 +1450,9 @@ index_storage_search_init(struct mailbox_transaction_context *t,
 		     sizeof(void *), 5);
 	i_array_init(&ctx->mail_ctx.mails, ctx->mail_ctx.max_mails);
 
+	T_BEGIN {
+		search_args_sort_by_cost(&args->args);
+	} T_END;
 	mail_search_args_reset(ctx->mail_ctx.args->args, TRUE);
 	if (args->have_inthreads) {
 		if (mail_thread_init(t->box, NULL, &ctx->thread_ctx) < 0)
@@ -1322,6 +1476,7 @@ index_storage_search_init(struct mailbox_transaction_context *t,
 
 	/* Need to reset results for match_always cases */
 	mail_search_args_reset(ctx->mail_ctx.args->args, FALSE);
+	index_search_cache_init(ctx);
 	return &ctx->mail_ctx;
 }
 
@@ -1350,6 +1505,10 @@ int index_storage_search_deinit(struct mail_search_context *_ctx)
 
 	ret = ctx->failed ? -1 : 0;
 
+	if (ctx->body_search != NULL)
+		message_search_multi_deinit(&ctx->body_search);
+	if (array_is_created(&ctx->body_search_ctxs))
+		array_free(&ctx->body_search_ctxs);
 	mail_search_args_reset(ctx->mail_ctx.args->args, FALSE);
 	(void)mail_search_args_foreach(ctx->mail_ctx.args->args,
 				       search_arg_deinit, ctx);
@@ -1361,6 +1520,7 @@ int index_storage_search_deinit(struct mail_search_context *_ctx)
 	}
 	if (ctx->thread_ctx != NULL)
 		mail_thread_deinit(&ctx->thread_ctx);
+	index_search_cache_deinit(ctx, ret == 0);
 	array_free(&ctx->mail_ctx.results);
 	array_free(&ctx->mail_ctx.module_contexts);
 
@@ -1485,6 +1645,11 @@ static int search_match_next(struct index_search_context *ctx)
 	unsigned int i, n = N_ELEMENTS(cache_lookups);
 	int ret = -1;
 
+	if (ctx->search_cache_match) {
+		/* the same search already matched this message earlier */
+		return 1;
+	}
+
 	if (ctx->have_mailbox_args) {
 		/* check that the mailbox name matches.
 		   this makes sense only with virtual mailboxes. */
@@ -1793,10 +1958,11 @@ static int search_more(struct index_search_context *ctx,
 	return ret;
 }
 
-bool index_storage_search_next_nonblock(struct mail_search_context *_ctx,
-					struct mail **mail_r, bool *tryagain_r)
+static bool
+index_search_next_nonblock(struct index_search_context *ctx,
+			   struct mail **mail_r, bool *tryagain_r)
 {
-        struct index_search_context *ctx = (struct index_search_context *)_ctx;
+	struct mail_search_context *_ctx = &ctx->mail_ctx;
 	struct mail *mail, *const *mailp;
 	uint32_t seq;
 	int ret;
@@ -1842,6 +2008,21 @@ bool index_storage_search_next_nonblock(struct mail_search_context *_ctx,
 	return TRUE;
 }
 
+bool index_storage_search_next_nonblock(struct mail_search_context *_ctx,
+					struct mail **mail_r, bool *tryagain_r)
+{
+        struct index_search_context *ctx = (struct index_search_context *)_ctx;
+
+	if (!index_search_next_nonblock(ctx, mail_r, tryagain_r)) {
+		if (ctx->search_cache != NULL && !*tryagain_r)
+			index_search_cache_finished(ctx);
+		return FALSE;
+	}
+	if (ctx->search_cache != NULL)
+		index_search_cache_add_match(ctx, (*mail_r)->uid);
+	return TRUE;
+}
+
 bool index_storage_search_next_update_seq(struct mail_search_context *_ctx)
 {
         struct index_search_context *ctx = (struct index_search_context *)_ctx;
@@ -1855,6 +2036,14 @@ bool index_storage_search_next_update_seq(struct mail_search_context *_ctx)
 		_ctx->seq++;
 	}
 
+	ctx->search_cache_match = FALSE;
+	if (ctx->search_cache != NULL &&
+	    index_search_cache_next_seq(ctx, &_ctx->seq) > 0) {
+		ctx->search_cache_match = TRUE;
+		_ctx->progress_cur = _ctx->seq;
+		return _ctx->seq <= ctx->seq2;
+	}
+
 	if (!ctx->have_seqsets && !ctx->have_index_args &&
 	    _ctx->update_result == NULL) {
 		_ctx->progress_cur = _ctx->seq;
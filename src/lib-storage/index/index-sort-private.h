@@ -8,6 +8,8 @@ struct mail_search_sort_program {
 	enum mail_sort_type sort_program[MAX_SORT_PROGRAM_SIZE];
 	struct mail *temp_mail;
 	unsigned int slow_mails_left;
+	/* index extensions caching the primary ARRIVAL, DATE and SIZE keys */
+	uint32_t arrival_ext_id, date_ext_id, size_ext_id;
 
 	void (*sort_list_add)(struct mail_search_sort_program *program,
 			      struct mail *mail);
@@ -27,6 +29,17 @@ int index_sort_node_cmp_type(struct mail_search_sort_program *program,
 			     const enum mail_sort_type *sort_program,
 			     uint32_t seq1, uint32_t seq2);
 
+/* Sort the nodes using cmp. If they're already sorted or they're in exactly
+   the reverse order (e.g. REVERSE ARRIVAL), this is done in O(n) time
+   without qsort(). */
+void index_sort_nodes_i(struct array *nodes,
+			int (*cmp)(const void *, const void *));
+#define index_sort_nodes(nodes, cmp) \
+	index_sort_nodes_i(&(nodes)->arr + \
+		CALLBACK_TYPECHECK(cmp, int (*)(typeof(*(nodes)->v), \
+						typeof(*(nodes)->v))), \
+		(int (*)(const void *, const void *))cmp)
+
 void index_sort_list_init_string(struct mail_search_sort_program *program);
 void index_sort_list_add_string(struct mail_search_sort_program *program,
 				struct mail *mail);
@@ -71,6 +71,107 @@ index_sort_program_set_date_failed(struct mail_search_sort_program *program,
 	}
 }
 
+/* The ARRIVAL, DATE and SIZE sort keys never change for a mail, so once
+   they're looked up they're stored to index extension records. This way
+   the following sorts don't need to access the cache file at all. Key 0
+   means that the key isn't known yet. */
+static bool
+index_sort_lookup_key(struct mail_search_sort_program *program,
+		      uint32_t ext_id, uint32_t seq, uint64_t *key_r)
+{
+	const void *data;
+	bool expunged;
+
+	mail_index_lookup_ext(program->t->view, seq, ext_id, &data, &expunged);
+	if (data == NULL || expunged)
+		return FALSE;
+	*key_r = *(const uint64_t *)data;
+	return *key_r != 0;
+}
+
+static void
+index_sort_update_key(struct mail_search_sort_program *program,
+		      uint32_t ext_id, uint32_t seq, uint64_t key)
+{
+	if (key == 0 || mail_index_is_expunged(program->t->view, seq))
+		return;
+	mail_index_update_ext(program->t->itrans, seq, ext_id, &key, NULL);
+}
+
+/* dates may be negative, so bias them to keep the keys' ordering */
+#define INDEX_SORT_DATE_KEY(date) \
+	((uint64_t)(int64_t)(date) + (1ULL << 63))
+
+static bool
+index_sort_lookup_date(struct mail_search_sort_program *program,
+		       uint32_t ext_id, uint32_t seq, time_t *date_r)
+{
+	uint64_t key;
+
+	if (!index_sort_lookup_key(program, ext_id, seq, &key))
+		return FALSE;
+	*date_r = (time_t)(int64_t)(key - (1ULL << 63));
+	return TRUE;
+}
+
+static bool
+index_sort_lookup_size(struct mail_search_sort_program *program,
+		       uint32_t seq, uoff_t *size_r)
+{
+	uint64_t key;
+
+	if (!index_sort_lookup_key(program, program->size_ext_id, seq, &key))
+		return FALSE;
+	*size_r = key - 1;
+	return TRUE;
+}
+
+static time_t
+index_sort_mail_get_arrival(struct mail_search_sort_program *program,
+			    struct mail *mail)
+{
+	time_t date;
+
+	if (mail_get_received_date(mail, &date) < 0)
+		return index_sort_program_set_date_failed(program, mail);
+	index_sort_update_key(program, program->arrival_ext_id, mail->seq,
+			      INDEX_SORT_DATE_KEY(date));
+	return date;
+}
+
+static time_t
+index_sort_mail_get_date(struct mail_search_sort_program *program,
+			 struct mail *mail)
+{
+	time_t date;
+	int tz;
+
+	if (mail_get_date(mail, &date, &tz) < 0)
+		return index_sort_program_set_date_failed(program, mail);
+	if (date == 0) {
+		if (mail_get_received_date(mail, &date) < 0)
+			return index_sort_program_set_date_failed(program, mail);
+	}
+	index_sort_update_key(program, program->date_ext_id, mail->seq,
+			      INDEX_SORT_DATE_KEY(date));
+	return date;
+}
+
+static uoff_t
+index_sort_mail_get_size(struct mail_search_sort_program *program,
+			 struct mail *mail)
+{
+	uoff_t size;
+
+	if (mail_get_virtual_size(mail, &size) < 0) {
+		index_sort_program_set_mail_failed(program, mail);
+		return 0;
+	}
+	index_sort_update_key(program, program->size_ext_id, mail->seq,
+			      size + 1);
+	return size;
+}
+
 static void
 index_sort_list_add_arrival(struct mail_search_sort_program *program,
 			    struct mail *mail)
@@ -80,8 +181,9 @@ index_sort_list_add_arrival(struct mail_search_sort_program *program,
 
 	node = array_append_space(nodes);
 	node->seq = mail->seq;
-	if (mail_get_received_date(mail, &node->date) < 0)
-		node->date = index_sort_program_set_date_failed(program, mail);
+	if (!index_sort_lookup_date(program, program->arrival_ext_id,
+				    mail->seq, &node->date))
+		node->date = index_sort_mail_get_arrival(program, mail);
 }
 
 static void
@@ -90,16 +192,12 @@ index_sort_list_add_date(struct mail_search_sort_program *program,
 {
 	ARRAY_TYPE(mail_sort_node_date) *nodes = program->context;
 	struct mail_sort_node_date *node;
-	int tz;
 
 	node = array_append_space(nodes);
 	node->seq = mail->seq;
-	if (mail_get_date(mail, &node->date, &tz) < 0)
-		node->date = index_sort_program_set_date_failed(program, mail);
-	else if (node->date == 0) {
-		if (mail_get_received_date(mail, &node->date) < 0)
-			node->date = index_sort_program_set_date_failed(program, mail);
-	}
+	if (!index_sort_lookup_date(program, program->date_ext_id,
+				    mail->seq, &node->date))
+		node->date = index_sort_mail_get_date(program, mail);
 }
 
 static void
@@ -111,10 +209,8 @@ index_sort_list_add_size(struct mail_search_sort_program *program,
 
 	node = array_append_space(nodes);
 	node->seq = mail->seq;
-	if (mail_get_virtual_size(mail, &node->size) < 0) {
-		index_sort_program_set_mail_failed(program, mail);
-		node->size = 0;
-	}
+	if (!index_sort_lookup_size(program, mail->seq, &node->size))
+		node->size = index_sort_mail_get_size(program, mail);
 }
 
 static int index_sort_get_pop3_order(struct mail *mail, uoff_t *size_r)
@@ -216,7 +312,7 @@ index_sort_list_finish_date(struct mail_search_sort_program *program)
 {
 	ARRAY_TYPE(mail_sort_node_date) *nodes = program->context;
 
-	array_sort(nodes, sort_node_date_cmp);
+	index_sort_nodes(nodes, sort_node_date_cmp);
 	memcpy(&program->seqs, nodes, sizeof(program->seqs));
 	i_free(nodes);
 	program->context = NULL;
@@ -242,7 +338,7 @@ index_sort_list_finish_size(struct mail_search_sort_program *program)
 {
 	ARRAY_TYPE(mail_sort_node_size) *nodes = program->context;
 
-	array_sort(nodes, sort_node_size_cmp);
+	index_sort_nodes(nodes, sort_node_size_cmp);
 	memcpy(&program->seqs, nodes, sizeof(program->seqs));
 	i_free(nodes);
 	program->context = NULL;
@@ -279,6 +375,34 @@ index_sort_list_finish_float(struct mail_search_sort_program *program)
 	program->context = NULL;
 }
 
+void index_sort_nodes_i(struct array *nodes,
+			int (*cmp)(const void *, const void *))
+{
+	const unsigned char *data = nodes->buffer->data;
+	size_t size = nodes->element_size;
+	unsigned int i, count = array_count_i(nodes);
+	bool ascending = TRUE, descending = TRUE;
+	int ret;
+
+	/* nodes are added in sequence order, so they're commonly already
+	   sorted by ARRIVAL and DATE, or the exact opposite with REVERSE. */
+	for (i = 1; i < count && (ascending || descending); i++) {
+		ret = cmp(data + (i-1) * size, data + i * size);
+		if (ret > 0)
+			ascending = FALSE;
+		else
+			descending = FALSE;
+	}
+	if (ascending)
+		return;
+	if (descending) {
+		/* each node sorts strictly before the previous one */
+		array_reverse_i(nodes);
+		return;
+	}
+	array_sort_i(nodes, cmp);
+}
+
 void index_sort_list_finish(struct mail_search_sort_program *program)
 {
 	i_zero(&static_node_cmp_context);
@@ -331,6 +455,16 @@ index_sort_program_init(struct mailbox_transaction_context *t,
 	if (i == MAX_SORT_PROGRAM_SIZE)
 		i_panic("index_sort_program_init(): Invalid sort program");
 
+	program->arrival_ext_id =
+		mail_index_ext_register(t->box->index, "sort-a", 0,
+					sizeof(uint64_t), sizeof(uint64_t));
+	program->date_ext_id =
+		mail_index_ext_register(t->box->index, "sort-d", 0,
+					sizeof(uint64_t), sizeof(uint64_t));
+	program->size_ext_id =
+		mail_index_ext_register(t->box->index, "sort-z", 0,
+					sizeof(uint64_t), sizeof(uint64_t));
+
 	switch (program->sort_program[0] & MAIL_SORT_MASK) {
 	case MAIL_SORT_ARRIVAL:
 	case MAIL_SORT_DATE: {
@@ -550,7 +684,7 @@ int index_sort_node_cmp_type(struct mail_search_sort_program *program,
 	time_t time1, time2;
 	uoff_t size1, size2;
 	float float1, float2;
-	int tz, ret = 0;
+	int ret = 0;
 
 	sort_type = *sort_program & MAIL_SORT_MASK;
 	switch (sort_type) {
@@ -574,48 +708,43 @@ int index_sort_node_cmp_type(struct mail_search_sort_program *program,
 		} T_END;
 		break;
 	case MAIL_SORT_ARRIVAL:
-		index_sort_set_seq(program, mail, seq1);
-		if (mail_get_received_date(mail, &time1) < 0)
-			time1 = index_sort_program_set_date_failed(program, mail);
-
-		index_sort_set_seq(program, mail, seq2);
-		if (mail_get_received_date(mail, &time2) < 0)
-			time2 = index_sort_program_set_date_failed(program, mail);
+		if (!index_sort_lookup_date(program, program->arrival_ext_id,
+					    seq1, &time1)) {
+			index_sort_set_seq(program, mail, seq1);
+			time1 = index_sort_mail_get_arrival(program, mail);
+		}
+		if (!index_sort_lookup_date(program, program->arrival_ext_id,
+					    seq2, &time2)) {
+			index_sort_set_seq(program, mail, seq2);
+			time2 = index_sort_mail_get_arrival(program, mail);
+		}
 
 		ret = time1 < time2 ? -1 :
 			(time1 > time2 ? 1 : 0);
 		break;
 	case MAIL_SORT_DATE:
-		index_sort_set_seq(program, mail, seq1);
-		if (mail_get_date(mail, &time1, &tz) < 0)
-			time1 = index_sort_program_set_date_failed(program, mail);
-		else if (time1 == 0) {
-			if (mail_get_received_date(mail, &time1) < 0)
-				time1 = index_sort_program_set_date_failed(program, mail);
+		if (!index_sort_lookup_date(program, program->date_ext_id,
+					    seq1, &time1)) {
+			index_sort_set_seq(program, mail, seq1);
+			time1 = index_sort_mail_get_date(program, mail);
 		}
-
-		index_sort_set_seq(program, mail, seq2);
-		if (mail_get_date(mail, &time2, &tz) < 0)
-			time2 = index_sort_program_set_date_failed(program, mail);
-		else if (time2 == 0) {
-			if (mail_get_received_date(mail, &time2) < 0)
-				time2 = index_sort_program_set_date_failed(program, mail);
+		if (!index_sort_lookup_date(program, program->date_ext_id,
+					    seq2, &time2)) {
+			index_sort_set_seq(program, mail, seq2);
+			time2 = index_sort_mail_get_date(program, mail);
 		}
 
 		ret = time1 < time2 ? -1 :
 			(time1 > time2 ? 1 : 0);
 		break;
 	case MAIL_SORT_SIZE:
-		index_sort_set_seq(program, mail, seq1);
-		if (mail_get_virtual_size(mail, &size1) < 0) {
-			index_sort_program_set_mail_failed(program, mail);
-			size1 = 0;
+		if (!index_sort_lookup_size(program, seq1, &size1)) {
+			index_sort_set_seq(program, mail, seq1);
+			size1 = index_sort_mail_get_size(program, mail);
 		}
-
-		index_sort_set_seq(program, mail, seq2);
-		if (mail_get_virtual_size(mail, &size2) < 0) {
-			index_sort_program_set_mail_failed(program, mail);
-			size2 = 0;
+		if (!index_sort_lookup_size(program, seq2, &size2)) {
+			index_sort_set_seq(program, mail, seq2);
+			size2 = index_sort_mail_get_size(program, mail);
 		}
 
 		ret = size1 < size2 ? -1 :
@@ -17,6 +17,7 @@
 #include "index-storage.h"
 #include "index-mail.h"
 #include "index-attachment.h"
+#include "index-header-bloom.h"
 #include "index-thread-private.h"
 #include "index-mailbox-size.h"
 
@@ -276,6 +277,8 @@ int index_storage_mailbox_alloc_index(struct mailbox *box)
 			.compress_delete_percentage = set->mail_cache_compress_delete_percentage,
 			.compress_continued_percentage = set->mail_cache_compress_continued_percentage,
 			.compress_header_continue_count = set->mail_cache_compress_header_continue_count,
+			.compress_incremental_count = set->mail_cache_compress_incremental_count,
+			.columns = set->mail_cache_columns,
 		},
 	};
 	mail_index_set_optimization_settings(box->index, &optimization_set);
@@ -359,6 +362,9 @@ int index_storage_mailbox_open(struct mailbox *box, bool move_to_memory)
 	box->mail_vsize_ext_id = mail_index_ext_register(box->index, "vsize", 0,
 							 sizeof(uint32_t),
 							 sizeof(uint32_t));
+	box->search_cache_hdr_ext_id =
+		mail_index_ext_register(box->index, "hdr-search-cache", 0, 0, 0);
+	index_header_bloom_register(box);
 
 	box->opened = TRUE;
 
@@ -44,6 +44,10 @@ struct index_mailbox_context {
 
 	time_t sync_last_check;
 	uint32_t list_index_sync_ext_id;
+
+	uint32_t header_bloom_ext_id;
+	/* mail_search_indexed_headers as NUL-separated names, NULL if none */
+	const buffer_t *header_bloom_names;
 };
 
 #define INDEX_STORAGE_CONTEXT(obj) \
@@ -6,6 +6,9 @@
 #include "mail-index-strmap.h"
 
 #define MAIL_THREAD_INDEX_SUFFIX ".thread"
+/* The thread tree built for the whole mailbox is saved here, so new
+   sessions don't need to rebuild it. */
+#define MAIL_THREAD_TREE_SUFFIX ".thread-tree"
 
 /* After initially building the index, assign first_invalid_msgid_idx to
    the next unused index + SKIP_COUNT. When more messages are added and
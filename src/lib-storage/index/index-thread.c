@@ -4,8 +4,13 @@
 
 #include "lib.h"
 #include "array.h"
+#include "str.h"
+#include "crc32.h"
 #include "bsearch-insert-pos.h"
 #include "hash2.h"
+#include "read-full.h"
+#include "write-full.h"
+#include "safe-mkstemp.h"
 #include "message-id.h"
 #include "mail-search.h"
 #include "mail-search-build.h"
@@ -13,6 +18,10 @@
 #include "index-storage.h"
 #include "index-thread-private.h"
 
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #define MAIL_THREAD_CONTEXT(obj) \
 	MODULE_CONTEXT(obj, mail_thread_storage_module)
@@ -46,6 +55,29 @@ struct mail_thread_mailbox {
 
 	/* set only temporarily while needed */
 	struct mail_thread_context *ctx;
+
+	/* cache has changed since it was read from or written to the thread
+	   tree file */
+	bool tree_changed:1;
+};
+
+struct mail_thread_tree_header {
+#define MAIL_THREAD_TREE_VERSION 1
+	uint8_t version;
+	uint8_t node_size;
+	uint8_t unused[2];
+
+	uint32_t uid_validity;
+	uint32_t last_uid;
+	/* Number of messages in the tree */
+	uint32_t messages_count;
+	/* crc32 of the msgid_map records up to last_uid. The saved tree can
+	   be used only if the string indexes haven't changed. */
+	uint32_t msgid_map_crc32;
+	uint32_t first_invalid_msgid_str_idx;
+	uint32_t next_invalid_msgid_str_idx;
+	uint32_t nodes_count;
+	/* struct mail_thread_node nodes[nodes_count] */
 };
 
 static MODULE_CONTEXT_DEFINE_INIT(mail_thread_storage_module,
@@ -225,6 +257,7 @@ static void mail_thread_strmap_remap(const uint32_t *idx_map,
 	/* replace the old nodes with the renumbered ones */
 	array_free(&cache->thread_nodes);
 	cache->thread_nodes = new_nodes;
+	tbox->tree_changed = TRUE;
 }
 
 static int thread_get_mail_header(struct mail *mail, const char *name,
@@ -388,6 +421,8 @@ static bool mail_thread_cache_update_removes(struct mail_thread_mailbox *tbox,
 	   UID in msgid_map */
 	msgid_map = array_get(tbox->msgid_map, &map_count);
 	uids = array_get(&removed_uids, &uid_count);
+	if (uid_count > 0)
+		tbox->tree_changed = TRUE;
 	for (i = j = 0; i < uid_count; i++) {
 		/* find and remove from the map */
 		bsearch_insert_pos(&uids[i].seq1, &msgid_map[j],
@@ -431,6 +466,7 @@ static void mail_thread_cache_update_adds(struct mail_thread_mailbox *tbox,
 	uids = array_get(added_uids, &uid_count);
 	if (uid_count == 0)
 		return;
+	tbox->tree_changed = TRUE;
 
 	(void)array_bsearch_insert_pos(tbox->msgid_map, &uids[0].seq1,
 				       msgid_map_cmp, &j);
@@ -496,6 +532,187 @@ static void mail_thread_cache_sync_remove(struct mail_thread_mailbox *tbox,
 	mailbox_search_result_free(&cache->search_result);
 }
 
+static bool mail_thread_search_args_is_all(const struct mail_search_args *args)
+{
+	return args->args != NULL && args->args->next == NULL &&
+		args->args->type == SEARCH_ALL && !args->args->match_not;
+}
+
+static const char *mail_thread_tree_get_path(struct mailbox *box)
+{
+	const char *dir;
+
+	if (mail_index_is_in_memory(box->index) ||
+	    mailbox_get_path_to(box, MAILBOX_LIST_PATH_TYPE_INDEX, &dir) <= 0)
+		return NULL;
+	return t_strconcat(dir, "/", box->index_prefix,
+			   MAIL_THREAD_TREE_SUFFIX, NULL);
+}
+
+static uint32_t
+mail_thread_msgid_map_crc32(struct mail_thread_mailbox *tbox, uint32_t last_uid)
+{
+	const struct mail_index_strmap_rec *msgid_map;
+	uint32_t next_uid = last_uid + 1;
+	unsigned int idx, count;
+
+	(void)array_bsearch_insert_pos(tbox->msgid_map, &next_uid,
+				       msgid_map_cmp, &idx);
+	msgid_map = array_get(tbox->msgid_map, &count);
+	while (idx > 0 && msgid_map[idx-1].uid >= next_uid)
+		idx--;
+	return crc32_data(msgid_map, idx * sizeof(*msgid_map));
+}
+
+static bool
+mail_thread_tree_read_nodes(struct mail_thread_mailbox *tbox,
+			    struct mailbox *box, int fd, const char *path,
+			    const struct mail_thread_tree_header *hdr)
+{
+	struct mail_thread_node *nodes;
+	size_t size = hdr->nodes_count * sizeof(*nodes);
+	unsigned int i;
+	bool ret = TRUE;
+	int ret2;
+
+	nodes = i_malloc(I_MAX(size, 1));
+	if ((ret2 = read_full(fd, nodes, size)) <= 0) {
+		if (ret2 < 0)
+			mailbox_set_critical(box, "read(%s) failed: %m", path);
+		ret = FALSE;
+	}
+	for (i = 0; i < hdr->nodes_count && ret; i++) {
+		if (nodes[i].parent_idx >= hdr->nodes_count ||
+		    (nodes[i].parent_idx == i && i != 0))
+			ret = FALSE;
+	}
+	if (ret) {
+		array_clear(&tbox->cache->thread_nodes);
+		array_append(&tbox->cache->thread_nodes, nodes,
+			     hdr->nodes_count);
+	}
+	i_free(nodes);
+	return ret;
+}
+
+static bool
+mail_thread_tree_read(struct mail_thread_mailbox *tbox, struct mailbox *box)
+{
+	struct mail_thread_cache *cache = tbox->cache;
+	struct mail_thread_tree_header hdr;
+	const char *path;
+	struct stat st;
+	uint32_t seq1, seq2, messages_count;
+	bool ret = FALSE;
+	int fd, ret2;
+
+	path = mail_thread_tree_get_path(box);
+	if (path == NULL)
+		return FALSE;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		if (errno != ENOENT)
+			mailbox_set_critical(box, "open(%s) failed: %m", path);
+		return FALSE;
+	}
+	if (fstat(fd, &st) < 0) {
+		mailbox_set_critical(box, "fstat(%s) failed: %m", path);
+		i_close_fd(&fd);
+		return FALSE;
+	}
+	if ((ret2 = read_full(fd, &hdr, sizeof(hdr))) <= 0) {
+		if (ret2 < 0)
+			mailbox_set_critical(box, "read(%s) failed: %m", path);
+		i_close_fd(&fd);
+		return FALSE;
+	}
+
+	mailbox_get_seq_range(box, 1, hdr.last_uid, &seq1, &seq2);
+	messages_count = seq1 == 0 ? 0 : seq2 - seq1 + 1;
+	if (hdr.version != MAIL_THREAD_TREE_VERSION ||
+	    hdr.node_size != sizeof(struct mail_thread_node) ||
+	    hdr.uid_validity != mail_index_get_header(box->view)->uid_validity ||
+	    (uoff_t)st.st_size != sizeof(hdr) +
+	    	(uoff_t)hdr.nodes_count * sizeof(struct mail_thread_node) ||
+	    hdr.first_invalid_msgid_str_idx > hdr.next_invalid_msgid_str_idx) {
+		/* old or broken - rebuild */
+	} else if (hdr.messages_count != messages_count ||
+		   hdr.msgid_map_crc32 !=
+		   mail_thread_msgid_map_crc32(tbox, hdr.last_uid)) {
+		/* messages were expunged or the string indexes changed */
+	} else if (mail_thread_tree_read_nodes(tbox, box, fd, path, &hdr)) {
+		cache->last_uid = hdr.last_uid;
+		cache->first_invalid_msgid_str_idx =
+			hdr.first_invalid_msgid_str_idx;
+		cache->next_invalid_msgid_str_idx =
+			hdr.next_invalid_msgid_str_idx;
+		ret = TRUE;
+	}
+	i_close_fd(&fd);
+	return ret;
+}
+
+static void
+mail_thread_tree_write(struct mail_thread_mailbox *tbox, struct mailbox *box)
+{
+	struct mail_thread_cache *cache = tbox->cache;
+	const struct mailbox_permissions *perm;
+	struct mail_thread_tree_header hdr;
+	const struct mail_thread_node *nodes;
+	const char *path, *temp_path;
+	unsigned int i, count;
+	string_t *str;
+	int fd;
+
+	if (!mail_thread_search_args_is_all(cache->search_result->search_args) ||
+	    tbox->strmap_view == NULL)
+		return;
+	if ((path = mail_thread_tree_get_path(box)) == NULL)
+		return;
+
+	nodes = array_get(&cache->thread_nodes, &count);
+	i_zero(&hdr);
+	hdr.version = MAIL_THREAD_TREE_VERSION;
+	hdr.node_size = sizeof(*nodes);
+	hdr.uid_validity = mail_index_get_header(box->view)->uid_validity;
+	hdr.last_uid = cache->last_uid;
+	for (i = 0; i < count; i++) {
+		if (MAIL_THREAD_NODE_EXISTS(&nodes[i]))
+			hdr.messages_count++;
+	}
+	hdr.msgid_map_crc32 = mail_thread_msgid_map_crc32(tbox, cache->last_uid);
+	hdr.first_invalid_msgid_str_idx = cache->first_invalid_msgid_str_idx;
+	hdr.next_invalid_msgid_str_idx = cache->next_invalid_msgid_str_idx;
+	hdr.nodes_count = count;
+
+	perm = mailbox_get_permissions(box);
+	str = t_str_new(256);
+	str_append(str, path);
+	fd = safe_mkstemp_hostpid_group(str, perm->file_create_mode,
+					perm->file_create_gid,
+					perm->file_create_gid_origin);
+	temp_path = str_c(str);
+	if (fd == -1) {
+		mailbox_set_critical(box, "safe_mkstemp(%s) failed: %m",
+				     temp_path);
+		return;
+	}
+	if (write_full(fd, &hdr, sizeof(hdr)) < 0 ||
+	    write_full(fd, nodes, count * sizeof(*nodes)) < 0) {
+		mailbox_set_critical(box, "write(%s) failed: %m", temp_path);
+		i_close_fd(&fd);
+	} else if (close(fd) < 0) {
+		mailbox_set_critical(box, "close(%s) failed: %m", temp_path);
+	} else if (rename(temp_path, path) < 0) {
+		mailbox_set_critical(box, "rename(%s, %s) failed: %m",
+				     temp_path, path);
+	} else {
+		return;
+	}
+	i_unlink(temp_path);
+}
+
 static void mail_thread_cache_sync_add(struct mail_thread_mailbox *tbox,
 				       struct mail_thread_context *ctx,
 				       struct mail_search_context *search_ctx)
@@ -504,21 +721,31 @@ static void mail_thread_cache_sync_add(struct mail_thread_mailbox *tbox,
 	struct mail *mail;
 	const struct mail_index_strmap_rec *msgid_map;
 	unsigned int i, count;
-
-	mail_thread_cache_fix_invalid_indexes(tbox);
+	uint32_t read_last_uid = 0;
 
 	if (cache->search_result != NULL) {
 		/* we already checked at sync_remove that we can use this
 		   search result. */
+		mail_thread_cache_fix_invalid_indexes(tbox);
 		mail_thread_cache_update_adds(tbox, &ctx->added_uids);
 		return;
 	}
 
-	cache->last_uid = 0;
-	cache->first_invalid_msgid_str_idx = cache->next_invalid_msgid_str_idx =
-		mail_index_strmap_view_get_highest_idx(tbox->strmap_view) + 1 +
-		THREAD_INVALID_MSGID_STR_IDX_SKIP_COUNT;
-	array_clear(&cache->thread_nodes);
+	if (mail_thread_search_args_is_all(ctx->search_args) &&
+	    mail_thread_tree_read(tbox, ctx->box)) {
+		/* only the messages added after the tree was saved need to
+		   be added to it */
+		read_last_uid = cache->last_uid;
+		mail_thread_cache_fix_invalid_indexes(tbox);
+	} else {
+		cache->last_uid = 0;
+		cache->first_invalid_msgid_str_idx =
+			cache->next_invalid_msgid_str_idx =
+			mail_index_strmap_view_get_highest_idx(tbox->strmap_view) +
+			1 + THREAD_INVALID_MSGID_STR_IDX_SKIP_COUNT;
+		array_clear(&cache->thread_nodes);
+		tbox->tree_changed = TRUE;
+	}
 
 	cache->search_result =
 		mailbox_search_result_save(search_ctx,
@@ -531,10 +758,13 @@ static void mail_thread_cache_sync_add(struct mail_thread_mailbox *tbox,
 	i_assert(msgid_map[count].uid == 0);
 	i = 0;
 	while (i < count && mailbox_search_next(search_ctx, &mail)) {
+		if (mail->uid <= read_last_uid)
+			continue;
 		while (msgid_map[i].uid < mail->uid)
 			i++;
 		i_assert(i < count);
 		mail_thread_add(cache, msgid_map+i, &i);
+		tbox->tree_changed = TRUE;
 	}
 }
 
@@ -621,6 +851,9 @@ static void mail_thread_mailbox_close(struct mailbox *box)
 
 	i_assert(tbox->ctx == NULL);
 
+	if (tbox->tree_changed && tbox->cache->search_result != NULL)
+		mail_thread_tree_write(tbox, box);
+	tbox->tree_changed = FALSE;
 	if (tbox->strmap_view != NULL)
 		mail_index_strmap_view_close(&tbox->strmap_view);
 	if (tbox->cache->search_result != NULL)
@@ -1,5 +1,6 @@
 /* Copyright (c) 2002-2018 Dovecot authors, see the included COPYING file */
 
+#define _GNU_SOURCE /* for sync_file_range() */
 #include "lib.h"
 #include "ioloop.h"
 #include "array.h"
@@ -36,6 +37,8 @@ struct maildir_filename {
 	enum mail_flags flags;
 	unsigned int pop3_order;
 	bool preserve_filename:1;
+	/* file is fsynced only at commit */
+	bool fsync_pending:1;
 	ARRAY_TYPE(keyword_indexes) keywords;
 };
 
@@ -562,8 +565,9 @@ static int maildir_save_finish_real(struct mail_save_context *_ctx)
 		ctx->have_keywords = TRUE;
 	}
 
-	if (storage->set->parsed_fsync_mode != FSYNC_MODE_NEVER &&
-	    !ctx->failed) {
+	if (ctx->failed) {
+		/* no need to fsync */
+	} else if (storage->set->parsed_fsync_mode == FSYNC_MODE_ALWAYS) {
 		if (fsync(ctx->fd) < 0) {
 			if (!mail_storage_set_error_from_errno(storage)) {
 				mail_set_critical(_ctx->dest_mail,
@@ -571,6 +575,15 @@ static int maildir_save_finish_real(struct mail_save_context *_ctx)
 			}
 			ctx->failed = TRUE;
 		}
+	} else if (storage->set->parsed_fsync_mode == FSYNC_MODE_OPTIMIZED) {
+		/* The file only needs to be on disk before it's moved to
+		   new/ or cur/ at commit. Don't make the client wait for it
+		   after each mail of e.g. MULTIAPPEND, but start writing
+		   the data already so there's little left for the fsync. */
+#ifdef HAVE_SYNC_FILE_RANGE
+		(void)sync_file_range(ctx->fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+#endif
+		ctx->file_last->fsync_pending = TRUE;
 	}
 	real_size = lseek(ctx->fd, 0, SEEK_END);
 	if (real_size == (off_t)-1) {
@@ -648,6 +661,34 @@ maildir_save_unlink_files(struct maildir_save_context *ctx)
 	ctx->files = NULL;
 }
 
+static int maildir_save_fsync_files(struct maildir_save_context *ctx)
+{
+	struct maildir_filename *mf;
+	const char *path;
+	int fd, ret = 0;
+
+	for (mf = ctx->files; mf != NULL && ret == 0; mf = mf->next) T_BEGIN {
+		if (mf->fsync_pending) {
+			path = maildir_mf_get_path(ctx, mf);
+			fd = open(path, O_WRONLY);
+			if (fd == -1) {
+				mailbox_set_critical(&ctx->mbox->box,
+					"open(%s) failed: %m", path);
+				ret = -1;
+			} else {
+				if (fsync(fd) < 0) {
+					mailbox_set_critical(&ctx->mbox->box,
+						"fsync(%s) failed: %m", path);
+					ret = -1;
+				}
+				i_close_fd(&fd);
+			}
+			mf->fsync_pending = FALSE;
+		}
+	} T_END;
+	return ret;
+}
+
 static int maildir_transaction_fsync_dirs(struct maildir_save_context *ctx,
 					  bool new_changed, bool cur_changed)
 {
@@ -959,6 +1000,12 @@ int maildir_transaction_save_commit_pre(struct mail_save_context *_ctx)
 	if (ctx->files_count == 0)
 		return 0;
 
+	/* fsync all the saved files at once before locking the uidlist */
+	if (maildir_save_fsync_files(ctx) < 0) {
+		maildir_transaction_save_rollback(_ctx);
+		return -1;
+	}
+
 	sync_flags = MAILDIR_UIDLIST_SYNC_PARTIAL |
 		MAILDIR_UIDLIST_SYNC_NOREFRESH;
 
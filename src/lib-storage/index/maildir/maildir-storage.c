@@ -575,6 +575,7 @@ static void maildir_mailbox_close(struct mailbox *box)
 	if (mbox->keywords != NULL)
 		maildir_keywords_deinit(&mbox->keywords);
 	maildir_uidlist_deinit(&mbox->uidlist);
+	maildir_sync_notify_deinit(mbox);
 	index_storage_mailbox_close(box);
 }
 
@@ -72,6 +72,8 @@ struct maildir_mailbox {
 	struct mail_index_view *flags_view;
 
 	struct timeout *keep_lock_to;
+	/* inotify watches for new/ and cur/ (maildir_sync_inotify) */
+	struct maildir_sync_notify *sync_notify;
 
 	/* Filled lazily by mailbox_get_private_flags_mask() */
 	enum mail_flags _private_flags_mask;
@@ -0,0 +1,215 @@
+/* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "maildir-storage.h"
+#include "maildir-uidlist.h"
+#include "maildir-sync.h"
+
+#ifdef HAVE_INOTIFY_INIT
+
+#include "fd-util.h"
+
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#define MAILDIR_SYNC_NOTIFY_MASK \
+	(IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+	 IN_DELETE_SELF | IN_MOVE_SELF)
+#define MAILDIR_SYNC_NOTIFY_BUFLEN (16*1024)
+
+/* inotify watches for new/ and cur/ directories. The events are read only
+   during syncing, so the ioloop isn't used. The filenames in the events
+   aren't used either - any event simply means that the directory needs to be
+   scanned again the normal way. */
+struct maildir_sync_notify {
+	int fd;
+	/* [0] = new/, [1] = cur/ */
+	int wd[2];
+	/* no events seen since the directory scan began */
+	bool pending[2];
+	/* directory is known to be unchanged since the last successful sync */
+	bool unchanged[2];
+};
+
+static void maildir_sync_notify_disable(struct maildir_mailbox *mbox)
+{
+	struct maildir_sync_notify *notify = mbox->sync_notify;
+
+	/* keep the struct so that inotify_init() isn't attempted again */
+	i_close_fd(&notify->fd);
+	notify->wd[0] = notify->wd[1] = -1;
+	notify->pending[0] = notify->pending[1] = FALSE;
+	notify->unchanged[0] = notify->unchanged[1] = FALSE;
+}
+
+static void maildir_sync_notify_changed(struct maildir_sync_notify *notify,
+					unsigned int idx)
+{
+	notify->pending[idx] = FALSE;
+	notify->unchanged[idx] = FALSE;
+}
+
+static void maildir_sync_notify_drain(struct maildir_mailbox *mbox)
+{
+	struct maildir_sync_notify *notify = mbox->sync_notify;
+	const struct inotify_event *event;
+	unsigned char buf[MAILDIR_SYNC_NOTIFY_BUFLEN];
+	ssize_t ret, pos;
+	unsigned int i;
+
+	if (notify == NULL || notify->fd == -1)
+		return;
+
+	for (;;) {
+		ret = read(notify->fd, buf, sizeof(buf));
+		if (ret < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				break;
+			i_error("read(inotify) failed: %m");
+			maildir_sync_notify_disable(mbox);
+			return;
+		}
+		if (ret == 0)
+			break;
+
+		for (pos = 0; pos + (ssize_t)sizeof(*event) <= ret;
+		     pos += sizeof(*event) + event->len) {
+			event = (const struct inotify_event *)(buf + pos);
+
+			if ((event->mask & IN_Q_OVERFLOW) != 0) {
+				/* some events were lost */
+				maildir_sync_notify_changed(notify, 0);
+				maildir_sync_notify_changed(notify, 1);
+				continue;
+			}
+			for (i = 0; i < N_ELEMENTS(notify->wd); i++) {
+				if (notify->wd[i] != event->wd)
+					continue;
+				maildir_sync_notify_changed(notify, i);
+				if ((event->mask & IN_IGNORED) != 0) {
+					/* the directory was deleted or
+					   unmounted */
+					notify->wd[i] = -1;
+				}
+			}
+		}
+	}
+}
+
+void maildir_sync_notify_scan_begin(struct maildir_mailbox *mbox,
+				    const char *path, bool new_dir)
+{
+	struct maildir_sync_notify *notify = mbox->sync_notify;
+	unsigned int idx = new_dir ? 0 : 1;
+	int fd;
+
+	if (!mbox->storage->set->maildir_sync_inotify)
+		return;
+
+	if (notify == NULL) {
+		fd = inotify_init();
+		if (fd == -1) {
+			if (errno != EMFILE)
+				i_error("inotify_init() failed: %m");
+		} else {
+			fd_close_on_exec(fd, TRUE);
+			fd_set_nonblock(fd, TRUE);
+		}
+		notify = mbox->sync_notify = i_new(struct maildir_sync_notify, 1);
+		notify->fd = fd;
+		notify->wd[0] = notify->wd[1] = -1;
+	}
+	if (notify->fd == -1)
+		return;
+
+	maildir_sync_notify_drain(mbox);
+	if (notify->fd == -1)
+		return;
+
+	if (notify->wd[idx] == -1) {
+		notify->wd[idx] = inotify_add_watch(notify->fd, path,
+						    MAILDIR_SYNC_NOTIFY_MASK);
+		if (notify->wd[idx] == -1) {
+			/* ENOENT can happen if the mailbox is being deleted.
+			   ENOSPC means that the max_user_watches limit was
+			   reached. Just fall back to normal syncing. */
+			if (errno != ENOENT && errno != ENOSPC) {
+				i_error("inotify_add_watch(%s) failed: %m",
+					path);
+			}
+			notify->unchanged[idx] = FALSE;
+			return;
+		}
+	}
+	/* the scan begins after this, so any following event means that the
+	   scan may have missed the change. */
+	notify->pending[idx] = TRUE;
+	notify->unchanged[idx] = FALSE;
+}
+
+void maildir_sync_notify_synced(struct maildir_mailbox *mbox,
+				bool new_scanned, bool cur_scanned)
+{
+	struct maildir_sync_notify *notify = mbox->sync_notify;
+
+	if (notify == NULL || notify->fd == -1)
+		return;
+
+	maildir_sync_notify_drain(mbox);
+	if (new_scanned && notify->pending[0])
+		notify->unchanged[0] = TRUE;
+	if (cur_scanned && notify->pending[1])
+		notify->unchanged[1] = TRUE;
+	notify->pending[0] = notify->pending[1] = FALSE;
+}
+
+bool maildir_sync_notify_is_unchanged(struct maildir_mailbox *mbox,
+				      bool new_dir)
+{
+	struct maildir_sync_notify *notify = mbox->sync_notify;
+	unsigned int idx = new_dir ? 0 : 1;
+
+	maildir_sync_notify_drain(mbox);
+	if (notify == NULL || notify->wd[idx] == -1)
+		return FALSE;
+	return notify->unchanged[idx];
+}
+
+void maildir_sync_notify_deinit(struct maildir_mailbox *mbox)
+{
+	struct maildir_sync_notify *notify = mbox->sync_notify;
+
+	if (notify == NULL)
+		return;
+	mbox->sync_notify = NULL;
+
+	/* closing the fd removes the watches as well */
+	i_close_fd(&notify->fd);
+	i_free(notify);
+}
+
+#else
+
+void maildir_sync_notify_scan_begin(struct maildir_mailbox *mbox ATTR_UNUSED,
+				    const char *path ATTR_UNUSED,
+				    bool new_dir ATTR_UNUSED)
+{
+}
+
+void maildir_sync_notify_synced(struct maildir_mailbox *mbox ATTR_UNUSED,
+				bool new_scanned ATTR_UNUSED,
+				bool cur_scanned ATTR_UNUSED)
+{
+}
+
+bool maildir_sync_notify_is_unchanged(struct maildir_mailbox *mbox ATTR_UNUSED,
+				      bool new_dir ATTR_UNUSED)
+{
+	return FALSE;
+}
+
+void maildir_sync_notify_deinit(struct maildir_mailbox *mbox ATTR_UNUSED)
+{
+}
+
+#endif
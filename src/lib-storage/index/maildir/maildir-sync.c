@@ -229,6 +229,8 @@ struct maildir_sync_context {
 	bool partial:1;
 	bool locked:1;
 	bool racing:1;
+	bool new_scanned:1;
+	bool cur_scanned:1;
 };
 
 void maildir_sync_set_racing(struct maildir_sync_context *ctx)
@@ -413,6 +415,11 @@ maildir_scan_dir(struct maildir_sync_context *ctx, bool new_dir, bool final,
 	bool move_new, dir_changed = FALSE;
 
 	path = new_dir ? ctx->new_dir : ctx->cur_dir;
+	maildir_sync_notify_scan_begin(ctx->mbox, path, new_dir);
+	if (new_dir)
+		ctx->new_scanned = TRUE;
+	else
+		ctx->cur_scanned = TRUE;
 	for (i = 0;; i++) {
 		dirp = opendir(path);
 		if (dirp != NULL)
@@ -626,6 +633,9 @@ static int maildir_sync_quick_check(struct maildir_mailbox *mbox, bool undirty,
 	 (undirty || \
 	  (time_t)(hdr)->name ## _check_time < ioloop_time - MAILDIR_SYNC_SECS))
 
+#define DIR_DELAYED_REFRESH_NEEDED(hdr, name) \
+	(DIR_DELAYED_REFRESH(hdr, name) && !name ## _unchanged)
+
 #define DIR_MTIME_CHANGED(st, hdr, name) \
 	((st).st_mtime != (time_t)(hdr)->name ## _mtime || \
 	 !ST_NTIMES_EQUAL(ST_MTIME_NSEC(st), (hdr)->name ## _mtime_nsecs))
@@ -633,6 +643,7 @@ static int maildir_sync_quick_check(struct maildir_mailbox *mbox, bool undirty,
 	struct maildir_index_header *hdr = &mbox->maildir_hdr;
 	struct stat new_st, cur_st;
 	bool refreshed = FALSE, check_new = FALSE, check_cur = FALSE;
+	bool new_unchanged, cur_unchanged;
 
 	*why_r = 0;
 
@@ -648,20 +659,27 @@ static int maildir_sync_quick_check(struct maildir_mailbox *mbox, bool undirty,
 
 	*new_changed_r = *cur_changed_r = FALSE;
 
+	/* The delayed refresh is needed because a file may have been added
+	   within the same second as the directory was scanned, without
+	   the mtime changing. If inotify has seen no changes since the
+	   directory was fully scanned, this can't have happened. */
+	new_unchanged = maildir_sync_notify_is_unchanged(mbox, TRUE);
+	cur_unchanged = maildir_sync_notify_is_unchanged(mbox, FALSE);
+
 	/* try to avoid stat()ing by first checking delayed changes */
-	if (DIR_DELAYED_REFRESH(hdr, new) ||
-	    (DIR_DELAYED_REFRESH(hdr, cur) &&
+	if (DIR_DELAYED_REFRESH_NEEDED(hdr, new) ||
+	    (DIR_DELAYED_REFRESH_NEEDED(hdr, cur) &&
 	     !mbox->storage->set->maildir_very_dirty_syncs)) {
 		/* refresh index and try again */
 		if (maildir_sync_header_refresh(mbox) < 0)
 			return -1;
 		refreshed = TRUE;
 
-		if (DIR_DELAYED_REFRESH(hdr, new)) {
+		if (DIR_DELAYED_REFRESH_NEEDED(hdr, new)) {
 			*why_r |= WHY_DELAYEDNEW;
 			*new_changed_r = TRUE;
 		}
-		if (DIR_DELAYED_REFRESH(hdr, cur) &&
+		if (DIR_DELAYED_REFRESH_NEEDED(hdr, cur) &&
 		    !mbox->storage->set->maildir_very_dirty_syncs) {
 			*why_r |= WHY_DELAYEDCUR;
 			*cur_changed_r = TRUE;
@@ -977,6 +995,11 @@ maildir_sync_context(struct maildir_sync_context *ctx, bool forced,
 		}
 	}
 
+	if (ctx->locked && !*lost_files_r && !ctx->mbox->syncing_commit) {
+		/* the scanned directories are now fully in the index */
+		maildir_sync_notify_synced(ctx->mbox, ctx->new_scanned,
+					   ctx->cur_scanned);
+	}
 	return maildir_uidlist_sync_deinit(&ctx->uidlist_sync_ctx, TRUE);
 }
 
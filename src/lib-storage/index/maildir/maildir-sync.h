@@ -51,6 +51,16 @@ int maildir_sync_lookup(struct maildir_mailbox *mbox, uint32_t uid,
 int maildir_list_index_has_changed(struct mailbox *box,
 				   struct mail_index_view *list_view,
 				   uint32_t seq, bool quick);
+/* inotify-based tracking of whether new/ and cur/ have been modified since
+   they were last scanned. These do nothing unless maildir_sync_inotify=yes. */
+void maildir_sync_notify_scan_begin(struct maildir_mailbox *mbox,
+				    const char *path, bool new_dir);
+void maildir_sync_notify_synced(struct maildir_mailbox *mbox,
+				bool new_scanned, bool cur_scanned);
+bool maildir_sync_notify_is_unchanged(struct maildir_mailbox *mbox,
+				      bool new_dir);
+void maildir_sync_notify_deinit(struct maildir_mailbox *mbox);
+
 void maildir_list_index_update_sync(struct mailbox *box,
 				    struct mail_index_transaction *trans,
 				    uint32_t seq);
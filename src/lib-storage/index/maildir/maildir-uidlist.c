@@ -80,6 +80,10 @@ struct maildir_uidlist {
 	ARRAY_TYPE(maildir_uidlist_rec_p) records;
 	HASH_TABLE_TYPE(path_to_maildir_uidlist_rec) files;
 	unsigned int change_counter;
+	/* While re-reading a recreated uidlist, the previous records. The
+	   unchanged ones are reused instead of allocating them again. */
+	HASH_TABLE_TYPE(path_to_maildir_uidlist_rec) reuse_files;
+	buffer_t *ext_buf;
 
 	unsigned int version;
 	unsigned int uid_validity, next_uid, prev_read_uid, last_seen_uid;
@@ -275,6 +279,7 @@ struct maildir_uidlist *maildir_uidlist_init(struct maildir_mailbox *mbox)
 			  maildir_filename_base_cmp);
 	uidlist->next_uid = 1;
 	uidlist->hdr_extensions = str_new(default_pool, 128);
+	uidlist->ext_buf = buffer_create_dynamic(default_pool, 128);
 
 	uidlist->dotlock_settings.use_io_notify = TRUE;
 	uidlist->dotlock_settings.use_excl_lock =
@@ -328,10 +333,13 @@ void maildir_uidlist_deinit(struct maildir_uidlist **_uidlist)
 	maildir_uidlist_close(uidlist);
 
 	hash_table_destroy(&uidlist->files);
+	if (hash_table_is_created(uidlist->reuse_files))
+		hash_table_destroy(&uidlist->reuse_files);
 	pool_unref(&uidlist->record_pool);
 
 	array_free(&uidlist->records);
 	str_free(&uidlist->hdr_extensions);
+	buffer_free(&uidlist->ext_buf);
 	i_free(uidlist->path);
 	i_free(uidlist);
 }
@@ -343,6 +351,16 @@ static int maildir_uid_cmp(struct maildir_uidlist_rec *const *rec1,
 		(*rec1)->uid > (*rec2)->uid ? 1 : 0;
 }
 
+static size_t maildir_uidlist_ext_size(const unsigned char *extensions)
+{
+	size_t len;
+
+	for (len = 0; extensions[len] != '\0'; len++) {
+		while (extensions[len] != '\0') len++;
+	}
+	return len + 1;
+}
+
 static void ATTR_FORMAT(2, 3)
 maildir_uidlist_set_corrupted(struct maildir_uidlist *uidlist,
 			      const char *fmt, ...)
@@ -405,13 +423,10 @@ maildir_uidlist_records_array_delete(struct maildir_uidlist *uidlist,
 
 static bool
 maildir_uidlist_read_extended(struct maildir_uidlist *uidlist,
-			      const char **line_p,
-			      struct maildir_uidlist_rec *rec)
+			      const char **line_p, buffer_t *buf)
 {
 	const char *start, *line = *line_p;
-	buffer_t *buf;
 
-	buf = t_buffer_create(128);
 	while (*line != '\0' && *line != ':') {
 		/* skip over an extension field */
 		start = line;
@@ -428,12 +443,8 @@ maildir_uidlist_read_extended(struct maildir_uidlist *uidlist,
 		while (*line == ' ') line++;
 	}
 
-	if (buf->used > 0) {
-		/* save the extensions */
+	if (buf->used > 0)
 		buffer_append_c(buf, '\0');
-		rec->extensions = p_malloc(uidlist->record_pool, buf->used);
-		memcpy(rec->extensions, buf->data, buf->used);
-	}
 
 	if (*line == ':')
 		line++;
@@ -444,6 +455,28 @@ maildir_uidlist_read_extended(struct maildir_uidlist *uidlist,
 	return TRUE;
 }
 
+static struct maildir_uidlist_rec *
+maildir_uidlist_rec_reuse(struct maildir_uidlist *uidlist, uint32_t uid,
+			  const char *filename)
+{
+	struct maildir_uidlist_rec *rec;
+	const buffer_t *ext = uidlist->ext_buf;
+
+	if (!hash_table_is_created(uidlist->reuse_files))
+		return NULL;
+
+	rec = hash_table_lookup(uidlist->reuse_files, filename);
+	if (rec == NULL || rec->uid != uid ||
+	    strcmp(rec->filename, filename) != 0)
+		return NULL;
+	if (rec->extensions == NULL ? ext->used != 0 :
+	    (ext->used != maildir_uidlist_ext_size(rec->extensions) ||
+	     memcmp(rec->extensions, ext->data, ext->used) != 0))
+		return NULL;
+	hash_table_remove(uidlist->reuse_files, filename);
+	return rec;
+}
+
 static bool maildir_uidlist_next(struct maildir_uidlist *uidlist,
 				 const char *line)
 {
@@ -489,19 +522,16 @@ static bool maildir_uidlist_next(struct maildir_uidlist *uidlist,
 		return FALSE;
 	}
 
-	rec = p_new(uidlist->record_pool, struct maildir_uidlist_rec, 1);
-	rec->uid = uid;
-	rec->flags = MAILDIR_UIDLIST_REC_FLAG_NONSYNCED;
-
 	while (*line == ' ') line++;
 
+	buffer_set_used_size(uidlist->ext_buf, 0);
 	if (uidlist->version == UIDLIST_VERSION) {
 		/* read extended fields */
 		bool ret;
 
 		T_BEGIN {
 			ret = maildir_uidlist_read_extended(uidlist, &line,
-							    rec);
+							    uidlist->ext_buf);
 		} T_END;
 		if (!ret) {
 			maildir_uidlist_set_corrupted(uidlist, 
@@ -517,6 +547,19 @@ static bool maildir_uidlist_next(struct maildir_uidlist *uidlist,
 		return FALSE;
 	}
 
+	rec = maildir_uidlist_rec_reuse(uidlist, uid, line);
+	if (rec == NULL) {
+		rec = p_new(uidlist->record_pool, struct maildir_uidlist_rec, 1);
+		rec->uid = uid;
+		if (uidlist->ext_buf->used > 0) {
+			rec->extensions = p_malloc(uidlist->record_pool,
+						   uidlist->ext_buf->used);
+			memcpy(rec->extensions, uidlist->ext_buf->data,
+			       uidlist->ext_buf->used);
+		}
+	}
+	rec->flags = MAILDIR_UIDLIST_REC_FLAG_NONSYNCED;
+
 	old_rec = hash_table_lookup(uidlist->files, line);
 	if (old_rec == NULL) {
 		/* no conflicts */
@@ -561,7 +604,8 @@ static bool maildir_uidlist_next(struct maildir_uidlist *uidlist,
 		uidlist->unsorted = TRUE;
 	}
 
-	rec->filename = p_strdup(uidlist->record_pool, line);
+	if (rec->filename == NULL)
+		rec->filename = p_strdup(uidlist->record_pool, line);
 	hash_table_update(uidlist->files, rec->filename, rec);
 	array_push_back(&uidlist->records, &rec);
 	return TRUE;
@@ -926,6 +970,15 @@ static int maildir_uidlist_open_latest(struct maildir_uidlist *uidlist)
 
 		if (!recreated)
 			return 0;
+		if (!hash_table_is_created(uidlist->reuse_files)) {
+			/* usually most of the records are the same in the
+			   new file */
+			uidlist->reuse_files = uidlist->files;
+			hash_table_create(&uidlist->files, default_pool,
+					  hash_table_count(uidlist->reuse_files),
+					  maildir_filename_base_hash,
+					  maildir_filename_base_cmp);
+		}
 		maildir_uidlist_reset(uidlist);
 	}
 
@@ -959,6 +1012,8 @@ int maildir_uidlist_refresh(struct maildir_uidlist *uidlist)
 		/* ESTALE - try reopening and rereading */
 		maildir_uidlist_close(uidlist);
         }
+	if (hash_table_is_created(uidlist->reuse_files))
+		hash_table_destroy(&uidlist->reuse_files);
 	if (ret >= 0) {
 		uidlist->initial_read = TRUE;
 		uidlist->initial_hdr_read = TRUE;
@@ -1732,19 +1787,14 @@ maildir_uidlist_sync_next_partial(struct maildir_uidlist_sync_ctx *ctx,
 static unsigned char *ext_dup(pool_t pool, const unsigned char *extensions)
 {
 	unsigned char *ret;
+	size_t len;
 
 	if (extensions == NULL)
 		return NULL;
 
-	T_BEGIN {
-		unsigned int len;
-
-		for (len = 0; extensions[len] != '\0'; len++) {
-			while (extensions[len] != '\0') len++;
-		}
-		ret = p_malloc(pool, len + 1);
-		memcpy(ret, extensions, len);
-	} T_END;
+	len = maildir_uidlist_ext_size(extensions);
+	ret = p_malloc(pool, len);
+	memcpy(ret, extensions, len);
 	return ret;
 }
 
@@ -20,6 +20,7 @@ static const struct setting_define mbox_setting_defines[] = {
 	DEF(SET_BOOL, mbox_dirty_syncs),
 	DEF(SET_BOOL, mbox_very_dirty_syncs),
 	DEF(SET_BOOL, mbox_lazy_writes),
+	DEF(SET_BOOL, mbox_flags_in_index),
 	DEF(SET_ENUM, mbox_md5),
 
 	SETTING_DEFINE_LIST_END
@@ -34,6 +35,7 @@ static const struct mbox_settings mbox_default_settings = {
 	.mbox_dirty_syncs = TRUE,
 	.mbox_very_dirty_syncs = FALSE,
 	.mbox_lazy_writes = TRUE,
+	.mbox_flags_in_index = FALSE,
 	.mbox_md5 = "apop3d:all"
 };
 
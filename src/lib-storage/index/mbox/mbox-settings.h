@@ -10,6 +10,7 @@ struct mbox_settings {
 	bool mbox_dirty_syncs;
 	bool mbox_very_dirty_syncs;
 	bool mbox_lazy_writes;
+	bool mbox_flags_in_index;
 	const char *mbox_md5;
 };
 
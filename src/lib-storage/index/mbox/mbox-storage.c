@@ -607,7 +607,8 @@ static void mbox_mailbox_close(struct mailbox *box)
 	if (box->view != NULL) {
 		hdr = mail_index_get_header(box->view);
 		if ((hdr->flags & MAIL_INDEX_HDR_FLAG_HAVE_DIRTY) != 0 &&
-		    !mbox_is_backend_readonly(mbox)) {
+		    !mbox_is_backend_readonly(mbox) &&
+		    !mbox->storage->set->mbox_flags_in_index) {
 			/* we've done changes to mbox which haven't been
 			   written yet. do it now. */
 			sync_flags |= MBOX_SYNC_REWRITE;
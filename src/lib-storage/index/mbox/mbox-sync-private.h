@@ -143,6 +143,8 @@ struct mbox_sync_context {
 	bool keep_recent:1;
 	bool readonly:1;
 	bool delay_writes:1;
+	/* flag and keyword changes are never written to the mbox file */
+	bool flags_in_index:1;
 	bool renumber_uids:1;
 	bool moved_offsets:1;
 	bool ext_modified:1;
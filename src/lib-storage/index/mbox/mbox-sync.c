@@ -348,7 +348,8 @@ static void mbox_sync_get_dirty_flags(struct mbox_sync_mail_context *mail_ctx,
 	idx_flags = rec->flags & MAIL_FLAGS_NONRECENT;
 	mbox_flags = mail_ctx->mail.flags & MAIL_FLAGS_NONRECENT;
 	if (idx_flags != mbox_flags) {
-		mail_ctx->need_rewrite = TRUE;
+		if (!sync_ctx->flags_in_index)
+			mail_ctx->need_rewrite = TRUE;
 		mail_ctx->mail.flags = (mail_ctx->mail.flags & MAIL_RECENT) |
 			idx_flags | MAIL_INDEX_MAIL_FLAG_DIRTY;
 	}
@@ -358,7 +359,8 @@ static void mbox_sync_get_dirty_flags(struct mbox_sync_mail_context *mail_ctx,
 	mail_index_lookup_keywords(sync_ctx->sync_view, sync_ctx->idx_seq,
 				   &idx_keywords);
 	if (!index_keyword_array_cmp(&idx_keywords, &mail_ctx->mail.keywords)) {
-		mail_ctx->need_rewrite = TRUE;
+		if (!sync_ctx->flags_in_index)
+			mail_ctx->need_rewrite = TRUE;
 		mail_ctx->mail.flags |= MAIL_INDEX_MAIL_FLAG_DIRTY;
 
 		if (!array_is_created(&mail_ctx->mail.keywords)) {
@@ -420,7 +422,11 @@ static void mbox_sync_update_index(struct mbox_sync_mail_context *mail_ctx,
 	uint8_t mbox_flags;
 
 	mbox_flags = mail->flags & ~MAIL_RECENT;
-	if (!sync_ctx->delay_writes) {
+	if (sync_ctx->flags_in_index) {
+		/* the index has the authoritative flags as long as they
+		   differ from the file's. the header may have been written
+		   anyway, but that is noticed by the next sync. */
+	} else if (!sync_ctx->delay_writes) {
 		/* changes are written to the mbox file */
 		mbox_flags &= ~MAIL_INDEX_MAIL_FLAG_DIRTY;
 	} else if (mail_ctx->need_rewrite) {
@@ -1868,7 +1874,8 @@ again:
 	}
 
 	sync_flags = index_storage_get_sync_flags(&mbox->box);
-	if ((flags & MBOX_SYNC_REWRITE) != 0)
+	if ((flags & MBOX_SYNC_REWRITE) != 0 &&
+	    !mbox->storage->set->mbox_flags_in_index)
 		sync_flags |= MAIL_INDEX_SYNC_FLAG_FLUSH_DIRTY;
 
 	ret = index_storage_expunged_sync_begin(&mbox->box, &index_sync_ctx,
@@ -1921,12 +1928,14 @@ again:
 	sync_ctx.flags = flags;
 	sync_ctx.readonly = readonly;
 	sync_ctx.delay_writes = delay_writes;
+	sync_ctx.flags_in_index = mbox->storage->set->mbox_flags_in_index;
 
 	sync_ctx.sync_changes =
 		index_sync_changes_init(index_sync_ctx, sync_view, trans,
-					sync_ctx.delay_writes);
+					sync_ctx.delay_writes ||
+					sync_ctx.flags_in_index);
 
-	if (!changed && delay_writes) {
+	if (!changed && (delay_writes || sync_ctx.flags_in_index)) {
 		/* if we have only flag changes, we don't need to open the
 		   mbox file */
 		bool expunged;
@@ -737,7 +737,7 @@ index_list_rename_mailbox(struct mailbox_list *_oldlist, const char *oldname,
 	const size_t oldname_len = strlen(oldname);
 	struct mailbox_list_index_sync_context *sync_ctx;
 	struct mailbox_list_index_record oldrec, newrec;
-	struct mailbox_list_index_node *oldnode, *newnode, *child;
+	struct mailbox_list_index_node *oldnode, *newnode;
 	const void *data;
 	bool created, expunged;
 	uint32_t oldseq, newseq;
@@ -781,9 +781,8 @@ index_list_rename_mailbox(struct mailbox_list *_oldlist, const char *oldname,
 	/* copy all the data from old node to new node */
 	newnode->uid = oldnode->uid;
 	newnode->flags = oldnode->flags;
-	newnode->children = oldnode->children; oldnode->children = NULL;
-	for (child = newnode->children; child != NULL; child = child->next)
-		child->parent = newnode;
+	mailbox_list_index_node_move_children(sync_ctx->ilist,
+					      oldnode, newnode);
 
 	/* remove the old node from existence */
 	mailbox_list_index_node_unlink(sync_ctx->ilist, oldnode);
@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "array.h"
+#include "ioloop.h"
 #include "mail-index-modseq.h"
 #include "mailbox-list-index-storage.h"
 #include "mailbox-list-index.h"
@@ -32,11 +33,18 @@ struct index_list_storage_module index_list_storage_module =
 #define MAILBOX_IS_NEVER_IN_INDEX(box) \
 	((box)->inbox_any && !(box)->storage->set->mailbox_list_index_include_inbox)
 
+static bool index_list_status_check_is_cached(struct index_list_mailbox *ibox)
+{
+	return ibox->last_status_check_timeval.tv_sec == ioloop_timeval.tv_sec &&
+		ibox->last_status_check_timeval.tv_usec == ioloop_timeval.tv_usec;
+}
+
 static int
 index_list_open_view(struct mailbox *box, bool status_check,
 		     struct mail_index_view **view_r, uint32_t *seq_r)
 {
 	struct mailbox_list_index *ilist = INDEX_LIST_CONTEXT_REQUIRE(box->list);
+	struct index_list_mailbox *ibox = INDEX_LIST_STORAGE_CONTEXT(box);
 	struct mailbox_list_index_node *node;
 	struct mail_index_view *view;
 	uint32_t seq;
@@ -66,9 +74,14 @@ index_list_open_view(struct mailbox *box, bool status_check,
 	} else if (!status_check) {
 		/* this operation doesn't need the index to be up-to-date */
 		ret = 0;
+	} else if (index_list_status_check_is_cached(ibox)) {
+		/* e.g. LIST-STATUS looking up both STATUS and SIZE */
+		ret = 0;
 	} else T_BEGIN {
 		ret = box->v.list_index_has_changed == NULL ? 0 :
 			box->v.list_index_has_changed(box, view, seq, FALSE);
+		if (ret == 0)
+			ibox->last_status_check_timeval = ioloop_timeval;
 	} T_END;
 
 	if (ret != 0) {
@@ -623,6 +636,7 @@ index_list_update(struct mailbox *box, struct mail_index_view *list_view,
 static int index_list_update_mailbox(struct mailbox *box)
 {
 	struct mailbox_list_index *ilist = INDEX_LIST_CONTEXT_REQUIRE(box->list);
+	struct index_list_mailbox *ibox = INDEX_LIST_STORAGE_CONTEXT(box);
 	struct mail_index_sync_ctx *list_sync_ctx;
 	struct mail_index_view *list_view;
 	struct mail_index_transaction *list_trans;
@@ -631,6 +645,9 @@ static int index_list_update_mailbox(struct mailbox *box)
 
 	i_assert(box->opened);
 
+	/* the list index record is going to be updated */
+	i_zero(&ibox->last_status_check_timeval);
+
 	if (ilist->syncing || ilist->updating_status)
 		return 0;
 	if (box->deleting) {
@@ -11,6 +11,10 @@ struct index_list_mailbox {
 
 	uint32_t pre_sync_log_file_seq;
 	uoff_t pre_sync_log_file_head_offset;
+	/* ioloop_timeval when the list index record was last found to be
+	   up-to-date. STATUS and metadata lookups done in the same ioloop
+	   run don't need to check the backend again. */
+	struct timeval last_status_check_timeval;
 
 	bool have_backend:1;
 };
@@ -72,14 +72,7 @@ mailbox_list_index_node_add(struct mailbox_list_index_sync_context *ctx,
 	node->name_id = ++ctx->ilist->highest_name_id;
 	node->uid = ctx->next_uid++;
 
-	if (parent != NULL) {
-		node->parent = parent;
-		node->next = parent->children;
-		parent->children = node;
-	} else {
-		node->next = ctx->ilist->mailbox_tree;
-		ctx->ilist->mailbox_tree = node;
-	}
+	mailbox_list_index_node_link(ctx->ilist, parent, node);
 	hash_table_insert(ctx->ilist->mailbox_hash,
 			  POINTER_CAST(node->uid), node);
 	hash_table_insert(ctx->ilist->mailbox_names,
@@ -102,15 +95,15 @@ uint32_t mailbox_list_index_sync_name(struct mailbox_list_index_sync_context *ct
 	path = *name == '\0' ? empty_path :
 		t_strsplit(name, ctx->sep);
 	/* find the last node that exists in the path */
-	node = ctx->ilist->mailbox_tree; parent = NULL;
+	parent = NULL;
 	for (i = 0; path[i] != NULL; i++) {
-		node = mailbox_list_index_node_find_sibling(node, path[i]);
+		node = mailbox_list_index_node_find_child(ctx->ilist, parent,
+							  path[i]);
 		if (node == NULL)
 			break;
 
 		node->flags |= MAILBOX_LIST_INDEX_FLAG_SYNC_EXISTS;
 		parent = node;
-		node = node->children;
 	}
 
 	node = parent;
@@ -31,17 +31,35 @@ void mailbox_list_index_set_index_error(struct mailbox_list *list)
 	mail_index_reset_error(ilist->index);
 }
 
+static int mailbox_list_index_node_cmp(const struct mailbox_list_index_node *n1,
+				       const struct mailbox_list_index_node *n2)
+{
+	return  n1->parent == n2->parent &&
+		strcmp(n1->name, n2->name) == 0 ? 0 : -1;
+}
+
+static unsigned int
+mailbox_list_index_node_hash(const struct mailbox_list_index_node *node)
+{
+	return str_hash(node->name) ^
+		POINTER_CAST_TO(node->parent, unsigned int);
+}
+
 static void mailbox_list_index_init_pool(struct mailbox_list_index *ilist)
 {
 	ilist->mailbox_pool = pool_alloconly_create("mailbox list index", 4096);
 	hash_table_create_direct(&ilist->mailbox_names, ilist->mailbox_pool, 0);
 	hash_table_create_direct(&ilist->mailbox_hash, ilist->mailbox_pool, 0);
+	hash_table_create(&ilist->mailbox_children_hash, ilist->mailbox_pool, 0,
+			  mailbox_list_index_node_hash,
+			  mailbox_list_index_node_cmp);
 }
 
 void mailbox_list_index_reset(struct mailbox_list_index *ilist)
 {
 	hash_table_destroy(&ilist->mailbox_names);
 	hash_table_destroy(&ilist->mailbox_hash);
+	hash_table_destroy(&ilist->mailbox_children_hash);
 	pool_unref(&ilist->mailbox_pool);
 
 	ilist->mailbox_tree = NULL;
@@ -125,25 +143,37 @@ mailbox_list_index_node_find_sibling(struct mailbox_list_index_node *node,
 	return NULL;
 }
 
+struct mailbox_list_index_node *
+mailbox_list_index_node_find_child(struct mailbox_list_index *ilist,
+				   struct mailbox_list_index_node *parent,
+				   const char *name)
+{
+	struct mailbox_list_index_node lookup_node;
+
+	i_zero(&lookup_node);
+	lookup_node.parent = parent;
+	lookup_node.name = name;
+	return hash_table_lookup(ilist->mailbox_children_hash, &lookup_node);
+}
+
 static struct mailbox_list_index_node *
 mailbox_list_index_lookup_real(struct mailbox_list *list, const char *name)
 {
 	struct mailbox_list_index *ilist = INDEX_LIST_CONTEXT_REQUIRE(list);
-	struct mailbox_list_index_node *node = ilist->mailbox_tree;
+	struct mailbox_list_index_node *node = NULL;
 	const char *const *path;
 	unsigned int i;
 	char sep[2];
 
 	if (*name == '\0')
-		return mailbox_list_index_node_find_sibling(node, "");
+		return mailbox_list_index_node_find_child(ilist, NULL, "");
 
 	sep[0] = mailbox_list_get_hierarchy_sep(list); sep[1] = '\0';
 	path = t_strsplit(name, sep);
-	for (i = 0;; i++) {
-		node = mailbox_list_index_node_find_sibling(node, path[i]);
-		if (node == NULL || path[i+1] == NULL)
+	for (i = 0; path[i] != NULL; i++) {
+		node = mailbox_list_index_node_find_child(ilist, node, path[i]);
+		if (node == NULL)
 			break;
-		node = node->children;
 	}
 	return node;
 }
@@ -175,6 +205,42 @@ void mailbox_list_index_node_get_path(const struct mailbox_list_index_node *node
 	str_append(str, node->name);
 }
 
+static void
+mailbox_list_index_node_hash_add(struct mailbox_list_index *ilist,
+				 struct mailbox_list_index_node *node)
+{
+	/* with a corrupted index there could be duplicates. the first one
+	   is found by lookups. */
+	if (hash_table_lookup(ilist->mailbox_children_hash, node) == NULL)
+		hash_table_insert(ilist->mailbox_children_hash, node, node);
+}
+
+static void
+mailbox_list_index_node_hash_remove(struct mailbox_list_index *ilist,
+				    struct mailbox_list_index_node *node)
+{
+	struct mailbox_list_index_node *old_node;
+
+	old_node = hash_table_lookup(ilist->mailbox_children_hash, node);
+	if (old_node == node)
+		hash_table_remove(ilist->mailbox_children_hash, node);
+}
+
+void mailbox_list_index_node_link(struct mailbox_list_index *ilist,
+				  struct mailbox_list_index_node *parent,
+				  struct mailbox_list_index_node *node)
+{
+	node->parent = parent;
+	if (parent != NULL) {
+		node->next = parent->children;
+		parent->children = node;
+	} else {
+		node->next = ilist->mailbox_tree;
+		ilist->mailbox_tree = node;
+	}
+	mailbox_list_index_node_hash_add(ilist, node);
+}
+
 void mailbox_list_index_node_unlink(struct mailbox_list_index *ilist,
 				    struct mailbox_list_index_node *node)
 {
@@ -186,6 +252,25 @@ void mailbox_list_index_node_unlink(struct mailbox_list_index *ilist,
 	while (*prev != node)
 		prev = &(*prev)->next;
 	*prev = node->next;
+	mailbox_list_index_node_hash_remove(ilist, node);
+}
+
+void mailbox_list_index_node_move_children(struct mailbox_list_index *ilist,
+					   struct mailbox_list_index_node *old_parent,
+					   struct mailbox_list_index_node *new_parent)
+{
+	struct mailbox_list_index_node *child;
+
+	i_assert(new_parent->children == NULL);
+
+	new_parent->children = old_parent->children;
+	old_parent->children = NULL;
+	for (child = new_parent->children; child != NULL; child = child->next) {
+		/* the hash key changes along with the parent */
+		mailbox_list_index_node_hash_remove(ilist, child);
+		child->parent = new_parent;
+		mailbox_list_index_node_hash_add(ilist, child);
+	}
 }
 
 static int mailbox_list_index_parse_header(struct mailbox_list_index *ilist,
@@ -264,20 +349,6 @@ mailbox_list_index_generate_name(struct mailbox_list_index *ilist,
 		ilist->highest_name_id = node->name_id;
 }
 
-static int mailbox_list_index_node_cmp(const struct mailbox_list_index_node *n1,
-				       const struct mailbox_list_index_node *n2)
-{
-	return  n1->parent == n2->parent &&
-		strcmp(n1->name, n2->name) == 0 ? 0 : -1;
-}
-
-static unsigned int
-mailbox_list_index_node_hash(const struct mailbox_list_index_node *node)
-{
-	return str_hash(node->name) ^
-		POINTER_CAST_TO(node->parent, unsigned int);
-}
-
 static bool node_has_parent(const struct mailbox_list_index_node *parent,
 			    const struct mailbox_list_index_node *node)
 {
@@ -393,9 +464,7 @@ static int mailbox_list_index_parse_records(struct mailbox_list_index *ilist,
 				/* just place it under the root */
 				node->corrupted_ext = TRUE;
 			} else {
-				node->parent = parent;
-				node->next = parent->children;
-				parent->children = node;
+				mailbox_list_index_node_link(ilist, parent, node);
 				continue;
 			}
 		} else if (strcasecmp(node->name, "INBOX") == 0) {
@@ -423,8 +492,7 @@ static int mailbox_list_index_parse_records(struct mailbox_list_index *ilist,
 				"Duplicate mailbox '%s' in index, renaming to %s",
 				old_name, node->name);
 		}
-		node->next = ilist->mailbox_tree;
-		ilist->mailbox_tree = node;
+		mailbox_list_index_node_link(ilist, NULL, node);
 	}
 	hash_table_destroy(&duplicate_hash);
 	return *error_r == NULL ? 0 : -1;
@@ -665,6 +733,7 @@ static void mailbox_list_index_deinit(struct mailbox_list *list)
 	if (ilist->index != NULL) {
 		hash_table_destroy(&ilist->mailbox_hash);
 		hash_table_destroy(&ilist->mailbox_names);
+		hash_table_destroy(&ilist->mailbox_children_hash);
 		pool_unref(&ilist->mailbox_pool);
 		if (ilist->opened)
 			mail_index_close(ilist->index);
@@ -112,6 +112,9 @@ struct mailbox_list_index {
 
 	/* uint32_t uid => node */
 	HASH_TABLE(void *, struct mailbox_list_index_node *) mailbox_hash;
+	/* (parent, name) => node */
+	HASH_TABLE(struct mailbox_list_index_node *,
+		   struct mailbox_list_index_node *) mailbox_children_hash;
 	struct mailbox_list_index_node *mailbox_tree;
 
 	bool pending_init:1;
@@ -153,8 +156,16 @@ struct mailbox_list_index_node *
 mailbox_list_index_lookup_uid(struct mailbox_list_index *ilist, uint32_t uid);
 void mailbox_list_index_node_get_path(const struct mailbox_list_index_node *node,
 				      char sep, string_t *str);
+/* Add the node under the parent (or the root if NULL). */
+void mailbox_list_index_node_link(struct mailbox_list_index *ilist,
+				  struct mailbox_list_index_node *parent,
+				  struct mailbox_list_index_node *node);
 void mailbox_list_index_node_unlink(struct mailbox_list_index *ilist,
 				    struct mailbox_list_index_node *node);
+/* Move all of the old parent's children under the new parent. */
+void mailbox_list_index_node_move_children(struct mailbox_list_index *ilist,
+					   struct mailbox_list_index_node *old_parent,
+					   struct mailbox_list_index_node *new_parent);
 
 int mailbox_list_index_index_open(struct mailbox_list *list);
 bool mailbox_list_index_need_refresh(struct mailbox_list_index *ilist,
@@ -171,6 +182,12 @@ int mailbox_list_index_set_uncorrupted(struct mailbox_list *list);
 struct mailbox_list_index_node *
 mailbox_list_index_node_find_sibling(struct mailbox_list_index_node *node,
 				     const char *name);
+/* Find the named child of the parent (or a root node if parent is NULL).
+   Uses a hash lookup instead of going through all the siblings. */
+struct mailbox_list_index_node *
+mailbox_list_index_node_find_child(struct mailbox_list_index *ilist,
+				   struct mailbox_list_index_node *parent,
+				   const char *name);
 void mailbox_list_index_reset(struct mailbox_list_index *ilist);
 int mailbox_list_index_parse(struct mailbox_list *list,
 			     struct mail_index_view *view, bool force);
@@ -42,6 +42,63 @@ mailbox_autoexpunge_lock(struct mail_user *user, struct file_lock **lock)
 	}
 }
 
+static int
+mailbox_autoexpunge_get_save_date(struct mail *mail, time_t *timestamp_r)
+{
+	int ret;
+
+	/* Try first if the saved-date can be found without opening the
+	   mail. If not, fall back to the full lookup. */
+	mail->lookup_abort = MAIL_LOOKUP_ABORT_NOT_IN_CACHE;
+	ret = mail_get_save_date(mail, timestamp_r);
+	mail->lookup_abort = MAIL_LOOKUP_ABORT_NEVER;
+	if (ret < 0 &&
+	    mailbox_get_last_mail_error(mail->box) == MAIL_ERROR_LOOKUP_ABORTED)
+		ret = mail_get_save_date(mail, timestamp_r);
+	return ret;
+}
+
+static int
+mailbox_autoexpunge_is_expired(struct mail *mail, time_t expire_time,
+			       time_t last_rename_stamp)
+{
+	time_t timestamp;
+
+	if (mailbox_autoexpunge_get_save_date(mail, &timestamp) < 0) {
+		if (mailbox_get_last_mail_error(mail->box) == MAIL_ERROR_EXPUNGED)
+			return 0;
+		return -1;
+	}
+	return I_MAX(last_rename_stamp, timestamp) <= expire_time ? 1 : 0;
+}
+
+static int
+mailbox_autoexpunge_find_end(struct mail *mail, uint32_t first_seq,
+			     uint32_t messages_count, time_t expire_time,
+			     time_t last_rename_stamp, uint32_t *end_seq_r)
+{
+	uint32_t left = first_seq, right = messages_count + 1, mid;
+	int ret;
+
+	/* The mails are expected to be in save date order. Binary search
+	   the first mail that isn't expired yet, so the save dates need to
+	   be looked up only for a few mails. */
+	while (left < right) {
+		mid = left + (right - left) / 2;
+		mail_set_seq(mail, mid);
+		ret = mailbox_autoexpunge_is_expired(mail, expire_time,
+						     last_rename_stamp);
+		if (ret < 0)
+			return -1;
+		if (ret > 0)
+			left = mid + 1;
+		else
+			right = mid;
+	}
+	*end_seq_r = left;
+	return 0;
+}
+
 static int
 mailbox_autoexpunge(struct mailbox *box, unsigned int interval_time,
 		    unsigned int max_mails, unsigned int *expunged_count)
@@ -51,7 +108,7 @@ mailbox_autoexpunge(struct mailbox *box, unsigned int interval_time,
 	struct mailbox_metadata metadata;
 	const struct mail_index_header *hdr;
 	struct mailbox_status status;
-	uint32_t seq;
+	uint32_t seq, first_seq, end_seq;
 	time_t timestamp, expire_time, last_rename_stamp = 0;
 	const void *data;
 	size_t size;
@@ -94,32 +151,47 @@ mailbox_autoexpunge(struct mailbox *box, unsigned int interval_time,
 		last_rename_stamp = *(const uint32_t*)data;
 
 	t = mailbox_transaction_begin(box, 0, "autoexpunge");
-	mail = mail_alloc(t, 0, NULL);
+	mail = mail_alloc(t, MAIL_FETCH_SAVE_DATE, NULL);
 
+	/* max_mails is still being reached for the mails before first_seq.
+	   expunge them without checking their saved-dates. */
 	hdr = mail_index_get_header(box->view);
-	for (seq = 1; seq <= hdr->messages_count; seq++) {
+	if (max_mails > 0 && hdr->messages_count > max_mails)
+		first_seq = hdr->messages_count - max_mails + 1;
+	else
+		first_seq = 1;
+
+	if (interval_time == 0 || last_rename_stamp > expire_time) {
+		/* nothing is expired by date */
+		end_seq = first_seq;
+	} else if (mailbox_autoexpunge_find_end(mail, first_seq,
+						hdr->messages_count,
+						expire_time, last_rename_stamp,
+						&end_seq) < 0) {
+		end_seq = first_seq;
+		ret = -1;
+	}
+
+	for (seq = 1; seq < end_seq; seq++) {
 		mail_set_seq(mail, seq);
-		if (max_mails > 0 && hdr->messages_count - seq + 1 > max_mails) {
-			/* max_mails is still being reached -> expunge.
-			   don't even check saved-dates before we're
-			   below max_mails. */
-			mail_autoexpunge(mail);
-			count++;
-		} else if (interval_time == 0) {
-			/* only max_mails is used. nothing further to do. */
-			break;
-		} else if (mail_get_save_date(mail, &timestamp) == 0) {
+		if (seq >= first_seq) {
+			/* The binary search assumed that the mails are in
+			   save date order. Verify each mail's saved-date
+			   before expunging it and stop at the first mail
+			   that isn't expired in case they aren't. */
+			if (mailbox_autoexpunge_get_save_date(mail, &timestamp) < 0) {
+				if (mailbox_get_last_mail_error(box) == MAIL_ERROR_EXPUNGED) {
+					/* already expunged */
+					continue;
+				}
+				ret = -1;
+				break;
+			}
 			if (I_MAX(last_rename_stamp, timestamp) > expire_time)
 				break;
-			mail_autoexpunge(mail);
-			count++;
-		} else if (mailbox_get_last_mail_error(box) == MAIL_ERROR_EXPUNGED) {
-			/* already expunged */
-		} else {
-			/* failed */
-			ret = -1;
-			break;
 		}
+		mail_autoexpunge(mail);
+		count++;
 	}
 	mail_free(&mail);
 	if (mailbox_transaction_commit(&t) < 0)
@@ -4,6 +4,8 @@
 #include "ioloop.h"
 #include "istream.h"
 #include "ostream.h"
+#include "array.h"
+#include "write-full.h"
 #include "home-expand.h"
 #include "file-dotlock.h"
 #include "hash.h"
@@ -43,7 +45,13 @@ struct mail_duplicate_file {
 
 	int new_fd;
 	struct dotlock *dotlock;
+	/* records added by mail_duplicate_mark() */
+	ARRAY(struct mail_duplicate *) new_records;
+
 	bool changed:1;
+	/* the file needs to be rewritten, instead of only appending the new
+	   records to it */
+	bool rewrite:1;
 };
 
 struct mail_duplicate_db {
@@ -141,6 +149,10 @@ mail_duplicate_read_records(struct mail_duplicate_file *file,
 			d->user = p_strndup(file->pool,
 					    data + hdr.id_size, hdr.user_size);
 			d->time = hdr.stamp;
+			if (hash_table_lookup(file->hash, d) != NULL) {
+				/* the record was appended again later */
+				change_count++;
+			}
 			hash_table_update(file->hash, d, d);
 		} else {
                         change_count++;
@@ -148,9 +160,13 @@ mail_duplicate_read_records(struct mail_duplicate_file *file,
 		i_stream_skip(input, hdr.id_size + hdr.user_size);
 	}
 
-	if (hash_table_count(file->hash) *
-	    COMPRESS_PERCENTAGE / 100 > change_count)
+	/* rewrite the file once enough of it is expired or overridden
+	   records. otherwise new records are only appended to it. */
+	if (change_count > hash_table_count(file->hash) *
+	    COMPRESS_PERCENTAGE / 100) {
 		file->changed = TRUE;
+		file->rewrite = TRUE;
+	}
 	return 0;
 }
 
@@ -163,6 +179,9 @@ static int mail_duplicate_read(struct mail_duplicate_file *file)
 	int fd;
 	unsigned int record_size = 0;
 
+	/* unless the file is successfully read, it needs to be recreated */
+	file->rewrite = TRUE;
+
 	fd = open(file->path, O_RDONLY);
 	if (fd == -1) {
 		if (errno == ENOENT)
@@ -181,12 +200,15 @@ static int mail_duplicate_read(struct mail_duplicate_file *file)
 		} else if (hdr.version == DUPLICATE_VERSION) {
 			record_size = sizeof(struct mail_duplicate_record_header);
 			i_stream_skip(input, sizeof(hdr));
+			file->rewrite = FALSE;
 		}
 	}
 
 	if (record_size == 0 ||
-	    mail_duplicate_read_records(file, input, record_size) < 0)
+	    mail_duplicate_read_records(file, input, record_size) < 0) {
 		i_unlink_if_exists(file->path);
+		file->rewrite = TRUE;
+	}
 
 	i_stream_unref(&input);
 	if (close(fd) < 0)
@@ -218,6 +240,7 @@ mail_duplicate_file_new(struct mail_duplicate_db *db)
 			file->path, db->dotlock_set.timeout);
 	}
 	hash_table_create(&file->hash, pool, 0, mail_duplicate_hash, mail_duplicate_cmp);
+	p_array_init(&file->new_records, pool, 16);
 
 	(void)mail_duplicate_read(file);
 	return file;
@@ -281,6 +304,51 @@ void mail_duplicate_mark(struct mail_duplicate_db *db,
 
 	db->file->changed = TRUE;
 	hash_table_update(db->file->hash, d, d);
+	array_push_back(&db->file->new_records, &d);
+}
+
+static void
+mail_duplicate_record_append(buffer_t *buf, const struct mail_duplicate *d)
+{
+	struct mail_duplicate_record_header rec;
+
+	i_zero(&rec);
+	rec.stamp = d->time;
+	rec.id_size = d->id_size;
+	rec.user_size = strlen(d->user);
+
+	buffer_append(buf, &rec, sizeof(rec));
+	buffer_append(buf, d->id, rec.id_size);
+	buffer_append(buf, d->user, rec.user_size);
+}
+
+static int mail_duplicate_file_append(struct mail_duplicate_file *file)
+{
+	struct mail_duplicate *const *dp;
+	buffer_t *buf;
+	int fd, ret = 0;
+
+	fd = open(file->path, O_WRONLY | O_APPEND);
+	if (fd == -1) {
+		if (errno != ENOENT)
+			i_error("open(%s) failed: %m", file->path);
+		return -1;
+	}
+
+	buf = t_buffer_create(1024);
+	array_foreach(&file->new_records, dp)
+		mail_duplicate_record_append(buf, *dp);
+	if (write_full(fd, buf->data, buf->used) < 0) {
+		i_error("write(%s) failed: %m", file->path);
+		/* a partially written record makes the file unreadable,
+		   so it'll be recreated next time */
+		ret = -1;
+	}
+	if (close(fd) < 0) {
+		i_error("close(%s) failed: %m", file->path);
+		ret = -1;
+	}
+	return ret;
 }
 
 void mail_duplicate_db_flush(struct mail_duplicate_db *db)
@@ -299,6 +367,19 @@ void mail_duplicate_db_flush(struct mail_duplicate_db *db)
 		mail_duplicate_file_free(&db->file);
 		return;
 	}
+	if (!file->rewrite) {
+		/* only new records - append them while still holding the
+		   lock, instead of rewriting the whole file */
+		int ret;
+
+		T_BEGIN {
+			ret = mail_duplicate_file_append(file);
+		} T_END;
+		if (ret == 0) {
+			mail_duplicate_file_free(&db->file);
+			return;
+		}
+	}
 
 	i_zero(&hdr);
 	hdr.version = DUPLICATE_VERSION;
@@ -108,6 +108,10 @@ enum mail_storage_class_flags {
 	MAIL_STORAGE_CLASS_FLAG_NO_LIST_DELETES	= 0x400,
 	/* Storage supports stubs (used for caching purposes). */
 	MAIL_STORAGE_CLASS_FLAG_STUBS = 0x800,
+	/* Mailboxes are changed only by Dovecot processes via the storage
+	   (no external MDAs or remote servers), so the processes can
+	   announce their changes to each other via mailbox-notify. */
+	MAIL_STORAGE_CLASS_FLAG_NO_EXTERNAL_CHANGES = 0x1000,
 };
 
 struct mail_binary_cache {
@@ -401,6 +405,7 @@ struct mailbox {
 	uint32_t box_name_hdr_ext_id;
 	uint32_t box_last_rename_stamp_ext_id;
 	uint32_t mail_vsize_ext_id;
+	uint32_t search_cache_hdr_ext_id;
 
 	/* MAIL_RECENT flags handling */
 	ARRAY_TYPE(seq_range) recent_flags;
@@ -414,6 +419,12 @@ struct mailbox {
 	void *notify_context;
 	struct timeout *to_notify, *to_notify_delay;
 	struct mailbox_notify_file *notify_files;
+	/* Non-NULL while waiting for changes via mailbox-notify service */
+	struct mailbox_notify_client_watch *notify_client_watch;
+	/* Mailbox GUID as hex, looked up when needed by mailbox-notify */
+	const char *notify_guid;
+	/* Highest modseq already sent to mailbox-notify service */
+	uint64_t notify_sent_modseq;
 
 	/* Increased by one for each new struct mailbox. */
 	unsigned int generation_sequence;
@@ -580,6 +591,8 @@ struct mailbox_transaction_stats {
 	unsigned long long files_read_bytes;
 	/* number of cache lookup hits */
 	unsigned long cache_hit_count;
+	/* number of cache lookups that didn't find the field */
+	unsigned long cache_miss_count;
 };
 
 struct mail_save_private_changes {
@@ -627,6 +640,9 @@ struct mailbox_transaction_context {
 	struct mailbox_transaction_stats stats;
 	/* Set to TRUE to update stats_* fields */
 	bool stats_track:1;
+	/* the header search filter extension was checked to match the
+	   configured headers */
+	bool header_bloom_checked:1;
 };
 
 union mail_search_module_context {
@@ -1670,6 +1670,38 @@ void mail_storage_service_init_settings(struct mail_storage_service_ctx *ctx,
 	pool_unref(&temp_pool);
 }
 
+void mail_storage_service_preload(struct mail_storage_service_ctx *ctx,
+				  const struct mail_storage_service_input *input)
+{
+	const struct setting_parser_info *user_info;
+	const struct mail_user_settings *user_set;
+	const struct setting_parser_context *set_parser;
+	const char *error;
+	pool_t temp_pool;
+	void **sets;
+
+	temp_pool = pool_alloconly_create("service preload settings", 4096);
+	if (mail_storage_service_read_settings(ctx, input, temp_pool,
+					       &user_info, &set_parser,
+					       &error) < 0) {
+		/* the error is logged again by the user lookup */
+		i_error("%s", error);
+		pool_unref(&temp_pool);
+		return;
+	}
+	sets = master_service_settings_parser_get_others(master_service,
+							 set_parser);
+	user_set = sets[0];
+
+	if (ctx->conn == NULL)
+		mail_storage_service_first_init(ctx, user_info, user_set,
+						ctx->flags);
+	if (mail_storage_service_load_modules(ctx, user_info, user_set,
+					      &error) < 0)
+		i_error("%s", error);
+	pool_unref(&temp_pool);
+}
+
 static int
 mail_storage_service_all_iter_deinit(struct mail_storage_service_ctx *ctx)
 {
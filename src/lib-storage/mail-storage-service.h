@@ -93,6 +93,13 @@ int mail_storage_service_read_settings(struct mail_storage_service_ctx *ctx,
 void mail_storage_service_init_settings(struct mail_storage_service_ctx *ctx,
 					const struct mail_storage_service_input *input)
 	ATTR_NULL(2);
+/* Read the settings without any user-specific input and load the global
+   mail_plugins. This can be called at process startup, so that processes
+   started by the service's process_min_avail only need to do the
+   user-specific initialization once a client connects. Errors are only
+   logged. */
+void mail_storage_service_preload(struct mail_storage_service_ctx *ctx,
+				  const struct mail_storage_service_input *input);
 /* Returns 1 if ok, 0 if user wasn't found, -1 if fatal error,
    -2 if error is user-specific (e.g. invalid settings). */
 int mail_storage_service_lookup(struct mail_storage_service_ctx *ctx,
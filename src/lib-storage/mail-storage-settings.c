@@ -50,6 +50,7 @@ static const struct setting_define mail_storage_setting_defines[] = {
 	DEF(SET_UINT, mail_cache_compress_delete_percentage),
 	DEF(SET_UINT, mail_cache_compress_continued_percentage),
 	DEF(SET_UINT, mail_cache_compress_header_continue_count),
+	DEF(SET_UINT, mail_cache_compress_incremental_count),
 	DEF(SET_SIZE, mail_index_rewrite_min_log_bytes),
 	DEF(SET_SIZE, mail_index_rewrite_max_log_bytes),
 	DEF(SET_SIZE, mail_index_log_rotate_min_size),
@@ -57,12 +58,17 @@ static const struct setting_define mail_storage_setting_defines[] = {
 	DEF(SET_TIME, mail_index_log_rotate_min_age),
 	DEF(SET_TIME, mail_index_log2_max_age),
 	DEF(SET_TIME, mailbox_idle_check_interval),
+	DEF(SET_STR, mailbox_notify_socket_path),
 	DEF(SET_UINT, mail_max_keyword_length),
 	DEF(SET_TIME, mail_max_lock_timeout),
 	DEF(SET_TIME, mail_temp_scan_interval),
 	DEF(SET_UINT, mail_vsize_bg_after_count),
 	DEF(SET_UINT, mail_sort_max_read_count),
+	DEF(SET_UINT, mail_search_cache_entries),
+	DEF(SET_STR, mail_search_indexed_headers),
+	DEF(SET_BOOL, mail_cache_columns),
 	DEF(SET_BOOL, mail_save_crlf),
+	DEF(SET_BOOL, mail_vsize_on_save),
 	DEF(SET_ENUM, mail_fsync),
 	DEF(SET_BOOL, mmap_disable),
 	DEF(SET_BOOL, dotlock_use_excl),
@@ -116,6 +122,7 @@ const struct mail_storage_settings mail_storage_default_settings = {
 	.mail_cache_compress_delete_percentage = 20,
 	.mail_cache_compress_continued_percentage = 200,
 	.mail_cache_compress_header_continue_count = 4,
+	.mail_cache_compress_incremental_count = 0,
 	.mail_index_rewrite_min_log_bytes = 8 * 1024,
 	.mail_index_rewrite_max_log_bytes = 128 * 1024,
 	.mail_index_log_rotate_min_size = 32 * 1024,
@@ -123,12 +130,17 @@ const struct mail_storage_settings mail_storage_default_settings = {
 	.mail_index_log_rotate_min_age = 5 * 60,
 	.mail_index_log2_max_age = 3600 * 24 * 2,
 	.mailbox_idle_check_interval = 30,
+	.mailbox_notify_socket_path = "",
 	.mail_max_keyword_length = 50,
 	.mail_max_lock_timeout = 0,
 	.mail_temp_scan_interval = 7*24*60*60,
 	.mail_vsize_bg_after_count = 0,
 	.mail_sort_max_read_count = 0,
+	.mail_search_cache_entries = 0,
+	.mail_search_indexed_headers = "",
+	.mail_cache_columns = FALSE,
 	.mail_save_crlf = FALSE,
+	.mail_vsize_on_save = FALSE,
 	.mail_fsync = "optimized:never:always",
 	.mmap_disable = FALSE,
 	.dotlock_use_excl = TRUE,
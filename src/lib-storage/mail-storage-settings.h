@@ -32,6 +32,7 @@ struct mail_storage_settings {
 	unsigned int mail_cache_compress_delete_percentage;
 	unsigned int mail_cache_compress_continued_percentage;
 	unsigned int mail_cache_compress_header_continue_count;
+	unsigned int mail_cache_compress_incremental_count;
 	uoff_t mail_index_rewrite_min_log_bytes;
 	uoff_t mail_index_rewrite_max_log_bytes;
 	uoff_t mail_index_log_rotate_min_size;
@@ -39,12 +40,17 @@ struct mail_storage_settings {
 	unsigned int mail_index_log_rotate_min_age;
 	unsigned int mail_index_log2_max_age;
 	unsigned int mailbox_idle_check_interval;
+	const char *mailbox_notify_socket_path;
 	unsigned int mail_max_keyword_length;
 	unsigned int mail_max_lock_timeout;
 	unsigned int mail_temp_scan_interval;
 	unsigned int mail_vsize_bg_after_count;
 	unsigned int mail_sort_max_read_count;
+	unsigned int mail_search_cache_entries;
+	const char *mail_search_indexed_headers;
+	bool mail_cache_columns;
 	bool mail_save_crlf;
+	bool mail_vsize_on_save;
 	const char *mail_fsync;
 	bool mmap_disable;
 	bool dotlock_use_excl;
@@ -31,6 +31,7 @@
 #include "mail-search-mime-register.h"
 #include "mailbox-search-result-private.h"
 #include "mailbox-guid-cache.h"
+#include "mailbox-notify-client.h"
 #include "mail-cache.h"
 
 #include <ctype.h>
@@ -681,6 +682,12 @@ struct mail_user *mail_storage_get_user(struct mail_storage *storage)
 	return storage->user;
 }
 
+bool mail_storage_is_file_per_msg(struct mail_storage *storage)
+{
+	return (storage->class_flags &
+		MAIL_STORAGE_CLASS_FLAG_FILE_PER_MSG) != 0;
+}
+
 void mail_storage_set_callbacks(struct mail_storage *storage,
 				struct mail_storage_callbacks *callbacks,
 				void *context)
@@ -1483,6 +1490,7 @@ void mailbox_close(struct mailbox *box)
 		i_panic("Trying to close mailbox %s with open transactions",
 			box->name);
 	}
+	mailbox_notify_client_unwatch(box);
 	box->v.close(box);
 
 	if (box->storage->binary_cache.box == box)
@@ -2079,8 +2087,10 @@ int mailbox_sync_deinit(struct mailbox_sync_context **_ctx,
 			i_error("Syncing INBOX failed: %s", errormsg);
 		}
 	}
-	if (ret == 0)
+	if (ret == 0) {
 		box->synced = TRUE;
+		mailbox_notify_client_changed(box);
+	}
 	return ret;
 }
 
@@ -2108,7 +2118,8 @@ void mailbox_notify_changes(struct mailbox *box,
 	box->notify_callback = callback;
 	box->notify_context = context;
 
-	box->v.notify_changes(box);
+	if (!mailbox_notify_client_watch(box))
+		box->v.notify_changes(box);
 }
 
 void mailbox_notify_changes_stop(struct mailbox *box)
@@ -2118,6 +2129,7 @@ void mailbox_notify_changes_stop(struct mailbox *box)
 	box->notify_callback = NULL;
 	box->notify_context = NULL;
 
+	mailbox_notify_client_unwatch(box);
 	box->v.notify_changes(box);
 }
 
@@ -2182,6 +2194,16 @@ bool mailbox_search_seen_lost_data(struct mail_search_context *ctx)
 	return ctx->seen_lost_data;
 }
 
+void mailbox_search_set_min_prefetch_count(struct mail_search_context *ctx,
+					   unsigned int count)
+{
+	i_assert(ctx->seq == 0);
+
+	/* max_mails includes the current mail */
+	if (count < UINT_MAX && ctx->max_mails < count + 1)
+		ctx->max_mails = count + 1;
+}
+
 void mailbox_search_mail_detach(struct mail_search_context *ctx,
 				struct mail *mail)
 {
@@ -2237,6 +2259,18 @@ mailbox_transaction_begin(struct mailbox *box,
 	return trans;
 }
 
+static void
+mailbox_transaction_stats_finish(struct mailbox_transaction_context *t)
+{
+	struct mail_user *user = t->box->storage->user;
+
+	while (user->creator != NULL)
+		user = user->creator;
+	user->trans_files_read_bytes += t->stats.files_read_bytes;
+	user->trans_cache_hit_count += t->stats.cache_hit_count;
+	user->trans_cache_miss_count += t->stats.cache_miss_count;
+}
+
 int mailbox_transaction_commit(struct mailbox_transaction_context **t)
 {
 	struct mail_transaction_commit_changes changes;
@@ -2261,6 +2295,7 @@ int mailbox_transaction_commit_get_changes(
 	changes_r->pool = NULL;
 
 	*_t = NULL;
+	mailbox_transaction_stats_finish(t);
 	T_BEGIN {
 		ret = box->v.transaction_commit(t, changes_r);
 	} T_END;
@@ -2277,6 +2312,8 @@ int mailbox_transaction_commit_get_changes(
 	box->transaction_count--;
 	if (ret < 0 && changes_r->pool != NULL)
 		pool_unref(&changes_r->pool);
+	if (ret == 0)
+		mailbox_notify_client_changed(box);
 	return ret;
 }
 
@@ -2286,6 +2323,7 @@ void mailbox_transaction_rollback(struct mailbox_transaction_context **_t)
 	struct mailbox *box = t->box;
 
 	*_t = NULL;
+	mailbox_transaction_stats_finish(t);
 	box->v.transaction_rollback(t);
 	box->transaction_count--;
 }
@@ -470,6 +470,9 @@ void mail_storage_unref(struct mail_storage **storage);
 const struct mail_storage_settings *
 mail_storage_get_settings(struct mail_storage *storage) ATTR_PURE;
 struct mail_user *mail_storage_get_user(struct mail_storage *storage) ATTR_PURE;
+/* Returns TRUE if the storage saves each mail into its own file (e.g. maildir,
+   sdbox), so copying a mail to it may be done by hard linking the file. */
+bool mail_storage_is_file_per_msg(struct mail_storage *storage) ATTR_PURE;
 
 /* Set storage callback functions to use. */
 void mail_storage_set_callbacks(struct mail_storage *storage,
@@ -724,6 +727,11 @@ bool mailbox_search_next_nonblock(struct mail_search_context *ctx,
    determine correctly if those messages should have been returned in this
    search. */
 bool mailbox_search_seen_lost_data(struct mail_search_context *ctx);
+/* Prefetch at least this many mails ahead of the current one while searching,
+   even if mail_prefetch_count is lower. Backends that don't prefetch ignore
+   this. This must be called before the first mailbox_search_next*() call. */
+void mailbox_search_set_min_prefetch_count(struct mail_search_context *ctx,
+					   unsigned int count);
 /* Detach the given mail from the search context. This allows the mail to live
    even after mail_search_context has been freed. */
 void mailbox_search_mail_detach(struct mail_search_context *ctx,
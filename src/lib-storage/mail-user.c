@@ -26,6 +26,7 @@
 #include "mail-storage.h"
 #include "mailbox-list-private.h"
 #include "mail-autoexpunge.h"
+#include "mailbox-notify-client.h"
 #include "mail-user.h"
 
 
@@ -39,6 +40,7 @@ static void mail_user_deinit_base(struct mail_user *user)
 		dict_deinit(&user->_attr_dict);
 	}
 	mail_namespaces_deinit(&user->namespaces);
+	mailbox_notify_client_deinit(user);
 	if (user->_service_user != NULL)
 		mail_storage_service_user_unref(&user->_service_user);
 }
@@ -67,10 +67,17 @@ struct mail_user {
 	normalizer_func_t *default_normalizer;
 	/* Filled lazily by mailbox_attribute_*() when accessing attributes. */
 	struct dict *_attr_dict;
+	/* Filled lazily by mailbox_notify_client_*() */
+	struct mailbox_notify_client *_notify_client;
 
 	/* Module-specific contexts. See mail_storage_module_id. */
 	ARRAY(union mail_user_module_context *) module_contexts;
 
+	/* Totals of the statistics of all the finished mailbox transactions.
+	   Transactions of autocreated users are added to their creator. */
+	uint64_t trans_files_read_bytes;
+	uint64_t trans_cache_hit_count, trans_cache_miss_count;
+
 	/* User doesn't exist (as reported by userdb lookup when looking
 	   up home) */
 	bool nonexistent:1;
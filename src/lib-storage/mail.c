@@ -521,6 +521,7 @@ int mail_set_attachment_keywords(struct mail *mail)
 
 	/* walk all parts and see if there is an attachment */
 	struct message_part *parts;
+	mail_add_temp_wanted_fields(mail, MAIL_FETCH_IMAP_BODYSTRUCTURE, NULL);
 	if (mail_get_parts(mail, &parts) < 0) {
 		mail_set_critical(mail, "Failed to add attachment keywords: "
 				  "mail_get_parts() failed: %s",
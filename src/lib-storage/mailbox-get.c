@@ -203,6 +203,14 @@ mailbox_get_expunges_full(struct mailbox *box, uint64_t prev_modseq,
 	}
 	mail_transaction_log_view_rewind(log_view);
 
+	if (modseq_too_old && ret == 0 && expunges == NULL &&
+	    mail_index_modseq_get_expunged_uids(box->view, prev_modseq,
+						expunged_uids)) {
+		/* the transaction logs no longer go back far enough, but the
+		   index still remembers the expunged UIDs. */
+		modseq_too_old = FALSE;
+	}
+
 	/* drop UIDs that don't match the filter */
 	seq_range_array_intersect(expunged_uids, uids_filter);
 
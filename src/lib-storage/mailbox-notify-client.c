@@ -0,0 +1,282 @@
+/* Copyright (c) 2018 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "llist.h"
+#include "strnum.h"
+#include "ostream.h"
+#include "connection.h"
+#include "mail-index-modseq.h"
+#include "mail-storage-private.h"
+#include "mailbox-notify-client.h"
+
+/* Don't try to reconnect more often than this after failures */
+#define MAILBOX_NOTIFY_CLIENT_RECONNECT_INTERVAL_SECS 10
+/* Changes tend to come in bursts. Wait a bit before notifying. */
+#define MAILBOX_NOTIFY_CLIENT_DELAY_MSECS 100
+
+struct mailbox_notify_client_watch {
+	struct mailbox_notify_client_watch *prev, *next;
+
+	struct mailbox_notify_client *client;
+	struct mailbox *box;
+	struct timeout *to_delay;
+};
+
+struct mailbox_notify_client {
+	struct connection conn;
+	struct mail_user *user;
+
+	struct mailbox_notify_client_watch *watches;
+	time_t reconnect_after;
+	bool connected:1;
+};
+
+static struct connection_list *mailbox_notify_clients;
+
+static void mailbox_notify_client_delay(struct mailbox_notify_client_watch *watch)
+{
+	struct mailbox *box = watch->box;
+
+	timeout_remove(&watch->to_delay);
+	if (box->notify_callback != NULL)
+		box->notify_callback(box, box->notify_context);
+}
+
+static void
+mailbox_notify_client_changed_input(struct mailbox_notify_client *client,
+				    const char *guid, uint64_t modseq)
+{
+	struct mailbox_notify_client_watch *watch;
+	uint64_t synced_modseq;
+
+	for (watch = client->watches; watch != NULL; watch = watch->next) {
+		if (watch->to_delay != NULL ||
+		    strcmp(watch->box->notify_guid, guid) != 0)
+			continue;
+		/* the view's highest modseq tells what we've already synced.
+		   without the modseq header it's unknown, so always notify. */
+		synced_modseq =
+			mail_index_modseq_get_highest_synced(watch->box->view);
+		if (synced_modseq != 0 && modseq <= synced_modseq)
+			continue;
+		watch->to_delay = timeout_add_short(MAILBOX_NOTIFY_CLIENT_DELAY_MSECS,
+						    mailbox_notify_client_delay,
+						    watch);
+	}
+}
+
+static int
+mailbox_notify_client_input_args(struct connection *conn,
+				 const char *const *args)
+{
+	struct mailbox_notify_client *client =
+		(struct mailbox_notify_client *)conn;
+	uint64_t modseq;
+
+	/* CHANGED <mailbox guid> <highest modseq> */
+	if (args[0] != NULL && strcmp(args[0], "CHANGED") == 0 &&
+	    args[1] != NULL && args[2] != NULL &&
+	    str_to_uint64(args[2], &modseq) == 0) {
+		mailbox_notify_client_changed_input(client, args[1], modseq);
+		return 1;
+	}
+	e_error(conn->event, "Received unexpected input: %s",
+		t_strarray_join(args, "\t"));
+	return -1;
+}
+
+static void mailbox_notify_watch_free(struct mailbox_notify_client_watch *watch)
+{
+	DLLIST_REMOVE(&watch->client->watches, watch);
+	watch->box->notify_client_watch = NULL;
+	timeout_remove(&watch->to_delay);
+	i_free(watch);
+}
+
+static void mailbox_notify_client_destroy(struct connection *conn)
+{
+	struct mailbox_notify_client *client =
+		(struct mailbox_notify_client *)conn;
+	struct mailbox_notify_client_watch *watch;
+	struct mailbox *box;
+
+	connection_disconnect(conn);
+	client->connected = FALSE;
+	client->reconnect_after = ioloop_time +
+		MAILBOX_NOTIFY_CLIENT_RECONNECT_INTERVAL_SECS;
+
+	/* Fall back to watching the mailbox files. Changes may have been
+	   missed, so notify immediately as well. */
+	while (client->watches != NULL) {
+		watch = client->watches;
+		box = watch->box;
+		mailbox_notify_watch_free(watch);
+
+		box->v.notify_changes(box);
+		if (box->notify_callback != NULL)
+			box->notify_callback(box, box->notify_context);
+	}
+}
+
+static const struct connection_settings mailbox_notify_client_set = {
+	.service_name_in = MAILBOX_NOTIFY_SERVICE_NAME,
+	.service_name_out = MAILBOX_NOTIFY_SERVICE_NAME,
+	.major_version = MAILBOX_NOTIFY_VERSION_MAJOR,
+	.minor_version = MAILBOX_NOTIFY_VERSION_MINOR,
+
+	.input_max_size = (size_t)-1,
+	.output_max_size = (size_t)-1,
+	.client = TRUE
+};
+
+static const struct connection_vfuncs mailbox_notify_client_vfuncs = {
+	.destroy = mailbox_notify_client_destroy,
+	.input_args = mailbox_notify_client_input_args,
+};
+
+static struct mailbox_notify_client *
+mailbox_notify_client_get(struct mailbox *box)
+{
+	struct mail_user *user = box->storage->user;
+	struct mailbox_notify_client *client = user->_notify_client;
+	const char *path = box->storage->set->mailbox_notify_socket_path;
+
+	if (client == NULL) {
+		if (*path != '/')
+			path = t_strconcat(user->set->base_dir, "/", path, NULL);
+		if (mailbox_notify_clients == NULL) {
+			mailbox_notify_clients =
+				connection_list_init(&mailbox_notify_client_set,
+						     &mailbox_notify_client_vfuncs);
+		}
+		client = i_new(struct mailbox_notify_client, 1);
+		client->user = user;
+		connection_init_client_unix(mailbox_notify_clients,
+					    &client->conn, path);
+		user->_notify_client = client;
+	}
+	if (client->connected)
+		return client;
+	if (ioloop_time < client->reconnect_after)
+		return NULL;
+
+	if (connection_client_connect(&client->conn) < 0) {
+		e_error(user->event, "mailbox-notify: net_connect_unix(%s) failed: %m",
+			client->conn.name);
+		client->reconnect_after = ioloop_time +
+			MAILBOX_NOTIFY_CLIENT_RECONNECT_INTERVAL_SECS;
+		return NULL;
+	}
+	client->connected = TRUE;
+	return client;
+}
+
+static int mailbox_notify_get_guid(struct mailbox *box)
+{
+	struct mailbox_metadata metadata;
+
+	if (box->notify_guid != NULL)
+		return 0;
+	if (mailbox_get_metadata(box, MAILBOX_METADATA_GUID, &metadata) < 0)
+		return -1;
+	box->notify_guid = p_strdup(box->pool, guid_128_to_string(metadata.guid));
+	return 0;
+}
+
+static bool mailbox_notify_client_is_usable(struct mailbox *box)
+{
+	/* Only the storages whose mailboxes are changed by nothing but
+	   Dovecot's own index updates can rely on the writers' notifications.
+	   Others (e.g. maildir/mbox with external MDAs, imapc, virtual) need
+	   to keep watching for the changes themselves. */
+	return box->storage->set->mailbox_notify_socket_path[0] != '\0' &&
+		(box->storage->class_flags &
+		 MAIL_STORAGE_CLASS_FLAG_NO_EXTERNAL_CHANGES) != 0 &&
+		box->index != NULL;
+}
+
+bool mailbox_notify_client_watch(struct mailbox *box)
+{
+	struct mailbox_notify_client *client;
+	struct mailbox_notify_client_watch *watch;
+
+	if (box->notify_client_watch != NULL)
+		return TRUE;
+	if (!mailbox_notify_client_is_usable(box) || box->view == NULL)
+		return FALSE;
+	if (mailbox_notify_get_guid(box) < 0)
+		return FALSE;
+	if ((client = mailbox_notify_client_get(box)) == NULL)
+		return FALSE;
+
+	watch = i_new(struct mailbox_notify_client_watch, 1);
+	watch->client = client;
+	watch->box = box;
+	DLLIST_PREPEND(&client->watches, watch);
+	box->notify_client_watch = watch;
+
+	o_stream_nsend_str(client->conn.output,
+			   t_strdup_printf("SUB\t%s\n", box->notify_guid));
+	return TRUE;
+}
+
+void mailbox_notify_client_unwatch(struct mailbox *box)
+{
+	struct mailbox_notify_client_watch *watch = box->notify_client_watch;
+	struct mailbox_notify_client *client;
+
+	if (watch == NULL)
+		return;
+	client = watch->client;
+	mailbox_notify_watch_free(watch);
+
+	/* another mailbox in this session may still want the same mailbox */
+	for (watch = client->watches; watch != NULL; watch = watch->next) {
+		if (strcmp(watch->box->notify_guid, box->notify_guid) == 0)
+			return;
+	}
+	o_stream_nsend_str(client->conn.output,
+			   t_strdup_printf("UNSUB\t%s\n", box->notify_guid));
+}
+
+void mailbox_notify_client_changed(struct mailbox *box)
+{
+	struct mailbox_notify_client *client;
+	uint64_t modseq;
+
+	if (!mailbox_notify_client_is_usable(box))
+		return;
+
+	/* Only changes written by this process are sent. The other
+	   processes send their own changes. */
+	modseq = mail_index_modseq_get_last_appended(box->index);
+	if (modseq <= box->notify_sent_modseq)
+		return;
+	if (mailbox_notify_get_guid(box) < 0)
+		return;
+	if ((client = mailbox_notify_client_get(box)) == NULL)
+		return;
+
+	box->notify_sent_modseq = modseq;
+	o_stream_nsend_str(client->conn.output,
+		t_strdup_printf("CHANGED\t%s\t%"PRIu64"\n",
+				box->notify_guid, modseq));
+}
+
+void mailbox_notify_client_deinit(struct mail_user *user)
+{
+	struct mailbox_notify_client *client = user->_notify_client;
+
+	if (client == NULL)
+		return;
+	user->_notify_client = NULL;
+
+	/* all the mailboxes have already been freed */
+	i_assert(client->watches == NULL);
+	connection_deinit(&client->conn);
+	i_free(client);
+
+	if (mailbox_notify_clients->connections_count == 0)
+		connection_list_deinit(&mailbox_notify_clients);
+}
@@ -0,0 +1,26 @@
+#ifndef MAILBOX_NOTIFY_CLIENT_H
+#define MAILBOX_NOTIFY_CLIENT_H
+
+#define MAILBOX_NOTIFY_SERVICE_NAME "mailbox-notify"
+#define MAILBOX_NOTIFY_VERSION_MAJOR 1
+#define MAILBOX_NOTIFY_VERSION_MINOR 0
+
+struct mailbox;
+struct mail_user;
+
+/* Start waiting for the mailbox's change notifications from the
+   mailbox-notify service. box->notify_callback is called when another
+   process has changed the mailbox. Returns FALSE if mailbox_notify_socket_path
+   isn't set, the storage may be changed outside Dovecot's index updates or
+   the service can't be used, and the caller should fall back to the
+   storage's own change watching instead. */
+bool mailbox_notify_client_watch(struct mailbox *box);
+/* Stop waiting for the mailbox's change notifications. */
+void mailbox_notify_client_unwatch(struct mailbox *box);
+/* The mailbox may have been changed by this process. Tell the processes
+   waiting for it if the highest modseq has grown. */
+void mailbox_notify_client_changed(struct mailbox *box);
+
+void mailbox_notify_client_deinit(struct mail_user *user);
+
+#endif
@@ -35,6 +35,13 @@ bool mail_index_modseq_get_next_log_offset(struct mail_index_view *view ATTR_UNU
 	return TRUE;
 }
 
+bool mail_index_modseq_get_expunged_uids(struct mail_index_view *view ATTR_UNUSED,
+					 uint64_t modseq ATTR_UNUSED,
+					 ARRAY_TYPE(seq_range) *expunged_uids ATTR_UNUSED)
+{
+	return FALSE;
+}
+
 struct mail_transaction_log_view *
 mail_transaction_log_view_open(struct mail_transaction_log *log ATTR_UNUSED) { return NULL; }
 int mail_transaction_log_view_set(struct mail_transaction_log_view *view ATTR_UNUSED,
@@ -0,0 +1,11 @@
+#ifndef BASE64_PRIVATE_H
+#define BASE64_PRIVATE_H
+
+#include "base64.h"
+
+/* Enable or disable the SIMD implementation. It's enabled by default when
+   the CPU supports it. This is mainly useful for testing and benchmarking
+   the scalar code. */
+void base64_set_simd(bool enable);
+
+#endif
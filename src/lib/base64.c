@@ -1,9 +1,14 @@
 /* Copyright (c) 2007-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
-#include "base64.h"
+#include "base64-private.h"
 #include "buffer.h"
 
+#ifdef HAVE_X86_SIMD_TARGETS
+#  include <tmmintrin.h>
+#  define BASE64_SIMD_TARGET __attribute__((target("ssse3")))
+#endif
+
 static const char b64enc[] =
 	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
@@ -43,15 +48,137 @@ static const unsigned char b64dec[256] = {
 	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
 };
 
+#ifdef HAVE_X86_SIMD_TARGETS
+/* -1 = not checked yet, 0 = disabled, 1 = enabled */
+static int base64_simd = -1;
+
+static bool base64_have_simd(void)
+{
+	if (unlikely(base64_simd == -1))
+		base64_simd = __builtin_cpu_supports("ssse3") ? 1 : 0;
+	return base64_simd == 1;
+}
+
+void base64_set_simd(bool enable)
+{
+	base64_simd = enable ? -1 : 0;
+}
+
+/* The SSSE3 code is based on the algorithms described by Wojciech Muła
+   and Daniel Lemire, as implemented by Alfred Klomp's base64 library. */
+static size_t BASE64_SIMD_TARGET
+base64_encode_ssse3(const unsigned char *src, size_t src_size,
+		    unsigned char *dest)
+{
+	/* each 3 byte group is expanded to a 32bit lane */
+	const __m128i shuf = _mm_set_epi8(
+		10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+	/* offsets added to 6bit values: a-z, 0-9, +, /, A-Z */
+	const __m128i offsets = _mm_setr_epi8(
+		'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+		'/' - 63, 'A', 0, 0);
+	__m128i in, t0, t1, t2, t3, idx, lut_idx, out;
+	size_t pos;
+
+	/* 16 bytes are read, but only 12 are used */
+	for (pos = 0; src_size - pos >= 16; pos += 12, dest += 16) {
+		in = _mm_loadu_si128((const void *)(src + pos));
+		in = _mm_shuffle_epi8(in, shuf);
+
+		/* split each lane into four 6bit indexes */
+		t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+		t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+		t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+		t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+		idx = _mm_or_si128(t1, t3);
+
+		/* 0..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12,
+		   and then 0..25 -> 13 */
+		lut_idx = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+		lut_idx = _mm_or_si128(lut_idx, _mm_and_si128(
+			_mm_cmpgt_epi8(_mm_set1_epi8(26), idx),
+			_mm_set1_epi8(13)));
+		out = _mm_add_epi8(idx, _mm_shuffle_epi8(offsets, lut_idx));
+		_mm_storeu_si128((void *)dest, out);
+	}
+	return pos;
+}
+
+/* Decode up to max_blocks 16 byte blocks. Each block is written as 16 bytes,
+   of which the first 12 bytes are the output. Returns the number of blocks
+   decoded. Stops at the first block that isn't fully valid base64. */
+static size_t BASE64_SIMD_TARGET
+base64_decode_ssse3(const unsigned char *src, size_t src_size,
+		    unsigned char *dest, size_t max_blocks)
+{
+	/* lut_lo[lo nibble] & lut_hi[hi nibble] is non-zero for
+	   characters that aren't valid base64 (including '=') */
+	const __m128i lut_lo = _mm_setr_epi8(
+		0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+		0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+	const __m128i lut_hi = _mm_setr_epi8(
+		0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+		0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	/* offsets to add by hi nibble, '/' uses index 1 */
+	const __m128i lut_roll = _mm_setr_epi8(
+		0, 16, 19, 4, -65, -65, -71, -71,
+		0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i nibble_mask = _mm_set1_epi8(0x0f);
+	const __m128i shuf = _mm_setr_epi8(
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	__m128i in, hi_nibbles, lo_nibbles, hi, lo, roll;
+	size_t n;
+
+	for (n = 0; n < max_blocks && src_size >= 16; n++) {
+		in = _mm_loadu_si128((const void *)src);
+		hi_nibbles = _mm_and_si128(_mm_srli_epi32(in, 4), nibble_mask);
+		lo_nibbles = _mm_and_si128(in, nibble_mask);
+		hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+		lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+		if (_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi),
+						     _mm_setzero_si128())) != 0) {
+			/* whitespace, padding or invalid input - let the
+			   scalar code handle it */
+			break;
+		}
+		roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(
+			_mm_cmpeq_epi8(in, _mm_set1_epi8('/')), hi_nibbles));
+		in = _mm_add_epi8(in, roll);
+
+		/* pack the 6bit values into 12 bytes */
+		in = _mm_maddubs_epi16(in, _mm_set1_epi32(0x01400140));
+		in = _mm_madd_epi16(in, _mm_set1_epi32(0x00011000));
+		in = _mm_shuffle_epi8(in, shuf);
+		_mm_storeu_si128((void *)dest, in);
+
+		src += 16;
+		src_size -= 16;
+		dest += 12;
+	}
+	return n;
+}
+#else
+void base64_set_simd(bool enable ATTR_UNUSED)
+{
+}
+#endif
+
 void base64_encode(const void *src, size_t src_size, buffer_t *dest)
 {
 	const size_t res_size = MAX_BASE64_ENCODED_SIZE(src_size);
 	unsigned char *start = buffer_append_space_unsafe(dest, res_size);
 	unsigned char *ptr = start;
 	const unsigned char *src_c = src;
-	size_t src_pos;
+	size_t src_pos = 0;
 
-	for (src_pos = 0; src_size - src_pos > 2; src_pos += 3, ptr += 4) {
+#ifdef HAVE_X86_SIMD_TARGETS
+	if (src_size >= 16 && base64_have_simd()) {
+		src_pos = base64_encode_ssse3(src_c, src_size, ptr);
+		ptr += src_pos / 3 * 4;
+	}
+#endif
+	for (; src_size - src_pos > 2; src_pos += 3, ptr += 4) {
 		ptr[0] = b64enc[src_c[src_pos] >> 2];
 		ptr[1] = b64enc[((src_c[src_pos] & 0x03) << 4) |
 				(src_c[src_pos+1] >> 4)];
@@ -86,15 +213,53 @@ void base64_encode(const void *src, size_t src_size, buffer_t *dest)
 #define IS_EMPTY(c) \
 	((c) == '\n' || (c) == '\r' || (c) == ' ' || (c) == '\t')
 
+/* Decoded output is collected into a local buffer before it's appended to
+   dest. */
+#define BASE64_DECODE_BATCH_SIZE 192
+
 int base64_decode(const void *src, size_t src_size,
 		  size_t *src_pos_r, buffer_t *dest)
 {
 	const unsigned char *src_c = src;
 	size_t src_pos;
-	unsigned char input[4], output[3];
+	unsigned char input[4];
+	/* the SIMD code writes 4 bytes past its output */
+	unsigned char output[BASE64_DECODE_BATCH_SIZE + 4];
+	size_t output_used = 0;
 	int ret = 1;
+#ifdef HAVE_X86_SIMD_TARGETS
+	bool try_simd = base64_have_simd();
+#endif
 
 	for (src_pos = 0; src_pos+3 < src_size; ) {
+		if (output_used + 3 > BASE64_DECODE_BATCH_SIZE) {
+			buffer_append(dest, output, output_used);
+			output_used = 0;
+		}
+#ifdef HAVE_X86_SIMD_TARGETS
+		if (try_simd && src_size - src_pos >= 16) {
+			size_t max_blocks, n;
+
+			if (output_used + 12 > BASE64_DECODE_BATCH_SIZE) {
+				buffer_append(dest, output, output_used);
+				output_used = 0;
+			}
+			max_blocks = (BASE64_DECODE_BATCH_SIZE - output_used) / 12;
+			n = base64_decode_ssse3(src_c + src_pos,
+						       src_size - src_pos,
+						       output + output_used,
+						       max_blocks);
+			src_pos += n * 16;
+			output_used += n * 12;
+			if (n == max_blocks)
+				continue;
+			/* don't retry until we're past the next whitespace
+			   (e.g. the CRLF at the end of line) */
+			try_simd = FALSE;
+			if (src_pos+3 >= src_size)
+				break;
+		}
+#endif
 		input[0] = b64dec[src_c[src_pos]];
 		if (input[0] == 0xff) {
 			if (unlikely(!IS_EMPTY(src_c[src_pos]))) {
@@ -102,6 +267,9 @@ int base64_decode(const void *src, size_t src_size,
 				break;
 			}
 			src_pos++;
+#ifdef HAVE_X86_SIMD_TARGETS
+			try_simd = base64_simd == 1;
+#endif
 			continue;
 		}
 
@@ -110,7 +278,7 @@ int base64_decode(const void *src, size_t src_size,
 			ret = -1;
 			break;
 		}
-		output[0] = (input[0] << 2) | (input[1] >> 4);
+		output[output_used] = (input[0] << 2) | (input[1] >> 4);
 
 		input[2] = b64dec[src_c[src_pos+2]];
 		if (input[2] == 0xff) {
@@ -119,29 +287,30 @@ int base64_decode(const void *src, size_t src_size,
 				ret = -1;
 				break;
 			}
-			buffer_append(dest, output, 1);
+			output_used++;
 			ret = 0;
 			src_pos += 4;
 			break;
 		}
 
-		output[1] = (input[1] << 4) | (input[2] >> 2);
+		output[output_used+1] = (input[1] << 4) | (input[2] >> 2);
 		input[3] = b64dec[src_c[src_pos+3]];
 		if (input[3] == 0xff) {
 			if (unlikely(src_c[src_pos+3] != '=')) {
 				ret = -1;
 				break;
 			}
-			buffer_append(dest, output, 2);
+			output_used += 2;
 			ret = 0;
 			src_pos += 4;
 			break;
 		}
 
-		output[2] = ((input[2] << 6) & 0xc0) | input[3];
-		buffer_append(dest, output, 3);
+		output[output_used+2] = ((input[2] << 6) & 0xc0) | input[3];
+		output_used += 3;
 		src_pos += 4;
 	}
+	buffer_append(dest, output, output_used);
 
 	for (; src_pos < src_size; src_pos++) {
 		if (!IS_EMPTY(src_c[src_pos]))
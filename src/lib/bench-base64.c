@@ -0,0 +1,79 @@
+/* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
+
+#include "bench-lib.h"
+#include "buffer.h"
+#include "randgen.h"
+#include "base64-private.h"
+
+#define BENCH_BASE64_INPUT_SIZE (1024*64)
+#define BENCH_BASE64_LINE_LEN 76
+
+static void
+bench_base64_impl(const char *name, bool simd, const buffer_t *input,
+		  const buffer_t *encoded, const buffer_t *wrapped)
+{
+	buffer_t *output;
+	unsigned int i, count;
+
+	output = t_buffer_create(MAX_BASE64_ENCODED_SIZE(input->used) + 16);
+	base64_set_simd(simd);
+
+	bench_begin(t_strdup_printf("base64_encode %s", name));
+	bench_set_bytes_per_op(input->used);
+	while ((count = bench_batch()) > 0) {
+		for (i = 0; i < count; i++) {
+			buffer_set_used_size(output, 0);
+			base64_encode(input->data, input->used, output);
+		}
+	}
+	bench_end();
+
+	bench_begin(t_strdup_printf("base64_decode %s", name));
+	bench_set_bytes_per_op(encoded->used);
+	while ((count = bench_batch()) > 0) {
+		for (i = 0; i < count; i++) {
+			buffer_set_used_size(output, 0);
+			if (base64_decode(encoded->data, encoded->used,
+					  NULL, output) < 0)
+				i_unreached();
+		}
+	}
+	bench_end();
+
+	bench_begin(t_strdup_printf("base64_decode %s %u char lines", name,
+				    BENCH_BASE64_LINE_LEN));
+	bench_set_bytes_per_op(wrapped->used);
+	while ((count = bench_batch()) > 0) {
+		for (i = 0; i < count; i++) {
+			buffer_set_used_size(output, 0);
+			if (base64_decode(wrapped->data, wrapped->used,
+					  NULL, output) < 0)
+				i_unreached();
+		}
+	}
+	bench_end();
+}
+
+void bench_base64(void)
+{
+	buffer_t *input, *encoded, *wrapped;
+	size_t pos;
+
+	input = t_buffer_create(BENCH_BASE64_INPUT_SIZE);
+	random_fill(buffer_append_space_unsafe(input, BENCH_BASE64_INPUT_SIZE),
+		    BENCH_BASE64_INPUT_SIZE);
+	encoded = t_buffer_create(MAX_BASE64_ENCODED_SIZE(BENCH_BASE64_INPUT_SIZE));
+	base64_encode(input->data, input->used, encoded);
+
+	wrapped = t_buffer_create(encoded->used +
+		encoded->used / BENCH_BASE64_LINE_LEN * 2 + 2);
+	for (pos = 0; pos < encoded->used; pos += BENCH_BASE64_LINE_LEN) {
+		buffer_append(wrapped, CONST_PTR_OFFSET(encoded->data, pos),
+			      I_MIN(BENCH_BASE64_LINE_LEN, encoded->used - pos));
+		buffer_append(wrapped, "\r\n", 2);
+	}
+
+	bench_base64_impl("scalar", FALSE, input, encoded, wrapped);
+	bench_base64_impl("simd", TRUE, input, encoded, wrapped);
+	base64_set_simd(TRUE);
+}
@@ -0,0 +1,88 @@
+/* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
+
+#include "bench-lib.h"
+#include "hash.h"
+
+#define BENCH_HASH_KEY_COUNT 10000
+
+static void bench_hash_type(bool open_addressing)
+{
+	HASH_TABLE(char *, void *) str_table;
+	HASH_TABLE(void *, void *) direct_table;
+	const char *prefix = open_addressing ? "hash open" : "hash";
+	const char **keys, **miss_keys;
+	unsigned int i, n, count;
+
+	keys = t_new(const char *, BENCH_HASH_KEY_COUNT);
+	miss_keys = t_new(const char *, BENCH_HASH_KEY_COUNT);
+	for (i = 0; i < BENCH_HASH_KEY_COUNT; i++) {
+		keys[i] = t_strdup_printf("key-%u@example.com", i * 7919);
+		miss_keys[i] = t_strdup_printf("miss-%u@example.com", i);
+	}
+
+	if (open_addressing)
+		hash_table_create_open(&str_table, 0, str_hash, strcmp);
+	else
+		hash_table_create(&str_table, default_pool, 0, str_hash, strcmp);
+	bench_begin(t_strdup_printf("%s str insert", prefix));
+	while ((count = bench_batch()) > 0) {
+		for (n = 0; n < count; n++) {
+			i = n % BENCH_HASH_KEY_COUNT;
+			hash_table_insert(str_table, (char *)keys[i],
+					  POINTER_CAST(1));
+			if (i == BENCH_HASH_KEY_COUNT-1)
+				hash_table_clear(str_table, TRUE);
+		}
+		hash_table_clear(str_table, TRUE);
+	}
+	bench_end();
+
+	for (i = 0; i < BENCH_HASH_KEY_COUNT; i++)
+		hash_table_insert(str_table, (char *)keys[i], POINTER_CAST(1));
+	bench_begin(t_strdup_printf("%s str lookup", prefix));
+	while ((count = bench_batch()) > 0) {
+		for (n = 0; n < count; n++) {
+			if (hash_table_lookup(str_table,
+					keys[n % BENCH_HASH_KEY_COUNT]) == NULL)
+				i_unreached();
+		}
+	}
+	bench_end();
+
+	bench_begin(t_strdup_printf("%s str lookup miss", prefix));
+	while ((count = bench_batch()) > 0) {
+		for (n = 0; n < count; n++) {
+			if (hash_table_lookup(str_table,
+					miss_keys[n % BENCH_HASH_KEY_COUNT]) != NULL)
+				i_unreached();
+		}
+	}
+	bench_end();
+	hash_table_destroy(&str_table);
+
+	if (open_addressing)
+		hash_table_create_direct_open(&direct_table, 0);
+	else
+		hash_table_create_direct(&direct_table, default_pool, 0);
+	for (i = 1; i <= BENCH_HASH_KEY_COUNT; i++) {
+		hash_table_insert(direct_table, POINTER_CAST(i),
+				  POINTER_CAST(i));
+	}
+	bench_begin(t_strdup_printf("%s direct lookup", prefix));
+	while ((count = bench_batch()) > 0) {
+		for (n = 0; n < count; n++) {
+			i = n % BENCH_HASH_KEY_COUNT + 1;
+			if (hash_table_lookup(direct_table,
+					      POINTER_CAST(i)) == NULL)
+				i_unreached();
+		}
+	}
+	bench_end();
+	hash_table_destroy(&direct_table);
+}
+
+void bench_hash(void)
+{
+	bench_hash_type(FALSE);
+	bench_hash_type(TRUE);
+}
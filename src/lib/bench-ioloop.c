@@ -0,0 +1,53 @@
+/* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
+
+#include "bench-lib.h"
+#include "ioloop.h"
+
+#define BENCH_IOLOOP_TIMEOUT_COUNT 100000
+
+static void bench_ioloop_timeout_callback(void *context ATTR_UNUSED)
+{
+}
+
+static void bench_ioloop_started(void *context ATTR_UNUSED)
+{
+	io_loop_stop(current_ioloop);
+}
+
+static void bench_ioloop_timeout_reset(unsigned int msecs)
+{
+	struct ioloop *ioloop;
+	struct timeout **timeouts, *to_start;
+	unsigned int i, n, count;
+
+	ioloop = io_loop_create();
+	timeouts = i_new(struct timeout *, BENCH_IOLOOP_TIMEOUT_COUNT);
+	for (i = 0; i < BENCH_IOLOOP_TIMEOUT_COUNT; i++) {
+		timeouts[i] = timeout_add_short(msecs + i % 100,
+						bench_ioloop_timeout_callback, NULL);
+	}
+	/* new timeouts are started by the ioloop */
+	to_start = timeout_add(0, bench_ioloop_started, NULL);
+	io_loop_run(ioloop);
+	timeout_remove(&to_start);
+
+	bench_begin(t_strdup_printf("timeout_reset %u ms timeouts", msecs));
+	while ((count = bench_batch()) > 0) {
+		for (n = 0; n < count; n++)
+			timeout_reset(timeouts[n % BENCH_IOLOOP_TIMEOUT_COUNT]);
+	}
+	bench_end();
+
+	for (i = 0; i < BENCH_IOLOOP_TIMEOUT_COUNT; i++)
+		timeout_remove(&timeouts[i]);
+	i_free(timeouts);
+	io_loop_destroy(&ioloop);
+}
+
+void bench_ioloop(void)
+{
+	/* priority queue */
+	bench_ioloop_timeout_reset(10);
+	/* timing wheel */
+	bench_ioloop_timeout_reset(60*1000);
+}
@@ -0,0 +1,75 @@
+/* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
+
+#include "bench-lib.h"
+#include "str.h"
+#include "istream.h"
+#include "istream-crlf.h"
+#include "istream-concat.h"
+
+#define BENCH_ISTREAM_LINE "This is a line of mail text, roughly 60 chars long\n"
+#define BENCH_ISTREAM_LINE_COUNT 1000
+
+static void bench_istream_read_all(struct istream *input)
+{
+	const unsigned char *data;
+	size_t size;
+
+	while (i_stream_read_more(input, &data, &size) > 0)
+		i_stream_skip(input, size);
+	i_assert(input->eof && input->stream_errno == 0);
+}
+
+void bench_istream(void)
+{
+	struct istream *input, *input2, *concat[3];
+	string_t *str;
+	unsigned int i, count;
+
+	str = t_str_new(sizeof(BENCH_ISTREAM_LINE) * BENCH_ISTREAM_LINE_COUNT);
+	for (i = 0; i < BENCH_ISTREAM_LINE_COUNT; i++)
+		str_append(str, BENCH_ISTREAM_LINE);
+
+	bench_begin("i_stream_read_next_line()");
+	bench_set_bytes_per_op(str_len(str));
+	while ((count = bench_batch()) > 0) {
+		for (i = 0; i < count; i++) {
+			input = i_stream_create_from_data(str_data(str),
+							  str_len(str));
+			while (i_stream_read_next_line(input) != NULL) ;
+			i_stream_unref(&input);
+		}
+	}
+	bench_end();
+
+	bench_begin("istream-crlf");
+	bench_set_bytes_per_op(str_len(str));
+	while ((count = bench_batch()) > 0) {
+		for (i = 0; i < count; i++) {
+			input = i_stream_create_from_data(str_data(str),
+							  str_len(str));
+			input2 = i_stream_create_crlf(input);
+			bench_istream_read_all(input2);
+			i_stream_unref(&input2);
+			i_stream_unref(&input);
+		}
+	}
+	bench_end();
+
+	bench_begin("istream-concat");
+	bench_set_bytes_per_op(str_len(str) * 2);
+	while ((count = bench_batch()) > 0) {
+		for (i = 0; i < count; i++) {
+			concat[0] = i_stream_create_from_data(str_data(str),
+							      str_len(str));
+			concat[1] = i_stream_create_from_data(str_data(str),
+							      str_len(str));
+			concat[2] = NULL;
+			input = i_stream_create_concat(concat);
+			i_stream_unref(&concat[0]);
+			i_stream_unref(&concat[1]);
+			bench_istream_read_all(input);
+			i_stream_unref(&input);
+		}
+	}
+	bench_end();
+}
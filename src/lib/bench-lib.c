@@ -0,0 +1,14 @@
+/* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
+
+#include "bench-lib.h"
+
+int main(int argc, char *argv[])
+{
+	static const struct named_bench bench_functions[] = {
+#define BENCH(x) BENCH_NAMED(x)
+#include "bench-lib.inc"
+#undef BENCH
+		{ NULL, NULL }
+	};
+	return bench_main(bench_functions, argc, argv);
+}
@@ -0,0 +1,11 @@
+#ifndef BENCH_LIB
+#define BENCH_LIB
+
+#include "lib.h"
+#include "bench-common.h"
+
+#define BENCH(x) void x(void);
+#include "bench-lib.inc"
+#undef BENCH
+
+#endif
@@ -0,0 +1,86 @@
+/* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
+
+#include "bench-lib.h"
+
+#define BENCH_MEMPOOL_ALLOCS_PER_CLEAR 1000
+
+void bench_mempool_alloconly(void)
+{
+	pool_t pool;
+	unsigned int i, count;
+
+	pool = pool_alloconly_create("bench", 1024*64);
+	bench_begin("pool_alloconly p_malloc(32)");
+	while ((count = bench_batch()) > 0) {
+		for (i = 0; i < count; i++) {
+			(void)p_malloc(pool, 32);
+			if (i % BENCH_MEMPOOL_ALLOCS_PER_CLEAR == 0)
+				p_clear(pool);
+		}
+	}
+	bench_end();
+
+	bench_begin("pool_alloconly create+unref");
+	while ((count = bench_batch()) > 0) {
+		for (i = 0; i < count; i++) {
+			pool_t tmp_pool = pool_alloconly_create("bench tmp", 512);
+			(void)p_strdup(tmp_pool, "hello");
+			pool_unref(&tmp_pool);
+		}
+	}
+	bench_end();
+	pool_unref(&pool);
+}
+
+static void bench_mempool_alloc_free(pool_t pool, const char *name)
+{
+	void *mems[64];
+	unsigned int i, count;
+
+	memset(mems, 0, sizeof(mems));
+	bench_begin(name);
+	while ((count = bench_batch()) > 0) {
+		for (i = 0; i < count; i++) {
+			void **memp = &mems[i % N_ELEMENTS(mems)];
+
+			p_free(pool, *memp);
+			*memp = p_malloc(pool, 16 + (i % 8) * 24);
+		}
+	}
+	bench_end();
+	p_clear(pool);
+}
+
+void bench_mempool_allocfree_slab(void)
+{
+	pool_t pool;
+
+	pool = pool_allocfree_create("bench");
+	bench_mempool_alloc_free(pool, "pool_allocfree p_malloc+p_free");
+	pool_unref(&pool);
+
+	pool = pool_slab_create("bench");
+	bench_mempool_alloc_free(pool, "pool_slab p_malloc+p_free");
+	pool_unref(&pool);
+}
+
+void bench_data_stack(void)
+{
+	unsigned int i, count;
+
+	bench_begin("data stack T_BEGIN+t_malloc(32)");
+	while ((count = bench_batch()) > 0) {
+		for (i = 0; i < count; i++) T_BEGIN {
+			(void)t_malloc_no0(32);
+		} T_END;
+	}
+	bench_end();
+
+	bench_begin("data stack t_strdup_printf()");
+	while ((count = bench_batch()) > 0) {
+		for (i = 0; i < count; i++) T_BEGIN {
+			(void)t_strdup_printf("%u: %s", i, "hello");
+		} T_END;
+	}
+	bench_end();
+}
@@ -0,0 +1,41 @@
+/* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
+
+#include "bench-lib.h"
+#include "array.h"
+#include "seq-range-array.h"
+
+#define BENCH_SEQ_RANGE_MAX_SEQ 100000
+
+void bench_seq_range_array(void)
+{
+	ARRAY_TYPE(seq_range) range;
+	unsigned int i, count;
+	uint32_t seq;
+
+	i_array_init(&range, 128);
+	bench_begin("seq_range_array_add sequential");
+	while ((count = bench_batch()) > 0) {
+		for (i = 0; i < count; i++) {
+			seq = i % BENCH_SEQ_RANGE_MAX_SEQ + 1;
+			if (seq == 1)
+				array_clear(&range);
+			seq_range_array_add(&range, seq);
+		}
+	}
+	bench_end();
+
+	/* every other sequence, so each one is a separate range */
+	array_clear(&range);
+	for (seq = 1; seq <= BENCH_SEQ_RANGE_MAX_SEQ; seq += 2)
+		seq_range_array_add(&range, seq);
+	bench_begin("seq_range_exists sparse");
+	while ((count = bench_batch()) > 0) {
+		for (i = 0; i < count; i++) {
+			seq = (i * 7919) % BENCH_SEQ_RANGE_MAX_SEQ + 1;
+			if (seq_range_exists(&range, seq) != ((seq % 2) == 1))
+				i_unreached();
+		}
+	}
+	bench_end();
+	array_free(&range);
+}
@@ -0,0 +1,50 @@
+/* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
+
+#include "bench-lib.h"
+#include "str-find.h"
+#include "str-find-multi.h"
+
+#define BENCH_STR_FIND_DATA_SIZE 4096
+
+void bench_str_find(void)
+{
+	static const char *const keys[] = {
+		"Subject: hello there", "world\r\nX", "hellox", "Subjex", NULL
+	};
+	struct str_find_context *ctx;
+	struct str_find_multi_context *mctx;
+	unsigned char *data;
+	unsigned int i, count;
+
+	/* text that contains a lot of partial matches */
+	data = t_malloc_no0(BENCH_STR_FIND_DATA_SIZE);
+	for (i = 0; i < BENCH_STR_FIND_DATA_SIZE; i++)
+		data[i] = "Subject: hello world\r\n"[i % 22];
+
+	ctx = str_find_init(default_pool, "Subject: hello there");
+	bench_begin("str_find_more 4k miss");
+	bench_set_bytes_per_op(BENCH_STR_FIND_DATA_SIZE);
+	while ((count = bench_batch()) > 0) {
+		for (i = 0; i < count; i++) {
+			str_find_reset(ctx);
+			if (str_find_more(ctx, data, BENCH_STR_FIND_DATA_SIZE))
+				i_unreached();
+		}
+	}
+	bench_end();
+	str_find_deinit(&ctx);
+
+	mctx = str_find_multi_init(default_pool, keys);
+	bench_begin("str_find_multi_more 4k miss 4 keys");
+	bench_set_bytes_per_op(BENCH_STR_FIND_DATA_SIZE);
+	while ((count = bench_batch()) > 0) {
+		for (i = 0; i < count; i++) {
+			str_find_multi_reset(mctx);
+			if (str_find_multi_more(mctx, data,
+						BENCH_STR_FIND_DATA_SIZE))
+				i_unreached();
+		}
+	}
+	bench_end();
+	str_find_multi_deinit(&mctx);
+}
@@ -584,6 +584,20 @@ void data_stack_set_clean_after_pop(bool enable ATTR_UNUSED)
 #endif
 }
 
+void data_stack_free_unused(void)
+{
+	if (unused_block != &outofmem_area.block)
+		free(unused_block);
+	unused_block = NULL;
+
+	while (unused_frame_blocks != NULL) {
+		struct stack_frame_block *frame_block = unused_frame_blocks;
+		unused_frame_blocks = unused_frame_blocks->prev;
+
+		free(frame_block);
+	}
+}
+
 void data_stack_init(void)
 {
 	if (data_stack_initialized) {
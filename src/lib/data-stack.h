@@ -117,6 +117,12 @@ void t_buffer_alloc_last_full(void);
 /* If enabled, all the used memory is cleared after t_pop(). */
 void data_stack_set_clean_after_pop(bool enable);
 
+/* Free the memory that was kept allocated for reuse by later t_push() and
+   t_malloc() calls. This is useful for long-running processes that serve
+   multiple users, so one user's large request doesn't keep memory
+   permanently reserved. */
+void data_stack_free_unused(void);
+
 void data_stack_init(void);
 void data_stack_deinit(void);
 
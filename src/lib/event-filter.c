@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "array.h"
 #include "llist.h"
+#include "hash.h"
 #include "str.h"
 #include "strescape.h"
 #include "wildcard-match.h"
@@ -62,6 +63,24 @@ struct event_filter_query_internal {
 	void *context;
 };
 
+/* Each query is indexed by its most selective exact match requirement. An
+   event needs to check only the queries found via its own name, source
+   filename, categories and field keys plus the queries that couldn't be
+   indexed at all. */
+enum event_filter_index_type {
+	EVENT_FILTER_INDEX_NAME,
+	EVENT_FILTER_INDEX_SOURCE,
+	EVENT_FILTER_INDEX_CATEGORY,
+	EVENT_FILTER_INDEX_FIELD,
+
+	EVENT_FILTER_INDEX_COUNT
+};
+
+struct event_filter_index_entry {
+	/* indexes to event_filter.queries */
+	ARRAY_TYPE(uint) queries;
+};
+
 struct event_filter {
 	struct event_filter *prev, *next;
 
@@ -69,11 +88,33 @@ struct event_filter {
 	int refcount;
 	ARRAY(struct event_filter_query_internal) queries;
 
+	/* Built by event_filter_compile() on the first match after the
+	   queries have changed. */
+	pool_t index_pool;
+	HASH_TABLE(const char *, struct event_filter_index_entry *)
+		indexes[EVENT_FILTER_INDEX_COUNT];
+	ARRAY_TYPE(uint) unindexed_queries;
+	/* Log types that at least one query wants */
+	enum event_filter_log_type log_type_mask;
+
 	bool named_queries_only;
+	bool compiled;
 };
 
 static struct event_filter *event_filters = NULL;
 
+static void event_filter_index_free(struct event_filter *filter)
+{
+	unsigned int i;
+
+	if (!filter->compiled)
+		return;
+	for (i = 0; i < EVENT_FILTER_INDEX_COUNT; i++)
+		hash_table_destroy(&filter->indexes[i]);
+	pool_unref(&filter->index_pool);
+	filter->compiled = FALSE;
+}
+
 struct event_filter *event_filter_create(void)
 {
 	struct event_filter *filter;
@@ -107,6 +148,7 @@ void event_filter_unref(struct event_filter **_filter)
 		return;
 
 	DLLIST_REMOVE(&event_filters, filter);
+	event_filter_index_free(filter);
 	pool_unref(&filter->pool);
 }
 
@@ -187,6 +229,7 @@ void event_filter_add(struct event_filter *filter,
 {
 	struct event_filter_query_internal *int_query;
 
+	event_filter_index_free(filter);
 	int_query = array_append_space(&filter->queries);
 	int_query->context = query->context;
 
@@ -515,6 +558,143 @@ event_filter_query_match(const struct event_filter_query_internal *query,
 	return TRUE;
 }
 
+static bool wildcard_is_exact(const char *mask)
+{
+	return strpbrk(mask, "*?") == NULL;
+}
+
+static void
+event_filter_index_add(struct event_filter *filter,
+		       enum event_filter_index_type type, const char *key,
+		       unsigned int query_idx)
+{
+	struct event_filter_index_entry *entry;
+
+	entry = hash_table_lookup(filter->indexes[type], key);
+	if (entry == NULL) {
+		entry = p_new(filter->index_pool,
+			      struct event_filter_index_entry, 1);
+		p_array_init(&entry->queries, filter->index_pool, 4);
+		hash_table_insert(filter->indexes[type], key, entry);
+	}
+	array_push_back(&entry->queries, &query_idx);
+}
+
+static void event_filter_compile(struct event_filter *filter)
+{
+	const struct event_filter_query_internal *queries;
+	unsigned int i, count;
+
+	i_assert(!filter->compiled);
+
+	filter->index_pool = pool_alloconly_create("event filter index", 1024);
+	for (i = 0; i < EVENT_FILTER_INDEX_COUNT; i++) {
+		hash_table_create(&filter->indexes[i], filter->index_pool, 0,
+				  str_hash, strcmp);
+	}
+	p_array_init(&filter->unindexed_queries, filter->index_pool, 4);
+	filter->log_type_mask = 0;
+
+	queries = array_get(&filter->queries, &count);
+	for (i = 0; i < count; i++) {
+		const struct event_filter_query_internal *query = &queries[i];
+
+		filter->log_type_mask |= query->log_type_mask;
+		if (query->name != NULL && wildcard_is_exact(query->name)) {
+			event_filter_index_add(filter, EVENT_FILTER_INDEX_NAME,
+					       query->name, i);
+		} else if (query->source_filename != NULL) {
+			event_filter_index_add(filter, EVENT_FILTER_INDEX_SOURCE,
+					       query->source_filename, i);
+		} else if (query->categories_count > 0) {
+			event_filter_index_add(filter, EVENT_FILTER_INDEX_CATEGORY,
+					       query->categories[0].name, i);
+		} else if (query->fields_count > 0) {
+			event_filter_index_add(filter, EVENT_FILTER_INDEX_FIELD,
+					       query->fields[0].key, i);
+		} else {
+			array_push_back(&filter->unindexed_queries, &i);
+		}
+	}
+	filter->compiled = TRUE;
+}
+
+static bool
+event_filter_index_lookup(struct event_filter *filter,
+			  enum event_filter_index_type type, const char *key,
+			  unsigned char *candidates)
+{
+	struct event_filter_index_entry *entry;
+	const unsigned int *idxp;
+
+	entry = hash_table_lookup(filter->indexes[type], key);
+	if (entry == NULL)
+		return FALSE;
+	array_foreach(&entry->queries, idxp)
+		candidates[*idxp / 8] |= 1 << (*idxp % 8);
+	return TRUE;
+}
+
+static bool
+event_filter_find_candidates(struct event_filter *filter, struct event *event,
+			     const char *source_filename,
+			     const struct failure_context *ctx,
+			     unsigned char *candidates)
+{
+	struct event_category *const *catp;
+	const struct event_category *cat;
+	const struct event_field *fields;
+	const unsigned int *idxp;
+	unsigned int i, fields_count;
+	struct event *e;
+	bool found = FALSE;
+
+	i_assert(ctx->type < N_ELEMENTS(event_filter_log_types));
+	if ((filter->log_type_mask & event_filter_log_types[ctx->type]) == 0)
+		return FALSE;
+
+	array_foreach(&filter->unindexed_queries, idxp) {
+		candidates[*idxp / 8] |= 1 << (*idxp % 8);
+		found = TRUE;
+	}
+	if (event->sending_name != NULL &&
+	    event_filter_index_lookup(filter, EVENT_FILTER_INDEX_NAME,
+				      event->sending_name, candidates))
+		found = TRUE;
+	if (source_filename != NULL && event->source_filename != NULL &&
+	    hash_table_count(filter->indexes[EVENT_FILTER_INDEX_SOURCE]) > 0 &&
+	    event_filter_index_lookup(filter, EVENT_FILTER_INDEX_SOURCE,
+				      event->source_filename, candidates))
+		found = TRUE;
+
+	if (hash_table_count(filter->indexes[EVENT_FILTER_INDEX_CATEGORY]) > 0) {
+		for (e = event; e != NULL; e = event_get_parent(e)) {
+			if (!array_is_created(&e->categories))
+				continue;
+			array_foreach(&e->categories, catp) {
+				for (cat = *catp; cat != NULL; cat = cat->parent) {
+					if (event_filter_index_lookup(filter,
+						EVENT_FILTER_INDEX_CATEGORY,
+						cat->name, candidates))
+						found = TRUE;
+				}
+			}
+		}
+	}
+	if (hash_table_count(filter->indexes[EVENT_FILTER_INDEX_FIELD]) > 0) {
+		for (e = event; e != NULL; e = event_get_parent(e)) {
+			fields = event_get_fields(e, &fields_count);
+			for (i = 0; i < fields_count; i++) {
+				if (event_filter_index_lookup(filter,
+						EVENT_FILTER_INDEX_FIELD,
+						fields[i].key, candidates))
+					found = TRUE;
+			}
+		}
+	}
+	return found;
+}
+
 static bool
 event_filter_match_fastpath(struct event_filter *filter, struct event *event)
 {
@@ -524,6 +704,8 @@ event_filter_match_fastpath(struct event_filter *filter, struct event *event)
 		   to check any further. */
 		return FALSE;
 	}
+	if (!filter->compiled)
+		event_filter_compile(filter);
 	return TRUE;
 }
 
@@ -539,23 +721,40 @@ bool event_filter_match_source(struct event_filter *filter, struct event *event,
 			       unsigned int source_linenum,
 			       const struct failure_context *ctx)
 {
-	const struct event_filter_query_internal *query;
+	const struct event_filter_query_internal *queries;
+	unsigned char *candidates;
+	unsigned int i, count;
+	bool ret = FALSE;
 
 	if (!event_filter_match_fastpath(filter, event))
 		return FALSE;
 
-	array_foreach(&filter->queries, query) {
-		if (event_filter_query_match(query, event, source_filename,
-					     source_linenum, ctx))
-			return TRUE;
-	}
-	return FALSE;
+	queries = array_get(&filter->queries, &count);
+	if (count == 0)
+		return FALSE;
+	T_BEGIN {
+		candidates = t_malloc0((count + 7) / 8);
+		if (event_filter_find_candidates(filter, event, source_filename,
+						 ctx, candidates)) {
+			for (i = 0; i < count && !ret; i++) {
+				if ((candidates[i / 8] & (1 << (i % 8))) != 0 &&
+				    event_filter_query_match(&queries[i], event,
+							     source_filename,
+							     source_linenum, ctx))
+					ret = TRUE;
+			}
+		}
+	} T_END;
+	return ret;
 }
 
 struct event_filter_match_iter {
 	struct event_filter *filter;
 	struct event *event;
 	const struct failure_context *failure_ctx;
+	/* bitmap of the queries that may match */
+	unsigned char *candidates;
+	unsigned int candidates_count;
 	unsigned int idx;
 };
 
@@ -569,7 +768,16 @@ event_filter_match_iter_init(struct event_filter *filter, struct event *event,
 	iter->filter = filter;
 	iter->event = event;
 	iter->failure_ctx = ctx;
-	if (!event_filter_match_fastpath(filter, event))
+	if (!event_filter_match_fastpath(filter, event) ||
+	    array_count(&filter->queries) == 0) {
+		iter->idx = UINT_MAX;
+		return iter;
+	}
+
+	iter->candidates_count = array_count(&filter->queries);
+	iter->candidates = i_malloc((iter->candidates_count + 7) / 8);
+	if (!event_filter_find_candidates(filter, event, event->source_filename,
+					  ctx, iter->candidates))
 		iter->idx = UINT_MAX;
 	return iter;
 }
@@ -580,10 +788,17 @@ void *event_filter_match_iter_next(struct event_filter_match_iter *iter)
 	unsigned int count;
 
 	queries = array_get(&iter->filter->queries, &count);
+	/* queries added after the iteration started aren't matched */
+	count = I_MIN(count, iter->candidates_count);
 	while (iter->idx < count) {
 		const struct event_filter_query_internal *query =
 			&queries[iter->idx];
 
+		if ((iter->candidates[iter->idx / 8] &
+		     (1 << (iter->idx % 8))) == 0) {
+			iter->idx++;
+			continue;
+		}
 		iter->idx++;
 		if (query->context != NULL &&
 		    event_filter_query_match(query, iter->event,
@@ -600,6 +815,7 @@ void event_filter_match_iter_deinit(struct event_filter_match_iter **_iter)
 	struct event_filter_match_iter *iter = *_iter;
 
 	*_iter = NULL;
+	i_free(iter->candidates);
 	i_free(iter);
 }
 
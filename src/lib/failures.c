@@ -58,10 +58,16 @@ static char *log_prefix = NULL;
 static char *log_stamp_format = NULL, *log_stamp_format_suffix = NULL;
 static bool failure_ignore_errors = FALSE, log_prefix_sent = FALSE;
 static bool coredump_on_error = FALSE;
+/* Ring buffer of internal log lines that couldn't be written yet */
+static unsigned char *log_buffer = NULL;
+static size_t log_buffer_size = 0, log_buffer_pos = 0, log_buffer_used = 0;
+static unsigned int log_buffer_dropped_count = 0;
 static void log_timestamp_add(const struct failure_context *ctx, string_t *str);
 static void log_prefix_add(const struct failure_context *ctx, string_t *str);
 static void i_failure_send_option(const char *key, const char *value);
-static int internal_send_split(string_t *full_str, size_t prefix_len);
+static int internal_send_split(string_t *full_str, size_t prefix_len,
+			       bool buffered);
+static int log_buffer_flush(bool wait);
 
 static string_t * ATTR_FORMAT(3, 0) default_format(const struct failure_context *ctx,
 						   size_t *prefix_len_r ATTR_UNUSED,
@@ -206,14 +212,140 @@ static string_t * ATTR_FORMAT(3, 0) internal_format(const struct failure_context
 	return str;
 }
 
-static int internal_write(enum log_type type ATTR_UNUSED, string_t *data, size_t prefix_len)
+static bool log_buffer_append(const void *data, size_t len)
 {
+	size_t end, n;
+
+	if (log_buffer_size - log_buffer_used < len)
+		return FALSE;
+	end = (log_buffer_pos + log_buffer_used) % log_buffer_size;
+	n = I_MIN(len, log_buffer_size - end);
+	memcpy(log_buffer + end, data, n);
+	memcpy(log_buffer, CONST_PTR_OFFSET(data, n), len - n);
+	log_buffer_used += len;
+	return TRUE;
+}
+
+static bool log_buffer_append_dropped(void)
+{
+	char str[128];
+
+	if (i_snprintf(str, sizeof(str),
+		       "\001%c%s Dropped %u log messages: log buffer was full\n",
+		       LOG_TYPE_WARNING+1, my_pid, log_buffer_dropped_count) < 0)
+		i_unreached();
+	if (!log_buffer_append(str, strlen(str)))
+		return FALSE;
+	log_buffer_dropped_count = 0;
+	return TRUE;
+}
+
+static void log_buffer_append_line(const unsigned char *data, size_t len)
+{
+	if (log_buffer_dropped_count > 0 && !log_buffer_append_dropped())
+		log_buffer_dropped_count++;
+	else if (!log_buffer_append(data, len))
+		log_buffer_dropped_count++;
+}
+
+static void log_buffer_consume(size_t len)
+{
+	i_assert(len <= log_buffer_used);
+
+	log_buffer_pos = (log_buffer_pos + len) % log_buffer_size;
+	log_buffer_used -= len;
+	if (log_buffer_used == 0)
+		log_buffer_pos = 0;
+}
+
+static size_t log_buffer_get_batch(unsigned char batch[STATIC_ARRAY PIPE_BUF])
+{
+	size_t len, n;
+
+	len = I_MIN(log_buffer_used, PIPE_BUF);
+	n = I_MIN(len, log_buffer_size - log_buffer_pos);
+	memcpy(batch, log_buffer + log_buffer_pos, n);
+	memcpy(batch + n, log_buffer, len - n);
+
+	/* write only full lines, so a single write() stays atomic and
+	   doesn't get mixed with other processes' log lines */
+	for (n = len; n > 0; n--) {
+		if (batch[n-1] == '\n')
+			return n;
+	}
+	return len;
+}
+
+static bool log_fd_is_writable(int fd)
+{
+	struct pollfd pfd = {
+		.fd = fd,
+		.events = POLLOUT,
+	};
+
+	/* errors are reported as being writable, so write() returns them */
+	return poll(&pfd, 1, 0) > 0;
+}
+
+static int log_buffer_flush(bool wait)
+{
+	unsigned char batch[PIPE_BUF];
+	size_t len;
+	ssize_t ret;
+
+	for (;;) {
+		if (log_buffer_used == 0) {
+			if (log_buffer_dropped_count == 0 ||
+			    !log_buffer_append_dropped())
+				break;
+		}
+		len = log_buffer_get_batch(batch);
+		if (wait) {
+			if (log_fd_write(STDERR_FILENO, batch, len) < 0)
+				return -1;
+			ret = len;
+		} else {
+			if (!log_fd_is_writable(STDERR_FILENO))
+				return 0;
+			ret = write(STDERR_FILENO, batch, len);
+			if (ret < 0 && (errno == EAGAIN || errno == EINTR))
+				return 0;
+			if (ret == 0)
+				errno = ENOSPC;
+			if (ret <= 0)
+				return -1;
+		}
+		log_buffer_consume(ret);
+	}
+	return 0;
+}
+
+static int internal_write(enum log_type type, string_t *data, size_t prefix_len)
+{
+	if (log_buffer_size > 0) {
+		if (type == LOG_TYPE_DEBUG || type == LOG_TYPE_INFO) {
+			if (str_len(data)+1 <= PIPE_BUF) {
+				str_append_c(data, '\n');
+				log_buffer_append_line(str_data(data),
+						       str_len(data));
+			} else {
+				(void)internal_send_split(data, prefix_len,
+							  TRUE);
+			}
+			return log_buffer_flush(FALSE);
+		}
+		/* write the more important messages synchronously, but
+		   keep them ordered after the buffered ones */
+		if (log_buffer_flush(TRUE) < 0)
+			return -1;
+	}
+
 	if (str_len(data)+1 <= PIPE_BUF) {
 		str_append_c(data, '\n');
 		return log_fd_write(STDERR_FILENO,
 				    str_data(data), str_len(data));
 	}
-	return internal_send_split(data, prefix_len);
+	return internal_send_split(data, prefix_len, FALSE);
 }
 
 static void internal_on_handler_failure(const struct failure_context *ctx ATTR_UNUSED)
@@ -309,6 +441,7 @@ void failure_exit(int status)
 		recursed = TRUE;
 		failure_exit_callback(&status);
 	}
+	(void)log_buffer_flush(TRUE);
 	exit(status);
 }
 
@@ -726,6 +859,12 @@ static void i_failure_send_option(const char *key, const char *value)
 
 	str = t_strdup_printf("\001%c%s %s=%s\n", LOG_TYPE_OPTION+1,
 			      my_pid, key, value);
+	if (log_buffer_used > 0 && log_buffer_append(str, strlen(str))) {
+		/* the option must not affect the already buffered lines */
+		(void)log_buffer_flush(FALSE);
+		return;
+	}
+	(void)log_buffer_flush(TRUE);
 	(void)write_full(STDERR_FILENO, str, strlen(str));
 }
 
@@ -753,7 +892,8 @@ const char *i_get_failure_prefix(void)
 	return log_prefix != NULL ? log_prefix : "";
 }
 
-static int internal_send_split(string_t *full_str, size_t prefix_len)
+static int internal_send_split(string_t *full_str, size_t prefix_len,
+			       bool buffered)
 {
 	string_t *str;
 	size_t max_text_len, pos = prefix_len;
@@ -766,8 +906,10 @@ static int internal_send_split(string_t *full_str, size_t prefix_len)
 		str_truncate(str, prefix_len);
 		str_append_max(str, str_c(full_str) + pos, max_text_len);
 		str_append_c(str, '\n');
-		if (log_fd_write(STDERR_FILENO,
-				 str_data(str), str_len(str)) < 0)
+		if (buffered)
+			log_buffer_append_line(str_data(str), str_len(str));
+		else if (log_fd_write(STDERR_FILENO,
+				      str_data(str), str_len(str)) < 0)
 			return -1;
 		pos += max_text_len;
 	}
@@ -868,6 +1010,38 @@ void i_set_failure_internal(void)
 	i_set_debug_handler(i_internal_error_handler);
 }
 
+void i_set_failure_buffer_size(size_t max_size)
+{
+	i_assert(max_size == 0 || max_size >= PIPE_BUF);
+
+	(void)log_buffer_flush(TRUE);
+	i_free_and_null(log_buffer);
+	log_buffer_size = max_size;
+	log_buffer_pos = log_buffer_used = 0;
+	log_buffer_dropped_count = 0;
+	if (max_size > 0)
+		log_buffer = i_malloc(max_size);
+}
+
+bool i_failure_flush_buffer(void)
+{
+	if (log_buffer_used == 0 && log_buffer_dropped_count == 0)
+		return FALSE;
+	if (log_buffer_flush(FALSE) < 0) {
+		/* the next synchronously written message fails the same
+		   way and handles the error */
+		log_buffer_pos = log_buffer_used = 0;
+		return FALSE;
+	}
+	return log_buffer_used > 0;
+}
+
+void i_failure_discard_buffer(void)
+{
+	log_buffer_pos = log_buffer_used = 0;
+	log_buffer_dropped_count = 0;
+}
+
 bool i_failure_handler_is_internal(failure_callback_t *const callback)
 {
 	return callback == i_internal_fatal_handler ||
@@ -934,6 +1108,8 @@ void i_set_failure_exit_callback(void (*callback)(int *status))
 
 void failures_deinit(void)
 {
+	i_set_failure_buffer_size(0);
+
 	if (log_debug_fd == log_info_fd || log_debug_fd == log_fd)
 		log_debug_fd = STDERR_FILENO;
 
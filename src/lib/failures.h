@@ -110,6 +110,21 @@ void i_set_failure_file(const char *path, const char *prefix);
 
 /* Send errors to stderr using internal error protocol. */
 void i_set_failure_internal(void);
+/* With the internal error protocol, buffer up to max_size bytes of debug
+   and info messages that can't be written to the log pipe without
+   blocking. They're written in batches once the pipe is writable again.
+   Messages that don't fit are dropped and the number of dropped messages
+   is logged afterwards. Warnings and errors are still written
+   synchronously after the buffered messages. 0 disables the buffering,
+   otherwise max_size must be at least PIPE_BUF. */
+void i_set_failure_buffer_size(size_t max_size);
+/* Write buffered log messages as far as it can be done without blocking.
+   Returns TRUE if some messages are still buffered. */
+bool i_failure_flush_buffer(void);
+/* Call in a child process after fork() to drop the log messages buffered by
+   the parent process. The parent still writes them, so otherwise they could
+   be logged twice. */
+void i_failure_discard_buffer(void);
 /* Returns TRUE if the given callback handler was set via
    i_set_failure_internal(). */
 bool i_failure_handler_is_internal(failure_callback_t *const callback);
@@ -29,6 +29,9 @@ static uint64_t file_lock_wait_usecs = 0;
 static long long file_lock_slow_warning_usecs = -1;
 
 static void file_lock_log_warning_if_slow(struct file_lock *lock);
+static void file_lock_wait_end_method(const char *lock_name,
+				      enum file_lock_method lock_method,
+				      int lock_type);
 
 bool file_lock_method_parse(const char *name, enum file_lock_method *method_r)
 {
@@ -202,7 +205,7 @@ static int file_lock_do(int fd, const char *path, int lock_type,
 		ret = fcntl(fd, timeout_secs != 0 ? F_SETLKW : F_SETLK, &fl);
 		if (timeout_secs != 0) {
 			alarm(0);
-			file_lock_wait_end(path);
+			file_lock_wait_end_method(path, lock_method, lock_type);
 		}
 
 		if (ret == 0)
@@ -256,7 +259,7 @@ static int file_lock_do(int fd, const char *path, int lock_type,
 		ret = flock(fd, operation);
 		if (timeout_secs != 0) {
 			alarm(0);
-			file_lock_wait_end(path);
+			file_lock_wait_end_method(path, lock_method, lock_type);
 		}
 
 		if (ret == 0)
@@ -429,6 +432,45 @@ static void file_try_unlink_locked(struct file_lock *lock)
 	file_lock_free(&temp_lock);
 }
 
+static const char *file_lock_type_to_str(int lock_type)
+{
+	return lock_type == F_UNLCK ? "unlock" :
+		(lock_type == F_RDLCK ? "read" : "write");
+}
+
+static struct event *
+file_lock_event_create(const char *name, const char *path,
+		       enum file_lock_method lock_method, int lock_type)
+{
+	struct event *event = event_create(NULL);
+	const char *p = strrchr(path, '/');
+
+	/* lock_file is the path's basename (e.g. dovecot.index.log), so
+	   stats can group the same kind of locks from all mailboxes. */
+	event_set_name(event, name);
+	event_add_str(event, "lock_path", path);
+	event_add_str(event, "lock_file", p == NULL ? path : p + 1);
+	event_add_str(event, "lock_method", file_lock_method_to_str(lock_method));
+	event_add_str(event, "lock_type", file_lock_type_to_str(lock_type));
+	return event;
+}
+
+static void file_lock_send_released_event(struct file_lock *lock)
+{
+	struct event *event;
+	struct timeval now;
+
+	if (gettimeofday(&now, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	long long diff = timeval_diff_usecs(&now, &lock->locked_time);
+
+	event = file_lock_event_create("file_lock_released", lock->path,
+				       lock->lock_method, lock->lock_type);
+	event_add_int(event, "hold_usecs", diff);
+	e_debug(event, "Lock %s released after %lld usecs", lock->path, diff);
+	event_unref(&event);
+}
+
 void file_lock_free(struct file_lock **_lock)
 {
 	struct file_lock *lock = *_lock;
@@ -446,6 +488,7 @@ void file_lock_free(struct file_lock **_lock)
 		i_close_fd(&lock->fd);
 
 	file_lock_log_warning_if_slow(lock);
+	file_lock_send_released_event(lock);
 	i_free(lock->path);
 	i_free(lock);
 }
@@ -515,8 +558,11 @@ static void file_lock_log_warning_if_slow(struct file_lock *lock)
 	}
 }
 
-void file_lock_wait_end(const char *lock_name)
+static void file_lock_wait_end_method(const char *lock_name,
+				      enum file_lock_method lock_method,
+				      int lock_type)
 {
+	struct event *event;
 	struct timeval now;
 
 	i_assert(lock_wait_start.tv_sec != 0);
@@ -535,6 +581,17 @@ void file_lock_wait_end(const char *lock_name)
 	}
 	file_lock_wait_usecs += diff;
 	lock_wait_start.tv_sec = 0;
+
+	event = file_lock_event_create("file_lock_wait_finished", lock_name,
+				       lock_method, lock_type);
+	event_add_int(event, "wait_usecs", diff);
+	e_debug(event, "Waited %lld usecs for lock %s", diff, lock_name);
+	event_unref(&event);
+}
+
+void file_lock_wait_end(const char *lock_name)
+{
+	file_lock_wait_end_method(lock_name, FILE_LOCK_METHOD_DOTLOCK, F_WRLCK);
 }
 
 uint64_t file_lock_wait_get_total_usecs(void)
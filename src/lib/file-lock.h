@@ -74,7 +74,9 @@ void file_lock_set_path(struct file_lock *lock, const char *path);
 const char *file_lock_find(int lock_fd, enum file_lock_method lock_method,
 			   int lock_type);
 
-/* Track the duration of a lock wait. */
+/* Track the duration of a dotlock wait. A file_lock_wait_finished event is
+   sent with the wait time. (Freeing a struct file_lock similarly sends a
+   file_lock_released event with the lock's hold time.) */
 void file_lock_wait_start(void);
 void file_lock_wait_end(const char *lock_name);
 /* Return how many microseconds has been spent on lock waiting. */
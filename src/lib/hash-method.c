@@ -6,6 +6,7 @@
 #include "sha1.h"
 #include "sha2.h"
 #include "sha3.h"
+#include "xxhash.h"
 #include "hash-method.h"
 
 const struct hash_method *hash_method_lookup(const char *name)
@@ -81,6 +82,7 @@ const struct hash_method *hash_methods[] = {
 	&hash_method_sha512,
 	&hash_method_sha3_256,
 	&hash_method_sha3_512,
+	&hash_method_xxh64,
 	&hash_method_size,
 	NULL
 };
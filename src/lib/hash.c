@@ -10,8 +10,94 @@
 
 #define HASH_TABLE_MIN_SIZE 67
 
+/* Open addressing tables keep a control byte for each slot. Free slots are
+   EMPTY or DELETED (both have the high bit set), used slots contain the
+   lowest 7 bits of the hash. The control bytes are probed a group at a
+   time, using SIMD comparisons when the compiler targets SSE2 or NEON. */
+#define HASH_OPEN_GROUP_SIZE 16
+#define HASH_OPEN_MIN_SIZE HASH_OPEN_GROUP_SIZE
+#define HASH_OPEN_CTRL_EMPTY 0x80
+#define HASH_OPEN_CTRL_DELETED 0xfe
+#define HASH_OPEN_CTRL_IS_FULL(c) (((c) & 0x80) == 0)
+/* Maximum number of used + deleted slots before the table is grown. */
+#define HASH_OPEN_MAX_LOAD(size) ((size) - (size) / 8)
+
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#  define HASH_OPEN_BITS_PER_SLOT 1
+static inline uint64_t hash_open_group_match(const uint8_t *ctrl, uint8_t c)
+{
+	__m128i group = _mm_loadu_si128((const void *)ctrl);
+
+	return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group,
+							  _mm_set1_epi8(c)));
+}
+static inline uint64_t hash_open_group_match_free(const uint8_t *ctrl)
+{
+	return (uint32_t)_mm_movemask_epi8(
+		_mm_loadu_si128((const void *)ctrl));
+}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#  include <arm_neon.h>
+#  define HASH_OPEN_BITS_PER_SLOT 4
+/* narrowing shift gives 4 bits per byte, keep only the lowest of them */
+#  define HASH_OPEN_NEON_MASK(v) \
+	(vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16( \
+		vreinterpretq_u16_u8(v), 4)), 0) & 0x1111111111111111ULL)
+static inline uint64_t hash_open_group_match(const uint8_t *ctrl, uint8_t c)
+{
+	return HASH_OPEN_NEON_MASK(vceqq_u8(vld1q_u8(ctrl), vdupq_n_u8(c)));
+}
+static inline uint64_t hash_open_group_match_free(const uint8_t *ctrl)
+{
+	return HASH_OPEN_NEON_MASK(vtstq_u8(vld1q_u8(ctrl),
+					    vdupq_n_u8(0x80)));
+}
+#else
+#  define HASH_OPEN_BITS_PER_SLOT 1
+static inline uint64_t hash_open_group_match(const uint8_t *ctrl, uint8_t c)
+{
+	uint64_t mask = 0;
+	unsigned int i;
+
+	for (i = 0; i < HASH_OPEN_GROUP_SIZE; i++) {
+		if (ctrl[i] == c)
+			mask |= 1U << i;
+	}
+	return mask;
+}
+static inline uint64_t hash_open_group_match_free(const uint8_t *ctrl)
+{
+	uint64_t mask = 0;
+	unsigned int i;
+
+	for (i = 0; i < HASH_OPEN_GROUP_SIZE; i++) {
+		if (!HASH_OPEN_CTRL_IS_FULL(ctrl[i]))
+			mask |= 1U << i;
+	}
+	return mask;
+}
+#endif
+
+#if __GNUC__ > 3 || (__GNUC__ == 3 && __GNUC_MINOR__ >= 4)
+#  define hash_open_mask_first(mask) \
+	((unsigned int)__builtin_ctzll(mask) / HASH_OPEN_BITS_PER_SLOT)
+#else
+static unsigned int hash_open_mask_first(uint64_t mask)
+{
+	unsigned int n = 0;
+
+	i_assert(mask != 0);
+	for (; (mask & 1) == 0; mask >>= 1)
+		n++;
+	return n / HASH_OPEN_BITS_PER_SLOT;
+}
+#endif
+
 #undef hash_table_create
 #undef hash_table_create_direct
+#undef hash_table_create_open
+#undef hash_table_create_direct_open
 #undef hash_table_destroy
 #undef hash_table_clear
 #undef hash_table_lookup
@@ -32,6 +118,11 @@ struct hash_node {
 	void *value;
 };
 
+struct hash_slot {
+	void *key;
+	void *value;
+};
+
 struct hash_table {
 	pool_t node_pool;
 
@@ -42,6 +133,12 @@ struct hash_table {
 	struct hash_node *nodes;
 	struct hash_node *free_nodes;
 
+	/* open addressing: size is a power of two, removed_count is the
+	   number of DELETED slots and nodes/free_nodes aren't used */
+	bool open_addressing;
+	uint8_t *ctrl;
+	struct hash_slot *slots;
+
 	hash_callback_t *hash_cb;
 	hash_cmp_callback_t *key_compare_cb;
 };
@@ -52,6 +149,9 @@ struct hash_iterate_context {
 	unsigned int pos;
 };
 
+static unsigned int hash_open_capacity(unsigned int count);
+static void hash_open_resize(struct hash_table *table, unsigned int size);
+
 enum hash_table_operation{
 	HASH_TABLE_OP_INSERT,
 	HASH_TABLE_OP_UPDATE,
@@ -129,6 +229,29 @@ static void hash_table_destroy_nodes(struct hash_table *table)
 	}
 }
 
+void hash_table_create_open(struct hash_table **table_r,
+			    unsigned int initial_size,
+			    hash_callback_t *hash_cb,
+			    hash_cmp_callback_t *key_compare_cb)
+{
+	struct hash_table *table;
+
+	table = i_new(struct hash_table, 1);
+	table->open_addressing = TRUE;
+	table->initial_size = hash_open_capacity(initial_size);
+	table->hash_cb = hash_cb;
+	table->key_compare_cb = key_compare_cb;
+
+	hash_open_resize(table, table->initial_size);
+	*table_r = table;
+}
+
+void hash_table_create_direct_open(struct hash_table **table_r,
+				   unsigned int initial_size)
+{
+	hash_table_create_open(table_r, initial_size, direct_hash, direct_cmp);
+}
+
 void hash_table_destroy(struct hash_table **_table)
 {
 	struct hash_table *table = *_table;
@@ -139,6 +262,13 @@ void hash_table_destroy(struct hash_table **_table)
 
 	i_assert(table->frozen == 0);
 
+	if (table->open_addressing) {
+		i_free(table->ctrl);
+		i_free(table->slots);
+		i_free(table);
+		return;
+	}
+
 	if (!table->node_pool->alloconly_pool) {
 		hash_table_destroy_nodes(table);
 		destroy_node_list(table, table->free_nodes);
@@ -153,6 +283,13 @@ void hash_table_clear(struct hash_table *table, bool free_nodes)
 {
 	i_assert(table->frozen == 0);
 
+	if (table->open_addressing) {
+		memset(table->ctrl, HASH_OPEN_CTRL_EMPTY, table->size);
+		table->nodes_count = 0;
+		table->removed_count = 0;
+		return;
+	}
+
 	if (!table->node_pool->alloconly_pool)
 		hash_table_destroy_nodes(table);
 
@@ -168,6 +305,215 @@ void hash_table_clear(struct hash_table *table, bool free_nodes)
 	table->removed_count = 0;
 }
 
+static unsigned int hash_open_capacity(unsigned int count)
+{
+	unsigned int size = HASH_OPEN_MIN_SIZE;
+
+	while (HASH_OPEN_MAX_LOAD(size) < count) {
+		i_assert(size < (1U << 31));
+		size <<= 1;
+	}
+	return size;
+}
+
+static inline unsigned int hash_open_hash(const struct hash_table *table,
+					  const void *key)
+{
+	unsigned int hash = table->hash_cb(key);
+
+	/* The hash callbacks (e.g. str_hash() and direct hashing) don't
+	   spread their bits evenly, but the group and the control byte are
+	   taken from different bits. Mix them with the murmur3 finalizer. */
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bU;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35U;
+	hash ^= hash >> 16;
+	return hash;
+}
+
+#define HASH_OPEN_HASH_CTRL(hash) ((uint8_t)((hash) & 0x7f))
+#define HASH_OPEN_HASH_GROUP(table, hash) \
+	(((hash) >> 7) & ((table)->size / HASH_OPEN_GROUP_SIZE - 1))
+
+static struct hash_slot *
+hash_open_lookup_slot(const struct hash_table *table, const void *key,
+		      unsigned int hash)
+{
+	unsigned int group_mask = table->size / HASH_OPEN_GROUP_SIZE - 1;
+	unsigned int group = HASH_OPEN_HASH_GROUP(table, hash);
+	uint8_t ctrl_hash = HASH_OPEN_HASH_CTRL(hash);
+	const uint8_t *ctrl;
+	unsigned int probe, idx;
+	uint64_t mask;
+
+	/* triangular probing visits each group exactly once */
+	for (probe = 1; probe <= group_mask + 1; probe++) {
+		ctrl = &table->ctrl[group * HASH_OPEN_GROUP_SIZE];
+		mask = hash_open_group_match(ctrl, ctrl_hash);
+		for (; mask != 0; mask &= mask - 1) {
+			idx = group * HASH_OPEN_GROUP_SIZE +
+				hash_open_mask_first(mask);
+			if (table->key_compare_cb(table->slots[idx].key,
+						  key) == 0)
+				return &table->slots[idx];
+		}
+		if (hash_open_group_match(ctrl, HASH_OPEN_CTRL_EMPTY) != 0)
+			break;
+		group = (group + probe) & group_mask;
+	}
+	return NULL;
+}
+
+static unsigned int
+hash_open_find_free(const struct hash_table *table, unsigned int hash)
+{
+	unsigned int group_mask = table->size / HASH_OPEN_GROUP_SIZE - 1;
+	unsigned int group = HASH_OPEN_HASH_GROUP(table, hash);
+	unsigned int probe;
+	uint64_t mask;
+
+	for (probe = 1; probe <= group_mask + 1; probe++) {
+		mask = hash_open_group_match_free(
+			&table->ctrl[group * HASH_OPEN_GROUP_SIZE]);
+		if (mask != 0) {
+			return group * HASH_OPEN_GROUP_SIZE +
+				hash_open_mask_first(mask);
+		}
+		group = (group + probe) & group_mask;
+	}
+	i_panic("hash table is full (%u nodes) while frozen",
+		table->nodes_count);
+}
+
+static void hash_open_resize(struct hash_table *table, unsigned int size)
+{
+	uint8_t *old_ctrl = table->ctrl;
+	struct hash_slot *old_slots = table->slots;
+	unsigned int i, idx, hash, old_size = table->size;
+
+	i_assert(table->frozen == 0);
+	i_assert(size >= HASH_OPEN_MIN_SIZE);
+	i_assert(HASH_OPEN_MAX_LOAD(size) >= table->nodes_count);
+
+	table->size = size;
+	table->ctrl = i_malloc(size);
+	memset(table->ctrl, HASH_OPEN_CTRL_EMPTY, size);
+	table->slots = i_new(struct hash_slot, size);
+	table->removed_count = 0;
+
+	for (i = 0; i < old_size; i++) {
+		if (!HASH_OPEN_CTRL_IS_FULL(old_ctrl[i]))
+			continue;
+		hash = hash_open_hash(table, old_slots[i].key);
+		idx = hash_open_find_free(table, hash);
+		table->ctrl[idx] = HASH_OPEN_HASH_CTRL(hash);
+		table->slots[idx] = old_slots[i];
+	}
+	i_free(old_ctrl);
+	i_free(old_slots);
+}
+
+static void hash_open_grow(struct hash_table *table)
+{
+	unsigned int max_load = HASH_OPEN_MAX_LOAD(table->size);
+
+	/* If a large part of the used slots are DELETED, rehashing them
+	   away gives enough room. Otherwise double the size. */
+	if (table->removed_count >= max_load / 4) {
+		hash_open_resize(table, I_MIN(table->size,
+			I_MAX(table->initial_size,
+			      hash_open_capacity(table->nodes_count * 2))));
+	} else {
+		hash_open_resize(table, table->size * 2);
+	}
+}
+
+static void
+hash_open_insert(struct hash_table *table, void *key, void *value,
+		 enum hash_table_operation opcode)
+{
+	struct hash_slot *slot;
+	unsigned int hash, idx;
+
+	i_assert(key != NULL);
+
+	hash = hash_open_hash(table, key);
+	slot = hash_open_lookup_slot(table, key, hash);
+	if (slot != NULL) {
+		i_assert(opcode == HASH_TABLE_OP_UPDATE);
+		slot->value = value;
+		return;
+	}
+
+	idx = hash_open_find_free(table, hash);
+	if (table->ctrl[idx] == HASH_OPEN_CTRL_EMPTY) {
+		/* frozen tables are allowed to go over the maximum load */
+		if (table->frozen == 0 &&
+		    table->nodes_count + table->removed_count >=
+		    HASH_OPEN_MAX_LOAD(table->size)) {
+			hash_open_grow(table);
+			idx = hash_open_find_free(table, hash);
+		}
+	} else {
+		i_assert(table->ctrl[idx] == HASH_OPEN_CTRL_DELETED);
+		table->removed_count--;
+	}
+	table->ctrl[idx] = HASH_OPEN_HASH_CTRL(hash);
+	table->slots[idx].key = key;
+	table->slots[idx].value = value;
+	table->nodes_count++;
+}
+
+static bool hash_open_try_remove(struct hash_table *table, const void *key)
+{
+	struct hash_slot *slot;
+	unsigned int idx, group_start;
+
+	slot = hash_open_lookup_slot(table, key, hash_open_hash(table, key));
+	if (unlikely(slot == NULL))
+		return FALSE;
+
+	idx = slot - table->slots;
+	group_start = idx - idx % HASH_OPEN_GROUP_SIZE;
+	/* Lookups don't continue past a group that has EMPTY slots, so if
+	   there already is one, no other key can depend on this slot. */
+	if (hash_open_group_match(&table->ctrl[group_start],
+				  HASH_OPEN_CTRL_EMPTY) != 0) {
+		table->ctrl[idx] = HASH_OPEN_CTRL_EMPTY;
+	} else {
+		table->ctrl[idx] = HASH_OPEN_CTRL_DELETED;
+		table->removed_count++;
+	}
+	table->nodes_count--;
+
+	if (table->frozen == 0 && table->size > table->initial_size &&
+	    table->nodes_count < HASH_OPEN_MAX_LOAD(table->size) / 8) {
+		hash_open_resize(table, I_MAX(table->initial_size,
+			hash_open_capacity(table->nodes_count * 2)));
+	}
+	return TRUE;
+}
+
+static bool
+hash_open_iterate(struct hash_iterate_context *ctx,
+		  void **key_r, void **value_r)
+{
+	struct hash_table *table = ctx->table;
+
+	/* existing slots are never moved while the table is frozen */
+	for (; ctx->pos < table->size; ctx->pos++) {
+		if (HASH_OPEN_CTRL_IS_FULL(table->ctrl[ctx->pos])) {
+			*key_r = table->slots[ctx->pos].key;
+			*value_r = table->slots[ctx->pos].value;
+			ctx->pos++;
+			return TRUE;
+		}
+	}
+	*key_r = *value_r = NULL;
+	return FALSE;
+}
+
 static struct hash_node *
 hash_table_lookup_node(const struct hash_table *table,
 		       const void *key, unsigned int hash)
@@ -191,6 +537,13 @@ void *hash_table_lookup(const struct hash_table *table, const void *key)
 {
 	struct hash_node *node;
 
+	if (table->open_addressing) {
+		struct hash_slot *slot =
+			hash_open_lookup_slot(table, key,
+					      hash_open_hash(table, key));
+		return slot != NULL ? slot->value : NULL;
+	}
+
 	node = hash_table_lookup_node(table, key, table->hash_cb(key));
 	return node != NULL ? node->value : NULL;
 }
@@ -201,6 +554,17 @@ bool hash_table_lookup_full(const struct hash_table *table,
 {
 	struct hash_node *node;
 
+	if (table->open_addressing) {
+		struct hash_slot *slot =
+			hash_open_lookup_slot(table, lookup_key,
+					      hash_open_hash(table, lookup_key));
+		if (slot == NULL)
+			return FALSE;
+		*orig_key = slot->key;
+		*value = slot->value;
+		return TRUE;
+	}
+
 	node = hash_table_lookup_node(table, lookup_key,
 				      table->hash_cb(lookup_key));
 	if (node == NULL)
@@ -296,12 +660,18 @@ hash_table_insert_node(struct hash_table *table, void *key, void *value,
 
 void hash_table_insert(struct hash_table *table, void *key, void *value)
 {
-	hash_table_insert_node(table, key, value, HASH_TABLE_OP_INSERT);
+	if (table->open_addressing)
+		hash_open_insert(table, key, value, HASH_TABLE_OP_INSERT);
+	else
+		hash_table_insert_node(table, key, value, HASH_TABLE_OP_INSERT);
 }
 
 void hash_table_update(struct hash_table *table, void *key, void *value)
 {
-	hash_table_insert_node(table, key, value, HASH_TABLE_OP_UPDATE);
+	if (table->open_addressing)
+		hash_open_insert(table, key, value, HASH_TABLE_OP_UPDATE);
+	else
+		hash_table_insert_node(table, key, value, HASH_TABLE_OP_UPDATE);
 }
 
 static void
@@ -346,6 +716,9 @@ bool hash_table_try_remove(struct hash_table *table, const void *key)
 	struct hash_node *node;
 	unsigned int hash;
 
+	if (table->open_addressing)
+		return hash_open_try_remove(table, key);
+
 	hash = table->hash_cb(key);
 
 	node = hash_table_lookup_node(table, key, hash);
@@ -375,7 +748,8 @@ struct hash_iterate_context *hash_table_iterate_init(struct hash_table *table)
 
 	ctx = i_new(struct hash_iterate_context, 1);
 	ctx->table = table;
-	ctx->next = &table->nodes[0];
+	if (!table->open_addressing)
+		ctx->next = &table->nodes[0];
 	return ctx;
 }
 
@@ -402,6 +776,9 @@ bool hash_table_iterate(struct hash_iterate_context *ctx,
 {
 	struct hash_node *node;
 
+	if (ctx->table->open_addressing)
+		return hash_open_iterate(ctx, key_r, value_r);
+
 	node = ctx->next;
 	if (node != NULL && node->key == NULL)
 		node = hash_table_iterate_next(ctx, node);
@@ -440,6 +817,13 @@ void hash_table_thaw(struct hash_table *table)
 	if (--table->frozen > 0)
 		return;
 
+	if (table->open_addressing) {
+		if (table->nodes_count + table->removed_count >
+		    HASH_OPEN_MAX_LOAD(table->size))
+			hash_open_grow(table);
+		return;
+	}
+
 	if (table->removed_count > 0) {
 		if (!hash_table_resize(table, FALSE))
 			hash_table_compress_removed(table);
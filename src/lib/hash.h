@@ -61,6 +61,55 @@ void hash_table_create_direct(struct hash_table **table_r, pool_t node_pool,
 	hash_table_create_direct(&(*table)._table, pool, size)
 #endif
 
+/* Create a hash table using open addressing. Keys and values are stored in
+   a flat array instead of separately allocated nodes, so lookups do less
+   pointer chasing and each node uses less memory. Otherwise all the
+   hash_table_*() functions work the same for both kinds of tables, except
+   that a frozen open addressing table can't grow: inserting to it when all
+   of its slots are used assert-crashes. */
+void hash_table_create_open(struct hash_table **table_r,
+			    unsigned int initial_size,
+			    hash_callback_t *hash_cb,
+			    hash_cmp_callback_t *key_compare_cb);
+#if defined (__GNUC__) && !defined(__cplusplus)
+#  define hash_table_create_open(table, size, hash_cb, key_cmp_cb) \
+	({(void)COMPILE_ERROR_IF_TRUE( \
+		sizeof((*table)._key) != sizeof(void *) || \
+		sizeof((*table)._value) != sizeof(void *)); \
+	(void)COMPILE_ERROR_IF_TRUE( \
+		!__builtin_types_compatible_p(typeof(&key_cmp_cb), \
+			int (*)(typeof((*table)._key), typeof((*table)._key))) && \
+		!__builtin_types_compatible_p(typeof(&key_cmp_cb), \
+			int (*)(typeof((*table)._const_key), typeof((*table)._const_key)))); \
+	(void)COMPILE_ERROR_IF_TRUE( \
+		!__builtin_types_compatible_p(typeof(&hash_cb), \
+			unsigned int (*)(typeof((*table)._key))) && \
+		!__builtin_types_compatible_p(typeof(&hash_cb), \
+			unsigned int (*)(typeof((*table)._const_key)))); \
+	hash_table_create_open(&(*table)._table, size, \
+		(hash_callback_t *)hash_cb, \
+		(hash_cmp_callback_t *)key_cmp_cb);})
+#else
+#  define hash_table_create_open(table, size, hash_cb, key_cmp_cb) \
+	hash_table_create_open(&(*table)._table, size, \
+		(hash_callback_t *)hash_cb, \
+		(hash_cmp_callback_t *)key_cmp_cb)
+#endif
+/* Create open addressing hash table where comparisons are done directly
+   with the pointers. */
+void hash_table_create_direct_open(struct hash_table **table_r,
+				   unsigned int initial_size);
+#if defined (__GNUC__) && !defined(__cplusplus)
+#  define hash_table_create_direct_open(table, size) \
+	({(void)COMPILE_ERROR_IF_TRUE( \
+		sizeof((*table)._key) != sizeof(void *) || \
+		sizeof((*table)._value) != sizeof(void *)); \
+	hash_table_create_direct_open(&(*table)._table, size);})
+#else
+#  define hash_table_create_direct_open(table, size) \
+	hash_table_create_direct_open(&(*table)._table, size)
+#endif
+
 #define hash_table_is_created(table) \
 	((table)._table != NULL)
 
@@ -76,21 +76,11 @@ void hash2_clear(struct hash2_table *hash)
 	hash->deleted_values = NULL;
 }
 
-static void hash2_resize(struct hash2_table *hash, bool grow)
+static void hash2_rehash(struct hash2_table *hash, unsigned int next_size)
 {
 	ARRAY_TYPE(hash2_value) old_hash_table;
 	struct hash2_value *const *old_hash, *value, **valuep, *next;
-	unsigned int next_size, old_count, i, idx;
-	float nodes_per_list;
-
-	nodes_per_list = (float)hash->count / (float)hash->hash_table_size;
-	if (nodes_per_list > 0.3 && nodes_per_list < 2.0)
-		return;
-
-	next_size = I_MAX(primes_closest(hash->count + 1), hash->initial_size);
-	if (hash->hash_table_size >= next_size &&
-	    (grow || next_size == hash->hash_table_size))
-		return;
+	unsigned int old_count, i, idx;
 
 	old_hash_table = hash->hash_table;
 	hash2_alloc_table(hash, next_size);
@@ -110,6 +100,30 @@ static void hash2_resize(struct hash2_table *hash, bool grow)
 	array_free(&old_hash_table);
 }
 
+static void hash2_resize(struct hash2_table *hash, bool grow)
+{
+	unsigned int next_size;
+	float nodes_per_list;
+
+	nodes_per_list = (float)hash->count / (float)hash->hash_table_size;
+	if (nodes_per_list > 0.3 && nodes_per_list < 2.0)
+		return;
+
+	next_size = I_MAX(primes_closest(hash->count + 1), hash->initial_size);
+	if (hash->hash_table_size >= next_size &&
+	    (grow || next_size == hash->hash_table_size))
+		return;
+	hash2_rehash(hash, next_size);
+}
+
+void hash2_reserve(struct hash2_table *hash, unsigned int count)
+{
+	unsigned int next_size = primes_closest(count);
+
+	if (next_size > hash->hash_table_size)
+		hash2_rehash(hash, next_size);
+}
+
 void *hash2_lookup(const struct hash2_table *hash, const void *key)
 {
 	unsigned int key_hash = hash->key_hash_cb(key);
@@ -20,6 +20,9 @@ hash2_create(unsigned int initial_size, unsigned int value_size,
 void hash2_destroy(struct hash2_table **hash);
 /* Remove all nodes from hash table. */
 void hash2_clear(struct hash2_table *hash);
+/* Grow the hash table so that count nodes can be inserted without having to
+   resize it. */
+void hash2_reserve(struct hash2_table *hash, unsigned int count);
 
 void *hash2_lookup(const struct hash2_table *hash, const void *key) ATTR_PURE;
 /* Iterate through all nodes with the given hash. iter must initially be
@@ -9,6 +9,30 @@
 #  define IOLOOP_INITIAL_FD_COUNT 128
 #endif
 
+/* Timeouts of at least this many milliseconds are kept in a hierarchical
+   timing wheel, which makes adding and resetting them O(1). They're moved
+   to the timeouts priority queue once their wheel slot is reached, so they
+   still run at their exact time. Shorter timeouts go directly to the
+   priority queue. */
+#define IOLOOP_TIMEOUT_WHEEL_MIN_MSECS 1000
+#define IOLOOP_TIMEOUT_WHEEL_TICK_MSECS 16
+#define IOLOOP_TIMEOUT_WHEEL_LEVEL_BITS 6
+#define IOLOOP_TIMEOUT_WHEEL_LEVEL_SLOTS (1U << IOLOOP_TIMEOUT_WHEEL_LEVEL_BITS)
+#define IOLOOP_TIMEOUT_WHEEL_LEVELS 4
+
+struct timeout_wheel {
+	/* The first tick that hasn't been processed yet */
+	uint64_t cur_tick;
+	/* The earliest tick where something may need to be done, if
+	   next_tick_valid is set. Removals don't update it, so it may be
+	   too early. */
+	uint64_t next_tick;
+	unsigned int count[IOLOOP_TIMEOUT_WHEEL_LEVELS];
+	struct timeout *slots[IOLOOP_TIMEOUT_WHEEL_LEVELS]
+		[IOLOOP_TIMEOUT_WHEEL_LEVEL_SLOTS];
+	bool next_tick_valid;
+};
+
 struct ioloop {
         struct ioloop *prev;
 
@@ -18,6 +42,7 @@ struct ioloop {
 	struct io_file *next_io_file;
 	struct priorityq *timeouts;
 	ARRAY(struct timeout *) timeouts_new;
+	struct timeout_wheel timeout_wheel;
 	struct io_wait_timer *wait_timers;
 
         struct ioloop_handler_context *handler_context;
@@ -80,6 +105,11 @@ struct timeout {
 	struct ioloop *ioloop;
 	struct ioloop_context *ctx;
 
+	/* Linked into a timeout_wheel slot, or NULL if not in the wheel */
+	struct timeout **wheel_slot;
+	struct timeout *wheel_prev, *wheel_next;
+	unsigned int wheel_level;
+
 	bool one_shot:1;
 };
 
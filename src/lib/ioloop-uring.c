@@ -0,0 +1,502 @@
+/* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "ioloop-private.h"
+#include "ioloop-iolist.h"
+
+#ifdef IOLOOP_URING
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/* The submission queue is flushed at the latest when it fills up, so this
+   only limits how many registration changes can be batched together. */
+#define IOLOOP_URING_MIN_ENTRIES 128
+#define IOLOOP_URING_MAX_ENTRIES 4096
+
+/* user_data for our own POLL_REMOVE requests. Poll requests always have
+   non-zero generation, so their user_data can never be 0. */
+#define IOLOOP_URING_USER_DATA_INTERNAL 0
+
+#define IO_URING_ERROR (POLLERR | POLLHUP)
+#define IO_URING_INPUT (POLLIN | POLLPRI | IO_URING_ERROR)
+#define IO_URING_OUTPUT (POLLOUT | IO_URING_ERROR)
+
+struct io_uring_fd {
+	struct io_list *list;
+	/* user_data of the currently armed poll request, 0 if none */
+	uint64_t armed_user_data;
+	/* poll events the armed request is waiting for */
+	unsigned int armed_events;
+	/* incremented whenever the fd may refer to a different file, so that
+	   completions of the old poll request get ignored */
+	uint32_t generation;
+	bool dirty:1;
+};
+
+struct ioloop_handler_context {
+	int ring_fd;
+
+	void *sq_ptr, *cq_ptr;
+	size_t sq_size, cq_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+	unsigned int sq_entries, to_submit;
+
+	unsigned int fd_count;
+	ARRAY(struct io_uring_fd) fds;
+	ARRAY(int) dirty_fds;
+	ARRAY(struct io_uring_cqe) events;
+};
+
+static int
+io_uring_setup_sys(unsigned int entries, struct io_uring_params *params)
+{
+	return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int
+io_uring_enter_sys(int fd, unsigned int to_submit, unsigned int min_complete,
+		   unsigned int flags, const void *arg, size_t argsz)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		       flags, arg, argsz);
+}
+
+static void *
+io_uring_mmap(int ring_fd, size_t size, off_t offset)
+{
+	void *ptr;
+
+	ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		   ring_fd, offset);
+	if (ptr == MAP_FAILED)
+		i_fatal("mmap(io_uring) failed: %m");
+	return ptr;
+}
+
+void io_loop_handler_init(struct ioloop *ioloop, unsigned int initial_fd_count)
+{
+	struct ioloop_handler_context *ctx;
+	struct io_uring_params params;
+	unsigned int entries;
+
+	ioloop->handler_context = ctx = i_new(struct ioloop_handler_context, 1);
+
+	i_array_init(&ctx->fds, initial_fd_count);
+	i_array_init(&ctx->dirty_fds, initial_fd_count);
+	i_array_init(&ctx->events, initial_fd_count);
+
+	entries = nearest_power(I_MAX(initial_fd_count,
+				      IOLOOP_URING_MIN_ENTRIES));
+	entries = I_MIN(entries, IOLOOP_URING_MAX_ENTRIES);
+
+	i_zero(&params);
+	ctx->ring_fd = io_uring_setup_sys(entries, &params);
+	if (ctx->ring_fd < 0) {
+		i_fatal("io_uring_setup(): %m (you may need to build "
+			"with --with-ioloop=epoll)");
+	}
+	fd_close_on_exec(ctx->ring_fd, TRUE);
+	if ((params.features & IORING_FEAT_EXT_ARG) == 0 ||
+	    (params.features & IORING_FEAT_NODROP) == 0) {
+		i_fatal("io_uring: Kernel is too old (need Linux 5.11+, "
+			"or build with --with-ioloop=epoll)");
+	}
+
+	ctx->sq_entries = params.sq_entries;
+	ctx->sq_size = params.sq_off.array +
+		params.sq_entries * sizeof(unsigned int);
+	ctx->cq_size = params.cq_off.cqes +
+		params.cq_entries * sizeof(struct io_uring_cqe);
+	if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+		ctx->sq_size = ctx->cq_size = I_MAX(ctx->sq_size, ctx->cq_size);
+		ctx->sq_ptr = io_uring_mmap(ctx->ring_fd, ctx->sq_size,
+					    IORING_OFF_SQ_RING);
+		ctx->cq_ptr = ctx->sq_ptr;
+	} else {
+		ctx->sq_ptr = io_uring_mmap(ctx->ring_fd, ctx->sq_size,
+					    IORING_OFF_SQ_RING);
+		ctx->cq_ptr = io_uring_mmap(ctx->ring_fd, ctx->cq_size,
+					    IORING_OFF_CQ_RING);
+	}
+	ctx->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ctx->sqes = io_uring_mmap(ctx->ring_fd, ctx->sqes_size,
+				  IORING_OFF_SQES);
+
+	ctx->sq_head = PTR_OFFSET(ctx->sq_ptr, params.sq_off.head);
+	ctx->sq_tail = PTR_OFFSET(ctx->sq_ptr, params.sq_off.tail);
+	ctx->sq_mask = PTR_OFFSET(ctx->sq_ptr, params.sq_off.ring_mask);
+	ctx->sq_array = PTR_OFFSET(ctx->sq_ptr, params.sq_off.array);
+	ctx->cq_head = PTR_OFFSET(ctx->cq_ptr, params.cq_off.head);
+	ctx->cq_tail = PTR_OFFSET(ctx->cq_ptr, params.cq_off.tail);
+	ctx->cq_mask = PTR_OFFSET(ctx->cq_ptr, params.cq_off.ring_mask);
+	ctx->cqes = PTR_OFFSET(ctx->cq_ptr, params.cq_off.cqes);
+}
+
+void io_loop_handler_deinit(struct ioloop *ioloop)
+{
+	struct ioloop_handler_context *ctx = ioloop->handler_context;
+	struct io_uring_fd *fd;
+
+	array_foreach_modifiable(&ctx->fds, fd)
+		i_free(fd->list);
+
+	if (munmap(ctx->sqes, ctx->sqes_size) < 0)
+		i_error("munmap(io_uring sqes) failed: %m");
+	if (ctx->cq_ptr != ctx->sq_ptr) {
+		if (munmap(ctx->cq_ptr, ctx->cq_size) < 0)
+			i_error("munmap(io_uring cq) failed: %m");
+	}
+	if (munmap(ctx->sq_ptr, ctx->sq_size) < 0)
+		i_error("munmap(io_uring sq) failed: %m");
+	if (close(ctx->ring_fd) < 0)
+		i_error("close(io_uring) failed: %m");
+	array_free(&ctx->fds);
+	array_free(&ctx->dirty_fds);
+	array_free(&ctx->events);
+	i_free(ioloop->handler_context);
+}
+
+static unsigned int io_uring_event_mask(struct io_list *list)
+{
+	unsigned int events = 0;
+	struct io_file *io;
+	int i;
+
+	for (i = 0; i < IOLOOP_IOLIST_IOS_PER_FD; i++) {
+		io = list->ios[i];
+
+		if (io == NULL)
+			continue;
+
+		if ((io->io.condition & IO_READ) != 0)
+			events |= IO_URING_INPUT;
+		if ((io->io.condition & IO_WRITE) != 0)
+			events |= IO_URING_OUTPUT;
+		if ((io->io.condition & IO_ERROR) != 0)
+			events |= IO_URING_ERROR;
+	}
+	return events;
+}
+
+static int io_uring_submit(struct ioloop_handler_context *ctx,
+			   unsigned int min_complete, unsigned int flags,
+			   const struct io_uring_getevents_arg *arg)
+{
+	int ret;
+
+	ret = io_uring_enter_sys(ctx->ring_fd, ctx->to_submit, min_complete,
+				 flags, arg, arg == NULL ? 0 : sizeof(*arg));
+	if (ret > 0) {
+		i_assert((unsigned int)ret <= ctx->to_submit);
+		ctx->to_submit -= ret;
+	}
+	return ret;
+}
+
+static void io_uring_submit_nowait(struct ioloop_handler_context *ctx)
+{
+	if (io_uring_submit(ctx, 0, 0, NULL) < 0 &&
+	    errno != EINTR && errno != EBUSY && errno != EAGAIN)
+		i_fatal("io_uring_enter() failed: %m");
+}
+
+static struct io_uring_sqe *io_uring_get_sqe(struct ioloop_handler_context *ctx)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int tail, idx;
+
+	tail = *ctx->sq_tail;
+	while (tail - __atomic_load_n(ctx->sq_head, __ATOMIC_ACQUIRE) >=
+	       ctx->sq_entries) {
+		/* submission queue is full - flush it without waiting */
+		io_uring_submit_nowait(ctx);
+	}
+
+	idx = tail & *ctx->sq_mask;
+	sqe = &ctx->sqes[idx];
+	i_zero(sqe);
+	ctx->sq_array[idx] = idx;
+	return sqe;
+}
+
+static void io_uring_sqe_commit(struct ioloop_handler_context *ctx)
+{
+	__atomic_store_n(ctx->sq_tail, *ctx->sq_tail + 1, __ATOMIC_RELEASE);
+	ctx->to_submit++;
+}
+
+static void io_uring_queue_poll_remove(struct ioloop_handler_context *ctx,
+				       uint64_t user_data)
+{
+	struct io_uring_sqe *sqe = io_uring_get_sqe(ctx);
+
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = user_data;
+	sqe->user_data = IOLOOP_URING_USER_DATA_INTERNAL;
+	io_uring_sqe_commit(ctx);
+}
+
+static void io_uring_queue_poll_add(struct ioloop_handler_context *ctx,
+				    int fd, unsigned int events,
+				    uint64_t user_data)
+{
+	struct io_uring_sqe *sqe = io_uring_get_sqe(ctx);
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = events;
+	sqe->user_data = user_data;
+	io_uring_sqe_commit(ctx);
+}
+
+static void io_uring_fd_set_dirty(struct ioloop_handler_context *ctx,
+				  struct io_uring_fd *ufd, int fd)
+{
+	if (ufd->dirty)
+		return;
+	ufd->dirty = TRUE;
+	array_push_back(&ctx->dirty_fds, &fd);
+}
+
+static void io_uring_flush_changes(struct ioloop_handler_context *ctx)
+{
+	struct io_uring_fd *ufd;
+	unsigned int events;
+	uint64_t user_data;
+	const int *fdp;
+
+	/* All the io_add()s and io_remove()s done since the previous wait are
+	   coalesced here, so an fd whose poll mask ended up unchanged doesn't
+	   cause any syscalls and the rest are submitted together with the
+	   wait itself. */
+	array_foreach(&ctx->dirty_fds, fdp) {
+		ufd = array_idx_modifiable(&ctx->fds, *fdp);
+		i_assert(ufd->dirty);
+		ufd->dirty = FALSE;
+
+		events = io_uring_event_mask(ufd->list);
+		user_data = ((uint64_t)ufd->generation << 32) |
+			(unsigned int)*fdp;
+		if (events != 0 && ufd->armed_user_data == user_data &&
+		    events == ufd->armed_events)
+			continue;
+
+		if (ufd->armed_user_data != 0) {
+			io_uring_queue_poll_remove(ctx, ufd->armed_user_data);
+			ufd->armed_user_data = 0;
+		}
+		if (events != 0) {
+			ufd->armed_user_data = user_data;
+			ufd->armed_events = events;
+			io_uring_queue_poll_add(ctx, *fdp, events, user_data);
+		}
+	}
+	array_clear(&ctx->dirty_fds);
+}
+
+void io_loop_handle_add(struct io_file *io)
+{
+	struct ioloop_handler_context *ctx = io->io.ioloop->handler_context;
+	struct io_uring_fd *ufd;
+
+	ufd = array_idx_get_space(&ctx->fds, io->fd);
+	if (ufd->list == NULL) {
+		ufd->list = i_new(struct io_list, 1);
+		ufd->generation = 1;
+	}
+
+	if (ioloop_iolist_add(ufd->list, io)) {
+		ctx->fd_count++;
+		/* make sure there's space to copy a completion for each fd */
+		if (array_count(&ctx->events) < ctx->fd_count)
+			array_append_zero(&ctx->events);
+	} else {
+		/* modifying an existing registration - batch it */
+		io_uring_fd_set_dirty(ctx, ufd, io->fd);
+		return;
+	}
+	if (ufd->dirty) {
+		/* the previous registration hasn't been removed yet */
+		return;
+	}
+
+	/* A new fd is registered immediately the same way as with
+	   EPOLL_CTL_ADD, so that the order of the reported events stays the
+	   same as with epoll. Only the modifications and removals, which
+	   happen all the time while e.g. ostreams get flushed, are batched. */
+	i_assert(ufd->armed_user_data == 0);
+	ufd->armed_user_data = ((uint64_t)ufd->generation << 32) |
+		(unsigned int)io->fd;
+	ufd->armed_events = io_uring_event_mask(ufd->list);
+	io_uring_queue_poll_add(ctx, io->fd, ufd->armed_events,
+				ufd->armed_user_data);
+	io_uring_submit_nowait(ctx);
+}
+
+void io_loop_handle_remove(struct io_file *io, bool closed ATTR_UNUSED)
+{
+	struct ioloop_handler_context *ctx = io->io.ioloop->handler_context;
+	struct io_uring_fd *ufd;
+
+	ufd = array_idx_modifiable(&ctx->fds, io->fd);
+	if (ioloop_iolist_del(ufd->list, io)) {
+		/* The fd may get closed and its number reused for another
+		   file before the changes are flushed. Unlike with epoll the
+		   poll request keeps the old file referenced, so it must
+		   always be removed, and any of its completions that are
+		   still in the queue must be ignored. */
+		i_assert(ctx->fd_count > 0);
+		ctx->fd_count--;
+		if (++ufd->generation == 0)
+			ufd->generation++;
+	}
+	io_uring_fd_set_dirty(ctx, ufd, io->fd);
+	i_free(io);
+}
+
+static unsigned int io_uring_get_events(struct ioloop_handler_context *ctx)
+{
+	struct io_uring_cqe *events;
+	unsigned int head, tail, count, max_count;
+
+	events = array_get_modifiable(&ctx->events, &max_count);
+	head = *ctx->cq_head;
+	tail = __atomic_load_n(ctx->cq_tail, __ATOMIC_ACQUIRE);
+	for (count = 0; head != tail; head++) {
+		const struct io_uring_cqe *cqe = &ctx->cqes[head & *ctx->cq_mask];
+
+		if (cqe->user_data == IOLOOP_URING_USER_DATA_INTERNAL)
+			continue;
+		if (count == max_count) {
+			/* leave the rest for the next run */
+			break;
+		}
+		events[count++] = *cqe;
+	}
+	__atomic_store_n(ctx->cq_head, head, __ATOMIC_RELEASE);
+	return count;
+}
+
+static struct io_list *
+io_uring_event_get_list(struct ioloop_handler_context *ctx,
+			const struct io_uring_cqe *cqe)
+{
+	struct io_uring_fd *ufd;
+	int fd = (int)(cqe->user_data & 0xffffffff);
+
+	if ((unsigned int)fd >= array_count(&ctx->fds))
+		return NULL;
+	ufd = array_idx_modifiable(&ctx->fds, fd);
+	if (ufd->armed_user_data != cqe->user_data ||
+	    (cqe->user_data >> 32) != ufd->generation) {
+		/* stale completion for an already removed poll request */
+		return NULL;
+	}
+	/* Poll requests are one-shot, because multishot polls only trigger
+	   on new wakeups while ioloop users expect level-triggered behavior
+	   (e.g. an istream that didn't read everything). The re-arming is
+	   submitted together with the next wait, so it's still free. */
+	ufd->armed_user_data = 0;
+	io_uring_fd_set_dirty(ctx, ufd, fd);
+	if (cqe->res < 0) {
+		if (cqe->res == -ECANCELED)
+			return NULL;
+		errno = -cqe->res;
+		i_panic("io_uring poll(%d) failed: %m", fd);
+	}
+	return ufd->list;
+}
+
+void io_loop_handler_run_internal(struct ioloop *ioloop)
+{
+	struct ioloop_handler_context *ctx = ioloop->handler_context;
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	const struct io_uring_cqe *event;
+	struct io_list *list;
+	struct io_file *io;
+	struct timeval tv;
+	unsigned int i, events_count;
+	int msecs, ret, j;
+	bool call;
+
+	i_assert(ctx != NULL);
+
+	/* get the time left for next timeout task */
+	msecs = io_loop_run_get_wait_time(ioloop, &tv);
+
+	io_uring_flush_changes(ctx);
+	if (ioloop->io_files != NULL && ctx->fd_count > 0) {
+		i_zero(&arg);
+		if (msecs >= 0) {
+			ts.tv_sec = tv.tv_sec;
+			ts.tv_nsec = tv.tv_usec * 1000;
+			arg.ts = (uintptr_t)&ts;
+		}
+		ret = io_uring_submit(ctx, 1, IORING_ENTER_GETEVENTS |
+				      IORING_ENTER_EXT_ARG, &arg);
+		if (ret < 0 && errno != EINTR && errno != ETIME &&
+		    errno != EBUSY && errno != EAGAIN)
+			i_fatal("io_uring_enter(): %m");
+	} else {
+		/* no I/Os, but we should have some timeouts.
+		   just wait for them. */
+		i_assert(msecs >= 0);
+		if (ctx->to_submit > 0) {
+			/* still need to get rid of the removed polls */
+			io_uring_submit_nowait(ctx);
+		}
+		usleep(msecs*1000);
+	}
+	events_count = io_uring_get_events(ctx);
+
+	/* execute timeout handlers */
+	io_loop_handle_timeouts(ioloop);
+
+	if (!ioloop->running)
+		return;
+
+	for (i = 0; i < events_count; i++) {
+		/* io_loop_handle_add() may cause events array reallocation,
+		   so we have use array_idx() */
+		event = array_idx(&ctx->events, i);
+		list = io_uring_event_get_list(ctx, event);
+		if (list == NULL)
+			continue;
+
+		for (j = 0; j < IOLOOP_IOLIST_IOS_PER_FD; j++) {
+			io = list->ios[j];
+			if (io == NULL)
+				continue;
+
+			call = FALSE;
+			if ((event->res & (POLLHUP | POLLERR)) != 0)
+				call = TRUE;
+			else if ((io->io.condition & IO_READ) != 0)
+				call = (event->res & (POLLIN | POLLPRI)) != 0;
+			else if ((io->io.condition & IO_WRITE) != 0)
+				call = (event->res & POLLOUT) != 0;
+			else if ((io->io.condition & IO_ERROR) != 0)
+				call = (event->res & IO_URING_ERROR) != 0;
+
+			if (call) {
+				io_loop_call_io(&io->io);
+				if (!ioloop->running)
+					return;
+			}
+		}
+	}
+}
+
+#endif	/* IOLOOP_URING */
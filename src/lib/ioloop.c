@@ -10,6 +10,8 @@
 
 #include <unistd.h>
 
+#define IOLOOP_LOG_BUFFER_RETRY_MSECS 100
+
 #define timer_is_larger(tvp, uvp) \
 	((tvp)->tv_sec > (uvp)->tv_sec || \
 	 ((tvp)->tv_sec == (uvp)->tv_sec && \
@@ -248,6 +250,247 @@ static void timeout_update_next(struct timeout *timeout, struct timeval *tv_now)
 	}
 }
 
+static uint64_t timeout_wheel_tick(const struct timeval *tv)
+{
+	return ((uint64_t)tv->tv_sec * 1000 + tv->tv_usec / 1000) /
+		IOLOOP_TIMEOUT_WHEEL_TICK_MSECS;
+}
+
+static bool timeout_wheel_is_empty(const struct timeout_wheel *wheel)
+{
+	unsigned int level;
+
+	for (level = 0; level < IOLOOP_TIMEOUT_WHEEL_LEVELS; level++) {
+		if (wheel->count[level] > 0)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static void timeout_wheel_add(struct ioloop *ioloop, struct timeout *timeout)
+{
+	struct timeout_wheel *wheel = &ioloop->timeout_wheel;
+	uint64_t tick, diff, event_tick;
+	unsigned int level, shift, idx;
+
+	i_assert(timeout->wheel_slot == NULL);
+	i_assert(timeout->item.idx == UINT_MAX);
+
+	if (timeout_wheel_is_empty(wheel))
+		wheel->cur_tick = timeout_wheel_tick(&ioloop_timeval);
+
+	tick = timeout_wheel_tick(&timeout->next_run);
+	if (tick < wheel->cur_tick) {
+		/* the slot has already been processed */
+		priorityq_add(ioloop->timeouts, &timeout->item);
+		return;
+	}
+
+	diff = tick - wheel->cur_tick;
+	for (level = 0; level < IOLOOP_TIMEOUT_WHEEL_LEVELS - 1; level++) {
+		if ((diff >> (IOLOOP_TIMEOUT_WHEEL_LEVEL_BITS * (level+1))) == 0)
+			break;
+	}
+	if ((diff >> (IOLOOP_TIMEOUT_WHEEL_LEVEL_BITS *
+		      IOLOOP_TIMEOUT_WHEEL_LEVELS)) != 0) {
+		/* beyond the wheel's range. put it to the furthest slot, it
+		   gets placed again when the slot is cascaded. */
+		tick = wheel->cur_tick - 1 +
+			(1ULL << (IOLOOP_TIMEOUT_WHEEL_LEVEL_BITS *
+				  IOLOOP_TIMEOUT_WHEEL_LEVELS));
+	}
+	shift = IOLOOP_TIMEOUT_WHEEL_LEVEL_BITS * level;
+	idx = (tick >> shift) & (IOLOOP_TIMEOUT_WHEEL_LEVEL_SLOTS - 1);
+
+	timeout->wheel_slot = &wheel->slots[level][idx];
+	timeout->wheel_level = level;
+	DLLIST_PREPEND_FULL(timeout->wheel_slot, timeout,
+			    wheel_prev, wheel_next);
+	wheel->count[level]++;
+
+	/* level 0 slots are expired at their tick, higher level slots
+	   are cascaded at the start of their range */
+	event_tick = (tick >> shift) << shift;
+	if (event_tick < wheel->cur_tick)
+		event_tick += (uint64_t)IOLOOP_TIMEOUT_WHEEL_LEVEL_SLOTS << shift;
+	if (wheel->next_tick_valid && event_tick < wheel->next_tick)
+		wheel->next_tick = event_tick;
+}
+
+static void timeout_wheel_remove(struct ioloop *ioloop,
+				 struct timeout *timeout)
+{
+	DLLIST_REMOVE_FULL(timeout->wheel_slot, timeout,
+			   wheel_prev, wheel_next);
+	i_assert(ioloop->timeout_wheel.count[timeout->wheel_level] > 0);
+	ioloop->timeout_wheel.count[timeout->wheel_level]--;
+	timeout->wheel_slot = NULL;
+}
+
+static struct timeout *
+timeout_wheel_detach_slot(struct ioloop *ioloop, unsigned int level,
+			  unsigned int idx)
+{
+	struct timeout_wheel *wheel = &ioloop->timeout_wheel;
+	struct timeout *list = wheel->slots[level][idx], *timeout;
+
+	wheel->slots[level][idx] = NULL;
+	for (timeout = list; timeout != NULL; timeout = timeout->wheel_next) {
+		i_assert(wheel->count[level] > 0);
+		wheel->count[level]--;
+		timeout->wheel_slot = NULL;
+	}
+	return list;
+}
+
+static void
+timeout_wheel_cascade(struct ioloop *ioloop, unsigned int level,
+		      unsigned int idx)
+{
+	struct timeout *timeout, *next;
+
+	timeout = timeout_wheel_detach_slot(ioloop, level, idx);
+	for (; timeout != NULL; timeout = next) {
+		next = timeout->wheel_next;
+		timeout->wheel_prev = timeout->wheel_next = NULL;
+		timeout_wheel_add(ioloop, timeout);
+	}
+}
+
+static void
+timeout_wheel_run(struct ioloop *ioloop, const struct timeval *tv_now)
+{
+	struct timeout_wheel *wheel = &ioloop->timeout_wheel;
+	struct timeout *timeout, *next;
+	uint64_t now_tick = timeout_wheel_tick(tv_now);
+	uint64_t skip_tick;
+	unsigned int level, idx;
+
+	while (wheel->cur_tick <= now_tick) {
+		if (timeout_wheel_is_empty(wheel)) {
+			wheel->cur_tick = now_tick + 1;
+			break;
+		}
+		idx = wheel->cur_tick & (IOLOOP_TIMEOUT_WHEEL_LEVEL_SLOTS - 1);
+		for (level = 1; idx == 0 && level < IOLOOP_TIMEOUT_WHEEL_LEVELS;
+		     level++) {
+			/* move the next slot of the upper level down */
+			idx = (wheel->cur_tick >>
+			       (IOLOOP_TIMEOUT_WHEEL_LEVEL_BITS * level)) &
+				(IOLOOP_TIMEOUT_WHEEL_LEVEL_SLOTS - 1);
+			timeout_wheel_cascade(ioloop, level, idx);
+		}
+
+		/* the slot's timeouts expire during this tick. let the
+		   priority queue handle their exact times. */
+		idx = wheel->cur_tick & (IOLOOP_TIMEOUT_WHEEL_LEVEL_SLOTS - 1);
+		timeout = timeout_wheel_detach_slot(ioloop, 0, idx);
+		for (; timeout != NULL; timeout = next) {
+			next = timeout->wheel_next;
+			timeout->wheel_prev = timeout->wheel_next = NULL;
+			priorityq_add(ioloop->timeouts, &timeout->item);
+		}
+		wheel->cur_tick++;
+
+		if (wheel->count[0] == 0) {
+			/* nothing to do until the next cascade */
+			skip_tick = (wheel->cur_tick +
+				     IOLOOP_TIMEOUT_WHEEL_LEVEL_SLOTS - 1) &
+				~(uint64_t)(IOLOOP_TIMEOUT_WHEEL_LEVEL_SLOTS - 1);
+			wheel->cur_tick = I_MIN(skip_tick, now_tick + 1);
+		}
+	}
+	wheel->next_tick_valid = FALSE;
+}
+
+static bool
+timeout_wheel_get_next_run(struct ioloop *ioloop, struct timeval *tv_r)
+{
+	struct timeout_wheel *wheel = &ioloop->timeout_wheel;
+	uint64_t tick, msecs;
+	unsigned int level, shift, idx, k;
+
+	if (timeout_wheel_is_empty(wheel))
+		return FALSE;
+
+	if (!wheel->next_tick_valid) {
+		wheel->next_tick = UINT64_MAX;
+		for (level = 0; level < IOLOOP_TIMEOUT_WHEEL_LEVELS; level++) {
+			if (wheel->count[level] == 0)
+				continue;
+			/* the slot containing cur_tick has already been
+			   processed unless cur_tick is at its start. in that
+			   case its next run is one full rotation later. */
+			shift = IOLOOP_TIMEOUT_WHEEL_LEVEL_BITS * level;
+			for (k = 0; k <= IOLOOP_TIMEOUT_WHEEL_LEVEL_SLOTS; k++) {
+				tick = ((wheel->cur_tick >> shift) + k) << shift;
+				if (tick < wheel->cur_tick)
+					continue;
+				idx = (tick >> shift) &
+					(IOLOOP_TIMEOUT_WHEEL_LEVEL_SLOTS - 1);
+				if (wheel->slots[level][idx] != NULL)
+					break;
+			}
+			if (tick < wheel->next_tick)
+				wheel->next_tick = tick;
+		}
+		wheel->next_tick_valid = TRUE;
+	}
+
+	msecs = wheel->next_tick * IOLOOP_TIMEOUT_WHEEL_TICK_MSECS;
+	tv_r->tv_sec = msecs / 1000;
+	tv_r->tv_usec = (msecs % 1000) * 1000;
+	return TRUE;
+}
+
+static void timeout_wheel_time_moved(struct ioloop *ioloop, long diff_secs)
+{
+	struct timeout_wheel *wheel = &ioloop->timeout_wheel;
+	struct timeout *list = NULL, *timeout, *next;
+	unsigned int level, idx;
+
+	for (level = 0; level < IOLOOP_TIMEOUT_WHEEL_LEVELS; level++) {
+		for (idx = 0; idx < IOLOOP_TIMEOUT_WHEEL_LEVEL_SLOTS; idx++) {
+			timeout = timeout_wheel_detach_slot(ioloop, level, idx);
+			for (; timeout != NULL; timeout = next) {
+				next = timeout->wheel_next;
+				timeout->next_run.tv_sec += diff_secs;
+				DLLIST_PREPEND_FULL(&list, timeout,
+						    wheel_prev, wheel_next);
+			}
+		}
+	}
+	/* the wheel is empty now, so the first add resets its position */
+	wheel->next_tick_valid = FALSE;
+	for (timeout = list; timeout != NULL; timeout = next) {
+		next = timeout->wheel_next;
+		timeout->wheel_prev = timeout->wheel_next = NULL;
+		timeout_wheel_add(ioloop, timeout);
+	}
+}
+
+static bool timeout_is_scheduled(const struct timeout *timeout)
+{
+	return timeout->item.idx != UINT_MAX || timeout->wheel_slot != NULL;
+}
+
+static void timeout_schedule(struct ioloop *ioloop, struct timeout *timeout)
+{
+	if (!timeout->one_shot &&
+	    timeout->msecs >= IOLOOP_TIMEOUT_WHEEL_MIN_MSECS)
+		timeout_wheel_add(ioloop, timeout);
+	else
+		priorityq_add(ioloop->timeouts, &timeout->item);
+}
+
+static void timeout_unschedule(struct timeout *timeout)
+{
+	if (timeout->item.idx != UINT_MAX)
+		priorityq_remove(timeout->ioloop->timeouts, &timeout->item);
+	else if (timeout->wheel_slot != NULL)
+		timeout_wheel_remove(timeout->ioloop, timeout);
+}
+
 static struct timeout *
 timeout_add_common(struct ioloop *ioloop, const char *source_filename,
 		   unsigned int source_linenum,
@@ -369,8 +612,8 @@ timeout_copy(const struct timeout *old_to, struct ioloop *ioloop)
 	new_to->msecs = old_to->msecs;
 	new_to->next_run = old_to->next_run;
 
-	if (old_to->item.idx != UINT_MAX)
-		priorityq_add(new_to->ioloop->timeouts, &new_to->item);
+	if (timeout_is_scheduled(old_to))
+		timeout_schedule(new_to->ioloop, new_to);
 	else if (!new_to->one_shot) {
 		i_assert(new_to->msecs > 0);
 		array_push_back(&new_to->ioloop->timeouts_new, &new_to);
@@ -397,8 +640,8 @@ void timeout_remove(struct timeout **_timeout)
 	ioloop = timeout->ioloop;
 
 	*_timeout = NULL;
-	if (timeout->item.idx != UINT_MAX)
-		priorityq_remove(timeout->ioloop->timeouts, &timeout->item);
+	if (timeout_is_scheduled(timeout))
+		timeout_unschedule(timeout);
 	else if (!timeout->one_shot && timeout->msecs > 0) {
 		struct timeout *const *to_idx;
 		array_foreach(&ioloop->timeouts_new, to_idx) {
@@ -415,7 +658,7 @@ void timeout_remove(struct timeout **_timeout)
 static void ATTR_NULL(2)
 timeout_reset_timeval(struct timeout *timeout, struct timeval *tv_now)
 {
-	if (timeout->item.idx == UINT_MAX)
+	if (!timeout_is_scheduled(timeout))
 		return;
 
 	timeout_update_next(timeout, tv_now);
@@ -434,8 +677,8 @@ timeout_reset_timeval(struct timeout *timeout, struct timeval *tv_now)
 		 timeout->next_run.tv_sec > tv_now->tv_sec ||
 		 (timeout->next_run.tv_sec == tv_now->tv_sec &&
 		  timeout->next_run.tv_usec > tv_now->tv_usec));
-	priorityq_remove(timeout->ioloop->timeouts, &timeout->item);
-	priorityq_add(timeout->ioloop->timeouts, &timeout->item);
+	timeout_unschedule(timeout);
+	timeout_schedule(timeout->ioloop, timeout);
 }
 
 void timeout_reset(struct timeout *timeout)
@@ -444,8 +687,8 @@ void timeout_reset(struct timeout *timeout)
 	timeout_reset_timeval(timeout, NULL);
 }
 
-static int timeout_get_wait_time(struct timeout *timeout, struct timeval *tv_r,
-				 struct timeval *tv_now)
+static int timeval_get_wait_time(const struct timeval *next_run,
+				 struct timeval *tv_r, struct timeval *tv_now)
 {
 	int ret;
 
@@ -457,10 +700,10 @@ static int timeout_get_wait_time(struct timeout *timeout, struct timeval *tv_r,
 	tv_r->tv_usec = tv_now->tv_usec;
 
 	i_assert(tv_r->tv_sec > 0);
-	i_assert(timeout->next_run.tv_sec > 0);
+	i_assert(next_run->tv_sec > 0);
 
-	tv_r->tv_sec = timeout->next_run.tv_sec - tv_r->tv_sec;
-	tv_r->tv_usec = timeout->next_run.tv_usec - tv_r->tv_usec;
+	tv_r->tv_sec = next_run->tv_sec - tv_r->tv_sec;
+	tv_r->tv_usec = next_run->tv_usec - tv_r->tv_usec;
 	if (tv_r->tv_usec < 0) {
 		tv_r->tv_sec--;
 		tv_r->tv_usec += 1000000;
@@ -480,20 +723,40 @@ static int timeout_get_wait_time(struct timeout *timeout, struct timeval *tv_r,
 	return ret;
 }
 
+static int timeout_get_wait_time(struct timeout *timeout, struct timeval *tv_r,
+				 struct timeval *tv_now)
+{
+	return timeval_get_wait_time(&timeout->next_run, tv_r, tv_now);
+}
+
 static int io_loop_get_wait_time(struct ioloop *ioloop, struct timeval *tv_r)
 {
-	struct timeval tv_now;
+	struct timeval tv_now, tv_wheel, tv_log;
 	struct priorityq_item *item;
 	struct timeout *timeout;
+	const struct timeval *next_run = NULL;
 	int msecs;
 
 	item = priorityq_peek(ioloop->timeouts);
 	timeout = (struct timeout *)item;
+	if (timeout != NULL)
+		next_run = &timeout->next_run;
+	if (timeout_wheel_get_next_run(ioloop, &tv_wheel) &&
+	    (next_run == NULL || timeval_cmp(&tv_wheel, next_run) < 0))
+		next_run = &tv_wheel;
+	if (i_failure_flush_buffer()) {
+		/* log pipe is full - retry writing the buffered messages
+		   soon even if nothing else happens */
+		tv_log = ioloop_timeval;
+		timeval_add_msecs(&tv_log, IOLOOP_LOG_BUFFER_RETRY_MSECS);
+		if (next_run == NULL || timeval_cmp(&tv_log, next_run) < 0)
+			next_run = &tv_log;
+	}
 
 	/* we need to see if there are pending IO waiting,
 	   if there is, we set msecs = 0 to ensure they are
 	   processed without delay */
-	if (timeout == NULL && ioloop->io_pending_count == 0) {
+	if (next_run == NULL && ioloop->io_pending_count == 0) {
 		/* no timeouts. use INT_MAX msecs for timeval and
 		   return -1 for poll/epoll infinity. */
 		tv_r->tv_sec = INT_MAX / 1000;
@@ -510,7 +773,7 @@ static int io_loop_get_wait_time(struct ioloop *ioloop, struct timeval *tv_r)
 		tv_r->tv_usec = 0;
 	} else {
 		tv_now.tv_sec = 0;
-		msecs = timeout_get_wait_time(timeout, tv_r, &tv_now);
+		msecs = timeval_get_wait_time(next_run, tv_r, &tv_now);
 	}
 	ioloop->next_max_time = (tv_now.tv_sec + msecs/1000) + 1;
 
@@ -572,7 +835,7 @@ static void io_loop_timeouts_start_new(struct ioloop *ioloop)
 		i_assert(!timeout->one_shot);
 		i_assert(timeout->msecs > 0);
 		timeout_update_next(timeout, &ioloop_timeval);
-		priorityq_add(ioloop->timeouts, &timeout->item);
+		timeout_schedule(ioloop, timeout);
 	}
 	array_clear(&ioloop->timeouts_new);
 }
@@ -589,6 +852,7 @@ static void io_loop_timeouts_update(struct ioloop *ioloop, long diff_secs)
 
 		to->next_run.tv_sec += diff_secs;
 	}
+	timeout_wheel_time_moved(ioloop, diff_secs);
 }
 
 static void io_loops_timeouts_update(long diff_secs)
@@ -646,6 +910,7 @@ static void io_loop_handle_timeouts_real(struct ioloop *ioloop)
 
 	ioloop_time = ioloop_timeval.tv_sec;
 	tv_call = ioloop_timeval;
+	timeout_wheel_run(ioloop, &tv_call);
 
 	while (ioloop->running &&
 	       (item = priorityq_peek(ioloop->timeouts)) != NULL) {
@@ -818,6 +1083,7 @@ void io_loop_destroy(struct ioloop **_ioloop)
 	struct ioloop *ioloop = *_ioloop;
 	struct timeout *const *to_idx;
 	struct priorityq_item *item;
+	unsigned int level, idx;
 	bool leaks = FALSE;
 
 	*_ioloop = NULL;
@@ -879,6 +1145,28 @@ void io_loop_destroy(struct ioloop **_ioloop)
 	}
 	priorityq_deinit(&ioloop->timeouts);
 
+	for (level = 0; level < IOLOOP_TIMEOUT_WHEEL_LEVELS; level++) {
+		for (idx = 0; idx < IOLOOP_TIMEOUT_WHEEL_LEVEL_SLOTS; idx++) {
+			while (ioloop->timeout_wheel.slots[level][idx] != NULL) {
+				struct timeout *to =
+					ioloop->timeout_wheel.slots[level][idx];
+				const char *error = t_strdup_printf(
+					"Timeout leak: %p (%s:%u)",
+					(void *)to->callback,
+					to->source_filename,
+					to->source_linenum);
+
+				if (panic_on_leak)
+					i_panic("%s", error);
+				else
+					i_warning("%s", error);
+				timeout_wheel_remove(ioloop, to);
+				timeout_free(to);
+				leaks = TRUE;
+			}
+		}
+	}
+
 	while (ioloop->wait_timers != NULL) {
 		struct io_wait_timer *timer = ioloop->wait_timers;
 		const char *error = t_strdup_printf(
@@ -907,6 +1195,24 @@ void io_loop_destroy(struct ioloop **_ioloop)
 	i_free(ioloop);
 }
 
+void io_loop_reinit_after_fork(void)
+{
+	struct ioloop *ioloop;
+	struct io_file *io;
+
+	for (ioloop = current_ioloop; ioloop != NULL; ioloop = ioloop->prev) {
+		if (ioloop->handler_context == NULL)
+			continue;
+		/* this closes only our copy of the shared fd */
+		io_loop_handler_deinit(ioloop);
+		io_loop_initialize_handler(ioloop);
+		for (io = ioloop->io_files; io != NULL; io = io->next) {
+			if (io->fd != -1)
+				io_loop_handle_add(io);
+		}
+	}
+}
+
 void io_loop_set_time_moved_callback(struct ioloop *ioloop,
 				     io_loop_time_moved_callback_t *callback)
 {
@@ -193,6 +193,12 @@ struct ioloop *io_loop_create(void);
 void io_loop_set_max_fd_count(struct ioloop *ioloop, unsigned int max_fds);
 /* Destroy I/O loop and set ioloop pointer to NULL. */
 void io_loop_destroy(struct ioloop **ioloop);
+/* Call in a child process after fork(). The kernel state of the current
+   ioloop and its parent ioloops (e.g. the epoll fd) is shared with the parent
+   process, so adding or removing an I/O in the child could break the parent's
+   I/O handlers. This recreates the state for the child with the existing
+   I/Os re-added to it. */
+void io_loop_reinit_after_fork(void);
 
 /* If time moves backwards or jumps forwards call the callback. */
 void io_loop_set_time_moved_callback(struct ioloop *ioloop,
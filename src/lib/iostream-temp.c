@@ -1,5 +1,6 @@
 /* Copyright (c) 2013-2018 Dovecot authors, see the included COPYING file */
 
+#define _GNU_SOURCE /* for memfd_create() */
 #include "lib.h"
 #include "buffer.h"
 #include "str.h"
@@ -10,8 +11,14 @@
 #include "iostream-temp.h"
 
 #include <unistd.h>
+#ifdef HAVE_MEMFD_CREATE
+#  include <sys/mman.h>
+#endif
 
 #define IOSTREAM_TEMP_MAX_BUF_SIZE_DEFAULT (1024*128)
+/* Maximum total size of the IOSTREAM_TEMP_FLAG_MEMFD temp files in this
+   process. Temp files that would exceed it are moved to disk. */
+#define IOSTREAM_TEMP_MEMFD_MAX_TOTAL_SIZE (1024*1024*16)
 
 struct temp_ostream {
 	struct ostream_private ostream;
@@ -28,45 +35,154 @@ struct temp_ostream {
 	int fd;
 	bool fd_tried;
 	uoff_t fd_size;
+	/* fd is a memfd - memfd_size of it is counted in memfd_total_size */
+	bool fd_memfd;
+	uoff_t memfd_size;
 };
 
+static uoff_t memfd_total_size = 0;
+#ifdef HAVE_MEMFD_CREATE
+static bool memfd_unsupported = FALSE;
+#endif
+
 static bool o_stream_temp_dup_cancel(struct temp_ostream *tstream,
 				     enum ostream_send_istream_result *res_r);
 
+static void o_stream_temp_fd_close(struct temp_ostream *tstream)
+{
+	if (tstream->fd_memfd) {
+		i_assert(memfd_total_size >= tstream->memfd_size);
+		memfd_total_size -= tstream->memfd_size;
+		tstream->memfd_size = 0;
+		tstream->fd_memfd = FALSE;
+	}
+	i_close_fd(&tstream->fd);
+	tstream->ostream.fd = -1;
+}
+
 static void
 o_stream_temp_close(struct iostream_private *stream,
 		    bool close_parent ATTR_UNUSED)
 {
 	struct temp_ostream *tstream = (struct temp_ostream *)stream;
 
-	i_close_fd(&tstream->fd);
+	o_stream_temp_fd_close(tstream);
 	buffer_free(&tstream->buf);
 	i_free(tstream->temp_path_prefix);
 	i_free(tstream->name);
 }
 
-static int o_stream_temp_move_to_fd(struct temp_ostream *tstream)
+static int o_stream_temp_create_disk_fd(struct temp_ostream *tstream,
+					const char **path_r)
 {
 	string_t *path;
-
-	if (tstream->fd_tried)
-		return -1;
-	tstream->fd_tried = TRUE;
+	int fd;
 
 	path = t_str_new(128);
 	str_append(path, tstream->temp_path_prefix);
-	tstream->fd = safe_mkstemp_hostpid(path, 0600, (uid_t)-1, (gid_t)-1);
-	if (tstream->fd == -1) {
+	fd = safe_mkstemp_hostpid(path, 0600, (uid_t)-1, (gid_t)-1);
+	if (fd == -1) {
 		i_error("safe_mkstemp(%s) failed: %m", str_c(path));
 		return -1;
 	}
 	if (i_unlink(str_c(path)) < 0) {
-		i_close_fd(&tstream->fd);
+		i_close_fd(&fd);
 		return -1;
 	}
+	*path_r = str_c(path);
+	return fd;
+}
+
+static bool
+o_stream_temp_create_memfd(struct temp_ostream *tstream, uoff_t size)
+{
+#ifdef HAVE_MEMFD_CREATE
+	if ((tstream->flags & IOSTREAM_TEMP_FLAG_MEMFD) == 0 ||
+	    memfd_unsupported ||
+	    memfd_total_size + size > IOSTREAM_TEMP_MEMFD_MAX_TOTAL_SIZE)
+		return FALSE;
+
+	tstream->fd = memfd_create("iostream-temp", MFD_CLOEXEC);
+	if (tstream->fd == -1) {
+		if (errno == ENOSYS)
+			memfd_unsupported = TRUE;
+		else
+			i_error("memfd_create() failed: %m");
+		return FALSE;
+	}
+	tstream->fd_memfd = TRUE;
+	return TRUE;
+#else
+	return FALSE;
+#endif
+}
+
+static void o_stream_temp_memfd_move_to_disk(struct temp_ostream *tstream)
+{
+	unsigned char buf[IO_BLOCK_SIZE];
+	const char *path;
+	uoff_t offset = 0;
+	ssize_t ret = 0;
+	int fd;
+
+	fd = o_stream_temp_create_disk_fd(tstream, &path);
+	if (fd == -1)
+		return;
+	while (offset < tstream->fd_size &&
+	       (ret = pread(tstream->fd, buf, sizeof(buf), offset)) > 0) {
+		if (write_full(fd, buf, ret) < 0) {
+			i_error("write(%s) failed: %m", path);
+			i_close_fd(&fd);
+			return;
+		}
+		offset += ret;
+	}
+	if (ret < 0) {
+		/* not really expecting this to happen */
+		i_error("iostream-temp %s: read(memfd) failed: %m",
+			o_stream_get_name(&tstream->ostream.ostream));
+		i_close_fd(&fd);
+		return;
+	}
+	o_stream_temp_fd_close(tstream);
+	tstream->fd = fd;
+	tstream->ostream.fd = fd;
+}
+
+static void
+o_stream_temp_memfd_reserve(struct temp_ostream *tstream, uoff_t size)
+{
+	if (!tstream->fd_memfd || size <= tstream->memfd_size)
+		return;
+
+	if (memfd_total_size - tstream->memfd_size + size >
+	    IOSTREAM_TEMP_MEMFD_MAX_TOTAL_SIZE) {
+		o_stream_temp_memfd_move_to_disk(tstream);
+		if (!tstream->fd_memfd)
+			return;
+		/* failed to move to disk, just keep it in the memfd */
+	}
+	memfd_total_size += size - tstream->memfd_size;
+	tstream->memfd_size = size;
+}
+
+static int o_stream_temp_move_to_fd(struct temp_ostream *tstream)
+{
+	const char *path = "memfd";
+
+	if (tstream->fd_tried)
+		return -1;
+	tstream->fd_tried = TRUE;
+
+	if (!o_stream_temp_create_memfd(tstream, tstream->buf->used)) {
+		tstream->fd = o_stream_temp_create_disk_fd(tstream, &path);
+		if (tstream->fd == -1)
+			return -1;
+	}
+	o_stream_temp_memfd_reserve(tstream, tstream->buf->used);
 	if (write_full(tstream->fd, tstream->buf->data, tstream->buf->used) < 0) {
-		i_error("write(%s) failed: %m", str_c(path));
-		i_close_fd(&tstream->fd);
+		i_error("write(%s) failed: %m", path);
+		o_stream_temp_fd_close(tstream);
 		return -1;
 	}
 	/* make the fd available also to o_stream_get_fd(),
@@ -102,8 +218,7 @@ int o_stream_temp_move_to_memory(struct ostream *output)
 		tstream->ostream.ostream.stream_errno = EIO;
 		return -1;
 	}
-	i_close_fd(&tstream->fd);
-	tstream->ostream.fd = -1;
+	o_stream_temp_fd_close(tstream);
 	return 0;
 }
 
@@ -114,6 +229,11 @@ o_stream_temp_fd_sendv(struct temp_ostream *tstream,
 	size_t bytes = 0;
 	unsigned int i;
 
+	for (i = 0; i < iov_count; i++)
+		bytes += iov[i].iov_len;
+	o_stream_temp_memfd_reserve(tstream, tstream->fd_size + bytes);
+
+	bytes = 0;
 	for (i = 0; i < iov_count; i++) {
 		if (write_full(tstream->fd, iov[i].iov_base, iov[i].iov_len) < 0) {
 			i_error("iostream-temp %s: write(%s*) failed: %m - moving to memory",
@@ -272,9 +392,10 @@ o_stream_temp_write_at(struct ostream_private *stream,
 		buffer_write(tstream->buf, offset, data, size);
 		stream->ostream.offset = tstream->buf->used;
 	} else {
+		o_stream_temp_memfd_reserve(tstream, offset + size);
 		if (pwrite_full(tstream->fd, data, size, offset) < 0) {
 			stream->ostream.stream_errno = errno;
-			i_close_fd(&tstream->fd);
+			o_stream_temp_fd_close(tstream);
 			return -1;
 		}
 		if (tstream->fd_size < offset + size)
@@ -341,6 +462,31 @@ static void iostream_temp_buf_destroyed(buffer_t *buf)
 	buffer_free(&buf);
 }
 
+static void iostream_temp_memfd_destroyed(uoff_t *memfd_size)
+{
+	i_assert(memfd_total_size >= *memfd_size);
+	memfd_total_size -= *memfd_size;
+	i_free(memfd_size);
+}
+
+static void
+iostream_temp_memfd_move_to_istream(struct temp_ostream *tstream,
+				    struct istream *input)
+{
+	uoff_t *memfd_size;
+
+	if (!tstream->fd_memfd)
+		return;
+
+	/* the memfd is now owned by the istream */
+	memfd_size = i_new(uoff_t, 1);
+	*memfd_size = tstream->memfd_size;
+	i_stream_add_destroy_callback(input, iostream_temp_memfd_destroyed,
+				      memfd_size);
+	tstream->memfd_size = 0;
+	tstream->fd_memfd = FALSE;
+}
+
 struct istream *iostream_temp_finish(struct ostream **output,
 				     size_t max_buffer_size)
 {
@@ -378,9 +524,20 @@ struct istream *iostream_temp_finish(struct ostream **output,
 	} else if (tstream->dupstream != NULL) {
 		/* return the original failed stream. */
 		input = tstream->dupstream;
+	} else if (tstream->fd != -1 &&
+		   (tstream->flags & IOSTREAM_TEMP_FLAG_MMAP) != 0) {
+		int fd = tstream->fd;
+		input = i_stream_create_mmap(fd, tstream->fd_size, 0,
+					     tstream->fd_size, TRUE);
+		tstream->fd = -1;
+		iostream_temp_memfd_move_to_istream(tstream, input);
+		i_stream_set_name(input, t_strdup_printf(
+			"(Temp file fd %d in %s%s, %"PRIuUOFF_T" bytes)",
+			fd, tstream->temp_path_prefix, for_path, tstream->fd_size));
 	} else if (tstream->fd != -1) {
 		int fd = tstream->fd;
 		input = i_stream_create_fd_autoclose(&tstream->fd, max_buffer_size);
+		iostream_temp_memfd_move_to_istream(tstream, input);
 		i_stream_set_name(input, t_strdup_printf(
 			"(Temp file fd %d in %s%s, %"PRIuUOFF_T" bytes)",
 			fd, tstream->temp_path_prefix, for_path, tstream->fd_size));
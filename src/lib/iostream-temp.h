@@ -5,7 +5,17 @@ enum iostream_temp_flags {
 	/* if o_stream_send_istream() is called with a readable fd, don't
 	   actually copy the input stream, just have iostream_temp_finish()
 	   return a new iostream pointing to the fd dup()ed */
-	IOSTREAM_TEMP_FLAG_TRY_FD_DUP	= 0x01
+	IOSTREAM_TEMP_FLAG_TRY_FD_DUP	= 0x01,
+	/* if the data was written to a temporary file, have
+	   iostream_temp_finish() return an mmap()ed istream for it. This
+	   avoids copying the data to istream buffers when it's read
+	   multiple times. */
+	IOSTREAM_TEMP_FLAG_MMAP		= 0x02,
+	/* when the data no longer fits to the memory buffer, write it to an
+	   anonymous memfd_create() file instead of to a file in the temp
+	   directory if possible. The memfds are moved to disk once all of
+	   the process's memfds would exceed a fixed total size. */
+	IOSTREAM_TEMP_FLAG_MEMFD	= 0x04
 };
 
 /* Start writing to given output stream. The data is initially written to
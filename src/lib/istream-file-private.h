@@ -20,4 +20,12 @@ i_stream_create_file_common(struct file_istream *fstream,
 ssize_t i_stream_file_read(struct istream_private *stream);
 void i_stream_file_close(struct iostream_private *stream, bool close_parent);
 
+/* Returns the fd if data can be read directly from it (e.g. with splice())
+   bypassing the istream, or -1 if not. This is possible only for plain
+   non-seekable fd istreams that have no buffered data. */
+int i_stream_file_get_direct_fd(struct istream *input);
+/* The caller read size bytes directly from the fd returned by
+   i_stream_file_get_direct_fd(). size=0 means that EOF was reached. */
+void i_stream_file_direct_read(struct istream *input, size_t size);
+
 #endif
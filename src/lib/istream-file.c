@@ -123,6 +123,35 @@ ssize_t i_stream_file_read(struct istream_private *stream)
 	return ret;
 }
 
+int i_stream_file_get_direct_fd(struct istream *input)
+{
+	struct istream_private *stream = input->real_stream;
+	struct file_istream *fstream = (struct file_istream *)stream;
+
+	if (stream->read != i_stream_file_read || fstream->file ||
+	    fstream->seen_eof || fstream->skip_left > 0 ||
+	    stream->skip != stream->pos)
+		return -1;
+	return stream->fd;
+}
+
+void i_stream_file_direct_read(struct istream *input, size_t size)
+{
+	struct istream_private *stream = input->real_stream;
+	struct file_istream *fstream = (struct file_istream *)stream;
+
+	i_assert(i_stream_file_get_direct_fd(input) != -1);
+
+	if (size == 0) {
+		input->eof = TRUE;
+		fstream->seen_eof = TRUE;
+	} else {
+		input->v_offset += size;
+		stream->skip = stream->pos = 0;
+		stream->last_read_timeval = ioloop_timeval;
+	}
+}
+
 static void i_stream_file_seek(struct istream_private *stream, uoff_t v_offset,
 			       bool mark ATTR_UNUSED)
 {
@@ -7,6 +7,7 @@
 #include "hex-dec.h"
 #include "unichar.h"
 #include "istream-jsonstr.h"
+#include "mem-scan.h"
 #include "json-parser.h"
 
 enum json_state {
@@ -172,32 +173,37 @@ static bool json_parse_whitespace(struct json_parser *parser)
 
 static int json_skip_string(struct json_parser *parser)
 {
-	for (; parser->data != parser->end; parser->data++) {
-		if (*parser->data == '"') {
-			parser->data++;
+	const unsigned char *p;
+
+	while (parser->data != parser->end) {
+		p = mem_find_chr2(parser->data, parser->end - parser->data,
+				  '"', '\\');
+		if (p == NULL || (*p == '\\' && p + 1 == parser->end)) {
+			/* wait for more data */
+			parser->data = parser->end;
+			break;
+		}
+		if (*p == '"') {
+			parser->data = p + 1;
 			json_parser_update_input_pos(parser);
 			return 1;
 		}
-		if (*parser->data == '\\') {
-			switch (*++parser->data) {
-			case '"':
-			case '\\':
-			case '/':
-			case 'b':
-			case 'f':
-			case 'n':
-			case 'r':
-			case 't':
-				break;
-			case 'u':
-				if (parser->end - parser->data < 4)
-					return -1;
-				parser->data += 3;
-				break;
-			default:
-				return -1;
-			}
+		switch (p[1]) {
+		case '"':
+		case '\\':
+		case '/':
+		case 'b':
+		case 'f':
+		case 'n':
+		case 'r':
+		case 't':
+		case 'u':
+			/* the \u hex digits are skipped as normal characters */
+			break;
+		default:
+			return -1;
 		}
+		parser->data = p + 2;
 	}
 	json_parser_update_input_pos(parser);
 	return 0;
@@ -277,6 +283,7 @@ static int json_parse_unicode_escape(struct json_parser *parser)
 static int json_parse_string(struct json_parser *parser, bool allow_skip,
 			     const char **value_r)
 {
+	const unsigned char *p;
 	int ret;
 
 	if (*parser->data != '"')
@@ -290,44 +297,50 @@ static int json_parse_string(struct json_parser *parser, bool allow_skip,
 
 	str_truncate(parser->value, 0);
 	for (; parser->data != parser->end; parser->data++) {
+		/* copy everything until the next '"' or '\\' */
+		p = mem_find_chr2(parser->data, parser->end - parser->data,
+				  '"', '\\');
+		if (p == NULL) {
+			parser->data = parser->end;
+			return 0;
+		}
+		str_append_data(parser->value, parser->data, p - parser->data);
+		parser->data = p;
+
 		if (*parser->data == '"') {
 			parser->data++;
 			*value_r = str_c(parser->value);
 			return 1;
 		}
-		if (*parser->data != '\\')
+		if (++parser->data == parser->end)
+			return 0;
+		switch (*parser->data) {
+		case '"':
+		case '\\':
+		case '/':
 			str_append_c(parser->value, *parser->data);
-		else {
-			if (++parser->data == parser->end)
-				return 0;
-			switch (*parser->data) {
-			case '"':
-			case '\\':
-			case '/':
-				str_append_c(parser->value, *parser->data);
-				break;
-			case 'b':
-				str_append_c(parser->value, '\b');
-				break;
-			case 'f':
-				str_append_c(parser->value, '\f');
-				break;
-			case 'n':
-				str_append_c(parser->value, '\n');
-				break;
-			case 'r':
-				str_append_c(parser->value, '\r');
-				break;
-			case 't':
-				str_append_c(parser->value, '\t');
-				break;
-			case 'u':
-				if ((ret=json_parse_unicode_escape(parser)) <= 0)
-					return ret;
-				break;
-			default:
-				return -1;
-			}
+			break;
+		case 'b':
+			str_append_c(parser->value, '\b');
+			break;
+		case 'f':
+			str_append_c(parser->value, '\f');
+			break;
+		case 'n':
+			str_append_c(parser->value, '\n');
+			break;
+		case 'r':
+			str_append_c(parser->value, '\r');
+			break;
+		case 't':
+			str_append_c(parser->value, '\t');
+			break;
+		case 'u':
+			if ((ret=json_parse_unicode_escape(parser)) <= 0)
+				return ret;
+			break;
+		default:
+			return -1;
 		}
 	}
 	return 0;
@@ -815,11 +828,21 @@ void json_append_escaped(string_t *dest, const char *src)
 
 void json_append_escaped_data(string_t *dest, const unsigned char *src, size_t size)
 {
+	const unsigned char *p;
 	size_t i;
 	int bytes = 0;
 	unichar_t chr;
 
 	for (i = 0; i < size;) {
+		/* copy everything that doesn't need escaping as-is */
+		p = mem_find_json_escape(src + i, size - i);
+		if (p == NULL) {
+			str_append_data(dest, src + i, size - i);
+			break;
+		}
+		str_append_data(dest, src + i, p - (src + i));
+		i = p - src;
+
 		bytes = uni_utf8_get_char_n(src+i, size-i, &chr);
 		/* refuse to add invalid data */
 		i_assert(bytes > 0 && uni_is_valid_ucs4(chr));
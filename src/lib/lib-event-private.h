@@ -15,6 +15,9 @@ struct event {
 	event_log_prefix_callback_t *log_prefix_callback;
 	void *log_prefix_callback_context;
 	enum log_type min_log_level;
+	/* Adds the fields lazily. Cleared once it's called. */
+	event_fields_callback_t *fields_callback;
+	void *fields_callback_context;
 	bool log_prefix_from_system_pool:1;
 	bool log_prefix_replace:1;
 	bool passthrough:1;
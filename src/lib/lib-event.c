@@ -22,6 +22,11 @@ enum event_code {
 	EVENT_CODE_FIELD_TIMEVAL	= 'T',
 };
 
+/* Most events fit into the pool's first block, so a cleared pool can be
+   reused for the next event without any further allocations. */
+#define EVENT_POOL_INITIAL_SIZE 1024
+#define EVENT_POOL_CACHE_MAX_COUNT 32
+
 extern const struct event_passthrough event_passthrough_vfuncs;
 
 static struct event *events = NULL;
@@ -32,6 +37,8 @@ static ARRAY(event_category_callback_t *) event_category_callbacks;
 static ARRAY(struct event_category *) event_registered_categories;
 static ARRAY(struct event *) global_event_stack;
 static uint64_t event_id_counter = 0;
+static pool_t event_pool_cache[EVENT_POOL_CACHE_MAX_COUNT];
+static unsigned int event_pool_cache_count = 0;
 
 static struct event *last_passthrough_event(void)
 {
@@ -54,6 +61,20 @@ event_find_category(struct event *event, const struct event_category *category);
 static struct event_field *
 event_find_field_int(struct event *event, const char *key);
 
+static void event_fields_resolve(const struct event *_event)
+{
+	/* the fields are logically already part of the event */
+	struct event *event = (struct event *)_event;
+	event_fields_callback_t *callback = event->fields_callback;
+
+	if (callback == NULL)
+		return;
+	event->fields_callback = NULL;
+	T_BEGIN {
+		callback(event, event->fields_callback_context);
+	} T_END;
+}
+
 void event_copy_categories_fields(struct event *to, struct event *from)
 {
 	unsigned int cat_count;
@@ -61,6 +82,7 @@ void event_copy_categories_fields(struct event *to, struct event *from)
 	while (cat_count-- > 0)
 		event_add_category(to, categories[cat_count]);
 	const struct event_field *fld;
+	event_fields_resolve(from);
 	if (!array_is_created(&from->fields))
 		return;
 	array_foreach(&from->fields, fld) {
@@ -97,6 +119,8 @@ bool event_has_all_categories(struct event *event, const struct event *other)
 bool event_has_all_fields(struct event *event, const struct event *other)
 {
 	struct event_field *fld;
+	event_fields_resolve(event);
+	event_fields_resolve(other);
 	if (!array_is_created(&other->fields))
 		return TRUE;
 	array_foreach_modifiable(&other->fields, fld) {
@@ -118,12 +142,34 @@ struct event *event_dup(const struct event *source)
 	return ret;
 }
 
+static pool_t event_pool_get(void)
+{
+	if (event_pool_cache_count > 0)
+		return event_pool_cache[--event_pool_cache_count];
+	return pool_alloconly_create(MEMPOOL_GROWING"event",
+				     EVENT_POOL_INITIAL_SIZE);
+}
+
+static void event_pool_put(pool_t *_pool)
+{
+	pool_t pool = *_pool;
+
+	*_pool = NULL;
+	if (event_pool_cache_count == N_ELEMENTS(event_pool_cache)) {
+		pool_unref(&pool);
+		return;
+	}
+	/* this frees all but the first block */
+	p_clear(pool);
+	event_pool_cache[event_pool_cache_count++] = pool;
+}
+
 #undef event_create
 struct event *event_create(struct event *parent, const char *source_filename,
 			   unsigned int source_linenum)
 {
 	struct event *event;
-	pool_t pool = pool_alloconly_create(MEMPOOL_GROWING"event", 64);
+	pool_t pool = event_pool_get();
 
 	event = p_new(pool, struct event, 1);
 	event->event_passthrough = event_passthrough_vfuncs;
@@ -234,7 +280,7 @@ void event_unref(struct event **_event)
 	event_unref(&event->parent);
 
 	DLLIST_REMOVE(&events, event);
-	pool_unref(&event->pool);
+	event_pool_put(&event->pool);
 }
 
 struct event *events_get_head(void)
@@ -453,7 +499,10 @@ event_find_field_int(struct event *event, const char *key)
 const struct event_field *
 event_find_field(struct event *event, const char *key)
 {
-	const struct event_field *field = event_find_field_int(event, key);
+	const struct event_field *field;
+
+	event_fields_resolve(event);
+	field = event_find_field_int(event, key);
 	if (field != NULL || event->parent == NULL)
 		return field;
 	return event_find_field(event->parent, key);
@@ -530,6 +579,7 @@ event_inc_int(struct event *event, const char *key, intmax_t num)
 {
 	struct event_field *field;
 
+	event_fields_resolve(event);
 	field = event_find_field_int(event, key);
 	if (field == NULL || field->value_type != EVENT_FIELD_VALUE_TYPE_INTMAX)
 		return event_add_int(event, key, num);
@@ -566,6 +616,15 @@ event_add_fields(struct event *event,
 	return event;
 }
 
+#undef event_set_fields_callback
+void event_set_fields_callback(struct event *event,
+			       event_fields_callback_t *callback,
+			       void *context)
+{
+	event->fields_callback = callback;
+	event->fields_callback_context = context;
+}
+
 void event_field_clear(struct event *event, const char *key)
 {
 	event_add_str(event, key, "");
@@ -599,6 +658,7 @@ void event_get_last_duration(struct event *event, intmax_t *duration_r)
 const struct event_field *
 event_get_fields(struct event *event, unsigned int *count_r)
 {
+	event_fields_resolve(event);
 	if (!array_is_created(&event->fields)) {
 		*count_r = 0;
 		return NULL;
@@ -712,6 +772,7 @@ void event_export(const struct event *event, string_t *dest)
 		}
 	}
 
+	event_fields_resolve(event);
 	if (array_is_created(&event->fields)) {
 		const struct event_field *field;
 		array_foreach(&event->fields, field) {
@@ -1056,4 +1117,6 @@ void lib_event_deinit(void)
 	array_free(&event_category_callbacks);
 	array_free(&event_registered_categories);
 	array_free(&global_event_stack);
+	while (event_pool_cache_count > 0)
+		pool_unref(&event_pool_cache[--event_pool_cache_count]);
 }
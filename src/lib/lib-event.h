@@ -78,6 +78,7 @@ struct event_passthrough {
 };
 
 typedef const char *event_log_prefix_callback_t(void *context);
+typedef void event_fields_callback_t(struct event *event, void *context);
 
 /* Returns TRUE if the event has all the categories that the "other" event has (and maybe more). */
 bool event_has_all_categories(struct event *event, const struct event *other);
@@ -220,6 +221,19 @@ event_add_timeval(struct event *event, const char *key,
    terminates with key=NULL. Returns the event parameter. */
 struct event *
 event_add_fields(struct event *event, const struct event_add_field *fields);
+/* Add the event's fields via the callback only once they're needed, i.e.
+   when a filter, event_find_field*(), event_get_fields() or event_export()
+   looks at them. This avoids formatting the values for events that nobody
+   is interested in. The callback is called at most once, and the fields it
+   adds replace earlier fields with the same key. The context must stay
+   valid until the event is freed or the callback is replaced. */
+void event_set_fields_callback(struct event *event,
+			       event_fields_callback_t *callback,
+			       void *context);
+#define event_set_fields_callback(_event, callback, context) \
+	event_set_fields_callback(_event, (event_fields_callback_t *)callback, \
+		context + CALLBACK_TYPECHECK(callback, \
+			void (*)(struct event *, typeof(context))))
 /* Mark a field as nonexistent. If a parent event has the field set, this
    allows removing it from the child event. Using an event filter with e.g.
    "key=*" won't match this field anymore, although it's still visible in
@@ -0,0 +1,196 @@
+/* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "mem-scan.h"
+
+/* The SIMD instruction set is selected at compile time. Each vector
+   comparison is turned into a bitmask with MEM_VEC_BITS_PER_BYTE bits for
+   each byte: x86 has movemask for this, NEON needs a narrowing shift that
+   gives 4 bits per byte. */
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#  define MEM_VEC_SIZE 32
+#  define MEM_VEC_BITS_PER_BYTE 1
+typedef __m256i mem_vec_t;
+#  define mem_vec_load(p) _mm256_loadu_si256((const void *)(p))
+#  define mem_vec_set1(c) _mm256_set1_epi8(c)
+#  define mem_vec_eq_mask(v, c) \
+	((uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, c)))
+#  define mem_vec_lt_signed_mask(v, c) \
+	((uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(c, v)))
+#elif defined(__SSE2__)
+#  include <emmintrin.h>
+#  define MEM_VEC_SIZE 16
+#  define MEM_VEC_BITS_PER_BYTE 1
+typedef __m128i mem_vec_t;
+#  define mem_vec_load(p) _mm_loadu_si128((const void *)(p))
+#  define mem_vec_set1(c) _mm_set1_epi8(c)
+#  define mem_vec_eq_mask(v, c) \
+	((uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, c)))
+#  define mem_vec_lt_signed_mask(v, c) \
+	((uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmplt_epi8(v, c)))
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#  include <arm_neon.h>
+#  define MEM_VEC_SIZE 16
+#  define MEM_VEC_BITS_PER_BYTE 4
+typedef uint8x16_t mem_vec_t;
+#  define mem_vec_load(p) vld1q_u8(p)
+#  define mem_vec_set1(c) vdupq_n_u8(c)
+static inline uint64_t mem_vec_to_mask(uint8x16_t m)
+{
+	return vget_lane_u64(vreinterpret_u64_u8(
+		vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+}
+#  define mem_vec_eq_mask(v, c) mem_vec_to_mask(vceqq_u8(v, c))
+#  define mem_vec_lt_signed_mask(v, c) \
+	mem_vec_to_mask(vcltq_s8(vreinterpretq_s8_u8(v), \
+				 vreinterpretq_s8_u8(c)))
+#endif
+
+#ifdef MEM_VEC_SIZE
+#define MEM_VEC_MASK_LAST_SHIFT \
+	((MEM_VEC_SIZE - 1) * MEM_VEC_BITS_PER_BYTE)
+#define MEM_VEC_MASK_BYTE ((1U << MEM_VEC_BITS_PER_BYTE) - 1)
+
+#if __GNUC__ > 3 || (__GNUC__ == 3 && __GNUC_MINOR__ >= 4)
+#  define mem_ctz64(mask) ((unsigned int)__builtin_ctzll(mask))
+#  define mem_popcount64(mask) ((unsigned int)__builtin_popcountll(mask))
+#else
+static unsigned int mem_ctz64(uint64_t mask)
+{
+	unsigned int n = 0;
+
+	i_assert(mask != 0);
+	for (; (mask & 1) == 0; mask >>= 1)
+		n++;
+	return n;
+}
+
+static unsigned int mem_popcount64(uint64_t mask)
+{
+	unsigned int n = 0;
+
+	for (; mask != 0; mask &= mask - 1)
+		n++;
+	return n;
+}
+#endif
+#endif
+
+const void *mem_find_crlf(const void *data, size_t size)
+{
+	const unsigned char *p = data, *end = p + size;
+#ifdef MEM_VEC_SIZE
+	const mem_vec_t cr = mem_vec_set1('\r'), lf = mem_vec_set1('\n');
+	mem_vec_t v;
+	uint64_t mask;
+
+	for (; (size_t)(end - p) >= MEM_VEC_SIZE; p += MEM_VEC_SIZE) {
+		v = mem_vec_load(p);
+		mask = mem_vec_eq_mask(v, cr) | mem_vec_eq_mask(v, lf);
+		if (mask != 0)
+			return p + mem_ctz64(mask) / MEM_VEC_BITS_PER_BYTE;
+	}
+#endif
+	for (; p < end; p++) {
+		if (*p == '\r' || *p == '\n')
+			return p;
+	}
+	return NULL;
+}
+
+const void *mem_find_chr2(const void *data, size_t size,
+			  unsigned char c1, unsigned char c2)
+{
+	const unsigned char *p = data, *end = p + size;
+#ifdef MEM_VEC_SIZE
+	const mem_vec_t v1 = mem_vec_set1(c1), v2 = mem_vec_set1(c2);
+	mem_vec_t v;
+	uint64_t mask;
+
+	for (; (size_t)(end - p) >= MEM_VEC_SIZE; p += MEM_VEC_SIZE) {
+		v = mem_vec_load(p);
+		mask = mem_vec_eq_mask(v, v1) | mem_vec_eq_mask(v, v2);
+		if (mask != 0)
+			return p + mem_ctz64(mask) / MEM_VEC_BITS_PER_BYTE;
+	}
+#endif
+	for (; p < end; p++) {
+		if (*p == c1 || *p == c2)
+			return p;
+	}
+	return NULL;
+}
+
+const void *mem_find_json_escape(const void *data, size_t size)
+{
+	const unsigned char *p = data, *end = p + size;
+#ifdef MEM_VEC_SIZE
+	const mem_vec_t quote = mem_vec_set1('"'), bslash = mem_vec_set1('\\');
+	/* as signed bytes, both control characters and 8bit bytes are
+	   below 0x20 */
+	const mem_vec_t space = mem_vec_set1(0x20);
+	mem_vec_t v;
+	uint64_t mask;
+
+	for (; (size_t)(end - p) >= MEM_VEC_SIZE; p += MEM_VEC_SIZE) {
+		v = mem_vec_load(p);
+		mask = mem_vec_eq_mask(v, quote) | mem_vec_eq_mask(v, bslash) |
+			mem_vec_lt_signed_mask(v, space);
+		if (mask != 0)
+			return p + mem_ctz64(mask) / MEM_VEC_BITS_PER_BYTE;
+	}
+#endif
+	for (; p < end; p++) {
+		if (*p < 0x20 || *p >= 0x80 || *p == '"' || *p == '\\')
+			return p;
+	}
+	return NULL;
+}
+
+void mem_count_lfs(const void *data, size_t size, unsigned char prev,
+		   struct mem_lf_counts *counts)
+{
+	const unsigned char *p = data, *end = p + size;
+#ifdef MEM_VEC_SIZE
+	const mem_vec_t cr = mem_vec_set1('\r'), lf = mem_vec_set1('\n');
+	const mem_vec_t nul = mem_vec_set1('\0');
+	uint64_t lf_mask, cr_mask, prev_cr_mask;
+	uint64_t prev_cr = prev == '\r' ? MEM_VEC_MASK_BYTE : 0;
+	mem_vec_t v;
+
+	for (; (size_t)(end - p) >= MEM_VEC_SIZE; p += MEM_VEC_SIZE) {
+		v = mem_vec_load(p);
+		lf_mask = mem_vec_eq_mask(v, lf);
+		cr_mask = mem_vec_eq_mask(v, cr);
+		if (lf_mask != 0) {
+			/* CR positions shifted to the following byte */
+			prev_cr_mask = (cr_mask << MEM_VEC_BITS_PER_BYTE) |
+				prev_cr;
+			counts->lf_count +=
+				mem_popcount64(lf_mask) / MEM_VEC_BITS_PER_BYTE;
+			counts->bare_lf_count +=
+				mem_popcount64(lf_mask & ~prev_cr_mask) /
+				MEM_VEC_BITS_PER_BYTE;
+		}
+		if (!counts->have_nuls && mem_vec_eq_mask(v, nul) != 0)
+			counts->have_nuls = TRUE;
+		prev_cr = (cr_mask >> MEM_VEC_MASK_LAST_SHIFT) &
+			MEM_VEC_MASK_BYTE;
+	}
+	if (p != data)
+		prev = p[-1];
+#endif
+	for (; p < end; p++) {
+		if (*p <= '\n') {
+			if (*p == '\n') {
+				counts->lf_count++;
+				if (prev != '\r')
+					counts->bare_lf_count++;
+			} else if (*p == '\0') {
+				counts->have_nuls = TRUE;
+			}
+		}
+		prev = *p;
+	}
+}
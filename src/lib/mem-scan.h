@@ -0,0 +1,34 @@
+#ifndef MEM_SCAN_H
+#define MEM_SCAN_H
+
+/* Fast scanning for line endings and other special characters. These are
+   vectorized when compiled for a CPU with SSE2, AVX2 or (aarch64) NEON
+   support. */
+
+struct mem_lf_counts {
+	/* Number of LFs */
+	size_t lf_count;
+	/* Number of LFs not preceded by CR */
+	size_t bare_lf_count;
+	/* At least one NUL byte was seen */
+	bool have_nuls;
+};
+
+/* Returns pointer to the first CR or LF in data, or NULL if there are
+   none. */
+const void *mem_find_crlf(const void *data, size_t size);
+/* Returns pointer to the first c1 or c2 in data, or NULL if there are
+   none. */
+const void *mem_find_chr2(const void *data, size_t size,
+			  unsigned char c1, unsigned char c2);
+/* Returns pointer to the first byte that can't be written as-is inside a
+   JSON string: '"', '\\', control characters and 8bit bytes. Returns NULL
+   if there are none. */
+const void *mem_find_json_escape(const void *data, size_t size);
+
+/* Count LFs in data and add them to counts. prev is the byte preceding
+   data[0], which is used to find out whether the first LF is bare. */
+void mem_count_lfs(const void *data, size_t size, unsigned char prev,
+		   struct mem_lf_counts *counts);
+
+#endif
@@ -0,0 +1,349 @@
+/* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
+
+/* @UNSAFE: whole file */
+#include "lib.h"
+#include "mempool.h"
+#include "llist.h"
+
+/*
+ * Slab pools support both allocating and freeing memory, like allocfree
+ * pools, but small allocations are carved out of larger pages instead of
+ * being malloc()ed one at a time.
+ *
+ * Implementation
+ * ==============
+ *
+ * Each allocation is preceded by a chunk header (struct slab_chunk), which
+ * remembers the size class the chunk belongs to.
+ *
+ * Allocations up to SLAB_MAX_CLASS_SIZE bytes are rounded up to the nearest
+ * size class (a power of two).  Each size class has its own free list of
+ * chunks.  When a free list is empty, a new page of SLAB_PAGE_SIZE bytes is
+ * allocated and split into chunks of that size class.  The pages are kept in
+ * a singly-linked list so that they can be released all at once.
+ *
+ * Larger allocations are malloc()ed individually and kept in a
+ * doubly-linked list, just like in allocfree pools.
+ *
+ * Freeing a small chunk simply pushes it to the front of its size class'
+ * free list.  The page memory is returned to the system only when the pool
+ * is cleared or destroyed.
+ *
+ * Reallocation returns the same chunk if the new size still fits into it.
+ * Otherwise a new chunk is allocated, the data is copied to it and the old
+ * one is freed.
+ *
+ * Clearing frees all the pages and large allocations and empties the free
+ * lists.
+ *
+ * The pool isn't meant for allocations that stay at their peak size for a
+ * long time: freed small chunks are never given back to the system until the
+ * pool is cleared.
+ */
+
+#define SLAB_MIN_CLASS_SHIFT 4 /* 16 bytes */
+#define SLAB_CLASS_COUNT 7 /* up to 1024 bytes */
+#define SLAB_MAX_CLASS_SIZE \
+	((size_t)1 << (SLAB_MIN_CLASS_SHIFT + SLAB_CLASS_COUNT - 1))
+#define SLAB_PAGE_SIZE (1024*16)
+#define SLAB_CLASS_LARGE SLAB_CLASS_COUNT
+
+struct slab_chunk {
+	/* free list (small chunks) or a list of large allocations */
+	struct slab_chunk *prev, *next;
+	/* requested size for large allocations */
+	size_t size;
+	unsigned int class_idx;
+};
+
+struct slab_page {
+	struct slab_page *next;
+};
+
+struct slab_pool {
+	struct pool pool;
+	int refcount;
+	size_t total_alloc_used;
+
+	struct slab_page *pages;
+	size_t pages_count;
+	struct slab_chunk *free_chunks[SLAB_CLASS_COUNT];
+	struct slab_chunk *large_chunks;
+#ifdef DEBUG
+	char *name;
+#endif
+};
+
+#define SIZEOF_SLAB_POOL MEM_ALIGN(sizeof(struct slab_pool))
+#define SIZEOF_SLAB_PAGE MEM_ALIGN(sizeof(struct slab_page))
+#define SIZEOF_SLAB_CHUNK MEM_ALIGN(sizeof(struct slab_chunk))
+
+#define SLAB_CLASS_SIZE(class_idx) \
+	((size_t)1 << (SLAB_MIN_CLASS_SHIFT + (class_idx)))
+#define SLAB_CHUNK_DATA(chunk) \
+	PTR_OFFSET(chunk, SIZEOF_SLAB_CHUNK)
+
+static const char *pool_slab_get_name(pool_t pool);
+static void pool_slab_ref(pool_t pool);
+static void pool_slab_unref(pool_t *pool);
+static void *pool_slab_malloc(pool_t pool, size_t size);
+static void pool_slab_free(pool_t pool, void *mem);
+static void *pool_slab_realloc(pool_t pool, void *mem,
+			       size_t old_size, size_t new_size);
+static void pool_slab_clear(pool_t pool);
+static size_t pool_slab_get_max_easy_alloc_size(pool_t pool);
+
+static const struct pool_vfuncs static_slab_pool_vfuncs = {
+	pool_slab_get_name,
+
+	pool_slab_ref,
+	pool_slab_unref,
+
+	pool_slab_malloc,
+	pool_slab_free,
+
+	pool_slab_realloc,
+
+	pool_slab_clear,
+	pool_slab_get_max_easy_alloc_size
+};
+
+static const struct pool static_slab_pool = {
+	.v = &static_slab_pool_vfuncs,
+
+	.alloconly_pool = FALSE,
+	.datastack_pool = FALSE
+};
+
+pool_t pool_slab_create(const char *name ATTR_UNUSED)
+{
+	struct slab_pool *pool;
+
+	if (SIZEOF_SLAB_CHUNK > (SSIZE_T_MAX - POOL_MAX_ALLOC_SIZE))
+		i_panic("POOL_MAX_ALLOC_SIZE is too large");
+
+	pool = calloc(1, SIZEOF_SLAB_POOL);
+	if (pool == NULL)
+		i_fatal_status(FATAL_OUTOFMEM, "calloc(1, %"PRIuSIZE_T"): Out of memory",
+			       SIZEOF_SLAB_POOL);
+#ifdef DEBUG
+	pool->name = strdup(name);
+#endif
+	pool->pool = static_slab_pool;
+	pool->refcount = 1;
+	return &pool->pool;
+}
+
+static void pool_slab_destroy(struct slab_pool *spool)
+{
+	pool_slab_clear(&spool->pool);
+#ifdef DEBUG
+	free(spool->name);
+#endif
+	free(spool);
+}
+
+static const char *pool_slab_get_name(pool_t pool ATTR_UNUSED)
+{
+#ifdef DEBUG
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	return spool->name;
+#else
+	return "slab";
+#endif
+}
+
+static void pool_slab_ref(pool_t pool)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	i_assert(spool->refcount > 0);
+
+	spool->refcount++;
+}
+
+static void pool_slab_unref(pool_t *_pool)
+{
+	pool_t pool = *_pool;
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	i_assert(spool->refcount > 0);
+
+	/* erase the pointer before freeing anything, as the pointer may
+	   exist inside the pool's memory area */
+	*_pool = NULL;
+
+	if (--spool->refcount > 0)
+		return;
+
+	pool_slab_destroy(spool);
+}
+
+static unsigned int pool_slab_get_class(size_t size)
+{
+	unsigned int class_idx = 0;
+
+	while (SLAB_CLASS_SIZE(class_idx) < size)
+		class_idx++;
+	return class_idx;
+}
+
+static void pool_slab_add_page(struct slab_pool *spool, unsigned int class_idx)
+{
+	const size_t chunk_size =
+		SIZEOF_SLAB_CHUNK + SLAB_CLASS_SIZE(class_idx);
+	struct slab_page *page;
+	struct slab_chunk *chunk;
+	size_t pos;
+
+	page = malloc(SLAB_PAGE_SIZE);
+	if (page == NULL)
+		i_fatal_status(FATAL_OUTOFMEM, "malloc(%u): Out of memory",
+			       SLAB_PAGE_SIZE);
+	page->next = spool->pages;
+	spool->pages = page;
+	spool->pages_count++;
+
+	for (pos = SIZEOF_SLAB_PAGE; pos + chunk_size <= SLAB_PAGE_SIZE;
+	     pos += chunk_size) {
+		chunk = PTR_OFFSET(page, pos);
+		chunk->class_idx = class_idx;
+		chunk->next = spool->free_chunks[class_idx];
+		spool->free_chunks[class_idx] = chunk;
+	}
+}
+
+static struct slab_chunk *pool_slab_get_chunk(void *mem)
+{
+	struct slab_chunk *chunk = PTR_OFFSET(mem, -SIZEOF_SLAB_CHUNK);
+
+	i_assert(chunk->class_idx <= SLAB_CLASS_LARGE);
+	return chunk;
+}
+
+static void *pool_slab_malloc(pool_t pool, size_t size)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	struct slab_chunk *chunk;
+	unsigned int class_idx;
+
+	if (size > SLAB_MAX_CLASS_SIZE) {
+		chunk = calloc(1, SIZEOF_SLAB_CHUNK + size);
+		if (chunk == NULL)
+			i_fatal_status(FATAL_OUTOFMEM, "calloc(1, %"PRIuSIZE_T"): Out of memory",
+				       SIZEOF_SLAB_CHUNK + size);
+		chunk->class_idx = SLAB_CLASS_LARGE;
+		chunk->size = size;
+		DLLIST_PREPEND(&spool->large_chunks, chunk);
+		spool->total_alloc_used += size;
+		return SLAB_CHUNK_DATA(chunk);
+	}
+
+	class_idx = pool_slab_get_class(size);
+	if (spool->free_chunks[class_idx] == NULL)
+		pool_slab_add_page(spool, class_idx);
+	chunk = spool->free_chunks[class_idx];
+	spool->free_chunks[class_idx] = chunk->next;
+	chunk->next = NULL;
+
+	spool->total_alloc_used += SLAB_CLASS_SIZE(class_idx);
+	memset(SLAB_CHUNK_DATA(chunk), 0, size);
+	return SLAB_CHUNK_DATA(chunk);
+}
+
+static void pool_slab_free(pool_t pool, void *mem)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	struct slab_chunk *chunk = pool_slab_get_chunk(mem);
+
+	if (chunk->class_idx == SLAB_CLASS_LARGE) {
+		i_assert(spool->total_alloc_used >= chunk->size);
+		spool->total_alloc_used -= chunk->size;
+		DLLIST_REMOVE(&spool->large_chunks, chunk);
+		free(chunk);
+		return;
+	}
+
+	i_assert(spool->total_alloc_used >= SLAB_CLASS_SIZE(chunk->class_idx));
+	spool->total_alloc_used -= SLAB_CLASS_SIZE(chunk->class_idx);
+	chunk->next = spool->free_chunks[chunk->class_idx];
+	spool->free_chunks[chunk->class_idx] = chunk;
+}
+
+static void *pool_slab_realloc(pool_t pool, void *mem,
+			       size_t old_size, size_t new_size)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	struct slab_chunk *chunk = pool_slab_get_chunk(mem);
+	unsigned char *new_mem;
+
+	if (chunk->class_idx == SLAB_CLASS_LARGE &&
+	    new_size > SLAB_MAX_CLASS_SIZE) {
+		DLLIST_REMOVE(&spool->large_chunks, chunk);
+		spool->total_alloc_used -= chunk->size;
+		new_mem = realloc(chunk, SIZEOF_SLAB_CHUNK + new_size);
+		if (new_mem == NULL)
+			i_fatal_status(FATAL_OUTOFMEM, "realloc(block, %"PRIuSIZE_T")",
+				       SIZEOF_SLAB_CHUNK + new_size);
+		chunk = (struct slab_chunk *)new_mem;
+		chunk->size = new_size;
+		DLLIST_PREPEND(&spool->large_chunks, chunk);
+		spool->total_alloc_used += new_size;
+	} else if (chunk->class_idx != SLAB_CLASS_LARGE &&
+		   new_size <= SLAB_CLASS_SIZE(chunk->class_idx)) {
+		/* still fits into the same chunk */
+	} else {
+		new_mem = pool_slab_malloc(pool, new_size);
+		memcpy(new_mem, mem, I_MIN(old_size, new_size));
+		pool_slab_free(pool, mem);
+		return new_mem;
+	}
+
+	/* zero out new memory */
+	if (new_size > old_size) {
+		memset(PTR_OFFSET(SLAB_CHUNK_DATA(chunk), old_size), 0,
+		       new_size - old_size);
+	}
+	return SLAB_CHUNK_DATA(chunk);
+}
+
+static void pool_slab_clear(pool_t pool)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	struct slab_page *page;
+	struct slab_chunk *chunk;
+
+	while (spool->large_chunks != NULL) {
+		chunk = spool->large_chunks;
+		spool->large_chunks = chunk->next;
+		free(chunk);
+	}
+	while (spool->pages != NULL) {
+		page = spool->pages;
+		spool->pages = page->next;
+		free(page);
+	}
+	spool->pages_count = 0;
+	memset(spool->free_chunks, 0, sizeof(spool->free_chunks));
+	spool->total_alloc_used = 0;
+}
+
+static size_t pool_slab_get_max_easy_alloc_size(pool_t pool ATTR_UNUSED)
+{
+	return 0;
+}
+
+size_t pool_slab_get_total_used_size(pool_t pool)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	return spool->total_alloc_used;
+}
+
+size_t pool_slab_get_total_alloc_size(pool_t pool)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	const struct slab_chunk *chunk;
+	size_t size = spool->pages_count * SLAB_PAGE_SIZE + sizeof(*spool);
+
+	for (chunk = spool->large_chunks; chunk != NULL; chunk = chunk->next)
+		size += SIZEOF_SLAB_CHUNK + chunk->size;
+	return size;
+}
@@ -81,6 +81,12 @@ pool_t pool_allocfree_create(const char *name);
    See pool_alloconly_create_clean. */
 pool_t pool_allocfree_create_clean(const char *name);
 
+/* Create a new slab pool. It's like the alloc pool, but small allocations
+   are taken from per-size-class free lists of larger pages, which makes
+   allocating and freeing them much cheaper. Freed memory isn't returned to
+   the system until the pool is cleared or destroyed. */
+pool_t pool_slab_create(const char *name);
+
 /* Similar to nearest_power(), but try not to exceed buffer's easy
    allocation size. If you don't have any explicit minimum size, use
    old_size + 1. */
@@ -173,6 +179,12 @@ size_t pool_allocfree_get_total_used_size(pool_t pool);
 /* Returns how much system memory has been allocated for this pool. */
 size_t pool_allocfree_get_total_alloc_size(pool_t pool);
 
+/* Returns how much memory has been allocated from this pool. Small
+   allocations are counted with their size class' size. */
+size_t pool_slab_get_total_used_size(pool_t pool);
+/* Returns how much system memory has been allocated for this pool. */
+size_t pool_slab_get_total_alloc_size(pool_t pool);
+
 /* private: */
 void pool_system_free(pool_t pool, void *mem);
 
@@ -19,12 +19,16 @@ struct file_ostream {
 	size_t buffer_size, optimal_block_size;
 	size_t head, tail; /* first unsent/unused byte */
 
+	/* pipe used for moving data from fd istreams with splice() */
+	int splice_pipe[2];
+
 	bool full:1; /* if head == tail, is buffer empty or full? */
 	bool file:1;
 	bool flush_pending:1;
 	bool socket_cork_set:1;
 	bool no_socket_cork:1;
 	bool no_sendfile:1;
+	bool no_splice:1;
 	bool autoclose_fd:1;
 };
 
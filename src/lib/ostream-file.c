@@ -2,16 +2,18 @@
 
 /* @UNSAFE: whole file */
 
+#define _GNU_SOURCE /* for splice() */
 #include "lib.h"
 #include "ioloop.h"
 #include "write-full.h"
 #include "net.h"
 #include "sendfile-util.h"
 #include "istream.h"
-#include "istream-private.h"
+#include "istream-file-private.h"
 #include "ostream-file-private.h"
 
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #ifdef HAVE_SYS_UIO_H
 #  include <sys/uio.h>
@@ -28,6 +30,13 @@
 #define MAX_SSIZE_T(size) \
 	((size) < SSIZE_T_MAX ? (size_t)(size) : SSIZE_T_MAX)
 
+/* Maximum amount of data moved with splice() at a time. This is the default
+   Linux pipe capacity, so the pipe never blocks. */
+#define MAX_SPLICE_SIZE (64*1024)
+/* Max number of iovecs that o_stream_sendv() writes together with the
+   buffered data */
+#define MAX_MERGED_SENDV_IOV_COUNT 8
+
 static void stream_send_io(struct file_ostream *fstream);
 static struct ostream * o_stream_create_fd_common(int fd,
 		size_t max_buffer_size, bool autoclose_fd);
@@ -59,6 +68,10 @@ static void o_stream_file_destroy(struct iostream_private *stream)
 {
 	struct file_ostream *fstream = (struct file_ostream *)stream;
 
+	if (fstream->splice_pipe[0] != -1) {
+		i_close_fd(&fstream->splice_pipe[0]);
+		i_close_fd(&fstream->splice_pipe[1]);
+	}
 	i_free(fstream->buffer);
 }
 
@@ -546,6 +559,37 @@ static size_t o_stream_add(struct file_ostream *fstream,
 	return sent;
 }
 
+/* Write the buffered data and the given iovecs with a single writev().
+   Returns how much of the iovecs' data was written, or -1 on error. */
+static ssize_t
+o_stream_file_writev_with_buffer(struct file_ostream *fstream,
+				 const struct const_iovec *iov,
+				 unsigned int iov_count)
+{
+	struct const_iovec full_iov[2 + MAX_MERGED_SENDV_IOV_COUNT];
+	size_t buffered;
+	ssize_t ret;
+	int buf_iov_count;
+
+	i_assert(iov_count <= MAX_MERGED_SENDV_IOV_COUNT);
+
+	buffered = file_buffer_get_used_size(fstream);
+	buf_iov_count = o_stream_fill_iovec(fstream, full_iov);
+	i_assert(buf_iov_count > 0);
+	memcpy(full_iov + buf_iov_count, iov, sizeof(*iov) * iov_count);
+
+	ret = o_stream_file_writev_full(fstream, full_iov,
+					buf_iov_count + iov_count);
+	if (ret < 0)
+		return -1;
+	if ((size_t)ret < buffered) {
+		update_buffer(fstream, ret);
+		return 0;
+	}
+	update_buffer(fstream, buffered);
+	return ret - buffered;
+}
+
 ssize_t o_stream_file_sendv(struct ostream_private *stream,
 				   const struct const_iovec *iov,
 				   unsigned int iov_count)
@@ -553,6 +597,7 @@ ssize_t o_stream_file_sendv(struct ostream_private *stream,
 	struct file_ostream *fstream = (struct file_ostream *)stream;
 	size_t size, total_size, added, optimal_size;
 	unsigned int i;
+	bool written = FALSE;
 	ssize_t ret = 0;
 
 	for (i = 0, size = 0; i < iov_count; i++)
@@ -560,19 +605,33 @@ ssize_t o_stream_file_sendv(struct ostream_private *stream,
 	total_size = size;
 
 	if (size > get_unused_space(fstream) && !IS_STREAM_EMPTY(fstream)) {
-		if (o_stream_file_flush(stream) < 0)
-			return -1;
+		if (iov_count > MAX_MERGED_SENDV_IOV_COUNT) {
+			if (o_stream_file_flush(stream) < 0)
+				return -1;
+		} else {
+			/* Flushing the buffer separately would need two
+			   syscalls. The new data is written only after all
+			   the buffered data is, so the order stays the same
+			   even with partial writes. */
+			ret = o_stream_file_writev_with_buffer(fstream, iov,
+							       iov_count);
+			if (ret < 0)
+				return -1;
+			written = TRUE;
+		}
 	}
 
 	optimal_size = I_MIN(fstream->optimal_block_size,
 			     fstream->ostream.max_buffer_size);
-	if (IS_STREAM_EMPTY(fstream) &&
+	if (!written && IS_STREAM_EMPTY(fstream) &&
 	    (!stream->corked || size >= optimal_size)) {
 		/* send immediately */
 		ret = o_stream_file_writev_full(fstream, iov, iov_count);
 		if (ret < 0)
 			return -1;
-
+		written = TRUE;
+	}
+	if (written) {
 		size = ret;
 		while (size > 0 && iov_count > 0 && size >= iov[0].iov_len) {
 			size -= iov[0].iov_len;
@@ -790,6 +849,139 @@ io_stream_sendfile(struct ostream_private *outstream,
 	return TRUE;
 }
 
+#ifdef HAVE_SPLICE
+static int o_stream_file_splice_pipe_init(struct file_ostream *foutstream)
+{
+	if (foutstream->splice_pipe[0] != -1)
+		return 0;
+
+	if (pipe(foutstream->splice_pipe) < 0) {
+		i_error("pipe() failed: %m");
+		foutstream->splice_pipe[0] = foutstream->splice_pipe[1] = -1;
+		return -1;
+	}
+	fd_set_nonblock(foutstream->splice_pipe[0], TRUE);
+	fd_set_nonblock(foutstream->splice_pipe[1], TRUE);
+	fd_close_on_exec(foutstream->splice_pipe[0], TRUE);
+	fd_close_on_exec(foutstream->splice_pipe[1], TRUE);
+	return 0;
+}
+
+static int
+o_stream_file_splice_buffer_rest(struct file_ostream *foutstream, size_t size)
+{
+	struct ostream_private *outstream = &foutstream->ostream;
+	unsigned char *data;
+	ssize_t ret;
+
+	/* The output can't take more data right now. Move the rest of the
+	   data in the pipe to our buffer, so it gets sent the same way as
+	   any other buffered data. This is the only time the data gets
+	   copied to userspace. */
+	i_assert(IS_STREAM_EMPTY(foutstream));
+	i_assert(size <= outstream->max_buffer_size);
+
+	data = t_malloc_no0(size);
+	ret = read(foutstream->splice_pipe[0], data, size);
+	if (ret < 0) {
+		io_stream_set_error(&outstream->iostream,
+				    "read(splice pipe) failed: %m");
+		outstream->ostream.stream_errno = errno;
+		return -1;
+	}
+	i_assert((size_t)ret == size);
+	if (o_stream_add(foutstream, data, size) != size)
+		i_unreached();
+	outstream->ostream.offset += size;
+	return 0;
+}
+
+static bool
+io_stream_splice(struct ostream_private *outstream,
+		 struct istream *instream, int in_fd,
+		 enum ostream_send_istream_result *res_r)
+{
+	struct file_ostream *foutstream = (struct file_ostream *)outstream;
+	size_t max_size, left;
+	ssize_t ret;
+
+	if (o_stream_file_splice_pipe_init(foutstream) < 0)
+		return FALSE;
+
+	o_stream_socket_cork(foutstream);
+
+	/* flush out any data in buffer */
+	if ((ret = buffer_flush(foutstream)) < 0) {
+		*res_r = OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT;
+		return TRUE;
+	} else if (ret == 0) {
+		*res_r = OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT;
+		return TRUE;
+	}
+
+	/* never move more data than can be buffered, so whatever doesn't
+	   get written can still be moved to the buffer */
+	max_size = I_MIN(outstream->max_buffer_size, MAX_SPLICE_SIZE);
+	for (;;) {
+		ret = splice(in_fd, NULL, foutstream->splice_pipe[1], NULL,
+			     max_size, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (ret == 0) {
+			i_stream_file_direct_read(instream, 0);
+			*res_r = OSTREAM_SEND_ISTREAM_RESULT_FINISHED;
+			return TRUE;
+		}
+		if (ret < 0) {
+			if (errno == EINVAL) {
+				/* splice() isn't supported for these fds */
+				return FALSE;
+			}
+			if (errno == EINTR || errno == EAGAIN) {
+				*res_r = OSTREAM_SEND_ISTREAM_RESULT_WAIT_INPUT;
+				return TRUE;
+			}
+			io_stream_set_error(&instream->real_stream->iostream,
+					    "splice() failed: %m");
+			instream->stream_errno = errno;
+			*res_r = OSTREAM_SEND_ISTREAM_RESULT_ERROR_INPUT;
+			return TRUE;
+		}
+		i_stream_file_direct_read(instream, ret);
+
+		left = ret;
+		while (left > 0) {
+			ret = splice(foutstream->splice_pipe[0], NULL,
+				     foutstream->fd, NULL, left,
+				     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (ret > 0) {
+				left -= ret;
+				foutstream->real_offset += ret;
+				foutstream->buffer_offset += ret;
+				outstream->ostream.offset += ret;
+				continue;
+			}
+			if (ret < 0 && errno == EINTR)
+				continue;
+			if (ret < 0 && errno != EAGAIN) {
+				io_stream_set_error(&outstream->iostream,
+						    "splice() failed: %m");
+				outstream->ostream.stream_errno = errno;
+				stream_closed(foutstream);
+				*res_r = OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT;
+				return TRUE;
+			}
+			T_BEGIN {
+				ret = o_stream_file_splice_buffer_rest(
+					foutstream, left);
+			} T_END;
+			*res_r = ret < 0 ?
+				OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT :
+				OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT;
+			return TRUE;
+		}
+	}
+}
+#endif
+
 static enum ostream_send_istream_result
 io_stream_copy_backwards(struct ostream_private *outstream,
 			 struct istream *instream, uoff_t in_size)
@@ -929,6 +1121,19 @@ o_stream_file_send_istream(struct ostream_private *outstream,
 		   regular sending. */
 		foutstream->no_sendfile = TRUE;
 	}
+#ifdef HAVE_SPLICE
+	/* Move data from sockets and pipes directly within the kernel.
+	   The writev() check skips e.g. unix ostreams that need to send fds
+	   along with the data. */
+	if (!foutstream->no_splice && !foutstream->file &&
+	    foutstream->fd != -1 && foutstream->writev == o_stream_file_writev &&
+	    (in_fd = i_stream_file_get_direct_fd(instream)) != -1 &&
+	    in_fd != foutstream->fd) {
+		if (io_stream_splice(outstream, instream, in_fd, &res))
+			return res;
+		foutstream->no_splice = TRUE;
+	}
+#endif
 
 	same_stream = i_stream_get_fd(instream) == foutstream->fd &&
 		foutstream->fd != -1;
@@ -955,6 +1160,7 @@ o_stream_create_file_common(struct file_ostream *fstream,
 	fstream->fd = fd;
 	fstream->autoclose_fd = autoclose_fd;
 	fstream->optimal_block_size = DEFAULT_OPTIMAL_BLOCK_SIZE;
+	fstream->splice_pipe[0] = fstream->splice_pipe[1] = -1;
 
 	fstream->ostream.iostream.close = o_stream_file_close;
 	fstream->ostream.iostream.destroy = o_stream_file_destroy;
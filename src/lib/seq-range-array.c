@@ -4,6 +4,12 @@
 #include "array.h"
 #include "seq-range-array.h"
 
+/* With at least this many ranges in the source array the set operations
+   build the result with a single pass over both arrays, instead of
+   inserting/removing the ranges one by one. Each insert/delete moves the
+   rest of the array, which becomes quadratic with large sparse arrays. */
+#define SEQ_RANGE_ARRAY_LINEAR_MIN_COUNT 8
+
 static bool ATTR_NOWARN_UNUSED_RESULT
 seq_range_lookup(const ARRAY_TYPE(seq_range) *array,
 		 uint32_t seq, unsigned int *idx_r)
@@ -118,10 +124,25 @@ seq_range_array_add_range_internal(ARRAY_TYPE(seq_range) *array,
 	struct seq_range *data, value;
 	unsigned int idx1, idx2, count;
 
+	data = array_get_modifiable(array, &count);
+	if (count == 0 || data[count-1].seq2 < seq1) {
+		/* quick check: appending, which is the usual case when
+		   parsing sequence sets */
+		if (r_count != NULL)
+			*r_count = seq2 - seq1 + 1;
+		if (count > 0 && data[count-1].seq2 + 1 == seq1)
+			data[count-1].seq2 = seq2;
+		else {
+			value.seq1 = seq1;
+			value.seq2 = seq2;
+			array_push_back(array, &value);
+		}
+		return;
+	}
+
 	seq_range_lookup(array, seq1, &idx1);
 	seq_range_lookup(array, seq2, &idx2);
 
-	data = array_get_modifiable(array, &count);
 	if (r_count != NULL) {
 		/* Find number we're adding by counting the number we're
 		   not adding, and subtracting that from the nominal range. */
@@ -176,7 +197,7 @@ seq_range_array_add_range_internal(ARRAY_TYPE(seq_range) *array,
 		if (seq2 > data[idx1].seq2) {
 			/* merge */
 			if (idx2 == count ||
-			    data[idx2].seq1 > seq2+1)
+			    (seq2 < (uint32_t)-1 && data[idx2].seq1 > seq2+1))
 				idx2--;
 			if (seq2 >= data[idx2].seq2) {
 				data[idx1].seq2 = seq2;
@@ -201,6 +222,55 @@ unsigned int seq_range_array_add_range_count(ARRAY_TYPE(seq_range) *array,
 	return count;
 }
 
+static void
+seq_range_array_push_merged(ARRAY_TYPE(seq_range) *array,
+			    const struct seq_range *range)
+{
+	struct seq_range *last;
+
+	/* ranges must be added in the order of seq1 */
+	if (array_count(array) > 0) {
+		last = array_back_modifiable(array);
+		i_assert(last->seq1 <= range->seq1);
+		if (last->seq2 == (uint32_t)-1 || last->seq2 + 1 >= range->seq1) {
+			if (last->seq2 < range->seq2)
+				last->seq2 = range->seq2;
+			return;
+		}
+	}
+	array_push_back(array, range);
+}
+
+static void
+seq_range_array_replace(ARRAY_TYPE(seq_range) *dest,
+			ARRAY_TYPE(seq_range) *result)
+{
+	array_clear(dest);
+	array_append_array(dest, result);
+	array_free(result);
+}
+
+static void
+seq_range_array_merge_linear(ARRAY_TYPE(seq_range) *dest,
+			     const ARRAY_TYPE(seq_range) *src)
+{
+	ARRAY_TYPE(seq_range) result;
+	const struct seq_range *range1, *range2;
+	unsigned int i1, i2, count1, count2;
+
+	range1 = array_get(dest, &count1);
+	range2 = array_get(src, &count2);
+	i_array_init(&result, count1 + count2);
+	for (i1 = i2 = 0; i1 < count1 || i2 < count2; ) {
+		if (i2 == count2 ||
+		    (i1 < count1 && range1[i1].seq1 <= range2[i2].seq1))
+			seq_range_array_push_merged(&result, &range1[i1++]);
+		else
+			seq_range_array_push_merged(&result, &range2[i2++]);
+	}
+	seq_range_array_replace(dest, &result);
+}
+
 void seq_range_array_merge(ARRAY_TYPE(seq_range) *dest,
 			   const ARRAY_TYPE(seq_range) *src)
 {
@@ -211,8 +281,12 @@ void seq_range_array_merge(ARRAY_TYPE(seq_range) *dest,
 		return;
 	}
 
-	array_foreach(src, range)
-		seq_range_array_add_range(dest, range->seq1, range->seq2);
+	if (array_count(src) < SEQ_RANGE_ARRAY_LINEAR_MIN_COUNT) {
+		array_foreach(src, range)
+			seq_range_array_add_range(dest, range->seq1, range->seq2);
+	} else {
+		seq_range_array_merge_linear(dest, src);
+	}
 }
 
 bool seq_range_array_remove(ARRAY_TYPE(seq_range) *array, uint32_t seq)
@@ -327,12 +401,62 @@ unsigned int seq_range_array_remove_range(ARRAY_TYPE(seq_range) *array,
 	return remove_count;
 }
 
+static unsigned int
+seq_range_array_remove_seq_range_linear(ARRAY_TYPE(seq_range) *dest,
+					const ARRAY_TYPE(seq_range) *src)
+{
+	ARRAY_TYPE(seq_range) result;
+	const struct seq_range *range1, *range2;
+	struct seq_range value;
+	unsigned int i1, i2, count1, count2, ret = 0;
+	bool removed_all;
+
+	range1 = array_get(dest, &count1);
+	range2 = array_get(src, &count2);
+	i_array_init(&result, count1 + 1);
+	for (i1 = i2 = 0; i1 < count1; i1++) {
+		value = range1[i1];
+		removed_all = FALSE;
+
+		/* skip over the src ranges before this range */
+		while (i2 < count2 && range2[i2].seq2 < value.seq1)
+			i2++;
+		/* remove the overlapping src ranges. the last one may
+		   overlap the next range as well, so don't skip it. */
+		for (; i2 < count2 && range2[i2].seq1 <= value.seq2; i2++) {
+			if (range2[i2].seq1 > value.seq1) {
+				struct seq_range head = {
+					.seq1 = value.seq1,
+					.seq2 = range2[i2].seq1 - 1,
+				};
+				array_push_back(&result, &head);
+				value.seq1 = range2[i2].seq1;
+			}
+			if (range2[i2].seq2 >= value.seq2) {
+				ret += value.seq2 - value.seq1 + 1;
+				removed_all = TRUE;
+				break;
+			}
+			ret += range2[i2].seq2 - value.seq1 + 1;
+			value.seq1 = range2[i2].seq2 + 1;
+		}
+		if (!removed_all)
+			array_push_back(&result, &value);
+	}
+	seq_range_array_replace(dest, &result);
+	return ret;
+}
+
 unsigned int seq_range_array_remove_seq_range(ARRAY_TYPE(seq_range) *dest,
 					      const ARRAY_TYPE(seq_range) *src)
 {
 	unsigned int ret = 0;
 	const struct seq_range *src_range;
 
+	if (array_count(src) >= SEQ_RANGE_ARRAY_LINEAR_MIN_COUNT &&
+	    array_count(dest) > 0)
+		return seq_range_array_remove_seq_range_linear(dest, src);
+
 	array_foreach(src, src_range) {
 		ret += seq_range_array_remove_range(dest, src_range->seq1,
 						    src_range->seq2);
@@ -362,6 +486,37 @@ void seq_range_array_remove_nth(ARRAY_TYPE(seq_range) *array,
 	seq_range_array_remove_range(array, seq1, seq2);
 }
 
+static unsigned int
+seq_range_array_intersect_linear(ARRAY_TYPE(seq_range) *dest,
+				 const ARRAY_TYPE(seq_range) *src)
+{
+	ARRAY_TYPE(seq_range) result;
+	const struct seq_range *range1, *range2;
+	struct seq_range value;
+	unsigned int i1, i2, count1, count2, ret = 0;
+
+	range1 = array_get(dest, &count1);
+	range2 = array_get(src, &count2);
+	for (i1 = 0; i1 < count1; i1++)
+		ret += range1[i1].seq2 - range1[i1].seq1 + 1;
+
+	i_array_init(&result, I_MIN(count1, count2) + 1);
+	for (i1 = i2 = 0; i1 < count1 && i2 < count2; ) {
+		value.seq1 = I_MAX(range1[i1].seq1, range2[i2].seq1);
+		value.seq2 = I_MIN(range1[i1].seq2, range2[i2].seq2);
+		if (value.seq1 <= value.seq2) {
+			array_push_back(&result, &value);
+			ret -= value.seq2 - value.seq1 + 1;
+		}
+		if (range1[i1].seq2 < range2[i2].seq2)
+			i1++;
+		else
+			i2++;
+	}
+	seq_range_array_replace(dest, &result);
+	return ret;
+}
+
 unsigned int seq_range_array_intersect(ARRAY_TYPE(seq_range) *dest,
 				       const ARRAY_TYPE(seq_range) *src)
 {
@@ -370,6 +525,9 @@ unsigned int seq_range_array_intersect(ARRAY_TYPE(seq_range) *dest,
 	uint32_t last_seq = 0;
 
 	src_range = array_get(src, &count);
+	if (count >= SEQ_RANGE_ARRAY_LINEAR_MIN_COUNT && array_count(dest) > 0)
+		return seq_range_array_intersect_linear(dest, src);
+
 	for (i = 0; i < count; i++) {
 		if (last_seq + 1 < src_range[i].seq1) {
 			ret += seq_range_array_remove_range(dest,
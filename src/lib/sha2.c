@@ -34,6 +34,16 @@
 #include "lib.h"
 #include "sha2.h"
 
+#if defined(__x86_64__) && \
+	((defined(__GNUC__) && __GNUC__ >= 7) || defined(__clang__))
+#  define HAVE_SHA256_SHANI
+#  include <cpuid.h>
+#  include <immintrin.h>
+#  ifndef bit_SHA
+#    define bit_SHA (1 << 29)
+#  endif
+#endif
+
 #define SHFR(x, n)    (x >> n)
 #define ROTR(x, n)   ((x >> n) | (x << ((sizeof(x) << 3) - n)))
 #define ROTL(x, n)   ((x << n) | (x >> ((sizeof(x) << 3) - n)))
@@ -176,8 +186,8 @@ static const uint64_t sha512_k[80] =
 /* SHA-256 functions */
 
 static void ATTR_UNSIGNED_WRAPS
-sha256_transf(struct sha256_ctx *ctx, const unsigned char *data,
-	      size_t block_nb)
+sha256_transf_c(struct sha256_ctx *ctx, const unsigned char *data,
+		size_t block_nb)
 {
 	uint32_t w[64];
 	uint32_t wv[8];
@@ -221,6 +231,101 @@ sha256_transf(struct sha256_ctx *ctx, const unsigned char *data,
 	}
 }
 
+#ifdef HAVE_SHA256_SHANI
+static bool sha256_have_shani(void)
+{
+	static int have_shani = -1;
+	unsigned int eax, ebx, ecx, edx;
+
+	if (have_shani != -1)
+		return have_shani == 1;
+
+	have_shani = 0;
+	/* SHA extensions, the code also uses SSSE3 and SSE4.1 */
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) != 0 &&
+	    (ecx & bit_SSSE3) != 0 && (ecx & bit_SSE4_1) != 0 &&
+	    __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) != 0 &&
+	    (ebx & bit_SHA) != 0)
+		have_shani = 1;
+	return have_shani == 1;
+}
+
+static void __attribute__((target("sha,ssse3,sse4.1")))
+sha256_transf_shani(struct sha256_ctx *ctx, const unsigned char *data,
+		    size_t block_nb)
+{
+	const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+					    0x0405060700010203ULL);
+	__m128i state0, state1, msg, tmp, abef_save, cdgh_save;
+	__m128i w[4];
+	size_t i;
+	int j;
+
+	/* the instructions want the state as ABEF and CDGH */
+	tmp = _mm_loadu_si128((const __m128i *)&ctx->h[0]);
+	state1 = _mm_loadu_si128((const __m128i *)&ctx->h[4]);
+	tmp = _mm_shuffle_epi32(tmp, 0xB1);
+	state1 = _mm_shuffle_epi32(state1, 0x1B);
+	state0 = _mm_alignr_epi8(tmp, state1, 8);
+	state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+	for (i = 0; i < block_nb; i++) {
+		const unsigned char *sub_block = data + (i << 6);
+
+		abef_save = state0;
+		cdgh_save = state1;
+		for (j = 0; j < 4; j++) {
+			msg = _mm_loadu_si128((const __m128i *)
+					      (sub_block + j*16));
+			w[j] = _mm_shuffle_epi8(msg, mask);
+		}
+
+		/* w[j & 3] holds the message schedule words 4*j..4*j+3 */
+		for (j = 0; j < 16; j++) {
+			msg = _mm_add_epi32(w[j & 3], _mm_loadu_si128(
+				(const __m128i *)&sha256_k[j*4]));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			msg = _mm_shuffle_epi32(msg, 0x0E);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+
+			if (j < 12) {
+				tmp = _mm_sha256msg1_epu32(w[j & 3],
+							   w[(j + 1) & 3]);
+				tmp = _mm_add_epi32(tmp, _mm_alignr_epi8(
+					w[(j + 3) & 3], w[(j + 2) & 3], 4));
+				w[j & 3] = _mm_sha256msg2_epu32(tmp,
+							w[(j + 3) & 3]);
+			}
+		}
+
+		state0 = _mm_add_epi32(state0, abef_save);
+		state1 = _mm_add_epi32(state1, cdgh_save);
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1B);
+	state1 = _mm_shuffle_epi32(state1, 0xB1);
+	state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+	state1 = _mm_alignr_epi8(state1, tmp, 8);
+	_mm_storeu_si128((__m128i *)&ctx->h[0], state0);
+	_mm_storeu_si128((__m128i *)&ctx->h[4], state1);
+}
+#endif
+
+static void
+sha256_transf(struct sha256_ctx *ctx, const unsigned char *data,
+	      size_t block_nb)
+{
+	if (block_nb == 0)
+		return;
+#ifdef HAVE_SHA256_SHANI
+	if (sha256_have_shani()) {
+		sha256_transf_shani(ctx, data, block_nb);
+		return;
+	}
+#endif
+	sha256_transf_c(ctx, data, block_nb);
+}
+
 void sha256_init(struct sha256_ctx *ctx)
 {
 	int i;
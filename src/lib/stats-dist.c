@@ -1,6 +1,7 @@
 /* Copyright (c) 2015-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "bits.h"
 #include "stats-dist.h"
 #include "sort.h"
 
@@ -8,6 +9,13 @@
    more than 20 in your subsample. */
 #define TIMING_DEFAULT_SUBSAMPLING_BUFFER (20*24) /* 20*24 fits in a page */
 
+/* Sketches split each power of 2 into 2^STATS_DIST_SKETCH_FRACBITS
+   buckets, so each bucket's width is at most 1/64 of its values. Values
+   below 2^(STATS_DIST_SKETCH_FRACBITS+1) have their own buckets. */
+#define STATS_DIST_SKETCH_FRACBITS 6
+/* Buckets are allocated in steps of this many */
+#define STATS_DIST_SKETCH_ALLOC_STEP 64
+
 struct stats_dist {
 	unsigned int sample_count;
 	unsigned int count;
@@ -15,6 +23,14 @@ struct stats_dist {
 	uint64_t min;
 	uint64_t max;
 	uint64_t sum;
+
+	/* Sketch: buckets[i] is the number of values in bucket
+	   bucket_first+i. mean and m2 are for computing the variance. */
+	bool sketch;
+	unsigned int bucket_first, bucket_count;
+	uint32_t *buckets;
+	double mean, m2;
+
 	uint64_t samples[];
 };
 
@@ -34,30 +50,147 @@ struct stats_dist *stats_dist_init_with_size(unsigned int sample_count)
 	return stats;
 }
 
+struct stats_dist *stats_dist_init_sketch(void)
+{
+	struct stats_dist *stats = i_new(struct stats_dist, 1);
+
+	stats->sketch = TRUE;
+	return stats;
+}
+
 void stats_dist_deinit(struct stats_dist **_stats)
 {
-	i_free_and_null(*_stats);
+	struct stats_dist *stats = *_stats;
+
+	if (stats == NULL)
+		return;
+	*_stats = NULL;
+
+	i_free(stats->buckets);
+	i_free(stats);
 }
 
 void stats_dist_reset(struct stats_dist *stats)
 {
 	unsigned int sample_count = stats->sample_count;
+	bool sketch = stats->sketch;
+
+	i_free(stats->buckets);
 	i_zero(stats);
 	stats->sample_count = sample_count;
+	stats->sketch = sketch;
+}
+
+/* bits_fraclog() for 64bit values */
+static unsigned int stats_dist_sketch_bucket(uint64_t value)
+{
+	unsigned int bits = bits_required64(value);
+
+	if (bits <= STATS_DIST_SKETCH_FRACBITS + 1)
+		return value;
+
+	unsigned int bandnum = bits - STATS_DIST_SKETCH_FRACBITS;
+	unsigned int bandstart = bandnum << STATS_DIST_SKETCH_FRACBITS;
+	unsigned int fracoffs = value >> (bandnum - 1); /* has leading 1 */
+	return bandstart + fracoffs - BIT(STATS_DIST_SKETCH_FRACBITS);
+}
+
+static uint64_t stats_dist_sketch_bucket_start(unsigned int bucket)
+{
+	unsigned int bandnum = bucket >> STATS_DIST_SKETCH_FRACBITS;
+
+	if (bandnum <= 1)
+		return bucket;
+	uint64_t fracoffs1 = BIT(STATS_DIST_SKETCH_FRACBITS) +
+		(bucket & (BIT(STATS_DIST_SKETCH_FRACBITS)-1));
+	return fracoffs1 << (bandnum - 1);
+}
+
+/* Returns the value that represents the bucket: its midpoint limited to
+   the values that were actually seen. */
+static uint64_t
+stats_dist_sketch_bucket_value(const struct stats_dist *stats,
+			       unsigned int bucket)
+{
+	uint64_t start = stats_dist_sketch_bucket_start(bucket);
+	uint64_t value = start;
+
+	if ((bucket >> STATS_DIST_SKETCH_FRACBITS) > 1) {
+		uint64_t width = (uint64_t)1 <<
+			((bucket >> STATS_DIST_SKETCH_FRACBITS) - 1);
+		value = start + (width - 1) / 2;
+	}
+	if (value < stats->min)
+		return stats->min;
+	if (value > stats->max)
+		return stats->max;
+	return value;
+}
+
+/* Make sure buckets [first, last] are allocated */
+static void
+stats_dist_sketch_ensure(struct stats_dist *stats,
+			 unsigned int first, unsigned int last)
+{
+	unsigned int new_first, new_count;
+	uint32_t *new_buckets;
+
+	if (stats->bucket_count > 0) {
+		if (first >= stats->bucket_first &&
+		    last < stats->bucket_first + stats->bucket_count)
+			return;
+		first = I_MIN(first, stats->bucket_first);
+		last = I_MAX(last, stats->bucket_first +
+			     stats->bucket_count - 1);
+	}
+
+	/* round outwards, so that values close to the old ones don't
+	   require growing again */
+	new_first = first - first % STATS_DIST_SKETCH_ALLOC_STEP;
+	new_count = last - new_first + 1;
+	new_count += STATS_DIST_SKETCH_ALLOC_STEP -
+		new_count % STATS_DIST_SKETCH_ALLOC_STEP;
+
+	new_buckets = i_new(uint32_t, new_count);
+	if (stats->bucket_count > 0) {
+		memcpy(new_buckets + (stats->bucket_first - new_first),
+		       stats->buckets,
+		       sizeof(*stats->buckets) * stats->bucket_count);
+	}
+	i_free(stats->buckets);
+	stats->buckets = new_buckets;
+	stats->bucket_first = new_first;
+	stats->bucket_count = new_count;
+}
+
+static void stats_dist_sketch_add(struct stats_dist *stats, uint64_t value)
+{
+	unsigned int bucket = stats_dist_sketch_bucket(value);
+	double delta;
+
+	stats_dist_sketch_ensure(stats, bucket, bucket);
+	stats->buckets[bucket - stats->bucket_first]++;
+
+	/* Welford's online variance */
+	delta = value - stats->mean;
+	stats->mean += delta / (stats->count + 1);
+	stats->m2 += delta * (value - stats->mean);
 }
 
 void stats_dist_add(struct stats_dist *stats, uint64_t value)
 {
-	if (stats->count < stats->sample_count) {
+	if (stats->sketch)
+		stats_dist_sketch_add(stats, value);
+	else if (stats->count < stats->sample_count)
 		stats->samples[stats->count] = value;
-		if (stats->count == 0)
-			stats->min = stats->max = value;
-	} else {
+	else {
 		unsigned int idx = i_rand_limit(stats->count);
 		if (idx < stats->sample_count)
 			stats->samples[idx] = value;
 	}
 
+	if (stats->count == 0)
+		stats->min = stats->max = value;
 	stats->count++;
 	stats->sum += value;
 	if (stats->max < value)
@@ -67,6 +200,37 @@ void stats_dist_add(struct stats_dist *stats, uint64_t value)
 	stats->sorted = FALSE;
 }
 
+void stats_dist_merge(struct stats_dist *dest, const struct stats_dist *src)
+{
+	unsigned int i;
+	double delta, total;
+
+	i_assert(dest->sketch && src->sketch);
+
+	if (src->count == 0)
+		return;
+
+	stats_dist_sketch_ensure(dest, src->bucket_first,
+				 src->bucket_first + src->bucket_count - 1);
+	for (i = 0; i < src->bucket_count; i++) {
+		dest->buckets[src->bucket_first - dest->bucket_first + i] +=
+			src->buckets[i];
+	}
+
+	/* combine the variances */
+	total = (double)dest->count + src->count;
+	delta = src->mean - dest->mean;
+	dest->m2 += src->m2 + delta * delta * dest->count * src->count / total;
+	dest->mean += delta * src->count / total;
+
+	if (dest->count == 0 || dest->min > src->min)
+		dest->min = src->min;
+	if (dest->max < src->max)
+		dest->max = src->max;
+	dest->count += src->count;
+	dest->sum += src->sum;
+}
+
 unsigned int stats_dist_get_count(const struct stats_dist *stats)
 {
 	return stats->count;
@@ -108,10 +272,36 @@ static void stats_dist_ensure_sorted(struct stats_dist *stats)
 	stats->sorted = TRUE;
 }
 
+/* Returns the value at the given 0-based rank of the sorted values */
+static uint64_t
+stats_dist_sketch_get_rank(const struct stats_dist *stats, unsigned int rank)
+{
+	unsigned int i, seen = 0;
+
+	/* the extremes are known exactly */
+	if (rank == 0)
+		return stats->min;
+	if (rank >= stats->count - 1)
+		return stats->max;
+
+	for (i = 0; i < stats->bucket_count; i++) {
+		seen += stats->buckets[i];
+		if (seen > rank) {
+			return stats_dist_sketch_bucket_value(stats,
+				stats->bucket_first + i);
+		}
+	}
+	return stats->max;
+}
+
 uint64_t stats_dist_get_median(const struct stats_dist *stats)
 {
 	if (stats->count == 0)
 		return 0;
+	if (stats->sketch) {
+		return (stats_dist_sketch_get_rank(stats, (stats->count-1)/2) +
+			stats_dist_sketch_get_rank(stats, stats->count/2)) / 2;
+	}
 	/* cast-away const - reading requires sorting */
 	stats_dist_ensure_sorted((struct stats_dist *)stats);
 	unsigned int count = (stats->count < stats->sample_count)
@@ -126,6 +316,8 @@ double stats_dist_get_variance(const struct stats_dist *stats)
 	double sum = 0;
 	if (stats->count == 0)
 		return 0;
+	if (stats->sketch)
+		return stats->m2 / stats->count;
 
 	double avg = stats_dist_get_avg(stats);
 	double count = (stats->count < stats->sample_count)
@@ -165,6 +357,10 @@ uint64_t stats_dist_get_percentile(const struct stats_dist *stats, double fracti
 {
 	if (stats->count == 0)
 		return 0;
+	if (stats->sketch) {
+		return stats_dist_sketch_get_rank(stats,
+			stats_dist_get_index(stats->count, fraction));
+	}
 	/* cast-away const - reading requires sorting */
 	stats_dist_ensure_sorted((struct stats_dist *)stats);
 	unsigned int count = (stats->count < stats->sample_count)
@@ -177,6 +373,10 @@ uint64_t stats_dist_get_percentile(const struct stats_dist *stats, double fracti
 const uint64_t *stats_dist_get_samples(const struct stats_dist *stats,
 				       unsigned int *count_r)
 {
+	if (stats->sketch) {
+		*count_r = 0;
+		return NULL;
+	}
 	*count_r = (stats->count < stats->sample_count)
 		? stats->count
 		: stats->sample_count;
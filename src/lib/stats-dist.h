@@ -3,6 +3,12 @@
 
 struct stats_dist *stats_dist_init(void);
 struct stats_dist *stats_dist_init_with_size(unsigned int sample_count);
+/* Create a distribution that counts the values in logarithmic buckets
+   instead of keeping a random subsample of them. Adding a value is O(1)
+   and the memory usage depends only on the range of the values. The
+   median and percentiles are within 1% of the real values, and the count,
+   sum, min, max, average and variance are exact. */
+struct stats_dist *stats_dist_init_sketch(void);
 void stats_dist_deinit(struct stats_dist **stats);
 
 /* Reset all events. */
@@ -11,6 +17,10 @@ void stats_dist_reset(struct stats_dist *stats);
 /* Add a new event. */
 void stats_dist_add(struct stats_dist *stats, uint64_t value);
 
+/* Add all events from src to dest. Both must have been created with
+   stats_dist_init_sketch(). */
+void stats_dist_merge(struct stats_dist *dest, const struct stats_dist *src);
+
 /* Returns number of events added. */
 unsigned int stats_dist_get_count(const struct stats_dist *stats);
 /* Returns the sum of all events. */
@@ -34,7 +44,7 @@ static inline uint64_t stats_dist_get_95th(const struct stats_dist *stats)
 {
 	return stats_dist_get_percentile(stats, 0.95);
 }
-/* Returns the sample array */
+/* Returns the sample array. Sketches have no samples. */
 const uint64_t *stats_dist_get_samples(const struct stats_dist *stats,
 				       unsigned int *count_r);
 #endif
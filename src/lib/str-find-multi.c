@@ -0,0 +1,239 @@
+/* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
+
+/* @UNSAFE: whole file */
+
+#include "lib.h"
+#include "str-find-multi.h"
+
+/* Node 0 is the root. Since no node links back to the root through
+   first_child or next_sibling, 0 also means "none" for them and for dict. */
+struct str_find_multi_node {
+	unsigned int first_child, next_sibling;
+	/* longest proper suffix of this node's string that is also in the
+	   trie */
+	unsigned int fail;
+	/* the nearest node via the fail links which ends a key */
+	unsigned int dict;
+	unsigned char chr;
+	bool key_end:1;
+	bool found:1;
+};
+
+struct str_find_multi_context {
+	pool_t pool;
+
+	struct str_find_multi_node *nodes;
+	unsigned int node_count;
+	unsigned int *key_nodes;
+	unsigned int key_count;
+	unsigned int key_end_count, found_count;
+
+	/* If all the keys begin with the same character, it's found with
+	   memchr(), because it's usually very fast. Otherwise -1. */
+	int first_chr;
+	unsigned int state;
+	unsigned int root_next[UCHAR_MAX+1];
+};
+
+static unsigned int
+str_find_multi_child(const struct str_find_multi_context *ctx,
+		     unsigned int node, unsigned char chr)
+{
+	unsigned int child;
+
+	for (child = ctx->nodes[node].first_child; child != 0;
+	     child = ctx->nodes[child].next_sibling) {
+		if (ctx->nodes[child].chr == chr)
+			return child;
+	}
+	return 0;
+}
+
+static unsigned int
+str_find_multi_next(const struct str_find_multi_context *ctx,
+		    unsigned int node, unsigned char chr)
+{
+	unsigned int child;
+
+	for (; node != 0; node = ctx->nodes[node].fail) {
+		child = str_find_multi_child(ctx, node, chr);
+		if (child != 0)
+			return child;
+	}
+	return ctx->root_next[chr];
+}
+
+static void
+str_find_multi_add_key(struct str_find_multi_context *ctx,
+		       unsigned int key_idx, const unsigned char *key)
+{
+	struct str_find_multi_node *node;
+	unsigned int cur = 0, child;
+
+	for (; *key != '\0'; key++) {
+		child = cur == 0 ? ctx->root_next[*key] :
+			str_find_multi_child(ctx, cur, *key);
+		if (child == 0) {
+			child = ctx->node_count++;
+			node = &ctx->nodes[child];
+			node->chr = *key;
+			node->next_sibling = ctx->nodes[cur].first_child;
+			ctx->nodes[cur].first_child = child;
+			if (cur == 0)
+				ctx->root_next[*key] = child;
+		}
+		cur = child;
+	}
+	if (!ctx->nodes[cur].key_end) {
+		ctx->nodes[cur].key_end = TRUE;
+		ctx->key_end_count++;
+	}
+	ctx->key_nodes[key_idx] = cur;
+}
+
+static void str_find_multi_build_links(struct str_find_multi_context *ctx)
+{
+	struct str_find_multi_node *node;
+	unsigned int *queue, head = 0, tail = 0, cur, child, fail;
+
+	/* breadth-first, so that the fail links always point to nodes that
+	   are already finished */
+	queue = t_new(unsigned int, ctx->node_count);
+	for (child = ctx->nodes[0].first_child; child != 0;
+	     child = ctx->nodes[child].next_sibling)
+		queue[tail++] = child;
+
+	while (head < tail) {
+		cur = queue[head++];
+		for (child = ctx->nodes[cur].first_child; child != 0;
+		     child = ctx->nodes[child].next_sibling) {
+			node = &ctx->nodes[child];
+			fail = str_find_multi_next(ctx, ctx->nodes[cur].fail,
+						   node->chr);
+			node->fail = fail;
+			node->dict = ctx->nodes[fail].key_end ? fail :
+				ctx->nodes[fail].dict;
+			queue[tail++] = child;
+		}
+	}
+}
+
+struct str_find_multi_context *
+str_find_multi_init(pool_t pool, const char *const *keys)
+{
+	struct str_find_multi_context *ctx;
+	unsigned int i, first_chr_count = 0;
+	size_t total_len = 1;
+
+	ctx = p_new(pool, struct str_find_multi_context, 1);
+	ctx->pool = pool;
+	for (i = 0; keys[i] != NULL; i++) {
+		i_assert(keys[i][0] != '\0');
+		total_len = MALLOC_ADD(total_len, strlen(keys[i]));
+	}
+	i_assert(i > 0);
+	i_assert(total_len < UINT_MAX);
+	ctx->key_count = i;
+	ctx->key_nodes = p_new(pool, unsigned int, ctx->key_count);
+	ctx->nodes = p_new(pool, struct str_find_multi_node, total_len);
+	ctx->node_count = 1;
+
+	for (i = 0; i < ctx->key_count; i++) {
+		str_find_multi_add_key(ctx, i,
+				       (const unsigned char *)keys[i]);
+	}
+	T_BEGIN {
+		str_find_multi_build_links(ctx);
+	} T_END;
+
+	ctx->first_chr = -1;
+	for (i = 0; i <= UCHAR_MAX; i++) {
+		if (ctx->root_next[i] != 0) {
+			ctx->first_chr = i;
+			first_chr_count++;
+		}
+	}
+	if (first_chr_count != 1)
+		ctx->first_chr = -1;
+	return ctx;
+}
+
+void str_find_multi_deinit(struct str_find_multi_context **_ctx)
+{
+	struct str_find_multi_context *ctx = *_ctx;
+
+	*_ctx = NULL;
+	p_free(ctx->pool, ctx->nodes);
+	p_free(ctx->pool, ctx->key_nodes);
+	p_free(ctx->pool, ctx);
+}
+
+bool str_find_multi_more(struct str_find_multi_context *ctx,
+			 const unsigned char *data, size_t size)
+{
+	const unsigned char *p;
+	unsigned int state = ctx->state, node;
+	size_t i;
+	bool ret = FALSE;
+
+	for (i = 0; i < size; i++) {
+		if (state == 0) {
+			/* skip quickly over the data that can't begin
+			   any key */
+			if (ctx->first_chr != -1) {
+				p = memchr(data + i, ctx->first_chr, size - i);
+				if (p == NULL)
+					break;
+				i = p - data;
+			} else {
+				while (ctx->root_next[data[i]] == 0) {
+					if (++i == size)
+						break;
+				}
+				if (i == size)
+					break;
+			}
+		}
+		state = str_find_multi_next(ctx, state, data[i]);
+
+		node = ctx->nodes[state].key_end ? state :
+			ctx->nodes[state].dict;
+		for (; node != 0; node = ctx->nodes[node].dict) {
+			if (!ctx->nodes[node].found) {
+				ctx->nodes[node].found = TRUE;
+				ctx->found_count++;
+				ret = TRUE;
+			}
+		}
+	}
+	ctx->state = state;
+	return ret;
+}
+
+bool str_find_multi_is_found(struct str_find_multi_context *ctx,
+			     unsigned int key_idx)
+{
+	i_assert(key_idx < ctx->key_count);
+
+	return ctx->nodes[ctx->key_nodes[key_idx]].found;
+}
+
+bool str_find_multi_all_found(struct str_find_multi_context *ctx)
+{
+	return ctx->found_count == ctx->key_end_count;
+}
+
+void str_find_multi_reset(struct str_find_multi_context *ctx)
+{
+	ctx->state = 0;
+}
+
+void str_find_multi_reset_found(struct str_find_multi_context *ctx)
+{
+	unsigned int i;
+
+	ctx->state = 0;
+	ctx->found_count = 0;
+	for (i = 0; i < ctx->node_count; i++)
+		ctx->nodes[i].found = FALSE;
+}
@@ -0,0 +1,29 @@
+#ifndef STR_FIND_MULTI_H
+#define STR_FIND_MULTI_H
+
+/* Find multiple keys from the same data with a single pass over it
+   (Aho-Corasick). */
+struct str_find_multi_context;
+
+/* keys is a NULL-terminated list of non-empty keys. */
+struct str_find_multi_context *
+str_find_multi_init(pool_t pool, const char *const *keys);
+void str_find_multi_deinit(struct str_find_multi_context **ctx);
+
+/* Returns TRUE if some key which wasn't found earlier is now found. It's
+   possible to send the data in arbitrary blocks and have the keys still
+   match. */
+bool str_find_multi_more(struct str_find_multi_context *ctx,
+			 const unsigned char *data, size_t size);
+/* Returns TRUE if the key with the given index has been found. */
+bool str_find_multi_is_found(struct str_find_multi_context *ctx,
+			     unsigned int key_idx);
+/* Returns TRUE if all the keys have been found. */
+bool str_find_multi_all_found(struct str_find_multi_context *ctx);
+/* Reset input data. The next str_find_multi_more() call won't try to match
+   the keys to earlier data. The already found keys stay found. */
+void str_find_multi_reset(struct str_find_multi_context *ctx);
+/* Reset input data and forget all the found keys. */
+void str_find_multi_reset_found(struct str_find_multi_context *ctx);
+
+#endif
@@ -2,7 +2,7 @@
 
 #include "test-lib.h"
 #include "str.h"
-#include "base64.h"
+#include "base64-private.h"
 
 
 static void test_base64_encode(void)
@@ -101,9 +101,89 @@ static void test_base64_random(void)
 	test_end();
 }
 
+static void
+test_base64_decode_both(const unsigned char *data, size_t size,
+			buffer_t *dest_simd, buffer_t *dest_scalar,
+			unsigned int idx)
+{
+	size_t pos_simd, pos_scalar;
+	int ret_simd, ret_scalar;
+
+	buffer_set_used_size(dest_simd, 0);
+	buffer_set_used_size(dest_scalar, 0);
+	base64_set_simd(TRUE);
+	ret_simd = base64_decode(data, size, &pos_simd, dest_simd);
+	base64_set_simd(FALSE);
+	ret_scalar = base64_decode(data, size, &pos_scalar, dest_scalar);
+	base64_set_simd(TRUE);
+
+	test_assert_idx(ret_simd == ret_scalar, idx);
+	test_assert_idx(pos_simd == pos_scalar, idx);
+	test_assert_idx(buffer_cmp(dest_simd, dest_scalar), idx);
+}
+
+static void test_base64_simd(void)
+{
+	static const char invalid_chars[] = "\r\n =!\x80";
+	unsigned char buf[300];
+	string_t *str, *str_scalar, *dest, *dest_scalar;
+	char *data;
+	unsigned int i, j, max, line_len;
+
+	str = t_str_new(512);
+	str_scalar = t_str_new(512);
+	dest = t_str_new(512);
+	dest_scalar = t_str_new(512);
+
+	test_begin("base64 SIMD and scalar code");
+	for (i = 0; i < 1000; i++) {
+		max = i_rand_limit(sizeof(buf));
+		for (j = 0; j < max; j++)
+			buf[j] = i_rand();
+
+		str_truncate(str, 0);
+		str_truncate(str_scalar, 0);
+		base64_set_simd(TRUE);
+		base64_encode(buf, max, str);
+		base64_set_simd(FALSE);
+		base64_encode(buf, max, str_scalar);
+		base64_set_simd(TRUE);
+		test_assert_idx(str_equals(str, str_scalar), i);
+
+		/* valid input */
+		test_base64_decode_both(str_data(str), str_len(str),
+					dest, dest_scalar, i);
+		test_assert_idx(str_len(dest) == max &&
+				memcmp(buf, str_data(dest), max) == 0, i);
+
+		/* line wrapped input */
+		line_len = i_rand_minmax(1, 80);
+		str_truncate(str_scalar, 0);
+		for (j = 0; j < str_len(str); j += line_len) {
+			str_append_data(str_scalar, str_data(str) + j,
+					I_MIN(line_len, str_len(str) - j));
+			str_append(str_scalar, "\r\n");
+		}
+		test_base64_decode_both(str_data(str_scalar),
+					str_len(str_scalar),
+					dest, dest_scalar, i);
+
+		/* invalid input */
+		if (str_len(str) > 0) {
+			data = str_c_modifiable(str);
+			data[i_rand_limit(str_len(str))] =
+				invalid_chars[i_rand_limit(sizeof(invalid_chars)-1)];
+			test_base64_decode_both(str_data(str), str_len(str),
+						dest, dest_scalar, i);
+		}
+	}
+	test_end();
+}
+
 void test_base64(void)
 {
 	test_base64_encode();
 	test_base64_decode();
 	test_base64_random();
+	test_base64_simd();
 }
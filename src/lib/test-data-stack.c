@@ -138,11 +138,32 @@ static void test_ds_recursive(int count, int depth)
 	test_end();
 }
 
+static void test_ds_free_unused(void)
+{
+	test_begin("data-stack free unused");
+	T_BEGIN {
+		unsigned char *p;
+
+		/* allocate a new block, which becomes unused after T_END */
+		T_BEGIN {
+			p = t_malloc0(t_get_bytes_available() + 100000);
+			p[99999] = 1;
+		} T_END;
+		data_stack_free_unused();
+		/* allocating works still */
+		p = t_malloc0(200000);
+		test_assert(p[199999] == 0);
+	} T_END;
+	data_stack_free_unused();
+	test_end();
+}
+
 void test_data_stack(void)
 {
 	test_ds_buffers();
 	test_ds_realloc();
 	test_ds_recursive(20, 80);
+	test_ds_free_unused();
 }
 
 enum fatal_test_state fatal_data_stack(unsigned int stage)
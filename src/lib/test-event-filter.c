@@ -177,10 +177,153 @@ static void test_event_filter_parent_category_match(void)
 	test_end();
 }
 
+static void test_event_filter_indexed_queries(void)
+{
+	struct event_category category = {
+		.name = "indexed",
+	};
+	struct event_filter *filter;
+	struct event_filter_match_iter *iter;
+	const struct failure_context failure_ctx = {
+		.type = LOG_TYPE_DEBUG
+	};
+	const struct failure_context error_ctx = {
+		.type = LOG_TYPE_ERROR
+	};
+	const char *query_categories[] = { "indexed", NULL };
+	const char *query_log_types[] = { "error", NULL };
+	const struct event_filter_field query_fields[] = {
+		{ .key = "user", .value = "t*" },
+		{ .key = NULL, .value = NULL },
+	};
+	struct event_filter_query queries[] = {
+		{ .name = "exact", .context = "exact" },
+		{ .name = "wild*", .context = "wild" },
+		{ .categories = query_categories, .context = "category" },
+		{ .fields = query_fields, .context = "field" },
+		{ .name = "exact", .categories = query_log_types,
+		  .context = "error" },
+	};
+	unsigned int i;
+
+	test_begin("event filter: indexed queries");
+
+	filter = event_filter_create();
+	for (i = 0; i < N_ELEMENTS(queries); i++)
+		event_filter_add(filter, &queries[i]);
+
+	struct event *parent = event_create(NULL);
+	struct event *e = event_create(parent);
+
+	test_assert(!event_filter_match(filter, e, &failure_ctx));
+	event_set_name(e, "other");
+	test_assert(!event_filter_match(filter, e, &failure_ctx));
+
+	/* exact name */
+	event_set_name(e, "exact");
+	iter = event_filter_match_iter_init(filter, e, &failure_ctx);
+	test_assert_strcmp(event_filter_match_iter_next(iter), "exact");
+	test_assert(event_filter_match_iter_next(iter) == NULL);
+	event_filter_match_iter_deinit(&iter);
+	iter = event_filter_match_iter_init(filter, e, &error_ctx);
+	test_assert_strcmp(event_filter_match_iter_next(iter), "exact");
+	test_assert_strcmp(event_filter_match_iter_next(iter), "error");
+	test_assert(event_filter_match_iter_next(iter) == NULL);
+	event_filter_match_iter_deinit(&iter);
+
+	/* wildcard name isn't indexed */
+	event_set_name(e, "wildcard");
+	test_assert(event_filter_match(filter, e, &failure_ctx));
+
+	/* category and field are found via the parent */
+	event_set_name(e, "other");
+	event_add_category(parent, &category);
+	test_assert(event_filter_match(filter, e, &failure_ctx));
+	event_add_str(parent, "user", "testuser");
+	iter = event_filter_match_iter_init(filter, e, &failure_ctx);
+	test_assert_strcmp(event_filter_match_iter_next(iter), "category");
+	test_assert_strcmp(event_filter_match_iter_next(iter), "field");
+	test_assert(event_filter_match_iter_next(iter) == NULL);
+	event_filter_match_iter_deinit(&iter);
+
+	/* adding a query rebuilds the index */
+	struct event_filter_query other_query = {
+		.name = "other", .context = "other",
+	};
+	event_filter_add(filter, &other_query);
+	event_set_name(e, "other");
+	iter = event_filter_match_iter_init(filter, e, &failure_ctx);
+	test_assert_strcmp(event_filter_match_iter_next(iter), "category");
+	test_assert_strcmp(event_filter_match_iter_next(iter), "field");
+	test_assert_strcmp(event_filter_match_iter_next(iter), "other");
+	test_assert(event_filter_match_iter_next(iter) == NULL);
+	event_filter_match_iter_deinit(&iter);
+
+	event_filter_unref(&filter);
+	event_unref(&e);
+	event_unref(&parent);
+	test_end();
+}
+
+static void test_fields_callback(struct event *event, unsigned int *count)
+{
+	(*count)++;
+	event_add_str(event, "lazy", "value");
+}
+
+static void test_event_filter_fields_callback(void)
+{
+	struct event_filter *filter;
+	const struct failure_context failure_ctx = {
+		.type = LOG_TYPE_DEBUG
+	};
+	const struct event_filter_field query_fields[] = {
+		{ .key = "lazy", .value = "value" },
+		{ .key = NULL, .value = NULL },
+	};
+	struct event_filter_query name_query = {
+		.name = "named",
+	};
+	struct event_filter_query field_query = {
+		.fields = query_fields,
+	};
+	const struct event_field *field;
+	unsigned int count = 0;
+
+	test_begin("event filter: lazy fields callback");
+
+	struct event *e = event_create(NULL);
+	event_set_fields_callback(e, test_fields_callback, &count);
+	event_add_str(e, "lazy", "overridden");
+	event_set_name(e, "other");
+
+	/* the fields aren't needed */
+	filter = event_filter_create();
+	event_filter_add(filter, &name_query);
+	test_assert(!event_filter_match(filter, e, &failure_ctx));
+	test_assert(count == 0);
+	event_filter_unref(&filter);
+
+	filter = event_filter_create();
+	event_filter_add(filter, &field_query);
+	test_assert(event_filter_match(filter, e, &failure_ctx));
+	test_assert(count == 1);
+	test_assert(event_filter_match(filter, e, &failure_ctx));
+	test_assert(count == 1);
+	event_filter_unref(&filter);
+
+	field = event_find_field(e, "lazy");
+	test_assert(field != NULL && strcmp(field->value.str, "value") == 0);
+	event_unref(&e);
+	test_end();
+}
+
 void test_event_filter(void)
 {
 	test_event_filter_override_parent_fields();
 	test_event_filter_clear_parent_fields();
 	test_event_filter_inc_int();
 	test_event_filter_parent_category_match();
+	test_event_filter_indexed_queries();
+	test_event_filter_fields_callback();
 }
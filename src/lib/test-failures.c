@@ -3,8 +3,12 @@
 /* Unit tests for failure helpers */
 
 #include "test-lib.h"
+#include "str.h"
+#include "fd-util.h"
 #include "failures.h"
 
+#include <unistd.h>
+
 static int handlers_set_me;
 
 static void test_failures_handler(const struct failure_context *ctx,
@@ -63,9 +67,95 @@ static void test_expected_str(void)
 	test_end();
 }
 
+static void test_failures_buffer_read(int fd, string_t *str)
+{
+	unsigned char buf[1024];
+	ssize_t ret;
+	bool more;
+
+	do {
+		more = i_failure_flush_buffer();
+		while ((ret = read(fd, buf, sizeof(buf))) > 0)
+			str_append_data(str, buf, ret);
+		test_assert(ret < 0 && errno == EAGAIN);
+	} while (more);
+}
+
+static void test_failures_buffer(void)
+{
+	failure_callback_t *handlers[4];
+	string_t *str = str_new(default_pool, 1024);
+	const char *const *lines, *p;
+	unsigned int i, next = 0, dropped = 0;
+	bool seen_after = FALSE;
+	int fds[2], old_stderr;
+
+	test_begin("failure buffer");
+	i_get_failure_handlers(handlers, handlers+1, handlers+2, handlers+3);
+	if (pipe(fds) < 0)
+		i_fatal("pipe() failed: %m");
+	fd_set_nonblock(fds[0], TRUE);
+	fd_set_nonblock(fds[1], TRUE);
+	old_stderr = dup(STDERR_FILENO);
+	if (old_stderr < 0 || dup2(fds[1], STDERR_FILENO) < 0)
+		i_fatal("dup2() failed: %m");
+	i_set_failure_internal();
+	i_set_failure_buffer_size(8192);
+
+	/* fill the pipe - logging must not block or fail */
+	memset(str_c_modifiable(str), 'x', 1024);
+	while (write(STDERR_FILENO, str_data(str), 1024) > 0) ;
+	for (i = 0; i < 1000; i++)
+		i_debug("line %u", i);
+
+	str_truncate(str, 0);
+	test_failures_buffer_read(fds[0], str);
+	/* the buffer is empty again */
+	i_debug("after");
+	test_failures_buffer_read(fds[0], str);
+
+	lines = t_strsplit(str_c(str), "\n");
+	for (; *lines != NULL; lines++) {
+		if ((p = strchr(*lines, '\001')) == NULL ||
+		    (p[1] != LOG_TYPE_DEBUG+1 && p[1] != LOG_TYPE_WARNING+1))
+			continue;
+		p = strchr(p, ' ') + 1;
+		if (str_begins(p, "line ")) {
+			test_assert(dropped == 0);
+			test_assert(strcmp(p + 5, dec2str(next)) == 0);
+			next++;
+		} else if (str_begins(p, "Dropped ")) {
+			test_assert(next > 0 && dropped == 0);
+			dropped = atoi(p + 8);
+		} else if (strcmp(p, "after") == 0) {
+			seen_after = TRUE;
+		}
+		/* ignore other lines, e.g. data stack growing debug
+		   messages with devel-checks */
+	}
+	test_assert(next > 0 && next < 1000);
+	/* the dropped count may include other debug messages */
+	test_assert(next + dropped >= 1000);
+	test_assert(seen_after);
+
+	i_set_failure_buffer_size(0);
+	str_free(&str);
+	if (dup2(old_stderr, STDERR_FILENO) < 0)
+		i_fatal("dup2() failed: %m");
+	i_close_fd(&old_stderr);
+	i_close_fd(&fds[0]);
+	i_close_fd(&fds[1]);
+	i_set_fatal_handler(default_fatal_handler);
+	i_set_error_handler(handlers[1]);
+	i_set_info_handler(handlers[2]);
+	i_set_debug_handler(handlers[3]);
+	test_end();
+}
+
 void test_failures(void)
 {
 	test_get_set_handlers();
 	test_expected();
 	test_expected_str();
+	test_failures_buffer();
 }
@@ -140,6 +140,68 @@ static void test_hash_methods_fips() {
 			"\xe5\x46\x70\xf1",
 			160 / 8
 		},
+		{ "sha256",
+			"",
+			0,
+			1,
+			"\xe3\xb0\xc4\x42\x98\xfc\x1c\x14"
+			"\x9a\xfb\xf4\xc8\x99\x6f\xb9\x24"
+			"\x27\xae\x41\xe4\x64\x9b\x93\x4c"
+			"\xa4\x95\x99\x1b\x78\x52\xb8\x55",
+			256 / 8
+		},
+		{ "sha256",
+			"abc",
+			3,
+			1,
+			"\xba\x78\x16\xbf\x8f\x01\xcf\xea"
+			"\x41\x41\x40\xde\x5d\xae\x22\x23"
+			"\xb0\x03\x61\xa3\x96\x17\x7a\x9c"
+			"\xb4\x10\xff\x61\xf2\x00\x15\xad",
+			256 / 8
+		},
+		{ "sha256",
+			"abcdbcdecdefdefgefghfghighijhijk"
+			"ijkljklmklmnlmnomnopnopq",
+			56,
+			1,
+			"\x24\x8d\x6a\x61\xd2\x06\x38\xb8"
+			"\xe5\xc0\x26\x93\x0c\x3e\x60\x39"
+			"\xa3\x3c\xe4\x59\x64\xff\x21\x67"
+			"\xf6\xec\xed\xd4\x19\xdb\x06\xc1",
+			256 / 8
+		},
+		{ "sha256",
+			"a",
+			1,
+			1000000,
+			"\xcd\xc7\x6e\x5c\x99\x14\xfb\x92"
+			"\x81\xa1\xc7\xe2\x84\xd7\x3e\x67"
+			"\xf1\x80\x9a\x48\xa4\x97\x20\x0e"
+			"\x04\x6d\x39\xcc\xc7\x11\x2c\xd0",
+			256 / 8
+		},
+		{ "xxh64",
+			"",
+			0,
+			1,
+			"\xef\x46\xdb\x37\x51\xd8\xe9\x99",
+			64 / 8
+		},
+		{ "xxh64",
+			"abc",
+			3,
+			1,
+			"\x44\xbc\x2c\xf5\xad\x77\x09\x99",
+			64 / 8
+		},
+		{ "xxh64",
+			"Nobody inspects the spammish repetition",
+			39,
+			1,
+			"\xfb\xce\xa8\x3c\x8a\x37\x8b\xf1",
+			64 / 8
+		},
 		{ "sha3-256",
 			"",
 			0,
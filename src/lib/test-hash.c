@@ -4,7 +4,7 @@
 #include "hash.h"
 
 
-static void test_hash_random_pool(pool_t pool)
+static void test_hash_random_pool(pool_t pool, bool open_addressing)
 {
 #define KEYMAX 100000
 	HASH_TABLE(void *, void *) hash;
@@ -12,7 +12,10 @@ static void test_hash_random_pool(pool_t pool)
 	unsigned int i, key, keyidx, delidx;
 
 	keys = i_new(unsigned int, KEYMAX); keyidx = 0;
-	hash_table_create_direct(&hash, pool, 0);
+	if (open_addressing)
+		hash_table_create_direct_open(&hash, 0);
+	else
+		hash_table_create_direct(&hash, pool, 0);
 	for (i = 0; i < KEYMAX; i++) {
 		key = (i_rand() % KEYMAX) + 1;
 		if (i_rand() % 5 > 0) {
@@ -35,13 +38,95 @@ static void test_hash_random_pool(pool_t pool)
 	i_free(keys);
 }
 
+static void test_hash_open_iterate(void)
+{
+#define ITER_KEY_COUNT 1000
+	HASH_TABLE(void *, void *) hash;
+	struct hash_iterate_context *iter;
+	void *key, *value, *orig_key;
+	unsigned int i, count, seen[ITER_KEY_COUNT+1];
+
+	test_begin("hash open addressing iterate");
+	hash_table_create_direct_open(&hash, 0);
+	for (i = 1; i <= ITER_KEY_COUNT; i++)
+		hash_table_insert(hash, POINTER_CAST(i), POINTER_CAST(i));
+	hash_table_update(hash, POINTER_CAST(1), POINTER_CAST(2));
+	test_assert(hash_table_lookup_full(hash, POINTER_CAST(1),
+					   &orig_key, &value));
+	test_assert(orig_key == POINTER_CAST(1) && value == POINTER_CAST(2));
+	test_assert(hash_table_count(hash) == ITER_KEY_COUNT);
+
+	/* remove every other key while iterating */
+	memset(seen, 0, sizeof(seen));
+	count = 0;
+	iter = hash_table_iterate_init(hash);
+	while (hash_table_iterate(iter, hash, &key, &value)) {
+		i = POINTER_CAST_TO(key, unsigned int);
+		seen[i]++;
+		count++;
+		if (i % 2 == 0)
+			hash_table_remove(hash, key);
+	}
+	hash_table_iterate_deinit(&iter);
+	test_assert(count == ITER_KEY_COUNT);
+	for (i = 1; i <= ITER_KEY_COUNT; i++) {
+		test_assert_idx(seen[i] == 1, i);
+		test_assert_idx((hash_table_lookup(hash, POINTER_CAST(i)) != NULL) ==
+				(i % 2 != 0), i);
+	}
+	test_assert(hash_table_count(hash) == ITER_KEY_COUNT/2);
+
+	/* frozen tables can be filled past the maximum load */
+	hash_table_clear(hash, TRUE);
+	hash_table_freeze(hash);
+	for (i = 1; i <= ITER_KEY_COUNT; i++)
+		hash_table_insert(hash, POINTER_CAST(i), POINTER_CAST(i));
+	hash_table_thaw(hash);
+	for (i = 1; i <= ITER_KEY_COUNT; i++)
+		test_assert_idx(hash_table_lookup(hash, POINTER_CAST(i)) != NULL, i);
+	hash_table_destroy(&hash);
+	test_end();
+}
+
+static void test_hash_open_str(void)
+{
+	HASH_TABLE(const char *, const char *) hash;
+	const char *keys[100];
+	unsigned int i;
+
+	test_begin("hash open addressing strings");
+	hash_table_create_open(&hash, 0, strcase_hash, strcasecmp);
+	for (i = 0; i < N_ELEMENTS(keys); i++) {
+		keys[i] = t_strdup_printf("Key%u", i);
+		hash_table_insert(hash, keys[i], keys[i]);
+	}
+	for (i = 0; i < N_ELEMENTS(keys); i++) {
+		const char *lookup = t_strdup_printf("KEY%u", i);
+		test_assert_idx(hash_table_lookup(hash, lookup) == keys[i], i);
+	}
+	test_assert(hash_table_lookup(hash, t_strdup("key100")) == NULL);
+	for (i = 0; i < N_ELEMENTS(keys); i += 3)
+		test_assert_idx(hash_table_try_remove(hash, keys[i]), i);
+	for (i = 0; i < N_ELEMENTS(keys); i++) {
+		test_assert_idx((hash_table_lookup(hash, keys[i]) != NULL) ==
+				(i % 3 != 0), i);
+	}
+	test_assert(!hash_table_try_remove(hash, keys[0]));
+	hash_table_destroy(&hash);
+	test_end();
+}
+
 void test_hash(void)
 {
 	pool_t pool;
 
-	test_hash_random_pool(default_pool);
+	test_hash_random_pool(default_pool, FALSE);
+	test_hash_random_pool(NULL, TRUE);
 
 	pool = pool_alloconly_create("test hash", 1024);
-	test_hash_random_pool(pool);
+	test_hash_random_pool(pool, FALSE);
 	pool_unref(&pool);
+
+	test_hash_open_iterate();
+	test_hash_open_str();
 }
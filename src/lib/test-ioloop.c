@@ -7,6 +7,7 @@
 #include "istream.h"
 
 #include <unistd.h>
+#include <sys/wait.h>
 
 struct test_ctx {
 	bool got_left;
@@ -127,6 +128,73 @@ static void test_ioloop_timeout(void)
 	test_end();
 }
 
+struct test_wheel_timeout {
+	struct timeout *to;
+	unsigned int msecs;
+	struct timeval tv_fired;
+	unsigned int *pending_count;
+};
+
+static void test_ioloop_wheel_callback(struct test_wheel_timeout *wto)
+{
+	if (gettimeofday(&wto->tv_fired, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	timeout_remove(&wto->to);
+	if (--*wto->pending_count == 0)
+		io_loop_stop(current_ioloop);
+}
+
+static void test_ioloop_wheel_reset(struct test_wheel_timeout *wto)
+{
+	timeout_reset(wto->to);
+	wto->msecs += 500;
+	timeout_remove(&wto[1].to);
+}
+
+static void test_ioloop_timeout_wheel(void)
+{
+	static const unsigned int msecs[] = { 1000, 1050, 1200, 1100 };
+	struct test_wheel_timeout wtos[N_ELEMENTS(msecs) + 1];
+	struct ioloop *ioloop;
+	struct timeout *to_far, *to_very_far;
+	struct timeval tv_start;
+	unsigned int i, pending_count = N_ELEMENTS(msecs);
+	long long diff;
+
+	test_begin("ioloop timeout wheel");
+	ioloop = io_loop_create();
+	if (gettimeofday(&tv_start, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+
+	i_zero(&wtos);
+	for (i = 0; i < N_ELEMENTS(msecs); i++) {
+		wtos[i].msecs = msecs[i];
+		wtos[i].pending_count = &pending_count;
+		wtos[i].to = timeout_add(msecs[i], test_ioloop_wheel_callback,
+					 &wtos[i]);
+	}
+	/* reset the last one after 500 ms */
+	wtos[i].to = timeout_add_short(500, test_ioloop_wheel_reset,
+				       &wtos[i-1]);
+	/* these are never reached */
+	to_far = timeout_add(15*60*1000, test_ioloop_wheel_callback, &wtos[0]);
+	to_very_far = timeout_add(100*3600*1000, test_ioloop_wheel_callback,
+				  &wtos[0]);
+
+	io_loop_run(ioloop);
+	for (i = 0; i < N_ELEMENTS(msecs); i++) {
+		diff = timeval_diff_msecs(&wtos[i].tv_fired, &tv_start);
+		/* next_run is truncated to milliseconds */
+		test_assert_idx(diff + 3 >= wtos[i].msecs, i);
+		test_assert_idx(diff < wtos[i].msecs + 500, i);
+	}
+	test_assert(wtos[i].to == NULL);
+	timeout_remove(&to_far);
+	timeout_remove(&to_very_far);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
 static void io_callback(void *context ATTR_UNUSED)
 {
 }
@@ -196,10 +264,65 @@ static void test_ioloop_pending_io(void)
 	test_end();
 }
 
+static void test_ioloop_fork_cb(bool *called)
+{
+	*called = TRUE;
+	io_loop_stop(current_ioloop);
+}
+
+static void test_ioloop_fork_to(struct ioloop *ioloop)
+{
+	io_loop_stop(ioloop);
+}
+
+static void test_ioloop_reinit_after_fork(void)
+{
+	struct ioloop *ioloop;
+	struct io *io;
+	struct timeout *to;
+	bool called = FALSE;
+	int fds[2], status;
+	pid_t pid;
+
+	test_begin("ioloop reinit after fork");
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		i_fatal("socketpair() failed: %m");
+	ioloop = io_loop_create();
+	io = io_add(fds[0], IO_READ, test_ioloop_fork_cb, &called);
+
+	if ((pid = fork()) < 0)
+		i_fatal("fork() failed: %m");
+	if (pid == 0) {
+		/* removing the io in the child must not remove it from
+		   the parent's ioloop */
+		io_loop_reinit_after_fork();
+		io_remove(&io);
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0)
+		i_fatal("waitpid() failed: %m");
+	test_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	if (write(fds[1], "x", 1) != 1)
+		i_fatal("write() failed: %m");
+	to = timeout_add(2000, test_ioloop_fork_to, ioloop);
+	io_loop_run(ioloop);
+	test_assert(called);
+
+	timeout_remove(&to);
+	io_remove(&io);
+	io_loop_destroy(&ioloop);
+	i_close_fd(&fds[0]);
+	i_close_fd(&fds[1]);
+	test_end();
+}
+
 void test_ioloop(void)
 {
 	test_ioloop_timeout();
+	test_ioloop_timeout_wheel();
 	test_ioloop_find_fd_conditions();
 	test_ioloop_pending_io();
 	test_ioloop_fd();
+	test_ioloop_reinit_after_fork();
 }
@@ -48,6 +48,84 @@ static void test_iostream_temp_create_sized_disk(void)
 	test_end();
 }
 
+static void test_iostream_temp_mmap(void)
+{
+	struct ostream *output;
+	struct istream *input, *input2;
+	const unsigned char *data;
+	size_t size;
+
+	test_begin("iostream_temp mmap");
+	output = iostream_temp_create_sized(".", IOSTREAM_TEMP_FLAG_MMAP,
+					    "test", 4);
+	test_assert(o_stream_send_str(output, "123456789") == 9);
+	test_assert(o_stream_get_fd(output) != -1);
+	input = iostream_temp_finish(&output, 128);
+	test_assert(i_stream_read_more(input, &data, &size) > 0 &&
+		    size == 9 && memcmp(data, "123456789", 9) == 0);
+
+	/* reading it again via another stream doesn't affect the first */
+	input2 = i_stream_create_limit(input, 4);
+	test_assert(i_stream_read_more(input2, &data, &size) > 0 &&
+		    size == 4 && memcmp(data, "1234", 4) == 0);
+	i_stream_unref(&input2);
+	i_stream_skip(input, 9);
+	test_assert(i_stream_read(input) == -1 && input->stream_errno == 0);
+	i_stream_unref(&input);
+
+	/* small data stays in memory */
+	output = iostream_temp_create_sized(".", IOSTREAM_TEMP_FLAG_MMAP,
+					    "test", 16);
+	test_assert(o_stream_send_str(output, "123") == 3);
+	input = iostream_temp_finish(&output, 128);
+	test_assert(i_stream_read_more(input, &data, &size) > 0 &&
+		    size == 3 && memcmp(data, "123", 3) == 0);
+	i_stream_unref(&input);
+	test_end();
+}
+
+#ifdef HAVE_MEMFD_CREATE
+static void test_iostream_temp_memfd(void)
+{
+	struct ostream *output;
+	struct istream *input;
+	const unsigned char *data;
+	unsigned char buf[1024*64];
+	unsigned int i;
+	size_t size;
+	int fd;
+
+	test_begin("iostream_temp memfd");
+	/* the temp directory isn't needed */
+	output = iostream_temp_create_sized(".intentional-nonexistent-error/",
+					    IOSTREAM_TEMP_FLAG_MEMFD, "test", 4);
+	test_assert(o_stream_send_str(output, "123456789") == 9);
+	test_assert(o_stream_get_fd(output) != -1);
+	test_assert(o_stream_pwrite(output, "x", 1, 2) == 0);
+	input = iostream_temp_finish(&output, 128);
+	test_assert(i_stream_read_more(input, &data, &size) > 0 &&
+		    size == 9 && memcmp(data, "12x456789", 9) == 0);
+	i_stream_unref(&input);
+
+	/* growing past the total memfd size moves it to disk */
+	memset(buf, 'a', sizeof(buf));
+	output = iostream_temp_create_sized(".", IOSTREAM_TEMP_FLAG_MEMFD,
+					    "test", 4);
+	test_assert(o_stream_send_str(output, "12345") == 5);
+	fd = o_stream_get_fd(output);
+	test_assert(fd != -1);
+	for (i = 0; i < 1024*16*1024 / sizeof(buf); i++)
+		test_assert(o_stream_send(output, buf, sizeof(buf)) == sizeof(buf));
+	test_assert(o_stream_get_fd(output) != -1 &&
+		    o_stream_get_fd(output) != fd);
+	input = iostream_temp_finish(&output, 128);
+	test_assert(i_stream_read_bytes(input, &data, &size, 6) == 1 &&
+		    memcmp(data, "12345a", 6) == 0);
+	i_stream_unref(&input);
+	test_end();
+}
+#endif
+
 static void test_iostream_temp_create_write_error(void)
 {
 	struct ostream *output;
@@ -145,6 +223,10 @@ void test_iostream_temp(void)
 {
 	test_iostream_temp_create_sized_memory();
 	test_iostream_temp_create_sized_disk();
+	test_iostream_temp_mmap();
+#ifdef HAVE_MEMFD_CREATE
+	test_iostream_temp_memfd();
+#endif
 	test_iostream_temp_create_write_error();
 	test_iostream_temp_istream();
 }
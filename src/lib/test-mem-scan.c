@@ -0,0 +1,160 @@
+/* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
+
+#include "test-lib.h"
+#include "mem-scan.h"
+
+static const void *test_find_crlf(const unsigned char *data, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (data[i] == '\r' || data[i] == '\n')
+			return data + i;
+	}
+	return NULL;
+}
+
+static const void *test_find_json_escape(const unsigned char *data, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (data[i] < 0x20 || data[i] >= 0x80 ||
+		    data[i] == '"' || data[i] == '\\')
+			return data + i;
+	}
+	return NULL;
+}
+
+static void
+test_count_lfs(const unsigned char *data, size_t size, unsigned char prev,
+	       struct mem_lf_counts *counts)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (data[i] == '\n') {
+			counts->lf_count++;
+			if ((i == 0 ? prev : data[i-1]) != '\r')
+				counts->bare_lf_count++;
+		} else if (data[i] == '\0') {
+			counts->have_nuls = TRUE;
+		}
+	}
+}
+
+static void test_mem_find_crlf(void)
+{
+	static const char chars[] = "\r\nab.";
+	unsigned char buf[200];
+	unsigned int i, start, len;
+
+	test_begin("mem_find_crlf()");
+	test_assert(mem_find_crlf("", 0) == NULL);
+	memset(buf, 'x', sizeof(buf));
+	for (i = 0; i < sizeof(buf); i++) {
+		test_assert_idx(mem_find_crlf(buf, i) == NULL, i);
+		buf[i] = (i % 2) == 0 ? '\r' : '\n';
+		test_assert_idx(mem_find_crlf(buf, sizeof(buf)) == buf + i, i);
+		test_assert_idx(mem_find_crlf(buf, i) == NULL, i);
+		buf[i] = 'x';
+	}
+
+	for (i = 0; i < 1000; i++) {
+		for (len = 0; len < sizeof(buf); len++) {
+			buf[len] = i_rand_limit(20) != 0 ? 'x' :
+				chars[i_rand_limit(sizeof(chars)-1)];
+		}
+		start = i_rand_limit(32);
+		len = i_rand_limit(sizeof(buf) - start + 1);
+		test_assert_idx(mem_find_crlf(buf + start, len) ==
+				test_find_crlf(buf + start, len), i);
+	}
+	test_end();
+}
+
+static void test_mem_find_chr2(void)
+{
+	unsigned char buf[100];
+	unsigned int i;
+
+	test_begin("mem_find_chr2()");
+	test_assert(mem_find_chr2("", 0, '"', '\\') == NULL);
+	memset(buf, 'x', sizeof(buf));
+	test_assert(mem_find_chr2(buf, sizeof(buf), '"', '\\') == NULL);
+	for (i = 0; i < sizeof(buf); i++) {
+		buf[i] = (i % 2) == 0 ? '"' : '\\';
+		test_assert_idx(mem_find_chr2(buf, sizeof(buf), '"', '\\') ==
+				buf + i, i);
+		test_assert_idx(mem_find_chr2(buf, i, '"', '\\') == NULL, i);
+		buf[i] = 'x';
+	}
+	test_end();
+}
+
+static void test_mem_find_json_escape(void)
+{
+	static const unsigned char chars[] = {
+		'"', '\\', '\0', '\n', 0x1f, 0x20, 0x7e, 0x7f, 0x80, 0xff
+	};
+	unsigned char buf[200];
+	unsigned int i, start, len;
+
+	test_begin("mem_find_json_escape()");
+	for (i = 0; i < 1000; i++) {
+		for (len = 0; len < sizeof(buf); len++) {
+			buf[len] = i_rand_limit(20) != 0 ? 'x' :
+				chars[i_rand_limit(sizeof(chars))];
+		}
+		start = i_rand_limit(32);
+		len = i_rand_limit(sizeof(buf) - start + 1);
+		test_assert_idx(mem_find_json_escape(buf + start, len) ==
+				test_find_json_escape(buf + start, len), i);
+	}
+	test_end();
+}
+
+static void test_mem_count_lfs(void)
+{
+	static const char chars[] = "\r\n\0a";
+	struct mem_lf_counts counts, test_counts;
+	unsigned char buf[200];
+	unsigned int i, start, len;
+	unsigned char prev;
+
+	test_begin("mem_count_lfs()");
+	i_zero(&counts);
+	mem_count_lfs("\n", 1, '\r', &counts);
+	test_assert(counts.lf_count == 1 && counts.bare_lf_count == 0);
+	mem_count_lfs("\n", 1, 'x', &counts);
+	test_assert(counts.lf_count == 2 && counts.bare_lf_count == 1);
+	test_assert(!counts.have_nuls);
+
+	for (i = 0; i < 1000; i++) {
+		for (len = 0; len < sizeof(buf); len++) {
+			buf[len] = i_rand_limit(3) != 0 ? 'x' :
+				chars[i_rand_limit(sizeof(chars)-1)];
+		}
+		start = i_rand_limit(32);
+		len = i_rand_limit(sizeof(buf) - start + 1);
+		prev = i_rand_limit(2) == 0 ? '\r' : 'x';
+
+		i_zero(&counts);
+		i_zero(&test_counts);
+		mem_count_lfs(buf + start, len, prev, &counts);
+		test_count_lfs(buf + start, len, prev, &test_counts);
+		test_assert_idx(counts.lf_count == test_counts.lf_count, i);
+		test_assert_idx(counts.bare_lf_count ==
+				test_counts.bare_lf_count, i);
+		test_assert_idx(counts.have_nuls == test_counts.have_nuls, i);
+	}
+	test_end();
+}
+
+void test_mem_scan(void)
+{
+	test_mem_find_crlf();
+	test_mem_find_chr2();
+	test_mem_find_json_escape();
+	test_mem_count_lfs();
+}
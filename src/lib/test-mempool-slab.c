@@ -0,0 +1,97 @@
+/* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
+
+#include "test-lib.h"
+
+static bool mem_has_bytes(const void *mem, size_t size, uint8_t b)
+{
+	const uint8_t *bytes = mem;
+	unsigned int i;
+
+	for (i = 0; i < size; i++) {
+		if (bytes[i] != b)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static void test_mempool_slab_alloc_free(void)
+{
+	void *mems[256];
+	size_t used = 0;
+	pool_t pool;
+	unsigned int i;
+
+	test_begin("mempool_slab alloc and free");
+	pool = pool_slab_create("test");
+
+	for (i = 0; i < N_ELEMENTS(mems); i++) {
+		mems[i] = p_malloc(pool, i*9 + 1);
+		test_assert_idx(mem_has_bytes(mems[i], i*9 + 1, 0), i);
+		memset(mems[i], i, i*9 + 1);
+	}
+	/* free every other one and allocate them again */
+	for (i = 0; i < N_ELEMENTS(mems); i += 2)
+		p_free(pool, mems[i]);
+	for (i = 0; i < N_ELEMENTS(mems); i += 2) {
+		mems[i] = p_malloc(pool, i*9 + 1);
+		test_assert_idx(mem_has_bytes(mems[i], i*9 + 1, 0), i);
+		memset(mems[i], i, i*9 + 1);
+	}
+	for (i = 0; i < N_ELEMENTS(mems); i++) {
+		test_assert_idx(mem_has_bytes(mems[i], i*9 + 1, i), i);
+		used += i*9 + 1;
+	}
+	test_assert(pool_slab_get_total_used_size(pool) >= used);
+	test_assert(pool_slab_get_total_alloc_size(pool) >=
+		    pool_slab_get_total_used_size(pool));
+
+	for (i = 0; i < N_ELEMENTS(mems); i++)
+		p_free(pool, mems[i]);
+	test_assert(pool_slab_get_total_used_size(pool) == 0);
+
+	/* clearing releases everything at once */
+	for (i = 0; i < N_ELEMENTS(mems); i++)
+		mems[i] = p_malloc(pool, i*9 + 1);
+	p_clear(pool);
+	test_assert(pool_slab_get_total_used_size(pool) == 0);
+	mems[0] = p_malloc(pool, 10);
+	test_assert(mem_has_bytes(mems[0], 10, 0));
+
+	pool_unref(&pool);
+	test_end();
+}
+
+static void test_mempool_slab_realloc(void)
+{
+	pool_t pool;
+	unsigned char *mem = NULL;
+	unsigned int i;
+
+	test_begin("mempool_slab realloc");
+	pool = pool_slab_create("test");
+
+	/* grow through all the size classes and into large allocations */
+	for (i = 1; i < 3000; i++) {
+		mem = p_realloc(pool, mem, i-1, i);
+		test_assert_idx(mem_has_bytes(mem, i-1, 0xde), i);
+		test_assert_idx(mem[i-1] == 0, i);
+		memset(mem, 0xde, i);
+	}
+	/* shrink back to a small allocation */
+	mem = p_realloc(pool, mem, i-1, 10);
+	test_assert(mem_has_bytes(mem, 10, 0xde));
+	mem = p_realloc(pool, mem, 10, 20);
+	test_assert(mem_has_bytes(mem, 10, 0xde));
+	test_assert(mem_has_bytes(mem + 10, 10, 0));
+	p_free(pool, mem);
+	test_assert(pool_slab_get_total_used_size(pool) == 0);
+
+	pool_unref(&pool);
+	test_end();
+}
+
+void test_mempool_slab(void)
+{
+	test_mempool_slab_alloc_free();
+	test_mempool_slab_realloc();
+}
@@ -1,6 +1,7 @@
 /* Copyright (c) 2009-2018 Dovecot authors, see the included COPYING file */
 
 #include "test-lib.h"
+#include "ioloop.h"
 #include "net.h"
 #include "str.h"
 #include "safe-mkstemp.h"
@@ -173,9 +174,128 @@ static void test_ostream_file_send_istream_sendfile(void)
 	test_end();
 }
 
+static void test_ostream_file_send_istream_splice(void)
+{
+	struct ioloop *ioloop;
+	struct istream *input;
+	struct ostream *output;
+	unsigned char data[MAX_BUFSIZE*64], buf[sizeof(data)];
+	enum ostream_send_istream_result res;
+	size_t i, filled = 0, pos = 0;
+	ssize_t ret;
+	int in_fd[2], sock_fd[2];
+
+	test_begin("ostream file send istream splice()");
+	ioloop = io_loop_create();
+
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = i % 251;
+
+	/* pipe istream */
+	i_assert(pipe(in_fd) == 0);
+	fd_set_nonblock(in_fd[0], TRUE);
+	input = i_stream_create_fd(in_fd[0], 1024);
+
+	/* temp socket ostream */
+	i_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sock_fd) == 0);
+	fd_set_nonblock(sock_fd[0], TRUE);
+	fd_set_nonblock(sock_fd[1], TRUE);
+	output = o_stream_create_fd(sock_fd[0], sizeof(data));
+
+	/* data that fits directly to the socket */
+	test_assert(write(in_fd[1], "abcdefghij", 10) == 10);
+	test_assert(o_stream_send_istream(output, input) ==
+		    OSTREAM_SEND_ISTREAM_RESULT_WAIT_INPUT);
+	test_assert(output->offset == 10 && input->v_offset == 10);
+	test_assert(read(sock_fd[1], buf, sizeof(buf)) == 10 &&
+		    memcmp(buf, "abcdefghij", 10) == 0);
+
+	/* fill up the socket, so the rest needs to be buffered */
+	memset(buf, 0, sizeof(buf));
+	while ((ret = write(sock_fd[0], buf, sizeof(buf))) > 0)
+		filled += ret;
+	test_assert(errno == EAGAIN);
+	test_assert(write(in_fd[1], data, sizeof(data)) == sizeof(data));
+	i_close_fd(&in_fd[1]);
+	res = o_stream_send_istream(output, input);
+	test_assert(res == OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT);
+	test_assert(o_stream_get_buffer_used_size(output) > 0);
+	test_assert(input->v_offset == 10 + sizeof(data));
+	test_assert(output->offset == 10 + sizeof(data));
+
+	/* read everything and check that the data is intact */
+	for (;;) {
+		ret = read(sock_fd[1], buf, sizeof(buf));
+		for (i = 0; ret > 0 && i < (size_t)ret; i++, pos++) {
+			if (pos >= filled &&
+			    buf[i] != data[pos - filled])
+				break;
+		}
+		if (ret > 0 && i < (size_t)ret)
+			break;
+		if (o_stream_flush(output) < 0)
+			break;
+		if (res == OSTREAM_SEND_ISTREAM_RESULT_FINISHED) {
+			if (ret <= 0)
+				break;
+		} else if (o_stream_get_buffer_used_size(output) == 0) {
+			res = o_stream_send_istream(output, input);
+		}
+	}
+	test_assert(res == OSTREAM_SEND_ISTREAM_RESULT_FINISHED);
+	test_assert(input->eof);
+	test_assert(pos == filled + sizeof(data));
+
+	i_stream_unref(&input);
+	o_stream_destroy(&output);
+	i_close_fd(&in_fd[0]);
+	i_close_fd(&sock_fd[0]);
+	i_close_fd(&sock_fd[1]);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+static void test_ostream_file_sendv_buffered(void)
+{
+	struct ostream *output;
+	struct const_iovec iov[2];
+	char buf[32];
+	int sock_fd[2];
+
+	test_begin("ostream file sendv with buffered data");
+
+	i_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sock_fd) == 0);
+	output = o_stream_create_fd(sock_fd[0], 10);
+
+	/* the first send stays in the buffer */
+	o_stream_cork(output);
+	test_assert(o_stream_send(output, "abc", 3) == 3);
+	test_assert(o_stream_get_buffer_used_size(output) == 3);
+
+	/* this doesn't fit to the buffer, so it's written together with the
+	   buffered data */
+	iov[0].iov_base = "defghijk";
+	iov[0].iov_len = 8;
+	iov[1].iov_base = "lmnopqrs";
+	iov[1].iov_len = 8;
+	test_assert(o_stream_sendv(output, iov, 2) == 16);
+	test_assert(o_stream_get_buffer_used_size(output) == 0);
+	test_assert(output->offset == 19);
+	test_assert(read(sock_fd[1], buf, sizeof(buf)) == 19 &&
+		    memcmp(buf, "abcdefghijklmnopqrs", 19) == 0);
+	o_stream_uncork(output);
+
+	o_stream_destroy(&output);
+	i_close_fd(&sock_fd[0]);
+	i_close_fd(&sock_fd[1]);
+	test_end();
+}
+
 void test_ostream_file(void)
 {
 	test_ostream_file_random();
 	test_ostream_file_send_istream_file();
 	test_ostream_file_send_istream_sendfile();
+	test_ostream_file_send_istream_splice();
+	test_ostream_file_sendv_buffered();
 }
@@ -294,6 +294,73 @@ static void test_seq_range_array_have_common(void)
 	test_out("seq_range_array_have_common()", success);
 }
 
+static void
+test_seq_range_create_bits(ARRAY_TYPE(seq_range) *array, uint32_t base,
+			   uint32_t bits)
+{
+	unsigned int i;
+
+	array_clear(array);
+	for (i = 0; i < 32; i++) {
+		if ((bits & (1U << i)) != 0)
+			seq_range_array_add(array, base + i);
+	}
+}
+
+static bool
+test_seq_range_equals_bits(const ARRAY_TYPE(seq_range) *array, uint32_t base,
+			   uint32_t bits)
+{
+	ARRAY_TYPE(seq_range) expected;
+
+	t_array_init(&expected, 16);
+	test_seq_range_create_bits(&expected, base, bits);
+	return array_cmp(array, &expected);
+}
+
+static void test_seq_range_array_set_ops(void)
+{
+	ARRAY_TYPE(seq_range) arr1, arr2, dest;
+	uint32_t base, bits1, bits2;
+	unsigned int i, ret;
+	bool success = TRUE;
+
+	test_begin("seq_range_array set operations");
+	t_array_init(&arr1, 16);
+	t_array_init(&arr2, 16);
+	t_array_init(&dest, 16);
+	for (i = 0; i < 10000 && success; i++) {
+		/* test also the ranges at the end of uint32_t */
+		base = i % 2 == 0 ? 1 : (uint32_t)-32;
+		bits1 = i_rand();
+		bits2 = i_rand();
+		test_seq_range_create_bits(&arr1, base, bits1);
+		test_seq_range_create_bits(&arr2, base, bits2);
+
+		array_clear(&dest);
+		array_append_array(&dest, &arr1);
+		seq_range_array_merge(&dest, &arr2);
+		if (!test_seq_range_equals_bits(&dest, base, bits1 | bits2))
+			success = FALSE;
+
+		array_clear(&dest);
+		array_append_array(&dest, &arr1);
+		ret = seq_range_array_intersect(&dest, &arr2);
+		if (!test_seq_range_equals_bits(&dest, base, bits1 & bits2) ||
+		    ret != seq_range_count(&arr1) - seq_range_count(&dest))
+			success = FALSE;
+
+		array_clear(&dest);
+		array_append_array(&dest, &arr1);
+		ret = seq_range_array_remove_seq_range(&dest, &arr2);
+		if (!test_seq_range_equals_bits(&dest, base, bits1 & ~bits2) ||
+		    ret != seq_range_count(&arr1) - seq_range_count(&dest))
+			success = FALSE;
+	}
+	test_assert(success);
+	test_end();
+}
+
 void test_seq_range_array(void)
 {
 	test_seq_range_array_add_boundaries();
@@ -302,5 +369,6 @@ void test_seq_range_array(void)
 	test_seq_range_array_invert();
 	test_seq_range_array_invert_edges();
 	test_seq_range_array_have_common();
+	test_seq_range_array_set_ops();
 	test_seq_range_array_random();
 }
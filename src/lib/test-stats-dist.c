@@ -79,6 +79,66 @@ static void test_stats_dist_get_variance(void)
 	test_end();
 }
 
+static void test_stats_dist_sketch(void)
+{
+#define SKETCH_VALUE_COUNT 100000
+	struct stats_dist *t, *t2, *merged;
+	uint64_t value, expected;
+	unsigned int i;
+	double fraction;
+
+	test_begin("stats_dists sketch");
+	t = stats_dist_init_sketch();
+	t2 = stats_dist_init_sketch();
+	merged = stats_dist_init_sketch();
+	test_assert(stats_dist_get_percentile(t, 0.5) == 0);
+	/* add 1..SKETCH_VALUE_COUNT in a shuffled order, half to each */
+	for (i = 0; i < SKETCH_VALUE_COUNT; i++) {
+		value = (i * 7919ULL) % SKETCH_VALUE_COUNT + 1;
+		stats_dist_add(i % 2 == 0 ? t : t2, value);
+	}
+	stats_dist_merge(merged, t);
+	stats_dist_merge(merged, t2);
+	test_assert(stats_dist_get_count(merged) == SKETCH_VALUE_COUNT);
+	test_assert(stats_dist_get_sum(merged) ==
+		    (uint64_t)SKETCH_VALUE_COUNT * (SKETCH_VALUE_COUNT+1) / 2);
+	test_assert(stats_dist_get_min(merged) == 1);
+	test_assert(stats_dist_get_max(merged) == SKETCH_VALUE_COUNT);
+	test_assert(DBL_EQ(stats_dist_get_avg(merged),
+			   (SKETCH_VALUE_COUNT+1) / 2.0));
+	/* variance of 1..n is (n^2-1)/12 */
+	test_assert(fabs(stats_dist_get_variance(merged) -
+			 ((double)SKETCH_VALUE_COUNT*SKETCH_VALUE_COUNT - 1) / 12) < 1.0);
+
+	for (fraction = 0.01; fraction < 1.0; fraction += 0.01) {
+		expected = SKETCH_VALUE_COUNT * fraction;
+		value = stats_dist_get_percentile(merged, fraction);
+		test_assert_idx(value >= expected * 0.99 &&
+				value <= expected * 1.01 + 1,
+				(unsigned int)(fraction * 100));
+	}
+	value = stats_dist_get_median(merged);
+	test_assert(value >= SKETCH_VALUE_COUNT/2 * 0.99 &&
+		    value <= SKETCH_VALUE_COUNT/2 * 1.01);
+	test_assert(stats_dist_get_percentile(merged, 1.0) == SKETCH_VALUE_COUNT);
+	test_assert(stats_dist_get_percentile(merged, 0.0) == 1);
+
+	/* small values are exact */
+	stats_dist_reset(t);
+	for (i = 0; i < 100; i++)
+		stats_dist_add(t, i);
+	test_assert(stats_dist_get_percentile(t, 0.5) == 49);
+	test_assert(stats_dist_get_median(t) == 49);
+	stats_dist_add(t, (uint64_t)-1);
+	test_assert(stats_dist_get_max(t) == (uint64_t)-1);
+	test_assert(stats_dist_get_percentile(t, 1.0) == (uint64_t)-1);
+
+	stats_dist_deinit(&t);
+	stats_dist_deinit(&t2);
+	stats_dist_deinit(&merged);
+	test_end();
+}
+
 void test_stats_dist(void)
 {
 	static int64_t test_input1[] = {
@@ -129,4 +189,5 @@ void test_stats_dist(void)
 	test_end();
 
 	test_stats_dist_get_variance();
+	test_stats_dist_sketch();
 }
@@ -0,0 +1,93 @@
+/* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
+
+#include "test-lib.h"
+#include "str-find-multi.h"
+
+static void test_str_find_multi_blocks(void)
+{
+	static const char *text = "ushers she hehis";
+	static const char *const keys[] = {
+		"he", "she", "his", "hers", "hehis", "x", "shex", "he", NULL
+	};
+	static const bool found[] = {
+		TRUE, TRUE, TRUE, TRUE, TRUE, FALSE, FALSE, TRUE
+	};
+	struct str_find_multi_context *ctx;
+	const unsigned char *data = (const unsigned char *)text;
+	size_t i, len = strlen(text);
+	unsigned int j;
+
+	test_begin("str_find_multi() blocks");
+	ctx = str_find_multi_init(default_pool, keys);
+	/* the same result with every possible block size */
+	for (i = 1; i <= len; i++) {
+		size_t pos;
+
+		str_find_multi_reset_found(ctx);
+		for (pos = 0; pos < len; pos += i)
+			(void)str_find_multi_more(ctx, data + pos,
+						  I_MIN(i, len - pos));
+		for (j = 0; keys[j] != NULL; j++)
+			test_assert_idx(str_find_multi_is_found(ctx, j) == found[j], i*100 + j);
+		test_assert(!str_find_multi_all_found(ctx));
+	}
+
+	/* reset() doesn't allow matches across the data blocks */
+	str_find_multi_reset_found(ctx);
+	test_assert(!str_find_multi_more(ctx, (const void *)"s", 1));
+	str_find_multi_reset(ctx);
+	test_assert(str_find_multi_more(ctx, (const void *)"hex", 3));
+	test_assert(str_find_multi_is_found(ctx, 0));
+	test_assert(!str_find_multi_is_found(ctx, 1));
+	test_assert(str_find_multi_is_found(ctx, 5));
+	test_assert(!str_find_multi_is_found(ctx, 6));
+	str_find_multi_deinit(&ctx);
+	test_end();
+}
+
+static void test_str_find_multi_random(void)
+{
+	const char *keys[5];
+	char text[64], key_buf[N_ELEMENTS(keys)][5];
+	struct str_find_multi_context *ctx;
+	unsigned int i, j, n, key_count, len;
+
+	test_begin("str_find_multi() random");
+	for (i = 0; i < 1000; i++) {
+		/* a small alphabet gives a lot of partial matches */
+		len = i_rand_limit(sizeof(text) - 1);
+		for (j = 0; j < len; j++)
+			text[j] = 'a' + i_rand_limit(3);
+		text[len] = '\0';
+
+		key_count = i_rand_minmax(1, N_ELEMENTS(keys) - 1);
+		for (j = 0; j < key_count; j++) {
+			unsigned int key_len =
+				i_rand_minmax(1, sizeof(key_buf[j]) - 1);
+			for (n = 0; n < key_len; n++)
+				key_buf[j][n] = 'a' + i_rand_limit(3);
+			key_buf[j][key_len] = '\0';
+			keys[j] = key_buf[j];
+		}
+		keys[key_count] = NULL;
+
+		ctx = str_find_multi_init(default_pool, keys);
+		for (j = 0; j < len; ) {
+			n = i_rand_minmax(1, len - j);
+			(void)str_find_multi_more(ctx, (const void *)(text + j), n);
+			j += n;
+		}
+		for (j = 0; j < key_count; j++) {
+			test_assert_idx(str_find_multi_is_found(ctx, j) ==
+					(strstr(text, keys[j]) != NULL), i);
+		}
+		str_find_multi_deinit(&ctx);
+	}
+	test_end();
+}
+
+void test_str_find_multi(void)
+{
+	test_str_find_multi_blocks();
+	test_str_find_multi_random();
+}
@@ -121,6 +121,44 @@ static void test_unichar_surrogates(void)
 	test_end();
 }
 
+static void test_unichar_ascii_fast_path(void)
+{
+	unsigned char input[300];
+	buffer_t *output = t_buffer_create(sizeof(input));
+	unsigned int i, start;
+	bool success = TRUE;
+
+	test_begin("unichar ascii fast path");
+	for (i = 0; i < sizeof(input); i++)
+		input[i] = 1 + i % 127;
+	test_assert(uni_utf8_ascii_prefix_len(input, sizeof(input)) ==
+		    sizeof(input));
+	test_assert(uni_utf8_ascii_prefix_len(input, 0) == 0);
+
+	/* test all the word alignments */
+	for (start = 0; start < 16; start++) {
+		buffer_set_used_size(output, 0);
+		test_assert_idx(uni_utf8_to_decomposed_titlecase(input + start,
+				sizeof(input) - start, output) == 0, start);
+		test_assert_idx(output->used == sizeof(input) - start, start);
+		for (i = start; i < sizeof(input) && success; i++) {
+			if (((const unsigned char *)output->data)[i - start] !=
+			    uni_ucs4_to_titlecase(input[i]))
+				success = FALSE;
+		}
+		test_assert_idx(success, start);
+	}
+
+	/* 8bit byte in the middle of a word */
+	input[13] = 0xc3; input[14] = 0xa4;
+	test_assert(uni_utf8_ascii_prefix_len(input, sizeof(input)) == 13);
+	test_assert(uni_utf8_data_is_valid(input, sizeof(input)));
+	test_assert(uni_utf8_strlen_n(input, 20) == 19);
+	input[14] = 'x';
+	test_assert(!uni_utf8_data_is_valid(input, sizeof(input)));
+	test_end();
+}
+
 void test_unichar(void)
 {
 	static const char overlong_utf8[] = "\xf8\x80\x95\x81\xa1";
@@ -182,4 +220,5 @@ void test_unichar(void)
 	test_unichar_uni_utf8_partial_strlen_n();
 	test_unichar_valid_unicode();
 	test_unichar_surrogates();
+	test_unichar_ascii_fast_path();
 }
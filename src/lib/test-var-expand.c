@@ -458,6 +458,73 @@ static void test_var_expand_merge_tables(void)
 	test_end();
 }
 
+static void test_var_expand_program(void)
+{
+	static const char *tests[] = {
+		"",
+		"plain text",
+		"%u@%d",
+		"%Lu/%{domain}/%1.2Ud",
+		"%{user}%{nonexistent}%{func1:foo}",
+		"%Hu %N{user} %2.3Hd %M{domain}",
+		"%05{number} %-3.2{domain} %3.-2n",
+		"%{if;%u;eq;user;yes;no} %{md5:user}",
+		"%x %% %",
+		"%{unclosed",
+		"trailing %L",
+	};
+	static const struct var_expand_table table[] = {
+		{ 'u', "User", "user" },
+		{ 'd', "Example.com", "domain" },
+		{ 'n', "42", "number" },
+		{ '\0', NULL, NULL }
+	};
+	static const struct var_expand_table table2[] = {
+		{ 'u', "other", "user" },
+		{ 'd', "example.org", "domain" },
+		{ 'n', "7", "number" },
+		{ '\0', NULL, NULL }
+	};
+	/* different layout than the table used for compiling */
+	static const struct var_expand_table table3[] = {
+		{ 'd', "example.net", "domain" },
+		{ 'u', "third", "user" },
+		{ '\0', NULL, NULL }
+	};
+	static const struct var_expand_func_table func_table[] = {
+		{ "func1", test_var_expand_func1 },
+		{ NULL, NULL }
+	};
+	const struct var_expand_table *const tables[] = {
+		table, table2, table3, NULL
+	};
+	struct var_expand_program *program;
+	string_t *str = t_str_new(128), *str2 = t_str_new(128);
+	const char *error, *error2;
+	unsigned int i, j;
+	int ret, ret2, ctx = 0xabcdef;
+
+	test_begin("var_expand_program");
+	for (i = 0; i < N_ELEMENTS(tests); i++) {
+		program = var_expand_program_compile(tests[i], table);
+		for (j = 0; j < N_ELEMENTS(tables); j++) {
+			str_truncate(str, 0);
+			str_truncate(str2, 0);
+			ret = var_expand_with_funcs(str, tests[i], tables[j],
+						    func_table, &ctx, &error);
+			ret2 = var_expand_program_expand(program, str2,
+							 tables[j], func_table,
+							 &ctx, &error2);
+			test_assert_idx(ret == ret2, i);
+			test_assert_idx(strcmp(str_c(str), str_c(str2)) == 0, i);
+			test_assert_idx(null_strcmp(error, error2) == 0, i);
+		}
+		var_expand_program_free(&program);
+		test_assert(program == NULL);
+	}
+	test_end();
+}
+
 void test_var_expand(void)
 {
 	test_var_expand_ranges();
@@ -469,4 +536,5 @@ void test_var_expand(void)
 	test_var_expand_extensions();
 	test_var_expand_if();
 	test_var_expand_merge_tables();
+	test_var_expand_program();
 }
@@ -13,6 +13,25 @@
 const unsigned char utf8_replacement_char[UTF8_REPLACEMENT_CHAR_LEN] =
 	{ 0xef, 0xbf, 0xbd }; /* 0xfffd */
 
+#define UNI_ASCII_WORD_HIGH_BITS 0x8080808080808080ULL
+
+size_t uni_utf8_ascii_prefix_len(const void *_data, size_t size)
+{
+	const unsigned char *data = _data;
+	uint64_t word;
+	size_t i;
+
+	/* check a word at a time */
+	for (i = 0; i + sizeof(word) <= size; i += sizeof(word)) {
+		memcpy(&word, data + i, sizeof(word));
+		if ((word & UNI_ASCII_WORD_HIGH_BITS) != 0)
+			break;
+	}
+	while (i < size && data[i] < 0x80)
+		i++;
+	return i;
+}
+
 static const uint8_t utf8_non1_bytes[256 - 192 - 2] = {
 	2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,
 	3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,4,4,4,4,4,4,4,4,5,5,5,5,6,6,1,1
@@ -208,6 +227,12 @@ unsigned int uni_utf8_partial_strlen_n(const void *_input, size_t size,
 	size_t i;
 
 	for (i = 0; i < size; ) {
+		if (input[i] < 0x80) {
+			count = uni_utf8_ascii_prefix_len(input + i, size - i);
+			i += count;
+			len += count;
+			continue;
+		}
 		count = uni_utf8_char_bytes(input[i]);
 		if (i + count > size)
 			break;
@@ -326,6 +351,35 @@ static void output_add_replacement_char(buffer_t *output)
 	buffer_append(output, utf8_replacement_char, UTF8_REPLACEMENT_CHAR_LEN);
 }
 
+static inline uint64_t ATTR_UNSIGNED_WRAPS
+uni_ascii_word_to_titlecase(uint64_t word)
+{
+	/* All the bytes are 7bit, so the additions can't carry over to the
+	   next byte. The high bit gets set for bytes >= 'a' and > 'z'. */
+	uint64_t ge_a = word + 0x1f1f1f1f1f1f1f1fULL;
+	uint64_t gt_z = word + 0x0505050505050505ULL;
+	uint64_t mask = ge_a & ~gt_z & UNI_ASCII_WORD_HIGH_BITS;
+
+	/* titlecase is the same as uppercase for ASCII */
+	return word ^ (mask >> 2);
+}
+
+static void
+uni_ascii_to_titlecase(const unsigned char *input, size_t size,
+		       unsigned char *output)
+{
+	uint64_t word;
+	size_t i;
+
+	for (i = 0; i + sizeof(word) <= size; i += sizeof(word)) {
+		memcpy(&word, input + i, sizeof(word));
+		word = uni_ascii_word_to_titlecase(word);
+		memcpy(output + i, &word, sizeof(word));
+	}
+	for (; i < size; i++)
+		output[i] = titlecase8_map[input[i]];
+}
+
 int uni_utf8_to_decomposed_titlecase(const void *_input, size_t size,
 				     buffer_t *output)
 {
@@ -334,6 +388,16 @@ int uni_utf8_to_decomposed_titlecase(const void *_input, size_t size,
 	int ret = 0;
 
 	while (size > 0) {
+		if (*input < 0x80) {
+			/* ASCII has no decompositions */
+			size_t len = uni_utf8_ascii_prefix_len(input, size);
+			uni_ascii_to_titlecase(input, len,
+				buffer_append_space_unsafe(output, len));
+			input += len;
+			size -= len;
+			continue;
+		}
+
 		int bytes = uni_utf8_get_char_n(input, size, &chr);
 		if (bytes <= 0) {
 			/* invalid input. try the next byte. */
@@ -371,7 +435,7 @@ static int uni_utf8_find_invalid_pos(const unsigned char *input, size_t size,
 	/* find the first invalid utf8 sequence */
 	for (i = 0; i < size;) {
 		if (input[i] < 0x80)
-			i++;
+			i += uni_utf8_ascii_prefix_len(input + i, size - i);
 		else {
 			len = is_valid_utf8_seq(input + i, size-i);
 			if (unlikely(len == 0)) {
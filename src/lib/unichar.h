@@ -110,6 +110,9 @@ int uni_utf8_to_decomposed_titlecase(const void *input, size_t size,
    replacement character (0xfffd), write the output to buf and return FALSE. */
 bool uni_utf8_get_valid_data(const unsigned char *input, size_t size,
 			     buffer_t *buf) ATTR_WARN_UNUSED_RESULT;
+/* Returns the number of bytes at the beginning of data that are 7bit ASCII
+   (and so also valid UTF-8). */
+size_t uni_utf8_ascii_prefix_len(const void *data, size_t size);
 /* Returns TRUE if string is valid UTF-8 input. */
 bool uni_utf8_str_is_valid(const char *str);
 /* Returns TRUE if data contains only valid UTF-8 input. */
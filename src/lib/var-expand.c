@@ -457,19 +457,209 @@ var_expand_long(struct var_expand_context *ctx,
 	return ret;
 }
 
+struct var_expand_field {
+	/* short key, or '\0' with %{long_key} */
+	char key;
+	/* %{long_key} without the {} */
+	const char *long_key;
+	size_t long_key_len;
+
+	int offset, width;
+	bool zero_padding;
+	unsigned int modifier_count;
+	const char *(*modifiers[MAX_MODIFIER_COUNT])
+		(const char *, struct var_expand_context *);
+};
+
+struct var_expand_program_op {
+	/* non-NULL for literal text, otherwise field is used */
+	const char *literal;
+	struct var_expand_field field;
+	/* index of the variable in the table given to compile,
+	   or -1 if it wasn't found */
+	int table_idx;
+};
+
+struct var_expand_program {
+	pool_t pool;
+	size_t table_size;
+	ARRAY(struct var_expand_program_op) ops;
+};
+
+/* Parse [<offset>.]<width>[<modifiers>]<variable> from str, which points
+   to the data after '%'. Returns the last character of the variable, or NULL
+   if the string ended before the variable. */
+static const char *
+var_expand_parse_field(const char *str, struct var_expand_field *field_r)
+{
+	const struct var_expand_modifier *m;
+	const char *end;
+	int sign = 1;
+
+	i_zero(field_r);
+	if (*str == '-') {
+		sign = -1;
+		str++;
+	}
+	if (*str == '0') {
+		field_r->zero_padding = TRUE;
+		str++;
+	}
+	while (*str >= '0' && *str <= '9') {
+		field_r->width = field_r->width*10 + (*str - '0');
+		str++;
+	}
+
+	if (*str == '.') {
+		field_r->offset = sign * field_r->width;
+		sign = 1;
+		field_r->width = 0;
+		str++;
+
+		/* if offset was prefixed with zero (or it was
+		   plain zero), just ignore that. zero padding
+		   is done with the width. */
+		field_r->zero_padding = FALSE;
+		if (*str == '0') {
+			field_r->zero_padding = TRUE;
+			str++;
+		}
+		if (*str == '-') {
+			sign = -1;
+			str++;
+		}
+
+		while (*str >= '0' && *str <= '9') {
+			field_r->width = field_r->width*10 + (*str - '0');
+			str++;
+		}
+		field_r->width = sign * field_r->width;
+	}
+
+	while (field_r->modifier_count < MAX_MODIFIER_COUNT) {
+		for (m = modifiers; m->key != '\0'; m++) {
+			if (m->key == *str)
+				break;
+		}
+		if (m->key == '\0')
+			break;
+		/* @UNSAFE */
+		field_r->modifiers[field_r->modifier_count++] = m->func;
+		str++;
+	}
+
+	if (*str == '\0')
+		return NULL;
+
+	if (*str == '{' && strchr(str, '}') != NULL) {
+		/* %{long_key} */
+		unsigned int ctr = 1;
+		bool escape = FALSE;
+		end = str;
+		while(*++end != '\0' && ctr > 0) {
+			if (!escape && *end == '\\') {
+				escape = TRUE;
+				continue;
+			}
+			if (escape) {
+				escape = FALSE;
+				continue;
+			}
+			if (*end == '{') ctr++;
+			if (*end == '}') ctr--;
+		}
+		if (ctr == 0)
+			/* it needs to come back a bit */
+			end--;
+		/* if there is no } it will consume rest of the
+		   string */
+		field_r->long_key = str + 1;
+		field_r->long_key_len = end - (str + 1);
+		return end;
+	}
+	field_r->key = *str;
+	return str;
+}
+
+static int
+var_expand_field(string_t *dest, struct var_expand_context *ctx,
+		 const struct var_expand_field *field, int table_idx,
+		 const char **error_r)
+{
+	const struct var_expand_table *t;
+	const char *var = NULL;
+	unsigned int i;
+	int ret;
+
+	/* reset per-field modifiers */
+	ctx->offset = field->offset;
+	ctx->width = field->width;
+	ctx->zero_padding = field->zero_padding;
+
+	t = table_idx < 0 ? NULL : &ctx->table[table_idx];
+	if (field->long_key != NULL) {
+		if (t != NULL && t->long_key != NULL &&
+		    strcmp(t->long_key, field->long_key) == 0) {
+			/* precompiled table lookup */
+			var = t->value != NULL ? t->value : "";
+			ret = 1;
+		} else {
+			ret = var_expand_long(ctx, field->long_key,
+					      field->long_key_len,
+					      &var, error_r);
+		}
+		i_assert(var != NULL);
+	} else if (t != NULL && t->key == field->key) {
+		/* precompiled table lookup */
+		var = t->value != NULL ? t->value : "";
+		ret = 1;
+	} else {
+		ret = var_expand_short(ctx->table, field->key, &var, error_r);
+	}
+	if (var == NULL)
+		return ret;
+
+	for (i = 0; i < field->modifier_count; i++)
+		var = field->modifiers[i](var, ctx);
+
+	if (ctx->offset < 0) {
+		/* if offset is < 0 then we want to
+		   start at the end */
+		size_t len = strlen(var);
+
+		if (len > (size_t)-ctx->offset)
+			var += len + ctx->offset;
+	} else {
+		while (*var != '\0' && ctx->offset > 0) {
+			ctx->offset--;
+			var++;
+		}
+	}
+	if (ctx->width == 0)
+		str_append(dest, var);
+	else if (!ctx->zero_padding) {
+		if (ctx->width < 0)
+			ctx->width = strlen(var) - (-ctx->width);
+		str_append_max(dest, var, ctx->width);
+	} else {
+		/* %05d -like padding. no truncation. */
+		ssize_t len = strlen(var);
+		while (len < ctx->width) {
+			str_append_c(dest, '0');
+			ctx->width--;
+		}
+		str_append(dest, var);
+	}
+	return ret;
+}
+
 int var_expand_with_funcs(string_t *dest, const char *str,
 			  const struct var_expand_table *table,
 			  const struct var_expand_func_table *func_table,
 			  void *context, const char **error_r)
 {
-	const struct var_expand_modifier *m;
-	const char *var;
 	struct var_expand_context ctx;
-	const char *(*modifier[MAX_MODIFIER_COUNT])
-		(const char *, struct var_expand_context *);
-	const char *end;
-	unsigned int i, modifier_count;
-	size_t len;
+	struct var_expand_field field;
 	int ret, final_ret = 1;
 
 	*error_r = NULL;
@@ -483,144 +673,128 @@ int var_expand_with_funcs(string_t *dest, const char *str,
 		if (*str != '%')
 			str_append_c(dest, *str);
 		else {
-			int sign = 1;
+			str = var_expand_parse_field(str + 1, &field);
+			if (str == NULL)
+				break;
+			ret = var_expand_field(dest, &ctx, &field, -1, error_r);
+			if (final_ret > ret)
+				final_ret = ret;
+		}
+	}
+	return final_ret;
+}
 
-			str++;
+static int
+var_expand_program_find_idx(const struct var_expand_table *table,
+			    const struct var_expand_field *field)
+{
+	const struct var_expand_table *t;
 
-			/* reset per-field modifiers */
-			ctx.offset = 0;
-			ctx.width = 0;
-			ctx.zero_padding = FALSE;
+	if (table == NULL)
+		return -1;
+	for (t = table; !TABLE_LAST(t); t++) {
+		if (field->long_key != NULL ?
+		    (t->long_key != NULL &&
+		     strcmp(t->long_key, field->long_key) == 0) :
+		    t->key == field->key)
+			return t - table;
+	}
+	return -1;
+}
 
-			/* [<offset>.]<width>[<modifiers>]<variable> */
-			if (*str == '-') {
-				sign = -1;
-				str++;
-			}
-			if (*str == '0') {
-				ctx.zero_padding = TRUE;
-				str++;
-			}
-			while (*str >= '0' && *str <= '9') {
-				ctx.width = ctx.width*10 + (*str - '0');
-				str++;
-			}
+static void
+var_expand_program_add_literal(struct var_expand_program *program,
+			       string_t *literal)
+{
+	struct var_expand_program_op *op;
 
-			if (*str == '.') {
-				ctx.offset = sign * ctx.width;
-				sign = 1;
-				ctx.width = 0;
-				str++;
-
-				/* if offset was prefixed with zero (or it was
-				   plain zero), just ignore that. zero padding
-				   is done with the width. */
-				ctx.zero_padding = FALSE;
-				if (*str == '0') {
-					ctx.zero_padding = TRUE;
-					str++;
-				}
-				if (*str == '-') {
-					sign = -1;
-					str++;
-				}
-
-				while (*str >= '0' && *str <= '9') {
-					ctx.width = ctx.width*10 + (*str - '0');
-					str++;
-				}
-				ctx.width = sign * ctx.width;
-			}
+	if (str_len(literal) == 0)
+		return;
+	op = array_append_space(&program->ops);
+	op->literal = p_strdup(program->pool, str_c(literal));
+	str_truncate(literal, 0);
+}
 
-			modifier_count = 0;
-			while (modifier_count < MAX_MODIFIER_COUNT) {
-				modifier[modifier_count] = NULL;
-				for (m = modifiers; m->key != '\0'; m++) {
-					if (m->key == *str) {
-						/* @UNSAFE */
-						modifier[modifier_count] =
-							m->func;
-						str++;
-						break;
-					}
-				}
-				if (modifier[modifier_count] == NULL)
-					break;
-				modifier_count++;
-			}
+struct var_expand_program *
+var_expand_program_compile(const char *str,
+			   const struct var_expand_table *table)
+{
+	struct var_expand_program *program;
+	struct var_expand_program_op *op;
+	struct var_expand_field field;
+	string_t *literal;
+	pool_t pool;
+
+	pool = pool_alloconly_create("var expand program", 512);
+	program = p_new(pool, struct var_expand_program, 1);
+	program->pool = pool;
+	program->table_size = var_expand_table_size(table);
+	p_array_init(&program->ops, pool, 8);
+
+	literal = t_str_new(128);
+	for (; *str != '\0'; str++) {
+		if (*str != '%') {
+			str_append_c(literal, *str);
+			continue;
+		}
+		str = var_expand_parse_field(str + 1, &field);
+		if (str == NULL)
+			break;
+		var_expand_program_add_literal(program, literal);
 
-			if (*str == '\0')
-				break;
+		op = array_append_space(&program->ops);
+		op->field = field;
+		if (field.long_key != NULL) {
+			op->field.long_key = p_strndup(pool, field.long_key,
+						       field.long_key_len);
+		}
+		op->table_idx = var_expand_program_find_idx(table, &op->field);
+	}
+	var_expand_program_add_literal(program, literal);
+	return program;
+}
 
-			var = NULL;
-			if (*str == '{' && (end = strchr(str, '}')) != NULL) {
-				/* %{long_key} */
-				unsigned int ctr = 1;
-				bool escape = FALSE;
-				end = str;
-				while(*++end != '\0' && ctr > 0) {
-					if (!escape && *end == '\\') {
-						escape = TRUE;
-						continue;
-					}
-					if (escape) {
-						escape = FALSE;
-						continue;
-					}
-					if (*end == '{') ctr++;
-					if (*end == '}') ctr--;
-				}
-				if (ctr == 0)
-					/* it needs to come back a bit */
-					end--;
-				/* if there is no } it will consume rest of the
-				   string */
-				len = end - (str + 1);
-				ret = var_expand_long(&ctx, str+1, len,
-						      &var, error_r);
-				i_assert(var != NULL);
-				str = end;
-			} else {
-				ret = var_expand_short(ctx.table, *str,
-						       &var, error_r);
-			}
-			if (final_ret > ret)
-				final_ret = ret;
+void var_expand_program_free(struct var_expand_program **_program)
+{
+	struct var_expand_program *program = *_program;
 
-			if (var != NULL) {
-				for (i = 0; i < modifier_count; i++)
-					var = modifier[i](var, &ctx);
-
-				if (ctx.offset < 0) {
-					/* if offset is < 0 then we want to
-					   start at the end */
-					size_t len = strlen(var);
-
-					if (len > (size_t)-ctx.offset)
-						var += len + ctx.offset;
-				} else {
-					while (*var != '\0' && ctx.offset > 0) {
-						ctx.offset--;
-						var++;
-					}
-				}
-				if (ctx.width == 0)
-					str_append(dest, var);
-				else if (!ctx.zero_padding) {
-					if (ctx.width < 0)
-						ctx.width = strlen(var) - (-ctx.width);
-					str_append_max(dest, var, ctx.width);
-				} else {
-					/* %05d -like padding. no truncation. */
-					ssize_t len = strlen(var);
-					while (len < ctx.width) {
-						str_append_c(dest, '0');
-						ctx.width--;
-					}
-					str_append(dest, var);
-				}
-			}
+	if (program == NULL)
+		return;
+	*_program = NULL;
+	pool_unref(&program->pool);
+}
+
+int var_expand_program_expand(const struct var_expand_program *program,
+			      string_t *dest,
+			      const struct var_expand_table *table,
+			      const struct var_expand_func_table *func_table,
+			      void *context, const char **error_r)
+{
+	const struct var_expand_program_op *op;
+	struct var_expand_context ctx;
+	bool use_idx;
+	int ret, final_ret = 1;
+
+	*error_r = NULL;
+
+	i_zero(&ctx);
+	ctx.table = table;
+	ctx.func_table = func_table;
+	ctx.context = context;
+
+	/* The table indexes can be used only if the table has the same layout
+	   as the one given to compile. Each lookup still verifies that the
+	   key matches, so this just protects against reading past the end. */
+	use_idx = var_expand_table_size(table) == program->table_size;
+	array_foreach(&program->ops, op) {
+		if (op->literal != NULL) {
+			str_append(dest, op->literal);
+			continue;
 		}
+		ret = var_expand_field(dest, &ctx, &op->field,
+				       use_idx ? op->table_idx : -1, error_r);
+		if (final_ret > ret)
+			final_ret = ret;
 	}
 	return final_ret;
 }
@@ -30,6 +30,23 @@ int var_expand_with_funcs(string_t *dest, const char *str,
 			  const struct var_expand_func_table *func_table,
 			  void *func_context, const char **error_r) ATTR_NULL(3, 4, 5);
 
+/* Parse the format string once, so it can be expanded multiple times without
+   parsing it again. The variables are looked up from the table already now.
+   The table given to var_expand_program_expand() should have the same
+   layout, i.e. only the values may differ. Otherwise the variables are
+   looked up the same way as with var_expand(). */
+struct var_expand_program *
+var_expand_program_compile(const char *str,
+			   const struct var_expand_table *table) ATTR_NULL(2);
+void var_expand_program_free(struct var_expand_program **program);
+/* Like var_expand_with_funcs(), but expand a compiled format string. */
+int var_expand_program_expand(const struct var_expand_program *program,
+			      string_t *dest,
+			      const struct var_expand_table *table,
+			      const struct var_expand_func_table *func_table,
+			      void *func_context, const char **error_r)
+	ATTR_NULL(3, 4, 5);
+
 /* Returns the actual key character for given string, ie. skip any modifiers
    that are before it. The string should be the data after the '%' character.
    For %{long_variable}, '{' is returned. */
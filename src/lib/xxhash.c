@@ -0,0 +1,172 @@
+/* Copyright (c) 2018 Dovecot authors, see the included COPYING file */
+
+/* Implemented according to the XXH64 specification at
+   https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md */
+
+#include "lib.h"
+#include "xxhash.h"
+
+#define XXH64_PRIME1 0x9E3779B185EBCA87ULL
+#define XXH64_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define XXH64_PRIME3 0x165667B19E3779F9ULL
+#define XXH64_PRIME4 0x85EBCA77C2B2AE63ULL
+#define XXH64_PRIME5 0x27D4EB2F165667C5ULL
+
+#define XXH64_ROTL(x, n) (((x) << (n)) | ((x) >> (64 - (n))))
+
+static inline uint64_t xxh64_read64(const unsigned char *p)
+{
+	return (uint64_t)p[0] | ((uint64_t)p[1] << 8) |
+		((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) |
+		((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) |
+		((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+static inline uint32_t xxh64_read32(const unsigned char *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+		((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t ATTR_UNSIGNED_WRAPS
+xxh64_round(uint64_t acc, uint64_t input)
+{
+	acc += input * XXH64_PRIME2;
+	acc = XXH64_ROTL(acc, 31);
+	return acc * XXH64_PRIME1;
+}
+
+static inline uint64_t ATTR_UNSIGNED_WRAPS
+xxh64_merge_round(uint64_t acc, uint64_t val)
+{
+	acc ^= xxh64_round(0, val);
+	return acc * XXH64_PRIME1 + XXH64_PRIME4;
+}
+
+static const unsigned char *
+xxh64_stripes(uint64_t v[STATIC_ARRAY 4], const unsigned char *p,
+	      const unsigned char *end)
+{
+	for (; p + 32 <= end; p += 32) {
+		v[0] = xxh64_round(v[0], xxh64_read64(p));
+		v[1] = xxh64_round(v[1], xxh64_read64(p + 8));
+		v[2] = xxh64_round(v[2], xxh64_read64(p + 16));
+		v[3] = xxh64_round(v[3], xxh64_read64(p + 24));
+	}
+	return p;
+}
+
+void ATTR_UNSIGNED_WRAPS xxh64_init(struct xxh64_ctx *ctx, uint64_t seed)
+{
+	i_zero(ctx);
+	ctx->seed = seed;
+	ctx->v[0] = seed + XXH64_PRIME1 + XXH64_PRIME2;
+	ctx->v[1] = seed + XXH64_PRIME2;
+	ctx->v[2] = seed;
+	ctx->v[3] = seed - XXH64_PRIME1;
+}
+
+void xxh64_loop(struct xxh64_ctx *ctx, const void *data, size_t size)
+{
+	const unsigned char *p = data, *end = p + size;
+
+	ctx->total_len += size;
+	if (ctx->memsize + size < sizeof(ctx->mem)) {
+		memcpy(ctx->mem + ctx->memsize, p, size);
+		ctx->memsize += size;
+		return;
+	}
+
+	if (ctx->memsize > 0) {
+		size_t n = sizeof(ctx->mem) - ctx->memsize;
+
+		memcpy(ctx->mem + ctx->memsize, p, n);
+		(void)xxh64_stripes(ctx->v, ctx->mem,
+				    ctx->mem + sizeof(ctx->mem));
+		p += n;
+		ctx->memsize = 0;
+	}
+	p = xxh64_stripes(ctx->v, p, end);
+	if (p < end) {
+		memcpy(ctx->mem, p, end - p);
+		ctx->memsize = end - p;
+	}
+}
+
+uint64_t ATTR_UNSIGNED_WRAPS xxh64_result(struct xxh64_ctx *ctx)
+{
+	const unsigned char *p = ctx->mem, *end = p + ctx->memsize;
+	uint64_t h;
+
+	if (ctx->total_len >= 32) {
+		h = XXH64_ROTL(ctx->v[0], 1) + XXH64_ROTL(ctx->v[1], 7) +
+			XXH64_ROTL(ctx->v[2], 12) + XXH64_ROTL(ctx->v[3], 18);
+		h = xxh64_merge_round(h, ctx->v[0]);
+		h = xxh64_merge_round(h, ctx->v[1]);
+		h = xxh64_merge_round(h, ctx->v[2]);
+		h = xxh64_merge_round(h, ctx->v[3]);
+	} else {
+		h = ctx->seed + XXH64_PRIME5;
+	}
+	h += ctx->total_len;
+
+	for (; p + 8 <= end; p += 8) {
+		h ^= xxh64_round(0, xxh64_read64(p));
+		h = XXH64_ROTL(h, 27) * XXH64_PRIME1 + XXH64_PRIME4;
+	}
+	if (p + 4 <= end) {
+		h ^= (uint64_t)xxh64_read32(p) * XXH64_PRIME1;
+		h = XXH64_ROTL(h, 23) * XXH64_PRIME2 + XXH64_PRIME3;
+		p += 4;
+	}
+	for (; p < end; p++) {
+		h ^= *p * XXH64_PRIME5;
+		h = XXH64_ROTL(h, 11) * XXH64_PRIME1;
+	}
+
+	h ^= h >> 33;
+	h *= XXH64_PRIME2;
+	h ^= h >> 29;
+	h *= XXH64_PRIME3;
+	h ^= h >> 32;
+	return h;
+}
+
+uint64_t xxh64(const void *data, size_t size, uint64_t seed)
+{
+	struct xxh64_ctx ctx;
+
+	xxh64_init(&ctx, seed);
+	xxh64_loop(&ctx, data, size);
+	return xxh64_result(&ctx);
+}
+
+static void hash_method_init_xxh64(void *context)
+{
+	xxh64_init(context, 0);
+}
+
+static void
+hash_method_loop_xxh64(void *context, const void *data, size_t size)
+{
+	xxh64_loop(context, data, size);
+}
+
+static void hash_method_result_xxh64(void *context, unsigned char *result_r)
+{
+	uint64_t h = xxh64_result(context);
+	unsigned int i;
+
+	for (i = 0; i < XXH64_RESULTLEN; i++)
+		result_r[i] = (h >> (56 - i*8)) & 0xff;
+}
+
+const struct hash_method hash_method_xxh64 = {
+	"xxh64",
+	sizeof(struct xxh64_ctx),
+	XXH64_RESULTLEN,
+
+	hash_method_init_xxh64,
+	hash_method_loop_xxh64,
+	hash_method_result_xxh64
+};
@@ -0,0 +1,30 @@
+#ifndef XXHASH_H
+#define XXHASH_H
+
+#include "hash-method.h"
+
+/* XXH64 - a fast non-cryptographic hash. Use it only for internal lookup
+   and deduplication keys where collisions can't be forced by an attacker
+   to cause harm, never for anything security related. */
+
+#define XXH64_RESULTLEN 8
+
+struct xxh64_ctx {
+	uint64_t total_len;
+	uint64_t v[4];
+	unsigned char mem[32];
+	size_t memsize;
+	uint64_t seed;
+};
+
+void xxh64_init(struct xxh64_ctx *ctx, uint64_t seed);
+void xxh64_loop(struct xxh64_ctx *ctx, const void *data, size_t size);
+uint64_t xxh64_result(struct xxh64_ctx *ctx);
+
+uint64_t xxh64(const void *data, size_t size, uint64_t seed);
+
+/* The digest is the big endian (canonical) representation of the hash
+   with seed 0. */
+extern const struct hash_method hash_method_xxh64;
+
+#endif
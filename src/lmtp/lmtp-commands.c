@@ -203,8 +203,13 @@ int cmd_data_begin(void *conn_ctx,
 
 	path = t_str_new(256);
 	mail_user_set_get_temp_prefix(path, client->raw_mail_user->set);
+	/* the message is read once for each recipient, so use mmap()
+	   instead of read()ing it again to istream buffers each time */
 	client->state.mail_data_output = 
-		iostream_temp_create_named(str_c(path), 0, "(lmtp data)");
+		iostream_temp_create_named(str_c(path),
+					   IOSTREAM_TEMP_FLAG_MMAP |
+					   IOSTREAM_TEMP_FLAG_MEMFD,
+					   "(lmtp data)");
 
 	client->state.data_input = data_input;
 	return 0;
@@ -1,8 +1,10 @@
 /* Copyright (c) 2009-2018 Dovecot authors, see the included COPYING file */
 
 #include "lmtp-common.h"
+#include "ioloop.h"
 #include "str.h"
 #include "istream.h"
+#include "write-full.h"
 #include "strescape.h"
 #include "time-util.h"
 #include "hostpid.h"
@@ -25,6 +27,10 @@
 #include "lmtp-recipient.h"
 #include "lmtp-local.h"
 
+#include <unistd.h>
+#include <poll.h>
+#include <sys/wait.h>
+
 struct lmtp_local_recipient {
 	struct lmtp_recipient *rcpt;
 	char *session_id;
@@ -46,7 +52,18 @@ struct lmtp_local {
 
 	struct mail *raw_mail, *first_saved_mail;
 	struct mail_user *rcpt_user;
+
+	bool parallel_delivery:1;
+};
+
+struct lmtp_local_child {
+	pid_t pid;
+	int fd;
+	struct lmtp_local_recipient *llrcpt;
+	/* <status> TAB <enhanced code> TAB <text> */
+	string_t *reply;
 };
+ARRAY_DEFINE_TYPE(lmtp_local_child, struct lmtp_local_child);
 
 /*
  * LMTP local
@@ -536,6 +553,18 @@ lmtp_local_deliver(struct lmtp_local *local,
 	return ret;
 }
 
+static bool lmtp_local_can_link_saved_mail(struct mail_user *user)
+{
+	struct mail_namespace *ns = mail_namespace_find_inbox(user->namespaces);
+
+	/* Copying the saved mail to the other recipients is useful only if
+	   the copies can be hard linked. Otherwise it's cheaper to keep
+	   copying the raw mail, which is parsed only once and keeps its
+	   cached fields for all the recipients. It also allows freeing each
+	   mail_user immediately after its delivery. */
+	return mail_storage_is_file_per_msg(ns->storage);
+}
+
 int lmtp_local_default_deliver(struct client *client,
 			       struct lmtp_recipient *lrcpt,
 			       struct smtp_server_cmd_ctx *cmd ATTR_UNUSED,
@@ -559,6 +588,13 @@ int lmtp_local_default_deliver(struct client *client,
 	dctx.smtp_set = lldctx->smtp_set;
 	dctx.session_id = lldctx->session_id;
 	dctx.src_mail = lldctx->src_mail;
+	if (dctx.src_mail == local->first_saved_mail &&
+	    !lmtp_local_can_link_saved_mail(lldctx->rcpt_user)) {
+		/* this recipient's storage can't link the first saved mail,
+		   so copying it would only read it back from the first
+		   recipient's storage. */
+		dctx.src_mail = local->raw_mail;
+	}
 
 	/* MAIL FROM */
 	dctx.mail_from = trans->mail_from;
@@ -580,7 +616,8 @@ int lmtp_local_default_deliver(struct client *client,
 	dctx.rcpt_default_mailbox = lldctx->rcpt_default_mailbox;
 
 	dctx.save_dest_mail = array_count(&trans->rcpt_to) > 1 &&
-		local->first_saved_mail == NULL;
+		local->first_saved_mail == NULL && !local->parallel_delivery &&
+		lmtp_local_can_link_saved_mail(dctx.rcpt_user);
 
 	dctx.session_time_msecs =
 		timeval_diff_msecs(&client->state.data_end_timeval,
@@ -672,6 +709,204 @@ lmtp_local_deliver_to_rcpts(struct lmtp_local *local,
 	return first_uid;
 }
 
+static void ATTR_NORETURN
+lmtp_local_child_deliver(struct lmtp_local *local,
+			 struct smtp_server_cmd_ctx *cmd,
+			 struct smtp_server_transaction *trans,
+			 struct lmtp_local_recipient *llrcpt,
+			 struct mail_deliver_session *session, int fd)
+{
+	struct smtp_server_recipient *rcpt = llrcpt->rcpt->rcpt;
+	struct smtp_server_reply *reply;
+	const char *enh_code, *line;
+	unsigned int status;
+
+	/* The parent's ioloop shares its epoll fd with us. Recreate it, so
+	   the parent's I/O handlers stay intact. */
+	io_loop_reinit_after_fork();
+	i_failure_discard_buffer();
+
+	(void)lmtp_local_deliver(local, cmd, trans, llrcpt,
+				 local->raw_mail, session);
+	/* the parent no longer sends the anvil DISCONNECT, so send it even
+	   if lmtp_local_deliver() failed before it did that */
+	lmtp_local_rcpt_anvil_disconnect(llrcpt);
+	if (local->rcpt_user != NULL) {
+		/* finish quota and other pending dict updates */
+		mail_user_autoexpunge(local->rcpt_user);
+		mail_user_unref(&local->rcpt_user);
+	}
+
+	reply = smtp_server_recipient_get_reply(rcpt);
+	if (reply != NULL) {
+		status = smtp_server_reply_get_status(reply, &enh_code);
+		line = t_strdup_printf("%u\t%s\t%s", status,
+			enh_code == NULL ? "" : str_tabescape(enh_code),
+			str_tabescape(smtp_server_reply_get_message(reply)));
+		if (write_full(fd, line, strlen(line)) < 0)
+			i_error("write(delivery result) failed: %m");
+	}
+	/* don't run any exit handlers, they belong to the parent */
+	_exit(0);
+}
+
+static void
+lmtp_local_child_start(struct lmtp_local *local,
+		       struct smtp_server_cmd_ctx *cmd,
+		       struct smtp_server_transaction *trans,
+		       struct lmtp_local_recipient *llrcpt,
+		       struct mail_deliver_session *session,
+		       ARRAY_TYPE(lmtp_local_child) *children)
+{
+	struct smtp_server_recipient *rcpt = llrcpt->rcpt->rcpt;
+	struct lmtp_local_child *child;
+	int fd[2];
+	pid_t pid;
+
+	if (pipe(fd) < 0) {
+		e_error(rcpt->event, "pipe() failed: %m");
+		smtp_server_recipient_reply(rcpt, 451, "4.3.0",
+					    "Temporary internal error");
+		return;
+	}
+	if ((pid = fork()) < 0) {
+		e_error(rcpt->event, "fork() failed: %m");
+		smtp_server_recipient_reply(rcpt, 451, "4.3.0",
+					    "Temporary internal error");
+		i_close_fd(&fd[0]);
+		i_close_fd(&fd[1]);
+		return;
+	}
+	if (pid == 0) {
+		i_close_fd(&fd[0]);
+		lmtp_local_child_deliver(local, cmd, trans, llrcpt,
+					 session, fd[1]);
+	}
+	i_close_fd(&fd[1]);
+	/* the child sends the anvil DISCONNECT after its delivery */
+	llrcpt->anvil_connect_sent = FALSE;
+
+	child = array_append_space(children);
+	child->pid = pid;
+	child->fd = fd[0];
+	child->llrcpt = llrcpt;
+	child->reply = str_new(default_pool, 128);
+}
+
+static void
+lmtp_local_child_finish(struct lmtp_local_child *child)
+{
+	struct smtp_server_recipient *rcpt = child->llrcpt->rcpt->rcpt;
+	const char *const *args;
+	unsigned int status;
+	int child_status;
+
+	i_close_fd(&child->fd);
+	while (waitpid(child->pid, &child_status, 0) < 0) {
+		if (errno != EINTR) {
+			e_error(rcpt->event, "waitpid(%s) failed: %m",
+				dec2str(child->pid));
+			break;
+		}
+	}
+
+	args = t_strsplit_tabescaped(str_c(child->reply));
+	if (str_array_length(args) != 3 ||
+	    str_to_uint(args[0], &status) < 0 ||
+	    status < 200 || status >= 600) {
+		e_error(rcpt->event, "Delivery process %s died without "
+			"replying", dec2str(child->pid));
+		smtp_server_recipient_reply(rcpt, 451, "4.3.0",
+					    "Temporary internal error");
+	} else {
+		/* the text already contains the recipient path if needed */
+		smtp_server_reply_index(rcpt->cmd, rcpt->index, status,
+					args[1][0] == '\0' ? NULL : args[1],
+					"%s", args[2]);
+	}
+	str_free(&child->reply);
+}
+
+static void
+lmtp_local_children_wait(ARRAY_TYPE(lmtp_local_child) *children)
+{
+	struct lmtp_local_child *child;
+	struct pollfd *fds;
+	unsigned int i, count;
+	unsigned char buf[1024];
+	ssize_t ret;
+
+	child = array_get_modifiable(children, &count);
+	fds = t_new(struct pollfd, count);
+	for (i = 0; i < count; i++) {
+		fds[i].fd = child[i].fd;
+		fds[i].events = POLLIN;
+	}
+	if (poll(fds, count, -1) < 0) {
+		if (errno == EINTR)
+			return;
+		i_fatal("poll() failed: %m");
+	}
+
+	for (i = count; i > 0; i--) {
+		if (fds[i-1].revents == 0)
+			continue;
+		ret = read(child[i-1].fd, buf, sizeof(buf));
+		if (ret > 0) {
+			str_append_data(child[i-1].reply, buf, ret);
+			continue;
+		}
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			i_error("read(delivery result) failed: %m");
+		lmtp_local_child_finish(&child[i-1]);
+		array_delete(children, i-1, 1);
+	}
+}
+
+static void
+lmtp_local_deliver_to_rcpts_parallel(struct lmtp_local *local,
+				     struct smtp_server_cmd_ctx *cmd,
+				     struct smtp_server_transaction *trans,
+				     struct mail_deliver_session *session)
+{
+	unsigned int limit =
+		local->client->lmtp_set->lmtp_local_delivery_concurrency;
+	ARRAY_TYPE(lmtp_local_child) children;
+	struct lmtp_local_recipient *const *llrcpts;
+	unsigned int count, i;
+
+	local->parallel_delivery = TRUE;
+	i_array_init(&children, limit);
+	llrcpts = array_get(&local->rcpt_to, &count);
+	for (i = 0; i < count; i++) {
+		if (llrcpts[i]->duplicate != NULL)
+			continue;
+		while (array_count(&children) >= limit) T_BEGIN {
+			lmtp_local_children_wait(&children);
+		} T_END;
+		lmtp_local_child_start(local, cmd, trans, llrcpts[i],
+				       session, &children);
+	}
+	while (array_count(&children) > 0) T_BEGIN {
+		lmtp_local_children_wait(&children);
+	} T_END;
+	array_free(&children);
+	local->parallel_delivery = FALSE;
+
+	/* duplicates can be replied only after the original recipient */
+	for (i = 0; i < count; i++) {
+		struct lmtp_local_recipient *llrcpt = llrcpts[i];
+
+		if (llrcpt->duplicate != NULL) {
+			smtp_server_reply_submit_duplicate(cmd,
+				llrcpt->rcpt->rcpt->index,
+				llrcpt->duplicate->rcpt->rcpt->index);
+		}
+	}
+}
+
 static int
 lmtp_local_open_raw_mail(struct lmtp_local *local,
 			 struct smtp_server_transaction *trans,
@@ -721,7 +956,15 @@ void lmtp_local_data(struct client *client,
 
 	session = mail_deliver_session_init();
 	old_uid = geteuid();
-	first_uid = lmtp_local_deliver_to_rcpts(local, cmd, trans, session);
+	if (client->lmtp_set->lmtp_local_delivery_concurrency > 1 &&
+	    array_count(&local->rcpt_to) > 1) {
+		lmtp_local_deliver_to_rcpts_parallel(local, cmd, trans,
+						     session);
+		first_uid = (uid_t)-1;
+	} else {
+		first_uid = lmtp_local_deliver_to_rcpts(local, cmd, trans,
+							session);
+	}
 	mail_deliver_session_deinit(&session);
 
 	if (local->first_saved_mail != NULL) {
@@ -1,6 +1,8 @@
 /* Copyright (c) 2009-2018 Dovecot authors, see the included COPYING file */
 
 #include "lmtp-common.h"
+#include "hostpid.h"
+#include "llist.h"
 #include "istream.h"
 #include "istream-sized.h"
 #include "ostream.h"
@@ -22,6 +24,8 @@
 
 #define LMTP_MAX_REPLY_SIZE 4096
 #define LMTP_PROXY_DEFAULT_TIMEOUT_MSECS (1000*125)
+/* How long an idle backend connection is kept in the pool */
+#define LMTP_PROXY_POOL_IDLE_TIMEOUT_MSECS (30*1000)
 
 enum lmtp_proxy_ssl_flags {
 	/* Use SSL/TLS enabled */
@@ -58,7 +62,10 @@ struct lmtp_proxy_connection {
 	struct lmtp_proxy *proxy;
 	struct lmtp_proxy_rcpt_settings set;
 	char *host;
+	/* Connection pool key, or NULL if the connection isn't pooled */
+	char *pool_key;
 
+	struct smtp_client_connection *lmtp_conn;
 	struct smtp_client_transaction *lmtp_trans;
 	struct istream *data_input;
 	struct timeout *to;
@@ -73,6 +80,9 @@ struct lmtp_proxy {
 	struct smtp_server_transaction *trans;
 
 	struct smtp_client *lmtp_client;
+	/* Settings for the backend connections when they're pooled */
+	struct smtp_client_settings pool_conn_set;
+	unsigned int pool_max_connections;
 
 	ARRAY(struct lmtp_proxy_connection *) connections;
 	ARRAY(struct lmtp_proxy_recipient *) rcpt_to;
@@ -86,10 +96,143 @@ struct lmtp_proxy {
 	bool finished:1;
 };
 
+struct lmtp_proxy_pool_conn {
+	struct lmtp_proxy_pool_conn *prev, *next;
+
+	char *key;
+	struct smtp_client_connection *conn;
+	struct timeout *to_idle;
+};
+
+/* The backend connections are pooled in a client shared by all the incoming
+   connections of this process. */
+static struct smtp_client *lmtp_proxy_pool_client = NULL;
+/* Idle backend connections sorted by the time they were added */
+static struct lmtp_proxy_pool_conn *lmtp_proxy_pool_head, *lmtp_proxy_pool_tail;
+static unsigned int lmtp_proxy_pool_count = 0;
+
 static void
 lmtp_proxy_data_cb(const struct smtp_reply *reply,
 		   struct lmtp_proxy_recipient *lprcpt);
 
+/*
+ * Connection pool
+ */
+
+static struct smtp_client *lmtp_proxy_pool_get_client(void)
+{
+	struct smtp_client_settings lmtp_set;
+
+	if (lmtp_proxy_pool_client != NULL)
+		return lmtp_proxy_pool_client;
+
+	i_zero(&lmtp_set);
+	lmtp_set.my_hostname = my_hostdomain();
+	lmtp_set.dns_client_socket_path = dns_client_socket_path;
+	lmtp_set.max_reply_size = LMTP_MAX_REPLY_SIZE;
+	lmtp_proxy_pool_client = smtp_client_init(&lmtp_set);
+	return lmtp_proxy_pool_client;
+}
+
+static const char *
+lmtp_proxy_pool_get_key(struct lmtp_proxy *proxy,
+			const struct lmtp_proxy_rcpt_settings *set)
+{
+	const struct smtp_client_settings *conn_set = &proxy->pool_conn_set;
+	const struct smtp_proxy_data *proxy_data = &conn_set->proxy_data;
+	string_t *key = t_str_new(128);
+
+	str_printfa(key, "%d\t%s\t%s\t%s\t%u\t%d\t%d\t%s\t%s",
+		    set->protocol, set->host,
+		    set->hostip.family == 0 ? "" : net_ip2addr(&set->hostip),
+		    set->source_ip.family == 0 ? "" :
+		    net_ip2addr(&set->source_ip), set->port, set->ssl_flags,
+		    set->proxy_not_trusted ? 0 : 1,
+		    conn_set->my_hostname, conn_set->rawlog_dir);
+	if (!set->proxy_not_trusted) {
+		/* XCLIENT is sent only once per connection, so the connection
+		   can be reused only for the same proxy data. */
+		str_printfa(key, "\t%d\t%s\t%u\t%s\t%s\t%u\t%u\t%u",
+			    proxy_data->proto,
+			    net_ip2addr(&proxy_data->source_ip),
+			    proxy_data->source_port,
+			    proxy_data->helo == NULL ? "" : proxy_data->helo,
+			    proxy_data->login == NULL ? "" : proxy_data->login,
+			    proxy_data->ttl_plus_1, proxy_data->timeout_secs,
+			    proxy_data->extra_fields_count);
+	}
+	return str_c(key);
+}
+
+static void
+lmtp_proxy_pool_conn_free(struct lmtp_proxy_pool_conn *pconn,
+			  struct smtp_client_connection **conn_r)
+{
+	DLLIST2_REMOVE(&lmtp_proxy_pool_head, &lmtp_proxy_pool_tail, pconn);
+	lmtp_proxy_pool_count--;
+
+	timeout_remove(&pconn->to_idle);
+	if (conn_r != NULL)
+		*conn_r = pconn->conn;
+	else
+		smtp_client_connection_close(&pconn->conn);
+	i_free(pconn->key);
+	i_free(pconn);
+}
+
+static void lmtp_proxy_pool_conn_idle_timeout(struct lmtp_proxy_pool_conn *pconn)
+{
+	lmtp_proxy_pool_conn_free(pconn, NULL);
+}
+
+static struct smtp_client_connection *lmtp_proxy_pool_take(const char *key)
+{
+	struct lmtp_proxy_pool_conn *pconn, *next;
+	struct smtp_client_connection *conn;
+
+	/* prefer the most recently used connection */
+	for (pconn = lmtp_proxy_pool_tail; pconn != NULL; pconn = next) {
+		next = pconn->prev;
+		if (strcmp(pconn->key, key) != 0)
+			continue;
+		if (smtp_client_connection_get_state(pconn->conn) !=
+		    SMTP_CLIENT_CONNECTION_STATE_READY) {
+			/* disconnected by the backend */
+			lmtp_proxy_pool_conn_free(pconn, NULL);
+			continue;
+		}
+		lmtp_proxy_pool_conn_free(pconn, &conn);
+		return conn;
+	}
+	return NULL;
+}
+
+static void
+lmtp_proxy_pool_put(struct lmtp_proxy *proxy, struct lmtp_proxy_connection *conn)
+{
+	struct lmtp_proxy_pool_conn *pconn;
+
+	while (lmtp_proxy_pool_count >= proxy->pool_max_connections)
+		lmtp_proxy_pool_conn_free(lmtp_proxy_pool_head, NULL);
+
+	pconn = i_new(struct lmtp_proxy_pool_conn, 1);
+	pconn->key = i_strdup(conn->pool_key);
+	pconn->conn = conn->lmtp_conn;
+	pconn->to_idle = timeout_add(LMTP_PROXY_POOL_IDLE_TIMEOUT_MSECS,
+				     lmtp_proxy_pool_conn_idle_timeout, pconn);
+	DLLIST2_APPEND(&lmtp_proxy_pool_head, &lmtp_proxy_pool_tail, pconn);
+	lmtp_proxy_pool_count++;
+	conn->lmtp_conn = NULL;
+}
+
+void lmtp_proxy_pool_deinit(void)
+{
+	while (lmtp_proxy_pool_head != NULL)
+		lmtp_proxy_pool_conn_free(lmtp_proxy_pool_head, NULL);
+	if (lmtp_proxy_pool_client != NULL)
+		smtp_client_deinit(&lmtp_proxy_pool_client);
+}
+
 /*
  * LMTP proxy
  */
@@ -123,8 +266,19 @@ lmtp_proxy_init(struct client *client,
 		lmtp_set.proxy_data.ttl_plus_1--;
 	lmtp_set.event_parent = client->event;
 
-	proxy->lmtp_client = smtp_client_init(&lmtp_set);
+	proxy->pool_max_connections =
+		client->lmtp_set->lmtp_proxy_max_pooled_connections;
+	if (proxy->pool_max_connections == 0) {
+		proxy->lmtp_client = smtp_client_init(&lmtp_set);
+		return proxy;
+	}
 
+	/* The connections may outlive this client, so they can't use its
+	   event. Give the per-client settings to each connection instead. */
+	proxy->lmtp_client = lmtp_proxy_pool_get_client();
+	proxy->pool_conn_set.my_hostname = lmtp_set.my_hostname;
+	proxy->pool_conn_set.rawlog_dir = lmtp_set.rawlog_dir;
+	proxy->pool_conn_set.proxy_data = lmtp_set.proxy_data;
 	return proxy;
 }
 
@@ -133,8 +287,17 @@ lmtp_proxy_connection_deinit(struct lmtp_proxy_connection *conn)
 {
 	if (conn->lmtp_trans != NULL)
 		smtp_client_transaction_destroy(&conn->lmtp_trans);
+	if (conn->lmtp_conn != NULL) {
+		if (conn->pool_key != NULL && !conn->failed &&
+		    smtp_client_connection_get_state(conn->lmtp_conn) ==
+		    SMTP_CLIENT_CONNECTION_STATE_READY)
+			lmtp_proxy_pool_put(conn->proxy, conn);
+		else
+			smtp_client_connection_close(&conn->lmtp_conn);
+	}
 	timeout_remove(&conn->to);
 	i_stream_unref(&conn->data_input);
+	i_free(conn->pool_key);
 	i_free(conn->host);
 	i_free(conn);
 }
@@ -149,7 +312,8 @@ void lmtp_proxy_deinit(struct lmtp_proxy **_proxy)
 	array_foreach(&proxy->connections, conns)
 		lmtp_proxy_connection_deinit(*conns);
 
-	smtp_client_deinit(&proxy->lmtp_client);
+	if (proxy->pool_max_connections == 0)
+		smtp_client_deinit(&proxy->lmtp_client);
 	i_stream_unref(&proxy->data_input);
 	timeout_remove(&proxy->to_finish);
 	array_free(&proxy->rcpt_to);
@@ -236,27 +400,43 @@ lmtp_proxy_get_connection(struct lmtp_proxy *proxy,
 
 	lmtp_proxy_connection_init_ssl(conn, &ssl_set, &ssl_mode);
 
-	i_zero(&lmtp_set);
-	lmtp_set.my_ip = conn->set.source_ip;
-	lmtp_set.ssl = &ssl_set;
-	lmtp_set.peer_trusted = !conn->set.proxy_not_trusted;
-	lmtp_set.forced_capabilities = SMTP_CAPABILITY__ORCPT;
-
-	if (conn->set.hostip.family != 0) {
-		lmtp_conn = smtp_client_connection_create_ip(proxy->lmtp_client,
-			set->protocol, &conn->set.hostip, conn->set.port,
-			conn->set.host, ssl_mode, &lmtp_set);
+	if (proxy->pool_max_connections > 0) {
+		conn->pool_key = i_strdup(lmtp_proxy_pool_get_key(proxy, set));
+		lmtp_conn = lmtp_proxy_pool_take(conn->pool_key);
 	} else {
-		lmtp_conn = smtp_client_connection_create(proxy->lmtp_client,
-			set->protocol, conn->set.host, conn->set.port,
-			ssl_mode, &lmtp_set);
+		lmtp_conn = NULL;
+	}
+
+	if (lmtp_conn == NULL) {
+		if (proxy->pool_max_connections > 0)
+			lmtp_set = proxy->pool_conn_set;
+		else
+			i_zero(&lmtp_set);
+		lmtp_set.my_ip = conn->set.source_ip;
+		lmtp_set.ssl = &ssl_set;
+		lmtp_set.peer_trusted = !conn->set.proxy_not_trusted;
+		lmtp_set.forced_capabilities = SMTP_CAPABILITY__ORCPT;
+
+		if (conn->set.hostip.family != 0) {
+			lmtp_conn = smtp_client_connection_create_ip(
+				proxy->lmtp_client, set->protocol,
+				&conn->set.hostip, conn->set.port,
+				conn->set.host, ssl_mode, &lmtp_set);
+		} else {
+			lmtp_conn = smtp_client_connection_create(
+				proxy->lmtp_client, set->protocol,
+				conn->set.host, conn->set.port,
+				ssl_mode, &lmtp_set);
+		}
+		smtp_client_connection_connect(lmtp_conn, NULL, NULL);
 	}
-	smtp_client_connection_connect(lmtp_conn, NULL, NULL);
 
 	conn->lmtp_trans = smtp_client_transaction_create(lmtp_conn,
 		trans->mail_from, &trans->params, 0,
 		lmtp_proxy_connection_finish, conn);
-	smtp_client_connection_unref(&lmtp_conn);
+	/* keep the reference, so the connection can be pooled after the
+	   transaction is finished */
+	conn->lmtp_conn = lmtp_conn;
 
 	smtp_client_transaction_start(conn->lmtp_trans,
 				      lmtp_proxy_mail_cb, conn);
@@ -63,9 +63,11 @@ static const struct setting_define lmtp_setting_defines[] = {
 	DEF(SET_BOOL, lmtp_save_to_detail_mailbox),
 	DEF(SET_BOOL, lmtp_rcpt_check_quota),
 	DEF(SET_UINT, lmtp_user_concurrency_limit),
+	DEF(SET_UINT, lmtp_local_delivery_concurrency),
 	DEF(SET_ENUM, lmtp_hdr_delivery_address),
 	DEF(SET_STR_VARS, lmtp_rawlog_dir),
 	DEF(SET_STR_VARS, lmtp_proxy_rawlog_dir),
+	DEF(SET_UINT, lmtp_proxy_max_pooled_connections),
 
 	DEF(SET_STR_VARS, login_greeting),
 	DEF(SET_STR, login_trusted_networks),
@@ -81,9 +83,11 @@ static const struct lmtp_settings lmtp_default_settings = {
 	.lmtp_save_to_detail_mailbox = FALSE,
 	.lmtp_rcpt_check_quota = FALSE,
 	.lmtp_user_concurrency_limit = 0,
+	.lmtp_local_delivery_concurrency = 1,
 	.lmtp_hdr_delivery_address = "final:none:original",
 	.lmtp_rawlog_dir = "",
 	.lmtp_proxy_rawlog_dir = "",
+	.lmtp_proxy_max_pooled_connections = 0,
 
 	.login_greeting = PACKAGE_NAME" ready.",
 	.login_trusted_networks = "",
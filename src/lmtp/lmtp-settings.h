@@ -18,9 +18,11 @@ struct lmtp_settings {
 	bool lmtp_save_to_detail_mailbox;
 	bool lmtp_rcpt_check_quota;
 	unsigned int lmtp_user_concurrency_limit;
+	unsigned int lmtp_local_delivery_concurrency;
 	const char *lmtp_hdr_delivery_address;
 	const char *lmtp_rawlog_dir;
 	const char *lmtp_proxy_rawlog_dir;
+	unsigned int lmtp_proxy_max_pooled_connections;
 
 	const char *login_greeting;
 	const char *login_trusted_networks;
@@ -13,6 +13,7 @@
 #include "mail-storage-service.h"
 #include "smtp-submit-settings.h"
 #include "lda-settings.h"
+#include "lmtp-proxy.h"
 
 #include <unistd.h>
 
@@ -105,6 +106,7 @@ static void main_init(void)
 static void main_deinit(void)
 {
 	clients_destroy();
+	lmtp_proxy_pool_deinit();
 	if (anvil != NULL)
 		anvil_client_deinit(&anvil);
 	i_free(dns_client_socket_path);
@@ -165,6 +167,15 @@ int main(int argc, char *argv[])
 
 	main_init();
 	master_service_init_finish(master_service);
+	if (!IS_STANDALONE()) {
+		/* do the non-user-specific initialization already before the
+		   first client connects */
+		struct mail_storage_service_input preload_input = {
+			.module = "lmtp",
+			.service = "lmtp",
+		};
+		mail_storage_service_preload(storage_service, &preload_input);
+	}
 	master_service_run(master_service, client_connected);
 
 	main_deinit();
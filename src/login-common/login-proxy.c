@@ -11,6 +11,7 @@
 #include "array.h"
 #include "str.h"
 #include "strescape.h"
+#include "sort.h"
 #include "time-util.h"
 #include "master-service.h"
 #include "master-service-ssl-settings.h"
@@ -902,6 +903,63 @@ login_proxy_cmd_kick_director_hash(struct ipc_cmd *cmd, const char *const *args)
 	ipc_cmd_success_reply(&cmd, t_strdup_printf("%u", count));
 }
 
+static bool
+want_kick_director_hashes(struct client *client, ARRAY_TYPE(uint32_t) *hashes)
+{
+	unsigned int proxy_hash;
+	uint32_t hash;
+
+	if (!director_username_hash(client, &proxy_hash))
+		return FALSE;
+	hash = proxy_hash;
+	return array_bsearch(hashes, &hash, uint32_cmp) != NULL;
+}
+
+static void
+login_proxy_cmd_kick_director_hashes(struct ipc_cmd *cmd,
+				     const char *const *args)
+{
+	struct login_proxy *proxy, *next;
+	ARRAY_TYPE(uint32_t) hashes;
+	uint32_t hash;
+	unsigned int count = 0;
+
+	/* kick all connections matching any of the given hashes with a single
+	   scan through the proxies. this is used by director for moving
+	   many users at once. */
+	if (args[0] == NULL) {
+		ipc_cmd_fail(&cmd, "Missing parameter");
+		return;
+	}
+	t_array_init(&hashes, str_array_length(args));
+	for (; *args != NULL; args++) {
+		if (str_to_uint32(*args, &hash) < 0) {
+			ipc_cmd_fail(&cmd, "Invalid parameters");
+			return;
+		}
+		array_push_back(&hashes, &hash);
+	}
+	array_sort(&hashes, uint32_cmp);
+
+	for (proxy = login_proxies; proxy != NULL; proxy = next) {
+		next = proxy->next;
+
+		if (want_kick_director_hashes(proxy->client, &hashes)) {
+			login_proxy_free_delayed(&proxy, KILLED_BY_DIRECTOR_REASON);
+			count++;
+		}
+	}
+	for (proxy = login_proxies_pending; proxy != NULL; proxy = next) {
+		next = proxy->next;
+
+		if (want_kick_director_hashes(proxy->client, &hashes)) {
+			client_destroy(proxy->client, KILLED_BY_DIRECTOR_REASON);
+			count++;
+		}
+	}
+	ipc_cmd_success_reply(&cmd, t_strdup_printf("%u", count));
+}
+
 static void
 login_proxy_cmd_list_reply(struct ipc_cmd *cmd, string_t *str,
 			   struct login_proxy *proxy)
@@ -963,6 +1021,8 @@ static void login_proxy_ipc_cmd(struct ipc_cmd *cmd, const char *line)
 		login_proxy_cmd_kick_alt(cmd, args);
 	else if (strcmp(name, "KICK-DIRECTOR-HASH") == 0)
 		login_proxy_cmd_kick_director_hash(cmd, args);
+	else if (strcmp(name, "KICK-DIRECTOR-HASHES") == 0)
+		login_proxy_cmd_kick_director_hashes(cmd, args);
 	else if (strcmp(name, "LIST-FULL") == 0)
 		login_proxy_cmd_list(cmd, args);
 	else
@@ -0,0 +1,208 @@
+/* Copyright (c) 2018 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "hash.h"
+#include "ostream.h"
+#include "connection.h"
+#include "restrict-access.h"
+#include "master-service.h"
+#include "master-service-settings.h"
+#include "mailbox-notify-client.h"
+
+/* Mail processes send CHANGED <mailbox guid> <highest modseq> after they've
+   modified a mailbox. The line is forwarded to all the other connections
+   that have subscribed to the mailbox with SUB <mailbox guid>. */
+
+struct notify_mailbox {
+	char *guid;
+	ARRAY(struct notify_client *) clients;
+};
+
+struct notify_client {
+	struct connection conn;
+	ARRAY(struct notify_mailbox *) mailboxes;
+};
+
+static struct connection_list *clients;
+static HASH_TABLE(char *, struct notify_mailbox *) mailboxes;
+
+static bool
+notify_mailbox_find_client(struct notify_mailbox *mailbox,
+			   struct notify_client *client, unsigned int *idx_r)
+{
+	struct notify_client *const *clientp;
+
+	array_foreach(&mailbox->clients, clientp) {
+		if (*clientp == client) {
+			*idx_r = array_foreach_idx(&mailbox->clients, clientp);
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+static void notify_client_sub(struct notify_client *client, const char *guid)
+{
+	struct notify_mailbox *mailbox;
+	unsigned int idx;
+
+	mailbox = hash_table_lookup(mailboxes, guid);
+	if (mailbox == NULL) {
+		mailbox = i_new(struct notify_mailbox, 1);
+		mailbox->guid = i_strdup(guid);
+		i_array_init(&mailbox->clients, 4);
+		hash_table_insert(mailboxes, mailbox->guid, mailbox);
+	} else if (notify_mailbox_find_client(mailbox, client, &idx)) {
+		return;
+	}
+	array_push_back(&mailbox->clients, &client);
+	array_push_back(&client->mailboxes, &mailbox);
+}
+
+static void
+notify_client_unsub_mailbox(struct notify_client *client,
+			    struct notify_mailbox *mailbox)
+{
+	unsigned int idx;
+
+	if (notify_mailbox_find_client(mailbox, client, &idx))
+		array_delete(&mailbox->clients, idx, 1);
+	if (array_count(&mailbox->clients) > 0)
+		return;
+
+	hash_table_remove(mailboxes, mailbox->guid);
+	array_free(&mailbox->clients);
+	i_free(mailbox->guid);
+	i_free(mailbox);
+}
+
+static void notify_client_unsub(struct notify_client *client, const char *guid)
+{
+	struct notify_mailbox *const *mailboxp;
+
+	array_foreach(&client->mailboxes, mailboxp) {
+		struct notify_mailbox *mailbox = *mailboxp;
+
+		if (strcmp(mailbox->guid, guid) == 0) {
+			array_delete(&client->mailboxes,
+				     array_foreach_idx(&client->mailboxes,
+						       mailboxp), 1);
+			notify_client_unsub_mailbox(client, mailbox);
+			break;
+		}
+	}
+}
+
+static void
+notify_client_changed(struct notify_client *client, const char *guid,
+		      const char *modseq)
+{
+	struct notify_mailbox *mailbox;
+	struct notify_client *const *clientp;
+	const char *line;
+
+	mailbox = hash_table_lookup(mailboxes, guid);
+	if (mailbox == NULL)
+		return;
+
+	line = t_strdup_printf("CHANGED\t%s\t%s\n", guid, modseq);
+	array_foreach(&mailbox->clients, clientp) {
+		if (*clientp != client)
+			o_stream_nsend_str((*clientp)->conn.output, line);
+	}
+}
+
+static int
+notify_client_input_args(struct connection *conn, const char *const *args)
+{
+	struct notify_client *client = (struct notify_client *)conn;
+
+	if (args[0] == NULL || args[1] == NULL) {
+		e_error(conn->event, "Invalid input");
+		return -1;
+	}
+	if (strcmp(args[0], "SUB") == 0)
+		notify_client_sub(client, args[1]);
+	else if (strcmp(args[0], "UNSUB") == 0)
+		notify_client_unsub(client, args[1]);
+	else if (strcmp(args[0], "CHANGED") == 0 && args[2] != NULL)
+		notify_client_changed(client, args[1], args[2]);
+	else {
+		e_error(conn->event, "Unknown command: %s", args[0]);
+		return -1;
+	}
+	return 1;
+}
+
+static void notify_client_destroy(struct connection *conn)
+{
+	struct notify_client *client = (struct notify_client *)conn;
+	struct notify_mailbox *const *mailboxp;
+
+	array_foreach(&client->mailboxes, mailboxp)
+		notify_client_unsub_mailbox(client, *mailboxp);
+	array_free(&client->mailboxes);
+
+	connection_deinit(&client->conn);
+	i_free(client);
+
+	master_service_client_connection_destroyed(master_service);
+}
+
+static const struct connection_settings client_set = {
+	.service_name_in = MAILBOX_NOTIFY_SERVICE_NAME,
+	.service_name_out = MAILBOX_NOTIFY_SERVICE_NAME,
+	.major_version = MAILBOX_NOTIFY_VERSION_MAJOR,
+	.minor_version = MAILBOX_NOTIFY_VERSION_MINOR,
+	.input_max_size = 1024,
+	.output_max_size = (size_t)-1,
+	.client = FALSE
+};
+
+static const struct connection_vfuncs client_vfuncs = {
+	.destroy = notify_client_destroy,
+	.input_args = notify_client_input_args
+};
+
+static void client_connected(struct master_service_connection *conn)
+{
+	struct notify_client *client;
+
+	client = i_new(struct notify_client, 1);
+	i_array_init(&client->mailboxes, 4);
+	connection_init_server(clients, &client->conn,
+			       "mailbox-notify", conn->fd, conn->fd);
+	master_service_client_connection_accept(conn);
+}
+
+int main(int argc, char *argv[])
+{
+	const enum master_service_flags service_flags =
+		MASTER_SERVICE_FLAG_UPDATE_PROCTITLE;
+	const char *error;
+
+	master_service = master_service_init("mailbox-notify", service_flags,
+					     &argc, &argv, "");
+	if (master_getopt(master_service) > 0)
+		return FATAL_DEFAULT;
+	if (master_service_settings_read_simple(master_service,
+						NULL, &error) < 0)
+		i_fatal("Error reading configuration: %s", error);
+	master_service_init_log(master_service, "mailbox-notify: ");
+
+	restrict_access_by_env(RESTRICT_ACCESS_FLAG_ALLOW_ROOT, NULL);
+	restrict_access_allow_coredumps(TRUE);
+
+	hash_table_create(&mailboxes, default_pool, 0, str_hash, strcmp);
+	clients = connection_list_init(&client_set, &client_vfuncs);
+	master_service_init_finish(master_service);
+
+	master_service_run(master_service, client_connected);
+
+	connection_list_deinit(&clients);
+	i_assert(hash_table_count(mailboxes) == 0);
+	hash_table_destroy(&mailboxes);
+	master_service_deinit(&master_service);
+	return 0;
+}
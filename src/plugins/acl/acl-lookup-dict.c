@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "array.h"
 #include "str.h"
+#include "hash.h"
 #include "dict.h"
 #include "mail-user.h"
 #include "mail-namespace.h"
@@ -23,10 +24,9 @@ struct acl_lookup_dict_iter {
 	pool_t pool;
 	struct acl_lookup_dict *dict;
 
-	pool_t iter_value_pool;
 	ARRAY_TYPE(const_string) iter_ids;
 	ARRAY_TYPE(const_string) iter_values;
-	unsigned int iter_idx, iter_value_idx;
+	unsigned int iter_value_idx;
 
 	bool failed:1;
 };
@@ -263,34 +263,47 @@ int acl_lookup_dict_rebuild(struct acl_lookup_dict *dict)
 static void acl_lookup_dict_iterate_read(struct acl_lookup_dict_iter *iter)
 {
 	struct dict_iterate_context *dict_iter;
-	const char *const *idp, *prefix, *key, *value, *error;
+	HASH_TABLE(const char *, void *) seen_users;
+	const char *const *ids, **paths, *key, *value, *error;
 	size_t prefix_len;
+	unsigned int i, count;
+
+	/* look up all the identifiers at once. read all of it to memory.
+	   at least currently dict-proxy can support only one iteration at a
+	   time, but the acl code can end up rebuilding the dict, which opens
+	   another iteration. */
+	ids = array_get(&iter->iter_ids, &count);
+	paths = t_new(const char *, count + 1);
+	for (i = 0; i < count; i++) {
+		paths[i] = t_strconcat(DICT_PATH_SHARED DICT_SHARED_BOXES_PATH,
+				       ids[i], "/", NULL);
+	}
 
-	idp = array_idx(&iter->iter_ids, iter->iter_idx);
-	iter->iter_idx++;
-	iter->iter_value_idx = 0;
-
-	prefix = t_strconcat(DICT_PATH_SHARED DICT_SHARED_BOXES_PATH,
-			     *idp, "/", NULL);
-	prefix_len = strlen(prefix);
-
-	/* read all of it to memory. at least currently dict-proxy can support
-	   only one iteration at a time, but the acl code can end up rebuilding
-	   the dict, which opens another iteration. */
-	p_clear(iter->iter_value_pool);
-	array_clear(&iter->iter_values);
-	dict_iter = dict_iterate_init(iter->dict->dict, prefix,
-				      DICT_ITERATE_FLAG_RECURSE);
+	/* the same user is often visible via multiple identifiers (e.g.
+	   "anyone" and a group). return each of them only once. */
+	hash_table_create(&seen_users, default_pool, 0, str_hash, strcmp);
+	dict_iter = dict_iterate_init_multiple(iter->dict->dict, paths,
+					       DICT_ITERATE_FLAG_RECURSE);
 	while (dict_iterate(dict_iter, &key, &value)) {
+		for (i = 0; i < count; i++) {
+			if (str_begins(key, paths[i]))
+				break;
+		}
+		i_assert(i < count);
+		prefix_len = strlen(paths[i]);
 		i_assert(prefix_len < strlen(key));
 
-		key = p_strdup(iter->iter_value_pool, key + prefix_len);
+		if (hash_table_lookup(seen_users, key + prefix_len) != NULL)
+			continue;
+		key = p_strdup(iter->pool, key + prefix_len);
+		hash_table_insert(seen_users, key, POINTER_CAST(1));
 		array_push_back(&iter->iter_values, &key);
 	}
 	if (dict_iterate_deinit(&dict_iter, &error) < 0) {
 		i_error("%s", error);
 		iter->failed = TRUE;
 	}
+	hash_table_destroy(&seen_users);
 }
 
 struct acl_lookup_dict_iter *
@@ -316,8 +329,6 @@ acl_lookup_dict_iterate_visible_init(struct acl_lookup_dict *dict)
 	array_push_back(&iter->iter_ids, &id);
 
 	i_array_init(&iter->iter_values, 64);
-	iter->iter_value_pool =
-		pool_alloconly_create("acl lookup dict iter values", 1024);
 
 	/* get all groups we belong to */
 	if (auser->groups != NULL) {
@@ -328,12 +339,10 @@ acl_lookup_dict_iterate_visible_init(struct acl_lookup_dict *dict)
 		}
 	}
 
-	/* iterate through all identifiers that match us, start with the
-	   first one */
-	if (dict->dict != NULL)
+	/* get the users from all the identifiers that match us */
+	if (dict->dict != NULL) T_BEGIN {
 		acl_lookup_dict_iterate_read(iter);
-	else
-		array_clear(&iter->iter_ids);
+	} T_END;
 	return iter;
 }
 
@@ -346,12 +355,6 @@ acl_lookup_dict_iterate_visible_next(struct acl_lookup_dict_iter *iter)
 	keys = array_get(&iter->iter_values, &count);
 	if (iter->iter_value_idx < count)
 		return keys[iter->iter_value_idx++];
-
-	if (iter->iter_idx < array_count(&iter->iter_ids)) {
-		/* get to the next iterator */
-		acl_lookup_dict_iterate_read(iter);
-		return acl_lookup_dict_iterate_visible_next(iter);
-	}
 	return NULL;
 }
 
@@ -362,7 +365,6 @@ int acl_lookup_dict_iterate_visible_deinit(struct acl_lookup_dict_iter **_iter)
 
 	*_iter = NULL;
 	array_free(&iter->iter_values);
-	pool_unref(&iter->iter_value_pool);
 	pool_unref(&iter->pool);
 	return ret;
 }
@@ -295,6 +295,7 @@ const struct fs fs_class_compress = {
 		fs_wrapper_iter_next,
 		fs_wrapper_iter_deinit,
 		NULL,
-		fs_wrapper_get_nlinks
+		fs_wrapper_get_nlinks,
+		fs_wrapper_delete_bulk,
 	}
 };
@@ -0,0 +1,1324 @@
+/* Copyright (c) 2018 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "llist.h"
+#include "str.h"
+#include "guid.h"
+#include "ioloop.h"
+#include "istream-private.h"
+#include "ostream.h"
+#include "iostream-temp.h"
+#include "settings-parser.h"
+#include "http-url.h"
+#include "http-date.h"
+#include "http-response.h"
+#include "http-client.h"
+#include "fs-api-private.h"
+
+/* Object storage over HTTP. Objects are accessed with GET, HEAD, PUT and
+   DELETE requests to <url>/<path>. Large objects are uploaded in parallel
+   parts using the S3-compatible multipart upload protocol. */
+
+#define FS_HTTP_DEFAULT_PART_SIZE (16*1024*1024)
+#define FS_HTTP_DEFAULT_MAX_PARALLEL 4
+#define FS_HTTP_DEFAULT_MAX_PIPELINED 8
+#define FS_HTTP_DEFAULT_TIMEOUT_MSECS (60*1000)
+#define FS_HTTP_MAX_ATTEMPTS 3
+/* S3 limit */
+#define FS_HTTP_MAX_PARTS 10000
+/* The multipart upload replies are small XML documents. S3 may send
+   whitespace while completing the upload, so allow some extra. */
+#define FS_HTTP_MAX_REPLY_BODY_SIZE (1024*1024)
+
+enum fs_http_request_type {
+	FS_HTTP_REQUEST_TYPE_PUT,
+	FS_HTTP_REQUEST_TYPE_UPLOAD_INIT,
+	FS_HTTP_REQUEST_TYPE_UPLOAD_PART,
+	FS_HTTP_REQUEST_TYPE_UPLOAD_COMPLETE,
+	FS_HTTP_REQUEST_TYPE_UPLOAD_ABORT
+};
+
+enum fs_http_write_state {
+	FS_HTTP_WRITE_STATE_NONE = 0,
+	FS_HTTP_WRITE_STATE_PUT,
+	FS_HTTP_WRITE_STATE_UPLOAD_INIT,
+	FS_HTTP_WRITE_STATE_UPLOAD_PARTS,
+	FS_HTTP_WRITE_STATE_UPLOAD_COMPLETE,
+	FS_HTTP_WRITE_STATE_FINISHED,
+	FS_HTTP_WRITE_STATE_FAILED
+};
+
+struct http_fs {
+	struct fs fs;
+	pool_t pool;
+
+	struct http_client *client;
+	struct http_url *url;
+	const char *base_target;
+
+	uoff_t part_size;
+	uoff_t read_block_size;
+
+	/* ioloop used while waiting for requests to finish */
+	struct ioloop *ioloop;
+	/* write requests whose response payload is being read */
+	struct http_fs_request *payload_requests;
+};
+
+struct http_fs_request {
+	struct http_fs_request *prev, *next;
+	struct http_fs_request *payload_prev, *payload_next;
+
+	struct http_fs *fs;
+	/* NULL if the file no longer cares about the result */
+	struct http_fs_file *file;
+	struct http_client_request *req;
+	enum fs_http_request_type type;
+	unsigned int part_idx;
+
+	struct istream *payload;
+	struct io *io;
+	string_t *body;
+};
+
+struct http_fs_file {
+	struct fs_file file;
+	struct http_fs *fs;
+	enum fs_open_mode open_mode;
+	char *target;
+
+	/* read stream started by fs_prefetch() */
+	struct istream *input;
+
+	/* HEAD/DELETE request */
+	struct http_client_request *sync_req;
+	unsigned int sync_status;
+	char *sync_error;
+	uoff_t head_size;
+	time_t head_mtime;
+
+	/* writing */
+	enum fs_http_write_state write_state;
+	struct istream *write_input;
+	uoff_t write_size, write_part_size;
+	char *upload_id;
+	ARRAY_TYPE(string) part_etags;
+	unsigned int parts_pending;
+	char *write_error;
+	int write_errno;
+	/* in-flight write requests */
+	struct http_fs_request *requests;
+
+	fs_file_async_callback_t *async_callback;
+	void *async_context;
+};
+
+struct http_fs_istream {
+	struct istream_private istream;
+	struct http_fs *fs;
+	char *target;
+
+	struct http_client_request *req;
+	struct istream *payload;
+	/* object offset of the next byte read from the payload */
+	uoff_t payload_offset;
+	/* object offset where the current response started */
+	uoff_t response_offset;
+	/* bytes to skip if the server ignored the Range header */
+	uoff_t payload_skip;
+	/* end of the range requested by fs_prefetch(), (uoff_t)-1 if none */
+	uoff_t prefetch_end;
+	/* total object size, (uoff_t)-1 if not known yet */
+	uoff_t object_size;
+
+	char *error;
+	int error_errno;
+	bool eof:1;
+};
+
+extern const struct fs fs_class_http;
+
+static void
+fs_http_write_response(const struct http_response *response,
+		       struct http_fs_request *hreq);
+
+static struct http_client_request *
+fs_http_request_init(struct http_fs *fs, const char *method,
+		     const char *target,
+		     http_client_request_callback_t *callback, void *context)
+{
+	struct http_client_request *req;
+
+	req = (http_client_request)(fs->client, method, fs->url->host.name,
+				    target, callback, context);
+	http_client_request_set_port(req, http_url_get_port(fs->url));
+	http_client_request_set_ssl(req, fs->url->have_ssl);
+	if (fs->url->user != NULL) {
+		http_client_request_set_auth_simple(req, fs->url->user,
+						    fs->url->password);
+	}
+	return req;
+}
+#define fs_http_request_init(fs, method, target, callback, context) \
+	fs_http_request_init(fs, method, target, \
+		(http_client_request_callback_t *)callback, context + \
+		CALLBACK_TYPECHECK(callback, void (*)( \
+			const struct http_response *response, typeof(context))))
+
+static void fs_http_wakeup(struct http_fs *fs)
+{
+	if (fs->ioloop != NULL)
+		io_loop_stop(fs->ioloop);
+}
+
+static void fs_http_move_payload_ios(struct http_fs *fs)
+{
+	struct http_fs_request *hreq;
+
+	for (hreq = fs->payload_requests; hreq != NULL;
+	     hreq = hreq->payload_next)
+		hreq->io = io_loop_move_io(&hreq->io);
+}
+
+/* Run the HTTP client until something happens. If input is given, wait
+   also for it to become readable. */
+static void fs_http_wait(struct http_fs *fs, struct istream *input)
+{
+	struct ioloop *prev_ioloop = current_ioloop;
+	struct io *io = NULL;
+
+	i_assert(fs->ioloop == NULL);
+
+	fs->ioloop = io_loop_create();
+	(void)http_client_switch_ioloop(fs->client);
+	fs_http_move_payload_ios(fs);
+	if (input != NULL)
+		io = io_add_istream(input, fs_http_wakeup, fs);
+	if (io != NULL || fs->payload_requests != NULL ||
+	    http_client_get_pending_request_count(fs->client) > 0)
+		io_loop_run(fs->ioloop);
+	io_remove(&io);
+
+	io_loop_set_current(prev_ioloop);
+	(void)http_client_switch_ioloop(fs->client);
+	fs_http_move_payload_ios(fs);
+	io_loop_set_current(fs->ioloop);
+	io_loop_destroy(&fs->ioloop);
+}
+
+static struct fs *fs_http_alloc(void)
+{
+	struct http_fs *fs;
+
+	fs = i_new(struct http_fs, 1);
+	fs->fs = fs_class_http;
+	fs->pool = pool_alloconly_create("http fs", 512);
+	return &fs->fs;
+}
+
+static int
+fs_http_parse_param(struct http_fs *fs, const char *key, const char *value,
+		    struct http_client_settings *http_set)
+{
+	const char *error;
+
+	if (strcmp(key, "part_size") == 0) {
+		if (settings_get_size(value, &fs->part_size, &error) < 0) {
+			fs_set_error(&fs->fs, "Invalid part_size '%s': %s",
+				     value, error);
+			return -1;
+		}
+	} else if (strcmp(key, "read_block_size") == 0) {
+		if (settings_get_size(value, &fs->read_block_size,
+				      &error) < 0) {
+			fs_set_error(&fs->fs, "Invalid read_block_size '%s': %s",
+				     value, error);
+			return -1;
+		}
+	} else if (strcmp(key, "max_parallel") == 0) {
+		if (str_to_uint(value, &http_set->max_parallel_connections) < 0 ||
+		    http_set->max_parallel_connections == 0) {
+			fs_set_error(&fs->fs, "Invalid max_parallel '%s'", value);
+			return -1;
+		}
+	} else if (strcmp(key, "max_pipelined") == 0) {
+		if (str_to_uint(value, &http_set->max_pipelined_requests) < 0 ||
+		    http_set->max_pipelined_requests == 0) {
+			fs_set_error(&fs->fs, "Invalid max_pipelined '%s'", value);
+			return -1;
+		}
+	} else if (strcmp(key, "timeout") == 0) {
+		if (settings_get_time_msecs(value,
+				&http_set->request_timeout_msecs, &error) < 0) {
+			fs_set_error(&fs->fs, "Invalid timeout '%s': %s",
+				     value, error);
+			return -1;
+		}
+	} else {
+		fs_set_error(&fs->fs, "Unknown parameter '%s'", key);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+fs_http_init(struct fs *_fs, const char *args, const struct fs_settings *set)
+{
+	struct http_fs *fs = (struct http_fs *)_fs;
+	struct http_client_settings http_set;
+	const char *p, *key, *value, *error;
+	string_t *target;
+
+	i_zero(&http_set);
+	http_set.dns_client = set->dns_client;
+	http_set.ssl = set->ssl_client_set;
+	http_set.max_parallel_connections = FS_HTTP_DEFAULT_MAX_PARALLEL;
+	http_set.max_pipelined_requests = FS_HTTP_DEFAULT_MAX_PIPELINED;
+	http_set.max_attempts = FS_HTTP_MAX_ATTEMPTS;
+	http_set.request_timeout_msecs = FS_HTTP_DEFAULT_TIMEOUT_MSECS;
+	http_set.connect_timeout_msecs = FS_HTTP_DEFAULT_TIMEOUT_MSECS;
+	http_set.event_parent = set->event;
+	http_set.debug = set->debug;
+	fs->part_size = FS_HTTP_DEFAULT_PART_SIZE;
+
+	/* [<key>=<value>:]*<url> */
+	while (!str_begins(args, "http://") && !str_begins(args, "https://")) {
+		p = strchr(args, ':');
+		if (p == NULL) {
+			fs_set_error(_fs, "URL not given as parameter");
+			return -1;
+		}
+		key = t_strdup_until(args, p);
+		args = p + 1;
+
+		value = strchr(key, '=');
+		if (value == NULL) {
+			fs_set_error(_fs, "Invalid parameter '%s'", key);
+			return -1;
+		}
+		key = t_strdup_until(key, value++);
+		if (fs_http_parse_param(fs, key, value, &http_set) < 0)
+			return -1;
+	}
+
+	if (http_url_parse(args, NULL, HTTP_URL_ALLOW_USERINFO_PART, fs->pool,
+			   &fs->url, &error) < 0) {
+		fs_set_error(_fs, "Invalid URL '%s': %s", args, error);
+		return -1;
+	}
+	if (fs->url->enc_query != NULL) {
+		fs_set_error(_fs, "URL can't have a query: %s", args);
+		return -1;
+	}
+	target = t_str_new(128);
+	http_url_escape_path(target, fs->url->path == NULL ? "/" :
+			     fs->url->path);
+	if (str_len(target) == 0 || str_c(target)[str_len(target)-1] != '/')
+		str_append_c(target, '/');
+	fs->base_target = p_strdup(fs->pool, str_c(target));
+
+	fs->client = http_client_init(&http_set);
+	return 0;
+}
+
+static void fs_http_deinit(struct fs *_fs)
+{
+	struct http_fs *fs = (struct http_fs *)_fs;
+
+	if (fs->client != NULL)
+		http_client_deinit(&fs->client);
+	pool_unref(&fs->pool);
+	i_free(fs);
+}
+
+static enum fs_properties fs_http_get_properties(struct fs *fs ATTR_UNUSED)
+{
+	return FS_PROPERTY_STAT | FS_PROPERTY_ASYNC;
+}
+
+static struct fs_file *fs_http_file_alloc(void)
+{
+	struct http_fs_file *file = i_new(struct http_fs_file, 1);
+	return &file->file;
+}
+
+static void
+fs_http_file_init(struct fs_file *_file, const char *path,
+		  enum fs_open_mode mode, enum fs_open_flags flags ATTR_UNUSED)
+{
+	struct http_fs_file *file = (struct http_fs_file *)_file;
+	struct http_fs *fs = (struct http_fs *)_file->fs;
+	guid_128_t guid;
+	string_t *target;
+
+	i_assert(mode != FS_OPEN_MODE_APPEND); /* not supported */
+
+	file->fs = fs;
+	file->open_mode = mode;
+	if (mode == FS_OPEN_MODE_CREATE_UNIQUE_128) {
+		guid_128_generate(guid);
+		path = t_strdup_printf("%s/%s", path,
+				       guid_128_to_string(guid));
+	}
+	file->file.path = i_strdup(path);
+
+	target = t_str_new(128);
+	str_append(target, fs->base_target);
+	if (path[0] == '/')
+		path++;
+	http_url_escape_path(target, path);
+	file->target = i_strdup(str_c(target));
+	i_array_init(&file->part_etags, 4);
+}
+
+static void fs_http_request_payload_end(struct http_fs_request *hreq)
+{
+	struct istream *payload = hreq->payload;
+
+	DLLIST_REMOVE_FULL(&hreq->fs->payload_requests, hreq,
+			   payload_prev, payload_next);
+	io_remove(&hreq->io);
+	str_free(&hreq->body);
+	hreq->payload = NULL;
+	/* this may destroy the request and free hreq */
+	i_stream_unref(&payload);
+}
+
+static void fs_http_file_requests_abort(struct http_fs_file *file)
+{
+	struct http_fs_request *hreq, *next;
+	struct http_client_request *req;
+
+	for (hreq = file->requests; hreq != NULL; hreq = next) {
+		next = hreq->next;
+
+		DLLIST_REMOVE(&file->requests, hreq);
+		hreq->file = NULL;
+		if (hreq->payload != NULL)
+			fs_http_request_payload_end(hreq);
+		else if (hreq->req != NULL) {
+			req = hreq->req;
+			hreq->req = NULL;
+			http_client_request_abort(&req);
+		}
+	}
+}
+
+static void fs_http_request_destroyed(struct http_fs_request *hreq)
+{
+	i_assert(hreq->payload == NULL);
+
+	if (hreq->file != NULL)
+		DLLIST_REMOVE(&hreq->file->requests, hreq);
+	i_free(hreq);
+}
+
+static struct http_fs_request *
+fs_http_write_request(struct http_fs_file *file,
+		      enum fs_http_request_type type,
+		      const char *method, const char *target)
+{
+	struct http_fs_request *hreq;
+
+	hreq = i_new(struct http_fs_request, 1);
+	hreq->fs = file->fs;
+	hreq->type = type;
+	hreq->req = fs_http_request_init(file->fs, method, target,
+					 fs_http_write_response, hreq);
+	http_client_request_set_destroy_callback(hreq->req,
+		fs_http_request_destroyed, hreq);
+	if (type != FS_HTTP_REQUEST_TYPE_UPLOAD_ABORT) {
+		hreq->file = file;
+		DLLIST_PREPEND(&file->requests, hreq);
+	}
+	return hreq;
+}
+
+static const char *fs_http_upload_target(struct http_fs_file *file)
+{
+	string_t *target = t_str_new(128);
+
+	str_printfa(target, "%s?uploadId=", file->target);
+	http_url_escape_param(target, file->upload_id);
+	return str_c(target);
+}
+
+static void fs_http_upload_abort(struct http_fs_file *file)
+{
+	struct http_fs_request *hreq;
+
+	if (file->upload_id == NULL)
+		return;
+
+	/* remove the already uploaded parts. Nobody waits for the result. */
+	hreq = fs_http_write_request(file, FS_HTTP_REQUEST_TYPE_UPLOAD_ABORT,
+				     "DELETE", fs_http_upload_target(file));
+	http_client_request_submit(hreq->req);
+	i_free(file->upload_id);
+}
+
+static void fs_http_write_finished(struct http_fs_file *file)
+{
+	i_stream_unref(&file->write_input);
+	fs_http_wakeup(file->fs);
+	if (file->async_callback != NULL)
+		file->async_callback(file->async_context);
+}
+
+static void
+fs_http_write_fail(struct http_fs_file *file, int error_errno,
+		   const char *error)
+{
+	if (file->write_state == FS_HTTP_WRITE_STATE_FAILED)
+		return;
+
+	file->write_state = FS_HTTP_WRITE_STATE_FAILED;
+	file->write_errno = error_errno;
+	i_free(file->write_error);
+	file->write_error = i_strdup(error);
+	fs_http_file_requests_abort(file);
+	fs_http_upload_abort(file);
+	fs_http_write_finished(file);
+}
+
+static void fs_http_upload_parts(struct http_fs_file *file)
+{
+	struct http_fs_request *hreq;
+	struct istream *input;
+	const char *target;
+	unsigned int i, count;
+	uoff_t offset, size;
+
+	count = (file->write_size + file->write_part_size - 1) /
+		file->write_part_size;
+	file->write_state = FS_HTTP_WRITE_STATE_UPLOAD_PARTS;
+	file->parts_pending = count;
+
+	/* submit all the parts at once. The HTTP client sends them over
+	   max_parallel connections, pipelining the rest. */
+	for (i = 0; i < count; i++) {
+		offset = i * file->write_part_size;
+		size = I_MIN(file->write_part_size, file->write_size - offset);
+		target = t_strdup_printf("%s&partNumber=%u",
+					 fs_http_upload_target(file), i + 1);
+
+		hreq = fs_http_write_request(file,
+			FS_HTTP_REQUEST_TYPE_UPLOAD_PART, "PUT", target);
+		hreq->part_idx = i;
+		input = i_stream_create_range(file->write_input, offset, size);
+		http_client_request_set_payload(hreq->req, input, FALSE);
+		i_stream_unref(&input);
+		http_client_request_submit(hreq->req);
+	}
+}
+
+static void fs_http_upload_complete(struct http_fs_file *file)
+{
+	struct http_fs_request *hreq;
+	char *const *etags;
+	unsigned int i, count;
+	string_t *body;
+
+	body = t_str_new(128);
+	str_append(body, "<CompleteMultipartUpload>");
+	etags = array_get(&file->part_etags, &count);
+	for (i = 0; i < count; i++) {
+		str_printfa(body, "<Part><PartNumber>%u</PartNumber>"
+			    "<ETag>%s</ETag></Part>", i + 1, etags[i]);
+	}
+	str_append(body, "</CompleteMultipartUpload>");
+
+	file->write_state = FS_HTTP_WRITE_STATE_UPLOAD_COMPLETE;
+	hreq = fs_http_write_request(file,
+		FS_HTTP_REQUEST_TYPE_UPLOAD_COMPLETE, "POST",
+		fs_http_upload_target(file));
+	http_client_request_set_payload_data(hreq->req, str_data(body),
+					     str_len(body));
+	http_client_request_submit(hreq->req);
+}
+
+static const char *fs_http_xml_get_value(const char *body, const char *name)
+{
+	const char *tag, *p, *end;
+
+	tag = t_strdup_printf("<%s>", name);
+	p = strstr(body, tag);
+	if (p == NULL)
+		return NULL;
+	p += strlen(tag);
+	end = strstr(p, t_strdup_printf("</%s>", name));
+	return end == NULL ? NULL : t_strdup_until(p, end);
+}
+
+static void
+fs_http_write_body_finished(struct http_fs_file *file,
+			    enum fs_http_request_type type, const char *body)
+{
+	const char *upload_id;
+
+	switch (type) {
+	case FS_HTTP_REQUEST_TYPE_UPLOAD_INIT:
+		upload_id = fs_http_xml_get_value(body, "UploadId");
+		if (upload_id == NULL || upload_id[0] == '\0') {
+			fs_http_write_fail(file, EIO, t_strdup_printf(
+				"POST %s failed: UploadId missing from reply",
+				file->file.path));
+			break;
+		}
+		file->upload_id = i_strdup(upload_id);
+		fs_http_upload_parts(file);
+		break;
+	case FS_HTTP_REQUEST_TYPE_UPLOAD_COMPLETE:
+		/* S3 may fail the completion after already replying 200 */
+		if (strstr(body, "<Error>") != NULL) {
+			fs_http_write_fail(file, EIO, t_strdup_printf(
+				"POST %s failed: %s", file->file.path, body));
+			break;
+		}
+		i_free(file->upload_id);
+		file->write_state = FS_HTTP_WRITE_STATE_FINISHED;
+		fs_http_write_finished(file);
+		break;
+	default:
+		i_unreached();
+	}
+}
+
+static void fs_http_request_payload_input(struct http_fs_request *hreq)
+{
+	struct http_fs *fs = hreq->fs;
+	struct http_fs_file *file = hreq->file;
+	enum fs_http_request_type type = hreq->type;
+	const unsigned char *data;
+	const char *body, *error = NULL;
+	size_t size;
+	int ret;
+
+	while ((ret = i_stream_read_more(hreq->payload, &data, &size)) > 0) {
+		if (str_len(hreq->body) + size > FS_HTTP_MAX_REPLY_BODY_SIZE)
+			break;
+		str_append_data(hreq->body, data, size);
+		i_stream_skip(hreq->payload, size);
+	}
+	if (ret == 0)
+		return;
+
+	if (ret > 0) {
+		error = t_strdup_printf("%s: Reply is larger than %u bytes",
+					i_stream_get_name(hreq->payload),
+					FS_HTTP_MAX_REPLY_BODY_SIZE);
+	} else if (hreq->payload->stream_errno != 0) {
+		error = t_strdup_printf("read(%s) failed: %s",
+					i_stream_get_name(hreq->payload),
+					i_stream_get_error(hreq->payload));
+	}
+	body = t_strdup(str_c(hreq->body));
+	fs_http_request_payload_end(hreq);
+
+	if (file == NULL)
+		;
+	else if (error != NULL)
+		fs_http_write_fail(file, EIO, error);
+	else
+		fs_http_write_body_finished(file, type, body);
+	fs_http_wakeup(fs);
+}
+
+static void
+fs_http_write_response(const struct http_response *response,
+		       struct http_fs_request *hreq)
+{
+	struct http_fs_file *file = hreq->file;
+	const char *etag;
+	char *etag_dup;
+
+	hreq->req = NULL;
+	if (file == NULL) {
+		if (!http_response_is_success(response)) {
+			e_debug(hreq->fs->fs.event,
+				"Aborting multipart upload failed: %s",
+				http_response_get_message(response));
+		}
+		return;
+	}
+
+	if (!http_response_is_success(response)) {
+		fs_http_write_fail(file, response->status == 412 ? EEXIST : EIO,
+			t_strdup_printf("%s failed: %s", file->file.path,
+					http_response_get_message(response)));
+		return;
+	}
+
+	switch (hreq->type) {
+	case FS_HTTP_REQUEST_TYPE_PUT:
+		file->write_state = FS_HTTP_WRITE_STATE_FINISHED;
+		fs_http_write_finished(file);
+		break;
+	case FS_HTTP_REQUEST_TYPE_UPLOAD_PART:
+		etag = http_response_header_get(response, "ETag");
+		if (etag == NULL) {
+			fs_http_write_fail(file, EIO, t_strdup_printf(
+				"PUT %s part %u failed: ETag missing from reply",
+				file->file.path, hreq->part_idx + 1));
+			break;
+		}
+		etag_dup = i_strdup(etag);
+		array_idx_set(&file->part_etags, hreq->part_idx, &etag_dup);
+		i_assert(file->parts_pending > 0);
+		if (--file->parts_pending == 0)
+			fs_http_upload_complete(file);
+		break;
+	case FS_HTTP_REQUEST_TYPE_UPLOAD_INIT:
+	case FS_HTTP_REQUEST_TYPE_UPLOAD_COMPLETE:
+		if (response->payload == NULL) {
+			fs_http_write_body_finished(file, hreq->type, "");
+			break;
+		}
+		i_stream_ref(response->payload);
+		hreq->payload = response->payload;
+		hreq->body = str_new(default_pool, 256);
+		hreq->io = io_add_istream(hreq->payload,
+					  fs_http_request_payload_input, hreq);
+		DLLIST_PREPEND_FULL(&hreq->fs->payload_requests, hreq,
+				    payload_prev, payload_next);
+		fs_http_request_payload_input(hreq);
+		break;
+	case FS_HTTP_REQUEST_TYPE_UPLOAD_ABORT:
+		i_unreached();
+	}
+}
+
+static void fs_http_file_deinit(struct fs_file *_file)
+{
+	struct http_fs_file *file = (struct http_fs_file *)_file;
+	char **etagp;
+
+	i_assert(_file->output == NULL);
+
+	if (file->sync_req != NULL)
+		http_client_request_abort(&file->sync_req);
+	fs_http_file_requests_abort(file);
+	fs_http_upload_abort(file);
+
+	i_stream_unref(&file->input);
+	i_stream_unref(&file->write_input);
+	array_foreach_modifiable(&file->part_etags, etagp)
+		i_free(*etagp);
+	array_free(&file->part_etags);
+	i_free(file->write_error);
+	i_free(file->sync_error);
+	i_free(file->target);
+	i_free(file->file.path);
+	i_free(file);
+}
+
+static void fs_http_file_close(struct fs_file *_file)
+{
+	struct http_fs_file *file = (struct http_fs_file *)_file;
+
+	i_stream_unref(&file->input);
+}
+
+static void
+fs_http_set_async_callback(struct fs_file *_file,
+			   fs_file_async_callback_t *callback, void *context)
+{
+	struct http_fs_file *file = (struct http_fs_file *)_file;
+
+	file->async_callback = callback;
+	file->async_context = context;
+}
+
+static void fs_http_wait_async(struct fs *_fs)
+{
+	struct http_fs *fs = (struct http_fs *)_fs;
+
+	fs_http_wait(fs, NULL);
+}
+
+static bool fs_http_switch_ioloop(struct fs *_fs)
+{
+	struct http_fs *fs = (struct http_fs *)_fs;
+
+	(void)http_client_switch_ioloop(fs->client);
+	fs_http_move_payload_ios(fs);
+	return http_client_get_pending_request_count(fs->client) > 0;
+}
+
+static bool
+fs_http_parse_content_range(const char *value, uoff_t *start_r,
+			    uoff_t *total_r)
+{
+	const char *p;
+
+	/* bytes <start>-<end>/<total or *> */
+	if (!str_begins(value, "bytes "))
+		return FALSE;
+	value += 6;
+	p = strchr(value, '-');
+	if (p == NULL || str_to_uoff(t_strdup_until(value, p), start_r) < 0)
+		return FALSE;
+	p = strchr(p, '/');
+	if (p == NULL)
+		return FALSE;
+	p++;
+	if (strcmp(p, "*") == 0) {
+		*total_r = (uoff_t)-1;
+		return TRUE;
+	}
+	return str_to_uoff(p, total_r) == 0;
+}
+
+static void
+fs_http_istream_set_error(struct http_fs_istream *hstream, int error_errno,
+			  const char *error)
+{
+	if (hstream->error_errno != 0)
+		return;
+	hstream->error_errno = error_errno;
+	hstream->error = i_strdup_printf("GET %s failed: %s",
+		i_stream_get_name(&hstream->istream.istream), error);
+}
+
+static void
+fs_http_istream_response(const struct http_response *response,
+			 struct http_fs_istream *hstream)
+{
+	const char *value;
+	uoff_t start, size;
+
+	hstream->req = NULL;
+	hstream->response_offset = hstream->payload_offset;
+	switch (response->status) {
+	case 200:
+		/* the whole object. The server either ignored the Range or
+		   there wasn't one. */
+		hstream->payload_skip = hstream->payload_offset;
+		value = http_response_header_get(response, "Content-Length");
+		if (value != NULL && str_to_uoff(value, &size) == 0)
+			hstream->object_size = size;
+		break;
+	case 206:
+		value = http_response_header_get(response, "Content-Range");
+		if (value == NULL ||
+		    !fs_http_parse_content_range(value, &start, &size) ||
+		    start != hstream->payload_offset) {
+			fs_http_istream_set_error(hstream, EIO, t_strdup_printf(
+				"Invalid Content-Range: %s",
+				value == NULL ? "(missing)" : value));
+			break;
+		}
+		if (size != (uoff_t)-1)
+			hstream->object_size = size;
+		break;
+	case 416:
+		/* reading past the end of the object */
+		hstream->eof = TRUE;
+		break;
+	case 404:
+		fs_http_istream_set_error(hstream, ENOENT,
+					  http_response_get_message(response));
+		break;
+	default:
+		fs_http_istream_set_error(hstream, EIO,
+					  http_response_get_message(response));
+		break;
+	}
+	if (http_response_is_success(response) && hstream->error_errno == 0) {
+		if (response->payload == NULL)
+			hstream->payload = i_stream_create_from_data("", 0);
+		else {
+			i_stream_ref(response->payload);
+			hstream->payload = response->payload;
+		}
+	}
+	fs_http_wakeup(hstream->fs);
+}
+
+static void fs_http_istream_request(struct http_fs_istream *hstream)
+{
+	struct http_fs *fs = hstream->fs;
+	uoff_t offset = hstream->payload_offset;
+	uoff_t end = hstream->prefetch_end;
+
+	i_assert(hstream->req == NULL);
+	i_assert(hstream->payload == NULL);
+
+	if (fs->read_block_size > 0 &&
+	    (end == (uoff_t)-1 || end - offset > fs->read_block_size))
+		end = offset + fs->read_block_size;
+	/* the prefetch range applies only to the first request */
+	hstream->prefetch_end = (uoff_t)-1;
+
+	hstream->req = fs_http_request_init(fs, "GET", hstream->target,
+					    fs_http_istream_response, hstream);
+	if (end != (uoff_t)-1 && end > offset) {
+		http_client_request_add_header(hstream->req, "Range",
+			t_strdup_printf("bytes=%"PRIuUOFF_T"-%"PRIuUOFF_T,
+					offset, end - 1));
+	} else if (offset > 0) {
+		http_client_request_add_header(hstream->req, "Range",
+			t_strdup_printf("bytes=%"PRIuUOFF_T"-", offset));
+	}
+	http_client_request_submit(hstream->req);
+}
+
+static void fs_http_istream_reset(struct http_fs_istream *hstream)
+{
+	if (hstream->req != NULL)
+		http_client_request_abort(&hstream->req);
+	i_stream_unref(&hstream->payload);
+	hstream->payload_skip = 0;
+	hstream->eof = FALSE;
+}
+
+static ssize_t fs_http_istream_read(struct istream_private *stream)
+{
+	struct http_fs_istream *hstream = (struct http_fs_istream *)stream;
+	const unsigned char *data;
+	size_t size, avail;
+	int ret;
+
+	for (;;) {
+		if (hstream->error_errno != 0) {
+			io_stream_set_error(&stream->iostream, "%s",
+					    hstream->error);
+			stream->istream.stream_errno = hstream->error_errno;
+			return -1;
+		}
+		if (hstream->payload == NULL) {
+			if (hstream->eof ||
+			    hstream->payload_offset >= hstream->object_size) {
+				stream->istream.eof = TRUE;
+				return -1;
+			}
+			if (hstream->req == NULL)
+				fs_http_istream_request(hstream);
+			fs_http_wait(hstream->fs, NULL);
+			continue;
+		}
+
+		ret = i_stream_read_more(hstream->payload, &data, &size);
+		if (ret == 0) {
+			fs_http_wait(hstream->fs, hstream->payload);
+			continue;
+		}
+		if (ret < 0) {
+			if (hstream->payload->stream_errno != 0) {
+				fs_http_istream_set_error(hstream,
+					hstream->payload->stream_errno,
+					i_stream_get_error(hstream->payload));
+			} else if (hstream->object_size == (uoff_t)-1) {
+				/* size wasn't known, so this was all of it */
+				hstream->eof = TRUE;
+			} else if (hstream->payload_offset ==
+				   hstream->response_offset &&
+				   hstream->payload_offset <
+				   hstream->object_size) {
+				fs_http_istream_set_error(hstream, EIO,
+							  "Empty reply");
+			}
+			/* continue with the next range, if any */
+			i_stream_unref(&hstream->payload);
+			continue;
+		}
+		if (hstream->payload_skip > 0) {
+			size = I_MIN(size, hstream->payload_skip);
+			i_stream_skip(hstream->payload, size);
+			hstream->payload_skip -= size;
+			continue;
+		}
+
+		if (!i_stream_try_alloc(stream, size, &avail))
+			return -2;
+		size = I_MIN(size, avail);
+		memcpy(stream->w_buffer + stream->pos, data, size);
+		stream->pos += size;
+		i_stream_skip(hstream->payload, size);
+		hstream->payload_offset += size;
+		return size;
+	}
+}
+
+static void fs_http_istream_seek(struct istream_private *stream,
+				 uoff_t v_offset, bool mark ATTR_UNUSED)
+{
+	struct http_fs_istream *hstream = (struct http_fs_istream *)stream;
+
+	stream->istream.v_offset = v_offset;
+	stream->skip = stream->pos = 0;
+	if (v_offset != hstream->payload_offset) {
+		/* continue with a ranged request from the new offset */
+		fs_http_istream_reset(hstream);
+		hstream->payload_offset = v_offset;
+	}
+}
+
+static int fs_http_istream_stat(struct istream_private *stream,
+				bool exact ATTR_UNUSED)
+{
+	struct http_fs_istream *hstream = (struct http_fs_istream *)stream;
+
+	/* the size is known after the first response */
+	if (hstream->object_size == (uoff_t)-1 && hstream->payload == NULL &&
+	    !hstream->eof) {
+		if (hstream->req == NULL)
+			fs_http_istream_request(hstream);
+		while (hstream->req != NULL)
+			fs_http_wait(hstream->fs, NULL);
+	}
+	if (hstream->error_errno != 0) {
+		io_stream_set_error(&stream->iostream, "%s", hstream->error);
+		stream->istream.stream_errno = hstream->error_errno;
+		return -1;
+	}
+	stream->statbuf.st_size = hstream->object_size == (uoff_t)-1 ? -1 :
+		(off_t)hstream->object_size;
+	return 0;
+}
+
+static void fs_http_istream_close(struct iostream_private *stream,
+				  bool close_parent ATTR_UNUSED)
+{
+	struct http_fs_istream *hstream = (struct http_fs_istream *)stream;
+
+	fs_http_istream_reset(hstream);
+}
+
+static void fs_http_istream_destroy(struct iostream_private *stream)
+{
+	struct http_fs_istream *hstream = (struct http_fs_istream *)stream;
+
+	i_stream_free_buffer(&hstream->istream);
+	i_free(hstream->target);
+	i_free(hstream->error);
+}
+
+static struct istream *
+fs_http_istream_create(struct http_fs_file *file, uoff_t prefetch_length,
+		       size_t max_buffer_size)
+{
+	struct http_fs_istream *hstream;
+	struct istream *input;
+
+	hstream = i_new(struct http_fs_istream, 1);
+	hstream->fs = file->fs;
+	hstream->target = i_strdup(file->target);
+	hstream->object_size = (uoff_t)-1;
+	hstream->prefetch_end = prefetch_length;
+	hstream->istream.iostream.close = fs_http_istream_close;
+	hstream->istream.iostream.destroy = fs_http_istream_destroy;
+	hstream->istream.max_buffer_size = max_buffer_size;
+	hstream->istream.read = fs_http_istream_read;
+	hstream->istream.seek = fs_http_istream_seek;
+	hstream->istream.stat = fs_http_istream_stat;
+
+	/* seeking is done with ranged requests */
+	hstream->istream.istream.blocking = TRUE;
+	hstream->istream.istream.seekable = TRUE;
+
+	input = i_stream_create(&hstream->istream, NULL, -1, 0);
+	i_stream_set_name(input, file->file.path);
+	return input;
+}
+
+static bool fs_http_prefetch(struct fs_file *_file, uoff_t length)
+{
+	struct http_fs_file *file = (struct http_fs_file *)_file;
+	struct http_fs_istream *hstream;
+
+	if (file->input == NULL) {
+		/* start the request now, reading continues in
+		   fs_read_stream() */
+		file->input = fs_http_istream_create(file, length,
+						     IO_BLOCK_SIZE);
+		hstream = (struct http_fs_istream *)file->input->real_stream;
+		fs_http_istream_request(hstream);
+	}
+	return FALSE;
+}
+
+static struct istream *
+fs_http_read_stream(struct fs_file *_file, size_t max_buffer_size)
+{
+	struct http_fs_file *file = (struct http_fs_file *)_file;
+	struct istream *input;
+
+	if (file->input == NULL)
+		return fs_http_istream_create(file, (uoff_t)-1, max_buffer_size);
+
+	input = file->input;
+	file->input = NULL;
+	i_stream_set_max_buffer_size(input, max_buffer_size);
+	return input;
+}
+
+static void fs_http_write_stream(struct fs_file *_file)
+{
+	struct http_fs_file *file = (struct http_fs_file *)_file;
+
+	i_assert(_file->output == NULL);
+
+	file->write_state = FS_HTTP_WRITE_STATE_NONE;
+	_file->output = iostream_temp_create_named(_file->fs->temp_path_prefix,
+						   0, fs_file_path(_file));
+}
+
+static void fs_http_write_start(struct http_fs_file *file)
+{
+	struct http_fs_request *hreq;
+	uoff_t part_size = file->fs->part_size;
+
+	if (i_stream_get_size(file->write_input, TRUE, &file->write_size) <= 0) {
+		fs_http_write_fail(file, EIO, t_strdup_printf(
+			"Couldn't get size of %s: %s",
+			i_stream_get_name(file->write_input),
+			i_stream_get_error(file->write_input)));
+		return;
+	}
+
+	if (part_size == 0 || file->write_size <= part_size) {
+		file->write_state = FS_HTTP_WRITE_STATE_PUT;
+		hreq = fs_http_write_request(file, FS_HTTP_REQUEST_TYPE_PUT,
+					     "PUT", file->target);
+		if (file->open_mode == FS_OPEN_MODE_CREATE) {
+			http_client_request_add_header(hreq->req,
+						       "If-None-Match", "*");
+		}
+		http_client_request_set_payload(hreq->req, file->write_input,
+						FALSE);
+		http_client_request_submit(hreq->req);
+		return;
+	}
+
+	/* multipart upload */
+	if (file->write_size / part_size >= FS_HTTP_MAX_PARTS)
+		part_size = file->write_size / (FS_HTTP_MAX_PARTS - 1);
+	file->write_part_size = part_size;
+	file->write_state = FS_HTTP_WRITE_STATE_UPLOAD_INIT;
+	hreq = fs_http_write_request(file, FS_HTTP_REQUEST_TYPE_UPLOAD_INIT,
+				     "POST", t_strconcat(file->target,
+							 "?uploads", NULL));
+	http_client_request_set_payload_empty(hreq->req);
+	http_client_request_submit(hreq->req);
+}
+
+static int fs_http_write_stream_finish(struct fs_file *_file, bool success)
+{
+	struct http_fs_file *file = (struct http_fs_file *)_file;
+
+	if (_file->output != NULL) {
+		if (_file->output->closed)
+			success = FALSE;
+		if (!success)
+			o_stream_destroy(&_file->output);
+		else {
+			file->write_input =
+				iostream_temp_finish(&_file->output,
+						     IO_BLOCK_SIZE);
+			fs_http_write_start(file);
+		}
+	}
+	if (!success) {
+		fs_http_file_requests_abort(file);
+		fs_http_upload_abort(file);
+		i_stream_unref(&file->write_input);
+		file->write_state = FS_HTTP_WRITE_STATE_FAILED;
+		return -1;
+	}
+
+	while (file->write_state != FS_HTTP_WRITE_STATE_FINISHED &&
+	       file->write_state != FS_HTTP_WRITE_STATE_FAILED) {
+		if ((_file->flags & FS_OPEN_FLAG_ASYNC) != 0)
+			return 0;
+		fs_http_wait(file->fs, NULL);
+	}
+	if (file->write_state == FS_HTTP_WRITE_STATE_FAILED) {
+		fs_set_error(_file->fs, "%s", file->write_error);
+		errno = file->write_errno;
+		return -1;
+	}
+	return 1;
+}
+
+static void
+fs_http_sync_response(const struct http_response *response,
+		      struct http_fs_file *file)
+{
+	const char *value;
+
+	file->sync_req = NULL;
+	file->sync_status = response->status;
+	i_free(file->sync_error);
+	if (!http_response_is_success(response)) {
+		file->sync_error =
+			i_strdup(http_response_get_message(response));
+	} else {
+		value = http_response_header_get(response, "Content-Length");
+		if (value == NULL || str_to_uoff(value, &file->head_size) < 0)
+			file->head_size = (uoff_t)-1;
+		value = http_response_header_get(response, "Last-Modified");
+		if (value == NULL ||
+		    !http_date_parse((const unsigned char *)value,
+				     strlen(value), &file->head_mtime))
+			file->head_mtime = 0;
+	}
+	fs_http_wakeup(file->fs);
+}
+
+static void
+fs_http_sync_request_submit(struct http_fs_file *file, const char *method)
+{
+	i_assert(file->sync_req == NULL);
+
+	file->sync_status = 0;
+	file->sync_req = fs_http_request_init(file->fs, method, file->target,
+					      fs_http_sync_response, file);
+	http_client_request_submit(file->sync_req);
+}
+
+/* Send a request without payload and wait for the reply. Returns the HTTP
+   status code. */
+static unsigned int
+fs_http_sync_request(struct http_fs_file *file, const char *method)
+{
+	fs_http_sync_request_submit(file, method);
+	while (file->sync_req != NULL)
+		fs_http_wait(file->fs, NULL);
+	return file->sync_status;
+}
+
+static void
+fs_http_sync_request_set_error(struct http_fs_file *file, const char *method)
+{
+	errno = file->sync_status == 404 ? ENOENT : EIO;
+	fs_set_error(file->file.fs, "%s %s failed: %s", method,
+		     file->file.path, file->sync_error);
+}
+
+static int fs_http_exists(struct fs_file *_file)
+{
+	struct http_fs_file *file = (struct http_fs_file *)_file;
+	unsigned int status;
+
+	status = fs_http_sync_request(file, "HEAD");
+	if (status / 100 == 2)
+		return 1;
+	if (status == 404)
+		return 0;
+	fs_http_sync_request_set_error(file, "HEAD");
+	return -1;
+}
+
+static int fs_http_stat(struct fs_file *_file, struct stat *st_r)
+{
+	struct http_fs_file *file = (struct http_fs_file *)_file;
+
+	if (fs_http_sync_request(file, "HEAD") / 100 != 2) {
+		fs_http_sync_request_set_error(file, "HEAD");
+		return -1;
+	}
+	if (file->head_size == (uoff_t)-1) {
+		fs_set_error(_file->fs, "HEAD %s failed: "
+			     "Content-Length missing from reply", _file->path);
+		errno = EIO;
+		return -1;
+	}
+	i_zero(st_r);
+	st_r->st_size = file->head_size;
+	st_r->st_mtime = file->head_mtime;
+	return 0;
+}
+
+static int fs_http_rename(struct fs_file *src, struct fs_file *dest)
+{
+	fs_set_error(dest->fs, "rename(%s, %s) not supported",
+		     src->path, dest->path);
+	errno = ENOTSUP;
+	return -1;
+}
+
+static int fs_http_delete(struct fs_file *_file)
+{
+	struct http_fs_file *file = (struct http_fs_file *)_file;
+
+	if (fs_http_sync_request(file, "DELETE") / 100 != 2) {
+		fs_http_sync_request_set_error(file, "DELETE");
+		return -1;
+	}
+	return 0;
+}
+
+static int fs_http_delete_bulk(struct fs_file *const *files, unsigned int count)
+{
+	struct http_fs_file *file;
+	unsigned int i, pending;
+	int ret = 0;
+
+	/* Submit all the requests at once, so the HTTP client sends them in
+	   parallel up to its max_parallel and max_pipelined limits. */
+	for (i = 0; i < count; i++) {
+		file = (struct http_fs_file *)files[i];
+		fs_http_sync_request_submit(file, "DELETE");
+	}
+	do {
+		for (i = pending = 0; i < count; i++) {
+			file = (struct http_fs_file *)files[i];
+			if (file->sync_req != NULL)
+				pending++;
+		}
+		if (pending > 0)
+			fs_http_wait((struct http_fs *)files[0]->fs, NULL);
+	} while (pending > 0);
+
+	/* go through the failures backwards, so the first one's error is
+	   left as the fs error */
+	for (i = count; i > 0; i--) {
+		file = (struct http_fs_file *)files[i-1];
+		if (file->sync_status / 100 != 2) {
+			fs_http_sync_request_set_error(file, "DELETE");
+			ret = -1;
+		}
+	}
+	return ret;
+}
+
+const struct fs fs_class_http = {
+	.name = "http",
+	.v = {
+		fs_http_alloc,
+		fs_http_init,
+		fs_http_deinit,
+		fs_http_get_properties,
+		fs_http_file_alloc,
+		fs_http_file_init,
+		fs_http_file_deinit,
+		fs_http_file_close,
+		NULL,
+		fs_http_set_async_callback,
+		fs_http_wait_async,
+		NULL,
+		NULL,
+		fs_http_prefetch,
+		fs_read_via_stream,
+		fs_http_read_stream,
+		fs_write_via_stream,
+		fs_http_write_stream,
+		fs_http_write_stream_finish,
+		NULL,
+		NULL,
+		fs_http_exists,
+		fs_http_stat,
+		fs_default_copy,
+		fs_http_rename,
+		fs_http_delete,
+		NULL,
+		NULL,
+		NULL,
+		NULL,
+		fs_http_switch_ioloop,
+		NULL,
+		fs_http_delete_bulk
+	}
+};
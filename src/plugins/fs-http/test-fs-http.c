@@ -0,0 +1,239 @@
+/* Copyright (c) 2018 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "str.h"
+#include "hostpid.h"
+#include "ioloop.h"
+#include "http-url.h"
+#include "http-request.h"
+#include "http-server.h"
+#include "fs-api-private.h"
+#include "test-common.h"
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+
+#define TEST_OBJECT_DATA "hello world"
+/* larger than FS_HTTP_MAX_REPLY_BODY_SIZE */
+#define TEST_LARGE_REPLY_SIZE (2*1024*1024)
+
+extern const struct fs fs_class_http;
+
+static struct ip_addr bind_ip;
+static in_port_t bind_port;
+static int fd_listen = -1;
+static pid_t server_pid = (pid_t)-1;
+static struct ioloop *ioloop;
+
+/*
+ * Test server
+ */
+
+static struct http_server *http_server;
+static struct io *io_listen;
+static string_t *large_reply;
+
+static void
+test_server_handle_request(void *context ATTR_UNUSED,
+			   struct http_server_request *req)
+{
+	const struct http_request *hreq = http_server_request_get(req);
+	const char *path = hreq->target.url->path;
+	struct http_server_response *resp;
+
+	if (strcmp(hreq->method, "GET") == 0 &&
+	    strcmp(path, "/bucket/object") == 0) {
+		resp = http_server_response_create(req, 200, "OK");
+		http_server_response_set_payload_data(resp,
+			(const unsigned char *)TEST_OBJECT_DATA,
+			strlen(TEST_OBJECT_DATA));
+		http_server_response_submit(resp);
+	} else if (strcmp(hreq->method, "POST") == 0 &&
+		   strcmp(path, "/bucket/large-reply") == 0) {
+		/* multipart upload init with a too large reply */
+		resp = http_server_response_create(req, 200, "OK");
+		http_server_response_set_payload_data(resp,
+			str_data(large_reply), str_len(large_reply));
+		http_server_response_submit(resp);
+	} else {
+		http_server_request_fail(req, 404, "Not Found");
+	}
+}
+
+static void
+test_server_connection_destroy(void *context ATTR_UNUSED,
+			       const char *reason ATTR_UNUSED)
+{
+}
+
+static const struct http_server_callbacks test_server_callbacks = {
+	.connection_destroy = test_server_connection_destroy,
+	.handle_request = test_server_handle_request
+};
+
+static void test_server_accept(void *context ATTR_UNUSED)
+{
+	int fd;
+
+	fd = net_accept(fd_listen, NULL, NULL);
+	if (fd == -1)
+		return;
+	if (fd == -2)
+		i_fatal("test server: accept() failed: %m");
+	net_set_nonblock(fd, TRUE);
+	(void)http_server_connection_create(http_server, fd, fd, FALSE,
+					    &test_server_callbacks, NULL);
+}
+
+static void test_server_run(void)
+{
+	struct http_server_settings http_set;
+
+	large_reply = str_new(default_pool, TEST_LARGE_REPLY_SIZE);
+	str_append(large_reply, "<InitiateMultipartUploadResult>");
+	while (str_len(large_reply) < TEST_LARGE_REPLY_SIZE)
+		str_append_c(large_reply, ' ');
+
+	i_zero(&http_set);
+	http_set.max_pipelined_requests = 4;
+	http_server = http_server_init(&http_set);
+	io_listen = io_add(fd_listen, IO_READ, test_server_accept, NULL);
+
+	io_loop_run(ioloop);
+
+	io_remove(&io_listen);
+	http_server_deinit(&http_server);
+	str_free(&large_reply);
+}
+
+static void test_server_start(void)
+{
+	bind_port = 0;
+	fd_listen = net_listen(&bind_ip, &bind_port, 128);
+	if (fd_listen == -1) {
+		i_fatal("listen(%s:%u) failed: %m",
+			net_ip2addr(&bind_ip), bind_port);
+	}
+
+	if ((server_pid = fork()) == (pid_t)-1)
+		i_fatal("fork() failed: %m");
+	if (server_pid == 0) {
+		server_pid = (pid_t)-1;
+		hostpid_init();
+		/* child: server */
+		ioloop = io_loop_create();
+		test_server_run();
+		io_loop_destroy(&ioloop);
+		i_close_fd(&fd_listen);
+		/* wait for it to be killed; this way, valgrind will not
+		   object to this process going away inelegantly. */
+		sleep(60);
+		exit(1);
+	}
+	i_close_fd(&fd_listen);
+}
+
+static void test_server_kill(void)
+{
+	if (server_pid != (pid_t)-1) {
+		(void)kill(server_pid, SIGKILL);
+		(void)waitpid(server_pid, NULL, 0);
+		server_pid = (pid_t)-1;
+	}
+}
+
+static void test_run_client_server(void (*client_test)(struct fs *fs),
+				   const char *params)
+{
+	static bool registered = FALSE;
+	struct fs_settings fs_set;
+	struct fs *fs;
+	const char *error;
+
+	if (!registered) {
+		fs_class_register(&fs_class_http);
+		registered = TRUE;
+	}
+	test_server_start();
+
+	ioloop = io_loop_create();
+	i_zero(&fs_set);
+	fs_set.temp_dir = ".";
+	if (fs_init("http", t_strdup_printf("%shttp://%s:%u/bucket/", params,
+					    net_ip2addr(&bind_ip), bind_port),
+		    &fs_set, &fs, &error) < 0)
+		i_fatal("fs_init() failed: %s", error);
+	client_test(fs);
+	fs_deinit(&fs);
+	io_loop_destroy(&ioloop);
+
+	test_server_kill();
+}
+
+/*
+ * Tests
+ */
+
+static void test_client_read(struct fs *fs)
+{
+	struct fs_file *file;
+	char buf[128];
+	ssize_t ret;
+
+	file = fs_file_init(fs, "object", FS_OPEN_MODE_READONLY);
+	ret = fs_read(file, buf, sizeof(buf));
+	test_assert(ret == (ssize_t)strlen(TEST_OBJECT_DATA));
+	test_assert(ret > 0 && memcmp(buf, TEST_OBJECT_DATA, ret) == 0);
+	fs_file_deinit(&file);
+
+	file = fs_file_init(fs, "nonexistent", FS_OPEN_MODE_READONLY);
+	test_assert(fs_read(file, buf, sizeof(buf)) < 0 && errno == ENOENT);
+	fs_file_deinit(&file);
+}
+
+static void test_fs_http_read(void)
+{
+	test_begin("fs-http read");
+	test_run_client_server(test_client_read, "");
+	test_end();
+}
+
+static void test_client_reply_too_large(struct fs *fs)
+{
+	static const char data[] = "0123456789abcdef0123456789abcdef";
+	struct fs_file *file;
+
+	file = fs_file_init(fs, "large-reply", FS_OPEN_MODE_REPLACE);
+	test_assert(fs_write(file, data, sizeof(data)-1) < 0 && errno == EIO);
+	test_assert(strstr(fs_file_last_error(file), "Reply is larger") != NULL);
+	fs_file_deinit(&file);
+}
+
+static void test_fs_http_reply_too_large(void)
+{
+	test_begin("fs-http reply too large");
+	/* the object is larger than part_size, so a multipart upload is
+	   started. the server's reply to it is too large to buffer. */
+	test_run_client_server(test_client_reply_too_large, "part_size=16:");
+	test_end();
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_fs_http_read,
+		test_fs_http_reply_too_large,
+		NULL
+	};
+
+	(void)signal(SIGPIPE, SIG_IGN);
+
+	/* listen on localhost */
+	i_zero(&bind_ip);
+	bind_ip.family = AF_INET;
+	bind_ip.u.ip4.s_addr = htonl(INADDR_LOOPBACK);
+
+	return test_run(test_functions);
+}
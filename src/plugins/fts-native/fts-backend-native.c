@@ -0,0 +1,504 @@
+/* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "mail-namespace.h"
+#include "mail-storage-private.h"
+#include "mailbox-list-iter.h"
+#include "mail-search.h"
+#include "fts-native-index.h"
+#include "fts-native-plugin.h"
+
+#define FTS_NATIVE_FILE_PREFIX "dovecot.fts.native"
+
+struct native_fts_backend {
+	struct fts_backend backend;
+
+	struct mailbox *box;
+	struct fts_native_index *index;
+
+	bool refresh;
+};
+
+struct native_fts_backend_update_context {
+	struct fts_backend_update_context ctx;
+
+	enum fts_native_field field;
+	uint32_t uid;
+
+	bool failed;
+};
+
+static const struct {
+	const char *name;
+	enum fts_native_field field;
+} native_header_fields[] = {
+	{ "From", FTS_NATIVE_FIELD_FROM },
+	{ "To", FTS_NATIVE_FIELD_TO },
+	{ "Cc", FTS_NATIVE_FIELD_CC },
+	{ "Bcc", FTS_NATIVE_FIELD_BCC },
+	{ "Subject", FTS_NATIVE_FIELD_SUBJECT }
+};
+
+static enum fts_native_field fts_native_header_field(const char *hdr_name)
+{
+	unsigned int i;
+
+	for (i = 0; i < N_ELEMENTS(native_header_fields); i++) {
+		if (strcasecmp(native_header_fields[i].name, hdr_name) == 0)
+			return native_header_fields[i].field;
+	}
+	return FTS_NATIVE_FIELD_HEADER;
+}
+
+static struct fts_backend *fts_backend_native_alloc(void)
+{
+	struct native_fts_backend *backend;
+
+	backend = i_new(struct native_fts_backend, 1);
+	backend->backend = fts_backend_native;
+	return &backend->backend;
+}
+
+static int
+fts_backend_native_init(struct fts_backend *_backend, const char **error_r)
+{
+	struct fts_native_user *fuser =
+		FTS_NATIVE_USER_CONTEXT(_backend->ns->user);
+
+	if (fuser == NULL) {
+		/* invalid settings */
+		*error_r = "Invalid fts_native settings";
+		return -1;
+	}
+	return 0;
+}
+
+static void
+fts_backend_native_unset_box(struct native_fts_backend *backend)
+{
+	if (backend->index != NULL)
+		fts_native_index_deinit(&backend->index);
+	backend->box = NULL;
+}
+
+static void fts_backend_native_deinit(struct fts_backend *_backend)
+{
+	struct native_fts_backend *backend =
+		(struct native_fts_backend *)_backend;
+
+	fts_backend_native_unset_box(backend);
+	i_free(backend);
+}
+
+static struct fts_native_index *
+fts_backend_native_index_init(struct fts_backend *_backend,
+			      struct mailbox *box)
+{
+	struct fts_native_user *fuser =
+		FTS_NATIVE_USER_CONTEXT_REQUIRE(_backend->ns->user);
+	const struct mailbox_permissions *perm;
+	const struct mail_storage_settings *mail_set;
+	struct fts_native_index_settings set;
+	struct mailbox_status status;
+	const char *path;
+
+	perm = mailbox_get_permissions(box);
+	mail_set = mailbox_get_storage(box)->set;
+	if (mailbox_get_path_to(box, MAILBOX_LIST_PATH_TYPE_INDEX, &path) <= 0)
+		i_unreached(); /* fts already checked this */
+	mailbox_get_open_status(box, STATUS_UIDVALIDITY, &status);
+
+	i_zero(&set);
+	set.lock_method = mail_set->parsed_lock_method;
+	set.lock_timeout_secs = mail_set->mail_max_lock_timeout;
+	set.fsync_mode = mail_set->parsed_fsync_mode;
+	set.mode = perm->file_create_mode;
+	set.gid = perm->file_create_gid;
+	set.gid_origin = perm->file_create_gid_origin;
+	set.memtable_max_size = fuser->set.memtable_size;
+	set.max_segments = fuser->set.max_segments;
+
+	return fts_native_index_init(t_strconcat(path, "/"FTS_NATIVE_FILE_PREFIX,
+						 NULL), status.uidvalidity,
+				     &set);
+}
+
+static int
+fts_backend_native_set_box(struct native_fts_backend *backend,
+			   struct mailbox *box)
+{
+	const char *error;
+
+	if (backend->box == box) {
+		if (!backend->refresh)
+			return 0;
+	} else {
+		fts_backend_native_unset_box(backend);
+		if (box == NULL)
+			return 0;
+		backend->index = fts_backend_native_index_init(&backend->backend,
+							       box);
+		backend->box = box;
+	}
+	backend->refresh = FALSE;
+
+	if (fts_native_index_refresh(backend->index, &error) < 0) {
+		i_error("fts-native: %s", error);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+fts_backend_native_get_last_uid(struct fts_backend *_backend,
+				struct mailbox *box, uint32_t *last_uid_r)
+{
+	struct native_fts_backend *backend =
+		(struct native_fts_backend *)_backend;
+
+	if (fts_backend_native_set_box(backend, box) < 0)
+		return -1;
+	*last_uid_r = fts_native_index_get_last_uid(backend->index);
+	return 0;
+}
+
+static struct fts_backend_update_context *
+fts_backend_native_update_init(struct fts_backend *_backend)
+{
+	struct native_fts_backend_update_context *ctx;
+
+	ctx = i_new(struct native_fts_backend_update_context, 1);
+	ctx->ctx.backend = _backend;
+	return &ctx->ctx;
+}
+
+static int
+fts_backend_native_flush(struct native_fts_backend_update_context *ctx)
+{
+	struct native_fts_backend *backend =
+		(struct native_fts_backend *)ctx->ctx.backend;
+	const char *error;
+
+	if (backend->index == NULL)
+		return 0;
+	if (fts_native_index_flush(backend->index, &error) < 0) {
+		i_error("fts-native: %s", error);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+fts_backend_native_update_deinit(struct fts_backend_update_context *_ctx)
+{
+	struct native_fts_backend_update_context *ctx =
+		(struct native_fts_backend_update_context *)_ctx;
+	int ret = ctx->failed ? -1 : 0;
+
+	/* this is normally called by the indexer-worker, so any segment
+	   merging happens in the background as well */
+	if (fts_backend_native_flush(ctx) < 0)
+		ret = -1;
+	i_free(ctx);
+	return ret;
+}
+
+static void
+fts_backend_native_update_set_mailbox(struct fts_backend_update_context *_ctx,
+				      struct mailbox *box)
+{
+	struct native_fts_backend_update_context *ctx =
+		(struct native_fts_backend_update_context *)_ctx;
+	struct native_fts_backend *backend =
+		(struct native_fts_backend *)ctx->ctx.backend;
+
+	if (fts_backend_native_flush(ctx) < 0)
+		ctx->failed = TRUE;
+	if (fts_backend_native_set_box(backend, box) < 0)
+		ctx->failed = TRUE;
+	ctx->uid = 0;
+}
+
+static void
+fts_backend_native_update_expunge(struct fts_backend_update_context *_ctx,
+				  uint32_t uid)
+{
+	struct native_fts_backend *backend =
+		(struct native_fts_backend *)_ctx->backend;
+
+	if (backend->index != NULL)
+		fts_native_index_expunge(backend->index, uid);
+}
+
+static bool
+fts_backend_native_update_set_build_key(struct fts_backend_update_context *_ctx,
+					const struct fts_backend_build_key *key)
+{
+	struct native_fts_backend_update_context *ctx =
+		(struct native_fts_backend_update_context *)_ctx;
+	struct native_fts_backend *backend =
+		(struct native_fts_backend *)ctx->ctx.backend;
+
+	if (ctx->failed || backend->index == NULL)
+		return FALSE;
+
+	if (key->uid != ctx->uid &&
+	    fts_native_index_want_flush(backend->index)) {
+		/* the previous mails are fully added, so last_uid can be
+		   updated safely */
+		if (fts_backend_native_flush(ctx) < 0) {
+			ctx->failed = TRUE;
+			return FALSE;
+		}
+	}
+
+	switch (key->type) {
+	case FTS_BACKEND_BUILD_KEY_HDR:
+		/* SEARCH FROM etc. match only the message's own headers,
+		   not the headers of attached messages */
+		ctx->field = fts_native_header_field(key->hdr_name);
+		break;
+	case FTS_BACKEND_BUILD_KEY_MIME_HDR:
+		ctx->field = FTS_NATIVE_FIELD_HEADER;
+		break;
+	case FTS_BACKEND_BUILD_KEY_BODY_PART:
+		ctx->field = FTS_NATIVE_FIELD_BODY;
+		break;
+	case FTS_BACKEND_BUILD_KEY_BODY_PART_BINARY:
+		i_unreached();
+	}
+	ctx->uid = key->uid;
+	return TRUE;
+}
+
+static void
+fts_backend_native_update_unset_build_key(struct fts_backend_update_context *_ctx ATTR_UNUSED)
+{
+}
+
+static int
+fts_backend_native_update_build_more(struct fts_backend_update_context *_ctx,
+				     const unsigned char *data, size_t size)
+{
+	struct native_fts_backend_update_context *ctx =
+		(struct native_fts_backend_update_context *)_ctx;
+	struct native_fts_backend *backend =
+		(struct native_fts_backend *)ctx->ctx.backend;
+
+	/* with FTS_BACKEND_FLAG_TOKENIZED_INPUT this is called once for
+	   each token */
+	fts_native_index_add(backend->index, ctx->field, data, size, ctx->uid);
+	return 0;
+}
+
+static int fts_backend_native_refresh(struct fts_backend *_backend)
+{
+	struct native_fts_backend *backend =
+		(struct native_fts_backend *)_backend;
+
+	backend->refresh = TRUE;
+	return 0;
+}
+
+static int fts_backend_native_optimize_box(struct fts_backend *_backend,
+					   struct mailbox *box)
+{
+	struct fts_native_index *index;
+	const char *error;
+	int ret;
+
+	index = fts_backend_native_index_init(_backend, box);
+	ret = fts_native_index_optimize(index, &error);
+	if (ret < 0)
+		i_error("fts-native: %s", error);
+	fts_native_index_deinit(&index);
+	return ret;
+}
+
+static int fts_backend_native_optimize(struct fts_backend *_backend)
+{
+	struct native_fts_backend *backend =
+		(struct native_fts_backend *)_backend;
+	struct mailbox_list_iterate_context *iter;
+	const struct mailbox_info *info;
+	struct mailbox *box;
+	const char *path;
+	int ret = 0;
+
+	fts_backend_native_unset_box(backend);
+
+	iter = mailbox_list_iter_init(_backend->ns->list, "*",
+				      MAILBOX_LIST_ITER_SKIP_ALIASES |
+				      MAILBOX_LIST_ITER_NO_AUTO_BOXES);
+	while ((info = mailbox_list_iter_next(iter)) != NULL) {
+		if ((info->flags &
+		     (MAILBOX_NONEXISTENT | MAILBOX_NOSELECT)) != 0)
+			continue;
+
+		box = mailbox_alloc(info->ns->list, info->vname, 0);
+		if (mailbox_open(box) == 0 &&
+		    mailbox_get_path_to(box, MAILBOX_LIST_PATH_TYPE_INDEX,
+					&path) > 0) {
+			T_BEGIN {
+				if (fts_backend_native_optimize_box(_backend,
+								    box) < 0)
+					ret = -1;
+			} T_END;
+		}
+		mailbox_free(&box);
+	}
+	if (mailbox_list_iter_deinit(&iter) < 0)
+		ret = -1;
+	return ret;
+}
+
+static int native_lookup_arg(struct native_fts_backend *backend,
+			     const struct mail_search_arg *arg, bool and_args,
+			     ARRAY_TYPE(seq_range) *definite_uids,
+			     ARRAY_TYPE(seq_range) *maybe_uids)
+{
+	enum fts_native_field fields;
+	ARRAY_TYPE(seq_range) tmp_definite_uids, tmp_maybe_uids;
+	ARRAY_TYPE(seq_range) *uids;
+	const char *error;
+	uint32_t last_uid;
+
+	switch (arg->type) {
+	case SEARCH_TEXT:
+		fields = FTS_NATIVE_FIELDS_ALL;
+		break;
+	case SEARCH_BODY:
+		fields = FTS_NATIVE_FIELD_BODY;
+		break;
+	case SEARCH_HEADER:
+	case SEARCH_HEADER_ADDRESS:
+	case SEARCH_HEADER_COMPRESS_LWSP:
+		if (arg->value.str[0] == '\0') {
+			/* checking only for the header's existence */
+			return 0;
+		}
+		fields = fts_native_header_field(arg->hdr_field_name);
+		break;
+	default:
+		return 0;
+	}
+
+	i_array_init(&tmp_definite_uids, 128);
+	i_array_init(&tmp_maybe_uids, 128);
+
+	/* the rest of the headers are indexed in the same field, so it's not
+	   known which header the term came from */
+	uids = fields != FTS_NATIVE_FIELD_HEADER ?
+		&tmp_definite_uids : &tmp_maybe_uids;
+	if (fts_native_index_lookup(backend->index, fields, arg->value.str,
+				    uids, &error) < 0) {
+		i_error("fts-native: %s", error);
+		array_free(&tmp_definite_uids);
+		array_free(&tmp_maybe_uids);
+		return -1;
+	}
+
+	if (arg->match_not) {
+		/* definite -> non-match
+		   maybe -> maybe
+		   non-match -> maybe */
+		array_clear(&tmp_maybe_uids);
+
+		last_uid = fts_native_index_get_last_uid(backend->index);
+		if (last_uid > 0)
+			seq_range_array_add_range(&tmp_maybe_uids, 1, last_uid);
+		seq_range_array_remove_seq_range(&tmp_maybe_uids,
+						 &tmp_definite_uids);
+		array_clear(&tmp_definite_uids);
+	}
+
+	if (and_args) {
+		/* AND:
+		   definite && definite -> definite
+		   definite && maybe -> maybe
+		   maybe && maybe -> maybe */
+
+		/* put definites among maybies, so they can be intersected */
+		seq_range_array_merge(maybe_uids, definite_uids);
+		seq_range_array_merge(&tmp_maybe_uids, &tmp_definite_uids);
+
+		seq_range_array_intersect(maybe_uids, &tmp_maybe_uids);
+		seq_range_array_intersect(definite_uids, &tmp_definite_uids);
+		/* remove duplicate maybies that are also definites */
+		seq_range_array_remove_seq_range(maybe_uids, definite_uids);
+	} else {
+		/* OR:
+		   definite || definite -> definite
+		   definite || maybe -> definite
+		   maybe || maybe -> maybe */
+
+		/* remove maybies that are now definites */
+		seq_range_array_remove_seq_range(&tmp_maybe_uids,
+						 definite_uids);
+		seq_range_array_remove_seq_range(maybe_uids,
+						 &tmp_definite_uids);
+
+		seq_range_array_merge(definite_uids, &tmp_definite_uids);
+		seq_range_array_merge(maybe_uids, &tmp_maybe_uids);
+	}
+
+	array_free(&tmp_definite_uids);
+	array_free(&tmp_maybe_uids);
+	return 1;
+}
+
+static int
+fts_backend_native_lookup(struct fts_backend *_backend, struct mailbox *box,
+			  struct mail_search_arg *args,
+			  enum fts_lookup_flags flags,
+			  struct fts_result *result)
+{
+	struct native_fts_backend *backend =
+		(struct native_fts_backend *)_backend;
+	bool and_args = (flags & FTS_LOOKUP_FLAG_AND_ARGS) != 0;
+	bool first = TRUE;
+	int ret;
+
+	if (fts_backend_native_set_box(backend, box) < 0)
+		return -1;
+
+	for (; args != NULL; args = args->next) {
+		ret = native_lookup_arg(backend, args, first ? FALSE : and_args,
+					&result->definite_uids,
+					&result->maybe_uids);
+		if (ret < 0)
+			return -1;
+		if (ret > 0) {
+			args->match_always = TRUE;
+			first = FALSE;
+		}
+	}
+	return 0;
+}
+
+struct fts_backend fts_backend_native = {
+	.name = "native",
+	.flags = FTS_BACKEND_FLAG_TOKENIZED_INPUT,
+
+	{
+		fts_backend_native_alloc,
+		fts_backend_native_init,
+		fts_backend_native_deinit,
+		fts_backend_native_get_last_uid,
+		fts_backend_native_update_init,
+		fts_backend_native_update_deinit,
+		fts_backend_native_update_set_mailbox,
+		fts_backend_native_update_expunge,
+		fts_backend_native_update_set_build_key,
+		fts_backend_native_update_unset_build_key,
+		fts_backend_native_update_build_more,
+		fts_backend_native_refresh,
+		NULL,
+		fts_backend_native_optimize,
+		fts_backend_default_can_lookup,
+		fts_backend_native_lookup,
+		NULL,
+		NULL
+	}
+};
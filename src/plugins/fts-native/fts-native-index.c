@@ -0,0 +1,1081 @@
+/* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "hash.h"
+#include "str.h"
+#include "numpack.h"
+#include "read-full.h"
+#include "write-full.h"
+#include "ostream.h"
+#include "eacces-error.h"
+#include "file-create-locked.h"
+#include "fts-native-index.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/* Segment file:
+
+   struct fts_native_segment_header
+   term_count * entry
+   term_count * uint32_t offset of each entry, in sorted order
+
+   Each entry has a key, which is the field byte followed by the term, and
+   the UID ranges containing it:
+
+   numpack key_len, key[key_len], numpack range_count,
+   range_count * (numpack seq1 - previous seq2, numpack seq2 - seq1)
+
+   The entries are sorted by their key, so terms can be looked up with
+   a binary search of the offsets. The integers in the header and the
+   offsets are in native byte order, same as in the other index files. */
+#define FTS_NATIVE_SEGMENT_MAGIC 0x534e5446 /* "FTNS" */
+#define FTS_NATIVE_SEGMENT_VERSION 1
+/* Version 1 indexed all the headers in FTS_NATIVE_FIELD_HEADER. Such
+   indexes are rebuilt. */
+#define FTS_NATIVE_MANIFEST_VERSION 2
+
+struct fts_native_segment_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t term_count;
+	uint32_t dir_offset;
+};
+
+struct fts_native_segment {
+	uint32_t id;
+	uint32_t term_count;
+	/* NULL until the segment is needed */
+	buffer_t *data;
+};
+ARRAY_DEFINE_TYPE(fts_native_segment, struct fts_native_segment);
+
+struct fts_native_entry {
+	const unsigned char *key;
+	size_t key_len;
+	const unsigned char *postings, *end;
+};
+
+struct fts_native_memterm {
+	ARRAY_TYPE(seq_range) uids;
+};
+
+struct fts_native_segment_writer {
+	struct fts_native_index *index;
+	const char *temp_path;
+	int fd;
+	struct ostream *output;
+
+	ARRAY(uint32_t) offsets;
+	buffer_t *buf;
+};
+
+struct fts_native_index {
+	char *path_prefix, *manifest_path, *lock_path;
+	uint32_t uidvalidity;
+	struct fts_native_index_settings set;
+	char *gid_origin;
+
+	/* the manifest as it was last read or written */
+	struct stat manifest_st;
+	uint32_t last_uid, next_segment_id;
+	ARRAY_TYPE(fts_native_segment) segments;
+	ARRAY_TYPE(seq_range) expunged_uids;
+	/* segments to unlink after the next manifest write */
+	ARRAY(uint32_t) obsolete_segment_ids;
+
+	/* the terms added since the last flush */
+	pool_t mem_pool;
+	HASH_TABLE(char *, struct fts_native_memterm *) memtable;
+	string_t *mem_key;
+	uint32_t mem_last_uid;
+	ARRAY_TYPE(seq_range) mem_expunged_uids;
+
+	bool manifest_read:1;
+};
+
+struct fts_native_index *
+fts_native_index_init(const char *path_prefix, uint32_t uidvalidity,
+		      const struct fts_native_index_settings *set)
+{
+	struct fts_native_index *index;
+
+	index = i_new(struct fts_native_index, 1);
+	index->path_prefix = i_strdup(path_prefix);
+	index->manifest_path = i_strconcat(path_prefix, ".manifest", NULL);
+	index->lock_path = i_strconcat(path_prefix, ".lock", NULL);
+	index->uidvalidity = uidvalidity;
+	index->set = *set;
+	index->gid_origin = i_strdup(set->gid_origin);
+	index->set.gid_origin = index->gid_origin;
+	i_array_init(&index->segments, 16);
+	i_array_init(&index->expunged_uids, 32);
+	i_array_init(&index->obsolete_segment_ids, 16);
+	i_array_init(&index->mem_expunged_uids, 32);
+
+	index->mem_pool = pool_alloconly_create("fts native memtable", 1024*64);
+	hash_table_create(&index->memtable, default_pool, 0, str_hash, strcmp);
+	index->mem_key = str_new(default_pool, 128);
+	return index;
+}
+
+static void fts_native_segments_free(ARRAY_TYPE(fts_native_segment) *segments)
+{
+	struct fts_native_segment *seg;
+
+	array_foreach_modifiable(segments, seg) {
+		if (seg->data != NULL)
+			buffer_free(&seg->data);
+	}
+	array_clear(segments);
+}
+
+static void fts_native_memtable_reset(struct fts_native_index *index)
+{
+	hash_table_clear(index->memtable, FALSE);
+	p_clear(index->mem_pool);
+	array_clear(&index->mem_expunged_uids);
+}
+
+void fts_native_index_deinit(struct fts_native_index **_index)
+{
+	struct fts_native_index *index = *_index;
+
+	*_index = NULL;
+	fts_native_memtable_reset(index);
+	hash_table_destroy(&index->memtable);
+	pool_unref(&index->mem_pool);
+	str_free(&index->mem_key);
+
+	fts_native_segments_free(&index->segments);
+	array_free(&index->segments);
+	array_free(&index->expunged_uids);
+	array_free(&index->obsolete_segment_ids);
+	array_free(&index->mem_expunged_uids);
+	i_free(index->gid_origin);
+	i_free(index->path_prefix);
+	i_free(index->manifest_path);
+	i_free(index->lock_path);
+	i_free(index);
+}
+
+static const char *
+fts_native_segment_path(struct fts_native_index *index, uint32_t id)
+{
+	return t_strdup_printf("%s.%u", index->path_prefix, id);
+}
+
+static int
+fts_native_read_file(int fd, const char *path, const struct stat *st,
+		     buffer_t *buf, const char **error_r)
+{
+	void *data;
+	int ret;
+
+	data = buffer_append_space_unsafe(buf, st->st_size);
+	if ((ret = read_full(fd, data, st->st_size)) < 0) {
+		*error_r = t_strdup_printf("read(%s) failed: %m", path);
+		return -1;
+	}
+	if (ret == 0) {
+		*error_r = t_strdup_printf("read(%s) failed: "
+					   "File unexpectedly shrank", path);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+fts_native_parse_uids(const char *str, ARRAY_TYPE(seq_range) *uids)
+{
+	const char *const *ranges, *p;
+	uint32_t seq1, seq2;
+
+	for (ranges = t_strsplit(str, ","); *ranges != NULL; ranges++) {
+		p = strchr(*ranges, '-');
+		if (p == NULL) {
+			if (str_to_uint32(*ranges, &seq1) < 0)
+				return -1;
+			seq2 = seq1;
+		} else if (str_to_uint32(t_strdup_until(*ranges, p), &seq1) < 0 ||
+			   str_to_uint32(p + 1, &seq2) < 0) {
+			return -1;
+		}
+		if (seq1 == 0 || seq1 > seq2)
+			return -1;
+		seq_range_array_add_range(uids, seq1, seq2);
+	}
+	return 0;
+}
+
+static int
+fts_native_manifest_parse(struct fts_native_index *index, const char *data,
+			  ARRAY_TYPE(fts_native_segment) *segments,
+			  const char **error_r)
+{
+	const char *const *lines, *const *args;
+	struct fts_native_segment *seg;
+	unsigned int version;
+	uint32_t uidvalidity;
+
+	lines = t_strsplit(data, "\n");
+	args = t_strsplit(lines[0], " ");
+	if (str_array_length(args) != 4 ||
+	    str_to_uint(args[0], &version) < 0 ||
+	    str_to_uint32(args[1], &uidvalidity) < 0 ||
+	    str_to_uint32(args[2], &index->last_uid) < 0 ||
+	    str_to_uint32(args[3], &index->next_segment_id) < 0) {
+		*error_r = "Invalid header";
+		return -1;
+	}
+	if (version > FTS_NATIVE_MANIFEST_VERSION) {
+		*error_r = t_strdup_printf("Unsupported version %u", version);
+		return -1;
+	}
+
+	for (lines++; *lines != NULL; lines++) {
+		if (**lines == '\0')
+			continue;
+		args = t_strsplit(*lines, " ");
+		if (strcmp(args[0], "S") == 0) {
+			seg = array_append_space(segments);
+			if (str_array_length(args) != 3 ||
+			    str_to_uint32(args[1], &seg->id) < 0 ||
+			    str_to_uint32(args[2], &seg->term_count) < 0 ||
+			    seg->id >= index->next_segment_id) {
+				*error_r = t_strdup_printf(
+					"Invalid segment line: %s", *lines);
+				return -1;
+			}
+		} else if (strcmp(args[0], "X") == 0) {
+			if (str_array_length(args) != 2 ||
+			    fts_native_parse_uids(args[1],
+						  &index->expunged_uids) < 0) {
+				*error_r = t_strdup_printf(
+					"Invalid expunge line: %s", *lines);
+				return -1;
+			}
+		} else {
+			*error_r = t_strdup_printf("Invalid line: %s", *lines);
+			return -1;
+		}
+	}
+	if (uidvalidity != index->uidvalidity ||
+	    version != FTS_NATIVE_MANIFEST_VERSION) {
+		/* the mailbox was recreated or the index is in an old
+		   format - start from scratch */
+		array_foreach_modifiable(segments, seg)
+			array_push_back(&index->obsolete_segment_ids, &seg->id);
+		array_clear(segments);
+		array_clear(&index->expunged_uids);
+		index->last_uid = 0;
+	}
+	return 0;
+}
+
+static void fts_native_manifest_reset(struct fts_native_index *index)
+{
+	fts_native_segments_free(&index->segments);
+	array_clear(&index->expunged_uids);
+	index->last_uid = 0;
+	index->next_segment_id = 1;
+}
+
+static int
+fts_native_manifest_read(struct fts_native_index *index, const char **error_r)
+{
+	ARRAY_TYPE(fts_native_segment) segments;
+	struct fts_native_segment *seg, *old_seg;
+	struct stat st;
+	buffer_t *buf;
+	int fd, ret;
+
+	fd = open(index->manifest_path, O_RDONLY);
+	if (fd == -1) {
+		if (errno != ENOENT) {
+			*error_r = t_strdup_printf("open(%s) failed: %m",
+						   index->manifest_path);
+			return -1;
+		}
+		fts_native_manifest_reset(index);
+		i_zero(&index->manifest_st);
+		index->manifest_read = TRUE;
+		return 0;
+	}
+	if (fstat(fd, &st) < 0) {
+		*error_r = t_strdup_printf("fstat(%s) failed: %m",
+					   index->manifest_path);
+		i_close_fd(&fd);
+		return -1;
+	}
+	if (index->manifest_read &&
+	    st.st_ino == index->manifest_st.st_ino &&
+	    CMP_DEV_T(st.st_dev, index->manifest_st.st_dev) &&
+	    st.st_size == index->manifest_st.st_size &&
+	    st.st_mtime == index->manifest_st.st_mtime) {
+		/* unchanged */
+		i_close_fd(&fd);
+		return 0;
+	}
+
+	buf = t_buffer_create(st.st_size + 1);
+	ret = fts_native_read_file(fd, index->manifest_path, &st, buf, error_r);
+	i_close_fd(&fd);
+	if (ret < 0)
+		return -1;
+
+	t_array_init(&segments, 16);
+	array_clear(&index->expunged_uids);
+	if (fts_native_manifest_parse(index, str_c(buf), &segments,
+				      error_r) < 0) {
+		*error_r = t_strdup_printf("Corrupted fts index file %s: %s",
+					   index->manifest_path, *error_r);
+		fts_native_manifest_reset(index);
+		index->manifest_read = FALSE;
+		return -1;
+	}
+
+	/* the segments are immutable, so keep the ones already read */
+	array_foreach_modifiable(&segments, seg) {
+		array_foreach_modifiable(&index->segments, old_seg) {
+			if (old_seg->id == seg->id) {
+				seg->data = old_seg->data;
+				old_seg->data = NULL;
+				break;
+			}
+		}
+	}
+	fts_native_segments_free(&index->segments);
+	array_append_array(&index->segments, &segments);
+	index->manifest_st = st;
+	index->manifest_read = TRUE;
+	return 0;
+}
+
+int fts_native_index_refresh(struct fts_native_index *index,
+			     const char **error_r)
+{
+	return fts_native_manifest_read(index, error_r);
+}
+
+uint32_t fts_native_index_get_last_uid(struct fts_native_index *index)
+{
+	return I_MAX(index->last_uid, index->mem_last_uid);
+}
+
+static int
+fts_native_create_file(struct fts_native_index *index, const char *path,
+		       const char **error_r)
+{
+	int fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC,
+		  index->set.mode == 0 ? 0600 : index->set.mode);
+	if (fd == -1) {
+		if (errno == EACCES)
+			*error_r = eacces_error_get_creating("open", path);
+		else {
+			*error_r = t_strdup_printf(
+				"open(%s, O_CREAT) failed: %m", path);
+		}
+		return -1;
+	}
+	if (index->set.gid != (gid_t)-1 &&
+	    fchown(fd, (uid_t)-1, index->set.gid) < 0) {
+		if (errno == EPERM) {
+			*error_r = eperm_error_get_chgrp("fchown", path,
+				index->set.gid, index->set.gid_origin);
+		} else {
+			*error_r = t_strdup_printf("fchown(%s) failed: %m",
+						   path);
+		}
+		i_close_fd(&fd);
+		i_unlink(path);
+		return -1;
+	}
+	return fd;
+}
+
+static int
+fts_native_file_finish(struct fts_native_index *index, int *fd,
+		       const char *temp_path, const char *path,
+		       const char **error_r)
+{
+	int ret = 0;
+
+	if (index->set.fsync_mode != FSYNC_MODE_NEVER && fdatasync(*fd) < 0) {
+		*error_r = t_strdup_printf("fdatasync(%s) failed: %m",
+					   temp_path);
+		ret = -1;
+	}
+	if (close(*fd) < 0 && ret == 0) {
+		*error_r = t_strdup_printf("close(%s) failed: %m", temp_path);
+		ret = -1;
+	}
+	*fd = -1;
+	if (ret == 0 && rename(temp_path, path) < 0) {
+		*error_r = t_strdup_printf("rename(%s, %s) failed: %m",
+					   temp_path, path);
+		ret = -1;
+	}
+	if (ret < 0)
+		i_unlink_if_exists(temp_path);
+	return ret;
+}
+
+static void
+fts_native_append_uids(string_t *str, const ARRAY_TYPE(seq_range) *uids)
+{
+	const struct seq_range *range;
+	bool first = TRUE;
+
+	array_foreach(uids, range) {
+		if (!first)
+			str_append_c(str, ',');
+		first = FALSE;
+		str_printfa(str, "%u", range->seq1);
+		if (range->seq1 != range->seq2)
+			str_printfa(str, "-%u", range->seq2);
+	}
+}
+
+static int
+fts_native_manifest_write(struct fts_native_index *index,
+			  const char **error_r)
+{
+	const struct fts_native_segment *seg;
+	const uint32_t *idp;
+	const char *temp_path;
+	string_t *str;
+	int fd;
+
+	str = t_str_new(256);
+	str_printfa(str, "%u %u %u %u\n", FTS_NATIVE_MANIFEST_VERSION,
+		    index->uidvalidity, index->last_uid,
+		    index->next_segment_id);
+	array_foreach(&index->segments, seg)
+		str_printfa(str, "S %u %u\n", seg->id, seg->term_count);
+	if (array_count(&index->expunged_uids) > 0) {
+		str_append(str, "X ");
+		fts_native_append_uids(str, &index->expunged_uids);
+		str_append_c(str, '\n');
+	}
+
+	temp_path = t_strconcat(index->manifest_path, ".tmp", NULL);
+	if ((fd = fts_native_create_file(index, temp_path, error_r)) == -1)
+		return -1;
+	if (write_full(fd, str_data(str), str_len(str)) < 0) {
+		*error_r = t_strdup_printf("write(%s) failed: %m", temp_path);
+		i_close_fd(&fd);
+		i_unlink(temp_path);
+		return -1;
+	}
+	if (fstat(fd, &index->manifest_st) < 0) {
+		*error_r = t_strdup_printf("fstat(%s) failed: %m", temp_path);
+		i_close_fd(&fd);
+		i_unlink(temp_path);
+		return -1;
+	}
+	if (fts_native_file_finish(index, &fd, temp_path,
+				   index->manifest_path, error_r) < 0) {
+		index->manifest_read = FALSE;
+		return -1;
+	}
+
+	/* nothing refers to the replaced segments anymore. The lookups that
+	   still use them will re-read the manifest. */
+	array_foreach(&index->obsolete_segment_ids, idp)
+		i_unlink_if_exists(fts_native_segment_path(index, *idp));
+	array_clear(&index->obsolete_segment_ids);
+	return 0;
+}
+
+static int
+fts_native_lock(struct fts_native_index *index, struct file_lock **lock_r,
+		const char **error_r)
+{
+	struct file_create_settings set;
+	const char *error;
+	bool created;
+	int fd;
+
+	i_zero(&set);
+	set.lock_timeout_secs = index->set.lock_timeout_secs;
+	set.lock_method = index->set.lock_method;
+	set.mode = index->set.mode;
+	set.gid = index->set.gid;
+	set.gid_origin = index->set.gid_origin;
+
+	fd = file_create_locked(index->lock_path, &set, lock_r, &created,
+				&error);
+	if (fd == -1) {
+		*error_r = t_strdup_printf("file_create_locked(%s) failed: %s",
+					   index->lock_path, error);
+		return -1;
+	}
+	file_lock_set_close_on_free(*lock_r, TRUE);
+	file_lock_set_unlink_on_free(*lock_r, TRUE);
+	return 0;
+}
+
+void fts_native_index_add(struct fts_native_index *index,
+			  enum fts_native_field field,
+			  const unsigned char *term, size_t term_len,
+			  uint32_t uid)
+{
+	struct fts_native_memterm *memterm;
+	char *key;
+
+	i_assert(uid > 0);
+
+	if (term_len == 0 || memchr(term, '\0', term_len) != NULL)
+		return;
+
+	str_truncate(index->mem_key, 0);
+	str_append_c(index->mem_key, field);
+	str_append_data(index->mem_key, term, term_len);
+
+	memterm = hash_table_lookup(index->memtable, str_c(index->mem_key));
+	if (memterm == NULL) {
+		key = p_strdup(index->mem_pool, str_c(index->mem_key));
+		memterm = p_new(index->mem_pool, struct fts_native_memterm, 1);
+		p_array_init(&memterm->uids, index->mem_pool, 1);
+		hash_table_insert(index->memtable, key, memterm);
+	}
+	seq_range_array_add(&memterm->uids, uid);
+	if (index->mem_last_uid < uid)
+		index->mem_last_uid = uid;
+}
+
+void fts_native_index_expunge(struct fts_native_index *index, uint32_t uid)
+{
+	seq_range_array_add(&index->mem_expunged_uids, uid);
+}
+
+bool fts_native_index_want_flush(struct fts_native_index *index)
+{
+	return pool_alloconly_get_total_used_size(index->mem_pool) >=
+		index->set.memtable_max_size;
+}
+
+static int
+fts_native_segment_writer_init(struct fts_native_index *index,
+			       struct fts_native_segment_writer *writer_r,
+			       const char **error_r)
+{
+	struct fts_native_segment_header hdr;
+
+	i_zero(writer_r);
+	writer_r->index = index;
+	writer_r->temp_path = t_strconcat(index->path_prefix, ".tmp", NULL);
+	writer_r->fd = fts_native_create_file(index, writer_r->temp_path,
+					      error_r);
+	if (writer_r->fd == -1)
+		return -1;
+	writer_r->output = o_stream_create_fd_file(writer_r->fd, 0, FALSE);
+	o_stream_cork(writer_r->output);
+	t_array_init(&writer_r->offsets, 1024);
+	writer_r->buf = t_buffer_create(256);
+
+	/* the header is written once the directory offset is known */
+	i_zero(&hdr);
+	o_stream_nsend(writer_r->output, &hdr, sizeof(hdr));
+	return 0;
+}
+
+static void
+fts_native_segment_writer_add(struct fts_native_segment_writer *writer,
+			      const unsigned char *key, size_t key_len,
+			      const ARRAY_TYPE(seq_range) *uids)
+{
+	const struct seq_range *range;
+	uint32_t offset, prev_seq2 = 0;
+
+	buffer_set_used_size(writer->buf, 0);
+	numpack_encode(writer->buf, key_len);
+	buffer_append(writer->buf, key, key_len);
+	numpack_encode(writer->buf, array_count(uids));
+	array_foreach(uids, range) {
+		numpack_encode(writer->buf, range->seq1 - prev_seq2);
+		numpack_encode(writer->buf, range->seq2 - range->seq1);
+		prev_seq2 = range->seq2;
+	}
+
+	/* the offsets are 32bit - the output fails below if they overflow */
+	offset = (uint32_t)writer->output->offset;
+	array_push_back(&writer->offsets, &offset);
+	o_stream_nsend(writer->output, writer->buf->data, writer->buf->used);
+}
+
+static void
+fts_native_segment_writer_abort(struct fts_native_segment_writer *writer)
+{
+	o_stream_abort(writer->output);
+	o_stream_destroy(&writer->output);
+	i_close_fd(&writer->fd);
+	i_unlink(writer->temp_path);
+}
+
+static int
+fts_native_segment_writer_finish(struct fts_native_segment_writer *writer,
+				 struct fts_native_segment *seg_r,
+				 const char **error_r)
+{
+	struct fts_native_index *index = writer->index;
+	struct fts_native_segment_header hdr;
+	uoff_t dir_offset = writer->output->offset;
+
+	i_zero(&hdr);
+	hdr.magic = FTS_NATIVE_SEGMENT_MAGIC;
+	hdr.version = FTS_NATIVE_SEGMENT_VERSION;
+	hdr.term_count = array_count(&writer->offsets);
+	hdr.dir_offset = (uint32_t)dir_offset;
+
+	o_stream_nsend(writer->output, array_front(&writer->offsets),
+		       array_count(&writer->offsets) * sizeof(uint32_t));
+	if (writer->output->offset > (uint32_t)-1) {
+		*error_r = t_strdup_printf("%s: Segment grew too large",
+					   writer->temp_path);
+		fts_native_segment_writer_abort(writer);
+		return -1;
+	}
+	if (o_stream_finish(writer->output) < 0) {
+		*error_r = t_strdup_printf("write(%s) failed: %s",
+			writer->temp_path,
+			o_stream_get_error(writer->output));
+		fts_native_segment_writer_abort(writer);
+		return -1;
+	}
+	o_stream_destroy(&writer->output);
+	if (pwrite_full(writer->fd, &hdr, sizeof(hdr), 0) < 0) {
+		*error_r = t_strdup_printf("pwrite(%s) failed: %m",
+					   writer->temp_path);
+		i_close_fd(&writer->fd);
+		i_unlink(writer->temp_path);
+		return -1;
+	}
+
+	i_zero(seg_r);
+	seg_r->id = index->next_segment_id;
+	seg_r->term_count = hdr.term_count;
+	if (fts_native_file_finish(index, &writer->fd, writer->temp_path,
+				   fts_native_segment_path(index, seg_r->id),
+				   error_r) < 0)
+		return -1;
+	index->next_segment_id++;
+	return 0;
+}
+
+static int fts_native_segment_open(struct fts_native_index *index,
+				   struct fts_native_segment *seg,
+				   const char **error_r)
+{
+	struct fts_native_segment_header hdr;
+	const char *path;
+	struct stat st;
+	int fd, ret;
+
+	if (seg->data != NULL)
+		return 1;
+
+	path = fts_native_segment_path(index, seg->id);
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		if (errno == ENOENT)
+			return 0;
+		*error_r = t_strdup_printf("open(%s) failed: %m", path);
+		return -1;
+	}
+	if (fstat(fd, &st) < 0) {
+		*error_r = t_strdup_printf("fstat(%s) failed: %m", path);
+		i_close_fd(&fd);
+		return -1;
+	}
+	seg->data = buffer_create_dynamic(default_pool, st.st_size);
+	ret = fts_native_read_file(fd, path, &st, seg->data, error_r);
+	i_close_fd(&fd);
+	if (ret < 0) {
+		buffer_free(&seg->data);
+		return -1;
+	}
+
+	if (seg->data->used < sizeof(hdr))
+		*error_r = "File too small";
+	else {
+		memcpy(&hdr, seg->data->data, sizeof(hdr));
+		if (hdr.magic != FTS_NATIVE_SEGMENT_MAGIC)
+			*error_r = "Invalid magic";
+		else if (hdr.version != FTS_NATIVE_SEGMENT_VERSION) {
+			*error_r = t_strdup_printf("Unsupported version %u",
+						   hdr.version);
+		} else if (hdr.term_count != seg->term_count) {
+			*error_r = t_strdup_printf(
+				"Term count %u doesn't match manifest's %u",
+				hdr.term_count, seg->term_count);
+		} else if (hdr.dir_offset < sizeof(hdr) ||
+			   hdr.dir_offset > seg->data->used ||
+			   (seg->data->used - hdr.dir_offset) /
+				sizeof(uint32_t) != hdr.term_count ||
+			   (seg->data->used - hdr.dir_offset) %
+				sizeof(uint32_t) != 0)
+			*error_r = "Invalid directory offset";
+		else
+			return 1;
+	}
+	*error_r = t_strdup_printf("Corrupted fts index file %s: %s",
+				   path, *error_r);
+	buffer_free(&seg->data);
+	return -1;
+}
+
+static int
+fts_native_segment_get_entry(const struct fts_native_segment *seg,
+			     unsigned int idx, struct fts_native_entry *entry_r)
+{
+	const unsigned char *data = seg->data->data, *p, *end;
+	struct fts_native_segment_header hdr;
+	uint32_t offset, key_len;
+
+	memcpy(&hdr, data, sizeof(hdr));
+	i_assert(idx < hdr.term_count);
+	memcpy(&offset, data + hdr.dir_offset + idx * sizeof(offset),
+	       sizeof(offset));
+	if (offset < sizeof(hdr) || offset >= hdr.dir_offset)
+		return -1;
+
+	p = data + offset;
+	end = data + hdr.dir_offset;
+	if (numpack_decode32(&p, end, &key_len) < 0 ||
+	    key_len == 0 || key_len > (size_t)(end - p))
+		return -1;
+	entry_r->key = p;
+	entry_r->key_len = key_len;
+	entry_r->postings = p + key_len;
+	entry_r->end = end;
+	return 0;
+}
+
+static int
+fts_native_entry_get_uids(const struct fts_native_entry *entry,
+			  ARRAY_TYPE(seq_range) *uids)
+{
+	const unsigned char *p = entry->postings;
+	uint64_t seq1, seq2 = 0, delta, len;
+	uint32_t i, count;
+
+	if (numpack_decode32(&p, entry->end, &count) < 0)
+		return -1;
+	for (i = 0; i < count; i++) {
+		if (numpack_decode(&p, entry->end, &delta) < 0 ||
+		    numpack_decode(&p, entry->end, &len) < 0 || delta == 0)
+			return -1;
+		seq1 = seq2 + delta;
+		seq2 = seq1 + len;
+		if (seq2 > (uint32_t)-1)
+			return -1;
+		seq_range_array_add_range(uids, seq1, seq2);
+	}
+	return 0;
+}
+
+static int
+fts_native_key_cmp(const unsigned char *key1, size_t key1_len,
+		   const unsigned char *key2, size_t key2_len)
+{
+	int ret;
+
+	ret = memcmp(key1, key2, I_MIN(key1_len, key2_len));
+	if (ret != 0)
+		return ret;
+	return key1_len < key2_len ? -1 :
+		(key1_len > key2_len ? 1 : 0);
+}
+
+static int
+fts_native_segment_lookup(const struct fts_native_segment *seg,
+			  const unsigned char *prefix, size_t prefix_len,
+			  ARRAY_TYPE(seq_range) *uids_r)
+{
+	struct fts_native_entry entry;
+	unsigned int idx, left_idx = 0, right_idx = seg->term_count;
+
+	/* find the first key that isn't smaller than the prefix */
+	while (left_idx < right_idx) {
+		idx = (left_idx + right_idx) / 2;
+		if (fts_native_segment_get_entry(seg, idx, &entry) < 0)
+			return -1;
+		if (fts_native_key_cmp(entry.key, entry.key_len,
+				       prefix, prefix_len) < 0)
+			left_idx = idx + 1;
+		else
+			right_idx = idx;
+	}
+	for (idx = left_idx; idx < seg->term_count; idx++) {
+		if (fts_native_segment_get_entry(seg, idx, &entry) < 0)
+			return -1;
+		if (entry.key_len < prefix_len ||
+		    memcmp(entry.key, prefix, prefix_len) != 0)
+			break;
+		if (fts_native_entry_get_uids(&entry, uids_r) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+static int
+fts_native_index_lookup_segments(struct fts_native_index *index,
+				 enum fts_native_field fields,
+				 const char *prefix,
+				 ARRAY_TYPE(seq_range) *uids_r,
+				 const char **error_r)
+{
+	struct fts_native_segment *seg;
+	string_t *key = t_str_new(128);
+	enum fts_native_field field;
+	int ret;
+
+	array_foreach_modifiable(&index->segments, seg) {
+		if ((ret = fts_native_segment_open(index, seg, error_r)) <= 0)
+			return ret;
+		for (field = FTS_NATIVE_FIELD_HEADER;
+		     field <= FTS_NATIVE_FIELD_LAST; field <<= 1) {
+			if ((fields & field) == 0)
+				continue;
+			str_truncate(key, 0);
+			str_append_c(key, field);
+			str_append(key, prefix);
+			if (fts_native_segment_lookup(seg, str_data(key),
+						      str_len(key),
+						      uids_r) < 0) {
+				*error_r = t_strdup_printf(
+					"Corrupted fts index file %s: "
+					"Broken entries",
+					fts_native_segment_path(index, seg->id));
+				return -1;
+			}
+		}
+	}
+	return 1;
+}
+
+int fts_native_index_lookup(struct fts_native_index *index,
+			    enum fts_native_field fields, const char *prefix,
+			    ARRAY_TYPE(seq_range) *uids_r,
+			    const char **error_r)
+{
+	int ret;
+
+	if (!index->manifest_read) {
+		if (fts_native_manifest_read(index, error_r) < 0)
+			return -1;
+	}
+	ret = fts_native_index_lookup_segments(index, fields, prefix,
+					       uids_r, error_r);
+	if (ret == 0) {
+		/* a segment was merged away after the manifest was read.
+		   The new manifest must have it. */
+		array_clear(uids_r);
+		if (fts_native_manifest_read(index, error_r) < 0)
+			return -1;
+		ret = fts_native_index_lookup_segments(index, fields, prefix,
+						       uids_r, error_r);
+		if (ret == 0) {
+			*error_r = t_strdup_printf(
+				"%s: Listed segment doesn't exist",
+				index->manifest_path);
+			ret = -1;
+		}
+	}
+	if (ret < 0)
+		return -1;
+	seq_range_array_remove_seq_range(uids_r, &index->expunged_uids);
+	return 0;
+}
+
+static int fts_native_memtable_write(struct fts_native_index *index,
+				     const char **error_r)
+{
+	struct fts_native_segment_writer writer;
+	struct fts_native_segment seg;
+	struct hash_iterate_context *iter;
+	ARRAY_TYPE(const_string) keys;
+	struct fts_native_memterm *memterm;
+	const char *const *keyp;
+	char *key;
+
+	t_array_init(&keys, hash_table_count(index->memtable));
+	iter = hash_table_iterate_init(index->memtable);
+	while (hash_table_iterate(iter, index->memtable, &key, &memterm))
+		array_push_back(&keys, (const char **)&key);
+	hash_table_iterate_deinit(&iter);
+	array_sort(&keys, i_strcmp_p);
+
+	if (fts_native_segment_writer_init(index, &writer, error_r) < 0)
+		return -1;
+	array_foreach(&keys, keyp) {
+		memterm = hash_table_lookup(index->memtable, *keyp);
+		fts_native_segment_writer_add(&writer,
+			(const unsigned char *)*keyp, strlen(*keyp),
+			&memterm->uids);
+	}
+	if (fts_native_segment_writer_finish(&writer, &seg, error_r) < 0)
+		return -1;
+	array_push_back(&index->segments, &seg);
+	return 0;
+}
+
+static int
+fts_native_merge(struct fts_native_index *index, bool drop_expunged,
+		 const char **error_r)
+{
+	struct fts_native_segment_writer writer;
+	struct fts_native_segment *segs, new_seg;
+	struct fts_native_entry *entries, *min_entry, key;
+	ARRAY_TYPE(seq_range) uids;
+	unsigned int i, count, *cursors;
+	int ret;
+
+	segs = array_get_modifiable(&index->segments, &count);
+	for (i = 0; i < count; i++) {
+		ret = fts_native_segment_open(index, &segs[i], error_r);
+		if (ret == 0) {
+			*error_r = t_strdup_printf("open(%s) failed: %m",
+				fts_native_segment_path(index, segs[i].id));
+		}
+		if (ret <= 0)
+			return -1;
+	}
+
+	cursors = t_new(unsigned int, count);
+	entries = t_new(struct fts_native_entry, count);
+	for (i = 0; i < count; i++) {
+		if (segs[i].term_count > 0 &&
+		    fts_native_segment_get_entry(&segs[i], 0, &entries[i]) < 0)
+			goto corrupted;
+	}
+
+	if (fts_native_segment_writer_init(index, &writer, error_r) < 0)
+		return -1;
+	t_array_init(&uids, 128);
+	for (;;) {
+		/* find the smallest key among the segments */
+		min_entry = NULL;
+		for (i = 0; i < count; i++) {
+			if (cursors[i] == segs[i].term_count)
+				continue;
+			if (min_entry == NULL ||
+			    fts_native_key_cmp(entries[i].key,
+					       entries[i].key_len,
+					       min_entry->key,
+					       min_entry->key_len) < 0)
+				min_entry = &entries[i];
+		}
+		if (min_entry == NULL)
+			break;
+		key = *min_entry;
+
+		/* combine its UIDs from all the segments. The older segments
+		   are first, so the UIDs are mostly appended. */
+		array_clear(&uids);
+		for (i = 0; i < count; i++) {
+			if (cursors[i] == segs[i].term_count ||
+			    fts_native_key_cmp(entries[i].key,
+					       entries[i].key_len,
+					       key.key, key.key_len) != 0)
+				continue;
+			if (fts_native_entry_get_uids(&entries[i], &uids) < 0)
+				goto corrupted_writer;
+			if (++cursors[i] < segs[i].term_count &&
+			    fts_native_segment_get_entry(&segs[i], cursors[i],
+							 &entries[i]) < 0)
+				goto corrupted_writer;
+		}
+		if (drop_expunged)
+			seq_range_array_remove_seq_range(&uids,
+							 &index->expunged_uids);
+		if (array_count(&uids) > 0) {
+			fts_native_segment_writer_add(&writer, key.key,
+						      key.key_len, &uids);
+		}
+	}
+	if (fts_native_segment_writer_finish(&writer, &new_seg, error_r) < 0)
+		return -1;
+
+	for (i = 0; i < count; i++)
+		array_push_back(&index->obsolete_segment_ids, &segs[i].id);
+	fts_native_segments_free(&index->segments);
+	array_push_back(&index->segments, &new_seg);
+	if (drop_expunged)
+		array_clear(&index->expunged_uids);
+	return 0;
+
+corrupted_writer:
+	fts_native_segment_writer_abort(&writer);
+corrupted:
+	*error_r = t_strdup_printf("Corrupted fts index: %s: Broken entries",
+				   index->path_prefix);
+	return -1;
+}
+
+static int
+fts_native_index_write(struct fts_native_index *index, bool optimize,
+		       const char **error_r)
+{
+	struct file_lock *lock;
+	int ret = 0;
+
+	if (fts_native_lock(index, &lock, error_r) < 0)
+		return -1;
+	/* the manifest may have been changed by another process */
+	if (fts_native_manifest_read(index, error_r) < 0) {
+		file_lock_free(&lock);
+		return -1;
+	}
+
+	if (hash_table_count(index->memtable) > 0)
+		ret = fts_native_memtable_write(index, error_r);
+	if (ret == 0) {
+		if (index->last_uid < index->mem_last_uid)
+			index->last_uid = index->mem_last_uid;
+		seq_range_array_merge(&index->expunged_uids,
+				      &index->mem_expunged_uids);
+		if (array_count(&index->segments) > 1 &&
+		    (optimize ||
+		     array_count(&index->segments) > index->set.max_segments))
+			ret = fts_native_merge(index, TRUE, error_r);
+		else if (optimize && array_count(&index->segments) == 1 &&
+			 array_count(&index->expunged_uids) > 0)
+			ret = fts_native_merge(index, TRUE, error_r);
+	}
+	if (ret == 0)
+		ret = fts_native_manifest_write(index, error_r);
+	if (ret < 0) {
+		/* make sure the next use sees the manifest that's actually
+		   on the disk */
+		index->manifest_read = FALSE;
+	}
+	file_lock_free(&lock);
+	fts_native_memtable_reset(index);
+	index->mem_last_uid = 0;
+	return ret;
+}
+
+int fts_native_index_flush(struct fts_native_index *index,
+			   const char **error_r)
+{
+	if (hash_table_count(index->memtable) == 0 &&
+	    array_count(&index->mem_expunged_uids) == 0 &&
+	    index->mem_last_uid <= index->last_uid)
+		return 0;
+	return fts_native_index_write(index, FALSE, error_r);
+}
+
+int fts_native_index_optimize(struct fts_native_index *index,
+			      const char **error_r)
+{
+	return fts_native_index_write(index, TRUE, error_r);
+}
@@ -0,0 +1,84 @@
+#ifndef FTS_NATIVE_INDEX_H
+#define FTS_NATIVE_INDEX_H
+
+#include "seq-range-array.h"
+#include "file-lock.h"
+#include "fsync-mode.h"
+
+/* Terms are indexed separately for each field. The field is the first
+   byte of the term's key in the index. */
+enum fts_native_field {
+	/* all the headers that don't have their own field */
+	FTS_NATIVE_FIELD_HEADER		= 0x01,
+	FTS_NATIVE_FIELD_BODY		= 0x02,
+	/* the commonly searched message headers */
+	FTS_NATIVE_FIELD_FROM		= 0x04,
+	FTS_NATIVE_FIELD_TO		= 0x08,
+	FTS_NATIVE_FIELD_CC		= 0x10,
+	FTS_NATIVE_FIELD_BCC		= 0x20,
+	FTS_NATIVE_FIELD_SUBJECT	= 0x40
+};
+#define FTS_NATIVE_FIELD_LAST FTS_NATIVE_FIELD_SUBJECT
+#define FTS_NATIVE_FIELDS_ALL ((FTS_NATIVE_FIELD_LAST << 1) - 1)
+
+struct fts_native_index_settings {
+	enum file_lock_method lock_method;
+	unsigned int lock_timeout_secs;
+	enum fsync_mode fsync_mode;
+
+	mode_t mode;
+	gid_t gid;
+	const char *gid_origin;
+
+	/* Write the added terms to a new segment when their memory usage
+	   grows larger than this. */
+	size_t memtable_max_size;
+	/* Merge the segments into one after a write leaves more than this
+	   many of them. */
+	unsigned int max_segments;
+};
+
+/* The index consists of path_prefix.manifest, which lists the segments,
+   the last indexed UID and the expunged UIDs, and the immutable segment
+   files path_prefix.<id>. All the changes are done while holding
+   path_prefix.lock. Lookups don't lock anything. */
+struct fts_native_index *
+fts_native_index_init(const char *path_prefix, uint32_t uidvalidity,
+		      const struct fts_native_index_settings *set);
+void fts_native_index_deinit(struct fts_native_index **index);
+
+/* Re-read the manifest if it has changed. */
+int fts_native_index_refresh(struct fts_native_index *index,
+			     const char **error_r);
+/* Returns the last UID that was added to the index, including the terms
+   that haven't been flushed yet. */
+uint32_t fts_native_index_get_last_uid(struct fts_native_index *index);
+
+/* Add a term to the in-memory table. The UIDs must be added in ascending
+   order, although the same UID may be added many times. */
+void fts_native_index_add(struct fts_native_index *index,
+			  enum fts_native_field field,
+			  const unsigned char *term, size_t term_len,
+			  uint32_t uid);
+/* Mark UID expunged. It's dropped from lookup results immediately and from
+   the segments when they're merged. */
+void fts_native_index_expunge(struct fts_native_index *index, uint32_t uid);
+/* Returns TRUE if the in-memory table should be flushed. */
+bool fts_native_index_want_flush(struct fts_native_index *index);
+/* Write the added terms to a new segment and the expunges to the manifest.
+   If there are too many segments afterwards, merge them. */
+int fts_native_index_flush(struct fts_native_index *index,
+			   const char **error_r);
+/* Flush and merge all the segments into one, dropping the expunged UIDs. */
+int fts_native_index_optimize(struct fts_native_index *index,
+			      const char **error_r);
+
+/* Add to uids_r all the UIDs that have a term beginning with prefix in any
+   of the given fields. Only the flushed terms are looked up, and the
+   expunged UIDs aren't returned. */
+int fts_native_index_lookup(struct fts_native_index *index,
+			    enum fts_native_field fields, const char *prefix,
+			    ARRAY_TYPE(seq_range) *uids_r,
+			    const char **error_r);
+
+#endif
@@ -0,0 +1,216 @@
+/* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "str.h"
+#include "istream.h"
+#include "unlink-directory.h"
+#include "test-common.h"
+#include "fts-native-index.h"
+
+#include <sys/stat.h>
+
+#define TESTDIR_NAME ".dovecot.test"
+#define TEST_INDEX_PREFIX TESTDIR_NAME"/dovecot.fts.native"
+#define TEST_UIDVALIDITY 1234
+
+static struct fts_native_index_settings test_set = {
+	.lock_method = FILE_LOCK_METHOD_FCNTL,
+	.lock_timeout_secs = 10,
+	.fsync_mode = FSYNC_MODE_NEVER,
+	.mode = 0600,
+	.gid = (gid_t)-1,
+	.memtable_max_size = 1024*1024,
+	.max_segments = 4,
+};
+
+static void test_dir_init(void)
+{
+	const char *error;
+
+	(void)unlink_directory(TESTDIR_NAME, UNLINK_DIRECTORY_FLAG_RMDIR, &error);
+	if (mkdir(TESTDIR_NAME, 0700) < 0)
+		i_error("mkdir(%s) failed: %m", TESTDIR_NAME);
+}
+
+static void test_dir_deinit(void)
+{
+	const char *error;
+
+	(void)unlink_directory(TESTDIR_NAME, UNLINK_DIRECTORY_FLAG_RMDIR, &error);
+}
+
+static void
+test_add(struct fts_native_index *index, enum fts_native_field field,
+	 const char *term, uint32_t uid)
+{
+	fts_native_index_add(index, field, (const unsigned char *)term,
+			     strlen(term), uid);
+}
+
+static const char *
+test_lookup(struct fts_native_index *index, enum fts_native_field fields,
+	    const char *prefix)
+{
+	ARRAY_TYPE(seq_range) uids;
+	const struct seq_range *range;
+	const char *error;
+	string_t *str = t_str_new(64);
+
+	t_array_init(&uids, 8);
+	test_assert(fts_native_index_lookup(index, fields, prefix,
+					    &uids, &error) == 0);
+	array_foreach(&uids, range) {
+		if (str_len(str) > 0)
+			str_append_c(str, ',');
+		str_printfa(str, "%u", range->seq1);
+		if (range->seq1 != range->seq2)
+			str_printfa(str, "-%u", range->seq2);
+	}
+	return str_c(str);
+}
+
+static unsigned int test_segment_count(void)
+{
+	struct istream *input;
+	const char *line;
+	unsigned int count = 0;
+
+	input = i_stream_create_file(TEST_INDEX_PREFIX".manifest", 1024);
+	while ((line = i_stream_read_next_line(input)) != NULL) {
+		if (line[0] == 'S')
+			count++;
+	}
+	i_stream_unref(&input);
+	return count;
+}
+
+static void test_fts_native_index_lookup(void)
+{
+	struct fts_native_index *index, *index2;
+	const char *error;
+	uint32_t uid;
+
+	test_begin("fts native index lookup");
+	test_dir_init();
+
+	index = fts_native_index_init(TEST_INDEX_PREFIX, TEST_UIDVALIDITY,
+				      &test_set);
+	test_assert(fts_native_index_refresh(index, &error) == 0);
+	test_assert(fts_native_index_get_last_uid(index) == 0);
+
+	for (uid = 1; uid <= 100; uid++) {
+		test_add(index, FTS_NATIVE_FIELD_BODY, "all", uid);
+		test_add(index, FTS_NATIVE_FIELD_BODY,
+			 uid % 2 == 0 ? "even" : "odd", uid);
+		test_add(index, FTS_NATIVE_FIELD_HEADER,
+			 t_strdup_printf("subject%u", uid), uid);
+		if (uid == 7 || uid == 42)
+			test_add(index, FTS_NATIVE_FIELD_FROM, "sender", uid);
+	}
+	test_add(index, FTS_NATIVE_FIELD_BODY, "evening", 51);
+	test_assert(fts_native_index_get_last_uid(index) == 100);
+	test_assert(fts_native_index_flush(index, &error) == 0);
+	test_assert(test_segment_count() == 1);
+
+	test_assert_strcmp(test_lookup(index, FTS_NATIVE_FIELD_BODY, "all"),
+			   "1-100");
+	test_assert_strcmp(test_lookup(index, FTS_NATIVE_FIELD_BODY, "al"),
+			   "1-100");
+	test_assert_strcmp(test_lookup(index, FTS_NATIVE_FIELD_BODY, "evening"),
+			   "51");
+	test_assert_strcmp(test_lookup(index, FTS_NATIVE_FIELD_HEADER, "all"),
+			   "");
+	test_assert_strcmp(test_lookup(index, FTS_NATIVE_FIELD_HEADER,
+				       "subject10"), "10,100");
+	test_assert_strcmp(test_lookup(index, FTS_NATIVE_FIELD_HEADER |
+				       FTS_NATIVE_FIELD_BODY, "subject5"),
+			   "5,50-59");
+	test_assert_strcmp(test_lookup(index, FTS_NATIVE_FIELD_BODY, "zzz"),
+			   "");
+	test_assert_strcmp(test_lookup(index, FTS_NATIVE_FIELD_FROM, "sender"),
+			   "7,42");
+	test_assert_strcmp(test_lookup(index, FTS_NATIVE_FIELD_HEADER,
+				       "sender"), "");
+	test_assert_strcmp(test_lookup(index, FTS_NATIVE_FIELDS_ALL, "send"),
+			   "7,42");
+
+	/* another process sees the flushed segment */
+	index2 = fts_native_index_init(TEST_INDEX_PREFIX, TEST_UIDVALIDITY,
+				       &test_set);
+	test_assert(fts_native_index_refresh(index2, &error) == 0);
+	test_assert(fts_native_index_get_last_uid(index2) == 100);
+	test_assert_strcmp(test_lookup(index2, FTS_NATIVE_FIELD_BODY, "even"),
+			   test_lookup(index, FTS_NATIVE_FIELD_BODY, "even"));
+	fts_native_index_deinit(&index2);
+
+	/* a different UIDVALIDITY means the index is empty */
+	index2 = fts_native_index_init(TEST_INDEX_PREFIX, TEST_UIDVALIDITY + 1,
+				       &test_set);
+	test_assert(fts_native_index_refresh(index2, &error) == 0);
+	test_assert(fts_native_index_get_last_uid(index2) == 0);
+	test_assert_strcmp(test_lookup(index2, FTS_NATIVE_FIELD_BODY, "all"),
+			   "");
+	fts_native_index_deinit(&index2);
+
+	fts_native_index_deinit(&index);
+	test_dir_deinit();
+	test_end();
+}
+
+static void test_fts_native_index_merge(void)
+{
+	struct fts_native_index *index;
+	const char *error;
+	uint32_t uid;
+
+	test_begin("fts native index merge");
+	test_dir_init();
+
+	index = fts_native_index_init(TEST_INDEX_PREFIX, TEST_UIDVALIDITY,
+				      &test_set);
+	for (uid = 1; uid <= test_set.max_segments; uid++) {
+		test_add(index, FTS_NATIVE_FIELD_BODY, "common", uid);
+		test_add(index, FTS_NATIVE_FIELD_BODY,
+			 t_strdup_printf("unique%u", uid), uid);
+		test_assert(fts_native_index_flush(index, &error) == 0);
+		test_assert(test_segment_count() == uid);
+	}
+	fts_native_index_expunge(index, 2);
+	test_assert(fts_native_index_flush(index, &error) == 0);
+	test_assert_strcmp(test_lookup(index, FTS_NATIVE_FIELD_BODY, "common"),
+			   "1,3-4");
+
+	/* one more segment triggers the merge */
+	test_add(index, FTS_NATIVE_FIELD_BODY, "common", 5);
+	test_assert(fts_native_index_flush(index, &error) == 0);
+	test_assert(test_segment_count() == 1);
+	test_assert_strcmp(test_lookup(index, FTS_NATIVE_FIELD_BODY, "common"),
+			   "1,3-5");
+	test_assert_strcmp(test_lookup(index, FTS_NATIVE_FIELD_BODY, "unique"),
+			   "1,3-4");
+	test_assert_strcmp(test_lookup(index, FTS_NATIVE_FIELD_BODY, "unique2"),
+			   "");
+
+	/* optimize drops the expunged UIDs */
+	fts_native_index_expunge(index, 4);
+	test_assert(fts_native_index_optimize(index, &error) == 0);
+	test_assert(test_segment_count() == 1);
+	test_assert_strcmp(test_lookup(index, FTS_NATIVE_FIELD_BODY, "unique"),
+			   "1,3");
+	test_assert(fts_native_index_get_last_uid(index) == 5);
+
+	fts_native_index_deinit(&index);
+	test_dir_deinit();
+	test_end();
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_fts_native_index_lookup,
+		test_fts_native_index_merge,
+		NULL
+	};
+	return test_run(test_functions);
+}
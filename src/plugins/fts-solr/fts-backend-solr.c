@@ -28,8 +28,6 @@
 #define SOLR_HEADER_LINE_MAX_TRUNC_SIZE 1024
 
 #define SOLR_QUERY_MAX_MAILBOX_COUNT 10
-/* How often to flush indexing request to Solr before beginning a new one. */
-#define SOLR_MAIL_FLUSH_INTERVAL 1000
 
 struct solr_fts_backend {
 	struct fts_backend backend;
@@ -47,6 +45,8 @@ struct solr_fts_backend_update_context {
 	struct mailbox *cur_box;
 	char box_guid[MAILBOX_GUID_HEX_LENGTH+1];
 
+	const struct fts_solr_settings *set;
+	/* non-NULL if the current batch grew too large to be buffered */
 	struct solr_connection_post *post;
 	uint32_t prev_uid;
 	string_t *cmd, *cur_value, *cur_value2;
@@ -57,6 +57,7 @@ struct solr_fts_backend_update_context {
 	unsigned int mails_since_flush;
 
 	bool tokenized_input:1;
+	bool batch_open:1;
 	bool last_indexed_uid_set:1;
 	bool body_open:1;
 	bool documents_added:1;
@@ -278,10 +279,13 @@ fts_backend_solr_get_last_uid(struct fts_backend *_backend,
 static struct fts_backend_update_context *
 fts_backend_solr_update_init(struct fts_backend *_backend)
 {
+	struct fts_solr_user *fuser =
+		FTS_SOLR_USER_CONTEXT_REQUIRE(_backend->ns->user);
 	struct solr_fts_backend_update_context *ctx;
 
 	ctx = i_new(struct solr_fts_backend_update_context, 1);
 	ctx->ctx.backend = _backend;
+	ctx->set = &fuser->set;
 	ctx->tokenized_input =
 		(_backend->flags & FTS_BACKEND_FLAG_TOKENIZED_INPUT) != 0;
 	i_array_init(&ctx->fields, 16);
@@ -356,16 +360,61 @@ fts_backend_solr_doc_close(struct solr_fts_backend_update_context *ctx)
 	str_append(ctx->cmd, "</doc>");
 }
 
+static void
+fts_backend_solr_cmd_open(struct solr_fts_backend_update_context *ctx,
+			  string_t *str, const char *name)
+{
+	str_printfa(str, "<%s", name);
+	if (ctx->set->commit_within_msecs > 0) {
+		str_printfa(str, " commitWithin=\"%u\"",
+			    ctx->set->commit_within_msecs);
+	}
+	str_append_c(str, '>');
+}
+
+static void
+fts_backend_solr_cmd_flush(struct solr_fts_backend_update_context *ctx)
+{
+	struct solr_fts_backend *backend =
+		(struct solr_fts_backend *)ctx->ctx.backend;
+
+	if (ctx->post == NULL) {
+		if (str_len(ctx->cmd) < ctx->set->batch_max_size)
+			return;
+		/* the batch is too large to keep in memory. stream the rest
+		   of it. */
+		ctx->post = solr_connection_post_begin(backend->solr_conn);
+	} else if (str_len(ctx->cmd) < SOLR_CMDBUF_FLUSH_SIZE) {
+		return;
+	}
+	solr_connection_post_more(ctx->post, str_data(ctx->cmd),
+				  str_len(ctx->cmd));
+	str_truncate(ctx->cmd, 0);
+}
+
 static int
 fts_backed_solr_build_flush(struct solr_fts_backend_update_context *ctx)
 {
-	if (ctx->post == NULL)
+	struct solr_fts_backend *backend =
+		(struct solr_fts_backend *)ctx->ctx.backend;
+
+	if (!ctx->batch_open)
 		return 0;
 
 	fts_backend_solr_doc_close(ctx);
 	str_append(ctx->cmd, "</add>");
 	ctx->mails_since_flush = 0;
+	ctx->batch_open = FALSE;
 
+	if (ctx->post == NULL) {
+		/* don't wait for the reply, so the following batches can be
+		   built and sent meanwhile */
+		solr_connection_post_pending(backend->solr_conn, FALSE,
+					     str_data(ctx->cmd),
+					     str_len(ctx->cmd));
+		str_truncate(ctx->cmd, 0);
+		return 0;
+	}
 	solr_connection_post_more(ctx->post, str_data(ctx->cmd),
 				  str_len(ctx->cmd));
 	str_truncate(ctx->cmd, 0);
@@ -379,9 +428,11 @@ fts_backend_solr_expunge_flush(struct solr_fts_backend_update_context *ctx)
 		(struct solr_fts_backend *)ctx->ctx.backend;
 
 	str_append(ctx->cmd_expunge, "</delete>");
-	(void)solr_connection_post(backend->solr_conn, str_c(ctx->cmd_expunge));
+	solr_connection_post_pending(backend->solr_conn, TRUE,
+				     str_data(ctx->cmd_expunge),
+				     str_len(ctx->cmd_expunge));
 	str_truncate(ctx->cmd_expunge, 0);
-	str_append(ctx->cmd_expunge, "<delete>");
+	fts_backend_solr_cmd_open(ctx, ctx->cmd_expunge, "delete");
 }
 
 static int
@@ -397,12 +448,15 @@ fts_backend_solr_update_deinit(struct fts_backend_update_context *_ctx)
 
 	if (fts_backed_solr_build_flush(ctx) < 0)
 		ret = -1;
+	if (ctx->expunges)
+		fts_backend_solr_expunge_flush(ctx);
+	if (solr_connection_post_pending_wait(backend->solr_conn) < 0)
+		ret = -1;
 
-	if (ctx->documents_added || ctx->expunges) {
+	if ((ctx->documents_added || ctx->expunges) &&
+	    ctx->set->soft_commit && ctx->set->commit_within_msecs == 0) {
 		/* commit and wait until the documents we just indexed are
 		   visible to the following search */
-		if (ctx->expunges)
-			fts_backend_solr_expunge_flush(ctx);
 		str = t_strdup_printf("<commit softCommit=\"true\" waitSearcher=\"%s\"/>",
 				      ctx->documents_added ? "true" : "false");
 		if (solr_connection_post(backend->solr_conn, str) < 0)
@@ -426,6 +480,8 @@ fts_backend_solr_update_set_mailbox(struct fts_backend_update_context *_ctx,
 {
 	struct solr_fts_backend_update_context *ctx =
 		(struct solr_fts_backend_update_context *)_ctx;
+	struct solr_fts_backend *backend =
+		(struct solr_fts_backend *)_ctx->backend;
 	const char *box_guid;
 
 	if (ctx->prev_uid != 0) {
@@ -435,6 +491,8 @@ fts_backend_solr_update_set_mailbox(struct fts_backend_update_context *_ctx,
 		   last_uid before we know it has succeeded */
 		if (fts_backed_solr_build_flush(ctx) < 0)
 			_ctx->failed = TRUE;
+		if (solr_connection_post_pending_wait(backend->solr_conn) < 0)
+			_ctx->failed = TRUE;
 		else if (!_ctx->failed)
 			fts_index_set_last_uid(ctx->cur_box, ctx->prev_uid);
 		ctx->prev_uid = 0;
@@ -476,7 +534,7 @@ fts_backend_solr_update_expunge(struct fts_backend_update_context *_ctx,
 	if (!ctx->expunges) {
 		ctx->expunges = TRUE;
 		ctx->cmd_expunge = str_new(default_pool, 1024);
-		str_append(ctx->cmd_expunge, "<delete>");
+		fts_backend_solr_cmd_open(ctx, ctx->cmd_expunge, "delete");
 	}
 
 	if (str_len(ctx->cmd_expunge) >= SOLR_CMDBUF_FLUSH_SIZE)
@@ -491,18 +549,15 @@ static void
 fts_backend_solr_uid_changed(struct solr_fts_backend_update_context *ctx,
 			     uint32_t uid)
 {
-	struct solr_fts_backend *backend =
-		(struct solr_fts_backend *)ctx->ctx.backend;
-
-	if (ctx->mails_since_flush++ >= SOLR_MAIL_FLUSH_INTERVAL) {
+	if (ctx->mails_since_flush++ >= ctx->set->batch_size) {
 		if (fts_backed_solr_build_flush(ctx) < 0)
 			ctx->ctx.failed = TRUE;
 	}
-	if (ctx->post == NULL) {
+	if (!ctx->batch_open) {
 		if (ctx->cmd == NULL)
 			ctx->cmd = str_new(default_pool, SOLR_CMDBUF_SIZE);
-		ctx->post = solr_connection_post_begin(backend->solr_conn);
-		str_append(ctx->cmd, "<add>");
+		fts_backend_solr_cmd_open(ctx, ctx->cmd, "add");
+		ctx->batch_open = TRUE;
 	} else {
 		fts_backend_solr_doc_close(ctx);
 	}
@@ -578,19 +633,13 @@ fts_backend_solr_update_build_more(struct fts_backend_update_context *_ctx,
 		/* we're writing to message body. if size is huge,
 		   flush it once in a while */
 		while (size >= SOLR_CMDBUF_FLUSH_SIZE) {
-			if (str_len(ctx->cmd) >= SOLR_CMDBUF_FLUSH_SIZE) {
-				solr_connection_post_more(ctx->post,
-							  str_data(ctx->cmd),
-							  str_len(ctx->cmd));
-				str_truncate(ctx->cmd, 0);
-			}
 			len = xml_encode_data_max(ctx->cmd, data, size,
-						  SOLR_CMDBUF_FLUSH_SIZE -
-						  str_len(ctx->cmd));
+						  SOLR_CMDBUF_FLUSH_SIZE);
 			i_assert(len > 0);
 			i_assert(len <= size);
 			data += len;
 			size -= len;
+			fts_backend_solr_cmd_flush(ctx);
 		}
 		xml_encode_data(ctx->cmd, data, size);
 		if (ctx->tokenized_input)
@@ -610,11 +659,7 @@ fts_backend_solr_update_build_more(struct fts_backend_update_context *_ctx,
 		}
 	}
 
-	if (str_len(ctx->cmd) >= SOLR_CMDBUF_FLUSH_SIZE) {
-		solr_connection_post_more(ctx->post, str_data(ctx->cmd),
-					  str_len(ctx->cmd));
-		str_truncate(ctx->cmd, 0);
-	}
+	fts_backend_solr_cmd_flush(ctx);
 	if (!ctx->truncate_header &&
 	    str_len(ctx->cur_value) >= SOLR_HEADER_MAX_SIZE) {
 		/* a large header */
@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "array.h"
 #include "http-client.h"
+#include "settings-parser.h"
 #include "mail-user.h"
 #include "mail-storage-hooks.h"
 #include "solr-connection.h"
@@ -20,11 +21,15 @@ static int
 fts_solr_plugin_init_settings(struct mail_user *user,
 			      struct fts_solr_settings *set, const char *str)
 {
-	const char *const *tmp;
+	const char *const *tmp, *error;
 
 	if (str == NULL)
 		str = "";
 
+	set->batch_size = FTS_SOLR_DEFAULT_BATCH_SIZE;
+	set->batch_max_size = FTS_SOLR_DEFAULT_BATCH_MAX_SIZE;
+	set->soft_commit = TRUE;
+
 	for (tmp = t_strsplit_spaces(str, " "); *tmp != NULL; tmp++) {
 		if (str_begins(*tmp, "url=")) {
 			set->url = p_strdup(user->pool, *tmp + 4);
@@ -37,6 +42,40 @@ fts_solr_plugin_init_settings(struct mail_user *user,
 				p_strdup(user->pool, *tmp + 11);
 		} else if (str_begins(*tmp, "rawlog_dir=")) {
 			set->rawlog_dir = p_strdup(user->pool, *tmp + 11);
+		} else if (str_begins(*tmp, "proxy_socket=")) {
+			set->proxy_socket_path =
+				p_strdup(user->pool, *tmp + 13);
+		} else if (str_begins(*tmp, "batch_size=")) {
+			if (str_to_uint(*tmp + 11, &set->batch_size) < 0 ||
+			    set->batch_size == 0) {
+				i_error("fts_solr: Invalid batch_size: %s",
+					*tmp + 11);
+				return -1;
+			}
+		} else if (str_begins(*tmp, "batch_max_size=")) {
+			if (settings_get_size(*tmp + 15, &set->batch_max_size,
+					      &error) < 0) {
+				i_error("fts_solr: Invalid batch_max_size: %s",
+					error);
+				return -1;
+			}
+		} else if (str_begins(*tmp, "soft_commit=")) {
+			if (strcmp(*tmp + 12, "yes") == 0)
+				set->soft_commit = TRUE;
+			else if (strcmp(*tmp + 12, "no") == 0)
+				set->soft_commit = FALSE;
+			else {
+				i_error("fts_solr: Invalid soft_commit value: %s",
+					*tmp + 12);
+				return -1;
+			}
+		} else if (str_begins(*tmp, "commit_within=")) {
+			if (str_to_uint(*tmp + 14,
+					&set->commit_within_msecs) < 0) {
+				i_error("fts_solr: Invalid commit_within: %s",
+					*tmp + 14);
+				return -1;
+			}
 		} else {
 			i_error("fts_solr: Invalid setting: %s", *tmp);
 			return -1;
@@ -10,9 +10,25 @@
 #define FTS_SOLR_USER_CONTEXT_REQUIRE(obj) \
 	MODULE_CONTEXT_REQUIRE(obj, fts_solr_user_module)
 
+#define FTS_SOLR_DEFAULT_BATCH_SIZE 1000
+#define FTS_SOLR_DEFAULT_BATCH_MAX_SIZE (1024*1024*4)
+
 struct fts_solr_settings {
 	const char *url, *default_ns_prefix, *rawlog_dir;
+	/* Send the requests via a HTTP proxy listening on this UNIX socket.
+	   This allows a local proxy to keep a warm connection pool to Solr
+	   shared by all the processes. */
+	const char *proxy_socket_path;
+	/* Send the indexed mails in batches of this many mails */
+	unsigned int batch_size;
+	/* Batches larger than this are streamed to Solr instead of being
+	   buffered and sent without waiting for the reply */
+	uoff_t batch_max_size;
+	/* Ask Solr to commit the updates within this many milliseconds
+	   instead of committing them at the end of the indexing */
+	unsigned int commit_within_msecs;
 	bool use_libfts;
+	bool soft_commit;
 	bool debug;
 };
 
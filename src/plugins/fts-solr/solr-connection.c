@@ -14,6 +14,10 @@
 
 #include <expat.h>
 
+/* Maximum number of update requests that are sent without waiting for
+   the earlier ones to finish. */
+#define SOLR_MAX_PENDING_POSTS 4
+
 enum solr_xml_response_state {
 	SOLR_XML_RESPONSE_STATE_ROOT,
 	SOLR_XML_RESPONSE_STATE_RESPONSE,
@@ -66,12 +70,16 @@ struct solr_connection {
 	char *http_password;
 
 	int request_status;
+	unsigned int pending_posts;
 
 	struct istream *payload;
 	struct io *io;
 
 	bool debug:1;
 	bool posting:1;
+	bool pending_post_failed:1;
+	/* the pending posts are deletes, not adds */
+	bool pending_posts_delete:1;
 	bool xml_failed:1;
 	bool http_ssl:1;
 };
@@ -147,7 +155,7 @@ int solr_connection_init(const struct fts_solr_settings *solr_set,
 	if (solr_http_client == NULL) {
 		i_zero(&http_set);
 		http_set.max_idle_time_msecs = 5*1000;
-		http_set.max_parallel_connections = 1;
+		http_set.max_parallel_connections = SOLR_MAX_PENDING_POSTS;
 		http_set.max_pipelined_requests = 1;
 		http_set.max_redirects = 1;
 		http_set.max_attempts = 3;
@@ -156,6 +164,7 @@ int solr_connection_init(const struct fts_solr_settings *solr_set,
 		http_set.ssl = ssl_client_set;
 		http_set.debug = solr_set->debug;
 		http_set.rawlog_dir = solr_set->rawlog_dir;
+		http_set.proxy_socket_path = solr_set->proxy_socket_path;
 		solr_http_client = http_client_init(&http_set);
 	}
 
@@ -173,6 +182,9 @@ void solr_connection_deinit(struct solr_connection **_conn)
 	struct solr_connection *conn = *_conn;
 
 	*_conn = NULL;
+	/* the pending requests' callbacks still refer to conn */
+	if (conn->pending_posts > 0)
+		http_client_wait(solr_http_client);
 	XML_ParserFree(conn->xml_parser);
 	i_free(conn->http_host);
 	i_free(conn->http_base_url);
@@ -504,6 +516,32 @@ solr_connection_update_response(const struct http_response *response,
 	}
 }
 
+static void
+solr_connection_pending_update_response(const struct http_response *response,
+					struct solr_connection *conn)
+{
+	i_assert(conn->pending_posts > 0);
+	conn->pending_posts--;
+
+	if (response->status / 100 != 2) {
+		i_error("fts_solr: Indexing failed: %s",
+			http_response_get_message(response));
+		conn->pending_post_failed = TRUE;
+	}
+}
+
+static void
+solr_connection_post_request_init(struct solr_connection *conn,
+				  struct http_client_request *http_req)
+{
+	if (conn->http_user != NULL) {
+		http_client_request_set_auth_simple(http_req, conn->http_user, conn->http_password);
+	}
+	http_client_request_set_port(http_req, conn->http_port);
+	http_client_request_set_ssl(http_req, conn->http_ssl);
+	http_client_request_add_header(http_req, "Content-Type", "text/xml");
+}
+
 static struct http_client_request *
 solr_connection_post_request(struct solr_connection *conn)
 {
@@ -515,21 +553,24 @@ solr_connection_post_request(struct solr_connection *conn)
 	http_req = http_client_request(solr_http_client, "POST",
 				       conn->http_host, url,
 				       solr_connection_update_response, conn);
-	if (conn->http_user != NULL) {
-		http_client_request_set_auth_simple(http_req, conn->http_user, conn->http_password);
-	}
-	http_client_request_set_port(http_req, conn->http_port);
-	http_client_request_set_ssl(http_req, conn->http_ssl);
-	http_client_request_add_header(http_req, "Content-Type", "text/xml");
+	solr_connection_post_request_init(conn, http_req);
 	return http_req;
 }
 
+static void solr_connection_pending_posts_finish(struct solr_connection *conn)
+{
+	if (conn->pending_posts > 0)
+		http_client_wait(solr_http_client);
+	i_assert(conn->pending_posts == 0);
+}
+
 struct solr_connection_post *
 solr_connection_post_begin(struct solr_connection *conn)
 {
 	struct solr_connection_post *post;
 
 	i_assert(!conn->posting);
+	solr_connection_pending_posts_finish(conn);
 	conn->posting = TRUE;
 
 	post = i_new(struct solr_connection_post, 1);
@@ -584,6 +625,7 @@ int solr_connection_post(struct solr_connection *conn, const char *cmd)
 	struct istream *post_payload;
 
 	i_assert(!conn->posting);
+	solr_connection_pending_posts_finish(conn);
 
 	http_req = solr_connection_post_request(conn);
 	post_payload = i_stream_create_from_data(cmd, strlen(cmd));
@@ -598,3 +640,45 @@ int solr_connection_post(struct solr_connection *conn, const char *cmd)
 
 	return conn->request_status;
 }
+
+void solr_connection_post_pending(struct solr_connection *conn, bool delete,
+				  const unsigned char *data, size_t size)
+{
+	struct http_client_request *http_req;
+	struct istream *post_payload;
+	const char *url;
+
+	i_assert(!conn->posting);
+
+	/* the pending requests may be processed in any order, since they're
+	   sent over parallel connections. don't mix adds and deletes, so a
+	   document's delete can't be processed before its add or the other
+	   way around. */
+	if (conn->pending_posts >= SOLR_MAX_PENDING_POSTS ||
+	    (conn->pending_posts > 0 && conn->pending_posts_delete != delete))
+		solr_connection_pending_posts_finish(conn);
+	conn->pending_posts_delete = delete;
+
+	url = t_strconcat(conn->http_base_url, "update", NULL);
+	http_req = http_client_request(solr_http_client, "POST",
+				       conn->http_host, url,
+				       solr_connection_pending_update_response,
+				       conn);
+	solr_connection_post_request_init(conn, http_req);
+	/* the caller will reuse its buffer, so copy the data */
+	post_payload = i_stream_create_copy_from_data(data, size);
+	http_client_request_set_payload(http_req, post_payload, FALSE);
+	i_stream_unref(&post_payload);
+	http_client_request_submit(http_req);
+	conn->pending_posts++;
+}
+
+int solr_connection_post_pending_wait(struct solr_connection *conn)
+{
+	int ret;
+
+	solr_connection_pending_posts_finish(conn);
+	ret = conn->pending_post_failed ? -1 : 0;
+	conn->pending_post_failed = FALSE;
+	return ret;
+}
@@ -30,4 +30,14 @@ void solr_connection_post_more(struct solr_connection_post *post,
 			       const unsigned char *data, size_t size);
 int solr_connection_post_end(struct solr_connection_post **post);
 
+/* Send an update request without waiting for its reply. Multiple requests
+   can be pending at the same time, but deletes are sent only after the
+   pending adds have finished and vice versa. The other posting functions
+   wait for the pending requests to finish before sending anything. */
+void solr_connection_post_pending(struct solr_connection *conn, bool delete,
+				  const unsigned char *data, size_t size);
+/* Wait for all the pending requests to finish. Returns -1 if any of them
+   failed since the last call. */
+int solr_connection_post_pending_wait(struct solr_connection *conn);
+
 #endif
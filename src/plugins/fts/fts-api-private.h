@@ -75,6 +75,8 @@ struct fts_backend {
 
 	struct fts_backend_vfuncs v;
 	struct mail_namespace *ns;
+	/* NULL unless fts_search_cache_ttl is set */
+	struct fts_search_cache *search_cache;
 
 	bool updating:1;
 };
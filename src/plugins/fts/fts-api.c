@@ -8,7 +8,9 @@
 #include "mail-storage-private.h"
 #include "mailbox-list-iter.h"
 #include "mail-search.h"
+#include "settings-parser.h"
 #include "fts-api-private.h"
+#include "fts-search-cache.h"
 
 static ARRAY(const struct fts_backend *) backends;
 
@@ -54,6 +56,23 @@ fts_backend_class_lookup(const char *backend_name)
 	return NULL;
 }
 
+static void fts_backend_init_search_cache(struct fts_backend *backend)
+{
+	const char *value, *error;
+	unsigned int ttl_secs;
+
+	value = mail_user_plugin_getenv(backend->ns->user,
+					"fts_search_cache_ttl");
+	if (value == NULL)
+		return;
+	if (settings_get_time(value, &ttl_secs, &error) < 0) {
+		i_error("Invalid fts_search_cache_ttl setting: %s", error);
+		return;
+	}
+	if (ttl_secs > 0)
+		backend->search_cache = fts_search_cache_init(ttl_secs);
+}
+
 int fts_backend_init(const char *backend_name, struct mail_namespace *ns,
 		     const char **error_r, struct fts_backend **backend_r)
 {
@@ -72,6 +91,7 @@ int fts_backend_init(const char *backend_name, struct mail_namespace *ns,
 		i_free(backend);
 		return -1;
 	}
+	fts_backend_init_search_cache(backend);
 	*backend_r = backend;
 	return 0;
 }
@@ -81,6 +101,8 @@ void fts_backend_deinit(struct fts_backend **_backend)
 	struct fts_backend *backend = *_backend;
 
 	*_backend = NULL;
+	if (backend->search_cache != NULL)
+		fts_search_cache_deinit(&backend->search_cache);
 	backend->v.deinit(backend);
 }
 
@@ -481,6 +481,7 @@ fts_build_mail_real(struct fts_backend_update_context *update_ctx,
 	struct message_decoder_context *decoder;
 	struct message_block raw_block, block;
 	struct message_part *prev_part, *parts;
+	enum mail_lookup_abort orig_lookup_abort;
 	bool skip_body = FALSE, body_part = FALSE, body_added = FALSE;
 	bool binary_body;
 	const char *error;
@@ -502,10 +503,22 @@ fts_build_mail_real(struct fts_backend_update_context *update_ctx,
 	if ((update_ctx->backend->flags & FTS_BACKEND_FLAG_TOKENIZED_INPUT) != 0)
 		ctx.pending_input = buffer_create_dynamic(default_pool, 128);
 
+	/* Use the cached MIME structure if it exists, so the bodies that
+	   aren't indexed can be skipped by their offsets. */
+	orig_lookup_abort = mail->lookup_abort;
+	mail->lookup_abort = MAIL_LOOKUP_ABORT_NOT_IN_CACHE;
+	if (mail_get_parts(mail, &parts) < 0)
+		parts = NULL;
+	mail->lookup_abort = orig_lookup_abort;
+
 	prev_part = NULL;
-	parser = message_parser_init(pool_datastack_create(), input,
-				     MESSAGE_HEADER_PARSER_FLAG_CLEAN_ONELINE,
-				     0);
+	if (parts != NULL) {
+		parser = message_parser_init_from_parts(parts, input,
+				MESSAGE_HEADER_PARSER_FLAG_CLEAN_ONELINE, 0);
+	} else {
+		parser = message_parser_init(pool_datastack_create(), input,
+				MESSAGE_HEADER_PARSER_FLAG_CLEAN_ONELINE, 0);
+	}
 
 	decoder = message_decoder_init(update_ctx->normalizer, 0);
 	for (;;) {
@@ -554,6 +567,8 @@ fts_build_mail_real(struct fts_backend_update_context *update_ctx,
 			if (binary_body)
 				message_decoder_set_return_binary(decoder, TRUE);
 			body_part = TRUE;
+			if (skip_body)
+				(void)message_parser_skip_part_body(parser);
 		} else {
 			if (skip_body)
 				continue;
@@ -0,0 +1,295 @@
+/* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "buffer.h"
+#include "str.h"
+#include "hex-binary.h"
+#include "hash-method.h"
+#include "mkdir-parents.h"
+#include "safe-mkstemp.h"
+#include "istream.h"
+#include "ostream.h"
+#include "settings-parser.h"
+#include "message-parser.h"
+#include "mail-user.h"
+#include "fts-parser.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define FTS_PARSER_CACHE_DEFAULT_MAX_SIZE (10*1024*1024)
+#define FTS_PARSER_CACHE_HASH_METHOD "sha256"
+
+struct cache_fts_parser {
+	struct fts_parser parser;
+	struct mail_user *user;
+	struct fts_parser *real_parser;
+
+	char *dir;
+	size_t max_size;
+	const struct hash_method *hash;
+	void *hash_ctx;
+	/* The attachment is buffered here until it's known whether its text
+	   is found from the cache. */
+	buffer_t *input;
+
+	/* cache hit: the text is read from here */
+	struct istream *cache_input;
+	/* cache miss: the extracted text is written here */
+	struct ostream *cache_output;
+	char *cache_path, *cache_temp_path;
+
+	/* the attachment was too large to be cached */
+	bool passthrough:1;
+	bool lookup_done:1;
+	bool cache_output_eof:1;
+	bool failed:1;
+};
+
+static void
+fts_parser_cache_send_input(struct cache_fts_parser *parser)
+{
+	struct message_block block;
+
+	if (parser->input->used == 0)
+		return;
+
+	i_zero(&block);
+	block.data = parser->input->data;
+	block.size = parser->input->used;
+	parser->real_parser->v.more(parser->real_parser, &block);
+	buffer_set_used_size(parser->input, 0);
+}
+
+static const char *
+fts_parser_cache_get_path(struct cache_fts_parser *parser)
+{
+	unsigned char *digest;
+	const char *hash;
+
+	digest = t_malloc_no0(parser->hash->digest_size);
+	parser->hash->result(parser->hash_ctx, digest);
+	hash = binary_to_hex(digest, parser->hash->digest_size);
+	return t_strdup_printf("%s/%c%c/%s", parser->dir, hash[0], hash[1],
+			       hash);
+}
+
+static int
+fts_parser_cache_create_temp(struct cache_fts_parser *parser)
+{
+	string_t *temp_path = t_str_new(256);
+	const char *dir, *p;
+	int fd;
+
+	p = strrchr(parser->cache_path, '/');
+	i_assert(p != NULL);
+	dir = t_strdup_until(parser->cache_path, p);
+
+	str_printfa(temp_path, "%s/.temp.", dir);
+	fd = safe_mkstemp_hostpid(temp_path, 0660, (uid_t)-1, (gid_t)-1);
+	if (fd == -1 && errno == ENOENT) {
+		if (mkdir_parents(dir, 0770) < 0 && errno != EEXIST) {
+			i_error("fts_parser_cache: mkdir_parents(%s) failed: %m",
+				dir);
+			return -1;
+		}
+		str_truncate(temp_path, 0);
+		str_printfa(temp_path, "%s/.temp.", dir);
+		fd = safe_mkstemp_hostpid(temp_path, 0660,
+					  (uid_t)-1, (gid_t)-1);
+	}
+	if (fd == -1) {
+		i_error("fts_parser_cache: safe_mkstemp(%s) failed: %m",
+			str_c(temp_path));
+		return -1;
+	}
+	parser->cache_temp_path = i_strdup(str_c(temp_path));
+	parser->cache_output = o_stream_create_fd_file_autoclose(&fd, 0);
+	o_stream_cork(parser->cache_output);
+	return 0;
+}
+
+static void fts_parser_cache_lookup(struct cache_fts_parser *parser)
+{
+	int fd;
+
+	parser->cache_path = i_strdup(fts_parser_cache_get_path(parser));
+	fd = open(parser->cache_path, O_RDONLY);
+	if (fd != -1) {
+		e_debug(parser->user->event,
+			"fts_parser_cache: Found text from %s",
+			parser->cache_path);
+		parser->cache_input =
+			i_stream_create_fd_autoclose(&fd, IO_BLOCK_SIZE);
+		(void)fts_parser_deinit(&parser->real_parser, NULL);
+		return;
+	}
+	if (errno != ENOENT) {
+		i_error("fts_parser_cache: open(%s) failed: %m",
+			parser->cache_path);
+	} else {
+		(void)fts_parser_cache_create_temp(parser);
+	}
+	fts_parser_cache_send_input(parser);
+}
+
+static void
+fts_parser_cache_read(struct cache_fts_parser *parser,
+		      struct message_block *block)
+{
+	const unsigned char *data;
+	size_t size;
+
+	if (i_stream_read_more(parser->cache_input, &data, &size) > 0) {
+		block->data = data;
+		block->size = size;
+		i_stream_skip(parser->cache_input, size);
+	} else if (parser->cache_input->stream_errno != 0) {
+		i_error("fts_parser_cache: read(%s) failed: %s",
+			i_stream_get_name(parser->cache_input),
+			i_stream_get_error(parser->cache_input));
+		parser->failed = TRUE;
+	}
+}
+
+static void fts_parser_cache_more(struct fts_parser *_parser,
+				  struct message_block *block)
+{
+	struct cache_fts_parser *parser = (struct cache_fts_parser *)_parser;
+
+	if (block->size > 0) {
+		if (!parser->passthrough) {
+			parser->hash->loop(parser->hash_ctx,
+					   block->data, block->size);
+			if (parser->input->used + block->size <=
+			    parser->max_size) {
+				buffer_append(parser->input,
+					      block->data, block->size);
+				block->size = 0;
+				return;
+			}
+			/* too large to be cached */
+			parser->passthrough = TRUE;
+			fts_parser_cache_send_input(parser);
+		}
+		parser->real_parser->v.more(parser->real_parser, block);
+		return;
+	}
+
+	if (!parser->passthrough && !parser->lookup_done) {
+		parser->lookup_done = TRUE;
+		fts_parser_cache_lookup(parser);
+	}
+	if (parser->cache_input != NULL) {
+		fts_parser_cache_read(parser, block);
+		return;
+	}
+
+	parser->real_parser->v.more(parser->real_parser, block);
+	if (parser->cache_output != NULL) {
+		if (block->size > 0) {
+			o_stream_nsend(parser->cache_output,
+				       block->data, block->size);
+		} else {
+			parser->cache_output_eof = TRUE;
+		}
+	}
+}
+
+static void
+fts_parser_cache_finish_output(struct cache_fts_parser *parser, bool success)
+{
+	if (success && !parser->cache_output_eof)
+		success = FALSE;
+	if (success && o_stream_finish(parser->cache_output) < 0) {
+		i_error("fts_parser_cache: write(%s) failed: %s",
+			parser->cache_temp_path,
+			o_stream_get_error(parser->cache_output));
+		success = FALSE;
+	}
+	o_stream_destroy(&parser->cache_output);
+
+	if (success && rename(parser->cache_temp_path, parser->cache_path) < 0) {
+		i_error("fts_parser_cache: rename(%s, %s) failed: %m",
+			parser->cache_temp_path, parser->cache_path);
+		success = FALSE;
+	}
+	if (!success)
+		(void)i_unlink_if_exists(parser->cache_temp_path);
+}
+
+static int fts_parser_cache_deinit(struct fts_parser *_parser,
+				   const char **retriable_err_msg_r)
+{
+	struct cache_fts_parser *parser = (struct cache_fts_parser *)_parser;
+	int ret;
+
+	if (parser->real_parser != NULL) {
+		ret = fts_parser_deinit(&parser->real_parser,
+					retriable_err_msg_r);
+	} else {
+		ret = parser->failed ? -1 : 1;
+	}
+	if (parser->cache_output != NULL)
+		fts_parser_cache_finish_output(parser, ret > 0);
+
+	i_stream_unref(&parser->cache_input);
+	buffer_free(&parser->input);
+	i_free(parser->hash_ctx);
+	i_free(parser->cache_path);
+	i_free(parser->cache_temp_path);
+	i_free(parser->dir);
+	i_free(parser);
+	return ret;
+}
+
+static struct fts_parser_vfuncs fts_parser_cache = {
+	NULL,
+	fts_parser_cache_more,
+	fts_parser_cache_deinit,
+	NULL
+};
+
+struct fts_parser *
+fts_parser_cache_init(struct fts_parser_context *parser_context,
+		      const char *parser_name, struct fts_parser *real_parser)
+{
+	struct mail_user *user = parser_context->user;
+	struct cache_fts_parser *parser;
+	const char *dir, *value, *error;
+	uoff_t max_size = FTS_PARSER_CACHE_DEFAULT_MAX_SIZE;
+
+	dir = mail_user_plugin_getenv(user, "fts_parser_cache");
+	if (dir == NULL || dir[0] == '\0')
+		return real_parser;
+
+	value = mail_user_plugin_getenv(user, "fts_parser_cache_max_size");
+	if (value != NULL && settings_get_size(value, &max_size, &error) < 0) {
+		i_error("Invalid fts_parser_cache_max_size setting: %s", error);
+		max_size = FTS_PARSER_CACHE_DEFAULT_MAX_SIZE;
+	}
+	if (max_size == 0)
+		return real_parser;
+
+	parser = i_new(struct cache_fts_parser, 1);
+	parser->parser.v = fts_parser_cache;
+	parser->user = user;
+	parser->real_parser = real_parser;
+	parser->dir = i_strdup(dir);
+	parser->max_size = max_size;
+	parser->input = buffer_create_dynamic(default_pool,
+					      I_MIN(max_size, IO_BLOCK_SIZE));
+
+	/* The same attachment may produce a different text with
+	   a different parser or content type. */
+	parser->hash = hash_method_lookup(FTS_PARSER_CACHE_HASH_METHOD);
+	i_assert(parser->hash != NULL);
+	parser->hash_ctx = i_malloc(parser->hash->context_size);
+	parser->hash->init(parser->hash_ctx);
+	parser->hash->loop(parser->hash_ctx, parser_name,
+			   strlen(parser_name) + 1);
+	parser->hash->loop(parser->hash_ctx, parser_context->content_type,
+			   strlen(parser_context->content_type) + 1);
+	return &parser->parser;
+}
@@ -20,9 +20,21 @@ static const char *plaintext_content_types[] = {
 	NULL
 };
 
+static const char *
+fts_parser_get_cache_name(const struct fts_parser_vfuncs *parser)
+{
+	/* the HTML parser is fast enough that it's not worth caching */
+	if (parser == &fts_parser_script)
+		return "script";
+	if (parser == &fts_parser_tika)
+		return "tika";
+	return NULL;
+}
+
 bool fts_parser_init(struct fts_parser_context *parser_context,
 		     struct fts_parser **parser_r)
 {
+	const char *cache_name;
 	unsigned int i;
 	i_assert(parser_context->user != NULL);
 	i_assert(parser_context->content_type != NULL);
@@ -35,8 +47,14 @@ bool fts_parser_init(struct fts_parser_context *parser_context,
 
 	for (i = 0; i < N_ELEMENTS(parsers); i++) {
 		*parser_r = parsers[i]->try_init(parser_context);
-		if (*parser_r != NULL)
+		if (*parser_r != NULL) {
+			cache_name = fts_parser_get_cache_name(parsers[i]);
+			if (cache_name != NULL) {
+				*parser_r = fts_parser_cache_init(parser_context,
+						cache_name, *parser_r);
+			}
 			return TRUE;
+		}
 	}
 	return FALSE;
 }
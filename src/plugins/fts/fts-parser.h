@@ -33,6 +33,12 @@ extern struct fts_parser_vfuncs fts_parser_tika;
 bool fts_parser_init(struct fts_parser_context *parser_context,
 		     struct fts_parser **parser_r);
 struct fts_parser *fts_parser_text_init(void);
+/* Wrap real_parser so that its output is cached to the fts_parser_cache
+   directory by a hash of the attachment. Returns real_parser if caching
+   isn't enabled. */
+struct fts_parser *
+fts_parser_cache_init(struct fts_parser_context *parser_context,
+		      const char *parser_name, struct fts_parser *real_parser);
 
 /* The parser is initially called with message body blocks. Once message is
    finished, it's still called with incoming size=0 while the parser increases
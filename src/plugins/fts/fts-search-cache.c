@@ -0,0 +1,129 @@
+/* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "hash.h"
+#include "llist.h"
+#include "ioloop.h"
+#include "fts-api.h"
+#include "fts-search-cache.h"
+
+/* Searches are typically repeated only one or a few at a time, e.g. when
+   paging through the results of the same query. */
+#define FTS_SEARCH_CACHE_MAX_ENTRIES 16
+
+struct fts_search_cache_entry {
+	/* newest first */
+	struct fts_search_cache_entry *prev, *next;
+
+	pool_t pool;
+	char *key;
+	time_t created;
+
+	buffer_t *args_matches;
+	ARRAY_TYPE(seq_range) definite_uids, maybe_uids;
+	ARRAY_TYPE(fts_score_map) scores;
+};
+
+struct fts_search_cache {
+	unsigned int ttl_secs;
+
+	HASH_TABLE(char *, struct fts_search_cache_entry *) entries;
+	struct fts_search_cache_entry *head, *tail;
+	unsigned int count;
+};
+
+struct fts_search_cache *fts_search_cache_init(unsigned int ttl_secs)
+{
+	struct fts_search_cache *cache;
+
+	cache = i_new(struct fts_search_cache, 1);
+	cache->ttl_secs = ttl_secs;
+	hash_table_create(&cache->entries, default_pool, 0, str_hash, strcmp);
+	return cache;
+}
+
+static void
+fts_search_cache_entry_remove(struct fts_search_cache *cache,
+			      struct fts_search_cache_entry *entry)
+{
+	hash_table_remove(cache->entries, entry->key);
+	DLLIST2_REMOVE(&cache->head, &cache->tail, entry);
+	i_assert(cache->count > 0);
+	cache->count--;
+	pool_unref(&entry->pool);
+}
+
+void fts_search_cache_deinit(struct fts_search_cache **_cache)
+{
+	struct fts_search_cache *cache = *_cache;
+
+	*_cache = NULL;
+	while (cache->head != NULL)
+		fts_search_cache_entry_remove(cache, cache->head);
+	hash_table_destroy(&cache->entries);
+	i_free(cache);
+}
+
+static void fts_search_cache_expire(struct fts_search_cache *cache)
+{
+	time_t expire_time = ioloop_time - cache->ttl_secs;
+
+	while (cache->tail != NULL && cache->tail->created <= expire_time)
+		fts_search_cache_entry_remove(cache, cache->tail);
+}
+
+bool fts_search_cache_lookup(struct fts_search_cache *cache, const char *key,
+			     struct fts_result *result,
+			     buffer_t *args_matches)
+{
+	struct fts_search_cache_entry *entry;
+
+	fts_search_cache_expire(cache);
+	entry = hash_table_lookup(cache->entries, key);
+	if (entry == NULL)
+		return FALSE;
+
+	buffer_append_buf(args_matches, entry->args_matches, 0, SIZE_MAX);
+	array_append_array(&result->definite_uids, &entry->definite_uids);
+	array_append_array(&result->maybe_uids, &entry->maybe_uids);
+	array_append_array(&result->scores, &entry->scores);
+	result->scores_sorted = TRUE;
+	return TRUE;
+}
+
+void fts_search_cache_add(struct fts_search_cache *cache, const char *key,
+			  const struct fts_result *result,
+			  const buffer_t *args_matches)
+{
+	struct fts_search_cache_entry *entry;
+	pool_t pool;
+
+	entry = hash_table_lookup(cache->entries, key);
+	if (entry != NULL)
+		fts_search_cache_entry_remove(cache, entry);
+	else if (cache->count >= FTS_SEARCH_CACHE_MAX_ENTRIES)
+		fts_search_cache_entry_remove(cache, cache->tail);
+
+	pool = pool_alloconly_create("fts search cache entry", 1024);
+	entry = p_new(pool, struct fts_search_cache_entry, 1);
+	entry->pool = pool;
+	entry->key = p_strdup(pool, key);
+	entry->created = ioloop_time;
+	entry->args_matches = buffer_create_dynamic(pool, args_matches->used);
+	buffer_append_buf(entry->args_matches, args_matches, 0, SIZE_MAX);
+	p_array_init(&entry->definite_uids, pool,
+		     I_MAX(array_count(&result->definite_uids), 1));
+	array_append_array(&entry->definite_uids, &result->definite_uids);
+	p_array_init(&entry->maybe_uids, pool,
+		     I_MAX(array_count(&result->maybe_uids), 1));
+	array_append_array(&entry->maybe_uids, &result->maybe_uids);
+	p_array_init(&entry->scores, pool,
+		     I_MAX(array_count(&result->scores), 1));
+	array_append_array(&entry->scores, &result->scores);
+
+	hash_table_insert(cache->entries, entry->key, entry);
+	DLLIST2_PREPEND(&cache->head, &cache->tail, entry);
+	cache->count++;
+}
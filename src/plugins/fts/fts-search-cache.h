@@ -0,0 +1,24 @@
+#ifndef FTS_SEARCH_CACHE_H
+#define FTS_SEARCH_CACHE_H
+
+struct fts_result;
+
+/* Cache of the most recent backend lookup results. The key must identify
+   everything that affects the result, including the mailbox and its last
+   indexed UID, so that the entries never need to be invalidated. They're
+   just dropped when they become older than ttl_secs. */
+struct fts_search_cache *fts_search_cache_init(unsigned int ttl_secs);
+void fts_search_cache_deinit(struct fts_search_cache **cache);
+
+/* Returns TRUE and appends the cached result to the result's (created)
+   arrays and the serialized search args to args_matches, if the key is
+   found. */
+bool fts_search_cache_lookup(struct fts_search_cache *cache, const char *key,
+			     struct fts_result *result,
+			     buffer_t *args_matches);
+/* Add the result of a backend lookup to the cache. */
+void fts_search_cache_add(struct fts_search_cache *cache, const char *key,
+			  const struct fts_result *result,
+			  const buffer_t *args_matches);
+
+#endif
@@ -3,10 +3,12 @@
 #include "lib.h"
 #include "array.h"
 #include "str.h"
+#include "hex-binary.h"
 #include "seq-range-array.h"
 #include "mail-search.h"
 #include "fts-api-private.h"
 #include "fts-search-args.h"
+#include "fts-search-cache.h"
 #include "fts-search-serialize.h"
 #include "fts-storage.h"
 
@@ -32,28 +34,69 @@ uid_range_to_seqs(struct fts_search_context *fctx,
 	}
 }
 
+static const char *
+fts_search_cache_get_key(struct fts_search_context *fctx,
+			 const struct mail_search_arg *args,
+			 enum fts_lookup_flags flags)
+{
+	struct mailbox_metadata metadata;
+	string_t *key;
+	buffer_t *matches;
+	const char *error;
+
+	if (mailbox_get_metadata(fctx->box, MAILBOX_METADATA_GUID,
+				 &metadata) < 0)
+		return NULL;
+
+	key = t_str_new(128);
+	str_printfa(key, "%s\t%u\t%x\t", guid_128_to_string(metadata.guid),
+		    fctx->last_indexed_uid, flags);
+	/* the backends' results may depend on the existing matches */
+	matches = t_buffer_create(16);
+	fts_search_serialize(matches, args);
+	binary_to_hex_append(key, matches->data, matches->used);
+	str_append_c(key, '\t');
+	if (!mail_search_args_to_imap(key, args, &error))
+		return NULL;
+	return str_c(key);
+}
+
 static int fts_search_lookup_level_single(struct fts_search_context *fctx,
 					  struct mail_search_arg *args,
 					  bool and_args)
 {
 	enum fts_lookup_flags flags = fctx->flags |
 		(and_args ? FTS_LOOKUP_FLAG_AND_ARGS : 0);
+	struct fts_search_cache *cache = fctx->backend->search_cache;
 	struct fts_search_level *level;
 	struct fts_result result;
+	const char *cache_key = NULL;
 
 	i_zero(&result);
 	p_array_init(&result.definite_uids, fctx->result_pool, 32);
 	p_array_init(&result.maybe_uids, fctx->result_pool, 32);
 	p_array_init(&result.scores, fctx->result_pool, 32);
 
-	mail_search_args_reset(args, TRUE);
-	if (fts_backend_lookup(fctx->backend, fctx->box, args, flags,
-			       &result) < 0)
-		return -1;
-
 	level = array_append_space(&fctx->levels);
 	level->args_matches = buffer_create_dynamic(fctx->result_pool, 16);
-	fts_search_serialize(level->args_matches, args);
+
+	mail_search_args_reset(args, TRUE);
+	if (cache != NULL)
+		cache_key = fts_search_cache_get_key(fctx, args, flags);
+	if (cache_key != NULL &&
+	    fts_search_cache_lookup(cache, cache_key, &result,
+				    level->args_matches)) {
+		fts_search_deserialize(args, level->args_matches);
+	} else {
+		if (fts_backend_lookup(fctx->backend, fctx->box, args, flags,
+				       &result) < 0)
+			return -1;
+		fts_search_serialize(level->args_matches, args);
+		if (cache_key != NULL) {
+			fts_search_cache_add(cache, cache_key, &result,
+					     level->args_matches);
+		}
+	}
 
 	uid_range_to_seqs(fctx, &result.definite_uids, &level->definite_seqs);
 	uid_range_to_seqs(fctx, &result.maybe_uids, &level->maybe_seqs);
@@ -347,6 +390,7 @@ void fts_search_lookup(struct fts_search_context *fctx)
 		return;
 	if (fts_backend_get_last_uid(fctx->backend, fctx->box, &last_uid) < 0)
 		return;
+	fctx->last_indexed_uid = last_uid;
 	mailbox_get_seq_range(fctx->box, last_uid+1, (uint32_t)-1,
 			      &seq1, &seq2);
 	fctx->first_unindexed_seq = seq1 != 0 ? seq1 : (uint32_t)-1;
@@ -35,6 +35,7 @@ struct fts_search_context {
 	ARRAY(struct fts_search_level) levels;
 	buffer_t *orig_matches;
 
+	uint32_t last_indexed_uid;
 	uint32_t first_unindexed_seq;
 
 	/* final scores, combined from all levels */
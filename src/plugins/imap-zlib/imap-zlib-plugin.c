@@ -7,6 +7,7 @@
 #include "module-context.h"
 #include "imap-commands.h"
 #include "compression.h"
+#include "ostream-zlib.h"
 #include "imap-zlib-plugin.h"
 
 
@@ -21,6 +22,7 @@ struct zlib_client {
 	int (*next_state_export)(struct client *client, bool internal,
 				 buffer_t *dest, const char **error_r);
 	const struct compression_handler *handler;
+	bool zstd_enabled:1;
 };
 
 const char *imap_zlib_plugin_version = DOVECOT_ABI_VERSION;
@@ -71,7 +73,7 @@ static bool cmd_compress(struct client_command_context *cmd)
 	struct istream *old_input;
 	struct ostream *old_output;
 	const char *mechanism, *value;
-	unsigned int level;
+	unsigned int level, min_level;
 
 	/* <mechanism> */
 	if (!client_read_args(cmd, 0, 0, &args))
@@ -89,7 +91,12 @@ static bool cmd_compress(struct client_command_context *cmd)
 		return TRUE;
 	}
 
-	handler = compression_lookup_handler(t_str_lcase(mechanism));
+	mechanism = t_str_lcase(mechanism);
+	if (strcmp(mechanism, "deflate") == 0 ||
+	    (strcmp(mechanism, "zstd") == 0 && zclient->zstd_enabled))
+		handler = compression_lookup_handler(mechanism);
+	else
+		handler = NULL;
 	if (handler == NULL || handler->create_istream == NULL) {
 		client_send_tagline(cmd, "NO Unknown compression mechanism.");
 		return TRUE;
@@ -103,11 +110,22 @@ static bool cmd_compress(struct client_command_context *cmd)
 	if (value == NULL || str_to_uint(value, &level) < 0 ||
 	    level <= 0 || level > 9)
 		level = IMAP_COMPRESS_DEFAULT_LEVEL;
+	/* with deflate the level can be lowered down to this when the
+	   client reads the output as fast as it's written */
+	value = mail_user_plugin_getenv(client->user,
+					"imap_zlib_compress_min_level");
+	if (value == NULL || str_to_uint(value, &min_level) < 0 ||
+	    min_level <= 0 || min_level > level)
+		min_level = level;
 
 	old_input = client->input;
 	old_output = client->output;
 	client->input = handler->create_istream(old_input, FALSE);
 	client->output = handler->create_ostream(old_output, level);
+	if (min_level < level && strcmp(handler->name, "deflate") == 0) {
+		o_stream_deflate_set_adaptive_level(client->output,
+						    min_level, level);
+	}
 	/* preserve output offset so that the bytes out counter in logout
 	   message doesn't get reset here */
 	client->output->offset = old_output->offset;
@@ -135,6 +153,7 @@ imap_zlib_state_export(struct client *client, bool internal,
 static void imap_zlib_client_created(struct client **clientp)
 {
 	struct client *client = *clientp;
+	const struct compression_handler *handler;
 	struct zlib_client *zclient;
 
 	if (mail_user_is_plugin_loaded(client->user, imap_zlib_module) &&
@@ -146,6 +165,15 @@ static void imap_zlib_client_created(struct client **clientp)
 		(*clientp)->v.state_export = imap_zlib_state_export;
 
 		client_add_capability(*clientp, "COMPRESS=DEFLATE");
+
+		/* Non-standard, so it needs to be explicitly enabled */
+		handler = compression_lookup_handler("zstd");
+		if (handler != NULL && handler->create_istream != NULL &&
+		    mail_user_plugin_getenv_bool(client->user,
+						 "imap_zlib_compress_zstd")) {
+			zclient->zstd_enabled = TRUE;
+			client_add_capability(*clientp, "COMPRESS=ZSTD");
+		}
 	}
 
 	if (next_hook_client_created != NULL)
@@ -60,5 +60,6 @@ const struct fs fs_class_crypt = {
 		fs_wrapper_iter_deinit,
 		NULL,
 		fs_wrapper_get_nlinks,
+		fs_wrapper_delete_bulk,
 	}
 };
@@ -10,6 +10,7 @@
 #include "mail-crypt-common.h"
 #include "mail-crypt-key.h"
 #include "mail-crypt-plugin.h"
+#include "mail-crypt-keycache-client.h"
 #include "mail-user.h"
 #include "hex-binary.h"
 #include "safe-memset.h"
@@ -271,7 +272,23 @@ int mail_crypt_decrypt_private_key(struct mailbox *box, const char *pubid,
 		}
 	}
 
-	bool res = dcrypt_key_load_private(&key, data, pw, dec_key, error_r);
+	bool cached = FALSE;
+	if (pw != NULL) {
+		/* password KDF is expensive, see if another session already
+		   did it */
+		const char *cache_error;
+		ret = mail_crypt_keycache_lookup(user, pubid, data, pw, &key,
+						 &cache_error);
+		if (ret < 0) {
+			e_error(user->event, "mail-crypt: "
+				"Key cache lookup for %s failed: %s",
+				pubid, cache_error);
+		}
+		cached = ret > 0;
+	}
+
+	bool res = cached ||
+		dcrypt_key_load_private(&key, data, pw, dec_key, error_r);
 
 	if (dec_key != NULL)
 		dcrypt_key_unref_private(&dec_key);
@@ -287,6 +304,15 @@ int mail_crypt_decrypt_private_key(struct mailbox *box, const char *pubid,
 
 	i_assert(key != NULL);
 
+	const char *cache_error;
+	if (pw != NULL && !cached &&
+	    mail_crypt_keycache_store(user, pubid, data, pw, key,
+				      &cache_error) < 0) {
+		e_error(user->event, "mail-crypt: "
+			"Key cache update for %s failed: %s",
+			pubid, cache_error);
+	}
+
 	*key_r = key;
 
 	return 1;
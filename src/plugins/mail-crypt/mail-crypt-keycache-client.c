@@ -0,0 +1,311 @@
+/* Copyright (c) 2018 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "str.h"
+#include "net.h"
+#include "istream.h"
+#include "write-full.h"
+#include "hex-binary.h"
+#include "sha2.h"
+#include "randgen.h"
+#include "safe-memset.h"
+#include "dcrypt.h"
+#include "mail-user.h"
+#include "mail-crypt-key.h"
+#include "mail-crypt-plugin.h"
+#include "mail-crypt-keycache-client.h"
+
+#include <unistd.h>
+
+#define MAIL_CRYPT_KEYCACHE_TIMEOUT_SECS 5
+#define MAIL_CRYPT_KEYCACHE_CIPHER "aes-256-gcm"
+#define MAIL_CRYPT_KEYCACHE_IV_SIZE 12
+#define MAIL_CRYPT_KEYCACHE_TAG_SIZE 16
+#define MAIL_CRYPT_KEYCACHE_KEY_SIZE 32
+#define MAIL_CRYPT_KEYCACHE_KDF_HASH "sha256"
+#define MAIL_CRYPT_KEYCACHE_KDF_MIN_ROUNDS 2048
+
+#define MAIL_CRYPT_KEYCACHE_HANDSHAKE \
+	"VERSION\t"MAIL_CRYPT_KEYCACHE_SERVICE_NAME"\t1\t0\n"
+
+struct mail_crypt_keycache_secret {
+	unsigned char key[MAIL_CRYPT_KEYCACHE_KEY_SIZE];
+	const char *id;
+};
+
+static void
+mail_crypt_keycache_get_kdf(const char *key_data,
+			    const char **hash_r, unsigned int *rounds_r)
+{
+	const char *const *fields = t_strsplit(key_data, ":\t");
+
+	*hash_r = MAIL_CRYPT_KEYCACHE_KDF_HASH;
+	*rounds_r = MAIL_CRYPT_KEYCACHE_KDF_MIN_ROUNDS;
+
+	/* use the same PBKDF2 parameters as the password encrypted key
+	   itself, so brute forcing the password using the cache is at least
+	   as expensive as brute forcing the stored key:
+	   2 : oid : enctype : cipher : salt : hash : rounds : data : id */
+	if (str_array_length(fields) == 9 && strcmp(fields[0], "2") == 0 &&
+	    strcmp(fields[2], "2") == 0) {
+		unsigned int rounds;
+
+		if (str_to_uint(fields[6], &rounds) == 0 &&
+		    rounds > *rounds_r)
+			*rounds_r = rounds;
+		*hash_r = fields[5];
+	}
+}
+
+static int
+mail_crypt_keycache_secret_init(struct mail_user *user, const char *pubid,
+				const char *key_data, const char *password,
+				struct mail_crypt_keycache_secret *secret_r,
+				const char **error_r)
+{
+	unsigned char id[SHA256_RESULTLEN];
+	const char *hash;
+	unsigned int rounds;
+	string_t *salt;
+	buffer_t *result;
+	bool res;
+
+	mail_crypt_keycache_get_kdf(key_data, &hash, &rounds);
+
+	/* key + idkey = PBKDF2(password, service \0 username \0 pubid),
+	   id = SHA256(idkey) */
+	salt = t_str_new(128);
+	str_append_data(salt, MAIL_CRYPT_KEYCACHE_SERVICE_NAME,
+			sizeof(MAIL_CRYPT_KEYCACHE_SERVICE_NAME));
+	str_append_data(salt, user->username, strlen(user->username) + 1);
+	str_append(salt, pubid);
+
+	result = t_buffer_create(MAIL_CRYPT_KEYCACHE_KEY_SIZE*2);
+	res = dcrypt_pbkdf2((const unsigned char *)password, strlen(password),
+			    str_data(salt), str_len(salt), hash, rounds,
+			    result, MAIL_CRYPT_KEYCACHE_KEY_SIZE*2, error_r);
+	if (res && result->used != MAIL_CRYPT_KEYCACHE_KEY_SIZE*2) {
+		*error_r = "PBKDF2 returned too little data";
+		res = FALSE;
+	}
+	if (res) {
+		const unsigned char *ptr = result->data;
+
+		memcpy(secret_r->key, ptr, MAIL_CRYPT_KEYCACHE_KEY_SIZE);
+		sha256_get_digest(ptr + MAIL_CRYPT_KEYCACHE_KEY_SIZE,
+				  MAIL_CRYPT_KEYCACHE_KEY_SIZE, id);
+		secret_r->id = binary_to_hex(id, sizeof(id));
+	}
+	safe_memset(buffer_get_modifiable_data(result, NULL), 0,
+		    result->used);
+	return res ? 0 : -1;
+}
+
+static int
+mail_crypt_keycache_query(struct mail_user *user, const char *cmd,
+			  const char **reply_r, const char **error_r)
+{
+	struct mail_crypt_user *muser = mail_crypt_get_mail_crypt_user(user);
+	const char *path = muser->keycache_socket_path;
+	struct istream *input;
+	const char *line;
+	string_t *str;
+	int fd, ret = -1;
+
+	fd = net_connect_unix(path);
+	if (fd == -1) {
+		*error_r = t_strdup_printf("net_connect_unix(%s) failed: %m",
+					   path);
+		return -1;
+	}
+	net_set_nonblock(fd, FALSE);
+	input = i_stream_create_fd(fd, MAIL_CRYPT_KEYCACHE_MAX_LINE_LENGTH);
+
+	str = t_str_new(256);
+	str_append(str, MAIL_CRYPT_KEYCACHE_HANDSHAKE);
+	str_append(str, cmd);
+	str_append_c(str, '\n');
+
+	alarm(MAIL_CRYPT_KEYCACHE_TIMEOUT_SECS);
+	if (write_full(fd, str_data(str), str_len(str)) < 0) {
+		*error_r = t_strdup_printf("write(%s) failed: %m", path);
+	} else if ((line = i_stream_read_next_line(input)) != NULL &&
+		   !str_begins(line, "VERSION\t"
+			       MAIL_CRYPT_KEYCACHE_SERVICE_NAME"\t1\t")) {
+		*error_r = t_strdup_printf("%s: Invalid handshake: %s",
+					   path, line);
+	} else if (line == NULL ||
+		   (line = i_stream_read_next_line(input)) == NULL) {
+		if (input->stream_errno == EINTR) {
+			*error_r = t_strdup_printf("%s: Timeout in %u secs",
+				path, MAIL_CRYPT_KEYCACHE_TIMEOUT_SECS);
+		} else if (input->stream_errno != 0) {
+			*error_r = t_strdup_printf("read(%s) failed: %s",
+				path, i_stream_get_error(input));
+		} else {
+			*error_r = t_strdup_printf("read(%s) failed: EOF",
+						   path);
+		}
+	} else {
+		*reply_r = t_strdup(line);
+		ret = 0;
+	}
+	alarm(0);
+
+	safe_memset(str_c_modifiable(str), 0, str_len(str));
+	i_stream_destroy(&input);
+	if (close(fd) < 0)
+		i_error("close(%s) failed: %m", path);
+	return ret;
+}
+
+int mail_crypt_keycache_lookup(struct mail_user *user, const char *pubid,
+			       const char *key_data, const char *password,
+			       struct dcrypt_private_key **key_r,
+			       const char **error_r)
+{
+	struct mail_crypt_user *muser = mail_crypt_get_mail_crypt_user(user);
+	struct mail_crypt_keycache_secret secret;
+	struct dcrypt_context_symmetric *dctx;
+	const char *reply;
+	buffer_t *value, *data;
+	bool res;
+
+	if (muser->keycache_socket_path == NULL)
+		return 0;
+
+	if (mail_crypt_keycache_secret_init(user, pubid, key_data, password,
+					    &secret, error_r) < 0)
+		return -1;
+	if (mail_crypt_keycache_query(user, t_strconcat("GET\t", secret.id, NULL),
+				      &reply, error_r) < 0) {
+		safe_memset(secret.key, 0, sizeof(secret.key));
+		return -1;
+	}
+	if (strcmp(reply, "-") == 0) {
+		safe_memset(secret.key, 0, sizeof(secret.key));
+		return 0;
+	}
+	if (!str_begins(reply, "+\t")) {
+		safe_memset(secret.key, 0, sizeof(secret.key));
+		*error_r = t_strdup_printf("Invalid key cache reply: %s", reply);
+		return -1;
+	}
+
+	/* <hex(iv + tag + encrypted key)> */
+	value = t_buffer_create(strlen(reply) / 2);
+	if (hex_to_binary(reply + 2, value) < 0 ||
+	    value->used <= MAIL_CRYPT_KEYCACHE_IV_SIZE +
+			   MAIL_CRYPT_KEYCACHE_TAG_SIZE) {
+		safe_memset(secret.key, 0, sizeof(secret.key));
+		*error_r = "Invalid key cache reply: Corrupted key data";
+		return -1;
+	}
+	const unsigned char *ptr = value->data;
+
+	if (!dcrypt_ctx_sym_create(MAIL_CRYPT_KEYCACHE_CIPHER,
+				   DCRYPT_MODE_DECRYPT, &dctx, error_r)) {
+		safe_memset(secret.key, 0, sizeof(secret.key));
+		return -1;
+	}
+	dcrypt_ctx_sym_set_key(dctx, secret.key, sizeof(secret.key));
+	safe_memset(secret.key, 0, sizeof(secret.key));
+	dcrypt_ctx_sym_set_iv(dctx, ptr, MAIL_CRYPT_KEYCACHE_IV_SIZE);
+	dcrypt_ctx_sym_set_tag(dctx, ptr + MAIL_CRYPT_KEYCACHE_IV_SIZE,
+			       MAIL_CRYPT_KEYCACHE_TAG_SIZE);
+	dcrypt_ctx_sym_set_aad(dctx, (const unsigned char *)secret.id,
+			       strlen(secret.id));
+
+	data = t_buffer_create(value->used + 1);
+	res = dcrypt_ctx_sym_init(dctx, error_r) &&
+		dcrypt_ctx_sym_update(dctx,
+			ptr + MAIL_CRYPT_KEYCACHE_IV_SIZE +
+			MAIL_CRYPT_KEYCACHE_TAG_SIZE,
+			value->used - MAIL_CRYPT_KEYCACHE_IV_SIZE -
+			MAIL_CRYPT_KEYCACHE_TAG_SIZE, data, error_r) &&
+		dcrypt_ctx_sym_final(dctx, data, error_r);
+	dcrypt_ctx_sym_destroy(&dctx);
+
+	if (res) {
+		res = dcrypt_key_load_private(key_r, str_c(data), NULL, NULL,
+					      error_r);
+	}
+	safe_memset(buffer_get_modifiable_data(data, NULL), 0, data->used);
+	return res ? 1 : -1;
+}
+
+int mail_crypt_keycache_store(struct mail_user *user, const char *pubid,
+			      const char *key_data, const char *password,
+			      struct dcrypt_private_key *key,
+			      const char **error_r)
+{
+	struct mail_crypt_user *muser = mail_crypt_get_mail_crypt_user(user);
+	struct mail_crypt_keycache_secret secret;
+	struct dcrypt_context_symmetric *dctx;
+	unsigned char iv[MAIL_CRYPT_KEYCACHE_IV_SIZE];
+	buffer_t *data, *value;
+	const char *reply;
+	bool res;
+
+	if (muser->keycache_socket_path == NULL)
+		return 0;
+
+	data = t_buffer_create(256);
+	if (!dcrypt_key_store_private(key, DCRYPT_FORMAT_DOVECOT, NULL, data,
+				      NULL, NULL, error_r))
+		return -1;
+
+	if (mail_crypt_keycache_secret_init(user, pubid, key_data, password,
+					    &secret, error_r) < 0) {
+		safe_memset(buffer_get_modifiable_data(data, NULL), 0,
+			    data->used);
+		return -1;
+	}
+	if (!dcrypt_ctx_sym_create(MAIL_CRYPT_KEYCACHE_CIPHER,
+				   DCRYPT_MODE_ENCRYPT, &dctx, error_r)) {
+		safe_memset(secret.key, 0, sizeof(secret.key));
+		safe_memset(buffer_get_modifiable_data(data, NULL), 0,
+			    data->used);
+		return -1;
+	}
+	random_fill(iv, sizeof(iv));
+	dcrypt_ctx_sym_set_key(dctx, secret.key, sizeof(secret.key));
+	safe_memset(secret.key, 0, sizeof(secret.key));
+	dcrypt_ctx_sym_set_iv(dctx, iv, sizeof(iv));
+	dcrypt_ctx_sym_set_aad(dctx, (const unsigned char *)secret.id,
+			       strlen(secret.id));
+
+	/* <iv> <tag> <encrypted key> */
+	value = t_buffer_create(data->used + 64);
+	buffer_append(value, iv, sizeof(iv));
+	buffer_append_zero(value, MAIL_CRYPT_KEYCACHE_TAG_SIZE);
+	res = dcrypt_ctx_sym_init(dctx, error_r) &&
+		dcrypt_ctx_sym_update(dctx, data->data, data->used,
+				      value, error_r) &&
+		dcrypt_ctx_sym_final(dctx, value, error_r);
+	safe_memset(buffer_get_modifiable_data(data, NULL), 0, data->used);
+	if (res) {
+		buffer_t *tag = t_buffer_create(MAIL_CRYPT_KEYCACHE_TAG_SIZE);
+		if (!dcrypt_ctx_sym_get_tag(dctx, tag) ||
+		    tag->used != MAIL_CRYPT_KEYCACHE_TAG_SIZE) {
+			*error_r = "Failed to get the key cache encryption tag";
+			res = FALSE;
+		} else {
+			buffer_write(value, sizeof(iv), tag->data, tag->used);
+		}
+	}
+	dcrypt_ctx_sym_destroy(&dctx);
+	if (!res)
+		return -1;
+
+	if (mail_crypt_keycache_query(user,
+			t_strdup_printf("PUT\t%s\t%s", secret.id,
+					binary_to_hex(value->data, value->used)),
+			&reply, error_r) < 0)
+		return -1;
+	if (strcmp(reply, "+") != 0) {
+		*error_r = t_strdup_printf("Invalid key cache reply: %s", reply);
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,37 @@
+#ifndef MAIL_CRYPT_KEYCACHE_CLIENT_H
+#define MAIL_CRYPT_KEYCACHE_CLIENT_H
+
+/* Client for the mail-crypt-keycache service, which caches password
+   protected private keys after they have been unlocked once, so that
+   parallel sessions don't all need to run the expensive key derivation.
+
+   The cache entry ID and the key used to encrypt the cached private key are
+   both derived from the password with the same PBKDF2 hash and rounds as
+   the stored key uses. So the service never sees the private key in
+   plaintext, the entry can't be found without the password and the IDs
+   don't make brute forcing the password any cheaper than the stored key
+   does. */
+
+#define MAIL_CRYPT_KEYCACHE_SERVICE_NAME "mail-crypt-keycache"
+#define MAIL_CRYPT_KEYCACHE_VERSION_MAJOR 1
+#define MAIL_CRYPT_KEYCACHE_VERSION_MINOR 0
+#define MAIL_CRYPT_KEYCACHE_MAX_LINE_LENGTH (64*1024)
+
+struct mail_user;
+struct dcrypt_private_key;
+
+/* Look up the private key for pubid unlocked with the password. key_data is
+   the stored password encrypted key. Returns 1 if found, 0 if not, -1 on
+   error. */
+int mail_crypt_keycache_lookup(struct mail_user *user, const char *pubid,
+			       const char *key_data, const char *password,
+			       struct dcrypt_private_key **key_r,
+			       const char **error_r);
+/* Add the unlocked private key to the cache. Returns 0 on success, -1 on
+   error. */
+int mail_crypt_keycache_store(struct mail_user *user, const char *pubid,
+			      const char *key_data, const char *password,
+			      struct dcrypt_private_key *key,
+			      const char **error_r);
+
+#endif
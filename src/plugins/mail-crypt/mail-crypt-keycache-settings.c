@@ -0,0 +1,50 @@
+/* Copyright (c) 2018 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "buffer.h"
+#include "settings-parser.h"
+#include "service-settings.h"
+
+#include <stddef.h>
+
+/* <settings checks> */
+static struct file_listener_settings mail_crypt_keycache_unix_listeners_array[] = {
+	{ "mail-crypt-keycache", 0660, "", "$default_internal_group" }
+};
+static struct file_listener_settings *mail_crypt_keycache_unix_listeners[] = {
+	&mail_crypt_keycache_unix_listeners_array[0]
+};
+static buffer_t mail_crypt_keycache_unix_listeners_buf = {
+	mail_crypt_keycache_unix_listeners,
+	sizeof(mail_crypt_keycache_unix_listeners), { NULL, }
+};
+/* </settings checks> */
+
+struct service_settings mail_crypt_keycache_service_settings = {
+	.name = "mail-crypt-keycache",
+	.protocol = "",
+	.type = "",
+	.executable = "mail-crypt-keycache",
+	.user = "$default_internal_user",
+	.group = "",
+	.privileged_group = "",
+	.extra_groups = "",
+	.chroot = "",
+
+	.drop_priv_before_exec = FALSE,
+
+	/* all the cached keys are in this one process, keep it running */
+	.process_min_avail = 0,
+	.process_limit = 1,
+	.client_limit = 1000,
+	.service_count = 0,
+	.idle_kill = UINT_MAX,
+	.vsz_limit = (uoff_t)-1,
+
+	.unix_listeners = { { &mail_crypt_keycache_unix_listeners_buf,
+			      sizeof(mail_crypt_keycache_unix_listeners[0]) } },
+	.fifo_listeners = ARRAY_INIT,
+	.inet_listeners = ARRAY_INIT,
+
+	.process_limit_1 = TRUE
+};
@@ -0,0 +1,252 @@
+/* Copyright (c) 2018 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "llist.h"
+#include "hash.h"
+#include "safe-memset.h"
+#include "settings-parser.h"
+#include "ostream.h"
+#include "connection.h"
+#include "restrict-access.h"
+#include "master-service.h"
+#include "mail-crypt-keycache-client.h"
+
+#include <sys/mman.h>
+
+/* The cache only ever sees opaque IDs and encrypted key blobs. The IDs and
+   the encryption keys are derived from the user's password by the
+   mail-crypt plugin using the stored key's own PBKDF2 parameters, so the
+   cached data is useless without knowing the password. Still, keep the process memory out of swap and core dumps. */
+
+#define MAIL_CRYPT_KEYCACHE_DEFAULT_TTL_SECS (30*60)
+/* keep the expire timeout's msecs within int */
+#define MAIL_CRYPT_KEYCACHE_MAX_TTL_SECS (7*24*60*60)
+#define MAIL_CRYPT_KEYCACHE_DEFAULT_MAX_ENTRIES 10000
+#define MAIL_CRYPT_KEYCACHE_CLIENT_IDLE_TIMEOUT_SECS 60
+
+struct keycache_entry {
+	struct keycache_entry *prev, *next;
+
+	char *id;
+	char *value;
+	time_t expires;
+};
+
+struct keycache_client {
+	struct connection conn;
+};
+
+static struct connection_list *clients;
+static HASH_TABLE(char *, struct keycache_entry *) entries;
+/* sorted by expire time */
+static struct keycache_entry *entries_head, *entries_tail;
+static unsigned int entries_count;
+static struct timeout *to_expire;
+
+static unsigned int keycache_ttl_secs = MAIL_CRYPT_KEYCACHE_DEFAULT_TTL_SECS;
+static unsigned int keycache_max_entries =
+	MAIL_CRYPT_KEYCACHE_DEFAULT_MAX_ENTRIES;
+
+static void keycache_expire(void *context);
+
+static void keycache_entry_free(struct keycache_entry *entry)
+{
+	hash_table_remove(entries, entry->id);
+	DLLIST2_REMOVE(&entries_head, &entries_tail, entry);
+	entries_count--;
+
+	safe_memset(entry->value, 0, strlen(entry->value));
+	i_free(entry->value);
+	i_free(entry->id);
+	i_free(entry);
+}
+
+static void keycache_expire_update(void)
+{
+	timeout_remove(&to_expire);
+	if (entries_head == NULL)
+		return;
+
+	time_t secs = entries_head->expires - ioloop_time;
+	if (secs < 0)
+		secs = 0;
+	to_expire = timeout_add(secs * 1000, keycache_expire, NULL);
+}
+
+static void keycache_expire(void *context ATTR_UNUSED)
+{
+	while (entries_head != NULL && entries_head->expires <= ioloop_time)
+		keycache_entry_free(entries_head);
+	keycache_expire_update();
+}
+
+static const char *keycache_get(const char *id)
+{
+	struct keycache_entry *entry;
+
+	entry = hash_table_lookup(entries, id);
+	if (entry == NULL)
+		return NULL;
+	if (entry->expires <= ioloop_time) {
+		keycache_entry_free(entry);
+		keycache_expire_update();
+		return NULL;
+	}
+	return entry->value;
+}
+
+static void keycache_put(const char *id, const char *value)
+{
+	struct keycache_entry *entry;
+
+	entry = hash_table_lookup(entries, id);
+	if (entry != NULL)
+		keycache_entry_free(entry);
+	else if (entries_count >= keycache_max_entries)
+		keycache_entry_free(entries_head);
+
+	entry = i_new(struct keycache_entry, 1);
+	entry->id = i_strdup(id);
+	entry->value = i_strdup(value);
+	entry->expires = ioloop_time + keycache_ttl_secs;
+	hash_table_insert(entries, entry->id, entry);
+	DLLIST2_APPEND(&entries_head, &entries_tail, entry);
+	entries_count++;
+
+	if (to_expire == NULL)
+		keycache_expire_update();
+}
+
+static int
+keycache_client_input_args(struct connection *conn, const char *const *args)
+{
+	const char *value;
+
+	if (args[0] == NULL) {
+		e_error(conn->event, "Empty command");
+		return -1;
+	}
+	if (strcmp(args[0], "GET") == 0 && args[1] != NULL) {
+		/* GET <id> */
+		value = keycache_get(args[1]);
+		if (value == NULL)
+			o_stream_nsend_str(conn->output, "-\n");
+		else {
+			o_stream_nsend_str(conn->output,
+				t_strconcat("+\t", value, "\n", NULL));
+		}
+		return 1;
+	}
+	if (strcmp(args[0], "PUT") == 0 &&
+	    args[1] != NULL && args[2] != NULL) {
+		/* PUT <id> <value> */
+		keycache_put(args[1], args[2]);
+		o_stream_nsend_str(conn->output, "+\n");
+		return 1;
+	}
+	e_error(conn->event, "Unknown command: %s", args[0]);
+	return -1;
+}
+
+static void keycache_client_destroy(struct connection *conn)
+{
+	struct keycache_client *client = (struct keycache_client *)conn;
+
+	connection_deinit(&client->conn);
+	i_free(client);
+
+	master_service_client_connection_destroyed(master_service);
+}
+
+static struct connection_settings client_set = {
+	.service_name_in = MAIL_CRYPT_KEYCACHE_SERVICE_NAME,
+	.service_name_out = MAIL_CRYPT_KEYCACHE_SERVICE_NAME,
+	.major_version = MAIL_CRYPT_KEYCACHE_VERSION_MAJOR,
+	.minor_version = MAIL_CRYPT_KEYCACHE_VERSION_MINOR,
+	.input_max_size = MAIL_CRYPT_KEYCACHE_MAX_LINE_LENGTH,
+	.output_max_size = (size_t)-1,
+	.input_idle_timeout_secs = MAIL_CRYPT_KEYCACHE_CLIENT_IDLE_TIMEOUT_SECS,
+	.client = FALSE
+};
+
+static const struct connection_vfuncs client_vfuncs = {
+	.destroy = keycache_client_destroy,
+	.input_args = keycache_client_input_args
+};
+
+static void client_connected(struct master_service_connection *conn)
+{
+	struct keycache_client *client;
+
+	client = i_new(struct keycache_client, 1);
+	connection_init_server(clients, &client->conn,
+			       "mail-crypt-keycache", conn->fd, conn->fd);
+	master_service_client_connection_accept(conn);
+}
+
+static void main_preinit(void)
+{
+#ifdef MCL_CURRENT
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+		i_warning("mlockall() failed: %m - cached keys may be swapped");
+#endif
+	restrict_access_by_env(RESTRICT_ACCESS_FLAG_ALLOW_ROOT, NULL);
+	restrict_access_allow_coredumps(FALSE);
+}
+
+static void main_init(void)
+{
+	hash_table_create(&entries, default_pool, 0, str_hash, strcmp);
+	clients = connection_list_init(&client_set, &client_vfuncs);
+}
+
+static void main_deinit(void)
+{
+	connection_list_deinit(&clients);
+	while (entries_head != NULL)
+		keycache_entry_free(entries_head);
+	timeout_remove(&to_expire);
+	hash_table_destroy(&entries);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *error;
+	int c;
+
+	master_service = master_service_init("mail-crypt-keycache", 0,
+					     &argc, &argv, "n:t:");
+	while ((c = master_getopt(master_service)) > 0) {
+		switch (c) {
+		case 'n':
+			if (str_to_uint(optarg, &keycache_max_entries) < 0 ||
+			    keycache_max_entries == 0)
+				i_fatal("Invalid -n parameter: '%s'", optarg);
+			break;
+		case 't':
+			if (settings_get_time(optarg, &keycache_ttl_secs,
+					      &error) < 0)
+				i_fatal("Invalid -t parameter: %s", error);
+			if (keycache_ttl_secs == 0 ||
+			    keycache_ttl_secs > MAIL_CRYPT_KEYCACHE_MAX_TTL_SECS) {
+				i_fatal("Invalid -t parameter: '%s' "
+					"(must be 1s .. %u secs)", optarg,
+					MAIL_CRYPT_KEYCACHE_MAX_TTL_SECS);
+			}
+			break;
+		default:
+			return FATAL_DEFAULT;
+		}
+	}
+
+	master_service_init_log(master_service, "mail-crypt-keycache: ");
+	main_preinit();
+
+	main_init();
+	master_service_init_finish(master_service);
+	master_service_run(master_service, client_connected);
+	main_deinit();
+	master_service_deinit(&master_service);
+	return 0;
+}
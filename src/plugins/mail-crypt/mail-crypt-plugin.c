@@ -263,6 +263,9 @@ mail_crypt_mail_save_begin(struct mail_save_context *ctx,
 		enc_flags = IO_STREAM_ENC_VERSION_1;
 	} else if (muser->save_version == 2) {
 		enc_flags = IO_STREAM_ENC_INTEGRITY_AEAD;
+	} else if (muser->save_version == 3) {
+		enc_flags = IO_STREAM_ENC_INTEGRITY_AEAD |
+			IO_STREAM_ENC_VERSION_3;
 	} else {
 		i_assert(muser->save_version == 0);
 		i_panic("mail_crypt_mail_save_begin not supposed to be called"
@@ -422,6 +425,15 @@ static void mail_crypt_mail_user_created(struct mail_user *user)
 		muser->curve = p_strdup(user->pool, curve);
 	}
 
+	const char *keycache = mail_user_plugin_getenv(user,
+			"mail_crypt_keycache_socket");
+	if (keycache != NULL && *keycache != '\0') {
+		muser->keycache_socket_path = *keycache == '/' ?
+			p_strdup(user->pool, keycache) :
+			p_strconcat(user->pool, user->set->base_dir, "/",
+				    keycache, NULL);
+	}
+
 	const char *version = mail_user_plugin_getenv(user,
 			"mail_crypt_save_version");
 
@@ -436,10 +448,12 @@ static void mail_crypt_mail_user_created(struct mail_user *user)
 		muser->save_version = 1;
 	} else if (version[0] == '2') {
 		muser->save_version = 2;
+	} else if (version[0] == '3') {
+		muser->save_version = 3;
 	} else {
 		user->error = p_strdup_printf(user->pool,
 				"mail_crypt_plugin: Invalid "
-				"mail_crypt_save_version %s: use 0, 1, or 2 ",
+				"mail_crypt_save_version %s: use 0, 1, 2 or 3 ",
 				version);
 	}
 
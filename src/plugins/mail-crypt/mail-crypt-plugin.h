@@ -19,6 +19,8 @@ struct mail_crypt_user {
 	struct mail_crypt_cache cache;
 	struct mail_crypt_key_cache_entry *key_cache;
 	const char *curve;
+	/* NULL if the unlocked key cache service isn't used */
+	const char *keycache_socket_path;
 	int save_version;
 };
 
@@ -1,6 +1,8 @@
 /* Copyright (c) 2015-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
+#include "strescape.h"
 #include "test-common.h"
 #include "ioloop.h"
 #include "lib-signals.h"
@@ -17,10 +19,18 @@
 #include "randgen.h"
 #include "dcrypt.h"
 #include "hex-binary.h"
+#include "net.h"
+#include "istream.h"
+#include "write-full.h"
 
 #include "mail-crypt-common.h"
 #include "mail-crypt-key.h"
 #include "mail-crypt-plugin.h"
+#include "mail-crypt-keycache-client.h"
+
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
 
 static const char *mcp_old_user_key = "1\t716\t0\t048FD04FD3612B22D32790C592CF21CEF417EFD2EA34AE5F688FA5B51BED29E05A308B68DA78E16E90B47A11E133BD9A208A2894FD01B0BEE865CE339EA3FB17AC\td0cfaca5d335f9edc41c84bb47465184cb0e2ec3931bebfcea4dd433615e77a0";
 static const char *mcp_old_user_key_id = "d0cfaca5d335f9edc41c84bb47465184cb0e2ec3931bebfcea4dd433615e77a0";
@@ -444,6 +454,124 @@ static void test_old_key(void)
 	test_end();
 }
 
+#define TEST_KEYCACHE_MAX_ENTRIES 8
+
+static void test_keycache_server_client(int fd, ARRAY_TYPE(const_string) *entries)
+{
+	struct istream *input;
+	const char *line, *const *args, *reply = "-";
+
+	input = i_stream_create_fd(fd, MAIL_CRYPT_KEYCACHE_MAX_LINE_LENGTH);
+	if ((line = i_stream_read_next_line(input)) == NULL ||
+	    (line = i_stream_read_next_line(input)) == NULL) {
+		i_stream_destroy(&input);
+		return;
+	}
+	args = t_strsplit_tabescaped(line);
+	if (strcmp(args[0], "GET") == 0) {
+		const char *const *entry;
+
+		array_foreach(entries, entry) {
+			if (strcmp(t_strcut(*entry, '\t'), args[1]) == 0)
+				reply = t_strdup_printf("+\t%s",
+					strchr(*entry, '\t') + 1);
+		}
+	} else if (array_count(entries) < TEST_KEYCACHE_MAX_ENTRIES) {
+		line = i_strdup_printf("%s\t%s", args[1], args[2]);
+		array_append(entries, &line, 1);
+		reply = "+";
+	}
+	reply = t_strdup_printf("VERSION\t"MAIL_CRYPT_KEYCACHE_SERVICE_NAME
+				"\t1\t0\n%s\n", reply);
+	(void)write_full(fd, reply, strlen(reply));
+	i_stream_destroy(&input);
+}
+
+static pid_t test_keycache_server_start(const char *path)
+{
+	ARRAY_TYPE(const_string) entries;
+	pid_t pid;
+	int fd_listen, fd;
+
+	if ((fd_listen = net_listen_unix(path, 16)) == -1)
+		i_fatal("net_listen_unix(%s) failed: %m", path);
+	if ((pid = fork()) == (pid_t)-1)
+		i_fatal("fork() failed: %m");
+	if (pid != 0) {
+		i_close_fd(&fd_listen);
+		return pid;
+	}
+
+	/* child: minimal blocking key cache server */
+	i_array_init(&entries, TEST_KEYCACHE_MAX_ENTRIES);
+	net_set_nonblock(fd_listen, FALSE);
+	for (;;) {
+		if ((fd = net_accept(fd_listen, NULL, NULL)) < 0)
+			continue;
+		net_set_nonblock(fd, FALSE);
+		T_BEGIN {
+			test_keycache_server_client(fd, &entries);
+		} T_END;
+		i_close_fd(&fd);
+	}
+}
+
+static void test_keycache(void)
+{
+	struct mail_crypt_user *muser =
+		mail_crypt_get_mail_crypt_user(test_mail_user);
+	struct dcrypt_keypair pair;
+	struct dcrypt_private_key *key = NULL;
+	const char *path, *pubid, *error;
+	string_t *key_data;
+	buffer_t *key_id;
+	pid_t pid;
+
+	test_begin("key cache");
+
+	path = t_strdup_printf("%s/keycache", mail_home);
+	pid = test_keycache_server_start(path);
+	muser->keycache_socket_path = path;
+
+	test_assert(dcrypt_keypair_generate(&pair, DCRYPT_KEY_EC, 0,
+					    "prime256v1", &error));
+	key_id = t_buffer_create(MAIL_CRYPT_HASH_BUF_SIZE);
+	test_assert(dcrypt_key_id_private(pair.priv,
+					  MAIL_CRYPT_KEY_ID_ALGORITHM,
+					  key_id, &error));
+	pubid = binary_to_hex(key_id->data, key_id->used);
+	key_data = t_str_new(256);
+	test_assert(dcrypt_key_store_private(pair.priv, DCRYPT_FORMAT_DOVECOT,
+					     "aes-256-ctr", key_data, "pass",
+					     NULL, &error));
+
+	/* not cached yet */
+	test_assert(mail_crypt_keycache_lookup(test_mail_user, pubid,
+					       str_c(key_data), "pass",
+					       &key, &error) == 0);
+	test_assert(mail_crypt_keycache_store(test_mail_user, pubid,
+					      str_c(key_data), "pass",
+					      pair.priv, &error) == 0);
+	/* cached key is found only with the right password */
+	test_assert(mail_crypt_keycache_lookup(test_mail_user, pubid,
+					       str_c(key_data), "wrong",
+					       &key, &error) == 0);
+	test_assert(mail_crypt_keycache_lookup(test_mail_user, pubid,
+					       str_c(key_data), "pass",
+					       &key, &error) == 1);
+	test_assert(key != NULL &&
+		    mail_crypt_private_key_id_match(key, pubid, &error) == 1);
+	if (key != NULL)
+		dcrypt_key_unref_private(&key);
+	dcrypt_keypair_unref(&pair);
+
+	muser->keycache_socket_path = NULL;
+	(void)kill(pid, SIGKILL);
+	(void)waitpid(pid, NULL, 0);
+	i_unlink(path);
+	test_end();
+}
+
 static void test_setup(void)
 {
 	struct dcrypt_settings set = {
@@ -481,6 +609,7 @@ int main(int argc, char **argv)
 		test_cache_reset,
 		test_verify_keys,
 		test_old_key,
+		test_keycache,
 		test_teardown,
 		NULL
 	};
@@ -7,6 +7,10 @@ void notify_contexts_mail_transaction_begin(struct mailbox_transaction_context *
 void notify_contexts_mail_save(struct mail *mail);
 void notify_contexts_mail_copy(struct mail *src, struct mail *dst);
 void notify_contexts_mail_expunge(struct mail *mail);
+/* Returns TRUE if some context wants to know about flag changes */
+bool notify_contexts_want_flag_changes(void);
+/* Returns TRUE if some context wants to know about keyword changes */
+bool notify_contexts_want_keyword_changes(void);
 void notify_contexts_mail_update_flags(struct mail *mail,
 				       enum mail_flags old_flags);
 void notify_contexts_mail_update_keywords(struct mail *mail,
@@ -1,6 +1,7 @@
 /* Copyright (c) 2013-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
 #include "llist.h"
 #include "mail-storage.h"
 #include "notify-plugin-private.h"
@@ -11,6 +12,10 @@ struct notify_mail_txn {
 	struct mailbox_transaction_context *parent_mailbox_txn;
 	struct mail *tmp_mail;
 	void *txn;
+
+	/* only used if mail_transaction_changes() is set */
+	ARRAY_TYPE(seq_range) changed_seqs;
+	struct notify_mail_changes changes;
 };
 
 struct notify_context {
@@ -22,6 +27,8 @@ struct notify_context {
 
 const char *notify_plugin_version = DOVECOT_ABI_VERSION;
 static struct notify_context *ctx_list = NULL;
+static unsigned int flag_changes_ctx_count = 0;
+static unsigned int keyword_changes_ctx_count = 0;
 
 static struct notify_mail_txn *
 notify_context_find_mail_txn(struct notify_context *ctx,
@@ -36,6 +43,22 @@ notify_context_find_mail_txn(struct notify_context *ctx,
 	i_panic("no notify_mail_txn found");
 }
 
+static void notify_mail_txn_free(struct notify_context *ctx,
+				 struct notify_mail_txn *mail_txn)
+{
+	DLLIST_REMOVE(&ctx->mail_txn_list, mail_txn);
+	if (array_is_created(&mail_txn->changed_seqs))
+		array_free(&mail_txn->changed_seqs);
+	i_free(mail_txn);
+}
+
+static void
+notify_mail_txn_add_change(struct notify_mail_txn *mail_txn, struct mail *mail)
+{
+	seq_range_array_add_with_init(&mail_txn->changed_seqs, 32, mail->seq);
+	mail_txn->changes.seqs = &mail_txn->changed_seqs;
+}
+
 void notify_contexts_mail_transaction_begin(struct mailbox_transaction_context *t)
 {
 	struct notify_context *ctx;
@@ -99,10 +122,19 @@ void notify_contexts_mail_update_flags(struct mail *mail,
 		return;
 
 	for (ctx = ctx_list; ctx != NULL; ctx = ctx->next) {
-		if (ctx->v.mail_update_flags == NULL)
+		if (ctx->v.mail_update_flags == NULL &&
+		    ctx->v.mail_transaction_changes == NULL)
 			continue;
 		mail_txn = notify_context_find_mail_txn(ctx, mail->transaction);
-		ctx->v.mail_update_flags(mail_txn->txn, mail, old_flags);
+		if (ctx->v.mail_transaction_changes != NULL) {
+			enum mail_flags new_flags = mail_get_flags(mail);
+
+			notify_mail_txn_add_change(mail_txn, mail);
+			mail_txn->changes.flags_added |= new_flags & ~old_flags;
+			mail_txn->changes.flags_removed |= old_flags & ~new_flags;
+		}
+		if (ctx->v.mail_update_flags != NULL)
+			ctx->v.mail_update_flags(mail_txn->txn, mail, old_flags);
 	}
 }
 
@@ -116,10 +148,18 @@ void notify_contexts_mail_update_keywords(struct mail *mail,
 		return;
 
 	for (ctx = ctx_list; ctx != NULL; ctx = ctx->next) {
-		if (ctx->v.mail_update_keywords == NULL)
+		if (ctx->v.mail_update_keywords == NULL &&
+		    ctx->v.mail_transaction_changes == NULL)
 			continue;
 		mail_txn = notify_context_find_mail_txn(ctx, mail->transaction);
-		ctx->v.mail_update_keywords(mail_txn->txn, mail, old_keywords);
+		if (ctx->v.mail_transaction_changes != NULL) {
+			notify_mail_txn_add_change(mail_txn, mail);
+			mail_txn->changes.keywords_changed = TRUE;
+		}
+		if (ctx->v.mail_update_keywords != NULL) {
+			ctx->v.mail_update_keywords(mail_txn->txn, mail,
+						    old_keywords);
+		}
 	}
 }
 
@@ -130,13 +170,15 @@ void notify_contexts_mail_transaction_commit(struct mailbox_transaction_context
 	struct notify_mail_txn *mail_txn;
 
 	for (ctx = ctx_list; ctx != NULL; ctx = ctx->next) {
-		if (ctx->v.mail_transaction_commit == NULL)
-			continue;
 		mail_txn = notify_context_find_mail_txn(ctx, t);
+		if (ctx->v.mail_transaction_changes != NULL &&
+		    mail_txn->changes.seqs != NULL) {
+			ctx->v.mail_transaction_changes(mail_txn->txn,
+							&mail_txn->changes);
+		}
 		if (ctx->v.mail_transaction_commit != NULL)
 			ctx->v.mail_transaction_commit(mail_txn->txn, changes);
-		DLLIST_REMOVE(&ctx->mail_txn_list, mail_txn);
-		i_free(mail_txn);
+		notify_mail_txn_free(ctx, mail_txn);
 	}
 }
 
@@ -149,8 +191,7 @@ void notify_contexts_mail_transaction_rollback(struct mailbox_transaction_contex
 		mail_txn = notify_context_find_mail_txn(ctx, t);
 		if (ctx->v.mail_transaction_rollback != NULL)
 			ctx->v.mail_transaction_rollback(mail_txn->txn);
-		DLLIST_REMOVE(&ctx->mail_txn_list, mail_txn);
-		i_free(mail_txn);
+		notify_mail_txn_free(ctx, mail_txn);
 	}
 }
 
@@ -230,6 +271,26 @@ void notify_contexts_mailbox_set_subscribed(struct mailbox *box,
 	}
 }
 
+bool notify_contexts_want_flag_changes(void)
+{
+	return flag_changes_ctx_count > 0;
+}
+
+bool notify_contexts_want_keyword_changes(void)
+{
+	return keyword_changes_ctx_count > 0;
+}
+
+static void notify_context_update_counts(struct notify_context *ctx, int diff)
+{
+	if (ctx->v.mail_update_flags != NULL ||
+	    ctx->v.mail_transaction_changes != NULL)
+		flag_changes_ctx_count += diff;
+	if (ctx->v.mail_update_keywords != NULL ||
+	    ctx->v.mail_transaction_changes != NULL)
+		keyword_changes_ctx_count += diff;
+}
+
 struct notify_context *
 notify_register(const struct notify_vfuncs *v)
 {
@@ -238,20 +299,21 @@ notify_register(const struct notify_vfuncs *v)
 	ctx = i_new(struct notify_context, 1);
 	ctx->v = *v;
 	DLLIST_PREPEND(&ctx_list, ctx);
+	notify_context_update_counts(ctx, 1);
 	return ctx;
 }
 
 void notify_unregister(struct notify_context *ctx)
 {
-	struct notify_mail_txn *mail_txn = ctx->mail_txn_list;
-
-	for (; mail_txn != NULL; mail_txn = mail_txn->next) {
+	while (ctx->mail_txn_list != NULL) {
 		if (ctx->v.mail_transaction_rollback != NULL)
-			ctx->v.mail_transaction_rollback(mail_txn->txn);
+			ctx->v.mail_transaction_rollback(ctx->mail_txn_list->txn);
+		notify_mail_txn_free(ctx, ctx->mail_txn_list);
 	}
 	if (ctx->mailbox_delete_txn != NULL &&
 	    ctx->v.mailbox_delete_rollback != NULL)
 		ctx->v.mailbox_delete_rollback(ctx->mailbox_delete_txn);
+	notify_context_update_counts(ctx, -1);
 	DLLIST_REMOVE(&ctx_list, ctx);
 	i_free(ctx);
 }
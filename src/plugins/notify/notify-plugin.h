@@ -2,6 +2,7 @@
 #define NOTIFY_PLUGIN_H
 
 #include "mail-types.h"
+#include "seq-range-array.h"
 
 struct mail;
 struct mail_transaction_commit_changes;
@@ -12,6 +13,16 @@ struct mailbox;
 struct notify_context;
 struct module;
 
+/* Summary of the flag and keyword changes done within a transaction */
+struct notify_mail_changes {
+	/* Sequences of the mails whose flags or keywords were changed */
+	const ARRAY_TYPE(seq_range) *seqs;
+	/* Flags that were added to or removed from at least one mail */
+	enum mail_flags flags_added, flags_removed;
+	/* Keywords were changed for at least one mail */
+	bool keywords_changed;
+};
+
 struct notify_vfuncs {
 	void *(*mail_transaction_begin)(struct mailbox_transaction_context *t);
 	void (*mail_save)(void *txn, struct mail *mail);
@@ -21,6 +32,13 @@ struct notify_vfuncs {
 				  enum mail_flags old_flags);
 	void (*mail_update_keywords)(void *txn, struct mail *mail,
 				     const char *const *old_keywords);
+	/* Called before mail_transaction_commit() if any flags or keywords
+	   were changed in the transaction. Consumers that don't need to look
+	   at the individual mails should implement this instead of
+	   mail_update_flags() and mail_update_keywords(), which are called
+	   separately for each changed mail. */
+	void (*mail_transaction_changes)(void *txn,
+			const struct notify_mail_changes *changes);
 	void (*mail_transaction_commit)(void *txn,
 			struct mail_transaction_commit_changes *changes);
 	void (*mail_transaction_rollback)(void *txn);
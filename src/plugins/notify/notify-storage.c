@@ -34,6 +34,12 @@ notify_mail_update_flags(struct mail *_mail, enum modify_type modify_type,
 	union mail_module_context *lmail = NOTIFY_MAIL_CONTEXT(mail);
 	enum mail_flags old_flags, new_flags;
 
+	if (!notify_contexts_want_flag_changes()) {
+		/* avoid looking up the flags for each mail */
+		lmail->super.update_flags(_mail, modify_type, flags);
+		return;
+	}
+
 	old_flags = mail_get_flags(_mail);
 	lmail->super.update_flags(_mail, modify_type, flags);
 	new_flags = mail_get_flags(_mail);
@@ -53,6 +59,11 @@ notify_mail_update_keywords(struct mail *_mail, enum modify_type modify_type,
 	const char *const *old_keywords, *const *new_keywords;
 	unsigned int i;
 
+	if (!notify_contexts_want_keyword_changes()) {
+		lmail->super.update_keywords(_mail, modify_type, keywords);
+		return;
+	}
+
 	old_keywords = mail_get_keywords(_mail);
 	lmail->super.update_keywords(_mail, modify_type, keywords);
 	new_keywords = mail_get_keywords(_mail);
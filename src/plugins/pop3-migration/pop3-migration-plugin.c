@@ -23,6 +23,11 @@
 #define POP3_MIGRATION_MAIL_CONTEXT(obj) \
 	MODULE_CONTEXT_REQUIRE(obj, pop3_migration_mail_module)
 
+/* Prefetch at least this many mails' headers while reading the header hashes.
+   With pop3c this pipelines the TOP commands instead of waiting for each
+   reply before sending the next command. */
+#define POP3_MIGRATION_HDR_PREFETCH_COUNT 50
+
 struct msg_map_common {
 	/* sha1(header) - set only when needed */
 	unsigned char hdr_sha1[SHA1_RESULTLEN];
@@ -494,6 +499,8 @@ map_read_hdr_hashes(struct mailbox *box, struct array *msg_map, uint32_t seq1)
 	ctx = mailbox_search_init(t, search_args, NULL,
 				  MAIL_FETCH_STREAM_HEADER, NULL);
 	mail_search_args_unref(&search_args);
+	mailbox_search_set_min_prefetch_count(ctx,
+		POP3_MIGRATION_HDR_PREFETCH_COUNT);
 
 	while (mailbox_search_next(ctx, &mail)) {
 		map = array_idx_modifiable_i(msg_map, mail->seq-1);
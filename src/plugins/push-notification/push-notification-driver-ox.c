@@ -29,23 +29,51 @@ static const char *const default_mboxes[] = { "INBOX", NULL };
 #define DEFAULT_CACHE_LIFETIME_SECS 60
 #define DEFAULT_TIMEOUT_MSECS 2000
 #define DEFAULT_RETRY_COUNT 1
+/* Keep the connection to the OX REST API open between notifications, so
+   each delivery doesn't need a new TCP+TLS handshake. */
+#define DEFAULT_MAX_IDLE_TIME_MSECS (30*1000)
+/* Without batch_size every notification is sent as its own request. */
+#define DEFAULT_BATCH_SIZE 1
+#define DEFAULT_BATCH_TIMEOUT_MSECS 1000
+
+/* Notifications queued to be sent to one URL as a single JSON array. These
+   are shared by all users of the process, so e.g. a mail delivered to
+   a large number of LMTP recipients results in only a few requests. */
+struct push_notification_driver_ox_batch {
+    pool_t pool;
+    char *url;
+    struct http_url *http_url;
+    struct event *event;
+
+    string_t *payload;
+    unsigned int count, max_count;
+    struct timeout *to;
+};
 
 /* This is data that is shared by all plugin users. */
 struct push_notification_driver_ox_global {
     struct http_client *http_client;
+    HASH_TABLE(char *, struct push_notification_driver_ox_batch *) batches;
     int refcount;
 };
 static struct push_notification_driver_ox_global *ox_global = NULL;
 
 /* This is data specific to an OX driver. */
 struct push_notification_driver_ox_config {
+    const char *url;
     struct http_url *http_url;
     struct event *event;
     unsigned int cached_ox_metadata_lifetime_secs;
     bool use_unsafe_username;
     unsigned int http_max_retries;
     unsigned int http_timeout_msecs;
+    unsigned int http_max_parallel_connections;
+    unsigned int http_max_pipelined_requests;
+    const char *http_proxy_socket_path;
+    unsigned int batch_size;
+    unsigned int batch_timeout_msecs;
 
+    /* NULL with non-zero timestamp caches that the metadata isn't set */
     char *cached_ox_metadata;
     time_t cached_ox_metadata_timestamp;
 };
@@ -69,6 +97,11 @@ push_notification_driver_ox_init_global(struct mail_user *user,
         http_set.debug = user->mail_debug;
         http_set.max_attempts = config->http_max_retries+1;
         http_set.request_timeout_msecs = config->http_timeout_msecs;
+        http_set.max_idle_time_msecs = DEFAULT_MAX_IDLE_TIME_MSECS;
+        http_set.max_parallel_connections =
+            config->http_max_parallel_connections;
+        http_set.max_pipelined_requests = config->http_max_pipelined_requests;
+        http_set.proxy_socket_path = config->http_proxy_socket_path;
         http_set.event_parent = user->event;
         i_zero(&ssl_set);
         mail_user_init_ssl_client_settings(user, &ssl_set);
@@ -94,6 +127,7 @@ push_notification_driver_ox_init(struct push_notification_driver_config *config,
     }
 
     dconfig = p_new(pool, struct push_notification_driver_ox_config, 1);
+    dconfig->url = p_strdup(pool, tmp);
     dconfig->event = event_create(user->event);
     event_add_category(dconfig->event, &event_category_push_notification);
     event_set_append_log_prefix(dconfig->event, "push-notification-ox: ");
@@ -130,13 +164,45 @@ push_notification_driver_ox_init(struct push_notification_driver_config *config,
         (str_to_uint(tmp, &dconfig->http_timeout_msecs) < 0)) {
         dconfig->http_timeout_msecs = DEFAULT_TIMEOUT_MSECS;
     }
+    tmp = hash_table_lookup(config->config, (const char *)"max_parallel_connections");
+    if ((tmp == NULL) ||
+        (str_to_uint(tmp, &dconfig->http_max_parallel_connections) < 0)) {
+        /* use the lib-http default */
+        dconfig->http_max_parallel_connections = 0;
+    }
+    tmp = hash_table_lookup(config->config, (const char *)"max_pipelined_requests");
+    if ((tmp == NULL) ||
+        (str_to_uint(tmp, &dconfig->http_max_pipelined_requests) < 0)) {
+        dconfig->http_max_pipelined_requests = 0;
+    }
+    tmp = hash_table_lookup(config->config, (const char *)"proxy_socket");
+    if (tmp != NULL)
+        dconfig->http_proxy_socket_path = p_strdup(pool, tmp);
+
+    tmp = hash_table_lookup(config->config, (const char *)"batch_size");
+    if ((tmp == NULL) ||
+        (str_to_uint(tmp, &dconfig->batch_size) < 0) ||
+        dconfig->batch_size == 0) {
+        dconfig->batch_size = DEFAULT_BATCH_SIZE;
+    }
+    tmp = hash_table_lookup(config->config, (const char *)"batch_timeout_msecs");
+    if ((tmp == NULL) ||
+        (str_to_uint(tmp, &dconfig->batch_timeout_msecs) < 0)) {
+        dconfig->batch_timeout_msecs = DEFAULT_BATCH_TIMEOUT_MSECS;
+    }
 
     e_debug(dconfig->event, "Using cache lifetime: %u",
             dconfig->cached_ox_metadata_lifetime_secs);
+    if (dconfig->batch_size > 1) {
+        e_debug(dconfig->event, "Using batch size %u with timeout %u msecs",
+                dconfig->batch_size, dconfig->batch_timeout_msecs);
+    }
 
     if (ox_global == NULL) {
         ox_global = i_new(struct push_notification_driver_ox_global, 1);
         ox_global->refcount = 0;
+        hash_table_create(&ox_global->batches, default_pool, 0,
+                          str_hash, strcmp);
     }
 
     ++ox_global->refcount;
@@ -155,7 +221,7 @@ static const char *push_notification_driver_ox_get_metadata
     bool success = FALSE, use_existing_txn = FALSE;
     int ret;
 
-    if ((dconfig->cached_ox_metadata != NULL) &&
+    if ((dconfig->cached_ox_metadata_timestamp != 0) &&
         ((dconfig->cached_ox_metadata_timestamp +
           	(time_t)dconfig->cached_ox_metadata_lifetime_secs) > ioloop_time)) {
         return dconfig->cached_ox_metadata;
@@ -186,11 +252,13 @@ static const char *push_notification_driver_ox_get_metadata
     if (!use_existing_txn) {
         mailbox_free(&inbox);
     }
-    if (!success)
+    if (ret < 0)
 	    return NULL;
 
+    /* Remember also that the metadata isn't set, so users without push
+       notifications don't need the attribute lookup for each mail. */
     i_free(dconfig->cached_ox_metadata);
-    dconfig->cached_ox_metadata = i_strdup(attr.value);
+    dconfig->cached_ox_metadata = success ? i_strdup(attr.value) : NULL;
     dconfig->cached_ox_metadata_timestamp = ioloop_time;
 
     return dconfig->cached_ox_metadata;
@@ -295,6 +363,22 @@ static void push_notification_driver_ox_http_callback
     }
 }
 
+static void push_notification_driver_ox_batch_http_callback
+(const struct http_response *response, struct push_notification_driver_ox_batch *batch)
+{
+    switch (response->status / 100) {
+    case 2:
+        e_debug(batch->event, "Notification batch sent successfully: %s",
+	        http_response_get_message(response));
+        break;
+
+    default:
+        e_error(batch->event, "Error when sending notification batch: %s",
+                http_response_get_message(response));
+        break;
+    }
+}
+
 /* Callback needed for i_stream_add_destroy_callback() in
  * push_notification_driver_ox_process_msg. */
 static void str_free_i(string_t *str)
@@ -302,6 +386,118 @@ static void str_free_i(string_t *str)
     str_free(&str);
 }
 
+static void
+push_notification_driver_ox_send(struct http_client_request *http_req,
+                                 string_t *str)
+{
+    struct istream *payload;
+
+    http_client_request_add_header(http_req, "Content-Type",
+                                   "application/json; charset=utf-8");
+    payload = i_stream_create_from_data(str_data(str), str_len(str));
+    i_stream_add_destroy_callback(payload, str_free_i, str);
+    http_client_request_set_payload(http_req, payload, FALSE);
+
+    http_client_request_submit(http_req);
+    i_stream_unref(&payload);
+}
+
+static void
+push_notification_driver_ox_batch_flush(struct push_notification_driver_ox_batch *batch)
+{
+    struct http_client_request *http_req;
+    string_t *str;
+
+    timeout_remove(&batch->to);
+    if (batch->count == 0)
+        return;
+
+    e_debug(batch->event, "Sending %u notifications", batch->count);
+
+    http_req = http_client_request_url(ox_global->http_client, "PUT",
+                                       batch->http_url,
+                                       push_notification_driver_ox_batch_http_callback,
+                                       batch);
+    http_client_request_set_event(http_req, batch->event);
+
+    str = str_new(default_pool, str_len(batch->payload) + 2);
+    str_append_c(str, '[');
+    str_append_str(str, batch->payload);
+    str_append_c(str, ']');
+    str_truncate(batch->payload, 0);
+    batch->count = 0;
+
+    push_notification_driver_ox_send(http_req, str);
+}
+
+static void
+push_notification_driver_ox_batch_add(struct push_notification_driver_ox_config *dconfig,
+                                      string_t *str)
+{
+    struct push_notification_driver_ox_batch *batch;
+    pool_t pool;
+
+    batch = hash_table_lookup(ox_global->batches, dconfig->url);
+    if (batch == NULL) {
+        pool = pool_alloconly_create("push-notification ox batch", 1024);
+        batch = p_new(pool, struct push_notification_driver_ox_batch, 1);
+        batch->pool = pool;
+        batch->url = p_strdup(pool, dconfig->url);
+        batch->http_url = http_url_clone_with_userinfo(pool, dconfig->http_url);
+        /* the batch outlives the users whose notifications it contains */
+        batch->event = event_create(NULL);
+        event_add_category(batch->event, &event_category_push_notification);
+        event_set_append_log_prefix(batch->event, "push-notification-ox: ");
+        batch->payload = str_new(default_pool, 1024);
+        hash_table_insert(ox_global->batches, batch->url, batch);
+    }
+    /* the first user's settings are used for the whole batch */
+    if (batch->count == 0) {
+        batch->max_count = dconfig->batch_size;
+        i_assert(batch->to == NULL);
+        batch->to = timeout_add(dconfig->batch_timeout_msecs,
+                                push_notification_driver_ox_batch_flush,
+                                batch);
+    } else {
+        str_append_c(batch->payload, ',');
+    }
+    str_append_str(batch->payload, str);
+    str_free(&str);
+
+    if (++batch->count >= batch->max_count)
+        push_notification_driver_ox_batch_flush(batch);
+}
+
+static void push_notification_driver_ox_batch_flush_all(void)
+{
+    struct hash_iterate_context *iter;
+    struct push_notification_driver_ox_batch *batch;
+    char *url;
+
+    iter = hash_table_iterate_init(ox_global->batches);
+    while (hash_table_iterate(iter, ox_global->batches, &url, &batch))
+        push_notification_driver_ox_batch_flush(batch);
+    hash_table_iterate_deinit(&iter);
+}
+
+static void push_notification_driver_ox_batches_free(void)
+{
+    struct hash_iterate_context *iter;
+    struct push_notification_driver_ox_batch *batch;
+    char *url;
+
+    iter = hash_table_iterate_init(ox_global->batches);
+    while (hash_table_iterate(iter, ox_global->batches, &url, &batch)) {
+        i_assert(batch->count == 0);
+        timeout_remove(&batch->to);
+        str_free(&batch->payload);
+        event_unref(&batch->event);
+        pool_unref(&batch->pool);
+    }
+    hash_table_iterate_deinit(&iter);
+    hash_table_destroy(&ox_global->batches);
+}
+
 static int push_notification_driver_ox_get_mailbox_status
 (struct push_notification_driver_txn *dtxn,
  struct mailbox_status *r_box_status)
@@ -338,7 +534,6 @@ static void push_notification_driver_ox_process_msg
         (struct push_notification_driver_ox_config *)dtxn->duser->context;
     struct http_client_request *http_req;
     struct push_notification_event_messagenew_data *messagenew;
-    struct istream *payload;
     string_t *str;
     struct push_notification_driver_ox_txn *txn =
         (struct push_notification_driver_ox_txn *)dtxn->context;
@@ -357,14 +552,6 @@ static void push_notification_driver_ox_process_msg
 
     push_notification_driver_ox_init_global(user, dconfig);
 
-    http_req = http_client_request_url(ox_global->http_client, "PUT",
-                                       dconfig->http_url,
-                                       push_notification_driver_ox_http_callback,
-                                       dconfig);
-    http_client_request_set_event(http_req, dconfig->event);
-    http_client_request_add_header(http_req, "Content-Type",
-                                   "application/json; charset=utf-8");
-
     str = str_new(default_pool, 256);
     str_append(str, "{\"user\":\"");
     json_append_escaped(str, dconfig->use_unsafe_username ?
@@ -393,14 +580,20 @@ static void push_notification_driver_ox_process_msg
     }
     str_append(str, "}");
 
-    e_debug(dconfig->event, "Sending notification: %s", str_c(str));
+    if (dconfig->batch_size > 1) {
+        e_debug(dconfig->event, "Queueing notification: %s", str_c(str));
+        push_notification_driver_ox_batch_add(dconfig, str);
+        return;
+    }
 
-    payload = i_stream_create_from_data(str_data(str), str_len(str));
-    i_stream_add_destroy_callback(payload, str_free_i, str);
-    http_client_request_set_payload(http_req, payload, FALSE);
+    e_debug(dconfig->event, "Sending notification: %s", str_c(str));
 
-    http_client_request_submit(http_req);
-    i_stream_unref(&payload);
+    http_req = http_client_request_url(ox_global->http_client, "PUT",
+                                       dconfig->http_url,
+                                       push_notification_driver_ox_http_callback,
+                                       dconfig);
+    http_client_request_set_event(http_req, dconfig->event);
+    push_notification_driver_ox_send(http_req, str);
 }
 
 static void push_notification_driver_ox_deinit
@@ -421,9 +614,13 @@ static void push_notification_driver_ox_deinit
 static void push_notification_driver_ox_cleanup(void)
 {
     if ((ox_global != NULL) && (ox_global->refcount <= 0)) {
+        /* the last user is gone - send out the partial batches */
+        push_notification_driver_ox_batch_flush_all();
         if (ox_global->http_client != NULL) {
+            http_client_wait(ox_global->http_client);
             http_client_deinit(&ox_global->http_client);
         }
+        push_notification_driver_ox_batches_free();
         i_free_and_null(ox_global);
     }
 }
@@ -32,8 +32,12 @@ struct quota_clone_user {
 	union mail_user_module_context module_ctx;
 	struct dict *dict;
 	struct timeout *to_quota_flush;
+	/* the values last written to dict, to avoid rewriting them */
+	uint64_t last_bytes_value, last_count_value;
 	bool quota_changed;
 	bool quota_flushing;
+	bool last_bytes_value_set;
+	bool last_count_value_set;
 };
 
 static void
@@ -50,11 +54,15 @@ quota_clone_dict_commit(const struct dict_commit_result *result,
 		break;
 	case DICT_COMMIT_RET_FAILED:
 		quser->quota_changed = TRUE;
+		quser->last_bytes_value_set = FALSE;
+		quser->last_count_value_set = FALSE;
 		i_error("quota_clone_dict: Failed to write value: %s",
 			result->error);
 		break;
 	case DICT_COMMIT_RET_WRITE_UNCERTAIN:
 		quser->quota_changed = TRUE;
+		quser->last_bytes_value_set = FALSE;
+		quser->last_count_value_set = FALSE;
 		i_error("quota_clone_dict: Write was unconfirmed (timeout or disconnect): %s",
 			result->error);
 		break;
@@ -118,18 +126,33 @@ static bool quota_clone_flush_real(struct mail_user *user)
 	   the special case of lookup changing from
 	   RESULT_LIMITED/RESULT_UNLIMITED to RESULT_UNKNOWN_RESOURCE, which
 	   leaves the old value unchanged. */
+	bool update_bytes = (bytes_res == QUOTA_GET_RESULT_LIMITED ||
+			     bytes_res == QUOTA_GET_RESULT_UNLIMITED) &&
+		(!quser->last_bytes_value_set ||
+		 quser->last_bytes_value != bytes_value);
+	bool update_count = (count_res == QUOTA_GET_RESULT_LIMITED ||
+			     count_res == QUOTA_GET_RESULT_UNLIMITED) &&
+		(!quser->last_count_value_set ||
+		 quser->last_count_value != count_value);
+	quser->quota_changed = FALSE;
+	if (!update_bytes && !update_count) {
+		/* the values haven't changed since the last write */
+		return TRUE;
+	}
+
 	trans = dict_transaction_begin(quser->dict);
-	if (bytes_res == QUOTA_GET_RESULT_LIMITED ||
-	    bytes_res == QUOTA_GET_RESULT_UNLIMITED) {
+	if (update_bytes) {
 		dict_set(trans, DICT_QUOTA_CLONE_BYTES_PATH,
 			 t_strdup_printf("%"PRIu64, bytes_value));
+		quser->last_bytes_value = bytes_value;
+		quser->last_bytes_value_set = TRUE;
 	}
-	if (count_res == QUOTA_GET_RESULT_LIMITED ||
-	    count_res == QUOTA_GET_RESULT_UNLIMITED) {
+	if (update_count) {
 		dict_set(trans, DICT_QUOTA_CLONE_COUNT_PATH,
 			 t_strdup_printf("%"PRIu64, count_value));
+		quser->last_count_value = count_value;
+		quser->last_count_value_set = TRUE;
 	}
-	quser->quota_changed = FALSE;
 	dict_transaction_commit_async(&trans, quota_clone_dict_commit, quser);
 	return FALSE;
 }
@@ -48,11 +48,12 @@ quota_count_mailbox(struct quota_root *root, struct mail_namespace *ns,
 	if ((box->storage->class_flags & MAIL_STORAGE_CLASS_FLAG_NOQUOTA) != 0) {
 		/* quota doesn't exist for this mailbox/storage */
 		ret = 0;
-	} else if (mailbox_get_metadata(box, root->quota->set->vsizes ?
-					MAILBOX_METADATA_VIRTUAL_SIZE :
-					MAILBOX_METADATA_PHYSICAL_SIZE,
-					&metadata) < 0 ||
-	    mailbox_get_status(box, STATUS_MESSAGES, &status) < 0) {
+	} else if (mailbox_get_status(box, STATUS_MESSAGES, &status) < 0 ||
+		   (status.messages > 0 &&
+		    mailbox_get_metadata(box, root->quota->set->vsizes ?
+					 MAILBOX_METADATA_VIRTUAL_SIZE :
+					 MAILBOX_METADATA_PHYSICAL_SIZE,
+					 &metadata) < 0)) {
 		errstr = mailbox_get_last_internal_error(box, &error);
 		if (error == MAIL_ERROR_TEMP) {
 			*error_r = t_strdup_printf(
@@ -71,6 +72,10 @@ quota_count_mailbox(struct quota_root *root, struct mail_namespace *ns,
 			/* non-temporary error, e.g. ACLs denied access. */
 			ret = 0;
 		}
+	} else if (status.messages == 0) {
+		/* empty mailbox - its size has to be zero, so there's no
+		   need to look it up. */
+		ret = 0;
 	} else {
 		ret = 0;
 		*bytes += root->quota->set->vsizes ?
@@ -18,6 +18,7 @@ struct dict_quota_root {
 	struct dict *dict;
 	struct timeout *to_update;
 	bool disable_unset;
+	bool reserve;
 };
 
 extern struct quota_backend quota_backend_dict;
@@ -35,6 +36,11 @@ static void handle_nounset_param(struct quota_root *_root, const char *param_val
 	((struct dict_quota_root *)_root)->disable_unset = TRUE;
 }
 
+static void handle_reserve_param(struct quota_root *_root, const char *param_value ATTR_UNUSED)
+{
+	((struct dict_quota_root *)_root)->reserve = TRUE;
+}
+
 static int dict_quota_init(struct quota_root *_root, const char *args,
 			   const char **error_r)
 {
@@ -44,6 +50,7 @@ static int dict_quota_init(struct quota_root *_root, const char *args,
 
 	const struct quota_param_parser dict_params[] = {
 		{.param_name = "no-unset", .param_handler = handle_nounset_param},
+		{.param_name = "reserve", .param_handler = handle_reserve_param},
 		quota_param_hidden, quota_param_ignoreunlimited, quota_param_noenforcing, quota_param_ns,
 		{.param_name = NULL}
 	};
@@ -221,14 +228,24 @@ dict_quota_update(struct quota_root *_root,
 		    <= QUOTA_GET_RESULT_INTERNAL_ERROR)
 			return -1;
 	} else {
+		int64_t bytes_diff = ctx->bytes_used;
+		int64_t count_diff = ctx->count_used;
+
+		if (root->reserve) {
+			/* the reserved amounts were already added */
+			bytes_diff -= ctx->bytes_reserved;
+			count_diff -= ctx->count_reserved;
+			if (bytes_diff == 0 && count_diff == 0)
+				return 0;
+		}
 		dt = dict_transaction_begin(root->dict);
-		if (ctx->bytes_used != 0) {
+		if (bytes_diff != 0) {
 			dict_atomic_inc(dt, DICT_QUOTA_CURRENT_BYTES_PATH,
-					ctx->bytes_used);
+					bytes_diff);
 		}
-		if (ctx->count_used != 0) {
+		if (count_diff != 0) {
 			dict_atomic_inc(dt, DICT_QUOTA_CURRENT_COUNT_PATH,
-					ctx->count_used);
+					count_diff);
 		}
 		dict_transaction_no_slowness_warning(dt);
 		dict_transaction_commit_async(&dt, dict_quota_update_callback,
@@ -237,6 +254,41 @@ dict_quota_update(struct quota_root *_root,
 	return 0;
 }
 
+static int
+dict_quota_reserve(struct quota_root *_root, int64_t bytes, int64_t count,
+		   const char **error_r)
+{
+	struct dict_quota_root *root = (struct dict_quota_root *)_root;
+	struct dict_transaction_context *dt;
+	const char *error;
+	int ret;
+
+	if (!root->reserve)
+		return 0;
+
+	dt = dict_transaction_begin(root->dict);
+	dict_atomic_inc(dt, DICT_QUOTA_CURRENT_BYTES_PATH, bytes);
+	dict_atomic_inc(dt, DICT_QUOTA_CURRENT_COUNT_PATH, count);
+	dict_transaction_no_slowness_warning(dt);
+	/* the reservation must be visible before the usage is looked up */
+	ret = dict_transaction_commit(&dt, &error);
+	if (ret < 0) {
+		*error_r = t_strdup_printf("dict_transaction_commit() failed: %s",
+					   error);
+		return -1;
+	}
+	if (ret == 0) {
+		/* row doesn't exist - the usage needs to be recalculated,
+		   which also includes the reservation. */
+		if (root->to_update == NULL) {
+			root->to_update = timeout_add_short(0,
+				dict_quota_recalc_timeout, root);
+		}
+		return 0;
+	}
+	return 1;
+}
+
 static void dict_quota_flush(struct quota_root *_root)
 {
 	struct dict_quota_root *root = (struct dict_quota_root *)_root;
@@ -259,5 +311,6 @@ struct quota_backend quota_backend_dict = {
 		.get_resource = dict_quota_get_resource,
 		.update = dict_quota_update,
 		.flush = dict_quota_flush,
+		.reserve = dict_quota_reserve,
 	}
 };
@@ -79,6 +79,15 @@ struct quota_backend_vfuncs {
 		      const char **error_r);
 	bool (*match_box)(struct quota_root *root, struct mailbox *box);
 	void (*flush)(struct quota_root *root);
+
+	/* Atomically add the bytes and count to the quota usage already
+	   before the mails are saved, so concurrent transactions see them.
+	   Negative values release the reservation. update() must then add
+	   only the difference between the used and reserved amounts.
+	   Returns 1 if reserved, 0 if the root doesn't do reservations, -1 on
+	   error. */
+	int (*reserve)(struct quota_root *root, int64_t bytes, int64_t count,
+		       const char **error_r);
 };
 
 struct quota_backend {
@@ -162,6 +171,8 @@ struct quota_transaction_context {
 	struct mailbox *box;
 
 	int64_t bytes_used, count_used;
+	/* how many bytes/mails have been reserved with backend.reserve() */
+	int64_t bytes_reserved, count_reserved;
 	/* how many bytes/mails can be saved until limit is reached.
 	   (set once, not updated by bytes_used/count_used).
 
@@ -71,6 +71,10 @@ static enum quota_alloc_result quota_default_test_alloc(
 		struct quota_transaction_context *ctx, uoff_t size,
 		const char **error_r);
 static void quota_over_flag_check_root(struct quota_root *root);
+static void
+quota_transaction_release(struct quota_transaction_context *ctx,
+			  unsigned int root_count, int64_t bytes,
+			  int64_t count);
 
 static const struct quota_backend *quota_backend_find(const char *name)
 {
@@ -1138,9 +1142,14 @@ int quota_transaction_commit(struct quota_transaction_context **_ctx)
 
 	*_ctx = NULL;
 
-	if (ctx->failed)
+	if (ctx->failed) {
+		if (ctx->bytes_reserved != 0 || ctx->count_reserved != 0) T_BEGIN {
+			quota_transaction_release(ctx,
+				array_count(&ctx->quota->roots),
+				ctx->bytes_reserved, ctx->count_reserved);
+		} T_END;
 		ret = -1;
-	else if (ctx->bytes_used != 0 || ctx->count_used != 0 ||
+	} else if (ctx->bytes_used != 0 || ctx->count_used != 0 ||
 		 ctx->recalculate != QUOTA_RECALCULATE_DONT) T_BEGIN {
 		ARRAY(struct quota_root *) warn_roots;
 
@@ -1303,14 +1312,143 @@ void quota_over_flag_check_startup(struct quota *quota)
 	}
 }
 
+static bool
+quota_transaction_root_is_updated(struct quota_transaction_context *ctx,
+				  struct quota_root *root,
+				  const char *mailbox_name)
+{
+	struct quota_rule *rule;
+
+	if (!quota_root_is_visible(root, ctx->box))
+		return FALSE;
+	rule = quota_root_rule_find(root->set, mailbox_name);
+	return rule == NULL || !rule->ignore;
+}
+
+static void
+quota_transaction_release(struct quota_transaction_context *ctx,
+			  unsigned int root_count, int64_t bytes,
+			  int64_t count)
+{
+	struct quota_root *const *roots;
+	const char *mailbox_name, *error;
+	unsigned int i;
+
+	mailbox_name = mailbox_get_vname(ctx->box);
+	(void)mail_namespace_find_unalias(ctx->box->storage->user->namespaces,
+					  &mailbox_name);
+	roots = array_idx(&ctx->quota->roots, 0);
+	for (i = 0; i < root_count; i++) {
+		if (roots[i]->backend.v.reserve == NULL ||
+		    !quota_transaction_root_is_updated(ctx, roots[i],
+						       mailbox_name))
+			continue;
+		if (roots[i]->backend.v.reserve(roots[i], -bytes, -count,
+						&error) < 0) {
+			i_error("Failed to release quota reservation for %s: %s",
+				mailbox_name, error);
+		}
+	}
+}
+
 void quota_transaction_rollback(struct quota_transaction_context **_ctx)
 {
 	struct quota_transaction_context *ctx = *_ctx;
 
 	*_ctx = NULL;
+	if (ctx->bytes_reserved != 0 || ctx->count_reserved != 0) T_BEGIN {
+		quota_transaction_release(ctx, array_count(&ctx->quota->roots),
+					  ctx->bytes_reserved,
+					  ctx->count_reserved);
+	} T_END;
 	i_free(ctx);
 }
 
+static bool
+quota_root_is_over_after_reserve(struct quota_transaction_context *ctx,
+				 struct quota_root *root,
+				 const char *mailbox_name, const char *name,
+				 uint64_t size, uint64_t extra)
+{
+	uint64_t current, limit;
+	const char *error;
+
+	if (quota_get_resource(root, mailbox_name, name, &current, &limit,
+			       &error) != QUOTA_GET_RESULT_LIMITED)
+		return FALSE;
+	/* the current value already includes this and all the other
+	   concurrent reservations */
+	if (current <= limit)
+		return FALSE;
+	if (extra > 0 && current - size < limit && current - limit <= extra) {
+		/* quota_grace allows the last mail to go over the limit */
+		return FALSE;
+	}
+	if (ctx->quota->set->debug) {
+		i_debug("quota: %s reservation of %"PRIu64" would exceed "
+			"quota (current=%"PRIu64" limit=%"PRIu64")",
+			name, size, current, limit);
+	}
+	return TRUE;
+}
+
+static enum quota_alloc_result
+quota_transaction_reserve(struct quota_transaction_context *ctx,
+			  uoff_t size, const char **error_r)
+{
+	struct quota_root *const *roots;
+	const char *mailbox_name, *error;
+	unsigned int i, count;
+	uint64_t extra;
+	bool use_grace, over = FALSE;
+	int ret;
+
+	mailbox_name = mailbox_get_vname(ctx->box);
+	(void)mail_namespace_find_unalias(ctx->box->storage->user->namespaces,
+					  &mailbox_name);
+	/* use quota_grace only for LDA/LMTP */
+	use_grace = (ctx->box->flags & MAILBOX_FLAG_POST_SESSION) != 0;
+
+	roots = array_get(&ctx->quota->roots, &count);
+	for (i = 0; i < count; i++) {
+		if (roots[i]->backend.v.reserve == NULL ||
+		    !quota_transaction_root_is_updated(ctx, roots[i],
+						       mailbox_name))
+			continue;
+		ret = roots[i]->backend.v.reserve(roots[i], size, 1, &error);
+		if (ret < 0) {
+			*error_r = t_strdup_printf(
+				"Failed to reserve quota for %s: %s",
+				mailbox_name, error);
+			quota_transaction_release(ctx, i, size, 1);
+			return QUOTA_ALLOC_RESULT_TEMPFAIL;
+		}
+		if (ret == 0 || roots[i]->no_enforcing)
+			continue;
+
+		extra = !use_grace ? 0 :
+			roots[i]->set->last_mail_max_extra_bytes;
+		if (quota_root_is_over_after_reserve(ctx, roots[i],
+				mailbox_name, QUOTA_NAME_STORAGE_BYTES,
+				size, extra) ||
+		    quota_root_is_over_after_reserve(ctx, roots[i],
+				mailbox_name, QUOTA_NAME_MESSAGES, 1, 0)) {
+			over = TRUE;
+			i++;
+			break;
+		}
+	}
+	if (over) {
+		quota_transaction_release(ctx, i, size, 1);
+		*error_r = t_strdup_printf(
+			"Allocating %"PRIuUOFF_T" bytes would exceed quota", size);
+		return QUOTA_ALLOC_RESULT_OVER_QUOTA;
+	}
+	ctx->bytes_reserved += size;
+	ctx->count_reserved++;
+	return QUOTA_ALLOC_RESULT_OK;
+}
+
 static int quota_get_mail_size(struct quota_transaction_context *ctx,
 			       struct mail *mail, uoff_t *size_r)
 {
@@ -1352,6 +1490,12 @@ enum quota_alloc_result quota_try_alloc(struct quota_transaction_context *ctx,
 	}
 
 	enum quota_alloc_result ret = quota_test_alloc(ctx, size, error_r);
+	if (ret != QUOTA_ALLOC_RESULT_OK)
+		return ret;
+	/* reserve the space already now, so it's seen by concurrent
+	   transactions. this also verifies that none of them have used up
+	   the space after the earlier limit check. */
+	ret = quota_transaction_reserve(ctx, size, error_r);
 	if (ret != QUOTA_ALLOC_RESULT_OK)
 		return ret;
 	/* with quota_try_alloc() we want to keep track of how many bytes
@@ -6,6 +6,7 @@
 #include "ioloop.h"
 #include "str.h"
 #include "mail-index-modseq.h"
+#include "mail-transaction-log.h"
 #include "mail-search-build.h"
 #include "mailbox-search-result-private.h"
 #include "mailbox-recent-flags.h"
@@ -782,6 +783,118 @@ virtual_sync_backend_handle_old_vmsgs(struct virtual_sync_context *ctx,
 	virtual_sync_bbox_uids_sort(bbox);
 }
 
+static void
+virtual_sync_log_add_uids(ARRAY_TYPE(seq_range) *uids, uint32_t max_uid,
+			  uint32_t uid1, uint32_t uid2)
+{
+	if (uid1 > max_uid)
+		return;
+	seq_range_array_add_range(uids, uid1, I_MIN(uid2, max_uid));
+}
+
+static void
+virtual_sync_log_add_keyword_uids(ARRAY_TYPE(seq_range) *uids,
+				  uint32_t max_uid,
+				  const struct mail_transaction_header *thdr,
+				  const struct mail_transaction_keyword_update *rec)
+{
+	const struct seq_range *range, *end;
+	unsigned int seqset_offset;
+
+	seqset_offset = sizeof(*rec) + rec->name_size;
+	if ((seqset_offset % 4) != 0)
+		seqset_offset += 4 - (seqset_offset % 4);
+	if (seqset_offset >= thdr->size)
+		return;
+
+	range = CONST_PTR_OFFSET(rec, seqset_offset);
+	end = CONST_PTR_OFFSET(rec, thdr->size);
+	for (; range < end; range++)
+		virtual_sync_log_add_uids(uids, max_uid, range->seq1, range->seq2);
+}
+
+/* Find the UIDs of old messages whose flags or keywords have changed since
+   sync_highest_modseq by reading only the backend's transaction log.
+   Returns FALSE if the log no longer has all the changes. */
+static bool
+virtual_sync_backend_get_log_changes(struct virtual_backend_box *bbox,
+				     uint32_t max_uid,
+				     ARRAY_TYPE(seq_range) *uids)
+{
+	struct mail_index_view *view = bbox->box->view;
+	struct mail_transaction_log_view *log_view;
+	const struct mail_transaction_header *thdr;
+	const void *tdata;
+	uint32_t log_seq;
+	uoff_t log_offset;
+	const char *reason;
+	bool reset;
+	int ret;
+
+	if (bbox->sync_highest_modseq == 0 ||
+	    !mail_index_modseq_get_next_log_offset(view,
+			bbox->sync_highest_modseq, &log_seq, &log_offset))
+		return FALSE;
+	if (log_seq > view->log_file_head_seq ||
+	    (log_seq == view->log_file_head_seq &&
+	     log_offset >= view->log_file_head_offset))
+		return TRUE;
+
+	log_view = mail_transaction_log_view_open(view->index->log);
+	if (mail_transaction_log_view_set(log_view, log_seq, log_offset,
+					  view->log_file_head_seq,
+					  view->log_file_head_offset,
+					  &reset, &reason) <= 0 || reset) {
+		mail_transaction_log_view_close(&log_view);
+		return FALSE;
+	}
+	while ((ret = mail_transaction_log_view_next(log_view, &thdr,
+						     &tdata)) > 0) {
+		switch (thdr->type & MAIL_TRANSACTION_TYPE_MASK) {
+		case MAIL_TRANSACTION_FLAG_UPDATE: {
+			const struct mail_transaction_flag_update *rec, *end;
+
+			end = CONST_PTR_OFFSET(tdata, thdr->size);
+			for (rec = tdata; rec < end; rec++) {
+				virtual_sync_log_add_uids(uids, max_uid,
+							  rec->uid1, rec->uid2);
+			}
+			break;
+		}
+		case MAIL_TRANSACTION_KEYWORD_UPDATE:
+			virtual_sync_log_add_keyword_uids(uids, max_uid,
+							  thdr, tdata);
+			break;
+		case MAIL_TRANSACTION_KEYWORD_RESET: {
+			const struct mail_transaction_keyword_reset *rec, *end;
+
+			end = CONST_PTR_OFFSET(tdata, thdr->size);
+			for (rec = tdata; rec < end; rec++) {
+				virtual_sync_log_add_uids(uids, max_uid,
+							  rec->uid1, rec->uid2);
+			}
+			break;
+		}
+		case MAIL_TRANSACTION_MODSEQ_UPDATE: {
+			const struct mail_transaction_modseq_update *rec, *end;
+
+			end = CONST_PTR_OFFSET(tdata, thdr->size);
+			for (rec = tdata; rec < end; rec++) {
+				virtual_sync_log_add_uids(uids, max_uid,
+							  rec->uid, rec->uid);
+			}
+			break;
+		}
+		default:
+			/* expunges and appends are handled separately, and the
+			   other changes don't affect the search results */
+			break;
+		}
+	}
+	mail_transaction_log_view_close(&log_view);
+	return ret == 0;
+}
+
 static int virtual_sync_backend_box_continue(struct virtual_sync_context *ctx,
 					     struct virtual_backend_box *bbox)
 {
@@ -824,7 +937,13 @@ static int virtual_sync_backend_box_continue(struct virtual_sync_context *ctx,
 	old_highest_modseq = mail_index_modseq_get_highest(view);
 
 	t_array_init(&flag_update_uids, I_MIN(128, old_msg_count));
-	if (bbox->sync_highest_modseq < old_highest_modseq) {
+	if (bbox->sync_highest_modseq < old_highest_modseq &&
+	    old_msg_count > 0 &&
+	    !virtual_sync_backend_get_log_changes(bbox, bbox->sync_next_uid-1,
+						  &flag_update_uids)) {
+		/* the changes aren't in the transaction log anymore -
+		   look up the modseq of each old message */
+		array_clear(&flag_update_uids);
 		for (seq = 1; seq <= old_msg_count; seq++) {
 			modseq = mail_index_modseq_lookup(view, seq);
 			if (modseq > bbox->sync_highest_modseq) {
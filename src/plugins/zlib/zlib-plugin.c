@@ -10,11 +10,15 @@
 #include "index-storage.h"
 #include "index-mail.h"
 #include "compression.h"
+#include "iostream-zstd.h"
 #include "zlib-plugin.h"
 
 #include <fcntl.h>
 
 #define ZLIB_PLUGIN_DEFAULT_LEVEL 6
+/* Use zlib_save_threads only for mails at least this large. With smaller
+   mails starting the threads costs more than they save. */
+#define ZLIB_PLUGIN_THREADS_MIN_MAIL_SIZE (1024*1024)
 
 #define ZLIB_CONTEXT(obj) \
 	MODULE_CONTEXT_REQUIRE(obj, zlib_storage_module)
@@ -46,6 +50,10 @@ struct zlib_user {
 
 	const struct compression_handler *save_handler;
 	unsigned int save_level;
+	unsigned int save_threads;
+	bool save_seekable;
+	/* zlib_zstd_dictionary */
+	struct zstd_dictionary *zstd_dict;
 };
 
 const char *zlib_plugin_version = DOVECOT_ABI_VERSION;
@@ -64,6 +72,21 @@ static bool zlib_mailbox_is_permail(struct mailbox *box)
 		(class_flags & MAIL_STORAGE_CLASS_FLAG_BINARY_DATA) != 0;
 }
 
+static bool zlib_handler_is_zstd(const struct compression_handler *handler)
+{
+	return strcmp(handler->name, "zstd") == 0;
+}
+
+static struct istream *
+zlib_create_istream(struct zlib_user *zuser,
+		    const struct compression_handler *handler,
+		    struct istream *input)
+{
+	if (zuser->zstd_dict != NULL && zlib_handler_is_zstd(handler))
+		return i_stream_create_zstd_dict(input, zuser->zstd_dict, TRUE);
+	return handler->create_istream(input, TRUE);
+}
+
 static void zlib_mail_cache_close(struct zlib_user *zuser)
 {
 	struct zlib_mail_cache *cache = &zuser->cache;
@@ -150,10 +173,17 @@ static int zlib_istream_opened(struct mail *_mail, struct istream **stream)
 		}
 
 		input = *stream;
-		*stream = handler->create_istream(input, TRUE);
+		*stream = zlib_create_istream(zuser, handler, input);
 		i_stream_unref(&input);
-		/* dont cache the stream if _mail->uid is 0 */
-		*stream = zlib_mail_cache_open(zuser, _mail, *stream, (_mail->uid > 0));
+		if (zlib_handler_is_zstd(handler) &&
+		    i_stream_zstd_is_seekable(*stream)) {
+			/* seeking needs to decompress only a single frame,
+			   so there's no need to cache it to a temp file */
+		} else {
+			/* dont cache the stream if _mail->uid is 0 */
+			*stream = zlib_mail_cache_open(zuser, _mail, *stream,
+						       (_mail->uid > 0));
+		}
 	}
 	return zmail->module_ctx.super.istream_opened(_mail, stream);
 }
@@ -229,12 +259,29 @@ zlib_mail_save_compress_begin(struct mail_save_context *ctx,
 	struct zlib_user *zuser = ZLIB_USER_CONTEXT(box->storage->user);
 	union mailbox_module_context *zbox = ZLIB_CONTEXT(box);
 	struct ostream *output;
+	uoff_t size;
 
 	if (zbox->super.save_begin(ctx, input) < 0)
 		return -1;
 
-	output = zuser->save_handler->create_ostream(ctx->data.output,
-						     zuser->save_level);
+	if (zlib_handler_is_zstd(zuser->save_handler)) {
+		struct zstd_ostream_settings set = {
+			.level = zuser->save_level,
+			.dict = zuser->zstd_dict,
+			.seekable = zuser->save_seekable,
+		};
+		if (zuser->save_threads > 0 &&
+		    i_stream_get_size(input, FALSE, &size) > 0 &&
+		    size >= ZLIB_PLUGIN_THREADS_MIN_MAIL_SIZE) {
+			/* compress large mails in parallel, so e.g. LMTP
+			   isn't blocked on them for long */
+			set.workers = zuser->save_threads;
+		}
+		output = o_stream_create_zstd_set(ctx->data.output, &set);
+	} else {
+		output = zuser->save_handler->create_ostream(ctx->data.output,
+							     zuser->save_level);
+	}
 	o_stream_unref(&ctx->data.output);
 	ctx->data.output = output;
 	o_stream_cork(ctx->data.output);
@@ -255,6 +302,7 @@ zlib_permail_alloc_init(struct mailbox *box, struct mailbox_vfuncs *v)
 
 static void zlib_mailbox_open_input(struct mailbox *box)
 {
+	struct zlib_user *zuser = ZLIB_USER_CONTEXT(box->storage->user);
 	const struct compression_handler *handler;
 	struct istream *input;
 	struct stat st;
@@ -281,7 +329,7 @@ static void zlib_mailbox_open_input(struct mailbox *box)
 		}
 		input = i_stream_create_fd_autoclose(&fd, MAX_INBUF_SIZE);
 		i_stream_set_name(input, box_path);
-		box->input = handler->create_istream(input, TRUE);
+		box->input = zlib_create_istream(zuser, handler, input);
 		i_stream_unref(&input);
 		box->flags |= MAILBOX_FLAG_READONLY;
 	}
@@ -331,6 +379,7 @@ static void zlib_mail_user_deinit(struct mail_user *user)
 	struct zlib_user *zuser = ZLIB_USER_CONTEXT(user);
 
 	zlib_mail_cache_close(zuser);
+	zstd_dictionary_unref(&zuser->zstd_dict);
 	zuser->module_ctx.super.deinit(user);
 }
 
@@ -338,7 +387,7 @@ static void zlib_mail_user_created(struct mail_user *user)
 {
 	struct mail_user_vfuncs *v = user->vlast;
 	struct zlib_user *zuser;
-	const char *name;
+	const char *name, *error;
 
 	zuser = p_new(user->pool, struct zlib_user, 1);
 	zuser->module_ctx.super = *v;
@@ -365,6 +414,32 @@ static void zlib_mail_user_created(struct mail_user *user)
 	}
 	if (zuser->save_level == 0)
 		zuser->save_level = ZLIB_PLUGIN_DEFAULT_LEVEL;
+	name = mail_user_plugin_getenv(user, "zlib_save_threads");
+	if (name != NULL && *name != '\0') {
+		if (str_to_uint(name, &zuser->save_threads) < 0 ||
+		    zuser->save_threads > 64) {
+			i_error("zlib_save_threads: Must be between 0..64");
+			zuser->save_threads = 0;
+		} else if (zuser->save_threads > 0 &&
+			   (zuser->save_handler == NULL ||
+			    !zlib_handler_is_zstd(zuser->save_handler))) {
+			i_error("zlib_save_threads: Supported only with zlib_save=zstd");
+			zuser->save_threads = 0;
+		}
+	}
+	zuser->save_seekable =
+		mail_user_plugin_getenv_bool(user, "zlib_save_seekable");
+	if (zuser->save_seekable &&
+	    (zuser->save_handler == NULL ||
+	     !zlib_handler_is_zstd(zuser->save_handler))) {
+		i_error("zlib_save_seekable: Supported only with zlib_save=zstd");
+		zuser->save_seekable = FALSE;
+	}
+	name = mail_user_plugin_getenv(user, "zlib_zstd_dictionary");
+	if (name != NULL && *name != '\0') {
+		if (zstd_dictionary_load(name, &zuser->zstd_dict, &error) < 0)
+			i_error("zlib_zstd_dictionary: %s", error);
+	}
 	MODULE_CONTEXT_SET(user, zlib_user_module, zuser);
 }
 
@@ -391,6 +391,15 @@ int main(int argc, char *argv[])
 	master_service_init_finish(master_service);
 	/* NOTE: login_set.*_socket_path are now invalid due to data stack
 	   having been freed */
+	if (!IS_STANDALONE()) {
+		/* do the non-user-specific initialization already before the
+		   first client connects */
+		struct mail_storage_service_input preload_input = {
+			.module = "pop3",
+			.service = "pop3",
+		};
+		mail_storage_service_preload(storage_service, &preload_input);
+	}
 
 	/* fake that we're running, so we know if client was destroyed
 	   while handling its initial input */
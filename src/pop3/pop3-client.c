@@ -471,7 +471,7 @@ int client_init_mailbox(struct client *client, const char **error_r)
 
 	ident = mail_user_get_anvil_userip_ident(client->user);
 	if (ident != NULL) {
-		master_service_anvil_send(master_service, t_strconcat(
+		master_service_anvil_send_batched(master_service, t_strconcat(
 			"CONNECT\t", my_pid, "\tpop3/", ident, "\n", NULL));
 		client->anvil_sent = TRUE;
 	}
@@ -601,7 +601,7 @@ static void client_default_destroy(struct client *client, const char *reason)
 	if (client->mailbox != NULL)
 		mailbox_free(&client->mailbox);
 	if (client->anvil_sent) {
-		master_service_anvil_send(master_service, t_strconcat(
+		master_service_anvil_send_batched(master_service, t_strconcat(
 			"DISCONNECT\t", my_pid, "\tpop3/",
 			mail_user_get_anvil_userip_ident(client->user),
 			"\n", NULL));
@@ -8,9 +8,15 @@
 #include "replicator-queue.h"
 #include "replicator-brain.h"
 
+/* Reserve 1/n of replication_max_conns (but at least one) for users who
+   have changes waiting to be replicated. Periodic syncs of the other users
+   can't use the reserved connections. */
+#define REPLICATOR_BRAIN_PERIODIC_CONNS_RESERVE_DIVISOR 4
+
 struct replicator_sync_context {
 	struct replicator_brain *brain;
 	struct replicator_user *user;
+	bool periodic;
 };
 
 struct replicator_brain {
@@ -20,6 +26,8 @@ struct replicator_brain {
 	struct timeout *to;
 
 	ARRAY_TYPE(dsync_client) dsync_clients;
+	/* number of running syncs for users without pending changes */
+	unsigned int periodic_sync_count;
 
 	bool deinitializing:1;
 };
@@ -103,12 +111,30 @@ get_dsync_client(struct replicator_brain *brain)
 	return conn;
 }
 
+static bool replicator_brain_have_free_client(struct replicator_brain *brain)
+{
+	struct dsync_client *const *connp;
+
+	if (array_count(&brain->dsync_clients) <
+	    brain->set->replication_max_conns)
+		return TRUE;
+	array_foreach(&brain->dsync_clients, connp) {
+		if (!dsync_client_is_busy(*connp))
+			return TRUE;
+	}
+	return FALSE;
+}
+
 static void dsync_callback(enum dsync_reply reply, const char *state,
 			   void *context)
 {
 	struct replicator_sync_context *ctx = context;
 	struct replicator_user *user = ctx->user;
 
+	if (ctx->periodic) {
+		i_assert(ctx->brain->periodic_sync_count > 0);
+		ctx->brain->periodic_sync_count--;
+	}
 	if (!replicator_user_unref(&user)) {
 		/* user was already removed */
 	} else if (reply == DSYNC_REPLY_NOUSER ||
@@ -129,17 +155,25 @@ static void dsync_callback(enum dsync_reply reply, const char *state,
 	i_free(ctx);
 }
 
-static bool
-dsync_replicate(struct replicator_brain *brain, struct replicator_user *user)
+static unsigned int
+replicator_brain_max_periodic_syncs(struct replicator_brain *brain)
+{
+	unsigned int max_conns = brain->set->replication_max_conns;
+	unsigned int reserved;
+
+	if (max_conns <= 1)
+		return max_conns;
+	reserved = max_conns / REPLICATOR_BRAIN_PERIODIC_CONNS_RESERVE_DIVISOR;
+	return max_conns - I_MAX(reserved, 1);
+}
+
+static void
+dsync_replicate(struct replicator_brain *brain, struct dsync_client *conn,
+		struct replicator_user *user)
 {
 	struct replicator_sync_context *ctx;
-	struct dsync_client *conn;
 	time_t next_full_sync;
-	bool full;
-
-	conn = get_dsync_client(brain);
-	if (conn == NULL)
-		return FALSE;
+	bool full, periodic;
 
 	next_full_sync = user->last_full_sync +
 		brain->set->replication_full_sync_interval;
@@ -151,6 +185,7 @@ dsync_replicate(struct replicator_brain *brain, struct replicator_user *user)
 		user->last_full_sync = ioloop_time;
 		user->force_full_sync = FALSE;
 	}
+	periodic = user->priority == REPLICATION_PRIORITY_NONE;
 	/* reset priority also. if more updates arrive during replication
 	   we'll do another replication to make sure nothing gets lost */
 	user->priority = REPLICATION_PRIORITY_NONE;
@@ -158,10 +193,12 @@ dsync_replicate(struct replicator_brain *brain, struct replicator_user *user)
 	ctx = i_new(struct replicator_sync_context, 1);
 	ctx->brain = brain;
 	ctx->user = user;
+	ctx->periodic = periodic;
+	if (periodic)
+		brain->periodic_sync_count++;
 	replicator_user_ref(user);
 	dsync_client_sync(conn, user->username, user->state, full,
 			  dsync_callback, ctx);
-	return TRUE;
 }
 
 static void replicator_brain_timeout(struct replicator_brain *brain)
@@ -175,6 +212,11 @@ static bool replicator_brain_fill_next(struct replicator_brain *brain)
 	struct replicator_user *user;
 	unsigned int next_secs;
 
+	/* don't touch the queue while all the connections are busy. the
+	   next finished sync will continue filling. */
+	if (!replicator_brain_have_free_client(brain))
+		return FALSE;
+
 	user = replicator_queue_pop(brain->queue, &next_secs);
 	if (user == NULL) {
 		/* nothing more to do */
@@ -184,11 +226,16 @@ static bool replicator_brain_fill_next(struct replicator_brain *brain)
 		return FALSE;
 	}
 
-	if (!dsync_replicate(brain, user)) {
-		/* all connections were full, put the user back to queue */
+	if (user->priority == REPLICATION_PRIORITY_NONE &&
+	    brain->periodic_sync_count >=
+	    replicator_brain_max_periodic_syncs(brain)) {
+		/* the queue is sorted by priority, so there are no users with
+		   pending changes left. keep the rest of the connections
+		   free for them. */
 		replicator_queue_push(brain->queue, user);
 		return FALSE;
 	}
+	dsync_replicate(brain, get_dsync_client(brain), user);
 	/* replication started for the user */
 	return TRUE;
 }
@@ -10,9 +10,13 @@
 #include "hash.h"
 #include "replicator-queue.h"
 
+#include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
 
+/* Buffered journal records are written at this interval */
+#define REPLICATOR_QUEUE_JOURNAL_FLUSH_MSECS 1000
+
 struct replicator_sync_lookup {
 	struct replicator_user *user;
 
@@ -34,6 +38,11 @@ struct replicator_queue {
 
 	void (*change_callback)(void *context);
 	void *change_context;
+
+	/* changes after the last export are appended here */
+	char *journal_path;
+	struct ostream *journal_output;
+	struct timeout *to_journal_flush;
 };
 
 struct replicator_queue_iter {
@@ -102,6 +111,9 @@ void replicator_queue_deinit(struct replicator_queue **_queue)
 	*_queue = NULL;
 
 	queue->change_callback = NULL;
+	/* the users are removed only from memory */
+	replicator_queue_journal_close(queue);
+	i_free(queue->journal_path);
 
 	while ((item = priorityq_pop(queue->user_queue)) != NULL) {
 		struct replicator_user *user = (struct replicator_user *)item;
@@ -125,6 +137,115 @@ void replicator_queue_set_change_callback(struct replicator_queue *queue,
 	queue->change_context = context;
 }
 
+static void
+replicator_queue_export_user(struct replicator_user *user, string_t *str);
+
+static void replicator_queue_journal_flush(struct replicator_queue *queue)
+{
+	timeout_remove(&queue->to_journal_flush);
+	if (o_stream_flush(queue->journal_output) < 0) {
+		i_error("write(%s) failed: %s", queue->journal_path,
+			o_stream_get_error(queue->journal_output));
+		/* the next export writes the full state anyway */
+		o_stream_destroy(&queue->journal_output);
+	}
+}
+
+static void replicator_queue_journal_append(struct replicator_queue *queue,
+					    const string_t *str)
+{
+	o_stream_nsend(queue->journal_output, str_data(str), str_len(str));
+	if (queue->to_journal_flush == NULL) {
+		queue->to_journal_flush =
+			timeout_add(REPLICATOR_QUEUE_JOURNAL_FLUSH_MSECS,
+				    replicator_queue_journal_flush, queue);
+	}
+}
+
+static void replicator_queue_journal_user(struct replicator_queue *queue,
+					  struct replicator_user *user)
+{
+	if (queue->journal_output == NULL)
+		return;
+
+	T_BEGIN {
+		string_t *str = t_str_new(128);
+
+		replicator_queue_export_user(user, str);
+		replicator_queue_journal_append(queue, str);
+	} T_END;
+}
+
+static void
+replicator_queue_journal_remove(struct replicator_queue *queue,
+				const struct replicator_user *user)
+{
+	if (queue->journal_output == NULL)
+		return;
+
+	T_BEGIN {
+		string_t *str = t_str_new(128);
+
+		/* <user> alone means the user was removed */
+		str_append_tabescaped(str, user->username);
+		str_append_c(str, '\n');
+		replicator_queue_journal_append(queue, str);
+	} T_END;
+}
+
+static int
+replicator_queue_journal_open_fd(struct replicator_queue *queue, int flags)
+{
+	int fd;
+
+	fd = open(queue->journal_path, O_WRONLY | O_CREAT | flags, 0600);
+	if (fd == -1) {
+		i_error("open(%s) failed: %m", queue->journal_path);
+		return -1;
+	}
+	if (lseek(fd, 0, SEEK_END) < 0) {
+		i_error("lseek(%s) failed: %m", queue->journal_path);
+		i_close_fd(&fd);
+		return -1;
+	}
+	queue->journal_output = o_stream_create_fd_file_autoclose(&fd, (uoff_t)-1);
+	o_stream_cork(queue->journal_output);
+	return 0;
+}
+
+int replicator_queue_journal_open(struct replicator_queue *queue,
+				  const char *path)
+{
+	i_assert(queue->journal_output == NULL);
+
+	i_free(queue->journal_path);
+	queue->journal_path = i_strdup(path);
+	return replicator_queue_journal_open_fd(queue, 0);
+}
+
+void replicator_queue_journal_close(struct replicator_queue *queue)
+{
+	if (queue->journal_output == NULL)
+		return;
+
+	replicator_queue_journal_flush(queue);
+	o_stream_destroy(&queue->journal_output);
+}
+
+static void replicator_queue_journal_truncate(struct replicator_queue *queue)
+{
+	if (queue->journal_path == NULL)
+		return;
+
+	/* everything in the journal is now in the exported file */
+	timeout_remove(&queue->to_journal_flush);
+	if (queue->journal_output != NULL) {
+		o_stream_abort(queue->journal_output);
+		o_stream_destroy(&queue->journal_output);
+	}
+	(void)replicator_queue_journal_open_fd(queue, O_TRUNC);
+}
+
 void replicator_user_ref(struct replicator_user *user)
 {
 	i_assert(user->refcount > 0);
@@ -177,6 +298,7 @@ replicator_queue_add_int(struct replicator_queue *queue, const char *username,
 
 	if (!user->popped)
 		priorityq_add(queue->user_queue, &user->item);
+	replicator_queue_journal_user(queue, user);
 	return user;
 }
 
@@ -222,6 +344,7 @@ void replicator_queue_remove(struct replicator_queue *queue,
 	if (!user->popped)
 		priorityq_remove(queue->user_queue, &user->item);
 	hash_table_remove(queue->user_hash, user->username);
+	replicator_queue_journal_remove(queue, user);
 	replicator_user_unref(&user);
 
 	if (queue->change_callback != NULL)
@@ -310,6 +433,7 @@ void replicator_queue_push(struct replicator_queue *queue,
 
 	priorityq_add(queue->user_queue, &user->item);
 	user->popped = FALSE;
+	replicator_queue_journal_user(queue, user);
 
 	T_BEGIN {
 		replicator_queue_handle_sync_lookups(queue, user);
@@ -317,7 +441,8 @@ void replicator_queue_push(struct replicator_queue *queue,
 }
 
 static int
-replicator_queue_import_line(struct replicator_queue *queue, const char *line)
+replicator_queue_import_line(struct replicator_queue *queue, const char *line,
+			     bool journal)
 {
 	const char *const *args, *username, *state;
 	unsigned int priority;
@@ -326,6 +451,13 @@ replicator_queue_import_line(struct replicator_queue *queue, const char *line)
 	/* <user> <priority> <last update> <last fast sync> <last full sync>
 	   <last failed> <state> <last successful sync>*/
 	args = t_strsplit_tabescaped(line);
+	if (journal && str_array_length(args) == 1 && args[0][0] != '\0') {
+		/* user was removed */
+		user = hash_table_lookup(queue->user_hash, args[0]);
+		if (user != NULL)
+			replicator_queue_remove(queue, &user);
+		return 0;
+	}
 	if (str_array_length(args) < 7)
 		return -1;
 
@@ -350,7 +482,7 @@ replicator_queue_import_line(struct replicator_queue *queue, const char *line)
 	}
 
 	user = hash_table_lookup(queue->user_hash, username);
-	if (user != NULL) {
+	if (user != NULL && !journal) {
 		if (user->last_update > tmp_user.last_update) {
 			/* we already have a newer state */
 			return 0;
@@ -364,6 +496,12 @@ replicator_queue_import_line(struct replicator_queue *queue, const char *line)
 	}
 	user = replicator_queue_add(queue, username,
 				    tmp_user.priority);
+	/* the journal records are in the order they happened, so the latest
+	   one always wins - even if it lowered the priority. */
+	if (!user->popped)
+		priorityq_remove(queue->user_queue, &user->item);
+	if (journal)
+		user->priority = tmp_user.priority;
 	user->last_update = tmp_user.last_update;
 	user->last_fast_sync = tmp_user.last_fast_sync;
 	user->last_full_sync = tmp_user.last_full_sync;
@@ -371,10 +509,15 @@ replicator_queue_import_line(struct replicator_queue *queue, const char *line)
 	user->last_sync_failed = tmp_user.last_sync_failed;
 	i_free(user->state);
 	user->state = i_strdup(state);
+	/* the sorting fields changed */
+	if (!user->popped)
+		priorityq_add(queue->user_queue, &user->item);
 	return 0;
 }
 
-int replicator_queue_import(struct replicator_queue *queue, const char *path)
+static int
+replicator_queue_import_file(struct replicator_queue *queue, const char *path,
+			     bool journal)
 {
 	struct istream *input;
 	const char *line;
@@ -391,7 +534,8 @@ int replicator_queue_import(struct replicator_queue *queue, const char *path)
 	input = i_stream_create_fd_autoclose(&fd, (size_t)-1);
 	while ((line = i_stream_read_next_line(input)) != NULL) {
 		T_BEGIN {
-			ret = replicator_queue_import_line(queue, line);
+			ret = replicator_queue_import_line(queue, line,
+							   journal);
 		} T_END;
 		if (ret < 0) {
 			i_error("Corrupted replicator record in %s: %s",
@@ -407,6 +551,17 @@ int replicator_queue_import(struct replicator_queue *queue, const char *path)
 	return ret;
 }
 
+int replicator_queue_import(struct replicator_queue *queue, const char *path)
+{
+	return replicator_queue_import_file(queue, path, FALSE);
+}
+
+int replicator_queue_import_journal(struct replicator_queue *queue,
+				    const char *path)
+{
+	return replicator_queue_import_file(queue, path, TRUE);
+}
+
 static void
 replicator_queue_export_user(struct replicator_user *user, string_t *str)
 {
@@ -426,12 +581,16 @@ int replicator_queue_export(struct replicator_queue *queue, const char *path)
 	struct replicator_queue_iter *iter;
 	struct replicator_user *user;
 	struct ostream *output;
+	const char *temp_path;
 	string_t *str;
 	int fd, ret = 0;
 
-	fd = creat(path, 0600);
+	/* write to a temporary file first, so a crash can't leave behind
+	   a partially written file */
+	temp_path = t_strconcat(path, ".tmp", NULL);
+	fd = creat(temp_path, 0600);
 	if (fd == -1) {
-		i_error("creat(%s) failed: %m", path);
+		i_error("creat(%s) failed: %m", temp_path);
 		return -1;
 	}
 	output = o_stream_create_fd_file_autoclose(&fd, 0);
@@ -447,10 +606,21 @@ int replicator_queue_export(struct replicator_queue *queue, const char *path)
 	}
 	replicator_queue_iter_deinit(&iter);
 	if (o_stream_finish(output) < 0) {
-		i_error("write(%s) failed: %s", path, o_stream_get_error(output));
+		i_error("write(%s) failed: %s", temp_path,
+			o_stream_get_error(output));
 		ret = -1;
 	}
 	o_stream_destroy(&output);
+
+	if (ret < 0)
+		i_unlink(temp_path);
+	else if (rename(temp_path, path) < 0) {
+		i_error("rename(%s, %s) failed: %m", temp_path, path);
+		i_unlink(temp_path);
+		ret = -1;
+	} else {
+		replicator_queue_journal_truncate(queue);
+	}
 	return ret;
 }
 
@@ -70,8 +70,19 @@ void replicator_queue_push(struct replicator_queue *queue,
 			   struct replicator_user *user);
 
 int replicator_queue_import(struct replicator_queue *queue, const char *path);
+/* Replay changes from a journal written after the last export. Unlike
+   _import(), the newest record always replaces the user's current state. */
+int replicator_queue_import_journal(struct replicator_queue *queue,
+				    const char *path);
+/* Export all users to the given path. If a journal is open, it's truncated
+   after a successful export. */
 int replicator_queue_export(struct replicator_queue *queue, const char *path);
 
+/* Start appending all user changes to the journal at the given path. */
+int replicator_queue_journal_open(struct replicator_queue *queue,
+				  const char *path);
+void replicator_queue_journal_close(struct replicator_queue *queue);
+
 /* Returns TRUE if user replication can be started now, FALSE if not. When
    returning FALSE, next_secs_r is set to user's next replication time. */
 bool replicator_queue_want_sync_now(struct replicator_queue *queue,
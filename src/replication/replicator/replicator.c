@@ -16,6 +16,7 @@
 /* if syncing fails, try again in 5 minutes */
 #define REPLICATOR_FAILURE_RESYNC_INTERVAL_SECS (60*5)
 #define REPLICATOR_DB_FNAME "replicator.db"
+#define REPLICATOR_DB_JOURNAL_FNAME "replicator.db.log"
 
 static struct replicator_queue *queue;
 static struct replicator_brain *brain;
@@ -41,6 +42,13 @@ static void replication_add_users(struct replicator_queue *queue)
 	/* add updates from replicator db, if it exists */
 	path = t_strconcat(service_set->state_dir, "/"REPLICATOR_DB_FNAME, NULL);
 	(void)replicator_queue_import(queue, path);
+
+	/* replay the changes since the last dump and continue journaling
+	   further changes, so they aren't lost if we crash */
+	path = t_strconcat(service_set->state_dir,
+			   "/"REPLICATOR_DB_JOURNAL_FNAME, NULL);
+	(void)replicator_queue_import_journal(queue, path);
+	(void)replicator_queue_journal_open(queue, path);
 }
 
 static void ATTR_NULL(1)
@@ -0,0 +1,202 @@
+/* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "str.h"
+#include "strescape.h"
+#include "istream.h"
+#include "ostream.h"
+#include "connection.h"
+#include "stats-exporter.h"
+
+#define STATS_EXPORTER_RECONNECT_INTERVAL_MSECS (10*1000)
+
+/* Protocol: After the VERSION handshake each event is sent as:
+
+   EVENT <TAB> metric name <TAB> log type <TAB> event [<TAB> parent ...]
+
+   The event and its parents are each in event_export() format, which is
+   tab-escaped once more. Nothing is expected from the receiver. */
+
+struct stats_exporter {
+	struct connection conn;
+	char *socket_path;
+	size_t max_buffer_size;
+
+	struct timeout *to_reconnect;
+	struct timeout *to_flush;
+	string_t *buf;
+
+	uint64_t dropped_count;
+	bool connected:1;
+};
+
+static struct connection_list *exporter_connections = NULL;
+
+static void stats_exporter_connect(struct stats_exporter *exporter);
+
+static void stats_exporter_reconnect(struct stats_exporter *exporter)
+{
+	timeout_remove(&exporter->to_reconnect);
+	stats_exporter_connect(exporter);
+}
+
+static void stats_exporter_disconnect(struct stats_exporter *exporter)
+{
+	timeout_remove(&exporter->to_flush);
+	if (exporter->connected) {
+		connection_disconnect(&exporter->conn);
+		exporter->connected = FALSE;
+	}
+	if (exporter->to_reconnect == NULL) {
+		exporter->to_reconnect =
+			timeout_add(STATS_EXPORTER_RECONNECT_INTERVAL_MSECS,
+				    stats_exporter_reconnect, exporter);
+	}
+}
+
+static void stats_exporter_connect(struct stats_exporter *exporter)
+{
+	if (connection_client_connect(&exporter->conn) < 0) {
+		i_error("stats: net_connect_unix(%s) failed: %m",
+			exporter->socket_path);
+		stats_exporter_disconnect(exporter);
+		return;
+	}
+	exporter->connected = TRUE;
+}
+
+static void stats_exporter_destroy(struct connection *conn)
+{
+	struct stats_exporter *exporter = (struct stats_exporter *)conn;
+
+	if (conn->disconnect_reason != CONNECTION_DISCONNECT_DEINIT)
+		i_error("stats: Event exporter %s disconnected",
+			exporter->socket_path);
+	stats_exporter_disconnect(exporter);
+}
+
+static void stats_exporter_input(struct connection *conn)
+{
+	const unsigned char *data;
+	size_t size;
+
+	/* the receiver isn't supposed to send anything */
+	while (i_stream_read_more(conn->input, &data, &size) > 0)
+		i_stream_skip(conn->input, size);
+	if (conn->input->eof || conn->input->stream_errno != 0) {
+		conn->disconnect_reason = CONNECTION_DISCONNECT_CONN_CLOSED;
+		stats_exporter_destroy(conn);
+	}
+}
+
+static const struct connection_settings stats_exporter_set = {
+	.service_name_out = "stats-exporter",
+	.major_version = 1,
+	.minor_version = 0,
+
+	.input_max_size = 1024,
+	.output_max_size = (size_t)-1,
+	.client = TRUE
+};
+
+static const struct connection_vfuncs stats_exporter_vfuncs = {
+	.destroy = stats_exporter_destroy,
+	.input = stats_exporter_input
+};
+
+struct stats_exporter *
+stats_exporter_init(const char *socket_path, size_t max_buffer_size)
+{
+	struct stats_exporter *exporter;
+
+	if (exporter_connections == NULL) {
+		exporter_connections =
+			connection_list_init(&stats_exporter_set,
+					     &stats_exporter_vfuncs);
+	}
+
+	exporter = i_new(struct stats_exporter, 1);
+	exporter->socket_path = i_strdup(socket_path);
+	exporter->max_buffer_size = max_buffer_size;
+	exporter->buf = str_new(default_pool, 512);
+	connection_init_client_unix(exporter_connections, &exporter->conn,
+				    exporter->socket_path);
+	stats_exporter_connect(exporter);
+	return exporter;
+}
+
+void stats_exporter_deinit(struct stats_exporter **_exporter)
+{
+	struct stats_exporter *exporter = *_exporter;
+
+	*_exporter = NULL;
+	if (exporter->connected)
+		(void)o_stream_flush(exporter->conn.output);
+	timeout_remove(&exporter->to_flush);
+	timeout_remove(&exporter->to_reconnect);
+	connection_deinit(&exporter->conn);
+	str_free(&exporter->buf);
+	i_free(exporter->socket_path);
+	i_free(exporter);
+
+	if (exporter_connections->connections == NULL)
+		connection_list_deinit(&exporter_connections);
+}
+
+static void stats_exporter_flush(struct stats_exporter *exporter)
+{
+	timeout_remove(&exporter->to_flush);
+	if (o_stream_uncork_flush(exporter->conn.output) < 0) {
+		i_error("stats: write(%s) failed: %s", exporter->socket_path,
+			o_stream_get_error(exporter->conn.output));
+		stats_exporter_disconnect(exporter);
+	}
+}
+
+void stats_exporter_event(struct stats_exporter *exporter,
+			  const char *metric_name, struct event *event,
+			  const struct failure_context *ctx)
+{
+	string_t *str = exporter->buf;
+
+	if (!exporter->connected)
+		return;
+
+	str_truncate(str, 0);
+	str_append(str, "EVENT\t");
+	str_append_tabescaped(str, metric_name);
+	str_printfa(str, "\t%d", ctx->type);
+	for (; event != NULL; event = event_get_parent(event)) T_BEGIN {
+		string_t *event_str = t_str_new(256);
+
+		event_export(event, event_str);
+		str_append_c(str, '\t');
+		str_append_tabescaped(str, str_c(event_str));
+	} T_END;
+	str_append_c(str, '\n');
+
+	if (o_stream_get_buffer_used_size(exporter->conn.output) +
+	    str_len(str) > exporter->max_buffer_size) {
+		/* the receiver isn't keeping up - don't let it grow
+		   our memory usage */
+		if (exporter->dropped_count++ == 0) {
+			i_warning("stats: Event exporter %s is too slow - "
+				  "dropping events", exporter->socket_path);
+		}
+		return;
+	}
+	if (exporter->dropped_count > 0) {
+		i_warning("stats: Event exporter %s dropped %"PRIu64" events",
+			  exporter->socket_path, exporter->dropped_count);
+		exporter->dropped_count = 0;
+	}
+
+	/* send all events of this ioloop run in one write */
+	if (exporter->to_flush == NULL) {
+		o_stream_cork(exporter->conn.output);
+		exporter->to_flush = timeout_add_short(0,
+			stats_exporter_flush, exporter);
+	}
+	o_stream_nsend(exporter->conn.output, str_data(str), str_len(str));
+}
@@ -0,0 +1,20 @@
+#ifndef STATS_EXPORTER_H
+#define STATS_EXPORTER_H
+
+struct event;
+struct failure_context;
+
+/* Stream events to an external process listening in the UNIX socket path.
+   The connection is non-blocking and events are sent in batches once per
+   ioloop run. If the receiver can't keep up and more than max_buffer_size
+   bytes are waiting to be sent, new events are dropped. */
+struct stats_exporter *
+stats_exporter_init(const char *socket_path, size_t max_buffer_size);
+void stats_exporter_deinit(struct stats_exporter **exporter);
+
+/* Export the event, which matched the given metric. */
+void stats_exporter_event(struct stats_exporter *exporter,
+			  const char *metric_name, struct event *event,
+			  const struct failure_context *ctx);
+
+#endif
@@ -6,12 +6,15 @@
 #include "time-util.h"
 #include "event-filter.h"
 #include "stats-settings.h"
+#include "stats-exporter.h"
 #include "stats-metrics.h"
 
 struct stats_metrics {
 	pool_t pool;
 	struct event_filter *filter;
 	ARRAY(struct metric *) metrics;
+
+	struct stats_exporter *exporter;
 };
 
 static void
@@ -54,7 +57,8 @@ static void stats_metrics_add_set(struct stats_metrics *metrics,
 
 	metric = p_new(metrics->pool, struct metric, 1);
 	metric->name = p_strdup(metrics->pool, set->name);
-	metric->duration_stats = stats_dist_init();
+	metric->duration_stats = stats_dist_init_sketch();
+	metric->export_events = set->export_events;
 
 	fields = t_strsplit_spaces(set->fields, " ");
 	metric->fields_count = str_array_length(fields);
@@ -64,7 +68,7 @@ static void stats_metrics_add_set(struct stats_metrics *metrics,
 		for (unsigned int i = 0; i < metric->fields_count; i++) {
 			metric->fields[i].field_key =
 				p_strdup(metrics->pool, fields[i]);
-			metric->fields[i].stats = stats_dist_init();
+			metric->fields[i].stats = stats_dist_init_sketch();
 		}
 	}
 	array_push_back(&metrics->metrics, &metric);
@@ -101,6 +105,11 @@ struct stats_metrics *stats_metrics_init(const struct stats_settings *set)
 	metrics->pool = pool;
 	metrics->filter = event_filter_create();
 	stats_metrics_add_from_settings(metrics, set);
+	if (set->stats_exporter_socket_path[0] != '\0') {
+		metrics->exporter =
+			stats_exporter_init(set->stats_exporter_socket_path,
+					    set->stats_exporter_max_buffer_size);
+	}
 	return metrics;
 }
 
@@ -120,6 +129,8 @@ void stats_metrics_deinit(struct stats_metrics **_metrics)
 
 	array_foreach(&metrics->metrics, metricp)
 		stats_metric_free(*metricp);
+	if (metrics->exporter != NULL)
+		stats_exporter_deinit(&metrics->exporter);
 	event_filter_unref(&metrics->filter);
 	pool_unref(&metrics->pool);
 }
@@ -178,8 +189,13 @@ void stats_metrics_event(struct stats_metrics *metrics, struct event *event,
 	struct metric *metric;
 
 	iter = event_filter_match_iter_init(metrics->filter, event, ctx);
-	while ((metric = event_filter_match_iter_next(iter)) != NULL)
+	while ((metric = event_filter_match_iter_next(iter)) != NULL) {
 		stats_metric_event(metric, event);
+		if (metric->export_events && metrics->exporter != NULL) {
+			stats_exporter_event(metrics->exporter, metric->name,
+					     event, ctx);
+		}
+	}
 	event_filter_match_iter_deinit(&iter);
 }
 
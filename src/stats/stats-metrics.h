@@ -16,6 +16,9 @@ struct metric {
 
 	unsigned int fields_count;
 	struct metric_field *fields;
+
+	/* Send matching events to the stats exporter */
+	bool export_events;
 };
 
 struct stats_metrics *stats_metrics_init(const struct stats_settings *set);
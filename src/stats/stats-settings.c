@@ -58,6 +58,7 @@ static const struct setting_define stats_metric_setting_defines[] = {
 	DEF(SET_STR, categories),
 	DEF(SET_STR, fields),
 	{ SET_STRLIST, "filter", offsetof(struct stats_metric_settings, filter), NULL },
+	DEF(SET_BOOL, export_events),
 	SETTING_DEFINE_LIST_END
 };
 
@@ -67,6 +68,7 @@ static const struct stats_metric_settings stats_metric_default_settings = {
 	.source_location = "",
 	.categories = "",
 	.fields = "",
+	.export_events = FALSE,
 };
 
 const struct setting_parser_info stats_metric_setting_parser_info = {
@@ -80,17 +82,26 @@ const struct setting_parser_info stats_metric_setting_parser_info = {
 	.check_func = stats_metric_settings_check,
 };
 
+#undef DEF
+#define DEF(type, name) \
+	{ type, #name, offsetof(struct stats_settings, name), NULL }
 #undef DEFLIST_UNIQUE
 #define DEFLIST_UNIQUE(field, name, defines) \
 	{ SET_DEFLIST_UNIQUE, name, \
 	  offsetof(struct stats_settings, field), defines }
 
 static const struct setting_define stats_setting_defines[] = {
+	DEF(SET_STR, stats_exporter_socket_path),
+	DEF(SET_SIZE, stats_exporter_max_buffer_size),
+
 	DEFLIST_UNIQUE(metrics, "metric", &stats_metric_setting_parser_info),
 	SETTING_DEFINE_LIST_END
 };
 
 const struct stats_settings stats_default_settings = {
+	.stats_exporter_socket_path = "",
+	.stats_exporter_max_buffer_size = 1024*1024,
+
 	.metrics = ARRAY_INIT
 };
 
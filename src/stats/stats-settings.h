@@ -8,11 +8,15 @@ struct stats_metric_settings {
 	const char *categories;
 	const char *fields;
 	ARRAY(const char *) filter;
+	bool export_events;
 
 	unsigned int parsed_source_linenum;
 };
 
 struct stats_settings {
+	const char *stats_exporter_socket_path;
+	uoff_t stats_exporter_max_buffer_size;
+
 	ARRAY(struct stats_metric_settings *) metrics;
 };
 
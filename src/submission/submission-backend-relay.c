@@ -1,8 +1,11 @@
 /* Copyright (c) 2018 Dovecot authors, see the included COPYING file */
 
 #include "submission-common.h"
+#include "ioloop.h"
+#include "llist.h"
 #include "str.h"
 #include "str-sanitize.h"
+#include "strescape.h"
 #include "mail-user.h"
 #include "iostream-ssl.h"
 #include "smtp-client.h"
@@ -13,18 +16,39 @@
 #include "submission-recipient.h"
 #include "submission-backend-relay.h"
 
+/* How long an idle relay connection is kept in the pool */
+#define SUBMISSION_RELAY_POOL_IDLE_TIMEOUT_MSECS (30*1000)
+
 struct submission_backend_relay {
 	struct submission_backend backend;
 
 	struct smtp_client_connection *conn;
 	struct smtp_client_transaction *trans;
 
+	/* Connection pool key, or NULL if the connection isn't pooled */
+	const char *pool_key;
+	unsigned int pool_max_connections;
+	struct timeout *to_pool_ready;
+
 	bool trans_started:1;
 	bool trusted:1;
 };
 
+struct submission_relay_pool_conn {
+	struct submission_relay_pool_conn *prev, *next;
+
+	char *key;
+	struct smtp_client_connection *conn;
+	struct timeout *to_idle;
+};
+
 static struct submission_backend_vfuncs backend_relay_vfuncs;
 
+/* Idle relay connections that can be reused by the following clients of this
+   process. Sorted by the time they were added. */
+static struct submission_relay_pool_conn *relay_pool_head, *relay_pool_tail;
+static unsigned int relay_pool_count;
+
 /*
  * Common
  */
@@ -924,6 +948,11 @@ static void relay_cmd_quit_relay(struct relay_cmd_quit_context *quit_cmd)
 		smtp_server_reply_quit(cmd);
 		return;
 	}
+	if (backend->pool_key != NULL) {
+		/* The relay connection is kept open for the next client. */
+		smtp_server_reply_quit(cmd);
+		return;
+	}
 
 	/* RFC 5321, Section 4.1.1.10:
 
@@ -971,6 +1000,100 @@ backend_relay_cmd_quit(struct submission_backend *_backend,
 	return 0;
 }
 
+/*
+ * Connection pool
+ */
+
+static const char *
+backend_relay_pool_get_key(const struct submision_backend_relay_settings *set)
+{
+	/* XCLIENT data is per client and it can be sent only once per
+	   connection. Raw logs are written to the user's directory. */
+	if (set->pool_max_connections == 0 || set->trusted ||
+	    (set->rawlog_dir != NULL && *set->rawlog_dir != '\0'))
+		return NULL;
+
+	return t_strdup_printf("%d\t%s\t%s\t%u\t%d\t%d\t%s\t%s\t%s\t%s",
+			       set->protocol,
+			       str_tabescape(set->path == NULL ? "" : set->path),
+			       str_tabescape(set->host == NULL ? "" : set->host),
+			       set->port, set->ssl_mode, set->ssl_verify ? 1 : 0,
+			       str_tabescape(set->my_hostname),
+			       str_tabescape(set->user),
+			       str_tabescape(set->master_user),
+			       str_tabescape(set->password));
+}
+
+static void
+backend_relay_pool_conn_free(struct submission_relay_pool_conn *pconn,
+			     struct smtp_client_connection **conn_r)
+{
+	DLLIST2_REMOVE(&relay_pool_head, &relay_pool_tail, pconn);
+	relay_pool_count--;
+
+	timeout_remove(&pconn->to_idle);
+	if (conn_r != NULL)
+		*conn_r = pconn->conn;
+	else
+		smtp_client_connection_close(&pconn->conn);
+	i_free(pconn->key);
+	i_free(pconn);
+}
+
+static void
+backend_relay_pool_conn_idle_timeout(struct submission_relay_pool_conn *pconn)
+{
+	backend_relay_pool_conn_free(pconn, NULL);
+}
+
+static struct smtp_client_connection *
+backend_relay_pool_take(const char *key)
+{
+	struct submission_relay_pool_conn *pconn, *next;
+	struct smtp_client_connection *conn;
+
+	/* prefer the most recently used connection */
+	for (pconn = relay_pool_tail; pconn != NULL; pconn = next) {
+		next = pconn->prev;
+		if (strcmp(pconn->key, key) != 0)
+			continue;
+		if (smtp_client_connection_get_state(pconn->conn) !=
+		    SMTP_CLIENT_CONNECTION_STATE_READY) {
+			/* disconnected by the relay server */
+			backend_relay_pool_conn_free(pconn, NULL);
+			continue;
+		}
+		backend_relay_pool_conn_free(pconn, &conn);
+		return conn;
+	}
+	return NULL;
+}
+
+static void
+backend_relay_pool_put(struct submission_backend_relay *backend)
+{
+	struct submission_relay_pool_conn *pconn;
+
+	while (relay_pool_count >= backend->pool_max_connections)
+		backend_relay_pool_conn_free(relay_pool_head, NULL);
+
+	pconn = i_new(struct submission_relay_pool_conn, 1);
+	pconn->key = i_strdup(backend->pool_key);
+	pconn->conn = backend->conn;
+	pconn->to_idle = timeout_add(SUBMISSION_RELAY_POOL_IDLE_TIMEOUT_MSECS,
+				     backend_relay_pool_conn_idle_timeout,
+				     pconn);
+	DLLIST2_APPEND(&relay_pool_head, &relay_pool_tail, pconn);
+	relay_pool_count++;
+	backend->conn = NULL;
+}
+
+void submission_backend_relay_pool_deinit(void)
+{
+	while (relay_pool_head != NULL)
+		backend_relay_pool_conn_free(relay_pool_head, NULL);
+}
+
 /*
  * Relay backend
  */
@@ -1036,6 +1159,17 @@ submission_backend_relay_create(
 	smtp_set.connect_timeout_msecs = set->connect_timeout_msecs;
 	smtp_set.command_timeout_msecs = set->command_timeout_msecs;
 
+	backend->pool_key = p_strdup(pool, backend_relay_pool_get_key(set));
+	backend->pool_max_connections = set->pool_max_connections;
+	if (backend->pool_key != NULL) {
+		backend->conn = backend_relay_pool_take(backend->pool_key);
+		if (backend->conn != NULL) {
+			e_debug(user->event,
+				"Reusing pooled relay connection");
+			return backend;
+		}
+	}
+
 	if (set->path == NULL) {
 		backend->conn = smtp_client_connection_create(
 			smtp_client, set->protocol, set->host, set->port,
@@ -1073,8 +1207,13 @@ static void backend_relay_destroy(struct submission_backend *_backend)
 	struct submission_backend_relay *backend =
 		(struct submission_backend_relay *)_backend;
 
+	timeout_remove(&backend->to_pool_ready);
 	if (backend->trans != NULL)
 		smtp_client_transaction_destroy(&backend->trans);
+	if (backend->conn != NULL && backend->pool_key != NULL &&
+	    smtp_client_connection_get_state(backend->conn) ==
+	    SMTP_CLIENT_CONNECTION_STATE_READY)
+		backend_relay_pool_put(backend);
 	if (backend->conn != NULL)
 		smtp_client_connection_close(&backend->conn);
 }
@@ -1099,11 +1238,25 @@ static void backend_relay_ready_cb(const struct smtp_reply *reply,
 		smtp_client_connection_get_capabilities(backend->conn));
 }
 
+static void backend_relay_pool_ready(struct submission_backend_relay *backend)
+{
+	timeout_remove(&backend->to_pool_ready);
+	submission_backend_started(&backend->backend,
+		smtp_client_connection_get_capabilities(backend->conn));
+}
+
 static void backend_relay_start(struct submission_backend *_backend)
 {
 	struct submission_backend_relay *backend =
 		(struct submission_backend_relay *)_backend;
 
+	if (smtp_client_connection_get_state(backend->conn) ==
+	    SMTP_CLIENT_CONNECTION_STATE_READY) {
+		/* pooled connection is already logged in */
+		backend->to_pool_ready = timeout_add_short(0,
+			backend_relay_pool_ready, backend);
+		return;
+	}
 	smtp_client_connection_connect(backend->conn,
 				       backend_relay_ready_cb, backend);
 }
@@ -29,6 +29,10 @@ struct submision_backend_relay_settings {
 	unsigned int connect_timeout_msecs;
 	unsigned int command_timeout_msecs;
 
+	/* Maximum number of idle relay connections to keep in this process
+	   for reuse by the following clients. 0 disables pooling. */
+	unsigned int pool_max_connections;
+
 	bool ssl_verify:1;
 	bool trusted:1;
 };
@@ -38,6 +42,9 @@ submission_backend_relay_create(
 	struct client *client,
 	const struct submision_backend_relay_settings *set);
 
+/* Close all the pooled relay connections. */
+void submission_backend_relay_pool_deinit(void);
+
 /* Returns the base backend object for this relay backend */
 struct submission_backend *
 submission_backend_relay_get(struct submission_backend_relay *backend)
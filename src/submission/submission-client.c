@@ -150,6 +150,8 @@ client_create_backend_default(struct client *client,
 	relay_set.max_idle_time = set->submission_relay_max_idle_time;
 	relay_set.connect_timeout_msecs = set->submission_relay_connect_timeout;
 	relay_set.command_timeout_msecs = set->submission_relay_command_timeout;
+	relay_set.pool_max_connections =
+		set->submission_relay_max_pooled_connections;
 	relay_set.trusted = set->submission_relay_trusted;
 
 	if (strcmp(set->submission_relay_ssl, "smtps") == 0)
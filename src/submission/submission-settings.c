@@ -88,6 +88,7 @@ static const struct setting_define submission_setting_defines[] = {
 
 	DEF(SET_TIME_MSECS, submission_relay_connect_timeout),
 	DEF(SET_TIME_MSECS, submission_relay_command_timeout),
+	DEF(SET_UINT, submission_relay_max_pooled_connections),
 
 	DEF(SET_STR, imap_urlauth_host),
 	DEF(SET_IN_PORT, imap_urlauth_port),
@@ -127,6 +128,7 @@ static const struct submission_settings submission_default_settings = {
 
 	.submission_relay_connect_timeout = 30*1000,
 	.submission_relay_command_timeout = 60*5*1000,
+	.submission_relay_max_pooled_connections = 0,
 
 	.imap_urlauth_host = "",
 	.imap_urlauth_port = 143,
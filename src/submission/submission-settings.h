@@ -45,6 +45,7 @@ struct submission_settings {
 
 	unsigned int submission_relay_connect_timeout;
 	unsigned int submission_relay_command_timeout;
+	unsigned int submission_relay_max_pooled_connections;
 
 	/* imap urlauth: */
 	const char *imap_urlauth_host;
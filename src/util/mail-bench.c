@@ -0,0 +1,682 @@
+/* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "array.h"
+#include "str.h"
+#include "strnum.h"
+#include "istream.h"
+#include "stats-dist.h"
+#include "time-util.h"
+#include "imapc-client.h"
+#include "smtp-address.h"
+#include "smtp-reply.h"
+#include "smtp-client.h"
+#include "smtp-client-connection.h"
+#include "smtp-client-transaction.h"
+#include "master-service.h"
+
+#include <stdio.h>
+#include <sys/time.h>
+
+/* Load generator for IMAP and LMTP. Each client logs in with its own IMAP
+   connection, selects INBOX and then keeps running commands picked randomly
+   from the workload, weighted by their relative weights. One command is
+   running at a time for each client, so the concurrency is the number of
+   clients. After the run the latency percentiles are printed for each
+   command.
+
+   The workload file has one command per line:
+
+   <select|fetch|search|idle|append|lmtp> <weight> [<arguments>]
+
+   The arguments are the full IMAP command for select, fetch and search,
+   and the number of milliseconds to idle for idle. append and lmtp send
+   the message given with -m. */
+
+#define MAIL_BENCH_DEFAULT_CLIENTS 10
+#define MAIL_BENCH_DEFAULT_SECS 60
+#define MAIL_BENCH_DEFAULT_IDLE_MSECS 1000
+#define MAIL_BENCH_STATS_SAMPLE_COUNT 100000
+
+enum mail_bench_cmd_type {
+	MAIL_BENCH_CMD_SELECT,
+	MAIL_BENCH_CMD_FETCH,
+	MAIL_BENCH_CMD_SEARCH,
+	MAIL_BENCH_CMD_IDLE,
+	MAIL_BENCH_CMD_APPEND,
+	MAIL_BENCH_CMD_LMTP,
+
+	MAIL_BENCH_CMD_COUNT
+};
+
+struct mail_bench_cmd {
+	enum mail_bench_cmd_type type;
+	/* relative weight of the command in the workload */
+	unsigned int weight;
+	/* IMAP command to send. For IDLE this is the number of milliseconds
+	   to stay idling. Not used for APPEND and LMTP. */
+	char *args;
+
+	struct stats_dist *latency;
+	unsigned int failures;
+};
+
+struct mail_bench_client {
+	unsigned int idx;
+	char *username;
+
+	struct imapc_client *imapc;
+	struct imapc_client_mailbox *box;
+	struct smtp_client_connection *lmtp_conn;
+	struct timeout *to;
+
+	struct mail_bench_cmd *cmd;
+	struct timeval cmd_start;
+	char *lmtp_error;
+};
+
+static const char *mail_bench_cmd_names[MAIL_BENCH_CMD_COUNT] = {
+	"select", "fetch", "search", "idle", "append", "lmtp"
+};
+
+static const char *mail_bench_default_workload[] = {
+	"select 5 SELECT INBOX",
+	"fetch 40 UID FETCH 1:20 (UID FLAGS BODY.PEEK[HEADER])",
+	"search 10 SEARCH SUBJECT benchmark",
+	"idle 5",
+	"append 10",
+	"lmtp 30",
+	NULL
+};
+
+static const char mail_bench_default_message[] =
+	"From: mail-bench <mail-bench@example.com>\r\n"
+	"To: mail-bench <mail-bench@example.com>\r\n"
+	"Subject: benchmark message\r\n"
+	"Date: Mon, 1 Jul 2019 12:00:00 +0000\r\n"
+	"Message-ID: <mail-bench@example.com>\r\n"
+	"\r\n"
+	"This message was sent by mail-bench.\r\n";
+
+static struct imapc_client_settings imapc_set;
+static struct smtp_client *lmtp_client;
+static const char *lmtp_host;
+static in_port_t lmtp_port;
+static const char *user_template;
+static unsigned int user_count;
+static buffer_t *message_buf;
+static const unsigned char *message_data;
+static size_t message_size;
+
+static ARRAY(struct mail_bench_cmd) cmds;
+static unsigned int total_weight;
+static ARRAY(struct mail_bench_client *) clients;
+static unsigned int clients_running;
+static bool stopping;
+
+static void mail_bench_client_next(struct mail_bench_client *client);
+
+static void mail_bench_workload_add(const char *line)
+{
+	struct mail_bench_cmd *cmd;
+	const char *name, *weight, *args;
+	enum mail_bench_cmd_type type;
+
+	/* <command> <weight> [<arguments>] */
+	name = t_strcut(line, ' ');
+	weight = line[strlen(name)] == '\0' ? "" : line + strlen(name) + 1;
+	args = strchr(weight, ' ');
+	if (args != NULL)
+		weight = t_strdup_until(weight, args++);
+
+	for (type = 0; type < MAIL_BENCH_CMD_COUNT; type++) {
+		if (strcasecmp(name, mail_bench_cmd_names[type]) == 0)
+			break;
+	}
+	if (type == MAIL_BENCH_CMD_COUNT)
+		i_fatal("Unknown workload command: %s", name);
+
+	cmd = array_append_space(&cmds);
+	cmd->type = type;
+	if (str_to_uint(weight, &cmd->weight) < 0 || cmd->weight == 0)
+		i_fatal("Invalid weight for workload command %s: %s", name, weight);
+	total_weight += cmd->weight;
+
+	switch (type) {
+	case MAIL_BENCH_CMD_SELECT:
+	case MAIL_BENCH_CMD_FETCH:
+	case MAIL_BENCH_CMD_SEARCH:
+		if (args == NULL)
+			i_fatal("Workload command %s is missing the IMAP command", name);
+		cmd->args = i_strdup(args);
+		break;
+	case MAIL_BENCH_CMD_IDLE:
+		cmd->args = i_strdup(args != NULL ? args :
+			dec2str(MAIL_BENCH_DEFAULT_IDLE_MSECS));
+		break;
+	case MAIL_BENCH_CMD_APPEND:
+	case MAIL_BENCH_CMD_LMTP:
+		break;
+	case MAIL_BENCH_CMD_COUNT:
+		i_unreached();
+	}
+	cmd->latency = stats_dist_init_with_size(MAIL_BENCH_STATS_SAMPLE_COUNT);
+}
+
+static void mail_bench_workload_read(const char *path)
+{
+	struct istream *input;
+	const char *line;
+
+	input = i_stream_create_file(path, IO_BLOCK_SIZE);
+	while ((line = i_stream_read_next_line(input)) != NULL) {
+		line = t_str_trim(line, " \t\r");
+		if (line[0] == '\0' || line[0] == '#')
+			continue;
+		T_BEGIN {
+			mail_bench_workload_add(line);
+		} T_END;
+	}
+	if (input->stream_errno != 0) {
+		i_fatal("read(%s) failed: %s", path,
+			i_stream_get_error(input));
+	}
+	i_stream_unref(&input);
+}
+
+static void mail_bench_message_read(const char *path)
+{
+	struct istream *input;
+	const unsigned char *data;
+	size_t size;
+	ssize_t ret;
+
+	message_buf = buffer_create_dynamic(default_pool, 4096);
+	input = i_stream_create_file(path, IO_BLOCK_SIZE);
+	while ((ret = i_stream_read_more(input, &data, &size)) > 0) {
+		buffer_append(message_buf, data, size);
+		i_stream_skip(input, size);
+	}
+	i_assert(ret == -1);
+	if (input->stream_errno != 0) {
+		i_fatal("read(%s) failed: %s", path,
+			i_stream_get_error(input));
+	}
+	i_stream_unref(&input);
+	message_data = message_buf->data;
+	message_size = message_buf->used;
+}
+
+static struct mail_bench_cmd *mail_bench_cmd_pick(void)
+{
+	struct mail_bench_cmd *cmd;
+	unsigned int n = i_rand_limit(total_weight);
+
+	array_foreach_modifiable(&cmds, cmd) {
+		if (n < cmd->weight)
+			return cmd;
+		n -= cmd->weight;
+	}
+	i_unreached();
+}
+
+static void mail_bench_client_free(struct mail_bench_client *client)
+{
+	timeout_remove(&client->to);
+	if (client->box != NULL)
+		imapc_client_mailbox_close(&client->box);
+	if (client->imapc != NULL)
+		imapc_client_deinit(&client->imapc);
+	if (client->lmtp_conn != NULL)
+		smtp_client_connection_unref(&client->lmtp_conn);
+
+	i_assert(clients_running > 0);
+	if (--clients_running == 0)
+		io_loop_stop(current_ioloop);
+}
+
+static void mail_bench_client_destroy(struct mail_bench_client *client)
+{
+	/* this is usually called from imapc/smtp-client callbacks, so
+	   don't free the connections immediately */
+	timeout_remove(&client->to);
+	client->to = timeout_add_short(0, mail_bench_client_free, client);
+	client->cmd = NULL;
+}
+
+static void
+mail_bench_cmd_finish(struct mail_bench_client *client, bool success,
+		      const char *error)
+{
+	struct mail_bench_cmd *cmd = client->cmd;
+	struct timeval now;
+
+	i_assert(cmd != NULL);
+	client->cmd = NULL;
+
+	if (!success) {
+		cmd->failures++;
+		if (imapc_set.debug) {
+			i_debug("%s: %s failed: %s", client->username,
+				mail_bench_cmd_names[cmd->type], error);
+		}
+	} else {
+		if (gettimeofday(&now, NULL) < 0)
+			i_fatal("gettimeofday() failed: %m");
+		stats_dist_add(cmd->latency,
+			       timeval_diff_usecs(&now, &client->cmd_start));
+	}
+	mail_bench_client_next(client);
+}
+
+static void
+mail_bench_imap_cmd_callback(const struct imapc_command_reply *reply,
+			     void *context)
+{
+	struct mail_bench_client *client = context;
+
+	switch (reply->state) {
+	case IMAPC_COMMAND_STATE_OK:
+		mail_bench_cmd_finish(client, TRUE, NULL);
+		break;
+	case IMAPC_COMMAND_STATE_NO:
+	case IMAPC_COMMAND_STATE_BAD:
+		mail_bench_cmd_finish(client, FALSE, reply->text_full);
+		break;
+	case IMAPC_COMMAND_STATE_AUTH_FAILED:
+	case IMAPC_COMMAND_STATE_DISCONNECTED:
+		i_error("%s: %s failed: %s", client->username,
+			mail_bench_cmd_names[client->cmd->type],
+			reply->text_full);
+		client->cmd->failures++;
+		client->cmd = NULL;
+		mail_bench_client_destroy(client);
+		break;
+	}
+}
+
+static void mail_bench_idle_finish(struct mail_bench_client *client)
+{
+	timeout_remove(&client->to);
+	mail_bench_cmd_finish(client, TRUE, NULL);
+}
+
+static void
+mail_bench_lmtp_reply(struct mail_bench_client *client, const char *cmd_name,
+		      const struct smtp_reply *reply)
+{
+	if (!smtp_reply_is_success(reply) && client->lmtp_error == NULL) {
+		client->lmtp_error = i_strdup_printf("%s: %s", cmd_name,
+						     smtp_reply_log(reply));
+	}
+}
+
+static void
+mail_bench_lmtp_rcpt_callback(const struct smtp_reply *reply,
+			      struct mail_bench_client *client)
+{
+	mail_bench_lmtp_reply(client, "RCPT TO", reply);
+}
+
+static void
+mail_bench_lmtp_data_callback(const struct smtp_reply *reply,
+			      struct mail_bench_client *client)
+{
+	mail_bench_lmtp_reply(client, "DATA", reply);
+}
+
+static void
+mail_bench_lmtp_trans_data_callback(const struct smtp_reply *reply ATTR_UNUSED,
+				    struct mail_bench_client *client ATTR_UNUSED)
+{
+	/* the per-recipient data callback handles the reply */
+}
+
+static void mail_bench_lmtp_trans_callback(struct mail_bench_client *client)
+{
+	char *error = client->lmtp_error;
+
+	/* all the replies have been received */
+	client->lmtp_error = NULL;
+	mail_bench_cmd_finish(client, error == NULL, error);
+	i_free(error);
+}
+
+static void mail_bench_lmtp_deliver(struct mail_bench_client *client)
+{
+	struct smtp_client_transaction *trans;
+	struct smtp_address *rcpt_to;
+	struct istream *input;
+	const char *error;
+
+	if (smtp_address_parse_username(pool_datastack_create(),
+					client->username, &rcpt_to,
+					&error) < 0) {
+		mail_bench_cmd_finish(client, FALSE, t_strdup_printf(
+			"Invalid username '%s': %s", client->username, error));
+		return;
+	}
+
+	if (client->lmtp_conn == NULL) {
+		if (strchr(lmtp_host, '/') != NULL) {
+			client->lmtp_conn = smtp_client_connection_create_unix(
+				lmtp_client, SMTP_PROTOCOL_LMTP, lmtp_host, NULL);
+		} else {
+			client->lmtp_conn = smtp_client_connection_create(
+				lmtp_client, SMTP_PROTOCOL_LMTP, lmtp_host,
+				lmtp_port, SMTP_CLIENT_SSL_MODE_NONE, NULL);
+		}
+		smtp_client_connection_connect(client->lmtp_conn, NULL, NULL);
+	}
+
+	trans = smtp_client_transaction_create(client->lmtp_conn,
+		smtp_address_create_temp("mail-bench", "example.com"), NULL, 0,
+		mail_bench_lmtp_trans_callback, client);
+	smtp_client_transaction_add_rcpt(trans, rcpt_to, NULL,
+		mail_bench_lmtp_rcpt_callback, mail_bench_lmtp_data_callback,
+		client);
+	input = i_stream_create_from_data(message_data, message_size);
+	smtp_client_transaction_send(trans, input,
+		mail_bench_lmtp_trans_data_callback, client);
+	i_stream_unref(&input);
+}
+
+static void mail_bench_client_run(struct mail_bench_client *client)
+{
+	struct mail_bench_cmd *cmd = client->cmd;
+	struct imapc_command *imapc_cmd;
+	struct istream *input;
+	unsigned int msecs;
+
+	if (gettimeofday(&client->cmd_start, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+
+	switch (cmd->type) {
+	case MAIL_BENCH_CMD_SELECT:
+	case MAIL_BENCH_CMD_FETCH:
+	case MAIL_BENCH_CMD_SEARCH:
+		imapc_cmd = imapc_client_mailbox_cmd(client->box,
+			mail_bench_imap_cmd_callback, client);
+		if (cmd->type == MAIL_BENCH_CMD_SELECT)
+			imapc_command_set_flags(imapc_cmd, IMAPC_COMMAND_FLAG_SELECT);
+		imapc_command_send(imapc_cmd, cmd->args);
+		break;
+	case MAIL_BENCH_CMD_IDLE:
+		/* IMAPC starts IDLE when there are no commands running and
+		   sends DONE when the next command is sent. The latency is
+		   the time spent idling. */
+		if (str_to_uint(cmd->args, &msecs) < 0)
+			msecs = MAIL_BENCH_DEFAULT_IDLE_MSECS;
+		imapc_client_mailbox_idle(client->box);
+		client->to = timeout_add(msecs, mail_bench_idle_finish, client);
+		break;
+	case MAIL_BENCH_CMD_APPEND:
+		imapc_cmd = imapc_client_cmd(client->imapc,
+			mail_bench_imap_cmd_callback, client);
+		input = i_stream_create_from_data(message_data, message_size);
+		imapc_command_sendf(imapc_cmd, "APPEND INBOX %p", input);
+		i_stream_unref(&input);
+		break;
+	case MAIL_BENCH_CMD_LMTP:
+		mail_bench_lmtp_deliver(client);
+		break;
+	case MAIL_BENCH_CMD_COUNT:
+		i_unreached();
+	}
+}
+
+static void mail_bench_client_next(struct mail_bench_client *client)
+{
+	if (stopping) {
+		mail_bench_client_destroy(client);
+		return;
+	}
+	client->cmd = mail_bench_cmd_pick();
+	T_BEGIN {
+		mail_bench_client_run(client);
+	} T_END;
+}
+
+static void
+mail_bench_select_callback(const struct imapc_command_reply *reply,
+			   void *context)
+{
+	struct mail_bench_client *client = context;
+
+	if (reply->state != IMAPC_COMMAND_STATE_OK) {
+		i_error("%s: SELECT INBOX failed: %s", client->username,
+			reply->text_full);
+		mail_bench_client_destroy(client);
+		return;
+	}
+	mail_bench_client_next(client);
+}
+
+static void
+mail_bench_login_callback(const struct imapc_command_reply *reply,
+			  void *context)
+{
+	struct mail_bench_client *client = context;
+	struct imapc_command *cmd;
+
+	if (reply->state != IMAPC_COMMAND_STATE_OK) {
+		i_error("%s: Login failed: %s", client->username,
+			reply->text_full);
+		mail_bench_client_destroy(client);
+		return;
+	}
+
+	client->box = imapc_client_mailbox_open(client->imapc, NULL);
+	cmd = imapc_client_mailbox_cmd(client->box,
+				       mail_bench_select_callback, client);
+	imapc_command_set_flags(cmd, IMAPC_COMMAND_FLAG_SELECT);
+	imapc_command_send(cmd, "SELECT INBOX");
+}
+
+static const char *mail_bench_get_username(unsigned int idx)
+{
+	const char *p = strstr(user_template, "%n");
+
+	/* %n is replaced with the user number */
+	if (p == NULL)
+		return user_template;
+	return t_strdup_printf("%s%u%s", t_strdup_until(user_template, p),
+			       idx % user_count + 1, p + 2);
+}
+
+static void mail_bench_client_start(unsigned int idx)
+{
+	struct mail_bench_client *client;
+	struct imapc_client_settings set = imapc_set;
+
+	client = i_new(struct mail_bench_client, 1);
+	client->idx = idx;
+	client->username = i_strdup(mail_bench_get_username(idx));
+	array_append(&clients, &client, 1);
+	clients_running++;
+
+	set.username = client->username;
+	client->imapc = imapc_client_init(&set);
+	imapc_client_set_login_callback(client->imapc,
+					mail_bench_login_callback, client);
+	imapc_client_login(client->imapc);
+}
+
+static void mail_bench_stop(void *context ATTR_UNUSED)
+{
+	/* let the running commands finish */
+	stopping = TRUE;
+}
+
+static void mail_bench_print_results(unsigned int secs)
+{
+	const struct mail_bench_cmd *cmd;
+	unsigned int count, total = 0;
+
+	printf("%-8s %9s %7s %9s %9s %9s %9s %9s %9s\n", "command", "count",
+	       "failed", "cmd/s", "p50 ms", "p90 ms", "p95 ms", "p99 ms",
+	       "max ms");
+	array_foreach(&cmds, cmd) {
+		count = stats_dist_get_count(cmd->latency);
+		total += count;
+		printf("%-8s %9u %7u %9.1f", mail_bench_cmd_names[cmd->type],
+		       count, cmd->failures, (double)count / secs);
+		if (count == 0) {
+			printf("\n");
+			continue;
+		}
+		printf(" %9.2f %9.2f %9.2f %9.2f %9.2f\n",
+		       stats_dist_get_percentile(cmd->latency, 0.50) / 1000.0,
+		       stats_dist_get_percentile(cmd->latency, 0.90) / 1000.0,
+		       stats_dist_get_percentile(cmd->latency, 0.95) / 1000.0,
+		       stats_dist_get_percentile(cmd->latency, 0.99) / 1000.0,
+		       stats_dist_get_max(cmd->latency) / 1000.0);
+	}
+	printf("%-8s %9u %7s %9.1f\n", "total", total, "", (double)total / secs);
+}
+
+static void mail_bench_deinit(void)
+{
+	struct mail_bench_client **clientp;
+	struct mail_bench_cmd *cmd;
+
+	array_foreach_modifiable(&clients, clientp) {
+		i_free((*clientp)->username);
+		i_free(*clientp);
+	}
+	array_free(&clients);
+	array_foreach_modifiable(&cmds, cmd) {
+		stats_dist_deinit(&cmd->latency);
+		i_free(cmd->args);
+	}
+	array_free(&cmds);
+	if (lmtp_client != NULL)
+		smtp_client_deinit(&lmtp_client);
+	if (message_buf != NULL)
+		buffer_free(&message_buf);
+}
+
+int main(int argc, char *argv[])
+{
+	const enum master_service_flags service_flags =
+		MASTER_SERVICE_FLAG_STANDALONE |
+		MASTER_SERVICE_FLAG_DONT_SEND_STATS;
+	struct smtp_client_settings lmtp_set;
+	const char *workload_path = NULL, *message_path = NULL;
+	unsigned int i, client_count = MAIL_BENCH_DEFAULT_CLIENTS;
+	unsigned int secs = MAIL_BENCH_DEFAULT_SECS;
+	struct timeout *to_stop;
+	int c;
+
+	i_zero(&imapc_set);
+	imapc_set.host = "127.0.0.1";
+	imapc_set.port = 143;
+	imapc_set.password = "pass";
+	imapc_set.temp_path_prefix = "/tmp/mail-bench";
+	imapc_set.rawlog_dir = "";
+	imapc_set.max_idle_time = IMAPC_DEFAULT_MAX_IDLE_TIME;
+	imapc_set.ssl_mode = IMAPC_CLIENT_SSL_MODE_NONE;
+	lmtp_host = "127.0.0.1";
+	lmtp_port = 24;
+	user_template = "user%n";
+
+	master_service = master_service_init("mail-bench", service_flags,
+					     &argc, &argv, "n:t:H:P:l:u:U:p:w:m:D");
+	while ((c = master_getopt(master_service)) > 0) {
+		switch (c) {
+		case 'n':
+			if (str_to_uint(optarg, &client_count) < 0 ||
+			    client_count == 0)
+				i_fatal("Invalid -n parameter: %s", optarg);
+			break;
+		case 't':
+			if (str_to_uint(optarg, &secs) < 0 || secs == 0)
+				i_fatal("Invalid -t parameter: %s", optarg);
+			break;
+		case 'H':
+			imapc_set.host = optarg;
+			lmtp_host = optarg;
+			break;
+		case 'P':
+			if (net_str2port(optarg, &imapc_set.port) < 0)
+				i_fatal("Invalid IMAP port: %s", optarg);
+			break;
+		case 'l':
+			/* port or UNIX socket path */
+			if (strchr(optarg, '/') != NULL)
+				lmtp_host = optarg;
+			else if (net_str2port(optarg, &lmtp_port) < 0)
+				i_fatal("Invalid LMTP port: %s", optarg);
+			break;
+		case 'u':
+			user_template = optarg;
+			break;
+		case 'U':
+			if (str_to_uint(optarg, &user_count) < 0 ||
+			    user_count == 0)
+				i_fatal("Invalid -U parameter: %s", optarg);
+			break;
+		case 'p':
+			imapc_set.password = optarg;
+			break;
+		case 'w':
+			workload_path = optarg;
+			break;
+		case 'm':
+			message_path = optarg;
+			break;
+		case 'D':
+			imapc_set.debug = TRUE;
+			break;
+		default:
+			i_fatal("Usage: mail-bench [-n <clients>] [-t <secs>] "
+				"[-H <host>] [-P <imap port>] "
+				"[-l <lmtp port or socket path>] "
+				"[-u <user template>] [-U <user count>] "
+				"[-p <password>] [-w <workload file>] "
+				"[-m <message file>] [-D]");
+		}
+	}
+	if (user_count == 0)
+		user_count = client_count;
+
+	master_service_init_log(master_service, "mail-bench: ");
+	master_service_init_finish(master_service);
+
+	i_array_init(&cmds, MAIL_BENCH_CMD_COUNT);
+	if (workload_path != NULL)
+		mail_bench_workload_read(workload_path);
+	else {
+		for (i = 0; mail_bench_default_workload[i] != NULL; i++)
+			mail_bench_workload_add(mail_bench_default_workload[i]);
+	}
+	if (total_weight == 0)
+		i_fatal("Workload has no commands");
+
+	if (message_path != NULL)
+		mail_bench_message_read(message_path);
+	else {
+		message_data = (const void *)mail_bench_default_message;
+		message_size = sizeof(mail_bench_default_message) - 1;
+	}
+
+	i_zero(&lmtp_set);
+	lmtp_set.my_hostname = "mail-bench";
+	lmtp_set.debug = imapc_set.debug;
+	lmtp_client = smtp_client_init(&lmtp_set);
+
+	i_array_init(&clients, client_count);
+	for (i = 0; i < client_count; i++) T_BEGIN {
+		mail_bench_client_start(i);
+	} T_END;
+
+	to_stop = timeout_add(secs * 1000, mail_bench_stop, NULL);
+	io_loop_run(current_ioloop);
+	timeout_remove(&to_stop);
+
+	mail_bench_print_results(secs);
+	mail_bench_deinit();
+	master_service_deinit(&master_service);
+	return 0;
+}